@@ -33,7 +33,10 @@
 #include <seastar/core/with_scheduling_group.hh>
 #include <seastar/core/metrics_api.hh>
 #include <seastar/core/io_intent.hh>
+#include <seastar/core/io_queue.hh>
 #include <seastar/util/later.hh>
+#include <seastar/util/file.hh>
+#include <seastar/core/gate.hh>
 #include <chrono>
 #include <vector>
 #include <boost/range/irange.hpp>
@@ -49,6 +52,7 @@
 #include <boost/range/adaptor/map.hpp>
 #include <boost/array.hpp>
 #include <iomanip>
+#include <sstream>
 #include <random>
 #include <yaml-cpp/yaml.h>
 
@@ -60,7 +64,7 @@ static auto random_seed = std::chrono::duration_cast<std::chrono::microseconds>(
 static std::default_random_engine random_generator(random_seed);
 
 class context;
-enum class request_type { seqread, seqwrite, randread, randwrite, append, cpu };
+enum class request_type { seqread, seqwrite, randread, randwrite, append, cpu, replay };
 
 namespace std {
 
@@ -173,6 +177,18 @@ struct shard_info {
     seastar::scheduling_group scheduling_group = seastar::default_scheduling_group();
 };
 
+// Where replay jobs get their requests from, see doc/io-tester.md
+struct replay_config {
+    enum class trace_format { seastar, blkparse, io_queue };
+    std::vector<std::string> traces;
+    trace_format format = trace_format::seastar;
+    // How much faster than recorded to replay
+    double speed = 1;
+    // The classes of the trace that get a priority class of their own,
+    // with their shares. The requests of the others are the job's.
+    std::unordered_map<std::string, unsigned> class_shares;
+};
+
 struct options {
     bool dsync = false;
     ::sleep_fn sleep_fn = timer_sleep<lowres_clock>;
@@ -192,6 +208,7 @@ struct job_config {
     // of the disk's cache
     uint64_t file_size;
     uint64_t offset_in_bdev;
+    ::replay_config replay;
     std::unique_ptr<class_data> gen_class_data();
 };
 
@@ -318,15 +335,20 @@ class class_data {
         });
     }
 
+protected:
+    virtual future<> do_issue_requests(std::chrono::steady_clock::time_point stop) {
+        if (rps() == 0) {
+            return issue_requests_in_parallel(stop, parallelism());
+        } else {
+            return issue_requests_at_rate(stop, rps(), parallelism());
+        }
+    }
+
 public:
     future<> issue_requests(std::chrono::steady_clock::time_point stop) {
         _start = std::chrono::steady_clock::now();
         return with_scheduling_group(_sg, [this, stop] {
-            if (rps() == 0) {
-                return issue_requests_in_parallel(stop, parallelism());
-            } else {
-                return issue_requests_at_rate(stop, rps(), parallelism());
-            }
+            return do_issue_requests(stop);
         }).then([this] {
             _total_duration = std::chrono::steady_clock::now() - _start;
         });
@@ -373,6 +395,7 @@ class class_data {
             { request_type::randwrite, "RAND WRITE" },
             { request_type::append , "APPEND" },
             { request_type::cpu , "CPU" },
+            { request_type::replay , "REPLAY" },
         }[_config.type];;
     }
 
@@ -632,6 +655,257 @@ class write_io_class_data : public io_class_data {
     }
 };
 
+// A request of a recorded trace
+struct trace_entry {
+    // Since the beginning of the trace
+    std::chrono::microseconds time;
+    bool write;
+    uint64_t offset;
+    uint64_t size;
+    std::string cls;
+};
+
+// One request per line, "<time in us> <shard> <R or W> <offset> <size> <class>",
+// '#' starting comments
+static std::optional<trace_entry> parse_seastar_trace_line(std::string_view line, unsigned& shard) {
+    std::istringstream in{std::string(line)};
+    trace_entry e;
+    uint64_t time;
+    std::string op;
+    if (!(in >> time)) {
+        return std::nullopt;
+    }
+    if (!(in >> shard >> op >> e.offset >> e.size >> e.cls) || (op != "R" && op != "W")) {
+        throw std::runtime_error("expected \"<time in us> <shard> <R or W> <offset> <size> <class>\"");
+    }
+    e.time = std::chrono::microseconds(time);
+    e.write = op == "W";
+    return e;
+}
+
+// The default output of blkparse, of which the requests queued (Q) are
+// taken, on the shard of the cpu they were queued on, of the class of the
+// process that queued them:
+//   <dev> <cpu> <seq> <time in s> <pid> <action> <rwbs> <sector> + <sectors> [<process>]
+static std::optional<trace_entry> parse_blkparse_line(std::string_view line, unsigned& shard) {
+    std::istringstream in{std::string(line)};
+    std::string dev, action, rwbs, plus, process;
+    uint64_t seq, pid, sectors;
+    double time;
+    trace_entry e;
+    if (!(in >> dev >> shard >> seq >> time >> pid >> action >> rwbs) || action != "Q"
+            || !(in >> e.offset >> plus >> sectors) || plus != "+") {
+        return std::nullopt;
+    }
+    bool read = rwbs.find('R') != std::string::npos;
+    e.write = rwbs.find('W') != std::string::npos;
+    if (read == e.write) {
+        // Discards and flushes
+        return std::nullopt;
+    }
+    in >> process;
+    if (process.size() > 2) {
+        e.cls = process.substr(1, process.size() - 2);
+    }
+    e.time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::duration<double>(time));
+    e.offset *= 512;
+    e.size = sectors * 512;
+    return e;
+}
+
+// The files written by io_queue::dump_trace(), one per shard. The requests
+// are queued at the time they were queued at, and of their class.
+static std::vector<std::pair<unsigned, trace_entry>> parse_io_queue_trace(const sstring& contents) {
+    io_queue::trace_file_header header;
+    if (contents.size() < sizeof(header)) {
+        throw std::runtime_error("truncated header");
+    }
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (!std::equal(std::begin(header.magic), std::end(header.magic), std::begin(io_queue::trace_file_header::file_magic))
+            || header.record_size != sizeof(io_queue::trace_record)) {
+        throw std::runtime_error("not an io_queue trace of this version");
+    }
+    size_t pos = sizeof(header);
+    auto need = [&] (size_t len) {
+        if (contents.size() - pos < len) {
+            throw std::runtime_error("truncated trace");
+        }
+    };
+    std::unordered_map<uint32_t, std::string> class_names;
+    for (uint32_t i = 0; i < header.nr_classes; i++) {
+        uint32_t id_and_length[2];
+        need(sizeof(id_and_length));
+        std::memcpy(id_and_length, contents.data() + pos, sizeof(id_and_length));
+        pos += sizeof(id_and_length);
+        need(id_and_length[1]);
+        class_names[id_and_length[0]] = std::string(contents.data() + pos, id_and_length[1]);
+        pos += id_and_length[1];
+    }
+    std::vector<std::pair<unsigned, trace_entry>> ret;
+    need(header.nr_records * sizeof(io_queue::trace_record));
+    for (uint64_t i = 0; i < header.nr_records; i++) {
+        io_queue::trace_record r;
+        std::memcpy(&r, contents.data() + pos, sizeof(r));
+        pos += sizeof(r);
+        trace_entry e;
+        // Made relative to the start of the trace by the caller
+        e.time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(r.queued));
+        e.write = r.write;
+        e.offset = r.pos;
+        e.size = r.length;
+        e.cls = class_names[r.class_id];
+        ret.emplace_back(header.shard, std::move(e));
+    }
+    return ret;
+}
+
+// Replays the requests of a trace on their shard, at the time they were
+// made at relative to the start of the trace, till its end or the end of
+// the test. Requests are issued at their time even if the ones before them
+// are not done, and their latency is counted from then. Offsets are wrapped
+// to the size of the job's file.
+class replay_io_class_data : public io_class_data {
+    std::vector<trace_entry> _trace;
+    std::unordered_map<std::string, io_priority_class> _classes;
+    std::chrono::microseconds _max_issue_delay{0};
+    uint64_t _late = 0;
+
+    void parse_text_trace(const std::string& path, const sstring& contents) {
+        auto& cfg = _config.replay;
+        std::string_view rest(contents);
+        unsigned line_nr = 0;
+        while (!rest.empty()) {
+            auto eol = rest.find('\n');
+            auto line = rest.substr(0, eol);
+            rest.remove_prefix(eol == std::string_view::npos ? rest.size() : eol + 1);
+            line_nr++;
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            unsigned shard;
+            std::optional<trace_entry> e;
+            try {
+                e = cfg.format == replay_config::trace_format::seastar ? parse_seastar_trace_line(line, shard) : parse_blkparse_line(line, shard);
+            } catch (const std::runtime_error& ex) {
+                throw std::runtime_error(format("{}:{}: {}", path, line_nr, ex.what()));
+            }
+            if (e && shard % smp::count == this_shard_id()) {
+                _trace.push_back(std::move(*e));
+            }
+        }
+    }
+
+    future<> load_trace() {
+        auto& cfg = _config.replay;
+        // The start of io_queue traces, the earliest request of all shards
+        auto start = std::make_unique<std::chrono::microseconds>(std::chrono::microseconds::max());
+        return do_for_each(cfg.traces, [this, &cfg, start = start.get()] (const std::string& path) {
+            return util::read_entire_file_contiguous(path).then([this, &cfg, &path, start] (sstring contents) {
+                if (cfg.format != replay_config::trace_format::io_queue) {
+                    parse_text_trace(path, contents);
+                    return;
+                }
+                std::vector<std::pair<unsigned, trace_entry>> entries;
+                try {
+                    entries = parse_io_queue_trace(contents);
+                } catch (const std::runtime_error& ex) {
+                    throw std::runtime_error(format("{}: {}", path, ex.what()));
+                }
+                for (auto& [shard, e] : entries) {
+                    *start = std::min(*start, e.time);
+                    if (shard % smp::count == this_shard_id()) {
+                        _trace.push_back(std::move(e));
+                    }
+                }
+            });
+        }).then([this, &cfg, start = std::move(start)] {
+            for (auto& e : _trace) {
+                if (cfg.format == replay_config::trace_format::io_queue) {
+                    e.time -= *start;
+                }
+                e.time = std::chrono::duration_cast<std::chrono::microseconds>(e.time / cfg.speed);
+            }
+            // blkparse sorts by time within a cpu only, and io_queue by completion
+            std::stable_sort(_trace.begin(), _trace.end(), [] (const trace_entry& a, const trace_entry& b) {
+                return a.time < b.time;
+            });
+            for (auto& [cls, shares] : cfg.class_shares) {
+                _classes.emplace(cls, io_priority_class::register_one(format("{}.{}", name(), cls), shares));
+            }
+        });
+    }
+
+    future<size_t> replay(const trace_entry& e) {
+        auto& pc = _classes.count(e.cls) ? _classes.at(e.cls) : _iop;
+        uint64_t alignment = e.write ? _file.disk_write_dma_alignment() : _file.disk_read_dma_alignment();
+        auto size = align_up(std::max<uint64_t>(e.size, alignment), alignment);
+        auto pos = align_down(e.offset % std::max(_config.file_size, size), alignment);
+        if (pos + size > _config.file_size) {
+            pos = 0;
+        }
+        auto bufptr = allocate_aligned_buffer<char>(size, _file.memory_dma_alignment());
+        auto buf = bufptr.get();
+        auto f = e.write ? _file.dma_write(pos + _offset, buf, size, pc) : _file.dma_read(pos + _offset, buf, size, pc);
+        return on_io_completed(std::move(f)).finally([bufptr = std::move(bufptr)] {});
+    }
+
+protected:
+    future<> do_issue_requests(std::chrono::steady_clock::time_point stop) override {
+        return do_with(gate(), size_t(0), [this, stop] (gate& g, size_t& next) {
+            return do_until([this, stop, &next] {
+                return next == _trace.size() || std::chrono::steady_clock::now() > stop;
+            }, [this, stop, &g, &next] {
+                auto& e = _trace[next];
+                auto at = _start + e.time;
+                auto now = std::chrono::steady_clock::now();
+                if (at > now) {
+                    return _sleep_fn(at, now);
+                }
+                next++;
+                auto delay = std::chrono::duration_cast<std::chrono::microseconds>(now - at);
+                _max_issue_delay = std::max(_max_issue_delay, delay);
+                _late += delay > 1ms;
+                (void)with_gate(g, [this, &e, stop, at] {
+                    return replay(e).then([this, stop, at] (size_t size) {
+                        auto now = std::chrono::steady_clock::now();
+                        if (now < stop) {
+                            add_result(size, std::chrono::duration_cast<std::chrono::microseconds>(now - at));
+                        }
+                    });
+                }).handle_exception([] (std::exception_ptr ep) {
+                    fmt::print("replayed request failed: {}\n", ep);
+                });
+                return make_ready_future<>();
+            }).then([&g] {
+                return g.close();
+            });
+        });
+    }
+
+public:
+    replay_io_class_data(job_config cfg) : io_class_data(std::move(cfg)) {}
+
+    future<> do_start(sstring path, directory_entry_type type) override {
+        return load_trace().then([this, path, type] {
+            return io_class_data::do_start(path, type);
+        });
+    }
+
+    future<size_t> issue_request(char *buf, io_intent* intent) override {
+        // Requests are issued by do_issue_requests()
+        return make_exception_future<size_t>(std::logic_error("replay jobs issue the requests of their trace"));
+    }
+
+    virtual void emit_results(YAML::Emitter& out) override {
+        io_class_data::emit_results(out);
+        out << YAML::Key << "replay" << YAML::BeginMap;
+        out << YAML::Key << "trace_requests" << YAML::Value << _trace.size();
+        out << YAML::Key << "late_requests" << YAML::Value << _late << YAML::Comment("issued over 1ms late");
+        out << YAML::Key << "max_issue_delay" << YAML::Value << _max_issue_delay.count() << YAML::Comment("usec");
+        out << YAML::EndMap;
+    }
+};
+
 class cpu_class_data : public class_data {
 public:
     cpu_class_data(job_config cfg) : class_data(std::move(cfg)) {}
@@ -659,6 +933,8 @@ class cpu_class_data : public class_data {
 std::unique_ptr<class_data> job_config::gen_class_data() {
     if (type == request_type::cpu) {
         return std::make_unique<cpu_class_data>(*this);
+    } else if (type == request_type::replay) {
+        return std::make_unique<replay_io_class_data>(*this);
     } else if ((type == request_type::seqread) || (type == request_type::randread)) {
         return std::make_unique<read_io_class_data>(*this);
     } else {
@@ -740,6 +1016,7 @@ struct convert<request_type> {
             { "randwrite", request_type::randwrite },
             { "append", request_type::append},
             { "cpu", request_type::cpu},
+            { "replay", request_type::replay},
         };
         auto reqstr = node.as<std::string>();
         if (!mappings.count(reqstr)) {
@@ -811,6 +1088,38 @@ struct convert<options> {
     }
 };
 
+template<>
+struct convert<replay_config> {
+    static bool decode(const Node& node, replay_config& rc) {
+        if (node["trace"].IsSequence()) {
+            rc.traces = node["trace"].as<std::vector<std::string>>();
+        } else {
+            rc.traces.push_back(node["trace"].as<std::string>());
+        }
+        if (node["format"]) {
+            auto fmt = node["format"].as<std::string>();
+            if (fmt == "seastar") {
+                rc.format = replay_config::trace_format::seastar;
+            } else if (fmt == "blkparse") {
+                rc.format = replay_config::trace_format::blkparse;
+            } else if (fmt == "io_queue") {
+                rc.format = replay_config::trace_format::io_queue;
+            } else {
+                throw std::runtime_error(format("Unknown trace format {}", fmt));
+            }
+        }
+        if (node["speed"]) {
+            rc.speed = node["speed"].as<double>();
+        }
+        if (node["classes"]) {
+            for (auto& [cls, shares] : node["classes"].as<std::map<std::string, unsigned>>()) {
+                rc.class_shares.emplace(cls, shares);
+            }
+        }
+        return true;
+    }
+};
+
 template<>
 struct convert<job_config> {
     static bool decode(const Node& node, job_config& cl) {
@@ -831,6 +1140,9 @@ struct convert<job_config> {
         if (node["options"]) {
             cl.options = node["options"].as<options>();
         }
+        if (cl.type == request_type::replay) {
+            cl.replay = node["replay"].as<replay_config>();
+        }
         return true;
     }
 };
@@ -918,6 +1230,10 @@ int main(int ac, char** av) {
         ("duration", bpo::value<unsigned>()->default_value(10), "for how long (in seconds) to run the test")
         ("conf", bpo::value<sstring>()->default_value("./conf.yaml"), "YAML file containing benchmark specification")
         ("keep-files", bpo::value<bool>()->default_value(false), "keep test files, next run may re-use them")
+        ("trace-io", bpo::value<sstring>(), "record the requests of the storage's I/O queue during the evaluation, "
+            "and write them to <path>.<shard>, for replay jobs of the io_queue format")
+        ("trace-io-records", bpo::value<size_t>()->default_value(1 << 20), "the number of requests --trace-io keeps on each "
+            "shard, the latest ones")
     ;
 
     distributed<context> ctx;
@@ -967,11 +1283,27 @@ int main(int ac, char** av) {
             ctx.invoke_on_all([] (auto& c) {
                 return c.start();
             }).get();
+            std::optional<sstring> trace_io;
+            dev_t dev = file_stat(storage).get0().device_id;
+            if (opts.count("trace-io")) {
+                trace_io = opts["trace-io"].as<sstring>();
+                smp::invoke_on_all([dev, records = opts["trace-io-records"].as<size_t>()] {
+                    engine().get_io_queue(dev).start_tracing(records);
+                }).get();
+            }
             std::cout << "Starting evaluation..." << std::endl;
             ctx.invoke_on_all([] (auto& c) {
                 return c.issue_requests();
             }).get();
             show_results(ctx);
+            if (trace_io) {
+                smp::invoke_on_all([dev, &trace_io] {
+                    auto& ioq = engine().get_io_queue(dev);
+                    return ioq.dump_trace(format("{}.{}", *trace_io, this_shard_id())).finally([&ioq] {
+                        ioq.stop_tracing();
+                    });
+                }).get();
+            }
             ctx.stop().get0();
         }).or_terminate();
     });
@@ -26,6 +26,8 @@
 #include <random>
 #include <memory>
 #include <vector>
+#include <set>
+#include <atomic>
 #include <cmath>
 #include <sys/vfs.h>
 #include <sys/sysmacros.h>
@@ -51,6 +53,7 @@
 #include <seastar/util/log.hh>
 #include <seastar/util/std-compat.hh>
 #include <seastar/util/read_first_line.hh>
+#include <seastar/util/conversions.hh>
 
 using namespace seastar;
 using namespace std::chrono_literals;
@@ -103,6 +106,8 @@ struct evaluation_directory {
     uint64_t _available_space;
     uint64_t _min_data_transfer_size = 512;
     unsigned _disks_per_array = 0;
+    // The leaf block devices the directory is on
+    std::set<std::string> _devices;
 
     void scan_device(unsigned dev_maj, unsigned dev_min) {
         scan_device(fmt::format("{}:{}", dev_maj, dev_min));
@@ -138,6 +143,7 @@ struct evaluation_directory {
                 _min_data_transfer_size = std::max(_min_data_transfer_size, disk_min_io_size);
                 _max_iodepth += read_first_line_as<uint64_t>(queue_dir / "nr_requests");
                 _disks_per_array++;
+                _devices.insert(sys_file.string());
             }
         } catch (std::system_error& se) {
             iotune_logger.error("Error while parsing sysfs. Will continue with guessed values: {}", se.what());
@@ -171,6 +177,10 @@ struct evaluation_directory {
         return _min_data_transfer_size;
     }
 
+    const std::set<std::string>& devices() const {
+        return _devices;
+    }
+
     future<> discover_directory() {
         return seastar::async([this] {
             auto f = open_directory(_name).get0();
@@ -223,6 +233,51 @@ static row_stats get_row_stats_for(const std::vector<T>& v) {
     return row_stats{ v.size(), avg, stdev };
 }
 
+// Lets the workers of a measurement, possibly on several shards, stop
+// together once each has a precise enough estimate of its rate: when the
+// 95% confidence interval of the mean of its per-period samples is within
+// the target fraction of the mean.
+class convergence {
+    float _target;
+    unsigned _participants;
+    // Workers converge only once they have reached this offset, so that
+    // the file the later phases read is written far enough
+    uint64_t _min_offset;
+    std::atomic<unsigned> _converged = { 0 };
+public:
+    static constexpr size_t min_samples = 5;
+
+    convergence(float target, unsigned participants, uint64_t min_offset = 0)
+        : _target(target)
+        , _participants(participants)
+        , _min_offset(min_offset)
+    {}
+
+    convergence(convergence&& o) noexcept
+        : _target(o._target)
+        , _participants(o._participants)
+        , _min_offset(o._min_offset)
+        , _converged(o._converged.load(std::memory_order_relaxed))
+    {}
+
+    uint64_t min_offset() const noexcept {
+        return _min_offset;
+    }
+
+    bool converged(const row_stats& stats) const noexcept {
+        return stats.points >= min_samples && stats.average > 0 &&
+            1.96 * stats.stdev / std::sqrt(stats.points) <= _target * stats.average;
+    }
+
+    void arrive() noexcept {
+        _converged.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool done() const noexcept {
+        return _converged.load(std::memory_order_relaxed) >= _participants;
+    }
+};
+
 class invalid_position : public std::exception {
 public:
     virtual const char* what() const noexcept {
@@ -313,6 +368,20 @@ class read_request_issuer : public request_issuer {
     }
 };
 
+// Reads with probability read_ratio, writes otherwise
+class mixed_request_issuer : public request_issuer {
+    file _file;
+    std::bernoulli_distribution _read_distribution;
+public:
+    mixed_request_issuer(file f, float read_ratio) : _file(f), _read_distribution(read_ratio) {}
+    future<size_t> issue_request(uint64_t pos, char* buf, uint64_t size) override {
+        if (_read_distribution(random_generator)) {
+            return _file.dma_read(pos, buf, size);
+        }
+        return _file.dma_write(pos, buf, size);
+    }
+};
+
 class io_worker {
     class requests_rate_meter {
         std::vector<unsigned>& _rates;
@@ -323,12 +392,13 @@ class io_worker {
         static constexpr auto period = 1s;
 
     public:
-        requests_rate_meter(std::chrono::duration<double> duration, std::vector<unsigned>& rates, const unsigned& requests)
+        requests_rate_meter(std::chrono::duration<double> duration, std::vector<unsigned>& rates, const unsigned& requests, io_worker& worker)
             : _rates(rates)
             , _requests(requests)
-            , _tick([this] {
+            , _tick([this, &worker] {
                 _rates.push_back(_requests - _prev_requests);
                 _prev_requests = _requests;
+                worker.maybe_converge();
             })
         {
             _rates.reserve(256); // ~2 minutes
@@ -356,6 +426,10 @@ class io_worker {
     // track separately because in the sequential case we may exhaust the file before _duration
     std::chrono::time_point<iotune_clock, std::chrono::duration<double>> _last_time_seen;
 
+    convergence* _convergence;
+    bool _converged = false;
+    const std::vector<unsigned>& _rates;
+    size_t _first_rate;
     requests_rate_meter _rr_meter;
     std::unique_ptr<position_generator> _pos_impl;
     std::unique_ptr<request_issuer> _req_impl;
@@ -365,16 +439,30 @@ class io_worker {
     }
 
     bool should_stop() const {
-        return iotune_clock::now() >= _end_load;
+        return iotune_clock::now() >= _end_load || (_convergence && _convergence->done());
+    }
+
+    void maybe_converge() {
+        if (!_convergence || _converged || _max_offset < _convergence->min_offset()) {
+            return;
+        }
+        std::vector<unsigned> rates(_rates.begin() + _first_rate, _rates.end());
+        if (_convergence->converged(get_row_stats_for<unsigned>(rates))) {
+            _converged = true;
+            _convergence->arrive();
+        }
     }
 
-    io_worker(size_t buffer_size, std::chrono::duration<double> duration, std::unique_ptr<request_issuer> reqs, std::unique_ptr<position_generator> pos, std::vector<unsigned>& rates)
+    io_worker(size_t buffer_size, std::chrono::duration<double> duration, std::unique_ptr<request_issuer> reqs, std::unique_ptr<position_generator> pos, std::vector<unsigned>& rates, convergence* conv)
         : _buffer_size(buffer_size)
         , _start_measuring(iotune_clock::now() + std::chrono::duration<double>(10ms))
         , _end_measuring(_start_measuring + duration)
         , _end_load(_end_measuring + 10ms)
         , _last_time_seen(_start_measuring)
-        , _rr_meter(duration, rates, _requests)
+        , _convergence(conv)
+        , _rates(rates)
+        , _first_rate(rates.size())
+        , _rr_meter(duration, rates, _requests, *this)
         , _pos_impl(std::move(pos))
         , _req_impl(std::move(reqs))
     {}
@@ -478,15 +566,19 @@ class test_file {
         });
     }
 
-    future<io_rates> read_workload(size_t buffer_size, pattern access_pattern, unsigned max_os_concurrency, std::chrono::duration<double> duration, std::vector<unsigned>& rates) {
+    uint64_t file_size() const noexcept {
+        return _file_size;
+    }
+
+    future<io_rates> read_workload(size_t buffer_size, pattern access_pattern, unsigned max_os_concurrency, std::chrono::duration<double> duration, std::vector<unsigned>& rates, convergence* conv) {
         buffer_size = std::max(buffer_size, _file.disk_read_dma_alignment());
-        auto worker = std::make_unique<io_worker>(buffer_size, duration, std::make_unique<read_request_issuer>(_file), get_position_generator(buffer_size, access_pattern), rates);
+        auto worker = std::make_unique<io_worker>(buffer_size, duration, std::make_unique<read_request_issuer>(_file), get_position_generator(buffer_size, access_pattern), rates, conv);
         return do_workload(std::move(worker), max_os_concurrency);
     }
 
-    future<io_rates> write_workload(size_t buffer_size, pattern access_pattern, unsigned max_os_concurrency, std::chrono::duration<double> duration, std::vector<unsigned>& rates) {
+    future<io_rates> write_workload(size_t buffer_size, pattern access_pattern, unsigned max_os_concurrency, std::chrono::duration<double> duration, std::vector<unsigned>& rates, convergence* conv) {
         buffer_size = std::max(buffer_size, _file.disk_write_dma_alignment());
-        auto worker = std::make_unique<io_worker>(buffer_size, duration, std::make_unique<write_request_issuer>(_file), get_position_generator(buffer_size, access_pattern), rates);
+        auto worker = std::make_unique<io_worker>(buffer_size, duration, std::make_unique<write_request_issuer>(_file), get_position_generator(buffer_size, access_pattern), rates, conv);
         bool update_file_size = worker->is_sequential();
         return do_workload(std::move(worker), max_os_concurrency, update_file_size).then([this] (io_rates r) {
             return _file.flush().then([r = std::move(r)] () mutable {
@@ -495,6 +587,16 @@ class test_file {
         });
     }
 
+    future<io_rates> mixed_workload(size_t buffer_size, float read_ratio, unsigned max_os_concurrency, std::chrono::duration<double> duration, std::vector<unsigned>& rates, convergence* conv) {
+        buffer_size = std::max({buffer_size, _file.disk_read_dma_alignment(), _file.disk_write_dma_alignment()});
+        auto worker = std::make_unique<io_worker>(buffer_size, duration, std::make_unique<mixed_request_issuer>(_file, read_ratio), get_position_generator(buffer_size, pattern::random), rates, conv);
+        return do_workload(std::move(worker), max_os_concurrency).then([this] (io_rates r) {
+            return _file.flush().then([r = std::move(r)] () mutable {
+                return make_ready_future<io_rates>(std::move(r));
+            });
+        });
+    }
+
     future<> stop() {
         return _file.close();
     }
@@ -502,6 +604,15 @@ class test_file {
 
 class iotune_multi_shard_context {
     ::evaluation_directory _test_directory;
+    // Zero to always measure for the given duration
+    float _convergence_target;
+    // The sequential write fills the file that the later phases read, so
+    // it doesn't stop earlier than this for the reads to spread over the disk
+    static constexpr uint64_t min_written_size = 1ull << 30;
+
+    convergence* converging(convergence& conv) noexcept {
+        return _convergence_target > 0 ? &conv : nullptr;
+    }
 
     unsigned per_shard_io_depth() const {
         auto iodepth = _test_directory.max_iodepth() / smp::count;
@@ -551,33 +662,49 @@ class iotune_multi_shard_context {
 
     future<io_rates> write_sequential_data(unsigned shard, size_t buffer_size, std::chrono::duration<double> duration) {
         return _iotune_test_file.invoke_on(shard, [this, buffer_size, duration] (test_file& tf) {
-            return tf.write_workload(buffer_size, test_file::pattern::sequential, 4 * _test_directory.disks_per_array(), duration, serial_rates);
+            return do_with(convergence(_convergence_target, 1, std::min(tf.file_size(), min_written_size)), [this, &tf, buffer_size, duration] (convergence& conv) {
+                return tf.write_workload(buffer_size, test_file::pattern::sequential, 4 * _test_directory.disks_per_array(), duration, serial_rates, converging(conv));
+            });
         });
     }
 
     future<io_rates> read_sequential_data(unsigned shard, size_t buffer_size, std::chrono::duration<double> duration) {
         return _iotune_test_file.invoke_on(shard, [this, buffer_size, duration] (test_file& tf) {
-            return tf.read_workload(buffer_size, test_file::pattern::sequential, 4 * _test_directory.disks_per_array(), duration, serial_rates);
+            return do_with(convergence(_convergence_target, 1), [this, &tf, buffer_size, duration] (convergence& conv) {
+                return tf.read_workload(buffer_size, test_file::pattern::sequential, 4 * _test_directory.disks_per_array(), duration, serial_rates, converging(conv));
+            });
         });
     }
 
     future<io_rates> write_random_data(size_t buffer_size, std::chrono::duration<double> duration) {
-        return _iotune_test_file.map_reduce0([buffer_size, this, duration] (test_file& tf) {
-            return tf.write_workload(buffer_size, test_file::pattern::random, per_shard_io_depth(), duration, sharded_rates.local());
-        }, io_rates(), std::plus<io_rates>());
+        return do_with(convergence(_convergence_target, smp::count), [this, buffer_size, duration] (convergence& conv) {
+            return _iotune_test_file.map_reduce0([buffer_size, this, duration, &conv] (test_file& tf) {
+                return tf.write_workload(buffer_size, test_file::pattern::random, per_shard_io_depth(), duration, sharded_rates.local(), converging(conv));
+            }, io_rates(), std::plus<io_rates>());
+        });
     }
 
     future<io_rates> read_random_data(size_t buffer_size, std::chrono::duration<double> duration) {
-        return _iotune_test_file.map_reduce0([buffer_size, this, duration] (test_file& tf) {
-            return tf.read_workload(buffer_size, test_file::pattern::random, per_shard_io_depth(), duration, sharded_rates.local());
-        }, io_rates(), std::plus<io_rates>());
+        return do_with(convergence(_convergence_target, smp::count), [this, buffer_size, duration] (convergence& conv) {
+            return _iotune_test_file.map_reduce0([buffer_size, this, duration, &conv] (test_file& tf) {
+                return tf.read_workload(buffer_size, test_file::pattern::random, per_shard_io_depth(), duration, sharded_rates.local(), converging(conv));
+            }, io_rates(), std::plus<io_rates>());
+        });
+    }
+
+    future<io_rates> mixed_random_data(size_t buffer_size, float read_ratio, std::chrono::duration<double> duration) {
+        return do_with(convergence(_convergence_target, smp::count), [this, buffer_size, read_ratio, duration] (convergence& conv) {
+            return _iotune_test_file.map_reduce0([buffer_size, read_ratio, this, duration, &conv] (test_file& tf) {
+                return tf.mixed_workload(buffer_size, read_ratio, per_shard_io_depth(), duration, sharded_rates.local(), converging(conv));
+            }, io_rates(), std::plus<io_rates>());
+        });
     }
 
 private:
     template <typename Fn>
     future<uint64_t> saturate(float rate_threshold, size_t buffer_size, std::chrono::duration<double> duration, Fn&& workload) {
         return _iotune_test_file.invoke_on(0, [this, rate_threshold, buffer_size, duration, workload] (test_file& tf) {
-            return (tf.*workload)(buffer_size, test_file::pattern::sequential, 1, duration, serial_rates).then([this, rate_threshold, buffer_size, duration, workload] (io_rates rates) {
+            return (tf.*workload)(buffer_size, test_file::pattern::sequential, 1, duration, serial_rates, nullptr).then([this, rate_threshold, buffer_size, duration, workload] (io_rates rates) {
                 serial_rates.clear();
                 if (rates.bytes_per_sec < rate_threshold) {
                     // The throughput with the given buffer-size is already "small enough", so
@@ -599,11 +726,19 @@ class iotune_multi_shard_context {
         return saturate(rate_threshold, buffer_size, duration, &test_file::read_workload);
     }
 
-    iotune_multi_shard_context(::evaluation_directory dir)
+    iotune_multi_shard_context(::evaluation_directory dir, float convergence_target)
         : _test_directory(dir)
+        , _convergence_target(convergence_target)
     {}
 };
 
+// The capacity of a random workload mixing reads and writes of one size
+struct mixed_point {
+    float read_ratio;
+    uint64_t request_size;
+    uint64_t iops;
+};
+
 struct disk_descriptor {
     std::string mountpoint;
     uint64_t read_iops;
@@ -612,6 +747,7 @@ struct disk_descriptor {
     uint64_t write_bw;
     std::optional<uint64_t> read_sat_len;
     std::optional<uint64_t> write_sat_len;
+    std::vector<mixed_point> mixed;
 };
 
 void string_to_file(sstring conf_file, sstring buf) {
@@ -650,6 +786,18 @@ void write_property_file(sstring conf_file, std::vector<disk_descriptor> disk_de
         if (desc.write_sat_len) {
             out << YAML::Key << "write_saturation_length" << YAML::Value << *desc.write_sat_len;
         }
+        if (!desc.mixed.empty()) {
+            out << YAML::Key << "mixed";
+            out << YAML::BeginSeq;
+            for (auto& m : desc.mixed) {
+                out << YAML::Flow << YAML::BeginMap;
+                out << YAML::Key << "read_ratio" << YAML::Value << m.read_ratio;
+                out << YAML::Key << "request_size" << YAML::Value << m.request_size;
+                out << YAML::Key << "iops" << YAML::Value << m.iops;
+                out << YAML::EndMap;
+            }
+            out << YAML::EndSeq;
+        }
         out << YAML::EndMap;
     }
     out << YAML::EndSeq;
@@ -679,6 +827,140 @@ fs::path mountpoint_of(sstring filename) {
     return mnt_candidate;
 }
 
+struct evaluation_params {
+    std::chrono::duration<double> duration;
+    unsigned accuracy;
+    bool read_saturation;
+    bool write_saturation;
+    bool mixed;
+    std::vector<float> mixed_read_ratios;
+    std::vector<uint64_t> mixed_request_sizes;
+    float convergence;
+};
+
+// Prints the measurements of one disk. When several disks are evaluated at
+// once, every line is printed whole and names the disk.
+class progress {
+    sstring _prefix;
+    sstring _what;
+public:
+    explicit progress(sstring prefix) : _prefix(std::move(prefix)) {}
+
+    void start(sstring what) {
+        _what = std::move(what);
+        if (_prefix.empty()) {
+            fmt::print("{}: ", _what);
+            std::cout.flush();
+        }
+    }
+
+    void done(const std::string& result) {
+        if (_prefix.empty()) {
+            fmt::print("{}\n", result);
+        } else {
+            fmt::print("{}: {}: {}\n", _prefix, _what, result);
+        }
+    }
+};
+
+disk_descriptor evaluate_disk(sstring mountpoint, const ::evaluation_directory& test_directory, const evaluation_params& params, progress p) {
+    auto duration = params.duration;
+    ::iotune_multi_shard_context iotune_tests(test_directory, params.convergence);
+    iotune_tests.start().get();
+    auto stop = defer([&iotune_tests] () noexcept {
+        try {
+            iotune_tests.stop().get();
+        } catch (...) {
+            fmt::print("Error occurred during iotune context shutdown: {}", std::current_exception());
+            abort();
+        }
+    });
+
+    row_stats rates;
+    auto accuracy_msg = [accuracy = params.accuracy, &rates] {
+        auto stdev = rates.stdev_percents() * 100.0;
+        return (accuracy == 0 || stdev > accuracy) ? fmt::format(" (deviation {}%)", int(round(stdev))) : std::string("");
+    };
+
+    iotune_tests.create_data_file().get();
+
+    p.start("Measuring sequential write bandwidth");
+    io_rates write_bw;
+    size_t sequential_buffer_size = 1 << 20;
+    for (unsigned shard = 0; shard < smp::count; ++shard) {
+        write_bw += iotune_tests.write_sequential_data(shard, sequential_buffer_size, duration * 0.70 / smp::count).get0();
+    }
+    write_bw.bytes_per_sec /= smp::count;
+    rates = iotune_tests.get_serial_rates().get0();
+    p.done(fmt::format("{} MB/s{}", uint64_t(write_bw.bytes_per_sec / (1024 * 1024)), accuracy_msg()));
+
+    std::optional<uint64_t> write_sat;
+
+    if (params.write_saturation) {
+        p.start("Measuring write saturation length");
+        write_sat = iotune_tests.saturate_write(write_bw.bytes_per_sec * (1.0 - rates.stdev_percents()), sequential_buffer_size/2, duration * 0.70).get0();
+        p.done(fmt::format("{}", *write_sat));
+    }
+
+    p.start("Measuring sequential read bandwidth");
+    auto read_bw = iotune_tests.read_sequential_data(0, sequential_buffer_size, duration * 0.1).get0();
+    rates = iotune_tests.get_serial_rates().get0();
+    p.done(fmt::format("{} MB/s{}", uint64_t(read_bw.bytes_per_sec / (1024 * 1024)), accuracy_msg()));
+
+    std::optional<uint64_t> read_sat;
+
+    if (params.read_saturation) {
+        p.start("Measuring read saturation length");
+        read_sat = iotune_tests.saturate_read(read_bw.bytes_per_sec * (1.0 - rates.stdev_percents()), sequential_buffer_size/2, duration * 0.1).get0();
+        p.done(fmt::format("{}", *read_sat));
+    }
+
+    p.start("Measuring random write IOPS");
+    auto write_iops = iotune_tests.write_random_data(test_directory.minimum_io_size(), duration * 0.1).get0();
+    rates = iotune_tests.get_sharded_worst_rates().get0();
+    p.done(fmt::format("{} IOPS{}", uint64_t(write_iops.iops), accuracy_msg()));
+
+    p.start("Measuring random read IOPS");
+    auto read_iops = iotune_tests.read_random_data(test_directory.minimum_io_size(), duration * 0.1).get0();
+    rates = iotune_tests.get_sharded_worst_rates().get0();
+    p.done(fmt::format("{} IOPS{}", uint64_t(read_iops.iops), accuracy_msg()));
+
+    // The peaks above are measured one at a time, but devices usually
+    // do worse when reads and writes mix than the sum of the peaks
+    // predicts, so measure that, too
+    std::vector<mixed_point> mixed_points;
+    if (params.mixed) {
+        auto mixed_duration = duration * 0.05;
+        for (auto size : params.mixed_request_sizes) {
+            size = std::max<uint64_t>(size, test_directory.minimum_io_size());
+            for (auto ratio : params.mixed_read_ratios) {
+                p.start(fmt::format("Measuring mixed IOPS, {}% reads of {} bytes", int(round(ratio * 100)), size));
+                auto mixed_iops = iotune_tests.mixed_random_data(size, ratio, mixed_duration).get0();
+                rates = iotune_tests.get_sharded_worst_rates().get0();
+                p.done(fmt::format("{} IOPS{}", uint64_t(mixed_iops.iops), accuracy_msg()));
+                mixed_points.push_back(mixed_point{ratio, size, uint64_t(mixed_iops.iops)});
+            }
+        }
+    }
+
+    struct disk_descriptor desc;
+    desc.mountpoint = mountpoint;
+    desc.read_iops = read_iops.iops;
+    desc.read_bw = read_bw.bytes_per_sec;
+    desc.read_sat_len = read_sat;
+    desc.write_iops = write_iops.iops;
+    desc.write_bw = write_bw.bytes_per_sec;
+    desc.write_sat_len = write_sat;
+    desc.mixed = std::move(mixed_points);
+    return desc;
+}
+
+struct disk_evaluation {
+    sstring mountpoint;
+    ::evaluation_directory directory;
+    disk_descriptor result;
+};
+
 int main(int ac, char** av) {
     namespace bpo = boost::program_options;
     bool fs_check = false;
@@ -697,6 +979,11 @@ int main(int ac, char** av) {
         ("fs-check", bpo::bool_switch(&fs_check), "perform FS check only")
         ("accuracy", bpo::value<unsigned>()->default_value(3), "acceptable deviation of measurements (percents)")
         ("saturation", bpo::value<sstring>()->default_value(""), "measure saturation lengths (read | write | both) (this is very slow!)")
+        ("convergence", bpo::value<float>()->default_value(1), "stop each measurement once the 95% confidence interval of the measured rate is within this many percents of it, "
+                "with --duration the longest it may take (0 to always measure for --duration)")
+        ("mixed", bpo::bool_switch(), "measure the capacity of random workloads mixing reads and writes, for each of --mixed-read-ratios and --mixed-request-sizes")
+        ("mixed-read-ratios", bpo::value<std::vector<float>>()->multitoken()->default_value({0.25, 0.5, 0.75}, "0.25 0.5 0.75"), "fractions of reads of the mixed workloads")
+        ("mixed-request-sizes", bpo::value<std::vector<sstring>>()->multitoken()->default_value({"4k", "64k", "512k"}, "4k 64k 512k"), "request sizes of the mixed workloads")
     ;
 
     return app.run(ac, av, [&] {
@@ -707,6 +994,18 @@ int main(int ac, char** av) {
             auto duration = std::chrono::duration<double>(configuration["duration"].as<unsigned>() * 1s);
             auto accuracy = configuration["accuracy"].as<unsigned>();
             auto saturation = configuration["saturation"].as<sstring>();
+            auto mixed = configuration["mixed"].as<bool>();
+            auto mixed_read_ratios = configuration["mixed-read-ratios"].as<std::vector<float>>();
+            std::vector<uint64_t> mixed_request_sizes;
+            for (auto& sz : configuration["mixed-request-sizes"].as<std::vector<sstring>>()) {
+                mixed_request_sizes.push_back(parse_memory_size(sz));
+            }
+            for (auto r : mixed_read_ratios) {
+                if (r <= 0.0 || r >= 1.0) {
+                    fmt::print("Bad --mixed-read-ratios value {}, must be between 0 and 1\n", r);
+                    return 1;
+                }
+            }
 
             bool read_saturation, write_saturation;
             if (saturation == "") {
@@ -726,7 +1025,17 @@ int main(int ac, char** av) {
                 return 1;
             }
 
-            std::vector<disk_descriptor> disk_descriptors;
+            evaluation_params params;
+            params.duration = duration;
+            params.accuracy = accuracy;
+            params.read_saturation = read_saturation;
+            params.write_saturation = write_saturation;
+            params.mixed = mixed;
+            params.mixed_read_ratios = std::move(mixed_read_ratios);
+            params.mixed_request_sizes = std::move(mixed_request_sizes);
+            params.convergence = configuration["convergence"].as<float>() / 100.0;
+
+            std::vector<disk_evaluation> evaluations;
             std::unordered_map<sstring, sstring> mountpoint_map;
             // We want to evaluate once per mountpoint, but we still want to write in one of the
             // directories that we were provided - we may not have permissions to write into the
@@ -771,89 +1080,51 @@ int main(int ac, char** av) {
                 // Directory is the same object for all tests.
                 ::evaluation_directory test_directory(eval_dir);
                 test_directory.discover_directory().get();
-                iotune_logger.info("Disk parameters: max_iodepth={} disks_per_array={} minimum_io_size={}",
+                iotune_logger.info("Disk parameters for {}: max_iodepth={} disks_per_array={} minimum_io_size={}", mountpoint,
                         test_directory.max_iodepth(), test_directory.disks_per_array(), test_directory.minimum_io_size());
+                evaluations.push_back(disk_evaluation{mountpoint, std::move(test_directory)});
+            }
 
-                ::iotune_multi_shard_context iotune_tests(test_directory);
-                iotune_tests.start().get();
-                auto stop = defer([&iotune_tests] () noexcept {
-                    try {
-                        iotune_tests.stop().get();
-                    } catch (...) {
-                        fmt::print("Error occurred during iotune context shutdown: {}", std::current_exception());
-                        abort();
-                    }
-                });
-
-                row_stats rates;
-                auto accuracy_msg = [accuracy, &rates] {
-                    auto stdev = rates.stdev_percents() * 100.0;
-                    return (accuracy == 0 || stdev > accuracy) ? fmt::format(" (deviation {}%)", int(round(stdev))) : std::string("");
-                };
-
-                iotune_tests.create_data_file().get();
-
-                fmt::print("Starting Evaluation. This may take a while...\n");
-                fmt::print("Measuring sequential write bandwidth: ");
-                std::cout.flush();
-                io_rates write_bw;
-                size_t sequential_buffer_size = 1 << 20;
-                for (unsigned shard = 0; shard < smp::count; ++shard) {
-                    write_bw += iotune_tests.write_sequential_data(shard, sequential_buffer_size, duration * 0.70 / smp::count).get0();
-                }
-                write_bw.bytes_per_sec /= smp::count;
-                rates = iotune_tests.get_serial_rates().get0();
-                fmt::print("{} MB/s{}\n", uint64_t(write_bw.bytes_per_sec / (1024 * 1024)), accuracy_msg());
-
-                std::optional<uint64_t> write_sat;
-
-                if (write_saturation) {
-                    fmt::print("Measuring write saturation length: ");
-                    std::cout.flush();
-                    write_sat = iotune_tests.saturate_write(write_bw.bytes_per_sec * (1.0 - rates.stdev_percents()), sequential_buffer_size/2, duration * 0.70).get0();
-                    fmt::print("{}\n", *write_sat);
-                }
-
-                fmt::print("Measuring sequential read bandwidth: ");
-                std::cout.flush();
-                auto read_bw = iotune_tests.read_sequential_data(0, sequential_buffer_size, duration * 0.1).get0();
-                rates = iotune_tests.get_serial_rates().get0();
-                fmt::print("{} MB/s{}\n", uint64_t(read_bw.bytes_per_sec / (1024 * 1024)), accuracy_msg());
-
-                std::optional<uint64_t> read_sat;
+            if (fs_check) {
+                return 0;
+            }
 
-                if (read_saturation) {
-                    fmt::print("Measuring read saturation length: ");
-                    std::cout.flush();
-                    read_sat = iotune_tests.saturate_read(read_bw.bytes_per_sec * (1.0 - rates.stdev_percents()), sequential_buffer_size/2, duration * 0.1).get0();
-                    fmt::print("{}\n", *read_sat);
+            // Disks that share no device are measured at the same time, those
+            // that do one after the other, not to skew each other's results
+            std::vector<std::vector<disk_evaluation*>> groups;
+            std::vector<std::set<std::string>> group_devices;
+            for (auto& ev : evaluations) {
+                std::vector<disk_evaluation*> group = { &ev };
+                std::set<std::string> devices = ev.directory.devices();
+                for (size_t i = 0; i < groups.size(); ) {
+                    auto& gd = group_devices[i];
+                    bool shared = std::any_of(devices.begin(), devices.end(), [&gd] (const std::string& d) { return gd.count(d); });
+                    if (shared) {
+                        group.insert(group.end(), groups[i].begin(), groups[i].end());
+                        devices.insert(gd.begin(), gd.end());
+                        groups.erase(groups.begin() + i);
+                        group_devices.erase(group_devices.begin() + i);
+                    } else {
+                        i++;
+                    }
                 }
-
-                fmt::print("Measuring random write IOPS: ");
-                std::cout.flush();
-                auto write_iops = iotune_tests.write_random_data(test_directory.minimum_io_size(), duration * 0.1).get0();
-                rates = iotune_tests.get_sharded_worst_rates().get0();
-                fmt::print("{} IOPS{}\n", uint64_t(write_iops.iops), accuracy_msg());
-
-                fmt::print("Measuring random read IOPS: ");
-                std::cout.flush();
-                auto read_iops = iotune_tests.read_random_data(test_directory.minimum_io_size(), duration * 0.1).get0();
-                rates = iotune_tests.get_sharded_worst_rates().get0();
-                fmt::print("{} IOPS{}\n", uint64_t(read_iops.iops), accuracy_msg());
-
-                struct disk_descriptor desc;
-                desc.mountpoint = mountpoint;
-                desc.read_iops = read_iops.iops;
-                desc.read_bw = read_bw.bytes_per_sec;
-                desc.read_sat_len = read_sat;
-                desc.write_iops = write_iops.iops;
-                desc.write_bw = write_bw.bytes_per_sec;
-                desc.write_sat_len = write_sat;
-                disk_descriptors.push_back(std::move(desc));
+                groups.push_back(std::move(group));
+                group_devices.push_back(std::move(devices));
             }
 
-            if (fs_check) {
-                return 0;
+            fmt::print("Starting Evaluation. This may take a while...\n");
+            bool concurrent = groups.size() > 1;
+            parallel_for_each(groups, [&params, concurrent] (std::vector<disk_evaluation*>& group) {
+                return seastar::async([&params, concurrent, &group] {
+                    for (auto* ev : group) {
+                        ev->result = evaluate_disk(ev->mountpoint, ev->directory, params, progress(concurrent ? ev->mountpoint : ""));
+                    }
+                });
+            }).get();
+
+            std::vector<disk_descriptor> disk_descriptors;
+            for (auto& ev : evaluations) {
+                disk_descriptors.push_back(std::move(ev.result));
             }
 
             auto file = "properties file";
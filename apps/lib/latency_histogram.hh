@@ -0,0 +1,156 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/bitops.hh>
+#include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace seastar_apps_lib {
+
+/// \brief A latency histogram in the manner of HdrHistogram
+///
+/// Counts latencies in microseconds with 3 significant digits: values below
+/// 2048us are counted exactly, and the larger ones in 1024 buckets per power
+/// of two, up to about an hour. Histograms of several shards are added up
+/// with operator+=.
+class latency_histogram {
+    static constexpr unsigned sub_bucket_bits = 11;
+    static constexpr uint64_t sub_bucket_count = 1 << sub_bucket_bits;
+    static constexpr uint64_t half_count = sub_bucket_count / 2;
+    // Up to about an hour
+    static constexpr unsigned max_shift = 21;
+
+    std::vector<uint64_t> _counts = std::vector<uint64_t>(sub_bucket_count + max_shift * half_count);
+    uint64_t _total = 0;
+    uint64_t _max = 0;
+    double _sum = 0;
+    double _sum_squares = 0;
+
+    static size_t index_of(uint64_t v) noexcept {
+        if (v < sub_bucket_count) {
+            return v;
+        }
+        unsigned shift = std::min<unsigned>(64 - seastar::count_leading_zeros(v) - sub_bucket_bits, max_shift);
+        auto top = std::min(v >> shift, sub_bucket_count - 1);
+        return sub_bucket_count + (shift - 1) * half_count + (top - half_count);
+    }
+    // The largest value counted at index i
+    static uint64_t value_of(size_t i) noexcept {
+        if (i < sub_bucket_count) {
+            return i;
+        }
+        unsigned shift = (i - sub_bucket_count) / half_count + 1;
+        uint64_t top = (i - sub_bucket_count) % half_count + half_count;
+        return ((top + 1) << shift) - 1;
+    }
+    // The value at percentile, and how many values are up to its bucket
+    std::pair<uint64_t, uint64_t> find_percentile(double percentile) const noexcept {
+        auto target = std::max<uint64_t>(1, std::ceil(percentile / 100 * _total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); i++) {
+            seen += _counts[i];
+            if (seen >= target) {
+                return {std::min(value_of(i), _max), seen};
+            }
+        }
+        return {_max, _total};
+    }
+public:
+    void record(std::chrono::microseconds latency) noexcept {
+        uint64_t v = std::max<int64_t>(latency.count(), 0);
+        _counts[index_of(v)]++;
+        _total++;
+        _max = std::max(_max, v);
+        _sum += v;
+        _sum_squares += double(v) * v;
+    }
+
+    latency_histogram& operator+=(const latency_histogram& o) noexcept {
+        for (size_t i = 0; i < _counts.size(); i++) {
+            _counts[i] += o._counts[i];
+        }
+        _total += o._total;
+        _max = std::max(_max, o._max);
+        _sum += o._sum;
+        _sum_squares += o._sum_squares;
+        return *this;
+    }
+
+    uint64_t total() const noexcept {
+        return _total;
+    }
+    std::chrono::microseconds max() const noexcept {
+        return std::chrono::microseconds(_max);
+    }
+    std::chrono::microseconds mean() const noexcept {
+        return std::chrono::microseconds(_total ? uint64_t(_sum / _total) : 0);
+    }
+    std::chrono::microseconds percentile(double percentile) const noexcept {
+        return std::chrono::microseconds(value_at_percentile(percentile));
+    }
+
+    /// In microseconds, \c percentile being from 0 to 100
+    uint64_t value_at_percentile(double percentile) const noexcept {
+        return find_percentile(percentile).first;
+    }
+
+    /// Prints the percentiles wrk2 prints, and with \c spectrum, the same
+    /// detailed percentile distribution as HdrHistogram, with 5 steps per
+    /// halving of the distance to 100%
+    void print(bool spectrum) const {
+        auto ms = [] (uint64_t us) { return us / 1000.0; };
+        fmt::print("  Latency Distribution (HdrHistogram - Recorded Latency)\n");
+        for (double p : {50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 99.999, 100.0}) {
+            fmt::print("{:8.3f}%  {:9.2f}ms\n", p, ms(value_at_percentile(p)));
+        }
+        if (!spectrum || !_total) {
+            return;
+        }
+        fmt::print("\n  Detailed Percentile spectrum:\n");
+        fmt::print("{:>12} {:>14} {:>10} {:>14}\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+        constexpr unsigned ticks_per_half_distance = 5;
+        double p = 0;
+        while (true) {
+            auto [v, count] = find_percentile(p);
+            if (count >= _total) {
+                fmt::print("{:12.3f} {:14.12f} {:10d}\n", ms(_max), 1.0, _total);
+                break;
+            }
+            fmt::print("{:12.3f} {:14.12f} {:10d} {:14.2f}\n", ms(v), p / 100, count, 1 / (1 - p / 100));
+            double half_distance = std::pow(2, std::floor(std::log2(100 / (100 - p))) + 1);
+            p += 100 / (ticks_per_half_distance * half_distance);
+        }
+        double mean = _sum / _total;
+        double stddev = std::sqrt(std::max(0.0, _sum_squares / _total - mean * mean));
+        fmt::print("#[Mean    = {:12.3f}, StdDeviation   = {:12.3f}]\n", ms(mean), ms(stddev));
+        fmt::print("#[Max     = {:12.3f}, Total count    = {:12d}]\n", ms(_max), _total);
+        fmt::print("#[Buckets = {:12d}, SubBuckets     = {:12d}]\n", max_shift + 1, sub_bucket_count);
+    }
+};
+
+}
@@ -23,6 +23,7 @@
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/range/irange.hpp>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
@@ -31,6 +32,7 @@
 #include <seastar/core/seastar.hh>
 #include <seastar/core/loop.hh>
 #include <seastar/core/timer-set.hh>
+#include <seastar/core/incremental_unordered_set.hh>
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/core/stream.hh>
 #include <seastar/core/memory.hh>
@@ -41,6 +43,7 @@
 #include <seastar/core/slab.hh>
 #include <seastar/core/align.hh>
 #include <seastar/core/print.hh>
+#include <seastar/core/unaligned.hh>
 #include <seastar/net/api.hh>
 #include <seastar/net/packet-data-source.hh>
 #include <seastar/util/std-compat.hh>
@@ -63,6 +66,7 @@ namespace bi = boost::intrusive;
 static constexpr double default_slab_growth_factor = 1.25;
 static constexpr uint64_t default_slab_page_size = 1UL*MB;
 static constexpr uint64_t default_per_cpu_slab_size = 0UL; // zero means reclaimer is enabled.
+static constexpr float default_lru_protected_ratio = 0.8;
 static __thread slab_allocator<item>* slab;
 static thread_local std::unique_ptr<slab_allocator<item>> slab_holder;
 
@@ -359,6 +363,15 @@ struct local_origin_tag {
     }
 };
 
+// How much a shard's slab needs memory, and how much it can spare
+struct memory_pressure {
+    uint64_t evictions;
+    // Slab pages the slab may still allocate
+    uint64_t available_pages;
+    // Slab pages the shard has free memory for
+    uint64_t free_pages;
+};
+
 struct item_insertion_data {
     item_key key;
     sstring ascii_prefix;
@@ -368,15 +381,12 @@ struct item_insertion_data {
 
 class cache {
 private:
-    using cache_type = bi::unordered_set<item,
-        bi::member_hook<item, item::hook_type, &item::_cache_link>,
-        bi::power_2_buckets<true>,
-        bi::constant_time_size<true>>;
-    using cache_iterator = typename cache_type::iterator;
+    // Grows a few buckets at a time, so that tens of millions of items
+    // don't stall the shard when the table grows
+    using cache_type = incremental_unordered_set<item,
+        bi::member_hook<item, item::hook_type, &item::_cache_link>>;
     static constexpr size_t initial_bucket_count = 1 << 10;
     static constexpr float load_factor = 0.75f;
-    size_t _resize_up_threshold = load_factor * initial_bucket_count;
-    std::vector<cache_type::bucket_type> _buckets;
     cache_type _cache;
     seastar::timer_set<item, &item::_timer_link> _alive;
     timer<clock_type> _timer;
@@ -384,6 +394,7 @@ class cache {
     clock_type::duration _wc_to_clock_type_delta;
     cache_stats _stats;
     timer<clock_type> _flush_timer;
+    uint64_t _slab_page_size;
 private:
     size_t item_size(item& item_ref) {
         constexpr size_t field_alignment = alignof(void*);
@@ -416,7 +427,7 @@ class cache {
     template <bool IsInCache = true, bool IsInTimerList = true, bool Release = true>
     void erase(item& item_ref) {
         if (IsInCache) {
-            _cache.erase(_cache.iterator_to(item_ref));
+            _cache.erase(item_ref);
         }
         if (IsInTimerList) {
             if (item_ref._expiry.ever_expires()) {
@@ -451,13 +462,13 @@ class cache {
     }
 
     inline
-    cache_iterator find(const item_key& key) {
+    item* find(const item_key& key) {
         return _cache.find(key, std::hash<item_key>(), item_key_cmp());
     }
 
     template <typename Origin>
     inline
-    cache_iterator add_overriding(cache_iterator i, item_insertion_data& insertion) {
+    item* add_overriding(item* i, item_insertion_data& insertion) {
         auto& old_item = *i;
         uint64_t old_item_version = old_item._version;
 
@@ -490,27 +501,11 @@ class cache {
             _timer.rearm(item_ref.get_timeout());
         }
         _stats._bytes += size;
-        maybe_rehash();
-    }
-
-    void maybe_rehash() {
-        if (_cache.size() >= _resize_up_threshold) {
-            auto new_size = _cache.bucket_count() * 2;
-            std::vector<cache_type::bucket_type> old_buckets;
-            try {
-                old_buckets = std::exchange(_buckets, std::vector<cache_type::bucket_type>(new_size));
-            } catch (const std::bad_alloc& e) {
-                _stats._resize_failure++;
-                return;
-            }
-            _cache.rehash(typename cache_type::bucket_traits(_buckets.data(), new_size));
-            _resize_up_threshold = _cache.bucket_count() * load_factor;
-        }
     }
 public:
-    cache(uint64_t per_cpu_slab_size, uint64_t slab_page_size)
-        : _buckets(initial_bucket_count)
-        , _cache(cache_type::bucket_traits(_buckets.data(), initial_bucket_count))
+    cache(uint64_t per_cpu_slab_size, uint64_t slab_page_size, float lru_protected_ratio, bool slab_reassign)
+        : _cache(initial_bucket_count, load_factor)
+        , _slab_page_size(slab_page_size)
     {
         using namespace std::chrono;
 
@@ -524,6 +519,8 @@ class cache {
         slab_holder = std::make_unique<slab_allocator<item>>(default_slab_growth_factor, per_cpu_slab_size, slab_page_size,
                 [this](item& item_ref) { erase<true, true, false>(item_ref); _stats._evicted++; });
         slab = slab_holder.get();
+        slab->set_protected_ratio(lru_protected_ratio);
+        slab->enable_page_reassignment(slab_reassign);
 #ifdef __DEBUG__
         static bool print_slab_classes = true;
         if (print_slab_classes) {
@@ -539,7 +536,7 @@ class cache {
 
     void flush_all() {
         _flush_timer.cancel();
-        _cache.erase_and_dispose(_cache.begin(), _cache.end(), [this] (item* it) {
+        _cache.clear_and_dispose([this] (item* it) {
             erase<false, true>(*it);
         });
     }
@@ -552,7 +549,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     bool set(item_insertion_data& insertion) {
         auto i = find(insertion.key);
-        if (i != _cache.end()) {
+        if (i) {
             add_overriding<Origin>(i, insertion);
             _stats._set_replaces++;
             return true;
@@ -566,7 +563,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     bool add(item_insertion_data& insertion) {
         auto i = find(insertion.key);
-        if (i != _cache.end()) {
+        if (i) {
             return false;
         }
 
@@ -578,7 +575,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     bool replace(item_insertion_data& insertion) {
         auto i = find(insertion.key);
-        if (i == _cache.end()) {
+        if (!i) {
             return false;
         }
 
@@ -589,7 +586,7 @@ class cache {
 
     bool remove(const item_key& key) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._delete_misses++;
             return false;
         }
@@ -601,7 +598,7 @@ class cache {
 
     item_ptr get(const item_key& key) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._get_misses++;
             return nullptr;
         }
@@ -613,7 +610,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     cas_result cas(item_insertion_data& insertion, item::version_type version) {
         auto i = find(insertion.key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._cas_misses++;
             return cas_result::not_found;
         }
@@ -637,13 +634,26 @@ class cache {
 
     cache_stats stats() {
         _stats._size = size();
+        _stats._resize_failure = _cache.grow_failures();
         return _stats;
     }
 
+    memory_pressure pressure() {
+        return memory_pressure{slab->evictions(), slab->available_pages(), memory::stats().free_memory() / _slab_page_size};
+    }
+
+    uint64_t lend_slab_pages(uint64_t pages) {
+        return slab->lend_pages(pages);
+    }
+
+    void borrow_slab_pages(uint64_t pages) {
+        slab->borrow_pages(pages);
+    }
+
     template <typename Origin = local_origin_tag>
     std::pair<item_ptr, bool> incr(item_key& key, uint64_t delta) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._incr_misses++;
             return {item_ptr{}, false};
         }
@@ -666,7 +676,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     std::pair<item_ptr, bool> decr(item_key& key, uint64_t delta) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._decr_misses++;
             return {item_ptr{}, false};
         }
@@ -692,8 +702,7 @@ class cache {
         size_t max_size = 0;
         unsigned max_bucket = 0;
 
-        for (size_t i = 0; i < _cache.bucket_count(); i++) {
-            size_t size = _cache.bucket_size(i);
+        _cache.for_each_bucket_size([&] (size_t size) {
             unsigned bucket;
             if (size == 0) {
                 bucket = 0;
@@ -703,7 +712,7 @@ class cache {
             max_bucket = std::max(max_bucket, bucket);
             max_size = std::max(max_size, size);
             histo[bucket]++;
-        }
+        });
 
         std::stringstream ss;
 
@@ -791,6 +800,45 @@ class sharded_cache {
         return _peers.invoke_on(cpu, &cache::get, std::ref(key));
     }
 
+    // Looks all the keys up with a single message to each shard that owns
+    // some of them. Resolves to the items, null for the missing ones, in
+    // the order of the keys.
+    // The caller must keep @keys live until the resulting future resolves.
+    future<std::vector<item_ptr>> get_multi(const std::vector<item_key>& keys) {
+        std::vector<std::vector<unsigned>> by_cpu(smp::count);
+        for (unsigned i = 0; i < keys.size(); i++) {
+            by_cpu[get_cpu(keys[i])].push_back(i);
+        }
+        return do_with(std::vector<item_ptr>(keys.size()), std::move(by_cpu), [this, &keys] (auto& items, auto& by_cpu) {
+            return parallel_for_each(boost::irange(0u, smp::count), [this, &keys, &items, &by_cpu] (unsigned cpu) {
+                auto& indices = by_cpu[cpu];
+                if (indices.empty()) {
+                    return make_ready_future<>();
+                }
+                if (cpu == this_shard_id()) {
+                    for (auto i : indices) {
+                        items[i] = _peers.local().get(keys[i]);
+                    }
+                    return make_ready_future<>();
+                }
+                return _peers.invoke_on(cpu, [&keys, &indices] (cache& c) {
+                    std::vector<item_ptr> found;
+                    found.reserve(indices.size());
+                    for (auto i : indices) {
+                        found.push_back(c.get(keys[i]));
+                    }
+                    return found;
+                }).then([&items, &indices] (std::vector<item_ptr> found) {
+                    for (unsigned j = 0; j < indices.size(); j++) {
+                        items[indices[j]] = std::move(found[j]);
+                    }
+                });
+            }).then([&items] {
+                return std::move(items);
+            });
+        });
+    }
+
     // The caller must keep @insertion live until the resulting future resolves.
     future<cas_result> cas(item_insertion_data& insertion, item::version_type version) {
         auto cpu = get_cpu(insertion.key);
@@ -804,6 +852,20 @@ class sharded_cache {
         return _peers.map_reduce(adder<cache_stats>(), &cache::stats);
     }
 
+    future<std::vector<memory_pressure>> pressure() {
+        return _peers.map([] (cache& c) { return c.pressure(); });
+    }
+
+    // Moves up to @pages slab pages of memory limit from shard @from to
+    // shard @to, resolves to how many were moved
+    future<uint64_t> lend_slab_pages(unsigned from, unsigned to, uint64_t pages) {
+        return _peers.invoke_on(from, &cache::lend_slab_pages, pages).then([this, to] (uint64_t lent) {
+            return _peers.invoke_on(to, &cache::borrow_slab_pages, lent).then([lent] {
+                return lent;
+            });
+        });
+    }
+
     // The caller must keep @key live until the resulting future resolves.
     future<std::pair<item_ptr, bool>> incr(item_key& key, uint64_t delta) {
         auto cpu = get_cpu(key);
@@ -862,6 +924,58 @@ struct system_stats {
     future<> stop() { return make_ready_future<>(); }
 };
 
+using stat_list = std::vector<std::pair<sstring, sstring>>;
+
+// The statistics reported by the stats command, in the order they are printed
+future<stat_list> gather_stats(sharded_cache& cache, distributed<system_stats>& sys_stats) {
+    return cache.stats().then([&sys_stats] (cache_stats all_cache_stats) {
+        return sys_stats.map_reduce(adder<system_stats>(), &system_stats::self).then([all_cache_stats] (system_stats all_system_stats) {
+            auto now = clock_type::now();
+            auto total_items = all_cache_stats._set_replaces + all_cache_stats._set_adds
+                + all_cache_stats._cas_hits;
+            stat_list stats;
+            auto add = [&stats] (const char* name, auto value) {
+                stats.emplace_back(name, to_sstring(value));
+            };
+            add("pid", getpid());
+            add("uptime", std::chrono::duration_cast<std::chrono::seconds>(now - all_system_stats._start_time).count());
+            add("time", std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
+            stats.emplace_back("version", VERSION_STRING);
+            add("pointer_size", sizeof(void*)*8);
+            add("curr_connections", all_system_stats._curr_connections);
+            add("total_connections", all_system_stats._total_connections);
+            add("connection_structures", all_system_stats._curr_connections);
+            add("cmd_get", all_system_stats._cmd_get);
+            add("cmd_set", all_system_stats._cmd_set);
+            add("cmd_flush", all_system_stats._cmd_flush);
+            add("cmd_touch", 0);
+            add("get_hits", all_cache_stats._get_hits);
+            add("get_misses", all_cache_stats._get_misses);
+            add("delete_misses", all_cache_stats._delete_misses);
+            add("delete_hits", all_cache_stats._delete_hits);
+            add("incr_misses", all_cache_stats._incr_misses);
+            add("incr_hits", all_cache_stats._incr_hits);
+            add("decr_misses", all_cache_stats._decr_misses);
+            add("decr_hits", all_cache_stats._decr_hits);
+            add("cas_misses", all_cache_stats._cas_misses);
+            add("cas_hits", all_cache_stats._cas_hits);
+            add("cas_badval", all_cache_stats._cas_badval);
+            add("touch_hits", 0);
+            add("touch_misses", 0);
+            add("auth_cmds", 0);
+            add("auth_errors", 0);
+            add("threads", smp::count);
+            add("curr_items", all_cache_stats._size);
+            add("total_items", total_items);
+            add("seastar.expired", all_cache_stats._expired);
+            add("seastar.resize_failure", all_cache_stats._resize_failure);
+            add("evictions", all_cache_stats._evicted);
+            add("bytes", all_cache_stats._bytes);
+            return stats;
+        });
+    });
+}
+
 class ascii_protocol {
 private:
     using this_type = ascii_protocol;
@@ -870,7 +984,6 @@ class ascii_protocol {
     memcache_ascii_parser _parser;
     item_key _item_key;
     item_insertion_data _insertion;
-    std::vector<item_ptr> _items;
 private:
     static constexpr const char *msg_crlf = "\r\n";
     static constexpr const char *msg_error = "ERROR\r\n";
@@ -919,14 +1032,9 @@ class ascii_protocol {
                 return out.write(std::move(msg));
             });
         } else {
-            _items.clear();
-            return parallel_for_each(_parser._keys.begin(), _parser._keys.end(), [this] (const auto& key) {
-                return _cache.get(key).then([this] (auto item) {
-                    _items.emplace_back(std::move(item));
-                });
-            }).then([this, &out] () {
+            return _cache.get_multi(_parser._keys).then([&out] (std::vector<item_ptr> items) {
                 scattered_message<char> msg;
-                for (auto& item : _items) {
+                for (auto& item : items) {
                     append_item<WithVersion>(msg, std::move(item));
                 }
                 msg.append_static(msg_end);
@@ -935,95 +1043,14 @@ class ascii_protocol {
         }
     }
 
-    template <typename Value>
-    static future<> print_stat(output_stream<char>& out, const char* key, Value value) {
-        return out.write(msg_stat)
-                .then([&out, key] { return out.write(key); })
-                .then([&out] { return out.write(" "); })
-                .then([&out, value] { return out.write(to_sstring(value)); })
-                .then([&out] { return out.write(msg_crlf); });
-    }
-
     future<> print_stats(output_stream<char>& out) {
-        return _cache.stats().then([this, &out] (auto stats) {
-            return _system_stats.map_reduce(adder<system_stats>(), &system_stats::self)
-                .then([&out, all_cache_stats = std::move(stats)] (auto all_system_stats) -> future<> {
-                    auto now = clock_type::now();
-                    auto total_items = all_cache_stats._set_replaces + all_cache_stats._set_adds
-                        + all_cache_stats._cas_hits;
-                    return print_stat(out, "pid", getpid())
-                        .then([&out, uptime = now - all_system_stats._start_time] {
-                            return print_stat(out, "uptime",
-                                std::chrono::duration_cast<std::chrono::seconds>(uptime).count());
-                        }).then([now, &out] {
-                            return print_stat(out, "time",
-                                std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
-                        }).then([&out] {
-                            return print_stat(out, "version", VERSION_STRING);
-                        }).then([&out] {
-                            return print_stat(out, "pointer_size", sizeof(void*)*8);
-                        }).then([&out, v = all_system_stats._curr_connections] {
-                            return print_stat(out, "curr_connections", v);
-                        }).then([&out, v = all_system_stats._total_connections] {
-                            return print_stat(out, "total_connections", v);
-                        }).then([&out, v = all_system_stats._curr_connections] {
-                            return print_stat(out, "connection_structures", v);
-                        }).then([&out, v = all_system_stats._cmd_get] {
-                            return print_stat(out, "cmd_get", v);
-                        }).then([&out, v = all_system_stats._cmd_set] {
-                            return print_stat(out, "cmd_set", v);
-                        }).then([&out, v = all_system_stats._cmd_flush] {
-                            return print_stat(out, "cmd_flush", v);
-                        }).then([&out] {
-                            return print_stat(out, "cmd_touch", 0);
-                        }).then([&out, v = all_cache_stats._get_hits] {
-                            return print_stat(out, "get_hits", v);
-                        }).then([&out, v = all_cache_stats._get_misses] {
-                            return print_stat(out, "get_misses", v);
-                        }).then([&out, v = all_cache_stats._delete_misses] {
-                            return print_stat(out, "delete_misses", v);
-                        }).then([&out, v = all_cache_stats._delete_hits] {
-                            return print_stat(out, "delete_hits", v);
-                        }).then([&out, v = all_cache_stats._incr_misses] {
-                            return print_stat(out, "incr_misses", v);
-                        }).then([&out, v = all_cache_stats._incr_hits] {
-                            return print_stat(out, "incr_hits", v);
-                        }).then([&out, v = all_cache_stats._decr_misses] {
-                            return print_stat(out, "decr_misses", v);
-                        }).then([&out, v = all_cache_stats._decr_hits] {
-                            return print_stat(out, "decr_hits", v);
-                        }).then([&out, v = all_cache_stats._cas_misses] {
-                            return print_stat(out, "cas_misses", v);
-                        }).then([&out, v = all_cache_stats._cas_hits] {
-                            return print_stat(out, "cas_hits", v);
-                        }).then([&out, v = all_cache_stats._cas_badval] {
-                            return print_stat(out, "cas_badval", v);
-                        }).then([&out] {
-                            return print_stat(out, "touch_hits", 0);
-                        }).then([&out] {
-                            return print_stat(out, "touch_misses", 0);
-                        }).then([&out] {
-                            return print_stat(out, "auth_cmds", 0);
-                        }).then([&out] {
-                            return print_stat(out, "auth_errors", 0);
-                        }).then([&out] {
-                            return print_stat(out, "threads", smp::count);
-                        }).then([&out, v = all_cache_stats._size] {
-                            return print_stat(out, "curr_items", v);
-                        }).then([&out, v = total_items] {
-                            return print_stat(out, "total_items", v);
-                        }).then([&out, v = all_cache_stats._expired] {
-                            return print_stat(out, "seastar.expired", v);
-                        }).then([&out, v = all_cache_stats._resize_failure] {
-                            return print_stat(out, "seastar.resize_failure", v);
-                        }).then([&out, v = all_cache_stats._evicted] {
-                            return print_stat(out, "evictions", v);
-                        }).then([&out, v = all_cache_stats._bytes] {
-                            return print_stat(out, "bytes", v);
-                        }).then([&out] {
-                            return out.write(msg_end);
-                        });
-                });
+        return gather_stats(_cache, _system_stats).then([&out] (stat_list stats) {
+            sstring buf;
+            for (auto& stat : stats) {
+                buf += make_sstring(msg_stat, stat.first, " ", stat.second, msg_crlf);
+            }
+            buf += msg_end;
+            return out.write(std::move(buf));
         });
     }
 public:
@@ -1219,6 +1246,405 @@ class ascii_protocol {
     };
 };
 
+// The memcached binary protocol, see
+// https://github.com/memcached/memcached/wiki/BinaryProtocolRevamped
+//
+// Clients look many keys up by sending quiet gets, which have no response
+// when the key is missing, followed by a command that has one, usually a
+// noop. The quiet gets are kept until then, and looked up together with
+// a single message to each shard.
+class binary_protocol {
+public:
+    static constexpr uint8_t request_magic = 0x80;
+private:
+    static constexpr uint8_t response_magic = 0x81;
+    // Larger requests close the connection
+    static constexpr uint32_t max_body_length = 64 * MB;
+    static constexpr uint32_t no_auto_create = 0xffffffff;
+
+    enum class opcode : uint8_t {
+        get = 0x00,
+        set = 0x01,
+        add = 0x02,
+        replace = 0x03,
+        del = 0x04,
+        increment = 0x05,
+        decrement = 0x06,
+        quit = 0x07,
+        flush = 0x08,
+        getq = 0x09,
+        noop = 0x0a,
+        version = 0x0b,
+        getk = 0x0c,
+        getkq = 0x0d,
+        stat = 0x10,
+        setq = 0x11,
+        addq = 0x12,
+        replaceq = 0x13,
+        deleteq = 0x14,
+        incrementq = 0x15,
+        decrementq = 0x16,
+        quitq = 0x17,
+        flushq = 0x18,
+    };
+
+    enum class status : uint16_t {
+        ok = 0x00,
+        key_not_found = 0x01,
+        key_exists = 0x02,
+        invalid_arguments = 0x04,
+        item_not_stored = 0x05,
+        non_numeric_value = 0x06,
+        unknown_command = 0x81,
+        out_of_memory = 0x82,
+    };
+
+    struct header {
+        uint8_t _magic;
+        uint8_t _opcode;
+        packed<uint16_t> _key_length;
+        uint8_t _extras_length;
+        uint8_t _data_type;
+        // the vbucket id in requests
+        packed<uint16_t> _status;
+        packed<uint32_t> _total_body_length;
+        // returned as is
+        packed<uint32_t> _opaque;
+        packed<uint64_t> _cas;
+
+        template<typename Adjuster>
+        auto adjust_endianness(Adjuster a) {
+            return a(_key_length, _status, _total_body_length, _cas);
+        }
+    } __attribute__((packed));
+    static_assert(sizeof(header) == 24);
+
+    struct pending_get {
+        opcode op;
+        uint32_t opaque;
+    };
+
+    sharded_cache& _cache;
+    distributed<system_stats>& _system_stats;
+    header _request;
+    temporary_buffer<char> _body;
+    item_key _key;
+    item_insertion_data _insertion;
+    std::vector<item_key> _get_keys;
+    std::vector<pending_get> _gets;
+    bool _closed = false;
+private:
+    static bool is_quiet(opcode op) {
+        switch (op) {
+        case opcode::getq: case opcode::getkq: case opcode::setq: case opcode::addq:
+        case opcode::replaceq: case opcode::deleteq: case opcode::incrementq:
+        case opcode::decrementq: case opcode::quitq: case opcode::flushq:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    std::string_view extras() const {
+        return std::string_view(_body.get(), _request._extras_length);
+    }
+
+    std::string_view key() const {
+        return std::string_view(_body.get() + _request._extras_length, _request._key_length);
+    }
+
+    std::string_view value() const {
+        auto offset = _request._extras_length + _request._key_length;
+        return std::string_view(_body.get() + offset, _body.size() - offset);
+    }
+
+    template <typename T>
+    static T read_be(const char* p) {
+        return net::ntoh(*unaligned_cast<T>(p));
+    }
+
+    static void append_header(scattered_message<char>& msg, opcode op, status st, uint32_t opaque,
+            size_t extras_length, size_t key_length, size_t value_length, uint64_t cas = 0) {
+        header h;
+        h._magic = response_magic;
+        h._opcode = uint8_t(op);
+        h._key_length = key_length;
+        h._extras_length = extras_length;
+        h._data_type = 0;
+        h._status = uint16_t(st);
+        h._total_body_length = extras_length + key_length + value_length;
+        h._opaque = opaque;
+        h._cas = cas;
+        h = hton(h);
+        msg.append(sstring(reinterpret_cast<const char*>(&h), sizeof(h)));
+    }
+
+    void append_response(scattered_message<char>& msg, status st, std::string_view value = {}, uint64_t cas = 0) {
+        append_header(msg, opcode(_request._opcode), st, _request._opaque, 0, 0, value.size(), cas);
+        if (!value.empty()) {
+            msg.append(sstring(value));
+        }
+    }
+
+    future<> respond(output_stream<char>& out, status st, std::string_view value = {}, uint64_t cas = 0) {
+        if (st == status::ok && is_quiet(opcode(_request._opcode))) {
+            return make_ready_future<>();
+        }
+        scattered_message<char> msg;
+        append_response(msg, st, value, cas);
+        return out.write(std::move(msg));
+    }
+
+    // The flags are kept in the ascii prefix of items, " <flags> <size>"
+    static uint32_t item_flags(const item& it) {
+        auto prefix = it.ascii_prefix();
+        return std::strtoul(sstring(prefix).c_str(), nullptr, 10);
+    }
+
+    static void append_item(scattered_message<char>& msg, opcode op, uint32_t opaque, item_ptr item) {
+        bool with_key = op == opcode::getk || op == opcode::getkq;
+        auto key_length = with_key ? item->key_size() : 0;
+        append_header(msg, op, status::ok, opaque, 4, key_length, item->value_size(), item->version());
+        auto flags = net::hton(item_flags(*item));
+        msg.append(sstring(reinterpret_cast<const char*>(&flags), sizeof(flags)));
+        if (with_key) {
+            msg.append_static(item->key());
+        }
+        msg.append_static(item->value());
+        msg.on_delete([item = std::move(item)] {});
+    }
+
+    future<> flush_gets(output_stream<char>& out) {
+        if (_gets.empty()) {
+            return make_ready_future<>();
+        }
+        _system_stats.local()._cmd_get += _gets.size();
+        return _cache.get_multi(_get_keys).then([this, &out] (std::vector<item_ptr> items) {
+            scattered_message<char> msg;
+            for (unsigned i = 0; i < items.size(); i++) {
+                auto op = _gets[i].op;
+                if (items[i]) {
+                    append_item(msg, op, _gets[i].opaque, std::move(items[i]));
+                } else if (op == opcode::get || op == opcode::getk) {
+                    auto& key = _get_keys[i].key();
+                    auto key_length = op == opcode::getk ? key.size() : 0;
+                    append_header(msg, op, status::key_not_found, _gets[i].opaque, 0, key_length, 0);
+                    if (key_length) {
+                        msg.append(key);
+                    }
+                }
+            }
+            _get_keys.clear();
+            _gets.clear();
+            if (!msg.size()) {
+                return make_ready_future<>();
+            }
+            return out.write(std::move(msg));
+        });
+    }
+
+    future<> handle_store(output_stream<char>& out, opcode op) {
+        if (_request._extras_length != 8 || key().empty()) {
+            return respond(out, status::invalid_arguments);
+        }
+        _system_stats.local()._cmd_set++;
+        auto flags = read_be<uint32_t>(extras().data());
+        auto expiry = read_be<uint32_t>(extras().data() + 4);
+        auto data = value();
+        _insertion = item_insertion_data{
+            .key = item_key(sstring(key())),
+            .ascii_prefix = make_sstring(" ", to_sstring(flags), " ", to_sstring(data.size())),
+            .data = sstring(data),
+            .expiry = expiration(_cache.get_wc_to_clock_type_delta(), expiry)
+        };
+        uint64_t cas = _request._cas;
+        if (cas && op == opcode::set) {
+            return _cache.cas(_insertion, cas).then([this, &out] (cas_result result) {
+                switch (result) {
+                case cas_result::stored:
+                    return respond(out, status::ok);
+                case cas_result::not_found:
+                    return respond(out, status::key_not_found);
+                case cas_result::bad_version:
+                    return respond(out, status::key_exists);
+                }
+                std::abort();
+            });
+        }
+        switch (op) {
+        case opcode::set:
+            return _cache.set(_insertion).then([this, &out] (bool) {
+                return respond(out, status::ok);
+            });
+        case opcode::add:
+            return _cache.add(_insertion).then([this, &out] (bool added) {
+                return respond(out, added ? status::ok : status::key_exists);
+            });
+        case opcode::replace:
+            return _cache.replace(_insertion).then([this, &out] (bool replaced) {
+                return respond(out, replaced ? status::ok : status::key_not_found);
+            });
+        default:
+            std::abort();
+        }
+    }
+
+    future<> handle_arithmetic(output_stream<char>& out, bool incr) {
+        if (_request._extras_length != 20 || key().empty()) {
+            return respond(out, status::invalid_arguments);
+        }
+        auto delta = read_be<uint64_t>(extras().data());
+        auto initial = read_be<uint64_t>(extras().data() + 8);
+        auto expiry = read_be<uint32_t>(extras().data() + 16);
+        _key = item_key(sstring(key()));
+        auto f = incr ? _cache.incr(_key, delta) : _cache.decr(_key, delta);
+        return f.then([this, &out, initial, expiry] (std::pair<item_ptr, bool> result) {
+            auto& item = result.first;
+            if (!item) {
+                if (expiry == no_auto_create) {
+                    return respond(out, status::key_not_found);
+                }
+                auto value = to_sstring(initial);
+                _insertion = item_insertion_data{
+                    .key = std::move(_key),
+                    .ascii_prefix = make_sstring(" 0 ", to_sstring(value.size())),
+                    .data = value,
+                    .expiry = expiration(_cache.get_wc_to_clock_type_delta(), expiry)
+                };
+                return _cache.add(_insertion).then([this, &out, initial] (bool) {
+                    return respond_counter(out, initial, 0);
+                });
+            }
+            if (!result.second) {
+                return respond(out, status::non_numeric_value);
+            }
+            auto value = std::strtoull(sstring(item->value()).c_str(), nullptr, 10);
+            return respond_counter(out, value, item->version());
+        });
+    }
+
+    future<> respond_counter(output_stream<char>& out, uint64_t value, uint64_t cas) {
+        auto v = net::hton(value);
+        return respond(out, status::ok, std::string_view(reinterpret_cast<const char*>(&v), sizeof(v)), cas);
+    }
+
+    future<> handle_stat(output_stream<char>& out) {
+        return gather_stats(_cache, _system_stats).then([this, &out] (stat_list stats) {
+            scattered_message<char> msg;
+            for (auto& stat : stats) {
+                append_header(msg, opcode::stat, status::ok, _request._opaque, 0, stat.first.size(), stat.second.size());
+                msg.append(std::move(stat.first));
+                msg.append(std::move(stat.second));
+            }
+            // terminated by an empty one
+            append_header(msg, opcode::stat, status::ok, _request._opaque, 0, 0, 0);
+            return out.write(std::move(msg));
+        });
+    }
+
+    future<> handle_request(output_stream<char>& out) {
+        auto op = opcode(_request._opcode);
+        switch (op) {
+        case opcode::get:
+        case opcode::getq:
+        case opcode::getk:
+        case opcode::getkq:
+            if (key().empty() || _request._extras_length) {
+                return respond(out, status::invalid_arguments);
+            }
+            _get_keys.emplace_back(sstring(key()));
+            _gets.push_back(pending_get{op, _request._opaque});
+            if (op == opcode::get || op == opcode::getk) {
+                return flush_gets(out);
+            }
+            return make_ready_future<>();
+        case opcode::set:
+        case opcode::setq:
+            return handle_store(out, opcode::set);
+        case opcode::add:
+        case opcode::addq:
+            return handle_store(out, opcode::add);
+        case opcode::replace:
+        case opcode::replaceq:
+            return handle_store(out, opcode::replace);
+        case opcode::del:
+        case opcode::deleteq:
+            _key = item_key(sstring(key()));
+            return _cache.remove(_key).then([this, &out] (bool removed) {
+                return respond(out, removed ? status::ok : status::key_not_found);
+            });
+        case opcode::increment:
+        case opcode::incrementq:
+            return handle_arithmetic(out, true);
+        case opcode::decrement:
+        case opcode::decrementq:
+            return handle_arithmetic(out, false);
+        case opcode::flush:
+        case opcode::flushq:
+        {
+            _system_stats.local()._cmd_flush++;
+            auto expiry = _request._extras_length == 4 ? read_be<uint32_t>(extras().data()) : 0;
+            auto f = expiry ? _cache.flush_at(expiry) : _cache.flush_all();
+            return f.then([this, &out] {
+                return respond(out, status::ok);
+            });
+        }
+        case opcode::noop:
+            return respond(out, status::ok);
+        case opcode::version:
+            return respond(out, status::ok, VERSION_STRING);
+        case opcode::stat:
+            return handle_stat(out);
+        case opcode::quit:
+        case opcode::quitq:
+            _closed = true;
+            return respond(out, status::ok);
+        }
+        return respond(out, status::unknown_command);
+    }
+public:
+    binary_protocol(sharded_cache& cache, distributed<system_stats>& system_stats)
+        : _cache(cache)
+        , _system_stats(system_stats)
+    {}
+
+    // Whether the client quit or broke the protocol
+    bool closed() const {
+        return _closed;
+    }
+
+    future<> handle(input_stream<char>& in, output_stream<char>& out) {
+        return in.read_exactly(sizeof(header)).then([this, &in, &out] (temporary_buffer<char> buf) {
+            if (buf.size() < sizeof(header)) {
+                // end of stream
+                return flush_gets(out);
+            }
+            _request = ntoh(*reinterpret_cast<const header*>(buf.get()));
+            if (_request._magic != request_magic || _request._total_body_length > max_body_length ||
+                    _request._extras_length + _request._key_length > _request._total_body_length) {
+                _closed = true;
+                return flush_gets(out);
+            }
+            return in.read_exactly(_request._total_body_length).then([this, &out] (temporary_buffer<char> body) {
+                if (body.size() < _request._total_body_length) {
+                    return flush_gets(out);
+                }
+                _body = std::move(body);
+                auto op = opcode(_request._opcode);
+                auto f = make_ready_future<>();
+                if (op != opcode::getq && op != opcode::getkq && op != opcode::get && op != opcode::getk) {
+                    f = flush_gets(out);
+                }
+                return f.then([this, &out] {
+                    return handle_request(out);
+                }).handle_exception_type([this, &out] (std::bad_alloc&) {
+                    return respond(out, status::out_of_memory);
+                });
+            });
+        });
+    }
+};
+
 class udp_server {
 public:
     static const size_t default_max_datagram_size = 1400;
@@ -1347,6 +1773,8 @@ class tcp_server {
         input_stream<char> _in;
         output_stream<char> _out;
         ascii_protocol _proto;
+        binary_protocol _binary_proto;
+        bool _binary = false;
         distributed<system_stats>& _system_stats;
         connection(connected_socket&& socket, socket_address addr, sharded_cache& c, distributed<system_stats>& system_stats)
             : _socket(std::move(socket))
@@ -1354,6 +1782,7 @@ class tcp_server {
             , _in(_socket.input())
             , _out(_socket.output())
             , _proto(c, system_stats)
+            , _binary_proto(c, system_stats)
             , _system_stats(system_stats)
         {
             _system_stats.local()._curr_connections++;
@@ -1362,6 +1791,22 @@ class tcp_server {
         ~connection() {
             _system_stats.local()._curr_connections--;
         }
+        // Binary requests start with a magic byte no ascii command does
+        future<> detect_protocol() {
+            return _in.consume([this] (temporary_buffer<char> buf) {
+                _binary = !buf.empty() && uint8_t(buf[0]) == binary_protocol::request_magic;
+                return make_ready_future<consumption_result<char>>(stop_consuming<char>(std::move(buf)));
+            });
+        }
+        bool done() const {
+            return _in.eof() || (_binary && _binary_proto.closed());
+        }
+        future<> handle() {
+            if (_binary) {
+                return _binary_proto.handle(_in, _out);
+            }
+            return _proto.handle(_in, _out);
+        }
     };
 public:
     tcp_server(sharded_cache& cache, distributed<system_stats>& system_stats, uint16_t port = 11211)
@@ -1380,9 +1825,11 @@ class tcp_server {
                 connected_socket fd = std::move(ar.connection);
                 socket_address addr = std::move(ar.remote_address);
                 auto conn = make_lw_shared<connection>(std::move(fd), addr, _cache, _system_stats);
-                (void)do_until([conn] { return conn->_in.eof(); }, [conn] {
-                    return conn->_proto.handle(conn->_in, conn->_out).then([conn] {
-                        return conn->_out.flush();
+                (void)conn->detect_protocol().then([conn] {
+                    return do_until([conn] { return conn->done(); }, [conn] {
+                        return conn->handle().then([conn] {
+                            return conn->_out.flush();
+                        });
                     });
                 }).finally([conn] {
                     return conn->_out.close().finally([conn]{});
@@ -1427,6 +1874,58 @@ class stats_printer {
     future<> stop() { return make_ready_future<>(); }
 };
 
+// With a memory limit on items, shards evict as soon as they reach it,
+// even if other shards have memory to spare because the keys they own are
+// less popular. Every second, the shard that evicted the most since the
+// previous second gets some of the limit of the one that has the most left
+// and didn't evict, as long as it has the memory for it.
+class memory_balancer {
+private:
+    timer<> _timer;
+    sharded_cache& _cache;
+    std::vector<uint64_t> _evictions;
+    bool _balancing = false;
+    static constexpr uint64_t max_pages_per_period = 16;
+public:
+    memory_balancer(sharded_cache& cache)
+        : _cache(cache)
+        , _evictions(smp::count) {}
+
+    void start() {
+        _timer.set_callback([this] {
+            if (_balancing) {
+                return;
+            }
+            _balancing = true;
+            (void)_cache.pressure().then([this] (std::vector<memory_pressure> pressure) {
+                std::optional<unsigned> borrower, lender;
+                uint64_t most_evictions = 0;
+                for (unsigned cpu = 0; cpu < pressure.size(); cpu++) {
+                    auto evictions = pressure[cpu].evictions - std::exchange(_evictions[cpu], pressure[cpu].evictions);
+                    if (evictions > most_evictions) {
+                        most_evictions = evictions;
+                        borrower = cpu;
+                    } else if (evictions == 0 && pressure[cpu].available_pages > 1 &&
+                            (!lender || pressure[cpu].available_pages > pressure[*lender].available_pages)) {
+                        lender = cpu;
+                    }
+                }
+                if (!borrower || !lender || *borrower == *lender) {
+                    return make_ready_future<>();
+                }
+                auto pages = std::min({pressure[*lender].available_pages / 2, pressure[*borrower].free_pages / 2, max_pages_per_period});
+                if (!pages) {
+                    return make_ready_future<>();
+                }
+                return _cache.lend_slab_pages(*lender, *borrower, pages).discard_result();
+            }).finally([this] {
+                _balancing = false;
+            });
+        });
+        _timer.arm_periodic(std::chrono::seconds(1));
+    }
+};
+
 } /* namespace memcache */
 
 int main(int ac, char** av) {
@@ -1436,6 +1935,7 @@ int main(int ac, char** av) {
     distributed<memcache::udp_server> udp_server;
     distributed<memcache::tcp_server> tcp_server;
     memcache::stats_printer stats(cache);
+    memcache::memory_balancer balancer(cache);
 
     namespace bpo = boost::program_options;
     app_template app;
@@ -1446,6 +1946,13 @@ int main(int ac, char** av) {
              "Maximum memory to be used for items (value in megabytes) (reclaimer is disabled if set)")
         ("slab-page-size", bpo::value<uint64_t>()->default_value(memcache::default_slab_page_size/MB),
              "Size of slab page (value in megabytes)")
+        ("lru-protected-ratio", bpo::value<float>()->default_value(memcache::default_lru_protected_ratio),
+             "Largest fraction of the items of a slab class kept in the protected segment of its LRU, "
+             "for items accessed again since they were stored (0 for a plain LRU)")
+        ("slab-reassign", bpo::value<bool>()->default_value(true),
+             "Move slab pages from slab classes with colder items to the ones that evict (with --max-slab-size)")
+        ("slab-lending", bpo::value<bool>()->default_value(false),
+             "Move the memory limit of shards that don't evict to the ones that do (with --max-slab-size)")
         ("stats",
              "Print basic statistics periodically (every second)")
         ("port", bpo::value<uint16_t>()->default_value(11211),
@@ -1462,7 +1969,13 @@ int main(int ac, char** av) {
         uint16_t port = config["port"].as<uint16_t>();
         uint64_t per_cpu_slab_size = config["max-slab-size"].as<uint64_t>() * MB;
         uint64_t slab_page_size = config["slab-page-size"].as<uint64_t>() * MB;
-        return cache_peers.start(std::move(per_cpu_slab_size), std::move(slab_page_size)).then([&system_stats] {
+        float lru_protected_ratio = config["lru-protected-ratio"].as<float>();
+        if (lru_protected_ratio < 0 || lru_protected_ratio >= 1) {
+            throw std::invalid_argument("--lru-protected-ratio must be in [0, 1)");
+        }
+        bool slab_reassign = config["slab-reassign"].as<bool>();
+        bool slab_lending = per_cpu_slab_size && config["slab-lending"].as<bool>();
+        return cache_peers.start(per_cpu_slab_size, slab_page_size, lru_protected_ratio, slab_reassign).then([&system_stats] {
             return system_stats.start(memcache::clock_type::now());
         }).then([&] {
             std::cout << PLATFORM << " memcached " << VERSION << "\n";
@@ -1482,10 +1995,13 @@ int main(int ac, char** av) {
                     (size_t)config["max-datagram-size"].as<int>());
         }).then([&] {
             return udp_server.invoke_on_all(&memcache::udp_server::start);
-        }).then([&stats, start_stats = config.count("stats")] {
+        }).then([&stats, start_stats = config.count("stats"), &balancer, slab_lending] {
             if (start_stats) {
                 stats.start();
             }
+            if (slab_lending) {
+                balancer.start();
+            }
         });
     });
 }
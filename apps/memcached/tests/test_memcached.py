@@ -545,6 +545,129 @@ class TestCommands(MemcacheTest):
                 self.assertEqual(call('get key\r\n'), prev)
                 self.delete('key')
 
+def binary_request(opcode, key=b'', value=b'', extras=b'', opaque=0, cas=0):
+    return struct.pack('>BBHBBHIIQ', 0x80, opcode, len(key), len(extras), 0, 0,
+        len(extras) + len(key) + len(value), opaque, cas) + extras + key + value
+
+def recv_exactly(s, n):
+    m = b''
+    while len(m) < n:
+        data = s.recv(n - len(m))
+        if not data:
+            raise EOFError()
+        m += data
+    return m
+
+def binary_response(s):
+    magic, opcode, key_length, extras_length, _, status, body_length, opaque, cas = \
+        struct.unpack('>BBHBBHIIQ', recv_exactly(s, 24))
+    body = recv_exactly(s, body_length)
+    key = body[extras_length:extras_length + key_length]
+    return {'magic': magic, 'opcode': opcode, 'status': status, 'opaque': opaque, 'cas': cas,
+            'extras': body[:extras_length], 'key': key, 'value': body[extras_length + key_length:]}
+
+class BinaryProtocolTests(MemcacheTest):
+    GET, SET, ADD, DELETE, INCR, QUIT, GETQ, NOOP, VERSION, GETK, GETKQ, STAT = \
+        0x00, 0x01, 0x02, 0x04, 0x05, 0x07, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x10
+    SETQ = 0x11
+
+    def setUp(self):
+        self.s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.s.settimeout(1)
+        self.s.connect(server_addr)
+
+    def tearDown(self):
+        self.s.close()
+        super().tearDown()
+
+    def send(self, *requests):
+        self.s.sendall(b''.join(requests))
+
+    def bset(self, key, value, flags=0, opcode=None, cas=0):
+        self.send(binary_request(opcode if opcode is not None else self.SET, key, value,
+            struct.pack('>II', flags, 0), cas=cas))
+
+    def test_set_and_get(self):
+        self.bset(b'key', b'value', flags=7)
+        r = binary_response(self.s)
+        self.assertEqual((r['magic'], r['opcode'], r['status']), (0x81, self.SET, 0))
+        self.send(binary_request(self.GET, b'key', opaque=42))
+        r = binary_response(self.s)
+        self.assertEqual(r['status'], 0)
+        self.assertEqual(r['opaque'], 42)
+        self.assertEqual(struct.unpack('>I', r['extras'])[0], 7)
+        self.assertEqual(r['value'], b'value')
+        self.assertNotEqual(r['cas'], 0)
+        self.assertEqual(call('get key\r\n'), b'VALUE key 7 5\r\nvalue\r\nEND\r\n')
+
+    def test_get_missing(self):
+        self.send(binary_request(self.GET, b'missing'))
+        self.assertEqual(binary_response(self.s)['status'], 1)
+
+    def test_quiet_gets_are_answered_before_noop(self):
+        self.bset(b'a', b'1', opcode=self.SETQ)
+        self.bset(b'c', b'3', opcode=self.SETQ)
+        self.send(binary_request(self.GETKQ, b'a', opaque=1),
+            binary_request(self.GETKQ, b'b', opaque=2),
+            binary_request(self.GETQ, b'c', opaque=3),
+            binary_request(self.NOOP, opaque=4))
+        responses = [binary_response(self.s) for i in range(3)]
+        self.assertEqual([r['opaque'] for r in responses], [1, 3, 4])
+        self.assertEqual(responses[0]['key'], b'a')
+        self.assertEqual(responses[0]['value'], b'1')
+        self.assertEqual(responses[1]['key'], b'')
+        self.assertEqual(responses[1]['value'], b'3')
+        self.assertEqual(responses[2]['opcode'], self.NOOP)
+
+    def test_add_existing(self):
+        self.bset(b'key', b'value')
+        binary_response(self.s)
+        self.send(binary_request(self.ADD, b'key', b'other', struct.pack('>II', 0, 0)))
+        self.assertEqual(binary_response(self.s)['status'], 2)
+
+    def test_cas(self):
+        self.bset(b'key', b'value')
+        cas = binary_response(self.s)['cas']
+        self.bset(b'key', b'other', cas=cas + 1)
+        self.assertEqual(binary_response(self.s)['status'], 2)
+        self.send(binary_request(self.GET, b'key'))
+        self.bset(b'key', b'other', cas=binary_response(self.s)['cas'])
+        self.assertEqual(binary_response(self.s)['status'], 0)
+
+    def test_delete(self):
+        self.bset(b'key', b'value')
+        binary_response(self.s)
+        self.send(binary_request(self.DELETE, b'key'))
+        self.assertEqual(binary_response(self.s)['status'], 0)
+        self.send(binary_request(self.DELETE, b'key'))
+        self.assertEqual(binary_response(self.s)['status'], 1)
+
+    def test_incr(self):
+        extras = struct.pack('>QQI', 5, 10, 0)
+        self.send(binary_request(self.INCR, b'counter', extras=extras))
+        self.assertEqual(struct.unpack('>Q', binary_response(self.s)['value'])[0], 10)
+        self.send(binary_request(self.INCR, b'counter', extras=extras))
+        self.assertEqual(struct.unpack('>Q', binary_response(self.s)['value'])[0], 15)
+        self.send(binary_request(self.INCR, b'missing', extras=struct.pack('>QQI', 1, 0, 0xffffffff)))
+        self.assertEqual(binary_response(self.s)['status'], 1)
+
+    def test_version_and_stat(self):
+        self.send(binary_request(self.VERSION))
+        self.assertRegex(binary_response(self.s)['value'], b'^seastar ')
+        self.send(binary_request(self.STAT))
+        keys = []
+        while True:
+            r = binary_response(self.s)
+            if not r['key']:
+                break
+            keys.append(r['key'])
+        self.assertIn(b'curr_items', keys)
+
+    def test_quit(self):
+        self.send(binary_request(self.QUIT))
+        self.assertEqual(binary_response(self.s)['status'], 0)
+        self.assertEqual(recv_all(self.s), b'')
+
 def wait_for_memcache_tcp(timeout=4):
     s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     timeout_at = time.time() + timeout
@@ -595,6 +718,7 @@ if __name__ == '__main__':
         suite.addTest(loader.loadTestsFromTestCase(UdpSpecificTests))
     else:
         suite.addTest(loader.loadTestsFromTestCase(TcpSpecificTests))
+        suite.addTest(loader.loadTestsFromTestCase(BinaryProtocolTests))
     result = runner.run(suite)
     if not result.wasSuccessful():
         sys.exit(1)
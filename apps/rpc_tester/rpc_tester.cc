@@ -21,24 +21,26 @@
 
 #include <vector>
 #include <chrono>
+#include <deque>
+#include <random>
 #include <yaml-cpp/yaml.h>
 #include <fmt/core.h>
 #include <boost/range/irange.hpp>
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics/stats.hpp>
-#include <boost/accumulators/statistics/max.hpp>
-#include <boost/accumulators/statistics/mean.hpp>
-#include <boost/accumulators/statistics/p_square_quantile.hpp>
-#include <boost/accumulators/statistics/extended_p_square.hpp>
-#include <boost/accumulators/statistics/extended_p_square_quantile.hpp>
 #include <seastar/core/app-template.hh>
 #include <seastar/core/thread.hh>
 #include <seastar/core/sharded.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/sleep.hh>
 #include <seastar/core/with_scheduling_group.hh>
 #include <seastar/rpc/rpc.hh>
+#include <seastar/rpc/lz4_compressor.hh>
+#include <seastar/rpc/lz4_fragmented_compressor.hh>
+#include <seastar/rpc/multi_algo_compressor_factory.hh>
+#include <seastar/rpc/zstd_compressor.hh>
+#include "../lib/latency_histogram.hh"
 
 using namespace seastar;
-using namespace boost::accumulators;
+using seastar_apps_lib::latency_histogram;
 
 struct serializer {};
 
@@ -101,11 +103,42 @@ struct server_config {
     bool nodelay = true;
 };
 
+// The distribution of the sizes of the payloads of write calls and of
+// stream messages
+struct payload_config {
+    enum class distribution { fixed, uniform, exponential };
+    distribution dist = distribution::fixed;
+    size_t size = 0;
+    size_t min = 0;
+    size_t max = 0;
+    double mean = 0;
+
+    size_t max_size() const noexcept {
+        return dist == distribution::fixed ? size : max;
+    }
+
+    template <typename RandomEngine>
+    size_t next(RandomEngine& rng) const {
+        switch (dist) {
+        case distribution::fixed:
+            return size;
+        case distribution::uniform:
+            return std::uniform_int_distribution<size_t>(min, max)(rng);
+        case distribution::exponential:
+            return std::min<size_t>(std::exponential_distribution<double>(1 / mean)(rng), max);
+        }
+        abort();
+    }
+};
+
 struct job_config {
     std::string name;
     std::string type;
     std::string verb;
-    unsigned parallelism;
+    unsigned parallelism = 0;
+    double rate = 0;
+    payload_config payload;
+    std::string compressor;
     unsigned shares = 100;
 
     std::chrono::seconds duration;
@@ -140,6 +173,24 @@ struct convert<server_config> {
     }
 };
 
+template<>
+struct convert<payload_config> {
+    static bool decode(const Node& node, payload_config& cfg) {
+        if (node.IsScalar()) {
+            cfg.size = node.as<size_t>();
+        } else if (node["mean"]) {
+            cfg.dist = payload_config::distribution::exponential;
+            cfg.mean = node["mean"].as<double>();
+            cfg.max = node["max"] ? node["max"].as<size_t>() : size_t(cfg.mean * 10);
+        } else {
+            cfg.dist = payload_config::distribution::uniform;
+            cfg.min = node["min"].as<size_t>();
+            cfg.max = node["max"].as<size_t>();
+        }
+        return true;
+    }
+};
+
 template <>
 struct convert<job_config> {
     static bool decode(const Node& node, job_config& cfg) {
@@ -147,8 +198,20 @@ struct convert<job_config> {
         cfg.type = node["type"].as<std::string>();
         if (cfg.type == "rpc") {
             cfg.verb = node["verb"].as<std::string>();
+            if (node["rate"]) {
+                cfg.rate = node["rate"].as<double>();
+            } else {
+                cfg.parallelism = node["parallelism"].as<unsigned>();
+            }
+        } else if (cfg.type == "stream") {
             cfg.parallelism = node["parallelism"].as<unsigned>();
         }
+        if (node["payload"]) {
+            cfg.payload = node["payload"].as<payload_config>();
+        }
+        if (node["compressor"]) {
+            cfg.compressor = node["compressor"].as<std::string>();
+        }
         if (node["shares"]) {
             cfg.shares = node["shares"].as<unsigned>();
         }
@@ -178,6 +241,8 @@ enum class rpc_verb : int32_t {
     HELLO = 0,
     BYE = 1,
     ECHO = 2,
+    WRITE = 3,
+    STREAM = 4,
 };
 
 using rpc_protocol = rpc::protocol<serializer, rpc_verb>;
@@ -191,66 +256,209 @@ class job {
     virtual ~job() {}
 };
 
-class job_rpc : public job {
-    using accumulator_type = accumulator_set<double, stats<tag::extended_p_square_quantile(quadratic), tag::mean, tag::max>>;
-
+// What jobs sending messages have in common: payloads, and the statistics
+class job_messages : public job {
+protected:
     job_config _cfg;
     rpc_protocol& _rpc;
     rpc_protocol::client& _client;
-    std::function<future<>(unsigned)> _call;
     std::chrono::steady_clock::time_point _stop;
     uint64_t _total_messages = 0;
-    accumulator_type _latencies;
+    uint64_t _total_bytes = 0;
+    uint64_t _errors = 0;
+    latency_histogram _latencies;
+    std::default_random_engine _rng{std::random_device()()};
+    // Payloads are prefixes of this, random lower case letters, which
+    // compress somewhat like text
+    sstring _payload_source;
+
+    job_messages(job_config cfg, rpc_protocol& rpc, rpc_protocol::client& client)
+            : _cfg(std::move(cfg))
+            , _rpc(rpc)
+            , _client(client)
+            , _stop(std::chrono::steady_clock::now() + _cfg.duration)
+            , _payload_source(uninitialized_string(_cfg.payload.max_size()))
+    {
+        std::uniform_int_distribution<int> letter('a', 'z');
+        for (auto& c : _payload_source) {
+            c = letter(_rng);
+        }
+    }
+
+    bool stopped() const noexcept {
+        return std::chrono::steady_clock::now() > _stop;
+    }
+
+    sstring make_payload() {
+        auto size = _cfg.payload.next(_rng);
+        _total_bytes += size;
+        return _payload_source.substr(0, size);
+    }
+
+    void record_latency(std::chrono::steady_clock::time_point start) noexcept {
+        _latencies.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+    }
+
+public:
+    virtual std::string name() const override { return _cfg.name; }
+
+    virtual void emit_result(YAML::Emitter& out) const override {
+        out << YAML::Key << "messages" << YAML::Value << _total_messages;
+        if (_total_bytes) {
+            out << YAML::Key << "bytes" << YAML::Value << _total_bytes;
+        }
+        if (_errors) {
+            out << YAML::Key << "errors" << YAML::Value << _errors;
+        }
+        out << YAML::Key << "latencies" << YAML::Comment("usec");
+        out << YAML::BeginMap;
+        out << YAML::Key << "average" << YAML::Value << uint64_t(_latencies.mean().count());
+        for (auto& q: quantiles) {
+            out << YAML::Key << fmt::format("p{}", q) << YAML::Value << uint64_t(_latencies.percentile(q * 100).count());
+        }
+        out << YAML::Key << "max" << YAML::Value << uint64_t(_latencies.max().count());
+        out << YAML::EndMap;
+    }
+};
+
+class job_rpc : public job_messages {
+    std::function<future<>(unsigned)> _call;
 
     future<> call_echo(unsigned dummy) {
         return _rpc.make_client<uint64_t(uint64_t)>(rpc_verb::ECHO)(_client, dummy).discard_result();
     }
 
+    future<> call_write(unsigned) {
+        return _rpc.make_client<uint64_t(sstring)>(rpc_verb::WRITE)(_client, make_payload()).discard_result();
+    }
+
+    future<> run_closed_loop() {
+        return parallel_for_each(boost::irange(0u, _cfg.parallelism), [this] (auto dummy) {
+            return do_until([this] {
+                return stopped();
+            }, [this, dummy] {
+                _total_messages++;
+                auto now = std::chrono::steady_clock::now();
+                return _call(dummy).then([this, start = now] {
+                    record_latency(start);
+                });
+            });
+        });
+    }
+
+    // Starts calls at the rate, regardless of how long they take, and
+    // measures their latency from when they were meant to start, so that
+    // the calls delayed by slow ones count
+    future<> run_open_loop() {
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1 / _cfg.rate));
+        return do_with(std::chrono::steady_clock::now(), gate(), [this, interval] (auto& next, gate& g) {
+            return do_until([this] {
+                return stopped();
+            }, [this, interval, &next, &g] {
+                auto now = std::chrono::steady_clock::now();
+                while (next <= now) {
+                    _total_messages++;
+                    (void)with_gate(g, [this, start = next] {
+                        return _call(0).then_wrapped([this, start] (future<> f) {
+                            if (f.failed()) {
+                                _errors++;
+                                f.ignore_ready_future();
+                                return;
+                            }
+                            record_latency(start);
+                        });
+                    });
+                    next += interval;
+                }
+                return seastar::sleep(next - now);
+            }).then([&g] {
+                return g.close();
+            });
+        });
+    }
+
 public:
     job_rpc(job_config cfg, rpc_protocol& rpc, rpc_protocol::client& client)
-            : _cfg(cfg)
-            , _rpc(rpc)
-            , _client(client)
-            , _stop(std::chrono::steady_clock::now() + _cfg.duration)
-            , _latencies(extended_p_square_probabilities = quantiles)
+            : job_messages(std::move(cfg), rpc, client)
     {
         if (_cfg.verb == "echo") {
             _call = [this] (unsigned x) { return call_echo(x); };
+        } else if (_cfg.verb == "write") {
+            _call = [this] (unsigned x) { return call_write(x); };
         } else {
             throw std::runtime_error("unknown verb");
         }
     }
 
-    virtual std::string name() const override { return _cfg.name; }
-
     virtual future<> run() override {
       return with_scheduling_group(_cfg.sg, [this] {
-        return parallel_for_each(boost::irange(0u, _cfg.parallelism), [this] (auto dummy) {
-            return do_until([this] {
-                return std::chrono::steady_clock::now() > _stop;
-            }, [this, dummy] {
+        return _cfg.rate ? run_open_loop() : run_closed_loop();
+      });
+    }
+};
+
+// Sends messages over rpc streams, each acknowledged by the server over a
+// stream back. The latency is the time till a message is acknowledged.
+class job_stream : public job_messages {
+    // Messages sent on a stream before waiting for the oldest to be acknowledged
+    static constexpr size_t window = 16;
+
+    struct stream {
+        rpc::sink<sstring> sink;
+        rpc::source<uint64_t> source;
+        std::deque<std::chrono::steady_clock::time_point> sent;
+        semaphore unacknowledged{window};
+
+        stream(rpc::sink<sstring> sink, rpc::source<uint64_t> source) : sink(std::move(sink)), source(std::move(source)) {}
+    };
+
+    future<> send(stream& s) {
+        return do_until([this] {
+            return stopped();
+        }, [this, &s] {
+            return s.unacknowledged.wait().then([this, &s] {
                 _total_messages++;
-                auto now = std::chrono::steady_clock::now();
-                return _call(dummy).then([this, start = now] {
-                    std::chrono::microseconds lat = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
-                    _latencies(lat.count());
-                });
+                s.sent.push_back(std::chrono::steady_clock::now());
+                return s.sink(make_payload());
+            });
+        }).finally([&s] {
+            return s.sink.flush().finally([&s] {
+                return s.sink.close();
             });
         });
-        return make_ready_future<>();
-      });
     }
 
-    virtual void emit_result(YAML::Emitter& out) const override {
-        out << YAML::Key << "messages" << YAML::Value << _total_messages;
-        out << YAML::Key << "latencies" << YAML::Comment("usec");
-        out << YAML::BeginMap;
-        out << YAML::Key << "average" << YAML::Value << (uint64_t)mean(_latencies);
-        for (auto& q: quantiles) {
-            out << YAML::Key << fmt::format("p{}", q) << YAML::Value << (uint64_t)quantile(_latencies, quantile_probability = q);
-        }
-        out << YAML::Key << "max" << YAML::Value << (uint64_t)max(_latencies);
-        out << YAML::EndMap;
+    future<> receive(stream& s) {
+        return repeat([this, &s] {
+            return s.source().then([this, &s] (std::optional<std::tuple<uint64_t>> ack) {
+                if (!ack) {
+                    return stop_iteration::yes;
+                }
+                record_latency(s.sent.front());
+                s.sent.pop_front();
+                s.unacknowledged.signal();
+                return stop_iteration::no;
+            });
+        });
+    }
+
+public:
+    job_stream(job_config cfg, rpc_protocol& rpc, rpc_protocol::client& client)
+            : job_messages(std::move(cfg), rpc, client)
+    {}
+
+    virtual future<> run() override {
+      return with_scheduling_group(_cfg.sg, [this] {
+        return parallel_for_each(boost::irange(0u, _cfg.parallelism), [this] (auto) {
+            return _client.make_stream_sink<serializer, sstring>().then([this] (rpc::sink<sstring> sink) {
+                return _rpc.make_client<rpc::source<uint64_t> (rpc::sink<sstring>)>(rpc_verb::STREAM)(_client, sink).then([this, sink] (rpc::source<uint64_t> source) {
+                    return do_with(stream(sink, std::move(source)), [this] (stream& s) {
+                        return when_all_succeed(send(s), receive(s)).discard_result();
+                    });
+                });
+            });
+        });
+      });
     }
 };
 
@@ -258,18 +466,39 @@ static std::unique_ptr<job> make_job(job_config cfg, rpc_protocol& rpc, rpc_prot
     if (cfg.type == "rpc") {
         return std::make_unique<job_rpc>(cfg, rpc, client);
     }
+    if (cfg.type == "stream") {
+        return std::make_unique<job_stream>(cfg, rpc, client);
+    }
 
     throw std::runtime_error("unknown job type");
 }
 
 class context {
+    rpc::lz4_compressor::factory _lz4;
+    rpc::lz4_fragmented_compressor::factory _lz4_fragmented;
+    rpc::zstd_compressor::factory _zstd;
+    // The server accepts all the compressors the jobs may ask for
+    rpc::multi_algo_compressor_factory _server_compressors{&_lz4, &_lz4_fragmented, &_zstd};
     std::unique_ptr<rpc_protocol> _rpc;
     std::unique_ptr<rpc_protocol::server> _server;
     std::unique_ptr<rpc_protocol::client> _client;
+    // The connections of the jobs with a compressor, which have their own
+    std::vector<std::unique_ptr<rpc_protocol::client>> _job_clients;
     promise<> _bye;
     config _cfg;
     std::vector<std::unique_ptr<job>> _jobs;
 
+    rpc::compressor::factory* compressor_factory(const std::string& name) {
+        if (name == "lz4") {
+            return &_lz4;
+        } else if (name == "lz4_fragmented") {
+            return &_lz4_fragmented;
+        } else if (name == "zstd") {
+            return &_zstd;
+        }
+        throw std::runtime_error(fmt::format("unknown compressor {}", name));
+    }
+
 public:
     context(std::optional<ipv4_addr> laddr, std::optional<ipv4_addr> caddr, uint16_t port, config cfg)
             : _rpc(std::make_unique<rpc_protocol>(serializer{}))
@@ -285,10 +514,36 @@ class context {
         _rpc->register_handler(rpc_verb::ECHO, [] (uint64_t val) {
             return make_ready_future<uint64_t>(val);
         });
+        _rpc->register_handler(rpc_verb::WRITE, [] (sstring payload) {
+            return make_ready_future<uint64_t>(payload.size());
+        });
+        _rpc->register_handler(rpc_verb::STREAM, [] (rpc::source<sstring> source) {
+            auto sink = source.make_sink<serializer, uint64_t>();
+            // Acknowledges each message with its size, till the client closes the stream
+            (void)repeat([source, sink] () mutable {
+                return source().then([sink] (std::optional<std::tuple<sstring>> data) mutable {
+                    if (!data) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    return sink(std::get<0>(*data).size()).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            }).finally([sink] () mutable {
+                return sink.flush();
+            }).finally([sink] () mutable {
+                return sink.close();
+            }).handle_exception([] (std::exception_ptr ep) {
+                fmt::print("stream error: {}\n", ep);
+            });
+            return sink;
+        });
 
         if (laddr) {
             rpc::server_options so;
             so.tcp_nodelay = _cfg.server.nodelay;
+            so.compressor_factory = &_server_compressors;
+            so.streaming_domain = rpc::streaming_domain_type(1);
             rpc::resource_limits limits;
             _server = std::make_unique<rpc_protocol::server>(*_rpc, so, *laddr, limits);
         }
@@ -299,7 +554,14 @@ class context {
             _client = std::make_unique<rpc_protocol::client>(*_rpc, co, *caddr);
 
             for (auto&& jc : _cfg.jobs) {
-                _jobs.push_back(make_job(jc, *_rpc, *_client));
+                auto* client = _client.get();
+                if (!jc.compressor.empty()) {
+                    auto jco = co;
+                    jco.compressor_factory = compressor_factory(jc.compressor);
+                    _job_clients.push_back(std::make_unique<rpc_protocol::client>(*_rpc, jco, *caddr));
+                    client = _job_clients.back().get();
+                }
+                _jobs.push_back(make_job(jc, *_rpc, *client));
             }
         }
     }
@@ -315,7 +577,11 @@ class context {
     future<> stop() {
         if (_client) {
             return _rpc->make_client<void()>(rpc_verb::BYE)(*_client).finally([this] {
-                return _client->stop();
+                return parallel_for_each(_job_clients, [] (auto& c) {
+                    return c->stop();
+                }).finally([this] {
+                    return _client->stop();
+                });
             });
         }
 
@@ -19,158 +19,161 @@
  * Copyright (C) 2015 Cloudius Systems, Ltd.
  */
 
-#include <seastar/http/response_parser.hh>
-#include <seastar/net/api.hh>
+#include <seastar/http/client.hh>
+#include <seastar/http/request.hh>
+#include <seastar/net/inet_address.hh>
 #include <seastar/core/seastar.hh>
 #include <seastar/core/print.hh>
 #include <seastar/core/app-template.hh>
 #include <seastar/core/distributed.hh>
-#include <seastar/core/semaphore.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/util/short_streams.hh>
+#include "../lib/latency_histogram.hh"
 #include <chrono>
+#include <random>
 
 using namespace seastar;
+using namespace std::chrono_literals;
+using seastar_apps_lib::latency_histogram;
 
-template <typename... Args>
-void http_debug(const char* fmt, Args&&... args) {
-#if HTTP_DEBUG
-    print(fmt, std::forward<Args>(args)...);
-#endif
-}
+namespace bpo = boost::program_options;
 
-class http_client {
-private:
-    unsigned _duration;
-    unsigned _conn_per_core;
-    unsigned _reqs_per_conn;
-    std::vector<connected_socket> _sockets;
-    semaphore _conn_connected{0};
-    semaphore _conn_finished{0};
-    timer<> _run_timer;
-    bool _timer_based;
-    bool _timer_done{false};
-    uint64_t _total_reqs{0};
-public:
-    http_client(unsigned duration, unsigned total_conn, unsigned reqs_per_conn)
-        : _duration(duration)
-        , _conn_per_core(total_conn / smp::count)
-        , _reqs_per_conn(reqs_per_conn)
-        , _run_timer([this] { _timer_done = true; })
-        , _timer_based(reqs_per_conn == 0) {
-    }
+// How requests are made: the template of the requests, and with rate, the
+// number of requests per second each shard starts, regardless of the
+// responses, instead of each connection making a request when it got the
+// response to the previous one
+struct load_config {
+    socket_address server;
+    sstring host;
+    sstring method;
+    sstring path;
+    std::vector<std::pair<sstring, sstring>> headers;
+    sstring body;
+    bool keep_alive;
+    unsigned conn_per_core;
+    unsigned reqs_per_conn;
+    std::chrono::seconds duration;
+    double rate;
+    bool poisson;
+};
+
+class http_load {
+    load_config _cfg;
+    http::experimental::client _client;
+    gate _in_flight;
+    bool _done = false;
+    uint64_t _total_reqs = 0;
+    uint64_t _errors = 0;
+    latency_histogram _latencies;
+    std::default_random_engine _rng{std::random_device()()};
 
-    class connection {
-    private:
-        connected_socket _fd;
-        input_stream<char> _read_buf;
-        output_stream<char> _write_buf;
-        http_response_parser _parser;
-        http_client* _http_client;
-        uint64_t _nr_done{0};
-    public:
-        connection(connected_socket&& fd, http_client* client)
-            : _fd(std::move(fd))
-            , _read_buf(_fd.input())
-            , _write_buf(_fd.output())
-            , _http_client(client){
+    httpd::request make_request() const {
+        auto req = httpd::request::make(_cfg.method, _cfg.host, _cfg.path);
+        for (auto& [name, value] : _cfg.headers) {
+            req._headers[name] = value;
+        }
+        if (!_cfg.keep_alive) {
+            req._headers["Connection"] = "close";
         }
+        req.content = _cfg.body;
+        return req;
+    }
+
+    // Latencies are measured from start, which for the open loop is when the
+    // request was meant to be sent, so that the time requests wait for the
+    // ones before them counts, which a closed loop omits
+    future<> do_req(steady_clock_type::time_point start) {
+        return _client.make_request(make_request(), [] (const httpd::reply& rep, input_stream<char>& body) {
+            return util::skip_entire_stream(body);
+        }).then_wrapped([this, start] (future<> f) {
+            _total_reqs++;
+            if (f.failed()) {
+                _errors++;
+                auto ex = f.get_exception();
+                if (_errors == 1) {
+                    fmt::print("http request error: {}\n", ex);
+                }
+                return;
+            }
+            _latencies.record(std::chrono::duration_cast<std::chrono::microseconds>(steady_clock_type::now() - start));
+        });
+    }
 
-        uint64_t nr_done() {
-            return _nr_done;
+    future<> run_closed_loop() {
+        return parallel_for_each(boost::irange(0u, _cfg.conn_per_core), [this] (unsigned) {
+            return do_with(uint64_t(0), [this] (uint64_t& nr_done) {
+                return do_until([this, &nr_done] {
+                    return _cfg.reqs_per_conn ? nr_done >= _cfg.reqs_per_conn : _done;
+                }, [this, &nr_done] {
+                    nr_done++;
+                    return do_req(steady_clock_type::now());
+                });
+            });
+        });
+    }
+
+    std::chrono::nanoseconds next_interval() {
+        double mean = 1e9 / (_cfg.rate / smp::count);
+        if (_cfg.poisson) {
+            mean = std::exponential_distribution<double>(1 / mean)(_rng);
         }
+        return std::chrono::nanoseconds(int64_t(mean));
+    }
 
-        future<> do_req() {
-            return _write_buf.write("GET / HTTP/1.1\r\nHost: 127.0.0.1:10000\r\n\r\n").then([this] {
-                return _write_buf.flush();
-            }).then([this] {
-                _parser.init();
-                return _read_buf.consume(_parser).then([this] {
-                    // Read HTTP response header first
-                    if (_parser.eof()) {
-                        return make_ready_future<>();
-                    }
-                    auto _rsp = _parser.get_parsed_response();
-                    auto it = _rsp->_headers.find("Content-Length");
-                    if (it == _rsp->_headers.end()) {
-                        fmt::print("Error: HTTP response does not contain: Content-Length\n");
-                        return make_ready_future<>();
-                    }
-                    auto content_len = std::stoi(it->second);
-                    http_debug("Content-Length = %d\n", content_len);
-                    // Read HTTP response body
-                    return _read_buf.read_exactly(content_len).then([this] (temporary_buffer<char> buf) {
-                        _nr_done++;
-                        http_debug("%s\n", buf.get());
-                        if (_http_client->done(_nr_done)) {
-                            return make_ready_future();
-                        } else {
-                            return do_req();
-                        }
+    future<> run_open_loop() {
+        return do_with(steady_clock_type::now(), [this] (steady_clock_type::time_point& next) {
+            return do_until([this] { return _done; }, [this, &next] {
+                // Start all the requests that are due, as the timer may be
+                // late, or the intervals shorter than its resolution
+                auto now = steady_clock_type::now();
+                while (next <= now) {
+                    (void)with_gate(_in_flight, [this, start = next] {
+                        return do_req(start);
                     });
-                });
+                    next += next_interval();
+                }
+                return seastar::sleep(next - now);
+            }).then([this] {
+                return _in_flight.close();
             });
+        });
+    }
+public:
+    explicit http_load(load_config cfg)
+        : _cfg(std::move(cfg))
+        , _client(_cfg.server, _cfg.host, http::experimental::client::config{_cfg.conn_per_core, 1}) {
+    }
+
+    future<> run() {
+        timer<> run_timer([this] { _done = true; });
+        if (_cfg.rate || !_cfg.reqs_per_conn) {
+            run_timer.arm(_cfg.duration);
         }
-    };
+        return do_with(std::move(run_timer), [this] (timer<>&) {
+            return _cfg.rate ? run_open_loop() : run_closed_loop();
+        });
+    }
 
     future<uint64_t> total_reqs() {
         fmt::print("Requests on cpu {:2d}: {:d}\n", this_shard_id(), _total_reqs);
         return make_ready_future<uint64_t>(_total_reqs);
     }
 
-    bool done(uint64_t nr_done) {
-        if (_timer_based) {
-            return _timer_done;
-        } else {
-            return nr_done >= _reqs_per_conn;
-        }
+    uint64_t errors() const noexcept {
+        return _errors;
     }
 
-    future<> connect(ipv4_addr server_addr) {
-        // Establish all the TCP connections first
-        for (unsigned i = 0; i < _conn_per_core; i++) {
-            // Connect in the background, signal _conn_connected when done.
-            (void)seastar::connect(make_ipv4_address(server_addr)).then([this] (connected_socket fd) {
-                _sockets.push_back(std::move(fd));
-                http_debug("Established connection %6d on cpu %3d\n", _conn_connected.current(), this_shard_id());
-                _conn_connected.signal();
-            }).or_terminate();
-        }
-        return _conn_connected.wait(_conn_per_core);
+    latency_histogram latencies() const {
+        return _latencies;
     }
 
-    future<> run() {
-        // All connected, start HTTP request
-        http_debug("Established all %6d tcp connections on cpu %3d\n", _conn_per_core, this_shard_id());
-        if (_timer_based) {
-            _run_timer.arm(std::chrono::seconds(_duration));
-        }
-        for (auto&& fd : _sockets) {
-            auto conn = new connection(std::move(fd), this);
-            // Run in the background, signal _conn_finished when done.
-            (void)conn->do_req().then_wrapped([this, conn] (auto&& f) {
-                http_debug("Finished connection %6d on cpu %3d\n", _conn_finished.current(), this_shard_id());
-                _total_reqs += conn->nr_done();
-                _conn_finished.signal();
-                delete conn;
-                // FIXME: should _conn_finished.signal be called only after this?
-                // nothing seems to synchronize with this background work.
-                try {
-                    f.get();
-                } catch (std::exception& ex) {
-                    fmt::print("http request error: {}\n", ex.what());
-                }
-            });
-        }
-
-        // All finished
-        return _conn_finished.wait(_conn_per_core);
-    }
     future<> stop() {
-        return make_ready_future();
+        return _client.close();
     }
 };
 
-namespace bpo = boost::program_options;
-
 int main(int ac, char** av) {
     app_template::config app_cfg;
     app_cfg.auto_handle_sigint_sigterm = false;
@@ -179,50 +182,94 @@ int main(int ac, char** av) {
     app.add_options()
         ("server,s", bpo::value<std::string>()->default_value("192.168.66.100:10000"), "Server address")
         ("conn,c", bpo::value<unsigned>()->default_value(100), "total connections")
-        ("reqs,r", bpo::value<unsigned>()->default_value(0), "reqs per connection")
-        ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of the test in seconds)");
+        ("reqs,r", bpo::value<unsigned>()->default_value(0), "reqs per connection, in the closed loop")
+        ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of the test in seconds)")
+        ("rate,R", bpo::value<double>()->default_value(0),
+            "total requests per second to send regardless of the responses, 0 for a closed loop where each "
+            "connection sends a request once it got the response to the previous one")
+        ("poisson", bpo::bool_switch(), "with --rate, send requests at exponentially distributed intervals "
+            "instead of evenly spaced ones")
+        ("method", bpo::value<std::string>()->default_value("GET"), "request method")
+        ("path", bpo::value<std::string>()->default_value("/"), "request target")
+        ("host", bpo::value<std::string>(), "Host header, the server address by default")
+        ("header,H", bpo::value<std::vector<std::string>>()->composing(), "\"name: value\" header to add to requests, "
+            "may be repeated")
+        ("body", bpo::value<std::string>()->default_value(""), "request body")
+        ("keep-alive", bpo::value<bool>()->default_value(true), "reuse connections, or else ask the server to "
+            "close them after each response")
+        ("print-spectrum", bpo::bool_switch(), "print the detailed latency percentile spectrum");
 
     return app.run(ac, av, [&app] () -> future<int> {
         auto& config = app.configuration();
         auto server = config["server"].as<std::string>();
-        auto reqs_per_conn = config["reqs"].as<unsigned>();
         auto total_conn= config["conn"].as<unsigned>();
-        auto duration = config["duration"].as<unsigned>();
 
         if (total_conn % smp::count != 0) {
             fmt::print("Error: conn needs to be n * cpu_nr\n");
             return make_ready_future<int>(-1);
         }
 
-        auto http_clients = new distributed<http_client>;
+        load_config cfg;
+        ipv4_addr addr{server};
+        cfg.server = make_ipv4_address(addr);
+        cfg.host = config.count("host") ? config["host"].as<std::string>() : server;
+        cfg.method = config["method"].as<std::string>();
+        cfg.path = config["path"].as<std::string>();
+        if (config.count("header")) {
+            for (auto& h : config["header"].as<std::vector<std::string>>()) {
+                auto colon = h.find(':');
+                if (colon == std::string::npos) {
+                    fmt::print("Error: header {} is not in the \"name: value\" form\n", h);
+                    return make_ready_future<int>(-1);
+                }
+                auto value = h.find_first_not_of(' ', colon + 1);
+                cfg.headers.emplace_back(h.substr(0, colon), value == std::string::npos ? "" : h.substr(value));
+            }
+        }
+        cfg.body = config["body"].as<std::string>();
+        cfg.keep_alive = config["keep-alive"].as<bool>();
+        cfg.conn_per_core = total_conn / smp::count;
+        cfg.reqs_per_conn = config["reqs"].as<unsigned>();
+        cfg.duration = std::chrono::seconds(config["duration"].as<unsigned>());
+        cfg.rate = config["rate"].as<double>();
+        cfg.poisson = config["poisson"].as<bool>();
+        auto spectrum = config["print-spectrum"].as<bool>();
+
+        auto http_clients = new distributed<http_load>;
 
         // Start http requests on all the cores
         auto started = steady_clock_type::now();
         fmt::print("========== http_client ============\n");
         fmt::print("Server: {}\n", server);
         fmt::print("Connections: {:d}\n", total_conn);
-        fmt::print("Requests/connection: {}\n", reqs_per_conn == 0 ? "dynamic (timer based)" : std::to_string(reqs_per_conn));
-        return http_clients->start(std::move(duration), std::move(total_conn), std::move(reqs_per_conn)).then([http_clients, server] {
-            return http_clients->invoke_on_all(&http_client::connect, ipv4_addr{server});
-        }).then([http_clients] {
-            return http_clients->invoke_on_all(&http_client::run);
+        if (cfg.rate) {
+            fmt::print("Rate: {} requests/sec, {}\n", cfg.rate, cfg.poisson ? "poisson" : "constant");
+        } else {
+            fmt::print("Requests/connection: {}\n", cfg.reqs_per_conn == 0 ? "dynamic (timer based)" : std::to_string(cfg.reqs_per_conn));
+        }
+        return http_clients->start(std::move(cfg)).then([http_clients] {
+            return http_clients->invoke_on_all(&http_load::run);
         }).then([http_clients] {
-            return http_clients->map_reduce(adder<uint64_t>(), &http_client::total_reqs);
-        }).then([http_clients, started] (auto total_reqs) {
+            return http_clients->map_reduce(adder<uint64_t>(), &http_load::total_reqs);
+        }).then([http_clients, started, spectrum] (auto total_reqs) {
            // All the http requests are finished
            auto finished = steady_clock_type::now();
            auto elapsed = finished - started;
            auto secs = static_cast<double>(elapsed.count() / 1000000000.0);
-           fmt::print("Total cpus: {:d}\n", smp::count);
-           fmt::print("Total requests: {:d}\n", total_reqs);
-           fmt::print("Total time: {:f}\n", secs);
-           fmt::print("Requests/sec: {:f}\n", static_cast<double>(total_reqs) / secs);
-           fmt::print("==========     done     ============\n");
+           return http_clients->map_reduce0(std::mem_fn(&http_load::errors), uint64_t(0), std::plus<uint64_t>()).then([=] (uint64_t errors) {
+               return http_clients->map_reduce0(std::mem_fn(&http_load::latencies), latency_histogram(),
+                       [] (latency_histogram a, const latency_histogram& b) { return std::move(a += b); }).then([=] (latency_histogram latencies) {
+                   fmt::print("Total cpus: {:d}\n", smp::count);
+                   fmt::print("Total requests: {:d}\n", total_reqs);
+                   fmt::print("Errors: {:d}\n", errors);
+                   fmt::print("Total time: {:f}\n", secs);
+                   fmt::print("Requests/sec: {:f}\n", static_cast<double>(total_reqs) / secs);
+                   latencies.print(spectrum);
+                   fmt::print("==========     done     ============\n");
+               });
+           });
+        }).then([http_clients] {
            return http_clients->stop().then([http_clients] {
-               // FIXME: If we call engine().exit(0) here to exit when
-               // requests are done. The tcp connection will not be closed
-               // properly, becasue we exit too earily and the FIN packets are
-               // not exchanged.
                 delete http_clients;
                 return make_ready_future<int>(0);
            });
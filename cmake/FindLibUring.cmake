@@ -0,0 +1,61 @@
+#
+# This file is open source software, licensed to you under the terms
+# of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+# distributed with this work for additional information regarding copyright
+# ownership.  You may not use this file except in compliance with the License.
+#
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+#
+# Copyright (C) 2022 Scylladb, Ltd.
+#
+
+find_package (PkgConfig REQUIRED)
+
+pkg_search_module (LibUring_PC liburing)
+
+find_library (LibUring_LIBRARY
+  NAMES uring
+  HINTS
+    ${LibUring_PC_LIBDIR}
+    ${LibUring_PC_LIBRARY_DIRS})
+
+find_path (LibUring_INCLUDE_DIR
+  NAMES liburing.h
+  HINTS
+    ${LibUring_PC_INCLUDEDIR}
+    ${LibUring_PC_INCLUDEDIRS})
+
+mark_as_advanced (
+  LibUring_LIBRARY
+  LibUring_INCLUDE_DIR)
+
+include (FindPackageHandleStandardArgs)
+
+find_package_handle_standard_args (LibUring
+  REQUIRED_VARS
+    LibUring_LIBRARY
+    LibUring_INCLUDE_DIR
+  VERSION_VAR LibUring_PC_VERSION)
+
+set (LibUring_LIBRARIES ${LibUring_LIBRARY})
+set (LibUring_INCLUDE_DIRS ${LibUring_INCLUDE_DIR})
+
+if (LibUring_FOUND AND NOT (TARGET URING::uring))
+  add_library (URING::uring UNKNOWN IMPORTED)
+
+  set_target_properties (URING::uring
+    PROPERTIES
+      IMPORTED_LOCATION ${LibUring_LIBRARY}
+      INTERFACE_INCLUDE_DIRECTORIES ${LibUring_INCLUDE_DIRS})
+endif ()
@@ -29,6 +29,7 @@ find_library (dpdk_PMD_I40E_LIBRARY rte_pmd_i40e)
 find_library (dpdk_PMD_IXGBE_LIBRARY rte_pmd_ixgbe)
 find_library (dpdk_PMD_E1000_LIBRARY rte_pmd_e1000)
 find_library (dpdk_PMD_BNXT_LIBRARY rte_pmd_bnxt)
+find_library (dpdk_PMD_BOND_LIBRARY rte_pmd_bond)
 find_library (dpdk_PMD_RING_LIBRARY rte_pmd_ring)
 find_library (dpdk_PMD_CXGBE_LIBRARY rte_pmd_cxgbe)
 find_library (dpdk_PMD_ENA_LIBRARY rte_pmd_ena)
@@ -62,6 +63,7 @@ set (dpdk_REQUIRED
   dpdk_PMD_IXGBE_LIBRARY
   dpdk_PMD_E1000_LIBRARY
   dpdk_PMD_BNXT_LIBRARY
+  dpdk_PMD_BOND_LIBRARY
   dpdk_PMD_RING_LIBRARY
   dpdk_PMD_CXGBE_LIBRARY
   dpdk_PMD_ENA_LIBRARY
@@ -109,6 +111,7 @@ if (dpdk_FOUND AND NOT (TARGET dpdk::dpdk))
     ${dpdk_MEMPOOL_LIBRARY}
     ${dpdk_MEMPOOL_RING_LIBRARY}
     ${dpdk_PMD_BNXT_LIBRARY}
+    ${dpdk_PMD_BOND_LIBRARY}
     ${dpdk_PMD_E1000_LIBRARY}
     ${dpdk_PMD_ENA_LIBRARY}
     ${dpdk_PMD_ENIC_LIBRARY}
@@ -190,6 +193,17 @@ if (dpdk_FOUND AND NOT (TARGET dpdk::dpdk))
       IMPORTED_LOCATION ${dpdk_PMD_BNXT_LIBRARY}
       INTERFACE_INCLUDE_DIRECTORIES ${dpdk_INCLUDE_DIR})
 
+  #
+  # pmd_bond
+  #
+
+  add_library (dpdk::pmd_bond UNKNOWN IMPORTED)
+
+  set_target_properties (dpdk::pmd_bond
+    PROPERTIES
+      IMPORTED_LOCATION ${dpdk_PMD_BOND_LIBRARY}
+      INTERFACE_INCLUDE_DIRECTORIES ${dpdk_INCLUDE_DIR})
+
   #
   # pmd_ring
   #
@@ -463,6 +477,7 @@ if (dpdk_FOUND AND NOT (TARGET dpdk::dpdk))
     dpdk::mempool
     dpdk::mempool_ring
     dpdk::pmd_bnxt
+    dpdk::pmd_bond
     dpdk::pmd_cxgbe
     dpdk::pmd_e1000
     dpdk::pmd_ena
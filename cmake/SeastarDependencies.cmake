@@ -58,6 +58,7 @@ macro (seastar_find_dependencies)
     # Private and private/public dependencies.
     Concepts
     GnuTLS
+    LibUring
     LinuxMembarrier
     Sanitizers
     StdAtomic
@@ -65,7 +66,9 @@ macro (seastar_find_dependencies)
     lksctp-tools # No version information published.
     numactl # No version information published.
     rt
-    yaml-cpp)
+    yaml-cpp
+    ZLIB
+    zstd)
 
   # Arguments to `find_package` for each 3rd-party dependency.
   # Note that the version specification is a "minimal" version requirement.
@@ -87,11 +90,14 @@ macro (seastar_find_dependencies)
   set (_seastar_dep_args_fmt 5.0.0 REQUIRED)
   set (_seastar_dep_args_lz4 1.7.3 REQUIRED)
   set (_seastar_dep_args_GnuTLS 3.3.26 REQUIRED)
+  set (_seastar_dep_args_LibUring 2.0)
   set (_seastar_dep_args_StdAtomic REQUIRED)
   set (_seastar_dep_args_hwloc 1.11.2)
   set (_seastar_dep_args_lksctp-tools REQUIRED)
   set (_seastar_dep_args_rt REQUIRED)
   set (_seastar_dep_args_yaml-cpp 0.5.1 REQUIRED)
+  set (_seastar_dep_args_ZLIB 1.2.11 REQUIRED)
+  set (_seastar_dep_args_zstd 1.4.0 REQUIRED)
 
   foreach (third_party ${_seastar_all_dependencies})
     find_package ("${third_party}" ${_seastar_dep_args_${third_party}})
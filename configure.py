@@ -90,6 +90,11 @@ add_tristate(
     name = 'hwloc',
     dest = 'hwloc',
     help = 'hwloc support')
+add_tristate(
+    arg_parser,
+    name = 'io_uring',
+    dest = 'io_uring',
+    help = 'io_uring support')
 add_tristate(
     arg_parser,
     name = 'alloc-failure-injector',
@@ -100,6 +105,16 @@ add_tristate(
     name = 'task-backtrace',
     dest = 'task_backtrace',
     help = 'Collect backtrace at deferring points')
+add_tristate(
+    arg_parser,
+    name = 'timer-wheel',
+    dest = 'timer_wheel',
+    help = 'Keep reactor timers in a hierarchical timer wheel')
+add_tristate(
+    arg_parser,
+    name = 'coroutine-frame-pool',
+    dest = 'coroutine_frame_pool',
+    help = 'Recycle coroutine frames through per-shard freelists')
 add_tristate(
     arg_parser,
     name = 'unused-result-error',
@@ -196,8 +211,11 @@ def configure_mode(mode):
         tr(args.dpdk, 'DPDK'),
         tr(infer_dpdk_machine(args.user_cflags), 'DPDK_MACHINE'),
         tr(args.hwloc, 'HWLOC', value_when_none='yes'),
+        tr(args.io_uring, 'IO_URING', value_when_none='yes'),
         tr(args.alloc_failure_injection, 'ALLOC_FAILURE_INJECTION', value_when_none='DEFAULT'),
         tr(args.task_backtrace, 'TASK_BACKTRACE'),
+        tr(args.timer_wheel, 'TIMER_WHEEL'),
+        tr(args.coroutine_frame_pool, 'COROUTINE_FRAME_POOL'),
         tr(args.alloc_page_size, 'ALLOC_PAGE_SIZE'),
         tr(args.split_dwarf, 'SPLIT_DWARF'),
         tr(args.heap_profiling, 'HEAP_PROFILING'),
@@ -28,6 +28,7 @@
 #include <seastar/core/loop.hh>
 #include <seastar/core/thread.hh>
 #include <seastar/util/defer.hh>
+#include <seastar/util/short_streams.hh>
 
 using namespace seastar;
 using namespace seastar::experimental;
@@ -37,6 +38,13 @@ int main(int argc, char** argv) {
     app.run(argc, argv, [] () -> seastar::future<> {
         return async([] {
             websocket::server ws;
+            ws.set_permessage_deflate(true);
+            // Echoes the messages back
+            ws.set_handler([] (websocket::connection& conn, websocket::message_type type, input_stream<char>& message) {
+                return util::read_entire_stream_contiguous(message).then([&conn, type] (sstring msg) {
+                    return conn.send_message(type, temporary_buffer<char>(msg.data(), msg.size()));
+                });
+            });
             auto d = defer([&ws] () noexcept {
                 ws.stop().get();
             });
@@ -24,6 +24,8 @@
 #include <seastar/core/abort_source.hh>
 #include <seastar/core/timer.hh>
 #include <seastar/core/lowres_clock.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <map>
 
 namespace seastar {
 
@@ -55,6 +57,100 @@ class abort_on_expiry {
     }
 };
 
+/// Ties many timeouts to abort sources with a single timer
+///
+/// Where \ref abort_on_expiry arms a timer per timeout, a server with a
+/// deadline per request can get the abort source of each deadline from
+/// a group instead. Deadlines are rounded up to a multiple of the
+/// group's granularity, and the requests of a rounded deadline share its
+/// abort source, so they abort up to a granularity late, never early.
+/// One timer, armed for the earliest deadline, aborts the sources in
+/// turn with abort_source::request_abort_preemptible().
+///
+/// Given a parent abort source, such as the one stopping the server,
+/// aborting it aborts all the deadlines of the group, and the ones asked
+/// for later, through a single subscription.
+template<typename Clock = lowres_clock>
+class abort_on_expiry_group {
+public:
+    using clock = Clock;
+    using duration = typename Clock::duration;
+    using time_point = typename Clock::time_point;
+private:
+    const duration _granularity;
+    std::map<time_point, lw_shared_ptr<seastar::abort_source>> _deadlines;
+    timer<Clock> _tr;
+    optimized_optional<seastar::abort_source::subscription> _parent_sub;
+    bool _aborted = false;
+
+    static void abort(lw_shared_ptr<seastar::abort_source> as) noexcept {
+        (void)as->request_abort_preemptible().finally([as] {});
+    }
+
+    void expire() noexcept {
+        auto now = Clock::now();
+        while (!_deadlines.empty() && _deadlines.begin()->first <= now) {
+            abort(std::move(_deadlines.begin()->second));
+            _deadlines.erase(_deadlines.begin());
+        }
+        if (!_deadlines.empty()) {
+            _tr.arm(_deadlines.begin()->first);
+        }
+    }
+
+    void abort_all() noexcept {
+        _aborted = true;
+        _tr.cancel();
+        for (auto& d : _deadlines) {
+            abort(std::move(d.second));
+        }
+        _deadlines.clear();
+    }
+public:
+    /// \param granularity how much later than their deadline requests may be aborted
+    /// \param parent if given, aborts all deadlines when aborted; must outlive the group
+    explicit abort_on_expiry_group(duration granularity, seastar::abort_source* parent = nullptr)
+            : _granularity(granularity)
+            , _tr([this] { expire(); }) {
+        if (parent) {
+            _parent_sub = parent->subscribe([this] () noexcept { abort_all(); });
+            _aborted = !_parent_sub;
+        }
+    }
+    abort_on_expiry_group(abort_on_expiry_group&&) = delete;
+
+    /// \returns the abort source aborted once \c deadline passed, already
+    ///          aborted if the parent was. The source stays valid for as long
+    ///          as it is referenced, the group going away only stops the
+    ///          pending deadlines from being aborted.
+    lw_shared_ptr<seastar::abort_source> get(time_point deadline) {
+        if (_aborted) {
+            auto as = make_lw_shared<seastar::abort_source>();
+            as->request_abort();
+            return as;
+        }
+        auto g = _granularity.count();
+        auto rounded = time_point(duration((deadline.time_since_epoch().count() + g - 1) / g * g));
+        // Requests mostly share a timeout, so deadlines come in order
+        if (!_deadlines.empty() && _deadlines.rbegin()->first == rounded) {
+            return _deadlines.rbegin()->second;
+        }
+        auto it = _deadlines.find(rounded);
+        if (it == _deadlines.end()) {
+            it = _deadlines.emplace(rounded, make_lw_shared<seastar::abort_source>()).first;
+            if (it == _deadlines.begin()) {
+                _tr.rearm(rounded);
+            }
+        }
+        return it->second;
+    }
+
+    /// \returns how many deadlines are pending
+    size_t pending() const noexcept {
+        return _deadlines.size();
+    }
+};
+
 /// @}
 
 }
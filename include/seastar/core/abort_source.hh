@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <seastar/core/future.hh>
 #include <seastar/util/noncopyable_function.hh>
 #include <seastar/util/optimized_optional.hh>
 #include <seastar/util/std-compat.hh>
@@ -47,7 +48,8 @@ class abort_requested_exception : public std::exception {
 
 /// Facility to communicate a cancellation request to a fiber.
 /// Callbacks can be registered with the \c abort_source, which are called
-/// atomically with a call to request_abort().
+/// atomically with a call to request_abort(), or in as many tasks as it
+/// takes with request_abort_preemptible().
 class abort_source {
     using subscription_callback_type = noncopyable_function<void() noexcept>;
 
@@ -96,6 +98,8 @@ class abort_source {
 private:
     using subscription_list_type = bi::list<subscription, bi::constant_time_size<false>>;
     std::optional<subscription_list_type> _subscriptions = subscription_list_type();
+    // The subscriptions request_abort_preemptible() has yet to call
+    subscription_list_type _aborting;
 
 public:
     /// Delays the invocation of the callback \c f until \ref request_abort() is called.
@@ -112,10 +116,27 @@ class abort_source {
 
     /// Requests that the target operation be aborted. Current subscriptions
     /// are invoked inline with this call, and no new ones can be registered.
+    /// Also calls the ones a request_abort_preemptible() in progress has
+    /// yet to.
     void request_abort() noexcept {
-        std::exchange(_subscriptions, std::nullopt)->clear_and_dispose([] (subscription* s) { s->on_abort(); });
+        if (_subscriptions) {
+            _aborting.splice(_aborting.end(), *_subscriptions);
+            _subscriptions = std::nullopt;
+        }
+        _aborting.clear_and_dispose([] (subscription* s) { s->on_abort(); });
     }
 
+    /// Requests that the target operation be aborted, calling the current
+    /// subscriptions in batches that yield when the task quota runs out,
+    /// so that an abort_source with many subscriptions doesn't stall the
+    /// reactor. abort_requested() is \c true and no new subscriptions can
+    /// be registered right away; subscriptions destroyed before their turn
+    /// aren't called.
+    ///
+    /// The abort_source must be kept alive until the returned future
+    /// resolves. Does nothing if an abort was already requested.
+    future<> request_abort_preemptible() noexcept;
+
     /// Returns whether an abort has been requested.
     bool abort_requested() const noexcept {
         return !_subscriptions;
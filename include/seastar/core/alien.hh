@@ -26,10 +26,12 @@
 #include <deque>
 #include <future>
 #include <memory>
+#include <vector>
 
 #include <boost/lockfree/queue.hpp>
 
 #include <seastar/core/future.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/core/cacheline.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/metrics_registration.hh>
@@ -161,6 +163,49 @@ void run_on(unsigned shard, Func func) {
     run_on(*internal::default_instance, shard, std::move(func));
 }
 
+/// \brief Delivers results of calls made with submit_to() to an alien thread
+/// running an event loop
+///
+/// The queue has an eventfd, which becomes readable when some calls
+/// completed. The alien thread adds it to its event loop (epoll, asio,
+/// libuv...) and calls poll() when it becomes readable, which runs the
+/// callbacks of the completed calls. No thread needs to block on each
+/// outstanding call.
+///
+/// A queue belongs to one alien thread, but calls to any shard can use it.
+class completion_queue {
+public:
+    /// \cond internal
+    struct completion {
+        virtual ~completion() = default;
+        virtual void complete() = 0;
+    };
+    /// \endcond
+private:
+    boost::lockfree::queue<completion*> _completed;
+    int _fd;
+    // Whether the eventfd was signalled since the last poll(), so that
+    // a burst of completions costs a single write to it
+    std::atomic<bool> _signalled{false};
+public:
+    completion_queue();
+    ~completion_queue();
+    completion_queue(const completion_queue&) = delete;
+    completion_queue& operator=(const completion_queue&) = delete;
+    /// The eventfd to wait on for completions
+    int fd() const noexcept {
+        return _fd;
+    }
+    /// Runs the callbacks of the calls completed so far, on the calling
+    /// thread, and returns how many it ran. It never blocks. The callbacks
+    /// must not throw.
+    size_t poll();
+    /// \cond internal
+    // Called on a shard when a call completes
+    void push(std::unique_ptr<completion> c);
+    /// \endcond
+};
+
 namespace internal {
 template<typename Func>
 using return_value_t = typename futurize<std::invoke_result_t<Func>>::value_type;
@@ -186,6 +231,16 @@ struct return_type_of<Func, false> {
     }
 };
 template <typename Func> using return_type_t = typename return_type_of<Func>::type;
+
+template <typename T>
+struct batch_result_of {
+    using type = std::vector<T>;
+};
+template <>
+struct batch_result_of<void> {
+    using type = void;
+};
+template <typename T> using batch_result_t = typename batch_result_of<T>::type;
 }
 
 /// Runs a function on a remote shard from an alien thread where engine() is not available.
@@ -228,5 +283,86 @@ std::future<T> submit_to(unsigned shard, Func func) {
     return submit_to(*internal::default_instance, shard, std::move(func));
 }
 
+namespace internal {
+template <typename T, typename Callback>
+struct callback_completion : completion_queue::completion {
+    std::promise<T> pr;
+    Callback cb;
+    explicit callback_completion(Callback&& cb) : cb(std::move(cb)) {}
+    void complete() override {
+        cb(pr.get_future());
+    }
+};
+}
+
+/// Runs a function on a remote shard from an alien thread where engine() is not available,
+/// and passes its result to a callback once it completes, without blocking any thread.
+///
+/// \param instance designates the Seastar instance to process the message
+/// \param shard designates the shard to run the function on
+/// \param func a callable to run on \c shard.  If \c func is a temporary object,
+///          its lifetime will be extended by moving it.  If \c func is a reference,
+///          the caller must guarantee that it will survive the call.
+/// \param cq the queue that delivers the result, see \ref completion_queue
+/// \param cb a callable taking a \c std::future<T>, which is ready and holds whatever
+///          \c func returned. It runs on the alien thread, from \c cq.poll().
+/// \note \c cq must outlive the call
+template<typename Func, typename Callback, typename T = internal::return_type_t<Func>>
+void submit_to(instance& instance, unsigned shard, Func func, completion_queue& cq, Callback cb) {
+    auto c = std::make_unique<internal::callback_completion<T, Callback>>(std::move(cb));
+    run_on(instance, shard, [c = std::move(c), &cq, func = std::move(func)] () mutable {
+        (void)func().then_wrapped([c = std::move(c), &cq] (auto&& result) mutable {
+            try {
+                internal::return_type_of<Func>::set(c->pr, result.get());
+            } catch (...) {
+                c->pr.set_exception(std::current_exception());
+            }
+            cq.push(std::move(c));
+        });
+    });
+}
+
+/// Runs many functions on a remote shard from an alien thread where engine() is not available.
+///
+/// Each submit_to() allocates a message, pushes it to the shard's queue,
+/// possibly wakes the shard up, and resolves a \c std::promise. A batch
+/// takes all of that just once, for all of its functions.
+///
+/// \param instance designates the Seastar instance to process the message
+/// \param shard designates the shard to run the functions on
+/// \param funcs callables to run on \c shard, in their order. The ones that
+///          return futures run concurrently.
+/// \return the results of \c funcs in their order, as a
+///          \c std::future<std::vector<T>>, or a \c std::future<void> when
+///          they return nothing. If any of them fails, the future holds
+///          one of the exceptions.
+/// \note the caller must keep the returned future alive until \c funcs return
+template<typename Func, typename T = internal::return_type_t<Func>>
+std::future<internal::batch_result_t<T>> submit_batch(instance& instance, unsigned shard, std::vector<Func> funcs) {
+    std::promise<internal::batch_result_t<T>> pr;
+    auto fut = pr.get_future();
+    run_on(instance, shard, [pr = std::move(pr), funcs = std::move(funcs)] () mutable {
+        std::vector<futurize_t<std::invoke_result_t<Func>>> futures;
+        futures.reserve(funcs.size());
+        for (auto& func : funcs) {
+            futures.push_back(futurize_invoke(func));
+        }
+        // std::future returned via std::promise above.
+        (void)when_all_succeed(futures.begin(), futures.end()).then_wrapped([pr = std::move(pr)] (auto&& result) mutable {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    result.get();
+                    pr.set_value();
+                } else {
+                    pr.set_value(result.get0());
+                }
+            } catch (...) {
+                pr.set_exception(std::current_exception());
+            }
+        });
+    });
+    return fut;
+}
+
 }
 }
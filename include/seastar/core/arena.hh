@@ -0,0 +1,98 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/util/std-compat.hh>
+#include <cstddef>
+
+namespace seastar {
+
+/// \addtogroup memory-module
+/// @{
+
+/// A bump allocator for objects that die together.
+///
+/// Memory is carved sequentially out of chunks obtained from the seastar
+/// allocator. Deallocating a single object does nothing; all the memory is
+/// given back at once by \ref reset() or the destructor. Allocating thus
+/// costs a pointer increment most of the time, and freeing a whole request's
+/// worth of parsers, headers and temporaries costs one free per chunk.
+///
+/// Chunk sizes double, starting from the initial chunk size, and are powers
+/// of two, which the seastar allocator serves without internal waste.
+/// Allocations larger than half the chunk size get their own chunk, so
+/// they don't waste the rest of the current one.
+///
+/// An arena is a \c std::pmr::memory_resource, so standard containers can
+/// allocate from it through \c std::pmr::polymorphic_allocator. Destructors
+/// of objects allocated from it are not run by the arena, so it suits
+/// objects whose memory is all they own (or that are destroyed explicitly).
+///
+/// An arena is not thread safe, and should be used on the shard that
+/// created it.
+class arena final : public std::pmr::memory_resource {
+    struct chunk {
+        chunk* next;
+        size_t size;
+    };
+    // Chunks in use, the current one first. Large allocations are
+    // linked after the current one.
+    chunk* _chunks = nullptr;
+    char* _pos = nullptr;
+    char* _end = nullptr;
+    size_t _next_chunk_size;
+    size_t _reserved = 0;
+public:
+    static constexpr size_t default_initial_chunk_size = 4096;
+
+    /// Constructs an arena. No memory is allocated until the first allocation.
+    ///
+    /// \param initial_chunk_size size of the first chunk, rounded up to a power of two
+    explicit arena(size_t initial_chunk_size = default_initial_chunk_size) noexcept;
+    arena(arena&&) noexcept;
+    arena& operator=(arena&&) = delete;
+    ~arena();
+
+    /// Releases all memory allocated from the arena at once.
+    ///
+    /// The largest chunk is kept for the following allocations, so an arena
+    /// reused for a series of similar requests stops calling the underlying
+    /// allocator once it has grown large enough for them.
+    void reset() noexcept;
+
+    /// Total memory held by the arena, in bytes, including unused chunk space.
+    size_t reserved_memory() const noexcept { return _reserved; }
+protected:
+    virtual void* do_allocate(size_t bytes, size_t alignment) override;
+    virtual void do_deallocate(void*, size_t, size_t) noexcept override {}
+    virtual bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override {
+        return this == &o;
+    }
+private:
+    void* allocate_slow(size_t bytes, size_t alignment);
+    static chunk* allocate_chunk(size_t size);
+    void free_chunks(chunk* c) noexcept;
+};
+
+/// @}
+
+}
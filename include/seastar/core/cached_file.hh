@@ -0,0 +1,126 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/layered_file.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/metrics_registration.hh>
+#include <seastar/util/noncopyable_function.hh>
+#include <boost/intrusive/list.hpp>
+#include <map>
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// A cache of file blocks, for use by the files of one shard.
+///
+/// Seastar files bypass the kernel page cache. A block_cache keeps
+/// recently read blocks of the \ref make_cached_file() files layered on
+/// top of it in memory, evicting the least recently used ones when it
+/// goes over capacity or when the allocator runs low on memory.
+/// Concurrent reads of a block that is not cached share a single read
+/// of the underlying file.
+///
+/// The cache is not thread safe; create one per shard, e.g. with
+/// \ref sharded, and only layer files of the same shard on it.
+class block_cache {
+public:
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+    };
+private:
+    using key = std::pair<uint64_t, uint64_t>; // file id, block index
+
+    struct block {
+        key k;
+        temporary_buffer<char> data;
+        // Set while the block is being read, for others to wait on
+        lw_shared_ptr<shared_promise<>> loading;
+        boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> lru_link;
+    };
+    using lru_list = boost::intrusive::list<block,
+            boost::intrusive::member_hook<block, decltype(block::lru_link), &block::lru_link>,
+            boost::intrusive::constant_time_size<false>>;
+
+    size_t _capacity;
+    size_t _block_size;
+    size_t _used = 0;
+    uint64_t _next_file_id = 0;
+    std::map<key, block> _blocks;
+    lru_list _lru;
+    stats _stats;
+    memory::reclaimer _reclaimer;
+    metrics::metric_groups _metrics;
+
+    size_t evict(size_t bytes) noexcept;
+    void erase(std::map<key, block>::iterator it) noexcept;
+public:
+    /// Constructs a cache.
+    ///
+    /// \param capacity the number of bytes the cached blocks may take
+    /// \param block_size the size of a cache block; it's rounded up to the
+    ///        read alignment of the files layered on the cache
+    explicit block_cache(size_t capacity, size_t block_size = 4096);
+    block_cache(block_cache&&) = delete;
+    ~block_cache();
+
+    size_t capacity() const noexcept { return _capacity; }
+    size_t block_size() const noexcept { return _block_size; }
+    /// The number of bytes taken by cached blocks.
+    size_t used() const noexcept { return _used; }
+    const stats& get_stats() const noexcept { return _stats; }
+
+    /// Sets the capacity, evicting blocks if it shrinks.
+    void set_capacity(size_t capacity) noexcept;
+
+    /// \cond internal
+    uint64_t allocate_file_id() noexcept { return _next_file_id++; }
+
+    /// Returns the block, calling load() to read it if it's not cached.
+    future<temporary_buffer<char>> get(uint64_t file_id, uint64_t block_idx, noncopyable_function<future<temporary_buffer<char>> ()> load);
+
+    /// Drops the blocks [from, to) of a file.
+    void invalidate(uint64_t file_id, uint64_t from = 0, uint64_t to = std::numeric_limits<uint64_t>::max()) noexcept;
+    /// \endcond
+};
+
+/// Layers a cache over a file.
+///
+/// Reads of the returned file are served in units of cache blocks from
+/// the cache, and fill it on misses. Writes, discards and truncations
+/// go to the underlying file and drop the blocks they touch. The file
+/// cannot be dup()-ed to other shards.
+///
+/// \param f the file to cache
+/// \param cache the cache, which must outlive the file
+file make_cached_file(file f, block_cache& cache);
+
+/// @}
+
+}
@@ -0,0 +1,321 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/circular_buffer.hh>
+#include <seastar/core/condition-variable.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/smp.hh>
+#include <optional>
+#include <vector>
+
+namespace seastar {
+
+/// \addtogroup smp-module
+/// @{
+
+/// Exception thrown when pushing into or popping from a \ref channel
+/// whose receiving end was closed.
+class broken_channel : public std::exception {
+public:
+    virtual const char* what() const noexcept {
+        return "Channel is broken";
+    }
+};
+
+/// \brief A bounded channel passing items from one shard to another
+///
+/// Items are pushed on the sender shard and popped on the receiver shard,
+/// by any number of fibers on each (which may be the same shard). Items
+/// pushed while an earlier batch is still on its way are sent together
+/// in the next message, so a busy channel costs far fewer cross-shard
+/// messages than a \ref smp::submit_to() per item.
+///
+/// At most \c capacity items are in the channel at any time. The sender
+/// takes a credit for each item it pushes, and the receiver hands the
+/// credits back in batches as items are popped, so a slow receiver holds
+/// up the sender rather than piling items up in its memory.
+///
+/// The channel object itself can be on any shard, but has to outlive
+/// both ends: the sender has to be closed with \ref sender::close(), and
+/// the receiver with \ref receiver::close(), before it is destroyed.
+///
+/// \code
+/// channel<sstring> ch(0, 1, 1024);
+/// co_await when_all_succeed(
+///     smp::submit_to(0, [&ch] () -> future<> {
+///         auto tx = ch.get_sender();
+///         for (auto& line : lines) {
+///             co_await tx.push(std::move(line));
+///         }
+///         co_await tx.close();
+///     }),
+///     smp::submit_to(1, [&ch] () -> future<> {
+///         auto rx = ch.get_receiver();
+///         while (auto line = co_await rx.pop()) {
+///             apply(*line);
+///         }
+///         co_await rx.close();
+///     }));
+/// \endcode
+template <typename T>
+SEASTAR_CONCEPT(requires std::is_nothrow_move_constructible_v<T>)
+class channel {
+    const shard_id _sender_shard;
+    const shard_id _receiver_shard;
+    const size_t _capacity;
+
+    // Used on the sender shard only
+    semaphore _credits;
+    std::vector<T> _batch;
+    gate _sends;
+    std::exception_ptr _send_ex;
+    bool _sending = false;
+    bool _sender_closed = false;
+    bool _receiver_gone = false;
+
+    // Used on the receiver shard only
+    circular_buffer<T> _items;
+    condition_variable _not_empty;
+    gate _credit_returns;
+    size_t _consumed = 0;
+    bool _end = false;
+    bool _receiver_closed = false;
+
+public:
+    /// A view of the sending end of a \ref channel, to be used on its
+    /// sender shard
+    class sender {
+        channel* _ch;
+    public:
+        explicit sender(channel& ch) noexcept : _ch(&ch) {}
+
+        /// \brief Pushes an item into the channel
+        ///
+        /// \return a future that becomes ready once the item is queued for
+        ///         sending, waiting for credits if the channel is full, or
+        ///         fails with \ref broken_channel if the receiver was closed
+        future<> push(T item) noexcept {
+            return _ch->push(std::move(item));
+        }
+
+        /// \brief Closes the sending end
+        ///
+        /// Sends the items still queued, and then marks the end of the
+        /// items for the receiver. No items can be pushed afterwards.
+        ///
+        /// \return a future that becomes ready once the receiver shard
+        ///         has got all the items
+        future<> close() noexcept {
+            return _ch->close_sender();
+        }
+    };
+
+    /// A view of the receiving end of a \ref channel, to be used on its
+    /// receiver shard
+    class receiver {
+        channel* _ch;
+    public:
+        explicit receiver(channel& ch) noexcept : _ch(&ch) {}
+
+        /// \brief Pops an item from the channel
+        ///
+        /// \return a future holding the next item, waiting for one if the
+        ///         channel is empty, or an empty optional once the sender
+        ///         was closed and all of its items were popped
+        future<std::optional<T>> pop() noexcept {
+            return _ch->pop();
+        }
+
+        /// \brief Closes the receiving end
+        ///
+        /// Drops the items not popped yet, fails pending and later pops
+        /// and pushes with \ref broken_channel.
+        ///
+        /// \return a future that becomes ready once the sender shard knows
+        future<> close() noexcept {
+            return _ch->close_receiver();
+        }
+    };
+
+    /// \brief Constructs a channel
+    ///
+    /// \param sender_shard the shard items are pushed on
+    /// \param receiver_shard the shard items are popped on
+    /// \param capacity the most items the channel holds, at least 1
+    channel(shard_id sender_shard, shard_id receiver_shard, size_t capacity)
+        : _sender_shard(sender_shard)
+        , _receiver_shard(receiver_shard)
+        , _capacity(std::max<size_t>(capacity, 1))
+        , _credits(_capacity)
+    {}
+
+    channel(const channel&) = delete;
+    channel(channel&&) = delete;
+
+    sender get_sender() noexcept {
+        return sender(*this);
+    }
+    receiver get_receiver() noexcept {
+        return receiver(*this);
+    }
+
+private:
+    future<> push(T item) noexcept {
+        if (_sender_closed) {
+            return make_exception_future<>(std::logic_error("push() into a closed channel"));
+        }
+        if (_receiver_gone) {
+            return make_exception_future<>(broken_channel());
+        }
+        if (_send_ex) {
+            return make_exception_future<>(_send_ex);
+        }
+        if (_credits.try_wait(1)) {
+            return enqueue(std::move(item));
+        }
+        return _credits.wait(1).then([this, item = std::move(item)] () mutable {
+            return enqueue(std::move(item));
+        });
+    }
+
+    future<> enqueue(T&& item) noexcept {
+        if (_sender_closed) {
+            // A push which waited for credits past close()
+            _credits.signal(1);
+            return make_exception_future<>(std::logic_error("push() into a closed channel"));
+        }
+        try {
+            _batch.push_back(std::move(item));
+        } catch (...) {
+            _credits.signal(1);
+            return current_exception_as_future();
+        }
+        if (!_sending) {
+            _sending = true;
+            // Taking the gate can't fail, only close_sender() closes it
+            // and no pushes are allowed by then
+            (void)with_gate(_sends, [this] {
+                return send();
+            });
+        }
+        return make_ready_future<>();
+    }
+
+    // Sends the queued items, and whatever was pushed while they were on
+    // their way, until there are no more
+    future<> send() noexcept {
+        return do_until([this] { return _batch.empty(); }, [this] {
+            return smp::submit_to(_receiver_shard, [this, batch = std::exchange(_batch, {})] () mutable {
+                deliver(batch);
+            });
+        }).handle_exception([this] (std::exception_ptr ep) {
+            // The items are lost, so are their credits; let the pushers know
+            _send_ex = std::move(ep);
+            _batch.clear();
+            _credits.broken(_send_ex);
+        }).finally([this] {
+            _sending = false;
+        });
+    }
+
+    future<> close_sender() noexcept {
+        _sender_closed = true;
+        return _sends.close().then([this] {
+            return smp::submit_to(_receiver_shard, [this] {
+                _end = true;
+                _not_empty.broadcast();
+            });
+        }).then([this] {
+            if (_send_ex) {
+                return make_exception_future<>(_send_ex);
+            }
+            return make_ready_future<>();
+        });
+    }
+
+    void deliver(std::vector<T>& batch) {
+        if (_receiver_closed) {
+            return;
+        }
+        _items.reserve(_items.size() + batch.size());
+        for (auto& item : batch) {
+            _items.push_back(std::move(item));
+        }
+        _not_empty.broadcast();
+    }
+
+    future<std::optional<T>> pop() noexcept {
+        if (_receiver_closed) {
+            return make_exception_future<std::optional<T>>(broken_channel());
+        }
+        if (!_items.empty()) {
+            std::optional<T> item(std::move(_items.front()));
+            _items.pop_front();
+            return_credit();
+            return make_ready_future<std::optional<T>>(std::move(item));
+        }
+        if (_end) {
+            return make_ready_future<std::optional<T>>(std::nullopt);
+        }
+        return _not_empty.wait().then([this] {
+            return pop();
+        });
+    }
+
+    // Credits go back in batches of a quarter of the capacity. The sender
+    // can't run out of them while the receiver holds on to less than that:
+    // it has all the rest, once the receiver has popped everything.
+    void return_credit() noexcept {
+        if (++_consumed < (_capacity + 3) / 4) {
+            return;
+        }
+        auto n = std::exchange(_consumed, 0);
+        (void)with_gate(_credit_returns, [this, n] {
+            return smp::submit_to(_sender_shard, [this, n] {
+                _credits.signal(n);
+            });
+        }).handle_exception([this, n] (std::exception_ptr) {
+            // Try again with the next pop
+            _consumed += n;
+        });
+    }
+
+    future<> close_receiver() noexcept {
+        _receiver_closed = true;
+        _items.clear();
+        _not_empty.broken(std::make_exception_ptr(broken_channel()));
+        return _credit_returns.close().then([this] {
+            return smp::submit_to(_sender_shard, [this] {
+                _receiver_gone = true;
+                _credits.broken(std::make_exception_ptr(broken_channel()));
+            });
+        });
+    }
+};
+
+/// @}
+
+}
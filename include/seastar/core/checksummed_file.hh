@@ -0,0 +1,80 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/file.hh>
+#include <stdexcept>
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// Thrown by reads of a \ref make_checksummed_file() file that find data
+/// not matching its checksum.
+class checksum_error : public std::runtime_error {
+    uint64_t _pos;
+public:
+    explicit checksum_error(uint64_t pos);
+    /// The position of the block that failed verification
+    uint64_t position() const noexcept {
+        return _pos;
+    }
+};
+
+/// Options of a \ref make_checksummed_file() file.
+struct checksummed_file_options {
+    /// The size of the blocks of a new file, each of which gets a
+    /// checksum; an existing file keeps its own. A power of two, and a
+    /// multiple of the DMA alignments of the data file.
+    size_t block_size = 4096;
+};
+
+/// Layers block checksums over a file.
+///
+/// Each block of the data file gets a CRC32C, computed with the CRC32
+/// instructions of the cpu where it has them, and kept in a separate
+/// checksum file. The checksums of the blocks read are verified by every
+/// read, which fails with \ref checksum_error on a mismatch, so the cost
+/// is only paid for the data actually read. Reads which copy the data
+/// out of a block verify it in the same pass.
+///
+/// The returned file reports the block size as its DMA alignment. Writes
+/// have to start at a block boundary, and to be made of whole blocks
+/// unless they reach the end of the file; others fail with EINVAL. File
+/// output streams satisfy this as long as their buffer size is a
+/// multiple of the block size.
+///
+/// The checksums are kept in memory, and written to the checksum file by
+/// flush() and close(). discard() does nothing. The file cannot be
+/// dup()-ed to other shards.
+///
+/// \param data the file holding the data
+/// \param checksums the file holding the checksums; empty if \c data is
+/// \param opts the options of the file
+/// \return the checksummed file, or an exception if the files don't
+///         match, in which case both are closed
+future<file> make_checksummed_file(file data, file checksums, checksummed_file_options opts = {});
+
+/// @}
+
+}
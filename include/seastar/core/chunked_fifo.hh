@@ -23,9 +23,18 @@
 
 #include <memory>
 #include <algorithm>
+#include <cstring>
+#include <iterator>
 
 namespace seastar {
 
+namespace memory {
+
+// See memory.hh, which can't be included here
+bool low_memory() noexcept;
+
+}
+
 // An unbounded FIFO queue of objects of type T.
 //
 // It provides operations to push items in one end of the queue, and pop them
@@ -182,6 +191,17 @@ class chunked_fifo {
     inline void emplace_back(A&&... args);
     inline T& front() const noexcept;
     inline void pop_front() noexcept;
+    // Appends the elements of [first, last), allocating the chunks they
+    // need up front. Trivially copyable elements from a pointer range are
+    // copied with memcpy(), a chunk at a time.
+    template <typename ForwardIt>
+    void append(ForwardIt first, ForwardIt last);
+    // Removes the first n elements, at most size()
+    void pop_front_n(size_t n) noexcept;
+    // Moves the first n elements, at most size(), to out and removes them.
+    // Trivially copyable elements are copied with memcpy(). Returns the end
+    // of the elements written to out.
+    T* pop_front_n(size_t n, T* out) noexcept;
     inline bool empty() const noexcept;
     inline size_t size() const noexcept;
     void clear() noexcept;
@@ -530,9 +550,13 @@ chunked_fifo<T, items_per_chunk>::front_chunk_delete() noexcept {
     // chunks to save: If we save them all, the queue can never shrink from
     // its maximum memory use (this is how circular_buffer behaves).
     // The ad-hoc choice made here is to limit the number of saved chunks to 1,
-    // but this could easily be made a configuration option.
+    // but this could easily be made a configuration option. None are kept
+    // while the shard is low on memory, including those left by reserve().
     static constexpr int save_free_chunks = 1;
-    if (_nfree_chunks < save_free_chunks) {
+    if (memory::low_memory()) {
+        delete _front_chunk;
+        shrink_to_fit();
+    } else if (_nfree_chunks < save_free_chunks) {
         _front_chunk->next = _free_chunks;
         _free_chunks = _front_chunk;
         ++_nfree_chunks;
@@ -558,6 +582,77 @@ chunked_fifo<T, items_per_chunk>::pop_front() noexcept {
     }
 }
 
+template <typename T, size_t items_per_chunk>
+template <typename ForwardIt>
+void
+chunked_fifo<T, items_per_chunk>::append(ForwardIt first, ForwardIt last) {
+    size_t n = std::distance(first, last);
+    // Takes all the memory needed, so that nothing below can fail for the
+    // memcpy() case
+    reserve(size() + n);
+    if constexpr (std::is_trivially_copyable_v<T> && std::is_pointer_v<ForwardIt>
+            && std::is_same_v<std::remove_cv_t<std::remove_pointer_t<ForwardIt>>, T>) {
+        static_assert(sizeof(maybe_item) == sizeof(T));
+        while (n) {
+            ensure_room_back();
+            auto room = items_per_chunk - (_back_chunk->end - _back_chunk->begin);
+            auto count = std::min(room, n);
+            auto e = mask(_back_chunk->end);
+            auto head = std::min(count, items_per_chunk - e);
+            std::memcpy(&_back_chunk->items[e].data, first, head * sizeof(T));
+            std::memcpy(&_back_chunk->items[0].data, first + head, (count - head) * sizeof(T));
+            _back_chunk->end += count;
+            first += count;
+            n -= count;
+        }
+    } else {
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+    }
+}
+
+template <typename T, size_t items_per_chunk>
+void
+chunked_fifo<T, items_per_chunk>::pop_front_n(size_t n) noexcept {
+    while (n) {
+        auto count = std::min<size_t>(_front_chunk->end - _front_chunk->begin, n);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (size_t i = 0; i < count; i++) {
+                _front_chunk->items[mask(_front_chunk->begin + i)].data.~T();
+            }
+        }
+        n -= count;
+        _front_chunk->begin += count;
+        if (_front_chunk->begin == _front_chunk->end) {
+            front_chunk_delete();
+        }
+    }
+}
+
+template <typename T, size_t items_per_chunk>
+T*
+chunked_fifo<T, items_per_chunk>::pop_front_n(size_t n, T* out) noexcept {
+    static_assert(std::is_nothrow_move_assignable_v<T>, "pop_front_n() assumes move assignment does not throw");
+    while (n) {
+        auto count = std::min<size_t>(_front_chunk->end - _front_chunk->begin, n);
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            auto b = mask(_front_chunk->begin);
+            auto head = std::min(count, items_per_chunk - b);
+            std::memcpy(out, &_front_chunk->items[b].data, head * sizeof(T));
+            std::memcpy(out + head, &_front_chunk->items[0].data, (count - head) * sizeof(T));
+            out += count;
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                *out++ = std::move(_front_chunk->items[mask(_front_chunk->begin + i)].data);
+            }
+        }
+        pop_front_n(count);
+        n -= count;
+    }
+    return out;
+}
+
 template <typename T, size_t items_per_chunk>
 void chunked_fifo<T, items_per_chunk>::reserve(size_t n) {
     // reserve() guarantees that (n - size()) additional push()es will
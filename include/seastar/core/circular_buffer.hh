@@ -26,9 +26,18 @@
 #include <seastar/util/concepts.hh>
 #include <memory>
 #include <algorithm>
+#include <cstring>
+#include <iterator>
 
 namespace seastar {
 
+namespace memory {
+
+// See memory.hh, which can't be included here
+bool low_memory() noexcept;
+
+}
+
 /// A growable double-ended queue container that can be efficiently
 /// extended (and shrunk) from both ends. Implementation is a single
 /// storage vector.
@@ -55,6 +64,12 @@ namespace seastar {
 ///     * pop_back() will invalidate end().
 ///
 /// reserve() may also invalidate all iterators and references.
+///
+/// A buffer keeps the storage it grew to when it empties, unless the
+/// shard is low on memory and the storage is larger than
+/// \c shrink_on_drain_bytes: then the pop that empties it frees it, so
+/// that buffers sized by a burst don't hold on to that memory for good.
+/// shrink_to_fit() frees the unused storage explicitly.
 template <typename T, typename Alloc = std::allocator<T>>
 class circular_buffer {
     struct impl : Alloc {
@@ -105,11 +120,31 @@ class circular_buffer {
     const T& back() const noexcept;
     void pop_front() noexcept;
     void pop_back() noexcept;
+    /// Appends the elements of [first, last), growing the storage at most
+    /// once. Trivially copyable elements from a pointer range are copied
+    /// with memcpy().
+    template <typename ForwardIt>
+    void append(ForwardIt first, ForwardIt last);
+    /// Removes the first \c n elements, at most size()
+    void pop_front_n(size_t n) noexcept;
+    /// Moves the first \c n elements, at most size(), to \c out and removes
+    /// them. Trivially copyable elements are copied with memcpy().
+    ///
+    /// \return the end of the elements written to \c out
+    T* pop_front_n(size_t n, T* out) noexcept;
     bool empty() const noexcept;
     size_t size() const noexcept;
     size_t capacity() const noexcept;
     void reserve(size_t);
+    /// Reduces the storage to the smallest power of two that fits the
+    /// elements, or frees it if there are none. Invalidates all iterators
+    /// and references. Keeps the storage if the smaller one can't be
+    /// allocated.
+    void shrink_to_fit() noexcept;
     void clear() noexcept;
+    // Storage larger than this is freed when the buffer empties while the
+    // shard is low on memory
+    static constexpr size_t shrink_on_drain_bytes = 4096;
     T& operator[](size_t idx) noexcept;
     const T& operator[](size_t idx) const noexcept;
     template <typename Func>
@@ -121,6 +156,7 @@ class circular_buffer {
     void expand();
     void expand(size_t);
     void maybe_expand(size_t nr = 1);
+    void maybe_release() noexcept;
     size_t mask(size_t idx) const;
 
     template<typename CB, typename ValueType>
@@ -261,6 +297,36 @@ circular_buffer<T, Alloc>::reserve(size_t size) {
     }
 }
 
+template <typename T, typename Alloc>
+void
+circular_buffer<T, Alloc>::shrink_to_fit() noexcept {
+    if (empty()) {
+        _impl.deallocate(_impl.storage, _impl.capacity);
+        _impl.reset();
+        return;
+    }
+    auto new_cap = size_t(1) << log2ceil(size());
+    if (new_cap < capacity()) {
+        try {
+            expand(new_cap);
+        } catch (...) {
+            // Keep the current storage
+        }
+    }
+}
+
+template <typename T, typename Alloc>
+inline
+void
+circular_buffer<T, Alloc>::maybe_release() noexcept {
+    if (__builtin_expect(_impl.begin == _impl.end && _impl.capacity * sizeof(T) > shrink_on_drain_bytes, false)) {
+        if (memory::low_memory()) {
+            _impl.deallocate(_impl.storage, _impl.capacity);
+            _impl.reset();
+        }
+    }
+}
+
 template <typename T, typename Alloc>
 inline
 void
@@ -451,6 +517,7 @@ void
 circular_buffer<T, Alloc>::pop_front() noexcept {
     std::allocator_traits<Alloc>::destroy(_impl, &front());
     ++_impl.begin;
+    maybe_release();
 }
 
 template <typename T, typename Alloc>
@@ -459,6 +526,65 @@ void
 circular_buffer<T, Alloc>::pop_back() noexcept {
     std::allocator_traits<Alloc>::destroy(_impl, &back());
     --_impl.end;
+    maybe_release();
+}
+
+template <typename T, typename Alloc>
+template <typename ForwardIt>
+void
+circular_buffer<T, Alloc>::append(ForwardIt first, ForwardIt last) {
+    size_t n = std::distance(first, last);
+    if (n == 0) {
+        return;
+    }
+    reserve(size() + n);
+    if constexpr (std::is_trivially_copyable_v<T> && std::is_pointer_v<ForwardIt>
+            && std::is_same_v<std::remove_cv_t<std::remove_pointer_t<ForwardIt>>, T>) {
+        auto e = mask(_impl.end);
+        auto head = std::min(n, _impl.capacity - e);
+        std::memcpy(_impl.storage + e, first, head * sizeof(T));
+        std::memcpy(_impl.storage, first + head, (n - head) * sizeof(T));
+        _impl.end += n;
+    } else {
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+    }
+}
+
+template <typename T, typename Alloc>
+void
+circular_buffer<T, Alloc>::pop_front_n(size_t n) noexcept {
+    if constexpr (std::is_trivially_destructible_v<T>) {
+        _impl.begin += n;
+    } else {
+        while (n--) {
+            std::allocator_traits<Alloc>::destroy(_impl, &front());
+            ++_impl.begin;
+        }
+    }
+    maybe_release();
+}
+
+template <typename T, typename Alloc>
+T*
+circular_buffer<T, Alloc>::pop_front_n(size_t n, T* out) noexcept {
+    static_assert(std::is_nothrow_move_assignable_v<T>, "pop_front_n() assumes move assignment does not throw");
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        if (n) {
+            auto b = mask(_impl.begin);
+            auto head = std::min(n, _impl.capacity - b);
+            std::memcpy(out, _impl.storage + b, head * sizeof(T));
+            std::memcpy(out + head, _impl.storage, (n - head) * sizeof(T));
+        }
+        out += n;
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            *out++ = std::move(_impl.storage[mask(_impl.begin + i)]);
+        }
+    }
+    pop_front_n(n);
+    return out;
 }
 
 template <typename T, typename Alloc>
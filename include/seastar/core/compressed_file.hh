@@ -0,0 +1,82 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/file.hh>
+#include <seastar/core/scheduling.hh>
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// The compression of a \ref make_compressed_file() file.
+enum class compressed_file_algorithm {
+    lz4,
+    zstd,
+};
+
+/// Options of a \ref make_compressed_file() file.
+struct compressed_file_options {
+    /// The compression of a new file; an existing file keeps its own.
+    compressed_file_algorithm algorithm = compressed_file_algorithm::lz4;
+    /// The size of the chunks the data of a new file is compressed in;
+    /// an existing file keeps its own.
+    size_t chunk_size = 64 * 1024;
+    /// The group compression and decompression run in, so that the CPU
+    /// they take can be controlled separately from the rest of the work.
+    scheduling_group compression_scheduling_group = default_scheduling_group();
+    /// How many chunks past the ones read are decompressed ahead of
+    /// sequential reads.
+    unsigned read_ahead = 1;
+};
+
+/// Layers compression over a file.
+///
+/// The data is stored in the underlying file in chunks, compressed
+/// independently and located through an index, so that cold data takes
+/// less disk space and bandwidth at the cost of CPU. The returned file
+/// has the usual dma_read()/dma_write() interface, and can be used with
+/// file streams, but is meant for files written sequentially:
+///
+/// - writes have to append, or rewrite data past the last full chunk,
+///   and fail with EINVAL otherwise;
+/// - truncations may both extend and shrink the file;
+/// - the index is written by flush() and close(); the file can only be
+///   opened again after one of them;
+/// - discard() and allocate() do nothing.
+///
+/// Concurrent reads of a chunk share a single read and decompression,
+/// and reads of consecutive chunks decompress
+/// \ref compressed_file_options::read_ahead chunks ahead. The file
+/// cannot be dup()-ed to other shards.
+///
+/// \param f the file to layer compression over; an empty one for a new
+///        compressed file, or one written by a compressed file before
+/// \param opts the options of the file
+/// \return the compressed file, or an exception if \c f is not empty and
+///         not a valid compressed file, in which case \c f is closed
+future<file> make_compressed_file(file f, compressed_file_options opts = {});
+
+/// @}
+
+}
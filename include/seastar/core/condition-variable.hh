@@ -24,6 +24,7 @@
 #include <boost/intrusive/list.hpp>
 
 #include <seastar/core/timer.hh>
+#include <seastar/core/internal/deferred_wakeup.hh>
 #ifdef SEASTAR_COROUTINES_ENABLED
 #   include <seastar/core/coroutine.hh>
 #endif
@@ -180,20 +181,31 @@ class condition_variable {
     };
 #endif
 
-    boost::intrusive::list<waiter, boost::intrusive::constant_time_size<false>> _waiters;
+    using waiter_list = boost::intrusive::list<waiter, boost::intrusive::constant_time_size<false>>;
+
+    waiter_list _waiters;
+    // Waiters a broadcast() hasn't got to yet. They are woken in batches,
+    // and the rest is left to a task if the reactor has other work to do.
+    waiter_list _waking;
+    internal::deferred_wakeup _wakeup;
     std::exception_ptr _ex; //"broken" exception
     bool _signalled = false; // set to true if signalled while no waiters
 
+    // Waiters woken before checking for preemption
+    static constexpr unsigned wakeup_batch = 128;
+
     void add_waiter(waiter&) noexcept;
     void timeout(waiter&) noexcept;
     bool wakeup_first() noexcept;
     bool check_and_consume_signal() noexcept;
+    void wake_waking(bool from_broadcast) noexcept;
+    static void continue_wakeup(void* cv) noexcept;
 public:
     /// Constructs a condition_variable object.
     /// Initialzie the semaphore with a default value of 0 to enusre
     /// the first call to wait() before signal() won't be waken up immediately.
     condition_variable() noexcept = default;
-    condition_variable(condition_variable&& rhs) noexcept = default;
+    condition_variable(condition_variable&& rhs) noexcept;
     ~condition_variable();
 
     /// Waits until condition variable is signaled, may wake up without condition been met
@@ -388,6 +400,12 @@ class condition_variable {
     void signal() noexcept;
 
     /// Notify variable and wake up all waiter
+    ///
+    /// The waiters are woken in the order they started waiting. When there
+    /// are many of them, only the first batch is woken right away, and the
+    /// rest are woken by a task of their own, in batches, so that waking
+    /// them doesn't hold up the reactor. Waiters which start waiting after
+    /// the call are not woken by it.
     void broadcast() noexcept;
 
     /// Signal to waiters that an error occurred.  \ref wait() will see
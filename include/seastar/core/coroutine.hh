@@ -44,6 +44,15 @@ class coroutine_traits_base {
         promise_type(promise_type&&) = delete;
         promise_type(const promise_type&) = delete;
 
+#ifdef SEASTAR_COROUTINE_FRAME_POOL
+        static void* operator new(size_t size) {
+            return local_coroutine_frame_freelist.allocate(size);
+        }
+        static void operator delete(void* p, size_t size) noexcept {
+            local_coroutine_frame_freelist.deallocate(p, size);
+        }
+#endif
+
         template<typename... U>
         void return_value(U&&... value) {
             _promise.set_value(std::forward<U>(value)...);
@@ -92,6 +101,15 @@ class coroutine_traits_base<> {
         promise_type(promise_type&&) = delete;
         promise_type(const promise_type&) = delete;
 
+#ifdef SEASTAR_COROUTINE_FRAME_POOL
+        static void* operator new(size_t size) {
+            return local_coroutine_frame_freelist.allocate(size);
+        }
+        static void operator delete(void* p, size_t size) noexcept {
+            local_coroutine_frame_freelist.deallocate(p, size);
+        }
+#endif
+
         void return_void() noexcept {
             _promise.set_value();
         }
@@ -138,6 +156,7 @@ struct awaiter {
         if (!CheckPreempt || !_future.available()) {
             _future.set_coroutine(hndl.promise());
         } else {
+            hndl.promise().inherit_task_local_values();
             schedule(&hndl.promise());
         }
     }
@@ -163,6 +182,7 @@ struct awaiter<CheckPreempt, T> {
         if (!CheckPreempt || !_future.available()) {
             _future.set_coroutine(hndl.promise());
         } else {
+            hndl.promise().inherit_task_local_values();
             schedule(&hndl.promise());
         }
     }
@@ -188,6 +208,7 @@ struct awaiter<CheckPreempt> {
         if (!CheckPreempt || !_future.available()) {
             _future.set_coroutine(hndl.promise());
         } else {
+            hndl.promise().inherit_task_local_values();
             schedule(&hndl.promise());
         }
     }
@@ -0,0 +1,71 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/http/httpd.hh>
+#include <seastar/core/sstring.hh>
+#include <chrono>
+
+namespace seastar {
+
+/// \brief In-process sampling CPU profiler.
+///
+/// While running, every shard periodically samples its own backtrace,
+/// driven by the CPU time the reactor thread consumes (the same perf_event
+/// task clock that the stall detector uses), and counts the samples per
+/// scheduling group and call stack. Unlike an external profiler, the
+/// samples know which shard and which scheduling group they belong to.
+///
+/// The profiler can also be started with the \c --cpu-profiler-period-us
+/// option.
+namespace cpu_profiler {
+
+/// Starts sampling on all shards, once every \c period of CPU time.
+/// Samples collected earlier are kept.
+future<> start(std::chrono::microseconds period);
+
+/// Stops sampling on all shards. The collected samples are kept.
+future<> stop();
+
+/// Drops the samples collected on all shards.
+future<> reset();
+
+/// Returns the samples collected on all shards as folded stacks, one
+/// "shard N;<scheduling group>;<outermost frame>;...;<innermost frame> <count>"
+/// line per distinct stack, ready to be fed to flamegraph.pl or speedscope.
+///
+/// Frames are named after the dynamic symbol table, so the binary should be
+/// linked with -rdynamic; frames that can't be named are shown as
+/// object+offset, which seastar-addr2line can resolve.
+future<sstring> folded_stacks();
+
+/// \defgroup add_cpu_profiler_routes adds an endpoint that returns the
+///    result of \ref folded_stacks(). The profile is reset after it's read
+///    if the \c reset query parameter is set to \c true.
+/// @{
+future<> add_routes(distributed<http_server>& server, sstring path = "/cpu_profile");
+future<> add_routes(http_server& server, sstring path = "/cpu_profile");
+/// @}
+
+}
+
+}
@@ -86,6 +86,7 @@ class deleter final {
     /// destroyed, both encapsulated actions will be carried out.
     void append(deleter d);
 private:
+    friend deleter make_cross_shard_deleter(deleter d, unsigned owner);
     static bool is_raw_object(impl* i) noexcept {
         auto x = reinterpret_cast<uintptr_t>(i);
         return x & 1;
@@ -246,6 +247,30 @@ make_free_deleter(void* obj) {
     return deleter(deleter::raw_object_tag(), obj);
 }
 
+/// Makes a deleter that can be destroyed on any shard, and carries out the
+/// encapsulated action of another deleter on the shard that owns it.
+///
+/// When the returned deleter is destroyed on a shard other than \c owner,
+/// \c d is queued up and sent back to \c owner together with the other
+/// deleters released on the same shard in the same task quota, so handing
+/// buffers to other shards costs one cross-shard message per batch rather
+/// than one per buffer. Deleters that only free memory are returned as is,
+/// since the memory allocator already returns such memory to its shard.
+///
+/// The returned deleter may be shared, but only on one shard at a time.
+///
+/// \param d deleter to invoke on \c owner
+/// \param owner the shard on which to invoke \c d
+/// \related deleter
+deleter make_cross_shard_deleter(deleter d, unsigned owner);
+
+/// Makes a deleter that can be destroyed on any shard, and carries out the
+/// encapsulated action of another deleter on the calling shard.
+///
+/// \param d deleter to invoke on the calling shard
+/// \related deleter
+deleter make_cross_shard_deleter(deleter d);
+
 /// Makes a deleter that calls \c std::free() when it is destroyed, as well
 /// as invoking the encapsulated action of another deleter.
 ///
@@ -0,0 +1,74 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/temporary_buffer.hh>
+#include <cstdint>
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// Statistics of the pool of DMA buffers of a shard.
+struct dma_buffer_pool_stats {
+    /// Buffers allocated from the pool
+    uint64_t hits = 0;
+    /// Buffers allocated from the allocator, the pool having none of their size
+    uint64_t misses = 0;
+    /// Buffers too large or too aligned for the pool
+    uint64_t bypasses = 0;
+    /// Buffers freed to the allocator, the pool being full or memory low
+    uint64_t evictions = 0;
+    /// The bytes the pool holds
+    size_t cached_bytes = 0;
+};
+
+/// Allocates a buffer for DMA from the pool of the shard.
+///
+/// Each shard keeps the buffers of up to 1MB that were freed, in power of
+/// two size classes, and reuses them, saving file I/O from allocating and
+/// freeing a large aligned buffer each time. The pool gives its buffers
+/// back to the allocator when memory runs low.
+///
+/// \param alignment the alignment of the buffer; a power of two
+/// \param size the size of the buffer
+temporary_buffer<char> allocate_dma_buffer(size_t alignment, size_t size);
+
+/// \copydoc allocate_dma_buffer(size_t, size_t)
+template <typename CharType>
+temporary_buffer<CharType> allocate_dma_buffer(size_t alignment, size_t size) {
+    auto buf = allocate_dma_buffer(alignment, size * sizeof(CharType));
+    auto p = reinterpret_cast<CharType*>(buf.get_write());
+    return temporary_buffer<CharType>(p, size, buf.release());
+}
+
+/// The statistics of the pool of DMA buffers of this shard.
+dma_buffer_pool_stats get_dma_buffer_pool_stats() noexcept;
+
+/// Sets how many bytes of free buffers the pool of this shard may hold,
+/// 8MB by default; 0 disables the pool.
+void set_dma_buffer_pool_capacity(size_t capacity) noexcept;
+
+/// @}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/file.hh>
+#include <cstdint>
+#include <vector>
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// The cipher of a \ref make_encrypted_file() file.
+enum class encrypted_file_cipher {
+    /// AES-128 in XTS mode, with a 32 byte key
+    aes_128_xts,
+    /// AES-256 in XTS mode, with a 64 byte key
+    aes_256_xts,
+};
+
+/// Options of a \ref make_encrypted_file() file.
+struct encrypted_file_options {
+    /// The cipher of a new file; an existing file keeps its own.
+    encrypted_file_cipher cipher = encrypted_file_cipher::aes_256_xts;
+    /// The size of the blocks of a new file, each of which is encrypted
+    /// on its own; an existing file keeps its own. A power of two, and a
+    /// multiple of the DMA alignments of the underlying file.
+    size_t block_size = 4096;
+    /// How much of a read or write is decrypted or encrypted at a time.
+    /// Larger I/O is split into pieces of this size, which are encrypted
+    /// while the previous ones are written, and decrypted while the next
+    /// ones are read.
+    size_t pipeline_size = 128 * 1024;
+};
+
+/// Layers encryption at rest over a file.
+///
+/// Each block of data is encrypted with AES in XTS mode, using its
+/// position in the file as the tweak, through GnuTLS, which uses the AES
+/// instructions of the cpu where it has them. XTS doesn't change the size
+/// of the data, so the file is the encrypted blocks after a header block
+/// holding the cipher, the block size, the size of the file, and a check
+/// of the key.
+///
+/// The returned file reports the block size as its DMA alignment, and
+/// writes have to be of whole blocks at block boundaries; others fail
+/// with EINVAL. File output streams satisfy this. Blocks never written
+/// read back as zeroes.
+///
+/// The size of the file is written to the header by flush() and close().
+/// discard() does nothing. The file cannot be dup()-ed to other shards.
+///
+/// \param f the file to layer encryption over; an empty one for a new
+///        encrypted file, or one written by an encrypted file before
+/// \param key the key, whose size depends on the cipher; the two halves
+///        of an XTS key have to differ
+/// \param opts the options of the file
+/// \return the encrypted file, or an exception if the key is wrong, or
+///         \c f is not empty and not a valid encrypted file, in which case
+///         \c f is closed
+future<file> make_encrypted_file(file f, std::vector<uint8_t> key, encrypted_file_options opts = {});
+
+/// @}
+
+}
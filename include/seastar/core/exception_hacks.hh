@@ -21,6 +21,63 @@
 
 #pragma once
 
+#include <exception>
+#include <type_traits>
+#include <typeinfo>
+
 namespace seastar {
 void init_phdr_cache();
+
+namespace internal {
+void* try_catch_dynamic(const std::exception_ptr& eptr, const std::type_info& catch_type) noexcept;
+}
+
+/// \brief The type of the exception held by an exception_ptr
+///
+/// Finds the type without rethrowing the exception where the C++ runtime
+/// allows for it, which libstdc++ does.
+///
+/// \return the dynamic type of the exception, or nullptr if \c eptr is empty
+const std::type_info* exception_ptr_type(const std::exception_ptr& eptr) noexcept;
+
+/// \brief Checks the type of the exception held by an exception_ptr
+///
+/// Does what
+/// \code
+/// try {
+///     std::rethrow_exception(eptr);
+/// } catch (Ex& ex) {
+///     return &ex;
+/// } catch (...) {
+///     return nullptr;
+/// }
+/// \endcode
+/// does, matching the exception as a catch clause would, but without
+/// throwing where the C++ runtime allows for it, which libstdc++ does.
+/// Throwing takes the unwinder, which takes locks and walks the stack,
+/// and is much slower than looking the type up, so this is the way to
+/// dispatch on exceptions, e.g. to map them to error codes.
+///
+/// \tparam Ex the type to match, a class type, which may be const
+/// \return a pointer to the exception held by \c eptr, valid as long as
+///         it is, if it is an \c Ex or derives from it, nullptr otherwise
+template <typename Ex>
+Ex* try_catch(const std::exception_ptr& eptr) noexcept {
+    static_assert(std::is_class_v<Ex>, "try_catch only matches class types");
+#ifdef __GLIBCXX__
+    return static_cast<Ex*>(internal::try_catch_dynamic(eptr, typeid(Ex)));
+#else
+    if (!eptr) {
+        return nullptr;
+    }
+    try {
+        std::rethrow_exception(eptr);
+    } catch (Ex& ex) {
+        return &ex;
+    } catch (...) {
+    }
+    return nullptr;
+#endif
+}
+
 }
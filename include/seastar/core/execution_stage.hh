@@ -26,6 +26,7 @@
 #include <seastar/core/function_traits.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/metrics.hh>
+#include <seastar/core/metrics_histogram.hh>
 #include <seastar/core/scheduling.hh>
 #include <seastar/util/reference_wrapper.hh>
 #include <seastar/util/concepts.hh>
@@ -61,6 +62,12 @@ namespace seastar {
 /// would execute these function calls is scheduled. Execution stages are also
 /// flushed when the reactor polls for events.
 ///
+/// By default a task is scheduled as soon as a call is queued, so a batch is
+/// whatever queues up until the task runs. A stage can instead be allowed to
+/// wait for a bigger batch for a bounded time, see
+/// execution_stage::set_max_batch_delay(). The sizes of the batches and how
+/// long they waited are exported as histograms of the stage.
+///
 /// When calling a function that is wrapped inside execution stage it is
 /// important to remember that the actual function call will happen at some
 /// later time and it has to be guaranteed the objects passed by lvalue
@@ -126,6 +133,14 @@ class execution_stage {
         uint64_t function_calls_enqueued = 0;
         uint64_t function_calls_executed = 0;
     };
+    using clock_type = std::chrono::steady_clock;
+    /// Histogram of the number of calls run by each batch
+    using batch_size_histogram = metrics::log_linear_histogram<3, 16>;
+    /// Histogram of how long the oldest call of each batch waited for it
+    /// to run, in microseconds
+    using queue_delay_histogram = metrics::log_linear_histogram<>;
+    /// The most calls a stage queues, and the largest batch it waits for
+    static constexpr size_t max_batch_size = 1024;
 protected:
     bool _empty = true;
     bool _flush_scheduled = false;
@@ -133,8 +148,20 @@ class execution_stage {
     stats _stats;
     sstring _name;
     metrics::metric_group _metric_group;
+    // Batching, see set_max_batch_delay()
+    clock_type::duration _max_batch_delay = clock_type::duration::zero();
+    size_t _batch_target = 1;
+    size_t _queued = 0;
+    bool _batch_preempted = false;
+    clock_type::time_point _first_queued;
+    batch_size_histogram _batch_sizes;
+    queue_delay_histogram _queue_delays;
 protected:
     virtual void do_flush() noexcept = 0;
+    // Called by the concrete stages for each call they queue
+    void queued() noexcept;
+    // Runs the queued calls, as do_flush() does, accounting for the batch
+    void run_batch() noexcept;
 public:
     explicit execution_stage(const sstring& name, scheduling_group sg = {});
     virtual ~execution_stage();
@@ -155,6 +182,30 @@ class execution_stage {
     /// Returns execution stage usage statistics
     const stats& get_stats() const noexcept { return _stats; }
 
+    /// Returns the histogram of the sizes of the batches run so far
+    const batch_size_histogram& batch_sizes() const noexcept { return _batch_sizes; }
+
+    /// Returns the histogram of how long the batches run so far waited
+    const queue_delay_histogram& queue_delays() const noexcept { return _queue_delays; }
+
+    /// \brief Lets the stage wait for bigger batches
+    ///
+    /// With a non-zero delay a task to run the queued calls is scheduled
+    /// once there are enough of them for a batch, or the oldest one has
+    /// waited for \c delay, whichever comes first. How many are enough
+    /// adapts to the rate of calls: it doubles when a batch fills up in
+    /// time and halves when it doesn't, up to \ref max_batch_size.
+    /// While calls wait the reactor polls rather than sleeps, so the
+    /// delay should be short, in the order of the task quota.
+    ///
+    /// A zero delay, the default, schedules the task right away.
+    void set_max_batch_delay(clock_type::duration delay) noexcept {
+        _max_batch_delay = delay;
+    }
+
+    /// Returns the current target size of the batches, see set_max_batch_delay()
+    size_t batch_target() const noexcept { return _batch_target; }
+
     /// Flushes execution stage
     ///
     /// Ensures that a task which would execute all queued operations is
@@ -164,6 +215,15 @@ class execution_stage {
     /// \return true if a new task has been scheduled
     bool flush() noexcept;
 
+    /// Flushes execution stage if the batch is due
+    ///
+    /// Like flush(), unless the stage is waiting for a bigger batch and its
+    /// oldest call hasn't waited for as long as it may yet, see
+    /// set_max_batch_delay(). The reactor calls it when it polls.
+    ///
+    /// \return true if a new task has been scheduled
+    bool flush_if_due() noexcept;
+
     /// Checks whether there are pending operations.
     ///
     /// \return true if there is at least one queued operation
@@ -212,7 +272,7 @@ class concrete_execution_stage final : public execution_stage {
                   "Function arguments need to be nothrow move constructible");
 
     static constexpr size_t flush_threshold = 128;
-    static constexpr size_t max_queue_length = 1024;
+    static constexpr size_t max_queue_length = max_batch_size;
 
     using return_type = futurize_t<ReturnType>;
     using promise_type = typename return_type::promise_type;
@@ -253,6 +313,7 @@ class concrete_execution_stage final : public execution_stage {
             }
         }
         _empty = _queue.empty();
+        _queued = _queue.size();
     }
 public:
     explicit concrete_execution_stage(const sstring& name, scheduling_group sg, noncopyable_function<ReturnType (Args...)> f)
@@ -288,13 +349,11 @@ class concrete_execution_stage final : public execution_stage {
     /// \return future containing the result of the call to the stage's function
     return_type operator()(typename internal::wrap_for_es<Args>::type... args) {
         if (_queue.size() >= max_queue_length) {
-            do_flush();
+            run_batch();
         }
         _queue.emplace_back(std::move(args)...);
-        _empty = false;
-        _stats.function_calls_enqueued++;
         auto f = _queue.back()._ready.get_future();
-        flush();
+        queued();
         return f;
     }
 };
@@ -313,6 +372,8 @@ class inheriting_execution_stage {
 ///
 /// A variation of \ref concrete_execution_stage that inherits the \ref scheduling_group
 /// from the caller. Each call (of `operator()`) can be in its own scheduling group.
+/// The stage of a group is made when a call is first made in it, so a stage
+/// used by few of the groups only costs as much as those.
 ///
 /// \tparam ReturnType return type of the function object
 /// \tparam Args  argument pack containing arguments to the function object, needs
@@ -329,16 +390,19 @@ class inheriting_concrete_execution_stage final : public inheriting_execution_st
 
     sstring _name;
     noncopyable_function<ReturnType (Args...)> _function;
-    std::vector<std::optional<per_group_stage_type>> _stage_for_group{max_scheduling_groups()};
+    execution_stage::clock_type::duration _max_batch_delay = execution_stage::clock_type::duration::zero();
+    std::vector<std::unique_ptr<per_group_stage_type>> _stage_for_group;
 private:
-    per_group_stage_type make_stage_for_group(scheduling_group sg) {
+    std::unique_ptr<per_group_stage_type> make_stage_for_group(scheduling_group sg) {
         // We can't use std::ref(function), because reference_wrapper decays to noncopyable_function& and
         // that selects the noncopyable_function copy constructor. Use a lambda instead.
         auto wrapped_function = [&_function = _function] (Args... args) {
             return _function(std::forward<Args>(args)...);
         };
         auto name = fmt::format("{}.{}", _name, sg.name());
-        return per_group_stage_type(name, sg, wrapped_function);
+        auto stage = std::make_unique<per_group_stage_type>(name, sg, wrapped_function);
+        stage->set_max_batch_delay(_max_batch_delay);
+        return stage;
     }
 public:
     /// Construct an inheriting concrete execution stage.
@@ -374,13 +438,27 @@ class inheriting_concrete_execution_stage final : public inheriting_execution_st
     return_type operator()(typename internal::wrap_for_es<Args>::type... args) {
         auto sg = current_scheduling_group();
         auto sg_id = internal::scheduling_group_index(sg);
+        if (__builtin_expect(sg_id >= _stage_for_group.size(), false)) {
+            _stage_for_group.resize(sg_id + 1);
+        }
         auto& slot = _stage_for_group[sg_id];
         if (!slot) {
-            slot.emplace(make_stage_for_group(sg));
+            slot = make_stage_for_group(sg);
         }
         return (*slot)(std::move(args)...);
     }
 
+    /// Lets the stages of all the groups wait for bigger batches, see
+    /// execution_stage::set_max_batch_delay()
+    void set_max_batch_delay(execution_stage::clock_type::duration delay) noexcept {
+        _max_batch_delay = delay;
+        for (auto& stage : _stage_for_group) {
+            if (stage) {
+                stage->set_max_batch_delay(delay);
+            }
+        }
+    }
+
     /// Returns summary of individual execution stage usage statistics
     ///
     /// \returns a vector of the stats of the individual per-scheduling group
@@ -21,7 +21,7 @@
  */
 #pragma once
 
-#include <boost/intrusive/slist.hpp>
+#include <boost/intrusive/list.hpp>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/core/circular_buffer.hh>
@@ -55,6 +55,8 @@ class fair_queue_ticket {
     /// \param size the size of the request
     fair_queue_ticket(uint32_t weight, uint32_t size) noexcept;
     fair_queue_ticket() noexcept {}
+    uint32_t weight() const noexcept { return _weight; }
+    uint32_t size() const noexcept { return _size; }
     fair_queue_ticket operator+(fair_queue_ticket desc) const noexcept;
     fair_queue_ticket operator-(fair_queue_ticket desc) const noexcept;
     /// Increase the quantity represented in this ticket by the amount represented by \c desc
@@ -104,20 +106,36 @@ class fair_queue_ticket {
 class fair_queue_entry {
     friend class fair_queue;
 
+public:
+    using clock_type = std::chrono::steady_clock;
+
+private:
     fair_queue_ticket _ticket;
-    bi::slist_member_hook<> _hook;
+    clock_type::time_point _deadline = clock_type::time_point::max();
+    bi::list_member_hook<> _hook;
 
 public:
     fair_queue_entry(fair_queue_ticket t) noexcept
         : _ticket(std::move(t)) {}
-    using container_list_t = bi::slist<fair_queue_entry,
+    using container_list_t = bi::list<fair_queue_entry,
             bi::constant_time_size<false>,
-            bi::cache_last<true>,
-            bi::member_hook<fair_queue_entry, bi::slist_member_hook<>, &fair_queue_entry::_hook>>;
+            bi::member_hook<fair_queue_entry, bi::list_member_hook<>, &fair_queue_entry::_hook>>;
 
     fair_queue_ticket ticket() const noexcept { return _ticket; }
+
+    /// Sets the time by which the request should be dispatched. Must be
+    /// called before the entry is queued.
+    ///
+    /// A request close to its deadline is dispatched ahead of the other
+    /// requests of its class, and a request past it is not dispatched at
+    /// all (see \ref fair_queue::dispatch_requests).
+    void set_deadline(clock_type::time_point deadline) noexcept { _deadline = deadline; }
+    clock_type::time_point deadline() const noexcept { return _deadline; }
+    bool has_deadline() const noexcept { return _deadline != clock_type::time_point::max(); }
 };
 
+class fair_group_pool;
+
 /// \brief Group of queues class
 ///
 /// This is a fair group. It's attached by one or mode fair queues. On machines having the
@@ -195,6 +213,9 @@ class fair_group {
 
     const fair_queue_ticket _cost_capacity;
     const capacity_t _replenish_rate;
+    // The fraction of the configured replenish rate currently in effect,
+    // lowered by the io_queue latency controller when the device is slow
+    std::atomic<float> _rate_scale;
     const capacity_t _replenish_limit;
     const capacity_t _replenish_threshold;
     std::atomic<clock_type::time_point> _replenished;
@@ -218,17 +239,34 @@ class fair_group {
     fair_group_atomic_rover _capacity_head;
     fair_group_atomic_rover _capacity_ceil;
 
+    /*
+     * Groups sharing a device each get a fraction of its rate. A group
+     * that has requests waiting for capacity may claim the time that an
+     * idle peer from the same pool has not yet turned into capacity, by
+     * moving that peer's replenish timestamp forward. Each stretch of
+     * every group's time is claimed once, either by the group itself
+     * or by one borrower, so the groups together never go above the
+     * device rate.
+     */
+    fair_group_pool* _pool = nullptr;
+    friend class fair_group_pool;
+
     capacity_t fetch_add(fair_group_atomic_rover& rover, capacity_t cap) noexcept;
+    void borrow_capacity(clock_type::time_point now) noexcept;
 
     template <typename Rep, typename Period>
     static auto rate_cast(const std::chrono::duration<Rep, Period> delta) noexcept {
         return std::chrono::duration_cast<rate_resolution>(delta);
     }
 
+    capacity_t replenish_rate() const noexcept {
+        return std::max<capacity_t>(std::round(_replenish_rate * _rate_scale.load(std::memory_order_relaxed)), 1);
+    }
+
     template <typename Rep, typename Period>
     capacity_t accumulated_capacity(const std::chrono::duration<Rep, Period> delta) const noexcept {
        auto delta_at_rate = rate_cast(delta);
-       return std::round(_replenish_rate * delta_at_rate.count());
+       return std::round(replenish_rate() * delta_at_rate.count());
     }
 
 public:
@@ -256,7 +294,7 @@ class fair_group {
     // Estimated time to process the given amount of capacity
     // (peer of accumulated_capacity() helper)
     rate_resolution capacity_duration(capacity_t cap) const noexcept {
-        return rate_resolution(cap / _replenish_rate);
+        return rate_resolution(cap / replenish_rate());
     }
 
     struct config {
@@ -280,10 +318,29 @@ class fair_group {
     void replenish_capacity(clock_type::time_point now) noexcept;
     void maybe_replenish_capacity(clock_type::time_point& local_ts) noexcept;
 
+    // Scale the configured replenish rate by the given factor, in (0, 1]
+    void set_rate_scale(float scale) noexcept { _rate_scale.store(scale, std::memory_order_relaxed); }
+    float rate_scale() const noexcept { return _rate_scale.load(std::memory_order_relaxed); }
+
     capacity_t capacity_deficiency(capacity_t from) const noexcept;
     capacity_t ticket_capacity(fair_queue_ticket ticket) const noexcept;
 };
 
+/// \brief Fair groups sharing one device
+///
+/// The groups are created together with the same configuration, each
+/// for its own fraction of the device rate, and lend each other the
+/// capacity they leave unused when idle. See fair_group.
+class fair_group_pool {
+    std::vector<std::unique_ptr<fair_group>> _groups;
+public:
+    fair_group_pool(fair_group::config cfg, unsigned nr_groups);
+    fair_group_pool(fair_group_pool&&) = delete;
+
+    fair_group& group(unsigned idx) noexcept { return *_groups[idx]; }
+    unsigned size() const noexcept { return _groups.size(); }
+};
+
 /// \brief Fair queuing class
 ///
 /// This is a fair queue, allowing multiple request producers to queue requests
@@ -303,6 +360,12 @@ class fair_group {
 /// When the classes that lag behind start seeing requests, the fair queue will serve
 /// them first, until balance is restored. This balancing is expected to happen within
 /// a certain time window that obeys an exponential decay.
+///
+/// Classes can also be put into groups, which can in turn be put into other
+/// groups. A group competes with its siblings according to its own shares, and
+/// the capacity it gets is split between its members according to theirs. For
+/// example, a group with 30 shares next to a class with 70 gets 30% of the
+/// capacity, and its two classes with 80 and 20 shares get 24% and 6% of it.
 class fair_queue {
 public:
     /// \brief Fair Queue configuration structure.
@@ -312,18 +375,26 @@ class fair_queue {
     struct config {
         sstring label = "";
         std::chrono::microseconds tau = std::chrono::milliseconds(5);
+        /// Requests whose deadline is closer than that are dispatched
+        /// before the other requests of their class
+        std::chrono::microseconds deadline_slack = std::chrono::milliseconds(1);
     };
 
     using class_id = unsigned int;
+    using group_id = unsigned int;
     class priority_class_data;
+    class priority_group_data;
     using capacity_t = fair_group::capacity_t;
     using signed_capacity_t = std::make_signed<capacity_t>::type;
 
 private:
     using clock_type = std::chrono::steady_clock;
+    // A node of the classes tree, either a class or a group
+    class priority_entry;
+    using priority_entry_ptr = priority_entry*;
     using priority_class_ptr = priority_class_data*;
     struct class_compare {
-        bool operator() (const priority_class_ptr& lhs, const priority_class_ptr & rhs) const noexcept;
+        bool operator() (const priority_entry_ptr& lhs, const priority_entry_ptr & rhs) const noexcept;
     };
 
     config _config;
@@ -333,10 +404,18 @@ class fair_queue {
     fair_queue_ticket _resources_queued;
     unsigned _requests_executing = 0;
     unsigned _requests_queued = 0;
-    using prioq = std::priority_queue<priority_class_ptr, std::vector<priority_class_ptr>, class_compare>;
+    using prioq = std::priority_queue<priority_entry_ptr, std::vector<priority_entry_ptr>, class_compare>;
+    // Top-level classes and groups, each group keeps its members in the same way
     prioq _handles;
     std::vector<std::unique_ptr<priority_class_data>> _priority_classes;
+    std::vector<std::unique_ptr<priority_group_data>> _priority_groups;
     capacity_t _last_accumulated = 0;
+    // Capacity of requests that finished, not yet returned to the group.
+    // See notify_request_finished_deferred()
+    capacity_t _capacity_released = 0;
+    // Classes with deadlines are checked for expired and urgent requests
+    // once per dispatch_requests() call
+    unsigned _dispatch_round = 0;
 
     /*
      * When the shared capacity os over the local queue delays
@@ -358,9 +437,14 @@ class fair_queue {
 
     std::optional<pending> _pending;
 
-    void push_priority_class(priority_class_data& pc);
-    void push_priority_class_from_idle(priority_class_data& pc);
-    void pop_priority_class(priority_class_data& pc);
+    prioq& handles_of(priority_entry& pc) noexcept;
+    capacity_t& last_accumulated_of(priority_entry& pc) noexcept;
+    void push_priority_class(priority_entry& pc);
+    void push_priority_class_from_idle(priority_entry& pc);
+    void pop_priority_class(priority_entry& pc);
+    void unqueue_priority_class(priority_entry& pc);
+    void charge_priority_class(priority_entry& pc, capacity_t cost);
+    void expire_requests(priority_class_data& pc, clock_type::time_point now, const std::function<void(fair_queue_entry&)>& expired);
 
     enum class grab_result { grabbed, cant_preempt, pending };
     grab_result grab_capacity(const fair_queue_entry& ent) noexcept;
@@ -380,6 +464,25 @@ class fair_queue {
     /// \param shares how many shares to create this class with
     void register_priority_class(class_id c, uint32_t shares);
 
+    /// Registers a priority class within a group of this fair queue.
+    ///
+    /// \param shares how many shares to create this class with, relative to the other members of the group
+    /// \param g the group to put the class into, must be registered
+    void register_priority_class(class_id c, uint32_t shares, group_id g);
+
+    /// Registers a group of priority classes against this fair queue.
+    ///
+    /// \param shares how many shares to create this group with
+    /// \param parent the group to nest this group into, or a top-level group if not set
+    void register_priority_group(group_id g, uint32_t shares, std::optional<group_id> parent = std::nullopt);
+
+    /// Unregister a group.
+    ///
+    /// It is illegal to unregister a group that still has classes or groups registered into it.
+    void unregister_priority_group(group_id g);
+
+    void update_shares_for_group(group_id g, uint32_t new_shares);
+
     /// Unregister a priority class.
     ///
     /// It is illegal to unregister a priority class that still have pending requests.
@@ -410,10 +513,36 @@ class fair_queue {
     /// Notifies that ont request finished
     /// \param desc an instance of \c fair_queue_ticket structure describing the request that just finished.
     void notify_request_finished(fair_queue_ticket desc) noexcept;
-    void notify_request_cancelled(fair_queue_entry& ent) noexcept;
+
+    /// Notifies that one request finished, like \ref notify_request_finished, but
+    /// keeps its capacity locally until \ref release_finished_capacity (or the next
+    /// \ref dispatch_requests) is called.
+    ///
+    /// The group capacity is shared between all shards, so returning it once for a
+    /// whole batch of completions saves an atomic update of a contended cache line
+    /// for each of them.
+    void notify_request_finished_deferred(fair_queue_ticket desc) noexcept;
+
+    /// Returns the capacity of requests finished with \ref notify_request_finished_deferred
+    /// to the group.
+    void release_finished_capacity() noexcept;
+
+    /// Takes a request that's not dispatched yet out of the queue
+    ///
+    /// The request is unlinked right away rather than left to be skipped
+    /// once it reaches the head of its class, and whatever it was going to
+    /// cost is accounted as cancelled capacity of the class instead.
+    /// \param c the class the entry was queued in
+    /// \param ent the queued entry, which may be destroyed afterwards
+    void notify_request_cancelled(class_id c, fair_queue_entry& ent) noexcept;
 
     /// Try to execute new requests if there is capacity left in the queue.
-    void dispatch_requests(std::function<void(fair_queue_entry&)> cb);
+    ///
+    /// Requests that have a deadline (see \ref fair_queue_entry::set_deadline)
+    /// and missed it are removed from the queue without being dispatched, and
+    /// handed to \c expired instead of \c cb. Without the \c expired callback
+    /// such requests are dispatched anyway.
+    void dispatch_requests(std::function<void(fair_queue_entry&)> cb, std::function<void(fair_queue_entry&)> expired = {});
 
     clock_type::time_point next_pending_aio() const noexcept;
 
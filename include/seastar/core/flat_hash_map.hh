@@ -0,0 +1,632 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/bitops.hh>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace seastar {
+
+/// \cond internal
+namespace internal {
+
+// The control bytes of a group of slots: a slot is empty, deleted, or full
+// with the 7 low bits of the hash of its key. Lookups compare the 16 bytes
+// of a group at once, and only look at the keys whose bits match.
+struct flat_hash_group {
+    static constexpr size_t width = 16;
+    static constexpr int8_t empty = -128;
+    static constexpr int8_t deleted = -2;
+
+    // The masks have bit i set for the matching slot i of the group
+#ifdef __SSE2__
+    static unsigned match(const int8_t* ctrl, int8_t h2) noexcept {
+        auto g = _mm_load_si128(reinterpret_cast<const __m128i*>(ctrl));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), g));
+    }
+    static unsigned match_empty(const int8_t* ctrl) noexcept {
+        return match(ctrl, empty);
+    }
+    // Empty or deleted, the ones with the high bit set
+    static unsigned match_free(const int8_t* ctrl) noexcept {
+        return _mm_movemask_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(ctrl)));
+    }
+#else
+    static unsigned match(const int8_t* ctrl, int8_t h2) noexcept {
+        unsigned m = 0;
+        for (size_t i = 0; i < width; i++) {
+            m |= unsigned(ctrl[i] == h2) << i;
+        }
+        return m;
+    }
+    static unsigned match_empty(const int8_t* ctrl) noexcept {
+        return match(ctrl, empty);
+    }
+    static unsigned match_free(const int8_t* ctrl) noexcept {
+        unsigned m = 0;
+        for (size_t i = 0; i < width; i++) {
+            m |= unsigned(ctrl[i] < 0) << i;
+        }
+        return m;
+    }
+#endif
+    static unsigned match_full(const int8_t* ctrl) noexcept {
+        return ~match_free(ctrl) & ((1u << width) - 1);
+    }
+};
+
+}
+/// \endcond
+
+/// An unordered associative container with open addressing
+///
+/// Similar to std::unordered_map, except that the elements are stored in
+/// a flat array of slots instead of a node each, so that inserting costs
+/// no allocation unless the table grows, and a lookup usually touches a
+/// 16-byte group of control bytes and the one slot holding the key. The
+/// groups are probed with SSE2 when it is available.
+///
+/// The table starts at a single group, so that small maps take a single
+/// small allocation. When it grows, the elements are moved to the new table
+/// a few groups per insertion rather than all at once, so that growing huge
+/// tables does not stall the reactor; lookups meanwhile search both tables.
+///
+/// Unlike std::unordered_map, insertion invalidates all iterators and
+/// references, as it may move elements to another table. Erasing only
+/// invalidates the iterators and references to the erased elements.
+///
+/// \tparam Key the key type, which must be nothrow move constructible
+/// \tparam T the mapped type, which must be nothrow move constructible
+template <typename Key, typename T, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class flat_hash_map {
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+private:
+    static_assert(std::is_nothrow_move_constructible_v<Key> && std::is_nothrow_move_constructible_v<T>,
+            "flat_hash_map moves its elements when it grows");
+
+    using group = internal::flat_hash_group;
+    static constexpr size_t width = group::width;
+    static constexpr size_t npos = size_t(-1);
+
+    struct alignas(std::max(width, alignof(value_type))) storage_unit {
+        char data[std::max(width, alignof(value_type))];
+    };
+
+    struct table {
+        int8_t* ctrl = nullptr;
+        value_type* slots = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+        size_t deleted = 0;
+
+        size_t groups() const noexcept {
+            return capacity / width;
+        }
+        static size_t ctrl_units(size_t capacity) noexcept {
+            return (capacity + sizeof(storage_unit) - 1) / sizeof(storage_unit);
+        }
+        static size_t units(size_t capacity) noexcept {
+            return ctrl_units(capacity) + (capacity * sizeof(value_type) + sizeof(storage_unit) - 1) / sizeof(storage_unit);
+        }
+    };
+
+    // _tables[1] is the table being moved to _tables[0], if any
+    table _tables[2];
+    // The next group of _tables[1] to move, and how many move per insertion
+    size_t _migrate_pos = 0;
+    size_t _migrate_groups = 0;
+    Hash _hash;
+    KeyEqual _eq;
+
+    // 7/8 of the slots may be used, deleted ones included
+    static size_t max_load(size_t capacity) noexcept {
+        return capacity - capacity / 8;
+    }
+    static size_t capacity_for(size_t n) noexcept {
+        size_t capacity = width;
+        while (max_load(capacity) < n) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+    // The hashers of the standard library are often the identity
+    static uint64_t mix(size_t h) noexcept {
+        uint64_t m = uint64_t(h) * 0x9e3779b97f4a7c15;
+        return m ^ (m >> 32);
+    }
+    static int8_t h2(uint64_t h) noexcept {
+        return h & 0x7f;
+    }
+    static size_t h1(uint64_t h) noexcept {
+        return h >> 7;
+    }
+
+    static table allocate_table(size_t capacity) {
+        table t;
+        auto mem = std::allocator<storage_unit>().allocate(table::units(capacity));
+        t.ctrl = reinterpret_cast<int8_t*>(mem);
+        t.slots = reinterpret_cast<value_type*>(mem + table::ctrl_units(capacity));
+        t.capacity = capacity;
+        std::memset(t.ctrl, group::empty, capacity);
+        return t;
+    }
+    static void destroy_elements(table& t) noexcept {
+        for (size_t g = 0; t.size && g < t.capacity; g += width) {
+            for (auto m = group::match_full(t.ctrl + g); m; m &= m - 1) {
+                t.slots[g + count_trailing_zeros(m)].~value_type();
+                t.size--;
+            }
+        }
+    }
+    static void free_table(table& t) noexcept {
+        if (t.capacity) {
+            destroy_elements(t);
+            std::allocator<storage_unit>().deallocate(reinterpret_cast<storage_unit*>(t.ctrl), table::units(t.capacity));
+        }
+        t = table();
+    }
+
+    template <typename K>
+    size_t find_in(const table& t, const K& key, uint64_t h) const {
+        if (!t.size) {
+            return npos;
+        }
+        auto mask = t.groups() - 1;
+        auto g = h1(h) & mask;
+        for (size_t i = 1; ; i++) {
+            auto ctrl = t.ctrl + g * width;
+            for (auto m = group::match(ctrl, h2(h)); m; m &= m - 1) {
+                auto idx = g * width + count_trailing_zeros(m);
+                if (_eq(t.slots[idx].first, key)) {
+                    return idx;
+                }
+            }
+            if (group::match_empty(ctrl)) {
+                return npos;
+            }
+            // Visits all the groups, as their number is a power of two
+            g = (g + i) & mask;
+        }
+    }
+    // Takes a free slot for a key that is not in the table
+    static size_t take_free(table& t, uint64_t h) noexcept {
+        auto mask = t.groups() - 1;
+        auto g = h1(h) & mask;
+        for (size_t i = 1; ; i++) {
+            auto ctrl = t.ctrl + g * width;
+            if (auto m = group::match_free(ctrl)) {
+                auto idx = g * width + count_trailing_zeros(m);
+                if (t.ctrl[idx] == group::deleted) {
+                    t.deleted--;
+                }
+                t.ctrl[idx] = h2(h);
+                t.size++;
+                return idx;
+            }
+            g = (g + i) & mask;
+        }
+    }
+    static void erase_at(table& t, size_t idx) noexcept {
+        t.slots[idx].~value_type();
+        t.size--;
+        // Lookups stop at the first group with an empty slot, so a slot can
+        // only be made empty in a group that already has one
+        auto ctrl = t.ctrl + idx / width * width;
+        if (group::match_empty(ctrl)) {
+            t.ctrl[idx] = group::empty;
+        } else {
+            t.ctrl[idx] = group::deleted;
+            t.deleted++;
+        }
+    }
+
+    void migrate(size_t groups) noexcept {
+        auto& from = _tables[1];
+        auto& to = _tables[0];
+        auto end = std::min(_migrate_pos + groups, from.groups());
+        for (; _migrate_pos < end; _migrate_pos++) {
+            auto g = _migrate_pos * width;
+            for (auto m = group::match_full(from.ctrl + g); m; m &= m - 1) {
+                auto idx = g + count_trailing_zeros(m);
+                auto& v = from.slots[idx];
+                auto to_idx = take_free(to, mix(_hash(v.first)));
+                // The key is destroyed right after it is moved from
+                new (&to.slots[to_idx]) value_type(std::piecewise_construct,
+                        std::forward_as_tuple(std::move(const_cast<Key&>(v.first))),
+                        std::forward_as_tuple(std::move(v.second)));
+                v.~value_type();
+                // Not empty, lookups must go on to the groups not moved yet
+                from.ctrl[idx] = group::deleted;
+                from.size--;
+            }
+        }
+        if (_migrate_pos == from.groups()) {
+            free_table(from);
+        }
+    }
+    void finish_migration() noexcept {
+        if (_tables[1].capacity) {
+            migrate(_tables[1].groups());
+        }
+    }
+    // Moves the elements to a table of \c capacity slots, migrating them
+    // progressively unless \c now
+    void grow(size_t capacity, bool now) {
+        finish_migration();
+        auto t = allocate_table(capacity);
+        _tables[1] = std::exchange(_tables[0], t);
+        _migrate_pos = 0;
+        auto& old = _tables[1];
+        if (!old.size) {
+            free_table(old);
+            return;
+        }
+        if (now) {
+            finish_migration();
+            return;
+        }
+        // Finish before the new table fills up with insertions
+        auto headroom = max_load(capacity) - old.size;
+        _migrate_groups = std::max<size_t>(2, old.groups() / headroom + 1);
+    }
+
+    // Where the key is, or a free slot for it in _tables[0]
+    template <typename K>
+    std::pair<size_t, unsigned> find_or_prepare_insert(const K& key, uint64_t h, bool& inserted) {
+        for (unsigned i = 0; i < 2; i++) {
+            auto idx = find_in(_tables[i], key, h);
+            if (idx != npos) {
+                inserted = false;
+                return {idx, i};
+            }
+        }
+        auto& t = _tables[0];
+        if (t.size + t.deleted >= max_load(t.capacity)) {
+            grow(capacity_for(2 * (size() + 1)), false);
+        } else if (_tables[1].capacity) {
+            migrate(_migrate_groups);
+        }
+        inserted = true;
+        return {take_free(_tables[0], h), 0};
+    }
+
+    template <typename K, typename... Args>
+    std::pair<size_t, unsigned> do_try_emplace(K&& key, bool& inserted, Args&&... args) {
+        auto h = mix(_hash(key));
+        auto [idx, i] = find_or_prepare_insert(key, h, inserted);
+        if (inserted) {
+            auto& t = _tables[0];
+            try {
+                new (&t.slots[idx]) value_type(std::piecewise_construct,
+                        std::forward_as_tuple(std::forward<K>(key)),
+                        std::forward_as_tuple(std::forward<Args>(args)...));
+            } catch (...) {
+                t.ctrl[idx] = group::empty;
+                t.size--;
+                throw;
+            }
+        }
+        return {idx, i};
+    }
+
+    template <bool Const>
+    class iterator_base {
+        using map_type = std::conditional_t<Const, const flat_hash_map, flat_hash_map>;
+        map_type* _map = nullptr;
+        unsigned _table = 2;
+        size_t _index = 0;
+
+        // Moves to the first element at or after the position
+        void settle() noexcept {
+            while (_table < 2) {
+                auto& t = _map->_tables[_table];
+                while (_index < t.capacity) {
+                    auto g = _index / width * width;
+                    if (auto m = group::match_full(t.ctrl + g) >> (_index - g)) {
+                        _index += count_trailing_zeros(m);
+                        return;
+                    }
+                    _index = g + width;
+                }
+                _table++;
+                _index = 0;
+            }
+        }
+
+        iterator_base(map_type* map, unsigned table, size_t index) noexcept
+                : _map(map), _table(table), _index(index) {
+        }
+        static iterator_base begin(map_type* map) noexcept {
+            iterator_base it(map, 0, 0);
+            it.settle();
+            return it;
+        }
+        friend class flat_hash_map;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename flat_hash_map::value_type;
+        using difference_type = ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        iterator_base() noexcept = default;
+        // iterator converts to const_iterator
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        iterator_base(const iterator_base<false>& o) noexcept
+                : _map(o._map), _table(o._table), _index(o._index) {
+        }
+
+        reference operator*() const noexcept {
+            return _map->_tables[_table].slots[_index];
+        }
+        pointer operator->() const noexcept {
+            return &**this;
+        }
+        iterator_base& operator++() noexcept {
+            _index++;
+            settle();
+            return *this;
+        }
+        iterator_base operator++(int) noexcept {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+        bool operator==(const iterator_base& o) const noexcept {
+            return _table == o._table && _index == o._index;
+        }
+        bool operator!=(const iterator_base& o) const noexcept {
+            return !(*this == o);
+        }
+        friend class iterator_base<!Const>;
+    };
+public:
+    using iterator = iterator_base<false>;
+    using const_iterator = iterator_base<true>;
+
+    flat_hash_map() = default;
+    explicit flat_hash_map(size_t n, const Hash& hash = Hash(), const KeyEqual& eq = KeyEqual())
+            : _hash(hash), _eq(eq) {
+        reserve(n);
+    }
+    flat_hash_map(std::initializer_list<value_type> il) {
+        reserve(il.size());
+        for (auto& v : il) {
+            insert(v);
+        }
+    }
+    flat_hash_map(const flat_hash_map& o)
+            : _hash(o._hash), _eq(o._eq) {
+        reserve(o.size());
+        for (auto& v : o) {
+            insert(v);
+        }
+    }
+    flat_hash_map(flat_hash_map&& o) noexcept
+            : _migrate_pos(o._migrate_pos)
+            , _migrate_groups(o._migrate_groups)
+            , _hash(std::move(o._hash))
+            , _eq(std::move(o._eq)) {
+        _tables[0] = std::exchange(o._tables[0], table());
+        _tables[1] = std::exchange(o._tables[1], table());
+    }
+    flat_hash_map& operator=(const flat_hash_map& o) {
+        if (this != &o) {
+            flat_hash_map tmp(o);
+            swap(tmp);
+        }
+        return *this;
+    }
+    flat_hash_map& operator=(flat_hash_map&& o) noexcept {
+        if (this != &o) {
+            this->~flat_hash_map();
+            new (this) flat_hash_map(std::move(o));
+        }
+        return *this;
+    }
+    ~flat_hash_map() {
+        free_table(_tables[0]);
+        free_table(_tables[1]);
+    }
+
+    void swap(flat_hash_map& o) noexcept {
+        using std::swap;
+        swap(_tables[0], o._tables[0]);
+        swap(_tables[1], o._tables[1]);
+        swap(_migrate_pos, o._migrate_pos);
+        swap(_migrate_groups, o._migrate_groups);
+        swap(_hash, o._hash);
+        swap(_eq, o._eq);
+    }
+
+    size_t size() const noexcept {
+        return _tables[0].size + _tables[1].size;
+    }
+    bool empty() const noexcept {
+        return !size();
+    }
+    /// The number of slots of the table, elements are moved to a larger
+    /// table when 7/8 of them are used
+    size_t capacity() const noexcept {
+        return _tables[0].capacity;
+    }
+    /// Whether the elements are being moved to a new table
+    bool rehashing() const noexcept {
+        return _tables[1].capacity;
+    }
+
+    /// Makes room for \c n elements, moving the existing ones at once
+    void reserve(size_t n) {
+        finish_migration();
+        if (n > max_load(_tables[0].capacity) - _tables[0].deleted) {
+            grow(capacity_for(std::max(n, size())), true);
+        }
+    }
+
+    /// Destroys the elements, keeping the table
+    void clear() noexcept {
+        free_table(_tables[1]);
+        destroy_elements(_tables[0]);
+        if (_tables[0].capacity) {
+            std::memset(_tables[0].ctrl, group::empty, _tables[0].capacity);
+        }
+        _tables[0].deleted = 0;
+    }
+
+    iterator begin() noexcept {
+        return iterator::begin(this);
+    }
+    const_iterator begin() const noexcept {
+        return const_iterator::begin(this);
+    }
+    const_iterator cbegin() const noexcept {
+        return begin();
+    }
+    iterator end() noexcept {
+        return iterator(this, 2, 0);
+    }
+    const_iterator end() const noexcept {
+        return const_iterator(this, 2, 0);
+    }
+    const_iterator cend() const noexcept {
+        return end();
+    }
+
+    iterator find(const Key& key) {
+        auto h = mix(_hash(key));
+        for (unsigned i = 0; i < 2; i++) {
+            auto idx = find_in(_tables[i], key, h);
+            if (idx != npos) {
+                return iterator(this, i, idx);
+            }
+        }
+        return end();
+    }
+    const_iterator find(const Key& key) const {
+        return const_cast<flat_hash_map*>(this)->find(key);
+    }
+    bool contains(const Key& key) const {
+        return find(key) != end();
+    }
+    size_t count(const Key& key) const {
+        return contains(key);
+    }
+
+    T& at(const Key& key) {
+        auto it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("flat_hash_map::at");
+        }
+        return it->second;
+    }
+    const T& at(const Key& key) const {
+        return const_cast<flat_hash_map*>(this)->at(key);
+    }
+    T& operator[](const Key& key) {
+        return try_emplace(key).first->second;
+    }
+    T& operator[](Key&& key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        bool inserted;
+        auto [idx, i] = do_try_emplace(key, inserted, std::forward<Args>(args)...);
+        return {iterator(this, i, idx), inserted};
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        bool inserted;
+        auto [idx, i] = do_try_emplace(std::move(key), inserted, std::forward<Args>(args)...);
+        return {iterator(this, i, idx), inserted};
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        std::pair<Key, T> v(std::forward<Args>(args)...);
+        return try_emplace(std::move(v.first), std::move(v.second));
+    }
+    std::pair<iterator, bool> insert(const value_type& v) {
+        return try_emplace(v.first, v.second);
+    }
+    std::pair<iterator, bool> insert(value_type&& v) {
+        return try_emplace(std::move(const_cast<Key&>(v.first)), std::move(v.second));
+    }
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& m) {
+        auto ret = try_emplace(key, std::forward<M>(m));
+        if (!ret.second) {
+            ret.first->second = std::forward<M>(m);
+        }
+        return ret;
+    }
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& m) {
+        auto ret = try_emplace(std::move(key), std::forward<M>(m));
+        if (!ret.second) {
+            ret.first->second = std::forward<M>(m);
+        }
+        return ret;
+    }
+
+    /// Erases the element, returning the iterator to the next one
+    iterator erase(const_iterator it) noexcept {
+        iterator next(this, it._table, it._index);
+        ++next;
+        erase_at(_tables[it._table], it._index);
+        return next;
+    }
+    iterator erase(iterator it) noexcept {
+        return erase(const_iterator(it));
+    }
+    size_t erase(const Key& key) {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+};
+
+}
@@ -32,7 +32,9 @@
 
 #include <seastar/core/file.hh>
 #include <seastar/core/iostream.hh>
+#include <seastar/core/scheduling.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <seastar/core/shared_future.hh>
 #include <seastar/core/internal/api-level.hh>
 
 namespace seastar {
@@ -56,6 +58,14 @@ struct file_input_stream_options {
     unsigned read_ahead = 0;      ///< Maximum number of extra read-ahead operations
     ::seastar::io_priority_class io_priority_class = default_priority_class();
     lw_shared_ptr<file_input_stream_history> dynamic_adjustments = { }; ///< Input stream history, if null dynamic adjustments are disabled
+    /// Maximum number of bytes to read ahead, if non-zero enables the
+    /// adaptive read-ahead window. The window starts at buffer_size and
+    /// grows while the consumer waits for data, first by merging reads
+    /// into larger ones (up to the file's disk_read_max_length), then by
+    /// issuing more of them in parallel. It shrinks when reads take
+    /// much longer per byte than they used to, i.e. when the device or
+    /// the I/O queue is under pressure. read_ahead is ignored in this mode.
+    size_t max_read_ahead = 0;
 };
 
 /// \brief Creates an input_stream to read a portion of a file.
@@ -82,6 +92,44 @@ input_stream<char> make_file_input_stream(
 input_stream<char> make_file_input_stream(
         file file, file_input_stream_options = {});
 
+/// \brief Batches flushes of a file.
+///
+/// Writers that flush the same file, e.g. several output streams of a
+/// commit log, each wait for their own fdatasync(). A group_commit issues
+/// a single file::flush() for all the flush() calls made while the
+/// previous one was in progress (or within \c window of the first of
+/// them), and resolves their futures together. Each returned future
+/// resolves after a flush that started after the call, so all writes
+/// completed before the call are stable.
+class group_commit {
+public:
+    struct stats {
+        uint64_t requests = 0; ///< Number of flush() calls
+        uint64_t flushes = 0;  ///< Number of file::flush() calls issued
+    };
+private:
+    file _file;
+    std::chrono::steady_clock::duration _window;
+    // Flush collecting waiters, not yet started
+    lw_shared_ptr<shared_promise<>> _next;
+    future<> _in_flight = make_ready_future<>();
+    stats _stats;
+public:
+    /// \param f the file to flush
+    /// \param window how long to wait for more flushes once one is
+    ///        requested and no flush is in progress; zero batches only
+    ///        the requests that arrive while a flush is in progress
+    explicit group_commit(file f, std::chrono::steady_clock::duration window = {}) noexcept;
+    group_commit(group_commit&&) = delete;
+
+    /// Flushes the file, together with other concurrent requests.
+    future<> flush() noexcept;
+    /// Waits for the requested flushes to complete. Doesn't close the file.
+    future<> close() noexcept;
+
+    const stats& get_stats() const noexcept { return _stats; }
+};
+
 struct file_output_stream_options {
     // For small files, setting preallocation_size can make it impossible for XFS to find
     // an aligned extent. On the other hand, without it, XFS will divide the file into
@@ -92,8 +140,19 @@ struct file_output_stream_options {
     // Large files should increase both buffer_size and preallocation_size.
     unsigned buffer_size = 65536;
     unsigned preallocation_size = 0; ///< Preallocate extents. For large files, set to a large number (a few megabytes) to reduce fragmentation
+    /// Extents of \ref preallocation_size are allocated in the background,
+    /// ahead of the writes: the next one once the stream gets closer than
+    /// this to the end of the preallocated range. 0 means half of
+    /// \ref preallocation_size.
+    unsigned preallocation_headroom = 0;
+    /// The scheduling group preallocation runs in
+    scheduling_group preallocation_scheduling_group = default_scheduling_group();
     unsigned write_behind = 1; ///< Number of buffers to write in parallel
     ::seastar::io_priority_class io_priority_class = default_priority_class();
+    /// If set, flush() of the stream goes through it, batching it with the
+    /// flushes of other streams or writers sharing it. It must be created
+    /// for the same file as the stream.
+    lw_shared_ptr<group_commit> flush_group = { };
 };
 
 SEASTAR_INCLUDE_API_V2 namespace api_v2 {
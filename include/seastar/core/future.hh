@@ -23,6 +23,7 @@
 
 #include <seastar/core/task.hh>
 #include <seastar/core/thread_impl.hh>
+#include <seastar/core/internal/size_class_freelist.hh>
 #include <stdexcept>
 #include <atomic>
 #include <memory>
@@ -776,6 +777,22 @@ struct continuation final : continuation_base_with_promise<Promise, T SEASTAR_EL
         }
         delete this;
     }
+    // Continuations are recycled through a per-shard freelist, as then()
+    // chains allocate and free them at a high rate
+    static void* operator new(size_t size) {
+        if constexpr (alignof(continuation) > alignof(std::max_align_t)) {
+            return ::operator new(size, std::align_val_t(alignof(continuation)));
+        } else {
+            return internal::local_continuation_freelist.allocate(size);
+        }
+    }
+    static void operator delete(void* p, size_t size) noexcept {
+        if constexpr (alignof(continuation) > alignof(std::max_align_t)) {
+            ::operator delete(p, size, std::align_val_t(alignof(continuation)));
+        } else {
+            internal::local_continuation_freelist.deallocate(p, size);
+        }
+    }
     Func _func;
     [[no_unique_address]] Wrapper _wrapper;
 };
@@ -0,0 +1,66 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/http/httpd.hh>
+#include <seastar/core/memory.hh>
+
+namespace seastar {
+
+namespace heap_profile {
+
+/*!
+ * \brief Adds an endpoint exposing the heap profile of all shards in pprof format
+ *
+ * GET \c path returns the live allocations recorded by the heap profiler
+ * (see \ref memory::set_heap_profiling_enabled()) on all shards, in the
+ * legacy text heap profile format, which \c pprof reads directly:
+ *
+ *     pprof -http :8080 <binary> http://<host>:<port>/debug/pprof/heap
+ *
+ * POST \c path turns profiling on or off on all shards at runtime:
+ * \c enable=true|false switches it, and \c sample_period=N sets the mean
+ * number of bytes allocated between samples (see
+ * \ref memory::set_heap_profiling_sample_period()).
+ *
+ * Requires seastar to be compiled with heap profiling support; otherwise
+ * the profile is empty.
+ */
+/// @{
+future<> add_heap_profile_routes(distributed<http_server>& server, sstring path = "/debug/pprof/heap");
+future<> add_heap_profile_routes(http_server& server, sstring path = "/debug/pprof/heap");
+/// @}
+
+namespace internal {
+
+struct shard_profile {
+    size_t sample_period = 0;
+    std::vector<memory::heap_profile_entry> entries;
+};
+
+// Formats the profiles of all shards as served by the GET endpoint
+sstring format_profile(const std::vector<shard_profile>& profiles);
+
+}
+
+}
+}
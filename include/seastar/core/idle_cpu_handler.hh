@@ -56,4 +56,19 @@ using idle_cpu_handler = noncopyable_function<idle_cpu_handler_result(work_waiti
 /// otherwise. This function should be used by a handler to return early if a task appears.
 void set_idle_cpu_handler(idle_cpu_handler&& handler);
 
+/// How a shard that ran out of work polls for more before going to sleep.
+///
+/// The adaptive modes learn how long the shard's idle periods usually last
+/// and poll only when new work is likely to come within a short time. The
+/// longer idle periods they expect, the sooner they sleep. On x86 cpus that
+/// have it, \c balanced and \c power modes poll with \c tpause, which lets
+/// the core run in a light power saving state between polls. \c --poll-mode
+/// overrides all modes.
+enum class idle_mode {
+    fixed,    //!< Poll for \c --idle-poll-time-us, then sleep
+    latency,  //!< Poll while work usually comes in, up to ten times \c --idle-poll-time-us
+    balanced, //!< Poll when work usually comes in within \c --idle-poll-time-us
+    power,    //!< Poll when work usually comes in within a quarter of \c --idle-poll-time-us
+};
+
 }
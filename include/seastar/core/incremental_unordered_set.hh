@@ -0,0 +1,212 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <boost/intrusive/unordered_set.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace seastar {
+
+/// An intrusive unordered set that grows without rehashing all its elements at once
+///
+/// Wraps a boost::intrusive::unordered_set, whose rehash() relinks all the
+/// elements to the new bucket array in one go, which takes long enough to
+/// stall the reactor when there are millions of them. Here, when the load
+/// factor reaches \c max_load, the elements stay in the old bucket array and
+/// are moved to one twice as large a few buckets at a time, on the following
+/// insertions. An element is in the new array if its bucket in the old one
+/// was moved already, so lookups still search a single bucket.
+///
+/// Since the set is intrusive, moving an element invalidates the iterators
+/// of the underlying sets but not pointers to the elements, which is what
+/// the set deals in.
+///
+/// \tparam T the element type
+/// \tparam Options the options of the boost::intrusive::unordered_set, such
+///         as the hook, power_2_buckets and constant_time_size are implied
+template <typename T, typename... Options>
+class incremental_unordered_set {
+public:
+    using set_type = boost::intrusive::unordered_set<T, Options...,
+            boost::intrusive::power_2_buckets<true>,
+            boost::intrusive::constant_time_size<true>>;
+    using bucket_type = typename set_type::bucket_type;
+    using bucket_traits = typename set_type::bucket_traits;
+private:
+    struct table {
+        std::unique_ptr<bucket_type[]> buckets;
+        set_type set;
+
+        explicit table(size_t bucket_count)
+                : buckets(new bucket_type[bucket_count])
+                , set(bucket_traits(buckets.get(), bucket_count)) {
+        }
+    };
+    // Moves at least this many buckets per insertion
+    static constexpr size_t min_buckets_per_step = 2;
+
+    std::unique_ptr<table> _current;
+    // The table being moved to _current, if any
+    std::unique_ptr<table> _old;
+    // The next bucket of _old to move, and how many move per insertion
+    size_t _migrate_pos = 0;
+    size_t _buckets_per_step = 0;
+    float _max_load;
+    size_t _grow_threshold;
+    uint64_t _grow_failures = 0;
+
+    table& table_for(const T& value) noexcept {
+        if (_old && _old->set.bucket(value) >= _migrate_pos) {
+            return *_old;
+        }
+        return *_current;
+    }
+
+    void migrate(size_t buckets) noexcept {
+        auto& from = _old->set;
+        auto end = std::min(_migrate_pos + buckets, from.bucket_count());
+        for (; _migrate_pos < end; _migrate_pos++) {
+            while (from.begin(_migrate_pos) != from.end(_migrate_pos)) {
+                auto& value = *from.begin(_migrate_pos);
+                from.erase(from.iterator_to(value));
+                _current->set.insert(value);
+            }
+        }
+        if (_migrate_pos == from.bucket_count()) {
+            _old.reset();
+        }
+    }
+
+    void grow() noexcept {
+        if (_old) {
+            migrate(_old->set.bucket_count());
+        }
+        auto bucket_count = _current->set.bucket_count() * 2;
+        std::unique_ptr<table> t;
+        try {
+            t = std::make_unique<table>(bucket_count);
+        } catch (const std::bad_alloc&) {
+            // Tried again on the next insertion
+            _grow_failures++;
+            return;
+        }
+        _old = std::exchange(_current, std::move(t));
+        _migrate_pos = 0;
+        _grow_threshold = bucket_count * _max_load;
+        // Finish before the new table has to grow in turn
+        auto headroom = std::max<size_t>(1, _grow_threshold - size());
+        _buckets_per_step = std::max(min_buckets_per_step, _old->set.bucket_count() / headroom + 1);
+    }
+public:
+    /// \param initial_bucket_count the number of buckets to start with, a power of two
+    /// \param max_load the load factor at which the set grows
+    explicit incremental_unordered_set(size_t initial_bucket_count = 1024, float max_load = 0.75f)
+            : _current(std::make_unique<table>(initial_bucket_count))
+            , _max_load(max_load)
+            , _grow_threshold(initial_bucket_count * max_load) {
+    }
+
+    size_t size() const noexcept {
+        return _current->set.size() + (_old ? _old->set.size() : 0);
+    }
+    bool empty() const noexcept {
+        return !size();
+    }
+    /// The number of buckets of the table the elements are moved to
+    size_t bucket_count() const noexcept {
+        return _current->set.bucket_count();
+    }
+    /// Whether elements are being moved to a larger bucket array
+    bool rehashing() const noexcept {
+        return bool(_old);
+    }
+    /// How many times growing failed for lack of memory
+    uint64_t grow_failures() const noexcept {
+        return _grow_failures;
+    }
+
+    /// Finds the element equal to \c key
+    ///
+    /// \param hasher hashes \c key as the set hashes its elements
+    /// \param eq compares \c key to elements
+    /// \return the element, or nullptr
+    template <typename Key, typename KeyHasher, typename KeyEqual>
+    T* find(const Key& key, KeyHasher hasher, KeyEqual eq) noexcept {
+        auto* t = _current.get();
+        if (_old && _old->set.bucket(key, hasher) >= _migrate_pos) {
+            t = _old.get();
+        }
+        auto it = t->set.find(key, hasher, eq);
+        return it != t->set.end() ? &*it : nullptr;
+    }
+
+    /// Inserts \c value, unless there is an equal element already
+    ///
+    /// \return the element equal to \c value, and whether it was inserted
+    std::pair<T*, bool> insert(T& value) noexcept {
+        auto ret = table_for(value).set.insert(value);
+        T* found = &*ret.first;
+        if (ret.second) {
+            if (_old) {
+                migrate(_buckets_per_step);
+            } else if (size() >= _grow_threshold) {
+                grow();
+            }
+        }
+        return {found, ret.second};
+    }
+
+    void erase(T& value) noexcept {
+        auto& s = table_for(value).set;
+        s.erase(s.iterator_to(value));
+    }
+
+    /// Removes all the elements, passing them to \c disposer
+    template <typename Disposer>
+    void clear_and_dispose(Disposer disposer) noexcept {
+        _current->set.clear_and_dispose(disposer);
+        if (_old) {
+            _old->set.clear_and_dispose(disposer);
+            _old.reset();
+        }
+    }
+
+    /// Calls \c func with the number of elements of each bucket, the ones
+    /// being moved included
+    template <typename Func>
+    void for_each_bucket_size(Func func) const {
+        for (auto* t : {_current.get(), _old.get()}) {
+            if (t) {
+                for (size_t i = 0; i < t->set.bucket_count(); i++) {
+                    func(t->set.bucket_size(i));
+                }
+            }
+        }
+    }
+};
+
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+namespace seastar {
+
+namespace internal {
+
+// Runs the rest of a primitive's wakeups in a task of their own, once it
+// woke a batch of waiters, so that waking thousands of them doesn't stall
+// the reactor. Moving cancels the task of the one moved from, the owner
+// has to reschedule it for the new one if it still has waiters to wake.
+class deferred_wakeup {
+    class wakeup_task;
+    wakeup_task* _task = nullptr;
+public:
+    deferred_wakeup() noexcept = default;
+    deferred_wakeup(deferred_wakeup&& o) noexcept {
+        o.cancel();
+    }
+    deferred_wakeup& operator=(deferred_wakeup&& o) noexcept {
+        cancel();
+        o.cancel();
+        return *this;
+    }
+    ~deferred_wakeup() {
+        cancel();
+    }
+    bool pending() const noexcept {
+        return _task;
+    }
+    // Schedules fn(target), which has to call done() first. Returns false
+    // if the task couldn't be allocated.
+    bool schedule(void (*fn)(void*), void* target) noexcept;
+    void done() noexcept {
+        _task = nullptr;
+    }
+    void cancel() noexcept;
+};
+
+}
+
+}
@@ -35,7 +35,7 @@ namespace internal {
 
 class io_request {
 public:
-    enum class operation { read, readv, write, writev, fdatasync, recv, recvmsg, send, sendmsg, accept, connect, poll_add, poll_remove, cancel };
+    enum class operation { read, readv, write, writev, fdatasync, recv, recvmsg, send, sendmsg, accept, connect, poll_add, poll_remove, cancel, nvme_read, nvme_write, discard, punch_hole };
 private:
     operation _op;
     int _fd;
@@ -65,6 +65,10 @@ class io_request {
 
     bool _nowait_works;
 
+    // NVMe passthrough commands address the namespace in logical blocks
+    uint8_t _lba_shift;
+    uint32_t _nsid;
+
     explicit io_request(operation op, int fd, int flags, ::msghdr* msg)
         : _op(op)
         , _fd(fd)
@@ -118,6 +122,17 @@ class io_request {
         _size.len = size;
     }
 
+    explicit io_request(operation op, int fd, uint32_t nsid, unsigned lba_shift, uint64_t pos, char* ptr, size_t size)
+        : _op(op)
+        , _fd(fd)
+        , _lba_shift(lba_shift)
+        , _nsid(nsid)
+    {
+        _attr.pos = pos;
+        _ptr.addr = ptr;
+        _size.len = size;
+    }
+
     explicit io_request(operation op, int fd)
         : _op(op)
         , _fd(fd)
@@ -142,6 +157,7 @@ class io_request {
         case operation::readv:
         case operation::recvmsg:
         case operation::recv:
+        case operation::nvme_read:
             return true;
         default:
             return false;
@@ -154,12 +170,21 @@ class io_request {
         case operation::writev:
         case operation::send:
         case operation::sendmsg:
+        case operation::nvme_write:
+        case operation::discard:
+        case operation::punch_hole:
             return true;
         default:
             return false;
         }
     }
 
+    // Discards have no asynchronous system call, the I/O queue runs them
+    // in the syscall thread
+    bool is_discard() const {
+        return _op == operation::discard || _op == operation::punch_hole;
+    }
+
     sstring opname() const;
 
     operation opcode() const {
@@ -218,6 +243,14 @@ class io_request {
         return _nowait_works;
     }
 
+    uint32_t nsid() const {
+        return _nsid;
+    }
+
+    unsigned lba_shift() const {
+        return _lba_shift;
+    }
+
     static io_request make_read(int fd, uint64_t pos, void* address, size_t size, bool nowait_works) {
         return io_request(operation::read, fd, pos, reinterpret_cast<char*>(address), size, nowait_works);
     }
@@ -250,6 +283,25 @@ class io_request {
         return io_request(operation::writev, fd, pos, iov.data(), iov.size(), nowait_works);
     }
 
+    // pos and size are in bytes, and must be multiples of the logical block size
+    static io_request make_nvme_read(int fd, uint32_t nsid, unsigned lba_shift, uint64_t pos, void* address, size_t size) {
+        return io_request(operation::nvme_read, fd, nsid, lba_shift, pos, reinterpret_cast<char*>(address), size);
+    }
+
+    static io_request make_nvme_write(int fd, uint32_t nsid, unsigned lba_shift, uint64_t pos, const void* address, size_t size) {
+        return io_request(operation::nvme_write, fd, nsid, lba_shift, pos, const_cast<char*>(reinterpret_cast<const char*>(address)), size);
+    }
+
+    // Discards a range of a block device
+    static io_request make_discard(int fd, uint64_t pos, size_t size) {
+        return io_request(operation::discard, fd, pos, nullptr, size);
+    }
+
+    // Punches a hole in a file, keeping its size
+    static io_request make_punch_hole(int fd, uint64_t pos, size_t size) {
+        return io_request(operation::punch_hole, fd, pos, nullptr, size);
+    }
+
     static io_request make_fdatasync(int fd) {
         return io_request(operation::fdatasync, fd);
     }
@@ -39,6 +39,17 @@ namespace internal {
 
 class buffer_allocator;
 
+// Reads the notifications the kernel queues on a socket's error queue (see
+// MSG_ERRQUEUE in recv(2)), such as MSG_ZEROCOPY completions. While that
+// queue is non-empty the socket polls as having an error, which wakes its
+// reader and writer even though there's nothing for them to do, so they
+// hand the queue over to the consumer before waiting again.
+class error_queue_consumer {
+public:
+    virtual ~error_queue_consumer() = default;
+    virtual void consume_error_queue(file_desc& fd) noexcept = 0;
+};
+
 }
 
 namespace net {
@@ -69,9 +80,18 @@ class pollable_fd_state {
     int events_requested = 0; // wanted by pollin/pollout promises
     int events_epoll = 0;     // installed in epoll
     int events_known = 0;     // returned from epoll
+    internal::error_queue_consumer* error_queue = nullptr;
+
+    // Called when a wakeup turned out to be spurious
+    void maybe_consume_error_queue() noexcept {
+        if (error_queue) {
+            error_queue->consume_error_queue(fd);
+        }
+    }
 
     friend class reactor;
     friend class pollable_fd;
+    friend class reactor_backend_uring;
 
     future<size_t> read_some(char* buffer, size_t size);
     future<size_t> read_some(uint8_t* buffer, size_t size);
@@ -88,7 +108,7 @@ class pollable_fd_state {
     void abort_writer();
     future<std::tuple<pollable_fd, socket_address>> accept();
     future<> connect(socket_address& sa);
-    future<size_t> sendmsg(struct msghdr *msg);
+    future<size_t> sendmsg(struct msghdr *msg, int flags = 0);
     future<size_t> recvmsg(struct msghdr *msg);
     future<size_t> sendto(socket_address addr, const void* buf, size_t len);
 
@@ -157,8 +177,8 @@ class pollable_fd {
     future<> connect(socket_address& sa) {
         return _s->connect(sa);
     }
-    future<size_t> sendmsg(struct msghdr *msg) {
-        return _s->sendmsg(msg);
+    future<size_t> sendmsg(struct msghdr *msg, int flags = 0) {
+        return _s->sendmsg(msg, flags);
     }
     future<size_t> recvmsg(struct msghdr *msg) {
         return _s->recvmsg(msg);
@@ -167,6 +187,7 @@ class pollable_fd {
         return _s->sendto(addr, buf, len);
     }
     file_desc& get_file_desc() const { return _s->fd; }
+    void set_error_queue_consumer(internal::error_queue_consumer* consumer) { _s->error_queue = consumer; }
     void shutdown(int how);
     void close() { _s.reset(); }
     explicit operator bool() const noexcept {
@@ -204,14 +225,15 @@ class readable_eventfd {
 class writeable_eventfd {
     file_desc _fd;
 public:
-    explicit writeable_eventfd(size_t initial = 0) : _fd(try_create_eventfd(initial)) {}
+    // flags are passed on to eventfd(2), on top of EFD_CLOEXEC
+    explicit writeable_eventfd(size_t initial = 0, int flags = 0) : _fd(try_create_eventfd(initial, flags)) {}
     writeable_eventfd(writeable_eventfd&&) = default;
     readable_eventfd read_side();
     void signal(size_t nr);
     int get_read_fd() { return _fd.get(); }
 private:
     explicit writeable_eventfd(file_desc&& fd) : _fd(std::move(fd)) {}
-    static file_desc try_create_eventfd(size_t initial);
+    static file_desc try_create_eventfd(size_t initial, int flags);
 
     friend class readable_eventfd;
 };
@@ -0,0 +1,110 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/sstring.hh>
+#include <seastar/util/noncopyable_function.hh>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <typeinfo>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace seastar {
+
+namespace internal {
+
+// A per-shard ring of the most recent scheduler events: task queue runs,
+// pollers that found work and tasks that overran the task quota, or the
+// stall detector threshold if that is lower. It is
+// written only by the owning reactor, so recording is a couple of stores
+// and the oldest events are silently overwritten.
+//
+// Timestamps are raw ticks (the TSC where available); they are converted
+// to wall time only when the ring is formatted.
+class scheduler_trace_ring {
+public:
+    enum class event_type : uint32_t {
+        task_queue,
+        poller,
+        long_task,
+    };
+    struct event {
+        uint64_t start;
+        uint64_t duration;
+        // The poller or the continuation, for poller and long_task events
+        const std::type_info* type;
+        event_type kind;
+        // Scheduling group id, for task_queue and long_task events
+        unsigned id;
+    };
+private:
+    std::unique_ptr<event[]> _events;
+    uint64_t _mask = 0;
+    uint64_t _head = 0;
+    uint64_t _long_task_threshold = 0;
+    uint64_t _base_ticks = 0;
+    double _ticks_per_ns = 1.0;
+    std::chrono::steady_clock::time_point _base_time;
+public:
+    static uint64_t timestamp() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // How many ticks timestamp() advances per nanosecond, measured once
+    // per process
+    static double ticks_per_ns() noexcept;
+
+    // Allocates room for at least \c entries events (0 disables tracing).
+    // Tasks running longer than \c long_task_threshold are recorded individually.
+    void configure(size_t entries, std::chrono::nanoseconds long_task_threshold);
+
+    bool enabled() const noexcept {
+        return _mask != 0;
+    }
+
+    uint64_t long_task_threshold() const noexcept {
+        return _long_task_threshold;
+    }
+
+    void set_long_task_threshold(std::chrono::nanoseconds long_task_threshold) noexcept {
+        _long_task_threshold = long_task_threshold.count() * _ticks_per_ns;
+    }
+
+    void record(event_type kind, unsigned id, uint64_t start, uint64_t end, const std::type_info* type = nullptr) noexcept {
+        _events[_head++ & _mask] = event{start, end - start, type, kind, id};
+    }
+
+    // Formats the events, oldest first, as comma-separated Chrome trace
+    // event objects on the track of \c shard
+    sstring to_json(unsigned shard, noncopyable_function<sstring (unsigned)> group_name) const;
+};
+
+}
+
+}
@@ -0,0 +1,118 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace seastar {
+
+namespace internal {
+
+// Per-thread cache of recently freed objects, bucketed into size classes
+// of \c Granularity bytes up to \c MaxSize, each holding up to \c MaxCached
+// objects. Larger objects go straight to the memory allocator.
+//
+// It is meant for objects that are created and destroyed at a high rate,
+// mostly on the shard that allocated them, such as continuations: keeping
+// a few freed ones around lets most allocations skip the memory allocator.
+//
+// Debug builds bypass the cache, to keep use-after-free detection working.
+template <size_t Granularity, size_t MaxSize, unsigned MaxCached>
+class size_class_freelist {
+    static constexpr size_t granularity = Granularity;
+    static constexpr size_t max_size = MaxSize;
+    static constexpr size_t nr_classes = max_size / granularity;
+    static constexpr unsigned max_cached = MaxCached;
+    static_assert(max_size % granularity == 0);
+    struct node {
+        node* next;
+    };
+    node* _heads[nr_classes] = {};
+    unsigned _counts[nr_classes] = {};
+private:
+    static constexpr size_t class_of(size_t size) noexcept {
+        return (size - 1) / granularity;
+    }
+public:
+    constexpr size_class_freelist() noexcept = default;
+
+    void* allocate(size_t size) {
+#ifndef SEASTAR_DEBUG
+        if (size <= max_size) {
+            auto c = class_of(size);
+            if (auto n = _heads[c]) {
+                _heads[c] = n->next;
+                --_counts[c];
+                return n;
+            }
+            // Allocate the whole class, so the object can be reused for any size in it
+            return ::operator new((c + 1) * granularity);
+        }
+#endif
+        return ::operator new(size);
+    }
+
+    void deallocate(void* p, size_t size) noexcept {
+#ifndef SEASTAR_DEBUG
+        if (size <= max_size) {
+            auto c = class_of(size);
+            if (_counts[c] < max_cached) {
+                _heads[c] = new (p) node{_heads[c]};
+                ++_counts[c];
+                return;
+            }
+            ::operator delete(p, (c + 1) * granularity);
+            return;
+        }
+#endif
+        ::operator delete(p, size);
+    }
+
+    // Returns the cached objects to the memory allocator
+    void drain() noexcept {
+        for (size_t c = 0; c != nr_classes; ++c) {
+            while (auto n = _heads[c]) {
+                _heads[c] = n->next;
+                ::operator delete(n, (c + 1) * granularity);
+            }
+            _counts[c] = 0;
+        }
+    }
+};
+
+// A continuation lives from the then() call until the value it waits for
+// arrives, and chains of them are created and destroyed at a high rate.
+//
+// Constant-initialized and trivially destructible, so accessing it doesn't
+// need a thread_local wrapper call; the reactor drains it on exit.
+inline thread_local size_class_freelist<16, 256, 128> local_continuation_freelist;
+
+#ifdef SEASTAR_COROUTINE_FRAME_POOL
+// Coroutine frames come in a handful of sizes, one per coroutine function,
+// but are much larger than continuations.
+inline thread_local size_class_freelist<64, 2048, 64> local_coroutine_frame_freelist;
+#endif
+
+}
+
+}
@@ -24,6 +24,7 @@
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/slist.hpp>
 #include <boost/container/small_vector.hpp>
+#include <chrono>
 #include <seastar/core/internal/io_intent.hh>
 #include <seastar/core/io_priority_class.hh>
 
@@ -41,7 +42,16 @@ namespace seastar {
 ///
 /// If no intent is provided, then the request is processed till its
 /// completion be it success or error
+///
+/// An intent can also carry a deadline. Requests that come close to
+/// it while queued are dispatched ahead of the other requests of their
+/// class, and requests that are still queued past it are resolved into
+/// the \ref timed_out_error "timed_out_error" without being dispatched.
 class io_intent {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+private:
     struct intents_for_queue {
         dev_t dev;
         io_priority_class_id qid;
@@ -72,16 +82,24 @@ class io_intent {
 
     boost::container::small_vector<intents_for_queue, 1> _intents;
     references _refs;
+    clock_type::time_point _deadline = clock_type::time_point::max();
     friend internal::intent_reference::intent_reference(io_intent*) noexcept;
 
 public:
     io_intent() = default;
     ~io_intent() = default;
 
+    /// Constructs an intent whose requests should be dispatched by
+    /// the given \c deadline
+    ///
+    /// The deadline cannot be changed later, so that the requests of
+    /// the intent keep their queueing order.
+    explicit io_intent(clock_type::time_point deadline) noexcept : _deadline(deadline) {}
+
     io_intent(const io_intent&) = delete;
     io_intent& operator=(const io_intent&) = delete;
     io_intent& operator=(io_intent&&) = delete;
-    io_intent(io_intent&& o) noexcept : _intents(std::move(o._intents)), _refs(std::move(o._refs)) {
+    io_intent(io_intent&& o) noexcept : _intents(std::move(o._intents)), _refs(std::move(o._refs)), _deadline(o._deadline) {
         for (auto&& r : _refs.list) {
             r._intent = this;
         }
@@ -95,6 +113,12 @@ class io_intent {
         _intents.clear();
     }
 
+    /// \returns the deadline of the intent's requests, or \c time_point::max()
+    /// if there's none
+    clock_type::time_point deadline() const noexcept {
+        return _deadline;
+    }
+
     /// @private
     internal::cancellable_queue& find_or_create_cancellable_queue(dev_t dev, io_priority_class_id qid) {
         for (auto&& i : _intents) {
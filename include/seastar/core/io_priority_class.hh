@@ -88,4 +88,8 @@ class io_priority_class {
 
 const io_priority_class& default_priority_class();
 
+/// The class file discards are queued in, see \ref file::discard().
+/// Its shares can be changed like those of any other class.
+const io_priority_class& discard_priority_class();
+
 } // namespace seastar
@@ -29,6 +29,7 @@
 #include <seastar/core/internal/io_request.hh>
 #include <mutex>
 #include <array>
+#include <vector>
 
 struct io_queue_for_tests;
 
@@ -57,6 +58,7 @@ using stream_id = unsigned;
 
 class io_priority_class;
 class io_desc_read_write;
+class io_completion;
 class queued_io_request;
 class io_group;
 
@@ -65,6 +67,7 @@ using io_group_ptr = std::shared_ptr<io_group>;
 class io_queue {
 public:
     class priority_class_data;
+    class trace_ring;
 
 private:
     std::vector<std::unique_ptr<priority_class_data>> _priority_classes;
@@ -73,6 +76,7 @@ class io_queue {
     internal::io_sink& _sink;
 
     priority_class_data& find_or_create_class(const io_priority_class& pc);
+    void submit_discard(io_completion* desc, const internal::io_request& req) noexcept;
 
     // The fields below are going away, they are just here so we can implement deprecated
     // functions that used to be provided by the fair_queue and are going away (from both
@@ -80,6 +84,7 @@ class io_queue {
     // decoupling and is temporary
     size_t _queued_requests = 0;
     size_t _requests_executing = 0;
+    std::unique_ptr<trace_ring> _trace;
 public:
 
     using clock_type = std::chrono::steady_clock;
@@ -104,12 +109,25 @@ class io_queue {
         unsigned disk_blocks_write_to_read_multiplier = read_request_base_count;
         size_t disk_read_saturation_length = std::numeric_limits<size_t>::max();
         size_t disk_write_saturation_length = std::numeric_limits<size_t>::max();
+        // How much more writes cost when mixed with reads than the write
+        // multipliers say, indexed by log2 of the request length in blocks.
+        // Longer requests use the last factor. Empty means no extra cost.
+        std::vector<float> disk_write_cost_factors;
         sstring mountpoint = "undefined";
         bool duplex = false;
         float rate_factor = 1.0;
         std::chrono::duration<double> rate_limit_duration = std::chrono::milliseconds(1);
+        // Zero disables the latency controller
+        std::chrono::duration<double> latency_target = std::chrono::duration<double>(0);
     };
 
+    // Completion latencies are collected into buckets four per octave
+    // of microseconds, up to ~30 seconds
+    static constexpr unsigned latency_buckets = 96;
+    static constexpr auto latency_control_period = std::chrono::milliseconds(100);
+    static unsigned latency_bucket(std::chrono::duration<double> lat) noexcept;
+    static std::chrono::duration<double> latency_bucket_limit(unsigned bucket) noexcept;
+
     io_queue(io_group_ptr group, internal::io_sink& sink);
     ~io_queue();
 
@@ -120,8 +138,9 @@ class io_queue {
     queue_request(const io_priority_class& pc, size_t len, internal::io_request req, io_intent* intent) noexcept;
     void submit_request(io_desc_read_write* desc, internal::io_request req) noexcept;
     void cancel_request(queued_io_request& req) noexcept;
-    void complete_cancelled_request(queued_io_request& req) noexcept;
+    void expire_request(queued_io_request& req) noexcept;
     void complete_request(io_desc_read_write& desc) noexcept;
+    void account_latency(clock_type::time_point now, std::chrono::duration<double> lat) noexcept;
 
 
     [[deprecated("modern I/O queues should use a property file")]] size_t capacity() const;
@@ -155,16 +174,85 @@ class io_queue {
 
     request_limits get_request_limits() const noexcept;
 
+    enum class trace_outcome : uint8_t { completed, failed, cancelled, expired };
+
+    /// \brief A request recorded by tracing, see start_tracing()
+    ///
+    /// Times are nanoseconds of clock_type since its epoch, or 0 for the
+    /// steps the request didn't get to. This is also the layout of the
+    /// records of the files written by dump_trace(), in the byte order of
+    /// the host.
+    struct trace_record {
+        int64_t queued;
+        int64_t dispatched;
+        int64_t completed;
+        uint64_t pos;
+        uint32_t length;
+        uint32_t ticket_weight;
+        uint32_t ticket_size;
+        uint16_t class_id;
+        uint8_t write;
+        trace_outcome outcome;
+    };
+    static_assert(sizeof(trace_record) == 48);
+
+    /// \brief The header of the files written by dump_trace()
+    ///
+    /// It is followed by nr_classes class names, each a uint32_t class id,
+    /// a uint32_t length and the name, and then by nr_records records,
+    /// oldest first.
+    struct trace_file_header {
+        static constexpr char file_magic[8] = {'S', 'S', 'I', 'O', 'T', 'R', 'C', '1'};
+        char magic[8];
+        uint32_t record_size;
+        uint32_t shard;
+        uint32_t nr_classes;
+        uint32_t reserved;
+        uint64_t dev_id;
+        uint64_t nr_records;
+    };
+    static_assert(sizeof(trace_file_header) == 40);
+
+    /// \brief Starts recording the requests of the queue
+    ///
+    /// Each request is recorded when it is done, into a ring of \c max_records
+    /// records, which keeps the latest ones. Recording takes a copy of 48
+    /// bytes per request, so it can stay on for a while in production.
+    /// Starting again clears the records.
+    void start_tracing(size_t max_records);
+    /// Stops recording, and drops the records
+    void stop_tracing() noexcept;
+    bool tracing() const noexcept {
+        return bool(_trace);
+    }
+    /// The records of the requests done since tracing started, oldest first,
+    /// up to the size of the ring
+    std::vector<trace_record> trace() const;
+    /// \brief Writes the records to a file, see \ref trace_file_header
+    ///
+    /// Recording goes on meanwhile, the file has the records of when it was
+    /// called.
+    future<> dump_trace(sstring path) const;
+    void add_trace_record(const trace_record& r) noexcept;
+
 private:
+    // Completions not yet passed to the group's latency controller
+    std::array<uint32_t, latency_buckets> _latency_hist = {};
+    clock_type::time_point _latency_folded;
+    metrics::metric_groups _latency_metrics;
+
     static fair_queue::config make_fair_queue_config(const config& cfg, sstring label);
     void register_stats(sstring name, priority_class_data& pc);
+    void register_latency_stats();
 
     const config& get_config() const noexcept;
 };
 
 class io_group {
 public:
-    explicit io_group(io_queue::config io_cfg);
+    explicit io_group(io_queue::config io_cfg, unsigned nr_groups = 1, unsigned group_idx = 0);
+    // Another of the groups sharing the device with peer
+    io_group(const io_group& peer, unsigned group_idx);
 
 private:
     friend class io_queue;
@@ -172,9 +260,19 @@ class io_group {
 
     const io_queue::config _config;
     size_t _max_request_length[2];
-    std::vector<std::unique_ptr<fair_group>> _fgs;
+    // The groups of the device lend each other unused capacity, one pool
+    // per stream
+    std::vector<std::shared_ptr<fair_group_pool>> _pools;
+    std::vector<fair_group*> _fgs;
+
+    // Latency controller state, shared by the queues of the group
+    std::array<std::atomic<uint64_t>, io_queue::latency_buckets> _latency_hist = {};
+    std::atomic<io_queue::clock_type::time_point> _latency_evaluated;
+    std::atomic<double> _latency_p99 = 0.0;
 
     static fair_group::config make_fair_group_config(const io_queue::config& qcfg) noexcept;
+    void attach_fair_groups(unsigned group_idx);
+    void maybe_adjust_rates(io_queue::clock_type::time_point now) noexcept;
 };
 
 inline const io_queue::config& io_queue::get_config() const noexcept {
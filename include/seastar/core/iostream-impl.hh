@@ -73,6 +73,26 @@ future<> output_stream<CharType>::write(scattered_message<CharType> msg) noexcep
     return write(std::move(msg).release());
 }
 
+// Appends buf to the zero-copy packet
+template<typename CharType>
+void
+output_stream<CharType>::gather(temporary_buffer<CharType> buf) {
+    if (_zc_bufs) {
+        _zc_bufs.append(net::packet(std::move(buf)));
+    } else {
+        _zc_bufs = net::packet(std::move(buf));
+    }
+}
+
+// Moves the buffered bytes to the zero-copy packet, behind what it holds
+template<typename CharType>
+void
+output_stream<CharType>::gather_buffer() {
+    _buf.trim(_end);
+    _end = 0;
+    gather(std::move(_buf));
+}
+
 template<typename CharType>
 future<>
 output_stream<CharType>::zero_copy_put(net::packet p) noexcept {
@@ -114,7 +134,9 @@ future<> output_stream<CharType>::write(net::packet p) noexcept {
     static_assert(std::is_same<CharType, char>::value, "packet works on char");
   try {
     if (p.len() != 0) {
-        assert(!_end && "Mixing buffered writes and zero-copy writes not supported yet");
+        if (_end) {
+            gather_buffer();
+        }
 
         if (_zc_bufs) {
             _zc_bufs.append(std::move(p));
@@ -122,7 +144,7 @@ future<> output_stream<CharType>::write(net::packet p) noexcept {
             _zc_bufs = std::move(p);
         }
 
-        if (_zc_bufs.len() >= _size) {
+        if (_zc_bufs.len() >= _size && !_corked) {
             if (_trim_to_size) {
                 return zero_copy_split_and_put(std::move(_zc_bufs));
             } else {
@@ -142,7 +164,6 @@ future<> output_stream<CharType>::write(temporary_buffer<CharType> p) noexcept {
     if (p.empty()) {
         return make_ready_future<>();
     }
-    assert(!_end && "Mixing buffered writes and zero-copy writes not supported yet");
     return write(net::packet(std::move(p)));
   } catch (...) {
     return current_exception_as_future();
@@ -163,7 +184,7 @@ input_stream<CharType>::read_exactly_part(size_t n, tmp_buf out, size_t complete
     }
 
     // _buf is now empty
-    return _fd.get().then([this, n, out = std::move(out), completed] (auto buf) mutable {
+    return next_buffer().then([this, n, out = std::move(out), completed] (auto buf) mutable {
         if (buf.size() == 0) {
             _eof = true;
             out.trim(completed);
@@ -187,7 +208,7 @@ input_stream<CharType>::read_exactly(size_t n) noexcept {
         return make_ready_future<tmp_buf>(std::move(front));
     } else if (_buf.size() == 0) {
         // buffer is empty: grab one and retry
-        return _fd.get().then([this, n] (auto buf) mutable {
+        return next_buffer().then([this, n] (auto buf) mutable {
             if (buf.size() == 0) {
                 _eof = true;
                 return make_ready_future<tmp_buf>(std::move(buf));
@@ -213,7 +234,7 @@ future<>
 input_stream<CharType>::consume(Consumer&& consumer) noexcept(std::is_nothrow_move_constructible_v<Consumer>) {
     return repeat([consumer = std::move(consumer), this] () mutable {
         if (_buf.empty() && !_eof) {
-            return _fd.get().then([this] (tmp_buf buf) {
+            return next_buffer().then([this] (tmp_buf buf) {
                 _buf = std::move(buf);
                 _eof = _buf.empty();
                 return make_ready_future<stop_iteration>(stop_iteration::no);
@@ -231,7 +252,7 @@ input_stream<CharType>::consume(Consumer&& consumer) noexcept(std::is_nothrow_mo
                 this->_buf = std::move(stop.get_buffer());
                 return make_ready_future<stop_iteration>(stop_iteration::yes);
             }, [this] (const skip_bytes& skip) {
-                return this->_fd.skip(skip.get_value()).then([this](tmp_buf buf) {
+                return this->skip_source(skip.get_value()).then([this](tmp_buf buf) {
                     if (!buf.empty()) {
                         this->_buf = std::move(buf);
                     }
@@ -258,7 +279,7 @@ input_stream<CharType>::read_up_to(size_t n) noexcept {
         if (_eof) {
             return make_ready_future<tmp_buf>();
         } else {
-            return _fd.get().then([this, n] (tmp_buf buf) {
+            return next_buffer().then([this, n] (tmp_buf buf) {
                 _eof = buf.empty();
                 _buf = std::move(buf);
                 return read_up_to(n);
@@ -287,7 +308,7 @@ input_stream<CharType>::read() noexcept {
         return make_ready_future<tmp_buf>();
     }
     if (_buf.empty()) {
-        return _fd.get().then([this] (tmp_buf buf) {
+        return next_buffer().then([this] (tmp_buf buf) {
             _eof = buf.empty();
             return make_ready_future<tmp_buf>(std::move(buf));
         });
@@ -305,15 +326,122 @@ input_stream<CharType>::skip(uint64_t n) noexcept {
     if (!n) {
         return make_ready_future<>();
     }
-    return _fd.skip(n).then([this] (temporary_buffer<CharType> buffer) {
+    return skip_source(n).then([this] (temporary_buffer<CharType> buffer) {
         _buf = std::move(buffer);
     });
 }
 
+template <typename CharType>
+future<temporary_buffer<CharType>>
+input_stream<CharType>::next_buffer() noexcept {
+    if (!_peeked.empty()) {
+        auto buf = std::move(_peeked.front());
+        _peeked.pop_front();
+        return make_ready_future<tmp_buf>(std::move(buf));
+    }
+    return _fd.get();
+}
+
+// Like data_source::skip(), but starting with the peeked buffers
+template <typename CharType>
+future<temporary_buffer<CharType>>
+input_stream<CharType>::skip_source(uint64_t n) noexcept {
+    while (!_peeked.empty()) {
+        auto buf = std::move(_peeked.front());
+        _peeked.pop_front();
+        if (buf.size() >= n) {
+            buf.trim_front(n);
+            return make_ready_future<tmp_buf>(std::move(buf));
+        }
+        n -= buf.size();
+    }
+    return _fd.skip(n);
+}
+
+template <typename CharType>
+size_t
+input_stream<CharType>::peekable() const noexcept {
+    size_t size = _buf.size();
+    for (auto& buf : _peeked) {
+        size += buf.size();
+    }
+    return size;
+}
+
+template <typename CharType>
+std::vector<temporary_buffer<CharType>>
+input_stream<CharType>::share_front(size_t n) {
+    std::vector<tmp_buf> bufs;
+    auto share = [&] (tmp_buf& buf) {
+        if (n && !buf.empty()) {
+            auto now = std::min(n, buf.size());
+            bufs.push_back(buf.share(0, now));
+            n -= now;
+        }
+    };
+    share(_buf);
+    for (auto& buf : _peeked) {
+        share(buf);
+    }
+    return bufs;
+}
+
+template <typename CharType>
+void
+input_stream<CharType>::trim_front(size_t n) noexcept {
+    auto now = std::min(n, _buf.size());
+    _buf.trim_front(now);
+    n -= now;
+    while (n) {
+        auto& buf = _peeked.front();
+        now = std::min(n, buf.size());
+        buf.trim_front(now);
+        n -= now;
+        if (buf.empty()) {
+            _peeked.pop_front();
+        }
+    }
+}
+
+template <typename CharType>
+future<std::vector<temporary_buffer<CharType>>>
+input_stream<CharType>::peek(size_t n) noexcept {
+    try {
+        if (_eof || peekable() >= n || (!_peeked.empty() && _peeked.back().empty())) {
+            return make_ready_future<std::vector<tmp_buf>>(share_front(n));
+        }
+        // make room before reading, so that nothing read can be lost
+        _peeked.reserve(_peeked.size() + 1);
+    } catch (...) {
+        return current_exception_as_future<std::vector<tmp_buf>>();
+    }
+    return _fd.get().then([this, n] (tmp_buf buf) {
+        if (_buf.empty() && _peeked.empty() && !buf.empty()) {
+            _buf = std::move(buf);
+        } else {
+            _peeked.push_back(std::move(buf));
+        }
+        return peek(n);
+    });
+}
+
+template <typename CharType>
+future<std::vector<temporary_buffer<CharType>>>
+input_stream<CharType>::read_exactly_fragmented(size_t n) noexcept {
+    return peek(n).then([this] (std::vector<tmp_buf> bufs) {
+        size_t size = 0;
+        for (auto& buf : bufs) {
+            size += buf.size();
+        }
+        trim_front(size);
+        return bufs;
+    });
+}
+
 template <typename CharType>
 data_source
 input_stream<CharType>::detach() && {
-    if (_buf) {
+    if (_buf || !_peeked.empty()) {
         throw std::logic_error("detach() called on a used input_stream");
     }
 
@@ -347,7 +475,7 @@ template <typename CharType>
 future<>
 output_stream<CharType>::write(const char_type* buf, size_t n) noexcept {
     if (__builtin_expect(!_buf || n > _size - _end, false)) {
-        return slow_write(buf, n);
+        return slow_write(buf, n, nullptr);
     }
     std::copy_n(buf, n, _buf.get_write() + _end);
     _end += n;
@@ -356,17 +484,27 @@ output_stream<CharType>::write(const char_type* buf, size_t n) noexcept {
 
 template <typename CharType>
 future<>
-output_stream<CharType>::slow_write(const char_type* buf, size_t n) noexcept {
+output_stream<CharType>::write(const char_type* buf, size_t n, crc32c_checksum& checksum) noexcept {
+    if (__builtin_expect(!_buf || n > _size - _end, false)) {
+        return slow_write(buf, n, &checksum);
+    }
+    copy(_buf.get_write() + _end, buf, n, &checksum);
+    _end += n;
+    return make_ready_future<>();
+}
+
+template <typename CharType>
+future<>
+output_stream<CharType>::slow_write(const char_type* buf, size_t n, crc32c_checksum* checksum) noexcept {
   try {
-    assert(!_zc_bufs && "Mixing buffered writes and zero-copy writes not supported yet");
     auto bulk_threshold = _end ? (2 * _size - _end) : _size;
     if (n >= bulk_threshold) {
         if (_end) {
             auto now = _size - _end;
-            std::copy(buf, buf + now, _buf.get_write() + _end);
+            copy(_buf.get_write() + _end, buf, now, checksum);
             _end = _size;
             temporary_buffer<char> tmp = _fd.allocate_buffer(n - now);
-            std::copy(buf + now, buf + n, tmp.get_write());
+            copy(tmp.get_write(), buf + now, n - now, checksum);
             _buf.trim(_end);
             _end = 0;
             return put(std::move(_buf)).then([this, tmp = std::move(tmp)]() mutable {
@@ -378,7 +516,7 @@ output_stream<CharType>::slow_write(const char_type* buf, size_t n) noexcept {
             });
         } else {
             temporary_buffer<char> tmp = _fd.allocate_buffer(n);
-            std::copy(buf, buf + n, tmp.get_write());
+            copy(tmp.get_write(), buf, n, checksum);
             if (_trim_to_size) {
                 return split_and_put(std::move(tmp));
             } else {
@@ -392,13 +530,13 @@ output_stream<CharType>::slow_write(const char_type* buf, size_t n) noexcept {
     }
 
     auto now = std::min(n, _size - _end);
-    std::copy(buf, buf + now, _buf.get_write() + _end);
+    copy(_buf.get_write() + _end, buf, now, checksum);
     _end += now;
     if (now == n) {
         return make_ready_future<>();
     } else {
         temporary_buffer<char> next = _fd.allocate_buffer(_size);
-        std::copy(buf + now, buf + n, next.get_write());
+        copy(next.get_write(), buf + now, n - now, checksum);
         _end = n - now;
         std::swap(next, _buf);
         return put(std::move(next));
@@ -411,6 +549,10 @@ output_stream<CharType>::slow_write(const char_type* buf, size_t n) noexcept {
 template <typename CharType>
 future<>
 output_stream<CharType>::flush() noexcept {
+    if (_corked) {
+        _flush_when_uncorked = true;
+        return make_ready_future<>();
+    }
     if (!_batch_flushes) {
         if (_end) {
             _buf.trim(_end);
@@ -438,11 +580,43 @@ output_stream<CharType>::flush() noexcept {
     return make_ready_future<>();
 }
 
+template <typename CharType>
+future<>
+output_stream<CharType>::uncork() noexcept {
+    assert(_corked);
+    if (--_corked) {
+        return make_ready_future<>();
+    }
+    if (std::exchange(_flush_when_uncorked, false)) {
+        return flush();
+    }
+    if (_zc_bufs && _zc_bufs.len() + _end >= _size) {
+        try {
+            if (_end) {
+                gather_buffer();
+            }
+        } catch (...) {
+            return current_exception_as_future();
+        }
+        return zero_copy_put(std::move(_zc_bufs));
+    }
+    return make_ready_future<>();
+}
+
 void add_to_flush_poller(output_stream<char>* x);
 
 template <typename CharType>
 future<>
 output_stream<CharType>::put(temporary_buffer<CharType> buf) noexcept {
+    if (_zc_bufs || _corked) {
+        // keep the order of, and send together with, earlier zero-copy writes
+      try {
+        gather(std::move(buf));
+      } catch (...) {
+        return current_exception_as_future();
+      }
+        return _corked ? make_ready_future<>() : zero_copy_put(std::move(_zc_bufs));
+    }
     // if flush is scheduled, disable it, so it will not try to write in parallel
     _flush = false;
     if (_flushing) {
@@ -470,7 +644,15 @@ output_stream<CharType>::poll_flush() noexcept {
     _flush = false;
     _flushing = true; // make whoever wants to write into the fd to wait for flush to complete
 
-    if (_end) {
+    if (_end && _zc_bufs) {
+        // send both as one packet
+        try {
+            gather_buffer();
+            f = _fd.put(std::move(_zc_bufs));
+        } catch (...) {
+            f = current_exception_as_future();
+        }
+    } else if (_end) {
         // send whatever is in the buffer right now
         _buf.trim(_end);
         _end = 0;
@@ -496,6 +678,9 @@ output_stream<CharType>::poll_flush() noexcept {
 template <typename CharType>
 future<>
 output_stream<CharType>::close() noexcept {
+    // nothing may stay held back
+    _corked = 0;
+    _flush_when_uncorked = false;
     return flush().finally([this] {
         if (_in_batch) {
             return _in_batch.value().get_future();
@@ -35,10 +35,13 @@
 
 #pragma once
 
+#include <vector>
 #include <seastar/core/future.hh>
 #include <seastar/core/temporary_buffer.hh>
 #include <seastar/core/scattered_message.hh>
+#include <seastar/core/circular_buffer.hh>
 #include <seastar/util/std-compat.hh>
+#include <seastar/util/crc32c.hh>
 
 namespace seastar {
 
@@ -255,6 +258,9 @@ class input_stream final {
     static_assert(sizeof(CharType) == 1, "must buffer stream of bytes");
     data_source _fd;
     temporary_buffer<CharType> _buf;
+    // Buffers fetched by peek() beyond _buf, handed out before reading
+    // from _fd again. An empty one marks the end of stream.
+    circular_buffer<temporary_buffer<CharType>> _peeked;
     bool _eof = false;
 private:
     using tmp_buf = temporary_buffer<CharType>;
@@ -309,6 +315,20 @@ class input_stream final {
     }
     /// Ignores n next bytes from the stream.
     future<> skip(uint64_t n) noexcept;
+    /// Returns the next n bytes of the stream without consuming them, or
+    /// fewer if the end of stream comes first.
+    ///
+    /// The bytes are returned as the buffers they were received in, shared
+    /// rather than copied, so a parser can look at data spanning several
+    /// buffers before deciding how much of it to consume.
+    future<std::vector<tmp_buf>> peek(size_t n) noexcept;
+    /// Reads n bytes from the stream, or fewer if the end of stream comes
+    /// first, as the buffers they were received in.
+    ///
+    /// Unlike read_exactly(), which copies when the bytes span several
+    /// buffers, this shares them, so large payloads can be passed on
+    /// (e.g. to an \ref output_stream) without being copied.
+    future<std::vector<tmp_buf>> read_exactly_fragmented(size_t n) noexcept;
 
     /// Detaches the underlying \c data_source from the \c input_stream.
     ///
@@ -324,6 +344,11 @@ class input_stream final {
     data_source detach() &&;
 private:
     future<temporary_buffer<CharType>> read_exactly_part(size_t n, tmp_buf buf, size_t completed) noexcept;
+    future<tmp_buf> next_buffer() noexcept;
+    future<tmp_buf> skip_source(uint64_t n) noexcept;
+    size_t peekable() const noexcept;
+    std::vector<tmp_buf> share_front(size_t n);
+    void trim_front(size_t n) noexcept;
 };
 
 struct output_stream_options {
@@ -340,6 +365,12 @@ struct output_stream_options {
 ///
 /// The data sink will not receive empty chunks.
 ///
+/// Buffered writes and zero-copy writes (packets, temporary buffers) may be
+/// mixed; whatever is pending when the stream flushes goes to the data sink
+/// as a single \ref net::packet, whose fragments a socket sends with one
+/// vectored write. cork() extends this to everything written until the
+/// matching uncork().
+///
 /// \note All methods must be called sequentially.  That is, no method
 /// may be invoked before the previous method's returned future is
 /// resolved.
@@ -357,6 +388,8 @@ class output_stream final {
     std::optional<promise<>> _in_batch;
     bool _flush = false;
     bool _flushing = false;
+    unsigned _corked = 0;
+    bool _flush_when_uncorked = false;
     std::exception_ptr _ex;
 private:
     size_t available() const noexcept { return _end - _begin; }
@@ -366,8 +399,18 @@ class output_stream final {
     void poll_flush() noexcept;
     future<> zero_copy_put(net::packet p) noexcept;
     future<> zero_copy_split_and_put(net::packet p) noexcept;
+    void gather(temporary_buffer<CharType> buf);
+    void gather_buffer();
     [[gnu::noinline]]
-    future<> slow_write(const CharType* buf, size_t n) noexcept;
+    future<> slow_write(const CharType* buf, size_t n, crc32c_checksum* checksum) noexcept;
+    // Copies into the stream's buffers, checksumming on the way if asked
+    static void copy(CharType* dst, const CharType* src, size_t n, crc32c_checksum* checksum) noexcept {
+        if (checksum) {
+            checksum->copy(reinterpret_cast<char*>(dst), reinterpret_cast<const char*>(src), n);
+        } else {
+            std::copy_n(src, n, dst);
+        }
+    }
 public:
     using char_type = CharType;
     output_stream() noexcept = default;
@@ -388,6 +431,10 @@ class output_stream final {
         }
     }
     future<> write(const char_type* buf, size_t n) noexcept;
+    /// Writes like write(const char_type*, size_t), and extends \c checksum
+    /// with the data while copying it into the stream's buffers, rather
+    /// than in a separate pass over it.
+    future<> write(const char_type* buf, size_t n, crc32c_checksum& checksum) noexcept;
     future<> write(const char_type* buf) noexcept;
 
     template <typename StringChar, typename SizeType, SizeType MaxSize, bool NulTerminate>
@@ -399,6 +446,20 @@ class output_stream final {
     future<> write(temporary_buffer<char_type>) noexcept;
     future<> flush() noexcept;
 
+    /// Holds back everything written from now on, including flush()es,
+    /// until the matching uncork(), so that it reaches the data sink as a
+    /// single packet no matter how many writes produced it. Calls nest.
+    ///
+    /// Nothing is sent while corked, so the stream's buffer size does not
+    /// bound what it holds.
+    void cork() noexcept {
+        ++_corked;
+    }
+    /// Ends the matching cork(). Ending the outermost one flushes the
+    /// stream if flush() was called while corked, and otherwise sends what
+    /// was gathered once it exceeds the buffer size.
+    future<> uncork() noexcept;
+
     /// Flushes the stream before closing it (and the underlying data sink) to
     /// any further writes.  The resulting future must be waited on before
     /// destroying this object.
@@ -32,6 +32,7 @@
 #include <seastar/core/task.hh>
 #include <seastar/util/bool_class.hh>
 #include <seastar/core/semaphore.hh>
+#include <seastar/util/later.hh>
 
 namespace seastar {
 
@@ -631,6 +632,99 @@ parallel_for_each(Range&& range, Func&& func) noexcept {
     return futurize_invoke(impl, std::forward<Range>(range), std::forward<Func>(func));
 }
 
+/// \brief Run tasks in parallel, in preemptible chunks (iterator version).
+///
+/// Like \ref parallel_for_each(), runs \c func on each element of the
+/// range [\c begin, \c end) and returns a future<> that resolves when all
+/// the invocations complete, but is meant for large ranges of cheap
+/// elements: elements are processed synchronously in a tight loop until the
+/// task quota is exhausted, at which point the rest of the range is
+/// processed in a new task. Only invocations that don't complete
+/// immediately cost a future; \c func may also return \c void for elements
+/// that never block.
+///
+/// Since the iteration can continue in the background, the range must
+/// outlive the returned future, and \c func is moved along with it.
+///
+/// \param begin an \c InputIterator designating the beginning of the range
+/// \param end an \c InputIterator designating the end of the range
+/// \param func Function to invoke with each element in the range (returning
+///             a \c future<> or \c void)
+/// \return a \c future<> that resolves when all the function invocations
+///         complete.  If one or more return an exception, the return value
+///         contains one of the exceptions.
+template <typename Iterator, typename Sentinel, typename Func>
+SEASTAR_CONCEPT( requires (requires (Func f, Iterator i) { { futurize_invoke(f, *i) } -> std::same_as<future<>>; { i++ }; } && (std::same_as<Sentinel, Iterator> || std::sentinel_for<Sentinel, Iterator>)))
+inline
+future<>
+chunked_parallel_for_each(Iterator begin, Sentinel end, Func&& func) noexcept {
+    parallel_for_each_state* s = nullptr;
+    auto add_future = [&s] (future<>&& f) {
+        memory::scoped_critical_alloc_section _;
+        if (!s) {
+            s = new parallel_for_each_state(0);
+        }
+        s->add_future(std::move(f));
+    };
+    while (begin != end) {
+        if constexpr (std::is_void_v<std::invoke_result_t<Func&, decltype(*begin)>>) {
+            try {
+                func(*begin);
+            } catch (...) {
+                add_future(current_exception_as_future());
+            }
+        } else {
+            auto f = futurize_invoke(func, *begin);
+            if (!f.available() || f.failed()) {
+                add_future(std::move(f));
+            }
+        }
+        ++begin;
+        if (need_preempt() && begin != end) {
+            try {
+                add_future(yield().then([begin = std::move(begin), end = std::move(end), func = std::decay_t<Func>(std::forward<Func>(func))] () mutable {
+                    return chunked_parallel_for_each(std::move(begin), std::move(end), std::move(func));
+                }));
+            } catch (...) {
+                add_future(current_exception_as_future());
+            }
+            break;
+        }
+    }
+    if (s) {
+        // s->get_future() takes ownership of s
+        return s->get_future();
+    }
+    return make_ready_future<>();
+}
+
+/// \brief Run tasks in parallel, in preemptible chunks (range version).
+///
+/// See the iterator version of \ref chunked_parallel_for_each(). The range
+/// must outlive the returned future.
+///
+/// \param range A range of objects to iterate run \c func on
+/// \param func  A callable, accepting reference to the range's
+///              \c value_type, and returning a \c future<> or \c void.
+/// \return a \c future<> that becomes ready when the entire range
+///         was processed.  If one or more of the invocations of
+///         \c func returned an exceptional future, then the return
+///         value will contain one of those exceptions.
+template <typename Range, typename Func>
+SEASTAR_CONCEPT( requires requires (Func f, Range r) {
+    { futurize_invoke(f, *std::begin(r)) } -> std::same_as<future<>>;
+    std::end(r);
+} )
+inline
+future<>
+chunked_parallel_for_each(Range&& range, Func&& func) noexcept {
+    try {
+        return chunked_parallel_for_each(std::begin(range), std::end(range), std::forward<Func>(func));
+    } catch (...) {
+        return current_exception_as_future();
+    }
+}
+
 /// Run a maximum of \c max_concurrent tasks in parallel (iterator version).
 ///
 /// Given a range [\c begin, \c end) of objects, run \c func on each \c *i in
@@ -136,6 +136,28 @@ static constexpr size_t huge_page_size =
 void configure(std::vector<resource::memory> m, bool mbind,
         std::optional<std::string> hugetlbfs_path = {});
 
+// With hugetlbfs_path, the memory of the shard is mapped from a file,
+// whose descriptor can be passed to another process to share it, as
+// vhost-user does.
+struct memory_file {
+    int fd; // open for as long as the shard runs
+    char* base; // mapped from offset 0 of the file
+    size_t size;
+};
+
+std::optional<memory_file> shard_memory_file() noexcept;
+
+/// How shard memory is faulted in ahead of use, see \c --prefault-memory
+enum class prefault_mode {
+    none,       //!< Memory is faulted in as it is first used
+    startup,    //!< Shards fault in their memory, in parallel, before the reactors start
+    background, //!< A thread per shard faults in its memory while the shard's cpu is idle
+};
+
+// Faults in the memory of the calling shard, lowest addresses (those
+// allocated from first) first. Returns once done for prefault_mode::startup.
+void prefault_memory(prefault_mode mode);
+
 void enable_abort_on_allocation_failure();
 
 class disable_abort_on_alloc_failure_temporarily {
@@ -218,6 +240,12 @@ bool drain_cross_cpu_freelist();
 void set_reclaim_hook(
         std::function<void (std::function<void ()>)> hook);
 
+// Like set_reclaim_hook(), for the background reclaim started when free
+// memory drops below background_reclaim_free_memory(). \c hook(fn) is
+// expected to run fn as a regular, preemptible, task.
+void set_background_reclaim_hook(
+        std::function<void (std::function<void ()>)> hook);
+
 /// \endcond
 
 class statistics;
@@ -238,14 +266,19 @@ class statistics {
     uint64_t _foreign_mallocs;
     uint64_t _foreign_frees;
     uint64_t _foreign_cross_frees;
+    uint64_t _cross_cpu_free_batches;
+    uint64_t _large_span_cache_hits;
+    size_t _large_span_cache_memory;
 private:
     statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees,
             uint64_t total_memory, uint64_t free_memory, uint64_t reclaims, uint64_t large_allocs,
-            uint64_t foreign_mallocs, uint64_t foreign_frees, uint64_t foreign_cross_frees)
+            uint64_t foreign_mallocs, uint64_t foreign_frees, uint64_t foreign_cross_frees,
+            uint64_t cross_cpu_free_batches, uint64_t large_span_cache_hits, size_t large_span_cache_memory)
         : _mallocs(mallocs), _frees(frees), _cross_cpu_frees(cross_cpu_frees)
         , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims), _large_allocs(large_allocs)
         , _foreign_mallocs(foreign_mallocs), _foreign_frees(foreign_frees)
-        , _foreign_cross_frees(foreign_cross_frees) {}
+        , _foreign_cross_frees(foreign_cross_frees), _cross_cpu_free_batches(cross_cpu_free_batches)
+        , _large_span_cache_hits(large_span_cache_hits), _large_span_cache_memory(large_span_cache_memory) {}
 public:
     /// Total number of memory allocations calls since the system was started.
     uint64_t mallocs() const { return _mallocs; }
@@ -254,8 +287,18 @@ class statistics {
     /// Total number of memory deallocations that occured on a different lcore
     /// than the one on which they were allocated.
     uint64_t cross_cpu_frees() const { return _cross_cpu_frees; }
+    /// Total number of batches in which cross_cpu_frees() were handed over
+    /// to the lcores owning the memory. Each batch costs one atomic operation
+    /// on the owner's free list.
+    uint64_t cross_cpu_free_batches() const { return _cross_cpu_free_batches; }
     /// Total number of objects which were allocated but not freed.
     size_t live_objects() const { return mallocs() - frees(); }
+    /// Total number of large allocations (128k to 1M) served by a span of
+    /// the same size freed recently, without searching the free lists.
+    uint64_t large_span_cache_hits() const { return _large_span_cache_hits; }
+    /// Memory (in bytes) in recently freed large spans kept for reuse.
+    /// It is counted as free, and given back under memory pressure.
+    size_t large_span_cache_memory() const { return _large_span_cache_memory; }
     /// Total free memory (in bytes)
     size_t free_memory() const { return _free_memory; }
     /// Total allocated memory (in bytes)
@@ -284,9 +327,48 @@ struct memory_layout {
 // Supported only when seastar allocator is enabled.
 memory::memory_layout get_memory_layout();
 
+/// How this shard's memory is spread over huge pages (\ref huge_page_size regions).
+///
+/// Each huge page partially used is a TLB entry that covers less allocated
+/// memory than it could; a high \c partial count relative to \c full means
+/// that live objects are scattered and accessing them costs more dTLB misses.
+struct huge_page_layout {
+    /// Number of huge page regions backing this shard's memory
+    size_t total = 0;
+    /// Regions with no memory allocated from them
+    size_t unused = 0;
+    /// Regions with both free and allocated memory
+    size_t partial = 0;
+    /// Regions entirely allocated
+    size_t full = 0;
+};
+
+/// Computes the huge page layout of the current shard's memory.
+///
+/// Walks the free page spans, so it is cheap enough for occasional
+/// monitoring, but shouldn't be called on a fast path.
+/// Returns an empty layout when the seastar allocator is disabled.
+huge_page_layout get_huge_page_layout();
+
+/// Asks the kernel to back a range of memory with huge pages right away.
+///
+/// Seastar memory is already eligible for transparent huge pages, but the
+/// kernel promotes it lazily, in the background, and only once a whole
+/// region was touched. For memory known to be hot, like a long-lived cache
+/// arena, this collapses the huge page regions fully contained in
+/// [\c ptr, \c ptr + \c size) synchronously (Linux 6.1 and later).
+///
+/// \return the number of bytes now backed by huge pages, 0 if the kernel
+///         doesn't support it or the range contains no whole huge page.
+size_t collapse_huge_pages(void* ptr, size_t size);
+
 /// Returns the size of free memory in bytes.
 size_t free_memory();
 
+/// Returns how much of this shard's memory was faulted in ahead of use
+/// so far, in bytes, see \c --prefault-memory
+size_t prefaulted_memory();
+
 /// Returns the value of free memory low water mark in bytes.
 /// When free memory is below this value, reclaimers are invoked until it goes above again.
 size_t min_free_memory();
@@ -294,6 +376,26 @@ size_t min_free_memory();
 /// Sets the value of free memory low water mark in memory::page_size units.
 void set_min_free_pages(size_t pages);
 
+/// Returns the free memory level, in bytes, below which reclaimers start
+/// running in the background, or 0 if background reclaim is disabled.
+///
+/// Reclaimers run in small steps, as regular tasks in the scheduling group
+/// chosen with \ref reactor::set_background_reclaim_scheduling_group(), until
+/// free memory is back above this level. As long as they keep up, free memory
+/// doesn't reach \ref min_free_memory(), where they would run synchronously
+/// with allocations and delay them.
+size_t background_reclaim_free_memory();
+
+/// Whether free memory is below the level at which reclaimers run, in the
+/// background or synchronously. Containers use it to give back memory they
+/// could keep for reuse otherwise. Always false with the default allocator.
+bool low_memory() noexcept;
+
+/// Sets the background reclaim level, see \ref background_reclaim_free_memory(),
+/// in memory::page_size units. It should be above the low water mark set by
+/// \ref set_min_free_pages(). 0 disables background reclaim, which is the default.
+void set_background_reclaim_free_pages(size_t pages);
+
 /// Enable the large allocation warning threshold.
 ///
 /// Warn when allocation above a given threshold are performed.
@@ -369,5 +471,37 @@ class scoped_heap_profiling {
     ~scoped_heap_profiling();
 };
 
+/// Sets how often the heap profiler records an allocation.
+///
+/// Capturing a backtrace on every allocation is too slow for production.
+/// With a non-zero \c bytes, allocations are sampled instead: on average
+/// one allocation site is recorded for every \c bytes allocated, with
+/// allocations larger than that always recorded. The sampled live
+/// memory, scaled up by the period, estimates the real one; pprof does the
+/// scaling when fed the output of \ref heap_profile::add_heap_profile_routes().
+///
+/// 0, the default, records every allocation. Affects the current shard only.
+void set_heap_profiling_sample_period(size_t bytes);
+
+/// Returns the heap profiling sample period of the current shard,
+/// see \ref set_heap_profiling_sample_period().
+size_t get_heap_profiling_sample_period();
+
+/// Live memory allocated from one call stack, as recorded by the heap profiler.
+struct heap_profile_entry {
+    /// Number of (recorded) live objects
+    size_t count;
+    /// Total size of these objects, in bytes
+    size_t size;
+    /// Return addresses of the call stack, innermost first
+    std::vector<uintptr_t> backtrace;
+};
+
+/// Returns the allocation sites of the current shard that have live objects.
+///
+/// Empty unless seastar was compiled with heap profiling support and
+/// profiling was enabled, see \ref set_heap_profiling_enabled().
+std::vector<heap_profile_entry> get_heap_profile();
+
 }
 }
@@ -257,6 +257,7 @@ enum class data_type : uint8_t {
     DERIVE, // signed int 64
     ABSOLUTE, // unsigned int 64
     HISTOGRAM,
+    SUMMARY,
 };
 
 /*!
@@ -334,6 +335,8 @@ using metric_function = std::function<metric_value()>;
 struct metric_type {
     data_type base_type;
     metric_type_def type_name;
+    // The quantiles a summary reports
+    std::vector<double> quantiles = {};
 };
 
 struct metric_definition_impl {
@@ -343,9 +346,18 @@ struct metric_definition_impl {
     description d;
     bool enabled = true;
     std::map<sstring, sstring> labels;
+    std::vector<sstring> aggregate_labels;
     metric_definition_impl& operator ()(bool enabled);
     metric_definition_impl& operator ()(const label_instance& label);
     metric_definition_impl& set_type(const sstring& type_name);
+    /*!
+     * \brief Report the metric summed over the given labels
+     *
+     * When scraped, the values of the metric that only differ by these
+     * labels are added, and reported once without them. Aggregating by
+     * the shard label merges the values of all the shards.
+     */
+    metric_definition_impl& aggregate(const std::vector<label>& labels);
     metric_definition_impl(
         metric_name_type name,
         metric_type type,
@@ -545,6 +557,23 @@ impl::metric_definition_impl make_histogram(metric_name_type name,
 }
 
 
+/*!
+ * \brief create a summary metric.
+ *
+ * Summaries report quantiles of a distribution, computed from a histogram
+ * when the metric is scraped. For them to be accurate the histogram should
+ * have fine buckets, like log_linear_histogram::to_full_histogram() returns.
+ * As the histogram is kept until then, summaries can be aggregated, unlike
+ * quantiles that were computed beforehand.
+ *
+ * \param quantiles the quantiles to report, between 0 and 1
+ */
+template<typename T>
+impl::metric_definition_impl make_summary(metric_name_type name, std::vector<double> quantiles,
+        T&& val, description d=description(), std::vector<label_instance> labels = {}) {
+    return  {name, {impl::data_type::SUMMARY, "summary", std::move(quantiles)}, make_function(std::forward<T>(val), impl::data_type::SUMMARY), d, labels};
+}
+
 /*!
  * \brief create a total_bytes metric.
  *
@@ -25,6 +25,7 @@
 #include <unordered_map>
 #include <seastar/core/sharded.hh>
 #include <boost/functional/hash.hpp>
+#include <regex>
 /*!
  * \file metrics_api.hh
  * \brief header file for metric API layer (like promehteus or collectd)
@@ -60,6 +61,58 @@ struct hash<seastar::metrics::impl::labels_type> {
 
 namespace seastar {
 namespace metrics {
+
+/*!
+ * \brief A rule that disables the metrics it matches, or the ones it does not
+ *
+ * The values of the source labels of a metric, joined by the separator,
+ * are matched against expr. The "__name__" source label stands for the
+ * full name of the metric family. Disabled metrics are not collected.
+ */
+struct relabel_config {
+    enum class relabel_action {
+        drop, ///< disable the metrics that match
+        keep, ///< disable the metrics that do not match
+    };
+    std::vector<sstring> source_labels;
+    std::regex expr;
+    relabel_action action = relabel_action::drop;
+    sstring separator = ";";
+};
+
+/*!
+ * \brief How the metrics of the families that match are reported
+ */
+struct metric_family_config {
+    /// The full name of the families, if empty regex_name is matched instead
+    sstring name;
+    std::regex regex_name;
+    /// The labels the metrics are summed over, as with
+    /// metric_definition_impl::aggregate(). Aggregating by shard_label
+    /// reports a single series for all the shards.
+    std::vector<sstring> aggregate_labels;
+};
+
+/*!
+ * \brief Replace the relabel configs, on all shards
+ *
+ * The configs apply to the metrics already registered as well as to
+ * the ones registered later, the last config to disable a metric wins
+ * over the ones before, and a metric registered as disabled stays so.
+ */
+future<> set_relabel_configs(std::vector<relabel_config> configs);
+
+const std::vector<relabel_config>& get_relabel_configs();
+
+/*!
+ * \brief Replace the metric family configs, on all shards
+ *
+ * Like the relabel configs they apply to all metrics, whenever registered.
+ */
+future<> set_metric_family_configs(std::vector<metric_family_config> configs);
+
+const std::vector<metric_family_config>& get_metric_family_configs();
+
 namespace impl {
 
 /**
@@ -152,6 +205,7 @@ struct metric_family_info {
     metric_type_def inherit_type;
     description d;
     sstring name;
+    std::vector<double> quantiles;
 };
 
 
@@ -161,8 +215,20 @@ struct metric_family_info {
 struct metric_info {
     metric_id id;
     bool enabled;
+    // The labels the metric is summed over when reported
+    std::vector<sstring> aggregate_labels;
+    // The labels of id, formatted once by format_labels()
+    sstring formatted_labels;
 };
 
+/*!
+ * \brief the labels as comma separated key="value" pairs
+ *
+ * This is how the exporters write a label set, it is kept in the
+ * metric_info so that it is not formatted again on every scrape.
+ */
+sstring format_labels(const labels_type& labels);
+
 
 using metrics_registration = std::vector<metric_id>;
 
@@ -184,8 +250,11 @@ class registered_metric {
     metric_info _info;
     metric_function _f;
     shared_ptr<impl> _impl;
+    // As registered, before the configs were applied
+    bool _registered_enabled;
+    std::vector<sstring> _registered_aggregate_labels;
 public:
-    registered_metric(metric_id id, metric_function f, bool enabled=true);
+    registered_metric(metric_id id, metric_function f, bool enabled=true, std::vector<sstring> aggregate_labels = {});
     virtual ~registered_metric() {}
     virtual metric_value operator()() const {
         return _f();
@@ -209,6 +278,10 @@ class registered_metric {
     metric_function& get_function() {
         return _f;
     }
+
+    // Apply the relabel and metric family configs to the metric
+    void apply_configs(const sstring& family_name, const std::vector<relabel_config>& relabel_configs,
+            const std::vector<metric_family_config>& family_configs);
 };
 
 using register_ref = shared_ptr<registered_metric>;
@@ -321,6 +394,10 @@ class impl {
     bool _dirty = true;
     shared_ptr<metric_metadata> _metadata;
     std::vector<std::vector<metric_function>> _current_metrics;
+    std::vector<relabel_config> _relabel_configs;
+    std::vector<metric_family_config> _metric_family_configs;
+
+    void apply_configs();
 public:
     value_map& get_value_map() {
         return _value_map;
@@ -330,7 +407,8 @@ class impl {
         return _value_map;
     }
 
-    void add_registration(const metric_id& id, const metric_type& type, metric_function f, const description& d, bool enabled);
+    void add_registration(const metric_id& id, const metric_type& type, metric_function f, const description& d, bool enabled,
+            std::vector<sstring> aggregate_labels = {});
     void remove_registration(const metric_id& id);
     future<> stop() {
         return make_ready_future<>();
@@ -342,6 +420,16 @@ class impl {
         _config = c;
     }
 
+    const std::vector<relabel_config>& get_relabel_configs() const {
+        return _relabel_configs;
+    }
+    void set_relabel_configs(std::vector<relabel_config> configs);
+
+    const std::vector<metric_family_config>& get_metric_family_configs() const {
+        return _metric_family_configs;
+    }
+    void set_metric_family_configs(std::vector<metric_family_config> configs);
+
     shared_ptr<metric_metadata> metadata();
 
     std::vector<std::vector<metric_function>>& functions();
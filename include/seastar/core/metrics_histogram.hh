@@ -0,0 +1,181 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/bitops.hh>
+#include <seastar/core/metrics_types.hh>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace seastar {
+namespace metrics {
+
+/*!
+ * \brief A log-linear histogram of integer values
+ *
+ * Each power of two range of values is split into 2^PrecisionBits buckets
+ * of equal width, so that a value is known up to a relative error of
+ * 2^-PrecisionBits, and values smaller than 2^PrecisionBits exactly.
+ * The buckets cover values up to 2^MaxBits, larger values are counted
+ * in the last one.
+ *
+ * The buckets are a fixed array, so adding a value takes a few
+ * instructions and never allocates. It is meant to be kept per shard,
+ * and as all the histograms of the same parameters have the same bucket
+ * bounds, the ones of different shards are merged exactly, be it with
+ * operator+= or when their metrics are aggregated.
+ *
+ * A bucket holds the values in (lower, upper], which is what the le
+ * label of Prometheus histogram buckets means.
+ */
+template <unsigned PrecisionBits = 3, unsigned MaxBits = 32>
+class log_linear_histogram {
+    static_assert(PrecisionBits < MaxBits && MaxBits < 64);
+    static constexpr uint64_t sub_buckets = uint64_t(1) << PrecisionBits;
+public:
+    static constexpr unsigned precision_bits = PrecisionBits;
+    static constexpr size_t nr_buckets = (MaxBits - PrecisionBits + 1) * sub_buckets;
+private:
+    std::array<uint64_t, nr_buckets> _buckets = {};
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+
+    // Values are bucketed by v - 1, so that powers of two are upper bounds
+    static constexpr size_t bucket_of(uint64_t v) noexcept {
+        uint64_t x = v ? v - 1 : 0;
+        if (x < sub_buckets) {
+            return x;
+        }
+        unsigned e = log2floor(x);
+        if (e >= MaxBits) {
+            return nr_buckets - 1;
+        }
+        uint64_t m = x >> (e - PrecisionBits);
+        return (e - PrecisionBits + 1) * sub_buckets + (m - sub_buckets);
+    }
+public:
+    /// The largest value that bucket \c i holds
+    static constexpr uint64_t upper_bound(size_t i) noexcept {
+        i++;
+        if (i < sub_buckets) {
+            return i;
+        }
+        uint64_t group = i >> PrecisionBits;
+        uint64_t m = sub_buckets + (i & (sub_buckets - 1));
+        return m << (group - 1);
+    }
+
+    void add(uint64_t v) noexcept {
+        _buckets[bucket_of(v)]++;
+        _count++;
+        _sum += v;
+    }
+
+    uint64_t count() const noexcept {
+        return _count;
+    }
+
+    uint64_t sum() const noexcept {
+        return _sum;
+    }
+
+    /// The number of values in bucket \c i
+    uint64_t bucket_count(size_t i) const noexcept {
+        return _buckets[i];
+    }
+
+    log_linear_histogram& operator+=(const log_linear_histogram& o) noexcept {
+        for (size_t i = 0; i < nr_buckets; i++) {
+            _buckets[i] += o._buckets[i];
+        }
+        _count += o._count;
+        _sum += o._sum;
+        return *this;
+    }
+
+    /*!
+     * \brief An estimate of the q-quantile of the values
+     *
+     * This is the upper bound of the bucket holding it, so it is not
+     * smaller than the actual quantile, and not larger by more than
+     * the precision of the histogram. It is 0 when there are no values.
+     */
+    uint64_t quantile(double q) const noexcept {
+        if (!_count) {
+            return 0;
+        }
+        auto rank = std::max<uint64_t>(uint64_t(std::ceil(q * _count)), 1);
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < nr_buckets; i++) {
+            cumulative += _buckets[i];
+            if (cumulative >= rank) {
+                return upper_bound(i);
+            }
+        }
+        return upper_bound(nr_buckets - 1);
+    }
+
+    /*!
+     * \brief The histogram, with power of two buckets, for a histogram metric
+     *
+     * Its buckets are 1, 2, 4, ... up to 2^MaxBits, whatever the precision.
+     */
+    histogram to_histogram() const {
+        histogram h;
+        h.sample_count = _count;
+        h.sample_sum = _sum;
+        h.buckets.reserve(MaxBits + 1);
+        uint64_t cumulative = 0;
+        size_t i = 0;
+        for (unsigned b = 0; b <= MaxBits; b++) {
+            auto bound = uint64_t(1) << b;
+            for (; i < nr_buckets && upper_bound(i) <= bound; i++) {
+                cumulative += _buckets[i];
+            }
+            h.buckets.push_back(histogram_bucket{cumulative, double(bound)});
+        }
+        return h;
+    }
+
+    /*!
+     * \brief The histogram with all its buckets, for a summary metric
+     *
+     * Summaries compute their quantiles from it when scraped, after
+     * it was merged with the ones of other shards if it is aggregated.
+     */
+    histogram to_full_histogram() const {
+        histogram h;
+        h.sample_count = _count;
+        h.sample_sum = _sum;
+        h.buckets.reserve(nr_buckets);
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < nr_buckets; i++) {
+            cumulative += _buckets[i];
+            h.buckets.push_back(histogram_bucket{cumulative, double(upper_bound(i))});
+        }
+        return h;
+    }
+};
+
+}
+}
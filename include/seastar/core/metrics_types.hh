@@ -20,6 +20,7 @@
  */
 
 #pragma once
+#include <cstdint>
 #include <vector>
 
 namespace seastar {
@@ -0,0 +1,130 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/metrics_api.hh>
+#include <seastar/core/scheduling.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/sstring.hh>
+#include <seastar/net/socket_defs.hh>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+namespace seastar {
+
+namespace tls { class certificate_credentials; }
+
+namespace http::experimental { class client; class connection_factory; }
+
+/// \brief Pushes the metrics of all shards to an OpenTelemetry collector
+///
+/// The metrics are sent with OTLP over HTTP, encoded in JSON, which
+/// collectors accept on /v1/metrics.
+namespace otlp {
+
+/*!
+ * Holds the OTLP exporter configuration
+ */
+struct config {
+    socket_address address; //!< The collector address
+    sstring host; //!< The Host header, and the server name with TLS
+    sstring path = "/v1/metrics"; //!< The path metrics are posted to
+    shared_ptr<tls::certificate_credentials> creds; //!< Connect with TLS, if set
+    std::chrono::milliseconds period = std::chrono::seconds(15); //!< How often metrics are pushed
+    /// The group exporting runs in, collecting the values on the other
+    /// shards included, so that it can be given a low share
+    scheduling_group sg = default_scheduling_group();
+    bool compress = true; //!< gzip the requests
+    size_t max_request_size = 4 << 20; //!< Metrics are split into requests of about this size, before compression
+    sstring service_name = "seastar"; //!< The service.name resource attribute
+    std::optional<metrics::label_instance> label; //!< A label that will be added to all metrics
+    sstring prefix = "seastar"; //!< a prefix that will be added to metric names
+};
+
+/*!
+ * \brief Pushes metrics periodically
+ *
+ * Counters and histograms are sent with delta temporality: each push
+ * reports what was counted since the previous one, which the exporter
+ * keeps the values of. Gauges and summaries are sent as they are.
+ *
+ * The exporter runs on the shard it was created on, and collects the
+ * metrics of all shards.
+ */
+class exporter {
+public:
+    struct stats {
+        uint64_t pushes = 0;
+        uint64_t requests = 0;
+        uint64_t failed_requests = 0;
+        uint64_t data_points = 0;
+        uint64_t bytes_sent = 0;
+    };
+private:
+    // The values of a series at the previous push
+    struct series_state {
+        double value = 0;
+        metrics::histogram histogram;
+        uint64_t start_time = 0;
+        // The push that last saw the series, ones that are gone are forgotten
+        uint64_t seen = 0;
+    };
+    config _cfg;
+    std::unique_ptr<http::experimental::client> _client;
+    std::unordered_map<sstring, series_state> _previous;
+    uint64_t _start_time;
+    bool _pushing = false;
+    stats _stats;
+    timer<> _timer;
+    gate _gate;
+    metrics::metric_groups _metrics;
+
+    future<> do_push();
+    // Encodes the values of all shards and sends them, in a thread
+    void export_values(const std::vector<foreign_ptr<metrics::impl::values_reference>>& shards);
+    future<> send(sstring body);
+public:
+    explicit exporter(config cfg);
+    /// Connects to the collector with a custom factory, instead of
+    /// the address and credentials of the config
+    exporter(config cfg, std::unique_ptr<http::experimental::connection_factory> f);
+    ~exporter();
+
+    /// Starts pushing the metrics every period
+    void start();
+
+    /// Pushes the metrics now
+    future<> push();
+
+    /// Stops pushing, waiting for a push in progress
+    future<> stop();
+
+    const stats& get_stats() const noexcept {
+        return _stats;
+    }
+};
+
+}
+}
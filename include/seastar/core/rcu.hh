@@ -0,0 +1,155 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/future.hh>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace seastar {
+
+/// \cond internal
+namespace internal {
+
+// An object waiting for all shards to pass a quiescent state, see rcu_retire()
+class rcu_retired {
+    rcu_retired* _next = nullptr;
+    uint64_t _epoch = 0;
+    friend struct rcu_retired_list;
+    friend void rcu_retire(std::unique_ptr<rcu_retired>) noexcept;
+public:
+    virtual ~rcu_retired() = default;
+    // Called once all shards passed a quiescent state, before the object
+    // is deleted
+    virtual void reclaim() noexcept {}
+};
+
+// Queues an object to be reclaimed, and deleted, on this shard once every
+// shard passed a quiescent state
+void rcu_retire(std::unique_ptr<rcu_retired> r) noexcept;
+
+// Sets up the epochs of the shards, before they start running
+void rcu_init(unsigned nr_shards);
+
+// Called by the reactor between tasks: the shard holds no pointer read from
+// an rcu_ptr. Reclaims what was retired by this shard that every shard is
+// done with, and returns whether it did.
+bool rcu_quiescent_state() noexcept;
+// Whether this shard has retired objects it can reclaim now
+bool rcu_can_reclaim() noexcept;
+// Whether this shard has retired objects at all
+bool rcu_pending() noexcept;
+// Called by the reactor around sleeping, when it runs no tasks and so is in
+// a quiescent state until it wakes up
+void rcu_offline() noexcept;
+void rcu_online() noexcept;
+
+template <typename T>
+class rcu_retired_object final : public rcu_retired {
+public:
+    std::unique_ptr<const T> obj;
+};
+
+}
+/// \endcond
+
+/// \addtogroup smp-module
+/// @{
+
+/// \brief A pointer to read-mostly data shared by all shards
+///
+/// Read-copy-update: all shards read the same copy of the data, directly,
+/// with no locking and no cross-shard messages, and an update publishes a
+/// new copy, while the old one is deleted only after no shard can be
+/// reading it any more. For large tables this saves the memory of keeping
+/// a copy per shard with \ref sharded, and the indirection through a
+/// \ref foreign_ptr.
+///
+/// A pointer got with read() may be used until the task that read it
+/// returns to the scheduler: not across a continuation, a co_await, or a
+/// get() in a seastar::thread. Whatever is needed beyond that has to be
+/// copied, or read again. The reactor notes when a shard is between tasks
+/// (a quiescent state), and an old copy is deleted, on the shard that
+/// replaced it, once all shards went through one after it was replaced.
+/// A sleeping shard doesn't hold up reclamation.
+///
+/// The data is const: it is never modified in place, it is replaced.
+///
+/// \code
+/// rcu_ptr<routing_table> routes(std::make_unique<routing_table>());
+///
+/// // On any shard
+/// auto next_hop = routes.read()->lookup(addr);
+///
+/// // On any shard, too
+/// auto updated = std::make_unique<routing_table>(*routes.read());
+/// updated->add(prefix, hop);
+/// routes.update(std::move(updated));
+/// \endcode
+///
+/// Updates from several shards at once are safe, the last one wins.
+/// Only reactor threads may read.
+template <typename T>
+class rcu_ptr {
+    std::atomic<const T*> _ptr;
+public:
+    explicit rcu_ptr(std::unique_ptr<const T> initial = nullptr) noexcept
+        : _ptr(initial.release()) {}
+    rcu_ptr(const rcu_ptr&) = delete;
+    rcu_ptr& operator=(const rcu_ptr&) = delete;
+
+    /// Deletes the data right away: no shard may be reading it any more
+    ~rcu_ptr() {
+        delete _ptr.load(std::memory_order_relaxed);
+    }
+
+    /// The current copy of the data, see \ref rcu_ptr for how long it
+    /// may be used
+    const T* read() const noexcept {
+        return _ptr.load(std::memory_order_acquire);
+    }
+
+    /// \brief Publishes a new copy of the data
+    ///
+    /// Reads on all shards return the new copy once this returns. The old
+    /// copy is deleted on this shard once no shard can be reading it.
+    ///
+    /// \throws std::bad_alloc if the old copy can't be queued for
+    ///         reclamation, in which case nothing is published
+    void update(std::unique_ptr<const T> next) {
+        auto retired = std::make_unique<internal::rcu_retired_object<T>>();
+        retired->obj.reset(_ptr.exchange(next.release(), std::memory_order_seq_cst));
+        internal::rcu_retire(std::move(retired));
+    }
+};
+
+/// \brief Waits until all shards passed a quiescent state
+///
+/// Once the returned future is ready no shard is still using a pointer it
+/// read from an \ref rcu_ptr before the call, which is what deleting the
+/// old copies relies on.
+future<> synchronize_rcu() noexcept;
+
+/// @}
+
+}
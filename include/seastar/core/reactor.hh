@@ -39,6 +39,7 @@
 #include <stdexcept>
 #include <unistd.h>
 #include <vector>
+#include <array>
 #include <queue>
 #include <algorithm>
 #include <thread>
@@ -81,6 +82,7 @@
 #include <seastar/core/smp.hh>
 #include <seastar/core/internal/io_request.hh>
 #include <seastar/core/internal/io_sink.hh>
+#include <seastar/core/internal/scheduler_trace.hh>
 #include <seastar/core/make_task.hh>
 #include "internal/pollable_fd.hh"
 #include "internal/poll.hh"
@@ -141,23 +143,39 @@ namespace internal {
 
 class reactor_stall_sampler;
 class cpu_stall_detector;
+class cpu_profiler;
 class buffer_allocator;
 
 template <typename Func> // signature: bool ()
 std::unique_ptr<pollfn> make_pollfn(Func&& func);
 
+/// How the reactor runs a \ref poller
+struct poller_options {
+    /// Accounts the poller in the reactor_poller_* metrics under this
+    /// name; unnamed pollers are accounted together as "other"
+    sstring name;
+    /// Each polling round runs the pollers from the highest priority down,
+    /// those of the same priority in the order they were registered
+    int priority = 0;
+    /// Bounds the time the poller takes per polling round, on average: a
+    /// poller that ran over is skipped in the rounds that follow until
+    /// they made up for it. 0 doesn't bound it.
+    std::chrono::microseconds budget{0};
+};
+
 class poller {
     std::unique_ptr<pollfn> _pollfn;
+    poller_options _opts;
     class registration_task;
     class deregistration_task;
     registration_task* _registration_task = nullptr;
 public:
     template <typename Func> // signature: bool ()
-    static poller simple(Func&& poll) {
-        return poller(make_pollfn(std::forward<Func>(poll)));
+    static poller simple(Func&& poll, poller_options opts = {}) {
+        return poller(make_pollfn(std::forward<Func>(poll)), std::move(opts));
     }
-    poller(std::unique_ptr<pollfn> fn)
-            : _pollfn(std::move(fn)) {
+    poller(std::unique_ptr<pollfn> fn, poller_options opts = {})
+            : _pollfn(std::move(fn)), _opts(std::move(opts)) {
         do_register();
     }
     ~poller();
@@ -186,6 +204,8 @@ class io_completion : public kernel_completion {
 
 class reactor {
 private:
+    struct sched_entity;
+    struct task_supergroup;
     struct task_queue;
     using task_queue_list = circular_buffer_fixed_capacity<task_queue*, 1 << log2ceil(max_scheduling_groups())>;
     using pollfn = seastar::pollfn;
@@ -202,6 +222,7 @@ class reactor {
     class io_queue_submission_pollfn;
     class syscall_pollfn;
     class execution_stage_pollfn;
+    class rcu_pollfn;
     friend class manual_clock;
     friend class file_data_source_impl; // for fstream statistics
     friend class internal::reactor_stall_sampler;
@@ -210,6 +231,7 @@ class reactor {
     friend struct task_quota_aio_completion;
     friend class reactor_backend_epoll;
     friend class reactor_backend_aio;
+    friend class reactor_backend_uring;
     friend class reactor_backend_selector;
     friend struct reactor_options;
     friend class aio_storage_context;
@@ -263,7 +285,25 @@ class reactor {
     std::unique_ptr<reactor_backend> _backend;
 #endif
     sigset_t _active_sigmask; // holds sigmask while sleeping with sig disabled
-    std::vector<pollfn*> _pollers;
+    struct poller_stats {
+        // In scheduler_trace_ring ticks
+        uint64_t time = 0;
+        uint64_t polls = 0;
+        uint64_t busy_polls = 0;
+        uint64_t skipped_polls = 0;
+        metrics::metric_groups metrics;
+    };
+    struct registered_poller {
+        pollfn* fn;
+        int priority;
+        // Ticks per round, 0 for unbounded, and what the poller has left
+        int64_t budget;
+        int64_t credit;
+        poller_stats* stats;
+    };
+    std::vector<registered_poller> _pollers;
+    // By poller_options::name
+    std::unordered_map<sstring, std::unique_ptr<poller_stats>> _poller_stats;
 
     static constexpr unsigned max_aio_per_queue = 128;
     static constexpr unsigned max_queues = 8;
@@ -290,37 +330,93 @@ class reactor {
     uint64_t _global_tasks_processed = 0;
     uint64_t _polls = 0;
     std::unique_ptr<internal::cpu_stall_detector> _cpu_stall_detector;
+    std::unique_ptr<internal::cpu_profiler> _cpu_profiler;
 
     unsigned _max_task_backlog = 1000;
-    timer_set<timer<>, &timer<>::_link> _timers;
-    timer_set<timer<>, &timer<>::_link>::timer_list_t _expired_timers;
-    timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link> _lowres_timers;
-    timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link>::timer_list_t _expired_lowres_timers;
-    timer_set<timer<manual_clock>, &timer<manual_clock>::_link> _manual_timers;
-    timer_set<timer<manual_clock>, &timer<manual_clock>::_link>::timer_list_t _expired_manual_timers;
+#ifdef SEASTAR_TIMER_WHEEL
+    template <typename Clock>
+    using timers_for = timer_wheel<timer<Clock>, &timer<Clock>::_link>;
+#else
+    template <typename Clock>
+    using timers_for = timer_set<timer<Clock>, &timer<Clock>::_link>;
+#endif
+    timers_for<steady_clock_type> _timers;
+    timers_for<steady_clock_type>::timer_list_t _expired_timers;
+    timers_for<lowres_clock> _lowres_timers;
+    timers_for<lowres_clock>::timer_list_t _expired_lowres_timers;
+    timers_for<manual_clock> _manual_timers;
+    timers_for<manual_clock>::timer_list_t _expired_manual_timers;
     io_stats _io_stats;
     uint64_t _fsyncs = 0;
     uint64_t _cxx_exceptions = 0;
     uint64_t _abandoned_failed_futures = 0;
-    struct task_queue {
-        explicit task_queue(unsigned id, sstring name, float shares);
+    // A node of the CPU scheduling tree, either a task queue or a
+    // supergroup of them. Active siblings are run in the order of their
+    // virtual runtime, which grows inversely to their shares.
+    struct sched_entity {
+        explicit sched_entity(float shares, task_supergroup* parent, bool is_supergroup) noexcept;
         int64_t _vruntime = 0;
         float _shares;
         int64_t _reciprocal_shares_times_2_power_32;
-        bool _current = false;
         bool _active = false;
-        uint8_t _id;
+        const bool _is_supergroup;
+        task_supergroup* _parent;
+        int64_t to_vruntime(sched_clock::duration runtime) const;
+        void set_shares(float shares) noexcept;
+        struct indirect_compare;
+    };
+
+    // Active entities, kept as a binary heap ordered by vruntime. The
+    // storage is reserved for all the possible members up front, so
+    // that (de)activating entities never allocates.
+    class sched_entity_heap {
+        std::vector<sched_entity*> _heap;
+    public:
+        void push(sched_entity* e) noexcept;
+        sched_entity* pop() noexcept;
+        sched_entity* top() const noexcept { return _heap.front(); }
+        bool empty() const noexcept { return _heap.empty(); }
+        size_t size() const noexcept { return _heap.size(); }
+        void reserve(size_t n) { _heap.reserve(n); }
+    };
+
+    struct task_supergroup : public sched_entity {
+        explicit task_supergroup(float shares, task_supergroup* parent) noexcept;
+        sched_entity_heap _active_members;
+        int64_t _last_vruntime = 0;
+        unsigned _nr_members = 0;
+    };
+
+    // The fields used each time the queue is activated or run come first,
+    // so that with the sched_entity fields they take the first two cache
+    // lines of the object, and the rest is only touched by metrics and
+    // configuration.
+    struct alignas(cache_line_size) task_queue : public sched_entity {
+        explicit task_queue(unsigned id, sstring name, float shares, task_supergroup* parent = nullptr);
+        circular_buffer<task*> _q;
+        unsigned _id;
+        bool _current = false;
+        bool _throttled = false;
         sched_clock::time_point _ts; // to help calculating wait/starve-times
         sched_clock::duration _runtime = {};
         sched_clock::duration _waittime = {};
-        sched_clock::duration _starvetime = {};
         uint64_t _tasks_processed = 0;
-        circular_buffer<task*> _q;
+        // CPU bandwidth limit: the queue may run for _cpu_quota in every
+        // _cpu_period, zero quota means no limit. Overruns are carried
+        // into the next periods.
+        sched_clock::duration _cpu_quota = {};
+
         sstring _name;
-        int64_t to_vruntime(sched_clock::duration runtime) const;
-        void set_shares(float shares) noexcept;
-        struct indirect_compare;
+        sched_clock::duration _starvetime = {};
         sched_clock::duration _time_spent_on_task_quota_violations = {};
+        sched_clock::duration _cpu_period = {};
+        sched_clock::duration _cpu_quota_used = {};
+        sched_clock::time_point _cpu_period_end;
+        sched_clock::time_point _throttled_since;
+        sched_clock::duration _throttled_time = {};
+        uint64_t _nr_throttled = 0;
+        timer<> _unthrottle_timer;
+        void roll_cpu_period(sched_clock::time_point now) noexcept;
         seastar::metrics::metric_groups _metrics;
         void rename(sstring new_name);
     private:
@@ -328,13 +424,21 @@ class reactor {
     };
 
     boost::container::static_vector<std::unique_ptr<task_queue>, max_scheduling_groups()> _task_queues;
+    // Indexed by supergroup id, the root (id 0) isn't kept here
+    boost::container::static_vector<std::unique_ptr<task_supergroup>, max_scheduling_groups() + 1> _task_supergroups;
     internal::scheduling_group_specific_thread_local_data _scheduling_group_specific_data;
+    // The top level of the scheduling tree
     int64_t _last_vruntime = 0;
-    task_queue_list _active_task_queues;
+    sched_entity_heap _active_task_queues;
+    unsigned _nr_top_level_entities = 0;
     task_queue_list _activating_task_queues;
     task_queue* _at_destroy_tasks;
     sched_clock::duration _task_quota;
     task* _current_task = nullptr;
+    // The type of _current_task, taken before it runs as the task may be
+    // gone before run_and_dispose() returns; read by the stall detector
+    const std::type_info* _current_task_type = nullptr;
+    internal::scheduler_trace_ring _scheduler_trace;
     /// Handler that will be called when there is no task to execute on cpu.
     /// It represents a low priority work.
     /// 
@@ -344,6 +448,7 @@ class reactor {
     /// Handler's argument is a function that returns true if a task which should be executed on cpu appears or false
     /// otherwise. This function should be used by a handler to return early if a task appears.
     idle_cpu_handler _idle_cpu_handler{ [] (work_waiting_on_reactor) {return idle_cpu_handler_result::no_more_work;} };
+    scheduling_group _background_reclaim_sg;
     std::unique_ptr<network_stack> _network_stack;
     lowres_clock::time_point _lowres_next_timeout;
     std::optional<pollable_fd> _aio_eventfd;
@@ -354,6 +459,12 @@ class reactor {
     sched_clock::duration _total_sleep;
     sched_clock::time_point _start_time = now();
     std::chrono::nanoseconds _max_poll_time = calculate_poll_time();
+    idle_mode _idle_mode = idle_mode::fixed;
+    // Counts of recent idle periods, by log2 of their length in microseconds
+    std::array<uint32_t, 24> _idle_periods = {};
+    // How long to poll before sleeping, as chosen by _idle_mode
+    std::chrono::nanoseconds _idle_poll_budget = _max_poll_time;
+    uint64_t _sleeps = 0;
     circular_buffer<output_stream<char>* > _flush_batching;
     std::atomic<bool> _sleeping alignas(seastar::cache_line_size){0};
     pthread_t _thread_id alignas(seastar::cache_line_size) = pthread_self();
@@ -365,7 +476,12 @@ class reactor {
     std::atomic<bool> _dying{false};
 private:
     static std::chrono::nanoseconds calculate_poll_time();
+    void account_idle_period(sched_clock::duration period) noexcept;
+    void update_idle_poll_budget() noexcept;
+    void idle_pause() noexcept;
     static void block_notifier(int);
+    static void cpu_profiler_notifier(int, siginfo_t*, void*);
+    sstring scheduling_group_name_or_id(unsigned id) const;
     size_t handle_aio_error(internal::linux_abi::iocb* iocb, int ec);
     bool flush_pending_aio();
     steady_clock_type::time_point next_pending_aio() const noexcept;
@@ -428,13 +544,22 @@ class reactor {
     bool posix_reuseport_detect();
     void run_some_tasks();
     void activate(task_queue& tq);
-    void insert_active_task_queue(task_queue* tq);
+    sched_entity_heap& active_members_of(sched_entity& e) noexcept;
+    int64_t& last_vruntime_of(sched_entity& e) noexcept;
+    void insert_active_task_queue(sched_entity* tq);
     task_queue* pop_active_task_queue(sched_clock::time_point now);
     void insert_activating_task_queues();
     void account_runtime(task_queue& tq, sched_clock::duration runtime);
+    bool charge_cpu_quota(task_queue& tq, sched_clock::time_point now, sched_clock::duration runtime) noexcept;
+    void unthrottle(task_queue& tq) noexcept;
+    void set_cpu_quota(task_queue& tq, sched_clock::duration quota, sched_clock::duration period) noexcept;
     void account_idle(sched_clock::duration idletime);
+    void add_sched_member(task_supergroup* parent);
+    void remove_sched_member(task_supergroup* parent) noexcept;
     void allocate_scheduling_group_specific_data(scheduling_group sg, scheduling_group_key key);
-    future<> init_scheduling_group(scheduling_group sg, sstring name, float shares);
+    future<> init_scheduling_group(scheduling_group sg, sstring name, float shares, scheduling_supergroup parent = {});
+    void init_scheduling_supergroup(scheduling_supergroup sg, float shares, scheduling_supergroup parent);
+    void destroy_scheduling_supergroup(scheduling_supergroup sg);
     future<> init_new_scheduling_group_key(scheduling_group_key key, scheduling_group_key_config cfg);
     future<> destroy_scheduling_group(scheduling_group sg);
     uint64_t tasks_processed() const;
@@ -567,6 +692,7 @@ class reactor {
     void shuffle(task*&, task_queue&);
 #endif
     task* current_task() const { return _current_task; }
+    const std::type_info* current_task_type() const noexcept { return _current_task_type; }
 
     void add_task(task* t) noexcept {
         auto sg = t->group();
@@ -607,8 +733,22 @@ class reactor {
     }
     void force_poll();
 
+    /// Sets how this shard polls before going to sleep, see \ref idle_mode
+    void set_idle_mode(idle_mode mode) noexcept;
+    idle_mode get_idle_mode() const noexcept {
+        return _idle_mode;
+    }
+
     void add_high_priority_task(task*) noexcept;
 
+    /// Sets the scheduling group background memory reclaim runs in.
+    ///
+    /// See \ref memory::set_background_reclaim_free_pages(). Defaults to
+    /// the default scheduling group.
+    void set_background_reclaim_scheduling_group(scheduling_group sg) noexcept {
+        _background_reclaim_sg = sg;
+    }
+
     network_stack& net() { return *_network_stack; }
 
     [[deprecated("Use this_shard_id")]]
@@ -641,7 +781,7 @@ class reactor {
      *
      * @param fn a new "poller" function to register
      */
-    void register_poller(pollfn* p);
+    void register_poller(pollfn* p, const internal::poller_options& opts = {});
     void unregister_poller(pollfn* p);
     void replace_poller(pollfn* old, pollfn* neww);
     void register_metrics();
@@ -666,7 +806,10 @@ class reactor {
     friend class pollable_fd_state;
     friend struct pollable_fd_state_deleter;
     friend class posix_file_impl;
+    friend class io_queue;
     friend class blockdev_file_impl;
+    friend class nvme_file_impl;
+    friend class posix_buffered_file_impl;
     friend class readable_eventfd;
     friend class timer<>;
     friend class timer<lowres_clock>;
@@ -675,13 +818,17 @@ class reactor {
     friend class smp_message_queue;
     friend class internal::poller;
     friend class scheduling_group;
+    friend class scheduling_supergroup;
     friend void add_to_flush_poller(output_stream<char>* os);
     friend void seastar::log_exception_trace() noexcept;
     friend void report_failed_future(const std::exception_ptr& eptr) noexcept;
     friend void with_allow_abandoned_failed_futures(unsigned count, noncopyable_function<void ()> func);
     metrics::metric_groups _metric_groups;
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares) noexcept;
+    friend future<scheduling_group> create_scheduling_group(sstring name, float shares, scheduling_supergroup parent) noexcept;
     friend future<> seastar::destroy_scheduling_group(scheduling_group) noexcept;
+    friend future<scheduling_supergroup> create_scheduling_supergroup(float shares, scheduling_supergroup parent) noexcept;
+    friend future<> seastar::destroy_scheduling_supergroup(scheduling_supergroup) noexcept;
     friend future<> seastar::rename_scheduling_group(scheduling_group sg, sstring new_name) noexcept;
     friend future<scheduling_group_key> scheduling_group_key_create(scheduling_group_key_config cfg) noexcept;
 
@@ -723,6 +870,21 @@ class reactor {
     void set_bypass_fsync(bool value);
     void update_blocked_reactor_notify_ms(std::chrono::milliseconds ms);
     std::chrono::milliseconds get_blocked_reactor_notify_ms() const;
+    /// Like update_blocked_reactor_notify_ms(), with sub-millisecond thresholds
+    void update_blocked_reactor_notify(std::chrono::microseconds us);
+    std::chrono::microseconds get_blocked_reactor_notify() const;
+    /// Formats this shard's scheduler trace, see \ref scheduler_trace::dump()
+    sstring format_scheduler_trace() const;
+    /// Samples this shard's backtrace every \c period of CPU time, see
+    /// \ref cpu_profiler::start(). A zero period stops sampling.
+    void set_cpu_profiler_period(std::chrono::nanoseconds period);
+    /// Formats the stacks sampled on this shard, see \ref cpu_profiler::folded_stacks()
+    sstring format_cpu_profile();
+    void reset_cpu_profile();
+    /// Formats the stalls of this shard aggregated by backtrace, see
+    /// \ref stall_reports::summary()
+    sstring format_stall_reports() const;
+    void reset_stall_reports();
     // For testing:
     void set_stall_detector_report_function(std::function<void ()> report);
     std::function<void ()> get_stall_detector_report_function() const;
@@ -771,6 +933,9 @@ inline int hrtimer_signal() {
 }
 
 
+/// Sets how all shards poll before going to sleep, see \ref idle_mode
+future<> set_idle_mode(idle_mode mode);
+
 extern logger seastar_logger;
 
 }
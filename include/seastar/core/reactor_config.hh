@@ -31,6 +31,10 @@ namespace seastar {
 struct reactor_config {
     bool auto_handle_sigint_sigterm = true;
     unsigned max_networking_aio_io_control_blocks = 10000;
+    bool uring_sqpoll = false;
+    bool uring_iopoll = false;
+    unsigned net_busy_poll_us = 0;
+    unsigned syscall_threads = 1;
 };
 /// \endcond
 
@@ -53,6 +57,13 @@ struct reactor_options : public program_options::option_group {
     ///
     /// Reduce for overprovisioned environments or laptops.
     program_options::value<unsigned> idle_poll_time_us;
+    /// \brief How to poll before going to sleep when idle.
+    ///
+    /// One of \p fixed, \p latency, \p balanced or \p power, see
+    /// \ref idle_mode. Can be changed at run time with \ref set_idle_mode().
+    ///
+    /// Default: \p fixed.
+    program_options::value<std::string> idle_mode;
     /// \brief Busy-poll for disk I/O.
     ///
     /// Reduces latency and increases throughput.
@@ -65,6 +76,13 @@ struct reactor_options : public program_options::option_group {
     ///
     /// Default: 1.5 * task_quota_ms value
     program_options::value<double> io_latency_goal_ms;
+    /// \brief Target 99th percentile latency (ms) of IO operations.
+    ///
+    /// When set, the I/O queues lower the rates given by the io properties
+    /// while the observed latency is above the target, and bring them back
+    /// as it recovers.
+    /// Default: not set, the rates are static.
+    program_options::value<double> io_latency_target_ms;
     /// \brief Maximum number of task backlog to allow.
     ///
     /// When the number of tasks grow above this, we stop polling (e.g. I/O)
@@ -76,6 +94,15 @@ struct reactor_options : public program_options::option_group {
     ///
     /// Default: 200.
     program_options::value<unsigned> blocked_reactor_notify_ms;
+    /// \brief Threshold in microseconds over which the reactor is considered
+    /// blocked if no progress is made; overrides \ref blocked_reactor_notify_ms.
+    ///
+    /// For latency targets below a millisecond. The stalling tasks are
+    /// then also recorded, with their type, in the scheduler trace. Needs
+    /// the perf_event based detector: the posix timer it falls back to
+    /// only fires on the kernel's scheduler tick.
+    /// Default: 0 (use \ref blocked_reactor_notify_ms).
+    program_options::value<unsigned> blocked_reactor_notify_us;
     /// \brief Maximum number of backtraces reported by stall detector per minute.
     ///
     /// Default: 5.
@@ -84,6 +111,23 @@ struct reactor_options : public program_options::option_group {
     ///
     /// Default: \p true.
     program_options::value<bool> blocked_reactor_report_format_oneline;
+    /// \brief Period in seconds of the log summary of the stalls that
+    /// occurred since the last one, aggregated by backtrace, see
+    /// \ref stall_reports.
+    ///
+    /// 0 disables the summary. Default: 600.
+    program_options::value<unsigned> blocked_reactor_summary_interval_s;
+    /// \brief Number of scheduler events each shard keeps for
+    /// \ref scheduler_trace::dump().
+    ///
+    /// Rounded up to a power of two; 0 disables the scheduler trace.
+    /// Default: 8192.
+    program_options::value<unsigned> scheduler_trace_entries;
+    /// \brief Sample each shard's backtrace once per this many microseconds
+    /// of CPU time, see \ref cpu_profiler.
+    ///
+    /// Default: 0 (the profiler is off).
+    program_options::value<unsigned> cpu_profiler_period_us;
     /// \brief Allow using buffered I/O if DMA is not available (reduces performance).
     program_options::value<> relaxed_dma;
     /// \brief Use the Linux NOWAIT AIO feature, which reduces reactor stalls due
@@ -129,6 +173,7 @@ struct reactor_options : public program_options::option_group {
     /// Available backends:
     /// * \p linux-aio
     /// * \p epoll
+    /// * \p io_uring (if Seastar was built with liburing)
     ///
     /// Default: \p linux-aio (if available).
     program_options::selection_value<reactor_backend_selector> reactor_backend;
@@ -144,6 +189,52 @@ struct reactor_options : public program_options::option_group {
     ///
     /// Default: 10000.
     program_options::value<unsigned> max_networking_io_control_blocks;
+    /// \brief Poll the io_uring submission queue from a kernel thread.
+    ///
+    /// Submitting I/O then usually doesn't need a system call, at the cost
+    /// of a kernel thread busy-polling on behalf of each shard while it is
+    /// active. Requires Linux 5.11 or later. Only valid for the \p io_uring
+    /// reactor backend (see \ref reactor_backend).
+    ///
+    /// Default: \p false.
+    program_options::value<bool> uring_sqpoll;
+    /// \brief Poll NVMe devices for I/O completions.
+    ///
+    /// I/O to NVMe generic devices (\p /dev/ngXnY) is sent to a separate
+    /// io_uring set up for polled completions, which avoids the latency of
+    /// completion interrupts. A shard busy-polls while such I/O is in flight
+    /// and still sleeps when idle. Requires Linux 6.1 or later, and poll
+    /// queues configured in the nvme driver (the \p poll_queues module
+    /// parameter). Only valid for the \p io_uring reactor backend (see
+    /// \ref reactor_backend).
+    ///
+    /// Default: \p false.
+    program_options::value<bool> uring_iopoll;
+    /// \brief Busy-poll network device queues instead of waiting for interrupts.
+    ///
+    /// When non-zero, a shard about to sleep first polls the receive queue
+    /// (NAPI instance) its sockets were last served by, for up to this many
+    /// microseconds, and each poll for socket events while it is busy runs
+    /// the queue's receive processing. Works best with one receive queue per
+    /// shard, its interrupts steered to the shard's cpu, and connections
+    /// kept there with the \p incoming_cpu load balancing algorithm. The
+    /// device's \p napi_defer_hard_irqs and \p gro_flush_timeout should be
+    /// set so that interrupts stay off while the shard polls. Requires Linux
+    /// 6.9 or later for the \p epoll reactor backend and Linux 6.9 with
+    /// liburing 2.6 or later for the \p io_uring one, and isn't supported by
+    /// \p linux-aio (see \ref reactor_backend).
+    ///
+    /// Default: 0 (disabled).
+    program_options::value<unsigned> net_busy_poll_us;
+    /// \brief Number of threads each shard offloads blocking system calls to.
+    ///
+    /// Operations the kernel can't do asynchronously, like opening, renaming
+    /// or stat()ing files, run on these threads. More threads let a shard
+    /// issue more of them concurrently, for example during bursts of file
+    /// creation, at the cost of idle threads the rest of the time.
+    ///
+    /// Default: 1.
+    program_options::value<unsigned> syscall_threads;
     /// \brief Enable seastar heap profiling.
     ///
     /// \note Unused when seastar was compiled without heap profiling support.
@@ -92,6 +92,8 @@ struct configuration {
     bool assign_orphan_cpus = false;
     std::vector<dev_t> devices;
     unsigned num_io_groups;
+    // Use only one PU of each core, leaving its SMT siblings to other threads
+    bool one_shard_per_core = false;
     hwloc::internal::topology_holder topology;
 };
 
@@ -117,6 +119,9 @@ struct io_queue_topology {
 struct cpu {
     unsigned cpu_id;
     std::vector<memory> mem;
+    unsigned nodeid = 0; // the NUMA node the cpu belongs to
+    cpuset siblings; // the other PUs of the cpu's core that run no shard
+    unsigned cache_group = 0; // index of the last level cache the cpu uses
 };
 
 struct resources {
@@ -126,6 +131,8 @@ struct resources {
 
 resources allocate(configuration& c);
 unsigned nr_processing_units(configuration& c);
+// The number of cores cpus belong to
+unsigned nr_cores(configuration& c, const cpuset& cpus);
 
 std::optional<resource::cpuset> parse_cpuset(std::string value);
 
@@ -0,0 +1,282 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/future.hh>
+#include <cassert>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace seastar {
+
+/// \addtogroup future-util
+/// @{
+
+/// An error, to construct a \ref result holding it, like std::unexpected
+template <typename E>
+struct result_error {
+    E error;
+};
+
+/// Makes a \ref result_error, which converts to any \ref result with
+/// errors of type \c E
+template <typename E>
+result_error<std::decay_t<E>> make_result_error(E&& e) {
+    return result_error<std::decay_t<E>>{std::forward<E>(e)};
+}
+
+/// \brief Either a value or an error
+///
+/// Failures which are expected as part of normal operation, such as a
+/// lookup missing, are cheaper to report as a value of some error type
+/// than as an exception: a failed future holds a std::exception_ptr,
+/// which allocates, and handling it often means throwing it. A
+/// future<result<T, E>> carries such errors as ordinary values, through
+/// then(), then_wrapped() and co_await alike, while real exceptions still
+/// fail the future, and reach handle_exception() as usual.
+///
+/// \ref then_ok() chains continuations which only run on success, and
+/// \ref value_or_exception() converts the errors to exceptions where
+/// they aren't expected any more.
+///
+/// \code
+/// future<result<row, lookup_error>> lookup(key k);
+///
+/// future<result<sstring, lookup_error>> name(key k) {
+///     return then_ok(lookup(k), [] (row r) {
+///         return r.name();
+///     });
+/// }
+/// \endcode
+///
+/// \tparam T the value type, may be void
+/// \tparam E the error type, typically an enum or a small struct
+template <typename T, typename E>
+class [[nodiscard]] result {
+    static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_move_constructible_v<E>,
+            "result is passed by futures, which require nothrow move");
+    std::variant<T, E> _v;
+public:
+    using value_type = T;
+    using error_type = E;
+
+    result(T v) noexcept : _v(std::in_place_index<0>, std::move(v)) {}
+    template <typename U>
+    SEASTAR_CONCEPT(requires std::is_constructible_v<E, U&&>)
+    result(result_error<U> e) noexcept(std::is_nothrow_constructible_v<E, U&&>)
+        : _v(std::in_place_index<1>, std::move(e.error)) {}
+
+    bool has_value() const noexcept {
+        return _v.index() == 0;
+    }
+    explicit operator bool() const noexcept {
+        return has_value();
+    }
+
+    /// The value, which has to be there
+    T& value() & noexcept {
+        assert(has_value());
+        return *std::get_if<0>(&_v);
+    }
+    const T& value() const & noexcept {
+        assert(has_value());
+        return *std::get_if<0>(&_v);
+    }
+    T&& value() && noexcept {
+        assert(has_value());
+        return std::move(*std::get_if<0>(&_v));
+    }
+
+    /// The error, which has to be there
+    E& error() & noexcept {
+        assert(!has_value());
+        return *std::get_if<1>(&_v);
+    }
+    const E& error() const & noexcept {
+        assert(!has_value());
+        return *std::get_if<1>(&_v);
+    }
+    E&& error() && noexcept {
+        assert(!has_value());
+        return std::move(*std::get_if<1>(&_v));
+    }
+
+    template <typename U>
+    T value_or(U&& def) && {
+        return has_value() ? std::move(*this).value() : T(std::forward<U>(def));
+    }
+};
+
+/// A \ref result without a value, only telling success or an error
+template <typename E>
+class [[nodiscard]] result<void, E> {
+    static_assert(std::is_nothrow_move_constructible_v<E>,
+            "result is passed by futures, which require nothrow move");
+    std::optional<E> _error;
+public:
+    using value_type = void;
+    using error_type = E;
+
+    result() noexcept = default;
+    template <typename U>
+    SEASTAR_CONCEPT(requires std::is_constructible_v<E, U&&>)
+    result(result_error<U> e) noexcept(std::is_nothrow_constructible_v<E, U&&>)
+        : _error(std::move(e.error)) {}
+
+    bool has_value() const noexcept {
+        return !_error;
+    }
+    explicit operator bool() const noexcept {
+        return has_value();
+    }
+    void value() const noexcept {
+        assert(has_value());
+    }
+
+    E& error() & noexcept {
+        assert(!has_value());
+        return *_error;
+    }
+    const E& error() const & noexcept {
+        assert(!has_value());
+        return *_error;
+    }
+    E&& error() && noexcept {
+        assert(!has_value());
+        return std::move(*_error);
+    }
+};
+
+template <typename T>
+struct is_result : std::false_type {};
+
+template <typename T, typename E>
+struct is_result<result<T, E>> : std::true_type {};
+
+namespace internal {
+
+// The result a then_ok() continuation's return value becomes: results are
+// passed on, other values are taken as success
+template <typename R, typename E>
+struct to_result {
+    using type = result<R, E>;
+};
+
+template <typename T, typename E>
+struct to_result<result<T, E>, E> {
+    using type = result<T, E>;
+};
+
+// What a then_ok() continuation returns, or the value of the future it
+// returns
+template <typename R>
+struct unwrap_future {
+    using type = R;
+};
+
+template <typename T>
+struct unwrap_future<future<T>> {
+    using type = T;
+};
+
+template <typename T, typename Func>
+struct then_ok_invoke_result : std::invoke_result<Func, T&&> {};
+
+template <typename Func>
+struct then_ok_invoke_result<void, Func> : std::invoke_result<Func> {};
+
+template <typename T, typename Func>
+using then_ok_func_result_t = typename unwrap_future<typename then_ok_invoke_result<T, Func>::type>::type;
+
+template <typename T, typename E, typename Func>
+using then_ok_result_t = typename to_result<then_ok_func_result_t<T, Func>, E>::type;
+
+}
+
+/// \brief Runs a continuation on the value of a successful \ref result
+///
+/// \c func gets the value (nothing for result<void, E>), and may return a
+/// value, a \ref result with the same error type, or a future of either.
+/// If \c f holds an error, or fails, \c func doesn't run, and the error or
+/// the exception is passed on without an exception being made of it.
+///
+/// \return a future of a \ref result with the value \c func returned, and
+///         the error type of \c f
+template <typename T, typename E, typename Func>
+future<internal::then_ok_result_t<T, E, Func>>
+then_ok(future<result<T, E>>&& f, Func&& func) noexcept {
+    using ret_type = internal::then_ok_result_t<T, E, Func>;
+    return f.then([func = std::forward<Func>(func)] (result<T, E> r) mutable -> future<ret_type> {
+        if (!r) {
+            return make_ready_future<ret_type>(make_result_error(std::move(r).error()));
+        }
+        auto call = [&] {
+            if constexpr (std::is_void_v<T>) {
+                return futurize_invoke(func);
+            } else {
+                return futurize_invoke(func, std::move(r).value());
+            }
+        };
+        using func_ret = internal::then_ok_func_result_t<T, Func>;
+        if constexpr (is_result<func_ret>::value) {
+            return call();
+        } else if constexpr (std::is_void_v<func_ret>) {
+            return call().then([] {
+                return ret_type();
+            });
+        } else {
+            return call().then([] (func_ret v) {
+                return ret_type(std::move(v));
+            });
+        }
+    });
+}
+
+/// \brief Converts the errors of a future's \ref result to exceptions
+///
+/// For where an error isn't expected any more, and failing the future
+/// is the right thing to do with it.
+///
+/// \param to_exception makes a std::exception_ptr of an error
+/// \return a future of the value, failed with the exception made of the
+///         error if there was one
+template <typename T, typename E, typename Func>
+SEASTAR_CONCEPT(requires std::is_invocable_r_v<std::exception_ptr, Func, E&&>)
+future<T>
+value_or_exception(future<result<T, E>>&& f, Func&& to_exception) noexcept {
+    return f.then([to_exception = std::forward<Func>(to_exception)] (result<T, E> r) mutable {
+        if (!r) {
+            return make_exception_future<T>(to_exception(std::move(r).error()));
+        }
+        if constexpr (std::is_void_v<T>) {
+            return make_ready_future<>();
+        } else {
+            return make_ready_future<T>(std::move(r).value());
+        }
+    });
+}
+
+/// @}
+
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/http/httpd.hh>
+#include <seastar/core/sstring.hh>
+
+namespace seastar {
+
+/// \brief Access to the reactor's scheduler trace.
+///
+/// Every shard keeps the most recent scheduler events in a fixed-size ring
+/// (see the \c --scheduler-trace-entries option): which scheduling group's
+/// task queue ran and for how long, which pollers found work, and which
+/// tasks ran longer than the task quota. The trace is kept cheap enough to
+/// stay enabled in production, so it can be looked at after a latency
+/// hiccup is noticed.
+namespace scheduler_trace {
+
+/// Collects the traces of all shards as a Chrome trace event format JSON
+/// document, which can be loaded into Perfetto or chrome://tracing.
+/// Each shard is shown as a separate thread.
+future<sstring> dump();
+
+/// \defgroup add_scheduler_trace_routes adds an endpoint that returns the
+///    result of \ref dump()
+/// @{
+future<> add_routes(distributed<http_server>& server, sstring path = "/scheduler_trace");
+future<> add_routes(http_server& server, sstring path = "/scheduler_trace");
+/// @}
+
+}
+
+}
@@ -45,6 +45,7 @@ class future;
 class reactor;
 
 class scheduling_group;
+class scheduling_supergroup;
 class scheduling_group_key;
 
 using sched_clock = std::chrono::steady_clock;
@@ -75,6 +76,41 @@ T* scheduling_group_get_specific_ptr(scheduling_group sg, scheduling_group_key k
 /// \return a scheduling group that can be used on any shard
 future<scheduling_group> create_scheduling_group(sstring name, float shares) noexcept;
 
+/// Creates a scheduling group within a supergroup.
+///
+/// Like create_scheduling_group(sstring, float), except that the group competes
+/// for the CPU time given to \c parent with the other members of \c parent.
+///
+/// \param name A name that identifiers the group; will be used as a label
+///             in the group's metrics
+/// \param shares number of shares of the CPU time allotted to the group,
+///              relative to the other members of \c parent
+/// \param parent the supergroup to create the group in
+/// \return a scheduling group that can be used on any shard
+future<scheduling_group> create_scheduling_group(sstring name, float shares, scheduling_supergroup parent) noexcept;
+
+/// Creates a scheduling supergroup with a specified number of shares.
+///
+/// The operation is global and affects all shards.
+///
+/// \param shares number of shares of the CPU time allotted to the supergroup,
+///              relative to the other members of \c parent
+/// \param parent the supergroup to nest the new one in, top-level by default
+/// \return a scheduling supergroup that can be used on any shard
+future<scheduling_supergroup> create_scheduling_supergroup(float shares, scheduling_supergroup parent) noexcept;
+future<scheduling_supergroup> create_scheduling_supergroup(float shares) noexcept;
+
+/// Destroys a scheduling supergroup.
+///
+/// All the scheduling groups and supergroups created in it must have been
+/// destroyed before.
+///
+/// The operation is global and affects all shards.
+///
+/// \param sg The scheduling supergroup to be destroyed
+/// \return a future that is ready when the supergroup has been torn down
+future<> destroy_scheduling_supergroup(scheduling_supergroup sg) noexcept;
+
 /// Destroys a scheduling group.
 ///
 /// Destroys a \ref scheduling_group previously created with create_scheduling_group().
@@ -286,7 +322,20 @@ class scheduling_group {
     /// \param shares number of shares allotted to the group. Use numbers
     ///               in the 1-1000 range.
     void set_shares(float shares) noexcept;
+    /// Limits the CPU time the group can use.
+    ///
+    /// Shares only divide the CPU between the groups that compete for it, so a
+    /// group alone on a shard can use all of it. With a quota, the group runs
+    /// for at most \c quota in every \c period, even when the shard has nothing
+    /// else to do, and is throttled for the rest of the period. The limit is
+    /// applied at task quota granularity, and going over it is paid back in the
+    /// next periods. The adjustment is local to the shard.
+    ///
+    /// \param quota CPU time the group can use per period, zero removes the limit
+    /// \param period the length of the accounting period
+    void set_cpu_quota(std::chrono::microseconds quota, std::chrono::microseconds period = std::chrono::milliseconds(100)) noexcept;
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares) noexcept;
+    friend future<scheduling_group> create_scheduling_group(sstring name, float shares, scheduling_supergroup parent) noexcept;
     friend future<> destroy_scheduling_group(scheduling_group sg) noexcept;
     friend future<> rename_scheduling_group(scheduling_group sg, sstring new_name) noexcept;
     friend class reactor;
@@ -310,6 +359,39 @@ class scheduling_group {
 
 };
 
+/// \brief Identifies a set of scheduling groups that share CPU time
+///
+/// A `scheduling_supergroup` competes for CPU time with its siblings -- the
+/// scheduling groups and supergroups created with the same parent -- according
+/// to its shares, and the time it gets is split between its own members
+/// according to theirs. For example, a supergroup with 300 shares next to a
+/// group with 700 gets 30% of the CPU, and its groups with 800 and 200 shares
+/// get 24% and 6%.
+///
+/// A default-constructed `scheduling_supergroup` denotes the top level, which
+/// the groups created by create_scheduling_group(sstring, float) belong to.
+class scheduling_supergroup {
+    unsigned _id;
+private:
+    explicit scheduling_supergroup(unsigned id) noexcept : _id(id) {}
+public:
+    /// Creates a `scheduling_supergroup` object denoting the top level
+    constexpr scheduling_supergroup() noexcept : _id(0) {}
+    bool operator==(scheduling_supergroup x) const noexcept { return _id == x._id; }
+    bool operator!=(scheduling_supergroup x) const noexcept { return _id != x._id; }
+    bool is_root() const noexcept { return _id == 0; }
+    /// Adjusts the number of shares allotted to the supergroup.
+    ///
+    /// Like \ref scheduling_group::set_shares(), the adjustment is local to the shard.
+    ///
+    /// \param shares number of shares allotted to the supergroup. Use numbers
+    ///               in the 1-1000 range.
+    void set_shares(float shares) noexcept;
+    friend future<scheduling_supergroup> create_scheduling_supergroup(float shares, scheduling_supergroup parent) noexcept;
+    friend future<> destroy_scheduling_supergroup(scheduling_supergroup sg) noexcept;
+    friend class reactor;
+};
+
 /// \cond internal
 namespace internal {
 
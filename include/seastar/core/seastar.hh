@@ -65,6 +65,9 @@ class socket_address;
 struct listen_options;
 enum class transport;
 
+// posix.hh
+class file_desc;
+
 // file.hh
 class file;
 struct file_open_options;
@@ -142,6 +145,15 @@ future<connected_socket> connect(socket_address sa, socket_address local, transp
 /// \return a \ref socket object that can be used for establishing connections
 socket make_socket();
 
+/// Takes up a connected stream socket of the kernel, such as one received
+/// from another process with \ref connected_socket::receive_fds(), as a
+/// \ref connected_socket of the posix stack.
+///
+/// \param fd a connected TCP, SCTP or unix domain stream socket
+///
+/// \return a \ref connected_socket owning \c fd
+connected_socket adopt_connected_socket(file_desc fd);
+
 /// Creates a udp_channel object suitable for sending UDP packets
 ///
 /// The channel is not bound to a local address, and thus can only be used
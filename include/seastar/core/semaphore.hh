@@ -30,6 +30,7 @@
 #include <seastar/core/abortable_fifo.hh>
 #include <seastar/core/timed_out_error.hh>
 #include <seastar/core/abort_on_expiry.hh>
+#include <seastar/core/internal/deferred_wakeup.hh>
 
 namespace seastar {
 
@@ -185,12 +186,44 @@ class basic_semaphore : private ExceptionFactory {
         }
     };
     internal::abortable_fifo<entry, expiry_handler> _wait_list;
+    internal::deferred_wakeup _wakeup;
+    // Waiters woken before checking for preemption
+    static constexpr unsigned wakeup_batch = 128;
     bool has_available_units(size_t nr) const noexcept {
         return _count >= 0 && (static_cast<size_t>(_count) >= nr);
     }
     bool may_proceed(size_t nr) const noexcept {
         return has_available_units(nr) && _wait_list.empty();
     }
+    bool can_wake_front() const noexcept {
+        return !_wait_list.empty() && has_available_units(_wait_list.front().nr);
+    }
+    void wake_front() noexcept {
+        auto& x = _wait_list.front();
+        _count -= x.nr;
+        x.pr.set_value();
+        _wait_list.pop_front();
+    }
+    // Wakes a batch of waiters, and leaves the rest to a task if the
+    // reactor has other work to do by then, or in any case if called from
+    // signal(), where there may be no preemption point until the task
+    // quota runs out
+    void wake_waiters(bool from_signal) noexcept {
+        while (can_wake_front()) {
+            for (unsigned i = 0; i < wakeup_batch && can_wake_front(); i++) {
+                wake_front();
+            }
+            if (can_wake_front() && (from_signal || need_preempt())
+                    && (_wakeup.pending() || _wakeup.schedule(continue_wakeup, this))) {
+                return;
+            }
+        }
+    }
+    static void continue_wakeup(void* sem) noexcept {
+        auto& s = *static_cast<basic_semaphore*>(sem);
+        s._wakeup.done();
+        s.wake_waiters(false);
+    }
 public:
     /// Returns the maximum number of units the semaphore counter can hold
     static constexpr size_t max_counter() noexcept {
@@ -214,6 +247,17 @@ class basic_semaphore : private ExceptionFactory {
     {
         static_assert(std::is_nothrow_move_constructible_v<expiry_handler>);
     }
+    basic_semaphore(basic_semaphore&&) noexcept = default;
+    basic_semaphore& operator=(basic_semaphore&&) noexcept = default;
+    ~basic_semaphore() {
+        // Waiters signal() had units for get them
+        if (_wakeup.pending()) {
+            _wakeup.cancel();
+            while (can_wake_front()) {
+                wake_front();
+            }
+        }
+    }
     /// Waits until at least a specific number of units are available in the
     /// counter, and reduces the counter by that amount of units.
     ///
@@ -318,17 +362,20 @@ class basic_semaphore : private ExceptionFactory {
     /// ready, and the value of the counter is reduced according to
     /// the amount requested.
     ///
+    /// \note When many waiters can proceed, the first ones are woken
+    ///       right away and the others in a task that follows, which
+    ///       checks for preemption between batches of them. Until then,
+    ///       they are still counted by \ref waiters(), and the units they
+    ///       are to get by \ref current().
+    ///
     /// \param nr Number of units to deposit (default 1).
     void signal(size_t nr = 1) noexcept {
         if (_ex) {
             return;
         }
         _count += nr;
-        while (!_wait_list.empty() && has_available_units(_wait_list.front().nr)) {
-            auto& x = _wait_list.front();
-            _count -= x.nr;
-            x.pr.set_value();
-            _wait_list.pop_front();
+        if (!_wakeup.pending()) {
+            wake_waiters(true);
         }
     }
 
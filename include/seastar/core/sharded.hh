@@ -24,6 +24,7 @@
 #include <seastar/core/smp.hh>
 #include <seastar/core/loop.hh>
 #include <seastar/core/map_reduce.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/util/is_smart_ptr.hh>
 #include <seastar/util/tuple_utils.hh>
 #include <seastar/core/do_with.hh>
@@ -256,7 +257,9 @@ class sharded {
     /// which is allocated on current shard.
     ///
     /// \param options the options to forward to the \ref smp::submit_to()
-    ///         called behind the scenes.
+    ///         called behind the scenes. With smp_submit_to_options::push_now
+    ///         all the calls are on their way to the other shards once this
+    ///         returns, rather than on the next poll.
     /// \param func a callable with the signature `void (Service&)`
     ///             or `future<> (Service&)`, to be called on each core
     ///             with the local instance as an argument.
@@ -316,36 +319,60 @@ class sharded {
     /// Invoke a callable on all instances of `Service` and reduce the results using
     /// `Reducer`.
     ///
+    /// \param options the options to forward to the \ref smp::submit_to()
+    ///         called behind the scenes. With smp_submit_to_options::push_now
+    ///         all the calls are on their way to the other shards once this
+    ///         returns, rather than on the next poll.
+    ///
     /// \see map_reduce(Iterator begin, Iterator end, Mapper&& mapper, Reducer&& r)
     template <typename Reducer, typename Func>
     inline
-    auto map_reduce(Reducer&& r, Func&& func) -> typename reducer_traits<Reducer>::future_type
+    auto map_reduce(smp_submit_to_options options, Reducer&& r, Func&& func) -> typename reducer_traits<Reducer>::future_type
     {
         return ::seastar::map_reduce(boost::make_counting_iterator<unsigned>(0),
                             boost::make_counting_iterator<unsigned>(_instances.size()),
-            [this, &func] (unsigned c) mutable {
-                return smp::submit_to(c, [this, func] () mutable {
+            [this, options, &func] (unsigned c) mutable {
+                return smp::submit_to(c, options, [this, func] () mutable {
                     auto inst = get_local_service();
                     return func(*inst);
                 });
             }, std::forward<Reducer>(r));
     }
 
-    /// The const version of \ref map_reduce(Reducer&& r, Func&& func)
+    /// The const version of \ref map_reduce(smp_submit_to_options options, Reducer&& r, Func&& func)
     template <typename Reducer, typename Func>
     inline
-    auto map_reduce(Reducer&& r, Func&& func) const -> typename reducer_traits<Reducer>::future_type
+    auto map_reduce(smp_submit_to_options options, Reducer&& r, Func&& func) const -> typename reducer_traits<Reducer>::future_type
     {
         return ::seastar::map_reduce(boost::make_counting_iterator<unsigned>(0),
                             boost::make_counting_iterator<unsigned>(_instances.size()),
-            [this, &func] (unsigned c) {
-                return smp::submit_to(c, [this, func] () {
+            [this, options, &func] (unsigned c) {
+                return smp::submit_to(c, options, [this, func] () {
                     auto inst = get_local_service();
                     return func(*inst);
                 });
             }, std::forward<Reducer>(r));
     }
 
+    /// Invoke a callable on all instances of `Service` and reduce the results using
+    /// `Reducer`.
+    ///
+    /// \see map_reduce(Iterator begin, Iterator end, Mapper&& mapper, Reducer&& r)
+    template <typename Reducer, typename Func>
+    inline
+    auto map_reduce(Reducer&& r, Func&& func) -> typename reducer_traits<Reducer>::future_type
+    {
+        return map_reduce(smp_submit_to_options(), std::forward<Reducer>(r), std::forward<Func>(func));
+    }
+
+    /// The const version of \ref map_reduce(Reducer&& r, Func&& func)
+    template <typename Reducer, typename Func>
+    inline
+    auto map_reduce(Reducer&& r, Func&& func) const -> typename reducer_traits<Reducer>::future_type
+    {
+        return map_reduce(smp_submit_to_options(), std::forward<Reducer>(r), std::forward<Func>(func));
+    }
+
     /// Applies a map function to all shards, then reduces the output by calling a reducer function.
     ///
     /// \param map callable with the signature `Value (Service&)` or
@@ -395,6 +422,52 @@ class sharded {
                             std::move(reduce));
     }
 
+    /// Applies a map function to all shards, then reduces the output pairwise
+    /// along a tree of shards.
+    ///
+    /// Unlike \ref map_reduce0(), which gathers the result of every shard
+    /// on the calling shard and reduces them there one after the other, the
+    /// results are reduced on intermediate shards: the shards are split in
+    /// two halves, each half is reduced recursively on its first shard, and
+    /// the two partial results are reduced on the shard that started the
+    /// split. The calling shard performs only log2(smp::count) reductions,
+    /// which matters when there are many shards and reducing is expensive,
+    /// for example when merging histograms.
+    ///
+    /// \param map callable with the signature `Value (Service&)` or
+    ///               `future<Value> (Service&)`, where \c Value is
+    ///               convertible to \c Initial
+    /// \param initial initial value used as the first input to \c reduce.
+    /// \param reduce associative binary function taking two Initial values
+    ///               and returning an Initial; it is copied to, and invoked
+    ///               on, arbitrary shards
+    ///
+    /// Partial results are moved across shards, so \c Initial must not
+    /// hold on to shard-local state.
+    ///
+    /// \return  the same result as \ref map_reduce0(), up to the order in
+    ///          which the reductions are performed
+    template <typename Mapper, typename Initial, typename Reduce>
+    inline
+    future<Initial>
+    map_reduce0_tree(Mapper map, Initial initial, Reduce reduce) {
+        return tree_map_reduce0<Initial>(this, 0, _instances.size(), std::move(map), reduce).then(
+                [initial = std::move(initial), reduce] (Initial result) mutable {
+            return reduce(std::move(initial), std::move(result));
+        });
+    }
+
+    /// The const version of \ref map_reduce0_tree(Mapper map, Initial initial, Reduce reduce)
+    template <typename Mapper, typename Initial, typename Reduce>
+    inline
+    future<Initial>
+    map_reduce0_tree(Mapper map, Initial initial, Reduce reduce) const {
+        return tree_map_reduce0<Initial>(this, 0, _instances.size(), std::move(map), reduce).then(
+                [initial = std::move(initial), reduce] (Initial result) mutable {
+            return reduce(std::move(initial), std::move(result));
+        });
+    }
+
     /// Applies a map function to all shards, and return a vector of the result.
     ///
     /// \param mapper callable with the signature `Value (Service&)` or
@@ -504,6 +577,28 @@ class sharded {
         }
         return inst;
     }
+
+    // Maps and reduces the shards [lo, hi), relative to the calling shard so
+    // that it is the root of the tree, and reduces on shard lo.
+    template <typename Initial, typename Self, typename Mapper, typename Reduce>
+    static future<Initial> tree_map_reduce0(Self* self, unsigned lo, unsigned hi, Mapper map, Reduce reduce) {
+        if (hi - lo == 1) {
+            return futurize_invoke([self, &map] {
+                return map(*self->get_local_service());
+            }).then([] (auto value) {
+                return Initial(std::move(value));
+            });
+        }
+        auto mid = lo + (hi - lo + 1) / 2;
+        auto shard = (this_shard_id() + mid - lo) % self->_instances.size();
+        auto right = smp::submit_to(shard, [self, mid, hi, map, reduce] {
+            return tree_map_reduce0<Initial>(self, mid, hi, map, reduce);
+        });
+        auto left = tree_map_reduce0<Initial>(self, lo, mid, std::move(map), reduce);
+        return when_all_succeed(std::move(left), std::move(right)).then_unpack([reduce] (Initial l, Initial r) mutable {
+            return reduce(std::move(l), std::move(r));
+        });
+    }
 };
 
 namespace internal {
@@ -781,8 +876,14 @@ sharded<Service>::invoke_on_others(smp_submit_to_options options, Func func, Arg
     static_assert(std::is_same_v<futurize_t<std::invoke_result_t<Func, Service&, Args...>>, future<>>,
                   "invoke_on_others()'s func must return void or future<>");
   try {
-    return invoke_on_all(options, [orig = this_shard_id(), func = std::move(func), args = std::tuple(std::move(args)...)] (Service& s) -> future<> {
-        return this_shard_id() == orig ? make_ready_future<>() : futurize_apply(func, std::tuple_cat(std::forward_as_tuple(s), args));;
+    // Skips the local shard rather than sending it a call that does nothing
+    return sharded_parallel_for_each([this, options, orig = this_shard_id(), func = std::move(func), args = std::tuple(std::move(args)...)] (unsigned c) {
+        if (c == orig) {
+            return make_ready_future<>();
+        }
+        return smp::submit_to(c, options, [this, func, args] {
+            return futurize_apply(func, std::tuple_cat(std::forward_as_tuple(*get_local_service()), args));
+        });
     });
   } catch (...) {
     return current_exception_as_future();
@@ -45,16 +45,17 @@ namespace seastar {
 /// \ref with_lock(shared_mutex&, Func&&) provide exception-safe
 /// wrappers for use with \c shared_mutex.
 ///
+/// Readers that queue up while a writer holds the lock are all let in
+/// together when it unlocks, including those that came after other
+/// writers. Readers don't get in ahead of queued writers otherwise, so a
+/// writer waits for at most one such batch of readers.
+///
 /// \see semaphore simpler mutual exclusion
 class shared_mutex {
     unsigned _readers = 0;
     bool _writer = false;
-    struct waiter {
-        waiter(promise<>&& pr, bool for_write) : pr(std::move(pr)), for_write(for_write) {}
-        promise<> pr;
-        bool for_write;
-    };
-    chunked_fifo<waiter> _waiters;
+    chunked_fifo<promise<>> _read_waiters;
+    chunked_fifo<promise<>> _write_waiters;
 public:
     shared_mutex() = default;
     shared_mutex(shared_mutex&&) = default;
@@ -70,8 +71,8 @@ class shared_mutex {
             return make_ready_future<>();
         }
         try {
-            _waiters.emplace_back(promise<>(), false);
-            return _waiters.back().pr.get_future();
+            _read_waiters.emplace_back();
+            return _read_waiters.back().get_future();
         } catch (...) {
             return current_exception_as_future();
         }
@@ -80,7 +81,7 @@ class shared_mutex {
     ///
     /// \return true iff could acquire the lock for shared access.
     bool try_lock_shared() noexcept {
-        if (!_writer && _waiters.empty()) {
+        if (!_writer && _write_waiters.empty()) {
             ++_readers;
             return true;
         }
@@ -89,8 +90,9 @@ class shared_mutex {
     /// Unlocks a \c shared_mutex after a previous call to \ref lock_shared().
     void unlock_shared() noexcept {
         assert(_readers > 0);
-        --_readers;
-        wake();
+        if (!--_readers) {
+            wake_writer();
+        }
     }
     /// Lock the \c shared_mutex for exclusive access
     ///
@@ -101,8 +103,8 @@ class shared_mutex {
             return make_ready_future<>();
         }
         try {
-            _waiters.emplace_back(promise<>(), true);
-            return _waiters.back().pr.get_future();
+            _write_waiters.emplace_back();
+            return _write_waiters.back().get_future();
         } catch (...) {
             return current_exception_as_future();
         }
@@ -121,25 +123,22 @@ class shared_mutex {
     void unlock() noexcept {
         assert(_writer);
         _writer = false;
-        wake();
+        if (_read_waiters.empty()) {
+            wake_writer();
+            return;
+        }
+        while (!_read_waiters.empty()) {
+            ++_readers;
+            _read_waiters.front().set_value();
+            _read_waiters.pop_front();
+        }
     }
 private:
-    void wake() noexcept {
-        while (!_waiters.empty()) {
-            auto& w = _waiters.front();
-            // note: _writer == false in wake()
-            if (w.for_write) {
-                if (!_readers) {
-                    _writer = true;
-                    w.pr.set_value();
-                    _waiters.pop_front();
-                }
-                break;
-            } else { // for read
-                ++_readers;
-                w.pr.set_value();
-                _waiters.pop_front();
-            }
+    void wake_writer() noexcept {
+        if (!_write_waiters.empty()) {
+            _writer = true;
+            _write_waiters.front().set_value();
+            _write_waiters.pop_front();
         }
     }
 };
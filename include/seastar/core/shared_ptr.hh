@@ -51,6 +51,9 @@ namespace seastar {
 // Both variants support shared_from_this() via enable_shared_from_this<>
 // and lw_enable_shared_from_this<>().
 //
+// Both can lend the object as a borrowed_ptr<>, which doesn't touch the
+// reference count.
+//
 
 #ifndef SEASTAR_DEBUG_SHARED_PTR
 using shared_ptr_counter_type = long;
@@ -70,6 +73,9 @@ class enable_lw_shared_from_this;
 template <typename T>
 class enable_shared_from_this;
 
+template <typename T>
+class borrowed_ptr;
+
 template <typename T, typename... A>
 lw_shared_ptr<T> make_lw_shared(A&&... a);
 
@@ -96,6 +102,75 @@ shared_ptr<T> const_pointer_cast(const shared_ptr<U>& p);
 
 struct lw_shared_ptr_counter_base {
     shared_ptr_counter_type _count = 0;
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+    long _borrows = 0;
+#endif
+};
+
+/// A handle to an object of a lw_shared_ptr<> or a shared_ptr<> that
+/// doesn't own it, from their borrow().
+///
+/// Copying a shared pointer writes the reference count in the shared
+/// object, so passing a shared object to continuations of many requests
+/// keeps bouncing its cache line. Copying or dropping a borrowed_ptr<>
+/// writes nothing; in exchange, the lender must keep an owning pointer
+/// until all borrowers are done. A gate the borrowers run under shows
+/// when that is:
+///
+///     (void)with_gate(g, [routes = _routes.borrow()] { return lookup(*routes); });
+///     ...
+///     return g.close().finally([routes = std::move(_routes)] {});
+///
+/// With SEASTAR_DEBUG_SHARED_PTR, borrowed_ptr<>s are counted, and the
+/// last owner going away while some are left aborts.
+template <typename T>
+class borrowed_ptr {
+    T* _p = nullptr;
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+    long* _borrows = nullptr;
+
+    borrowed_ptr(T* p, long* borrows) noexcept : _p(p), _borrows(borrows) {
+        if (_borrows) {
+            ++*_borrows;
+        }
+    }
+public:
+    borrowed_ptr() noexcept = default;
+    borrowed_ptr(const borrowed_ptr& x) noexcept : borrowed_ptr(x._p, x._borrows) {}
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    borrowed_ptr(const borrowed_ptr<U>& x) noexcept : borrowed_ptr(x._p, x._borrows) {}
+    ~borrowed_ptr() {
+        if (_borrows) {
+            --*_borrows;
+        }
+    }
+    borrowed_ptr& operator=(const borrowed_ptr& x) noexcept {
+        if (this != &x) {
+            this->~borrowed_ptr();
+            new (this) borrowed_ptr(x);
+        }
+        return *this;
+    }
+#else
+    explicit borrowed_ptr(T* p) noexcept : _p(p) {}
+public:
+    borrowed_ptr() noexcept = default;
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    borrowed_ptr(const borrowed_ptr<U>& x) noexcept : _p(x._p) {}
+#endif
+    using element_type = T;
+
+    T& operator*() const noexcept { return *_p; }
+    T* operator->() const noexcept { return _p; }
+    T* get() const noexcept { return _p; }
+    explicit operator bool() const noexcept { return _p; }
+
+    template <typename U>
+    friend class borrowed_ptr;
+    template <typename U>
+    friend class lw_shared_ptr;
+    template <typename U>
+    friend class shared_ptr;
 };
 
 
@@ -298,6 +373,9 @@ class lw_shared_ptr {
     [[gnu::always_inline]]
     ~lw_shared_ptr() {
         if (_p && !--_p->_count) {
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+            assert(!_p->_borrows && "object destroyed while borrowed");
+#endif
             accessors::dispose(_p);
         }
     }
@@ -347,10 +425,23 @@ class lw_shared_ptr {
         if (--p->_count) {
             return nullptr;
         } else {
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+            assert(!p->_borrows && "object released while borrowed");
+#endif
             return std::unique_ptr<T, disposer>(accessors::to_value(p));
         }
     }
 
+    // Lends the object without touching the reference count, see
+    // borrowed_ptr<>. Some owner must outlive the returned pointer.
+    borrowed_ptr<T> borrow() const noexcept {
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+        return borrowed_ptr<T>(get(), _p ? &_p->_borrows : nullptr);
+#else
+        return borrowed_ptr<T>(get());
+#endif
+    }
+
     long int use_count() const noexcept {
         if (_p) {
             return _p->_count;
@@ -458,6 +549,9 @@ struct shared_ptr_count_base {
     // destructor is responsible for fully-typed deletion
     virtual ~shared_ptr_count_base() {}
     shared_ptr_counter_type count = 0;
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+    long borrows = 0;
+#endif
 };
 
 template <typename T>
@@ -534,6 +628,9 @@ class shared_ptr {
     }
     ~shared_ptr() {
         if (_b && !--_b->count) {
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+            assert(!_b->borrows && "object destroyed while borrowed");
+#endif
             delete _b;
         }
     }
@@ -582,6 +679,15 @@ class shared_ptr {
     T* get() const noexcept {
         return _p;
     }
+    // Lends the object without touching the reference count, see
+    // borrowed_ptr<>. Some owner must outlive the returned pointer.
+    borrowed_ptr<T> borrow() const noexcept {
+#ifdef SEASTAR_DEBUG_SHARED_PTR
+        return borrowed_ptr<T>(_p, _b ? &_b->borrows : nullptr);
+#else
+        return borrowed_ptr<T>(_p);
+#endif
+    }
     long use_count() const noexcept {
         if (_b) {
             return _b->count;
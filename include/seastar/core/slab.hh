@@ -126,68 +126,151 @@ struct slab_page_desc {
 
 class slab_item_base {
     boost::intrusive::list_member_hook<> _lru_link;
+    // The allocator's access clock when the item was last accessed
+    uint32_t _last_access = 0;
+    // Whether the item is in the protected segment of the LRU
+    bool _protected = false;
 
     template<typename Item>
     friend class slab_class;
+    template<typename Item>
+    friend class slab_allocator;
 };
 
+/*
+ * The LRU of a slab class is segmented: new items enter the probation
+ * segment, and move to the protected one when accessed again. Items are
+ * evicted from the tail of probation first, so a scan over many items
+ * that are used once doesn't push the ones used repeatedly out. The
+ * protected segment holds at most protected_ratio of the items of the
+ * class, the least recently used of them go back to probation. With a
+ * ratio of zero, the LRU is a plain one.
+ */
 template<typename Item>
 class slab_class {
 private:
+    using lru_list = boost::intrusive::list<slab_item_base,
+        boost::intrusive::member_hook<slab_item_base, boost::intrusive::list_member_hook<>,
+        &slab_item_base::_lru_link>>;
+
     boost::intrusive::list<slab_page_desc,
         boost::intrusive::member_hook<slab_page_desc, boost::intrusive::list_member_hook<>,
         &slab_page_desc::_free_pages_link>> _free_slab_pages;
-    boost::intrusive::list<slab_item_base,
-        boost::intrusive::member_hook<slab_item_base, boost::intrusive::list_member_hook<>,
-        &slab_item_base::_lru_link>> _lru;
+    lru_list _probation;
+    lru_list _protected;
     size_t _size; // size of objects
     uint8_t _slab_class_id;
+    float _protected_ratio;
+    size_t _pages = 0;
+    // evictions since the class last tried to take a page from another one
+    size_t _evictions_since_rebalance = 0;
 private:
+    lru_list& lru_of(slab_item_base& item) {
+        return item._protected ? _protected : _probation;
+    }
+
     template<typename... Args>
     inline
     Item* create_item(void *object, uint32_t slab_page_index, Args&&... args) {
         Item *new_item = new(object) Item(slab_page_index, std::forward<Args>(args)...);
-        _lru.push_front(reinterpret_cast<slab_item_base&>(*new_item));
+        _probation.push_front(reinterpret_cast<slab_item_base&>(*new_item));
         return new_item;
     }
 
+    slab_item_base* lru_victim() {
+        if (!_probation.empty()) {
+            return &_probation.back();
+        }
+        if (!_protected.empty()) {
+            return &_protected.back();
+        }
+        return nullptr;
+    }
+
     inline
     std::pair<void *, uint32_t> evict_lru_item(std::function<void (Item& item_ref)>& erase_func) {
-        if (_lru.empty()) {
+        auto victim_base = lru_victim();
+        if (!victim_base) {
             return { nullptr, 0U };
         }
 
-        Item& victim = reinterpret_cast<Item&>(_lru.back());
+        Item& victim = reinterpret_cast<Item&>(*victim_base);
         uint32_t index = victim.get_slab_page_index();
         assert(victim.is_unlocked());
-        _lru.erase(_lru.iterator_to(reinterpret_cast<slab_item_base&>(victim)));
+        remove_item_from_lru(&victim);
         // WARNING: You need to make sure that erase_func will not release victim back to slab.
         erase_func(victim);
+        _evictions_since_rebalance++;
 
         return { reinterpret_cast<void*>(&victim), index };
     }
+
+    void shrink_protected() {
+        auto limit = size_t(_protected_ratio * (_probation.size() + _protected.size()));
+        while (_protected.size() > limit) {
+            auto& item = _protected.back();
+            _protected.pop_back();
+            item._protected = false;
+            _probation.push_front(item);
+        }
+    }
 public:
-    slab_class(size_t size, uint8_t slab_class_id)
+    slab_class(size_t size, uint8_t slab_class_id, float protected_ratio = 0)
         : _size(size)
         , _slab_class_id(slab_class_id)
+        , _protected_ratio(protected_ratio)
     {
     }
     slab_class(slab_class&&) = default;
     ~slab_class() {
         _free_slab_pages.clear();
-        _lru.clear();
+        _probation.clear();
+        _protected.clear();
     }
 
     size_t size() const {
         return _size;
     }
 
+
     bool empty() const {
         return _free_slab_pages.empty();
     }
 
     bool has_no_slab_pages() const {
-        return _lru.empty();
+        return _probation.empty() && _protected.empty();
+    }
+
+    size_t pages() const {
+        return _pages;
+    }
+
+    size_t protected_items() const {
+        return _protected.size();
+    }
+
+    void set_protected_ratio(float ratio) {
+        _protected_ratio = ratio;
+        shrink_protected();
+    }
+
+    /**
+     * The item that is evicted next, if any.
+     */
+    Item* coldest_item() {
+        return reinterpret_cast<Item*>(lru_victim());
+    }
+
+    /**
+     * Whether the class evicted at least \c evictions items since it last
+     * returned true.
+     */
+    bool evicted_since_rebalance(size_t evictions) {
+        if (_evictions_since_rebalance < evictions) {
+            return false;
+        }
+        _evictions_since_rebalance = 0;
+        return true;
     }
 
     template<typename... Args>
@@ -213,19 +296,32 @@ class slab_class {
         if (!slab_page) {
             throw std::bad_alloc{};
         }
-        // allocate descriptor to slab page.
-        slab_page_desc *desc = nullptr;
-        assert(_size % alignment == 0);
         try {
-            auto objects = max_object_size / _size;
-            desc = new slab_page_desc(slab_page, objects, _size, _slab_class_id, slab_page_index);
+            return create_from_page(slab_page, max_object_size, slab_page_index, std::move(insert_slab_page_desc), std::forward<Args>(args)...);
         } catch (const std::bad_alloc& e) {
             ::free(slab_page);
-            throw std::bad_alloc{};
+            throw;
         }
+    }
+
+    /**
+     * Like create_from_new_page(), but with a slab page that is allocated
+     * already, and that the caller frees if this throws.
+     */
+    template<typename... Args>
+    Item *create_from_page(void* slab_page, uint64_t max_object_size, uint32_t slab_page_index,
+                           std::function<void (slab_page_desc& desc)> insert_slab_page_desc,
+                           Args&&... args) {
+        assert(_size % std::alignment_of<Item>::value == 0);
+        // allocate descriptor to slab page.
+        auto objects = max_object_size / _size;
+        auto desc = new slab_page_desc(slab_page, objects, _size, _slab_class_id, slab_page_index);
 
-        _free_slab_pages.push_front(*desc);
+        if (!desc->empty()) {
+            _free_slab_pages.push_front(*desc);
+        }
         insert_slab_page_desc(*desc);
+        _pages++;
 
         // first object from the allocated slab page is returned.
         return create_item(slab_page, slab_page_index, std::forward<Args>(args)...);
@@ -242,7 +338,7 @@ class slab_class {
 
     void free_item(Item *item, slab_page_desc& desc) {
         void *object = item;
-        _lru.erase(_lru.iterator_to(reinterpret_cast<slab_item_base&>(*item)));
+        remove_item_from_lru(item);
         desc.free_object(object);
         if (desc.size() == 1) {
             // push back desc into the list of slab pages with free objects.
@@ -251,25 +347,38 @@ class slab_class {
     }
 
     void touch_item(Item *item) {
-        auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
-        _lru.erase(_lru.iterator_to(item_ref));
-        _lru.push_front(item_ref);
+        remove_item_from_lru(item);
+        insert_item_into_lru(item);
     }
 
     void remove_item_from_lru(Item *item) {
         auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
-        _lru.erase(_lru.iterator_to(item_ref));
+        auto& lru = lru_of(item_ref);
+        lru.erase(lru.iterator_to(item_ref));
     }
 
+    /**
+     * Inserts an accessed item, that is not in the LRU, at the head of the
+     * protected segment.
+     */
     void insert_item_into_lru(Item *item) {
         auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
-        _lru.push_front(item_ref);
+        item_ref._protected = true;
+        _protected.push_front(item_ref);
+        shrink_protected();
     }
 
     void remove_desc_from_free_list(slab_page_desc& desc) {
         assert(desc.slab_class_id() == _slab_class_id);
         _free_slab_pages.erase(_free_slab_pages.iterator_to(desc));
     }
+
+    void remove_page(slab_page_desc& desc) {
+        if (!desc.empty()) {
+            remove_desc_from_free_list(desc);
+        }
+        _pages--;
+    }
 };
 
 template<typename Item>
@@ -289,33 +398,41 @@ class slab_allocator {
     struct collectd_stats {
         uint64_t allocs;
         uint64_t frees;
-    } _stats;
+        uint64_t evictions;
+        uint64_t page_reassignments;
+    } _stats = {};
     memory::reclaimer *_reclaimer = nullptr;
     bool _reclaimed = false;
+    bool _page_reassignment = false;
+    // Incremented on every access, to tell how cold items are
+    uint32_t _access_clock = 0;
 private:
-    memory::reclaiming_result evict_lru_slab_page() {
-        if (_slab_page_desc_lru.empty()) {
-            // NOTE: Nothing to evict. If this happens, it implies that all
-            // slab pages in the slab are being used at the same time.
-            // That being said, this event is very unlikely to happen.
-            return memory::reclaiming_result::reclaimed_nothing;
-        }
-        // get descriptor of the least-recently-used slab page and related info.
-        auto& desc = _slab_page_desc_lru.back();
+    void accessed(Item* item) {
+        reinterpret_cast<slab_item_base*>(item)->_last_access = ++_access_clock;
+    }
+
+    // How long ago an item was accessed, in accesses
+    uint32_t age(Item* item) const {
+        return _access_clock - reinterpret_cast<slab_item_base*>(item)->_last_access;
+    }
+
+    /*
+     * Evicts the items of a slab page and frees its descriptor. Returns
+     * the slab page, that the caller frees or reuses.
+     */
+    void* evict_slab_page(slab_page_desc& desc) {
         assert(desc.refcnt() == 0);
         uint8_t slab_class_id = desc.slab_class_id();
         auto slab_class = get_slab_class(slab_class_id);
         void *slab_page = desc.slab_page();
 
         auto& free_objects = desc.free_objects();
+        // remove desc from the list of slab pages with free objects.
+        slab_class->remove_page(desc);
         if (!desc.empty()) {
-            // if not empty, remove desc from the list of slab pages with free objects.
-            slab_class->remove_desc_from_free_list(desc);
             // and sort the array of free objects for binary search later on.
             std::sort(free_objects.begin(), free_objects.end());
         }
-        // remove desc from the list of slab page descriptors.
-        _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
         // remove desc from the slab page vector.
         _slab_pages_vector[desc.index()] = nullptr;
 
@@ -341,11 +458,73 @@ class slab_allocator {
 #ifdef SEASTAR_DEBUG
         printf("lru slab page eviction succeeded! desc_empty?=%d\n", desc.empty());
 #endif
-        ::free(slab_page); // free slab page object
         delete &desc; // free its descriptor
+        return slab_page;
+    }
+
+    memory::reclaiming_result evict_lru_slab_page() {
+        if (_slab_page_desc_lru.empty()) {
+            // NOTE: Nothing to evict. If this happens, it implies that all
+            // slab pages in the slab are being used at the same time.
+            // That being said, this event is very unlikely to happen.
+            return memory::reclaiming_result::reclaimed_nothing;
+        }
+        // get descriptor of the least-recently-used slab page.
+        auto& desc = _slab_page_desc_lru.back();
+        // remove desc from the list of slab page descriptors.
+        _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
+        ::free(evict_slab_page(desc)); // free slab page object
         return memory::reclaiming_result::reclaimed_something;
     }
 
+    /*
+     * Moves a slab page from another slab class to sc, when sc has to evict
+     * items that were accessed more recently than the coldest item of the
+     * other class. The page of that coldest item is the one moved, its
+     * items are evicted. Classes keep at least one page.
+     */
+    template<typename... Args>
+    Item* create_from_reassigned_page(slab_class<Item>& sc, Args&&... args) {
+        auto victim = sc.coldest_item();
+        if (!victim) {
+            return nullptr;
+        }
+        uint32_t victim_age = age(victim);
+        Item* coldest = nullptr;
+        for (auto& donor : _slab_classes) {
+            if (&donor == &sc || donor.pages() < 2) {
+                continue;
+            }
+            auto item = donor.coldest_item();
+            if (item && age(item) > victim_age && (!coldest || age(item) > age(coldest))) {
+                coldest = item;
+            }
+        }
+        if (!coldest) {
+            return nullptr;
+        }
+        auto& desc = get_slab_page_desc(coldest);
+        if (desc.refcnt() != 0) {
+            // some item of the page is in use
+            return nullptr;
+        }
+
+        auto index = desc.index();
+        void* slab_page = evict_slab_page(desc);
+        _stats.page_reassignments++;
+        try {
+            return sc.create_from_page(slab_page, _max_object_size, index,
+                [this, index] (slab_page_desc& desc) {
+                    _slab_pages_vector[index] = &desc;
+                },
+                std::forward<Args>(args)...);
+        } catch (...) {
+            ::free(slab_page);
+            _available_slab_pages++;
+            throw;
+        }
+    }
+
     /*
      * Reclaim the least recently used slab page that is unused.
      */
@@ -404,7 +583,16 @@ class slab_allocator {
             sm::make_derive("free_total_operations", sm::description("Total number of slab free operations"), _stats.frees),
             sm::make_gauge("malloc_objects", sm::description("Number of slab created objects currently in memory"), [this] {
                 return _stats.allocs - _stats.frees;
-            })
+            }),
+            sm::make_derive("evictions", sm::description("Total number of objects evicted from the LRU of their slab class to make room for others"), _stats.evictions),
+            sm::make_derive("page_reassignments", sm::description("Total number of slab pages moved from one slab class to another"), _stats.page_reassignments),
+            sm::make_gauge("protected_objects", sm::description("Number of objects in the protected segments of the LRUs"), [this] {
+                size_t n = 0;
+                for (auto& sc : _slab_classes) {
+                    n += sc.protected_items();
+                }
+                return n;
+            }),
         });
     }
 
@@ -485,21 +673,81 @@ class slab_allocator {
                 }
                 _stats.allocs++;
             } else if (_erase_func) {
-                item = slab_class->create_from_lru(_erase_func, std::forward<Args>(args)...);
+                // Looked for once the class evicted a page worth of items, so
+                // that the search for a colder class costs little per allocation
+                if (_page_reassignment && !_reclaimer
+                        && slab_class->evicted_since_rebalance(_max_object_size / slab_class->size())) {
+                    // Constructs the item only if it returns one
+                    item = create_from_reassigned_page(*slab_class, std::forward<Args>(args)...);
+                }
+                if (item) {
+                    _stats.allocs++;
+                } else {
+                    item = slab_class->create_from_lru(_erase_func, std::forward<Args>(args)...);
+                    _stats.evictions++;
+                }
             }
         }
+        if (item) {
+            accessed(item);
+        }
         return item;
     }
 
+    /**
+     * Sets the largest fraction of the items of each slab class that can be
+     * in the protected segment of its LRU, 0 (the default) for plain LRUs.
+     */
+    void set_protected_ratio(float ratio) {
+        assert(ratio >= 0 && ratio < 1);
+        for (auto& sc : _slab_classes) {
+            sc.set_protected_ratio(ratio);
+        }
+    }
+
+    /**
+     * With a limit on the slab's memory, lets a slab class that has to evict
+     * items take a page from another one whose coldest item is colder.
+     * Without it, classes keep the pages they got first.
+     */
+    void enable_page_reassignment(bool enable) {
+        _page_reassignment = enable;
+    }
+
+    /**
+     * The number of slab pages that can still be allocated under the limit
+     */
+    uint64_t available_pages() const {
+        return _available_slab_pages;
+    }
+
+    /**
+     * Lowers the limit by up to \c pages slab pages that were not allocated
+     * yet, for another allocator to use them. Returns by how many.
+     */
+    uint64_t lend_pages(uint64_t pages) {
+        pages = std::min(pages, _available_slab_pages);
+        _available_slab_pages -= pages;
+        return pages;
+    }
+
+    /**
+     * Raises the limit by \c pages slab pages, lent by another allocator.
+     */
+    void borrow_pages(uint64_t pages) {
+        _available_slab_pages += pages;
+    }
+
+    uint64_t evictions() const {
+        return _stats.evictions;
+    }
+
     void lock_item(Item *item) {
         auto& desc = get_slab_page_desc(item);
-        if (_reclaimer) {
-            auto& refcnt = desc.refcnt();
-
-            if (++refcnt == 1) {
-                // remove slab page descriptor from list of slab page descriptors.
-                _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
-            }
+        auto& refcnt = desc.refcnt();
+        if (++refcnt == 1 && _reclaimer) {
+            // remove slab page descriptor from list of slab page descriptors.
+            _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
         }
         // remove item from the lru of its slab class.
         auto slab_class = get_slab_class(desc.slab_class_id());
@@ -508,17 +756,15 @@ class slab_allocator {
 
     void unlock_item(Item *item) {
         auto& desc = get_slab_page_desc(item);
-        if (_reclaimer) {
-            auto& refcnt = desc.refcnt();
-
-            if (--refcnt == 0) {
-                // insert slab page descriptor back into list of slab page descriptors.
-                _slab_page_desc_lru.push_front(desc);
-            }
+        auto& refcnt = desc.refcnt();
+        if (--refcnt == 0 && _reclaimer) {
+            // insert slab page descriptor back into list of slab page descriptors.
+            _slab_page_desc_lru.push_front(desc);
         }
-        // insert item into the lru of its slab class.
+        // insert item into the lru of its slab class, as accessed.
         auto slab_class = get_slab_class(desc.slab_class_id());
         slab_class->insert_item_into_lru(item);
+        accessed(item);
     }
 
     /**
@@ -541,6 +787,7 @@ class slab_allocator {
             auto& desc = get_slab_page_desc(item);
             auto slab_class = get_slab_class(desc.slab_class_id());
             slab_class->touch_item(item);
+            accessed(item);
         }
     }
 
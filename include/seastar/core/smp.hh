@@ -28,9 +28,13 @@
 #include <seastar/core/posix.hh>
 #include <seastar/core/reactor_config.hh>
 #include <seastar/core/resource.hh>
+#include <seastar/core/metrics_types.hh>
+#include <seastar/core/task_local.hh>
 #include <boost/lockfree/spsc_queue.hpp>
 #include <boost/thread/barrier.hpp>
 #include <boost/range/irange.hpp>
+#include <array>
+#include <chrono>
 #include <deque>
 #include <thread>
 
@@ -154,6 +158,13 @@ struct smp_submit_to_options {
     /// processed by the remote shard, and *not* to the time it takes to be
     /// executed there.
     smp_timeout_clock::time_point timeout = smp_no_timeout;
+    /// Requests to a shard are batched, and pushed to it when a batch is
+    /// full or the queues are next polled. With \c push_now the request
+    /// is pushed as soon as it is submitted, with the ones batched before
+    /// it. This is for fanning a call out to many shards, each getting one
+    /// request, which should start as early as possible; it defeats the
+    /// batching of many requests to the same shard.
+    bool push_now = false;
 
     smp_submit_to_options(smp_service_group service_group = default_smp_service_group(), smp_timeout_clock::time_point timeout = smp_no_timeout) noexcept
         : service_group(service_group)
@@ -168,6 +179,11 @@ smp_service_group_semaphore& get_smp_service_groups_semaphore(unsigned ssg_id, s
 class smp_message_queue {
     static constexpr size_t queue_length = 128;
     static constexpr size_t batch_size = 16;
+    // Crossing sockets costs more per transfer, so queues between shards on
+    // different NUMA nodes collect bigger batches before they are pushed
+    static constexpr size_t remote_node_batch_size = 64;
+    // Round trip latency buckets, for powers of two microseconds up to 2^(n-1)
+    static constexpr size_t latency_buckets = 16;
     static constexpr size_t prefetch_cnt = 2;
     struct work_item;
     struct lf_queue_remote {
@@ -183,12 +199,18 @@ class smp_message_queue {
     };
     lf_queue _pending;
     lf_queue _completed;
+    const size_t _batch_size;
+    const bool _remote_node;
     struct alignas(seastar::cache_line_size) {
         size_t _sent = 0;
         size_t _compl = 0;
         size_t _last_snt_batch = 0;
         size_t _last_cmpl_batch = 0;
         size_t _current_queue_length = 0;
+        std::array<uint64_t, latency_buckets> _latency_hist = {};
+        // Samples above the last bucket
+        uint64_t _latency_overflow = 0;
+        uint64_t _latency_sum_ns = 0;
     };
     // keep this between two structures with statistics
     // this makes sure that they have at least one cache line
@@ -200,8 +222,15 @@ class smp_message_queue {
         size_t _last_rcv_batch = 0;
     };
     struct work_item : public task {
-        explicit work_item(smp_service_group ssg) : task(current_scheduling_group()), ssg(ssg) {}
+        explicit work_item(smp_service_group ssg) : task(current_scheduling_group()), ssg(ssg) {
+            // The handle is of this shard, the values that cross shards
+            // are set on the other one instead
+            clear_task_local_handle();
+            task_locals = internal::cross_shard_task_local_values();
+        }
         smp_service_group ssg;
+        internal::task_local_values task_locals;
+        std::chrono::steady_clock::time_point submitted;
         virtual ~work_item() {}
         virtual void fail_with(std::exception_ptr) = 0;
         void process();
@@ -226,9 +255,10 @@ class smp_message_queue {
             return nullptr;
         }
         virtual void run_and_dispose() noexcept override {
+            task_local_scope scope(std::move(this->task_locals));
             // _queue.respond() below forwards the continuation chain back to the
             // calling shard.
-            (void)futurator::invoke(this->_func).then_wrapped([this] (auto f) {
+            (void)futurator::invoke(this->_func).then_wrapped([this, scope = std::move(scope)] (auto f) {
                 if (f.failed()) {
                     _ex = f.get_exception();
                 } else {
@@ -266,7 +296,7 @@ class smp_message_queue {
         memory::scoped_critical_alloc_section _;
         auto wi = std::make_unique<async_work_item<Func>>(*this, options.service_group, std::forward<Func>(func));
         auto fut = wi->get_future();
-        submit_item(t, options.timeout, std::move(wi));
+        submit_item(t, options.timeout, options.push_now, std::move(wi));
         return fut;
     }
     void start(unsigned cpuid);
@@ -277,7 +307,7 @@ class smp_message_queue {
     void stop();
 private:
     void work();
-    void submit_item(shard_id t, smp_timeout_clock::time_point timeout, std::unique_ptr<work_item> wi);
+    void submit_item(shard_id t, smp_timeout_clock::time_point timeout, bool push_now, std::unique_ptr<work_item> wi);
     void respond(work_item* wi);
     void move_pending();
     void flush_request_batch();
@@ -285,6 +315,7 @@ class smp_message_queue {
     bool has_unflushed_responses() const;
     bool pure_poll_rx() const;
     bool pure_poll_tx() const;
+    metrics::histogram latency_histogram() const;
 
     friend class smp;
 };
@@ -303,6 +334,14 @@ class smp : public std::enable_shared_from_this<smp> {
     };
     std::unique_ptr<smp_message_queue*[], qs_deleter> _qs_owner;
     static thread_local smp_message_queue**_qs;
+    static std::vector<unsigned> _numa_nodes;
+    // The shard running on each cpu, by cpu id, or -1
+    static std::vector<int> _cpu_shards;
+    // By shard, see sibling_cpus() and cache_group()
+    static std::vector<resource::cpuset> _sibling_cpus;
+    static std::vector<unsigned> _cache_groups;
+    static bool poll_active_queues();
+    static bool pure_poll_active_queues();
     static thread_local std::thread::id _tmain;
     bool _using_dpdk = false;
 
@@ -377,6 +416,55 @@ class smp : public std::enable_shared_from_this<smp> {
     }
     static bool poll_queues();
     static bool pure_poll_queues();
+    /// Returns the NUMA node of the cpu a shard runs on
+    ///
+    /// Without hwloc support, all shards are reported on node 0.
+    static unsigned numa_node(shard_id shard) noexcept {
+        return _numa_nodes[shard];
+    }
+    /// Returns the shard that was assigned a cpu, if any
+    ///
+    /// Shards only stay on their cpu when thread affinity is on.
+    static std::optional<shard_id> shard_of_cpu(unsigned cpu) noexcept {
+        if (cpu < _cpu_shards.size() && _cpu_shards[cpu] >= 0) {
+            return shard_id(_cpu_shards[cpu]);
+        }
+        return std::nullopt;
+    }
+    /// Returns the cpus that share a core with the shard's cpu and run no shard
+    ///
+    /// With \c --one-shard-per-core these are the shard's SMT siblings. The
+    /// shard's syscall threads run there, and so can other threads working
+    /// for the shard, like alien threads. Empty without thread affinity or
+    /// hwloc support.
+    static const resource::cpuset& sibling_cpus(shard_id shard) noexcept;
+    /// Returns the last level cache the shard's cpu uses
+    ///
+    /// That is the L3, of which chiplet cpus have one per core complex.
+    /// Shards in the same cache group exchange data more cheaply than
+    /// others, so they are the ones to prefer for submit_to() when there is
+    /// a choice. Without hwloc support, all shards are in group 0.
+    static unsigned cache_group(shard_id shard) noexcept {
+        return _cache_groups[shard];
+    }
+    /// Returns the shards in the cache group of \c shard, including it
+    static std::vector<shard_id> shards_sharing_cache(shard_id shard);
+    struct irq_affinity {
+        unsigned irq;
+        unsigned cpu;
+        shard_id shard;
+    };
+    /// Suggests a cpu for each interrupt of a network device
+    ///
+    /// The interrupts are spread over the cpus of the shards, alternating
+    /// between cache groups, so that each receive queue is served by a
+    /// different shard when there are enough of them. They can be applied
+    /// by writing the cpus to \c /proc/irq/<irq>/smp_affinity_list; with the
+    /// \c incoming_cpu load balancing algorithm, connections then stay on
+    /// the shard whose queue received them. Nothing is changed by this
+    /// function. Returns nothing when the interrupts of \c interface can't
+    /// be found.
+    static std::vector<irq_affinity> advise_irq_affinity(std::string_view interface);
     static boost::integer_range<unsigned> all_cpus() noexcept {
         return boost::irange(0u, count);
     }
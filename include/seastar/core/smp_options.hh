@@ -41,10 +41,36 @@ struct smp_options : public program_options::option_group {
     program_options::value<std::string> hugepages;
     /// Lock all memory (prevents swapping).
     program_options::value<bool> lock_memory;
+    /// \brief Fault in shard memory ahead of use.
+    ///
+    /// One of:
+    /// * \p none: memory is faulted in as it is first used;
+    /// * \p startup: shards fault in their memory, in parallel, before
+    ///   starting, so that the application doesn't take the faults later,
+    ///   nor the cost of \ref lock_memory;
+    /// * \p background: each shard's memory is faulted in, lowest
+    ///   addresses first, by a thread that only runs when the shard's cpu
+    ///   is idle, without delaying startup.
+    ///
+    /// Progress is reported by the \p memory_prefaulted_memory metric.
+    /// Requires Linux 5.14 or later. Memory from \ref hugepages is always
+    /// faulted in at startup.
+    ///
+    /// Default: \p none.
+    program_options::value<std::string> prefault_memory;
     /// Pin threads to their cpus (disable for overprovisioning).
     ///
     /// Default: \p true.
     program_options::value<bool> thread_affinity;
+    /// \brief Run at most one shard on each physical core.
+    ///
+    /// The SMT siblings of the shards' cpus are left to the shards' syscall
+    /// threads and to other threads working with the shards, see
+    /// \ref smp::sibling_cpus(). The default number of shards is then the
+    /// number of cores. Without \p HWLOC support, each cpu counts as a core.
+    ///
+    /// Default: \p false.
+    program_options::value<bool> one_shard_per_core;
     /// \brief Number of IO queues.
     ///
     /// Each IO unit will be responsible for a fraction of the IO requests.
@@ -78,6 +104,13 @@ struct smp_options : public program_options::option_group {
     /// them to remote ones.
     /// \note Unused when seastar is compiled without \p HWLOC support.
     program_options::value<bool> allow_cpus_in_remote_numa_nodes;
+    /// Poll only the cross-shard queues that other shards pushed to, or that
+    /// have batches waiting to be flushed, instead of all of them. Makes the
+    /// cost of polling scale with the number of peers a shard talks to rather
+    /// than with the number of shards, which helps on machines with many cores.
+    ///
+    /// Default: \p false.
+    program_options::value<bool> poll_active_smp_queues;
 
 public:
     smp_options(program_options::option_group* parent_group);
@@ -227,44 +227,23 @@ class basic_sstring {
         return size();
     }
 
+    // Both find()s leave the scanning to the char_traits (memchr() and
+    // memcmp() for char), which the C library vectorizes
     size_t find(char_type t, size_t pos = 0) const noexcept {
-        const char_type* it = str() + pos;
-        const char_type* end = str() + size();
-        while (it < end) {
-            if (*it == t) {
-                return it - str();
-            }
-            it++;
+        if (pos >= size()) {
+            return npos;
         }
-        return npos;
+        auto p = traits_type::find(str() + pos, size() - pos, t);
+        return p ? p - str() : npos;
     }
 
     size_t find(const basic_sstring& s, size_t pos = 0) const noexcept {
-        const char_type* it = str() + pos;
-        const char_type* end = str() + size();
-        const char_type* c_str = s.str();
-        const char_type* c_str_end = s.str() + s.size();
-
-	if (c_str == c_str_end) {
-            /* see https://en.cppreference.com/w/cpp/string/basic_string/find
-             * - an empty substring is found at pos if and only if pos <= size()
-             */
-            return (pos <= size()) ? pos : npos;
-        }
-
-        while (it < end) {
-            auto i = it;
-            auto j = c_str;
-            while ( i < end && j < c_str_end && *i == *j) {
-                i++;
-                j++;
-            }
-            if (j == c_str_end) {
-                return it - str();
-            }
-            it++;
-        }
-        return npos;
+        /* see https://en.cppreference.com/w/cpp/string/basic_string/find
+         * - an empty substring is found at pos if and only if pos <= size()
+         */
+        auto r = std::basic_string_view<char_type, traits_type>(str(), size()).find(
+                std::basic_string_view<char_type, traits_type>(s.str(), s.size()), pos);
+        return r == std::basic_string_view<char_type, traits_type>::npos ? npos : r;
     }
 
     /**
@@ -666,6 +645,18 @@ char* copy_str_to(char* dst, const Head& head, const Tail&... tail) {
     return copy_str_to(std::copy(v.begin(), v.end(), dst), tail...);
 }
 
+/// Compares two strings for equality, ignoring the case of ASCII letters
+///
+/// Other bytes have to be equal. This is how HTTP header names and
+/// similar protocol tokens compare, regardless of the locale.
+bool ascii_iequals(std::string_view a, std::string_view b) noexcept;
+
+/// Converts the ASCII capital letters of a buffer to lower case in place
+void ascii_to_lower(char* p, size_t n) noexcept;
+
+/// Concatenates strings and anything convertible to std::string_view
+///
+/// The result is allocated once, at its full size.
 template <typename String = sstring, typename... Args>
 static String make_sstring(Args&&... args)
 {
@@ -0,0 +1,59 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/http/httpd.hh>
+#include <seastar/core/sstring.hh>
+
+namespace seastar {
+
+/// \brief Stalls aggregated by backtrace.
+///
+/// Besides printing the backtrace of a stall, rate limited by
+/// \c --blocked-reactor-reports-per-minute, the stall detector of every
+/// shard counts all stalls by scheduling group, stalling task and
+/// backtrace, with the time they took. The busiest of the backtraces that stalled since the
+/// last summary are logged every \c --blocked-reactor-summary-interval-s,
+/// and the \c stall_detector metrics count the stalls and their time.
+namespace stall_reports {
+
+/// Returns the stalls of all shards, one
+/// "shard N group G: <count> stalls, <total> ms in total, up to <max> ms, task <type>: <backtrace>"
+/// line per scheduling group, task type and backtrace, the longest in total first
+/// on each shard. The backtraces are in the format of the stall reports,
+/// for seastar-addr2line.
+future<sstring> summary();
+
+/// Drops the stalls aggregated on all shards. The metrics keep counting.
+future<> reset();
+
+/// \defgroup add_stall_reports_routes adds an endpoint that returns the
+///    result of \ref summary(). The stalls are reset after they're read
+///    if the \c reset query parameter is set to \c true.
+/// @{
+future<> add_routes(distributed<http_server>& server, sstring path = "/stall_reports");
+future<> add_routes(http_server& server, sstring path = "/stall_reports");
+/// @}
+
+}
+
+}
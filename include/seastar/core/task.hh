@@ -23,12 +23,15 @@
 
 #include <memory>
 #include <seastar/core/scheduling.hh>
+#include <seastar/core/task_local.hh>
 #include <seastar/util/backtrace.hh>
 
 namespace seastar {
 
 class task {
     scheduling_group _sg;
+    // Fits in the padding after _sg
+    uint32_t _task_local_handle = *internal::current_task_local_handle_ptr();
 #ifdef SEASTAR_TASK_BACKTRACE
     shared_backtrace _bt;
 #endif
@@ -42,12 +45,23 @@ class task {
     scheduling_group set_scheduling_group(scheduling_group new_sg) noexcept{
         return std::exchange(_sg, new_sg);
     }
+    // For tasks that run on another shard, where the handle means nothing
+    void clear_task_local_handle() noexcept {
+        _task_local_handle = 0;
+    }
 public:
     explicit task(scheduling_group sg = current_scheduling_group()) noexcept : _sg(sg) {}
     virtual void run_and_dispose() noexcept = 0;
     /// Returns the next task which is waiting for this task to complete execution, or nullptr.
     virtual task* waiting_task() noexcept = 0;
     scheduling_group group() const { return _sg; }
+    uint32_t task_local_handle() const noexcept { return _task_local_handle; }
+    /// Takes the task-local values of the running task, for tasks that are
+    /// scheduled again, such as the ones of coroutines, which are a single
+    /// task for their lifetime
+    void inherit_task_local_values() noexcept {
+        _task_local_handle = *internal::current_task_local_handle_ptr();
+    }
     shared_backtrace get_backtrace() const;
 #ifdef SEASTAR_TASK_BACKTRACE
     void make_backtrace() noexcept;
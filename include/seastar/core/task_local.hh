@@ -0,0 +1,155 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <any>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace seastar {
+
+/// \cond internal
+namespace internal {
+
+// Tasks hold a handle to the task-local values of the task that created
+// them, which the reactor makes current when running them. A handle is an
+// index in a table of the sets of values of the shard, with a generation,
+// so that a task that outlives its values finds none. 0 is no values.
+inline
+uint32_t*
+current_task_local_handle_ptr() noexcept {
+    static thread_local uint32_t handle = 0;
+    return &handle;
+}
+
+using task_local_values = std::vector<std::pair<unsigned, std::any>>;
+
+// The values of the current task that go to other shards with it
+task_local_values cross_shard_task_local_values();
+
+}
+/// \endcond
+
+/// \addtogroup future-util
+/// @{
+
+/// \brief Identifies a task-local value, see \ref task_local
+class task_local_key {
+    unsigned _id;
+protected:
+    explicit task_local_key(bool crosses_shards) noexcept;
+    const std::any* find() const noexcept;
+public:
+    task_local_key(const task_local_key&) = delete;
+    task_local_key& operator=(const task_local_key&) = delete;
+
+    unsigned id() const noexcept {
+        return _id;
+    }
+    bool crosses_shards() const noexcept {
+        return _id & 1;
+    }
+};
+
+/*!
+ * \brief A value a task passes on to the continuations it creates
+ *
+ * A task_local object, typically a static one, is the key to a value of
+ * type T, which is set for a piece of work with task_local_scope or
+ * with_task_local(). The continuations created while the value is set
+ * inherit it, whether attached with future::then(), awaited by a coroutine,
+ * created by when_all() or parallel_for_each(), or waited for by a
+ * seastar::thread, and so do their own continuations.
+ *
+ * Tasks only copy a handle to the values of their creator, which fits in
+ * their existing layout, so this costs nothing to tasks when no value is
+ * set, and setting values costs a copy of the values already set.
+ *
+ * \tparam T the type of the value, which must be copyable
+ */
+template <typename T>
+class task_local : public task_local_key {
+public:
+    using value_type = T;
+
+    /// \param crosses_shards whether the value goes with the functions
+    ///        submitted to other shards with smp::submit_to(), for values
+    ///        that can be copied from another shard
+    explicit task_local(bool crosses_shards = false) noexcept : task_local_key(crosses_shards) {}
+
+    /// The value of the current task, or nullptr if it has none
+    const T* get() const noexcept {
+        auto v = find();
+        return v ? std::any_cast<T>(v) : nullptr;
+    }
+};
+
+/*!
+ * \brief Sets a task-local value for the current task and its continuations
+ *
+ * While the object lives, the continuations created by the current task
+ * and by its continuations have the value, along with the other values
+ * the task had. The value is released with the object, after which the
+ * continuations still pending no longer have it. It is meant to be kept
+ * for the duration of an operation, with do_with() or in the last
+ * continuation of the operation, or in the frame of a coroutine or of a
+ * seastar::thread.
+ *
+ * The task gets back the values it had before when the scope is destroyed,
+ * if the scope's are still the current ones.
+ */
+class task_local_scope {
+    uint32_t _handle = 0;
+    uint32_t _previous = 0;
+public:
+    /// Sets the value of \c key. If the value can't be stored for lack of
+    /// memory, the task is left without task-local values.
+    template <typename T>
+    task_local_scope(const task_local<T>& key, typename task_local<T>::value_type value) noexcept {
+        try {
+            activate(key, std::any(std::move(value)));
+        } catch (...) {
+            *internal::current_task_local_handle_ptr() = 0;
+        }
+    }
+    /// Sets the values that came from another shard, see
+    /// internal::cross_shard_task_local_values()
+    explicit task_local_scope(internal::task_local_values values) noexcept;
+    task_local_scope(task_local_scope&& o) noexcept;
+    task_local_scope& operator=(task_local_scope&& o) noexcept;
+    ~task_local_scope();
+
+    /// Gives the current task back the values it had before, while the
+    /// scope's stay set for the continuations that have them
+    void deactivate() noexcept;
+
+    /// \cond internal
+    const std::any* find(const task_local_key& key) const noexcept;
+    /// \endcond
+private:
+    void activate(const task_local_key& key, std::any value);
+};
+
+/// @}
+
+}
@@ -241,6 +241,25 @@ class temporary_buffer {
     }
 };
 
+/// Prepares a buffer to be handed over to another shard without copying.
+///
+/// The data stays where it is; the returned buffer can be used and
+/// destroyed on any shard, and the deleter of \c buf is invoked back on
+/// the calling shard, in batches (see \ref make_cross_shard_deleter()).
+/// It can be passed on, for example, to \ref output_stream::write() or to
+/// a \ref net::packet on the receiving shard.
+///
+/// \param buf buffer owned by the calling shard
+/// \return a buffer referring to the same data as \c buf
+template <typename CharType>
+inline
+temporary_buffer<CharType>
+make_cross_shard_buffer(temporary_buffer<CharType> buf) {
+    auto data = buf.get_write();
+    auto size = buf.size();
+    return temporary_buffer<CharType>(data, size, make_cross_shard_deleter(buf.release()));
+}
+
 /// @}
 
 }
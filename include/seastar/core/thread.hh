@@ -80,8 +80,18 @@ class thread_attributes {
     std::optional<seastar::scheduling_group> sched_group;
     // For stack_size 0, a default value will be used (128KiB when writing this comment)
     size_t stack_size = 0;
+    // Map the stack directly from the kernel instead of taking it from the
+    // memory allocator, so that its pages only take memory once the thread
+    // touches them. Suits threads that rarely need a deep stack. The size is
+    // rounded up to whole pages, and the lowest page is always a guard page.
+    bool lazy_stack = false;
 };
 
+/// Sets how many bytes of stacks of finished threads the current shard keeps
+/// for reuse by new threads (2MiB by default). 0 disables the reuse. Stacks
+/// above the limit are freed.
+void set_thread_stack_pool_limit(size_t bytes) noexcept;
+
 
 /// \cond internal
 extern thread_local jmp_buf_link g_unthreaded_context;
@@ -93,7 +103,9 @@ class thread_context final : private task {
     struct stack_deleter {
         void operator()(char *ptr) const noexcept;
         int valgrind_id;
-        stack_deleter(int valgrind_id);
+        size_t size;
+        bool lazy;
+        stack_deleter(int valgrind_id, size_t size, bool lazy);
     };
     using stack_holder = std::unique_ptr<char[], stack_deleter>;
 
@@ -114,7 +126,7 @@ class thread_context final : private task {
     static void s_main(int lo, int hi); // all parameters MUST be 'int' for makecontext
     void setup(size_t stack_size);
     void main();
-    stack_holder make_stack(size_t stack_size);
+    stack_holder make_stack(size_t stack_size, bool lazy);
     virtual void run_and_dispose() noexcept override; // from task class
 public:
     thread_context(thread_attributes attr, noncopyable_function<void ()> func);
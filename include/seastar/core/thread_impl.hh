@@ -35,19 +35,36 @@ using thread_clock = std::chrono::steady_clock;
 class thread_context;
 class scheduling_group;
 
+// Switch contexts by saving just the callee-saved registers on the stack
+// being left, on x86-64 only for now. Sanitized builds keep ucontext, which
+// the sanitizer fiber hooks are written against, and so do builds with
+// shadow stacks (CET), which only longjmp() knows how to unwind.
+#if !defined(SEASTAR_ASAN_ENABLED) && defined(__x86_64__) \
+        && !(defined(__CET__) && (__CET__ & 2))
+#define SEASTAR_THREAD_FAST_SWITCH
+#endif
+
 struct jmp_buf_link {
 #ifdef SEASTAR_ASAN_ENABLED
     ucontext_t context;
     void* fake_stack = nullptr;
     const void* stack_bottom;
     size_t stack_size;
+#elif defined(SEASTAR_THREAD_FAST_SWITCH)
+    // Where the registers of the context were saved when it was switched out
+    void* sp;
 #else
     jmp_buf jmpbuf;
 #endif
     jmp_buf_link* link;
     thread_context* thread;
 public:
+#ifdef SEASTAR_THREAD_FAST_SWITCH
+    // Starts running entry(arg) on a new stack, which ends at stack_top
+    void initial_switch_in(void (*entry)(void*), void* arg, char* stack_top);
+#else
     void initial_switch_in(ucontext_t* initial_context, const void* stack_bottom, size_t stack_size);
+#endif
     void switch_in();
     void switch_out();
     void initial_switch_in_completed();
@@ -19,6 +19,7 @@
 #include <array>
 #include <boost/intrusive/list.hpp>
 #include <seastar/core/bitset-iter.hh>
+#include <seastar/core/prefetch.hh>
 
 namespace seastar {
 
@@ -187,10 +188,16 @@ class timer_set {
         _last = timestamp;
         _next = max_timestamp;
 
+        // The timers are scattered in memory, and there is little work per
+        // timer to hide the misses behind, so fetch the next one while
+        // working on the current one
         auto& list = _buckets[index];
         while (!list.empty()) {
             auto& timer = *list.begin();
             list.pop_front();
+            if (!list.empty()) {
+                prefetch(&*list.begin());
+            }
             if (timer.get_timeout() <= now) {
                 exp.push_back(timer);
             } else {
@@ -201,7 +208,12 @@ class timer_set {
         _non_empty_buckets[index] = !list.empty();
 
         if (_next == max_timestamp && _non_empty_buckets.any()) {
-            for (auto& timer : _buckets[get_last_non_empty_bucket()]) {
+            auto& last = _buckets[get_last_non_empty_bucket()];
+            for (auto it = last.begin(); it != last.end();) {
+                auto& timer = *it++;
+                if (it != last.end()) {
+                    prefetch(&*it);
+                }
                 _next = std::min(_next, get_timestamp(timer));
             }
         }
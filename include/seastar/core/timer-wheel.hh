@@ -0,0 +1,305 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <chrono>
+#include <limits>
+#include <array>
+#include <cstdint>
+#include <boost/intrusive/list.hpp>
+#include <seastar/core/prefetch.hh>
+
+namespace seastar {
+
+/**
+ * A hierarchical timer wheel with the same interface as timer_set.
+ *
+ * Timestamps are split into 6-bit digits. A timer is kept on the level of
+ * the most significant digit in which its timeout differs from the last
+ * expiry time, in the slot given by its timeout's digit on that level. Each
+ * level has a bitmask of non-empty slots.
+ *
+ * insert() and remove() are O(1). expire() only visits the slots due up
+ * to the new time, and moves each timer down at most once per level over
+ * its lifetime, so it does less work than timer_set when there are many
+ * timers: timer_set's buckets are only one bit wide, so each of them mixes
+ * timers that are due soon with ones due much later.
+ *
+ * The price is memory: one list head per slot, 64 slots on each of
+ * 11 levels for 64-bit timestamps.
+ */
+template<typename Timer, boost::intrusive::list_member_hook<> Timer::*link>
+class timer_wheel {
+public:
+    using time_point = typename Timer::time_point;
+    using timer_list_t = boost::intrusive::list<Timer, boost::intrusive::member_hook<Timer, boost::intrusive::list_member_hook<>, link>>;
+private:
+    using duration = typename Timer::duration;
+    using timestamp_t = typename Timer::duration::rep;
+
+    static constexpr timestamp_t max_timestamp = std::numeric_limits<timestamp_t>::max();
+    static constexpr int timestamp_bits = std::numeric_limits<timestamp_t>::digits;
+    static constexpr int slot_bits = 6;
+    static constexpr int n_slots = 1 << slot_bits;
+    static constexpr int n_levels = (timestamp_bits + slot_bits - 1) / slot_bits;
+
+    std::array<std::array<timer_list_t, n_slots>, n_levels> _wheel;
+    std::array<uint64_t, n_levels> _non_empty_slots = {};
+    // Active timers with timeout <= _last
+    timer_list_t _overdue;
+    timestamp_t _last;
+    timestamp_t _next;
+private:
+    static timestamp_t get_timestamp(time_point _time_point) noexcept
+    {
+        return _time_point.time_since_epoch().count();
+    }
+
+    static timestamp_t get_timestamp(Timer& timer) noexcept
+    {
+        return get_timestamp(timer.get_timeout());
+    }
+
+    // Requires timestamp > last
+    static int get_level(timestamp_t timestamp, timestamp_t last) noexcept
+    {
+        auto diff = static_cast<uint64_t>(timestamp ^ last);
+        return (std::numeric_limits<uint64_t>::digits - 1 - __builtin_clzll(diff)) / slot_bits;
+    }
+
+    static int get_slot(timestamp_t timestamp, int level) noexcept
+    {
+        return (static_cast<uint64_t>(timestamp) >> (level * slot_bits)) & (n_slots - 1);
+    }
+
+    // Slots [from, to) of a level, as a mask
+    static uint64_t slot_range(int from, int to) noexcept
+    {
+        auto below = [] (int n) { return n == n_slots ? ~uint64_t(0) : (uint64_t(1) << n) - 1; };
+        return below(to) & ~below(from);
+    }
+
+    template <typename Func>
+    static void for_each_slot(uint64_t mask, Func&& func) noexcept
+    {
+        while (mask) {
+            func(__builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    void take_slots(int level, uint64_t mask, timer_list_t& to) noexcept
+    {
+        mask &= _non_empty_slots[level];
+        for_each_slot(mask, [&] (int slot) {
+            to.splice(to.end(), _wheel[level][slot]);
+        });
+        _non_empty_slots[level] &= ~mask;
+    }
+public:
+    timer_wheel() noexcept
+        : _last(0)
+        , _next(max_timestamp)
+    {
+    }
+
+    ~timer_wheel() {
+        while (!_overdue.empty()) {
+            _overdue.begin()->cancel();
+        }
+        for (int level = 0; level < n_levels; ++level) {
+            for (auto&& list : _wheel[level]) {
+                while (!list.empty()) {
+                    list.begin()->cancel();
+                }
+            }
+        }
+    }
+
+    /**
+     * Adds timer to the active set. See timer_set::insert().
+     *
+     * Returns true if and only if this timer's timeout is less than get_next_timeout().
+     */
+    bool insert(Timer& timer) noexcept
+    {
+        auto timestamp = get_timestamp(timer);
+        if (timestamp <= _last) {
+            _overdue.push_back(timer);
+        } else {
+            auto level = get_level(timestamp, _last);
+            auto slot = get_slot(timestamp, level);
+            _wheel[level][slot].push_back(timer);
+            _non_empty_slots[level] |= uint64_t(1) << slot;
+        }
+
+        if (timestamp < _next) {
+            _next = timestamp;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Removes timer from the active set. See timer_set::remove().
+     */
+    void remove(Timer& timer) noexcept
+    {
+        auto timestamp = get_timestamp(timer);
+        if (timestamp <= _last) {
+            _overdue.erase(_overdue.iterator_to(timer));
+            return;
+        }
+        auto level = get_level(timestamp, _last);
+        auto slot = get_slot(timestamp, level);
+        auto& list = _wheel[level][slot];
+        list.erase(list.iterator_to(timer));
+        if (list.empty()) {
+            _non_empty_slots[level] &= ~(uint64_t(1) << slot);
+        }
+    }
+
+    /**
+     * Expires active timers. See timer_set::expire().
+     */
+    timer_list_t expire(time_point now) noexcept
+    {
+        timer_list_t exp;
+        auto timestamp = get_timestamp(now);
+
+        if (timestamp < _last) {
+            abort();
+        }
+
+        exp.splice(exp.end(), _overdue);
+
+        timer_list_t to_redistribute;
+        if (timestamp != _last) {
+            // Timers on levels above the top one that changed keep their
+            // place. Those below it, and those in the slots of that level
+            // passed over, are due. The ones in the slot it now points to
+            // need to move down.
+            auto top = get_level(timestamp, _last);
+            for (int level = 0; level < top; ++level) {
+                take_slots(level, ~uint64_t(0), exp);
+            }
+            auto slot = get_slot(timestamp, top);
+            take_slots(top, slot_range(get_slot(_last, top) + 1, slot), exp);
+            take_slots(top, slot_range(slot, slot + 1), to_redistribute);
+        }
+
+        _last = timestamp;
+        _next = max_timestamp;
+
+        // Fetch the next timer while working on the current one, see
+        // timer_set::expire()
+        while (!to_redistribute.empty()) {
+            auto& timer = *to_redistribute.begin();
+            to_redistribute.pop_front();
+            if (!to_redistribute.empty()) {
+                prefetch(&*to_redistribute.begin());
+            }
+            if (get_timestamp(timer) <= timestamp) {
+                exp.push_back(timer);
+            } else {
+                insert(timer);
+            }
+        }
+
+        // The earliest timer is in the first non-empty slot of the lowest
+        // non-empty level, as lower levels agree with _last on more digits
+        if (_next == max_timestamp) {
+            for (int level = 0; level < n_levels; ++level) {
+                if (_non_empty_slots[level]) {
+                    auto& list = _wheel[level][__builtin_ctzll(_non_empty_slots[level])];
+                    for (auto it = list.begin(); it != list.end();) {
+                        auto& timer = *it++;
+                        if (it != list.end()) {
+                            prefetch(&*it);
+                        }
+                        _next = std::min(_next, get_timestamp(timer));
+                    }
+                    break;
+                }
+            }
+        }
+        return exp;
+    }
+
+    /**
+     * Returns a time point at which expire() should be called
+     * in order to ensure timers are expired in a timely manner.
+     *
+     * Returned values are monotonically increasing.
+     */
+    time_point get_next_timeout() const noexcept
+    {
+        return time_point(duration(std::max(_last, _next)));
+    }
+
+    /**
+     * Clears the active timer set.
+     */
+    void clear() noexcept
+    {
+        _overdue.clear();
+        for (int level = 0; level < n_levels; ++level) {
+            for_each_slot(_non_empty_slots[level], [&] (int slot) {
+                _wheel[level][slot].clear();
+            });
+            _non_empty_slots[level] = 0;
+        }
+    }
+
+    size_t size() const noexcept
+    {
+        size_t res = _overdue.size();
+        for (int level = 0; level < n_levels; ++level) {
+            for_each_slot(_non_empty_slots[level], [&] (int slot) {
+                res += _wheel[level][slot].size();
+            });
+        }
+        return res;
+    }
+
+    /**
+     * Returns true if and only if there are no timers in the active set.
+     */
+    bool empty() const noexcept
+    {
+        if (!_overdue.empty()) {
+            return false;
+        }
+        for (auto mask : _non_empty_slots) {
+            if (mask) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    time_point now() noexcept {
+        return Timer::clock::now();
+    }
+};
+
+}
@@ -27,6 +27,7 @@
 #include <functional>
 #include <seastar/core/future.hh>
 #include <seastar/core/timer-set.hh>
+#include <seastar/core/timer-wheel.hh>
 #include <seastar/core/scheduling.hh>
 
 /// \file
@@ -214,6 +215,7 @@ class timer {
     }
     friend class reactor;
     friend class timer_set<timer, &timer::_link>;
+    friend class timer_wheel<timer, &timer::_link>;
 };
 
 extern template class timer<steady_clock_type>;
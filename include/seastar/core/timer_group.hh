@@ -0,0 +1,223 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/timer.hh>
+#include <seastar/core/timer-set.hh>
+#include <seastar/core/lowres_clock.hh>
+#include <seastar/util/noncopyable_function.hh>
+#include <cassert>
+
+namespace seastar {
+
+/// \addtogroup timers
+/// @{
+
+/// A group of timeouts that expire in batches.
+///
+/// Each \ref timer fires its own callback as a separate task, so a large
+/// number of timeouts expiring together (e.g. idle timeouts of connections
+/// that were opened in a burst) costs one task per timeout. A timer_group
+/// keeps its entries in a private timer set driven by a single \ref timer,
+/// and hands all entries that expired together to one callback.
+///
+/// Like Linux timer slack, the group may fire an entry up to \c slack
+/// later than requested: expiry times are rounded up to a multiple of the
+/// slack, so that entries armed close to each other expire together.
+///
+/// Users derive their objects from \ref timer_group::entry and get them
+/// back with a static_cast in the callback. Entries must not outlive
+/// their group.
+///
+/// \tparam Clock clock used to denote time points, same as for \ref timer
+template <typename Clock = lowres_clock>
+class timer_group {
+public:
+    using time_point = typename Clock::time_point;
+    using duration = typename Clock::duration;
+
+    /// A timeout that belongs to a timer_group.
+    class entry {
+    public:
+        using time_point = typename Clock::time_point;
+        using duration = typename Clock::duration;
+        using clock = Clock;
+    private:
+        boost::intrusive::list_member_hook<> _link;
+        timer_group* _group;
+        time_point _expiry;
+        bool _armed = false;
+        bool _expired = false;
+        friend class timer_group;
+    public:
+        /// Constructs an entry of a group. The entry is not armed.
+        explicit entry(timer_group& group) noexcept : _group(&group) {}
+        entry(entry&&) = delete;
+        /// Destroys the entry. The entry is cancelled if armed.
+        ~entry() {
+            cancel();
+        }
+        /// Sets the expiration time. The entry must not be armed.
+        ///
+        /// \param until the earliest time at which the entry expires; the
+        ///        group may fire it up to its slack later
+        void arm(time_point until) noexcept {
+            _group->arm(*this, until);
+        }
+        /// Sets the expiration time relative to now. The entry must not be armed.
+        void arm(duration delta) noexcept {
+            arm(Clock::now() + delta);
+        }
+        /// Sets the expiration time, cancelling the entry first if it is armed.
+        void rearm(time_point until) noexcept {
+            cancel();
+            arm(until);
+        }
+        /// Sets the expiration time relative to now, cancelling the entry first if it is armed.
+        void rearm(duration delta) noexcept {
+            rearm(Clock::now() + delta);
+        }
+        /// Returns whether the entry is armed.
+        bool armed() const noexcept { return _armed; }
+        /// Cancels the entry. Does nothing if it is not armed.
+        ///
+        /// An entry that was handed to the group's callback but not
+        /// yet processed is removed from the batch.
+        ///
+        /// \return  if the entry was armed before the call.
+        bool cancel() noexcept {
+            return _group->cancel(*this);
+        }
+        /// Gets the expiration time of an armed entry, rounded up by the group's slack.
+        time_point get_timeout() const noexcept {
+            return _expiry;
+        }
+    };
+
+    using entry_set = timer_set<entry, &entry::_link>;
+    /// The entries passed to the callback, in no particular order.
+    using expired_list = typename entry_set::timer_list_t;
+    using callback_t = noncopyable_function<void (expired_list&)>;
+private:
+    timer<Clock> _timer;
+    entry_set _entries;
+    expired_list _expired;
+    callback_t _callback;
+    duration _slack;
+private:
+    time_point round_up(time_point until) const noexcept {
+        auto slack = _slack.count();
+        auto t = until.time_since_epoch().count();
+        if (slack <= 1 || t > std::numeric_limits<decltype(t)>::max() - slack) {
+            return until;
+        }
+        auto rem = t % slack;
+        return time_point(duration(rem ? t - rem + slack : t));
+    }
+
+    void arm(entry& e, time_point until) noexcept {
+        assert(!e._armed);
+        if (e._expired) {
+            // Armed again from the callback, before the batch was processed
+            _expired.erase(_expired.iterator_to(e));
+            e._expired = false;
+        }
+        e._expiry = round_up(until);
+        e._armed = true;
+        if (_entries.insert(e) || !_timer.armed()) {
+            _timer.rearm(_entries.get_next_timeout());
+        }
+    }
+
+    bool cancel(entry& e) noexcept {
+        if (e._expired) {
+            _expired.erase(_expired.iterator_to(e));
+            e._expired = false;
+            return true;
+        }
+        if (!e._armed) {
+            return false;
+        }
+        _entries.remove(e);
+        e._armed = false;
+        return true;
+    }
+
+    void expire(time_point now) noexcept {
+        _expired = _entries.expire(now);
+        for (auto& e : _expired) {
+            e._armed = false;
+            e._expired = true;
+        }
+    }
+
+    void complete() {
+        expire(_entries.now());
+        if (!_expired.empty()) {
+            _callback(_expired);
+        }
+        // Entries left in the batch by the callback are dropped
+        while (!_expired.empty()) {
+            auto& e = *_expired.begin();
+            _expired.pop_front();
+            e._expired = false;
+        }
+        if (!_entries.empty()) {
+            _timer.rearm(_entries.get_next_timeout());
+        }
+    }
+public:
+    /// Constructs a group.
+    ///
+    /// \param callback function called with a batch of expired entries.
+    ///        Entries may be armed again or cancelled from the callback,
+    ///        which removes them from the batch, so a loop over the batch
+    ///        has to move past an entry before doing either.
+    /// \param slack how late an entry may expire, to let entries armed at
+    ///        close times expire together
+    explicit timer_group(callback_t callback, duration slack = duration(0))
+        : _timer([this] { complete(); })
+        , _callback(std::move(callback))
+        , _slack(slack)
+    { }
+    timer_group(timer_group&&) = delete;
+    /// Destroys the group. Entries that are still armed are cancelled.
+    ~timer_group() {
+        _timer.cancel();
+        expire(time_point::max());
+        while (!_expired.empty()) {
+            auto& e = *_expired.begin();
+            _expired.pop_front();
+            e._expired = false;
+        }
+    }
+    /// Returns the slack of the group.
+    duration slack() const noexcept { return _slack; }
+    /// Sets the slack of the group. Affects entries armed from now on.
+    void set_slack(duration slack) noexcept { _slack = slack; }
+    /// Returns the number of armed entries.
+    size_t size() const noexcept { return _entries.size(); }
+};
+
+/// @}
+
+}
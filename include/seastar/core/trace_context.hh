@@ -0,0 +1,129 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/sstring.hh>
+#include <seastar/core/task_local.hh>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+namespace seastar {
+
+/// \brief Distributed tracing context propagation
+///
+/// A trace context identifies the trace and the span a piece of work
+/// belongs to. Once activated on a shard, it flows to the continuations
+/// of the tasks that run in it, as a \ref task_local value, to the
+/// functions submitted to other shards with smp::submit_to(), and to
+/// other nodes through rpc and http, which carry it in their requests.
+/// It is the [W3C Trace Context](https://www.w3.org/TR/trace-context/),
+/// so that it can be exchanged with other tracing systems.
+namespace tracing {
+
+struct trace_context {
+    using trace_id_type = std::array<uint8_t, 16>;
+    static constexpr uint8_t sampled_flag = 1;
+
+    trace_id_type trace_id = {};
+    uint64_t span_id = 0;
+    uint8_t flags = 0;
+
+    bool sampled() const noexcept {
+        return flags & sampled_flag;
+    }
+
+    /// A context for a span of the same trace, whose parent is this one
+    trace_context make_child() const noexcept;
+
+    /// A context starting a new trace, sampled if the sampler of this
+    /// shard says so
+    static trace_context make_root() noexcept;
+
+    /// The context as an HTTP traceparent header value
+    sstring to_traceparent() const;
+
+    /// Parses a traceparent header value, returning nothing if it is invalid
+    static std::optional<trace_context> from_traceparent(std::string_view value) noexcept;
+
+    bool operator==(const trace_context& o) const noexcept {
+        return trace_id == o.trace_id && span_id == o.span_id && flags == o.flags;
+    }
+    bool operator!=(const trace_context& o) const noexcept {
+        return !(*this == o);
+    }
+};
+
+/// Decides whether a new trace is recorded, the \c sampled_flag of its
+/// root context. Traces started elsewhere keep the decision made there.
+using sampler = std::function<bool (const trace_context&)>;
+
+/// Sets the sampler of this shard
+///
+/// Servers start a trace for requests that come without a context only
+/// when a sampler is set.
+void set_sampler(sampler s);
+
+/// Whether this shard has a sampler
+bool has_sampler() noexcept;
+
+/// A sampler recording the given fraction of the traces, decided from
+/// their trace id, so that the same traces are recorded everywhere
+sampler make_ratio_sampler(double ratio);
+
+/// The context of the running task, or nullptr if it has none
+const trace_context* current_trace_context() noexcept;
+
+/*!
+ * \brief Makes a context the one of the current task
+ *
+ * While the object lives, the continuations created by the current task
+ * and by its continuations have the context. The context is released with
+ * the object, after which the continuations still pending have none. It
+ * is meant to be kept for the duration of an operation, with do_with()
+ * or in the last continuation of the operation.
+ *
+ * The context restores the one the task had when it is destroyed, if it
+ * is still the current one.
+ */
+class active_context {
+    task_local_scope _scope;
+public:
+    /// Activates \c ctx. If the context can't be registered for lack of
+    /// memory, the task is left without a context.
+    explicit active_context(const trace_context& ctx) noexcept;
+
+    /// Gives the current task back the context it had before, while this
+    /// one stays registered for the continuations that have it
+    void deactivate() noexcept {
+        _scope.deactivate();
+    }
+
+    /// The context, or nullptr if it could not be activated or was moved away
+    const trace_context* get() const noexcept;
+};
+
+}
+
+}
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <tuple>
 #include <utility>
 #include <type_traits>
@@ -242,6 +243,10 @@ when_all_impl(Futs&&... futs) noexcept {
 /// Returns a tuple of futures so individual values or exceptions can be
 /// examined.
 ///
+/// Waiting takes a single allocation, none if all the futures are
+/// ready; in a coroutine, \ref coroutine::all keeps the state in the
+/// coroutine frame instead.
+///
 /// \param fut_or_funcs futures or functions that return futures
 /// \return an \c std::tuple<> of all futures returned; when ready,
 ///         all contained futures will be ready as well.
@@ -263,25 +268,65 @@ struct identity_futures_vector {
     }
 };
 
-// Internal function for when_all().
+// Waits for the futures of a vector in turn with a single allocation:
+// like when_all_state, it reuses one continuation for all of them, and
+// the futures that complete while it waits on another are found ready.
 template <typename ResolvedVectorTransform, typename Future>
-inline
-typename ResolvedVectorTransform::future_type
-complete_when_all(std::vector<Future>&& futures, typename std::vector<Future>::iterator pos) noexcept {
-    // If any futures are already ready, skip them.
-    while (pos != futures.end() && pos->available()) {
-        ++pos;
-    }
-    // Done?
-    if (pos == futures.end()) {
-        return ResolvedVectorTransform::run(std::move(futures));
-    }
-    // Wait for unready future, store, and continue.
-    return pos->then_wrapped([futures = std::move(futures), pos] (auto fut) mutable {
-        *pos++ = std::move(fut);
-        return complete_when_all<ResolvedVectorTransform>(std::move(futures), pos);
-    });
-}
+class when_all_vector_state {
+    using future_type = typename ResolvedVectorTransform::future_type;
+
+    class waiter final : public continuation_base_from_future_t<Future> {
+        when_all_vector_state* _all;
+    public:
+        explicit waiter(when_all_vector_state* all) noexcept : _all(all) {}
+        task* waiting_task() noexcept override { return _all->_p.waiting_task(); }
+        virtual void run_and_dispose() noexcept override {
+            using futurator = futurize<Future>;
+            auto state = _all;
+            auto& f = state->_futures[state->_pos];
+            if (__builtin_expect(this->_state.failed(), false)) {
+                f = futurator::make_exception_future(std::move(this->_state).get_exception());
+            } else {
+                f = futurator::from_tuple(std::move(this->_state).get_value());
+            }
+            this->~waiter();
+            state->wait_next();
+        }
+    };
+
+    std::vector<Future> _futures;
+    // The future waited for
+    size_t _pos = 0;
+    typename future_type::promise_type _p;
+    std::aligned_storage_t<sizeof(waiter), alignof(waiter)> _waiter;
+
+    explicit when_all_vector_state(std::vector<Future>&& futures) noexcept : _futures(std::move(futures)) {}
+
+    void wait_next() noexcept {
+        while (_pos < _futures.size() && _futures[_pos].available()) {
+            ++_pos;
+        }
+        if (_pos == _futures.size()) {
+            ResolvedVectorTransform::run(std::move(_futures)).forward_to(std::move(_p));
+            delete this;
+            return;
+        }
+        set_callback(std::move(_futures[_pos]), new (&_waiter) waiter(this));
+    }
+public:
+    static future_type wait_all(std::vector<Future>&& futures) noexcept {
+        if (std::all_of(futures.begin(), futures.end(), [] (const Future& f) { return f.available(); })) {
+            return ResolvedVectorTransform::run(std::move(futures));
+        }
+        auto state = [&] () noexcept {
+            memory::scoped_critical_alloc_section _;
+            return new when_all_vector_state(std::move(futures));
+        }();
+        auto ret = state->_p.get_future();
+        state->wait_next();
+        return ret;
+    }
+};
 
 template<typename ResolvedVectorTransform, typename FutureIterator>
 inline auto
@@ -298,7 +343,7 @@ do_when_all(FutureIterator begin, FutureIterator end) noexcept {
     // Important to invoke the *begin here, in case it's a function iterator,
     // so we launch all computation in parallel.
     std::move(begin, end, std::back_inserter(ret));
-    return complete_when_all<ResolvedVectorTransform>(std::move(ret), ret.begin());
+    return when_all_vector_state<ResolvedVectorTransform, typename itraits::value_type>::wait_all(std::move(ret));
 }
 
 } // namespace internal
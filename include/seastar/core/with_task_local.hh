@@ -0,0 +1,59 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/future.hh>
+#include <seastar/core/task_local.hh>
+
+namespace seastar {
+
+/// \addtogroup future-util
+/// @{
+
+/// \brief run a callable (with some arbitrary arguments) with a task-local value
+///
+/// The function, and the continuations it creates, run with \c value as
+/// the value of \c key, which is released when the future it returns
+/// resolves. The caller keeps its own values, for the continuations it
+/// attaches to the returned future included.
+///
+/// \param key the key of the value
+/// \param value the value
+/// \param func function to run; must be movable or copyable
+/// \param args arguments to the function; may be copied or moved, so use \c std::ref()
+///             to force passing references
+template <typename T, typename Func, typename... Args>
+inline
+auto
+with_task_local(const task_local<T>& key, typename task_local<T>::value_type value, Func&& func, Args&&... args) {
+    task_local_scope scope(key, std::move(value));
+    auto f = futurize_invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+    scope.deactivate();
+    if (f.available()) {
+        return f;
+    }
+    return f.finally([scope = std::move(scope)] {});
+}
+
+/// @}
+
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/future.hh>
+#include <seastar/core/trace_context.hh>
+
+namespace seastar {
+
+/// \addtogroup future-util
+/// @{
+
+/// \brief run a callable (with some arbitrary arguments) in a trace context
+///
+/// The function, and the continuations it creates, run with \c ctx as their
+/// trace context, which is released when the future it returns resolves.
+/// The caller keeps its own context, for the continuations it attaches to
+/// the returned future included.
+///
+/// \param ctx the trace context, see tracing::trace_context::make_child()
+/// \param func function to run; must be movable or copyable
+/// \param args arguments to the function; may be copied or moved, so use \c std::ref()
+///             to force passing references
+template <typename Func, typename... Args>
+inline
+auto
+with_trace_context(const tracing::trace_context& ctx, Func&& func, Args&&... args) {
+    tracing::active_context active(ctx);
+    auto f = futurize_invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+    active.deactivate();
+    if (f.available()) {
+        return f;
+    }
+    return f.finally([active = std::move(active)] {});
+}
+
+/// @}
+
+}
@@ -0,0 +1,296 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <exception>
+#include <optional>
+#include <utility>
+#include <seastar/core/coroutine.hh>
+#include <seastar/core/circular_buffer_fixed_capacity.hh>
+
+namespace seastar::coroutine {
+
+template <typename T, size_t BufferSize>
+class generator;
+
+namespace internal {
+
+using coroutine_handle_t = SEASTAR_INTERNAL_COROUTINE_NAMESPACE::coroutine_handle<void>;
+
+template <typename T, size_t BufferSize>
+class generator_promise final : public task {
+    using handle_type = SEASTAR_INTERNAL_COROUTINE_NAMESPACE::coroutine_handle<generator_promise>;
+    circular_buffer_fixed_capacity<T, BufferSize> _buffer;
+    // The consumer waiting for an element, if any
+    coroutine_handle_t _consumer;
+    std::exception_ptr _ex;
+    // The producer is parked in co_yield (or hasn't started yet), as opposed
+    // to waiting for a future, so the consumer has to resume it
+    bool _parked = true;
+    bool _finished = false;
+    // The generator was destroyed while the producer was waiting for a
+    // future; the producer destroys itself when it next suspends
+    bool _abandoned = false;
+
+    friend class generator<T, BufferSize>;
+
+    handle_type handle() noexcept {
+        return handle_type::from_promise(*this);
+    }
+
+    coroutine_handle_t take_consumer() noexcept {
+        auto c = std::exchange(_consumer, nullptr);
+        return c ? c : SEASTAR_INTERNAL_COROUTINE_NAMESPACE::noop_coroutine();
+    }
+
+    struct yield_awaiter {
+        generator_promise& _p;
+        bool await_ready() const noexcept {
+            return _p._buffer.size() < BufferSize && !_p._abandoned;
+        }
+        coroutine_handle_t await_suspend(coroutine_handle_t) noexcept {
+            if (_p._abandoned) {
+                _p.handle().destroy();
+                return SEASTAR_INTERNAL_COROUTINE_NAMESPACE::noop_coroutine();
+            }
+            _p._parked = true;
+            return _p.take_consumer();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct final_awaiter {
+        generator_promise& _p;
+        bool await_ready() const noexcept {
+            return false;
+        }
+        coroutine_handle_t await_suspend(coroutine_handle_t) noexcept {
+            if (_p._abandoned) {
+                _p.handle().destroy();
+                return SEASTAR_INTERNAL_COROUTINE_NAMESPACE::noop_coroutine();
+            }
+            _p._finished = true;
+            return _p.take_consumer();
+        }
+        void await_resume() noexcept {}
+    };
+
+    // Wraps the awaiting of a future by the producer: if it has to wait,
+    // the elements produced so far are handed to a waiting consumer meanwhile
+    template <typename... U>
+    struct future_awaiter {
+        generator_promise& _p;
+        seastar::future<U...> _future;
+        bool await_ready() const noexcept {
+            return _future.available() && !need_preempt();
+        }
+        coroutine_handle_t await_suspend(coroutine_handle_t) noexcept {
+            if (_future.available()) {
+                // Only preempted
+                _p.inherit_task_local_values();
+                schedule(&_p);
+            } else {
+                _future.set_coroutine(_p);
+            }
+            if (!_p._buffer.empty()) {
+                return _p.take_consumer();
+            }
+            return SEASTAR_INTERNAL_COROUTINE_NAMESPACE::noop_coroutine();
+        }
+        auto await_resume() {
+            if constexpr (sizeof...(U) == 0) {
+                _future.get();
+            } else {
+                return _future.get0();
+            }
+        }
+    };
+public:
+    generator_promise() = default;
+    generator_promise(generator_promise&&) = delete;
+    generator_promise(const generator_promise&) = delete;
+
+    generator<T, BufferSize> get_return_object() noexcept;
+
+    SEASTAR_INTERNAL_COROUTINE_NAMESPACE::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {*this}; }
+
+    template <typename U>
+    yield_awaiter yield_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, U&&>) {
+        _buffer.emplace_back(std::forward<U>(value));
+        return {*this};
+    }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() noexcept {
+        _ex = std::current_exception();
+    }
+
+    template <typename... U>
+    future_awaiter<U...> await_transform(seastar::future<U...>&& f) noexcept {
+        return {*this, std::move(f)};
+    }
+
+    template <typename Awaitable>
+    Awaitable&& await_transform(Awaitable&& a) noexcept {
+        return std::forward<Awaitable>(a);
+    }
+
+    virtual void run_and_dispose() noexcept override {
+        _parked = false;
+        handle().resume();
+    }
+
+    virtual task* waiting_task() noexcept override {
+        return nullptr;
+    }
+};
+
+}
+
+/// \brief A coroutine that produces a sequence of values with \c co_yield.
+///
+/// The producer is a coroutine returning \c generator<T> that hands out
+/// elements with `co_yield`, and may `co_await` futures in between. The
+/// consumer, itself a coroutine, retrieves them one at a time with
+/// `co_await gen()`, which returns a disengaged optional once the producer
+/// returns. An exception escaping the producer is rethrown to the consumer
+/// once the elements yielded before it are consumed.
+///
+/// The producer runs only when the consumer asks for elements, and runs
+/// ahead of it by up to \c BufferSize elements: it is suspended when the
+/// buffer is full, and control passes directly between the two coroutines
+/// without going through the scheduler or allocating, except that the
+/// reactor is given a chance to run other tasks when the task quota is
+/// exhausted. If the producer has to wait for a future, the elements it has
+/// buffered so far are handed to the consumer meanwhile.
+///
+/// Example
+///
+/// ```
+/// seastar::coroutine::generator<int> numbers(int n) {
+///     for (int i = 0; i < n; ++i) {
+///         co_yield i;
+///     }
+/// }
+///
+/// seastar::future<int> sum() {
+///     int acc = 0;
+///     auto gen = numbers(100);
+///     while (auto v = co_await gen()) {
+///         acc += *v;
+///     }
+///     co_return acc;
+/// }
+/// ```
+///
+/// \tparam T the type of the elements, which must be nothrow move constructible
+/// \tparam BufferSize how many elements the producer can run ahead of the
+///         consumer; a power of two
+template <typename T, size_t BufferSize = 16>
+class [[nodiscard]] generator {
+public:
+    using promise_type = internal::generator_promise<T, BufferSize>;
+private:
+    using handle_type = SEASTAR_INTERNAL_COROUTINE_NAMESPACE::coroutine_handle<promise_type>;
+    handle_type _handle;
+
+    struct next_awaiter {
+        promise_type& _p;
+        bool await_ready() const noexcept {
+            return !_p._buffer.empty() || _p._finished;
+        }
+        internal::coroutine_handle_t await_suspend(internal::coroutine_handle_t consumer) noexcept {
+            _p._consumer = consumer;
+            if (!_p._parked) {
+                // Waiting for a future; it will resume the consumer when it yields
+                return SEASTAR_INTERNAL_COROUTINE_NAMESPACE::noop_coroutine();
+            }
+            if (need_preempt()) {
+                schedule(&_p);
+                return SEASTAR_INTERNAL_COROUTINE_NAMESPACE::noop_coroutine();
+            }
+            _p._parked = false;
+            return _p.handle();
+        }
+        std::optional<T> await_resume() {
+            if (!_p._buffer.empty()) {
+                std::optional<T> ret(std::move(_p._buffer.front()));
+                _p._buffer.pop_front();
+                return ret;
+            }
+            if (_p._ex) {
+                std::rethrow_exception(std::exchange(_p._ex, nullptr));
+            }
+            return std::nullopt;
+        }
+    };
+
+    explicit generator(handle_type handle) noexcept : _handle(handle) {}
+    friend promise_type;
+    void release() noexcept {
+        if (!_handle) {
+            return;
+        }
+        auto& p = _handle.promise();
+        if (p._parked || p._finished) {
+            _handle.destroy();
+        } else {
+            p._abandoned = true;
+        }
+        _handle = nullptr;
+    }
+public:
+    generator(generator&& x) noexcept : _handle(std::exchange(x._handle, nullptr)) {}
+    generator& operator=(generator&& x) noexcept {
+        if (this != &x) {
+            release();
+            _handle = std::exchange(x._handle, nullptr);
+        }
+        return *this;
+    }
+    generator(const generator&) = delete;
+    ~generator() {
+        release();
+    }
+
+    /// Returns an awaitable for the next element, or for a disengaged
+    /// optional at the end of the sequence.
+    ///
+    /// The generator must not be called again until the returned awaitable
+    /// is resumed. It may be destroyed before the end of the sequence; if the
+    /// producer is waiting for a future then, it is destroyed once it next
+    /// yields.
+    next_awaiter operator()() noexcept {
+        return next_awaiter{_handle.promise()};
+    }
+};
+
+template <typename T, size_t BufferSize>
+inline
+generator<T, BufferSize>
+internal::generator_promise<T, BufferSize>::get_return_object() noexcept {
+    return generator<T, BufferSize>(handle());
+}
+
+}
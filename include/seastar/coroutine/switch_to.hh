@@ -73,6 +73,7 @@ struct [[nodiscard("must co_await a switch_to object")]] switch_to final : task
     void await_suspend(SEASTAR_INTERNAL_COROUTINE_NAMESPACE::coroutine_handle<T> hndl) noexcept {
         auto& t = hndl.promise();
         t.set_scheduling_group(_switch_to_sg);
+        t.inherit_task_local_values();
         _task = &t;
         schedule(_task);
     }
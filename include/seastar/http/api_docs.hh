@@ -127,8 +127,13 @@ class api_registry : public api_registry_base {
 
     future<std::unique_ptr<reply>> handle(const sstring& path,
             std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
-        rep->_content = json::formatter::to_json(_docs);
-        rep->done("json");
+        rep->write_body("json", [this] (output_stream<char>&& os) {
+            return do_with(std::move(os), [this] (output_stream<char>& os) {
+                return json::formatter::write(os, _docs).then([&os] {
+                    return os.close();
+                });
+            });
+        });
         return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
     }
 
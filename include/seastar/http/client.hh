@@ -0,0 +1,246 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/net/api.hh>
+#include <seastar/http/request.hh>
+#include <seastar/http/reply.hh>
+#include <seastar/http/response_parser.hh>
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/condition-variable.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/util/noncopyable_function.hh>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace seastar {
+
+namespace tls { class certificate_credentials; }
+
+namespace http {
+
+namespace experimental {
+
+/**
+ * \brief Handles the response to a request made by client or connection
+ *
+ * The handler gets the response status line and headers, and the stream with
+ * the response body. It should read the body till eof; otherwise the
+ * connection can't be reused and is closed. The stream must not be closed
+ * by the handler, that is done for it.
+ */
+using reply_handler = noncopyable_function<future<>(const httpd::reply&, input_stream<char>& body)>;
+
+/**
+ * \brief Thrown when a response doesn't have the expected status
+ */
+class unexpected_status_error : public std::runtime_error {
+    httpd::reply::status_type _status;
+public:
+    explicit unexpected_status_error(httpd::reply::status_type st);
+    httpd::reply::status_type status() const noexcept {
+        return _status;
+    }
+};
+
+/**
+ * \brief A single HTTP/1.1 connection to a server
+ *
+ * Requests may be made concurrently, in which case they are pipelined: each
+ * is sent as soon as the one before it has been, and the responses are
+ * handled in the same order. A request keeps the connection to itself from
+ * when its response starts arriving until its handler finishes.
+ *
+ * Aborting a request (see make_request()) shuts the connection down, which
+ * also fails the requests pipelined with it.
+ */
+class connection {
+    connected_socket _fd;
+    input_stream<char> _read_buf;
+    output_stream<char> _write_buf;
+    http_response_parser _parser;
+    // Serialize sending requests and receiving responses, respectively.
+    // Waiters are woken in order, so responses are read in the order their
+    // requests were sent in.
+    semaphore _send_sem{1};
+    semaphore _recv_sem{1};
+    unsigned _in_flight = 0;
+    bool _persistent = true;
+
+    future<> send_request(httpd::request& req);
+    future<> recv_reply(const httpd::request& req, reply_handler& handle, std::optional<httpd::reply::status_type> expected);
+    future<std::unique_ptr<httpd::reply>> recv_reply_head();
+    input_stream<char> make_body_stream(const httpd::request& req, const httpd::reply& rep,
+            std::unordered_map<sstring, sstring>& chunk_extensions, std::unordered_map<sstring, sstring>& trailing_headers);
+    void shutdown() noexcept;
+    // Expects _in_flight to have been incremented for the request
+    future<> do_make_request(httpd::request req, reply_handler handle, std::optional<httpd::reply::status_type> expected, abort_source* as);
+
+    friend class client;
+public:
+    /**
+     * \brief Create a connection over an already connected socket
+     */
+    explicit connection(connected_socket&& fd);
+
+    /**
+     * \brief Send a request and handle its response
+     *
+     * \param req the request; a Host header is required
+     * \param handle the response handler, see \ref reply_handler
+     * \param expected if set, a response with another status fails with
+     *        \ref unexpected_status_error instead of being handled
+     * \param as if set, aborting it fails the request with
+     *        abort_requested_exception. Use with a timer for timeouts.
+     */
+    future<> make_request(httpd::request req, reply_handler handle,
+            std::optional<httpd::reply::status_type> expected = httpd::reply::status_type::ok, abort_source* as = nullptr);
+
+    /**
+     * \brief Number of requests sent, or waiting to be sent, on the connection
+     */
+    unsigned in_flight() const noexcept {
+        return _in_flight;
+    }
+
+    /**
+     * \brief Whether more requests may be sent on the connection
+     *
+     * This is false once the server asked for the connection to be closed, a
+     * response body was not read to its end, or an error happened.
+     */
+    bool persistent() const noexcept {
+        return _persistent;
+    }
+
+    /**
+     * \brief Close the connection
+     *
+     * Requests still in flight fail.
+     */
+    future<> close();
+};
+
+/**
+ * \brief Opens the connections for a client
+ */
+class connection_factory {
+public:
+    virtual ~connection_factory() = default;
+    virtual future<connected_socket> make() = 0;
+};
+
+/**
+ * \brief Configuration of a \ref client
+ */
+struct client_config {
+    /// The maximum number of connections the client keeps open
+    unsigned max_connections = 100;
+    /// The maximum number of requests in flight on a connection; 1
+    /// disables pipelining
+    unsigned max_pipeline_depth = 1;
+};
+
+/**
+ * \brief A pool of keep-alive connections to one HTTP server
+ *
+ * Requests are sent over an idle connection if there is one, or else over a
+ * newly opened one, up to a limit. Past that, they are pipelined behind the
+ * requests already in flight on the least loaded connection, up to a depth,
+ * and otherwise wait for one to become available.
+ *
+ * Like the rest of seastar, a client belongs to a shard. To reuse
+ * connections across a service's outbound calls, keep one client per server
+ * on each shard, e.g. in a sharded<> service.
+ */
+class client {
+public:
+    using config = client_config;
+private:
+    std::unique_ptr<connection_factory> _new_connections;
+    sstring _host;
+    config _cfg;
+    std::vector<lw_shared_ptr<connection>> _connections;
+    unsigned _nr_connections = 0; // including the ones being opened
+    condition_variable _wait_con;
+    gate _gate;
+
+    // Returns a connection with the request already accounted in its in_flight()
+    future<lw_shared_ptr<connection>> get_connection(abort_source* as);
+    future<> put_connection(lw_shared_ptr<connection> con);
+public:
+    /**
+     * \brief Create a client connecting to a server with plain TCP
+     *
+     * \param addr the server address
+     * \param host the Host header of requests that don't have one
+     */
+    explicit client(socket_address addr, sstring host = "", config cfg = {});
+
+    /**
+     * \brief Create a client connecting to a server with TLS
+     *
+     * \param addr the server address
+     * \param creds the credentials to verify the server with
+     * \param host the server name, for verification and SNI, and the Host header of
+     *        requests that don't have one
+     */
+    client(socket_address addr, shared_ptr<tls::certificate_credentials> creds, sstring host, config cfg = {});
+
+    /**
+     * \brief Create a client opening connections with a custom factory
+     */
+    explicit client(std::unique_ptr<connection_factory> f, sstring host = "", config cfg = {});
+
+    client(client&&) = delete;
+    ~client();
+
+    /**
+     * \brief Send a request and handle its response
+     *
+     * See connection::make_request(). The connection is returned to the pool
+     * once the handler is done with the response.
+     */
+    future<> make_request(httpd::request req, reply_handler handle,
+            std::optional<httpd::reply::status_type> expected = httpd::reply::status_type::ok, abort_source* as = nullptr);
+
+    /**
+     * \brief Wait for the requests in flight and close all connections
+     */
+    future<> close();
+
+    /**
+     * \brief Number of connections currently open, or being opened
+     */
+    unsigned connections_nr() const noexcept {
+        return _nr_connections;
+    }
+};
+
+} // namespace experimental
+
+} // namespace http
+
+}
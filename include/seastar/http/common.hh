@@ -69,6 +69,11 @@ enum operation_type {
  */
 operation_type str2type(const sstring& type);
 
+/**
+ * Translate the operation type to command name
+ */
+sstring type2str(operation_type type);
+
 }
 
 }
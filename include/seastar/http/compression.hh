@@ -0,0 +1,102 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/iostream.hh>
+#include <seastar/core/scheduling.hh>
+#include <seastar/core/sstring.hh>
+#include <string_view>
+#include <vector>
+
+namespace seastar {
+
+namespace httpd {
+
+class request;
+class reply;
+
+/**
+ * The content codings replies can be compressed with
+ */
+enum class content_encoding {
+    identity,
+    gzip,
+    deflate,
+    zstd,
+};
+
+/**
+ * The name of a content coding, as used in the Accept-Encoding
+ * and Content-Encoding headers
+ */
+std::string_view to_string(content_encoding e) noexcept;
+
+/**
+ * Choose the content coding of a reply
+ * @param accept_encoding the Accept-Encoding header of the request
+ * @param supported the codings to choose from, by order of preference
+ * @return the supported coding the client prefers, by its q-values first and
+ * the order of \c supported second, or identity if it accepts none of them
+ */
+content_encoding negotiate_content_encoding(std::string_view accept_encoding,
+        const std::vector<content_encoding>& supported);
+
+/**
+ * Make a stream that compresses what is written to it, and writes the
+ * result to another stream. Flushing the stream flushes the compressor
+ * too, so that the receiver can decompress all that was written so far,
+ * and closing it ends the compressed data and closes \c out.
+ * @param out the stream the compressed data is written to
+ * @param encoding the content coding, other than identity
+ * @param sg the scheduling group compression runs in
+ * @param buffer_size the size of the buffers compressed at a time
+ */
+output_stream<char> make_compressing_output_stream(output_stream<char>&& out,
+        content_encoding encoding, scheduling_group sg, size_t buffer_size = 8192);
+
+/**
+ * How an http_server compresses its replies
+ */
+struct compression_config {
+    /// The codings to use, by order of preference when the client
+    /// accepts several equally
+    std::vector<content_encoding> encodings = {
+        content_encoding::zstd, content_encoding::gzip, content_encoding::deflate };
+    /// Replies with a content smaller than this are sent as they are.
+    /// Replies written with a body writer are always compressed.
+    size_t min_size = 1024;
+    /// The scheduling group compression runs in, so that compressing large
+    /// replies can be given a share of its own
+    scheduling_group sg = default_scheduling_group();
+};
+
+/**
+ * Compress the body of a reply, which is done, with the given content coding.
+ * This sets the Content-Encoding of the reply, and it is sent with chunked
+ * transfer encoding, as its compressed size is not known in advance.
+ * @param sg the scheduling group compression runs in
+ */
+void compress_reply(reply& rep, content_encoding encoding, scheduling_group sg);
+
+}
+
+}
@@ -22,7 +22,9 @@
 #pragma once
 
 #include <seastar/http/handlers.hh>
+#include <seastar/http/compression.hh>
 #include <seastar/core/iostream.hh>
+#include <memory>
 
 namespace seastar {
 
@@ -62,10 +64,7 @@ class file_transformer {
  */
 class file_interaction_handler : public handler_base {
 public:
-    file_interaction_handler(file_transformer* p = nullptr)
-            : transformer(p) {
-
-    }
+    file_interaction_handler(file_transformer* p = nullptr);
 
     ~file_interaction_handler();
 
@@ -79,6 +78,28 @@ class file_interaction_handler : public handler_base {
         return this;
     }
 
+    /**
+     * Keep the content of small files in memory, and reply with it for as
+     * long as the file's modification time and size stay the same.
+     * The cache belongs to the handler, so to the shard it runs on.
+     * @param max_file_size the largest file to cache
+     * @param max_total_size the memory the cached files may take, the least
+     * recently used ones are dropped beyond it
+     * @return this
+     */
+    file_interaction_handler* set_cache(size_t max_file_size, size_t max_total_size);
+
+    /**
+     * Serve pre-compressed variants of files, when the client accepts
+     * their coding: file.gz for gzip and file.zst for zstd, next to
+     * the file itself. Variants are not used with a transformer.
+     * @param encodings the codings to look for, by order of preference
+     * when the client accepts several equally
+     * @return this
+     */
+    file_interaction_handler* set_precompressed(std::vector<content_encoding> encodings = {
+            content_encoding::zstd, content_encoding::gzip });
+
     /**
      * if the url ends without a slash redirect
      * @param req the request
@@ -98,6 +119,8 @@ class file_interaction_handler : public handler_base {
 
     /**
      * read a file from the disk and return it in the replay.
+     * Without a transformer, the reply has a Content-Length and the file
+     * content is passed on to the connection without being copied.
      * @param file the full path to a file on the disk
      * @param req the reuest
      * @param rep the reply
@@ -108,6 +131,19 @@ class file_interaction_handler : public handler_base {
 
     output_stream<char> get_stream(std::unique_ptr<request> req,
             const sstring& extension, output_stream<char>&& s);
+
+private:
+    class content_cache;
+    std::unique_ptr<content_cache> _cache;
+    std::vector<content_encoding> _precompressed;
+
+    future<std::unique_ptr<reply>> read_precompressed(sstring file_name, sstring accept_encoding,
+            std::vector<content_encoding> encodings, std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+    future<std::unique_ptr<reply>> read_file(sstring file_name, sstring extension,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+
+    void write_content(temporary_buffer<char> content, std::unique_ptr<request> req,
+            const sstring& extension, reply& rep);
 };
 
 /**
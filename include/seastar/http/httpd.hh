@@ -31,6 +31,7 @@
 #include <seastar/core/queue.hh>
 #include <seastar/core/gate.hh>
 #include <seastar/core/metrics_registration.hh>
+#include <seastar/core/semaphore.hh>
 #include <seastar/util/std-compat.hh>
 #include <iostream>
 #include <algorithm>
@@ -42,6 +43,7 @@
 #include <vector>
 #include <boost/intrusive/list.hpp>
 #include <seastar/http/routes.hh>
+#include <seastar/http/compression.hh>
 #include <seastar/net/tls.hh>
 #include <seastar/core/shared_ptr.hh>
 
@@ -52,6 +54,7 @@ namespace httpd {
 class http_server;
 class http_stats;
 struct reply;
+class http2_connection;
 
 using namespace std::chrono_literals;
 
@@ -61,6 +64,36 @@ class http_stats {
     http_stats(http_server& server, const sstring& name);
 };
 
+/**
+ * How an http_server sheds load. Requests which would take it over the
+ * limits are answered with 503 Service Unavailable once their head is
+ * read, before their body is, and their connection is closed.
+ */
+struct admission_config {
+    /// Connections accepted beyond this many are only served requests
+    /// to the priority paths
+    size_t max_connections = std::numeric_limits<size_t>::max();
+    /// The number of requests read or handled at a time
+    size_t max_requests = std::numeric_limits<size_t>::max();
+    /// The memory, in bytes, the bodies of the requests read or handled at
+    /// a time may take, by their Content-Length. Chunked bodies, whose size
+    /// is not known in advance, are limited by the content length limit only.
+    size_t max_request_memory = std::numeric_limits<size_t>::max();
+    /// Requests to these paths, e.g. health checks, are admitted in a lane
+    /// of their own, so they are served even when the server sheds load
+    std::vector<sstring> priority_paths;
+    /// The number of requests to the priority paths handled at a time
+    size_t max_priority_requests = 16;
+};
+
+/**
+ * What an admitted request holds until it is handled
+ */
+struct admission_permit {
+    semaphore_units<> requests;
+    semaphore_units<> memory;
+};
+
 class connection : public boost::intrusive::list_base_hook<> {
     http_server& _server;
     connected_socket _fd;
@@ -71,9 +104,14 @@ class connection : public boost::intrusive::list_base_hook<> {
     http_request_parser _parser;
     std::unique_ptr<request> _req;
     std::unique_ptr<reply> _resp;
-    // null element marks eof
-    queue<std::unique_ptr<reply>> _replies { 10 };
+    // The replies in request order, still being generated for pipelined
+    // requests; null element marks eof
+    queue<future<std::unique_ptr<reply>>> _replies { 10 };
     bool _done = false;
+    // The HTTP/2 connection preface is only valid at the start
+    bool _first_request = true;
+    // Accepted beyond the admission connection limit
+    bool _over_connection_limit = false;
 public:
     connection(http_server& server, connected_socket&& fd,
             socket_address addr)
@@ -90,6 +128,8 @@ class connection : public boost::intrusive::list_base_hook<> {
     future<> read_one();
     future<> respond();
     future<> do_response_loop();
+    future<> drain_replies();
+    future<> flush_unless_more_ready();
 
     void set_headers(reply& resp);
 
@@ -120,12 +160,21 @@ class connection : public boost::intrusive::list_base_hook<> {
      */
     static sstring set_query_param(request& req);
 
-    future<bool> generate_reply(std::unique_ptr<request> req);
-    void generate_error_reply_and_close(std::unique_ptr<request> req, reply::status_type status, const sstring& msg);
+    /**
+     * Starts handling a request, returning its reply and whether the
+     * connection is to be closed after it
+     */
+    std::pair<future<std::unique_ptr<reply>>, bool> generate_reply(std::unique_ptr<request> req);
+    future<> generate_error_reply_and_close(std::unique_ptr<request> req, reply::status_type status, const sstring& msg);
 
     future<> write_body();
 
     output_stream<char>& out();
+private:
+    // Serves the rest of the connection as HTTP/2, once the client sent
+    // the connection preface
+    future<> serve_http2();
+    friend class http2_connection;
 };
 
 class http_server_tester;
@@ -138,11 +187,18 @@ class http_server {
     uint64_t _requests_served = 0;
     uint64_t _read_errors = 0;
     uint64_t _respond_errors = 0;
+    uint64_t _requests_shed = 0;
     shared_ptr<seastar::tls::server_credentials> _credentials;
     sstring _date = http_date();
     timer<> _date_format_timer { [this] {_date = http_date();} };
     size_t _content_length_limit = std::numeric_limits<size_t>::max();
     bool _content_streaming = false;
+    size_t _pipeline_depth = 10;
+    std::optional<compression_config> _compression;
+    std::optional<admission_config> _admission;
+    semaphore _admitted_requests{0};
+    semaphore _admitted_memory{0};
+    semaphore _admitted_priority_requests{0};
     gate _task_gate;
 public:
     routes _routes;
@@ -175,6 +231,10 @@ class http_server {
             return make_ready_future<>();
         }).get();
      *
+     * Clients negotiate HTTP/2 over TLS with ALPN, so to offer it add
+     * creds->set_alpn_protocols({"h2", "http/1.1"}) to the above.
+     * Plain connections may start HTTP/2 with prior knowledge at any time.
+     *
      */
     void set_tls_credentials(shared_ptr<seastar::tls::server_credentials> credentials);
 
@@ -186,6 +246,39 @@ class http_server {
 
     void set_content_streaming(bool b);
 
+    size_t get_pipeline_depth() const;
+
+    /*!
+     * \brief set how many requests of a connection may be in progress
+     *
+     * Requests that a client sends without waiting for the replies to the
+     * previous ones are read and handled concurrently, up to this many of
+     * them, 10 by default. Their replies are still written in order, the
+     * ones that are ready together. Requests are pipelined only when
+     * content streaming is off, as their bodies are read before they are
+     * handled.
+     */
+    void set_pipeline_depth(size_t depth);
+
+    /*!
+     * \brief compress replies for the clients that accept it
+     *
+     * Replies are compressed with the coding the request's Accept-Encoding
+     * prefers, if their content type is textual (text, json, javascript,
+     * xml and svg) and they don't have a Content-Encoding already, e.g.
+     * because they are a pre-compressed file.
+     */
+    void set_compression(compression_config cfg);
+
+    /*!
+     * \brief limit the connections and requests the server takes at a time
+     *
+     * Requests over the limits are answered with 503 Service Unavailable,
+     * see admission_config. The limits can be changed while serving, and
+     * apply to the requests and connections that come next.
+     */
+    void set_admission_control(admission_config cfg);
+
     future<> listen(socket_address addr, listen_options lo);
     future<> listen(socket_address addr);
     future<> stop();
@@ -197,13 +290,20 @@ class http_server {
     uint64_t requests_served() const;
     uint64_t read_errors() const;
     uint64_t reply_errors() const;
+    uint64_t requests_shed() const;
     // Write the current date in the specific "preferred format" defined in
     // RFC 7231, Section 7.1.1.1.
     static sstring http_date();
 private:
     future<> do_accept_one(int which);
+    // Compresses a reply which is done, as set with set_compression()
+    void compress(reply& rep, std::string_view accept_encoding) const;
+    // Admits a request whose head was read, as set with set_admission_control(),
+    // or returns nothing if it is to be shed
+    std::optional<admission_permit> admit(const request& req, bool over_connection_limit);
     boost::intrusive::list<connection> _connections;
     friend class seastar::httpd::connection;
+    friend class http2_connection;
     friend class http_server_tester;
 };
 
@@ -238,6 +338,12 @@ class http_server_control {
     future<> start(const sstring& name = generate_server_name());
     future<> stop();
     future<> set_routes(std::function<void(routes& r)> fun);
+    /**
+     * Fill a single routes table on this shard and have the servers of
+     * all shards dispatch through it, see routes::set_shared(). Calling it
+     * again swaps the table for a new one.
+     */
+    future<> set_shared_routes(std::function<void(routes& r)> fun);
     future<> listen(socket_address addr);
     future<> listen(socket_address addr, listen_options lo);
     distributed<http_server>& server();
@@ -221,6 +221,19 @@ class chunked_source_impl : public data_source_impl {
     }
 };
 
+/*
+ * An output_stream that encodes the data written to it as chunks
+ * on "out". Closing it doesn't write the terminating last-chunk.
+ * */
+output_stream<char> make_http_chunked_output_stream(output_stream<char>& out);
+
+/*
+ * An output_stream that passes exactly "length" bytes through to "out",
+ * used to send bodies with a Content-Length. Writing more, or closing it
+ * before "length" bytes were written, fails.
+ * */
+output_stream<char> make_http_content_length_output_stream(output_stream<char>& out, size_t length);
+
 } // namespace internal
 
 } // namespace httpd
@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/sstring.hh>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace seastar {
+
+namespace httpd {
+
+namespace internal {
+
+// HPACK header compression for HTTP/2, see RFC 7541
+
+class hpack_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+using header_list = std::vector<std::pair<sstring, sstring>>;
+
+/*
+ * Decodes the header blocks received on a connection. The dynamic table
+ * is shared by all the blocks, so they have to be decoded in the order
+ * they arrive, and a block which fails to decode leaves the decoder
+ * unusable: the connection has to be torn down.
+ */
+class hpack_decoder {
+    // Newest entry first
+    std::deque<std::pair<sstring, sstring>> _table;
+    size_t _table_size = 0;
+    size_t _max_table_size;
+    // As advertised in SETTINGS_HEADER_TABLE_SIZE
+    size_t _table_size_limit;
+public:
+    explicit hpack_decoder(size_t table_size_limit = 4096);
+
+    // Throws hpack_error if the block is malformed
+    header_list decode(std::string_view block);
+
+    size_t table_size() const noexcept {
+        return _table_size;
+    }
+private:
+    const std::pair<sstring, sstring>& lookup(size_t index) const;
+    void insert(sstring name, sstring value);
+    void evict(size_t max_size);
+};
+
+/*
+ * Encodes header blocks without ever inserting into the dynamic table:
+ * fields are sent as static table references or literals, so the
+ * encoder has no state and blocks can be produced in any order.
+ */
+class hpack_encoder {
+public:
+    // Appends the representation of a field to a block. name has to be
+    // lowercase, as HTTP/2 requires.
+    void encode(std::string& block, std::string_view name, std::string_view value) const;
+};
+
+// Exposed for testing
+void huffman_encode(std::string& out, std::string_view in);
+sstring huffman_decode(std::string_view in);
+
+}
+
+}
+
+}
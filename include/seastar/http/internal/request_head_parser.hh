@@ -0,0 +1,49 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+namespace seastar {
+
+namespace httpd {
+struct request;
+}
+
+// Declared outside of httpd::internal: request_parser.hh has a
+// "using namespace httpd", which would make seastar::internal ambiguous
+// for everything included after it.
+namespace internal {
+
+/*
+ * Fast path of http_request_parser for a request head that is contained
+ * in [p, pe) in its entirety. The head is scanned a vector at a time rather
+ * than a byte at a time, and stored in req.
+ *
+ * Returns the position following the empty line which terminates the head.
+ * Returns nullptr, leaving req untouched, when the head is incomplete or uses
+ * something the fast path does not handle (obs-fold, malformed input): the
+ * caller must then parse it with the state machine, which handles all cases.
+ */
+const char* parse_http_request_head(const char* p, const char* pe, httpd::request& req);
+
+}
+
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/http/httpd.hh>
+
+namespace seastar {
+
+namespace httpd {
+
+/// \brief Adds a GET endpoint serving memory diagnostics
+///
+/// It returns, as text, the report of
+/// \ref memory::generate_memory_diagnostics_report(): memory usage, the
+/// largest free span, the utilization of the small pools and the free
+/// spans by size. The report is of the shard given by the \c shard query
+/// parameter, by default of the shard handling the request.
+///
+/// \param server the server to add the endpoint to
+/// \param path the path of the endpoint
+future<> add_memory_diagnostics_routes(http_server& server, sstring path = "/memory");
+
+}
+
+}
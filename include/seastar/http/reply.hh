@@ -32,8 +32,11 @@
 #pragma once
 
 #include <seastar/core/sstring.hh>
+#include <chrono>
+#include <optional>
 #include <unordered_map>
 #include <seastar/http/mime_types.hh>
+#include <seastar/http/compression.hh>
 #include <seastar/core/iostream.hh>
 #include <seastar/util/noncopyable_function.hh>
 
@@ -43,6 +46,7 @@ namespace httpd {
 
 class connection;
 class routes;
+struct route_stats;
 
 /**
  * A reply to be sent to a client.
@@ -173,11 +177,25 @@ struct reply {
      *   is done.
      *
      * Message would use chunked transfer encoding in the reply.
+     * Each write to the stream waits for the connection to take in the data,
+     * so a large body is produced no faster than the client reads it, and is
+     * never held in memory as a whole. Use json::formatter::write() or
+     * json::stream_object() to stream json this way.
      *
      */
 
     void write_body(const sstring& content_type, noncopyable_function<future<>(output_stream<char>&&)>&& body_writer);
 
+    /*!
+     * \brief use an output stream to write a message body of a known length
+     *
+     * Same as above, but the reply has a Content-Length header instead of chunked transfer
+     * encoding, and the body writer must write exactly \c len bytes.
+     * Buffers written to the stream as temporary_buffer are passed on to the connection
+     * without being copied.
+     */
+    void write_body(const sstring& content_type, size_t len, noncopyable_function<future<>(output_stream<char>&&)>&& body_writer);
+
     /*!
      * \brief Write a string as the reply
      *
@@ -194,8 +212,16 @@ struct reply {
     future<> write_reply_headers(connection& connection);
 
     noncopyable_function<future<>(output_stream<char>&&)> _body_writer;
+    std::optional<size_t> _body_length;
+    // The metrics of the route that handled the request, if enabled,
+    // and when its handler was done
+    route_stats* _route_stats = nullptr;
+    std::chrono::steady_clock::time_point _handled_at;
     friend class routes;
     friend class connection;
+    friend class http2_connection;
+    friend class http_server;
+    friend void compress_reply(reply& rep, content_encoding encoding, scheduling_group sg);
 };
 
 } // namespace httpd
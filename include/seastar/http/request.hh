@@ -36,7 +36,9 @@
 #include <vector>
 #include <strings.h>
 #include <seastar/http/common.hh>
+#include <seastar/http/mime_types.hh>
 #include <seastar/core/iostream.hh>
+#include <seastar/util/noncopyable_function.hh>
 
 namespace seastar {
 
@@ -44,7 +46,7 @@ namespace httpd {
 class connection;
 
 /**
- * A request received from a client.
+ * A request received from a client, or to be sent by http::experimental::client.
  */
 struct request {
     enum class ctclass
@@ -54,14 +56,13 @@ struct request {
 
     struct case_insensitive_cmp {
         bool operator()(const sstring& s1, const sstring& s2) const {
-            return std::equal(s1.begin(), s1.end(), s2.begin(), s2.end(),
-                    [](char a, char b) { return ::tolower(a) == ::tolower(b); });
+            return ascii_iequals(s1, s2);
         }
     };
 
     struct case_insensitive_hash {
         size_t operator()(sstring s) const {
-            std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+            ascii_to_lower(s.data(), s.size());
             return std::hash<sstring>()(s);
         }
     };
@@ -137,6 +138,71 @@ struct request {
         return content_type_class == ctclass::app_x_www_urlencoded;
     }
 
+    /**
+     * Create a request to be sent by http::experimental::client
+     * @param method the request method, e.g. "GET"
+     * @param host the value of the Host header
+     * @param path the request target, including the query string if any
+     */
+    static request make(sstring method, sstring host, sstring path) {
+        request req;
+        req._method = std::move(method);
+        req._url = std::move(path);
+        req._version = "1.1";
+        req._headers["Host"] = std::move(host);
+        return req;
+    }
+
+    /*!
+     * \brief Set a string as the body of an outgoing request
+     *
+     * \param content_type - is used to choose the content type of the body. Use the file extension
+     *  you would have used for such a content, (i.e. "txt", "html", "json", etc')
+     * \param content - the message content
+     */
+    void write_body(const sstring& content_type, sstring content) {
+        set_content_type(content_type);
+        content_length = content.size();
+        this->content = std::move(content);
+    }
+
+    /*!
+     * \brief use an output stream to write the body of an outgoing request
+     *
+     * \param content_type - as above
+     * \param body_writer - a function that accepts an output stream and uses that stream to write the body.
+     *   The function should take ownership of the stream while using it and must close the stream when it
+     *   is done.
+     *
+     * The body is sent with chunked transfer encoding.
+     */
+    void write_body(const sstring& content_type, noncopyable_function<future<>(output_stream<char>&&)>&& body_writer) {
+        set_content_type(content_type);
+        content_length = 0;
+        this->body_writer = std::move(body_writer);
+    }
+
+    /*!
+     * \brief use an output stream to write a body of a known length
+     *
+     * Same as above, but the body is sent with a Content-Length header, and the
+     * writer must write exactly \c len bytes.
+     */
+    void write_body(const sstring& content_type, size_t len, noncopyable_function<future<>(output_stream<char>&&)>&& body_writer) {
+        write_body(content_type, std::move(body_writer));
+        content_length = len;
+    }
+
+    /*
+     * Writes the body of an outgoing request, if set with write_body(); the
+     * body is then either chunked or, if content_length is set, of that length.
+     */
+    noncopyable_function<future<>(output_stream<char>&&)> body_writer;
+
+private:
+    void set_content_type(const sstring& content_type) {
+        _headers["Content-Type"] = mime_types::extension_to_type(content_type);
+    }
 };
 
 } // namespace httpd
@@ -25,8 +25,14 @@
 #include <seastar/http/handlers.hh>
 #include <seastar/http/common.hh>
 #include <seastar/http/reply.hh>
+#include <seastar/core/metrics_registration.hh>
+#include <seastar/core/metrics_histogram.hh>
+#include <seastar/core/sharded.hh>
 
 #include <boost/program_options/variables_map.hpp>
+#include <array>
+#include <chrono>
+#include <memory>
 #include <unordered_map>
 
 namespace seastar {
@@ -67,15 +73,51 @@ class url {
 
 struct path_description;
 
+/**
+ * A latency distribution, in microseconds, reported with power of two buckets
+ */
+class latency_histogram {
+    metrics::log_linear_histogram<> _histogram;
+public:
+    void add(std::chrono::steady_clock::duration latency) noexcept;
+    metrics::histogram get() const;
+};
+
+/**
+ * The metrics of the requests of a method that a route handles
+ */
+struct route_stats {
+    /// from the handler being done to the reply starting to be written,
+    /// which is the time it waits behind earlier replies on its connection
+    latency_histogram queue_time;
+    /// from the request being routed to its handler being done
+    latency_histogram handler_time;
+    /// from the reply starting to be written to it being flushed
+    latency_histogram write_time;
+    uint64_t in_flight = 0;
+    metrics::metric_groups metrics;
+};
+
 /**
  * routes object do the request dispatching according to the url.
  * It uses two decision mechanism exact match, if a url matches exactly
  * (an optional leading slash is permitted) it is choosen
  * If not, the matching rules are used.
  * matching rules are evaluated by their insertion order
+ *
+ * Rules made of str_matcher and param_matcher, which are all the rules
+ * added with url and path_description, are kept in a trie over the url
+ * path segments, so finding the matching rule doesn't depend on the
+ * number of rules. Other rules are tried one by one.
+ *
+ * Instead of its own rules, a routes object can dispatch through a
+ * shared table, see set_shared().
  */
 class routes {
 public:
+    /// A routes object built once and used by the routes of all shards
+    using shared_table = foreign_ptr<seastar::shared_ptr<const routes>>;
+
     /**
      * The destructor deletes the match rules and handlers
      */
@@ -101,12 +143,13 @@ class routes {
      * rules are search only if an exact match was not found.
      * rules are search by the order they were added.
      * First in higher priority
+     * The rule should not be modified after it was added.
      * @param rule a rule to add
      * @param type the operation type
      * @return it self
      */
     routes& add(match_rule* rule, operation_type type = GET) {
-        _rules[type][_rover++] = rule;
+        add_cookie(rule, type);
         return *this;
     }
 
@@ -134,6 +177,8 @@ class routes {
      * the method takes the headers from the request and find the
      * right handler.
      * It then call the handler with the parameters (if they exists) found in the url
+     * The handler runs in the trace context of the traceparent header, if
+     * there is one, see tracing::trace_context.
      * @param path the url path found
      * @param req the http request
      * @param rep the http reply
@@ -158,9 +203,52 @@ class routes {
      * @return a handler based on the type/url match
      */
     handler_base* get_handler(operation_type type, const sstring& url,
-            parameters& params);
+            parameters& params) const;
+
+    /**
+     * Dispatch through a shared table rather than through the handlers,
+     * rules and exception handlers of this object, which are left as they
+     * are. A table is built and filled once, then wrapped in a foreign_ptr
+     * and copied to each shard; see http_server_control::set_shared_routes().
+     * This saves building and keeping a copy of the handlers and of the
+     * rule trie on every shard.
+     *
+     * Handlers of a shared table are called on all shards, possibly at the
+     * same time, so they must keep no per shard state of their own; they
+     * can still reach it, e.g. with sharded<>::local(). The table itself
+     * should not have metrics enabled, metrics are kept by the routes of
+     * each shard.
+     *
+     * Setting a table replaces the previous one at once for new requests,
+     * while requests already being handled keep the previous one alive.
+     * An empty table goes back to the own handlers.
+     */
+    void set_shared(shared_table table);
+
+    /**
+     * Register latency histograms and an in flight gauge for the requests
+     * of each route and method, in the "httpd" metrics group. A route is
+     * labeled the way it was registered, e.g. "/api/{id}" for a url with a
+     * parameter, rather than by the urls it matches, so the number of
+     * metrics stays bounded. Requests no route matches are labeled
+     * "not_found", and those of the default handler "default".
+     * The metrics of a route are registered with its first request.
+     * @param service the service label of the metrics, as the http_server name
+     */
+    void enable_metrics(const sstring& service);
 
 private:
+    future<std::unique_ptr<reply>> do_handle(const sstring& path, std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+    future<std::unique_ptr<reply>> handle_with_stats(operation_type type, handler_base* handler, const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+    future<std::unique_ptr<reply>> call_handler(handler_base* handler, const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+
+    void add_label(operation_type type, const handler_base* handler, sstring label);
+    void drop_label(operation_type type, const handler_base* handler);
+    route_stats* get_route_stats(operation_type type, const handler_base* handler);
+    route_stats* make_route_stats(operation_type type, const sstring& name);
+
     /**
      * Normalize the url to remove the last / if exists
      * and get the parameter part
@@ -176,8 +264,21 @@ class routes {
 private:
     rule_cookie _rover = 0;
     std::map<rule_cookie, match_rule*> _rules[NUM_OPERATION];
+    class rule_trie;
+    std::unique_ptr<rule_trie> _trie;
     //default Handler -- for any HTTP Method and Path (/*)
     handler_base* _default_handler = nullptr;
+    // Held by the requests using it as well
+    seastar::shared_ptr<shared_table> _shared;
+
+    struct route_label {
+        sstring name;
+        route_stats* stats = nullptr;
+    };
+    std::optional<sstring> _metrics_service;
+    std::unordered_map<const handler_base*, route_label> _labels[NUM_OPERATION];
+    // Kept for as long as the routes, replies point to them
+    std::map<sstring, std::unique_ptr<route_stats>> _route_stats[NUM_OPERATION];
 public:
     using exception_handler_fun = std::function<std::unique_ptr<reply>(std::exception_ptr eptr)>;
     using exception_handler_id = size_t;
@@ -218,15 +319,12 @@ class routes {
 
     /**
      * Add a rule to be used.
+     * The rule should not be modified after it was added.
      * @param rule a rule to add
      * @param type the operation type
      * @return a cookie using which the rule can be removed
      */
-    rule_cookie add_cookie(match_rule* rule, operation_type type) {
-        auto pos = _rover++;
-        _rules[type][pos] = rule;
-        return pos;
-    }
+    rule_cookie add_cookie(match_rule* rule, operation_type type);
 
     /**
      * Del a rule by cookie
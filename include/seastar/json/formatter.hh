@@ -27,6 +27,7 @@
 #include <map>
 #include <time.h>
 #include <sstream>
+#include <type_traits>
 #include <seastar/core/loop.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/iostream.hh>
@@ -89,7 +90,7 @@ class formatter {
             });
         } else {
             return stream.write(to_json(p.first) + ":").then([&p, &stream] {
-                write(stream, p.second);
+                return write(stream, state::none, p.second);
             });
         }
     }
@@ -98,15 +99,14 @@ class formatter {
     static future<> write(output_stream<char>& stream, state s, Iter i, Iter e) {
         return do_with(true, [&stream, s, i, e] (bool& first) {
             return stream.write(begin(s)).then([&first, &stream, s, i, e] {
-                return do_for_each(i, e, [&first, &stream] (auto& m) {
+                return do_for_each(i, e, [&first, &stream, s] (auto& m) {
                     auto f = (first) ? make_ready_future<>() : stream.write(",");
                     first = false;
-                    return f.then([&m, &stream] {
-                        return write(stream, m);
+                    return f.then([&m, &stream, s] {
+                        return write(stream, s, m);
                     });
                 }).then([&stream, s] {
-                    // FIXME: future is discarded
-                    (void)stream.write(end(s));
+                    return stream.write(end(s));
                 });
             });
         });
@@ -115,7 +115,12 @@ class formatter {
     // fallback template
     template<typename T>
     static future<> write(output_stream<char>& stream, state, const T& t) {
-        return stream.write(to_json(t));
+        if constexpr (std::is_base_of_v<jsonable, T>) {
+            // Objects write themselves member by member
+            return t.write(stream);
+        } else {
+            return stream.write(to_json(t));
+        }
     }
 
 public:
@@ -233,9 +238,7 @@ class formatter {
      * @param str the string to format
      * @return the given string in a json format
      */
-    static future<> write(output_stream<char>& s, const sstring& str) {
-        return s.write(to_json(str));
-    }
+    static future<> write(output_stream<char>& s, const sstring& str);
 
     /**
      * return a json formatted int
@@ -278,9 +281,7 @@ class formatter {
      * @param str the char* to format
      * @return the given char* in a json format
      */
-    static future<> write(output_stream<char>& s, const char* str) {
-        return s.write(to_json(str));
-    }
+    static future<> write(output_stream<char>& s, const char* str);
 
     /**
      * return a json formatted bool
@@ -321,13 +322,10 @@ class formatter {
      }
 
     /**
-     * return a json formatted json object
-     * @param obj the date_time to format
-     * @return the given json object in a json format
+     * write a json object, as it is being formatted
+     * @param obj the json object to write
      */
-    static future<> write(output_stream<char>& s, const jsonable& obj) {
-      return s.write(to_json(obj));
-     }
+    static future<> write(output_stream<char>& s, const jsonable& obj);
 
     /**
      * return a json formatted unsigned long
@@ -283,6 +283,10 @@ struct json_void : public jsonable{
  * }
  *
  * would return a json formatted string: "hello" (rather then hello)
+ *
+ * A value is formatted into a string as a whole. Large values should rather
+ * be returned with stream_object() or stream_range_as_array(), which write
+ * them to the reply as they are formatted.
  */
 struct json_return_type {
     sstring _res;
@@ -0,0 +1,194 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <seastar/core/future.hh>
+#include <seastar/core/iostream.hh>
+#include <seastar/core/sstring.hh>
+
+namespace seastar {
+
+namespace json {
+
+/**
+ * A parsed json value: null, a boolean, a number, a string, an array
+ * or an object.
+ *
+ * Numbers that are integers and fit in 64 bits are kept exact, the
+ * others as doubles. Objects keep their members in document order.
+ */
+class value {
+public:
+    enum class type {
+        null, boolean, number, string, array, object
+    };
+    using array_type = std::vector<value>;
+    using object_type = std::vector<std::pair<sstring, value>>;
+private:
+    std::variant<std::monostate, bool, int64_t, double, sstring, array_type, object_type> _v;
+public:
+    value() noexcept = default;
+    explicit value(bool b) noexcept : _v(b) {}
+    explicit value(int64_t n) noexcept : _v(n) {}
+    explicit value(double d) noexcept : _v(d) {}
+    explicit value(sstring s) noexcept : _v(std::move(s)) {}
+    explicit value(array_type a) noexcept : _v(std::move(a)) {}
+    explicit value(object_type o) noexcept : _v(std::move(o)) {}
+
+    type get_type() const noexcept;
+
+    bool is_null() const noexcept {
+        return _v.index() == 0;
+    }
+    bool is_integer() const noexcept {
+        return std::holds_alternative<int64_t>(_v);
+    }
+
+    // The accessors throw std::bad_variant_access on the wrong type
+    bool as_bool() const {
+        return std::get<bool>(_v);
+    }
+    /// The number as an integer; throws for numbers that aren't one
+    int64_t as_int64() const {
+        return std::get<int64_t>(_v);
+    }
+    double as_double() const {
+        return is_integer() ? double(std::get<int64_t>(_v)) : std::get<double>(_v);
+    }
+    const sstring& as_string() const {
+        return std::get<sstring>(_v);
+    }
+    const array_type& as_array() const {
+        return std::get<array_type>(_v);
+    }
+    array_type& as_array() {
+        return std::get<array_type>(_v);
+    }
+    const object_type& as_object() const {
+        return std::get<object_type>(_v);
+    }
+    object_type& as_object() {
+        return std::get<object_type>(_v);
+    }
+
+    /// The first member of an object with the given name, or nullptr
+    const value* find(std::string_view name) const;
+
+    /// The first member of an object with the given name; throws
+    /// std::out_of_range if there is none
+    const value& operator[](std::string_view name) const;
+
+    const value& operator[](size_t i) const {
+        return as_array().at(i);
+    }
+};
+
+/// Thrown for malformed json, or json beyond the parser's limits
+class parse_error : public std::runtime_error {
+    uint64_t _offset;
+public:
+    parse_error(const std::string& msg, uint64_t offset);
+
+    /// The offset in the document of the error
+    uint64_t offset() const noexcept {
+        return _offset;
+    }
+};
+
+struct parse_options {
+    /// The deepest nesting of arrays and objects accepted
+    unsigned max_depth = 128;
+    /// The largest document accepted, in bytes
+    uint64_t max_size = uint64_t(64) << 20;
+};
+
+/**
+ * An incremental json parser.
+ *
+ * The document is fed in fragments of any size, split anywhere, such as
+ * the buffers of an http body, and is never copied into a contiguous
+ * buffer. Strings are scanned a word at a time for their end and for
+ * escapes, so their bulk is copied without looking at each byte.
+ *
+ * Strings are not checked to be valid UTF-8.
+ */
+class parser {
+    enum class state : uint8_t;
+    struct frame {
+        value container;
+        sstring key;
+    };
+
+    parse_options _opts;
+    state _state;
+    uint64_t _offset = 0;
+    std::vector<frame> _stack;
+    value _result;
+    // The string, number or literal being parsed
+    std::string _token;
+    bool _token_is_key = false;
+    // The literal being matched and how much of it was
+    std::string_view _literal;
+    size_t _literal_matched = 0;
+    // The escape being decoded, and the high half of a surrogate pair
+    uint32_t _escape = 0;
+    unsigned _escape_digits = 0;
+    uint32_t _high_surrogate = 0;
+
+    [[noreturn]] void fail(const char* what, const char* p, const char* begin) const;
+    void complete(value v, const char* p, const char* begin);
+    void complete_number(const char* p, const char* begin);
+    void append_code_point(uint32_t cp);
+    const char* parse_string(const char* p, const char* end, const char* begin);
+public:
+    explicit parser(parse_options opts = {});
+
+    /// Parses the next fragment of the document
+    void feed(std::string_view fragment);
+
+    /// Ends the document, returning its value
+    value finish();
+};
+
+/// Parses a complete document
+value parse(std::string_view json, parse_options opts = {});
+
+/**
+ * Parses the document read from a stream, such as the content_stream
+ * of an http request, as it arrives.
+ *
+ * Large buffers are parsed in slices, letting other tasks run in
+ * between. Fails with parse_error for malformed json, for an exhausted
+ * limit and for trailing data after the document.
+ */
+future<value> parse(input_stream<char>& in, parse_options opts = {});
+
+}
+
+}
@@ -74,6 +74,28 @@ struct sctp_keepalive_params {
 
 using keepalive_params = std::variant<tcp_keepalive_params, sctp_keepalive_params>;
 
+/// Round-trip time and retransmission statistics of a TCP connection, see
+/// \ref connected_socket::get_tcp_stats(). The fields follow linux tcp(7)
+/// TCP_INFO.
+struct tcp_connection_stats {
+    /// Smoothed round-trip time (tcpi_rtt)
+    std::chrono::microseconds srtt;
+    /// Round-trip time variation (tcpi_rttvar)
+    std::chrono::microseconds rttvar;
+    /// Retransmission timeout (tcpi_rto)
+    std::chrono::microseconds rto;
+    /// Congestion window, in bytes
+    uint32_t cwnd;
+    /// Bytes sent but not yet acknowledged
+    uint32_t unacked_bytes;
+    /// Bytes queued for sending but not yet sent. Together with \c srtt
+    /// and \c cwnd, this tells how long new writes wait before being sent.
+    uint32_t unsent_bytes;
+    /// Segments retransmitted over the lifetime of the connection
+    /// (tcpi_total_retrans)
+    uint32_t total_retransmits;
+};
+
 /// \cond internal
 class connected_socket_impl;
 class socket_impl;
@@ -117,8 +139,19 @@ class udp_channel {
     socket_address local_address() const;
 
     future<udp_datagram> receive();
+    /// Receives all the datagrams that are available, at least one.
+    ///
+    /// Stacks that can read several datagrams at once, like the posix stack
+    /// with recvmmsg() and UDP GRO, return them together.
+    future<std::vector<udp_datagram>> receive_batch();
     future<> send(const socket_address& dst, const char* msg);
     future<> send(const socket_address& dst, packet p);
+    /// Sends several datagrams to the same destination.
+    ///
+    /// Stacks that can send several datagrams at once, like the posix stack
+    /// with sendmmsg() and UDP GSO, do so. Datagrams of equal sizes are
+    /// the cheapest to send with GSO.
+    future<> send_batch(const socket_address& dst, std::vector<packet> datagrams);
     bool is_closed() const;
     /// Causes a pending receive() to complete (possibly with an exception)
     void shutdown_input();
@@ -158,6 +191,18 @@ struct connected_socket_input_stream_config final {
     unsigned max_buffer_size = 128 * 1024;
 };
 
+class file_desc;
+
+/// Data received by \ref connected_socket::receive_fds(), with the file
+/// descriptors sent along with it. Using the descriptors needs
+/// <seastar/core/posix.hh>.
+struct fd_message {
+    /// The data received; empty once the peer closed the connection
+    temporary_buffer<char> data;
+    /// The descriptors sent with the data, now of this process
+    std::vector<file_desc> fds;
+};
+
 /// A TCP (or other stream-based protocol) connection.
 ///
 /// A \c connected_socket represents a full-duplex stream between
@@ -206,11 +251,20 @@ class connected_socket {
     /// Sets custom socket options. Based on setsockopt function.
     /// Linux users should refer to protocol-specific manuals
     /// to see available options, e.g. tcp(7), ip(7), etc.
+    ///
+    /// On TCP sockets of the posix stack, setting SO_ZEROCOPY also makes
+    /// large writes transmit straight from the caller's buffers (MSG_ZEROCOPY),
+    /// which are then held until the kernel no longer needs them.
     void set_sockopt(int level, int optname, const void* data, size_t len);
     /// Gets custom socket options. Based on getsockopt function.
     /// Linux users should refer to protocol-specific manuals
     /// to see available options, e.g. tcp(7), ip(7), etc.
     int get_sockopt(int level, int optname, void* data, size_t len) const;
+    /// Gets the round-trip time and retransmission statistics of a TCP
+    /// connection, which are cheap enough to be sampled periodically.
+    ///
+    /// Throws if the connection is not a TCP one.
+    net::tcp_connection_stats get_tcp_stats() const;
     /// Local address of the socket
     socket_address local_address() const noexcept;
 
@@ -227,6 +281,34 @@ class connected_socket {
     /// This is useful to abort operations on a socket that is not making
     /// progress due to a peer failure.
     void shutdown_input();
+
+    /// Sends file descriptors to the peer of a unix domain socket.
+    ///
+    /// The descriptors are passed as SCM_RIGHTS along with \c data, which
+    /// may not be empty, and the peer's receive_fds() gets descriptors of
+    /// its own process for the same open sockets, pipes or files. A
+    /// front-end can so hand accepted connections over to a back-end
+    /// process (see dup_fd() and adopt_connected_socket()), with no proxy
+    /// copying their data, or pass a large payload in a memfd that the
+    /// peer maps instead of reading it through the socket.
+    ///
+    /// Data written to output() must be flushed first to be sent before.
+    /// Fails with ENOTSUP on sockets other than unix domain ones of the
+    /// posix stack.
+    future<> send_fds(temporary_buffer<char> data, std::vector<file_desc> fds);
+    /// Receives up to \c max_size bytes and the file descriptors sent with
+    /// them by the peer's send_fds().
+    ///
+    /// A socket receiving descriptors should only be read this way: data
+    /// read from input() drops the descriptors sent with it.
+    future<fd_message> receive_fds(size_t max_size = 4096);
+    /// Duplicates the file descriptor of the socket, for send_fds().
+    ///
+    /// The duplicate refers to the same connection: destroying this
+    /// socket leaves it open, but closing its output() stream shuts the
+    /// connection's sending side down for both.
+    /// Fails with ENOTSUP on sockets not of the posix stack.
+    file_desc dup_fd() const;
 };
 /// @}
 
@@ -295,6 +377,12 @@ class server_socket {
         port,
         // This algorithm distributes all new connections to listen_options::fixed_cpu shard only.
         fixed,
+        // This algorithm keeps each connection on the shard running on the cpu that received
+        // its packets (SO_INCOMING_CPU), so that it is handled where the network interrupts
+        // for its flow are steered. Best with thread affinity, and with the interrupts or
+        // RPS/RFS spread over the cpus of the shards. Connections received on other cpus
+        // are distributed like connection_distribution does.
+        incoming_cpu,
         default_ = connection_distribution
     };
     /// Constructs a \c server_socket not corresponding to a connection
@@ -24,6 +24,7 @@
 
 #include <seastar/net/net.hh>
 #include <seastar/core/byteorder.hh>
+#include <seastar/core/lowres_clock.hh>
 #include <seastar/net/ethernet.hh>
 #include <unordered_map>
 
@@ -85,6 +86,12 @@ class arp_for : public arp_for_protocol {
     using l3addr = typename L3::address_type;
 private:
     static constexpr auto max_waiters = 512;
+    // Entries not confirmed for this long are still used, while they are
+    // re-validated with unicast queries, once per probe_interval. After
+    // max_probes unanswered ones, the next lookup resolves afresh.
+    static constexpr auto reachable_time = std::chrono::seconds(30);
+    static constexpr auto probe_interval = std::chrono::seconds(1);
+    static constexpr unsigned max_probes = 3;
     enum oper {
         op_request = 1,
         op_reply = 2,
@@ -132,12 +139,21 @@ class arp_for : public arp_for_protocol {
         std::vector<promise<l2addr>> _waiters;
         timer<> _timeout_timer;
     };
+    struct entry {
+        l2addr addr;
+        lowres_clock::time_point confirmed;
+        lowres_clock::time_point probed;
+        unsigned probes = 0;
+        // Our own and the broadcast address
+        bool permanent = false;
+    };
 private:
     l3addr _l3self = L3::broadcast_address();
-    std::unordered_map<l3addr, l2addr> _table;
+    std::unordered_map<l3addr, entry> _table;
     std::unordered_map<l3addr, resolution> _in_progress;
 private:
     packet make_query_packet(l3addr paddr);
+    bool revalidate(const l3addr& paddr, entry& e);
     virtual future<> received(packet p) override;
     future<> handle_request(arp_hdr* ah);
     l2addr l2self() const noexcept { return _arp.l2self(); }
@@ -145,14 +161,14 @@ class arp_for : public arp_for_protocol {
 public:
     future<> send_query(const l3addr& paddr);
     explicit arp_for(arp& a) : arp_for_protocol(a, L3::arp_protocol_type()) {
-        _table[L3::broadcast_address()] = ethernet::broadcast_address();
+        _table[L3::broadcast_address()] = entry{ethernet::broadcast_address(), {}, {}, 0, true};
     }
     future<ethernet_address> lookup(const l3addr& addr);
     void learn(l2addr l2, l3addr l3);
     void run();
     void set_self_addr(l3addr addr) {
         _table.erase(_l3self);
-        _table[addr] = l2self();
+        _table[addr] = entry{l2self(), {}, {}, 0, true};
         _l3self = addr;
     }
     friend class arp;
@@ -209,7 +225,11 @@ future<ethernet_address>
 arp_for<L3>::lookup(const l3addr& paddr) {
     auto i = _table.find(paddr);
     if (i != _table.end()) {
-        return make_ready_future<ethernet_address>(i->second);
+        if (revalidate(paddr, i->second)) {
+            return make_ready_future<ethernet_address>(i->second.addr);
+        }
+        // The neighbour went away, or changed its address without telling
+        _table.erase(i);
     }
     auto j = _in_progress.find(paddr);
     auto first_request = j == _in_progress.end();
@@ -237,10 +257,34 @@ arp_for<L3>::lookup(const l3addr& paddr) {
     return res._waiters.back().get_future();
 }
 
+// Returns whether the entry can still be used. Stale entries keep the
+// flows going while a query is sent straight to the address they have.
+template <typename L3>
+bool
+arp_for<L3>::revalidate(const l3addr& paddr, entry& e) {
+    if (e.permanent) {
+        return true;
+    }
+    auto now = lowres_clock::now();
+    if (now - e.confirmed < reachable_time || now - e.probed < probe_interval) {
+        return true;
+    }
+    if (e.probes == max_probes) {
+        return false;
+    }
+    e.probed = now;
+    ++e.probes;
+    send(e.addr, make_query_packet(paddr));
+    return true;
+}
+
 template <typename L3>
 void
 arp_for<L3>::learn(l2addr hwaddr, l3addr paddr) {
-    _table[paddr] = hwaddr;
+    auto& e = _table[paddr];
+    if (!e.permanent) {
+        e = entry{hwaddr, lowres_clock::now()};
+    }
     auto i = _in_progress.find(paddr);
     if (i != _in_progress.end()) {
         auto& res = i->second;
@@ -277,8 +321,14 @@ arp_for<L3>::received(packet p) {
 template <typename L3>
 future<>
 arp_for<L3>::handle_request(arp_hdr* ah) {
-    if (ah->target_paddr == _l3self
-            && _l3self != L3::broadcast_address()) {
+    // As in RFC 826, update the sender's entry if there is one, which is
+    // how gratuitous ARP moves traffic over after a failover, and add it
+    // if it asks for us, since it is about to talk to us
+    auto for_us = ah->target_paddr == _l3self && _l3self != L3::broadcast_address();
+    if (for_us || _table.count(ah->sender_paddr)) {
+        arp_learn(ah->sender_hwaddr, ah->sender_paddr);
+    }
+    if (for_us) {
         ah->oper = op_reply;
         ah->target_hwaddr = ah->sender_hwaddr;
         ah->target_paddr = ah->sender_paddr;
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <vector>
 #include <unordered_map>
 #include <memory>
@@ -29,6 +30,9 @@
 #include <seastar/core/future.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/lowres_clock.hh>
 #include <seastar/net/inet_address.hh>
 
 namespace seastar {
@@ -58,6 +62,14 @@ struct hostent {
 
 typedef std::optional<inet_address::family> opt_family;
 
+/**
+ * A hostent, and how long it may be cached when the resolver knows
+ */
+struct hostent_with_ttl {
+    hostent host;
+    std::optional<std::chrono::seconds> ttl;
+};
+
 struct srv_record {
     unsigned short priority;
     unsigned short weight;
@@ -105,6 +117,15 @@ class dns_resolver {
      * Resolves a hostname to one or more addresses and aliases
      */
     future<hostent> get_host_by_name(const sstring&, opt_family = {});
+    /**
+     * Resolves a hostname like get_host_by_name(), also giving the lowest
+     * TTL of the records. Numeric addresses and names in the hosts file
+     * have no TTL, and neither do records with a TTL of 0, which c-ares
+     * can't tell apart from the former, nor any name when c-ares is older
+     * than 1.16. With no family given, the addresses of both families are
+     * returned, preferred ones first.
+     */
+    future<hostent_with_ttl> get_host_by_name_with_ttl(const sstring&, opt_family = {});
     /**
      * Resolves an address to one or more addresses and aliases
      */
@@ -135,6 +156,66 @@ class dns_resolver {
     shared_ptr<impl> _impl;
 };
 
+/**
+ * A cache of name lookups in front of a dns_resolver, for one shard.
+ *
+ * Answers are kept for the TTL of their records, and failures to find
+ * a name for negative_ttl. For stale_ttl past its expiry, an answer is
+ * still returned while it is refreshed in the background. Concurrent
+ * lookups of the same name share a single query.
+ */
+class dns_cache {
+public:
+    using clock = lowres_clock;
+    struct options {
+        // How long answers with no known TTL are kept
+        std::chrono::seconds default_ttl = std::chrono::seconds(60);
+        std::chrono::seconds min_ttl = std::chrono::seconds(5);
+        std::chrono::seconds max_ttl = std::chrono::hours(1);
+        // How long a name that was not found is remembered
+        std::chrono::seconds negative_ttl = std::chrono::seconds(5);
+        std::chrono::seconds stale_ttl = std::chrono::seconds(30);
+        size_t max_entries = 4096;
+    };
+private:
+    struct entry {
+        // Set once the first query completes
+        std::optional<hostent> host;
+        std::exception_ptr error;
+        clock::time_point expiry;
+        // The query in progress, if any
+        std::optional<shared_future<hostent>> query;
+        uint64_t query_id = 0;
+    };
+    dns_resolver& _resolver;
+    options _options;
+    std::unordered_map<sstring, entry> _entries;
+    gate _refreshes;
+    uint64_t _queries = 0;
+
+    future<hostent> query(const sstring& key, const sstring& name, opt_family family);
+    void make_room(clock::time_point now);
+public:
+    explicit dns_cache(dns_resolver& resolver);
+    dns_cache(dns_resolver& resolver, options opts);
+
+    future<hostent> get_host_by_name(const sstring&, opt_family = {});
+    future<inet_address> resolve_name(const sstring&, opt_family = {});
+    /**
+     * Drops what is known of the name
+     */
+    void invalidate(const sstring&);
+    void clear();
+    size_t size() const noexcept {
+        return _entries.size();
+    }
+    /**
+     * Waits for the background refreshes. The resolver must be closed
+     * only after this.
+     */
+    future<> close();
+};
+
 namespace dns {
 
 // See above. These functions simply queries using a shard-local
@@ -145,6 +226,9 @@ future<hostent> get_host_by_addr(const inet_address&);
 future<inet_address> resolve_name(const sstring&, opt_family = {});
 future<sstring> resolve_addr(const inet_address&);
 
+// A shard-local cache in front of the default resolver above
+dns_cache& cache();
+
 future<std::vector<srv_record>> get_srv_records(dns_resolver::srv_proto proto,
                                                 const sstring& service,
                                                 const sstring& domain);
@@ -41,6 +41,38 @@ struct dpdk_options : public program_options::option_group {
     ///
     /// Default: \p on.
     program_options::value<std::string> hw_fc;
+    /// \brief Period in milliseconds of rebalancing the RSS redirection
+    /// table according to the receive load of the queues.
+    ///
+    /// Entries of the table are moved from the queues receiving the most
+    /// packets to the ones receiving the least. Connections established
+    /// before their entry is moved keep being served by their shard.
+    ///
+    /// Default: 0 (disabled).
+    program_options::value<unsigned> rss_rebalance_period;
+    /// \brief Maximum number of hardware flow steering (rte_flow) rules
+    /// each shard installs.
+    ///
+    /// An outgoing TCP connection is steered to the queue of its shard by
+    /// an exact match rule, instead of searching for a local port whose RSS
+    /// hash lands on it. When the shard is at the limit, or the device
+    /// refuses a rule, for lack of flow table entries or of support,
+    /// connections go back to relying on RSS until a rule is removed.
+    ///
+    /// Default: 0 (disabled).
+    program_options::value<unsigned> flow_steering_rules;
+    /// \brief Comma separated DPDK port indexes to bond into a single
+    /// port, used instead of \ref dpdk_port_index.
+    ///
+    /// Every shard gets a queue on each of the ports: it receives from all
+    /// of them, and its transmitted packets are spread across them by
+    /// their addresses and ports.
+    program_options::value<std::string> bond_ports;
+    /// \brief Bonding mode of \ref bond_ports: \p balance, for a static
+    /// link aggregation, or \p lacp, for 802.3ad.
+    ///
+    /// Default: \p balance.
+    program_options::value<std::string> bond_mode;
 
     /// \cond internal
     dpdk_options(program_options::option_group* parent_group);
@@ -62,6 +94,15 @@ std::unique_ptr<net::device> create_dpdk_net_device(
 std::unique_ptr<net::device> create_dpdk_net_device(
                                     const net::hw_config& hw_cfg);
 
+/**
+ * Bonds DPDK ports into an active-active bonded port.
+ *
+ * @param ports comma separated port indexes
+ * @param mode "balance" or "lacp"
+ * @return the index of the bonded port, for create_dpdk_net_device()
+ */
+uint16_t create_dpdk_bonded_port(const std::string& ports, const std::string& mode);
+
 namespace dpdk {
 /**
  * @return Number of bytes needed for mempool objects of each QP.
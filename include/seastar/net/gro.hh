@@ -0,0 +1,92 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/net/packet.hh>
+#include <seastar/net/const.hh>
+#include <seastar/util/noncopyable_function.hh>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace seastar {
+
+namespace net {
+
+/// \brief Software receive offload (GRO) for TCP over IPv4.
+///
+/// Merges consecutive in-order segments of the same TCP flow, received in
+/// one batch from the device, into a single large segment, the way a device
+/// doing LRO would, so that the IP and TCP layers handle one packet per
+/// flow and batch instead of one per MSS.
+///
+/// Packets are ethernet frames. Segments are only merged when they carry
+/// data, no flags other than ACK and PSH, and the same acknowledgement,
+/// window and TCP options as the segments before them; anything else is
+/// delivered as is, after the packets held for the same flow. Since the
+/// checksums of the merged segments are not recomputed, the device must
+/// have validated them (\ref hw_features::rx_csum_offload).
+class gro {
+public:
+    using deliver_fn = noncopyable_function<void (packet)>;
+    struct stats {
+        // Segments appended to another one
+        uint64_t merged_segments = 0;
+        // Packets delivered after having been held for merging
+        uint64_t merged_packets = 0;
+    };
+    static constexpr size_t max_flows = 8;
+    static constexpr unsigned max_segments = 64;
+private:
+    struct flow {
+        uint32_t src_ip;
+        uint32_t dst_ip;
+        uint32_t ports;
+        uint32_t next_seq;
+        uint32_t ack;
+        uint16_t window;
+        uint8_t options_len;
+        std::array<char, 40> options;
+        unsigned segments;
+        packet p;
+    };
+    deliver_fn _deliver;
+    // Flows with segments held since the last flush, oldest first
+    std::vector<flow> _flows;
+    stats _stats;
+private:
+    void deliver(flow& f);
+public:
+    explicit gro(deliver_fn deliver);
+    /// Merges \c p with the held segments of its flow, holds it for
+    /// segments to come, or delivers it.
+    void receive(packet p);
+    /// Delivers all held segments; called at the end of a receive batch.
+    void flush();
+    const stats& get_stats() const noexcept {
+        return _stats;
+    }
+};
+
+}
+
+}
@@ -75,6 +75,11 @@ struct ipv4_traits {
     static constexpr uint8_t ip_hdr_len_min = ipv4_hdr_len_min;
 };
 
+// Appends an address to the input of the RSS hash, in network byte order
+inline void push_address(forward_hash& out_hash_data, ipv4_address a) {
+    out_hash_data.push_back(hton(a.ip));
+}
+
 template <ip_protocol_num ProtoNum>
 class ipv4_l4 {
 public:
@@ -113,10 +118,10 @@ struct l4connid {
                 && foreign_port == x.foreign_port;
     }
 
-    uint32_t hash(rss_key_type rss_key) {
+    uint32_t hash(rss_key_type rss_key) const {
         forward_hash hash_data;
-        hash_data.push_back(hton(foreign_ip.ip));
-        hash_data.push_back(hton(local_ip.ip));
+        push_address(hash_data, foreign_ip);
+        push_address(hash_data, local_ip);
         hash_data.push_back(hton(foreign_port));
         hash_data.push_back(hton(local_port));
         return toeplitz_hash(rss_key, hash_data);
@@ -327,6 +332,10 @@ class ipv4 {
     explicit ipv4(interface* netif);
     void set_host_address(ipv4_address ip);
     ipv4_address host_address() const;
+    // The address packets to \c to are sent from
+    ipv4_address source_address(ipv4_address to) const {
+        return _host_address;
+    }
     void set_gw_address(ipv4_address ip);
     ipv4_address gw_address() const;
     void set_netmask_address(ipv4_address ip);
@@ -32,6 +32,11 @@ namespace net {
 
 uint16_t ip_checksum(const void* data, size_t len);
 
+// The ones' complement sum of data as 16-bit words in host byte order,
+// padded with a zero byte if len is odd, folded to 16 bits. Uses vector
+// instructions where the cpu has them.
+uint16_t ones_complement_sum(const char* data, size_t len) noexcept;
+
 struct checksummer {
     __int128 csum = 0;
     bool odd = false;
@@ -0,0 +1,305 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/net/ip.hh>
+#include <seastar/net/ipv6_address.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/semaphore.hh>
+#include <unordered_map>
+#include <vector>
+
+namespace seastar {
+
+namespace net {
+
+class ipv6;
+template <ip_protocol_num ProtoNum>
+class ipv6_l4;
+
+struct ipv6_traits {
+    using address_type = ipv6_address;
+    using inet_type = ipv6_l4<ip_protocol_num::tcp>;
+    struct l4packet {
+        ipv6_address to;
+        packet p;
+        ethernet_address e_dst;
+        ip_protocol_num proto_num;
+        // Neighbor discovery messages are sent with the maximum hop limit
+        uint8_t hop_limit = 64;
+    };
+    using packet_provider_type = std::function<std::optional<l4packet> ()>;
+    static void pseudo_header_checksum(checksummer& csum, const ipv6_address& src, const ipv6_address& dst,
+            ip_protocol_num proto, uint32_t len) {
+        csum.sum(reinterpret_cast<const char*>(src.ip.data()), ipv6_address::size());
+        csum.sum(reinterpret_cast<const char*>(dst.ip.data()), ipv6_address::size());
+        csum.sum_many(len, uint32_t(proto));
+    }
+    static void tcp_pseudo_header_checksum(checksummer& csum, const ipv6_address& src, const ipv6_address& dst, uint16_t len) {
+        pseudo_header_checksum(csum, src, dst, ip_protocol_num::tcp, len);
+    }
+    static void udp_pseudo_header_checksum(checksummer& csum, const ipv6_address& src, const ipv6_address& dst, uint16_t len) {
+        pseudo_header_checksum(csum, src, dst, ip_protocol_num::udp, len);
+    }
+    static constexpr uint8_t ip_hdr_len_min = ipv6_hdr_len_min;
+};
+
+inline void push_address(forward_hash& out_hash_data, const ipv6_address& a) {
+    for (auto b : a.ip) {
+        out_hash_data.push_back(b);
+    }
+}
+
+template <ip_protocol_num ProtoNum>
+class ipv6_l4 {
+public:
+    ipv6& _inet;
+public:
+    ipv6_l4(ipv6& inet) : _inet(inet) {}
+    void register_packet_provider(ipv6_traits::packet_provider_type func);
+    future<ethernet_address> get_l2_dst_address(ipv6_address to);
+    const ipv6& inet() const {
+        return _inet;
+    }
+};
+
+class ipv6_protocol {
+public:
+    virtual ~ipv6_protocol() {}
+    virtual void received(packet p, ipv6_address from, ipv6_address to) = 0;
+    virtual bool forward(forward_hash& out_hash_data, packet& p, size_t off) { return true; }
+};
+
+class ipv6_tcp final : public ipv6_protocol {
+    ipv6_l4<ip_protocol_num::tcp> _inet_l4;
+    std::unique_ptr<tcp<ipv6_traits>> _tcp;
+public:
+    ipv6_tcp(ipv6& inet);
+    ~ipv6_tcp();
+    virtual void received(packet p, ipv6_address from, ipv6_address to) override;
+    virtual bool forward(forward_hash& out_hash_data, packet& p, size_t off) override;
+    friend class ipv6;
+};
+
+struct icmpv6_hdr {
+    enum class msg_type : uint8_t {
+        echo_request = 128,
+        echo_reply = 129,
+        router_solicitation = 133,
+        router_advertisement = 134,
+        neighbor_solicitation = 135,
+        neighbor_advertisement = 136,
+        redirect = 137,
+    };
+    msg_type type;
+    uint8_t code;
+    packed<uint16_t> csum;
+    template <typename Adjuster>
+    auto adjust_endianness(Adjuster a) {
+        return a(csum);
+    }
+} __attribute__((packed));
+
+class ndp_error : public std::runtime_error {
+public:
+    ndp_error(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+// ICMPv6: answers echo requests, and resolves the link-layer addresses of
+// neighbors with neighbor discovery, which replaces ARP in IPv6
+class ipv6_icmp final : public ipv6_protocol {
+    static constexpr auto max_waiters = 512;
+    struct resolution {
+        std::vector<promise<ethernet_address>> _waiters;
+        timer<> _timeout_timer;
+    };
+    ipv6& _inet;
+    std::unordered_map<ipv6_address, ethernet_address> _neighbors;
+    std::unordered_map<ipv6_address, resolution> _in_progress;
+    circular_buffer<ipv6_traits::l4packet> _packetq;
+    semaphore _queue_space = {212992};
+private:
+    void send(ipv6_address to, ethernet_address e_dst, packet p, uint8_t hop_limit);
+    void send_solicitation(const ipv6_address& target);
+    void handle_solicitation(packet p, ipv6_address from);
+    void handle_advertisement(packet p);
+public:
+    explicit ipv6_icmp(ipv6& inet);
+    virtual void received(packet p, ipv6_address from, ipv6_address to) override;
+    future<ethernet_address> lookup(const ipv6_address& addr);
+    void learn(ethernet_address l2, const ipv6_address& l3);
+};
+
+class ipv6_udp : public ipv6_protocol {
+public:
+    static const int default_queue_size;
+private:
+    static const uint16_t min_anonymous_port = 32768;
+    ipv6 &_inet;
+    std::unordered_map<uint16_t, lw_shared_ptr<udp_channel_state>> _channels;
+    int _queue_size = default_queue_size;
+    uint16_t _next_anonymous_port = min_anonymous_port;
+    circular_buffer<ipv6_traits::l4packet> _packetq;
+private:
+    uint16_t next_port(uint16_t port);
+public:
+    class registration {
+    private:
+        ipv6_udp &_proto;
+        uint16_t _port;
+    public:
+        registration(ipv6_udp &proto, uint16_t port) : _proto(proto), _port(port) {};
+
+        void unregister() {
+            _proto._channels.erase(_proto._channels.find(_port));
+        }
+
+        uint16_t port() const {
+            return _port;
+        }
+    };
+
+    ipv6_udp(ipv6& inet);
+    udp_channel make_channel(ipv6_addr addr);
+    virtual void received(packet p, ipv6_address from, ipv6_address to) override;
+    void send(uint16_t src_port, ipv6_addr dst, packet &&p);
+    bool forward(forward_hash& out_hash_data, packet& p, size_t off) override;
+    void set_queue_size(int size) { _queue_size = size; }
+
+    const ipv6& inet() const {
+        return _inet;
+    }
+};
+
+struct ipv6_hdr {
+    // version (4 bits), traffic class (8 bits), flow label (20 bits)
+    packed<uint32_t> ver_tc_flow;
+    packed<uint16_t> payload_len;
+    uint8_t next_header;
+    uint8_t hop_limit;
+    ipv6_address src_ip;
+    ipv6_address dst_ip;
+    template <typename Adjuster>
+    auto adjust_endianness(Adjuster a) {
+        return a(ver_tc_flow, payload_len);
+    }
+    uint8_t version() const { return uint32_t(ver_tc_flow) >> 28; }
+} __attribute__((packed));
+
+static_assert(sizeof(ipv6_hdr) == ipv6_hdr_len_min, "ipv6_hdr has the wrong size");
+
+// The IPv6 layer of the native stack. It has a link-local address derived
+// from the MAC address, and optionally a statically configured global one.
+//
+// Extension headers are not supported: packets carrying any, fragments
+// included, are dropped, and datagrams larger than the MTU are not sent.
+class ipv6 {
+public:
+    using clock_type = lowres_clock;
+    using address_type = ipv6_address;
+    static constexpr uint8_t ndp_hop_limit = 255;
+private:
+    interface* _netif;
+    net::hw_features _hw_features;
+    std::vector<ipv6_traits::packet_provider_type> _pkt_providers;
+    ipv6_address _host_address;
+    ipv6_address _link_local_address;
+    ipv6_address _gw_address;
+    unsigned _prefix_length = 64;
+    l3_protocol _l3;
+    ipv6_tcp _tcp;
+    ipv6_icmp _icmp;
+    ipv6_udp _udp;
+    array_map<ipv6_protocol*, 256> _l4;
+    circular_buffer<l3_protocol::l3packet> _packetq;
+    unsigned _pkt_provider_idx = 0;
+private:
+    future<> handle_received_packet(packet p, ethernet_address from);
+    bool forward(forward_hash& out_hash_data, packet& p, size_t off);
+    std::optional<l3_protocol::l3packet> get_packet();
+    bool in_my_prefix(const ipv6_address& a) const;
+    bool accepts(const ipv6_address& dst) const;
+public:
+    explicit ipv6(interface* netif);
+    void set_host_address(ipv6_address ip);
+    ipv6_address host_address() const;
+    ipv6_address link_local_address() const;
+    // The address packets to \c to are sent from
+    ipv6_address source_address(const ipv6_address& to) const;
+    bool is_my_address(const ipv6_address& a) const;
+    void set_gw_address(ipv6_address ip);
+    ipv6_address gw_address() const;
+    void set_prefix_length(unsigned prefix_length);
+    unsigned prefix_length() const;
+    interface * netif() const {
+        return _netif;
+    }
+    void send(ipv6_address to, ip_protocol_num proto_num, packet p, ethernet_address e_dst, uint8_t hop_limit = 64);
+    tcp<ipv6_traits>& get_tcp() { return *_tcp._tcp; }
+    ipv6_udp& get_udp() { return _udp; }
+    // Checksum and segmentation offloads are only set up by the drivers for
+    // IPv4, so they are never used for IPv6
+    const net::hw_features& hw_features() const { return _hw_features; }
+    void learn(ethernet_address l2, ipv6_address l3) {
+        _icmp.learn(l2, l3);
+    }
+    void register_packet_provider(ipv6_traits::packet_provider_type&& func) {
+        _pkt_providers.push_back(std::move(func));
+    }
+    future<ethernet_address> get_l2_dst_address(ipv6_address to);
+
+    static bool is_multicast(const ipv6_address& a) {
+        return a.ip[0] == 0xff;
+    }
+    static bool is_link_local(const ipv6_address& a) {
+        return a.ip[0] == 0xfe && (a.ip[1] & 0xc0) == 0x80;
+    }
+    // ff02::1:ffXX:XXXX, the multicast group neighbor solicitations for
+    // \c a are sent to
+    static ipv6_address solicited_node_address(const ipv6_address& a);
+    static ethernet_address multicast_mac(const ipv6_address& a);
+    static ipv6_address link_local_address(ethernet_address mac);
+};
+
+template <ip_protocol_num ProtoNum>
+inline
+void ipv6_l4<ProtoNum>::register_packet_provider(ipv6_traits::packet_provider_type func) {
+    _inet.register_packet_provider([func = std::move(func)] {
+        auto l4p = func();
+        if (l4p) {
+            l4p.value().proto_num = ProtoNum;
+        }
+        return l4p;
+    });
+}
+
+template <ip_protocol_num ProtoNum>
+inline
+future<ethernet_address> ipv6_l4<ProtoNum>::get_l2_dst_address(ipv6_address to) {
+    return _inet.get_l2_dst_address(to);
+}
+
+void ndp_learn(ethernet_address l2, ipv6_address l3);
+
+}
+
+}
@@ -24,6 +24,7 @@
 #include <seastar/net/net.hh>
 #include <seastar/net/virtio.hh>
 #include <seastar/net/dpdk.hh>
+#include <seastar/net/xdp.hh>
 #include <seastar/util/program-options.hh>
 
 namespace seastar {
@@ -52,6 +53,17 @@ struct native_stack_options : public program_options::option_group {
     ///
     /// Default: \p 255.255.255.0.
     program_options::value<std::string> netmask_ipv4_addr;
+    /// \brief Static IPv6 address to use.
+    ///
+    /// Without it, IPv6 only uses the link-local address derived from the
+    /// MAC address.
+    program_options::value<std::string> host_ipv6_addr;
+    /// \brief Static IPv6 gateway to use.
+    program_options::value<std::string> gw_ipv6_addr;
+    /// \brief Length of the on-link IPv6 prefix of \ref host_ipv6_addr.
+    ///
+    /// Default: 64.
+    program_options::value<unsigned> ipv6_prefix_length;
     /// \brief Default size of the UDPv4 per-channel packet queue.
     ///
     /// Default: \ref ipv4_udp::default_queue_size.
@@ -76,6 +88,21 @@ struct native_stack_options : public program_options::option_group {
     ///
     /// Default: \p on.
     program_options::value<std::string> lro;
+    /// \brief Enable software receive offload (on/off): merge the TCP
+    /// segments of a flow received in one batch when the device does not
+    /// do LRO itself.
+    ///
+    /// Only takes effect if the device validates the receive checksums.
+    ///
+    /// Default: \p on.
+    program_options::value<std::string> gro;
+    /// \brief TCP congestion control algorithm of new connections
+    /// (\p reno, \p cubic or \p bbr).
+    ///
+    /// Can be changed per connection with the \p TCP_CONGESTION socket option.
+    ///
+    /// Default: \p reno.
+    program_options::value<std::string> tcp_congestion_control;
 
     /// Virtio configuration.
     virtio_options virtio_opts;
@@ -83,6 +110,8 @@ struct native_stack_options : public program_options::option_group {
     ///
     /// \note Unused when seastar is compiled without DPDK support.
     dpdk_options dpdk_opts;
+    /// AF_XDP configuration.
+    xdp_options xdp_opts;
 
     /// \cond internal
     bool _hugepages;
@@ -30,7 +30,9 @@
 #include <seastar/net/ethernet.hh>
 #include <seastar/net/packet.hh>
 #include <seastar/net/const.hh>
+#include <seastar/net/gro.hh>
 #include <unordered_map>
+#include <vector>
 
 namespace seastar {
 
@@ -72,6 +74,27 @@ class forward_hash {
     }
 };
 
+// A TCP or UDP flow over IPv4, as its packets are received: from the
+// peer's address and port to ours, in host byte order
+struct flow_key {
+    uint8_t proto;
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+
+    bool operator==(const flow_key& x) const noexcept {
+        return proto == x.proto && src_ip == x.src_ip && dst_ip == x.dst_ip
+                && src_port == x.src_port && dst_port == x.dst_port;
+    }
+    struct hash {
+        size_t operator()(const flow_key& k) const noexcept {
+            return std::hash<uint64_t>()((uint64_t(k.src_ip) << 32) | k.dst_ip)
+                    ^ std::hash<uint64_t>()((uint64_t(k.proto) << 32) | (uint32_t(k.src_port) << 16) | k.dst_port);
+        }
+    };
+};
+
 struct hw_features {
     // Enable tx ip header checksum offload
     bool tx_csum_ip_offload = false;
@@ -123,10 +146,18 @@ class interface {
     ethernet_address _hw_address;
     net::hw_features _hw_features;
     std::vector<l3_protocol::packet_provider_type> _pkt_providers;
+    // Received packets of flows owned by other shards, by shard; sent
+    // once per poll, a single cross-shard message per shard
+    static constexpr size_t max_forwarding = 1000;
+    std::vector<std::vector<packet>> _forward_batches;
+    size_t _forwarding = 0;
+    std::unique_ptr<internal::poller> _forward_poller;
 private:
     future<> dispatch_packet(packet p);
+    bool flush_forwards();
 public:
     explicit interface(std::shared_ptr<device> dev);
+    ~interface();
     ethernet_address hw_address() const noexcept { return _hw_address; }
     const net::hw_features& hw_features() const { return _hw_features; }
     future<> register_l3(eth_protocol_num proto_num,
@@ -137,6 +168,11 @@ class interface {
     void register_packet_provider(l3_protocol::packet_provider_type func) {
         _pkt_providers.push_back(std::move(func));
     }
+    // func appends the RSS hashes of the flows established on this shard
+    void register_flow_provider(std::function<void (std::vector<uint32_t>&)> func);
+    // See device::steer_flow()
+    bool steer_flow(const flow_key& flow);
+    void unsteer_flow(const flow_key& flow);
     uint16_t hw_queues_count();
     rss_key_type rss_key() const;
     friend class l3_protocol;
@@ -217,10 +253,21 @@ struct qp_stats {
 
 class qp {
     using packet_provider_type = std::function<std::optional<packet> ()>;
+    using flow_provider_type = std::function<void (std::vector<uint32_t>&)>;
     std::vector<packet_provider_type> _pkt_providers;
+    std::vector<flow_provider_type> _flow_providers;
     std::optional<std::array<uint8_t, 128>> _sw_reta;
+    // Packets received per bucket of the device's redirection table
+    std::vector<uint64_t> _rss_bucket_load;
+    // Flows whose redirection table bucket was moved to this queue after
+    // they were established on some shard: RSS hash -> shard
+    std::unordered_map<uint32_t, unsigned> _pinned_flows;
     circular_buffer<packet> _proxy_packetq;
     stream<packet> _rx_stream;
+    std::unique_ptr<gro> _gro;
+    // Packets received since the last l2flush(), and the batch being delivered
+    std::vector<packet> _rx_batch;
+    std::vector<packet> _rx_delivering;
     std::unique_ptr<internal::poller> _tx_poller;
     circular_buffer<packet> _tx_packetq;
 
@@ -256,10 +303,50 @@ class qp {
     void register_packet_provider(packet_provider_type func) {
         _pkt_providers.push_back(std::move(func));
     }
+    // Merge the TCP segments received in a batch before passing them up;
+    // requires the device to validate the checksums.
+    void enable_gro();
+    void deliver_rx_batch();
+    void register_flow_provider(flow_provider_type func) {
+        _flow_providers.push_back(std::move(func));
+    }
+    // RSS hashes of the flows established on this shard
+    std::vector<uint32_t> flow_hashes() const;
+    // Start counting the packets received per bucket of a redirection
+    // table of nr_buckets (a power of two) entries
+    void enable_rss_bucket_load(size_t nr_buckets) {
+        _rss_bucket_load.assign(nr_buckets, 0);
+    }
+    void count_rss_bucket(uint32_t hash) noexcept {
+        if (!_rss_bucket_load.empty()) {
+            _rss_bucket_load[hash & (_rss_bucket_load.size() - 1)]++;
+        }
+    }
+    // Returns the packets received per bucket since the last call
+    std::vector<uint64_t> take_rss_bucket_load();
+    void set_pinned_flows(std::unordered_map<uint32_t, unsigned> flows) {
+        _pinned_flows = std::move(flows);
+    }
     bool poll_tx();
     friend class device;
 };
 
+// Moving a bucket of a redirection table to another queue
+struct reta_move {
+    unsigned bucket;
+    unsigned from;
+    unsigned to;
+};
+
+// Plans moving buckets of redirection table reta away from the queues
+// whose receive load exceeds the average by more than max_imbalance (a
+// fraction of it), given the load of each bucket. Buckets are moved to
+// the least loaded queue, picking the one that best evens out the two
+// queues, so a single bucket carrying most of a queue's load (an elephant
+// flow) is never moved around in vain.
+std::vector<reta_move> plan_reta_rebalance(std::vector<uint8_t> reta, const std::vector<uint64_t>& bucket_load,
+        unsigned nr_queues, double max_imbalance, unsigned max_moves);
+
 class device {
 protected:
     std::unique_ptr<qp*[]> _queues;
@@ -271,9 +358,13 @@ class device {
     virtual ~device() {};
     qp& queue_for_cpu(unsigned cpu) { return *_queues[cpu]; }
     qp& local_queue() { return queue_for_cpu(this_shard_id()); }
+    // Received packets are passed up in batches: the driver calls
+    // l2receive() for each packet of a burst, and then l2flush().
     void l2receive(packet p) {
-        // FIXME: future is discarded
-        (void)_queues[this_shard_id()]->_rx_stream.produce(std::move(p));
+        _queues[this_shard_id()]->_rx_batch.push_back(std::move(p));
+    }
+    void l2flush() {
+        _queues[this_shard_id()]->deliver_rx_batch();
     }
     future<> receive(std::function<future<> (packet)> next_packet);
     virtual ethernet_address hw_address() = 0;
@@ -285,14 +376,32 @@ class device {
     virtual unsigned hash2qid(uint32_t hash) {
         return hash % hw_queues_count();
     }
+    // Has the device deliver the flow's packets to the queue of this shard,
+    // whatever their hash, until unsteer_flow(). Returns false if it can't,
+    // for lack of support or of room for more rules, leaving the flow to
+    // RSS. Called by the shard owning the flow.
+    virtual bool steer_flow(const flow_key& flow) { return false; }
+    virtual void unsteer_flow(const flow_key& flow) {}
     void set_local_queue(std::unique_ptr<qp> dev);
     template <typename Func>
     unsigned forward_dst(unsigned src_cpuid, Func&& hashfn) {
         auto& qp = queue_for_cpu(src_cpuid);
+        // The pinned flows are only looked at by the queue's own shard
+        bool pinned = src_cpuid == this_shard_id() && !qp._pinned_flows.empty();
+        if (!qp._sw_reta && !pinned) {
+            return src_cpuid;
+        }
+        auto full_hash = hashfn();
+        if (pinned) {
+            auto i = qp._pinned_flows.find(full_hash);
+            if (i != qp._pinned_flows.end()) {
+                return i->second;
+            }
+        }
         if (!qp._sw_reta) {
             return src_cpuid;
         }
-        auto hash = hashfn() >> _rss_table_bits;
+        auto hash = full_hash >> _rss_table_bits;
         auto& reta = *qp._sw_reta;
         return reta[hash % reta.size()];
     }
@@ -30,6 +30,7 @@
 #include <iosfwd>
 #include <seastar/util/std-compat.hh>
 #include <functional>
+#include <memory>
 
 namespace seastar {
 
@@ -91,6 +92,13 @@ class packet final {
         fragment& operator[](size_t idx) noexcept { return _start[idx]; }
     };
 
+    struct impl;
+    // Destroys an impl, returning its memory to the freelist
+    struct impl_deleter {
+        void operator()(impl* p) const noexcept;
+    };
+    using impl_ptr = std::unique_ptr<impl, impl_deleter>;
+
     struct impl {
         // when destroyed, virtual destructor will reclaim resources
         deleter _deleter;
@@ -111,12 +119,12 @@ class packet final {
 
         pseudo_vector fragments() noexcept { return { _frags, _nr_frags }; }
 
-        static std::unique_ptr<impl> allocate(size_t nr_frags) {
+        static impl_ptr allocate(size_t nr_frags) {
             nr_frags = std::max(nr_frags, default_nr_frags);
-            return std::unique_ptr<impl>(new (nr_frags) impl(nr_frags));
+            return impl_ptr(new (nr_frags) impl(nr_frags));
         }
 
-        static std::unique_ptr<impl> copy(impl* old, size_t nr) {
+        static impl_ptr copy(impl* old, size_t nr) {
             auto n = allocate(nr);
             n->_deleter = std::move(old->_deleter);
             n->_len = old->_len;
@@ -129,25 +137,32 @@ class packet final {
             return n;
         }
 
-        static std::unique_ptr<impl> copy(impl* old) {
+        static impl_ptr copy(impl* old) {
             return copy(old, old->_nr_frags);
         }
 
-        static std::unique_ptr<impl> allocate_if_needed(std::unique_ptr<impl> old, size_t extra_frags) {
+        static impl_ptr allocate_if_needed(impl_ptr old, size_t extra_frags) {
             if (old->_allocated_frags >= old->_nr_frags + extra_frags) {
                 return old;
             }
             return copy(old.get(), std::max<size_t>(old->_nr_frags + extra_frags, 2 * old->_nr_frags));
         }
+        // Every packet allocates an impl, and most have the default number
+        // of fragments. Freed ones of that size are kept on a per-thread
+        // freelist, sparing the allocator a round trip per packet.
+        static void* allocate_memory(size_t nr_frags);
+        static void free_memory(void* ptr, size_t nr_frags) noexcept;
+
         void* operator new(size_t size, size_t nr_frags = default_nr_frags) {
             assert(nr_frags == uint16_t(nr_frags));
-            return ::operator new(size + nr_frags * sizeof(fragment));
+            return allocate_memory(nr_frags);
         }
         // Matching the operator new above
         void operator delete(void* ptr, size_t nr_frags) {
-            return ::operator delete(ptr);
+            free_memory(ptr, nr_frags);
         }
-        // Since the above "placement delete" hides the global one, expose it
+        // Since the above "placement delete" hides the global one, expose
+        // it. The freelist also gets its memory from ::operator new().
         void operator delete(void* ptr) {
             return ::operator delete(ptr);
         }
@@ -182,8 +197,8 @@ class packet final {
                     to->_frags[0].base);
         }
     };
-    packet(std::unique_ptr<impl>&& impl) noexcept : _impl(std::move(impl)) {}
-    std::unique_ptr<impl> _impl;
+    packet(impl_ptr&& impl) noexcept : _impl(std::move(impl)) {}
+    impl_ptr _impl;
 public:
     static packet from_static_data(const char* data, size_t len) noexcept {
         return {fragment{const_cast<char*>(data), len}, deleter()};
@@ -324,6 +339,13 @@ packet::packet(packet&& x) noexcept
     : _impl(std::move(x._impl)) {
 }
 
+inline
+void packet::impl_deleter::operator()(impl* p) const noexcept {
+    auto nr_frags = p->_allocated_frags;
+    p->~impl();
+    impl::free_memory(p, nr_frags);
+}
+
 inline
 packet::impl::impl(size_t nr_frags) noexcept
     : _len(0), _allocated_frags(nr_frags) {
@@ -22,11 +22,14 @@
 #pragma once
 
 #include <seastar/core/sharded.hh>
+#include <seastar/core/circular_buffer.hh>
 #include <seastar/core/internal/pollable_fd.hh>
 #include <seastar/net/stack.hh>
 #include <seastar/core/polymorphic_temporary_buffer.hh>
 #include <seastar/core/internal/buffer_allocator.hh>
 #include <seastar/util/program-options.hh>
+#include <deque>
+#include <map>
 
 namespace seastar {
 
@@ -119,11 +122,71 @@ class posix_data_source_impl final : public data_source_impl, private internal::
     future<> close() override;
 };
 
+// Bookkeeping for MSG_ZEROCOPY transmission, enabled by setting SO_ZEROCOPY
+// on a posix connected socket. The kernel keeps reading packet data from our
+// memory after sendmsg() returns, so each packet is held until the kernel
+// posts the completions for all the sends that carried it on the socket's
+// error queue. Shared by the socket, where the option is set, and its sink.
+class posix_zerocopy_state final : public internal::error_queue_consumer {
+    struct pending_send {
+        std::optional<packet> p;
+        bool done = false;
+    };
+    pollable_fd _fd;
+    // One entry per zero-copy sendmsg() call, in the order the kernel
+    // numbers them
+    circular_buffer<pending_send> _pending;
+    uint32_t _first_seq = 0; // sequence number of _pending.front()
+    bool _enabled = false;
+public:
+    // Smaller packets are copied into the socket buffer as usual, since
+    // pinning their pages and processing the completion costs more than
+    // copying them.
+    static constexpr size_t threshold = 16 * 1024;
+    // How long closing the sink waits for the sends in flight to complete
+    static constexpr std::chrono::seconds close_timeout{1};
+    // Longest pause between polls of the error queue in wait_for_completions()
+    static constexpr std::chrono::seconds max_poll_interval{1};
+
+    explicit posix_zerocopy_state(pollable_fd fd) : _fd(std::move(fd)) {}
+    ~posix_zerocopy_state();
+    bool enabled() const noexcept {
+        return _enabled;
+    }
+    void enable(bool enabled) noexcept;
+    bool has_pending() const noexcept {
+        return !_pending.empty();
+    }
+    // Records a successful zero-copy sendmsg() call
+    void sent() {
+        _pending.push_back(pending_send{});
+    }
+    // Keeps \c p alive until all sends recorded so far have completed
+    void hold(packet p) {
+        if (!_pending.empty()) {
+            _pending.back().p = std::move(p);
+        }
+    }
+    virtual void consume_error_queue(file_desc& fd) noexcept override;
+    // Resolves once all sends recorded so far have completed. Nothing wakes
+    // us up for completions, so this polls, less often the longer it waits.
+    future<> wait_for_completions();
+};
+
 class posix_data_sink_impl : public data_sink_impl {
     pollable_fd _fd;
     packet _p;
+    lw_shared_ptr<posix_zerocopy_state> _zerocopy;
+    ::msghdr _zerocopy_mh;
+private:
+    bool use_zerocopy(size_t len) const noexcept {
+        return _zerocopy && _zerocopy->enabled() && len >= posix_zerocopy_state::threshold;
+    }
+    future<> put_zerocopy(packet p);
 public:
-    explicit posix_data_sink_impl(pollable_fd fd) : _fd(std::move(fd)) {}
+    explicit posix_data_sink_impl(pollable_fd fd, lw_shared_ptr<posix_zerocopy_state> zerocopy = {})
+            : _fd(std::move(fd)), _zerocopy(std::move(zerocopy)) {}
+    ~posix_data_sink_impl();
     using data_sink_impl::put;
     future<> put(packet p) override;
     future<> put(temporary_buffer<char> buf) override;
@@ -159,6 +222,13 @@ class posix_ap_server_socket_impl : public server_socket_impl {
 };
 
 class posix_server_socket_impl : public server_socket_impl {
+    // How many connections are taken off the listening socket at once
+    static constexpr unsigned max_accept_batch = 32;
+    struct handoff {
+        file_desc fd;
+        socket_address addr;
+        conntrack::handle cth;
+    };
     socket_address _sa;
     int _protocol;
     pollable_fd _lfd;
@@ -166,6 +236,13 @@ class posix_server_socket_impl : public server_socket_impl {
     server_socket::load_balancing_algorithm _lba;
     shard_id _fixed_cpu;
     std::pmr::polymorphic_allocator<char>* _allocator;
+    // Connections for this shard accepted in a batch, not yet returned
+    std::deque<accept_result> _accepted;
+
+    conntrack::handle connection_handle(const file_desc& fd, const socket_address& sa);
+    using handoff_map = std::map<shard_id, std::vector<handoff>>;
+    void dispatch(file_desc fd, socket_address sa, handoff_map& handoffs);
+    void hand_off(handoff_map handoffs);
 public:
     explicit posix_server_socket_impl(int protocol, socket_address sa, pollable_fd lfd,
         server_socket::load_balancing_algorithm lba, shard_id fixed_cpu,
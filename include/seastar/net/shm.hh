@@ -0,0 +1,94 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <seastar/net/api.hh>
+
+namespace seastar {
+
+namespace net {
+
+/// \addtogroup networking-module
+/// @{
+
+/// Options of a shared memory connection.
+struct shm_options {
+    /// The bytes of each of the two rings of a connection; a power of
+    /// two. Set by the side connecting, the listening side accepts any
+    /// size up to \ref max_ring_size.
+    size_t ring_size = 1 << 20;
+    /// The largest ring a listening side accepts.
+    size_t max_ring_size = 64 << 20;
+    /// How long a side with nothing to read keeps polling the ring,
+    /// letting other tasks run in between, before it sleeps on its
+    /// eventfd. Polling saves the peer the eventfd write and this side
+    /// the wakeup while calls keep coming, at the cost of the reactor
+    /// not idling. 0 sleeps right away.
+    std::chrono::microseconds poll_for{0};
+};
+
+/// Listens for shared memory connections of processes of this host.
+///
+/// Shared memory connections carry a byte stream, like TCP, through two
+/// lockless single producer, single consumer rings in a memfd mapped by
+/// both processes; a side only makes a system call to wake a peer that
+/// went to sleep waiting on it. Whatever runs over a \ref connected_socket
+/// runs over them unchanged; an rpc::protocol::server takes the returned
+/// \ref server_socket.
+///
+/// Peers connect to a unix domain socket bound at \c addr and hand the
+/// memfd and the wakeup eventfds over it, so the file system permissions
+/// of the socket decide who may connect. The socket then stays open to
+/// tell each side the other went away, even if it crashed.
+///
+/// The protocol, for peers that aren't seastar processes: the connecting
+/// side creates a memfd of 4096 + 2 * (128 + ring_size) bytes, starting
+/// with the little endian 32 bit magic 0x5353484d, the 32 bit version 1
+/// and the 64 bit ring_size, followed at offset 4096 by the ring from
+/// the connecting side, then the ring to it. A ring is a 128 byte header
+/// and its data. The header holds at offset 0 the 64 bit tail, the bytes
+/// ever written, and the 32 bit flag the writer closed; at offset 64 the
+/// 64 bit head, the bytes ever read, and the 32 bit flags the reader
+/// closed, the reader sleeps and the writer sleeps. The connecting side
+/// sends a byte with the memfd and four eventfds as SCM_RIGHTS: to wake
+/// the reader, then the writer, of the first ring, then of the second;
+/// the listening side answers a byte once it mapped the memfd. A side
+/// about to sleep sets its flag, checks the ring again, and waits on its
+/// eventfd; a side that moved the head or the tail clears the flag of a
+/// sleeping peer and writes its eventfd.
+///
+/// The connections handshake one at a time, each in the accept() that
+/// returns it.
+server_socket shm_listen(socket_address addr, shm_options opts = {});
+
+/// A \ref socket connecting to a \ref shm_listen() listener of this host
+/// at the unix domain address passed to connect(). Can be given to
+/// rpc::protocol::client.
+socket shm_socket(shm_options opts = {});
+
+/// @}
+
+}
+
+}
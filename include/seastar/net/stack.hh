@@ -23,6 +23,7 @@
 #include <chrono>
 #include <seastar/net/api.hh>
 #include <seastar/core/memory.hh>
+#include <seastar/core/posix.hh>
 #include "../core/internal/api-level.hh"
 
 namespace seastar {
@@ -46,7 +47,14 @@ class connected_socket_impl {
     virtual keepalive_params get_keepalive_parameters() const = 0;
     virtual void set_sockopt(int level, int optname, const void* data, size_t len) = 0;
     virtual int get_sockopt(int level, int optname, void* data, size_t len) const = 0;
+    virtual tcp_connection_stats get_tcp_stats() const;
     virtual socket_address local_address() const noexcept = 0;
+    // Sends a single TLS record of the given content type through a socket
+    // whose record layer was handed to the kernel (kTLS)
+    virtual future<> send_tls_record(uint8_t content_type, temporary_buffer<char> data);
+    virtual future<> send_fds(temporary_buffer<char> data, std::vector<file_desc> fds);
+    virtual future<fd_message> receive_fds(size_t max_size);
+    virtual file_desc dup_fd() const;
 };
 
 class socket_impl {
@@ -72,8 +80,10 @@ class udp_channel_impl {
     virtual ~udp_channel_impl() {}
     virtual socket_address local_address() const = 0;
     virtual future<udp_datagram> receive() = 0;
+    virtual future<std::vector<udp_datagram>> receive_batch();
     virtual future<> send(const socket_address& dst, const char* msg) = 0;
     virtual future<> send(const socket_address& dst, packet p) = 0;
+    virtual future<> send_batch(const socket_address& dst, std::vector<packet> datagrams);
     virtual void shutdown_input() = 0;
     virtual void shutdown_output() = 0;
     virtual bool is_closed() const = 0;
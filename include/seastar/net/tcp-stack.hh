@@ -32,10 +32,12 @@ struct listen_options;
 
 class server_socket;
 class connected_socket;
+class socket_address;
 
 namespace net {
 
 struct ipv4_traits;
+struct ipv6_traits;
 template <typename InetTraits>
 class tcp;
 
@@ -45,6 +47,20 @@ tcpv4_listen(tcp<ipv4_traits>& tcpv4, uint16_t port, listen_options opts);
 seastar::socket
 tcpv4_socket(tcp<ipv4_traits>& tcpv4);
 
+server_socket
+tcpv6_listen(tcp<ipv6_traits>& tcpv6, uint16_t port, listen_options opts);
+
+seastar::socket
+tcpv6_socket(tcp<ipv6_traits>& tcpv6);
+
+// Listens over IPv4 or IPv6, depending on the family of the address
+server_socket
+tcp_dual_stack_listen(tcp<ipv4_traits>& tcpv4, tcp<ipv6_traits>& tcpv6, socket_address sa, listen_options opts);
+
+// Connects over IPv4 or IPv6, depending on the family of the address
+seastar::socket
+tcp_dual_stack_socket(tcp<ipv4_traits>& tcpv4, tcp<ipv6_traits>& tcpv6);
+
 }
 
 }
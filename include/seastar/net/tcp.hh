@@ -31,12 +31,14 @@
 #include <seastar/net/ip.hh>
 #include <seastar/net/const.hh>
 #include <seastar/net/packet-util.hh>
+#include <seastar/net/tcp_congestion_control.hh>
 #include <seastar/util/std-compat.hh>
 #include <unordered_map>
 #include <map>
 #include <functional>
 #include <deque>
 #include <chrono>
+#include <optional>
 #include <random>
 #include <stdexcept>
 #include <system_error>
@@ -95,7 +97,7 @@ void tcp_debug(const char* fmt, Args&&... args) {
 
 struct tcp_option {
     // The kind and len field are fixed and defined in TCP protocol
-    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, timestamps = 8,  nop = 1, eol = 0 };
+    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, sack_blocks = 5, timestamps = 8,  nop = 1, eol = 0 };
     enum class option_len:  uint8_t { mss = 4, win_scale = 3, sack = 2, timestamps = 10, nop = 1, eol = 1 };
     static void write(char* p, option_kind kind, option_len len) {
         p[0] = static_cast<uint8_t>(kind);
@@ -172,11 +174,24 @@ struct tcp_option {
             tcp_option::write(p, kind, len);
         }
     };
+    // A block of data received out of order, reported in a SACK option (RFC 2018)
+    struct sack_block {
+        uint32_t start;
+        uint32_t end;
+    };
+    // Without timestamps, four blocks fit in the option space
+    static constexpr unsigned max_sack_blocks = 4;
+    static constexpr uint8_t sack_blocks_size(unsigned nr_blocks) {
+        // Two NOPs, kind and length, then the blocks
+        return nr_blocks ? 4 + 8 * nr_blocks : 0;
+    }
     static const uint8_t align = 4;
 
     void parse(uint8_t* beg, uint8_t* end);
-    uint8_t fill(void* h, const tcp_hdr* th, uint8_t option_size);
-    uint8_t get_size(bool syn_on, bool ack_on);
+    // Reads the SACK blocks of an ACK into \c blocks, and returns their number
+    static unsigned parse_sack_blocks(const uint8_t* beg, const uint8_t* end, sack_block* blocks);
+    uint8_t fill(void* h, const tcp_hdr* th, uint8_t option_size, const sack_block* blocks = nullptr, unsigned nr_blocks = 0);
+    uint8_t get_size(bool syn_on, bool ack_on, unsigned nr_blocks = 0);
 
     // For option negotiattion
     bool _mss_received = false;
@@ -287,6 +302,214 @@ struct tcp_hdr {
 struct tcp_tag {};
 using tcp_packet_merger = packet_merger<tcp_seq, tcp_tag>;
 
+/// SACK blocks reporting the data received out of order (RFC 2018).
+///
+/// \c out_of_order maps the start of each segment received above \c rcv_next
+/// to the segment. The first block covers \c recent, the most recently
+/// received segment, the others follow in sequence order. Returns the number
+/// of blocks written to \c blocks.
+template <typename OutOfOrderMap>
+unsigned make_sack_blocks(const OutOfOrderMap& out_of_order, tcp_seq rcv_next, tcp_seq recent, tcp_option::sack_block* blocks) {
+    if (out_of_order.empty()) {
+        return 0;
+    }
+    unsigned nr_blocks = 1;
+    bool have_recent = false;
+    auto add_block = [&] (tcp_seq beg, tcp_seq end) {
+        if (beg <= recent && recent < end) {
+            blocks[0] = {beg.raw, end.raw};
+            have_recent = true;
+        } else if (nr_blocks < tcp_option::max_sack_blocks) {
+            blocks[nr_blocks++] = {beg.raw, end.raw};
+        }
+    };
+    std::optional<std::pair<tcp_seq, tcp_seq>> range;
+    for (auto& [seg_beg, seg_p] : out_of_order) {
+        auto seg_end = seg_beg + seg_p.len();
+        if (seg_end <= rcv_next) {
+            continue;
+        }
+        if (range && seg_beg <= range->second) {
+            range->second = std::max(range->second, seg_end);
+        } else {
+            if (range) {
+                add_block(range->first, range->second);
+            }
+            range.emplace(std::max(seg_beg, rcv_next), seg_end);
+        }
+    }
+    if (range) {
+        add_block(range->first, range->second);
+    }
+    if (!have_recent) {
+        std::copy(blocks + 1, blocks + nr_blocks, blocks);
+        nr_blocks--;
+    }
+    return nr_blocks;
+}
+
+/// The SACK blocks that fit in a retransmission of a \c len byte segment.
+///
+/// The segment was sized for the options of its first transmission, so
+/// blocks are dropped until the segment and the options fit in \c mss.
+inline unsigned fit_sack_blocks(uint32_t len, uint16_t mss, unsigned nr_blocks) {
+    while (nr_blocks && len <= mss && len + tcp_option::sack_blocks_size(nr_blocks) > mss) {
+        nr_blocks--;
+    }
+    return nr_blocks;
+}
+
+/// Sender side SACK scoreboard (RFC 6675).
+///
+/// The segments are those sent but not yet acknowledged, starting at
+/// SND.UNA, in sequence order. Each has a \c p packet, and \c sacked and
+/// \c lost_retransmitted flags that the scoreboard maintains.
+struct tcp_sack_scoreboard {
+    static constexpr unsigned dupthresh = 3;
+    // The bytes in sacked segments
+    uint32_t sacked_bytes = 0;
+    // Segments that end at or below it and are not sacked are deemed lost
+    tcp_seq lost_boundary = {};
+    // Segments retransmitted during the current loss recovery
+    unsigned recovery_retransmits = 0;
+
+    bool is_lost(tcp_seq seg_end) const {
+        return seg_end <= lost_boundary;
+    }
+
+    // Marks the segments covered by SACK blocks, and applies IsLost()
+    template <typename Segments>
+    void update(Segments& segs, tcp_seq una, uint16_t mss, const tcp_option::sack_block* blocks, unsigned nr_blocks) {
+        auto seq = una;
+        for (auto& seg : segs) {
+            uint32_t len = seg.p.len();
+            auto end = seq + len;
+            for (unsigned i = 0; i < nr_blocks && !seg.sacked; ++i) {
+                if (make_seq(blocks[i].start) <= seq && end <= make_seq(blocks[i].end)) {
+                    seg.sacked = true;
+                    sacked_bytes += len;
+                }
+            }
+            seq = end;
+        }
+        // IsLost(): a segment is lost if DupThresh segments, or more than
+        // (DupThresh - 1) * SMSS bytes, above it were sacked
+        unsigned sacked_above = 0;
+        uint32_t sacked_bytes_above = 0;
+        for (auto it = segs.rbegin(); it != segs.rend(); ++it) {
+            uint32_t len = it->p.len();
+            if (it->sacked) {
+                sacked_above++;
+                sacked_bytes_above += len;
+            } else if (sacked_above >= dupthresh || sacked_bytes_above > (dupthresh - 1) * mss) {
+                if (lost_boundary < seq) {
+                    lost_boundary = seq;
+                }
+                break;
+            }
+            seq -= len;
+        }
+    }
+
+    // Forgets what was sacked, as the receiver may have reneged on it
+    template <typename Segments>
+    void clear(Segments& segs, tcp_seq una) {
+        for (auto& seg : segs) {
+            seg.sacked = false;
+            seg.lost_retransmitted = false;
+        }
+        sacked_bytes = 0;
+        recovery_retransmits = 0;
+        lost_boundary = una;
+    }
+
+    template <typename Segments>
+    void end_recovery(Segments& segs) {
+        if (recovery_retransmits) {
+            for (auto& seg : segs) {
+                seg.lost_retransmitted = false;
+            }
+            recovery_retransmits = 0;
+        }
+    }
+
+    // SetPipe(): the bytes estimated to be in the network
+    template <typename Segments>
+    uint32_t pipe(const Segments& segs, tcp_seq una) const {
+        uint32_t in_network = 0;
+        auto seq = una;
+        for (auto& seg : segs) {
+            uint32_t len = seg.p.len();
+            seq += len;
+            if (!seg.sacked) {
+                if (!is_lost(seq)) {
+                    in_network += len;
+                }
+                if (seg.lost_retransmitted) {
+                    in_network += len;
+                }
+            }
+        }
+        return in_network;
+    }
+
+    // NextSeg() rule 1: calls retransmit(seg, seq) for the lost segments in
+    // sequence order while the window allows. The segment at SND.UNA is
+    // retransmitted regardless of the window when \c front_lost is set.
+    template <typename Segments, typename Func>
+    void next_segs(Segments& segs, tcp_seq una, uint32_t cwnd, uint16_t mss, bool front_lost, Func&& retransmit) {
+        auto in_network = pipe(segs, una);
+        auto seq = una;
+        bool first = true;
+        for (auto& seg : segs) {
+            uint32_t len = seg.p.len();
+            auto end = seq + len;
+            if (!is_lost(end) && !(first && front_lost)) {
+                break;
+            }
+            if (!seg.sacked && !seg.lost_retransmitted) {
+                if (!first && in_network + mss > cwnd) {
+                    break;
+                }
+                seg.lost_retransmitted = true;
+                recovery_retransmits++;
+                retransmit(seg, seq);
+                in_network += len;
+            }
+            first = false;
+            seq = end;
+        }
+    }
+};
+
+/// Congestion control and round-trip time state of a connection.
+struct tcp_connection_info {
+    tcp_state state;
+    /// Congestion window, in bytes
+    uint32_t cwnd;
+    /// Slow start threshold, in bytes
+    uint32_t ssthresh;
+    /// Sender maximum segment size
+    uint16_t snd_mss;
+    /// Receiver maximum segment size
+    uint16_t rcv_mss;
+    /// Bytes sent but not yet acknowledged
+    uint32_t flight_size;
+    /// Bytes sent and selectively acknowledged, but not yet cumulatively
+    /// acknowledged
+    uint32_t sacked_bytes;
+    /// Smoothed round-trip time
+    std::chrono::milliseconds srtt;
+    /// Round-trip time variation
+    std::chrono::milliseconds rttvar;
+    /// Retransmission timeout
+    std::chrono::milliseconds rto;
+    /// Segments retransmitted over the lifetime of the connection
+    uint32_t total_retransmits;
+    /// Bytes queued for sending but not yet sent
+    uint32_t unsent_bytes;
+};
+
 template <typename InetTraits>
 class tcp {
 public:
@@ -294,6 +517,14 @@ class tcp {
     using inet_type = typename InetTraits::inet_type;
     using connid = l4connid<InetTraits>;
     using connid_hash = typename connid::connid_hash;
+    // Devices only steer IPv4 flows
+    static std::optional<flow_key> flow_of(const connid& id) {
+        if constexpr (std::is_same_v<ipaddr, ipv4_address>) {
+            return flow_key{uint8_t(ip_protocol_num::tcp), id.foreign_ip.ip, id.local_ip.ip, id.foreign_port, id.local_port};
+        } else {
+            return std::nullopt;
+        }
+    }
     class connection;
     class listener;
 private:
@@ -320,11 +551,17 @@ class tcp {
         ipaddr _foreign_ip;
         uint16_t _local_port;
         uint16_t _foreign_port;
+        // The device steers the packets of the connection to this shard
+        bool _hw_steered = false;
         struct unacked_segment {
             packet p;
             uint16_t data_len;
             unsigned nr_transmits;
             clock_type::time_point tx_time;
+            // Reported received by a SACK block
+            bool sacked = false;
+            // Retransmitted during the current SACK-based loss recovery
+            bool lost_retransmitted = false;
         };
         struct send {
             tcp_seq unacknowledged;
@@ -365,6 +602,8 @@ class tcp {
             uint32_t limited_transfer = 0;
             uint32_t partial_ack = 0;
             tcp_seq recover;
+            tcp_sack_scoreboard sack;
+            uint32_t total_retransmits = 0;
             bool window_probe = false;
             uint8_t zero_window_probing_out = 0;
         } _snd;
@@ -379,12 +618,16 @@ class tcp {
             // The total size of data stored in std::deque<packet> data
             size_t data_size = 0;
             tcp_packet_merger out_of_order;
+            // Start of the most recently received out-of-order segment,
+            // which is reported first in SACK blocks
+            tcp_seq last_out_of_order;
             std::optional<promise<>> _data_received_promise;
             // The maximun memory buffer size allowed for receiving
             // Currently, it is the same as default receive window size when window scaling is enabled
             size_t max_receive_buf_size = 3737600;
         } _rcv;
         tcp_option _option;
+        std::unique_ptr<tcp_congestion_control> _cc;
         timer<lowres_clock> _delayed_ack;
         // Retransmission timeout
         std::chrono::milliseconds _rto{1000};
@@ -428,7 +671,9 @@ class tcp {
         void input_handle_listen_state(tcp_hdr* th, packet p);
         void input_handle_syn_sent_state(tcp_hdr* th, packet p);
         void input_handle_other_state(tcp_hdr* th, packet p);
-        void output_one(bool data_retransmit = false);
+        void output_one(bool data_retransmit = false) {
+            output_segment(data_retransmit ? &_snd.data.front() : nullptr, _snd.unacknowledged);
+        }
         future<> wait_for_data();
         void abort_reader();
         future<> wait_for_all_data_acked();
@@ -437,9 +682,16 @@ class tcp {
         void connect();
         packet read();
         void close();
+        void set_hw_steered(bool steered) noexcept {
+            _hw_steered = steered;
+        }
         void remove_from_tcbs() {
             auto id = connid{_local_ip, _foreign_ip, _local_port, _foreign_port};
             _tcp._tcbs.erase(id);
+            if (_hw_steered) {
+                _hw_steered = false;
+                _tcp._inet._inet.netif()->unsteer_flow(*flow_of(id));
+            }
         }
         std::optional<typename InetTraits::l4packet> get_packet();
         void output() {
@@ -469,14 +721,30 @@ class tcp {
         tcp_state& state() {
             return _state;
         }
+        void set_congestion_control(std::string_view name) {
+            _cc = make_tcp_congestion_control(name);
+        }
+        const char* congestion_control() const noexcept {
+            return _cc->name();
+        }
+        tcp_connection_info info() const noexcept {
+            return tcp_connection_info{_state, _snd.cwnd, _snd.ssthresh, _snd.mss, _rcv.mss, uint32_t(_snd.next - _snd.unacknowledged),
+                    _snd.sack.sacked_bytes, _snd.first_rto_sample ? 0ms : _snd.srtt, _snd.first_rto_sample ? 0ms : _snd.rttvar, _rto,
+                    _snd.total_retransmits, _snd.unsent_len};
+        }
     private:
+        tcp_congestion_control::state congestion_state(uint32_t in_flight) const noexcept {
+            return {_snd.cwnd, _snd.ssthresh, _snd.mss, in_flight, _snd.first_rto_sample ? 0ms : _snd.srtt};
+        }
         void respond_with_reset(tcp_hdr* th);
         bool merge_out_of_order();
         void insert_out_of_order(tcp_seq seq, packet p);
         void trim_receive_data_after_window();
         bool should_send_ack(uint16_t seg_len);
         void clear_delayed_ack();
-        packet get_transmit_packet();
+        packet get_transmit_packet(uint8_t options_size);
+        // Sends a new segment, or retransmits \c retransmit which starts at \c retransmit_seq
+        void output_segment(unacked_segment* retransmit, tcp_seq retransmit_seq);
         void retransmit_one() {
             bool data_retransmit = true;
             output_one(data_retransmit);
@@ -508,6 +776,14 @@ class tcp {
         void fast_retransmit();
         void update_rto(clock_type::time_point tx_time);
         void update_cwnd(uint32_t acked_bytes);
+        bool sack_enabled() const noexcept {
+            return _option._sack_received;
+        }
+        unsigned get_sack_blocks(tcp_option::sack_block* blocks);
+        void update_scoreboard(const tcp_option::sack_block* blocks, unsigned nr_blocks);
+        void clear_scoreboard();
+        uint32_t pipe();
+        void sack_retransmit(bool front_lost);
         void cleanup();
         uint32_t can_send() {
             if (_snd.window_probe) {
@@ -538,6 +814,12 @@ class tcp {
                 x = flight <= max ? std::min(x, max - flight) : 0;
                 _snd.limited_transfer += x;
             } else if (_snd.dupacks >= 3) {
+                if (sack_enabled()) {
+                    // RFC6675: send while cwnd exceeds the estimated number
+                    // of bytes still in the network
+                    auto in_network = pipe();
+                    x = _snd.cwnd > in_network ? std::min(x, _snd.cwnd - in_network) : 0;
+                }
                 // RFC5681 Step 3.5
                 // Sent 1 full-sized segment at most
                 x = std::min(uint32_t(_snd.mss), x);
@@ -620,6 +902,7 @@ class tcp {
             _snd.unacknowledged = _snd.initial;
             _snd.next = _snd.initial + 1;
             _snd.recover = _snd.initial;
+            _snd.sack.lost_boundary = _snd.initial;
         }
         void do_local_fin_acked() {
             _snd.unacknowledged += 1;
@@ -645,6 +928,7 @@ class tcp {
             _snd.dupacks = 0;
             _snd.limited_transfer = 0;
             _snd.partial_ack = 0;
+            _snd.sack.end_recovery(_snd.data);
         }
         uint32_t data_segment_acked(tcp_seq seg_ack);
         bool segment_acceptable(tcp_seq seg_seq, unsigned seg_len);
@@ -659,8 +943,14 @@ class tcp {
     std::uniform_int_distribution<uint16_t> _port_dist{41952, 65535};
     circular_buffer<std::pair<lw_shared_ptr<tcb>, ethernet_address>> _poll_tcbs;
     // queue for packets that do not belong to any tcb
-    circular_buffer<ipv4_traits::l4packet> _packetq;
+    circular_buffer<typename InetTraits::l4packet> _packetq;
     semaphore _queue_space = {212992};
+    std::string _congestion_control = "reno";
+    uint64_t _fast_retransmits = 0;
+    uint64_t _retransmit_timeouts = 0;
+    uint64_t _sack_blocks_received = 0;
+    uint64_t _sack_blocks_sent = 0;
+    uint64_t _sack_retransmits = 0;
     metrics::metric_groups _metrics;
 public:
     const inet_type& inet() const {
@@ -707,6 +997,17 @@ class tcp {
         uint16_t local_port() {
             return _tcb->_local_port;
         }
+        // Switches the connection to another congestion control algorithm,
+        // keeping the current congestion window
+        void set_congestion_control(std::string_view name) {
+            _tcb->set_congestion_control(name);
+        }
+        const char* congestion_control() const noexcept {
+            return _tcb->congestion_control();
+        }
+        tcp_connection_info info() const noexcept {
+            return _tcb->info();
+        }
         void shutdown_connect();
         void close_read();
         void close_write();
@@ -759,6 +1060,11 @@ class tcp {
     listener listen(uint16_t port, size_t queue_length = 100);
     connection connect(socket_address sa);
     const net::hw_features& hw_features() const { return _inet._inet.hw_features(); }
+    // Sets the congestion control algorithm of new connections
+    void set_congestion_control(std::string name) {
+        make_tcp_congestion_control(name);
+        _congestion_control = std::move(name);
+    }
     future<> poll_tcb(ipaddr to, lw_shared_ptr<tcb> tcb);
     void add_connected_tcb(lw_shared_ptr<tcb> tcbp, uint16_t local_port) {
         auto it = _listening.find(local_port);
@@ -779,10 +1085,23 @@ tcp<InetTraits>::tcp(inet_type& inet)
     , _e(_rd()) {
     namespace sm = metrics;
 
+    // The IPv4 and IPv6 instances of a shard are told apart by a label
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("ip_version", std::is_same_v<typename InetTraits::address_type, ipv6_address> ? "6" : "4"));
     _metrics.add_group("tcp", {
         sm::make_derive("linearizations", [] { return tcp_packet_merger::linearizations(); },
                         sm::description("Counts a number of times a buffer linearization was invoked during the buffers merge process. "
-                                        "Divide it by a total TCP receive packet rate to get an everage number of lineraizations per TCP packet."))
+                                        "Divide it by a total TCP receive packet rate to get an everage number of lineraizations per TCP packet."), labels),
+        sm::make_derive("fast_retransmits", _fast_retransmits,
+                        sm::description("Counts the losses detected by duplicate acknowledgements, each of which starts a fast recovery."), labels),
+        sm::make_derive("retransmit_timeouts", _retransmit_timeouts,
+                        sm::description("Counts data retransmissions triggered by the retransmission timer, each of which collapses the congestion window."), labels),
+        sm::make_derive("sack_blocks_received", _sack_blocks_received,
+                        sm::description("Counts the SACK blocks received, each reporting a range of data the peer received out of order."), labels),
+        sm::make_derive("sack_blocks_sent", _sack_blocks_sent,
+                        sm::description("Counts the SACK blocks sent, each reporting a range of data received out of order."), labels),
+        sm::make_derive("sack_retransmits", _sack_retransmits,
+                        sm::description("Counts segments retransmitted during SACK-based loss recovery, other than the first one of each recovery."), labels),
     });
 
     _inet.register_packet_provider([this, tcb_polled = 0u] () mutable {
@@ -808,6 +1127,14 @@ tcp<InetTraits>::tcp(inet_type& inet)
         }
         return l4p;
     });
+    // Lets the device keep the packets of established connections coming
+    // to this shard when it moves their redirection table bucket
+    _inet._inet.netif()->register_flow_provider([this] (std::vector<uint32_t>& hashes) {
+        auto rss_key = _inet._inet.netif()->rss_key();
+        for (auto& c : _tcbs) {
+            hashes.push_back(c.first.hash(rss_key));
+        }
+    });
 }
 
 template <typename InetTraits>
@@ -826,18 +1153,33 @@ template <typename InetTraits>
 auto tcp<InetTraits>::connect(socket_address sa) -> connection {
     uint16_t src_port;
     connid id;
-    auto src_ip = _inet._inet.host_address();
-    auto dst_ip = ipv4_address(sa);
-    auto dst_port = net::ntoh(sa.u.in.sin_port);
-
-    do {
-        src_port = _port_dist(_e);
-        id = connid{src_ip, dst_ip, src_port, dst_port};
-    } while (_inet._inet.netif()->hw_queues_count() > 1 &&
-             (_inet._inet.netif()->hash2cpu(id.hash(_inet._inet.netif()->rss_key())) != this_shard_id()
-              || _tcbs.find(id) != _tcbs.end()));
+    auto dst_ip = ipaddr(sa);
+    auto src_ip = _inet._inet.source_address(dst_ip);
+    auto dst_port = sa.port();
+    auto netif = _inet._inet.netif();
+    bool steered = false;
+
+    if (netif->hw_queues_count() > 1) {
+        // Have the device steer the replies here, sparing the search for a
+        // port whose hash lands on this shard; if it can't, search
+        do {
+            src_port = _port_dist(_e);
+            id = connid{src_ip, dst_ip, src_port, dst_port};
+        } while (_tcbs.find(id) != _tcbs.end());
+        auto flow = flow_of(id);
+        steered = flow && netif->steer_flow(*flow);
+    }
+    if (!steered) {
+        do {
+            src_port = _port_dist(_e);
+            id = connid{src_ip, dst_ip, src_port, dst_port};
+        } while (netif->hw_queues_count() > 1 &&
+                 (netif->hash2cpu(id.hash(netif->rss_key())) != this_shard_id()
+                  || _tcbs.find(id) != _tcbs.end()));
+    }
 
     auto tcbp = make_lw_shared<tcb>(*this, id);
+    tcbp->set_hw_steered(steered);
     _tcbs.insert({id, tcbp});
     tcbp->connect();
     return connection(tcbp);
@@ -942,7 +1284,7 @@ void tcp<InetTraits>::send_packet_without_tcb(ipaddr from, ipaddr to, packet p)
     if (_queue_space.try_wait(p.len())) { // drop packets that do not fit the queue
         // FIXME: future is discarded
         (void)_inet.get_l2_dst_address(to).then([this, to, p = std::move(p)] (ethernet_address e_dst) mutable {
-                _packetq.emplace_back(ipv4_traits::l4packet{to, std::move(p), e_dst, ip_protocol_num::tcp});
+                _packetq.emplace_back(typename InetTraits::l4packet{to, std::move(p), e_dst, ip_protocol_num::tcp});
         });
     }
 }
@@ -966,6 +1308,7 @@ tcp<InetTraits>::tcb::tcb(tcp& t, connid id)
     , _delayed_ack([this] { _nr_full_seg_received = 0; output(); })
     , _retransmit([this] { retransmit(); })
     , _persist([this] { persist(); }) {
+    _cc = make_tcp_congestion_control(_tcp._congestion_control);
 }
 
 template <typename InetTraits>
@@ -1031,6 +1374,12 @@ uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
         }
         update_cwnd(acked_bytes);
         total_acked_bytes += acked_bytes;
+        if (_snd.data.front().sacked) {
+            _snd.sack.sacked_bytes -= acked_bytes;
+        }
+        if (_snd.data.front().lost_retransmitted) {
+            _snd.sack.recovery_retransmits--;
+        }
         _snd.current_queue_space -= _snd.data.front().data_len;
         signal_send_available();
         _snd.data.pop_front();
@@ -1041,6 +1390,9 @@ uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
         if (!_snd.data.empty()) {
             auto& unacked_seg = _snd.data.front();
             unacked_seg.p.trim_front(acked_bytes);
+            if (unacked_seg.sacked) {
+                _snd.sack.sacked_bytes -= acked_bytes;
+            }
         }
         _snd.unacknowledged = seg_ack;
         update_cwnd(acked_bytes);
@@ -1207,6 +1559,14 @@ void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
+    tcp_option::sack_block sack_blocks[tcp_option::max_sack_blocks];
+    unsigned nr_sack_blocks = 0;
+    if (sack_enabled() && th->data_offset * 4 > tcp_hdr::len) {
+        auto opt_len = th->data_offset * 4 - tcp_hdr::len;
+        auto opt_start = reinterpret_cast<uint8_t*>(p.get_header(0, th->data_offset * 4)) + tcp_hdr::len;
+        nr_sack_blocks = tcp_option::parse_sack_blocks(opt_start, opt_start + opt_len, sack_blocks);
+        _tcp._sack_blocks_received += nr_sack_blocks;
+    }
     p.trim_front(th->data_offset * 4);
     bool do_output = false;
     bool do_output_data = false;
@@ -1330,6 +1690,9 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
             if (_snd.unacknowledged < seg_ack && seg_ack <= _snd.next) {
                 // Remote ACKed data we sent
                 auto acked_bytes = data_segment_acked(seg_ack);
+                if (nr_sack_blocks) {
+                    update_scoreboard(sack_blocks, nr_sack_blocks);
+                }
 
                 // If SND.UNA < SEG.ACK =< SND.NXT, the send window should be updated.
                 if (_snd.wl1 < seg_seq || (_snd.wl1 == seg_seq && _snd.wl2 <= seg_ack)) {
@@ -1361,6 +1724,15 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                         // Exit the fast recovery procedure
                         exit_fast_recovery();
                         set_retransmit_timer();
+                    } else if (sack_enabled()) {
+                        tcp_debug("ack: partial_ack\n");
+                        // RFC6675: the window is not deflated; the hole at
+                        // SND.UNA and the lost segments are retransmitted,
+                        // then new data as the window allows
+                        sack_retransmit(true);
+                        if (++_snd.partial_ack == 1) {
+                            start_retransmit_timer();
+                        }
                     } else {
                         tcp_debug("ack: partial_ack\n");
                         // Retransmit the first unacknowledged segment
@@ -1405,6 +1777,15 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                 // Here, We follow RFC5681.
                 _snd.dupacks++;
                 uint32_t smss = _snd.mss;
+                if (nr_sack_blocks) {
+                    update_scoreboard(sack_blocks, nr_sack_blocks);
+                    // RFC6675 Section 5: enough data above SND.UNA was
+                    // received to deem it lost, even before the third
+                    // duplicate ACK
+                    if (_snd.dupacks < 3 && _snd.sack.is_lost(_snd.unacknowledged + _snd.data.front().p.len())) {
+                        _snd.dupacks = 3;
+                    }
+                }
                 // 3 duplicated ACKs trigger a fast retransmit
                 if (_snd.dupacks == 1 || _snd.dupacks == 2) {
                     // RFC5681 Step 3.1
@@ -1415,16 +1796,31 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     if (seg_ack - 1 > _snd.recover) {
                         _snd.recover = _snd.next - 1;
                         // RFC5681 Step 3.2
-                        _snd.ssthresh = std::max((flight_size() - _snd.limited_transfer) / 2, 2 * smss);
-                        fast_retransmit();
+                        _snd.ssthresh = _cc->on_loss(congestion_state(flight_size() - _snd.limited_transfer));
+                        _tcp._fast_retransmits++;
+                        if (sack_enabled()) {
+                            // RFC6675 Step 4: the window is not inflated,
+                            // data in flight is estimated by pipe() instead
+                            _snd.cwnd = _snd.ssthresh;
+                            sack_retransmit(true);
+                            do_output_data = true;
+                        } else {
+                            fast_retransmit();
+                        }
                     } else {
                         // Do not enter fast retransmit and do not reset ssthresh
                     }
-                    // RFC5681 Step 3.3
-                    _snd.cwnd = _snd.ssthresh + 3 * smss;
+                    if (!sack_enabled()) {
+                        // RFC5681 Step 3.3
+                        _snd.cwnd = _snd.ssthresh + 3 * smss;
+                    }
                 } else if (_snd.dupacks > 3) {
-                    // RFC5681 Step 3.4
-                    _snd.cwnd += smss;
+                    if (sack_enabled()) {
+                        sack_retransmit(false);
+                    } else {
+                        // RFC5681 Step 3.4
+                        _snd.cwnd += smss;
+                    }
                     // RFC5681 Step 3.5
                     do_output_data = true;
                 }
@@ -1565,7 +1961,7 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
 }
 
 template <typename InetTraits>
-packet tcp<InetTraits>::tcb::get_transmit_packet() {
+packet tcp<InetTraits>::tcb::get_transmit_packet(uint8_t options_size) {
     // easy case: empty queue
     if (_snd.unsent.empty()) {
         return packet();
@@ -1575,9 +1971,10 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
     uint32_t len;
     if (_tcp.hw_features().tx_tso) {
         // FIXME: Info tap device the size of the splitted packet
-        len = _tcp.hw_features().max_packet_len - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min;
+        len = _tcp.hw_features().max_packet_len - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min - options_size;
     } else {
-        len = std::min(uint16_t(_tcp.hw_features().mtu - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min), _snd.mss);
+        // The MSS does not account for options (RFC6691)
+        len = std::min(uint16_t(_tcp.hw_features().mtu - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min), _snd.mss) - options_size;
     }
     can_send = std::min(can_send, len);
     // easy case: one small packet
@@ -1614,18 +2011,26 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
+void tcp<InetTraits>::tcb::output_segment(unacked_segment* retransmit, tcp_seq retransmit_seq) {
     if (in_state(CLOSED)) {
         return;
     }
 
-    packet p = data_retransmit ? _snd.data.front().p.share() : get_transmit_packet();
-    packet clone = p.share();  // early clone to prevent share() from calling packet::unuse_internal_data() on header.
-    uint16_t len = p.len();
+    bool data_retransmit = retransmit;
     bool syn_on = syn_needs_on();
     bool ack_on = ack_needs_on();
+    tcp_option::sack_block sack_blocks[tcp_option::max_sack_blocks];
+    unsigned nr_sack_blocks = ack_on && !syn_on ? get_sack_blocks(sack_blocks) : 0;
+    if (data_retransmit) {
+        nr_sack_blocks = fit_sack_blocks(retransmit->p.len(), _snd.mss, nr_sack_blocks);
+    }
+    _tcp._sack_blocks_sent += nr_sack_blocks;
+    auto options_size = _option.get_size(syn_on, ack_on, nr_sack_blocks);
+
+    packet p = data_retransmit ? retransmit->p.share() : get_transmit_packet(options_size);
+    packet clone = p.share();  // early clone to prevent share() from calling packet::unuse_internal_data() on header.
+    uint16_t len = p.len();
 
-    auto options_size = _option.get_size(syn_on, ack_on);
     auto th = p.prepend_uninitialized_header(tcp_hdr::len + options_size);
     auto h = tcp_hdr{};
 
@@ -1642,7 +2047,7 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
 
     tcp_seq seq;
     if (data_retransmit) {
-        seq = _snd.unacknowledged;
+        seq = retransmit_seq;
     } else {
         seq = syn_on ? _snd.initial : _snd.next;
         _snd.next += len;
@@ -1658,7 +2063,7 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
     h.f_fin = fin_on;
 
     // Add tcp options
-    _option.fill(th, &h, options_size);
+    _option.fill(th, &h, options_size, sack_blocks, nr_sack_blocks);
     h.write(th);
 
     offload_info oi;
@@ -1680,7 +2085,7 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
         // CSUM offload case.
         //
         if (_tcp.hw_features().tx_tso && len > _snd.mss) {
-            oi.tso_seg_size = _snd.mss;
+            oi.tso_seg_size = _snd.mss - options_size;
         } else {
             pseudo_hdr_seg_len = tcp_hdr::len + options_size + len;
         }
@@ -1909,6 +2314,7 @@ bool tcp<InetTraits>::tcb::merge_out_of_order() {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::insert_out_of_order(tcp_seq seg, packet p) {
+    _rcv.last_out_of_order = seg;
     _rcv.out_of_order.merge(seg, std::move(p));
 }
 
@@ -1974,17 +2380,21 @@ void tcp<InetTraits>::tcb::retransmit() {
     // Update ssthresh only for the first retransmit
     uint32_t smss = _snd.mss;
     if (unacked_seg.nr_transmits == 0) {
-        _snd.ssthresh = std::max(flight_size() / 2, 2 * smss);
+        _snd.ssthresh = _cc->on_retransmit_timeout(congestion_state(flight_size()));
     }
+    _tcp._retransmit_timeouts++;
     // RFC6582 Step 4
     _snd.recover = _snd.next - 1;
     // Start the slow start process
     _snd.cwnd = smss;
     // End fast recovery
     exit_fast_recovery();
+    // RFC2018: the receiver may have reneged on the data it reported
+    clear_scoreboard();
 
     if (unacked_seg.nr_transmits < _max_nr_retransmit) {
         unacked_seg.nr_transmits++;
+        _snd.total_retransmits++;
     } else {
         // Delete connection when max num of retransmission is reached
         do_reset();
@@ -2000,6 +2410,7 @@ void tcp<InetTraits>::tcb::fast_retransmit() {
     if (!_snd.data.empty()) {
         auto& unacked_seg = _snd.data.front();
         unacked_seg.nr_transmits++;
+        _snd.total_retransmits++;
         retransmit_one();
         output();
     }
@@ -2033,15 +2444,45 @@ void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::update_cwnd(uint32_t acked_bytes) {
-    uint32_t smss = _snd.mss;
-    if (_snd.cwnd < _snd.ssthresh) {
-        // In slow start phase
-        _snd.cwnd += std::min(acked_bytes, smss);
-    } else {
-        // In congestion avoidance phase
-        uint32_t round_up = 1;
-        _snd.cwnd += std::max(round_up, smss * smss / _snd.cwnd);
+    // Cheaper than flight_size(), which walks the unacknowledged segments
+    uint32_t in_flight = _snd.next - _snd.unacknowledged;
+    _snd.cwnd = _cc->on_ack(congestion_state(in_flight), acked_bytes);
+}
+
+template <typename InetTraits>
+unsigned tcp<InetTraits>::tcb::get_sack_blocks(tcp_option::sack_block* blocks) {
+    if (!sack_enabled()) {
+        return 0;
     }
+    return make_sack_blocks(_rcv.out_of_order.map, _rcv.next, _rcv.last_out_of_order, blocks);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_scoreboard(const tcp_option::sack_block* blocks, unsigned nr_blocks) {
+    _snd.sack.update(_snd.data, _snd.unacknowledged, _snd.mss, blocks, nr_blocks);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::clear_scoreboard() {
+    _snd.sack.clear(_snd.data, _snd.unacknowledged);
+}
+
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::tcb::pipe() {
+    return _snd.sack.pipe(_snd.data, _snd.unacknowledged);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::sack_retransmit(bool front_lost) {
+    _snd.sack.next_segs(_snd.data, _snd.unacknowledged, _snd.cwnd, _snd.mss, front_lost, [this] (unacked_segment& seg, tcp_seq seq) {
+        if (seq != _snd.unacknowledged) {
+            _tcp._sack_retransmits++;
+        }
+        seg.nr_transmits++;
+        _snd.total_retransmits++;
+        output_segment(&seg, seq);
+    });
+    output();
 }
 
 template <typename InetTraits>
@@ -2064,8 +2505,8 @@ tcp_seq tcp<InetTraits>::tcb::get_isn() {
     //   M is the 4 microsecond timer
     using namespace std::chrono;
     uint32_t hash[4];
-    hash[0] = _local_ip.ip;
-    hash[1] = _foreign_ip.ip;
+    hash[0] = std::hash<ipaddr>()(_local_ip);
+    hash[1] = std::hash<ipaddr>()(_foreign_ip);
     hash[2] = (_local_port << 16) + _foreign_port;
     hash[3] = _isn_secret.key[15];
     CryptoPP::Weak::MD5::Transform(hash, _isn_secret.key);
@@ -2090,10 +2531,11 @@ std::optional<typename InetTraits::l4packet> tcp<InetTraits>::tcb::get_packet()
 
     auto p = std::move(_packetq.front());
     _packetq.pop_front();
-    if (!_packetq.empty() || (_snd.dupacks < 3 && can_send() > 0 && (_snd.window > 0))) {
+    if (!_packetq.empty() || ((_snd.dupacks < 3 || sack_enabled()) && can_send() > 0 && (_snd.window > 0))) {
         // If there are packets to send in the queue or tcb is allowed to send
         // more add tcp back to polling set to keep sending. In addition, dupacks >= 3
-        // is an indication that an segment is lost, stop sending more in this case.
+        // is an indication that an segment is lost, stop sending more in this case,
+        // unless SACK tells how much data is still in flight.
         // Finally - we can't send more until window is opened again.
         output();
     }
@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace seastar {
+
+namespace net {
+
+/// \brief Congestion control algorithm of a native stack TCP connection.
+///
+/// The connection itself takes care of loss detection and recovery (fast
+/// retransmit, fast recovery and retransmission timeouts); the algorithm
+/// decides how the congestion window grows as data is acknowledged, and
+/// how far it is reduced when a loss is detected.
+///
+/// The available algorithms are \c reno (RFC 5681), \c cubic (RFC 8312) and
+/// \c bbr. The algorithm is chosen for all connections of a stack with the
+/// \c --tcp-congestion-control option, and per connection by setting the
+/// \c TCP_CONGESTION socket option with \ref connected_socket::set_sockopt().
+class tcp_congestion_control {
+public:
+    /// Snapshot of the connection's state passed to the algorithm.
+    struct state {
+        /// Congestion window, in bytes
+        uint32_t cwnd;
+        /// Slow start threshold, in bytes
+        uint32_t ssthresh;
+        /// Sender maximum segment size
+        uint16_t mss;
+        /// Bytes sent but not yet acknowledged, not including any bytes
+        /// being acknowledged
+        uint32_t flight_size;
+        /// Smoothed round-trip time
+        std::chrono::milliseconds srtt;
+    };
+
+    virtual ~tcp_congestion_control() {}
+
+    /// The name of the algorithm, as accepted by \ref make_tcp_congestion_control().
+    virtual const char* name() const noexcept = 0;
+
+    /// Called when new data is acknowledged.
+    ///
+    /// \param s the connection's state
+    /// \param acked_bytes the number of newly acknowledged bytes
+    /// \return the new congestion window
+    virtual uint32_t on_ack(const state& s, uint32_t acked_bytes) noexcept = 0;
+
+    /// Called when three duplicate acknowledgements indicate a loss, on
+    /// entering fast recovery.
+    ///
+    /// \return the new slow start threshold; the congestion window is
+    ///         inflated from it during fast recovery, and deflated to it on
+    ///         leaving it.
+    virtual uint32_t on_loss(const state& s) noexcept = 0;
+
+    /// Called when the retransmission timer expires for the first time for
+    /// a segment. The congestion window is then reset to one segment.
+    ///
+    /// \return the new slow start threshold
+    virtual uint32_t on_retransmit_timeout(const state& s) noexcept = 0;
+};
+
+/// Creates an instance of the congestion control algorithm called \c name.
+///
+/// \throws std::invalid_argument if there is no such algorithm
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(std::string_view name);
+
+}
+
+}
@@ -20,14 +20,19 @@
  */
 #pragma once
 
+#include <chrono>
 #include <functional>
+#include <optional>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/any.hpp>
 
 #include <seastar/core/future.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <seastar/core/scheduling.hh>
+#include <seastar/util/noncopyable_function.hh>
 #include <seastar/net/socket_defs.hh>
 #include <seastar/util/std-compat.hh>
 #include <seastar/net/api.hh>
@@ -65,6 +70,13 @@ namespace tls {
     class certificate_credentials;
     class credentials_builder;
 
+    /**
+     * Runs a private key operation (an RSA signature or decryption) somewhere
+     * other than the reactor, e.g. on a thread pool, and resolves once it is
+     * done. See certificate_credentials::set_private_key_executor().
+     */
+    using private_key_executor = std::function<future<>(noncopyable_function<void()>)>;
+
     /**
      * Diffie-Hellman parameters for
      * wire encryption.
@@ -210,6 +222,60 @@ namespace tls {
          */
         void set_dn_verification_callback(dn_callback);
 
+        /**
+         * Hands encryption of outgoing records over to the kernel (kTLS) once
+         * the handshake completes, so that writes skip the userspace copy and
+         * encryption pass. Only used with TLS 1.2 and 1.3 sessions using
+         * AES-GCM or ChaCha20-Poly1305 on sockets of the posix stack; any
+         * other session, or a kernel without the tls module, silently keeps
+         * encrypting in userspace. Incoming records are always decrypted in
+         * userspace.
+         *
+         * Renegotiation and TLS 1.3 key updates cannot be performed once
+         * transmission is offloaded and fail the session.
+         */
+        void enable_kernel_tls(bool);
+
+        /**
+         * Remembers the parameters of up to \c max_entries sessions, keyed
+         * by the server name given to connect(), and offers them when
+         * connecting to the same name again, so that the server can resume
+         * the session (from a ticket or its session cache) instead of doing
+         * a full handshake. Connections without a server name always do a
+         * full handshake.
+         */
+        void enable_session_resumption(size_t max_entries);
+
+        /**
+         * Sets the application protocols to negotiate with ALPN (RFC 7301),
+         * most preferred first, e.g. {"h2", "http/1.1"}. Clients offer them
+         * all, servers select the first of their own list which the client
+         * offered, or none if they have none in common. See
+         * get_alpn_protocol().
+         */
+        void set_alpn_protocols(const std::vector<sstring>& protocols);
+
+        /**
+         * Runs the handshake computations of sessions using these
+         * credentials in the given scheduling group, so that they compete
+         * with the rest of the shard according to its shares rather than
+         * inline with whatever accepted or connected the socket.
+         */
+        void set_handshake_scheduling_group(scheduling_group);
+
+        /**
+         * Hands the operations with the RSA private keys loaded after this
+         * call to \c executor, which typically runs them on a thread pool,
+         * while the handshake waits without blocking the reactor. A single
+         * 2048 bit RSA signature takes about a millisecond, far longer than
+         * the task quota. Keys of other types, which are much cheaper to
+         * use, stay on the reactor.
+         *
+         * The operations only use the key, so they are safe to run on any
+         * thread.
+         */
+        void set_private_key_executor(private_key_executor executor);
+
     private:
         class impl;
         friend class session;
@@ -248,8 +314,35 @@ namespace tls {
         server_credentials& operator=(const server_credentials&) = delete;
 
         void set_client_auth(client_auth);
+
+        /**
+         * Issues session tickets, which let returning clients resume their
+         * session without a full handshake. Tickets are encrypted with keys
+         * derived from the master \c key (see generate_session_ticket_key())
+         * and the current time, rotated every \c lifetime, which is also how
+         * long a ticket stays valid. Credentials of different shards that
+         * are given the same master key accept each others tickets and rotate
+         * in step.
+         *
+         * Calling this again replaces the master key, invalidating all
+         * tickets issued so far.
+         */
+        void enable_session_tickets(const blob& key, std::chrono::seconds lifetime = std::chrono::hours(6));
+
+        /**
+         * Keeps up to \c max_entries sessions for \c lifetime, so that TLS 1.2
+         * clients which do not use tickets can resume them by session id.
+         * The cache belongs to this object, i.e. usually to a single shard.
+         */
+        void enable_session_cache(size_t max_entries, std::chrono::seconds lifetime = std::chrono::hours(1));
     };
 
+    /**
+     * Generates a random master key for server_credentials::enable_session_tickets().
+     * The same key should be given to the credentials of all shards.
+     */
+    sstring generate_session_ticket_key();
+
     class reloadable_credentials_base;
 
     using reload_callback = std::function<void(const std::unordered_set<sstring>&, std::exception_ptr)>;
@@ -281,6 +374,15 @@ namespace tls {
         future<> set_system_trust();
         void set_client_auth(client_auth);
         void set_priority_string(const sstring&);
+        void enable_kernel_tls(bool);
+        // Generates the ticket key once, so that all credentials built
+        // from copies of this builder share it
+        void enable_session_tickets(std::chrono::seconds lifetime = std::chrono::hours(6));
+        void enable_session_cache(size_t max_entries, std::chrono::seconds lifetime = std::chrono::hours(1));
+        void enable_session_resumption(size_t max_entries);
+        void set_alpn_protocols(const std::vector<sstring>& protocols);
+        void set_handshake_scheduling_group(scheduling_group);
+        void set_private_key_executor(private_key_executor);
 
         void apply_to(certificate_credentials&) const;
 
@@ -297,6 +399,15 @@ namespace tls {
         std::multimap<sstring, boost::any> _blobs;
         client_auth _client_auth = client_auth::NONE;
         sstring _priority;
+        bool _kernel_tls = false;
+        sstring _session_ticket_key;
+        std::chrono::seconds _session_ticket_lifetime;
+        size_t _session_cache_size = 0;
+        std::chrono::seconds _session_cache_lifetime;
+        size_t _session_resumption_size = 0;
+        std::vector<sstring> _alpn_protocols;
+        std::optional<scheduling_group> _handshake_scheduling_group;
+        private_key_executor _private_key_executor;
     };
 
     /**
@@ -341,6 +452,18 @@ namespace tls {
     // Wraps an existing server socket in SSL
     server_socket listen(shared_ptr<server_credentials>, server_socket);
     /// @}
+
+    /**
+     * Waits for the handshake of a TLS connection to complete, and returns
+     * whether it resumed an earlier session.
+     */
+    future<bool> check_session_is_resumed(connected_socket& socket);
+
+    /**
+     * Waits for the handshake of a TLS connection to complete, and returns
+     * the application protocol negotiated with ALPN, if any.
+     */
+    future<std::optional<sstring>> get_alpn_protocol(connected_socket& socket);
 }
 }
 
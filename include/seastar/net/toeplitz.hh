@@ -43,6 +43,11 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string_view>
 #include <vector>
 
 namespace seastar {
@@ -73,9 +78,10 @@ static constexpr uint8_t default_rsskey_52bytes_v[] = {
 
 static constexpr rss_key_type default_rsskey_52bytes{default_rsskey_52bytes_v, sizeof(default_rsskey_52bytes_v)};
 
+// The definition, a bit at a time
 template<typename T>
 static inline uint32_t
-toeplitz_hash(rss_key_type key, const T& data)
+toeplitz_hash_bitwise(rss_key_type key, const T& data)
 {
 	uint32_t hash = 0, v;
 	u_int i, b;
@@ -96,4 +102,69 @@ toeplitz_hash(rss_key_type key, const T& data)
 	return (hash);
 }
 
+// The hash is linear over GF(2): it is the xor of the contributions of
+// each byte of the data, which only depend on the byte's value and
+// position. With those precomputed, hashing takes a lookup per byte.
+class toeplitz_table {
+    std::vector<uint8_t> _key;
+    std::vector<std::array<uint32_t, 256>> _table;
+public:
+    // Data up to the length of the key is hashed from the table
+    explicit toeplitz_table(rss_key_type key)
+        : _key(key.begin(), key.end())
+        , _table(key.size())
+    {
+        for (size_t i = 0; i < _table.size(); i++) {
+            auto& t = _table[i];
+            t[0] = 0;
+            // The 32 bits of the key starting at bit 8 * i + 7 - b, past
+            // the end of the key being zero
+            for (unsigned b = 0; b < 8; b++) {
+                uint64_t window = 0;
+                for (size_t k = i; k < i + 5; k++) {
+                    window = (window << 8) | (k < key.size() ? key[k] : 0);
+                }
+                t[1 << b] = window >> (b + 1);
+            }
+            for (unsigned v = 1; v < 256; v++) {
+                auto low = v & -v;
+                t[v] = t[low] ^ t[v ^ low];
+            }
+        }
+    }
+
+    bool matches(rss_key_type key) const noexcept {
+        return std::equal(_key.begin(), _key.end(), key.begin(), key.end());
+    }
+
+    size_t max_length() const noexcept {
+        return _table.size();
+    }
+
+    template<typename T>
+    uint32_t hash(const T& data) const noexcept {
+        uint32_t h = 0;
+        for (size_t i = 0; i < data.size(); i++) {
+            h ^= _table[i][data[i]];
+        }
+        return h;
+    }
+};
+
+template<typename T>
+inline uint32_t
+toeplitz_hash(rss_key_type key, const T& data)
+{
+    // Interfaces share one or two keys, so the table of the last one
+    // used will do
+    static thread_local std::unique_ptr<toeplitz_table> table;
+    if (!table || !table->matches(key)) {
+        table = std::make_unique<toeplitz_table>(key);
+    }
+    if (data.size() > table->max_length()) {
+        return toeplitz_hash_bitwise(key, data);
+    }
+    return table->hash(data);
+}
+
 }
@@ -52,6 +52,13 @@ struct virtio_options : public program_options::option_group {
     ///
     /// Default: 256.
     program_options::value<unsigned> virtio_ring_size;
+    /// \brief Connect to a vhost-user switch through this unix socket,
+    /// instead of using vhost-net and a tap device.
+    ///
+    /// The switch, e.g. OVS-DPDK, reads and writes packets in the memory of
+    /// the shard, which therefore has to be backed by hugetlbfs, see
+    /// \ref smp_options::hugepages.
+    program_options::value<std::string> vhost_user_socket;
 
     /// \cond internal
     virtio_options(program_options::option_group* parent_group);
@@ -0,0 +1,63 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <memory>
+#include <seastar/net/net.hh>
+#include <seastar/net/ipv4_address.hh>
+#include <seastar/util/program-options.hh>
+
+namespace seastar {
+
+namespace net {
+
+/// AF_XDP configuration.
+///
+/// With AF_XDP, the NIC stays bound to its kernel driver: an XDP program
+/// redirects the packets addressed to the native stack to AF_XDP sockets,
+/// one per receive queue and shard, and lets the host have the others.
+struct xdp_options : public program_options::option_group {
+    /// \brief Network interface to use with AF_XDP instead of a tap device.
+    program_options::value<std::string> xdp_interface;
+    /// \brief Number of descriptors of each AF_XDP ring (must be power-of-two).
+    ///
+    /// Default: 2048.
+    program_options::value<unsigned> xdp_ring_size;
+    /// \brief Use zero-copy mode if the driver supports it (on / off).
+    ///
+    /// Default: \p on.
+    program_options::value<std::string> xdp_zero_copy;
+
+    /// \cond internal
+    xdp_options(program_options::option_group* parent_group);
+    /// \endcond
+};
+
+}
+
+/// \cond internal
+/// Only IPv4 packets to \c host_address, and ARP packets about it, are
+/// redirected to the native stack; all of them if it is unspecified.
+std::unique_ptr<net::device> create_xdp_net_device(const net::xdp_options& opts, net::ipv4_address host_address);
+/// \endcond
+
+}
@@ -37,8 +37,13 @@
 #include <seastar/core/queue.hh>
 #include <seastar/core/weak_ptr.hh>
 #include <seastar/core/scheduling.hh>
+#include <seastar/core/trace_context.hh>
+#include <seastar/core/metrics_histogram.hh>
+#include <seastar/core/metrics_registration.hh>
 #include <seastar/util/backtrace.hh>
 #include <seastar/util/log.hh>
+#include <seastar/util/noncopyable_function.hh>
+#include <boost/intrusive/list.hpp>
 
 namespace seastar {
 
@@ -99,19 +104,160 @@ struct resource_limits {
     std::function<isolation_config (sstring isolation_cookie)> isolate_connection = default_isolate_connection;
 };
 
+/// Limits on the requests of a single verb handled by a server, which keep
+/// an expensive verb from starving the others and turn overload into fast
+/// rejections instead of unbounded latency.
+///
+/// \see protocol::register_handler()
+struct handler_limits {
+    /// Handlers of the verb that may run at once, further requests queue
+    size_t max_concurrency = std::numeric_limits<size_t>::max();
+    /// Requests that may queue, further ones are rejected right away
+    size_t max_queued = std::numeric_limits<size_t>::max();
+    /// Rejects requests which are not expected to start before their
+    /// timeout, as sent by the client, expires. The expected queueing time
+    /// is estimated from the queue length and the recent handler latency.
+    /// Requests still queued when their timeout expires are dropped.
+    bool reject_late = true;
+};
+
+/// Statistics of the requests of a single verb with \ref handler_limits
+///
+/// \see protocol::get_handler_stats()
+struct handler_stats {
+    uint64_t started = 0;
+    uint64_t completed = 0;
+    /// Rejected on arrival, because of the queue length or the timeout
+    uint64_t rejected = 0;
+    /// Dropped because their timeout expired while queued
+    uint64_t timed_out = 0;
+    uint64_t queued = 0;
+    uint64_t running = 0;
+    /// Time spent waiting for the handler to start, in microseconds
+    metrics::histogram queue_time;
+    /// Time from the handler start until the reply is sent, in microseconds
+    metrics::histogram latency;
+};
+
+/// Options of the per verb metrics of a protocol
+///
+/// \see protocol::enable_metrics()
+struct verb_metrics_options {
+    /// The "protocol" label of the metrics, telling protocols apart
+    sstring protocol_name;
+    /// Names a verb, given as its number, in the "verb" label. Verbs named
+    /// "" have no metrics. By default verbs are named by their number.
+    std::function<sstring (uint64_t verb)> verb_name;
+    /// Names the group of a peer in the "peer_group" label, e.g. its
+    /// datacenter. It is called once per connection. By default all peers
+    /// are in the same group, "".
+    std::function<sstring (const socket_address& peer)> peer_group;
+    /// The most verb and peer group pairs with metrics of their own, on
+    /// each of the client and server sides. The requests of further pairs
+    /// are counted in the peer group "other" of their verb.
+    size_t max_series = 256;
+};
+
+/// Adaptive compression sends frames uncompressed when compressing them
+/// is unlikely to pay off: when they are small, or when recent frames did
+/// not compress well, as with already compressed blobs. Uncompressed
+/// frames are flagged in their compression header, which both ends must
+/// support, so it is negotiated.
+struct adaptive_compression_options {
+    /// Frames smaller than this are sent uncompressed
+    size_t min_frame_size = 256;
+    /// Frames are sent uncompressed while the rolling ratio of compressed
+    /// to uncompressed frame sizes is above this
+    double max_compression_ratio = 0.9;
+    /// While frames are sent uncompressed because of a poor ratio, one
+    /// in this many is still compressed to keep the ratio up to date
+    unsigned probe_interval = 16;
+};
+
+/// Coalescing delays flushing the messages sent by a client, so that
+/// messages sent in quick succession leave in a single write instead of
+/// a write each. This trades up to \ref max_delay of latency for fewer
+/// system calls and packets when there are many small messages.
+struct coalescing_options {
+    /// How long a sent message may wait for more messages before being
+    /// flushed
+    std::chrono::microseconds max_delay = std::chrono::microseconds(100);
+    /// Messages are flushed once this many bytes are pending, regardless
+    /// of the delay
+    size_t max_bytes = 64 * 1024;
+};
+
+/// Flow control and batching of rpc streams.
+///
+/// Both ends of a stream connection propose a window while it is
+/// negotiated, and the stream uses the smaller one in both directions:
+/// a source buffers up to a window of received elements before the
+/// connection stops being read, and a sink has up to a window of elements
+/// on their way before its calls wait. Streams with peers that don't
+/// negotiate a window use \ref max_stream_buffers_memory.
+struct stream_options {
+    /// The window this end proposes, in bytes
+    size_t window = max_stream_buffers_memory;
+    /// Elements up to this size sent by a sink before it yields are
+    /// batched into frames of up to this size, instead of a frame each;
+    /// larger elements are sent in a frame of their own, without being
+    /// copied. 0 disables batching.
+    size_t max_batch_bytes = 16 * 1024;
+};
+
 struct client_options {
     std::optional<net::tcp_keepalive_params> keepalive;
     bool tcp_nodelay = true;
     bool reuseaddr = false;
     compressor::factory* compressor_factory = nullptr;
+    /// Enables adaptive compression of the frames sent by the client,
+    /// if the server supports it
+    std::optional<adaptive_compression_options> adaptive_compression;
+    /// Enables coalescing of the messages sent by the client
+    std::optional<coalescing_options> coalescing;
     bool send_timeout_data = true;
+    /// Sends the trace context of the caller with each request, so that
+    /// the server handles it in the same trace, if the server supports it.
+    /// \see tracing::current_trace_context()
+    bool send_trace_context = false;
     connection_id stream_parent = invalid_connection_id;
+    /// Options of the streams made from this client
+    stream_options stream;
     /// Configures how this connection is isolated from other connection on the same server.
     ///
     /// \see resource_limits::isolate_connection
     sstring isolation_cookie;
 };
 
+/// How a client pool picks the connection for a call
+enum class pool_balancing {
+    /// Cycles through the connections
+    round_robin,
+    /// Picks the connection with the fewest queued and unanswered calls
+    least_pending,
+};
+
+/// \see protocol::client_pool
+struct client_pool_options {
+    /// Options of each of the pool's connections
+    client_options client;
+    unsigned connections = 1;
+    pool_balancing balancing = pool_balancing::round_robin;
+    /// Connects connection `i` from a local port that a server listening
+    /// with server_socket::load_balancing_algorithm::port hands to its
+    /// shard `i % connections`, so that \ref connections is typically the
+    /// number of shards of the server
+    bool shard_aware_ports = false;
+    /// Connects connection `i` to the port of the server address plus `i`,
+    /// which a server with \ref server_options::shard_ports handles on
+    /// its shard `i`
+    bool shard_ports = false;
+};
+
+/// The address at which a server with \ref server_options::shard_ports
+/// listening on addr handles connections on the given shard
+socket_address shard_port_address(const socket_address& addr, unsigned shard);
+
 /// @}
 
 // RPC call that passes stream connection id as a parameter
@@ -142,9 +288,20 @@ class server;
 
 struct server_options {
     compressor::factory* compressor_factory = nullptr;
+    /// Enables adaptive compression of the frames sent by the server, on
+    /// connections whose client supports it
+    std::optional<adaptive_compression_options> adaptive_compression;
     bool tcp_nodelay = true;
     std::optional<streaming_domain_type> streaming_domain;
+    /// Options of the streams the server accepts
+    stream_options stream;
     server_socket::load_balancing_algorithm load_balancing_algorithm = server_socket::load_balancing_algorithm::default_;
+    /// Makes the server listen on the port of its address plus the id of
+    /// the shard it is created on, and handle the connections accepted
+    /// there on that shard. A server created on every shard can then be
+    /// reached shard by shard, see client_pool_options::shard_ports.
+    /// Overrides \ref load_balancing_algorithm.
+    bool shard_ports = false;
     // optional filter function. If set, will be called with remote 
     // (connecting) address.    
     // Returning false will refuse the incoming connection. 
@@ -171,6 +328,9 @@ enum class protocol_features : uint32_t {
     CONNECTION_ID = 2,
     STREAM_PARENT = 3,
     ISOLATION = 4,
+    ADAPTIVE_COMPRESSION = 5,
+    TRACING = 6,
+    STREAM_WINDOW = 7,
 };
 
 // internal representation of feature data
@@ -262,8 +422,21 @@ class connection {
     std::list<outgoing_entry> _outgoing_queue;
     condition_variable _outgoing_queue_cond;
     future<> _send_loop_stopped = make_ready_future<>();
+    // Set if flushes are coalesced, see coalescing_options
+    std::optional<coalescing_options> _coalescing;
+    size_t _unflushed_bytes = 0;
+    timer<>::clock::time_point _flush_deadline;
     std::unique_ptr<compressor> _compressor;
+    // Set when both ends understand uncompressed frames on a compressing
+    // connection; _adaptive_compression is set if this end sends them
+    bool _adaptive_compression_negotiated = false;
+    std::optional<adaptive_compression_options> _adaptive_compression;
+    double _compression_ratio = 0;
+    unsigned _frames_since_probe = 0;
     bool _timeout_negotiated = false;
+    bool _trace_negotiated = false;
+    // The peer group of verb_metrics, once known
+    std::optional<sstring> _peer_group;
     // stream related fields
     bool _is_stream = false;
     connection_id _id = invalid_connection_id;
@@ -271,6 +444,10 @@ class connection {
     std::unordered_map<connection_id, xshard_connection_ptr> _streams;
     queue<rcv_buf> _stream_queue = queue<rcv_buf>(max_queued_stream_buffers);
     semaphore _stream_sem = semaphore(max_stream_buffers_memory);
+    // Negotiated, see stream_options; batches are sent only to peers
+    // that negotiated a window
+    size_t _stream_window = max_stream_buffers_memory;
+    size_t _stream_batch_bytes = 0;
     bool _sink_closed = true;
     bool _source_closed = true;
     // the future holds if sink is already closed
@@ -281,8 +458,10 @@ class connection {
         return _is_stream;
     }
 
+    bool skip_compression(size_t size);
     snd_buf compress(snd_buf buf);
     future<> send_buffer(snd_buf buf);
+    future<> flush_sent(size_t size);
 
     enum class outgoing_queue_type {
         request,
@@ -292,12 +471,12 @@ class connection {
 
     template<outgoing_queue_type QueueType> void send_loop();
     future<> stop_send_loop();
-    future<std::optional<rcv_buf>>  read_stream_frame_compressed(input_stream<char>& in);
     bool stream_check_twoway_closed() {
         return _sink_closed && _source_closed;
     }
     future<> stream_close();
-    future<> stream_process_incoming(rcv_buf&&);
+    void set_stream_window(size_t window, size_t max_batch_bytes);
+    future<> stream_process_incoming(rcv_buf&&, bool batch);
     future<> handle_stream_frame();
 
 public:
@@ -315,6 +494,12 @@ class connection {
     void abort();
     future<> stop() noexcept;
     future<> stream_receive(circular_buffer<foreign_ptr<std::unique_ptr<rcv_buf>>>& bufs);
+    // A frame read from a stream, holding several elements if batched
+    struct stream_frame_buf {
+        rcv_buf buf;
+        bool batch = false;
+    };
+    future<std::optional<stream_frame_buf>> read_stream_frame_compressed(input_stream<char>& in);
     future<> close_sink() {
         _sink_closed = true;
         if (stream_check_twoway_closed()) {
@@ -358,6 +543,7 @@ class connection {
     friend class sink_impl;
     template<typename Serializer, typename... In>
     friend class source_impl;
+    friend class verb_metrics;
 };
 
 struct deferred_snd_buf {
@@ -376,8 +562,24 @@ class sink_impl : public sink<Out...>::impl {
         uint64_t last_seq_num = 0;
         std::map<uint64_t, deferred_snd_buf> out_of_order_bufs;
     } _remote_state;
+
+    // The batch of small elements being filled, sent when full or once the
+    // caller yields. Used on the shard *this lives on.
+    size_t _max_batch_bytes;
+    temporary_buffer<char> _batch;
+    size_t _batch_size = 0;
+    unsigned _batch_elements = 0;
+    bool _batch_flush_scheduled = false;
+    future<> _batch_flushed = make_ready_future<>();
+
+    future<> send_frame(snd_buf data);
+    future<> send_batch();
 public:
-    sink_impl(xshard_connection_ptr con) : sink<Out...>::impl(std::move(con)) { this->_con->get()->_sink_closed = false; }
+    sink_impl(xshard_connection_ptr con)
+            : sink<Out...>::impl(con, con->get()->_stream_window)
+            , _max_batch_bytes(con->get()->_stream_batch_bytes) {
+        this->_con->get()->_sink_closed = false;
+    }
     future<> operator()(const Out&... args) override;
     future<> close() override;
     future<> flush() override;
@@ -392,11 +594,43 @@ class source_impl : public source<In...>::impl {
     future<std::optional<std::tuple<In...>>> operator()() override;
 };
 
+// Expires the deadlines of a client's outstanding calls from a single
+// timer. Deadlines are kept in a hashed wheel of coarse ticks and expire
+// in a batch at the first tick after them, so adding and removing one is
+// a list link and unlink rather than arming and cancelling a timer.
+class timeout_wheel {
+public:
+    static constexpr rpc_clock_type::duration tick = std::chrono::milliseconds(10);
+    struct entry {
+        boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> hook;
+        rpc_clock_type::time_point deadline;
+    };
+private:
+    using list_type = boost::intrusive::list<entry,
+            boost::intrusive::member_hook<entry, decltype(entry::hook), &entry::hook>,
+            boost::intrusive::constant_time_size<false>>;
+    static constexpr size_t nr_slots = 512;
+    std::array<list_type, nr_slots> _slots;
+    // The first tick not expired yet
+    uint64_t _next_tick = 0;
+    timer<rpc_clock_type> _timer;
+    noncopyable_function<void (entry&)> _expire;
+
+    static uint64_t tick_of(rpc_clock_type::time_point t) noexcept {
+        return t.time_since_epoch() / tick;
+    }
+    void on_tick();
+public:
+    explicit timeout_wheel(noncopyable_function<void (entry&)> expire);
+    // The entry is removed when destroyed, or once expired
+    void add(entry& e, rpc_clock_type::time_point deadline) noexcept;
+};
+
 class client : public rpc::connection, public weakly_referencable<client> {
     socket _socket;
     id_type _message_id = 1;
-    struct reply_handler_base {
-        timer<rpc_clock_type> t;
+    struct reply_handler_base : timeout_wheel::entry {
+        id_type id = 0;
         cancellable* pcancel = nullptr;
         virtual void operator()(client&, id_type, rcv_buf data) = 0;
         virtual void timeout() {}
@@ -429,6 +663,7 @@ class client : public rpc::connection, public weakly_referencable<client> {
     };
 private:
     std::unordered_map<id_type, std::unique_ptr<reply_handler_base>> _outstanding;
+    timeout_wheel _timeouts;
     socket_address _server_addr, _local_addr;
     client_options _options;
     std::optional<shared_promise<>> _client_negotiated = shared_promise<>();
@@ -532,7 +767,7 @@ class server {
         std::optional<isolation_config> _isolation_config;
     private:
         future<> negotiate_protocol(input_stream<char>& in);
-        future<std::tuple<std::optional<uint64_t>, uint64_t, int64_t, std::optional<rcv_buf>>>
+        future<std::tuple<std::optional<uint64_t>, uint64_t, int64_t, std::optional<rcv_buf>, std::optional<tracing::trace_context>>>
         read_request_frame_compressed(input_stream<char>& in);
         future<feature_map> negotiate(feature_map requested);
         void send_loop() {
@@ -611,13 +846,87 @@ class server {
     friend client;
 };
 
+// A local address with an ephemeral port that a server balancing
+// connections by port, and having nr_shards shards, hands to shard
+socket_address shard_aware_local_address(const socket_address& remote, unsigned shard, unsigned nr_shards);
+
 using rpc_handler_func = std::function<future<> (shared_ptr<server::connection>, std::optional<rpc_clock_type::time_point> timeout, int64_t msgid,
                                                  rcv_buf data)>;
 
+// Applies the handler_limits of a verb
+class handler_admission : public enable_lw_shared_from_this<handler_admission> {
+    // In microseconds, reported with power of two buckets
+    class latency_histogram {
+        metrics::log_linear_histogram<> _histogram;
+    public:
+        void add(std::chrono::microseconds v);
+        metrics::histogram get() const;
+    };
+    handler_limits _limits;
+    rpc_semaphore _concurrency;
+    handler_stats _stats;
+    latency_histogram _queue_time;
+    latency_histogram _latency;
+    // Moving average of the latency, in microseconds
+    double _average_latency = 0;
+public:
+    class permit;
+    explicit handler_admission(handler_limits limits);
+    // Whether a request arriving now with the given timeout is accepted
+    bool admit(std::optional<rpc_clock_type::time_point> timeout) noexcept;
+    // Waits for an accepted request's turn to run, fails with
+    // semaphore_timed_out if the timeout expires first
+    future<permit> enter(std::optional<rpc_clock_type::time_point> timeout);
+    handler_stats get_stats() const;
+};
+
+// Holds a concurrency slot for a running handler
+class handler_admission::permit {
+    lw_shared_ptr<handler_admission> _admission;
+    semaphore_units<semaphore_default_exception_factory, rpc_clock_type> _units;
+    rpc_clock_type::time_point _start;
+public:
+    permit(lw_shared_ptr<handler_admission> admission, semaphore_units<semaphore_default_exception_factory, rpc_clock_type> units) noexcept;
+    permit(permit&&) noexcept = default;
+    ~permit();
+};
+
+// The per verb metrics of a protocol, created on first use of a verb and
+// peer group. Used on the shard of the protocol only.
+class verb_metrics {
+public:
+    enum class side { client, server };
+    struct series {
+        // In microseconds: from the handler starting to the reply being
+        // sent on a server, from the request being sent to the reply
+        // arriving on a client
+        metrics::log_linear_histogram<> latency;
+        // Of the serialized arguments and return values
+        metrics::log_linear_histogram<> request_size;
+        metrics::log_linear_histogram<> response_size;
+        uint64_t errors = 0;
+        metrics::metric_groups metrics;
+    };
+private:
+    std::optional<verb_metrics_options> _options;
+    unsigned _shard;
+    // nullptr for verbs without metrics
+    std::map<std::pair<uint64_t, sstring>, std::unique_ptr<series>> _series[2];
+
+    std::unique_ptr<series> make_series(side s, uint64_t verb, const sstring& peer_group);
+public:
+    verb_metrics();
+    void enable(verb_metrics_options options);
+    // The series of a request of verb with the peer of c, or nullptr
+    series* get(side s, uint64_t verb, connection& c);
+};
+
 struct rpc_handler {
     scheduling_group sg;
     rpc_handler_func func;
     gate use_gate;
+    // Set if the verb has handler_limits
+    lw_shared_ptr<handler_admission> admission = nullptr;
 };
 
 class protocol_base {
@@ -766,11 +1075,95 @@ class protocol final : public protocol_base {
             rpc::client(p.get_logger(), &p._serializer, options, std::move(socket), addr, local) {}
     };
 
+    /// A set of connections to the same server, over which calls are
+    /// spread, so that the traffic between two nodes is not limited by a
+    /// single flow and send loop.
+    ///
+    /// Verbs are invoked on the connection returned by pick(), which is a
+    /// regular client, so streams are created from it as usual. Connections
+    /// that failed are replaced by pick().
+    class client_pool {
+        protocol& _proto;
+        client_pool_options _options;
+        socket_address _addr;
+        std::function<socket ()> _make_socket;
+        std::vector<std::unique_ptr<client>> _clients;
+        unsigned _next = 0;
+        std::vector<future<>> _stopping;
+    private:
+        std::unique_ptr<client> connect(unsigned i) {
+            socket_address local;
+            if (_options.shard_aware_ports) {
+                local = shard_aware_local_address(_addr, i, _options.connections);
+            }
+            auto addr = _options.shard_ports ? shard_port_address(_addr, i) : _addr;
+            if (_make_socket) {
+                return std::make_unique<client>(_proto, _options.client, _make_socket(), addr, local);
+            }
+            return std::make_unique<client>(_proto, _options.client, addr, local);
+        }
+        client& get(unsigned i) {
+            if (_clients[i]->error()) {
+                _stopping.push_back(_clients[i]->stop());
+                _clients[i] = connect(i);
+            }
+            return *_clients[i];
+        }
+    public:
+        client_pool(protocol& p, client_pool_options options, const socket_address& addr)
+                : client_pool(p, std::move(options), nullptr, addr) {}
+        /// Creates the pool's connections with sockets returned by make_socket
+        client_pool(protocol& p, client_pool_options options, std::function<socket ()> make_socket, const socket_address& addr)
+                : _proto(p), _options(std::move(options)), _addr(addr), _make_socket(std::move(make_socket)) {
+            _options.connections = std::max(_options.connections, 1u);
+            _clients.reserve(_options.connections);
+            for (unsigned i = 0; i < _options.connections; i++) {
+                _clients.push_back(connect(i));
+            }
+        }
+        /// \returns the connection to use for the next call
+        client& pick() {
+            unsigned i = 0;
+            if (_options.balancing == pool_balancing::round_robin) {
+                i = _next++ % _clients.size();
+            } else {
+                auto load = [] (const client& c) {
+                    auto s = c.get_stats();
+                    return s.pending + s.wait_reply;
+                };
+                for (unsigned j = 1; j < _clients.size(); j++) {
+                    if (load(*_clients[j]) < load(*_clients[i])) {
+                        i = j;
+                    }
+                }
+            }
+            return get(i);
+        }
+        /// \returns connection `i`, which with \ref client_pool_options::shard_aware_ports
+        ///     or \ref client_pool_options::shard_ports is handled by shard `i` of
+        ///     the server. Calls about data owned by a known shard are routed
+        ///     to it this way, saving the server a cross-shard hop.
+        client& at(unsigned i) {
+            return get(i % _clients.size());
+        }
+        size_t size() const noexcept {
+            return _clients.size();
+        }
+        /// Stops all connections, the pool must not be used afterwards
+        future<> stop() noexcept {
+            for (auto& c : _clients) {
+                _stopping.push_back(c->stop());
+            }
+            return when_all(_stopping.begin(), _stopping.end()).discard_result();
+        }
+    };
+
     friend server;
 private:
     std::unordered_map<MsgType, rpc_handler> _handlers;
     Serializer _serializer;
     logger _logger;
+    verb_metrics _verb_metrics;
 
 public:
     protocol(Serializer&& serializer) : _serializer(std::forward<Serializer>(serializer)) {}
@@ -822,6 +1215,50 @@ class protocol final : public protocol_base {
     template <typename Func>
     auto register_handler(MsgType t, scheduling_group sg, Func&& func);
 
+    /// Register a handler to be called when this verb is invoked, with
+    /// limits on the concurrency and queueing of its requests.
+    ///
+    /// \tparam Func the type of the handler for the verb. This determines the
+    ///     signature of the verb.
+    /// \param t the verb to register the handler for.
+    /// \param sg the scheduling group that will be used to invoke the handler
+    ///     in, see the overload without limits.
+    /// \param limits the limits on the requests of this verb. Rejected
+    ///     requests fail on the client with a std::runtime_error, like
+    ///     requests whose handler threw.
+    /// \param func the callable to be called when the verb is invoked by the
+    ///     remote.
+    ///
+    /// \returns a client, a callable that can be used to invoke the verb. See
+    ///     make_client().
+    template <typename Func>
+    auto register_handler(MsgType t, scheduling_group sg, handler_limits limits, Func&& func);
+
+    /// Statistics of a verb registered with \ref handler_limits
+    ///
+    /// \returns the statistics, or std::nullopt if the verb is not
+    ///     registered or has no limits.
+    std::optional<handler_stats> get_handler_stats(MsgType t) const {
+        auto it = _handlers.find(t);
+        if (it == _handlers.end() || !it->second.admission) {
+            return std::nullopt;
+        }
+        return it->second.admission->get_stats();
+    }
+
+    /// Registers metrics of the requests of each verb, in the "rpc" group:
+    /// histograms of their latency and of the sizes of their requests and
+    /// responses, and a count of their failures, both of the handlers of
+    /// this protocol and of the calls made with its clients. The metrics
+    /// are labeled by the protocol, the verb and the group of the peer,
+    /// see \ref verb_metrics_options for limiting their number.
+    ///
+    /// Only the requests of the shard of the protocol are counted, calls
+    /// made with its clients on other shards are not.
+    void enable_metrics(verb_metrics_options options) {
+        _verb_metrics.enable(std::move(options));
+    }
+
     /// Unregister the handler for the verb.
     ///
     /// Waits for all currently running handlers, then unregisters the handler.
@@ -25,6 +25,7 @@
 #include <seastar/core/sstring.hh>
 #include <seastar/core/when_all.hh>
 #include <seastar/util/is_smart_ptr.hh>
+#include <seastar/util/later.hh>
 #include <seastar/core/simple-stream.hh>
 #include <boost/range/numeric.hpp>
 #include <boost/range/adaptor/transformed.hpp>
@@ -211,7 +212,7 @@ inline void do_marshall(Serializer& serializer, Output& out, const T&... args);
 
 template <typename Serializer, typename Output>
 struct marshall_one {
-    template <typename T> struct helper {
+    template <typename T, typename Dummy = void> struct helper {
         static void doit(Serializer& serializer, Output& out, const T& arg) {
             using serialize_helper_type = serialize_helper<is_smart_ptr<typename std::remove_reference<T>::type>::value>;
             serialize_helper_type::serialize(serializer, out, arg);
@@ -244,6 +245,17 @@ struct marshall_one {
             std::apply(do_do_marshall, arg);
         }
     };
+    // Only copied when nested, see marshall_zero_copy() for the top level
+    template <typename Dummy> struct helper<zero_copy_buffer, Dummy> {
+        static void doit(Serializer& serializer, Output& out, const zero_copy_buffer& arg) {
+            char len[4];
+            write_le<uint32_t>(len, arg.size());
+            out.write(len, sizeof(len));
+            for (auto& f : arg.fragments) {
+                out.write(f.get(), f.size());
+            }
+        }
+    };
 };
 
 template <typename Serializer, typename Output, typename... T>
@@ -262,8 +274,64 @@ static inline memory_output_stream<snd_buf::iterator> make_serializer_stream(snd
     }
 }
 
+template <typename T>
+struct is_zero_copy_buffer : std::is_same<T, zero_copy_buffer> {};
+
+// Serializes the arguments between the zero_copy_buffer ones into
+// segments of their own, and links the buffers in between them
+template <typename Serializer, typename... T>
+inline snd_buf marshall_zero_copy(Serializer& serializer, size_t head_space, const T&... args) {
+    std::vector<size_t> segment_sizes{head_space};
+    auto measure_one = [&] (const auto& arg) {
+        if constexpr (is_zero_copy_buffer<std::decay_t<decltype(arg)>>::value) {
+            segment_sizes.back() += 4;
+            segment_sizes.push_back(0);
+        } else {
+            measuring_output_stream measure;
+            do_marshall(serializer, measure, arg);
+            segment_sizes.back() += measure.size();
+        }
+    };
+    (measure_one(args), ...);
+
+    std::vector<temporary_buffer<char>> bufs;
+    size_t size = 0;
+    auto segment = segment_sizes.begin();
+    temporary_buffer<char> current(*segment);
+    simple_memory_output_stream out(current.get_write(), current.size());
+    out.skip(head_space);
+    auto serialize_one = [&] (const auto& arg) {
+        if constexpr (is_zero_copy_buffer<std::decay_t<decltype(arg)>>::value) {
+            char len[4];
+            write_le<uint32_t>(len, arg.size());
+            out.write(len, sizeof(len));
+            size += current.size();
+            bufs.push_back(std::move(current));
+            for (auto&& f : arg.share()) {
+                if (f.size()) {
+                    size += f.size();
+                    bufs.push_back(std::move(f));
+                }
+            }
+            current = temporary_buffer<char>(*++segment);
+            out = simple_memory_output_stream(current.get_write(), current.size());
+        } else {
+            do_marshall(serializer, out, arg);
+        }
+    };
+    (serialize_one(args), ...);
+    if (current.size()) {
+        size += current.size();
+        bufs.push_back(std::move(current));
+    }
+    return snd_buf(std::move(bufs), size);
+}
+
 template <typename Serializer, typename... T>
 inline snd_buf marshall(Serializer& serializer, size_t head_space, const T&... args) {
+    if constexpr ((is_zero_copy_buffer<T>::value || ...)) {
+        return marshall_zero_copy(serializer, head_space, args...);
+    }
     measuring_output_stream measure;
     do_marshall(serializer, measure, args...);
     snd_buf ret(measure.size() + head_space);
@@ -278,9 +346,60 @@ inline std::tuple<> do_unmarshall(connection& c, Input& in) {
     return std::make_tuple();
 }
 
+// Deserializes a received frame, and shares its buffers with the
+// zero_copy_buffer values read from it
+class sharing_deserializer_stream : public memory_input_stream<rcv_buf::iterator> {
+    rcv_buf& _input;
+public:
+    explicit sharing_deserializer_stream(rcv_buf& input)
+        : memory_input_stream<rcv_buf::iterator>(make_deserializer_stream(input)), _input(input) {}
+    // Shares the next size bytes and skips them
+    std::vector<temporary_buffer<char>> share(size_t size) {
+        std::vector<temporary_buffer<char>> ret;
+        auto offset = _input.size - this->size();
+        skip(size);
+        auto share_from = [&] (temporary_buffer<char>& b) {
+            if (offset >= b.size()) {
+                offset -= b.size();
+                return;
+            }
+            auto now = std::min(b.size() - offset, size);
+            if (now) {
+                ret.push_back(b.share(offset, now));
+            }
+            offset = 0;
+            size -= now;
+        };
+        if (auto* b = std::get_if<temporary_buffer<char>>(&_input.bufs)) {
+            share_from(*b);
+        } else {
+            for (auto& b : std::get<std::vector<temporary_buffer<char>>>(_input.bufs)) {
+                share_from(b);
+                if (!size) {
+                    break;
+                }
+            }
+        }
+        return ret;
+    }
+};
+
+template <typename Input>
+inline std::vector<temporary_buffer<char>> read_zero_copy_fragments(Input& in, size_t size) {
+    std::vector<temporary_buffer<char>> ret;
+    temporary_buffer<char> b(size);
+    in.read(b.get_write(), size);
+    ret.push_back(std::move(b));
+    return ret;
+}
+
+inline std::vector<temporary_buffer<char>> read_zero_copy_fragments(sharing_deserializer_stream& in, size_t size) {
+    return in.share(size);
+}
+
 template<typename Serializer, typename Input>
 struct unmarshal_one {
-    template<typename T> struct helper {
+    template<typename T, typename Dummy = void> struct helper {
         static T doit(connection& c, Input& in) {
             return read(c.serializer<Serializer>(), in, type<T>());
         }
@@ -319,6 +438,13 @@ struct unmarshal_one {
             return do_unmarshall<Serializer, Input, T...>(c, in);
         }
     };
+    template <typename Dummy> struct helper<zero_copy_buffer, Dummy> {
+        static zero_copy_buffer doit(connection& c, Input& in) {
+            char len[4];
+            in.read(len, sizeof(len));
+            return zero_copy_buffer(read_zero_copy_fragments(in, read_le<uint32_t>(len)));
+        }
+    };
 };
 
 template <typename Serializer, typename Input, typename T0, typename... Trest>
@@ -331,6 +457,10 @@ inline std::tuple<T0, Trest...> do_unmarshall(connection& c, Input& in) {
 
 template <typename Serializer, typename... T>
 inline std::tuple<T...> unmarshall(connection& c, rcv_buf input) {
+    if constexpr ((is_zero_copy_buffer<T>::value || ...)) {
+        sharing_deserializer_stream in(input);
+        return do_unmarshall<Serializer, decltype(in), T...>(c, in);
+    }
     auto in = make_deserializer_stream(input);
     return do_unmarshall<Serializer, decltype(in), T...>(c, in);
 }
@@ -407,9 +537,12 @@ struct rcv_reply<Serializer, future<>> : rcv_reply<Serializer, void> {};
 
 template <typename Serializer, typename Ret, typename... InArgs>
 inline auto wait_for_reply(wait_type, std::optional<rpc_clock_type::time_point> timeout, cancellable* cancel, rpc::client& dst, id_type msg_id,
-        signature<Ret (InArgs...)> sig) {
+        signature<Ret (InArgs...)> sig, verb_metrics::series* series) {
     using reply_type = rcv_reply<Serializer, Ret>;
-    auto lambda = [] (reply_type& r, rpc::client& dst, id_type msg_id, rcv_buf data) mutable {
+    auto lambda = [series] (reply_type& r, rpc::client& dst, id_type msg_id, rcv_buf data) mutable {
+        if (series) {
+            series->response_size.add(data.size);
+        }
         if (msg_id >= 0) {
             dst.get_stats_internal().replied++;
             return r.get_reply(dst, std::move(data));
@@ -428,13 +561,13 @@ inline auto wait_for_reply(wait_type, std::optional<rpc_clock_type::time_point>
 
 template<typename Serializer, typename... InArgs>
 inline auto wait_for_reply(no_wait_type, std::optional<rpc_clock_type::time_point>, cancellable* cancel, rpc::client& dst, id_type msg_id,
-        signature<no_wait_type (InArgs...)> sig) {  // no_wait overload
+        signature<no_wait_type (InArgs...)> sig, verb_metrics::series*) {  // no_wait overload
     return make_ready_future<>();
 }
 
 template<typename Serializer, typename... InArgs>
 inline auto wait_for_reply(no_wait_type, std::optional<rpc_clock_type::time_point>, cancellable* cancel, rpc::client& dst, id_type msg_id,
-        signature<future<no_wait_type> (InArgs...)> sig) {  // future<no_wait> overload
+        signature<future<no_wait_type> (InArgs...)> sig, verb_metrics::series*) {  // future<no_wait> overload
     return make_ready_future<>();
 }
 
@@ -447,35 +580,82 @@ relative_timeout_to_absolute(rpc_clock_type::duration relative) {
     return now + std::min(relative, rpc_clock_type::time_point::max() - now);
 }
 
+// The trace context sent before the header of a request, when the
+// TRACING feature was negotiated: whether there is a context, its flags,
+// trace id and span id
+constexpr size_t request_trace_size = 26;
+
+inline void write_request_trace(char* p) noexcept {
+    auto ctx = tracing::current_trace_context();
+    if (!ctx) {
+        std::memset(p, 0, request_trace_size);
+        return;
+    }
+    p[0] = 1;
+    p[1] = ctx->flags;
+    std::memcpy(p + 2, ctx->trace_id.data(), ctx->trace_id.size());
+    write_le<uint64_t>(p + 18, ctx->span_id);
+}
+
+inline std::optional<tracing::trace_context> read_request_trace(const char* p) noexcept {
+    if (!p[0]) {
+        return std::nullopt;
+    }
+    tracing::trace_context ctx;
+    ctx.flags = p[1];
+    std::memcpy(ctx.trace_id.data(), p + 2, ctx.trace_id.size());
+    ctx.span_id = read_le<uint64_t>(p + 18);
+    return ctx;
+}
+
 // Returns lambda that can be used to send rpc messages.
 // The lambda gets client connection and rpc parameters as arguments, marshalls them sends
 // to a server and waits for a reply. After receiving reply it unmarshalls it and signal completion
 // to a caller.
 template<typename Serializer, typename MsgType, typename Ret, typename... InArgs>
-auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig) {
+auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig, verb_metrics* metrics = nullptr) {
     struct shelper {
         MsgType t;
         signature<Ret (InArgs...)> sig;
+        verb_metrics* metrics;
         auto send(rpc::client& dst, std::optional<rpc_clock_type::time_point> timeout, cancellable* cancel, const InArgs&... args) {
             if (dst.error()) {
                 using cleaned_ret_type = typename wait_signature<Ret>::cleaned_type;
                 return futurize<cleaned_ret_type>::make_exception_future(closed_error());
             }
+            auto series = metrics ? metrics->get(verb_metrics::side::client, uint64_t(t), dst) : nullptr;
 
             // send message
             auto msg_id = dst.next_message_id();
-            snd_buf data = marshall(dst.template serializer<Serializer>(), 28, args...);
-            static_assert(snd_buf::chunk_size >= 28, "send buffer chunk size is too small");
-            auto p = data.front().get_write() + 8; // 8 extra bytes for expiration timer
+            constexpr size_t head_space = request_trace_size + 28;
+            snd_buf data = marshall(dst.template serializer<Serializer>(), head_space, args...);
+            static_assert(snd_buf::chunk_size >= head_space, "send buffer chunk size is too small");
+            // The trace context is the one of the caller, the send loop
+            // drops it if it is not negotiated
+            write_request_trace(data.front().get_write());
+            auto p = data.front().get_write() + request_trace_size + 8; // 8 extra bytes for expiration timer
             write_le<uint64_t>(p, uint64_t(t));
             write_le<int64_t>(p + 8, msg_id);
-            write_le<uint32_t>(p + 16, data.size - 28);
+            write_le<uint32_t>(p + 16, data.size - head_space);
+            if (series) {
+                series->request_size.add(data.size - head_space);
+            }
 
             // prepare reply handler, if return type is now_wait_type this does nothing, since no reply will be sent
             using wait = wait_signature_t<Ret>;
-            return when_all(dst.send(std::move(data), timeout, cancel), wait_for_reply<Serializer>(wait(), timeout, cancel, dst, msg_id, sig)).then([] (auto r) {
+            auto f = when_all(dst.send(std::move(data), timeout, cancel), wait_for_reply<Serializer>(wait(), timeout, cancel, dst, msg_id, sig, series)).then([] (auto r) {
                     return std::move(std::get<1>(r)); // return future of wait_for_reply
             });
+            if (!series) {
+                return f;
+            }
+            return f.then_wrapped([series, start = std::chrono::steady_clock::now()] (auto f) {
+                series->latency.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+                if (f.failed()) {
+                    series->errors++;
+                }
+                return f;
+            });
         }
         auto operator()(rpc::client& dst, const InArgs&... args) {
             return send(dst, {}, nullptr, args...);
@@ -491,12 +671,12 @@ auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig) {
         }
 
     };
-    return shelper{xt, xsig};
+    return shelper{xt, xsig, metrics};
 }
 
 template<typename Serializer, typename SEASTAR_ELLIPSIS RetTypes>
 inline future<> reply(wait_type, future<RetTypes SEASTAR_ELLIPSIS>&& ret, int64_t msg_id, shared_ptr<server::connection> client,
-        std::optional<rpc_clock_type::time_point> timeout) {
+        std::optional<rpc_clock_type::time_point> timeout, verb_metrics::series* series = nullptr) {
     if (!client->error()) {
         snd_buf data;
         try {
@@ -522,6 +702,9 @@ inline future<> reply(wait_type, future<RetTypes SEASTAR_ELLIPSIS>&& ret, int64_
             os.write(ex.what(), len);
             msg_id = -msg_id;
         }
+        if (series) {
+            series->response_size.add(data.size - 12);
+        }
 
         return client->respond(msg_id, std::move(data), timeout);
     } else {
@@ -532,7 +715,8 @@ inline future<> reply(wait_type, future<RetTypes SEASTAR_ELLIPSIS>&& ret, int64_
 
 // specialization for no_wait_type which does not send a reply
 template<typename Serializer>
-inline future<> reply(no_wait_type, future<no_wait_type>&& r, int64_t msgid, shared_ptr<server::connection> client, std::optional<rpc_clock_type::time_point> timeout) {
+inline future<> reply(no_wait_type, future<no_wait_type>&& r, int64_t msgid, shared_ptr<server::connection> client, std::optional<rpc_clock_type::time_point> timeout,
+        verb_metrics::series* = nullptr) {
     try {
         r.get();
     } catch (std::exception& ex) {
@@ -565,40 +749,67 @@ auto lref_to_cref(T& x) {
 // Creates lambda to handle RPC message on a server.
 // The lambda unmarshalls all parameters, calls a handler, marshall return values and sends them back to a client
 template <typename Serializer, typename Func, typename Ret, typename... InArgs, typename WantClientInfo, typename WantTimePoint>
-auto recv_helper(signature<Ret (InArgs...)> sig, Func&& func, WantClientInfo wci, WantTimePoint wtp) {
+auto recv_helper(signature<Ret (InArgs...)> sig, Func&& func, WantClientInfo wci, WantTimePoint wtp, lw_shared_ptr<handler_admission> admission = nullptr,
+        uint64_t verb = 0, verb_metrics* metrics = nullptr) {
     using signature = decltype(sig);
     using wait_style = wait_signature_t<Ret>;
-    return [func = lref_to_cref(std::forward<Func>(func))](shared_ptr<server::connection> client,
+    return [func = lref_to_cref(std::forward<Func>(func)), admission = std::move(admission), verb, metrics](shared_ptr<server::connection> client,
                                                            std::optional<rpc_clock_type::time_point> timeout,
                                                            int64_t msg_id,
                                                            rcv_buf data) mutable {
+        auto series = metrics ? metrics->get(verb_metrics::side::server, verb, *client) : nullptr;
+        if (series) {
+            series->request_size.add(data.size);
+        }
         auto memory_consumed = client->estimate_request_size(data.size);
-        if (memory_consumed > client->max_request_size()) {
-            auto err = format("request size {:d} large than memory limit {:d}", memory_consumed, client->max_request_size());
-            client->get_logger()(client->peer_address(), err);
+        bool oversized = memory_consumed > client->max_request_size();
+        if (oversized || (admission && !admission->admit(timeout))) {
+            if (series) {
+                series->errors++;
+            }
+            auto err = oversized ? format("request size {:d} large than memory limit {:d}", memory_consumed, client->max_request_size())
+                    : sstring("request rejected: the verb is overloaded");
+            if (oversized) {
+                client->get_logger()(client->peer_address(), err);
+            }
             // FIXME: future is discarded
             (void)try_with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, err = std::move(err)] {
                 return reply<Serializer>(wait_style(), futurize<Ret>::make_exception_future(std::runtime_error(err.c_str())), msg_id, client, timeout).handle_exception([client, msg_id] (std::exception_ptr eptr) {
-                    client->get_logger()(client->info(), msg_id, format("got exception while processing an oversized message: {}", eptr));
+                    client->get_logger()(client->info(), msg_id, format("got exception while rejecting a message: {}", eptr));
                 });
             }).handle_exception_type([] (gate_closed_exception&) {/* ignore */});
             return make_ready_future();
         }
         // note: apply is executed asynchronously with regards to networking so we cannot chain futures here by doing "return apply()"
-        auto f = client->wait_for_resources(memory_consumed, timeout).then([client, timeout, msg_id, data = std::move(data), &func] (auto permit) mutable {
+        auto f = client->wait_for_resources(memory_consumed, timeout).then([client, timeout, msg_id, data = std::move(data), &func, admission, series] (auto permit) mutable {
                 // FIXME: future is discarded
-                (void)try_with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, data = std::move(data), permit = std::move(permit), &func] () mutable {
-                    try {
-                        auto args = unmarshall<Serializer, InArgs...>(*client, std::move(data));
-                        return apply(func, client->info(), timeout, WantClientInfo(), WantTimePoint(), signature(), std::move(args)).then_wrapped([client, timeout, msg_id, permit = std::move(permit)] (futurize_t<Ret> ret) mutable {
-                            return reply<Serializer>(wait_style(), std::move(ret), msg_id, client, timeout).handle_exception([permit = std::move(permit), client, msg_id] (std::exception_ptr eptr) {
-                                client->get_logger()(client->info(), msg_id, format("got exception while processing a message: {}", eptr));
+                (void)try_with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, data = std::move(data), permit = std::move(permit), &func, admission, series] () mutable {
+                    // Queueing for the verb does not hold up the connection, unlike
+                    // waiting for memory, so that the other verbs keep going
+                    auto admitted = admission ? admission->enter(timeout).then([] (handler_admission::permit p) {
+                        return std::optional<handler_admission::permit>(std::move(p));
+                    }) : make_ready_future<std::optional<handler_admission::permit>>();
+                    return admitted.then([client, timeout, msg_id, data = std::move(data), permit = std::move(permit), &func, series] (std::optional<handler_admission::permit> verb_permit) mutable {
+                        try {
+                            auto start = std::chrono::steady_clock::now();
+                            auto args = unmarshall<Serializer, InArgs...>(*client, std::move(data));
+                            return apply(func, client->info(), timeout, WantClientInfo(), WantTimePoint(), signature(), std::move(args)).then_wrapped([client, timeout, msg_id, permit = std::move(permit), verb_permit = std::move(verb_permit), series, start] (futurize_t<Ret> ret) mutable {
+                                if (series && ret.failed()) {
+                                    series->errors++;
+                                }
+                                return reply<Serializer>(wait_style(), std::move(ret), msg_id, client, timeout, series).handle_exception([permit = std::move(permit), client, msg_id] (std::exception_ptr eptr) {
+                                    client->get_logger()(client->info(), msg_id, format("got exception while processing a message: {}", eptr));
+                                }).finally([verb_permit = std::move(verb_permit), series, start] {
+                                    if (series) {
+                                        series->latency.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+                                    }
+                                });
                             });
-                        });
-                    } catch (...) {
-                        client->get_logger()(client->info(), msg_id, format("got exception while processing a message: {}", std::current_exception()));
-                        return make_ready_future();
-                    }
+                        } catch (...) {
+                            client->get_logger()(client->info(), msg_id, format("got exception while processing a message: {}", std::current_exception()));
+                            return make_ready_future();
+                        }
+                    }).handle_exception_type([] (semaphore_timed_out&) { /* the client gave up already */ });
                 }).handle_exception_type([] (gate_closed_exception&) {/* ignore */});
         });
 
@@ -654,7 +865,7 @@ template<typename Serializer, typename MsgType>
 template<typename Ret, typename... In>
 auto protocol<Serializer, MsgType>::make_client(signature<Ret(In...)> clear_sig, MsgType t) {
     using sig_type = signature<typename client_function_type<Ret, In...>::type>;
-    return send_helper<Serializer>(t, sig_type());
+    return send_helper<Serializer>(t, sig_type(), &_verb_metrics);
 }
 
 template<typename Serializer, typename MsgType>
@@ -671,11 +882,25 @@ auto protocol<Serializer, MsgType>::register_handler(MsgType t, scheduling_group
     using want_client_info = typename sig_type::want_client_info;
     using want_time_point = typename sig_type::want_time_point;
     auto recv = recv_helper<Serializer>(clean_sig_type(), std::forward<Func>(func),
-            want_client_info(), want_time_point());
+            want_client_info(), want_time_point(), nullptr, uint64_t(t), &_verb_metrics);
     register_receiver(t, rpc_handler{sg, make_copyable_function(std::move(recv))});
     return make_client(clean_sig_type(), t);
 }
 
+template<typename Serializer, typename MsgType>
+template<typename Func>
+auto protocol<Serializer, MsgType>::register_handler(MsgType t, scheduling_group sg, handler_limits limits, Func&& func) {
+    using sig_type = signature<typename function_traits<Func>::signature>;
+    using clean_sig_type = typename sig_type::clean;
+    using want_client_info = typename sig_type::want_client_info;
+    using want_time_point = typename sig_type::want_time_point;
+    auto admission = make_lw_shared<handler_admission>(limits);
+    auto recv = recv_helper<Serializer>(clean_sig_type(), std::forward<Func>(func),
+            want_client_info(), want_time_point(), admission, uint64_t(t), &_verb_metrics);
+    register_receiver(t, rpc_handler{sg, make_copyable_function(std::move(recv)), {}, std::move(admission)});
+    return make_client(clean_sig_type(), t);
+}
+
 template<typename Serializer, typename MsgType>
 template<typename Func>
 auto protocol<Serializer, MsgType>::register_handler(MsgType t, Func&& func) {
@@ -732,9 +957,74 @@ future<> sink_impl<Serializer, Out...>::operator()(const Out&... args) {
     static_assert(snd_buf::chunk_size >= 4, "send buffer chunk size is too small");
     auto p = data.front().get_write();
     write_le<uint32_t>(p, data.size - 4);
+    if (data.size > _max_batch_bytes) {
+        if (!_batch_elements) {
+            return send_frame(std::move(data));
+        }
+        // Anything batched goes first
+        auto f = send_batch();
+        return when_all_succeed(std::move(f), send_frame(std::move(data))).discard_result();
+    }
+    if (this->_ex) {
+        return make_exception_future(this->_ex);
+    }
+    // The element is laid out as a frame of its own, so a batch of one
+    // is sent as is, without the batch header
+    auto f = make_ready_future<>();
+    if (_batch_size + data.size > _max_batch_bytes + 4) {
+        f = send_batch();
+    }
+    if (!_batch_elements) {
+        _batch = temporary_buffer<char>(_max_batch_bytes + 4);
+        _batch_size = 4;
+    }
+    auto append = [this] (const temporary_buffer<char>& b) {
+        std::copy(b.begin(), b.end(), _batch.get_write() + _batch_size);
+        _batch_size += b.size();
+    };
+    if (auto* one = std::get_if<temporary_buffer<char>>(&data.bufs)) {
+        append(*one);
+    } else {
+        for (auto& b : std::get<std::vector<temporary_buffer<char>>>(data.bufs)) {
+            append(b);
+        }
+    }
+    _batch_elements++;
+    if (!_batch_flush_scheduled) {
+        _batch_flush_scheduled = true;
+        _batch_flushed = _batch_flushed.then([] {
+            return yield();
+        }).then([this] {
+            _batch_flush_scheduled = false;
+            // A failure is kept in _ex
+            return send_batch().handle_exception([] (std::exception_ptr) {});
+        });
+    }
+    return f;
+}
+
+template<typename Serializer, typename... Out>
+future<> sink_impl<Serializer, Out...>::send_batch() {
+    if (!_batch_elements) {
+        return make_ready_future<>();
+    }
+    auto buf = std::exchange(_batch, {});
+    buf.trim(_batch_size);
+    if (_batch_elements == 1) {
+        buf.trim_front(4);
+    } else {
+        write_le<uint32_t>(buf.get_write(), (_batch_size - 4) | stream_batch_flag);
+    }
+    _batch_size = 0;
+    _batch_elements = 0;
+    return send_frame(snd_buf(std::move(buf)));
+}
+
+template<typename Serializer, typename... Out>
+future<> sink_impl<Serializer, Out...>::send_frame(snd_buf data) {
     // we do not want to dead lock on huge packets, so let them in
     // but only one at a time
-    auto size = std::min(size_t(data.size), max_stream_buffers_memory);
+    auto size = std::min(size_t(data.size), this->_window);
     const auto seq_num = _next_seq_num++;
     return get_units(this->_sem, size).then([this, data = make_foreign(std::make_unique<snd_buf>(std::move(data))), seq_num] (semaphore_units<> su) mutable {
         if (this->_ex) {
@@ -785,33 +1075,40 @@ future<> sink_impl<Serializer, Out...>::operator()(const Out&... args) {
 template<typename Serializer, typename... Out>
 future<> sink_impl<Serializer, Out...>::flush() {
     // wait until everything is sent out before returning.
-    return with_semaphore(this->_sem, max_stream_buffers_memory, [this] {
-        if (this->_ex) {
-            return make_exception_future(this->_ex);
-        }
-        return make_ready_future();
+    return send_batch().then([this] {
+        return with_semaphore(this->_sem, this->_window, [this] {
+            if (this->_ex) {
+                return make_exception_future(this->_ex);
+            }
+            return make_ready_future();
+        });
     });
 }
 
 template<typename Serializer, typename... Out>
 future<> sink_impl<Serializer, Out...>::close() {
-    return with_semaphore(this->_sem, max_stream_buffers_memory, [this] {
-        return smp::submit_to(this->_con->get_owner_shard(), [this] {
-            connection* con = this->_con->get();
-            if (con->sink_closed()) { // double close, should not happen!
-                return make_exception_future(stream_closed());
-            }
-            future<> f = make_ready_future<>();
-            if (!con->error() && !this->_ex) {
-                snd_buf data = marshall(con->template serializer<Serializer>(), 4);
-                static_assert(snd_buf::chunk_size >= 4, "send buffer chunk size is too small");
-                auto p = data.front().get_write();
-                write_le<uint32_t>(p, -1U); // max len fragment marks an end of a stream
-                f = con->send(std::move(data), {}, nullptr);
-            } else {
-                f = this->_ex ? make_exception_future(this->_ex) : make_exception_future(closed_error());
-            }
-            return f.finally([con] { return con->close_sink(); });
+    // A failure to send the batch is kept in _ex, which is checked below
+    return send_batch().handle_exception([] (std::exception_ptr) {}).then([this] {
+        return std::exchange(_batch_flushed, make_ready_future<>());
+    }).then([this] {
+        return with_semaphore(this->_sem, this->_window, [this] {
+            return smp::submit_to(this->_con->get_owner_shard(), [this] {
+                connection* con = this->_con->get();
+                if (con->sink_closed()) { // double close, should not happen!
+                    return make_exception_future(stream_closed());
+                }
+                future<> f = make_ready_future<>();
+                if (!con->error() && !this->_ex) {
+                    snd_buf data = marshall(con->template serializer<Serializer>(), 4);
+                    static_assert(snd_buf::chunk_size >= 4, "send buffer chunk size is too small");
+                    auto p = data.front().get_write();
+                    write_le<uint32_t>(p, -1U); // max len fragment marks an end of a stream
+                    f = con->send(std::move(data), {}, nullptr);
+                } else {
+                    f = this->_ex ? make_exception_future(this->_ex) : make_exception_future(closed_error());
+                }
+                return f.finally([con] { return con->close_sink(); });
+            });
         });
     });
 }
@@ -53,6 +53,17 @@ struct stats {
     counter_type sent_messages = 0;
     counter_type wait_reply = 0;
     counter_type timeout = 0;
+    // Flushes of messages coalesced by the client
+    counter_type flushes = 0;
+    // Frames sent through the negotiated compressor, and frames sent
+    // uncompressed by adaptive compression
+    counter_type compressed_frames = 0;
+    counter_type uncompressed_frames = 0;
+    // Sizes of the compressed frames before and after compression
+    counter_type compression_input_bytes = 0;
+    counter_type compression_output_bytes = 0;
+    counter_type compression_time_ns = 0;
+    counter_type decompression_time_ns = 0;
 };
 
 
@@ -206,6 +217,30 @@ struct snd_buf {
     temporary_buffer<char>& front();
 };
 
+/// A blob passed as an rpc argument or return value without being copied.
+///
+/// The sent frame references the fragments, which are released once they
+/// are sent, so the caller's memory must stay unchanged until then. The
+/// received value shares the buffers the frame was read into. It is
+/// encoded as a 32-bit little endian length followed by the contents, and
+/// is copied like any other value when nested in another type.
+struct zero_copy_buffer {
+    std::vector<temporary_buffer<char>> fragments;
+
+    zero_copy_buffer() = default;
+    explicit zero_copy_buffer(temporary_buffer<char> b) {
+        fragments.push_back(std::move(b));
+    }
+    explicit zero_copy_buffer(std::vector<temporary_buffer<char>> bufs) : fragments(std::move(bufs)) {}
+    /// Wraps a string, which is kept alive until the buffer is released
+    explicit zero_copy_buffer(sstring s);
+    size_t size() const noexcept;
+    /// Shares the fragments, which does not modify them
+    std::vector<temporary_buffer<char>> share() const;
+    /// Copies the contents into a contiguous string
+    sstring linearize() const;
+};
+
 static inline memory_input_stream<rcv_buf::iterator> make_deserializer_stream(rcv_buf& input) {
     auto* b = std::get_if<temporary_buffer<char>>(&input.bufs);
     if (b) {
@@ -264,6 +299,9 @@ std::ostream& operator<<(std::ostream&, const connection_id&);
 using xshard_connection_ptr = lw_shared_ptr<foreign_ptr<shared_ptr<connection>>>;
 constexpr size_t max_queued_stream_buffers = 50;
 constexpr size_t max_stream_buffers_memory = 100 * 1024;
+// Set in the length of a stream frame holding several elements, each of
+// them a length and the element
+constexpr uint32_t stream_batch_flag = uint32_t(1) << 31;
 
 /// \addtogroup rpc
 /// @{
@@ -275,9 +313,11 @@ class sink {
     class impl {
     protected:
         xshard_connection_ptr _con;
+        // The bytes that may be sent ahead
+        size_t _window;
         semaphore _sem;
         std::exception_ptr _ex;
-        impl(xshard_connection_ptr con) : _con(std::move(con)), _sem(max_stream_buffers_memory) {}
+        impl(xshard_connection_ptr con, size_t window = max_stream_buffers_memory) : _con(std::move(con)), _window(window), _sem(window) {}
     public:
         virtual ~impl() {};
         virtual future<> operator()(const Out&... args) = 0;
@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/sstring.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/rpc/rpc_types.hh>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace seastar {
+namespace rpc {
+
+// Compresses frames with zstd, optionally with a dictionary shared by the
+// client and the server. Dictionaries help the most with small, repetitive
+// messages, on which lz4 does poorly.
+//
+// The client offers its dictionaries by id, in order of preference, and
+// plain zstd last, so a server that has none of them still picks zstd.
+// Fragmented buffers are compressed and decompressed as a stream, without
+// being linearized.
+class zstd_compressor final : public compressor {
+public:
+    static constexpr int default_level = 3;
+
+    // A dictionary in the zstd format, as produced by train() or by
+    // `zstd --train`. Both ends of a connection must have it.
+    class dictionary {
+        uint32_t _id;
+        temporary_buffer<char> _data;
+        ZSTD_CDict_s* _cdict;
+        ZSTD_DDict_s* _ddict;
+    public:
+        // Compression with the dictionary uses the given level
+        explicit dictionary(temporary_buffer<char> data, int level = default_level);
+        ~dictionary();
+        dictionary(const dictionary&) = delete;
+        dictionary& operator=(const dictionary&) = delete;
+        // The id recorded in the dictionary, which is what connections negotiate
+        uint32_t id() const noexcept {
+            return _id;
+        }
+        // The dictionary contents, for distributing them to other nodes
+        const temporary_buffer<char>& data() const noexcept {
+            return _data;
+        }
+        // Trains a dictionary of at most max_size bytes from messages sampled
+        // from the traffic it is going to compress
+        static temporary_buffer<char> train(const std::vector<temporary_buffer<char>>& samples, size_t max_size = 112 * 1024);
+        friend class zstd_compressor;
+    };
+
+    class factory final : public rpc::compressor::factory {
+        int _level;
+        std::vector<lw_shared_ptr<const dictionary>> _dictionaries;
+        sstring _features;
+    public:
+        explicit factory(int level = default_level, std::vector<lw_shared_ptr<const dictionary>> dictionaries = {});
+        virtual const sstring& supported() const override;
+        virtual std::unique_ptr<rpc::compressor> negotiate(sstring feature, bool is_server) const override;
+    };
+private:
+    int _level;
+    lw_shared_ptr<const dictionary> _dictionary;
+public:
+    zstd_compressor(int level, lw_shared_ptr<const dictionary> dictionary);
+    virtual snd_buf compress(size_t head_space, snd_buf data) override;
+    virtual rcv_buf decompress(rcv_buf data) override;
+    sstring name() const override;
+};
+
+}
+}
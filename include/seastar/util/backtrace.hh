@@ -79,6 +79,7 @@ class simple_backtrace {
 
     size_t hash() const noexcept { return _hash; }
     char delimeter() const noexcept { return _delimeter; }
+    const vector_type& frames() const noexcept { return _frames; }
 
     friend std::ostream& operator<<(std::ostream& out, const simple_backtrace&);
 
@@ -132,6 +133,8 @@ class tasktrace {
 
     size_t hash() const noexcept { return _hash; }
     char delimeter() const noexcept { return _main.delimeter(); }
+    // The backtrace of the task that was running, without the tasks waiting for it
+    const simple_backtrace& main_backtrace() const noexcept { return _main; }
 
     friend std::ostream& operator<<(std::ostream& out, const tasktrace&);
 
@@ -0,0 +1,58 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace seastar {
+
+/// Extends a CRC32C (Castagnoli) checksum with more data.
+///
+/// Uses the CRC32 instructions of SSE4.2 on x86, or of the CRC extension
+/// on ARM, where the cpu has them. Like zlib's crc32(), takes and returns
+/// finished checksums: the checksum of some data is crc32c(0, data, len),
+/// and that of a concatenation is computed by chaining calls.
+uint32_t crc32c(uint32_t crc, const char* data, size_t len) noexcept;
+
+/// Copies \c len bytes from \c src to \c dst, which must not overlap, and
+/// extends \c crc with them like crc32c() does, in a single pass over the
+/// data.
+uint32_t crc32c_copy(uint32_t crc, char* dst, const char* src, size_t len) noexcept;
+
+/// The CRC32C of a stream of data, see \ref crc32c().
+class crc32c_checksum {
+    uint32_t _crc = 0;
+public:
+    void update(const char* data, size_t len) noexcept {
+        _crc = crc32c(_crc, data, len);
+    }
+    /// Updates the checksum with data while copying it, see \ref crc32c_copy().
+    void copy(char* dst, const char* src, size_t len) noexcept {
+        _crc = crc32c_copy(_crc, dst, src, len);
+    }
+    uint32_t get() const noexcept {
+        return _crc;
+    }
+};
+
+}
@@ -90,6 +90,42 @@ future<std::vector<temporary_buffer<char>>> read_entire_file(std::filesystem::pa
 /// \param path path of the file to be read.
 future<sstring> read_entire_file_contiguous(std::filesystem::path path);
 
+/// An entry found by \ref walk_directory_tree().
+struct directory_tree_entry {
+    /// Path of the entry, the walked root followed by the names of the
+    /// directories leading to it
+    std::filesystem::path path;
+    /// Type of the entry, not following symbolic links
+    directory_entry_type type = directory_entry_type::unknown;
+    /// Size of the entry, if \ref directory_walk_options::stat_entries is set
+    uint64_t size = 0;
+};
+
+struct directory_walk_options {
+    /// Maximum number of entries passed to the consumer at once
+    size_t batch_size = 1024;
+    /// Maximum number of directories listed at once on each shard
+    unsigned max_concurrent_directories = 16;
+    /// Whether to stat() the entries, to get their sizes
+    bool stat_entries = false;
+};
+
+/// Lists all the entries under a directory, recursively, using all shards.
+///
+/// Subdirectories are handed out to the shards in turn, each shard lists
+/// the directories it's given and passes their entries, in batches, to
+/// its copy of \c consume. Directories are not followed through symbolic
+/// links. The batches are in no particular order, but the entries of a
+/// directory are passed before the ones of its subdirectories.
+///
+/// \param root the directory to walk; it's not passed to \c consume
+/// \param consume called with each batch, on the shard that listed it; a
+///        copy of it is made on each shard
+/// \param opts options controlling the walk
+future<> walk_directory_tree(std::filesystem::path root,
+        std::function<future<> (std::vector<directory_tree_entry>)> consume,
+        directory_walk_options opts = {});
+
 /// @}
 
 } // namespace util
@@ -80,6 +80,17 @@ struct options : public program_options::option_group {
     ///
     /// Default: \p false.
     program_options::value<bool> log_to_syslog;
+    /// Write the log from a background thread, with a buffer of this
+    /// size per shard, so that logging never blocks a reactor.
+    ///
+    /// Default: \p 0, logging is synchronous.
+    /// \see \ref seastar::logger::set_async_enabled().
+    program_options::value<unsigned> log_async_buffer_size;
+    /// Let the background log writer format the messages.
+    ///
+    /// Default: \p false.
+    /// \see \ref seastar::logger::set_deferred_formatting_enabled().
+    program_options::value<bool> log_deferred_formatting;
 
     /// \cond internal
     options(program_options::option_group* parent_group);
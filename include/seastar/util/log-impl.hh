@@ -21,7 +21,13 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <iterator>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <fmt/format.h>
 
 /// \addtogroup logging
 /// @{
@@ -114,6 +120,107 @@ class log_buf {
     std::string_view view() const noexcept { return std::string_view(_begin, size()); }
 };
 
+// The arguments of a message can be copied, to be formatted later by the
+// log writer thread, when they are all of the types below. Values of
+// arithmetic types are copied as they are, and strings as their characters,
+// which are formatted as a std::string_view.
+template <typename T, typename = void>
+struct deferred_log_arg {
+    static constexpr bool deferrable = false;
+};
+
+template <typename T>
+struct deferred_log_arg<T, std::enable_if_t<std::is_arithmetic_v<T>>> {
+    static constexpr bool deferrable = true;
+    static size_t size(const T&) noexcept {
+        return sizeof(T);
+    }
+    static char* encode(char* out, const T& v) noexcept {
+        std::memcpy(out, &v, sizeof(T));
+        return out + sizeof(T);
+    }
+    static T decode(const char*& in) noexcept {
+        T v;
+        std::memcpy(&v, in, sizeof(T));
+        in += sizeof(T);
+        return v;
+    }
+};
+
+// Character pointers are left out, as they may be null
+template <typename T>
+struct deferred_log_arg<T, std::enable_if_t<!std::is_arithmetic_v<T> && !std::is_pointer_v<T>
+        && std::is_convertible_v<const T&, std::string_view>>> {
+    static constexpr bool deferrable = true;
+    static size_t size(const T& v) noexcept {
+        return sizeof(uint32_t) + std::string_view(v).size();
+    }
+    static char* encode(char* out, const T& v) noexcept {
+        std::string_view s(v);
+        uint32_t len = s.size();
+        std::memcpy(out, &len, sizeof(len));
+        std::memcpy(out + sizeof(len), s.data(), len);
+        return out + sizeof(len) + len;
+    }
+    static std::string_view decode(const char*& in) noexcept {
+        uint32_t len;
+        std::memcpy(&len, in, sizeof(len));
+        std::string_view s(in + sizeof(len), len);
+        in += sizeof(len) + len;
+        return s;
+    }
+};
+
+template <typename... Args>
+constexpr bool is_deferrable_log_args_v = (deferred_log_arg<Args>::deferrable && ...);
+
+template <typename... Args>
+log_buf::inserter_iterator format_deferred_log_args(log_buf::inserter_iterator it, std::string_view format, const char* in) {
+    // The arguments are decoded in order, as a braced list is evaluated so
+    std::tuple<decltype(deferred_log_arg<Args>::decode(in))...> args{deferred_log_arg<Args>::decode(in)...};
+    return std::apply([&] (const auto&... a) {
+#if FMT_VERSION >= 80000
+        return fmt::format_to(it, fmt::runtime(format), a...);
+#else
+        return fmt::format_to(it, format, a...);
+#endif
+    }, args);
+}
+
+/// The arguments of a message whose formatting is deferred
+class deferred_log_args {
+public:
+    using formatter = log_buf::inserter_iterator (*)(log_buf::inserter_iterator, std::string_view format, const char* args);
+
+    virtual ~deferred_log_args() = default;
+    /// The size of the encoded arguments
+    virtual size_t size() const noexcept = 0;
+    /// Encodes the arguments into \c out, which has room for size() bytes
+    virtual void encode(char* out) const noexcept = 0;
+    /// The function that formats the encoded arguments
+    virtual formatter get_formatter() const noexcept = 0;
+};
+
+template <typename... Args>
+class deferred_log_args_impl final : public deferred_log_args {
+    std::tuple<const Args&...> _args;
+public:
+    explicit deferred_log_args_impl(const Args&... args) noexcept : _args(args...) {}
+    virtual size_t size() const noexcept override {
+        return std::apply([] (const auto&... a) {
+            return (size_t(0) + ... + deferred_log_arg<std::decay_t<decltype(a)>>::size(a));
+        }, _args);
+    }
+    virtual void encode(char* out) const noexcept override {
+        std::apply([out] (const auto&... a) mutable {
+            ((out = deferred_log_arg<std::decay_t<decltype(a)>>::encode(out, a)), ...);
+        }, _args);
+    }
+    virtual formatter get_formatter() const noexcept override {
+        return format_deferred_log_args<Args...>;
+    }
+};
+
 } // namespace internal
 /// \endcond
 
@@ -70,6 +70,10 @@ namespace seastar {
 class logger;
 class logger_registry;
 
+namespace internal {
+class async_log_backend;
+}
+
 /// \brief Logger class for ostream or syslog.
 ///
 /// Java style api for logging.
@@ -87,7 +91,10 @@ class logger {
     static std::ostream* _out;
     static std::atomic<bool> _ostream;
     static std::atomic<bool> _syslog;
+    static std::atomic<bool> _async;
+    static std::atomic<bool> _deferred;
     static inline thread_local bool silent = false;
+    friend class internal::async_log_backend;
 
 public:
     class log_writer {
@@ -134,7 +141,13 @@ class logger {
 private:
 
     // We can't use an std::function<> as it potentially allocates.
-    void do_log(log_level level, log_writer& writer);
+    // Returns false if the message was dropped, because the asynchronous
+    // logging buffer was full
+    bool do_log(log_level level, log_writer& writer);
+    // Queues the message, with its arguments, to be formatted by the
+    // asynchronous log writer. Returns false if the message has to be
+    // formatted now instead.
+    bool do_log_deferred(log_level level, std::string_view format, const internal::deferred_log_args& args);
     void failed_to_log(std::exception_ptr ex, format_info fmt) noexcept;
 
     class silencer {
@@ -186,6 +199,12 @@ class logger {
         uint64_t get_and_reset_dropped_messages() {
             return std::exchange(_dropped_messages, 0);
         }
+        // A message that passed the limit was dropped on the way to the
+        // log, so it is reported with the next one, as are the ones it
+        // reported itself
+        void restore_dropped_messages(uint64_t reported) {
+            _dropped_messages += reported + 1;
+        }
 
     public:
         explicit rate_limit(std::chrono::milliseconds interval);
@@ -216,6 +235,14 @@ class logger {
     void log(log_level level, format_info fmt, Args&&... args) noexcept {
         if (is_enabled(level)) {
             try {
+                if constexpr (internal::is_deferrable_log_args_v<std::decay_t<Args>...>) {
+                    if (_deferred.load(std::memory_order_relaxed)) {
+                        internal::deferred_log_args_impl<std::decay_t<Args>...> deferred(args...);
+                        if (do_log_deferred(level, fmt.format, deferred)) {
+                            return;
+                        }
+                    }
+                }
                 lambda_log_writer writer([&] (internal::log_buf::inserter_iterator it) {
 #if FMT_VERSION >= 80000
                     return fmt::format_to(it, fmt::runtime(fmt.format), std::forward<Args>(args)...);
@@ -248,9 +275,11 @@ class logger {
     void log(log_level level, rate_limit& rl, format_info fmt, Args&&... args) noexcept {
         if (is_enabled(level) && rl.check()) {
             try {
+                uint64_t reported = 0;
                 lambda_log_writer writer([&] (internal::log_buf::inserter_iterator it) {
                     if (rl.has_dropped_messages()) {
-                        it = fmt::format_to(it, "(rate limiting dropped {} similar messages) ", rl.get_and_reset_dropped_messages());
+                        reported = rl.get_and_reset_dropped_messages();
+                        it = fmt::format_to(it, "(rate limiting dropped {} similar messages) ", reported);
                     }
 #if FMT_VERSION >= 80000
                     return fmt::format_to(it, fmt::runtime(fmt.format), std::forward<Args>(args)...);
@@ -258,7 +287,9 @@ class logger {
                     return fmt::format_to(it, fmt.format, std::forward<Args>(args)...);
 #endif
                 });
-                do_log(level, writer);
+                if (!do_log(level, writer)) {
+                    rl.restore_dropped_messages(reported);
+                }
             } catch (...) {
                 failed_to_log(std::current_exception(), std::move(fmt));
             }
@@ -297,13 +328,17 @@ class logger {
     void log(log_level level, rate_limit& rl, log_writer& writer, format_info fmt = {}) noexcept {
         if (is_enabled(level) && rl.check()) {
             try {
+                uint64_t reported = 0;
                 lambda_log_writer writer_wrapper([&] (internal::log_buf::inserter_iterator it) {
                     if (rl.has_dropped_messages()) {
-                        it = fmt::format_to(it, "(rate limiting dropped {} similar messages) ", rl.get_and_reset_dropped_messages());
+                        reported = rl.get_and_reset_dropped_messages();
+                        it = fmt::format_to(it, "(rate limiting dropped {} similar messages) ", reported);
                     }
                     return writer(it);
                 });
-                do_log(level, writer_wrapper);
+                if (!do_log(level, writer_wrapper)) {
+                    rl.restore_dropped_messages(reported);
+                }
             } catch (...) {
                 failed_to_log(std::current_exception(), std::move(fmt));
             }
@@ -414,6 +449,41 @@ class logger {
     ///       this should be rare (will have to fill the pipe buffer
     ///       before syslogd can clear it) but can happen.
     static void set_syslog_enabled(bool enabled) noexcept;
+
+    /// Write the log from a dedicated thread. default is false
+    ///
+    /// Messages are queued in a buffer of each thread that logs, and a
+    /// background thread writes them to the output stream and syslog, so
+    /// logging never blocks the reactor. The messages of a thread are
+    /// written in the order they were logged. A message that finds the
+    /// buffer of its thread full is dropped, and counted. A rate limited
+    /// message that is dropped is counted by its rate_limit too, so that
+    /// the next message it lets through reports it.
+    ///
+    /// Disabling waits for the queued messages to be written.
+    ///
+    /// \param buffer_size the size of the buffer of each thread, in bytes;
+    ///        it applies to the threads that log for the first time after
+    ///        the call
+    static void set_async_enabled(bool enabled, size_t buffer_size = 1 << 20);
+
+    /// The number of messages dropped because the asynchronous logging
+    /// buffer of their thread was full
+    static uint64_t async_dropped_messages() noexcept;
+
+    /// Defer the formatting of messages to the asynchronous log writer.
+    /// default is false
+    ///
+    /// While asynchronous logging is enabled, messages whose arguments are
+    /// all numbers and strings are queued as they are, the format string,
+    /// the raw arguments and the timestamp, and the log writer thread
+    /// formats them, so logging costs a shard little more than copying
+    /// them. Other messages, and the rate limited ones, are formatted by
+    /// the shard as usual.
+    ///
+    /// The message is formatted as when logging, but for the arguments
+    /// being the values they had when they were logged.
+    static void set_deferred_formatting_enabled(bool enabled) noexcept;
 };
 
 /// \brief used to keep a static registry of loggers
@@ -490,6 +560,11 @@ struct logging_settings final {
     bool syslog_enabled;
     logger_timestamp_style stdout_timestamp_style = logger_timestamp_style::real;
     logger_ostream_type logger_ostream = logger_ostream_type::stderr;
+    /// The size of the asynchronous logging buffer of each thread,
+    /// or 0 to log synchronously
+    size_t async_buffer_size = 0;
+    /// Whether the asynchronous log writer formats the messages
+    bool deferred_formatting = false;
 };
 
 /// Shortcut for configuring the logging system all at once.
@@ -21,7 +21,9 @@
 
 #pragma once
 
+#include <seastar/core/sstring.hh>
 #include <seastar/util/noncopyable_function.hh>
+#include <vector>
 
 namespace seastar {
 namespace memory {
@@ -81,5 +83,61 @@ void set_additional_diagnostics_producer(noncopyable_function<void(memory_diagno
 /// low-memory conditions.
 sstring generate_memory_diagnostics_report();
 
+/// Usage of the objects of a small pool, for \ref fragmentation_report
+struct small_pool_stats {
+    /// Size of the pool's objects, in bytes
+    size_t object_size;
+    /// Size of the spans the pool prefers to allocate, in bytes
+    size_t span_size;
+    /// Number of allocated objects
+    size_t used_objects;
+    /// Memory in the pool's spans, in bytes
+    size_t memory;
+    /// Memory in free objects of the pool, in bytes, which no other
+    /// pool nor large allocation can use
+    size_t unused_memory;
+};
+
+/// \brief How fragmented the memory of this shard is
+///
+/// Free memory is only of use to a large allocation if enough of it is
+/// contiguous, and memory taken by a small pool is only available to
+/// objects of its size, so the amount of free memory alone doesn't tell
+/// which allocations will succeed.
+struct fragmentation_report {
+    /// Free memory, in bytes
+    size_t free_memory;
+    /// Size of the largest contiguous free span, the most a single large
+    /// allocation can get without reclaiming, in bytes
+    size_t largest_free_span;
+    /// Number of free spans of \ref page_size << i bytes, at index i
+    std::vector<size_t> free_spans;
+    /// The small pools in use
+    std::vector<small_pool_stats> small_pools;
+    /// Number of times the defragmentation hook was called
+    uint64_t defragmentations;
+};
+
+/// \brief Reports the fragmentation of the memory of this shard
+///
+/// Walks the free lists, so is cheap enough to be polled, but not to be
+/// called for every allocation. Only supported with the seastar allocator,
+/// the report is empty otherwise.
+fragmentation_report get_fragmentation_report();
+
+/// \brief Sets a hook to defragment memory
+///
+/// The hook is called when a large allocation can't be satisfied although
+/// there is enough free memory, in spans too small, and the reclaimers
+/// freed nothing. It is passed the size of the allocation, and is meant to
+/// move objects out of sparsely used memory, as log-structured allocators
+/// can, so that free spans can merge. It returns whether it freed any
+/// memory, in which case the allocation is retried.
+///
+/// The hook runs within the failing allocation, so it must not wait, and
+/// should allocate as little as possible; a large allocation failing
+/// within it doesn't call it again.
+void set_defragmentation_hook(noncopyable_function<bool (size_t)> hook);
+
 } // namespace memory
 } // namespace seastar
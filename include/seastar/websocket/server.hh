@@ -25,16 +25,18 @@
 #include <seastar/core/seastar.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/net/api.hh>
+#include <seastar/net/packet.hh>
 #include <seastar/core/gate.hh>
 #include <seastar/core/queue.hh>
+#include <seastar/core/semaphore.hh>
 #include <seastar/core/when_all.hh>
+#include <functional>
+#include <memory>
 
 namespace seastar::experimental::websocket {
 
 class server;
-struct reply {
-    //TODO: implement
-};
+class connection;
 
 /*!
  * \brief an error in handling a WebSocket connection
@@ -48,31 +50,64 @@ class exception : std::exception {
     }
 };
 
+/*!
+ * \brief the type of a data message
+ */
+enum class message_type {
+    text,
+    binary,
+};
+
+/*!
+ * \brief a function handling the data messages of a connection
+ *
+ * It is called for each message as soon as its first frame arrives, and
+ * the payload streams in, unmasked and inflated, as the rest of its frames
+ * do. So a large fragmented message is never held whole in memory.
+ * The messages of a connection are handled one at a time, and what a
+ * handler leaves unread of a message is discarded.
+ */
+using handler_t = std::function<future<>(connection& conn, message_type type, input_stream<char>& message)>;
+
 /*!
  * \brief a WebSocket connection
  */
 class connection : public boost::intrusive::list_base_hook<> {
+    // The payload of the message being received, as it arrives.
+    // The stream ends with an empty buffer.
+    struct message {
+        queue<temporary_buffer<char>> pieces;
+        // Set once the handler is done, what comes next is discarded
+        bool abandoned = false;
+        input_stream<char> stream;
+
+        message();
+    };
+    struct frame;
+    struct deflate_state;
+
     server& _server;
     connected_socket _fd;
     input_stream<char> _read_buf;
     output_stream<char> _write_buf;
     http_request_parser _http_parser;
-    std::unique_ptr<reply> _resp;
-    queue<std::unique_ptr<reply>> _replies{10};
     bool _done = false;
+    bool _close_sent = false;
+    // Frames are written one at a time
+    semaphore _write_sem{1};
+    // The message being received, and whether it is compressed
+    lw_shared_ptr<message> _message;
+    bool _message_compressed = false;
+    // The handler of the previous message
+    future<> _handled = make_ready_future<>();
+    // Set if permessage-deflate was negotiated
+    std::unique_ptr<deflate_state> _deflate;
 public:
     /*!
      * \param server owning \ref server
      * \param fd established socket used for communication
      */
-    connection(server& server, connected_socket&& fd)
-        : _server(server)
-        , _fd(std::move(fd))
-        , _read_buf(_fd.input())
-        , _write_buf(_fd.output())
-    {
-        on_new_connection();
-    }
+    connection(server& server, connected_socket&& fd);
     ~connection();
 
     /*!
@@ -84,12 +119,36 @@ class connection : public boost::intrusive::list_base_hook<> {
      */
     void shutdown();
 
+    /*!
+     * \brief send a data message in a single frame
+     *
+     * The payload is written to the socket as it is, without being copied,
+     * so a message fanned out to many connections can share one buffer.
+     * If permessage-deflate was negotiated, the payload is compressed first.
+     */
+    future<> send_message(message_type type, temporary_buffer<char> payload);
+
+    /*!
+     * \brief start the closing handshake
+     * \param code the status code, as defined in RFC 6455, section 7.4
+     */
+    future<> close(uint16_t code = 1000);
+
 protected:
     future<> read_loop();
     future<> read_one();
     future<> read_http_upgrade_request();
-    future<> response_loop();
     void on_new_connection();
+
+private:
+    future<> read_control_frame(frame f);
+    future<> read_data_frame(frame f);
+    future<> start_message(message_type type);
+    future<> push_payload(temporary_buffer<char> buf);
+    future<> end_message();
+    future<> send_frame(uint8_t first_byte, net::packet payload);
+    // Closes the connection because the client broke the protocol
+    future<> fail(uint16_t code, std::string_view reason);
 };
 
 /*!
@@ -102,6 +161,8 @@ class server {
     std::vector<server_socket> _listeners;
     gate _task_gate;
     boost::intrusive::list<connection> _connections;
+    handler_t _handler;
+    bool _permessage_deflate = false;
 public:
     /*!
      * \brief listen for a WebSocket connection on given address
@@ -115,6 +176,18 @@ class server {
      */
     void listen(socket_address addr, listen_options lo);
 
+    /*!
+     * \brief set the function which handles the messages of all connections
+     *
+     * Without one, messages are discarded.
+     */
+    void set_handler(handler_t handler);
+
+    /*!
+     * \brief accept the permessage-deflate extension (RFC 7692) when clients offer it
+     */
+    void set_permessage_deflate(bool enable);
+
     /*!
      * Stops the server and shuts down all active connections
      */
@@ -39,7 +39,10 @@ debian_packages=(
     xfslibs-dev
     libgnutls28-dev
     liblz4-dev
+    libzstd-dev
+    zlib1g-dev
     libsctp-dev
+    liburing-dev
     gcc
     make
     python3
@@ -75,6 +78,9 @@ redhat_packages=(
     gnutls-devel
     lksctp-tools-devel
     lz4-devel
+    libzstd-devel
+    zlib-devel
+    liburing-devel
     gcc
     make
     python3
@@ -151,6 +157,9 @@ arch_packages=(
     gnutls
     lksctp-tools
     lz4
+    zstd
+    zlib
+    liburing
     make
     libtool
     cmake
@@ -190,6 +199,8 @@ opensuse_packages=(
     libgnutls-devel
     libgnutlsxx28
     liblz4-devel
+    libzstd-devel
+    zlib-devel
     libnuma-devel
     lksctp-tools-devel
     ninja
@@ -0,0 +1,51 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/preempt.hh>
+#include <seastar/util/later.hh>
+
+namespace seastar {
+
+future<> abort_source::request_abort_preemptible() noexcept {
+    if (abort_requested()) {
+        return make_ready_future<>();
+    }
+    _aborting.splice(_aborting.end(), *_subscriptions);
+    _subscriptions = std::nullopt;
+    return repeat([this] {
+        while (!_aborting.empty()) {
+            // Unlinked first, as the callback may destroy the subscription
+            auto& s = _aborting.front();
+            _aborting.pop_front();
+            s.on_abort();
+            if (need_preempt() && !_aborting.empty()) {
+                return yield().then([] {
+                    return stop_iteration::no;
+                });
+            }
+        }
+        return make_ready_future<stop_iteration>(stop_iteration::yes);
+    });
+}
+
+}
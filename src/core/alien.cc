@@ -24,6 +24,9 @@
 #include <seastar/core/reactor.hh>
 #include <seastar/core/metrics.hh>
 #include <seastar/core/prefetch.hh>
+#include <seastar/core/posix.hh>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 namespace seastar {
 namespace alien {
@@ -139,6 +142,47 @@ bool instance::pure_poll_queues() {
     return queue.pure_poll_rx();
 }
 
+completion_queue::completion_queue()
+    : _completed(128)
+    , _fd(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    throw_system_error_on(_fd == -1, "eventfd");
+}
+
+completion_queue::~completion_queue() {
+    _completed.consume_all([] (completion* c) {
+        delete c;
+    });
+    ::close(_fd);
+}
+
+void completion_queue::push(std::unique_ptr<completion> c) {
+    while (!_completed.push(c.get())) {
+        // The node allocation failed, retry rather than lose the result
+    }
+    c.release();
+    // Pairs with the exchange in poll(), so that it either sees the
+    // completion or gets another signal
+    if (!_signalled.exchange(true, std::memory_order_acq_rel)) {
+        uint64_t one = 1;
+        auto r = ::write(_fd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+size_t completion_queue::poll() {
+    if (!_signalled.exchange(false, std::memory_order_acq_rel)) {
+        return 0;
+    }
+    uint64_t count;
+    auto r = ::read(_fd, &count, sizeof(count));
+    (void)r;
+    return _completed.consume_all([] (completion* c) {
+        std::unique_ptr<completion> guard(c);
+        c->complete();
+    });
+}
+
 instance* internal::default_instance;
 
 }
@@ -0,0 +1,114 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/arena.hh>
+#include <seastar/core/align.hh>
+#include <seastar/core/bitops.hh>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace seastar {
+
+arena::arena(size_t initial_chunk_size) noexcept
+    : _next_chunk_size(size_t(1) << log2ceil(std::max(initial_chunk_size, 2 * sizeof(chunk))))
+{
+}
+
+arena::arena(arena&& o) noexcept
+    : _chunks(std::exchange(o._chunks, nullptr))
+    , _pos(std::exchange(o._pos, nullptr))
+    , _end(std::exchange(o._end, nullptr))
+    , _next_chunk_size(o._next_chunk_size)
+    , _reserved(std::exchange(o._reserved, 0))
+{
+}
+
+arena::~arena() {
+    free_chunks(_chunks);
+}
+
+void* arena::do_allocate(size_t bytes, size_t alignment) {
+    auto p = align_up(_pos, alignment);
+    // No chunk yet: _pos and _end are both null
+    if (__builtin_expect(p && p <= _end && size_t(_end - p) >= bytes, true)) {
+        _pos = p + bytes;
+        return p;
+    }
+    return allocate_slow(bytes, alignment);
+}
+
+void* arena::allocate_slow(size_t bytes, size_t alignment) {
+    // Room for the header, and for aligning past it
+    auto needed = sizeof(chunk) + bytes + (alignment > alignof(chunk) ? alignment : 0);
+    if (needed > _next_chunk_size / 2) {
+        // Too big to share a chunk, keep the current chunk current
+        auto c = allocate_chunk(needed);
+        if (_chunks) {
+            c->next = _chunks->next;
+            _chunks->next = c;
+        } else {
+            c->next = nullptr;
+            _chunks = c;
+            _pos = _end = reinterpret_cast<char*>(c) + c->size;
+        }
+        _reserved += c->size;
+        return align_up(reinterpret_cast<char*>(c + 1), alignment);
+    }
+    auto c = allocate_chunk(_next_chunk_size);
+    c->next = _chunks;
+    _chunks = c;
+    _reserved += c->size;
+    _next_chunk_size *= 2;
+    _pos = align_up(reinterpret_cast<char*>(c + 1), alignment);
+    _end = reinterpret_cast<char*>(c) + c->size;
+    auto p = _pos;
+    _pos += bytes;
+    return p;
+}
+
+arena::chunk* arena::allocate_chunk(size_t size) {
+    auto c = static_cast<chunk*>(std::malloc(size));
+    if (!c) {
+        throw std::bad_alloc();
+    }
+    c->size = size;
+    return c;
+}
+
+void arena::free_chunks(chunk* c) noexcept {
+    while (c) {
+        std::free(std::exchange(c, c->next));
+    }
+}
+
+void arena::reset() noexcept {
+    if (!_chunks) {
+        return;
+    }
+    // The current chunk is the most recent, hence largest, regular one
+    free_chunks(std::exchange(_chunks->next, nullptr));
+    _reserved = _chunks->size;
+    _pos = reinterpret_cast<char*>(_chunks + 1);
+    _end = reinterpret_cast<char*>(_chunks) + _chunks->size;
+}
+
+}
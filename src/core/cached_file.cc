@@ -0,0 +1,262 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/cached_file.hh>
+#include <seastar/core/align.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/metrics.hh>
+#include "core/layered_file-impl.hh"
+#include <boost/range/irange.hpp>
+#include <cstring>
+
+namespace seastar {
+
+block_cache::block_cache(size_t capacity, size_t block_size)
+    : _capacity(capacity)
+    , _block_size(block_size)
+    , _reclaimer([this] (memory::reclaimer::request r) {
+        return evict(r.bytes_to_reclaim) ? memory::reclaiming_result::reclaimed_something : memory::reclaiming_result::reclaimed_nothing;
+    })
+{
+    namespace sm = seastar::metrics;
+    _metrics.add_group("block_cache", {
+        sm::make_counter("hits", _stats.hits, sm::description("Reads of blocks found in the cache")),
+        sm::make_counter("misses", _stats.misses, sm::description("Reads of blocks not found in the cache")),
+        sm::make_counter("evictions", _stats.evictions, sm::description("Blocks evicted to stay within capacity or to free memory")),
+        sm::make_counter("invalidations", _stats.invalidations, sm::description("Blocks dropped because their file was modified or closed")),
+        sm::make_gauge("bytes", [this] { return _used; }, sm::description("Bytes taken by cached blocks")),
+    });
+}
+
+block_cache::~block_cache() {
+    _lru.clear();
+}
+
+void block_cache::erase(std::map<key, block>::iterator it) noexcept {
+    _used -= it->second.data.size();
+    _blocks.erase(it);
+}
+
+size_t block_cache::evict(size_t bytes) noexcept {
+    size_t freed = 0;
+    while (freed < bytes && !_lru.empty()) {
+        auto& b = _lru.back();
+        _lru.pop_back();
+        freed += b.data.size();
+        erase(_blocks.find(b.k));
+        _stats.evictions++;
+    }
+    return freed;
+}
+
+void block_cache::set_capacity(size_t capacity) noexcept {
+    _capacity = capacity;
+    if (_used > _capacity) {
+        evict(_used - _capacity);
+    }
+}
+
+future<temporary_buffer<char>> block_cache::get(uint64_t file_id, uint64_t block_idx, noncopyable_function<future<temporary_buffer<char>> ()> load) {
+    key k(file_id, block_idx);
+    auto [it, inserted] = _blocks.try_emplace(k);
+    auto& b = it->second;
+    b.k = k;
+    if (!inserted) {
+        _stats.hits++;
+        if (b.loading) {
+            // Look it up again, it may be evicted or invalidated by then
+            return b.loading->get_shared_future().then([this, file_id, block_idx, load = std::move(load)] () mutable {
+                return get(file_id, block_idx, std::move(load));
+            });
+        }
+        _lru.erase(_lru.iterator_to(b));
+        _lru.push_front(b);
+        return make_ready_future<temporary_buffer<char>>(b.data.share());
+    }
+
+    _stats.misses++;
+    auto loading = make_lw_shared<shared_promise<>>();
+    b.loading = loading;
+    return futurize_invoke(load).then_wrapped([this, k, loading] (future<temporary_buffer<char>> f) {
+        auto it = _blocks.find(k);
+        bool ours = it != _blocks.end() && it->second.loading == loading;
+        if (f.failed()) {
+            if (ours) {
+                erase(it);
+            }
+            auto ex = f.get_exception();
+            loading->set_exception(ex);
+            return make_exception_future<temporary_buffer<char>>(std::move(ex));
+        }
+        auto buf = f.get0();
+        if (ours) {
+            auto& b = it->second;
+            b.loading = nullptr;
+            b.data = buf.share();
+            _used += b.data.size();
+            _lru.push_front(b);
+            if (_used > _capacity) {
+                evict(_used - _capacity);
+            }
+        }
+        loading->set_value();
+        return make_ready_future<temporary_buffer<char>>(std::move(buf));
+    });
+}
+
+void block_cache::invalidate(uint64_t file_id, uint64_t from, uint64_t to) noexcept {
+    auto it = _blocks.lower_bound(key(file_id, from));
+    while (it != _blocks.end() && it->first.first == file_id && it->first.second < to) {
+        _stats.invalidations++;
+        erase(it++);
+    }
+}
+
+namespace {
+
+class cached_file_impl : public internal::range_layered_file_impl {
+    block_cache& _cache;
+    const uint64_t _id;
+    const size_t _block_size;
+
+    future<temporary_buffer<char>> read_block(uint64_t idx, const io_priority_class& pc) {
+        return _cache.get(_id, idx, [this, idx, &pc] {
+            return _underlying_file.dma_read_bulk<char>(idx * _block_size, _block_size, pc);
+        });
+    }
+
+    virtual future<size_t> read_range(uint64_t pos, char* dst, size_t len, const io_priority_class& pc) override {
+        if (!len) {
+            return make_ready_future<size_t>(0);
+        }
+        auto first = pos / _block_size;
+        auto last = (pos + len - 1) / _block_size;
+        return do_with(std::vector<size_t>(last - first + 1), [this, pos, dst, len, first, last, &pc] (std::vector<size_t>& sizes) {
+            return parallel_for_each(boost::irange(first, last + 1), [this, pos, dst, len, first, &pc, &sizes] (uint64_t idx) {
+                return read_block(idx, pc).then([this, pos, dst, len, first, idx, &sizes] (temporary_buffer<char> buf) {
+                    auto block_pos = idx * _block_size;
+                    auto from = std::max(pos, block_pos);
+                    auto to = std::min(pos + len, block_pos + buf.size());
+                    if (from < to) {
+                        std::memcpy(dst + (from - pos), buf.get() + (from - block_pos), to - from);
+                    }
+                    sizes[idx - first] = buf.size();
+                });
+            }).then([this, pos, len, first, &sizes] {
+                // The first short block is the last one of the file
+                auto end = pos + len;
+                for (size_t i = 0; i < sizes.size(); i++) {
+                    if (sizes[i] < _block_size) {
+                        end = std::min(end, (first + i) * _block_size + sizes[i]);
+                        break;
+                    }
+                }
+                return size_t(std::max(end, pos) - pos);
+            });
+        });
+    }
+
+    template <typename Func>
+    auto invalidating(uint64_t from, uint64_t to, Func&& func) {
+        _cache.invalidate(_id, from / _block_size, align_up(to, uint64_t(_block_size)) / _block_size);
+        return func().finally([this, from, to] {
+            // Reads that raced with the write may have cached old data
+            _cache.invalidate(_id, from / _block_size, align_up(to, uint64_t(_block_size)) / _block_size);
+        });
+    }
+public:
+    cached_file_impl(file f, block_cache& cache)
+        : range_layered_file_impl(std::move(f))
+        , _cache(cache)
+        , _id(cache.allocate_file_id())
+        , _block_size(align_up(cache.block_size(), size_t(_underlying_file.disk_read_dma_alignment())))
+    {
+    }
+
+    ~cached_file_impl() {
+        _cache.invalidate(_id);
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        return invalidating(pos, pos + len, [&] {
+            return _underlying_file.dma_write(pos, buffer, len, pc);
+        });
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto& v : iov) {
+            len += v.iov_len;
+        }
+        return invalidating(pos, pos + len, [&] {
+            return _underlying_file.dma_write(pos, std::move(iov), pc);
+        });
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        auto idx = offset / _block_size;
+        if (range_size && idx == (offset + range_size - 1) / _block_size) {
+            // Within a block, share the cached buffer
+            return read_block(idx, pc).then([this, offset, range_size, idx] (temporary_buffer<char> buf) {
+                auto from = std::min<size_t>(offset - idx * _block_size, buf.size());
+                buf.trim_front(from);
+                buf.trim(std::min(range_size, buf.size()));
+                auto size = buf.size();
+                auto data = reinterpret_cast<uint8_t*>(buf.get_write());
+                return temporary_buffer<uint8_t>(data, size, buf.release());
+            });
+        }
+        return range_layered_file_impl::dma_read_bulk(offset, range_size, pc);
+    }
+    virtual future<> flush() override {
+        return _underlying_file.flush();
+    }
+    virtual future<struct stat> stat() override {
+        return _underlying_file.stat();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        return invalidating(length, std::numeric_limits<uint64_t>::max() / 2, [&] {
+            return _underlying_file.truncate(length);
+        });
+    }
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        return invalidating(offset, offset + length, [&] {
+            return _underlying_file.discard(offset, length);
+        });
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return _underlying_file.allocate(position, length);
+    }
+    virtual future<uint64_t> size() override {
+        return _underlying_file.size();
+    }
+    virtual future<> close() override {
+        _cache.invalidate(_id);
+        return _underlying_file.close();
+    }
+};
+
+}
+
+file make_cached_file(file f, block_cache& cache) {
+    return file(make_shared<cached_file_impl>(std::move(f), cache));
+}
+
+}
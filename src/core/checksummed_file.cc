@@ -0,0 +1,427 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/checksummed_file.hh>
+#include <seastar/core/layered_file.hh>
+#include <seastar/core/align.hh>
+#include <seastar/core/byteorder.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/when_all.hh>
+#include <seastar/core/print.hh>
+#include <seastar/util/crc32c.hh>
+#include "core/layered_file-impl.hh"
+#include <array>
+#include <cstring>
+#include <limits>
+
+namespace seastar {
+
+checksum_error::checksum_error(uint64_t pos)
+    : std::runtime_error(format("checksum mismatch in the block at {}", pos))
+    , _pos(pos)
+{}
+
+namespace {
+
+// The checksum file is a header, with the block size, followed by the
+// CRC32C of each block of the data file, little endian. The checksum of
+// the last block, which may be partial, covers the data up to the end of
+// the file.
+constexpr uint32_t checksum_file_magic = 0x31435243; // "CRC1"
+constexpr size_t header_size = 8;
+constexpr size_t checksum_size = 4;
+
+uint32_t zeroes_crc(size_t len) noexcept {
+    static const std::array<char, 4096> zeroes{};
+    uint32_t crc = 0;
+    while (len) {
+        auto n = std::min(len, zeroes.size());
+        crc = crc32c(crc, zeroes.data(), n);
+        len -= n;
+    }
+    return crc;
+}
+
+class checksummed_file_impl : public internal::range_layered_file_impl {
+    file _checksum_file;
+    const size_t _block_size;
+    const uint32_t _zero_block_crc;
+    uint64_t _size;
+    std::vector<uint32_t> _crcs;
+    // The checksums from here on are to be written to the checksum file
+    size_t _dirty_from = std::numeric_limits<size_t>::max();
+    // Serializes the updates of the checksums that need I/O, and their
+    // writing to the checksum file
+    semaphore _lock{1};
+
+    size_t nr_blocks(uint64_t size) const noexcept {
+        return align_up(size, uint64_t(_block_size)) / _block_size;
+    }
+
+    void mark_dirty(size_t from) noexcept {
+        _dirty_from = std::min(_dirty_from, from);
+    }
+
+    // Recomputes the checksum of a block from the data file
+    future<> rechecksum_block(size_t idx) {
+        auto pos = idx * _block_size;
+        auto len = std::min<uint64_t>(_block_size, _size - pos);
+        return _underlying_file.dma_read_exactly<char>(pos, len).then([this, idx] (temporary_buffer<char> buf) {
+            _crcs[idx] = crc32c(0, buf.get(), buf.size());
+            mark_dirty(idx);
+        });
+    }
+
+    // Follows the data file being truncated to, or written up to, size
+    future<> resize(uint64_t size) {
+        auto old_size = std::exchange(_size, size);
+        auto old_blocks = _crcs.size();
+        auto n = nr_blocks(size);
+        _crcs.resize(n);
+        if (size <= old_size) {
+            mark_dirty(n);
+            if (size < old_size && size % _block_size) {
+                return rechecksum_block(n - 1);
+            }
+            return make_ready_future<>();
+        }
+        // Up to where data is written, if anything, the file is zeroes
+        for (auto i = old_blocks; i < n; i++) {
+            auto len = std::min<uint64_t>(_block_size, size - i * _block_size);
+            _crcs[i] = len == _block_size ? _zero_block_crc : zeroes_crc(len);
+        }
+        mark_dirty(old_blocks);
+        if (old_size % _block_size) {
+            return rechecksum_block(old_blocks - 1);
+        }
+        return make_ready_future<>();
+    }
+
+    // The checksums of the blocks of data to be written at a block boundary
+    std::vector<uint32_t> checksum_blocks(const std::vector<iovec>& iov) const {
+        std::vector<uint32_t> crcs;
+        uint32_t crc = 0;
+        size_t in_block = 0;
+        for (auto& v : iov) {
+            auto p = static_cast<const char*>(v.iov_base);
+            auto left = v.iov_len;
+            while (left) {
+                auto n = std::min(left, _block_size - in_block);
+                crc = crc32c(crc, p, n);
+                p += n;
+                left -= n;
+                in_block += n;
+                if (in_block == _block_size) {
+                    crcs.push_back(crc);
+                    crc = 0;
+                    in_block = 0;
+                }
+            }
+        }
+        if (in_block) {
+            crcs.push_back(crc);
+        }
+        return crcs;
+    }
+
+    bool valid_write(uint64_t pos, size_t len) const noexcept {
+        return pos % _block_size == 0 && (len % _block_size == 0 || pos + len >= _size);
+    }
+
+    template <typename Func>
+    future<size_t> checksummed_write(uint64_t pos, size_t len, std::vector<uint32_t> crcs, Func&& write) {
+        return write().then([this, pos, len, crcs = std::move(crcs)] (size_t written) mutable {
+            return with_semaphore(_lock, 1, [this, pos, len, written, crcs = std::move(crcs)] () mutable {
+                auto end = pos + written;
+                auto f = end > _size ? resize(end) : make_ready_future<>();
+                return f.then([this, pos, len, written, crcs = std::move(crcs)] {
+                    auto first = pos / _block_size;
+                    auto full = written / _block_size;
+                    std::copy_n(crcs.begin(), full, _crcs.begin() + first);
+                    mark_dirty(first);
+                    if (written % _block_size == 0) {
+                        return make_ready_future<>();
+                    }
+                    if (written == len) {
+                        // The partial block the file ends with
+                        _crcs[first + full] = crcs[full];
+                        return make_ready_future<>();
+                    }
+                    return rechecksum_block(first + full);
+                }).then([written] {
+                    return written;
+                });
+            });
+        });
+    }
+
+    // Verifies the blocks in buf, read from start, stopping before the
+    // first one that's short, and copies what they hold of [pos, pos + len)
+    // to dst if asked, in the same pass. Returns how much of buf was
+    // verified.
+    size_t verify(uint64_t start, const char* buf, size_t n, char* dst = nullptr, uint64_t pos = 0, size_t len = 0) const {
+        size_t off = 0;
+        while (off < n) {
+            auto bpos = start + off;
+            auto idx = bpos / _block_size;
+            if (bpos >= _size || idx >= _crcs.size()) {
+                break;
+            }
+            size_t blen = std::min<uint64_t>(_block_size, _size - bpos);
+            if (n - off < blen) {
+                break;
+            }
+            auto b = buf + off;
+            uint32_t crc;
+            if (dst) {
+                size_t from = std::clamp<uint64_t>(std::max(pos, bpos) - bpos, 0, blen);
+                size_t to = std::clamp<uint64_t>(std::max(pos + len, bpos) - bpos, from, blen);
+                crc = crc32c(0, b, from);
+                if (from < to) {
+                    crc = crc32c_copy(crc, dst + (bpos + from - pos), b + from, to - from);
+                }
+                crc = crc32c(crc, b + to, blen - to);
+            } else {
+                crc = crc32c(0, b, blen);
+            }
+            if (crc != _crcs[idx]) {
+                throw checksum_error(bpos);
+            }
+            off += blen;
+        }
+        return off;
+    }
+
+    // Reads the blocks covering [pos, pos + len) into a buffer starting at
+    // the first of them
+    future<temporary_buffer<char>> read_blocks(uint64_t start, uint64_t end, const io_priority_class& pc) {
+        auto buf = temporary_buffer<char>::aligned(_memory_dma_alignment, end - start);
+        auto f = _underlying_file.dma_read(start, buf.get_write(), end - start, pc);
+        return f.then([buf = std::move(buf)] (size_t n) mutable {
+            buf.trim(n);
+            return std::move(buf);
+        });
+    }
+
+    virtual future<size_t> read_range(uint64_t pos, char* dst, size_t len, const io_priority_class& pc) override {
+        if (pos >= _size || !len) {
+            return make_ready_future<size_t>(0);
+        }
+        bool direct = pos % _block_size == 0 && len % _block_size == 0
+                && reinterpret_cast<uintptr_t>(dst) % _memory_dma_alignment == 0;
+        if (direct) {
+            return _underlying_file.dma_read(pos, dst, len, pc).then([this, pos, dst] (size_t n) {
+                return verify(pos, dst, n);
+            });
+        }
+        len = std::min<uint64_t>(len, _size - pos);
+        auto start = align_down(pos, uint64_t(_block_size));
+        auto end = align_up(pos + len, uint64_t(_block_size));
+        return read_blocks(start, end, pc).then([this, pos, dst, len, start] (temporary_buffer<char> buf) {
+            auto verified = verify(start, buf.get(), buf.size(), dst, pos, len);
+            return size_t(std::clamp<uint64_t>(start + verified, pos, pos + len) - pos);
+        });
+    }
+
+    future<> write_checksums() {
+        if (_dirty_from == std::numeric_limits<size_t>::max()) {
+            return make_ready_future<>();
+        }
+        auto n = _crcs.size();
+        uint64_t align = _checksum_file.disk_write_dma_alignment();
+        uint64_t start = align_down(header_size + std::min(_dirty_from, n) * checksum_size, align);
+        uint64_t end = header_size + n * checksum_size;
+        auto len = align_up(end, align) - start;
+        auto buf = temporary_buffer<char>::aligned(_checksum_file.memory_dma_alignment(), len);
+        std::memset(buf.get_write(), 0, len);
+        if (start == 0) {
+            write_le(buf.get_write(), checksum_file_magic);
+            write_le(buf.get_write() + 4, uint32_t(_block_size));
+        }
+        for (auto i = (std::max(start, uint64_t(header_size)) - header_size) / checksum_size; i < n; i++) {
+            write_le(buf.get_write() + header_size + i * checksum_size - start, _crcs[i]);
+        }
+        auto f = len ? _checksum_file.dma_write(start, buf.get(), len) : make_ready_future<size_t>(0);
+        return f.then([this, buf = std::move(buf), len, end] (size_t written) {
+            if (written != len) {
+                throw std::runtime_error("checksummed_file: short write of checksums");
+            }
+            return _checksum_file.truncate(end);
+        }).then([this] {
+            _dirty_from = std::numeric_limits<size_t>::max();
+        });
+    }
+
+public:
+    checksummed_file_impl(file data, file checksums, size_t block_size, uint64_t size, std::vector<uint32_t> crcs)
+        : range_layered_file_impl(std::move(data))
+        , _checksum_file(std::move(checksums))
+        , _block_size(block_size)
+        , _zero_block_crc(zeroes_crc(block_size))
+        , _size(size)
+        , _crcs(std::move(crcs))
+    {
+        _disk_read_dma_alignment = _block_size;
+        _disk_write_dma_alignment = _block_size;
+        _disk_overwrite_dma_alignment = _block_size;
+        if (_crcs.empty()) {
+            // Get the header written
+            mark_dirty(0);
+        }
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        if (!valid_write(pos, len)) {
+            return make_exception_future<size_t>(std::system_error(EINVAL, std::system_category(),
+                    "checksummed_file: writes have to be of whole blocks, but for the last one"));
+        }
+        auto crcs = checksum_blocks({iovec{const_cast<void*>(buffer), len}});
+        return checksummed_write(pos, len, std::move(crcs), [this, pos, buffer, len, &pc] {
+            return _underlying_file.dma_write(pos, buffer, len, pc);
+        });
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto& v : iov) {
+            len += v.iov_len;
+        }
+        if (!valid_write(pos, len)) {
+            return make_exception_future<size_t>(std::system_error(EINVAL, std::system_category(),
+                    "checksummed_file: writes have to be of whole blocks, but for the last one"));
+        }
+        auto crcs = checksum_blocks(iov);
+        return checksummed_write(pos, len, std::move(crcs), [this, pos, iov = std::move(iov), &pc] () mutable {
+            return _underlying_file.dma_write(pos, std::move(iov), pc);
+        });
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        if (offset >= _size || !range_size) {
+            return make_ready_future<temporary_buffer<uint8_t>>();
+        }
+        auto start = align_down(offset, uint64_t(_block_size));
+        auto end = align_up(std::min<uint64_t>(offset + range_size, _size), uint64_t(_block_size));
+        return read_blocks(start, end, pc).then([this, offset, range_size, start] (temporary_buffer<char> buf) {
+            buf.trim(verify(start, buf.get(), buf.size()));
+            buf.trim_front(std::min<size_t>(offset - start, buf.size()));
+            buf.trim(std::min(range_size, buf.size()));
+            auto size = buf.size();
+            auto data = reinterpret_cast<uint8_t*>(buf.get_write());
+            return temporary_buffer<uint8_t>(data, size, buf.release());
+        });
+    }
+    virtual future<> flush() override {
+        return _underlying_file.flush().then([this] {
+            return with_semaphore(_lock, 1, [this] {
+                return write_checksums();
+            });
+        }).then([this] {
+            return _checksum_file.flush();
+        });
+    }
+    virtual future<struct stat> stat() override {
+        return _underlying_file.stat();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        return with_semaphore(_lock, 1, [this, length] {
+            return _underlying_file.truncate(length).then([this, length] {
+                return resize(length);
+            });
+        });
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return _underlying_file.allocate(position, length);
+    }
+    virtual future<uint64_t> size() override {
+        return make_ready_future<uint64_t>(_size);
+    }
+    virtual future<> close() override {
+        return with_semaphore(_lock, 1, [this] {
+            return write_checksums();
+        }).then_wrapped([this] (future<> f) {
+            return when_all(_underlying_file.close(), _checksum_file.close()).then([f = std::move(f)] (auto closed) mutable {
+                if (f.failed()) {
+                    std::get<0>(closed).ignore_ready_future();
+                    std::get<1>(closed).ignore_ready_future();
+                    return std::move(f);
+                }
+                if (std::get<0>(closed).failed()) {
+                    std::get<1>(closed).ignore_ready_future();
+                    return std::move(std::get<0>(closed));
+                }
+                return std::move(std::get<1>(closed));
+            });
+        });
+    }
+};
+
+future<file> open_checksummed(file data, file checksums, checksummed_file_options opts, uint64_t size, uint64_t checksums_size) {
+    auto bs = opts.block_size;
+    if (checksums_size == 0) {
+        if (size != 0) {
+            throw std::runtime_error("checksummed_file: no checksums for a non-empty file");
+        }
+        if (bs == 0 || (bs & (bs - 1)) || bs % data.disk_write_dma_alignment() || bs % data.disk_read_dma_alignment()) {
+            throw std::invalid_argument(format("checksummed_file: bad block size {}", bs));
+        }
+        return make_ready_future<file>(file(seastar::make_shared<checksummed_file_impl>(std::move(data), std::move(checksums), bs, 0, std::vector<uint32_t>())));
+    }
+    auto f = checksums.dma_read_exactly<char>(0, checksums_size);
+    return f.then([data = std::move(data), checksums = std::move(checksums), size] (temporary_buffer<char> buf) mutable {
+        if (buf.size() < header_size || read_le<uint32_t>(buf.get()) != checksum_file_magic) {
+            throw std::runtime_error("checksummed_file: bad checksum file header");
+        }
+        size_t bs = read_le<uint32_t>(buf.get() + 4);
+        if (bs == 0 || (bs & (bs - 1)) || bs % data.disk_write_dma_alignment() || bs % data.disk_read_dma_alignment()) {
+            throw std::runtime_error(format("checksummed_file: bad block size {} in the checksum file", bs));
+        }
+        auto n = (buf.size() - header_size) / checksum_size;
+        if ((buf.size() - header_size) % checksum_size || n != align_up(size, uint64_t(bs)) / bs) {
+            throw std::runtime_error("checksummed_file: the checksums don't match the size of the file");
+        }
+        std::vector<uint32_t> crcs(n);
+        for (size_t i = 0; i < n; i++) {
+            crcs[i] = read_le<uint32_t>(buf.get() + header_size + i * checksum_size);
+        }
+        return file(seastar::make_shared<checksummed_file_impl>(std::move(data), std::move(checksums), bs, size, std::move(crcs)));
+    });
+}
+
+}
+
+future<file> make_checksummed_file(file data, file checksums, checksummed_file_options opts) {
+    return data.size().then([data, checksums] (uint64_t size) mutable {
+        return checksums.size().then([size] (uint64_t checksums_size) {
+            return std::make_pair(size, checksums_size);
+        });
+    }).then([data, checksums, opts] (std::pair<uint64_t, uint64_t> sizes) mutable {
+        return open_checksummed(data, checksums, opts, sizes.first, sizes.second);
+    }).handle_exception([data, checksums] (std::exception_ptr ex) mutable {
+        return when_all(data.close(), checksums.close()).then([ex = std::move(ex)] (auto closed) {
+            std::get<0>(closed).ignore_ready_future();
+            std::get<1>(closed).ignore_ready_future();
+            return make_exception_future<file>(std::move(ex));
+        });
+    });
+}
+
+}
@@ -0,0 +1,558 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/compressed_file.hh>
+#include <seastar/core/layered_file.hh>
+#include <seastar/core/align.hh>
+#include <seastar/core/byteorder.hh>
+#include <seastar/core/circular_buffer.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/with_scheduling_group.hh>
+#include <seastar/core/print.hh>
+#include "core/layered_file-impl.hh"
+#include <boost/range/irange.hpp>
+#include <lz4.h>
+#include <zstd.h>
+#include <cstring>
+
+namespace seastar {
+
+namespace {
+
+// The underlying file holds the compressed chunks, each starting at a
+// multiple of the write alignment, followed by the trailer: the index of
+// the chunks and the footer, which ends the file. All chunks but the last
+// one hold chunk_size bytes of data. The trailer goes right after the
+// full chunks, or after the last, partial, one, and is rewritten together
+// with the partial chunk by every flush.
+//
+// Integers are little endian.
+
+constexpr uint64_t compressed_file_magic = 0x3130465a43414553; // "SEACZF01"
+constexpr uint32_t compressed_file_version = 1;
+
+struct chunk_entry {
+    static constexpr size_t serialized_size = 16;
+
+    uint64_t offset;            // in the underlying file
+    uint32_t compressed_size;
+    uint32_t size;
+
+    char* serialize(char* p) const noexcept {
+        write_le(p, offset);
+        write_le(p + 8, compressed_size);
+        write_le(p + 12, size);
+        return p + serialized_size;
+    }
+
+    static chunk_entry deserialize(const char* p) noexcept {
+        return chunk_entry{read_le<uint64_t>(p), read_le<uint32_t>(p + 8), read_le<uint32_t>(p + 12)};
+    }
+};
+
+struct footer {
+    static constexpr size_t serialized_size = 48;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t algorithm;
+    uint64_t chunk_size;
+    uint64_t nr_chunks;         // including the partial one
+    uint64_t size;              // of the data
+    uint64_t data_end;          // where the full chunks end
+
+    void serialize(char* p) const noexcept {
+        write_le(p, magic);
+        write_le(p + 8, version);
+        write_le(p + 12, algorithm);
+        write_le(p + 16, chunk_size);
+        write_le(p + 24, nr_chunks);
+        write_le(p + 32, size);
+        write_le(p + 40, data_end);
+    }
+
+    static footer deserialize(const char* p) noexcept {
+        return footer{read_le<uint64_t>(p), read_le<uint32_t>(p + 8), read_le<uint32_t>(p + 12),
+                read_le<uint64_t>(p + 16), read_le<uint64_t>(p + 24), read_le<uint64_t>(p + 32), read_le<uint64_t>(p + 40)};
+    }
+};
+
+std::runtime_error corrupt(const char* what) {
+    return std::runtime_error(format("compressed_file: {}", what));
+}
+
+size_t compress_bound(compressed_file_algorithm algorithm, size_t size) noexcept {
+    switch (algorithm) {
+    case compressed_file_algorithm::lz4:
+        return LZ4_compressBound(size);
+    case compressed_file_algorithm::zstd:
+        return ZSTD_compressBound(size);
+    }
+    abort();
+}
+
+size_t compress(compressed_file_algorithm algorithm, const char* src, size_t size, char* dst, size_t capacity) {
+    switch (algorithm) {
+    case compressed_file_algorithm::lz4: {
+        auto ret = LZ4_compress_default(src, dst, size, capacity);
+        if (ret <= 0) {
+            throw std::runtime_error("compressed_file: lz4 compression failed");
+        }
+        return ret;
+    }
+    case compressed_file_algorithm::zstd: {
+        // Level 0 is zstd's default level
+        auto ret = ZSTD_compress(dst, capacity, src, size, 0);
+        if (ZSTD_isError(ret)) {
+            throw std::runtime_error(format("compressed_file: zstd compression failed: {}", ZSTD_getErrorName(ret)));
+        }
+        return ret;
+    }
+    }
+    abort();
+}
+
+void decompress(compressed_file_algorithm algorithm, const char* src, size_t compressed_size, char* dst, size_t size) {
+    switch (algorithm) {
+    case compressed_file_algorithm::lz4:
+        if (LZ4_decompress_safe(src, dst, compressed_size, size) != int(size)) {
+            throw corrupt("lz4 decompression failed");
+        }
+        return;
+    case compressed_file_algorithm::zstd: {
+        auto ret = ZSTD_decompress(dst, size, src, compressed_size);
+        if (ZSTD_isError(ret) || ret != size) {
+            throw corrupt("zstd decompression failed");
+        }
+        return;
+    }
+    }
+    abort();
+}
+
+class compressed_file_impl : public internal::range_layered_file_impl {
+    struct compressed_chunk {
+        // Padded to the write alignment with zeroes
+        temporary_buffer<char> buf;
+        uint32_t size;
+    };
+
+    struct cached_chunk {
+        uint64_t idx;
+        shared_future<lw_shared_ptr<temporary_buffer<char>>> data;
+    };
+
+    compressed_file_algorithm _algorithm;
+    size_t _chunk_size;
+    const scheduling_group _sg;
+    const unsigned _read_ahead;
+    // The full chunks
+    std::vector<chunk_entry> _chunks;
+    // Where the next chunk goes in the underlying file
+    uint64_t _data_end = 0;
+    // The data past the full chunks, kept in memory until it fills a chunk
+    temporary_buffer<char> _tail;
+    size_t _tail_size = 0;
+    // Whether the trailer in the underlying file is stale
+    bool _dirty = false;
+    // Serializes writes, truncations and flushes
+    semaphore _write_lock{1};
+    // The recently read chunks, most recent last
+    circular_buffer<cached_chunk> _cache;
+    uint64_t _next_sequential = 0;
+    gate _reads;
+
+    uint64_t tail_start() const noexcept {
+        return _chunks.size() * _chunk_size;
+    }
+
+    uint64_t data_size() const noexcept {
+        return tail_start() + _tail_size;
+    }
+
+    future<compressed_chunk> compress_chunk(const char* data, size_t size) {
+        return with_scheduling_group(_sg, [this, data, size] {
+            auto bound = compress_bound(_algorithm, size);
+            auto buf = temporary_buffer<char>::aligned(_memory_dma_alignment, align_up(bound, size_t(_disk_write_dma_alignment)));
+            auto n = compress(_algorithm, data, size, buf.get_write(), bound);
+            auto padded = align_up(n, size_t(_disk_write_dma_alignment));
+            std::memset(buf.get_write() + n, 0, padded - n);
+            buf.trim(padded);
+            return compressed_chunk{std::move(buf), uint32_t(n)};
+        });
+    }
+
+    future<temporary_buffer<char>> load_chunk(chunk_entry e, const io_priority_class& pc) {
+        return _underlying_file.dma_read_exactly<char>(e.offset, e.compressed_size, pc).then([this, e] (temporary_buffer<char> compressed) {
+            return with_scheduling_group(_sg, [this, e, compressed = std::move(compressed)] {
+                temporary_buffer<char> buf(e.size);
+                decompress(_algorithm, compressed.get(), compressed.size(), buf.get_write(), buf.size());
+                return buf;
+            });
+        });
+    }
+
+    // Concurrent reads of a chunk share its loading, and a few recently
+    // read chunks are kept for the reads to come, read-ahead included
+    future<lw_shared_ptr<temporary_buffer<char>>> read_chunk(uint64_t idx, const io_priority_class& pc) {
+        for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+            if (it->idx == idx) {
+                if (!it->data.failed()) {
+                    return it->data.get_future();
+                }
+                _cache.erase(it, std::next(it));
+                break;
+            }
+        }
+        auto f = try_with_gate(_reads, [this, e = _chunks[idx], &pc] {
+            return load_chunk(e, pc).then([] (temporary_buffer<char> buf) {
+                return make_lw_shared<temporary_buffer<char>>(std::move(buf));
+            });
+        });
+        if (_cache.size() > _read_ahead + 1) {
+            _cache.pop_front();
+        }
+        _cache.push_back(cached_chunk{idx, shared_future<lw_shared_ptr<temporary_buffer<char>>>(std::move(f))});
+        return _cache.back().data.get_future();
+    }
+
+    bool cached(uint64_t idx) const noexcept {
+        return std::any_of(_cache.begin(), _cache.end(), [idx] (const cached_chunk& c) { return c.idx == idx; });
+    }
+
+    void maybe_read_ahead(uint64_t first, uint64_t last, const io_priority_class& pc) {
+        // Reads within the last chunk read are still sequential
+        bool sequential = first == _next_sequential || first + 1 == _next_sequential;
+        _next_sequential = last + 1;
+        if (!sequential) {
+            return;
+        }
+        for (auto idx = last + 1; idx <= last + _read_ahead && idx < _chunks.size(); idx++) {
+            if (!cached(idx)) {
+                (void)read_chunk(idx, pc).discard_result().handle_exception([] (std::exception_ptr) {});
+            }
+        }
+    }
+
+    virtual future<size_t> read_range(uint64_t pos, char* dst, size_t len, const io_priority_class& pc) override {
+        auto size = data_size();
+        if (pos >= size || !len) {
+            return make_ready_future<size_t>(0);
+        }
+        len = std::min<uint64_t>(len, size - pos);
+        auto ts = tail_start();
+        if (pos + len > ts) {
+            auto from = std::max(pos, ts);
+            std::memcpy(dst + (from - pos), _tail.get() + (from - ts), pos + len - from);
+        }
+        if (pos >= ts) {
+            return make_ready_future<size_t>(len);
+        }
+        auto first = pos / _chunk_size;
+        auto last = (std::min(pos + len, ts) - 1) / _chunk_size;
+        maybe_read_ahead(first, last, pc);
+        return parallel_for_each(boost::irange(first, last + 1), [this, pos, dst, len, &pc] (uint64_t idx) {
+            return read_chunk(idx, pc).then([this, pos, dst, len, idx] (lw_shared_ptr<temporary_buffer<char>> buf) {
+                auto chunk_pos = idx * _chunk_size;
+                auto from = std::max(pos, chunk_pos);
+                auto to = std::min(pos + len, chunk_pos + buf->size());
+                std::memcpy(dst + (from - pos), buf->get() + (from - chunk_pos), to - from);
+            });
+        }).then([len] {
+            return len;
+        });
+    }
+
+    // Writes out the tail, which is full, as the next chunk
+    future<> write_tail_chunk(const io_priority_class& pc) {
+        return compress_chunk(_tail.get(), _chunk_size).then([this, &pc] (compressed_chunk c) {
+            auto len = c.buf.size();
+            auto f = _underlying_file.dma_write(_data_end, c.buf.get(), len, pc);
+            return f.then([this, c = std::move(c), len] (size_t written) {
+                if (written != len) {
+                    throw std::runtime_error("compressed_file: short write");
+                }
+                _chunks.push_back(chunk_entry{_data_end, c.size, uint32_t(_chunk_size)});
+                _data_end += len;
+                _tail_size = 0;
+            });
+        });
+    }
+
+    future<size_t> append(uint64_t pos, const char* data, size_t len, const io_priority_class& pc) {
+        if (pos < tail_start() || pos > data_size()) {
+            return make_exception_future<size_t>(std::system_error(EINVAL, std::system_category(),
+                    "compressed_file: writes have to be past the last full chunk and not past the end of the file"));
+        }
+        return do_with(size_t(0), [this, pos, data, len, &pc] (size_t& done) {
+            return repeat([this, pos, data, len, &pc, &done] {
+                if (done == len) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto off = pos + done - tail_start();
+                auto n = std::min(len - done, _chunk_size - off);
+                std::memcpy(_tail.get_write() + off, data + done, n);
+                _tail_size = std::max(_tail_size, off + n);
+                _dirty = true;
+                done += n;
+                if (_tail_size < _chunk_size) {
+                    return make_ready_future<stop_iteration>(stop_iteration::no);
+                }
+                return write_tail_chunk(pc).then([] {
+                    return stop_iteration::no;
+                });
+            }).then([len] {
+                return len;
+            });
+        });
+    }
+
+    future<> extend(uint64_t length) {
+        return repeat([this, length] {
+            auto size = data_size();
+            if (size >= length) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto n = std::min<uint64_t>(length - size, _chunk_size - _tail_size);
+            std::memset(_tail.get_write() + _tail_size, 0, n);
+            _tail_size += n;
+            _dirty = true;
+            if (_tail_size < _chunk_size) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return write_tail_chunk(default_priority_class()).then([] {
+                return stop_iteration::no;
+            });
+        });
+    }
+
+    future<> shrink(uint64_t length) {
+        _dirty = true;
+        if (length >= tail_start()) {
+            _tail_size = length - tail_start();
+            return make_ready_future<>();
+        }
+        // The chunk the file now ends in becomes the tail again
+        auto idx = length / _chunk_size;
+        auto keep = length % _chunk_size;
+        auto e = _chunks[idx];
+        auto f = keep ? load_chunk(e, default_priority_class()) : make_ready_future<temporary_buffer<char>>();
+        return f.then([this, idx, keep, e] (temporary_buffer<char> buf) {
+            std::memcpy(_tail.get_write(), buf.get(), keep);
+            _tail_size = keep;
+            _chunks.resize(idx);
+            _data_end = e.offset;
+            _cache.erase(std::remove_if(_cache.begin(), _cache.end(), [idx] (const cached_chunk& c) { return c.idx >= idx; }), _cache.end());
+        });
+    }
+
+    // Writes the partial chunk, if any, and the trailer after the full chunks
+    future<> write_trailer() {
+        if (!_dirty) {
+            return make_ready_future<>();
+        }
+        auto f = _tail_size
+                ? compress_chunk(_tail.get(), _tail_size).then([] (compressed_chunk c) { return std::optional<compressed_chunk>(std::move(c)); })
+                : make_ready_future<std::optional<compressed_chunk>>();
+        return f.then([this] (std::optional<compressed_chunk> tail) {
+            auto nr_chunks = _chunks.size() + bool(tail);
+            auto trailer_size = nr_chunks * chunk_entry::serialized_size + footer::serialized_size;
+            auto tail_len = tail ? tail->buf.size() : 0;
+            auto len = tail_len + align_up(trailer_size, size_t(_disk_write_dma_alignment));
+            auto buf = temporary_buffer<char>::aligned(_memory_dma_alignment, len);
+            std::memset(buf.get_write(), 0, len);
+            if (tail) {
+                std::memcpy(buf.get_write(), tail->buf.get(), tail_len);
+            }
+            auto p = buf.get_write() + len - trailer_size;
+            for (auto& e : _chunks) {
+                p = e.serialize(p);
+            }
+            if (tail) {
+                p = chunk_entry{_data_end, tail->size, uint32_t(_tail_size)}.serialize(p);
+            }
+            footer{compressed_file_magic, compressed_file_version, uint32_t(_algorithm), _chunk_size, nr_chunks, data_size(), _data_end}.serialize(p);
+            auto end = _data_end + len;
+            auto f = _underlying_file.dma_write(_data_end, buf.get(), len);
+            return f.then([this, buf = std::move(buf), len, end] (size_t written) {
+                if (written != len) {
+                    throw std::runtime_error("compressed_file: short write");
+                }
+                // Drop what earlier flushes wrote past the trailer
+                return _underlying_file.truncate(end);
+            }).then([this] {
+                _dirty = false;
+            });
+        });
+    }
+
+public:
+    compressed_file_impl(file f, const compressed_file_options& opts)
+        : range_layered_file_impl(std::move(f))
+        , _algorithm(opts.algorithm)
+        , _chunk_size(opts.chunk_size)
+        , _sg(opts.compression_scheduling_group)
+        , _read_ahead(opts.read_ahead)
+        , _tail(_chunk_size)
+    {
+    }
+
+    // Reads the index of a file of the given size
+    future<> load(uint64_t size) {
+        if (size < footer::serialized_size) {
+            return make_exception_future<>(corrupt("file too short"));
+        }
+        return _underlying_file.dma_read_exactly<char>(size - footer::serialized_size, footer::serialized_size).then([this, size] (temporary_buffer<char> buf) {
+            auto ft = footer::deserialize(buf.get());
+            if (ft.magic != compressed_file_magic) {
+                throw corrupt("bad magic");
+            }
+            if (ft.version != compressed_file_version) {
+                throw corrupt("unsupported version");
+            }
+            if (ft.algorithm > uint32_t(compressed_file_algorithm::zstd)) {
+                throw corrupt("unknown compression algorithm");
+            }
+            if (ft.chunk_size == 0 || ft.nr_chunks != align_up(ft.size, ft.chunk_size) / ft.chunk_size) {
+                throw corrupt("inconsistent footer");
+            }
+            auto index_size = ft.nr_chunks * chunk_entry::serialized_size;
+            if (index_size > size - footer::serialized_size) {
+                throw corrupt("index past the start of the file");
+            }
+            _algorithm = compressed_file_algorithm(ft.algorithm);
+            if (_chunk_size != ft.chunk_size) {
+                _chunk_size = ft.chunk_size;
+                _tail = temporary_buffer<char>(_chunk_size);
+            }
+            auto f = index_size
+                    ? _underlying_file.dma_read_exactly<char>(size - footer::serialized_size - index_size, index_size)
+                    : make_ready_future<temporary_buffer<char>>();
+            return f.then([this, ft] (temporary_buffer<char> index) {
+                _chunks.reserve(ft.nr_chunks);
+                for (uint64_t i = 0; i < ft.nr_chunks; i++) {
+                    _chunks.push_back(chunk_entry::deserialize(index.get() + i * chunk_entry::serialized_size));
+                }
+                _data_end = ft.data_end;
+                auto partial = ft.size % _chunk_size;
+                if (!partial) {
+                    return make_ready_future<>();
+                }
+                auto e = _chunks.back();
+                _chunks.pop_back();
+                if (e.size != partial) {
+                    return make_exception_future<>(corrupt("inconsistent index"));
+                }
+                return load_chunk(e, default_priority_class()).then([this] (temporary_buffer<char> buf) {
+                    std::memcpy(_tail.get_write(), buf.get(), buf.size());
+                    _tail_size = buf.size();
+                });
+            });
+        });
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        return with_semaphore(_write_lock, 1, [this, pos, buffer, len, &pc] {
+            return append(pos, static_cast<const char*>(buffer), len, pc);
+        });
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        return with_semaphore(_write_lock, 1, [this, pos, iov = std::move(iov), &pc] () mutable {
+            return do_with(std::move(iov), size_t(0), size_t(0), [this, pos, &pc] (std::vector<iovec>& iov, size_t& i, size_t& total) {
+                return repeat([this, pos, &pc, &iov, &i, &total] {
+                    if (i == iov.size()) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    auto& v = iov[i++];
+                    return append(pos + total, static_cast<const char*>(v.iov_base), v.iov_len, pc).then([&total] (size_t n) {
+                        total += n;
+                        return stop_iteration::no;
+                    });
+                }).then([&total] {
+                    return total;
+                });
+            });
+        });
+    }
+    virtual future<> flush() override {
+        return with_semaphore(_write_lock, 1, [this] {
+            return write_trailer();
+        }).then([this] {
+            return _underlying_file.flush();
+        });
+    }
+    virtual future<struct stat> stat() override {
+        return _underlying_file.stat().then([this] (struct stat st) {
+            st.st_size = data_size();
+            return st;
+        });
+    }
+    virtual future<> truncate(uint64_t length) override {
+        return with_semaphore(_write_lock, 1, [this, length] {
+            return length >= data_size() ? extend(length) : shrink(length);
+        });
+    }
+    // How much the data takes once compressed isn't known ahead
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return make_ready_future<>();
+    }
+    virtual future<uint64_t> size() override {
+        return make_ready_future<uint64_t>(data_size());
+    }
+    virtual future<> close() override {
+        return _reads.close().then([this] {
+            return with_semaphore(_write_lock, 1, [this] {
+                return write_trailer();
+            });
+        }).then_wrapped([this] (future<> f) {
+            return _underlying_file.close().then([f = std::move(f)] () mutable {
+                return std::move(f);
+            });
+        });
+    }
+};
+
+}
+
+future<file> make_compressed_file(file f, compressed_file_options opts) {
+    return f.size().then([f, opts] (uint64_t size) mutable {
+        auto impl = make_shared<compressed_file_impl>(std::move(f), opts);
+        if (size == 0) {
+            return make_ready_future<file>(file(impl));
+        }
+        return impl->load(size).then_wrapped([impl] (future<> fut) {
+            if (fut.failed()) {
+                auto ex = fut.get_exception();
+                return impl->underlying_file().close().then_wrapped([ex = std::move(ex)] (future<> f) {
+                    f.ignore_ready_future();
+                    return make_exception_future<file>(std::move(ex));
+                });
+            }
+            return make_ready_future<file>(file(impl));
+        });
+    });
+}
+
+}
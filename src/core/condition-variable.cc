@@ -20,6 +20,7 @@
  */
 
 #include <seastar/core/condition-variable.hh>
+#include <seastar/core/preempt.hh>
 
 namespace seastar {
 
@@ -31,16 +32,34 @@ const char* condition_variable_timed_out::what() const noexcept {
     return "Condition variable timed out";
 }
 
+condition_variable::condition_variable(condition_variable&& rhs) noexcept
+        : _waiters(std::move(rhs._waiters))
+        , _waking(std::move(rhs._waking))
+        , _ex(std::move(rhs._ex))
+        , _signalled(std::exchange(rhs._signalled, false)) {
+    // Moving cancelled rhs's wakeup task, take over the rest of its broadcast
+    rhs._wakeup.cancel();
+    if (!_waking.empty()) {
+        wake_waking(true);
+    }
+}
+
 condition_variable::~condition_variable() {
     broken();
 }
 
 void condition_variable::add_waiter(waiter& w) noexcept {
-    assert(!_signalled); // should not have snuck between
     if (_ex) {
         w.set_exception(_ex);
         return;
     }
+    // Only a waiter whose predicate failed when a deferred part of a
+    // broadcast() woke it can come back after a signal() found no one to
+    // wake, let it have that signal
+    if (check_and_consume_signal()) {
+        w.signal();
+        return;
+    }
     _waiters.push_back(w);
 }
 
@@ -73,17 +92,47 @@ void condition_variable::signal() noexcept {
     }
 }
 
+void condition_variable::wake_waking(bool from_broadcast) noexcept {
+    // As in basic_semaphore::wake_waiters(), the first batch is woken
+    // right away, and the rest by a task if called from broadcast(), since
+    // its caller may not reach a preemption point until the task quota
+    // runs out. Waiters are resumed by signal() without allocating: a
+    // coroutine's awaiter is the task that resumes it.
+    while (!_waking.empty()) {
+        for (unsigned i = 0; i < wakeup_batch && !_waking.empty(); i++) {
+            auto& w = _waking.front();
+            _waking.pop_front();
+            w.signal();
+        }
+        if (!_waking.empty() && (from_broadcast || need_preempt())
+                && (_wakeup.pending() || _wakeup.schedule(continue_wakeup, this))) {
+            return;
+        }
+    }
+}
+
+void condition_variable::continue_wakeup(void* cv) noexcept {
+    auto& c = *static_cast<condition_variable*>(cv);
+    c._wakeup.done();
+    c.wake_waking(false);
+}
+
 /// Notify variable and wake up all waiter
 void condition_variable::broadcast() noexcept {
-    auto tmp(std::move(_waiters));
-    while (!tmp.empty()) {
-        auto& w = tmp.front();
-        tmp.pop_front();
-        if (_ex) {
+    if (_ex) {
+        // Broken: fail everyone now, the variable may be going away
+        _wakeup.cancel();
+        _waking.splice(_waking.end(), _waiters);
+        while (!_waking.empty()) {
+            auto& w = _waking.front();
+            _waking.pop_front();
             w.set_exception(_ex);
-        } else {
-            w.signal();
         }
+        return;
+    }
+    _waking.splice(_waking.end(), _waiters);
+    if (!_wakeup.pending()) {
+        wake_waking(true);
     }
 }
 
@@ -0,0 +1,169 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/dma_buffer_pool.hh>
+#include <seastar/core/bitops.hh>
+#include <seastar/core/memory.hh>
+#include <array>
+#include <cstdlib>
+#include <utility>
+
+namespace seastar {
+
+namespace {
+
+// The pool's buffers are page aligned, which covers the memory alignment
+// of files
+constexpr size_t pool_alignment = 4096;
+constexpr unsigned min_class_shift = 12;
+constexpr unsigned max_class_shift = 20;
+constexpr unsigned nr_classes = max_class_shift - min_class_shift + 1;
+
+void* aligned_alloc_or_throw(size_t alignment, size_t size) {
+    void* p = nullptr;
+    if (::posix_memalign(&p, alignment, size)) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+class dma_buffer_pool;
+
+// Set while the pool of the thread is alive; buffers freed on other
+// threads, or after the pool is gone, go back to the allocator
+thread_local dma_buffer_pool* local_pool_ptr = nullptr;
+
+class dma_buffer_pool {
+    // The free buffers of each class, linked through their first bytes
+    struct free_buffer {
+        free_buffer* next;
+    };
+
+    std::array<free_buffer*, nr_classes> _free{};
+    size_t _capacity = 8 << 20;
+    dma_buffer_pool_stats _stats;
+    memory::reclaimer _reclaimer;
+
+    static size_t class_size(unsigned cls) noexcept {
+        return size_t(1) << (cls + min_class_shift);
+    }
+
+    void release(void* p, unsigned cls) noexcept {
+        auto size = class_size(cls);
+        if (_stats.cached_bytes + size > _capacity) {
+            ::free(p);
+            _stats.evictions++;
+            return;
+        }
+        _free[cls] = new (p) free_buffer{_free[cls]};
+        _stats.cached_bytes += size;
+    }
+
+    size_t evict(size_t bytes) noexcept {
+        size_t freed = 0;
+        // Largest first, they are the fewest for the bytes
+        for (unsigned cls = nr_classes; cls-- > 0 && freed < bytes; ) {
+            while (_free[cls] && freed < bytes) {
+                ::free(std::exchange(_free[cls], _free[cls]->next));
+                freed += class_size(cls);
+                _stats.evictions++;
+            }
+        }
+        _stats.cached_bytes -= freed;
+        return freed;
+    }
+public:
+    dma_buffer_pool()
+        : _reclaimer([this] (memory::reclaimer::request r) {
+            return evict(r.bytes_to_reclaim) ? memory::reclaiming_result::reclaimed_something : memory::reclaiming_result::reclaimed_nothing;
+        }, memory::reclaimer_scope::sync)
+    {
+        local_pool_ptr = this;
+    }
+    ~dma_buffer_pool() {
+        local_pool_ptr = nullptr;
+        evict(_stats.cached_bytes);
+    }
+
+    temporary_buffer<char> allocate(size_t alignment, size_t size) {
+        if (alignment > pool_alignment || size > class_size(nr_classes - 1) || !_capacity) {
+            _stats.bypasses++;
+            auto p = static_cast<char*>(aligned_alloc_or_throw(std::max(alignment, sizeof(void*)), size));
+            return temporary_buffer<char>(p, size, make_free_deleter(p));
+        }
+        unsigned cls = std::max(log2ceil(std::max(size, size_t(1))), min_class_shift) - min_class_shift;
+        void* p;
+        if (_free[cls]) {
+            p = std::exchange(_free[cls], _free[cls]->next);
+            _stats.cached_bytes -= class_size(cls);
+            _stats.hits++;
+        } else {
+            p = aligned_alloc_or_throw(pool_alignment, class_size(cls));
+            _stats.misses++;
+        }
+        deleter d;
+        try {
+            d = make_deleter([this, p, cls] {
+                if (local_pool_ptr == this) {
+                    release(p, cls);
+                } else {
+                    ::free(p);
+                }
+            });
+        } catch (...) {
+            release(p, cls);
+            throw;
+        }
+        return temporary_buffer<char>(static_cast<char*>(p), size, std::move(d));
+    }
+
+    const dma_buffer_pool_stats& stats() const noexcept {
+        return _stats;
+    }
+
+    void set_capacity(size_t capacity) noexcept {
+        _capacity = capacity;
+        if (_stats.cached_bytes > _capacity) {
+            evict(_stats.cached_bytes - _capacity);
+        }
+    }
+};
+
+dma_buffer_pool& local_pool() {
+    static thread_local dma_buffer_pool pool;
+    return pool;
+}
+
+}
+
+temporary_buffer<char> allocate_dma_buffer(size_t alignment, size_t size) {
+    return local_pool().allocate(alignment, size);
+}
+
+dma_buffer_pool_stats get_dma_buffer_pool_stats() noexcept {
+    return local_pool_ptr ? local_pool_ptr->stats() : dma_buffer_pool_stats{};
+}
+
+void set_dma_buffer_pool_capacity(size_t capacity) noexcept {
+    local_pool().set_capacity(capacity);
+}
+
+}
@@ -0,0 +1,451 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/encrypted_file.hh>
+#include <seastar/core/layered_file.hh>
+#include <seastar/core/align.hh>
+#include <seastar/core/byteorder.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/when_all.hh>
+#include <seastar/core/print.hh>
+#include "core/layered_file-impl.hh"
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <array>
+#include <cstring>
+#include <limits>
+
+namespace seastar {
+
+namespace {
+
+// The header, at the start of the first block of the file
+constexpr char header_magic[8] = {'S', 'E', 'A', 'E', 'N', 'C', '0', '1'};
+constexpr size_t key_check_size = 32;
+constexpr size_t header_size = sizeof(header_magic) + 4 + 4 + 8 + key_check_size;
+
+using key_check = std::array<char, key_check_size>;
+
+struct header {
+    encrypted_file_cipher cipher;
+    size_t block_size;
+    uint64_t size;
+    key_check check;
+};
+
+std::runtime_error corrupt(const char* what) {
+    return std::runtime_error(format("encrypted_file: not a valid encrypted file: {}", what));
+}
+
+// Blocks never written are holes, or zeroes past the end of a truncated
+// block, which no encryption of any data is likely to be
+bool all_zeroes(const char* p, size_t len) noexcept {
+    return !len || (!p[0] && !std::memcmp(p, p + 1, len - 1));
+}
+
+void check_block_size(const file& f, size_t bs) {
+    if (bs == 0 || (bs & (bs - 1)) || bs % f.disk_write_dma_alignment() || bs % f.disk_read_dma_alignment() || bs < header_size) {
+        throw std::invalid_argument(format("encrypted_file: bad block size {}", bs));
+    }
+}
+
+class xts_cipher {
+    gnutls_cipher_hd_t _hd = nullptr;
+    const size_t _block_size;
+
+    static void check(int res, const char* what) {
+        if (res < 0) {
+            throw std::runtime_error(format("encrypted_file: {}: {}", what, gnutls_strerror(res)));
+        }
+    }
+
+    void set_tweak(uint64_t block) noexcept {
+        std::array<char, 16> iv{};
+        write_le<uint64_t>(iv.data(), block);
+        gnutls_cipher_set_iv(_hd, iv.data(), iv.size());
+    }
+public:
+    xts_cipher(encrypted_file_cipher cipher, const std::vector<uint8_t>& key, size_t block_size)
+        : _block_size(block_size)
+    {
+        auto algorithm = cipher == encrypted_file_cipher::aes_128_xts ? GNUTLS_CIPHER_AES_128_XTS : GNUTLS_CIPHER_AES_256_XTS;
+        if (key.size() != gnutls_cipher_get_key_size(algorithm)) {
+            throw std::invalid_argument(format("encrypted_file: the key has {} bytes instead of {}", key.size(), gnutls_cipher_get_key_size(algorithm)));
+        }
+        gnutls_datum_t k{const_cast<unsigned char*>(key.data()), unsigned(key.size())};
+        check(gnutls_cipher_init(&_hd, algorithm, &k, nullptr), "cannot set up the cipher");
+    }
+    xts_cipher(const xts_cipher&) = delete;
+    ~xts_cipher() {
+        gnutls_cipher_deinit(_hd);
+    }
+
+    // Encrypts whole blocks in place, the first of them being block idx
+    void encrypt(uint64_t idx, char* buf, size_t len) {
+        for (size_t off = 0; off < len; off += _block_size) {
+            set_tweak(idx++);
+            check(gnutls_cipher_encrypt(_hd, buf + off, _block_size), "encryption failed");
+        }
+    }
+
+    // Decrypts whole blocks in place, the first of them being block idx
+    void decrypt(uint64_t idx, char* buf, size_t len) {
+        for (size_t off = 0; off < len; off += _block_size, idx++) {
+            if (all_zeroes(buf + off, _block_size)) {
+                continue;
+            }
+            set_tweak(idx);
+            check(gnutls_cipher_decrypt(_hd, buf + off, _block_size), "decryption failed");
+        }
+    }
+};
+
+// How much of len bytes, in pieces of piece bytes, the I/O of the pieces
+// got through, up to the first that fell short
+size_t completed(std::vector<future<size_t>> results, size_t len, size_t piece) {
+    size_t total = 0;
+    bool complete = true;
+    std::exception_ptr ex;
+    for (auto& r : results) {
+        if (r.failed()) {
+            auto e = r.get_exception();
+            if (complete) {
+                ex = std::move(e);
+                complete = false;
+            }
+            continue;
+        }
+        auto n = r.get0();
+        if (complete) {
+            auto expected = std::min(piece, len - total);
+            total += n;
+            complete = n == expected;
+        }
+    }
+    if (ex && !total) {
+        std::rethrow_exception(std::move(ex));
+    }
+    return total;
+}
+
+class encrypted_file_impl : public internal::range_layered_file_impl {
+    const encrypted_file_cipher _cipher_kind;
+    const size_t _block_size;
+    const size_t _pipeline_size;
+    xts_cipher _cipher;
+    uint64_t _size;
+    // Whether the size in the header is stale
+    bool _dirty;
+
+    // Where the data at pos is in the underlying file, past the header
+    uint64_t data_pos(uint64_t pos) const noexcept {
+        return _block_size + pos;
+    }
+
+    bool aligned(uint64_t pos, size_t len) const noexcept {
+        return pos % _block_size == 0 && len % _block_size == 0;
+    }
+
+    static future<size_t> unaligned() {
+        return make_exception_future<size_t>(std::system_error(EINVAL, std::system_category(),
+                "encrypted_file: I/O has to be of whole blocks"));
+    }
+
+    // Encrypts the data in iov, of len bytes, a piece at a time, and
+    // writes each piece while the next ones are encrypted. The loop can be
+    // preempted between pieces.
+    future<size_t> encrypted_write(uint64_t pos, std::vector<iovec> iov, size_t len, const io_priority_class& pc) {
+        struct write_state {
+            std::vector<iovec> iov;
+            size_t i = 0;
+            size_t iov_off = 0;
+            size_t done = 0;
+            std::vector<future<size_t>> writes;
+        };
+        return do_with(write_state{std::move(iov)}, [this, pos, len, &pc] (write_state& s) {
+            return repeat([this, pos, len, &pc, &s] {
+                if (s.done == len) {
+                    return stop_iteration::yes;
+                }
+                auto n = std::min(_pipeline_size, len - s.done);
+                auto buf = temporary_buffer<char>::aligned(_memory_dma_alignment, n);
+                for (size_t copied = 0; copied < n; ) {
+                    auto& v = s.iov[s.i];
+                    auto c = std::min(n - copied, v.iov_len - s.iov_off);
+                    std::memcpy(buf.get_write() + copied, static_cast<const char*>(v.iov_base) + s.iov_off, c);
+                    copied += c;
+                    s.iov_off += c;
+                    if (s.iov_off == v.iov_len) {
+                        s.i++;
+                        s.iov_off = 0;
+                    }
+                }
+                auto off = pos + s.done;
+                _cipher.encrypt(off / _block_size, buf.get_write(), n);
+                auto f = _underlying_file.dma_write(data_pos(off), buf.get(), n, pc);
+                s.writes.push_back(f.finally([buf = std::move(buf)] {}));
+                s.done += n;
+                return stop_iteration::no;
+            }).then_wrapped([this, pos, len, &s] (future<> f) {
+                // Whatever happened, the pieces in flight still use s
+                return when_all(s.writes.begin(), s.writes.end()).then([this, pos, len, f = std::move(f)] (std::vector<future<size_t>> results) mutable {
+                    if (f.failed()) {
+                        for (auto& r : results) {
+                            r.ignore_ready_future();
+                        }
+                        return make_exception_future<size_t>(f.get_exception());
+                    }
+                    auto written = completed(std::move(results), len, _pipeline_size);
+                    _size = std::max(_size, pos + written);
+                    _dirty = true;
+                    return make_ready_future<size_t>(written);
+                });
+            });
+        });
+    }
+
+    // Reads whole blocks a piece at a time, all pieces at once, and
+    // decrypts each as soon as it is read
+    future<size_t> encrypted_read(uint64_t pos, char* dst, size_t len, const io_priority_class& pc) {
+        if (pos >= _size) {
+            return make_ready_future<size_t>(0);
+        }
+        len = std::min<uint64_t>(len, align_up(_size - pos, uint64_t(_block_size)));
+        std::vector<future<size_t>> reads;
+        reads.reserve(align_up(len, _pipeline_size) / _pipeline_size);
+        for (size_t off = 0; off < len; off += _pipeline_size) {
+            auto n = std::min(_pipeline_size, len - off);
+            auto f = _underlying_file.dma_read(data_pos(pos + off), dst + off, n, pc);
+            reads.push_back(f.then([this, idx = (pos + off) / _block_size, buf = dst + off] (size_t read) {
+                auto whole = align_down(read, _block_size);
+                _cipher.decrypt(idx, buf, whole);
+                return whole;
+            }));
+        }
+        return when_all(reads.begin(), reads.end()).then([this, pos, len] (std::vector<future<size_t>> results) {
+            auto read = completed(std::move(results), len, _pipeline_size);
+            return std::min<uint64_t>(read, _size - pos);
+        });
+    }
+
+    virtual future<size_t> read_range(uint64_t pos, char* dst, size_t len, const io_priority_class& pc) override {
+        if (!aligned(pos, len)) {
+            return unaligned();
+        }
+        return encrypted_read(pos, dst, len, pc);
+    }
+
+    // Zeroes the block holding pos from pos on, so that what was past the
+    // end of the file reads as zeroes once it grows again
+    future<> zero_tail(uint64_t pos) {
+        auto start = align_down(pos, uint64_t(_block_size));
+        auto buf = temporary_buffer<char>::aligned(_memory_dma_alignment, _block_size);
+        auto dst = buf.get_write();
+        auto f = _underlying_file.dma_read(data_pos(start), dst, _block_size);
+        return f.then([this, pos, start, buf = std::move(buf)] (size_t read) mutable {
+            if (read != _block_size) {
+                throw std::runtime_error("encrypted_file: short read of a block");
+            }
+            auto dst = buf.get_write();
+            _cipher.decrypt(start / _block_size, dst, _block_size);
+            std::memset(dst + (pos - start), 0, _block_size - (pos - start));
+            _cipher.encrypt(start / _block_size, dst, _block_size);
+            auto f = _underlying_file.dma_write(data_pos(start), buf.get(), _block_size);
+            return f.then([this, buf = std::move(buf)] (size_t written) {
+                if (written != _block_size) {
+                    throw std::runtime_error("encrypted_file: short write of a block");
+                }
+            });
+        });
+    }
+
+    key_check compute_key_check() {
+        auto buf = std::make_unique<char[]>(_block_size);
+        std::memset(buf.get(), 0, _block_size);
+        // A tweak no block of data gets
+        _cipher.encrypt(std::numeric_limits<uint64_t>::max(), buf.get(), _block_size);
+        key_check ret;
+        std::copy_n(buf.get(), ret.size(), ret.begin());
+        return ret;
+    }
+
+    future<> write_header() {
+        if (!_dirty) {
+            return make_ready_future<>();
+        }
+        auto buf = temporary_buffer<char>::aligned(_memory_dma_alignment, _block_size);
+        auto p = buf.get_write();
+        std::memset(p, 0, _block_size);
+        std::copy_n(header_magic, sizeof(header_magic), p);
+        p += sizeof(header_magic);
+        write_le(p, uint32_t(_cipher_kind));
+        write_le(p + 4, uint32_t(_block_size));
+        write_le(p + 8, _size);
+        auto check = compute_key_check();
+        std::copy(check.begin(), check.end(), p + 16);
+        // Changes from here on need another write
+        _dirty = false;
+        auto f = _underlying_file.dma_write(0, buf.get(), _block_size);
+        return f.then_wrapped([this, buf = std::move(buf)] (future<size_t> f) {
+            if (f.failed() || f.get0() != _block_size) {
+                _dirty = true;
+                if (f.failed()) {
+                    return make_exception_future<>(f.get_exception());
+                }
+                return make_exception_future<>(std::runtime_error("encrypted_file: short write of the header"));
+            }
+            return make_ready_future<>();
+        });
+    }
+
+public:
+    encrypted_file_impl(file f, const std::vector<uint8_t>& key, encrypted_file_cipher cipher, size_t block_size,
+            size_t pipeline_size, uint64_t size, bool is_new)
+        : range_layered_file_impl(std::move(f))
+        , _cipher_kind(cipher)
+        , _block_size(block_size)
+        , _pipeline_size(align_up(std::max(pipeline_size, block_size), block_size))
+        , _cipher(cipher, key, block_size)
+        , _size(size)
+        , _dirty(is_new)
+    {
+        _disk_read_dma_alignment = _block_size;
+        _disk_write_dma_alignment = _block_size;
+        _disk_overwrite_dma_alignment = _block_size;
+    }
+
+    bool key_matches(const key_check& check) {
+        return compute_key_check() == check;
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        if (!aligned(pos, len)) {
+            return unaligned();
+        }
+        return encrypted_write(pos, {iovec{const_cast<void*>(buffer), len}}, len, pc);
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto& v : iov) {
+            len += v.iov_len;
+        }
+        if (!aligned(pos, len)) {
+            return unaligned();
+        }
+        return encrypted_write(pos, std::move(iov), len, pc);
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        auto front = offset % _block_size;
+        auto len = align_up(front + range_size, _block_size);
+        auto buf = temporary_buffer<uint8_t>::aligned(_memory_dma_alignment, len);
+        auto dst = reinterpret_cast<char*>(buf.get_write());
+        return encrypted_read(offset - front, dst, len, pc).then([buf = std::move(buf), front, range_size] (size_t n) mutable {
+            if (n <= front) {
+                return temporary_buffer<uint8_t>();
+            }
+            buf.trim(std::min(n, front + range_size));
+            buf.trim_front(front);
+            return std::move(buf);
+        });
+    }
+    virtual future<> flush() override {
+        return write_header().then([this] {
+            return _underlying_file.flush();
+        });
+    }
+    virtual future<struct stat> stat() override {
+        return _underlying_file.stat().then([this] (struct stat st) {
+            st.st_size = _size;
+            return st;
+        });
+    }
+    virtual future<> truncate(uint64_t length) override {
+        auto old_size = std::exchange(_size, length);
+        _dirty = true;
+        auto f = _underlying_file.truncate(data_pos(align_up(length, uint64_t(_block_size))));
+        auto edge = std::min(old_size, length);
+        if (length == old_size || edge % _block_size == 0) {
+            return f;
+        }
+        return f.then([this, edge] {
+            return zero_tail(edge);
+        });
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return _underlying_file.allocate(data_pos(position), length);
+    }
+    virtual future<uint64_t> size() override {
+        return make_ready_future<uint64_t>(_size);
+    }
+    virtual future<> close() override {
+        return write_header().then_wrapped([this] (future<> f) {
+            return _underlying_file.close().then([f = std::move(f)] () mutable {
+                return std::move(f);
+            });
+        });
+    }
+};
+
+header parse_header(const temporary_buffer<char>& buf) {
+    if (buf.size() < header_size || !std::equal(header_magic, header_magic + sizeof(header_magic), buf.get())) {
+        throw corrupt("bad header");
+    }
+    auto p = buf.get() + sizeof(header_magic);
+    header h;
+    auto cipher = read_le<uint32_t>(p);
+    if (cipher > uint32_t(encrypted_file_cipher::aes_256_xts)) {
+        throw corrupt("unknown cipher");
+    }
+    h.cipher = encrypted_file_cipher(cipher);
+    h.block_size = read_le<uint32_t>(p + 4);
+    h.size = read_le<uint64_t>(p + 8);
+    std::copy_n(p + 16, h.check.size(), h.check.begin());
+    return h;
+}
+
+}
+
+future<file> make_encrypted_file(file f, std::vector<uint8_t> key, encrypted_file_options opts) {
+    return f.size().then([f, key = std::move(key), opts] (uint64_t size) mutable {
+        if (size == 0) {
+            check_block_size(f, opts.block_size);
+            auto impl = seastar::make_shared<encrypted_file_impl>(f, key, opts.cipher, opts.block_size, opts.pipeline_size, 0, true);
+            return make_ready_future<file>(file(std::move(impl)));
+        }
+        return f.dma_read_bulk<char>(0, header_size).then([f, key = std::move(key), opts] (temporary_buffer<char> buf) {
+            auto h = parse_header(buf);
+            check_block_size(f, h.block_size);
+            auto impl = seastar::make_shared<encrypted_file_impl>(f, key, h.cipher, h.block_size, opts.pipeline_size, h.size, false);
+            if (!impl->key_matches(h.check)) {
+                throw std::runtime_error("encrypted_file: wrong key");
+            }
+            return file(std::move(impl));
+        });
+    }).handle_exception([f] (std::exception_ptr ex) mutable {
+        return f.close().then_wrapped([ex = std::move(ex)] (future<> closed) {
+            closed.ignore_ready_future();
+            return make_exception_future<file>(std::move(ex));
+        });
+    });
+}
+
+}
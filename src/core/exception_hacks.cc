@@ -55,6 +55,7 @@
 #include <link.h>
 #include <dlfcn.h>
 #include <assert.h>
+#include <cxxabi.h>
 #include <vector>
 #include <cstddef>
 #include <seastar/core/exception_hacks.hh>
@@ -90,6 +91,38 @@ void init_phdr_cache() {
     }, nullptr);
 }
 
+const std::type_info* exception_ptr_type(const std::exception_ptr& eptr) noexcept {
+    if (!eptr) {
+        return nullptr;
+    }
+#ifdef __GLIBCXX__
+    return eptr.__cxa_exception_type();
+#else
+    try {
+        std::rethrow_exception(eptr);
+    } catch (...) {
+        return abi::__cxa_current_exception_type();
+    }
+#endif
+}
+
+void* internal::try_catch_dynamic(const std::exception_ptr& eptr, const std::type_info& catch_type) noexcept {
+#ifdef __GLIBCXX__
+    // libstdc++'s exception_ptr is just a pointer to the thrown object,
+    // and a catch clause matches it with type_info::__do_catch(), which
+    // also adjusts the pointer to the base class it catches.
+    static_assert(sizeof(std::exception_ptr) == sizeof(void*));
+    void* obj = *reinterpret_cast<void* const*>(&eptr);
+    if (!obj) {
+        return nullptr;
+    }
+    if (catch_type.__do_catch(eptr.__cxa_exception_type(), &obj, 1)) {
+        return obj;
+    }
+#endif
+    return nullptr;
+}
+
 #ifndef NO_EXCEPTION_INTERCEPT
 seastar::logger exception_logger("exception");
 
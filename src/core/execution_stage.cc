@@ -63,7 +63,7 @@ execution_stage* execution_stage_manager::get_stage(const sstring& name) {
 bool execution_stage_manager::flush() noexcept {
     bool did_work = false;
     for (auto&& stage : _execution_stages) {
-        did_work |= stage->flush();
+        did_work |= stage->flush_if_due();
     }
     return did_work;
 }
@@ -94,6 +94,10 @@ execution_stage::execution_stage(execution_stage&& other)
     , _stats(other._stats)
     , _name(std::move(other._name))
     , _metric_group(std::move(other._metric_group))
+    , _max_batch_delay(other._max_batch_delay)
+    , _batch_target(other._batch_target)
+    , _batch_sizes(other._batch_sizes)
+    , _queue_delays(other._queue_delays)
 {
     internal::execution_stage_manager::get().update_execution_stage_registration(other, *this);
 }
@@ -129,21 +133,74 @@ execution_stage::execution_stage(const sstring& name, scheduling_group sg)
                                   [name, &esm = internal::execution_stage_manager::get()] {
                                       return esm.get_stage(name)->get_stats().function_calls_executed;
                                   }),
+             metrics::make_histogram("batch_size",
+                                  metrics::description("Histogram of the number of function calls executed by each task of execution stages"),
+                                  { metrics::label_instance("execution_stage", name), },
+                                  [name, &esm = internal::execution_stage_manager::get()] {
+                                      return esm.get_stage(name)->batch_sizes().to_histogram();
+                                  }),
+             metrics::make_histogram("queue_delay",
+                                  metrics::description("Histogram of how long the oldest function call of each task of execution stages waited for it, in microseconds"),
+                                  { metrics::label_instance("execution_stage", name), },
+                                  [name, &esm = internal::execution_stage_manager::get()] {
+                                      return esm.get_stage(name)->queue_delays().to_histogram();
+                                  }),
            });
     undo.cancel();
 }
 
+void execution_stage::queued() noexcept {
+    if (_empty) {
+        _first_queued = clock_type::now();
+        _empty = false;
+    }
+    _queued++;
+    _stats.function_calls_enqueued++;
+    if (_max_batch_delay == clock_type::duration::zero()) {
+        flush();
+    } else if (_queued >= _batch_target && !_flush_scheduled) {
+        // The batch filled up in time, try a bigger one next
+        _batch_target = std::min(_batch_target * 2, max_batch_size);
+        flush();
+    }
+}
+
+void execution_stage::run_batch() noexcept {
+    auto delay = clock_type::now() - _first_queued;
+    _queue_delays.add(std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(delay).count(), 0));
+    auto executed = _stats.function_calls_executed;
+    do_flush();
+    _batch_sizes.add(_stats.function_calls_executed - executed);
+    // Calls left by preemption are run by the next task without waiting for
+    // more, and their delay is counted from the same, older, time
+    _batch_preempted = !_empty;
+}
+
 bool execution_stage::flush() noexcept {
     if (_empty || _flush_scheduled) {
         return false;
     }
     _stats.tasks_scheduled++;
     schedule(make_task(_sg, [this] {
-        do_flush();
+        run_batch();
         _flush_scheduled = false;
     }));
     _flush_scheduled = true;
     return true;
 };
 
+bool execution_stage::flush_if_due() noexcept {
+    if (_empty || _flush_scheduled) {
+        return false;
+    }
+    if (_max_batch_delay != clock_type::duration::zero() && _queued < _batch_target && !_batch_preempted) {
+        if (clock_type::now() - _first_queued < _max_batch_delay) {
+            return false;
+        }
+        // The batch didn't fill up in time, wait for a smaller one next
+        _batch_target = std::max<size_t>(_batch_target / 2, 1);
+    }
+    return flush();
+}
+
 }
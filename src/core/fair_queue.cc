@@ -38,7 +38,7 @@
 namespace seastar {
 
 static_assert(sizeof(fair_queue_ticket) == sizeof(uint64_t), "unexpected fair_queue_ticket size");
-static_assert(sizeof(fair_queue_entry) <= 3 * sizeof(void*), "unexpected fair_queue_entry::_hook size");
+static_assert(sizeof(fair_queue_entry) <= 4 * sizeof(void*), "unexpected fair_queue_entry::_hook size");
 static_assert(sizeof(fair_queue_entry::container_list_t) == 2 * sizeof(void*), "unexpected priority_class::_queue size");
 
 fair_queue_ticket::fair_queue_ticket(uint32_t weight, uint32_t size) noexcept
@@ -98,6 +98,7 @@ uint64_t wrapping_difference(const uint64_t& a, const uint64_t& b) noexcept {
 fair_group::fair_group(config cfg)
         : _cost_capacity(cfg.weight_rate / rate_cast(std::chrono::seconds(1)).count(), cfg.size_rate / rate_cast(std::chrono::seconds(1)).count())
         , _replenish_rate(cfg.rate_factor * fixed_point_factor)
+        , _rate_scale(1.0)
         , _replenish_limit(_replenish_rate * rate_cast(cfg.rate_limit_duration).count())
         , _replenish_threshold(std::max((capacity_t)1, ticket_capacity(fair_queue_ticket(cfg.min_weight, cfg.min_size))))
         , _replenished(clock_type::now())
@@ -142,6 +143,49 @@ void fair_group::replenish_capacity(clock_type::time_point now) noexcept {
         auto max_extra = wrapping_difference(_capacity_ceil.load(std::memory_order_relaxed), _capacity_head.load(std::memory_order_relaxed));
         fetch_add(_capacity_head, std::min(extra, max_extra));
     }
+
+    if (_pool != nullptr) {
+        borrow_capacity(now);
+    }
+}
+
+void fair_group::borrow_capacity(clock_type::time_point now) noexcept {
+    auto want = wrapping_difference(_capacity_tail.load(std::memory_order_relaxed), _capacity_head.load(std::memory_order_relaxed));
+
+    for (unsigned i = 0; want != 0 && i < _pool->size(); i++) {
+        fair_group& peer = _pool->group(i);
+        if (&peer == this || peer.capacity_deficiency(peer._capacity_tail.load(std::memory_order_relaxed))) {
+            continue;
+        }
+
+        auto ts = peer._replenished.load(std::memory_order_relaxed);
+        if (now <= ts) {
+            continue;
+        }
+
+        // The groups of a pool share the configuration, so our rate is the peer's one
+        auto extra = accumulated_capacity(now - ts);
+        if (extra < _replenish_threshold || !peer._replenished.compare_exchange_weak(ts, now)) {
+            continue;
+        }
+
+        // Whatever the peer would have accumulated beyond what we need is
+        // dropped, the same as its own bucket would have dropped it
+        auto max_extra = wrapping_difference(_capacity_ceil.load(std::memory_order_relaxed), _capacity_head.load(std::memory_order_relaxed));
+        auto borrowed = std::min({extra, max_extra, want});
+        fetch_add(_capacity_head, borrowed);
+        want -= borrowed;
+    }
+}
+
+fair_group_pool::fair_group_pool(fair_group::config cfg, unsigned nr_groups) {
+    _groups.reserve(nr_groups);
+    for (unsigned i = 0; i < nr_groups; i++) {
+        _groups.push_back(std::make_unique<fair_group>(cfg));
+        if (nr_groups > 1) {
+            _groups.back()->_pool = this;
+        }
+    }
 }
 
 void fair_group::maybe_replenish_capacity(clock_type::time_point& local_ts) noexcept {
@@ -166,26 +210,63 @@ auto fair_group::fetch_add(fair_group_atomic_rover& rover, capacity_t cap) noexc
     return rover.fetch_add(cap);
 }
 
-// Priority class, to be used with a given fair_queue
-class fair_queue::priority_class_data {
+class fair_queue::priority_entry {
     friend class fair_queue;
+protected:
     uint32_t _shares = 0;
     capacity_t _accumulated = 0;
-    capacity_t _pure_accumulated = 0;
-    fair_queue_entry::container_list_t _queue;
+    priority_group_data* _parent;
     bool _queued = false;
+    const bool _is_group;
 
 public:
-    explicit priority_class_data(uint32_t shares) noexcept : _shares(std::max(shares, 1u)) {}
-    priority_class_data(const priority_class_data&) = delete;
-    priority_class_data(priority_class_data&&) = delete;
+    priority_entry(uint32_t shares, priority_group_data* parent, bool is_group) noexcept
+        : _shares(std::max(shares, 1u))
+        , _parent(parent)
+        , _is_group(is_group)
+    {}
+    priority_entry(const priority_entry&) = delete;
+    priority_entry(priority_entry&&) = delete;
 
     void update_shares(uint32_t shares) noexcept {
         _shares = (std::max(shares, 1u));
     }
 };
 
-bool fair_queue::class_compare::operator() (const priority_class_ptr& lhs, const priority_class_ptr & rhs) const noexcept {
+// Group of priority classes and other groups, to be used with a given fair_queue.
+// Its members compete for what the group gets like the top-level classes
+// compete for the whole queue
+class fair_queue::priority_group_data : public fair_queue::priority_entry {
+    friend class fair_queue;
+    prioq _handles;
+    capacity_t _last_accumulated = 0;
+    unsigned _nr_members = 0;
+
+public:
+    priority_group_data(uint32_t shares, priority_group_data* parent) noexcept
+        : priority_entry(shares, parent, true)
+    {}
+};
+
+// Priority class, to be used with a given fair_queue
+class fair_queue::priority_class_data : public fair_queue::priority_entry {
+    friend class fair_queue;
+    capacity_t _pure_accumulated = 0;
+    // Capacity of the requests cancelled before they were dispatched
+    capacity_t _cancelled = 0;
+    fair_queue_entry::container_list_t _queue;
+    // Number of queued requests that have a deadline
+    unsigned _deadlines = 0;
+    // The dispatch round in which the deadlines were last checked
+    unsigned _deadlines_checked = 0;
+
+public:
+    priority_class_data(uint32_t shares, priority_group_data* parent) noexcept
+        : priority_entry(shares, parent, false)
+    {}
+};
+
+bool fair_queue::class_compare::operator() (const priority_entry_ptr& lhs, const priority_entry_ptr & rhs) const noexcept {
     return lhs->_accumulated > rhs->_accumulated;
 }
 
@@ -206,7 +287,10 @@ fair_queue::fair_queue(fair_queue&& other)
     , _requests_queued(std::exchange(other._requests_queued, 0))
     , _handles(std::move(other._handles))
     , _priority_classes(std::move(other._priority_classes))
+    , _priority_groups(std::move(other._priority_groups))
     , _last_accumulated(other._last_accumulated)
+    , _capacity_released(std::exchange(other._capacity_released, 0))
+    , _dispatch_round(other._dispatch_round)
 {
 }
 
@@ -214,17 +298,32 @@ fair_queue::~fair_queue() {
     for (const auto& fq : _priority_classes) {
         assert(!fq);
     }
+    for (const auto& g : _priority_groups) {
+        assert(!g);
+    }
+    release_finished_capacity();
+}
+
+auto fair_queue::handles_of(priority_entry& pc) noexcept -> prioq& {
+    return pc._parent == nullptr ? _handles : pc._parent->_handles;
 }
 
-void fair_queue::push_priority_class(priority_class_data& pc) {
+auto fair_queue::last_accumulated_of(priority_entry& pc) noexcept -> capacity_t& {
+    return pc._parent == nullptr ? _last_accumulated : pc._parent->_last_accumulated;
+}
+
+void fair_queue::push_priority_class(priority_entry& pc) {
     if (!pc._queued) {
-        _handles.push(&pc);
+        handles_of(pc).push(&pc);
         pc._queued = true;
     }
 }
 
-void fair_queue::push_priority_class_from_idle(priority_class_data& pc) {
-    if (!pc._queued) {
+// Pushes the class and then each of its groups that's not yet queued
+// in its parent, so that dispatching can reach the class from the top
+void fair_queue::push_priority_class_from_idle(priority_entry& entry) {
+    for (auto e = &entry; e != nullptr && !e->_queued; e = e->_parent) {
+        auto& pc = *e;
         // Don't let the newcomer monopolize the disk for more than tau
         // duration. For this estimate how many capacity units can be
         // accumulated with the current class shares per rate resulution
@@ -233,17 +332,67 @@ void fair_queue::push_priority_class_from_idle(priority_class_data& pc) {
         // On start this deviation can go to negative values, so not to
         // introduce extra if's for that short corner case, use signed
         // arithmetics and make sure the _accumulated value doesn't grow
-        // over signed maximum (see overflow check below)
-        pc._accumulated = std::max<signed_capacity_t>(_last_accumulated - max_deviation, pc._accumulated);
-        _handles.push(&pc);
+        // over signed maximum (see overflow check in charge_priority_class)
+        pc._accumulated = std::max<signed_capacity_t>(last_accumulated_of(pc) - max_deviation, pc._accumulated);
+        handles_of(pc).push(&pc);
         pc._queued = true;
     }
 }
 
-void fair_queue::pop_priority_class(priority_class_data& pc) {
+// The class or group must be at the top of its parent's queue
+void fair_queue::pop_priority_class(priority_entry& pc) {
     assert(pc._queued);
     pc._queued = false;
-    _handles.pop();
+    handles_of(pc).pop();
+}
+
+// Takes a class or group out of its parent's queue wherever it sits in it,
+// and then each group left with no queued members. That's for entries that
+// go away while still queued, as the queues only let the top be popped
+void fair_queue::unqueue_priority_class(priority_entry& pc) {
+    for (priority_entry* e = &pc; e != nullptr && e->_queued; e = e->_parent) {
+        auto& handles = handles_of(*e);
+        prioq rest;
+        for (; !handles.empty(); handles.pop()) {
+            if (handles.top() != e) {
+                rest.push(handles.top());
+            }
+        }
+        handles = std::move(rest);
+        e->_queued = false;
+        if (e->_parent != nullptr && !e->_parent->_handles.empty()) {
+            break;
+        }
+    }
+}
+
+// Accounts the cost of a dispatched request to a class or a group, which
+// must have been popped from its parent's queue
+void fair_queue::charge_priority_class(priority_entry& pc, capacity_t cost) {
+    // signed overflow check to make push_priority_class_from_idle math work
+    if (pc._accumulated >= std::numeric_limits<signed_capacity_t>::max() - cost) {
+        auto reset = [&pc] (priority_entry& e) {
+            if (e._parent == pc._parent) {
+                if (e._queued) {
+                    e._accumulated -= pc._accumulated;
+                } else { // this includes pc
+                    e._accumulated = 0;
+                }
+            }
+        };
+        for (auto& c : _priority_classes) {
+            if (c) {
+                reset(*c);
+            }
+        }
+        for (auto& g : _priority_groups) {
+            if (g) {
+                reset(*g);
+            }
+        }
+        last_accumulated_of(pc) = 0;
+    }
+    pc._accumulated += cost;
 }
 
 auto fair_queue::grab_pending_capacity(const fair_queue_entry& ent) noexcept -> grab_result {
@@ -281,6 +430,41 @@ auto fair_queue::grab_capacity(const fair_queue_entry& ent) noexcept -> grab_res
     return grab_result::grabbed;
 }
 
+// Drops the requests of the class that missed their deadline and moves
+// the ones within the configured slack of it to the front of the queue,
+// earliest deadline first. The queue is only scanned for classes that
+// have requests with deadlines, once per dispatch_requests() call.
+//
+// Requests of one io_intent share the deadline, and the list sort is
+// stable, so they keep their queueing order.
+void fair_queue::expire_requests(priority_class_data& pc, clock_type::time_point now, const std::function<void(fair_queue_entry&)>& expired) {
+    auto urgent_deadline = now + _config.deadline_slack;
+    fair_queue_entry::container_list_t urgent;
+
+    for (auto it = pc._queue.begin(); it != pc._queue.end();) {
+        auto& ent = *it;
+        if (!ent.has_deadline() || ent._deadline > urgent_deadline) {
+            ++it;
+            continue;
+        }
+
+        it = pc._queue.erase(it);
+        if (ent._deadline < now && expired) {
+            pc._deadlines--;
+            _resources_queued -= ent._ticket;
+            _requests_queued--;
+            expired(ent);
+        } else {
+            urgent.push_back(ent);
+        }
+    }
+
+    urgent.sort([] (const fair_queue_entry& a, const fair_queue_entry& b) {
+        return a._deadline < b._deadline;
+    });
+    pc._queue.splice(pc._queue.begin(), urgent);
+}
+
 void fair_queue::register_priority_class(class_id id, uint32_t shares) {
     if (id >= _priority_classes.size()) {
         _priority_classes.resize(id + 1);
@@ -288,15 +472,63 @@ void fair_queue::register_priority_class(class_id id, uint32_t shares) {
         assert(!_priority_classes[id]);
     }
 
-    _priority_classes[id] = std::make_unique<priority_class_data>(shares);
+    _priority_classes[id] = std::make_unique<priority_class_data>(shares, nullptr);
+}
+
+void fair_queue::register_priority_class(class_id id, uint32_t shares, group_id gid) {
+    assert(gid < _priority_groups.size() && _priority_groups[gid]);
+    register_priority_class(id, shares);
+    auto& g = *_priority_groups[gid];
+    _priority_classes[id]->_parent = &g;
+    g._nr_members++;
 }
 
 void fair_queue::unregister_priority_class(class_id id) {
     auto& pclass = _priority_classes[id];
     assert(pclass && pclass->_queue.empty());
+    // A class whose requests were all cancelled may still be queued
+    unqueue_priority_class(*pclass);
+    if (pclass->_parent != nullptr) {
+        pclass->_parent->_nr_members--;
+    }
     pclass.reset();
 }
 
+void fair_queue::register_priority_group(group_id id, uint32_t shares, std::optional<group_id> parent) {
+    priority_group_data* p = nullptr;
+    if (parent) {
+        assert(*parent < _priority_groups.size() && _priority_groups[*parent]);
+        p = _priority_groups[*parent].get();
+    }
+
+    if (id >= _priority_groups.size()) {
+        _priority_groups.resize(id + 1);
+    } else {
+        assert(!_priority_groups[id]);
+    }
+
+    _priority_groups[id] = std::make_unique<priority_group_data>(shares, p);
+    if (p != nullptr) {
+        p->_nr_members++;
+    }
+}
+
+void fair_queue::unregister_priority_group(group_id id) {
+    auto& g = _priority_groups[id];
+    assert(g && g->_nr_members == 0 && !g->_queued);
+    if (g->_parent != nullptr) {
+        g->_parent->_nr_members--;
+    }
+    g.reset();
+}
+
+void fair_queue::update_shares_for_group(group_id id, uint32_t shares) {
+    assert(id < _priority_groups.size());
+    auto& g = _priority_groups[id];
+    assert(g);
+    g->update_shares(shares);
+}
+
 void fair_queue::update_shares_for_class(class_id id, uint32_t shares) {
     assert(id < _priority_classes.size());
     auto& pc = _priority_classes[id];
@@ -327,6 +559,9 @@ void fair_queue::queue(class_id id, fair_queue_entry& ent) {
     // someone else's, we need a separate promise at this point.
     push_priority_class_from_idle(pc);
     pc._queue.push_back(ent);
+    if (ent.has_deadline()) {
+        pc._deadlines++;
+    }
     _resources_queued += ent._ticket;
     _requests_queued++;
 }
@@ -337,9 +572,31 @@ void fair_queue::notify_request_finished(fair_queue_ticket desc) noexcept {
     _group.release_capacity(_group.ticket_capacity(desc));
 }
 
-void fair_queue::notify_request_cancelled(fair_queue_entry& ent) noexcept {
+void fair_queue::notify_request_finished_deferred(fair_queue_ticket desc) noexcept {
+    _resources_executing -= desc;
+    _requests_executing--;
+    _capacity_released += _group.ticket_capacity(desc);
+}
+
+void fair_queue::release_finished_capacity() noexcept {
+    if (_capacity_released != 0) {
+        _group.release_capacity(std::exchange(_capacity_released, 0));
+    }
+}
+
+// The class isn't charged until its requests are dispatched, so there's
+// nothing to give back to it. If the class is left empty it stays in the
+// dispatch queue until dispatch_requests() pops it, like it does when the
+// last request expires, or until it's unregistered.
+void fair_queue::notify_request_cancelled(class_id id, fair_queue_entry& ent) noexcept {
+    priority_class_data& pc = *_priority_classes[id];
+    pc._queue.erase(fair_queue_entry::container_list_t::s_iterator_to(ent));
+    if (ent.has_deadline()) {
+        pc._deadlines--;
+    }
+    pc._cancelled += _group.ticket_capacity(ent._ticket);
     _resources_queued -= ent._ticket;
-    ent._ticket = fair_queue_ticket();
+    _requests_queued--;
 }
 
 fair_queue::clock_type::time_point fair_queue::next_pending_aio() const noexcept {
@@ -362,12 +619,34 @@ fair_queue::clock_type::time_point fair_queue::next_pending_aio() const noexcept
     return std::chrono::steady_clock::time_point::max();
 }
 
-void fair_queue::dispatch_requests(std::function<void(fair_queue_entry&)> cb) {
+void fair_queue::dispatch_requests(std::function<void(fair_queue_entry&)> cb, std::function<void(fair_queue_entry&)> expired) {
     capacity_t dispatched = 0;
     boost::container::small_vector<priority_class_ptr, 2> preempt;
+    std::optional<clock_type::time_point> now;
+
+    release_finished_capacity();
+    _dispatch_round++;
 
     while (!_handles.empty() && (dispatched < _group.maximum_capacity() / smp::count)) {
-        priority_class_data& h = *_handles.top();
+        // Walk down the groups to the class that lags behind the most,
+        // popping the groups that have no queued members left
+        priority_entry* top = _handles.top();
+        while (top->_is_group && !static_cast<priority_group_data*>(top)->_handles.empty()) {
+            top = static_cast<priority_group_data*>(top)->_handles.top();
+        }
+        if (top->_is_group) {
+            pop_priority_class(*top);
+            continue;
+        }
+
+        priority_class_data& h = *static_cast<priority_class_data*>(top);
+        if (h._deadlines != 0 && h._deadlines_checked != _dispatch_round) {
+            h._deadlines_checked = _dispatch_round;
+            if (!now) {
+                now = clock_type::now();
+            }
+            expire_requests(h, *now, expired);
+        }
         if (h._queue.empty()) {
             pop_priority_class(h);
             continue;
@@ -385,9 +664,11 @@ void fair_queue::dispatch_requests(std::function<void(fair_queue_entry&)> cb) {
             continue;
         }
 
-        _last_accumulated = std::max(h._accumulated, _last_accumulated);
         pop_priority_class(h);
         h._queue.pop_front();
+        if (req.has_deadline()) {
+            h._deadlines--;
+        }
 
         _resources_executing += req._ticket;
         _resources_queued -= req._ticket;
@@ -398,34 +679,37 @@ void fair_queue::dispatch_requests(std::function<void(fair_queue_entry&)> cb) {
         // unrestricted queue it can be as low as 2k. With large enough shares this
         // has chances to be translated into zero cost which, in turn, will make the
         // class show no progress and monopolize the queue.
+        //
+        // The class and each of its groups are charged according to their own
+        // shares, so that shares compose along the tree.
         auto req_cap = _group.ticket_capacity(req._ticket);
-        auto req_cost  = std::max(req_cap / h._shares, (capacity_t)1);
-        // signed overflow check to make push_priority_class_from_idle math work
-        if (h._accumulated >= std::numeric_limits<signed_capacity_t>::max() - req_cost) {
-            for (auto& pc : _priority_classes) {
-                if (pc) {
-                    if (pc->_queued) {
-                        pc->_accumulated -= h._accumulated;
-                    } else { // this includes h
-                        pc->_accumulated = 0;
-                    }
-                }
+        for (priority_entry* e = &h; e != nullptr; e = e->_parent) {
+            auto& last_accumulated = last_accumulated_of(*e);
+            last_accumulated = std::max(e->_accumulated, last_accumulated);
+            if (e != &h) {
+                pop_priority_class(*e);
             }
-            _last_accumulated = 0;
+            charge_priority_class(*e, std::max(req_cap / e->_shares, (capacity_t)1));
         }
-        h._accumulated += req_cost;
         h._pure_accumulated += req_cap;
 
         if (!h._queue.empty()) {
             push_priority_class(h);
         }
+        for (auto g = h._parent; g != nullptr; g = g->_parent) {
+            if (!g->_handles.empty()) {
+                push_priority_class(*g);
+            }
+        }
 
         dispatched += _group.ticket_capacity(req._ticket);
         cb(req);
     }
 
     for (auto&& h : preempt) {
-        push_priority_class(*h);
+        for (priority_entry* e = h; e != nullptr && !e->_queued; e = e->_parent) {
+            push_priority_class(*e);
+        }
     }
 }
 
@@ -439,6 +723,9 @@ std::vector<seastar::metrics::impl::metric_definition_impl> fair_queue::metrics(
             sm::make_derive("adjusted_consumption",
                     [&pc] { return fair_group::capacity_tokens(pc._accumulated); },
                     sm::description("Consumed disk capacity units adjusted for class shares and idling preemption")),
+            sm::make_derive("cancelled_consumption",
+                    [&pc] { return fair_group::capacity_tokens(pc._cancelled); },
+                    sm::description("Disk capacity units of requests of this class cancelled before being dispatched, which were never consumed")),
     });
 }
 
@@ -23,9 +23,12 @@
 
 #include <seastar/core/file.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <seastar/core/shared_future.hh>
 
 #include <deque>
 #include <atomic>
+#include <map>
+#include <optional>
 
 namespace seastar {
 class io_queue;
@@ -39,6 +42,36 @@ struct fs_info;
 // Returns the final total length of all iovecs.
 size_t sanitize_iovecs(std::vector<iovec>& iov, size_t disk_alignment) noexcept;
 
+// Queues the discards of a file through its I/O queue, in the discard
+// priority class, so that they are paced with the rest of the I/O of the
+// device rather than all sent to the disk at once. The ranges discarded
+// while a batch is being sent are merged when adjacent or overlapping,
+// and sent together as the next batch, in pieces of bounded length.
+class discard_queue {
+    // The length of the discards sent to the disk, and how much each
+    // costs in the I/O queue: that of a write of this length
+    static constexpr uint64_t max_discard_length = 32 << 20;
+    static constexpr size_t discard_cost = 128 << 10;
+    // How many discards of a batch are queued at a time
+    static constexpr size_t max_queued = 16;
+
+    io_queue& _ioq;
+    const int _fd;
+    const bool _blockdev;
+    // The next batch, start to end
+    std::map<uint64_t, uint64_t> _pending;
+    std::optional<shared_promise<>> _pending_done;
+    bool _running = false;
+
+    void run_batch() noexcept;
+    future<> send(std::map<uint64_t, uint64_t> ranges);
+public:
+    // Block device discards use BLKDISCARD, the others punch holes
+    discard_queue(io_queue& ioq, int fd, bool blockdev) noexcept
+        : _ioq(ioq), _fd(fd), _blockdev(blockdev) {}
+    future<> discard(uint64_t offset, uint64_t length);
+};
+
 }
 
 class posix_file_handle_impl : public seastar::file_handle_impl {
@@ -76,11 +109,14 @@ class posix_file_impl : public file_impl {
     std::atomic<unsigned>* _refcount = nullptr;
     const dev_t _device_id;
     const bool _nowait_works;
-    io_queue& _io_queue;
     const open_flags _open_flags;
+    std::unique_ptr<internal::discard_queue> _discards;
 protected:
+    io_queue& _io_queue;
     int _fd;
 
+    future<> queue_discard(uint64_t offset, uint64_t length, bool blockdev) noexcept;
+
     posix_file_impl(int fd, open_flags, file_open_options options, dev_t device_id, bool nowait_works);
     posix_file_impl(int fd, open_flags, file_open_options options, dev_t device_id, const internal::fs_info& fsi);
     posix_file_impl(int fd, open_flags, std::atomic<unsigned>* refcount, dev_t device_id,
@@ -184,6 +220,24 @@ class posix_file_real_impl final : public posix_file_impl {
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc, io_intent* intent) noexcept override;
 };
 
+// A file opened through the page cache. Reads are first tried inline with
+// RWF_NOWAIT, which fails with EAGAIN instead of blocking when the data
+// is not cached; only then they go to the syscall thread. Writes take the
+// regular path.
+class posix_buffered_file_impl final : public posix_file_impl {
+    future<size_t> do_buffered_read(uint64_t pos, std::vector<iovec> iov) noexcept;
+public:
+    posix_buffered_file_impl(int fd, open_flags of, file_open_options options, const internal::fs_info& fsi, dev_t device_id);
+    using posix_file_impl::read_dma;
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept override;
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept override;
+    using posix_file_impl::write_dma;
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept override;
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept override;
+    using posix_file_impl::dma_read_bulk;
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc, io_intent* intent) noexcept override;
+};
+
 // The Linux XFS implementation is challenged wrt. append: a write that changes
 // eof will be blocked by any other concurrent AIO operation to the same file, whether
 // it changes file size or not. Furthermore, ftruncate() will also block and be blocked
@@ -213,9 +267,12 @@ class append_challenged_posix_file_impl final : public posix_file_impl, public e
     // Queue of pending operations; processed from front to end to avoid
     // starvation, but can issue concurrent operations.
     std::deque<op> _q;
+    // Appending writes the filesystem can take at once without blocking
     const unsigned _max_size_changing_ops = 0;
     unsigned _current_non_size_changing_ops = 0;
     unsigned _current_size_changing_ops = 0;
+    // Set while an operation which must run alone is in flight
+    bool _running_alone = false;
     const bool _fsync_is_exclusive = true;
 
     // Set when the user is closing the file
@@ -295,4 +352,36 @@ class blockdev_file_impl final : public posix_file_impl {
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc, io_intent* intent) noexcept override;
 };
 
+// Reads and writes an NVMe namespace through its generic character device
+// (/dev/ngXnY), sending NVMe read and write commands through io_uring
+// instead of going through the block layer. Requests are still queued
+// by the device's io_queue.
+class nvme_file_impl final : public posix_file_impl {
+    const uint32_t _nsid;
+    const unsigned _lba_shift;
+    const uint64_t _size;
+    // Commands larger than the device's maximum data transfer size fail,
+    // so longer requests are split. 128k is supported by every device.
+    static constexpr size_t max_transfer = 128 * 1024;
+
+    future<size_t> do_io(bool write, uint64_t pos, char* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept;
+    future<size_t> do_io(bool write, uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept;
+public:
+    nvme_file_impl(int fd, open_flags, file_open_options options, dev_t device_id, uint32_t nsid, unsigned lba_shift, uint64_t size);
+    future<> flush() noexcept override;
+    future<> truncate(uint64_t length) noexcept override;
+    future<> discard(uint64_t offset, uint64_t length) noexcept override;
+    future<uint64_t> size() noexcept override;
+    virtual future<> allocate(uint64_t position, uint64_t length) noexcept override;
+    virtual std::unique_ptr<seastar::file_handle_impl> dup() override;
+    using posix_file_impl::read_dma;
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept override;
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept override;
+    using posix_file_impl::write_dma;
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept override;
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept override;
+    using posix_file_impl::dma_read_bulk;
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc, io_intent* intent) noexcept override;
+};
+
 }
@@ -26,6 +26,7 @@
 #include <linux/types.h> // for xfs, below
 #include <linux/fs.h> // BLKBSZGET
 #include <linux/major.h>
+#include <linux/nvme_ioctl.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -43,6 +44,7 @@
 #include <seastar/util/internal/magic.hh>
 #include <seastar/core/io_queue.hh>
 #include "core/file-impl.hh"
+#include "core/reactor_backend.hh"
 #include "core/syscall_result.hh"
 #include "core/thread_pool.hh"
 #include "core/uname.hh"
@@ -96,8 +98,8 @@ file_handle::to_file() && {
 posix_file_impl::posix_file_impl(int fd, open_flags f, file_open_options options, dev_t device_id, bool nowait_works)
         : _device_id(device_id)
         , _nowait_works(nowait_works)
-        , _io_queue(engine().get_io_queue(_device_id))
         , _open_flags(f)
+        , _io_queue(engine().get_io_queue(_device_id))
         , _fd(fd)
 {
     configure_io_lengths();
@@ -161,8 +163,8 @@ posix_file_impl::posix_file_impl(int fd, open_flags f, std::atomic<unsigned>* re
         : _refcount(refcount)
         , _device_id(device_id)
         , _nowait_works(nowait_works)
-        , _io_queue(engine().get_io_queue(_device_id))
         , _open_flags(f)
+        , _io_queue(engine().get_io_queue(_device_id))
         , _fd(fd) {
     _memory_dma_alignment = memory_dma_alignment;
     _disk_read_dma_alignment = disk_read_dma_alignment;
@@ -236,17 +238,90 @@ posix_file_impl::fcntl_short(int op, uintptr_t arg) noexcept {
     return make_ready_future<int>(ret);
 }
 
-future<>
-posix_file_impl::discard(uint64_t offset, uint64_t length) noexcept {
-    return engine()._thread_pool->submit<syscall_result<int>>([this, offset, length] () mutable {
-        return wrap_syscall<int>(::fallocate(_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
-            offset, length));
-    }).then([] (syscall_result<int> sr) {
-        sr.throw_if_error();
+namespace internal {
+
+future<> discard_queue::discard(uint64_t offset, uint64_t length) {
+    if (!length) {
         return make_ready_future<>();
+    }
+    auto end = offset + length;
+    // Merge with the ranges it touches
+    auto it = _pending.upper_bound(offset);
+    if (it != _pending.begin() && std::prev(it)->second >= offset) {
+        --it;
+    }
+    while (it != _pending.end() && it->first <= end) {
+        offset = std::min(offset, it->first);
+        end = std::max(end, it->second);
+        it = _pending.erase(it);
+    }
+    _pending.emplace(offset, end);
+    if (!_pending_done) {
+        _pending_done.emplace();
+    }
+    auto f = _pending_done->get_shared_future();
+    if (!_running) {
+        run_batch();
+    }
+    return f;
+}
+
+void discard_queue::run_batch() noexcept {
+    _running = true;
+    auto ranges = std::exchange(_pending, {});
+    auto done = std::move(*_pending_done);
+    _pending_done.reset();
+    (void)futurize_invoke([this, ranges = std::move(ranges)] () mutable {
+        return send(std::move(ranges));
+    }).then_wrapped([this, done = std::move(done)] (future<> f) mutable {
+        if (_pending.empty()) {
+            _running = false;
+        } else {
+            run_batch();
+        }
+        // Last, as the file may be closed once its discards are done
+        if (f.failed()) {
+            done.set_exception(f.get_exception());
+        } else {
+            done.set_value();
+        }
     });
 }
 
+future<> discard_queue::send(std::map<uint64_t, uint64_t> ranges) {
+    std::vector<std::pair<uint64_t, uint64_t>> pieces;
+    for (auto [start, end] : ranges) {
+        for (auto pos = start; pos < end; pos += max_discard_length) {
+            pieces.emplace_back(pos, std::min(end - pos, max_discard_length));
+        }
+    }
+    return do_with(std::move(pieces), [this] (auto& pieces) {
+        return max_concurrent_for_each(pieces, max_queued, [this] (std::pair<uint64_t, uint64_t> p) {
+            auto req = _blockdev ? io_request::make_discard(_fd, p.first, p.second) : io_request::make_punch_hole(_fd, p.first, p.second);
+            return _ioq.queue_request(discard_priority_class(), discard_cost, std::move(req), nullptr).discard_result();
+        });
+    });
+}
+
+}
+
+future<>
+posix_file_impl::queue_discard(uint64_t offset, uint64_t length, bool blockdev) noexcept {
+    try {
+        if (!_discards) {
+            _discards = std::make_unique<internal::discard_queue>(_io_queue, _fd, blockdev);
+        }
+        return _discards->discard(offset, length);
+    } catch (...) {
+        return current_exception_as_future();
+    }
+}
+
+future<>
+posix_file_impl::discard(uint64_t offset, uint64_t length) noexcept {
+    return queue_discard(offset, length, false);
+}
+
 future<>
 posix_file_impl::allocate(uint64_t position, uint64_t length) noexcept {
 #ifdef FALLOC_FL_ZERO_RANGE
@@ -465,6 +540,86 @@ posix_file_real_impl::dma_read_bulk(uint64_t offset, size_t range_size, const io
     return posix_file_impl::do_dma_read_bulk(offset, range_size, pc, intent);
 }
 
+posix_buffered_file_impl::posix_buffered_file_impl(int fd, open_flags of, file_open_options options, const internal::fs_info& fsi, dev_t device_id)
+        : posix_file_impl(fd, of, std::move(options), device_id, fsi) {
+    // The page cache takes reads of any size at any offset
+    _disk_read_dma_alignment = 1;
+}
+
+future<size_t>
+posix_buffered_file_impl::do_buffered_read(uint64_t pos, std::vector<iovec> iov) noexcept {
+    // Kernels before 4.14 reject RWF_NOWAIT on buffered reads
+    static thread_local bool nowait_works = true;
+  try {
+    size_t done = 0;
+    // A short read is either the end of the file or the end of the cached
+    // data, so read on until the file ends or the cache misses
+    while (nowait_works) {
+        auto r = ::preadv2(_fd, iov.data(), iov.size(), pos + done, RWF_NOWAIT);
+        if (r == -1) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            if (errno != EOPNOTSUPP && errno != EINVAL) {
+                throw std::system_error(errno, std::system_category(), "preadv2 failed");
+            }
+            nowait_works = false;
+            break;
+        }
+        done += r;
+        if (r == 0 || size_t(r) == iovec_len(iov)) {
+            return make_ready_future<size_t>(done);
+        }
+        size_t rest = r;
+        auto it = iov.begin();
+        while (rest >= it->iov_len) {
+            rest -= it->iov_len;
+            ++it;
+        }
+        it->iov_base = static_cast<char*>(it->iov_base) + rest;
+        it->iov_len -= rest;
+        iov.erase(iov.begin(), it);
+    }
+    return engine()._thread_pool->submit<syscall_result<ssize_t>>([fd = _fd, pos = pos + done, iov = std::move(iov)] {
+        return wrap_syscall<ssize_t>(::preadv(fd, iov.data(), iov.size(), pos));
+    }).then([done] (syscall_result<ssize_t> sr) {
+        sr.throw_if_error();
+        return make_ready_future<size_t>(done + sr.result);
+    });
+  } catch (...) {
+    return current_exception_as_future<size_t>();
+  }
+}
+
+future<size_t>
+posix_buffered_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept {
+  try {
+    return do_buffered_read(pos, {iovec{buffer, len}});
+  } catch (...) {
+    return current_exception_as_future<size_t>();
+  }
+}
+
+future<size_t>
+posix_buffered_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept {
+    return do_buffered_read(pos, std::move(iov));
+}
+
+future<size_t>
+posix_buffered_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept {
+    return posix_file_impl::do_write_dma(pos, buffer, len, pc, intent);
+}
+
+future<size_t>
+posix_buffered_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept {
+    return posix_file_impl::do_write_dma(pos, std::move(iov), pc, intent);
+}
+
+future<temporary_buffer<uint8_t>>
+posix_buffered_file_impl::dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc, io_intent* intent) noexcept {
+    return posix_file_impl::do_dma_read_bulk(offset, range_size, pc, intent);
+}
+
 future<temporary_buffer<uint8_t>>
 posix_file_impl::do_dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc, io_intent* intent) noexcept {
     using tmp_buf_type = typename internal::file_read_state<uint8_t>::tmp_buf_type;
@@ -535,7 +690,7 @@ posix_file_impl::read_maybe_eof(uint64_t pos, size_t len, const io_priority_clas
     // We have to allocate a new aligned buffer to make sure we don't get
     // an EINVAL error due to unaligned destination buffer.
     //
-    temporary_buffer<uint8_t> buf = temporary_buffer<uint8_t>::aligned(
+    temporary_buffer<uint8_t> buf = allocate_dma_buffer<uint8_t>(
                _memory_dma_alignment, align_up(len, size_t(_disk_read_dma_alignment)));
 
     // try to read a single bulk from the given position
@@ -592,13 +747,7 @@ blockdev_file_impl::truncate(uint64_t length) noexcept {
 
 future<>
 blockdev_file_impl::discard(uint64_t offset, uint64_t length) noexcept {
-    return engine()._thread_pool->submit<syscall_result<int>>([this, offset, length] () mutable {
-        uint64_t range[2] { offset, length };
-        return wrap_syscall<int>(::ioctl(_fd, BLKDISCARD, &range));
-    }).then([] (syscall_result<int> sr) {
-        sr.throw_if_error();
-        return make_ready_future<>();
-    });
+    return queue_discard(offset, length, true);
 }
 
 future<>
@@ -632,6 +781,163 @@ blockdev_file_impl::dma_read_bulk(uint64_t offset, size_t range_size, const io_p
     return posix_file_impl::do_dma_read_bulk(offset, range_size, pc, intent);
 }
 
+nvme_file_impl::nvme_file_impl(int fd, open_flags f, file_open_options options, dev_t device_id, uint32_t nsid, unsigned lba_shift, uint64_t size)
+        : posix_file_impl(fd, f, options, device_id, false)
+        , _nsid(nsid)
+        , _lba_shift(lba_shift)
+        , _size(size) {
+    _disk_read_dma_alignment = 1u << _lba_shift;
+    _disk_write_dma_alignment = 1u << _lba_shift;
+    _disk_overwrite_dma_alignment = 1u << _lba_shift;
+}
+
+future<size_t>
+nvme_file_impl::do_io(bool write, uint64_t pos, char* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept {
+  try {
+    auto lba_mask = (uint64_t(1) << _lba_shift) - 1;
+    if ((pos & lba_mask) || (len & lba_mask)) {
+        return make_exception_future<size_t>(std::system_error(EINVAL, std::system_category(), "unaligned NVMe I/O"));
+    }
+    // Like reads of a block device, reads past the end are short
+    if (!write) {
+        len = pos < _size ? std::min<uint64_t>(len, _size - pos) : 0;
+    }
+    if (!len) {
+        return make_ready_future<size_t>(0);
+    }
+    if (len > max_transfer) {
+        return do_with(size_t(0), [this, write, pos, buffer, len, &pc, intent] (size_t& done) {
+            return parallel_for_each(boost::irange<size_t>(0, len, max_transfer), [this, write, pos, buffer, len, &pc, intent, &done] (size_t off) {
+                return do_io(write, pos + off, buffer + off, std::min(max_transfer, len - off), pc, intent).then([&done] (size_t n) {
+                    done += n;
+                });
+            }).then([&done] {
+                return done;
+            });
+        });
+    }
+    auto fut = write
+        ? engine().submit_io_write(&_io_queue, pc, len, internal::io_request::make_nvme_write(_fd, _nsid, _lba_shift, pos, buffer, len), intent)
+        : engine().submit_io_read(&_io_queue, pc, len, internal::io_request::make_nvme_read(_fd, _nsid, _lba_shift, pos, buffer, len), intent);
+    return fut.then([len] (size_t status) {
+        // Passthrough commands complete with the NVMe status rather than
+        // with the transferred length
+        if (status) {
+            return make_exception_future<size_t>(std::system_error(EIO, std::system_category(), format("NVMe command failed with status {:#x}", status)));
+        }
+        return make_ready_future<size_t>(len);
+    });
+  } catch (...) {
+    return current_exception_as_future<size_t>();
+  }
+}
+
+future<size_t>
+nvme_file_impl::do_io(bool write, uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept {
+    return do_with(std::move(iov), size_t(0), [this, write, pos, &pc, intent] (std::vector<iovec>& iov, size_t& done) {
+        uint64_t off = pos;
+        std::vector<std::pair<uint64_t, iovec>> parts;
+        parts.reserve(iov.size());
+        for (auto& v : iov) {
+            parts.emplace_back(off, v);
+            off += v.iov_len;
+        }
+        return parallel_for_each(std::move(parts), [this, write, &pc, intent, &done] (std::pair<uint64_t, iovec> part) {
+            return do_io(write, part.first, static_cast<char*>(part.second.iov_base), part.second.iov_len, pc, intent).then([&done] (size_t n) {
+                done += n;
+            });
+        }).then([&done] {
+            return done;
+        });
+    });
+}
+
+future<>
+nvme_file_impl::flush() noexcept {
+    return engine()._thread_pool->submit<syscall_result<int>>([this] {
+        ::nvme_passthru_cmd cmd{};
+        cmd.opcode = 0x00; // flush
+        cmd.nsid = _nsid;
+        return wrap_syscall<int>(::ioctl(_fd, NVME_IOCTL_IO_CMD, &cmd));
+    }).then([] (syscall_result<int> sr) {
+        sr.throw_if_error();
+        if (sr.result) {
+            throw std::system_error(EIO, std::system_category(), format("NVMe flush failed with status {:#x}", sr.result));
+        }
+    });
+}
+
+future<>
+nvme_file_impl::truncate(uint64_t length) noexcept {
+    return make_ready_future<>();
+}
+
+future<>
+nvme_file_impl::discard(uint64_t offset, uint64_t length) noexcept {
+    return engine()._thread_pool->submit<syscall_result<int>>([this, offset, length] {
+        // A single Dataset Management range, with the Deallocate attribute
+        struct {
+            uint32_t attributes;
+            uint32_t nlb;
+            uint64_t slba;
+        } range = { 0, uint32_t(length >> _lba_shift), offset >> _lba_shift };
+        ::nvme_passthru_cmd cmd{};
+        cmd.opcode = 0x09; // dataset management
+        cmd.nsid = _nsid;
+        cmd.addr = reinterpret_cast<uintptr_t>(&range);
+        cmd.data_len = sizeof(range);
+        cmd.cdw10 = 0; // number of ranges, zero based
+        cmd.cdw11 = 1 << 2; // deallocate
+        return wrap_syscall<int>(::ioctl(_fd, NVME_IOCTL_IO_CMD, &cmd));
+    }).then([] (syscall_result<int> sr) {
+        sr.throw_if_error();
+        if (sr.result) {
+            throw std::system_error(EIO, std::system_category(), format("NVMe deallocate failed with status {:#x}", sr.result));
+        }
+    });
+}
+
+future<uint64_t>
+nvme_file_impl::size() noexcept {
+    return make_ready_future<uint64_t>(_size);
+}
+
+future<>
+nvme_file_impl::allocate(uint64_t position, uint64_t length) noexcept {
+    // nothing to do for a raw device
+    return make_ready_future<>();
+}
+
+std::unique_ptr<seastar::file_handle_impl>
+nvme_file_impl::dup() {
+    throw std::runtime_error("NVMe passthrough files cannot be duplicated");
+}
+
+future<size_t>
+nvme_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept {
+    return do_io(true, pos, const_cast<char*>(static_cast<const char*>(buffer)), len, pc, intent);
+}
+
+future<size_t>
+nvme_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept {
+    return do_io(true, pos, std::move(iov), pc, intent);
+}
+
+future<size_t>
+nvme_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc, io_intent* intent) noexcept {
+    return do_io(false, pos, static_cast<char*>(buffer), len, pc, intent);
+}
+
+future<size_t>
+nvme_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc, io_intent* intent) noexcept {
+    return do_io(false, pos, std::move(iov), pc, intent);
+}
+
+future<temporary_buffer<uint8_t>>
+nvme_file_impl::dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc, io_intent* intent) noexcept {
+    return posix_file_impl::do_dma_read_bulk(offset, range_size, pc, intent);
+}
+
 append_challenged_posix_file_impl::append_challenged_posix_file_impl(int fd, open_flags f, file_open_options options, const fs_info& fsi, dev_t device_id)
         : posix_file_impl(fd, f, options, device_id, fsi)
         , _max_size_changing_ops(fsi.append_concurrency)
@@ -673,8 +979,13 @@ append_challenged_posix_file_impl::size_changing(const op& candidate) const noex
 
 bool
 append_challenged_posix_file_impl::may_dispatch(const op& candidate) const noexcept {
-    if (size_changing(candidate)) {
+    if (must_run_alone(candidate)) {
         return !_current_size_changing_ops && !_current_non_size_changing_ops;
+    } else if (appending_write(candidate)) {
+        // Appending writes are pipelined as far as the filesystem allows
+        // them to be, but never overlap other operations
+        return !_running_alone && !_current_non_size_changing_ops
+                && _current_size_changing_ops < std::max(_max_size_changing_ops, 1u);
     } else {
         return !_current_size_changing_ops;
     }
@@ -684,10 +995,15 @@ void
 append_challenged_posix_file_impl::dispatch(op& candidate) noexcept {
     unsigned* op_counter = size_changing(candidate)
             ? &_current_size_changing_ops : &_current_non_size_changing_ops;
+    bool alone = must_run_alone(candidate);
     ++*op_counter;
+    _running_alone |= alone;
     // FIXME: future is discarded
-    (void)candidate.run().then([me = shared_from_this(), op_counter] {
+    (void)candidate.run().then([me = shared_from_this(), op_counter, alone] {
         --*op_counter;
+        if (alone) {
+            me->_running_alone = false;
+        }
         me->process_queue();
     });
 }
@@ -707,9 +1023,13 @@ void append_challenged_posix_file_impl::truncate_to_logical_size() {
     }
 }
 
-// If we have a bunch of size-extending writes in the queue,
-// issue an ftruncate() extending the file size, so they can
-// be issued concurrently.
+// If we have a bunch of size-extending writes in the queue, more than
+// can run at once, or an appending write holds up other operations
+// behind it, issue an ftruncate() extending the file size, so they can
+// be issued concurrently. This batches the size updates ahead of the
+// writes: the file has to be idle for the ftruncate(), as the kernel
+// waits for in-flight direct I/O when changing the size, so it is done
+// once for everything queued.
 void
 append_challenged_posix_file_impl::optimize_queue() noexcept {
     if (_current_non_size_changing_ops || _current_size_changing_ops) {
@@ -718,6 +1038,7 @@ append_challenged_posix_file_impl::optimize_queue() noexcept {
     }
     auto speculative_size = _committed_size;
     unsigned n_appending_writes = 0;
+    bool holds_up_others = false;
     for (const auto& op : _q) {
         // stop calculating speculative size after a non-write, size-changing
         // operation is found to prevent an useless truncate from being issued.
@@ -728,10 +1049,12 @@ append_challenged_posix_file_impl::optimize_queue() noexcept {
         if (appending_write(op)) {
             speculative_size = std::max(speculative_size, op.pos + op.len);
             ++n_appending_writes;
+        } else if (n_appending_writes) {
+            holds_up_others = true;
         }
     }
     if (n_appending_writes > _max_size_changing_ops
-            || (n_appending_writes && _sloppy_size)) {
+            || (n_appending_writes && (_sloppy_size || holds_up_others))) {
         if (_sloppy_size) {
           if (!_committed_size) {
             speculative_size = std::max(speculative_size, _sloppy_size_hint);
@@ -993,6 +1316,45 @@ make_file_impl(int fd, file_open_options options, int flags) noexcept {
                         std::system_error(errno, std::system_category(), "ioctl(BLKBSZGET) failed"));
             }
             return make_ready_future<shared_ptr<file_impl>>(make_shared<blockdev_file_impl>(fd, open_flags(flags), options, st.st_rdev, block_size));
+        } else if (int nsid = S_ISCHR(st.st_mode) ? ::ioctl(fd, NVME_IOCTL_ID) : -1; nsid > 0) {
+            // An NVMe generic device, it only supports passthrough commands
+            if (!engine()._backend->supports_nvme_passthrough()) {
+                return make_exception_future<shared_ptr<file_impl>>(std::runtime_error(
+                        "NVMe generic devices need the io_uring reactor backend, on a kernel supporting NVMe passthrough"));
+            }
+            struct nvme_ns {
+                uint64_t size; // in logical blocks
+                unsigned lba_shift;
+            };
+            return engine()._thread_pool->submit<syscall_result_extra<nvme_ns>>([fd, nsid] {
+                // Identify Namespace: the size is at offset 0, the index of the
+                // format in use at offset 26, and the formats at offset 128
+                alignas(4096) static thread_local uint8_t data[4096];
+                ::nvme_admin_cmd cmd{};
+                cmd.opcode = 0x06; // identify
+                cmd.nsid = nsid;
+                cmd.addr = reinterpret_cast<uintptr_t>(data);
+                cmd.data_len = sizeof(data);
+                cmd.cdw10 = 0; // CNS: namespace
+                auto r = ::ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+                nvme_ns ns{};
+                if (r == 0) {
+                    std::memcpy(&ns.size, data, sizeof(ns.size));
+                    auto format = data[26] & 0xf;
+                    ns.lba_shift = data[128 + 4 * format + 2];
+                }
+                if (r > 0) {
+                    // The command failed with an NVMe status
+                    errno = EIO;
+                    r = -1;
+                }
+                return wrap_syscall(r, ns);
+            }).then([fd, nsid, flags, options = std::move(options), rdev = st.st_rdev] (syscall_result_extra<nvme_ns> sr) mutable {
+                sr.throw_if_error();
+                auto& ns = sr.extra;
+                return make_ready_future<shared_ptr<file_impl>>(make_shared<nvme_file_impl>(fd, open_flags(flags), std::move(options), rdev,
+                        nsid, ns.lba_shift, ns.size << ns.lba_shift));
+            });
         } else {
             if (S_ISDIR(st.st_mode)) {
                 // Directories don't care about block size, so we need not
@@ -1055,6 +1417,9 @@ make_file_impl(int fd, file_open_options options, int flags) noexcept {
                 });
             return get_fs_info.then([st_dev, fd, flags, options = std::move(options)] () mutable {
                 const fs_info& fsi = s_fstype[st_dev];
+                if (options.buffered) {
+                    return make_ready_future<shared_ptr<file_impl>>(make_shared<posix_buffered_file_impl>(fd, open_flags(flags), std::move(options), fsi, st_dev));
+                }
                 if (!fsi.append_challenged || options.append_is_unlikely || ((flags & O_ACCMODE) == O_RDONLY)) {
                     return make_ready_future<shared_ptr<file_impl>>(make_shared<posix_file_real_impl>(fd, open_flags(flags), std::move(options), fsi, st_dev));
                 }
@@ -19,9 +19,16 @@
  * Copyright 2020 ScyllaDB Ltd.
  */
 
+#include <climits>
+#include <map>
+
 #include <seastar/core/internal/pollable_fd.hh>
 #include <seastar/core/posix.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/do_with.hh>
 #include "fsnotify.hh"
 
 class seastar::fsnotifier::impl : public enable_shared_from_this<impl> {
@@ -36,6 +43,12 @@ class seastar::fsnotifier::impl : public enable_shared_from_this<impl> {
     };
     my_poll_fd _fd;
     watch_token _close_dummy = -1;
+
+    // inotify fails reads that can't hold the next event
+    static constexpr size_t min_read = sizeof(::inotify_event) + NAME_MAX + 1;
+
+    size_t drain(char* buf, size_t size);
+    std::vector<event> parse(const char* p, const char* e, bool coalesce);
 public:
     impl()
         : _fd(file_desc::inotify_init(IN_NONBLOCK | IN_CLOEXEC))
@@ -43,6 +56,7 @@ class seastar::fsnotifier::impl : public enable_shared_from_this<impl> {
     void remove_watch(watch_token);
     future<watch_token> create_watch(const sstring& path, flags events);
     future<std::vector<event>> wait();
+    future<std::vector<event>> wait(const batch_options&);
     void shutdown();
     bool active() const {
         return bool(_fd);
@@ -64,30 +78,67 @@ seastar::future<seastar::fsnotifier::watch_token> seastar::fsnotifier::impl::cre
     return engine().inotify_add_watch(_fd, path, uint32_t(events));
 }
 
+std::vector<seastar::fsnotifier::event> seastar::fsnotifier::impl::parse(const char* p, const char* e, bool coalesce) {
+    std::vector<event> events;
+    // the index of the event each watch and name was merged into
+    std::map<std::pair<watch_token, std::string_view>, size_t> merged;
+
+    while (p < e) {
+        auto ev = reinterpret_cast<const ::inotify_event*>(p);
+        p += sizeof(::inotify_event) + ev->len;
+        if (ev->wd == _close_dummy && _close_dummy != -1) {
+            _fd.close();
+            continue;
+        }
+        auto mask = flags(ev->mask);
+        std::string_view name = ev->len != 0 ? std::string_view(ev->name) : std::string_view();
+        if (coalesce && ev->cookie == 0 && (mask & (flags::overflow | flags::ignored)) == flags{}) {
+            auto [i, inserted] = merged.emplace(std::make_pair(ev->wd, name), events.size());
+            if (!inserted) {
+                events[i->second].mask |= mask;
+                continue;
+            }
+        }
+        events.emplace_back(event {
+            ev->wd, mask, ev->cookie, sstring(name)
+        });
+    }
+
+    return events;
+}
+
+size_t seastar::fsnotifier::impl::drain(char* buf, size_t size) {
+    size_t n = 0;
+    while (active() && size - n >= min_read) {
+        auto r = ::read(_fd, buf + n, size - n);
+        if (r <= 0) {
+            // EINVAL: the next event is too large for what is left
+            throw_system_error_on(r == -1 && errno != EAGAIN && errno != EINVAL, "could not read inotify events");
+            break;
+        }
+        n += r;
+    }
+    return n;
+}
+
 seastar::future<std::vector<seastar::fsnotifier::event>> seastar::fsnotifier::impl::wait() {
     // be paranoid about buffer alignment
     auto buf = temporary_buffer<char>::aligned(std::max(alignof(::inotify_event), alignof(int64_t)), 4096);
     auto f = _fd.read_some(buf.get_write(), buf.size());
     return f.then([me = shared_from_this(), buf = std::move(buf)](size_t n) {
-        auto p = buf.get();
-        auto e = buf.get() + n;
-
-        std::vector<event> events;
-
-        while (p < e) {
-            auto ev = reinterpret_cast<const ::inotify_event*>(p);
-            if (ev->wd == me->_close_dummy && me->_close_dummy != -1) {
-                me->_fd.close();                
-            } else {
-                events.emplace_back(event {
-                    ev->wd, flags(ev->mask), ev->cookie,
-                    ev->len != 0 ? sstring(ev->name) : sstring{}
-                });
-            }
-            p += sizeof(::inotify_event) + ev->len;
-        }
+        return me->parse(buf.get(), buf.get() + n, false);
+    });
+}
 
-        return events;
+seastar::future<std::vector<seastar::fsnotifier::event>> seastar::fsnotifier::impl::wait(const batch_options& opts) {
+    auto buf = temporary_buffer<char>::aligned(std::max(alignof(::inotify_event), alignof(int64_t)), std::max(opts.max_batch_bytes, min_read));
+    auto f = _fd.read_some(buf.get_write(), buf.size());
+    return f.then([me = shared_from_this(), buf = std::move(buf), opts](size_t n) mutable {
+        auto window = opts.window.count() ? seastar::sleep(opts.window) : make_ready_future<>();
+        return window.then([me = std::move(me), buf = std::move(buf), opts, n] () mutable {
+            n += me->drain(buf.get_write() + n, buf.size() - n);
+            return me->parse(buf.get(), buf.get() + n, opts.coalesce);
+        });
     });
 }
 
@@ -142,6 +193,10 @@ seastar::future<std::vector<seastar::fsnotifier::event>> seastar::fsnotifier::wa
     return _impl->wait();
 }
 
+seastar::future<std::vector<seastar::fsnotifier::event>> seastar::fsnotifier::wait(const batch_options& opts) const {
+    return _impl->wait(opts);
+}
+
 void seastar::fsnotifier::shutdown() {
     _impl->shutdown();
 }
@@ -149,3 +204,105 @@ void seastar::fsnotifier::shutdown() {
 bool seastar::fsnotifier::active() const {
     return _impl->active();
 }
+
+// the events the watcher needs to follow the tree, whatever the caller
+// asked for
+static constexpr seastar::fsnotifier::flags tree_flags = seastar::fsnotifier::flags(IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+
+seastar::recursive_fsnotifier::recursive_fsnotifier(sstring root, flags mask, size_t max_watches)
+    : _root(std::move(root))
+    , _mask(mask)
+    , _max_watches(max_watches)
+{}
+
+seastar::sstring seastar::recursive_fsnotifier::absolute(const sstring& path) const {
+    return path.empty() ? _root : _root + "/" + path;
+}
+
+void seastar::recursive_fsnotifier::moved(watched_dir& dir, sstring path) {
+    // the directories under it moved along
+    auto old_prefix = dir.path + "/";
+    for (auto& [token, d] : _dirs) {
+        if (d.path.size() > old_prefix.size() && std::string_view(d.path).substr(0, old_prefix.size()) == old_prefix) {
+            d.path = path + "/" + d.path.substr(old_prefix.size());
+        }
+    }
+    dir.path = std::move(path);
+}
+
+seastar::future<> seastar::recursive_fsnotifier::add_tree(sstring path) {
+    if (_dirs.size() >= _max_watches) {
+        return make_exception_future<>(std::runtime_error(format("more than {} directories to watch under {}", _max_watches, _root)));
+    }
+    return _notifier.create_watch(absolute(path), _mask | tree_flags).then([this, path] (fsnotifier::watch w) {
+        auto i = _dirs.find(w.token());
+        if (i != _dirs.end()) {
+            // inotify has a single watch per directory; this one was
+            // moved within the tree
+            w.release();
+            moved(i->second, path);
+        } else {
+            _dirs.emplace(w.token(), watched_dir{path, std::move(w)});
+        }
+        return open_directory(absolute(path));
+    }).then([this, path] (file dir) {
+        return do_with(std::move(dir), [this, path] (file& dir) {
+            auto listing = dir.list_directory([this, path] (directory_entry de) {
+                auto sub = path.empty() ? de.name : path + "/" + de.name;
+                auto type = de.type ? make_ready_future<std::optional<directory_entry_type>>(de.type) : file_type(absolute(sub), follow_symlink::no);
+                return type.then([this, sub = std::move(sub)] (std::optional<directory_entry_type> type) {
+                    return type == directory_entry_type::directory ? add_tree(std::move(sub)) : make_ready_future<>();
+                });
+            });
+            return do_with(std::move(listing), [&dir] (auto& listing) {
+                return listing.done().finally([&dir] {
+                    return dir.close();
+                });
+            });
+        });
+    });
+}
+
+seastar::future<> seastar::recursive_fsnotifier::start() {
+    return add_tree("");
+}
+
+seastar::future<std::vector<seastar::recursive_fsnotifier::event>> seastar::recursive_fsnotifier::wait(const fsnotifier::batch_options& opts) {
+    return _notifier.wait(opts).then([this] (std::vector<fsnotifier::event> events) {
+        return do_with(std::move(events), std::vector<event>(), [this] (std::vector<fsnotifier::event>& in, std::vector<event>& out) {
+            return do_for_each(in, [this, &out] (fsnotifier::event& e) {
+                if ((e.mask & flags::overflow) != flags{}) {
+                    out.push_back(event{flags::overflow, 0, {}});
+                    return make_ready_future<>();
+                }
+                auto i = _dirs.find(e.id);
+                if (i == _dirs.end()) {
+                    return make_ready_future<>();
+                }
+                auto& dir = i->second.path;
+                auto path = e.name.empty() ? dir : dir.empty() ? e.name : dir + "/" + e.name;
+                if ((e.mask & flags::ignored) != flags{}) {
+                    // the watch is gone with its directory
+                    i->second.watch.release();
+                    _dirs.erase(i);
+                    return make_ready_future<>();
+                }
+                if ((e.mask & _mask) != flags{}) {
+                    out.push_back(event{e.mask & (_mask | flags::is_dir), e.seq, path});
+                }
+                if ((e.mask & flags::is_dir) != flags{} && (e.mask & (flags::create_child | flags::move_to)) != flags{}) {
+                    return add_tree(std::move(path)).handle_exception([&out] (std::exception_ptr) {
+                        out.push_back(event{flags::overflow, 0, {}});
+                    });
+                }
+                return make_ready_future<>();
+            }).then([&out] {
+                return std::move(out);
+            });
+        });
+    });
+}
+
+void seastar::recursive_fsnotifier::shutdown() {
+    _notifier.shutdown();
+}
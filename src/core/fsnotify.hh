@@ -21,7 +21,9 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <unordered_map>
 #include <sys/inotify.h>
 
 #include <seastar/core/future.hh>
@@ -78,6 +80,8 @@ class fsnotifier {
                                         // DIR results if pathname is not a directory.  Using this
                                         // flag provides an application with a race-free way of
                                         // ensuring that the monitored object is a directory.
+        is_dir = IN_ISDIR,              // Set in events about a directory.
+        overflow = IN_Q_OVERFLOW,       // The event queue overflowed, events were lost.
     };
 
     using watch_token = int32_t;
@@ -127,8 +131,22 @@ class fsnotifier {
         sstring name; // optional file name, in case of move_from/to
     };
 
-    // wait for events
+    // how wait() gathers events into a batch
+    struct batch_options {
+        // the inotify data read per batch, which bounds its memory
+        size_t max_batch_bytes = 64 * 1024;
+        // merge the events of a watch and name into the first of them,
+        // or-ing their masks. Moves and queue overflows are kept apart.
+        bool coalesce = true;
+        // once events arrive, wait this long for more to join the batch
+        std::chrono::milliseconds window{0};
+    };
+
+    // wait for events, returning a single read of them
     future<std::vector<event>> wait() const;
+    // wait for events, returning all that are queued, up to the options'
+    // limit
+    future<std::vector<event>> wait(const batch_options&) const;
 
     // shutdown notifier and abort any event wait.
     // all watches are invalidated, and no new ones can be
@@ -142,6 +160,63 @@ class fsnotifier {
     }
 };
 
+/**
+ * Watches a directory and the directories under it, including the ones
+ * created or moved in while watching. Events name their file by its
+ * path relative to the root.
+ *
+ * There is one inotify watch per directory, up to max_watches of them,
+ * so memory stays bounded however large the tree. Events inside a new
+ * directory that happen before it is watched are lost. When the watcher
+ * loses track, because the kernel queue overflowed or a directory could
+ * not be watched, it reports an event with the overflow flag and an
+ * empty path; the caller should rescan the tree.
+ */
+class recursive_fsnotifier {
+public:
+    using flags = fsnotifier::flags;
+
+    struct event {
+        // event(s) generated
+        flags mask;
+        // event correlation -> move_from+move_to
+        fsnotifier::sequence_no seq;
+        // relative to the root, empty for the root itself
+        sstring path;
+    };
+
+    recursive_fsnotifier(sstring root, flags mask, size_t max_watches = 8192);
+
+    // watch the tree as it is now; fails if it has more than max_watches
+    // directories
+    future<> start();
+
+    // wait for events, batched as fsnotifier::wait() does
+    future<std::vector<event>> wait(const fsnotifier::batch_options& opts = {});
+
+    // shutdown notifier and abort any event wait.
+    void shutdown();
+
+    size_t watch_count() const {
+        return _dirs.size();
+    }
+private:
+    struct watched_dir {
+        sstring path;
+        fsnotifier::watch watch;
+    };
+
+    fsnotifier _notifier;
+    sstring _root;
+    flags _mask;
+    size_t _max_watches;
+    std::unordered_map<fsnotifier::watch_token, watched_dir> _dirs;
+
+    sstring absolute(const sstring& path) const;
+    future<> add_tree(sstring path);
+    void moved(watched_dir& dir, sstring path);
+};
+
 inline fsnotifier::flags operator|(fsnotifier::flags a, fsnotifier::flags b) {
     return fsnotifier::flags(std::underlying_type_t<fsnotifier::flags>(a) | std::underlying_type_t<fsnotifier::flags>(b));
 }
@@ -22,12 +22,16 @@
 #include <seastar/core/fstream.hh>
 #include <seastar/core/align.hh>
 #include <seastar/core/circular_buffer.hh>
+#include <seastar/core/dma_buffer_pool.hh>
 #include <seastar/core/semaphore.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/when_all.hh>
 #include <seastar/core/io_intent.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/with_scheduling_group.hh>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
+#include <limits.h>
 #include <malloc.h>
 #include <string.h>
 
@@ -83,7 +87,60 @@ class file_data_source_impl : public data_source_impl {
     bool _in_slow_start = false;
     io_intent _intent;
     using unused_ratio_target = std::ratio<25, 100>;
+    // Adaptive read-ahead state, see file_input_stream_options::max_read_ahead
+    size_t _max_read_size;
+    double _best_ns_per_byte = std::numeric_limits<double>::max();
+    unsigned _reads_to_settle = 0;
 private:
+    bool adaptive() const noexcept {
+        return _options.max_read_ahead != 0;
+    }
+
+    size_t read_ahead_window() const noexcept {
+        return _current_buffer_size * (_current_read_ahead + 1);
+    }
+
+    // The consumer had to wait, read ahead more. Larger reads are cheaper
+    // than more of them, so merge first and only then go parallel.
+    void grow_read_ahead_window() {
+        if (_in_slow_start) {
+            return;
+        }
+        if (_current_buffer_size * 2 <= _max_read_size && (_current_read_ahead + 1) * _current_buffer_size * 2 <= _options.max_read_ahead) {
+            _current_buffer_size *= 2;
+        } else if (read_ahead_window() + _current_buffer_size <= _options.max_read_ahead) {
+            _current_read_ahead++;
+        }
+    }
+
+    void shrink_read_ahead_window() {
+        if (_current_read_ahead > 1) {
+            _current_read_ahead /= 2;
+        } else if (_current_buffer_size / 2 >= _options.buffer_size) {
+            _current_buffer_size /= 2;
+        }
+    }
+
+    // Reads that take twice as long per byte as the best seen recently
+    // mean the device is busy or the I/O queue is backlogged. The best
+    // value slowly decays so that it follows the device over time.
+    void on_read_completed(std::chrono::steady_clock::duration latency, size_t len) {
+        if (!len) {
+            return;
+        }
+        double ns_per_byte = double(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()) / len;
+        _best_ns_per_byte = std::min(_best_ns_per_byte * 1.01, ns_per_byte);
+        if (_reads_to_settle) {
+            _reads_to_settle--;
+            return;
+        }
+        if (ns_per_byte > 2 * _best_ns_per_byte) {
+            shrink_read_ahead_window();
+            // Reads already in flight were issued with the old window
+            _reads_to_settle = _reads_in_progress - 1;
+        }
+    }
+
     size_t minimal_buffer_size() const {
         return std::min(std::max(_options.buffer_size / 4, size_t(8192)), _options.buffer_size);
     }
@@ -101,6 +158,9 @@ class file_data_source_impl : public data_source_impl {
         }
     }
     unsigned get_initial_read_ahead() const {
+        if (_options.max_read_ahead) {
+            return 1;
+        }
         return _options.dynamic_adjustments
                ? std::min(_options.dynamic_adjustments->read_ahead, _options.read_ahead)
                : !!_options.read_ahead;
@@ -195,6 +255,7 @@ class file_data_source_impl : public data_source_impl {
     {
         _options.buffer_size = select_buffer_size(_options.buffer_size, _file.disk_read_max_length());
         _current_buffer_size = _options.buffer_size;
+        _max_read_size = select_buffer_size(std::max(_options.max_read_ahead, _options.buffer_size), _file.disk_read_max_length());
         // prevent wraparounds
         set_new_buffer_size(after_skip::no);
         _remain = std::min(std::numeric_limits<uint64_t>::max() - _pos, _remain);
@@ -206,7 +267,11 @@ class file_data_source_impl : public data_source_impl {
     }
     virtual future<temporary_buffer<char>> get() override {
         if (!_read_buffers.empty() && !_read_buffers.front()._ready.available()) {
-            try_increase_read_ahead();
+            if (adaptive()) {
+                grow_read_ahead_window();
+            } else {
+                try_increase_read_ahead();
+            }
         }
         issue_read_aheads(1);
         auto ret = std::move(_read_buffers.front());
@@ -294,7 +359,10 @@ class file_data_source_impl : public data_source_impl {
             _read_buffers.emplace_back(_pos, actual_size, futurize_invoke([&] {
                     return _file.dma_read_bulk<char>(start, len, _options.io_priority_class, &_intent);
             }).then_wrapped(
-                    [this, start, pos = _pos, remain = _remain] (future<temporary_buffer<char>> ret) {
+                    [this, start, len, pos = _pos, remain = _remain, issued = std::chrono::steady_clock::now()] (future<temporary_buffer<char>> ret) {
+                if (adaptive() && !ret.failed() && !_done) {
+                    on_read_completed(std::chrono::steady_clock::now() - issued, len);
+                }
                 --_reads_in_progress;
                 if (_done && !_reads_in_progress) {
                     _done->set_value();
@@ -355,36 +423,106 @@ class file_data_sink_impl : public data_sink_impl {
     semaphore _write_behind_sem = { _options.write_behind };
     future<> _background_writes_done = make_ready_future<>();
     bool _failed = false;
+    // End of the range preallocated so far, and the allocation extending
+    // it, if any
+    uint64_t _preallocated = 0;
+    future<> _preallocation = make_ready_future<>();
+    bool _preallocating = false;
 public:
     file_data_sink_impl(file f, file_output_stream_options options)
             : _file(std::move(f)), _options(options) {
         _options.buffer_size = select_buffer_size<unsigned>(_options.buffer_size, _file.disk_write_max_length());
         _write_behind_sem.ensure_space_for_waiters(1); // So that wait() doesn't throw
     }
-    future<> put(net::packet data) override { abort(); }
     virtual temporary_buffer<char> allocate_buffer(size_t size) override {
-        return temporary_buffer<char>::aligned(_file.memory_dma_alignment(), size);
+        return allocate_dma_buffer(_file.memory_dma_alignment(), size);
     }
     using data_sink_impl::put;
     virtual future<> put(temporary_buffer<char> buf) override {
         uint64_t pos = _pos;
         _pos += buf.size();
-        if (!_options.write_behind) {
+        maybe_preallocate();
+        return write_behind([this, pos, buf = std::move(buf)] () mutable {
             return do_put(pos, std::move(buf));
+        });
+    }
+    // Zero-copy writes: if the fragments are suitably aligned, they are
+    // written with a single vectored dma_write(), otherwise they are
+    // copied into a buffer.
+    virtual future<> put(net::packet data) override {
+        if (!can_write_vectored(data)) {
+            auto buf = allocate_buffer(data.len());
+            auto p = buf.get_write();
+            for (auto&& f : data.fragments()) {
+                p = std::copy_n(f.base, f.size, p);
+            }
+            return put(std::move(buf));
+        }
+        uint64_t pos = _pos;
+        _pos += data.len();
+        maybe_preallocate();
+        return write_behind([this, pos, data = std::move(data)] () mutable {
+            return do_put(pos, std::move(data));
+        });
+    }
+private:
+    // Extends the preallocated range in the background when the writes get
+    // close to its end, so that they don't wait for it. Only one extent is
+    // allocated at a time, a stream outrunning the allocations skips the
+    // extents it already passed.
+    void maybe_preallocate() noexcept {
+        uint64_t extent = _options.preallocation_size;
+        uint64_t headroom = _options.preallocation_headroom ? _options.preallocation_headroom : extent / 2;
+        if (!extent || _preallocating || _pos + headroom <= _preallocated) {
+            return;
+        }
+        auto start = std::max(_preallocated, _pos);
+        _preallocating = true;
+        _preallocation = with_scheduling_group(_options.preallocation_scheduling_group, [this, start, extent] {
+            return _file.allocate(start, extent);
+        }).then_wrapped([this, end = start + extent] (future<> f) {
+            _preallocating = false;
+            if (f.failed()) {
+                // Preallocation is only an optimization; if it can't be
+                // done the writes will still allocate what they need
+                f.ignore_ready_future();
+                _options.preallocation_size = 0;
+            } else {
+                _preallocated = end;
+            }
+        });
+    }
+    bool can_write_vectored(const net::packet& data) const noexcept {
+        if (data.nr_frags() > IOV_MAX) {
+            return false;
+        }
+        auto mem_align = _file.memory_dma_alignment();
+        auto disk_align = _file.disk_write_dma_alignment();
+        for (auto&& f : data.fragments()) {
+            if ((reinterpret_cast<uintptr_t>(f.base) & (mem_align - 1)) || (f.size & (disk_align - 1))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    template <typename Func>
+    future<> write_behind(Func&& write) {
+        if (!_options.write_behind) {
+            return write();
         }
         // Write behind strategy:
         //
         // 1. Issue N writes in parallel, using a semaphore to limit to N
         // 2. Collect results in _background_writes_done, merging exception futures
         // 3. If we've already seen a failure, don't issue more writes.
-        return _write_behind_sem.wait().then([this, pos, buf = std::move(buf)] () mutable {
+        return _write_behind_sem.wait().then([this, write = std::forward<Func>(write)] () mutable {
             if (_failed) {
                 _write_behind_sem.signal();
                 auto ret = std::move(_background_writes_done);
                 _background_writes_done = make_ready_future<>();
                 return ret;
             }
-            auto this_write_done = do_put(pos, std::move(buf)).finally([this] {
+            auto this_write_done = write().finally([this] {
                 _write_behind_sem.signal();
             });
             _background_writes_done = when_all(std::move(_background_writes_done), std::move(this_write_done))
@@ -405,7 +543,27 @@ class file_data_sink_impl : public data_sink_impl {
             return make_ready_future<>();
         });
     }
-private:
+    future<> do_put(uint64_t pos, net::packet data) noexcept {
+      try {
+        assert(!(pos & (_file.disk_write_dma_alignment() - 1)));
+        std::vector<iovec> iov;
+        iov.reserve(data.nr_frags());
+        for (auto&& f : data.fragments()) {
+            iov.push_back(iovec{f.base, f.size});
+        }
+        return _file.dma_write(pos, std::move(iov), _options.io_priority_class).then(
+                [this, pos, data = std::move(data)] (size_t size) mutable {
+            // short write handling
+            if (size < data.len()) {
+                data.trim_front(size);
+                return do_put(pos + size, std::move(data));
+            }
+            return make_ready_future<>();
+        });
+      } catch (...) {
+          return make_exception_future<>(std::current_exception());
+      }
+    }
     future<> do_put(uint64_t pos, temporary_buffer<char> buf) noexcept {
       try {
         // put() must usually be of chunks multiple of file::dma_alignment.
@@ -456,12 +614,13 @@ class file_data_sink_impl : public data_sink_impl {
             return std::exchange(_background_writes_done, make_ready_future<>());
         }).finally([this] {
             _write_behind_sem.signal(_options.write_behind);
+            return std::exchange(_preallocation, make_ready_future<>());
         });
     }
 public:
     virtual future<> flush() override {
         return wait().then([this] {
-            return _file.flush();
+            return _options.flush_group ? _options.flush_group->flush() : _file.flush();
         });
     }
     virtual future<> close() noexcept override {
@@ -472,6 +631,42 @@ class file_data_sink_impl : public data_sink_impl {
     virtual size_t buffer_size() const noexcept override { return _options.buffer_size; }
 };
 
+group_commit::group_commit(file f, std::chrono::steady_clock::duration window) noexcept
+        : _file(std::move(f)), _window(window) {
+}
+
+future<> group_commit::flush() noexcept {
+    _stats.requests++;
+    if (_next) {
+        return _next->get_shared_future();
+    }
+    try {
+        _next = make_lw_shared<shared_promise<>>();
+    } catch (...) {
+        return current_exception_as_future();
+    }
+    auto ret = _next->get_shared_future();
+    _in_flight = _in_flight.then([this] {
+        return _window.count() ? sleep(_window) : make_ready_future<>();
+    }).then([this] {
+        // Requests made from now on wait for the next flush
+        auto batch = std::exchange(_next, nullptr);
+        _stats.flushes++;
+        return _file.flush().then_wrapped([batch = std::move(batch)] (future<> f) {
+            if (f.failed()) {
+                batch->set_exception(f.get_exception());
+            } else {
+                batch->set_value();
+            }
+        });
+    });
+    return ret;
+}
+
+future<> group_commit::close() noexcept {
+    return std::exchange(_in_flight, make_ready_future<>());
+}
+
 SEASTAR_INCLUDE_API_V2 namespace api_v2 {
 
 data_sink make_file_data_sink(file f, file_output_stream_options options) {
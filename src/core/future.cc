@@ -255,6 +255,8 @@ void internal::future_base::do_wait() noexcept {
 #ifdef SEASTAR_COROUTINES_ENABLED
 void internal::future_base::set_coroutine(task& coroutine) noexcept {
     assert(_promise);
+    // The coroutine resumes with the values it has when suspending
+    coroutine.inherit_task_local_values();
     _promise->_task = &coroutine;
 }
 #endif
@@ -0,0 +1,141 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/heap_profile.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/http/function_handlers.hh>
+#include <seastar/http/exception.hh>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <iterator>
+
+namespace seastar {
+
+namespace heap_profile {
+
+using namespace httpd;
+
+namespace internal {
+
+/*
+ * The legacy (pre-protobuf) heap profile format of gperftools, still read by
+ * pprof. heap_v2 tells pprof that the counts are sampled with the given mean
+ * period, so that it scales them back up. Each live allocation site is one
+ * line, in-use and allocated values are the same since only live objects
+ * are tracked. The memory map lets pprof symbolize the addresses.
+ */
+sstring format_profile(const std::vector<shard_profile>& profiles) {
+    size_t total_count = 0;
+    size_t total_size = 0;
+    for (auto& p : profiles) {
+        for (auto& e : p.entries) {
+            total_count += e.count;
+            total_size += e.size;
+        }
+    }
+    fmt::memory_buffer out;
+    auto it = std::back_inserter(out);
+    it = fmt::format_to(it, "heap profile: {}: {} [{}: {}] @ heap_v2/{}\n", total_count, total_size, total_count, total_size,
+            std::max<size_t>(profiles.front().sample_period, 1));
+    for (auto& p : profiles) {
+        for (auto& e : p.entries) {
+            it = fmt::format_to(it, "{}: {} [{}: {}] @", e.count, e.size, e.count, e.size);
+            for (auto addr : e.backtrace) {
+                it = fmt::format_to(it, " {:#x}", addr);
+            }
+            it = fmt::format_to(it, "\n");
+        }
+    }
+    // A pseudo-file generated from memory, reading it doesn't block
+    std::ifstream maps("/proc/self/maps");
+    it = fmt::format_to(it, "\nMAPPED_LIBRARIES:\n");
+    std::copy(std::istreambuf_iterator<char>(maps), std::istreambuf_iterator<char>(), it);
+    return sstring(out.data(), out.size());
+}
+
+}
+
+namespace {
+
+future<std::vector<internal::shard_profile>> collect_profiles() {
+    return do_with(std::vector<internal::shard_profile>(smp::count), [] (std::vector<internal::shard_profile>& profiles) {
+        return smp::invoke_on_all([&profiles] {
+            profiles[this_shard_id()] = internal::shard_profile{memory::get_heap_profiling_sample_period(), memory::get_heap_profile()};
+        }).then([&profiles] {
+            return std::move(profiles);
+        });
+    });
+}
+
+future<std::unique_ptr<reply>> get_profile(std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    return collect_profiles().then([rep = std::move(rep)] (std::vector<internal::shard_profile> profiles) mutable {
+        rep->write_body("txt", internal::format_profile(profiles));
+        return std::move(rep);
+    });
+}
+
+future<std::unique_ptr<reply>> configure_profiler(std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    std::optional<bool> enable;
+    std::optional<size_t> sample_period;
+    if (auto v = req->get_query_param("enable"); !v.empty()) {
+        if (v != "true" && v != "false") {
+            throw bad_param_exception("enable must be true or false");
+        }
+        enable = v == "true";
+    }
+    if (auto v = req->get_query_param("sample_period"); !v.empty()) {
+        try {
+            sample_period = boost::lexical_cast<size_t>(v);
+        } catch (boost::bad_lexical_cast&) {
+            throw bad_param_exception("sample_period must be a number of bytes");
+        }
+    }
+    return smp::invoke_on_all([enable, sample_period] {
+        // Set the period first, so that enabling never records every allocation
+        if (sample_period) {
+            memory::set_heap_profiling_sample_period(*sample_period);
+        }
+        if (enable) {
+            memory::set_heap_profiling_enabled(*enable);
+        }
+    }).then([rep = std::move(rep)] () mutable {
+        rep->set_status(reply::status_type::ok);
+        return std::move(rep);
+    });
+}
+
+}
+
+future<> add_heap_profile_routes(http_server& server, sstring path) {
+    server._routes.put(GET, path, new function_handler(future_handler_function(get_profile), "txt"));
+    server._routes.put(POST, path, new function_handler(future_handler_function(configure_profiler), "txt"));
+    return make_ready_future<>();
+}
+
+future<> add_heap_profile_routes(distributed<http_server>& server, sstring path) {
+    return server.invoke_on_all([path] (http_server& s) {
+        return add_heap_profile_routes(s, path);
+    });
+}
+
+}
+}
@@ -23,20 +23,28 @@
 #include <boost/intrusive/parent_from_member.hpp>
 #include <seastar/core/file.hh>
 #include <seastar/core/fair_queue.hh>
+#include <seastar/core/fstream.hh>
 #include <seastar/core/io_queue.hh>
 #include <seastar/core/io_intent.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/metrics.hh>
+#include <seastar/core/timed_out_error.hh>
 #include <seastar/core/linux-aio.hh>
 #include <seastar/core/internal/io_desc.hh>
 #include <seastar/core/internal/io_sink.hh>
 #include <seastar/core/io_priority_class.hh>
+#include <seastar/core/bitops.hh>
 #include <seastar/util/log.hh>
+#include "core/syscall_result.hh"
+#include "core/thread_pool.hh"
 #include <chrono>
 #include <mutex>
 #include <array>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 
 namespace seastar {
 
@@ -52,6 +60,10 @@ struct default_io_exception_factory {
     static auto cancelled() {
         return cancelled_error();
     }
+
+    static auto timed_out() {
+        return timed_out_error();
+    }
 };
 
 class io_queue::priority_class_data {
@@ -68,12 +80,34 @@ class io_queue::priority_class_data {
     } _rwstat[2] = {};
     uint32_t _nr_queued;
     uint32_t _nr_executing;
+    uint64_t _nr_expired = 0;
     std::chrono::duration<double> _queue_time;
     std::chrono::duration<double> _total_queue_time;
     std::chrono::duration<double> _total_execution_time;
     std::chrono::duration<double> _starvation_time;
     io_queue::clock_type::time_point _activated;
 
+    using latency_histogram = std::array<uint64_t, io_queue::latency_buckets>;
+    latency_histogram _queue_time_hist = {};
+    latency_histogram _execution_time_hist = {};
+
+    // Exported with one bucket per octave, in microseconds, like the
+    // other latency histograms
+    static metrics::histogram to_metrics_histogram(const latency_histogram& hist, std::chrono::duration<double> total) {
+        metrics::histogram h;
+        h.sample_sum = total.count() * 1e6;
+        h.buckets.reserve(io_queue::latency_buckets / 4);
+        for (unsigned i = 0; i < io_queue::latency_buckets; i++) {
+            h.sample_count += hist[i];
+            if (i % 4 == 3) {
+                auto& b = h.buckets.emplace_back();
+                b.count = h.sample_count;
+                b.upper_bound = io_queue::latency_bucket_limit(i).count() * 1e6;
+            }
+        }
+        return h;
+    }
+
 public:
     void update_shares(uint32_t shares) noexcept {
         _shares = std::max(shares, 1u);
@@ -104,6 +138,7 @@ class io_queue::priority_class_data {
         _rwstat[dnl.rw_idx()].add(dnl.length());
         _queue_time = lat;
         _total_queue_time += lat;
+        _queue_time_hist[io_queue::latency_bucket(lat)]++;
         _nr_queued--;
         _nr_executing++;
         if (_nr_executing == 1) {
@@ -115,8 +150,14 @@ class io_queue::priority_class_data {
         _nr_queued--;
     }
 
+    void on_expire() noexcept {
+        _nr_queued--;
+        _nr_expired++;
+    }
+
     void on_complete(std::chrono::duration<double> lat) noexcept {
         _total_execution_time += lat;
+        _execution_time_hist[io_queue::latency_bucket(lat)]++;
         _nr_executing--;
         if (_nr_executing == 0 && _nr_queued != 0) {
             _activated = io_queue::clock_type::now();
@@ -131,6 +172,7 @@ class io_queue::priority_class_data {
     }
 
     fair_queue::class_id fq_class() const noexcept { return _pc.id(); }
+    const io_priority_class& pc() const noexcept { return _pc; }
 
     std::vector<seastar::metrics::impl::metric_definition_impl> metrics();
     metrics::metric_groups metric_groups;
@@ -143,18 +185,40 @@ class io_desc_read_write final : public io_completion {
     const stream_id _stream;
     fair_queue_ticket _fq_ticket;
     promise<size_t> _pr;
+    // For tracing
+    io_queue::clock_type::time_point _queued;
+    io_direction_and_length _dnl;
+    uint64_t _pos;
+
+    void trace(io_queue::trace_outcome outcome) noexcept {
+        if (_ioq.tracing()) {
+            auto ns = [] (io_queue::clock_type::time_point t) {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+            };
+            _ioq.add_trace_record(io_queue::trace_record{
+                ns(_queued), ns(_dispatched), ns(io_queue::clock_type::now()),
+                _pos, uint32_t(_dnl.length()), _fq_ticket.weight(), _fq_ticket.size(),
+                uint16_t(_pclass.fq_class()), _dnl.is_write(), outcome,
+            });
+        }
+    }
 
 public:
-    io_desc_read_write(io_queue& ioq, io_queue::priority_class_data& pc, stream_id stream, fair_queue_ticket ticket)
+    io_desc_read_write(io_queue& ioq, io_queue::priority_class_data& pc, stream_id stream, fair_queue_ticket ticket,
+            io_queue::clock_type::time_point queued, io_direction_and_length dnl, uint64_t pos)
         : _ioq(ioq)
         , _pclass(pc)
         , _stream(stream)
         , _fq_ticket(ticket)
+        , _queued(queued)
+        , _dnl(dnl)
+        , _pos(pos)
     {}
 
     virtual void set_exception(std::exception_ptr eptr) noexcept override {
         io_log.trace("dev {} : req {} error", _ioq.dev_id(), fmt::ptr(this));
         _pclass.on_error();
+        trace(io_queue::trace_outcome::failed);
         _ioq.complete_request(*this);
         _pr.set_exception(eptr);
         delete this;
@@ -163,7 +227,10 @@ class io_desc_read_write final : public io_completion {
     virtual void complete(size_t res) noexcept override {
         io_log.trace("dev {} : req {} complete", _ioq.dev_id(), fmt::ptr(this));
         auto now = io_queue::clock_type::now();
-        _pclass.on_complete(std::chrono::duration_cast<std::chrono::duration<double>>(now - _dispatched));
+        auto lat = std::chrono::duration_cast<std::chrono::duration<double>>(now - _dispatched);
+        _pclass.on_complete(lat);
+        _ioq.account_latency(now, lat);
+        trace(io_queue::trace_outcome::completed);
         _ioq.complete_request(*this);
         _pr.set_value(res);
         delete this;
@@ -171,10 +238,18 @@ class io_desc_read_write final : public io_completion {
 
     void cancel() noexcept {
         _pclass.on_cancel();
+        trace(io_queue::trace_outcome::cancelled);
         _pr.set_exception(std::make_exception_ptr(default_io_exception_factory::cancelled()));
         delete this;
     }
 
+    void expire() noexcept {
+        _pclass.on_expire();
+        trace(io_queue::trace_outcome::expired);
+        _pr.set_exception(std::make_exception_ptr(default_io_exception_factory::timed_out()));
+        delete this;
+    }
+
     void dispatch(io_direction_and_length dnl, io_queue::clock_type::time_point queued) noexcept {
         auto now = io_queue::clock_type::now();
         _pclass.on_dispatch(dnl, std::chrono::duration_cast<std::chrono::duration<double>>(now - queued));
@@ -187,6 +262,7 @@ class io_desc_read_write final : public io_completion {
 
     fair_queue_ticket ticket() const noexcept { return _fq_ticket; }
     stream_id stream() const noexcept { return _stream; }
+    fair_queue::class_id fq_class() const noexcept { return _pclass.fq_class(); }
 };
 
 class queued_io_request : private internal::io_request {
@@ -198,8 +274,6 @@ class queued_io_request : private internal::io_request {
     internal::cancellable_queue::link _intent;
     std::unique_ptr<io_desc_read_write> _desc;
 
-    bool is_cancelled() const noexcept { return !_desc; }
-
 public:
     queued_io_request(internal::io_request req, io_queue& q, io_queue::priority_class_data& pc, io_direction_and_length dnl)
         : io_request(std::move(req))
@@ -208,7 +282,7 @@ class queued_io_request : private internal::io_request {
         , _started(io_queue::clock_type::now())
         , _stream(_ioq.request_stream(_dnl))
         , _fq_entry(_ioq.request_fq_ticket(dnl))
-        , _desc(std::make_unique<io_desc_read_write>(_ioq, pc, _stream, _fq_entry.ticket()))
+        , _desc(std::make_unique<io_desc_read_write>(_ioq, pc, _stream, _fq_entry.ticket(), _started, _dnl, pos()))
     {
         io_log.trace("dev {} : req {} queue  len {} ticket {}", _ioq.dev_id(), fmt::ptr(&*_desc), _dnl.length(), _fq_entry.ticket());
     }
@@ -216,12 +290,6 @@ class queued_io_request : private internal::io_request {
     queued_io_request(queued_io_request&&) = delete;
 
     void dispatch() noexcept {
-        if (is_cancelled()) {
-            _ioq.complete_cancelled_request(*this);
-            delete this;
-            return;
-        }
-
         io_log.trace("dev {} : req {} submit", _ioq.dev_id(), fmt::ptr(&*_desc));
         _intent.maybe_dequeue();
         _desc->dispatch(_dnl, _started);
@@ -229,9 +297,20 @@ class queued_io_request : private internal::io_request {
         delete this;
     }
 
+    // The request is taken out of the fair_queue, so it's gone for good.
+    // Must be dequeued from its intent first.
     void cancel() noexcept {
         _ioq.cancel_request(*this);
         _desc.release()->cancel();
+        delete this;
+    }
+
+    // Called instead of dispatch() when the request missed its deadline
+    void expire() noexcept {
+        _intent.maybe_dequeue();
+        _ioq.expire_request(*this);
+        _desc.release()->expire();
+        delete this;
     }
 
     void set_intent(internal::cancellable_queue* cq) noexcept {
@@ -241,6 +320,7 @@ class queued_io_request : private internal::io_request {
     future<size_t> get_future() noexcept { return _desc->get_future(); }
     fair_queue_entry& queue_entry() noexcept { return _fq_entry; }
     stream_id stream() const noexcept { return _stream; }
+    fair_queue::class_id fq_class() const noexcept { return _desc->fq_class(); }
 
     static queued_io_request& from_fq_entry(fair_queue_entry& ent) noexcept {
         return *boost::intrusive::get_parent_from_member(&ent, &queued_io_request::_fq_entry);
@@ -274,8 +354,9 @@ cancellable_queue& cancellable_queue::operator=(cancellable_queue&& o) noexcept
 
 cancellable_queue::~cancellable_queue() {
     while (_first != nullptr) {
-        queued_io_request::from_cq_link(*_first).cancel();
+        auto& req = queued_io_request::from_cq_link(*_first);
         pop_front();
+        req.cancel();
     }
 }
 
@@ -325,10 +406,212 @@ void io_sink::submit(io_completion* desc, io_request req) noexcept {
 
 } // internal namespace
 
+class io_queue::trace_ring {
+    std::vector<trace_record> _records;
+    size_t _next = 0;
+    bool _wrapped = false;
+public:
+    explicit trace_ring(size_t max_records) : _records(std::max<size_t>(max_records, 1)) {}
+
+    void add(const trace_record& r) noexcept {
+        _records[_next] = r;
+        if (++_next == _records.size()) {
+            _next = 0;
+            _wrapped = true;
+        }
+    }
+
+    std::vector<trace_record> records() const {
+        std::vector<trace_record> ret;
+        ret.reserve(_wrapped ? _records.size() : _next);
+        if (_wrapped) {
+            ret.insert(ret.end(), _records.begin() + _next, _records.end());
+        }
+        ret.insert(ret.end(), _records.begin(), _records.begin() + _next);
+        return ret;
+    }
+};
+
+void io_queue::start_tracing(size_t max_records) {
+    _trace = std::make_unique<trace_ring>(max_records);
+}
+
+void io_queue::stop_tracing() noexcept {
+    _trace.reset();
+}
+
+void io_queue::add_trace_record(const trace_record& r) noexcept {
+    _trace->add(r);
+}
+
+std::vector<io_queue::trace_record> io_queue::trace() const {
+    return _trace ? _trace->records() : std::vector<trace_record>();
+}
+
+future<> io_queue::dump_trace(sstring path) const {
+    struct dump {
+        trace_file_header header = {};
+        sstring classes;
+        std::vector<trace_record> records;
+    };
+    dump d;
+    d.records = trace();
+    for (auto& pc : _priority_classes) {
+        if (pc) {
+            auto name = pc->pc().get_name();
+            uint32_t id_and_length[2] = { uint32_t(pc->fq_class()), uint32_t(name.size()) };
+            d.classes.append(reinterpret_cast<const char*>(id_and_length), sizeof(id_and_length));
+            d.classes += name;
+            d.header.nr_classes++;
+        }
+    }
+    std::copy(std::begin(trace_file_header::file_magic), std::end(trace_file_header::file_magic), d.header.magic);
+    d.header.record_size = sizeof(trace_record);
+    d.header.shard = this_shard_id();
+    d.header.dev_id = dev_id();
+    d.header.nr_records = d.records.size();
+
+    return do_with(std::move(d), [path = std::move(path)] (dump& d) {
+        return with_file_close_on_failure(open_file_dma(path, open_flags::wo | open_flags::create | open_flags::truncate), [&d] (file f) {
+            return make_file_output_stream(std::move(f)).then([&d] (output_stream<char> out) {
+                return do_with(std::move(out), [&d] (output_stream<char>& out) {
+                    return out.write(reinterpret_cast<const char*>(&d.header), sizeof(d.header)).then([&d, &out] {
+                        return out.write(d.classes);
+                    }).then([&d, &out] {
+                        return out.write(reinterpret_cast<const char*>(d.records.data()), d.records.size() * sizeof(trace_record));
+                    }).finally([&out] {
+                        return out.close();
+                    });
+                });
+            });
+        });
+    });
+}
+
 void
 io_queue::complete_request(io_desc_read_write& desc) noexcept {
     _requests_executing--;
-    _streams[desc.stream()].notify_request_finished(desc.ticket());
+    // Capacity goes back to the group in poll_io_queue(), once for all the
+    // requests completed by this round of reaping
+    _streams[desc.stream()].notify_request_finished_deferred(desc.ticket());
+}
+
+unsigned io_queue::latency_bucket(std::chrono::duration<double> lat) noexcept {
+    auto us = static_cast<uint64_t>(std::max(lat.count(), 0.0) * 1e6);
+    if (us < 4) {
+        return us;
+    }
+    unsigned e = std::numeric_limits<uint64_t>::digits - 1 - count_leading_zeros(us);
+    unsigned sub = (us >> (e - 2)) & 3;
+    return std::min((e - 1) * 4 + sub, latency_buckets - 1);
+}
+
+std::chrono::duration<double> io_queue::latency_bucket_limit(unsigned bucket) noexcept {
+    if (bucket < 4) {
+        return std::chrono::duration<double>((bucket + 1) * 1e-6);
+    }
+    unsigned e = bucket / 4 + 1;
+    unsigned sub = bucket % 4;
+    return std::chrono::duration<double>(double(uint64_t(4 + sub + 1) << (e - 2)) * 1e-6);
+}
+
+void io_queue::account_latency(clock_type::time_point now, std::chrono::duration<double> lat) noexcept {
+    if (get_config().latency_target.count() == 0) {
+        return;
+    }
+
+    _latency_hist[latency_bucket(lat)]++;
+    if (now - _latency_folded < latency_control_period) {
+        return;
+    }
+
+    _latency_folded = now;
+    for (unsigned i = 0; i < latency_buckets; i++) {
+        if (_latency_hist[i] != 0) {
+            _group->_latency_hist[i].fetch_add(_latency_hist[i], std::memory_order_relaxed);
+            _latency_hist[i] = 0;
+        }
+    }
+    _group->maybe_adjust_rates(now);
+}
+
+/*
+ * The controller is AIMD on the fair groups' rate scale. Once per period
+ * one of the shards collects the latencies gathered by all the queues of
+ * the group. If their 99th percentile is above the target, the rates are
+ * cut back, otherwise they are brought back towards the configured ones.
+ * The rates never go above those from the io properties.
+ */
+void io_group::maybe_adjust_rates(io_queue::clock_type::time_point now) noexcept {
+    static constexpr float decrease_factor = 0.8;
+    static constexpr float increase_step = 0.05;
+    static constexpr float min_scale = 0.05;
+    static constexpr uint64_t min_samples = 16;
+
+    auto ts = _latency_evaluated.load(std::memory_order_relaxed);
+    if (now - ts < io_queue::latency_control_period || !_latency_evaluated.compare_exchange_strong(ts, now)) {
+        return; // next time or another shard
+    }
+
+    std::array<uint64_t, io_queue::latency_buckets> hist;
+    uint64_t total = 0;
+    for (unsigned i = 0; i < io_queue::latency_buckets; i++) {
+        hist[i] = _latency_hist[i].exchange(0, std::memory_order_relaxed);
+        total += hist[i];
+    }
+    if (total < min_samples) {
+        // Too few to tell, keep them for the next period
+        for (unsigned i = 0; i < io_queue::latency_buckets; i++) {
+            if (hist[i] != 0) {
+                _latency_hist[i].fetch_add(hist[i], std::memory_order_relaxed);
+            }
+        }
+        return;
+    }
+
+    unsigned bucket = 0;
+    for (uint64_t seen = 0; bucket < io_queue::latency_buckets - 1; bucket++) {
+        seen += hist[bucket];
+        if (seen * 100 >= total * 99) {
+            break;
+        }
+    }
+    auto p99 = io_queue::latency_bucket_limit(bucket);
+    _latency_p99.store(p99.count(), std::memory_order_relaxed);
+
+    auto scale = _fgs[0]->rate_scale();
+    auto new_scale = p99 > _config.latency_target ?
+            std::max(scale * decrease_factor, min_scale) :
+            std::min(scale + increase_step, 1.0f);
+    if (new_scale != scale) {
+        io_log.debug("dev {} : p99 latency {:.3f}ms, rate scale {} -> {}", _config.devid, p99.count() * 1000, scale, new_scale);
+        for (auto& fg : _fgs) {
+            fg->set_rate_scale(new_scale);
+        }
+    }
+}
+
+void io_queue::register_latency_stats() {
+    namespace sm = seastar::metrics;
+
+    auto owner_l = sm::shard_label(this_shard_id());
+    auto mnt_l = sm::label("mountpoint")(mountpoint());
+    auto& cfg = get_config();
+
+    _latency_metrics.add_group("io_queue", {
+        sm::make_gauge("latency_target_p99", [this] {
+            return _group->_latency_p99.load(std::memory_order_relaxed);
+        }, sm::description("Observed 99th percentile latency (seconds) of the device, as seen by the latency controller"), {owner_l, mnt_l}),
+        sm::make_gauge("adjusted_rate_scale", [this] {
+            return _group->_fgs[0]->rate_scale();
+        }, sm::description("Fraction of the configured io rates in effect"), {owner_l, mnt_l}),
+        sm::make_gauge("adjusted_iops_rate", [this, &cfg] {
+            return double(cfg.req_count_rate) / read_request_base_count * _group->_fgs[0]->rate_scale();
+        }, sm::description("Read ops per second currently allowed"), {owner_l, mnt_l}),
+        sm::make_gauge("adjusted_bandwidth_rate", [this, &cfg] {
+            return double(cfg.blocks_count_rate << block_size_shift) / read_request_base_count * _group->_fgs[0]->rate_scale();
+        }, sm::description("Read bytes per second currently allowed"), {owner_l, mnt_l}),
+    });
 }
 
 fair_queue::config io_queue::make_fair_queue_config(const config& iocfg, sstring label) {
@@ -362,6 +645,11 @@ io_queue::io_queue(io_group_ptr group, internal::io_sink& sink)
         }
         seastar_logger.info("Created io queue dev({}) capacities:{}", get_config().devid, caps_str);
     }
+
+    if (cfg.latency_target.count() != 0) {
+        _latency_folded = clock_type::now();
+        register_latency_stats();
+    }
 }
 
 fair_group::config io_group::make_fair_group_config(const io_queue::config& qcfg) noexcept {
@@ -376,13 +664,29 @@ fair_group::config io_group::make_fair_group_config(const io_queue::config& qcfg
     return cfg;
 }
 
-io_group::io_group(io_queue::config io_cfg)
+io_group::io_group(io_queue::config io_cfg, unsigned nr_groups, unsigned group_idx)
     : _config(std::move(io_cfg))
+    , _latency_evaluated(io_queue::clock_type::now())
 {
     auto fg_cfg = make_fair_group_config(_config);
-    _fgs.push_back(std::make_unique<fair_group>(fg_cfg));
+    _pools.push_back(std::make_shared<fair_group_pool>(fg_cfg, nr_groups));
     if (_config.duplex) {
-        _fgs.push_back(std::make_unique<fair_group>(fg_cfg));
+        _pools.push_back(std::make_shared<fair_group_pool>(fg_cfg, nr_groups));
+    }
+    attach_fair_groups(group_idx);
+}
+
+io_group::io_group(const io_group& peer, unsigned group_idx)
+    : _config(peer._config)
+    , _pools(peer._pools)
+    , _latency_evaluated(io_queue::clock_type::now())
+{
+    attach_fair_groups(group_idx);
+}
+
+void io_group::attach_fair_groups(unsigned group_idx) {
+    for (auto& pool : _pools) {
+        _fgs.push_back(&pool->group(group_idx));
     }
 
     /*
@@ -412,7 +716,8 @@ io_group::io_group(io_queue::config io_cfg)
     update_max_size(io_direction_and_length::write_idx);
     update_max_size(io_direction_and_length::read_idx);
 
-    seastar_logger.info("Created io group dev({}), length limit {}:{}, rate {}:{}", _config.devid,
+    seastar_logger.info("Created io group dev({}) {}/{}, length limit {}:{}, rate {}:{}", _config.devid,
+            group_idx, _pools[0]->size(),
             _max_request_length[io_direction_and_length::read_idx],
             _max_request_length[io_direction_and_length::write_idx],
             _config.req_count_rate, _config.blocks_count_rate);
@@ -542,6 +847,8 @@ std::vector<seastar::metrics::impl::metric_definition_impl> io_queue::priority_c
                 }
                 return st.count();
             }, sm::description("Total time spent starving for disk")),
+            sm::make_derive("expired_operations", _nr_expired,
+                    sm::description("Total operations dropped from the queue for missing their io_intent deadline")),
 
             // Note: The counter below is not the same as reactor's queued-io-requests
             // queued-io-requests shows us how many requests in total exist in this I/O Queue.
@@ -557,7 +864,13 @@ std::vector<seastar::metrics::impl::metric_definition_impl> io_queue::priority_c
             sm::make_gauge("delay", [this] {
                 return _queue_time.count();
             }, sm::description("random delay time in the queue")),
-            sm::make_gauge("shares", _shares, sm::description("current amount of shares"))
+            sm::make_gauge("shares", _shares, sm::description("current amount of shares")),
+            sm::make_histogram("delay_histogram", [this] {
+                return to_metrics_histogram(_queue_time_hist, _total_queue_time);
+            }, sm::description("Distribution of time spent in the queue, in microseconds")),
+            sm::make_histogram("exec_histogram", [this] {
+                return to_metrics_histogram(_execution_time_hist, _total_execution_time);
+            }, sm::description("Distribution of time spent in disk, in microseconds"))
     });
 }
 
@@ -641,7 +954,13 @@ fair_queue_ticket make_ticket(io_direction_and_length dnl, const io_queue::confi
     };
 
     const auto& m = mult[dnl.rw_idx()];
-    return fair_queue_ticket(m.weight, m.size * (dnl.length() >> io_queue::block_size_shift));
+    auto blocks = dnl.length() >> io_queue::block_size_shift;
+    if (dnl.rw_idx() == io_direction_and_length::write_idx && !cfg.disk_write_cost_factors.empty()) {
+        auto idx = std::min<size_t>(blocks ? log2floor(blocks) : 0, cfg.disk_write_cost_factors.size() - 1);
+        auto f = cfg.disk_write_cost_factors[idx];
+        return fair_queue_ticket(m.weight * f, m.size * f * blocks);
+    }
+    return fair_queue_ticket(m.weight, m.size * blocks);
 }
 
 fair_queue_ticket io_queue::request_fq_ticket(io_direction_and_length dnl) const noexcept {
@@ -682,6 +1001,9 @@ io_queue::queue_request(const io_priority_class& pc, size_t len, internal::io_re
             cq = &intent->find_or_create_cancellable_queue(dev_id(), pc.id());
         }
 
+        if (intent != nullptr) {
+            queued_req->queue_entry().set_deadline(intent->deadline());
+        }
         _streams[queued_req->stream()].queue(pclass.fq_class(), queued_req->queue_entry());
         queued_req->set_intent(cq);
         queued_req.release();
@@ -695,6 +1017,8 @@ void io_queue::poll_io_queue() {
     for (auto&& st : _streams) {
         st.dispatch_requests([] (fair_queue_entry& fqe) {
             queued_io_request::from_fq_entry(fqe).dispatch();
+        }, [] (fair_queue_entry& fqe) {
+            queued_io_request::from_fq_entry(fqe).expire();
         });
     }
 }
@@ -702,16 +1026,43 @@ void io_queue::poll_io_queue() {
 void io_queue::submit_request(io_desc_read_write* desc, internal::io_request req) noexcept {
     _queued_requests--;
     _requests_executing++;
+    if (req.is_discard()) {
+        submit_discard(desc, req);
+        return;
+    }
     _sink.submit(desc, std::move(req));
 }
 
+void io_queue::submit_discard(io_completion* desc, const internal::io_request& req) noexcept {
+    try {
+        auto f = engine()._thread_pool->submit<syscall_result<int>>([req] {
+            if (req.opcode() == internal::io_request::operation::discard) {
+                uint64_t range[2] { req.pos(), req.size() };
+                return wrap_syscall<int>(::ioctl(req.fd(), BLKDISCARD, &range));
+            }
+            return wrap_syscall<int>(::fallocate(req.fd(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, req.pos(), req.size()));
+        });
+        // The completion is owned by itself, and outlives the wait
+        (void)f.then_wrapped([desc] (future<syscall_result<int>> f) {
+            try {
+                f.get0().throw_if_error();
+                desc->complete(0);
+            } catch (...) {
+                desc->set_exception(std::current_exception());
+            }
+        });
+    } catch (...) {
+        desc->set_exception(std::current_exception());
+    }
+}
+
 void io_queue::cancel_request(queued_io_request& req) noexcept {
     _queued_requests--;
-    _streams[req.stream()].notify_request_cancelled(req.queue_entry());
+    _streams[req.stream()].notify_request_cancelled(req.fq_class(), req.queue_entry());
 }
 
-void io_queue::complete_cancelled_request(queued_io_request& req) noexcept {
-    _streams[req.stream()].notify_request_finished(req.queue_entry().ticket());
+void io_queue::expire_request(queued_io_request& req) noexcept {
+    _queued_requests--;
 }
 
 io_queue::clock_type::time_point io_queue::next_pending_aio() const noexcept {
@@ -0,0 +1,82 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+#include <seastar/core/layered_file.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/loop.hh>
+
+namespace seastar {
+
+namespace internal {
+
+// Base of the layered files that don't keep their data in the underlying
+// file as it is (cached, compressed, ...). All reads go through
+// read_range(), and the rest of the directory handling is the underlying
+// file's.
+class range_layered_file_impl : public layered_file_impl {
+protected:
+    // Copies [pos, pos + len) into dst, returns the number of bytes
+    // copied, which is short if the range goes past the end of the file
+    virtual future<size_t> read_range(uint64_t pos, char* dst, size_t len, const io_priority_class& pc) = 0;
+public:
+    using layered_file_impl::layered_file_impl;
+
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) override {
+        return read_range(pos, static_cast<char*>(buffer), len, pc);
+    }
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        return do_with(std::move(iov), size_t(0), size_t(0), [this, pos, &pc] (std::vector<iovec>& iov, size_t& i, size_t& total) {
+            return repeat([this, pos, &pc, &iov, &i, &total] {
+                if (i == iov.size()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto& v = iov[i++];
+                return read_range(pos + total, static_cast<char*>(v.iov_base), v.iov_len, pc).then([&total, &v] (size_t n) {
+                    total += n;
+                    return stop_iteration(n < v.iov_len);
+                });
+            }).then([&total] {
+                return total;
+            });
+        });
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        auto buf = temporary_buffer<uint8_t>::aligned(_memory_dma_alignment, range_size);
+        auto dst = reinterpret_cast<char*>(buf.get_write());
+        return read_range(offset, dst, range_size, pc).then([buf = std::move(buf)] (size_t n) mutable {
+            buf.trim(n);
+            return std::move(buf);
+        });
+    }
+    // Discarded data may read back as anything, including what it was
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        return make_ready_future<>();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override {
+        return _underlying_file.list_directory(std::move(next));
+    }
+};
+
+}
+
+}
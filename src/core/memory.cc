@@ -60,11 +60,14 @@
 #include <seastar/util/std-compat.hh>
 #include <seastar/util/log.hh>
 #include <seastar/core/aligned_buffer.hh>
+#include <seastar/core/align.hh>
 #include <unordered_set>
 #include <iostream>
+#include <random>
 #include <thread>
 
 #include <dlfcn.h>
+#include <sys/mman.h>
 
 namespace seastar {
 
@@ -185,7 +188,7 @@ namespace memory {
 seastar::logger seastar_memory_logger("seastar_memory");
 
 [[gnu::unused]]
-static allocation_site_ptr get_allocation_site();
+static allocation_site_ptr get_allocation_site(size_t size);
 
 static void on_allocation_failure(size_t size);
 
@@ -197,6 +200,7 @@ using pageidx = uint32_t;
 
 struct page;
 class page_list;
+class small_pool;
 
 static std::atomic<bool> live_cpus[max_cpus];
 
@@ -210,7 +214,7 @@ static thread_local bool is_reactor_thread = false;
 
 namespace alloc_stats {
 
-enum class types { allocs, frees, cross_cpu_frees, reclaims, large_allocs, foreign_mallocs, foreign_frees, foreign_cross_frees, enum_size };
+enum class types { allocs, frees, cross_cpu_frees, reclaims, large_allocs, foreign_mallocs, foreign_frees, foreign_cross_frees, cross_cpu_free_batches, large_span_cache_hits, defragmentations, enum_size };
 
 using stats_array = std::array<uint64_t, static_cast<std::size_t>(types::enum_size)>;
 using stats_atomic_array = std::array<std::atomic_uint64_t, static_cast<std::size_t>(types::enum_size)>;
@@ -281,6 +285,8 @@ class page_list_link {
     uint32_t _next;
     friend class page_list;
     friend seastar::internal::log_buf::inserter_iterator do_dump_memory_diagnostics(seastar::internal::log_buf::inserter_iterator);
+    friend small_pool_stats small_pool_usage(const small_pool& sp) noexcept;
+    friend fragmentation_report get_fragmentation_report();
 };
 
 constexpr size_t mem_base_alloc = size_t(1) << 44;
@@ -377,7 +383,15 @@ class page_list {
         }
         _front = ary[_front].link._next;
     }
+    template <typename Func>
+    void for_each(page* ary, Func func) {
+        for (auto idx = _front; idx; idx = ary[idx].link._next) {
+            func(ary[idx]);
+        }
+    }
     friend seastar::internal::log_buf::inserter_iterator do_dump_memory_diagnostics(seastar::internal::log_buf::inserter_iterator);
+    friend small_pool_stats small_pool_usage(const small_pool& sp) noexcept;
+    friend fragmentation_report get_fragmentation_report();
 };
 
 class small_pool {
@@ -408,6 +422,8 @@ class small_pool {
     void add_more_objects();
     void trim_free_list();
     friend seastar::internal::log_buf::inserter_iterator do_dump_memory_diagnostics(seastar::internal::log_buf::inserter_iterator);
+    friend small_pool_stats small_pool_usage(const small_pool& sp) noexcept;
+    friend fragmentation_report get_fragmentation_report();
 };
 
 // index 0b0001'1100 -> size (1 << 4) + 0b11 << (4 - 2)
@@ -487,21 +503,71 @@ struct cross_cpu_free_item {
     cross_cpu_free_item* next;
 };
 
+// Objects freed on a reactor thread that belong to one other shard, not yet
+// handed over to it. They are pushed to the owner's xcpu_freelist together,
+// with a single compare-and-swap, instead of one contended update per object.
+struct cross_cpu_free_magazine {
+    static constexpr unsigned capacity = 32;
+    cross_cpu_free_item* head = nullptr;
+    cross_cpu_free_item* tail = nullptr;
+    unsigned count = 0;
+    bool dirty = false; // listed in cpu_pages::xcpu_dirty_magazines
+};
+
+// Large spans freed recently, kept whole for the next allocations of their
+// size, which then skip searching the free lists, and the splitting and
+// merging of buddies. A cached span stays marked allocated, so that it is
+// not merged with its buddy. Spans from 128k to 1M are cached, up to a few
+// of each size, and at most max_bytes, or 1/64 of the shard's memory, in
+// total. The cache is trimmed before reclaimers run.
+struct large_span_cache {
+    static constexpr unsigned min_idx = log2ceil((128 << 10) / page_size);
+    static constexpr unsigned max_idx = log2ceil((1 << 20) / page_size);
+    static constexpr unsigned per_size = 8;
+    static constexpr size_t max_bytes = 4 << 20;
+    struct size_class {
+        pageidx spans[per_size];
+        unsigned count = 0;
+    };
+    size_class classes[max_idx - min_idx + 1];
+    uint32_t nr_pages = 0;
+};
+
 struct cpu_pages {
     uint32_t min_free_pages = 20000000 / page_size;
     char* memory;
+    // Updated by the prefault thread in background mode
+    std::atomic<size_t> prefaulted_bytes = 0;
+    bool hugetlbfs = false;
+    // The file backing the memory when hugetlbfs is set
+    lw_shared_ptr<file_desc> hugetlbfs_file;
     page* pages;
     uint32_t nr_pages;
     uint32_t nr_free_pages;
     uint32_t current_min_free_pages = 0;
+    // Free memory below which reclaimers start running in the background,
+    // ahead of reaching min_free_pages; 0 disables background reclaim
+    uint32_t background_reclaim_free_pages = 0;
+    // As above, but 0 while background reclaim is scheduled
+    uint32_t current_background_reclaim_free_pages = 0;
+    bool background_reclaim_scheduled = false;
+    static constexpr size_t background_reclaim_step_pages = (1 << 20) / page_size;
     size_t large_allocation_warning_threshold = std::numeric_limits<size_t>::max();
     unsigned cpu_id = -1U;
     std::function<void (std::function<void ()>)> reclaim_hook;
+    std::function<void (std::function<void ()>)> background_reclaim_hook;
     std::vector<reclaimer*> reclaimers;
+    noncopyable_function<bool (size_t)> defragmentation_hook;
+    bool defragmenting = false;
     static constexpr unsigned nr_span_lists = 32;
     page_list free_spans[nr_span_lists];  // contains aligned spans with span_size == 2^idx
+    large_span_cache large_spans;
     small_pool_array small_pools;
     alignas(seastar::cache_line_size) std::atomic<cross_cpu_free_item*> xcpu_freelist;
+    // Outgoing frees, indexed by the owner's cpu_id
+    cross_cpu_free_magazine xcpu_magazines[max_cpus];
+    unsigned xcpu_dirty_magazines[max_cpus];
+    unsigned nr_xcpu_dirty_magazines = 0;
     static std::atomic<unsigned> cpu_id_gen;
     static cpu_pages* all_cpus[max_cpus];
     union asu {
@@ -513,6 +579,11 @@ struct cpu_pages {
     } asu;
     allocation_site_ptr alloc_site_list_head = nullptr; // For easy traversal of asu.alloc_sites from scylla-gdb.py
     bool collect_backtrace = false;
+    // When non-zero, only allocations picked by a Poisson process with this
+    // mean period (in bytes allocated) record their allocation site
+    size_t heap_profiling_sample_period = 0;
+    ssize_t bytes_until_sample = 0;
+    std::minstd_rand sample_rng;
     char* mem() { return memory; }
 
     void link(page_list& list, page* span);
@@ -527,7 +598,11 @@ struct cpu_pages {
     void* allocate_large_aligned(unsigned align_pages, unsigned nr_pages);
     page* find_and_unlink_span(unsigned nr_pages);
     page* find_and_unlink_span_reclaiming(unsigned n_pages);
+    bool defragment(unsigned n_pages);
     void free_large(void* ptr);
+    page* take_cached_span(unsigned n_pages);
+    bool cache_span(pageidx start, uint32_t span_size);
+    bool trim_large_span_cache();
     bool grow_span(pageidx& start, uint32_t& nr_pages, unsigned idx);
     void free_span(pageidx start, uint32_t nr_pages);
     void free_span_no_merge(pageidx start, uint32_t nr_pages);
@@ -538,6 +613,9 @@ struct cpu_pages {
     static bool try_foreign_free(void* ptr);
     void shrink(void* ptr, size_t new_size);
     static void free_cross_cpu(unsigned cpu_id, void* ptr);
+    static void push_cross_cpu(unsigned cpu_id, cross_cpu_free_item* first, cross_cpu_free_item* last);
+    void flush_cross_cpu_magazine(unsigned cpu_id);
+    bool flush_cross_cpu_magazines();
     bool drain_cross_cpu_freelist();
     size_t object_size(void* ptr);
     page* to_page(void* p) {
@@ -548,14 +626,19 @@ struct cpu_pages {
     bool initialize();
     reclaiming_result run_reclaimers(reclaimer_scope, size_t pages_to_reclaim);
     void schedule_reclaim();
+    void schedule_background_reclaim();
     void set_reclaim_hook(std::function<void (std::function<void ()>)> hook);
+    void set_background_reclaim_hook(std::function<void (std::function<void ()>)> hook);
     void set_min_free_pages(size_t pages);
+    void set_background_reclaim_free_pages(size_t pages);
     void resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void replace_memory_backing(allocate_system_memory_fn alloc_sys_mem);
     void check_large_allocation(size_t size);
     void warn_large_allocation(size_t size);
     memory::memory_layout memory_layout();
+    memory::huge_page_layout huge_page_layout();
+    bool should_sample(size_t size);
     ~cpu_pages();
 };
 
@@ -594,6 +677,35 @@ scoped_heap_profiling::~scoped_heap_profiling() {
     }
 }
 
+void set_heap_profiling_sample_period(size_t bytes) {
+    auto& mem = get_cpu_mem();
+    mem.heap_profiling_sample_period = bytes;
+    mem.bytes_until_sample = 0;
+}
+
+size_t get_heap_profiling_sample_period() {
+    return get_cpu_mem().heap_profiling_sample_period;
+}
+
+std::vector<heap_profile_entry> get_heap_profile() {
+    // Sampling an allocation made here would modify the list being walked
+    disable_backtrace_temporarily dbt;
+    std::vector<heap_profile_entry> ret;
+    for (auto site = get_cpu_mem().alloc_site_list_head; site; site = site->next) {
+        if (!site->count) {
+            continue;
+        }
+        heap_profile_entry entry{site->count, site->size, {}};
+        for (auto& f : site->backtrace.main_backtrace().frames()) {
+            // frames keep the address of the call instruction, report the
+            // return address like other profilers do
+            entry.backtrace.push_back(f.so->begin + f.addr + 1);
+        }
+        ret.push_back(std::move(entry));
+    }
+    return ret;
+}
+
 #else
 
 void set_heap_profiling_enabled(bool enable) {
@@ -608,6 +720,17 @@ scoped_heap_profiling::scoped_heap_profiling() noexcept {
 scoped_heap_profiling::~scoped_heap_profiling() {
 }
 
+void set_heap_profiling_sample_period(size_t) {
+}
+
+size_t get_heap_profiling_sample_period() {
+    return 0;
+}
+
+std::vector<heap_profile_entry> get_heap_profile() {
+    return {};
+}
+
 #endif
 
 // Smallest index i such that all spans stored in the index are >= pages.
@@ -706,13 +829,42 @@ cpu_pages::find_and_unlink_span_reclaiming(unsigned n_pages) {
         if (span) {
             return span;
         }
-        if (run_reclaimers(reclaimer_scope::sync, n_pages) == reclaiming_result::reclaimed_nothing) {
+        if (trim_large_span_cache()) {
+            continue;
+        }
+        if (run_reclaimers(reclaimer_scope::sync, n_pages) == reclaiming_result::reclaimed_nothing
+                && !defragment(n_pages)) {
             return nullptr;
         }
     }
 }
 
+// Called when no span is large enough, and the reclaimers didn't help. If
+// enough memory is free, it is fragmented, so let the application move
+// objects around.
+bool cpu_pages::defragment(unsigned n_pages) {
+    if (!defragmentation_hook || defragmenting || nr_free_pages < n_pages) {
+        return false;
+    }
+    alloc_stats::increment_local(alloc_stats::types::defragmentations);
+    defragmenting = true;
+    bool freed = false;
+    try {
+        freed = defragmentation_hook(size_t(n_pages) * page_size);
+    } catch (...) {
+        seastar_memory_logger.warn("Defragmentation hook failed: {}", std::current_exception());
+    }
+    defragmenting = false;
+    return freed;
+}
+
 void cpu_pages::maybe_reclaim() {
+    if (nr_free_pages < std::max(min_free_pages, background_reclaim_free_pages)) {
+        trim_large_span_cache();
+    }
+    if (nr_free_pages < current_background_reclaim_free_pages) {
+        schedule_background_reclaim();
+    }
     if (nr_free_pages < current_min_free_pages) {
         drain_cross_cpu_freelist();
         if (nr_free_pages < current_min_free_pages) {
@@ -731,24 +883,28 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages) {
     if (nr_pages && n_pages >= nr_pages) {
         return nullptr;
     }
-    page* span = find_and_unlink_span_reclaiming(n_pages);
+    page* span = take_cached_span(n_pages);
     if (!span) {
-        return nullptr;
+        span = find_and_unlink_span_reclaiming(n_pages);
+        if (!span) {
+            return nullptr;
+        }
+        auto span_size = span->span_size;
+        auto span_idx = span - pages;
+        nr_free_pages -= span->span_size;
+        while (span_size >= n_pages * 2) {
+            span_size /= 2;
+            auto other_span_idx = span_idx + span_size;
+            free_span_no_merge(other_span_idx, span_size);
+        }
+        auto span_end = &pages[span_idx + span_size - 1];
+        span->free = span_end->free = false;
+        span->span_size = span_end->span_size = span_size;
     }
-    auto span_size = span->span_size;
     auto span_idx = span - pages;
-    nr_free_pages -= span->span_size;
-    while (span_size >= n_pages * 2) {
-        span_size /= 2;
-        auto other_span_idx = span_idx + span_size;
-        free_span_no_merge(other_span_idx, span_size);
-    }
-    auto span_end = &pages[span_idx + span_size - 1];
-    span->free = span_end->free = false;
-    span->span_size = span_end->span_size = span_size;
     span->pool = nullptr;
 #ifdef SEASTAR_HEAPPROF
-    auto alloc_site = get_allocation_site();
+    auto alloc_site = get_allocation_site(span->span_size * page_size);
     span->alloc_site = alloc_site;
     if (alloc_site) {
         ++alloc_site->count;
@@ -802,9 +958,24 @@ saved_backtrace get_backtrace() noexcept {
     return current_backtrace();
 }
 
+bool cpu_pages::should_sample(size_t size) {
+    if (!heap_profiling_sample_period) {
+        return true;
+    }
+    bytes_until_sample -= size;
+    if (bytes_until_sample > 0) {
+        return false;
+    }
+    // Exponentially distributed gaps give every allocated byte the same chance
+    // of being sampled, regardless of the size of the allocation it is part of
+    std::exponential_distribution<double> gap(1.0 / heap_profiling_sample_period);
+    bytes_until_sample = ssize_t(gap(sample_rng)) + 1;
+    return true;
+}
+
 static
-allocation_site_ptr get_allocation_site() {
-    if (!cpu_mem.is_initialized() || !cpu_mem.collect_backtrace) {
+allocation_site_ptr get_allocation_site(size_t size) {
+    if (!cpu_mem.is_initialized() || !cpu_mem.collect_backtrace || !cpu_mem.should_sample(size)) {
         return nullptr;
     }
     disable_backtrace_temporarily dbt;
@@ -842,7 +1013,7 @@ cpu_pages::allocate_small(unsigned size) {
     if (!ptr) {
         return nullptr;
     }
-    allocation_site_ptr alloc_site = get_allocation_site();
+    allocation_site_ptr alloc_site = get_allocation_site(pool.object_size());
     if (alloc_site) {
         ++alloc_site->count;
         alloc_site->size += pool.object_size();
@@ -862,7 +1033,54 @@ void cpu_pages::free_large(void* ptr) {
         alloc_site->size -= span->span_size * page_size;
     }
 #endif
-    free_span(idx, span->span_size);
+    if (!cache_span(idx, span->span_size)) {
+        free_span(idx, span->span_size);
+    }
+}
+
+page* cpu_pages::take_cached_span(unsigned n_pages) {
+    auto idx = log2ceil(n_pages);
+    if (idx < large_span_cache::min_idx || idx > large_span_cache::max_idx) {
+        return nullptr;
+    }
+    auto& sc = large_spans.classes[idx - large_span_cache::min_idx];
+    if (!sc.count) {
+        return nullptr;
+    }
+    page* span = &pages[sc.spans[--sc.count]];
+    large_spans.nr_pages -= span->span_size;
+    alloc_stats::increment_local(alloc_stats::types::large_span_cache_hits);
+    return span;
+}
+
+bool cpu_pages::cache_span(pageidx start, uint32_t span_size) {
+    auto idx = log2ceil(span_size);
+    if (idx < large_span_cache::min_idx || idx > large_span_cache::max_idx || span_size != (1u << idx)) {
+        return false;
+    }
+    auto& sc = large_spans.classes[idx - large_span_cache::min_idx];
+    auto max_pages = std::min<size_t>(large_span_cache::max_bytes / page_size, nr_pages / 64);
+    if (sc.count == large_span_cache::per_size || large_spans.nr_pages + span_size > max_pages
+            || nr_free_pages < std::max(min_free_pages, background_reclaim_free_pages)) {
+        return false;
+    }
+    sc.spans[sc.count++] = start;
+    large_spans.nr_pages += span_size;
+    return true;
+}
+
+bool cpu_pages::trim_large_span_cache() {
+    if (!large_spans.nr_pages) {
+        return false;
+    }
+    for (auto& sc : large_spans.classes) {
+        while (sc.count) {
+            auto start = sc.spans[--sc.count];
+            free_span(start, pages[start].span_size);
+        }
+    }
+    large_spans.nr_pages = 0;
+    return true;
 }
 
 size_t cpu_pages::object_size(void* ptr) {
@@ -888,12 +1106,60 @@ void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
         return;
     }
     auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
+    if (!is_reactor_thread) {
+        // Nothing would flush a magazine on this thread
+        push_cross_cpu(cpu_id, p, p);
+        alloc_stats::increment(alloc_stats::types::cross_cpu_frees);
+        return;
+    }
+    auto& mag = cpu_mem.xcpu_magazines[cpu_id];
+    p->next = mag.head;
+    if (!mag.head) {
+        mag.tail = p;
+    }
+    mag.head = p;
+    if (!mag.dirty) {
+        mag.dirty = true;
+        cpu_mem.xcpu_dirty_magazines[cpu_mem.nr_xcpu_dirty_magazines++] = cpu_id;
+    }
+    if (++mag.count == cross_cpu_free_magazine::capacity) {
+        cpu_mem.flush_cross_cpu_magazine(cpu_id);
+    }
+    alloc_stats::increment_local(alloc_stats::types::cross_cpu_frees);
+}
+
+void cpu_pages::push_cross_cpu(unsigned cpu_id, cross_cpu_free_item* first, cross_cpu_free_item* last) {
     auto& list = all_cpus[cpu_id]->xcpu_freelist;
     auto old = list.load(std::memory_order_relaxed);
     do {
-        p->next = old;
-    } while (!list.compare_exchange_weak(old, p, std::memory_order_release, std::memory_order_relaxed));
-    alloc_stats::increment(alloc_stats::types::cross_cpu_frees);
+        last->next = old;
+    } while (!list.compare_exchange_weak(old, first, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void cpu_pages::flush_cross_cpu_magazine(unsigned cpu_id) {
+    auto& mag = xcpu_magazines[cpu_id];
+    if (!mag.count) {
+        return;
+    }
+    // The owner may have gone away since the objects were queued; leak them, as above
+    if (live_cpus[cpu_id].load(std::memory_order_relaxed)) {
+        push_cross_cpu(cpu_id, mag.head, mag.tail);
+        alloc_stats::increment_local(alloc_stats::types::cross_cpu_free_batches);
+    }
+    mag.head = mag.tail = nullptr;
+    mag.count = 0;
+}
+
+bool cpu_pages::flush_cross_cpu_magazines() {
+    bool flushed = false;
+    for (unsigned i = 0; i < nr_xcpu_dirty_magazines; ++i) {
+        auto cpu_id = xcpu_dirty_magazines[i];
+        flushed |= xcpu_magazines[cpu_id].count != 0;
+        flush_cross_cpu_magazine(cpu_id);
+        xcpu_magazines[cpu_id].dirty = false;
+    }
+    nr_xcpu_dirty_magazines = 0;
+    return flushed;
 }
 
 bool cpu_pages::drain_cross_cpu_freelist() {
@@ -1159,6 +1425,33 @@ void cpu_pages::schedule_reclaim() {
     });
 }
 
+void cpu_pages::schedule_background_reclaim() {
+    current_background_reclaim_free_pages = 0;
+    background_reclaim_scheduled = true;
+    background_reclaim_hook([this] {
+        // Reclaim a bounded amount per task and reschedule, so that the
+        // reclaimers share the cpu with the rest of the scheduling group
+        bool more = false;
+        if (nr_free_pages < background_reclaim_free_pages) {
+            try {
+                auto step = std::min<size_t>(background_reclaim_free_pages - nr_free_pages, background_reclaim_step_pages);
+                more = run_reclaimers(reclaimer_scope::async, step) == reclaiming_result::reclaimed_something
+                        && nr_free_pages < background_reclaim_free_pages;
+            } catch (...) {
+                background_reclaim_scheduled = false;
+                current_background_reclaim_free_pages = background_reclaim_free_pages;
+                throw;
+            }
+        }
+        if (more) {
+            schedule_background_reclaim();
+        } else {
+            background_reclaim_scheduled = false;
+            current_background_reclaim_free_pages = background_reclaim_free_pages;
+        }
+    });
+}
+
 memory::memory_layout cpu_pages::memory_layout() {
     assert(is_initialized());
     return {
@@ -1167,11 +1460,49 @@ memory::memory_layout cpu_pages::memory_layout() {
     };
 }
 
+memory::huge_page_layout cpu_pages::huge_page_layout() {
+    static constexpr size_t pages_per_huge_page = huge_page_size / page_size;
+    memory::huge_page_layout ret;
+    if (!is_initialized()) {
+        return ret;
+    }
+    // Free spans are aligned to their size, so each one either covers whole
+    // huge pages or lies within a single one; count free pages per huge page.
+    std::vector<uint32_t> free_in_region(nr_pages / pages_per_huge_page);
+    for (auto& list : free_spans) {
+        list.for_each(pages, [&] (page& span) {
+            size_t idx = &span - pages;
+            for (auto end = idx + span.span_size; idx < end; idx = align_down(idx + pages_per_huge_page, pages_per_huge_page)) {
+                auto region = idx / pages_per_huge_page;
+                if (region < free_in_region.size()) {
+                    free_in_region[region] += std::min<size_t>(end - idx, pages_per_huge_page - idx % pages_per_huge_page);
+                }
+            }
+        });
+    }
+    ret.total = free_in_region.size();
+    for (auto nr_free : free_in_region) {
+        if (nr_free == pages_per_huge_page) {
+            ++ret.unused;
+        } else if (nr_free) {
+            ++ret.partial;
+        } else {
+            ++ret.full;
+        }
+    }
+    return ret;
+}
+
 void cpu_pages::set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
     reclaim_hook = hook;
     current_min_free_pages = min_free_pages;
 }
 
+void cpu_pages::set_background_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
+    background_reclaim_hook = hook;
+    current_background_reclaim_free_pages = background_reclaim_free_pages;
+}
+
 void cpu_pages::set_min_free_pages(size_t pages) {
     if (pages > std::numeric_limits<decltype(min_free_pages)>::max()) {
         throw std::runtime_error("Number of pages too large");
@@ -1180,6 +1511,18 @@ void cpu_pages::set_min_free_pages(size_t pages) {
     maybe_reclaim();
 }
 
+void cpu_pages::set_background_reclaim_free_pages(size_t pages) {
+    if (pages > std::numeric_limits<decltype(background_reclaim_free_pages)>::max()) {
+        throw std::runtime_error("Number of pages too large");
+    }
+    background_reclaim_free_pages = pages;
+    // Don't re-arm while a background reclaim is pending, it picks up the new value
+    if (background_reclaim_hook && !background_reclaim_scheduled) {
+        current_background_reclaim_free_pages = pages;
+    }
+    maybe_reclaim();
+}
+
 small_pool::small_pool(unsigned object_size) noexcept
     : _object_size(object_size) {
     unsigned span_size = 1;
@@ -1468,6 +1811,10 @@ void shrink(void* obj, size_t new_size) {
     get_cpu_mem().shrink(obj, new_size);
 }
 
+void set_background_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
+    get_cpu_mem().set_background_reclaim_hook(hook);
+}
+
 void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
     get_cpu_mem().set_reclaim_hook(hook);
 }
@@ -1524,6 +1871,8 @@ void configure(std::vector<resource::memory> m, bool mbind,
             return allocate_hugetlbfs_memory(*fdp, where, how_much);
         };
         get_cpu_mem().replace_memory_backing(sys_alloc);
+        get_cpu_mem().hugetlbfs = true;
+        get_cpu_mem().hugetlbfs_file = fdp;
     }
     get_cpu_mem().resize(total, sys_alloc);
     size_t pos = 0;
@@ -1548,24 +1897,97 @@ void configure(std::vector<resource::memory> m, bool mbind,
     }
 }
 
+// Populates the page tables of [start, start + size) without changing its
+// contents, in steps of whole huge pages so that transparent huge pages
+// are used where possible
+static void prefault_range(char* start, size_t size, std::atomic<size_t>& progress) {
+#ifndef MADV_POPULATE_WRITE
+    static constexpr int MADV_POPULATE_WRITE = 23;
+#endif
+    constexpr size_t step = 64 * huge_page_size;
+    size_t done = 0;
+    while (done < size) {
+        auto len = std::min(step, size - done);
+        if (::madvise(start + done, len, MADV_POPULATE_WRITE) != 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            static std::atomic<bool> warned = false;
+            if (!warned.exchange(true)) {
+                seastar_memory_logger.warn("Unable to prefault memory: {}. MADV_POPULATE_WRITE requires Linux 5.14 or later",
+                        std::error_code(errno, std::system_category()).message());
+            }
+            return;
+        }
+        done += len;
+        progress.fetch_add(len, std::memory_order_relaxed);
+    }
+}
+
+void prefault_memory(prefault_mode mode) {
+    auto& cm = get_cpu_mem();
+    // hugetlbfs memory is populated when mapped
+    if (mode == prefault_mode::none || cm.hugetlbfs) {
+        return;
+    }
+    auto start = cm.mem();
+    auto size = size_t(cm.nr_pages) * page_size;
+    auto& progress = cm.prefaulted_bytes;
+    if (mode == prefault_mode::startup) {
+        prefault_range(start, size, progress);
+        return;
+    }
+    // Inherits the affinity of the shard's thread, and only runs when
+    // the shard leaves its cpu idle
+    std::thread([start, size, &progress, cpu = cm.cpu_id] {
+        auto name = format("prefault-{}", cpu);
+        pthread_setname_np(pthread_self(), name.c_str());
+        sched_param param = {};
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+        prefault_range(start, size, progress);
+    }).detach();
+}
+
+size_t prefaulted_memory() {
+    return get_cpu_mem().prefaulted_bytes.load(std::memory_order_relaxed);
+}
+
+std::optional<memory_file> shard_memory_file() noexcept {
+    auto& cm = get_cpu_mem();
+    if (!cm.hugetlbfs_file) {
+        return std::nullopt;
+    }
+    return memory_file{cm.hugetlbfs_file->get(), cm.mem(), size_t(cm.nr_pages) * page_size};
+}
+
 statistics stats() {
     return statistics{alloc_stats::get(alloc_stats::types::allocs), alloc_stats::get(alloc_stats::types::frees), alloc_stats::get(alloc_stats::types::cross_cpu_frees),
-        cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, alloc_stats::get(alloc_stats::types::reclaims), alloc_stats::get(alloc_stats::types::large_allocs),
-        alloc_stats::get(alloc_stats::types::foreign_mallocs), alloc_stats::get(alloc_stats::types::foreign_frees), alloc_stats::get(alloc_stats::types::foreign_cross_frees)};
+        cpu_mem.nr_pages * page_size, (cpu_mem.nr_free_pages + cpu_mem.large_spans.nr_pages) * page_size,
+        alloc_stats::get(alloc_stats::types::reclaims), alloc_stats::get(alloc_stats::types::large_allocs),
+        alloc_stats::get(alloc_stats::types::foreign_mallocs), alloc_stats::get(alloc_stats::types::foreign_frees), alloc_stats::get(alloc_stats::types::foreign_cross_frees),
+        alloc_stats::get(alloc_stats::types::cross_cpu_free_batches), alloc_stats::get(alloc_stats::types::large_span_cache_hits),
+        cpu_mem.large_spans.nr_pages * page_size};
 }
 
 size_t free_memory() {
-    return get_cpu_mem().nr_free_pages * page_size;
+    return (get_cpu_mem().nr_free_pages + get_cpu_mem().large_spans.nr_pages) * page_size;
 }
 
 bool drain_cross_cpu_freelist() {
-    return get_cpu_mem().drain_cross_cpu_freelist();
+    // Hand over what this shard freed for the others, too, so that it doesn't
+    // sit in a half-full magazine
+    auto flushed = get_cpu_mem().flush_cross_cpu_magazines();
+    return get_cpu_mem().drain_cross_cpu_freelist() || flushed;
 }
 
 memory_layout get_memory_layout() {
     return get_cpu_mem().memory_layout();
 }
 
+huge_page_layout get_huge_page_layout() {
+    return get_cpu_mem().huge_page_layout();
+}
+
 size_t min_free_memory() {
     return get_cpu_mem().min_free_pages * page_size;
 }
@@ -1574,6 +1996,20 @@ void set_min_free_pages(size_t pages) {
     get_cpu_mem().set_min_free_pages(pages);
 }
 
+size_t background_reclaim_free_memory() {
+    return get_cpu_mem().background_reclaim_free_pages * page_size;
+}
+
+bool low_memory() noexcept {
+    auto& m = get_cpu_mem();
+    // Threads which never initialized the allocator have no pages at all
+    return m.nr_pages && m.nr_free_pages < std::max<size_t>(m.min_free_pages, m.background_reclaim_free_pages);
+}
+
+void set_background_reclaim_free_pages(size_t pages) {
+    get_cpu_mem().set_background_reclaim_free_pages(pages);
+}
+
 static thread_local int report_on_alloc_failure_suppressed = 0;
 
 class disable_report_on_alloc_failure_temporarily {
@@ -1659,6 +2095,65 @@ static human_readable_value to_hr_number(uint64_t number) {
     return to_human_readable_value(number, 1000, 10000, suffixes);
 }
 
+small_pool_stats small_pool_usage(const small_pool& sp) noexcept {
+    // For the small pools, there are two types of free objects:
+    // Pool freelist objects are poitned to by sp._free and their count is sp._free_count
+    // Span freelist objects are those removed from the pool freelist when that list
+    // becomes too large: they are instead attached to the spans allocated to this
+    // pool. To count this second category, we iterate over the spans below.
+    uint32_t span_freelist_objs = 0;
+    auto front = sp._span_list._front;
+    while (front) {
+        auto& span = get_cpu_mem().pages[front];
+        auto capacity_in_objects = span.span_size * page_size / sp.object_size();
+        span_freelist_objs += capacity_in_objects - span.nr_small_alloc;
+        front = span.link._next;
+    }
+    const auto free_objs = sp._free_count + span_freelist_objs; // pool + span free objects
+    small_pool_stats ret;
+    ret.object_size = sp.object_size();
+    ret.span_size = sp._span_sizes.preferred * page_size;
+    ret.used_objects = sp._pages_in_use * page_size / sp.object_size() - free_objs;
+    ret.memory = sp._pages_in_use * page_size;
+    ret.unused_memory = free_objs * sp.object_size();
+    return ret;
+}
+
+static size_t largest_free_span() noexcept {
+    auto& cpu = get_cpu_mem();
+    for (unsigned i = cpu.nr_span_lists; i-- > 0;) {
+        if (!cpu.free_spans[i].empty()) {
+            return (size_t(1) << i) * page_size;
+        }
+    }
+    return 0;
+}
+
+fragmentation_report get_fragmentation_report() {
+    auto& cpu = get_cpu_mem();
+    fragmentation_report ret;
+    ret.free_memory = cpu.nr_free_pages * page_size;
+    ret.largest_free_span = largest_free_span();
+    ret.free_spans.resize(cpu.nr_span_lists);
+    for (unsigned i = 0; i < cpu.nr_span_lists; i++) {
+        for (auto front = cpu.free_spans[i]._front; front; front = cpu.pages[front].link._next) {
+            ++ret.free_spans[i];
+        }
+    }
+    for (unsigned i = 0; i < cpu.small_pools.nr_small_pools; i++) {
+        auto& sp = cpu.small_pools[i];
+        if (sp.object_size() >= sizeof(free_object) && sp._pages_in_use) {
+            ret.small_pools.push_back(small_pool_usage(sp));
+        }
+    }
+    ret.defragmentations = alloc_stats::get(alloc_stats::types::defragmentations);
+    return ret;
+}
+
+void set_defragmentation_hook(noncopyable_function<bool (size_t)> hook) {
+    get_cpu_mem().defragmentation_hook = std::move(hook);
+}
+
 seastar::internal::log_buf::inserter_iterator do_dump_memory_diagnostics(seastar::internal::log_buf::inserter_iterator it) {
     auto free_mem = get_cpu_mem().nr_free_pages * page_size;
     auto total_mem = get_cpu_mem().nr_pages * page_size;
@@ -1666,6 +2161,7 @@ seastar::internal::log_buf::inserter_iterator do_dump_memory_diagnostics(seastar
 
     it = fmt::format_to(it, "Used memory:  {}\n", to_hr_size(total_mem - free_mem));
     it = fmt::format_to(it, "Free memory:  {}\n", to_hr_size(free_mem));
+    it = fmt::format_to(it, "Largest free span: {}\n", to_hr_size(largest_free_span()));
     it = fmt::format_to(it, "Total memory: {}\n\n", to_hr_size(total_mem));
 
     if (additional_diagnostics_producer) {
@@ -1688,31 +2184,15 @@ seastar::internal::log_buf::inserter_iterator do_dump_memory_diagnostics(seastar
             continue;
         }
 
-        // For the small pools, there are two types of free objects:
-        // Pool freelist objects are poitned to by sp._free and their count is sp._free_count
-        // Span freelist objects are those removed from the pool freelist when that list
-        // becomes too large: they are instead attached to the spans allocated to this
-        // pool. To count this second category, we iterate over the spans below.
-        uint32_t span_freelist_objs = 0;
-        auto front = sp._span_list._front;
-        while (front) {
-            auto& span = get_cpu_mem().pages[front];
-            auto capacity_in_objects = span.span_size * page_size / sp.object_size();
-            span_freelist_objs += capacity_in_objects - span.nr_small_alloc;
-            front = span.link._next;
-        }
-        const auto free_objs = sp._free_count + span_freelist_objs; // pool + span free objects
-        const auto use_count = sp._pages_in_use * page_size / sp.object_size() - free_objs;
-        auto memory = sp._pages_in_use * page_size;
-        const auto unused = free_objs * sp.object_size();
-        const auto wasted_percent = memory ? unused * 100 / memory : 0;
+        auto usage = small_pool_usage(sp);
+        const auto wasted_percent = usage.memory ? usage.unused_memory * 100 / usage.memory : 0;
         it = fmt::format_to(it,
                 "{}\t{}\t{}\t{}\t{}\t{}\n",
-                sp.object_size(),
-                to_hr_size(sp._span_sizes.preferred * page_size),
-                to_hr_number(use_count),
-                to_hr_size(memory),
-                to_hr_size(unused),
+                usage.object_size,
+                to_hr_size(usage.span_size),
+                to_hr_number(usage.used_objects),
+                to_hr_size(usage.memory),
+                to_hr_size(usage.unused_memory),
                 unsigned(wasted_percent));
     }
     it = fmt::format_to(it, "Page spans:\n");
@@ -2227,6 +2707,17 @@ scoped_heap_profiling::scoped_heap_profiling() noexcept {
 scoped_heap_profiling::~scoped_heap_profiling() {
 }
 
+void set_heap_profiling_sample_period(size_t) {
+}
+
+size_t get_heap_profiling_sample_period() {
+    return 0;
+}
+
+std::vector<heap_profile_entry> get_heap_profile() {
+    return {};
+}
+
 void enable_abort_on_allocation_failure() {
     seastar_logger.warn("Seastar compiled with default allocator, will not abort on bad_alloc");
 }
@@ -2243,11 +2734,25 @@ reclaimer::~reclaimer() {
 void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
 }
 
+void set_background_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
+}
+
 void configure(std::vector<resource::memory> m, bool mbind, std::optional<std::string> hugepages_path) {
 }
 
+void prefault_memory(prefault_mode mode) {
+}
+
+size_t prefaulted_memory() {
+    return 0;
+}
+
+std::optional<memory_file> shard_memory_file() noexcept {
+    return std::nullopt;
+}
+
 statistics stats() {
-    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0, 0, 0, 0, 0};
+    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0, 0, 0, 0, 0, 0, 0, 0};
 }
 
 bool drain_cross_cpu_freelist() {
@@ -2258,6 +2763,10 @@ memory_layout get_memory_layout() {
     throw std::runtime_error("get_memory_layout() not supported");
 }
 
+huge_page_layout get_huge_page_layout() {
+    return {};
+}
+
 size_t min_free_memory() {
     return 0;
 }
@@ -2266,6 +2775,18 @@ void set_min_free_pages(size_t pages) {
     // Ignore, reclaiming not supported for default allocator.
 }
 
+size_t background_reclaim_free_memory() {
+    return 0;
+}
+
+bool low_memory() noexcept {
+    return false;
+}
+
+void set_background_reclaim_free_pages(size_t pages) {
+    // Ignore, reclaiming not supported for default allocator.
+}
+
 void set_large_allocation_warning_threshold(size_t) {
     // Ignore, not supported for default allocator.
 }
@@ -2297,6 +2818,14 @@ sstring generate_memory_diagnostics_report() {
     return {};
 }
 
+fragmentation_report get_fragmentation_report() {
+    return {};
+}
+
+void set_defragmentation_hook(noncopyable_function<bool (size_t)>) {
+    // Ignore, not supported for default allocator.
+}
+
 }
 
 }
@@ -2305,6 +2834,26 @@ namespace seastar {
 
 #endif
 
+namespace memory {
+
+size_t collapse_huge_pages(void* ptr, size_t size) {
+#ifndef MADV_COLLAPSE
+    static constexpr int MADV_COLLAPSE = 25;
+#endif
+    auto start = align_up(reinterpret_cast<uintptr_t>(ptr), uintptr_t(huge_page_size));
+    auto end = align_down(reinterpret_cast<uintptr_t>(ptr) + size, uintptr_t(huge_page_size));
+    if (start >= end) {
+        return 0;
+    }
+    ::madvise(reinterpret_cast<void*>(start), end - start, MADV_HUGEPAGE);
+    if (::madvise(reinterpret_cast<void*>(start), end - start, MADV_COLLAPSE) != 0) {
+        return 0;
+    }
+    return end - start;
+}
+
+}
+
 /// \endcond
 
 }
@@ -109,6 +109,26 @@ future<> configure(const options& opts) {
     });
 }
 
+future<> set_relabel_configs(std::vector<relabel_config> configs) {
+    return smp::invoke_on_all([configs = std::move(configs)] {
+        impl::get_local_impl()->set_relabel_configs(configs);
+    });
+}
+
+const std::vector<relabel_config>& get_relabel_configs() {
+    return impl::get_local_impl()->get_relabel_configs();
+}
+
+future<> set_metric_family_configs(std::vector<metric_family_config> configs) {
+    return smp::invoke_on_all([configs = std::move(configs)] {
+        impl::get_local_impl()->set_metric_family_configs(configs);
+    });
+}
+
+const std::vector<metric_family_config>& get_metric_family_configs() {
+    return impl::get_local_impl()->get_metric_family_configs();
+}
+
 
 bool label_instance::operator!=(const label_instance& id2) const {
     auto& id1 = *this;
@@ -118,16 +138,61 @@ bool label_instance::operator!=(const label_instance& id2) const {
 label shard_label("shard");
 namespace impl {
 
-registered_metric::registered_metric(metric_id id, metric_function f, bool enabled) :
-        _f(f), _impl(get_local_impl()) {
+registered_metric::registered_metric(metric_id id, metric_function f, bool enabled, std::vector<sstring> aggregate_labels) :
+        _f(f), _impl(get_local_impl()), _registered_enabled(enabled), _registered_aggregate_labels(aggregate_labels) {
     _info.enabled = enabled;
     _info.id = id;
+    _info.aggregate_labels = std::move(aggregate_labels);
+    _info.formatted_labels = format_labels(id.labels());
+}
+
+void registered_metric::apply_configs(const sstring& family_name, const std::vector<relabel_config>& relabel_configs,
+        const std::vector<metric_family_config>& family_configs) {
+    _info.enabled = _registered_enabled;
+    for (auto&& rc : relabel_configs) {
+        sstring value;
+        const char* separator = "";
+        for (auto&& l : rc.source_labels) {
+            value += separator;
+            separator = rc.separator.c_str();
+            if (l == "__name__") {
+                value += family_name;
+            } else if (auto i = _info.id.labels().find(l); i != _info.id.labels().end()) {
+                value += i->second;
+            }
+        }
+        bool match = std::regex_match(value.begin(), value.end(), rc.expr);
+        if (match == (rc.action == relabel_config::relabel_action::drop)) {
+            _info.enabled = false;
+        }
+    }
+    _info.aggregate_labels = _registered_aggregate_labels;
+    for (auto&& fc : family_configs) {
+        if (fc.name.empty() ? std::regex_match(family_name.begin(), family_name.end(), fc.regex_name) : fc.name == family_name) {
+            _info.aggregate_labels.insert(_info.aggregate_labels.end(), fc.aggregate_labels.begin(), fc.aggregate_labels.end());
+        }
+    }
+}
+
+sstring format_labels(const labels_type& labels) {
+    sstring res;
+    const char* delimiter = "";
+    for (auto&& l : labels) {
+        res += delimiter;
+        res += l.first;
+        res += "=\"";
+        res += l.second;
+        res += "\"";
+        delimiter = ",";
+    }
+    return res;
 }
 
 metric_value metric_value::operator+(const metric_value& c) {
     metric_value res(*this);
     switch (_type) {
     case data_type::HISTOGRAM:
+    case data_type::SUMMARY:
         std::get<histogram>(res.u) += std::get<histogram>(c.u);
         break;
     default:
@@ -172,6 +237,13 @@ metric_definition_impl& metric_definition_impl::set_type(const sstring& type_nam
     return *this;
 }
 
+metric_definition_impl& metric_definition_impl::aggregate(const std::vector<label>& labels) {
+    for (auto&& l : labels) {
+        aggregate_labels.push_back(l.name());
+    }
+    return *this;
+}
+
 std::unique_ptr<metric_groups_def> create_metric_groups() {
     return  std::make_unique<metric_groups_impl>();
 }
@@ -186,7 +258,8 @@ metric_groups_impl& metric_groups_impl::add_metric(group_name_type name, const m
 
     metric_id id(name, md._impl->name, md._impl->labels);
 
-    get_local_impl()->add_registration(id, md._impl->type, md._impl->f, md._impl->d, md._impl->enabled);
+    get_local_impl()->add_registration(id, md._impl->type, md._impl->f, md._impl->d, md._impl->enabled,
+            md._impl->aggregate_labels);
 
     _registration.push_back(id);
     return *this;
@@ -283,6 +356,27 @@ instance_id_type shard() {
     return sstring("0");
 }
 
+void impl::apply_configs() {
+    for (auto&& mf : _value_map) {
+        for (auto&& m : mf.second) {
+            if (m.second) {
+                m.second->apply_configs(mf.first, _relabel_configs, _metric_family_configs);
+            }
+        }
+    }
+    dirty();
+}
+
+void impl::set_relabel_configs(std::vector<relabel_config> configs) {
+    _relabel_configs = std::move(configs);
+    apply_configs();
+}
+
+void impl::set_metric_family_configs(std::vector<metric_family_config> configs) {
+    _metric_family_configs = std::move(configs);
+    apply_configs();
+}
+
 void impl::update_metrics_if_needed() {
     if (_dirty) {
         // Forcing the metadata to an empty initialization
@@ -327,9 +421,11 @@ std::vector<std::vector<metric_function>>& impl::functions() {
     return _current_metrics;
 }
 
-void impl::add_registration(const metric_id& id, const metric_type& type, metric_function f, const description& d, bool enabled) {
-    auto rm = ::seastar::make_shared<registered_metric>(id, f, enabled);
+void impl::add_registration(const metric_id& id, const metric_type& type, metric_function f, const description& d, bool enabled,
+        std::vector<sstring> aggregate_labels) {
+    auto rm = ::seastar::make_shared<registered_metric>(id, f, enabled, std::move(aggregate_labels));
     sstring name = id.full_name();
+    rm->apply_configs(name, _relabel_configs, _metric_family_configs);
     if (_value_map.find(name) != _value_map.end()) {
         auto& metric = _value_map[name];
         if (metric.find(id.labels()) != metric.end()) {
@@ -344,6 +440,7 @@ void impl::add_registration(const metric_id& id, const metric_type& type, metric
         _value_map[name].info().d = d;
         _value_map[name].info().inherit_type = type.type_name;
         _value_map[name].info().name = id.full_name();
+        _value_map[name].info().quantiles = type.quantiles;
         _value_map[name][id.labels()] = rm;
     }
     dirty();
@@ -365,6 +462,8 @@ histogram& histogram::operator+=(const histogram& c) {
             buckets[i].count += c.buckets[i].count;
         }
     }
+    sample_count += c.sample_count;
+    sample_sum += c.sample_sum;
     return *this;
 }
 
@@ -0,0 +1,471 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/otlp.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/thread.hh>
+#include <seastar/core/with_scheduling_group.hh>
+#include <seastar/http/client.hh>
+#include <seastar/util/log.hh>
+#include <seastar/util/short_streams.hh>
+#include <boost/range/irange.hpp>
+#include <cmath>
+#include <map>
+#include <zlib.h>
+
+namespace seastar {
+
+extern seastar::logger seastar_logger;
+
+namespace otlp {
+
+namespace mi = metrics::impl;
+
+namespace {
+
+// AggregationTemporality of the OTLP protocol
+constexpr int aggregation_temporality_delta = 1;
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void append_string(std::string& buf, std::string_view s) {
+    buf += '"';
+    for (char c : s) {
+        switch (c) {
+        case '"': buf += "\\\""; break;
+        case '\\': buf += "\\\\"; break;
+        case '\n': buf += "\\n"; break;
+        case '\r': buf += "\\r"; break;
+        case '\t': buf += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                fmt::format_to(std::back_inserter(buf), "\\u{:04x}", c);
+            } else {
+                buf += c;
+            }
+        }
+    }
+    buf += '"';
+}
+
+// JSON has no infinities or NaN, the protobuf JSON mapping spells them as strings
+void append_double(std::string& buf, double d) {
+    if (std::isnan(d)) {
+        buf += "\"NaN\"";
+    } else if (std::isinf(d)) {
+        buf += d > 0 ? "\"Infinity\"" : "\"-Infinity\"";
+    } else {
+        fmt::format_to(std::back_inserter(buf), "{}", d);
+    }
+}
+
+// 64 bit integers are strings in the protobuf JSON mapping
+void append_uint64(std::string& buf, uint64_t v) {
+    fmt::format_to(std::back_inserter(buf), "\"{}\"", v);
+}
+
+void append_attributes(std::string& buf, const mi::labels_type& labels, const std::optional<metrics::label_instance>& label) {
+    buf += "\"attributes\":[";
+    const char* delimiter = "";
+    auto append = [&] (std::string_view key, std::string_view value) {
+        buf += delimiter;
+        buf += "{\"key\":";
+        append_string(buf, key);
+        buf += ",\"value\":{\"stringValue\":";
+        append_string(buf, value);
+        buf += "}}";
+        delimiter = ",";
+    };
+    if (label) {
+        append(label->key(), label->value());
+    }
+    for (auto&& l : labels) {
+        append(l.first, l.second);
+    }
+    buf += "]";
+}
+
+// The series of a metric family, on all shards, as they are reported
+using family_series = std::vector<std::pair<mi::labels_type, mi::metric_value>>;
+
+family_series collect_series(const std::vector<std::pair<const mi::metric_family_metadata*, const mi::value_vector*>>& shards) {
+    family_series series;
+    std::map<mi::labels_type, mi::metric_value> aggregated;
+    for (auto&& [metadata, values] : shards) {
+        for (size_t i = 0; i < metadata->metrics.size(); i++) {
+            auto& info = metadata->metrics[i];
+            auto& value = (*values)[i];
+            if (info.aggregate_labels.empty()) {
+                series.emplace_back(info.id.labels(), value);
+                continue;
+            }
+            auto labels = info.id.labels();
+            for (auto&& l : info.aggregate_labels) {
+                labels.erase(l);
+            }
+            auto it = aggregated.find(labels);
+            if (it == aggregated.end()) {
+                aggregated.emplace(std::move(labels), value);
+            } else {
+                it->second += value;
+            }
+        }
+    }
+    for (auto&& [labels, value] : aggregated) {
+        series.emplace_back(labels, std::move(value));
+    }
+    return series;
+}
+
+// The histogram of the values added since prev, which is what delta
+// temporality reports. A histogram that went back, because its
+// metric was registered anew, is reported whole.
+metrics::histogram histogram_delta(const metrics::histogram& h, const metrics::histogram& prev) {
+    if (prev.buckets.size() != h.buckets.size() || prev.sample_count > h.sample_count) {
+        return h;
+    }
+    metrics::histogram delta = h;
+    delta.sample_count -= prev.sample_count;
+    delta.sample_sum -= prev.sample_sum;
+    for (size_t i = 0; i < h.buckets.size(); i++) {
+        if (h.buckets[i].upper_bound != prev.buckets[i].upper_bound || prev.buckets[i].count > h.buckets[i].count) {
+            return h;
+        }
+        delta.buckets[i].count -= prev.buckets[i].count;
+    }
+    return delta;
+}
+
+std::unique_ptr<http::experimental::client> make_client(const config& cfg, std::unique_ptr<http::experimental::connection_factory> f) {
+    if (f) {
+        return std::make_unique<http::experimental::client>(std::move(f), cfg.host);
+    }
+    if (cfg.creds) {
+        return std::make_unique<http::experimental::client>(cfg.address, cfg.creds, cfg.host);
+    }
+    return std::make_unique<http::experimental::client>(cfg.address, cfg.host);
+}
+
+sstring gzip(std::string_view in) {
+    z_stream zs = {};
+    // Adding 16 to the window bits makes a gzip wrapper
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::bad_alloc();
+    }
+    sstring out = uninitialized_string(deflateBound(&zs, in.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = in.size();
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = out.size();
+    auto ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error("OTLP request gzip failure");
+    }
+    out.resize(zs.total_out);
+    return out;
+}
+
+}
+
+exporter::exporter(config cfg)
+        : exporter(std::move(cfg), nullptr) {
+}
+
+exporter::exporter(config cfg, std::unique_ptr<http::experimental::connection_factory> f)
+        : _cfg(std::move(cfg))
+        , _client(make_client(_cfg, std::move(f)))
+        , _start_time(now_ns())
+        , _timer([this] {
+            if (!_pushing && !_gate.is_closed()) {
+                (void)push().handle_exception([] (std::exception_ptr ep) {
+                    seastar_logger.warn("otlp: failed to push metrics: {}", ep);
+                });
+            }
+        }) {
+    namespace sm = metrics;
+    _metrics.add_group("otlp", {
+        sm::make_counter("pushes", _stats.pushes, sm::description("Number of times metrics were pushed")),
+        sm::make_counter("requests", _stats.requests, sm::description("Number of export requests sent")),
+        sm::make_counter("failed_requests", _stats.failed_requests, sm::description("Number of export requests that failed")),
+        sm::make_counter("data_points", _stats.data_points, sm::description("Number of data points exported")),
+        sm::make_counter("bytes_sent", _stats.bytes_sent, sm::description("Number of bytes of export requests sent, after compression")),
+    });
+}
+
+exporter::~exporter() = default;
+
+void exporter::start() {
+    _timer.arm_periodic(_cfg.period);
+}
+
+future<> exporter::send(sstring body) {
+    if (_cfg.compress) {
+        body = gzip(body);
+    }
+    auto req = httpd::request::make("POST", _cfg.host, _cfg.path);
+    if (_cfg.compress) {
+        req._headers["Content-Encoding"] = "gzip";
+    }
+    _stats.requests++;
+    _stats.bytes_sent += body.size();
+    req.write_body("json", std::move(body));
+    return _client->make_request(std::move(req), [] (const httpd::reply&, input_stream<char>& in) {
+        return util::skip_entire_stream(in);
+    }).handle_exception([this] (std::exception_ptr ep) {
+        _stats.failed_requests++;
+        return make_exception_future<>(std::move(ep));
+    });
+}
+
+future<> exporter::push() {
+    if (_pushing) {
+        return make_ready_future<>();
+    }
+    _pushing = true;
+    return futurize_invoke([this] {
+        return with_gate(_gate, [this] {
+            return with_scheduling_group(_cfg.sg, [this] {
+                return do_push();
+            });
+        });
+    }).finally([this] {
+        _pushing = false;
+    });
+}
+
+future<> exporter::do_push() {
+    return do_with(std::vector<foreign_ptr<mi::values_reference>>(smp::count), [this] (std::vector<foreign_ptr<mi::values_reference>>& shards) {
+        return parallel_for_each(boost::irange(0u, smp::count), [&shards] (unsigned cpu) {
+            return smp::submit_to(cpu, [] {
+                return mi::get_values();
+            }).then([&shards, cpu] (foreign_ptr<mi::values_reference> values) {
+                shards[cpu] = std::move(values);
+            });
+        }).then([this, &shards] {
+            thread_attributes attr;
+            attr.sched_group = _cfg.sg;
+            return seastar::async(std::move(attr), [this, &shards] {
+                export_values(shards);
+            });
+        });
+    });
+}
+
+void exporter::export_values(const std::vector<foreign_ptr<mi::values_reference>>& shards) {
+    // The families of all the shards, merged by name
+    std::map<sstring, std::vector<std::pair<const mi::metric_family_metadata*, const mi::value_vector*>>> families;
+    for (auto&& shard : shards) {
+        for (size_t i = 0; i < shard->metadata->size(); i++) {
+            auto& family = (*shard->metadata)[i];
+            families[family.mf.name].emplace_back(&family, &shard->values[i]);
+        }
+    }
+
+    auto push_id = ++_stats.pushes;
+    auto now = now_ns();
+    std::string buf;
+    buf.reserve(_cfg.max_request_size + _cfg.max_request_size / 4);
+    std::string key;
+    bool empty = true;
+    auto begin_request = [&] {
+        buf.clear();
+        buf += "{\"resourceMetrics\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":";
+        append_string(buf, _cfg.service_name);
+        buf += "}}]},\"scopeMetrics\":[{\"scope\":{\"name\":\"seastar\"},\"metrics\":[";
+        empty = true;
+    };
+    auto end_request = [&] {
+        if (!empty) {
+            buf += "]}]}]}";
+            send(sstring(buf.data(), buf.size())).get();
+        }
+    };
+    begin_request();
+
+    for (auto&& [family_name, shard_families] : families) {
+        auto& mf = shard_families.front().first->mf;
+        auto name = _cfg.prefix + "_" + family_name;
+        auto series = collect_series(shard_families);
+        if (series.empty()) {
+            continue;
+        }
+        if (!empty) {
+            buf += ",";
+        }
+        empty = false;
+        buf += "{\"name\":";
+        append_string(buf, name);
+        buf += ",\"description\":";
+        append_string(buf, mf.d.str());
+        switch (mf.type) {
+        case mi::data_type::GAUGE:
+            buf += ",\"gauge\":{\"dataPoints\":[";
+            break;
+        case mi::data_type::COUNTER:
+        case mi::data_type::DERIVE:
+        case mi::data_type::ABSOLUTE:
+            fmt::format_to(std::back_inserter(buf), ",\"sum\":{{\"aggregationTemporality\":{},\"isMonotonic\":{},\"dataPoints\":[",
+                    aggregation_temporality_delta, mf.type != mi::data_type::DERIVE);
+            break;
+        case mi::data_type::HISTOGRAM:
+            fmt::format_to(std::back_inserter(buf), ",\"histogram\":{{\"aggregationTemporality\":{},\"dataPoints\":[",
+                    aggregation_temporality_delta);
+            break;
+        case mi::data_type::SUMMARY:
+            buf += ",\"summary\":{\"dataPoints\":[";
+            break;
+        }
+
+        const char* delimiter = "";
+        for (auto&& [labels, value] : series) {
+            buf += delimiter;
+            delimiter = ",";
+            buf += "{";
+            append_attributes(buf, labels, _cfg.label);
+            key.assign(name.data(), name.size());
+            key += '{';
+            key += mi::format_labels(labels);
+            auto& prev = _previous[sstring(key.data(), key.size())];
+            if (!prev.seen) {
+                prev.start_time = _start_time;
+            }
+            prev.seen = push_id;
+            buf += ",\"startTimeUnixNano\":";
+            append_uint64(buf, prev.start_time);
+            buf += ",\"timeUnixNano\":";
+            append_uint64(buf, now);
+            switch (mf.type) {
+            case mi::data_type::GAUGE:
+                buf += ",\"asDouble\":";
+                append_double(buf, value.d());
+                break;
+            case mi::data_type::ABSOLUTE:
+                // Absolute metrics are reset on every read
+                buf += ",\"asDouble\":";
+                append_double(buf, value.d());
+                break;
+            case mi::data_type::COUNTER:
+            case mi::data_type::DERIVE: {
+                auto v = value.d();
+                // A counter that went back was reset
+                auto delta = mf.type == mi::data_type::COUNTER && v < prev.value ? v : v - prev.value;
+                buf += ",\"asDouble\":";
+                append_double(buf, delta);
+                prev.value = v;
+                break;
+            }
+            case mi::data_type::HISTOGRAM: {
+                auto& h = value.get_histogram();
+                auto delta = histogram_delta(h, prev.histogram);
+                buf += ",\"count\":";
+                append_uint64(buf, delta.sample_count);
+                buf += ",\"sum\":";
+                append_double(buf, delta.sample_sum);
+                // OTLP buckets are not cumulative, and there
+                // is one more than bounds, for the rest
+                buf += ",\"bucketCounts\":[";
+                uint64_t below = 0;
+                for (auto&& b : delta.buckets) {
+                    append_uint64(buf, b.count - below);
+                    buf += ",";
+                    below = b.count;
+                }
+                append_uint64(buf, delta.sample_count - std::min(below, delta.sample_count));
+                buf += "],\"explicitBounds\":[";
+                const char* d = "";
+                for (auto&& b : delta.buckets) {
+                    buf += d;
+                    append_double(buf, b.upper_bound);
+                    d = ",";
+                }
+                buf += "]";
+                prev.histogram = h;
+                break;
+            }
+            case mi::data_type::SUMMARY: {
+                auto& h = value.get_histogram();
+                buf += ",\"count\":";
+                append_uint64(buf, h.sample_count);
+                buf += ",\"sum\":";
+                append_double(buf, h.sample_sum);
+                buf += ",\"quantileValues\":[";
+                const char* d = "";
+                for (auto q : mf.quantiles) {
+                    auto rank = std::max<uint64_t>(uint64_t(std::ceil(q * h.sample_count)), 1);
+                    double v = h.buckets.empty() ? 0 : h.buckets.back().upper_bound;
+                    for (auto&& b : h.buckets) {
+                        if (b.count >= rank) {
+                            v = b.upper_bound;
+                            break;
+                        }
+                    }
+                    buf += d;
+                    buf += "{\"quantile\":";
+                    append_double(buf, q);
+                    buf += ",\"value\":";
+                    append_double(buf, h.sample_count ? v : 0);
+                    buf += "}";
+                    d = ",";
+                }
+                buf += "]";
+                break;
+            }
+            }
+            buf += "}";
+            if (mf.type == mi::data_type::COUNTER || mf.type == mi::data_type::DERIVE || mf.type == mi::data_type::HISTOGRAM) {
+                // The next delta starts where this one ended
+                prev.start_time = now;
+            }
+            _stats.data_points++;
+            thread::maybe_yield();
+        }
+        buf += "]}}";
+        if (buf.size() >= _cfg.max_request_size) {
+            end_request();
+            begin_request();
+        }
+    }
+    end_request();
+
+    // Forget the series that are gone
+    for (auto i = _previous.begin(); i != _previous.end();) {
+        if (i->second.seen != push_id) {
+            i = _previous.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+future<> exporter::stop() {
+    _timer.cancel();
+    return _gate.close().then([this] {
+        return _client->close();
+    });
+}
+
+}
+}
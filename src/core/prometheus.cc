@@ -20,7 +20,7 @@
  */
 
 #include <seastar/core/prometheus.hh>
-#include <sstream>
+#include <cmath>
 
 #include <seastar/core/scollectd_api.hh>
 #include "core/scollectd-impl.hh"
@@ -50,6 +50,8 @@ static std::string to_str(seastar::metrics::impl::data_type dt) {
         return "counter";
     case seastar::metrics::impl::data_type::HISTOGRAM:
         return "histogram";
+    case seastar::metrics::impl::data_type::SUMMARY:
+        return "summary";
     case seastar::metrics::impl::data_type::DERIVE:
     case seastar::metrics::impl::data_type::ABSOLUTE:
         // Prometheus server does not respect derive/absolute parameters
@@ -59,38 +61,40 @@ static std::string to_str(seastar::metrics::impl::data_type dt) {
     return "untyped";
 }
 
-static std::string to_str(const seastar::metrics::impl::metric_value& v) {
-    switch (v.type()) {
-    case seastar::metrics::impl::data_type::GAUGE:
-        return std::to_string(v.d());
-    case seastar::metrics::impl::data_type::COUNTER:
-    case seastar::metrics::impl::data_type::ABSOLUTE:
-        return std::to_string(v.ui());
-    case seastar::metrics::impl::data_type::DERIVE:
-        return std::to_string(v.i());
-    case seastar::metrics::impl::data_type::HISTOGRAM:
-        break;
+/*!
+ * \brief the q-quantile of the values of a histogram
+ *
+ * This is the upper bound of the first bucket that holds at least a q
+ * fraction of the values, or the last bound if no bucket does.
+ */
+static double quantile(const metrics::histogram& h, double q) {
+    if (h.buckets.empty() || !h.sample_count) {
+        return 0;
+    }
+    auto rank = std::max<uint64_t>(uint64_t(std::ceil(q * h.sample_count)), 1);
+    for (auto&& b : h.buckets) {
+        if (b.count >= rank) {
+            return b.upper_bound;
+        }
     }
-    return ""; // we should never get here but it makes the compiler happy
+    return h.buckets.back().upper_bound;
 }
 
-static void add_name(std::ostream& s, const sstring& name, const std::map<sstring, sstring>& labels, const config& ctx) {
-    s << name << "{";
+// Appends the name of a series, with its labels in braces, to buf
+static void add_name(std::string& buf, std::string_view name, std::string_view suffix, std::string_view ctx_label,
+        std::string_view labels, std::string_view extra = {}) {
+    buf += name;
+    buf += suffix;
+    buf += '{';
     const char* delimiter = "";
-    if (ctx.label) {
-        s << ctx.label->key()  << "=\"" << ctx.label->value() << '"';
-        delimiter = ",";
-    }
-
-    if (!labels.empty()) {
-        for (auto l : labels) {
-            s << delimiter;
-            s << l.first  << "=\"" << l.second << '"';
+    for (auto l : {ctx_label, labels, extra}) {
+        if (!l.empty()) {
+            buf += delimiter;
+            buf += l;
             delimiter = ",";
         }
     }
-    s << "} ";
-
+    buf += "} ";
 }
 
 /*!
@@ -484,63 +488,120 @@ metric_family_range get_range(const metrics_families_per_shard& mf, const sstrin
 
 }
 
+// The text written is flushed to the output stream once it is this large
+static constexpr size_t flush_size = 16384;
+
+static void write_value(std::string& buf, const sstring& name, const mi::metric_family_info& family,
+        const mi::metric_value& value, std::string_view labels, std::string_view ctx_label, std::string& extra) {
+    auto it = std::back_inserter(buf);
+    if (value.type() == mi::data_type::HISTOGRAM) {
+        auto&& h = value.get_histogram();
+        add_name(buf, name, "_sum", ctx_label, labels);
+        fmt::format_to(it, "{:g}\n", h.sample_sum);
+        add_name(buf, name, "_count", ctx_label, labels);
+        fmt::format_to(it, "{}\n", h.sample_count);
+        for (auto&& i : h.buckets) {
+            extra.clear();
+            fmt::format_to(std::back_inserter(extra), "le=\"{:f}\"", i.upper_bound);
+            add_name(buf, name, "_bucket", ctx_label, labels, extra);
+            fmt::format_to(it, "{}\n", i.count);
+        }
+        add_name(buf, name, "_bucket", ctx_label, labels, "le=\"+Inf\"");
+        fmt::format_to(it, "{}\n", h.sample_count);
+    } else if (value.type() == mi::data_type::SUMMARY) {
+        auto&& h = value.get_histogram();
+        for (auto q : family.quantiles) {
+            extra.clear();
+            fmt::format_to(std::back_inserter(extra), "quantile=\"{:f}\"", q);
+            add_name(buf, name, "", ctx_label, labels, extra);
+            fmt::format_to(it, "{:g}\n", quantile(h, q));
+        }
+        add_name(buf, name, "_sum", ctx_label, labels);
+        fmt::format_to(it, "{:g}\n", h.sample_sum);
+        add_name(buf, name, "_count", ctx_label, labels);
+        fmt::format_to(it, "{}\n", h.sample_count);
+    } else {
+        add_name(buf, name, "", ctx_label, labels);
+        try {
+            switch (value.type()) {
+            case mi::data_type::GAUGE:
+                fmt::format_to(it, "{:f}\n", value.d());
+                break;
+            case mi::data_type::COUNTER:
+            case mi::data_type::ABSOLUTE:
+                fmt::format_to(it, "{}\n", value.ui());
+                break;
+            default:
+                fmt::format_to(it, "{}\n", value.i());
+                break;
+            }
+        } catch (const std::range_error& e) {
+            seastar_logger.debug("prometheus: write_text_representation: {}{{{}}}: {}", name, labels, e.what());
+            buf += "NaN\n";
+        } catch (...) {
+            auto ex = std::current_exception();
+            // print this error as it's ignored later on by `connection::start_response`
+            seastar_logger.error("prometheus: write_text_representation: {}{{{}}}: {}", name, labels, ex);
+            std::rethrow_exception(std::move(ex));
+        }
+    }
+}
+
 future<> write_text_representation(output_stream<char>& out, const config& ctx, const metric_family_range& m) {
     return seastar::async([&ctx, &out, &m] () mutable {
-        bool found = false;
+        // The text is built in buf, which is reused so that formatting does
+        // not allocate once it grew, and written out in large pieces
+        std::string buf;
+        buf.reserve(flush_size * 2);
+        std::string extra;
+        auto maybe_flush = [&buf, &out] {
+            if (buf.size() >= flush_size) {
+                out.write(buf.data(), buf.size()).get();
+                buf.clear();
+            }
+            thread::maybe_yield();
+        };
+        sstring ctx_label = ctx.label ? mi::format_labels({{ctx.label->key(), ctx.label->value()}}) : sstring();
         for (metric_family& metric_family : m) {
             auto name = ctx.prefix + "_" + metric_family.name();
-            found = false;
-            metric_family.foreach_metric([&out, &ctx, &found, &name, &metric_family](auto value, auto value_info) mutable {
-                std::stringstream s;
+            bool found = false;
+            auto write_header = [&] {
                 if (!found) {
                     if (metric_family.metadata().d.str() != "") {
-                        s << "# HELP " << name << " " <<  metric_family.metadata().d.str() << "\n";
+                        fmt::format_to(std::back_inserter(buf), "# HELP {} {}\n", name, metric_family.metadata().d.str());
                     }
-                    s << "# TYPE " << name << " " << to_str(metric_family.metadata().type) << "\n";
+                    fmt::format_to(std::back_inserter(buf), "# TYPE {} {}\n", name, to_str(metric_family.metadata().type));
                     found = true;
                 }
-                if (value.type() == mi::data_type::HISTOGRAM) {
-                    auto&& h = value.get_histogram();
-                    std::map<sstring, sstring> labels = value_info.id.labels();
-                    add_name(s, name + "_sum", labels, ctx);
-                    s << h.sample_sum;
-                    s << "\n";
-                    add_name(s, name + "_count", labels, ctx);
-                    s << h.sample_count;
-                    s << "\n";
-
-                    auto& le = labels["le"];
-                    auto bucket = name + "_bucket";
-                    for (auto  i : h.buckets) {
-                         le = std::to_string(i.upper_bound);
-                        add_name(s, bucket, labels, ctx);
-                        s << i.count;
-                        s << "\n";
+            };
+            // The values of metrics that are aggregated, by their remaining labels
+            std::map<std::map<sstring, sstring>, mi::metric_value> aggregated;
+            metric_family.foreach_metric([&] (const mi::metric_value& value, const mi::metric_info& value_info) {
+                if (!value_info.aggregate_labels.empty()) {
+                    auto labels = value_info.id.labels();
+                    for (auto&& l : value_info.aggregate_labels) {
+                        labels.erase(l);
                     }
-                    labels["le"] = "+Inf";
-                    add_name(s, bucket, labels, ctx);
-                    s << h.sample_count;
-                    s << "\n";
-                } else {
-                    add_name(s, name, value_info.id.labels(), ctx);
-                    std::string value_str;
-                    try {
-                        value_str = to_str(value);
-                    } catch (const std::range_error& e) {
-                        seastar_logger.debug("prometheus: write_text_representation: {}: {}", s.str(), e.what());
-                        value_str = "NaN";
-                    } catch (...) {
-                        auto ex = std::current_exception();
-                        // print this error as it's ignored later on by `connection::start_response`
-                        seastar_logger.error("prometheus: write_text_representation: {}: {}", s.str(), ex);
-                        std::rethrow_exception(std::move(ex));
+                    auto i = aggregated.find(labels);
+                    if (i == aggregated.end()) {
+                        aggregated.emplace(std::move(labels), value);
+                    } else {
+                        i->second += value;
                     }
-                    s << value_str;
-                    s << "\n";
+                    return;
                 }
-                out.write(s.str()).get();
-                thread::maybe_yield();
+                write_header();
+                write_value(buf, name, metric_family.metadata(), value, value_info.formatted_labels, ctx_label, extra);
+                maybe_flush();
             });
+            for (auto&& [labels, value] : aggregated) {
+                write_header();
+                write_value(buf, name, metric_family.metadata(), value, mi::format_labels(labels), ctx_label, extra);
+                maybe_flush();
+            }
+        }
+        if (!buf.empty()) {
+            out.write(buf.data(), buf.size()).get();
         }
     });
 }
@@ -0,0 +1,174 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/rcu.hh>
+#include <seastar/core/cacheline.hh>
+#include <seastar/core/smp.hh>
+#include <limits>
+
+namespace seastar {
+
+namespace internal {
+
+// Each retirement advances the global epoch, and is tagged with the new
+// value. Between tasks, each shard copies the global epoch into its own,
+// so once all shards' epochs are at the tag of a retired object none of
+// them can still hold a pointer to it: whatever they read since, they
+// read after the update that retired it.
+//
+// A shard's epoch is offline while it sleeps. Going back online, it
+// stores the epoch and then fences before reading anything, while the
+// retiring shard fences between publishing and scanning the epochs, so
+// either the retiring shard sees the shard online, or the shard reads
+// the new copy.
+
+namespace {
+
+constexpr uint64_t offline_epoch = std::numeric_limits<uint64_t>::max();
+
+struct alignas(cache_line_size) shard_epoch {
+    std::atomic<uint64_t> epoch{offline_epoch};
+};
+
+alignas(cache_line_size) std::atomic<uint64_t> global_epoch{0};
+std::unique_ptr<shard_epoch[]> shard_epochs;
+unsigned nr_epochs = 0;
+
+uint64_t min_shard_epoch() noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t min = offline_epoch;
+    for (unsigned i = 0; i < nr_epochs; i++) {
+        min = std::min(min, shard_epochs[i].epoch.load(std::memory_order_acquire));
+    }
+    return min;
+}
+
+}
+
+// The objects this shard retired, oldest first, so in epoch order
+struct rcu_retired_list {
+    rcu_retired* head = nullptr;
+    rcu_retired** tail = &head;
+
+    ~rcu_retired_list() {
+        while (head) {
+            delete std::exchange(head, head->_next);
+        }
+    }
+
+    void push_back(rcu_retired* r) noexcept {
+        *tail = r;
+        tail = &r->_next;
+    }
+
+    bool reclaimable(uint64_t epoch) const noexcept {
+        return head && head->_epoch <= epoch;
+    }
+
+    bool reclaim(uint64_t epoch) noexcept {
+        bool reclaimed = false;
+        while (reclaimable(epoch)) {
+            std::unique_ptr<rcu_retired> r(std::exchange(head, head->_next));
+            if (!head) {
+                tail = &head;
+            }
+            r->reclaim();
+            reclaimed = true;
+        }
+        return reclaimed;
+    }
+};
+
+static thread_local rcu_retired_list retired;
+
+void rcu_init(unsigned nr_shards) {
+    shard_epochs.reset(new shard_epoch[nr_shards]);
+    nr_epochs = nr_shards;
+}
+
+void rcu_retire(std::unique_ptr<rcu_retired> r) noexcept {
+    if (!shard_epochs) {
+        // No reactors, so no one else reading
+        r->reclaim();
+        return;
+    }
+    r->_epoch = global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    retired.push_back(r.release());
+}
+
+bool rcu_quiescent_state() noexcept {
+    if (!shard_epochs) {
+        return false;
+    }
+    shard_epochs[this_shard_id()].epoch.store(global_epoch.load(std::memory_order_seq_cst), std::memory_order_release);
+    if (!retired.head) {
+        return false;
+    }
+    return retired.reclaim(min_shard_epoch());
+}
+
+bool rcu_can_reclaim() noexcept {
+    return retired.head && retired.reclaimable(min_shard_epoch());
+}
+
+bool rcu_pending() noexcept {
+    return retired.head;
+}
+
+void rcu_offline() noexcept {
+    if (shard_epochs) {
+        shard_epochs[this_shard_id()].epoch.store(offline_epoch, std::memory_order_release);
+    }
+}
+
+void rcu_online() noexcept {
+    if (shard_epochs) {
+        shard_epochs[this_shard_id()].epoch.store(global_epoch.load(std::memory_order_seq_cst), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+namespace {
+
+class rcu_barrier final : public rcu_retired {
+public:
+    promise<> done;
+    virtual void reclaim() noexcept override {
+        done.set_value();
+    }
+};
+
+}
+
+}
+
+future<> synchronize_rcu() noexcept {
+    try {
+        auto barrier = std::make_unique<internal::rcu_barrier>();
+        auto f = barrier->done.get_future();
+        internal::rcu_retire(std::move(barrier));
+        return f;
+    } catch (...) {
+        return current_exception_as_future();
+    }
+}
+
+}
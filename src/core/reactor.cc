@@ -31,6 +31,7 @@
 #include <seastar/core/task.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/memory.hh>
+#include <seastar/core/dma_buffer_pool.hh>
 #include <seastar/core/posix.hh>
 #include <seastar/net/packet.hh>
 #include <seastar/net/stack.hh>
@@ -54,6 +55,8 @@
 #include <seastar/core/internal/buffer_allocator.hh>
 #include <seastar/core/scheduling_specific.hh>
 #include <seastar/core/smp_options.hh>
+#include <seastar/core/bitops.hh>
+#include <seastar/core/align.hh>
 #include <seastar/util/log.hh>
 #include <seastar/util/read_first_line.hh>
 #include "core/file-impl.hh"
@@ -86,6 +89,10 @@
 #include <linux/types.h> // for xfs, below
 #include <sys/ioctl.h>
 #include <linux/perf_event.h>
+#ifdef __x86_64__
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 #include <xfs/linux.h>
 #define min min    /* prevent xfs.h from defining min() as a macro */
 #include <xfs/xfs.h>
@@ -103,6 +110,7 @@
 #include <iostream>
 #include <system_error>
 #include <cxxabi.h>
+#include <dlfcn.h>
 #endif
 
 #ifdef SEASTAR_SHUFFLE_TASK_QUEUE
@@ -129,6 +137,7 @@
 #include <seastar/core/alien.hh>
 #include <seastar/core/metrics.hh>
 #include <seastar/core/execution_stage.hh>
+#include <seastar/core/rcu.hh>
 #include <seastar/core/exception_hacks.hh>
 #include "stall_detector.hh"
 #include <seastar/util/memory_diagnostics.hh>
@@ -142,6 +151,13 @@
 
 namespace seastar {
 
+// The measured capacity of a random workload mixing reads and writes
+struct mixed_capacity {
+    float read_ratio;
+    uint64_t request_size;
+    uint64_t iops;
+};
+
 struct mountpoint_params {
     std::string mountpoint = "none";
     uint64_t read_bytes_rate = std::numeric_limits<uint64_t>::max();
@@ -152,6 +168,7 @@ struct mountpoint_params {
     uint64_t write_saturation_length = std::numeric_limits<uint64_t>::max();
     bool duplex = false;
     float rate_factor = 1.0;
+    std::vector<mixed_capacity> mixed;
 };
 
 }
@@ -178,6 +195,15 @@ struct convert<seastar::mountpoint_params> {
         if (node["rate_factor"]) {
             mp.rate_factor = node["rate_factor"].as<float>();
         }
+        if (node["mixed"]) {
+            for (auto&& m : node["mixed"]) {
+                mixed_capacity mc;
+                mc.read_ratio = m["read_ratio"].as<float>();
+                mc.request_size = parse_memory_size(m["request_size"].as<std::string>());
+                mc.iops = parse_memory_size(m["iops"].as<std::string>());
+                mp.mixed.push_back(mc);
+            }
+        }
         return true;
     }
 };
@@ -259,6 +285,7 @@ reactor::do_read_some(pollable_fd_state& fd, void* buffer, size_t len) {
     return readable(fd).then([this, &fd, buffer, len] () mutable {
         auto r = fd.fd.read(buffer, len);
         if (!r) {
+            fd.maybe_consume_error_queue();
             return do_read_some(fd, buffer, len);
         }
         if (size_t(*r) == len) {
@@ -277,6 +304,7 @@ reactor::do_read_some(pollable_fd_state& fd, internal::buffer_allocator* ba) {
             // Speculation failure, try again with real polling this time
             // Note we release the buffer and will reallocate it when poll
             // completes.
+            fd.maybe_consume_error_queue();
             return do_read_some(fd, ba);
         }
         if (size_t(*r) == buffer.size()) {
@@ -295,6 +323,7 @@ reactor::do_read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) {
         mh.msg_iovlen = iov.size();
         auto r = fd.fd.recvmsg(&mh, 0);
         if (!r) {
+            fd.maybe_consume_error_queue();
             return do_read_some(fd, iov);
         }
         if (size_t(*r) == iovec_len(iov)) {
@@ -309,6 +338,7 @@ reactor::do_write_some(pollable_fd_state& fd, const void* buffer, size_t len) {
     return writeable(fd).then([this, &fd, buffer, len] () mutable {
         auto r = fd.fd.send(buffer, len, MSG_NOSIGNAL);
         if (!r) {
+            fd.maybe_consume_error_queue();
             return do_write_some(fd, buffer, len);
         }
         if (size_t(*r) == len) {
@@ -335,6 +365,7 @@ reactor::do_write_some(pollable_fd_state& fd, net::packet& p) {
         mh.msg_iovlen = std::min<size_t>(p.nr_frags(), IOV_MAX);
         auto r = fd.fd.sendmsg(&mh, MSG_NOSIGNAL);
         if (!r) {
+            fd.maybe_consume_error_queue();
             return do_write_some(fd, p);
         }
         if (size_t(*r) == p.len()) {
@@ -435,6 +466,7 @@ future<size_t> pollable_fd_state::recvmsg(struct msghdr *msg) {
     return engine().readable(*this).then([this, msg] {
         auto r = fd.recvmsg(msg, 0);
         if (!r) {
+            maybe_consume_error_queue();
             return recvmsg(msg);
         }
         // We always speculate here to optimize for throughput in a workload
@@ -449,12 +481,13 @@ future<size_t> pollable_fd_state::recvmsg(struct msghdr *msg) {
     });
 };
 
-future<size_t> pollable_fd_state::sendmsg(struct msghdr* msg) {
+future<size_t> pollable_fd_state::sendmsg(struct msghdr* msg, int flags) {
     maybe_no_more_send();
-    return engine().writeable(*this).then([this, msg] () mutable {
-        auto r = fd.sendmsg(msg, 0);
+    return engine().writeable(*this).then([this, msg, flags] () mutable {
+        auto r = fd.sendmsg(msg, flags);
         if (!r) {
-            return sendmsg(msg);
+            maybe_consume_error_queue();
+            return sendmsg(msg, flags);
         }
         // For UDP this will always speculate. We can't know if there's room
         // or not, but most of the time there should be so the cost of mis-
@@ -816,12 +849,23 @@ static decltype(auto) install_signal_handler_stack() {
     });
 }
 
-reactor::task_queue::task_queue(unsigned id, sstring name, float shares)
+reactor::sched_entity::sched_entity(float shares, task_supergroup* parent, bool is_supergroup) noexcept
         : _shares(std::max(shares, 1.0f))
         , _reciprocal_shares_times_2_power_32((uint64_t(1) << 32) / _shares)
+        , _is_supergroup(is_supergroup)
+        , _parent(parent) {
+}
+
+reactor::task_supergroup::task_supergroup(float shares, task_supergroup* parent) noexcept
+        : sched_entity(shares, parent, true) {
+}
+
+reactor::task_queue::task_queue(unsigned id, sstring name, float shares, task_supergroup* parent)
+        : sched_entity(shares, parent, false)
         , _id(id)
         , _ts(now())
-        , _name(name) {
+        , _name(name)
+        , _unthrottle_timer(default_scheduling_group(), [this] { engine().unthrottle(*this); }) {
     register_stats();
 }
 
@@ -857,6 +901,17 @@ reactor::task_queue::register_stats() {
                 return _time_spent_on_task_quota_violations / 1ms;
         }, sm::description("Total amount in milliseconds we were in violation of the task quota"),
            {group_label}),
+        sm::make_counter("throttled_time_ms", [this] {
+                auto t = _throttled_time;
+                if (_throttled) {
+                    t += reactor::now() - _throttled_since;
+                }
+                return std::chrono::duration_cast<std::chrono::milliseconds>(t).count();
+        }, sm::description("Accumulated time this task queue was kept from running for exceeding its CPU quota"),
+           {group_label}),
+        sm::make_counter("throttled", _nr_throttled,
+                sm::description("Number of times this task queue exceeded its CPU quota and was throttled"),
+                {group_label}),
     });
     _metrics = std::exchange(new_metrics, {});
 }
@@ -876,14 +931,14 @@ __attribute__((no_sanitize("undefined"))) // multiplication below may overflow;
 #endif
 inline
 int64_t
-reactor::task_queue::to_vruntime(sched_clock::duration runtime) const {
+reactor::sched_entity::to_vruntime(sched_clock::duration runtime) const {
     auto scaled = (runtime.count() * _reciprocal_shares_times_2_power_32) >> 32;
     // Prevent overflow from returning ridiculous values
     return std::max<int64_t>(scaled, 0);
 }
 
 void
-reactor::task_queue::set_shares(float shares) noexcept {
+reactor::sched_entity::set_shares(float shares) noexcept {
     _shares = std::max(shares, 1.0f);
     _reciprocal_shares_times_2_power_32 = (uint64_t(1) << 32) / _shares;
 }
@@ -893,21 +948,98 @@ reactor::account_runtime(task_queue& tq, sched_clock::duration runtime) {
     if (runtime > (2 * _task_quota)) {
         tq._time_spent_on_task_quota_violations += runtime - _task_quota;
     }
-    tq._vruntime += tq.to_vruntime(runtime);
+    // Each supergroup up the tree is charged by its own shares
+    for (sched_entity* e = &tq; e != nullptr; e = e->_parent) {
+        e->_vruntime += e->to_vruntime(runtime);
+    }
     tq._runtime += runtime;
 }
 
+void
+reactor::task_queue::roll_cpu_period(sched_clock::time_point now) noexcept {
+    if (now >= _cpu_period_end) {
+        auto periods = (now - _cpu_period_end) / _cpu_period + 1;
+        _cpu_quota_used = std::max(_cpu_quota_used - periods * _cpu_quota, sched_clock::duration(0));
+        _cpu_period_end += periods * _cpu_period;
+    }
+}
+
+// Returns true if the queue ran out of its CPU quota and got throttled
+bool
+reactor::charge_cpu_quota(task_queue& tq, sched_clock::time_point now, sched_clock::duration runtime) noexcept {
+    tq.roll_cpu_period(now);
+    tq._cpu_quota_used += runtime;
+    if (tq._cpu_quota_used < tq._cpu_quota) {
+        return false;
+    }
+    sched_print("tq {} {} throttled until {}", (void*)&tq, tq._name, tq._cpu_period_end.time_since_epoch().count());
+    tq._throttled = true;
+    tq._throttled_since = now;
+    tq._nr_throttled++;
+    tq._unthrottle_timer.arm(tq._cpu_period_end);
+    return true;
+}
+
+void
+reactor::unthrottle(task_queue& tq) noexcept {
+    auto now = reactor::now();
+    if (tq._cpu_quota.count()) {
+        tq.roll_cpu_period(now);
+        if (tq._cpu_quota_used >= tq._cpu_quota) {
+            // Still paying back an overrun
+            tq._unthrottle_timer.arm(tq._cpu_period_end);
+            return;
+        }
+    }
+    tq._throttled = false;
+    tq._throttled_time += now - tq._throttled_since;
+    if (!tq._q.empty()) {
+        activate(tq);
+    }
+}
+
+void
+reactor::set_cpu_quota(task_queue& tq, sched_clock::duration quota, sched_clock::duration period) noexcept {
+    tq._cpu_quota = quota;
+    tq._cpu_period = std::max(period, sched_clock::duration(1ms));
+    tq._cpu_quota_used = {};
+    tq._cpu_period_end = now() + tq._cpu_period;
+    if (tq._throttled) {
+        tq._unthrottle_timer.cancel();
+        unthrottle(tq);
+    }
+}
+
 void
 reactor::account_idle(sched_clock::duration runtime) {
     // anything to do here?
 }
 
-struct reactor::task_queue::indirect_compare {
-    bool operator()(const task_queue* tq1, const task_queue* tq2) const {
+struct reactor::sched_entity::indirect_compare {
+    bool operator()(const sched_entity* tq1, const sched_entity* tq2) const {
         return tq1->_vruntime < tq2->_vruntime;
     }
 };
 
+void reactor::sched_entity_heap::push(sched_entity* e) noexcept {
+    // Can't reallocate, the storage is reserved by add_sched_member()
+    assert(_heap.size() < _heap.capacity());
+    _heap.push_back(e);
+    // std::push_heap() keeps the largest element at the front
+    std::push_heap(_heap.begin(), _heap.end(), [] (const sched_entity* a, const sched_entity* b) {
+        return sched_entity::indirect_compare()(b, a);
+    });
+}
+
+reactor::sched_entity* reactor::sched_entity_heap::pop() noexcept {
+    std::pop_heap(_heap.begin(), _heap.end(), [] (const sched_entity* a, const sched_entity* b) {
+        return sched_entity::indirect_compare()(b, a);
+    });
+    auto e = _heap.back();
+    _heap.pop_back();
+    return e;
+}
+
 reactor::reactor(std::shared_ptr<smp> smp, alien::instance& alien, unsigned id, reactor_backend_selector rbs, reactor_config cfg)
     : _smp(std::move(smp))
     , _alien(alien)
@@ -923,7 +1055,7 @@ reactor::reactor(std::shared_ptr<smp> smp, alien::instance& alien, unsigned id,
     , _cpu_started(0)
     , _cpu_stall_detector(make_cpu_stall_detector())
     , _reuseport(posix_reuseport_detect())
-    , _thread_pool(std::make_unique<thread_pool>(this, seastar::format("syscall-{}", id))) {
+    , _thread_pool(std::make_unique<thread_pool>(this, seastar::format("syscall-{}", id), cfg.syscall_threads)) {
     /*
      * The _backend assignment is here, not on the initialization list as
      * the chosen backend constructor may want to handle signals and thus
@@ -931,7 +1063,9 @@ reactor::reactor(std::shared_ptr<smp> smp, alien::instance& alien, unsigned id,
      */
     _backend = rbs.create(*this);
     *internal::get_scheduling_group_specific_thread_local_data_ptr() = &_scheduling_group_specific_data;
+    add_sched_member(nullptr);
     _task_queues.push_back(std::make_unique<task_queue>(0, "main", 1000));
+    add_sched_member(nullptr);
     _task_queues.push_back(std::make_unique<task_queue>(1, "atexit", 1000));
     _at_destroy_tasks = _task_queues.back().get();
     set_need_preempt_var(&_preemption_monitor);
@@ -952,12 +1086,20 @@ reactor::reactor(std::shared_ptr<smp> smp, alien::instance& alien, unsigned id,
             fn();
         }));
     });
+    memory::set_background_reclaim_hook([this] (std::function<void ()> reclaim_fn) {
+        schedule(make_task(_background_reclaim_sg, [fn = std::move(reclaim_fn)] {
+            fn();
+        }));
+    });
 }
 
 reactor::~reactor() {
+    // Owns a timer, so it has to go before the timer lists
+    _cpu_profiler.reset();
     sigset_t mask;
     sigemptyset(&mask);
     sigaddset(&mask, cpu_stall_detector::signal_number());
+    sigaddset(&mask, cpu_profiler::signal_number());
     auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
     assert(r == 0);
 
@@ -990,6 +1132,10 @@ reactor::~reactor() {
             }
         }
     }
+    internal::local_continuation_freelist.drain();
+#ifdef SEASTAR_COROUTINE_FRAME_POOL
+    internal::local_coroutine_frame_freelist.drain();
+#endif
 }
 
 reactor::sched_stats
@@ -1061,7 +1207,10 @@ cpu_stall_detector::cpu_stall_detector(cpu_stall_detector_config cfg)
     namespace sm = seastar::metrics;
 
     _metrics.add_group("stall_detector", {
-            sm::make_derive("reported", _total_reported, sm::description("Total number of reported stalls, look in the traces for the exact reason"))});
+            sm::make_derive("reported", _total_reported, sm::description("Total number of reported stalls, look in the traces for the exact reason")),
+            sm::make_derive("stalls", _total_stalls, sm::description("Total number of stalls, reported or not")),
+            sm::make_derive("stall_time_ms", [this] { return _total_stall_time / 1ms; }, sm::description("Total time spent in stalls, in milliseconds")),
+            sm::make_gauge("distinct_backtraces", [this] { return _stalls.size(); }, sm::description("Number of distinct stall backtraces aggregated, see the stall reports"))});
 
     // note: if something is added here that can, it should take care to destroy _timer.
 }
@@ -1114,6 +1263,7 @@ void cpu_stall_detector::on_signal() {
     if (!last_seen) {
         return; // stall detector in not active
     } else if (last_seen == tasks_processed) { // no task was processed - report
+        capture_stall();
         maybe_report();
         _report_at <<= 1;
     } else {
@@ -1149,6 +1299,7 @@ void cpu_stall_detector_posix_timer::arm_timer() {
 void cpu_stall_detector::start_task_run(sched_clock::time_point now) {
     if (now > _rearm_timer_at) {
         report_suppressions(now);
+        maybe_summarize(now);
         _report_at = 1;
         _run_started_at = now;
         _rearm_timer_at = now + _threshold * _report_at;
@@ -1161,6 +1312,11 @@ void cpu_stall_detector::start_task_run(sched_clock::time_point now) {
 void cpu_stall_detector::end_task_run(sched_clock::time_point now) {
     std::atomic_signal_fence(std::memory_order_acquire); // Don't hoist this write, so the signal handler can see it
     _last_tasks_processed_seen.store(0, std::memory_order_relaxed);
+    if (_captured.load(std::memory_order_relaxed)) {
+        std::atomic_signal_fence(std::memory_order_acquire);
+        aggregate_stall(now);
+        _captured.store(false, std::memory_order_relaxed);
+    }
 }
 
 void cpu_stall_detector_posix_timer::start_sleep() {
@@ -1265,6 +1421,12 @@ cpu_stall_detector_linux_perf_event::try_make(cpu_stall_detector_config cfg) {
         .exclude_callchain_user = 1,  // we're using backtrace() to capture the user callchain
         .wakeup_events = 1,
     };
+    auto desc = open_signalling_perf_event(pea, signal_number());
+    return std::make_unique<cpu_stall_detector_linux_perf_event>(std::move(desc), std::move(cfg));
+}
+
+file_desc
+internal::open_signalling_perf_event(::perf_event_attr& pea, int signo) {
     unsigned long flags = 0;
     if (kernel_uname().whitelisted({"3.14"})) {
         flags |= PERF_FLAG_FD_CLOEXEC;
@@ -1282,7 +1444,7 @@ cpu_stall_detector_linux_perf_event::try_make(cpu_stall_detector_config cfg) {
     if (ret1 == -1) {
         abort();
     }
-    auto ret2 = ::fcntl(fd, F_SETSIG, signal_number());
+    auto ret2 = ::fcntl(fd, F_SETSIG, signo);
     if (ret2 == -1) {
         abort();
     }
@@ -1294,7 +1456,7 @@ cpu_stall_detector_linux_perf_event::try_make(cpu_stall_detector_config cfg) {
     if (ret3 == -1) {
         abort();
     }
-    return std::make_unique<cpu_stall_detector_linux_perf_event>(std::move(desc), std::move(cfg));
+    return desc;
 }
 
 
@@ -1308,12 +1470,162 @@ internal::make_cpu_stall_detector(cpu_stall_detector_config cfg) {
     }
 }
 
+cpu_profiler::cpu_profiler()
+        : _pending(std::make_unique<std::array<sample, max_pending>>())
+        , _collect_timer([this] { collect(); }) {
+    // Same reason as in the cpu_stall_detector constructor
+    backtrace([] (frame) {});
+
+    ::perf_event_attr pea = {
+        .type = PERF_TYPE_SOFTWARE,
+        .size = sizeof(pea),
+        .config = PERF_COUNT_SW_TASK_CLOCK,
+        .sample_period = 1'000'000'000,
+        .disabled = 1,
+    };
+    try {
+        _perf_event = open_signalling_perf_event(pea, signal_number());
+    } catch (...) {
+        seastar_logger.warn("Creation of perf_event based cpu profiler failed, falling back to posix timer: {}", std::current_exception());
+        struct sigevent sev = {};
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = signal_number();
+        sev._sigev_un._tid = syscall(SYS_gettid);
+        timer_t timer;
+        int err = timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer);
+        if (err) {
+            throw std::system_error(std::error_code(err, std::system_category()));
+        }
+        _timer = timer;
+    }
+}
+
+cpu_profiler::~cpu_profiler() {
+    set_period(0ns);
+    if (_timer) {
+        timer_delete(*_timer);
+    }
+}
+
+void cpu_profiler::set_period(std::chrono::nanoseconds period) {
+    if (_perf_event) {
+        _perf_event->ioctl(PERF_EVENT_IOC_DISABLE, 0);
+        if (period.count()) {
+            _perf_event->ioctl(PERF_EVENT_IOC_PERIOD, uint64_t(period.count()));
+            _perf_event->ioctl(PERF_EVENT_IOC_RESET, 0);
+            _perf_event->ioctl(PERF_EVENT_IOC_ENABLE, 0);
+        }
+    } else {
+        auto its = posix::to_relative_itimerspec(period, period);
+        timer_settime(*_timer, 0, &its, nullptr);
+    }
+    _period = period;
+    if (period.count()) {
+        _collect_timer.rearm_periodic(100ms);
+    } else {
+        _collect_timer.cancel();
+        collect();
+    }
+}
+
+void cpu_profiler::on_signal(void* ucontext) noexcept {
+    auto head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_relaxed) == max_pending) {
+        ++_dropped;
+        return;
+    }
+    auto& s = (*_pending)[head % max_pending];
+    s.sg = internal::scheduling_group_index(*internal::current_scheduling_group_ptr());
+
+    void* buffer[max_frames + 8];
+    int n = ::backtrace(buffer, max_frames + 8);
+    // Drop the frames of the signal handler itself: they end just before
+    // the interrupted instruction.
+    uintptr_t pc = 0;
+    auto& mc = static_cast<ucontext_t*>(ucontext)->uc_mcontext;
+#if defined(__x86_64__)
+    pc = mc.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    pc = mc.pc;
+#else
+    (void)mc;
+#endif
+    int first = 0;
+    for (int i = 0; i < n; ++i) {
+        if (reinterpret_cast<uintptr_t>(buffer[i]) == pc) {
+            first = i;
+            break;
+        }
+    }
+    unsigned nr = 0;
+    for (int i = first; i < n && nr < max_frames; ++i) {
+        auto ip = reinterpret_cast<uintptr_t>(buffer[i]);
+        // Return addresses point past the call instruction
+        s.frames[nr++] = i == first && pc ? ip : ip - 1;
+    }
+    s.nr_frames = nr;
+    std::atomic_signal_fence(std::memory_order_release);
+    _head.store(head + 1, std::memory_order_relaxed);
+}
+
+void cpu_profiler::collect() {
+    auto head = _head.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    for (auto tail = _tail.load(std::memory_order_relaxed); tail != head; ++tail) {
+        auto& s = (*_pending)[tail % max_pending];
+        std::vector<uintptr_t> key;
+        key.reserve(s.nr_frames + 1);
+        key.push_back(s.sg);
+        key.insert(key.end(), s.frames, s.frames + s.nr_frames);
+        ++_stacks[std::move(key)];
+        ++_total;
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    _tail.store(head, std::memory_order_relaxed);
+}
+
+void cpu_profiler::reset() {
+    collect();
+    _stacks.clear();
+}
+
+static sstring symbolize(uintptr_t addr) {
+    Dl_info info;
+    if (::dladdr(reinterpret_cast<void*>(addr), &info) && info.dli_sname) {
+        int status;
+        std::unique_ptr<char[], void (*)(void*)> demangled(abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status), std::free);
+        return status == 0 ? sstring(demangled.get()) : sstring(info.dli_sname);
+    }
+    auto f = decorate(addr);
+    return f.so->name.empty() ? format("0x{:x}", f.addr) : format("{}+0x{:x}", f.so->name, f.addr);
+}
+
+sstring cpu_profiler::folded_stacks(unsigned shard, noncopyable_function<sstring (unsigned)> group_name) {
+    collect();
+    std::unordered_map<uintptr_t, sstring> symbols;
+    sstring ret;
+    for (auto& [key, count] : _stacks) {
+        ret += format("shard {};{}", shard, group_name(key[0]));
+        for (auto it = key.rbegin(); it != std::prev(key.rend()); ++it) {
+            auto sym = symbols.find(*it);
+            if (sym == symbols.end()) {
+                sym = symbols.emplace(*it, symbolize(*it)).first;
+            }
+            ret += ";";
+            ret += sym->second;
+        }
+        ret += format(" {}\n", count);
+    }
+    return ret;
+}
+
 void
 reactor::update_blocked_reactor_notify_ms(std::chrono::milliseconds ms) {
     auto cfg = _cpu_stall_detector->get_config();
     if (ms != cfg.threshold) {
         cfg.threshold = ms;
         _cpu_stall_detector->update_config(cfg);
+        _scheduler_trace.set_long_task_threshold(std::min<std::chrono::nanoseconds>(_task_quota, ms));
         seastar_logger.info("updated: blocked-reactor-notify-ms={}", ms.count());
     }
 }
@@ -1324,6 +1636,23 @@ reactor::get_blocked_reactor_notify_ms() const {
     return std::chrono::duration_cast<std::chrono::milliseconds>(d);
 }
 
+void
+reactor::update_blocked_reactor_notify(std::chrono::microseconds us) {
+    auto cfg = _cpu_stall_detector->get_config();
+    if (us != cfg.threshold) {
+        cfg.threshold = us;
+        _cpu_stall_detector->update_config(cfg);
+        _scheduler_trace.set_long_task_threshold(std::min<std::chrono::nanoseconds>(_task_quota, us));
+        seastar_logger.info("updated: blocked-reactor-notify-us={}", us.count());
+    }
+}
+
+std::chrono::microseconds
+reactor::get_blocked_reactor_notify() const {
+    auto d = _cpu_stall_detector->get_config().threshold;
+    return std::chrono::duration_cast<std::chrono::microseconds>(d);
+}
+
 void
 reactor::set_stall_detector_report_function(std::function<void ()> report) {
     auto cfg = _cpu_stall_detector->get_config();
@@ -1336,6 +1665,71 @@ reactor::get_stall_detector_report_function() const {
     return _cpu_stall_detector->get_config().report;
 }
 
+sstring
+reactor::scheduling_group_name_or_id(unsigned id) const {
+    return id < _task_queues.size() && _task_queues[id] ? _task_queues[id]->_name : format("sg{}", id);
+}
+
+sstring
+reactor::format_scheduler_trace() const {
+    return _scheduler_trace.to_json(_id, [this] (unsigned id) {
+        return scheduling_group_name_or_id(id);
+    });
+}
+
+void
+reactor::set_cpu_profiler_period(std::chrono::nanoseconds period) {
+    if (!_cpu_profiler) {
+        if (!period.count()) {
+            return;
+        }
+        struct sigaction sa = {};
+        sa.sa_sigaction = &reactor::cpu_profiler_notifier;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        auto r = ::sigaction(cpu_profiler::signal_number(), &sa, nullptr);
+        throw_system_error_on(r == -1, "sigaction");
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, cpu_profiler::signal_number());
+        r = ::pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+        assert(r == 0);
+        _cpu_profiler = std::make_unique<cpu_profiler>();
+    }
+    _cpu_profiler->set_period(period);
+}
+
+sstring
+reactor::format_cpu_profile() {
+    if (!_cpu_profiler) {
+        return "";
+    }
+    return _cpu_profiler->folded_stacks(_id, [this] (unsigned id) {
+        return scheduling_group_name_or_id(id);
+    });
+}
+
+void
+reactor::reset_cpu_profile() {
+    if (_cpu_profiler) {
+        _cpu_profiler->reset();
+    }
+}
+
+sstring
+reactor::format_stall_reports() const {
+    return _cpu_stall_detector->format_stalls(_id);
+}
+
+void
+reactor::reset_stall_reports() {
+    _cpu_stall_detector->reset_stalls();
+}
+
+void
+reactor::cpu_profiler_notifier(int, siginfo_t*, void* ucontext) {
+    engine()._cpu_profiler->on_signal(ucontext);
+}
+
 void
 reactor::block_notifier(int) {
     engine()._cpu_stall_detector->on_signal();
@@ -1353,12 +1747,138 @@ cpu_stall_detector::generate_trace() {
 
     backtrace_buffer buf;
     buf.append("Reactor stalled for ");
-    buf.append_decimal(uint64_t(delta / 1ms));
-    buf.append(" ms");
+    if (_threshold < 1ms) {
+        buf.append_decimal(uint64_t(delta / 1us));
+        buf.append(" us");
+    } else {
+        buf.append_decimal(uint64_t(delta / 1ms));
+        buf.append(" ms");
+    }
     print_with_backtrace(buf, _config.oneline);
     maybe_report_kernel_trace();
 }
 
+// Called from the signal handler: only the first signal of a stall takes
+// its backtrace, later ones see the same stall going on
+void
+cpu_stall_detector::capture_stall() noexcept {
+    if (_captured.load(std::memory_order_relaxed)) {
+        return;
+    }
+    _capture.sg = internal::scheduling_group_index(*internal::current_scheduling_group_ptr());
+    _capture.task_type = engine().current_task_type();
+    unsigned nr = 0;
+    backtrace([&] (frame f) {
+        if (nr < max_stall_frames) {
+            _capture.frames[nr++] = f;
+        }
+    });
+    _capture.nr_frames = nr;
+    std::atomic_signal_fence(std::memory_order_release);
+    _captured.store(true, std::memory_order_relaxed);
+}
+
+void
+cpu_stall_detector::aggregate_stall(sched_clock::time_point now) {
+    auto duration = now - _run_started_at;
+    _total_stalls++;
+    _total_stall_time += duration;
+    try {
+        std::vector<uintptr_t> key;
+        key.reserve(2 + 2 * _capture.nr_frames);
+        key.push_back(_capture.sg);
+        key.push_back(reinterpret_cast<uintptr_t>(_capture.task_type));
+        for (unsigned i = 0; i < _capture.nr_frames; i++) {
+            key.push_back(reinterpret_cast<uintptr_t>(_capture.frames[i].so));
+            key.push_back(_capture.frames[i].addr);
+        }
+        auto it = _stalls.find(key);
+        if (it == _stalls.end()) {
+            if (_stalls.size() == max_distinct_stalls) {
+                return;
+            }
+            auto frames = simple_backtrace::vector_type(_capture.frames, _capture.frames + _capture.nr_frames);
+            it = _stalls.emplace(std::move(key), stall_stats{simple_backtrace(std::move(frames), _config.oneline ? ' ' : '\n'), _capture.sg, _capture.task_type}).first;
+        }
+        auto& s = it->second;
+        s.count++;
+        s.total += duration;
+        s.max = std::max(s.max, duration);
+    } catch (...) {
+        // Only counted
+    }
+}
+
+// Stalls may be shorter than a millisecond, see --blocked-reactor-notify-us
+static double stall_ms(sched_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static sstring stall_task_name(const std::type_info* type) {
+    return type ? pretty_type_name(*type) : sstring("none");
+}
+
+void
+cpu_stall_detector::maybe_summarize(sched_clock::time_point now) {
+    if (!_config.summary_interval.count() || now < _summary_mark + _config.summary_interval) {
+        return;
+    }
+    auto interval = now - _summary_mark;
+    _summary_mark = now;
+    std::vector<stall_stats*> recent;
+    uint64_t count = 0;
+    sched_clock::duration total{};
+    for (auto& [key, s] : _stalls) {
+        if (s.count != s.summarized_count) {
+            recent.push_back(&s);
+            count += s.count - s.summarized_count;
+            total += s.total - s.summarized_total;
+        }
+    }
+    if (recent.empty()) {
+        return;
+    }
+    std::sort(recent.begin(), recent.end(), [] (const stall_stats* a, const stall_stats* b) {
+        return a->total - a->summarized_total > b->total - b->summarized_total;
+    });
+    seastar_logger.warn("{} stalls for {:.3f} ms in total on shard {} in the last {} s, from {} distinct backtraces; the longest in total:",
+            count, stall_ms(total), _shard_id, std::chrono::duration_cast<std::chrono::seconds>(interval).count(), recent.size());
+    for (size_t i = 0; i < std::min(recent.size(), size_t(5)); i++) {
+        auto& s = *recent[i];
+        seastar_logger.warn("{} stalls for {:.3f} ms in total, up to {:.3f} ms, in scheduling group {}, task {}: {}",
+                s.count - s.summarized_count, stall_ms(s.total - s.summarized_total), stall_ms(s.max),
+                engine().scheduling_group_name_or_id(s.sg), stall_task_name(s.task_type), s.trace);
+    }
+    for (auto s : recent) {
+        s->summarized_count = s->count;
+        s->summarized_total = s->total;
+    }
+}
+
+sstring
+cpu_stall_detector::format_stalls(unsigned shard) const {
+    std::vector<const stall_stats*> stalls;
+    stalls.reserve(_stalls.size());
+    for (auto& [key, s] : _stalls) {
+        stalls.push_back(&s);
+    }
+    std::sort(stalls.begin(), stalls.end(), [] (const stall_stats* a, const stall_stats* b) {
+        return a->total > b->total;
+    });
+    sstring ret;
+    for (auto s : stalls) {
+        ret += format("shard {} group {}: {} stalls, {:.3f} ms in total, up to {:.3f} ms, task {}: {}\n", shard,
+                engine().scheduling_group_name_or_id(s->sg), s->count, stall_ms(s->total), stall_ms(s->max),
+                stall_task_name(s->task_type), s->trace);
+    }
+    return ret;
+}
+
+void
+cpu_stall_detector::reset_stalls() {
+    _stalls.clear();
+}
+
 template <typename T, typename E, typename EnableFunc>
 void reactor::complete_timers(T& timers, E& expired_timers, EnableFunc&& enable_fn) noexcept(noexcept(enable_fn())) {
     expired_timers = timers.expire(timers.now());
@@ -1369,6 +1889,9 @@ void reactor::complete_timers(T& timers, E& expired_timers, EnableFunc&& enable_
     while (!expired_timers.empty()) {
         auto t = &*expired_timers.begin();
         expired_timers.pop_front();
+        if (!expired_timers.empty()) {
+            prefetch(&*expired_timers.begin());
+        }
         t->_queued = false;
         if (t->_armed) {
             t->_armed = false;
@@ -1440,14 +1963,20 @@ void reactor::configure(const reactor_options& opts) {
     auto task_quota = opts.task_quota_ms.get_value() * 1ms;
     _task_quota = std::chrono::duration_cast<sched_clock::duration>(task_quota);
 
-    auto blocked_time = opts.blocked_reactor_notify_ms.get_value() * 1ms;
+    std::chrono::microseconds blocked_time = opts.blocked_reactor_notify_ms.get_value() * 1ms;
+    if (opts.blocked_reactor_notify_us.get_value()) {
+        blocked_time = opts.blocked_reactor_notify_us.get_value() * 1us;
+    }
     cpu_stall_detector_config csdc;
     csdc.threshold = blocked_time;
     csdc.stall_detector_reports_per_minute = opts.blocked_reactor_reports_per_minute.get_value();
     csdc.oneline = opts.blocked_reactor_report_format_oneline.get_value();
+    csdc.summary_interval = std::chrono::seconds(opts.blocked_reactor_summary_interval_s.get_value());
     _cpu_stall_detector->update_config(csdc);
 
     _max_task_backlog = opts.max_task_backlog.get_value();
+    _scheduler_trace.configure(opts.scheduler_trace_entries.get_value(), std::min<std::chrono::nanoseconds>(_task_quota, blocked_time));
+    set_cpu_profiler_period(std::chrono::microseconds(opts.cpu_profiler_period_us.get_value()));
     _max_poll_time = opts.idle_poll_time_us.get_value() * 1us;
     if (opts.poll_mode) {
         _max_poll_time = std::chrono::nanoseconds::max();
@@ -1455,6 +1984,18 @@ void reactor::configure(const reactor_options& opts) {
     if (opts.overprovisioned && opts.idle_poll_time_us.defaulted() && !opts.poll_mode) {
         _max_poll_time = 0us;
     }
+    auto mode = opts.idle_mode.get_value();
+    if (mode == "fixed") {
+        set_idle_mode(idle_mode::fixed);
+    } else if (mode == "latency") {
+        set_idle_mode(idle_mode::latency);
+    } else if (mode == "balanced") {
+        set_idle_mode(idle_mode::balanced);
+    } else if (mode == "power") {
+        set_idle_mode(idle_mode::power);
+    } else {
+        throw std::runtime_error(format("Invalid --idle-mode {}, valid modes are: fixed, latency, balanced and power", mode));
+    }
     set_strict_dma(!opts.relaxed_dma);
     if (!opts.poll_aio.get_value() || (opts.poll_aio.defaulted() && opts.overprovisioned)) {
         _aio_eventfd = pollable_fd(file_desc::eventfd(0, 0));
@@ -1625,6 +2166,14 @@ sstring io_request::opname() const {
         return "poll remove";
     case io_request::operation::cancel:
         return "cancel";
+    case io_request::operation::nvme_read:
+        return "nvme read";
+    case io_request::operation::nvme_write:
+        return "nvme write";
+    case io_request::operation::discard:
+        return "discard";
+    case io_request::operation::punch_hole:
+        return "punch hole";
     }
     std::abort();
 }
@@ -1676,6 +2225,13 @@ const io_priority_class& default_priority_class() {
     return shard_default_class;
 }
 
+const io_priority_class& discard_priority_class() {
+    static thread_local auto shard_discard_class = [] {
+        return io_priority_class::register_one("discard", 1);
+    }();
+    return shard_discard_class;
+}
+
 future<size_t>
 reactor::submit_io_read(io_queue* ioq, const io_priority_class& pc, size_t len, io_request req, io_intent* intent) noexcept {
     ++_io_stats.aio_reads;
@@ -1716,10 +2272,11 @@ reactor::open_file_dma(std::string_view nameref, open_flags flags, file_open_opt
     return do_with(static_cast<int>(flags), std::move(options), [this, nameref] (auto& open_flags, file_open_options& options) {
         sstring name(nameref);
         return _thread_pool->submit<syscall_result<int>>([this, name, &open_flags, &options, strict_o_direct = _strict_o_direct, bypass_fsync = _bypass_fsync] () mutable {
-            // We want O_DIRECT, except in three cases:
+            // We want O_DIRECT, except in four cases:
             //   - tmpfs (which doesn't support it, but works fine anyway)
             //   - strict_o_direct == false (where we forgive it being not supported)
             //   - _kernel_page_cache == true (where we disable it for short-lived test processes)
+            //   - options.buffered == true (where the page cache is asked for)
             // Because open() with O_DIRECT will fail, we open it without O_DIRECT, try
             // to update it to O_DIRECT with fcntl(), and if that fails, see if we
             // can forgive it.
@@ -1740,7 +2297,7 @@ reactor::open_file_dma(std::string_view nameref, open_flags flags, file_open_opt
             if (fd == -1) {
                 return wrap_syscall<int>(fd);
             }
-            int o_direct_flag = _kernel_page_cache ? 0 : O_DIRECT;
+            int o_direct_flag = _kernel_page_cache || options.buffered ? 0 : O_DIRECT;
             int r = ::fcntl(fd, F_SETFL, open_flags | o_direct_flag);
             auto maybe_ret = wrap_syscall<int>(r);  // capture errno (should be EINVAL)
             if (r == -1  && strict_o_direct && !is_tmpfs(fd)) {
@@ -2260,6 +2817,11 @@ void reactor::register_metrics() {
             // total_operations value:DERIVE:0:U
             sm::make_derive("tasks_processed", std::bind(&reactor::tasks_processed, this), sm::description("Total tasks processed")),
             sm::make_derive("polls", _polls, sm::description("Number of times pollers were executed")),
+            sm::make_derive("sleeps", _sleeps, sm::description("Number of times the reactor went to sleep when idle")),
+            sm::make_gauge("idle_mode", [this] { return int(_idle_mode); },
+                    sm::description("How the reactor polls before sleeping: 0 fixed, 1 latency, 2 balanced, 3 power")),
+            sm::make_gauge("idle_poll_budget_us", [this] { return double(_idle_poll_budget.count()) / 1000; },
+                    sm::description("How long the reactor polls before sleeping when idle, in microseconds")),
             sm::make_derive("timers_pending", std::bind(&decltype(_timers)::size, &_timers), sm::description("Number of tasks in the timer-pending queue")),
             sm::make_gauge("utilization", [this] { return (1-_load)  * 100; }, sm::description("CPU utilization")),
             sm::make_derive("cpu_busy_ms", [this] () -> int64_t { return total_busy_time() / 1ms; },
@@ -2280,6 +2842,19 @@ void reactor::register_metrics() {
             // total_operations value:DERIVE:0:U
             sm::make_derive("io_threaded_fallbacks", std::bind(&thread_pool::operation_count, _thread_pool.get()),
                     sm::description("Total number of io-threaded-fallbacks operations")),
+            sm::make_gauge("io_threaded_fallbacks_queue_length", std::bind(&thread_pool::queue_length, _thread_pool.get()),
+                    sm::description("Number of io-threaded-fallbacks operations submitted and not yet completed")),
+            // total_operations value:DERIVE:0:U
+            sm::make_derive("io_threaded_fallbacks_wait_us", [this] { return std::chrono::duration_cast<std::chrono::microseconds>(_thread_pool->wait_time()).count(); },
+                    sm::description("Total time io-threaded-fallbacks operations waited for a thread, in microseconds. "
+                            "Growing faster than the operations themselves run indicates the threads are saturated (see --syscall-threads)")),
+            // total_operations value:DERIVE:0:U
+            sm::make_derive("io_threaded_fallbacks_run_us", [this] { return std::chrono::duration_cast<std::chrono::microseconds>(_thread_pool->run_time()).count(); },
+                    sm::description("Total time io-threaded-fallbacks operations ran for, in microseconds")),
+            // total_operations value:DERIVE:0:U
+            sm::make_derive("io_threaded_fallbacks_wakeups", std::bind(&thread_pool::wakeup_count, _thread_pool.get()),
+                    sm::description("Number of times io-threaded-fallbacks threads were woken up. "
+                            "Operations submitted together share a wake-up")),
 
     });
 
@@ -2288,13 +2863,43 @@ void reactor::register_metrics() {
                     sm::description("Total number of malloc operations")),
             sm::make_derive("free_operations", [] { return memory::stats().frees(); }, sm::description("Total number of free operations")),
             sm::make_derive("cross_cpu_free_operations", [] { return memory::stats().cross_cpu_frees(); }, sm::description("Total number of cross cpu free")),
+            sm::make_derive("cross_cpu_free_batches", [] { return memory::stats().cross_cpu_free_batches(); }, sm::description("Total number of batches cross cpu frees were handed over in")),
+            sm::make_derive("large_span_cache_hits", [] { return memory::stats().large_span_cache_hits(); },
+                    sm::description("Total number of large allocations served by a recently freed span of the same size")),
+            sm::make_current_bytes("large_span_cache_memory", [] { return memory::stats().large_span_cache_memory(); },
+                    sm::description("Memory in recently freed large spans kept for reuse, in bytes, counted as free")),
+            sm::make_current_bytes("largest_free_span", [] { return memory::get_fragmentation_report().largest_free_span; },
+                    sm::description("Size of the largest contiguous free memory, in bytes. Well below free_memory means fragmentation")),
+            sm::make_current_bytes("small_pools_unused_memory", [] {
+                size_t unused = 0;
+                for (auto& sp : memory::get_fragmentation_report().small_pools) {
+                    unused += sp.unused_memory;
+                }
+                return unused;
+            }, sm::description("Memory taken by small pools, but not used by their objects, in bytes")),
+            sm::make_derive("defragmentations", [] { return memory::get_fragmentation_report().defragmentations; },
+                    sm::description("Total number of times the defragmentation hook was called for a large allocation failing despite free memory")),
             sm::make_gauge("malloc_live_objects", [] { return memory::stats().live_objects(); }, sm::description("Number of live objects")),
             sm::make_current_bytes("free_memory", [] { return memory::stats().free_memory(); }, sm::description("Free memory size in bytes")),
             sm::make_current_bytes("total_memory", [] { return memory::stats().total_memory(); }, sm::description("Total memory size in bytes")),
             sm::make_current_bytes("allocated_memory", [] { return memory::stats().allocated_memory(); }, sm::description("Allocated memory size in bytes")),
+            sm::make_current_bytes("prefaulted_memory", [] { return memory::prefaulted_memory(); },
+                    sm::description("Memory faulted in ahead of use by --prefault-memory, in bytes")),
             sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations"))
     });
 
+    _metric_groups.add_group("dma_buffer_pool", {
+            sm::make_counter("hits", [] { return get_dma_buffer_pool_stats().hits; }, sm::description("Total DMA buffers allocated from the pool")),
+            sm::make_counter("misses", [] { return get_dma_buffer_pool_stats().misses; },
+                    sm::description("Total DMA buffers allocated from the allocator, the pool having none of their size")),
+            sm::make_counter("bypasses", [] { return get_dma_buffer_pool_stats().bypasses; },
+                    sm::description("Total DMA buffers too large or too aligned for the pool")),
+            sm::make_counter("evictions", [] { return get_dma_buffer_pool_stats().evictions; },
+                    sm::description("Total DMA buffers freed to the allocator because the pool was full or memory low")),
+            sm::make_current_bytes("cached_bytes", [] { return get_dma_buffer_pool_stats().cached_bytes; },
+                    sm::description("Bytes held by the free DMA buffers of the pool")),
+    });
+
     _metric_groups.add_group("reactor", {
             sm::make_derive("logging_failures", [] { return logging_failures; }, sm::description("Total number of logging failures")),
             // total_operations value:DERIVE:0:U
@@ -2335,20 +2940,41 @@ void reactor::run_tasks(task_queue& tq) {
     // Make sure new tasks will inherit our scheduling group
     *internal::current_scheduling_group_ptr() = scheduling_group(tq._id);
     auto& tasks = tq._q;
+    const bool tracing = _scheduler_trace.enabled();
+    const uint64_t run_started = tracing ? _scheduler_trace.timestamp() : 0;
+    uint64_t task_started = run_started;
     while (!tasks.empty()) {
         auto tsk = tasks.front();
         tasks.pop_front();
+        // Tasks queued by other shards, or by I/O completions, are likely
+        // not in the cache; have the next one on its way while this one runs
+        if (!tasks.empty()) {
+            prefetch(tasks.front());
+        }
         STAP_PROBE(seastar, reactor_run_tasks_single_start);
         task_histogram_add_task(*tsk);
+        // The task is gone after it runs, so note what it was beforehand
+        const std::type_info& task_type = typeid(*tsk);
         _current_task = tsk;
+        _current_task_type = &task_type;
+        *internal::current_task_local_handle_ptr() = tsk->task_local_handle();
         tsk->run_and_dispose();
         _current_task = nullptr;
+        _current_task_type = nullptr;
         STAP_PROBE(seastar, reactor_run_tasks_single_end);
+        if (tracing) {
+            auto task_completed = _scheduler_trace.timestamp();
+            if (task_completed - task_started > _scheduler_trace.long_task_threshold()) {
+                _scheduler_trace.record(internal::scheduler_trace_ring::event_type::long_task, tq._id, task_started, task_completed, &task_type);
+            }
+            task_started = task_completed;
+        }
         ++tq._tasks_processed;
         ++_global_tasks_processed;
         // check at end of loop, to allow at least one task to run
         if (need_preempt()) {
-            if (tasks.size() <= _max_task_backlog) {
+            // A queue with a CPU quota must get back to run_some_tasks() to be charged
+            if (tasks.size() <= _max_task_backlog || tq._cpu_quota.count()) {
                 break;
             } else {
                 // While need_preempt() is set, task execution is inefficient due to
@@ -2358,6 +2984,11 @@ void reactor::run_tasks(task_queue& tq) {
             }
         }
     }
+    // Work started outside of tasks, by pollers and timers, has no task-local values
+    *internal::current_task_local_handle_ptr() = 0;
+    if (tracing) {
+        _scheduler_trace.record(internal::scheduler_trace_ring::event_type::task_queue, tq._id, run_started, task_started);
+    }
 }
 
 #ifdef SEASTAR_SHUFFLE_TASK_QUEUE
@@ -2629,18 +3260,51 @@ class reactor::execution_stage_pollfn final : public reactor::pollfn {
     }
     virtual bool try_enter_interrupt_mode() override {
         // This is a passive poller, so if a previous poll
-        // returned false (idle), there's no more work to do.
-        return true;
+        // returned false (idle), there's no more work to do,
+        // unless a stage is waiting for a bigger batch, which
+        // has to be flushed when its delay is up.
+        return !_esm.poll();
     }
     virtual void exit_interrupt_mode() override { }
 };
 
+// Passes a quiescent state of the shard for rcu_ptr between tasks, and
+// reclaims what was retired on it once all shards did
+class reactor::rcu_pollfn final : public reactor::pollfn {
+public:
+    rcu_pollfn() {
+        internal::rcu_online();
+    }
+    ~rcu_pollfn() {
+        internal::rcu_offline();
+    }
+    virtual bool poll() override {
+        return internal::rcu_quiescent_state();
+    }
+    virtual bool pure_poll() override {
+        return internal::rcu_can_reclaim();
+    }
+    virtual bool try_enter_interrupt_mode() override {
+        // Nothing wakes this shard up when the others are done with what
+        // it retired, so it polls until then
+        if (internal::rcu_pending()) {
+            return false;
+        }
+        internal::rcu_offline();
+        return true;
+    }
+    virtual void exit_interrupt_mode() override {
+        internal::rcu_online();
+    }
+};
+
 class reactor::syscall_pollfn final : public reactor::pollfn {
     reactor& _r;
 public:
     syscall_pollfn(reactor& r) : _r(r) {}
     virtual bool poll() final override {
-        return _r._thread_pool->complete();
+        bool woken = _r._thread_pool->flush_wakeups();
+        return _r._thread_pool->complete() || woken;
     }
     virtual bool pure_poll() override final {
         return poll(); // actually performs work, but triggers no user continuations, so okay
@@ -2696,38 +3360,57 @@ reactor::have_more_tasks() const {
     return _active_task_queues.size() + _activating_task_queues.size();
 }
 
-void reactor::insert_active_task_queue(task_queue* tq) {
+reactor::sched_entity_heap& reactor::active_members_of(sched_entity& e) noexcept {
+    return e._parent == nullptr ? _active_task_queues : e._parent->_active_members;
+}
+
+int64_t& reactor::last_vruntime_of(sched_entity& e) noexcept {
+    return e._parent == nullptr ? _last_vruntime : e._parent->_last_vruntime;
+}
+
+void reactor::add_sched_member(task_supergroup* parent) {
+    auto& nr = parent == nullptr ? _nr_top_level_entities : parent->_nr_members;
+    auto& active = parent == nullptr ? _active_task_queues : parent->_active_members;
+    active.reserve(nr + 1);
+    nr++;
+}
+
+void reactor::remove_sched_member(task_supergroup* parent) noexcept {
+    auto& nr = parent == nullptr ? _nr_top_level_entities : parent->_nr_members;
+    nr--;
+}
+
+void reactor::insert_active_task_queue(sched_entity* tq) {
     tq->_active = true;
-    auto& atq = _active_task_queues;
-    auto less = task_queue::indirect_compare();
-    if (atq.empty() || less(atq.back(), tq)) {
-        // Common case: idle->working
-        // Common case: CPU intensive task queue going to the back
-        atq.push_back(tq);
-    } else {
-        // Common case: newly activated queue preempting everything else
-        atq.push_front(tq);
-        // Less common case: newly activated queue behind something already active
-        size_t i = 0;
-        while (i + 1 != atq.size() && !less(atq[i], atq[i+1])) {
-            std::swap(atq[i], atq[i+1]);
-            ++i;
-        }
-    }
+    active_members_of(*tq).push(tq);
 }
 
+// Pops the task queue to run next, walking down the supergroups with
+// the lowest vruntime. The supergroups on the way are popped too, and
+// are re-inserted by run_some_tasks() after the task queue runs.
 reactor::task_queue* reactor::pop_active_task_queue(sched_clock::time_point now) {
-    task_queue* tq = _active_task_queues.front();
-    _active_task_queues.pop_front();
+    sched_entity* e = _active_task_queues.pop();
+    _last_vruntime = std::max(e->_vruntime, _last_vruntime);
+    while (e->_is_supergroup) {
+        auto& sg = static_cast<task_supergroup&>(*e);
+        e = sg._active_members.pop();
+        sg._last_vruntime = std::max(e->_vruntime, sg._last_vruntime);
+    }
+    auto tq = static_cast<task_queue*>(e);
     tq->_starvetime += now - tq->_ts;
     return tq;
 }
 
 void
 reactor::insert_activating_task_queues() {
-    // Quadratic, but since we expect the common cases in insert_active_task_queue() to dominate, faster
     for (auto&& tq : _activating_task_queues) {
         insert_active_task_queue(tq);
+        // Activate the supergroups that had no active members so far,
+        // limiting their advantage like activate() does for task queues
+        for (auto sg = tq->_parent; sg != nullptr && !sg->_active; sg = sg->_parent) {
+            sg->_vruntime = std::max(last_vruntime_of(*sg), sg->_vruntime);
+            insert_active_task_queue(sg);
+        }
     }
     _activating_task_queues.clear();
 }
@@ -2750,7 +3433,6 @@ reactor::run_some_tasks() {
         task_queue* tq = pop_active_task_queue(t_run_started);
         sched_print("running tq {} {}", (void*)tq, tq->_name);
         tq->_current = true;
-        _last_vruntime = std::max(tq->_vruntime, _last_vruntime);
         run_tasks(*tq);
         tq->_current = false;
         t_run_completed = now();
@@ -2759,11 +3441,21 @@ reactor::run_some_tasks() {
         sched_print("run complete ({} {}); time consumed {} usec; final vruntime {} empty {}",
                 (void*)tq, tq->_name, delta / 1us, tq->_vruntime, tq->_q.empty());
         tq->_ts = t_run_completed;
-        if (!tq->_q.empty()) {
+        if (tq->_cpu_quota.count() && charge_cpu_quota(*tq, t_run_completed, delta)) {
+            // Re-activated by unthrottle() when the quota is replenished
+            tq->_active = false;
+        } else if (!tq->_q.empty()) {
             insert_active_task_queue(tq);
         } else {
             tq->_active = false;
         }
+        for (auto sg = tq->_parent; sg != nullptr; sg = sg->_parent) {
+            if (!sg->_active_members.empty()) {
+                insert_active_task_queue(sg);
+            } else {
+                sg->_active = false;
+            }
+        }
     } while (have_more_tasks() && !need_preempt());
     _cpu_stall_detector->end_task_run(t_run_completed);
     STAP_PROBE(seastar, reactor_run_tasks_end);
@@ -2773,7 +3465,7 @@ reactor::run_some_tasks() {
 
 void
 reactor::activate(task_queue& tq) {
-    if (tq._active) {
+    if (tq._active || tq._throttled) {
         return;
     }
     sched_print("activating {} {}", (void*)&tq, tq._name);
@@ -2783,10 +3475,11 @@ reactor::activate(task_queue& tq) {
     // bound later.
     //
     // FIXME: different scheduling groups have different sensitivity to jitter, take advantage
-    if (_last_vruntime > tq._vruntime) {
-        sched_print("tq {} {} losing vruntime {} due to sleep", (void*)&tq, tq._name, _last_vruntime - tq._vruntime);
+    auto last_vruntime = last_vruntime_of(tq);
+    if (last_vruntime > tq._vruntime) {
+        sched_print("tq {} {} losing vruntime {} due to sleep", (void*)&tq, tq._name, last_vruntime - tq._vruntime);
     }
-    tq._vruntime = std::max(_last_vruntime, tq._vruntime);
+    tq._vruntime = std::max(last_vruntime, tq._vruntime);
     auto now = reactor::now();
     tq._waittime += now - tq._ts;
     tq._ts = now;
@@ -2840,15 +3533,18 @@ int reactor::do_run() {
     // 5. kernel submission: for I/O, will submit what was generated from last step.
     // 6. reap kernel events completion: some of the submissions from last step may return immediately.
     //                                   For example if we are dealing with poll() on a fd that has events.
-    poller smp_poller(std::make_unique<smp_pollfn>(*this));
+    //
+    // Pollers registered later, with the default priority, run after these.
+    poller smp_poller(std::make_unique<smp_pollfn>(*this), {"smp"});
 
-    poller reap_kernel_completions_poller(std::make_unique<reap_kernel_completions_pollfn>(*this));
-    poller io_queue_submission_poller(std::make_unique<io_queue_submission_pollfn>(*this));
-    poller kernel_submit_work_poller(std::make_unique<kernel_submit_work_pollfn>(*this));
-    poller final_real_kernel_completions_poller(std::make_unique<reap_kernel_completions_pollfn>(*this));
+    poller reap_kernel_completions_poller(std::make_unique<reap_kernel_completions_pollfn>(*this), {"kernel_completions"});
+    poller io_queue_submission_poller(std::make_unique<io_queue_submission_pollfn>(*this), {"io_queue_submission"});
+    poller kernel_submit_work_poller(std::make_unique<kernel_submit_work_pollfn>(*this), {"kernel_submission"});
+    poller final_real_kernel_completions_poller(std::make_unique<reap_kernel_completions_pollfn>(*this), {"kernel_completions"});
 
-    poller batch_flush_poller(std::make_unique<batch_flush_pollfn>(*this));
-    poller execution_stage_poller(std::make_unique<execution_stage_pollfn>());
+    poller batch_flush_poller(std::make_unique<batch_flush_pollfn>(*this), {"batch_flush"});
+    poller execution_stage_poller(std::make_unique<execution_stage_pollfn>(), {"execution_stages"});
+    poller rcu_poller(std::make_unique<rcu_pollfn>(), {"rcu"});
 
     start_aio_eventfd_loop();
 
@@ -2874,12 +3570,12 @@ int reactor::do_run() {
         });
     });
 
-    poller syscall_poller(std::make_unique<syscall_pollfn>(*this));
+    poller syscall_poller(std::make_unique<syscall_pollfn>(*this), {"syscalls"});
 
-    poller drain_cross_cpu_freelist(std::make_unique<drain_cross_cpu_freelist_pollfn>());
+    poller drain_cross_cpu_freelist(std::make_unique<drain_cross_cpu_freelist_pollfn>(), {"cross_cpu_frees"});
 
-    poller expire_lowres_timers(std::make_unique<lowres_timer_pollfn>(*this));
-    poller sig_poller(std::make_unique<signal_pollfn>(*this));
+    poller expire_lowres_timers(std::make_unique<lowres_timer_pollfn>(*this), {"lowres_timers"});
+    poller sig_poller(std::make_unique<signal_pollfn>(*this), {"signals"});
 
     using namespace std::chrono_literals;
     timer<lowres_clock> load_timer;
@@ -2887,6 +3583,7 @@ int reactor::do_run() {
     auto idle_start = now(), idle_end = idle_start;
     load_timer.set_callback([this, &last_idle, &idle_start, &idle_end] () mutable {
         _total_idle += idle_end - idle_start;
+        update_idle_poll_budget();
         auto load = double((_total_idle - last_idle).count()) / double(std::chrono::duration_cast<sched_clock::duration>(1s).count());
         last_idle = _total_idle;
         load = std::min(load, 1.0);
@@ -2912,6 +3609,7 @@ int reactor::do_run() {
     assert(r == 0);
 
     bool idle = false;
+    auto idle_period_start = idle_start;
 
     std::function<bool()> check_for_work = [this] () {
         return poll_once() || have_more_tasks();
@@ -2945,6 +3643,7 @@ int reactor::do_run() {
             if (idle) {
                 _total_idle += idle_end - idle_start;
                 account_idle(idle_end - idle_start);
+                account_idle_period(idle_end - idle_period_start);
                 idle_start = idle_end;
                 idle = false;
             }
@@ -2952,6 +3651,7 @@ int reactor::do_run() {
             idle_end = now();
             if (!idle) {
                 idle_start = idle_end;
+                idle_period_start = idle_end;
                 idle = true;
             }
             bool go_to_sleep = true;
@@ -2965,13 +3665,14 @@ int reactor::do_run() {
                 report_exception("Exception while running idle cpu handler", std::current_exception());
             }
             if (go_to_sleep) {
-                internal::cpu_relax();
-                if (idle_end - idle_start > _max_poll_time) {
+                idle_pause();
+                if (idle_end - idle_start > _idle_poll_budget) {
                     // Turn off the task quota timer to avoid spurious wakeups
                     struct itimerspec zero_itimerspec = {};
                     _task_quota_timer.timerfd_settime(0, zero_itimerspec);
                     auto start_sleep = now();
                     _cpu_stall_detector->start_sleep();
+                    ++_sleeps;
                     sleep();
                     _cpu_stall_detector->end_sleep();
                     // We may have slept for a while, so freshen idle_end
@@ -2994,13 +3695,126 @@ int reactor::do_run() {
     return _return;
 }
 
+void reactor::set_idle_mode(idle_mode mode) noexcept {
+    _idle_mode = mode;
+    update_idle_poll_budget();
+}
+
+void reactor::account_idle_period(sched_clock::duration period) noexcept {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(period).count();
+    // Bucket b holds periods shorter than 2^b microseconds
+    unsigned bucket = us > 0 ? 64 - count_leading_zeros(uint64_t(us)) : 0;
+    _idle_periods[std::min<unsigned>(bucket, _idle_periods.size() - 1)]++;
+}
+
+// Called every second. Recent idle periods count more than older ones,
+// as the counts are halved every time.
+void reactor::update_idle_poll_budget() noexcept {
+    auto periods = _idle_periods;
+    for (auto& p : _idle_periods) {
+        p /= 2;
+    }
+    if (_idle_mode == idle_mode::fixed || _max_poll_time == std::chrono::nanoseconds::max()) {
+        _idle_poll_budget = _max_poll_time;
+        return;
+    }
+    uint64_t total = 0;
+    for (auto p : periods) {
+        total += p;
+    }
+    // Not enough idle periods to learn from
+    if (total < 16) {
+        _idle_poll_budget = _max_poll_time;
+        return;
+    }
+    double fraction;
+    std::chrono::nanoseconds limit;
+    switch (_idle_mode) {
+    case idle_mode::latency:
+        fraction = 0.99;
+        limit = _max_poll_time * 10;
+        break;
+    case idle_mode::balanced:
+        fraction = 0.9;
+        limit = _max_poll_time;
+        break;
+    default:
+        fraction = 0.5;
+        limit = _max_poll_time / 4;
+        break;
+    }
+    // How long the idle periods usually last, to the precision of a bucket
+    uint64_t seen = 0;
+    unsigned bucket = 0;
+    while (bucket < periods.size() - 1) {
+        seen += periods[bucket];
+        if (seen >= total * fraction) {
+            break;
+        }
+        bucket++;
+    }
+    auto expected = std::chrono::nanoseconds(std::chrono::microseconds(uint64_t(1) << bucket));
+    if (expected <= limit) {
+        _idle_poll_budget = expected;
+    } else if (_idle_mode == idle_mode::latency) {
+        _idle_poll_budget = limit;
+    } else {
+        // Work is not likely to come soon, polling would be wasted
+        _idle_poll_budget = 0ns;
+    }
+}
+
+#ifdef __x86_64__
+
+static bool cpu_has_tpause() {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 5));
+}
+
+// Waits in C0.1 (light) or C0.2 (deeper) until the TSC reaches deadline,
+// or an interrupt
+static void tpause(bool light, uint64_t deadline) noexcept {
+    // tpause %ecx, spelled out for assemblers that don't know it
+    asm volatile(".byte 0x66, 0x0f, 0xae, 0xf1"
+            : : "c"(uint32_t(light)), "a"(uint32_t(deadline)), "d"(uint32_t(deadline >> 32)) : "cc", "memory");
+}
+
+#endif
+
+void reactor::idle_pause() noexcept {
+#ifdef __x86_64__
+    static const bool have_tpause = cpu_has_tpause();
+    if (have_tpause) {
+        // tpause doesn't wake up on messages from other shards, so the
+        // pauses are kept short compared to the wakeup latency of sleeping
+        switch (_idle_mode) {
+        case idle_mode::balanced:
+            tpause(true, __rdtsc() + 1000);
+            return;
+        case idle_mode::power:
+            tpause(false, __rdtsc() + 10000);
+            return;
+        default:
+            break;
+        }
+    }
+#endif
+    internal::cpu_relax();
+}
+
+future<> set_idle_mode(idle_mode mode) {
+    return smp::invoke_on_all([mode] {
+        engine().set_idle_mode(mode);
+    });
+}
+
 void
 reactor::sleep() {
     for (auto i = _pollers.begin(); i != _pollers.end(); ++i) {
-        auto ok = (*i)->try_enter_interrupt_mode();
+        auto ok = i->fn->try_enter_interrupt_mode();
         if (!ok) {
             while (i != _pollers.begin()) {
-                (*--i)->exit_interrupt_mode();
+                (--i)->fn->exit_interrupt_mode();
             }
             return;
         }
@@ -3009,15 +3823,38 @@ reactor::sleep() {
     _backend->wait_and_process_events(&_active_sigmask);
 
     for (auto i = _pollers.rbegin(); i != _pollers.rend(); ++i) {
-        (*i)->exit_interrupt_mode();
+        i->fn->exit_interrupt_mode();
     }
 }
 
 bool
 reactor::poll_once() {
     bool work = false;
-    for (auto c : _pollers) {
-        work |= c->poll();
+    auto started = _scheduler_trace.timestamp();
+    for (auto& p : _pollers) {
+        if (p.budget) {
+            p.credit = std::min(p.credit + p.budget, p.budget);
+            if (p.credit <= 0) {
+                p.stats->skipped_polls++;
+                continue;
+            }
+        }
+        bool found = p.fn->poll();
+        auto completed = _scheduler_trace.timestamp();
+        auto elapsed = completed - started;
+        if (p.budget) {
+            p.credit -= elapsed;
+        }
+        p.stats->time += elapsed;
+        p.stats->polls++;
+        p.stats->busy_polls += found;
+        // Only pollers that found work are recorded, so that an idle
+        // reactor doesn't flush the trace
+        if (found && _scheduler_trace.enabled()) {
+            _scheduler_trace.record(internal::scheduler_trace_ring::event_type::poller, 0, started, completed, &typeid(*p.fn));
+        }
+        work |= found;
+        started = completed;
     }
 
     return work;
@@ -3025,8 +3862,8 @@ reactor::poll_once() {
 
 bool
 reactor::pure_poll_once() {
-    for (auto c : _pollers) {
-        if (c->pure_poll()) {
+    for (auto& p : _pollers) {
+        if (p.fn->pure_poll()) {
             return true;
         }
     }
@@ -3042,7 +3879,7 @@ class poller::registration_task final : public task {
     explicit registration_task(poller* p) : _p(p) {}
     virtual void run_and_dispose() noexcept override {
         if (_p) {
-            engine().register_poller(_p->_pollfn.get());
+            engine().register_poller(_p->_pollfn.get(), _p->_opts);
             _p->_registration_task = nullptr;
         }
         delete this;
@@ -3070,22 +3907,50 @@ class poller::deregistration_task final : public task {
 
 }
 
-void reactor::register_poller(pollfn* p) {
-    _pollers.push_back(p);
+void reactor::register_poller(pollfn* p, const internal::poller_options& opts) {
+    auto name = opts.name.empty() ? sstring("other") : opts.name;
+    auto& stats = _poller_stats[name];
+    if (!stats) {
+        stats = std::make_unique<poller_stats>();
+        namespace sm = seastar::metrics;
+        static auto poller_label = sm::label("poller");
+        auto& s = *stats;
+        s.metrics.add_group("reactor", {
+            sm::make_counter("poller_time_ms", [&s] { return uint64_t(s.time / internal::scheduler_trace_ring::ticks_per_ns() / 1000000); },
+                    sm::description("Time spent polling; an increment rate of 1000ms per second indicates the poller takes all the shard's time"),
+                    {poller_label(name)}),
+            sm::make_counter("poller_polls", s.polls, sm::description("Number of times the poller was polled"), {poller_label(name)}),
+            sm::make_counter("poller_busy_polls", s.busy_polls, sm::description("Number of times the poller found work"), {poller_label(name)}),
+            sm::make_counter("poller_skipped_polls", s.skipped_polls,
+                    sm::description("Number of times the poller wasn't polled for being over its budget"), {poller_label(name)}),
+        });
+    }
+    auto budget = int64_t(opts.budget.count() * 1000 * internal::scheduler_trace_ring::ticks_per_ns());
+    // After the pollers of the same or a higher priority
+    auto pos = std::find_if(_pollers.begin(), _pollers.end(), [&] (const registered_poller& x) {
+        return x.priority < opts.priority;
+    });
+    _pollers.insert(pos, registered_poller{p, opts.priority, budget, budget, stats.get()});
 }
 
 void reactor::unregister_poller(pollfn* p) {
-    _pollers.erase(std::find(_pollers.begin(), _pollers.end(), p));
+    _pollers.erase(std::find_if(_pollers.begin(), _pollers.end(), [p] (const registered_poller& x) {
+        return x.fn == p;
+    }));
 }
 
 void reactor::replace_poller(pollfn* old, pollfn* neww) {
-    std::replace(_pollers.begin(), _pollers.end(), old, neww);
+    for (auto& x : _pollers) {
+        if (x.fn == old) {
+            x.fn = neww;
+        }
+    }
 }
 
 namespace internal {
 
 poller::poller(poller&& x) noexcept
-        : _pollfn(std::move(x._pollfn)), _registration_task(std::exchange(x._registration_task, nullptr)) {
+        : _pollfn(std::move(x._pollfn)), _opts(std::move(x._opts)), _registration_task(std::exchange(x._registration_task, nullptr)) {
     if (_pollfn && _registration_task) {
         _registration_task->moved(this);
     }
@@ -3143,10 +4008,11 @@ poller::~poller() {
 syscall_work_queue::syscall_work_queue()
     : _pending()
     , _completed()
-    , _start_eventfd(0) {
+    , _start_eventfd(0, EFD_SEMAPHORE) {
 }
 
 void syscall_work_queue::submit_item(std::unique_ptr<syscall_work_queue::work_item> item) {
+    item->submitted = std::chrono::steady_clock::now();
     (void)_queue_has_room.wait().then_wrapped([this, item = std::move(item)] (future<> f) mutable {
         // propagate wait failure via work_item
         if (f.failed()) {
@@ -3154,10 +4020,30 @@ void syscall_work_queue::submit_item(std::unique_ptr<syscall_work_queue::work_it
             return;
         }
         _pending.push(item.release());
-        _start_eventfd.signal(1);
+        if (!_woken) {
+            _woken = true;
+            _wakeups++;
+            _start_eventfd.signal(1);
+        } else {
+            _unsignaled++;
+        }
     });
 }
 
+bool syscall_work_queue::flush_wakeups(unsigned max_threads) {
+    _woken = false;
+    if (!_unsignaled) {
+        return false;
+    }
+    // The thread woken up for the first item may have taken them already,
+    // in which case the extra threads find the queue empty and go back to
+    // sleep
+    _wakeups++;
+    _start_eventfd.signal(std::min(_unsignaled, max_threads));
+    _unsignaled = 0;
+    return true;
+}
+
 unsigned syscall_work_queue::complete() {
     std::array<work_item*, queue_length> tmp_buf;
     auto end = tmp_buf.data();
@@ -3166,6 +4052,8 @@ unsigned syscall_work_queue::complete() {
     });
     for (auto p = tmp_buf.data(); p != end; ++p) {
         auto wi = *p;
+        _wait_time += wi->started - wi->submitted;
+        _run_time += wi->finished - wi->started;
         wi->complete();
         delete wi;
     }
@@ -3177,6 +4065,8 @@ unsigned syscall_work_queue::complete() {
 smp_message_queue::smp_message_queue(reactor* from, reactor* to)
     : _pending(to)
     , _completed(from)
+    , _batch_size(smp::numa_node(from->_id) == smp::numa_node(to->_id) ? batch_size : remote_node_batch_size)
+    , _remote_node(smp::numa_node(from->_id) != smp::numa_node(to->_id))
 {
 }
 
@@ -3191,6 +4081,77 @@ void smp_message_queue::stop() {
     _metrics.clear();
 }
 
+namespace {
+
+// Which peers of each shard have pushed to the shard's queues since it last
+// polled them, one bit per peer. Written by the producing shards, consumed
+// by smp::poll_queues() when smp_options::poll_active_smp_queues is set.
+class active_smp_queues {
+    static constexpr unsigned bits_per_word = std::numeric_limits<uint64_t>::digits;
+    static constexpr unsigned words_per_line = seastar::cache_line_size / sizeof(uint64_t);
+    // A shard's words are written by all its peers, so keep them off the
+    // cache lines of the other shards' words.
+    struct alignas(seastar::cache_line_size) line {
+        std::atomic<uint64_t> words[words_per_line];
+    };
+    unsigned _words_per_shard;
+    unsigned _lines_per_shard;
+    std::unique_ptr<line[]> _lines;
+
+    std::atomic<uint64_t>& word(shard_id shard, unsigned w) noexcept {
+        return _lines[shard * _lines_per_shard + w / words_per_line].words[w % words_per_line];
+    }
+public:
+    explicit active_smp_queues(unsigned nr_shards)
+        : _words_per_shard(align_up(nr_shards, bits_per_word) / bits_per_word)
+        , _lines_per_shard(align_up(_words_per_shard, words_per_line) / words_per_line)
+        , _lines(new line[nr_shards * _lines_per_shard]())
+    {}
+    unsigned words_per_shard() const noexcept {
+        return _words_per_shard;
+    }
+    // Release pairs with the acquire in consume(), so that the consumer sees
+    // what was pushed before the bit was set.
+    void mark(shard_id consumer, shard_id producer) noexcept {
+        word(consumer, producer / bits_per_word).fetch_or(uint64_t(1) << (producer % bits_per_word), std::memory_order_release);
+    }
+    uint64_t consume(shard_id consumer, unsigned w) noexcept {
+        auto& wd = word(consumer, w);
+        // Skip the write, and the cache line transfer, when there's nothing to take
+        return wd.load(std::memory_order_relaxed) ? wd.exchange(0, std::memory_order_acquire) : 0;
+    }
+    bool any(shard_id consumer) noexcept {
+        for (unsigned w = 0; w < _words_per_shard; ++w) {
+            if (word(consumer, w).load(std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+std::unique_ptr<active_smp_queues> active_smp_queues_instance;
+
+// The peers this shard has requests or responses towards that were batched
+// but possibly not yet pushed, in the same layout as active_smp_queues
+thread_local std::vector<uint64_t> unflushed_smp_queues;
+
+void mark_unflushed_smp_queue(shard_id peer) noexcept {
+    if (!unflushed_smp_queues.empty()) {
+        unflushed_smp_queues[peer / 64] |= uint64_t(1) << (peer % 64);
+    }
+}
+
+template <typename Func>
+void for_each_set_bit(uint64_t word, unsigned base, Func func) {
+    while (word) {
+        func(base + count_trailing_zeros(word));
+        word &= word - 1;
+    }
+}
+
+}
+
 void smp_message_queue::move_pending() {
     auto begin = _tx.a.pending_fifo.cbegin();
     auto end = _tx.a.pending_fifo.cend();
@@ -3212,23 +4173,25 @@ bool smp_message_queue::pure_poll_tx() const {
     return !const_cast<lf_queue&>(_completed).empty();
 }
 
-void smp_message_queue::submit_item(shard_id t, smp_timeout_clock::time_point timeout, std::unique_ptr<smp_message_queue::work_item> item) {
+void smp_message_queue::submit_item(shard_id t, smp_timeout_clock::time_point timeout, bool push_now, std::unique_ptr<smp_message_queue::work_item> item) {
   // matching signal() in process_completions()
   auto ssg_id = internal::smp_service_group_id(item->ssg);
   auto& sem = get_smp_service_groups_semaphore(ssg_id, t);
   // Future indirectly forwarded to `item`.
-  (void)get_units(sem, 1, timeout).then_wrapped([this, item = std::move(item)] (future<smp_service_group_semaphore_units> units_fut) mutable {
+  (void)get_units(sem, 1, timeout).then_wrapped([this, t, push_now, item = std::move(item)] (future<smp_service_group_semaphore_units> units_fut) mutable {
     if (units_fut.failed()) {
         item->fail_with(units_fut.get_exception());
         ++_compl;
         ++_last_cmpl_batch;
         return;
     }
+    item->submitted = std::chrono::steady_clock::now();
     _tx.a.pending_fifo.push_back(item.get());
+    mark_unflushed_smp_queue(t);
     // no exceptions from this point
     item.release();
     units_fut.get0().release();
-    if (_tx.a.pending_fifo.size() >= batch_size) {
+    if (_tx.a.pending_fifo.size() >= _batch_size || push_now) {
         move_pending();
     }
   });
@@ -3236,7 +4199,8 @@ void smp_message_queue::submit_item(shard_id t, smp_timeout_clock::time_point ti
 
 void smp_message_queue::respond(work_item* item) {
     _completed_fifo.push_back(item);
-    if (_completed_fifo.size() >= batch_size || engine()._stopped) {
+    mark_unflushed_smp_queue(_completed.remote->_id);
+    if (_completed_fifo.size() >= _batch_size || engine()._stopped) {
         flush_response_batch();
     }
 }
@@ -3273,6 +4237,9 @@ smp_message_queue::lf_queue::maybe_wakeup() {
     // because seq_cst is so expensive.
     //
     // However, we do need a compiler barrier:
+    if (active_smp_queues_instance) {
+        active_smp_queues_instance->mark(remote->_id, this_shard_id());
+    }
     std::atomic_signal_fence(std::memory_order_seq_cst);
     if (remote->_sleeping.load(std::memory_order_relaxed)) {
         // We are free to clear it, because we're sending a signal now
@@ -3312,7 +4279,17 @@ size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
 }
 
 size_t smp_message_queue::process_completions(shard_id t) {
-    auto nr = process_queue<prefetch_cnt*2>(_completed, [t] (work_item* wi) {
+    auto now = std::chrono::steady_clock::now();
+    auto nr = process_queue<prefetch_cnt*2>(_completed, [this, t, now] (work_item* wi) {
+        auto latency = now - wi->submitted;
+        _latency_sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        auto bucket = us > 1 ? log2ceil(uint64_t(us)) : 0;
+        if (bucket < latency_buckets) {
+            ++_latency_hist[bucket];
+        } else {
+            ++_latency_overflow;
+        }
         wi->complete();
         auto ssg_id = smp_service_group_id(wi->ssg);
         get_smp_service_groups_semaphore(ssg_id, t).signal();
@@ -3340,6 +4317,21 @@ size_t smp_message_queue::process_incoming() {
     return nr;
 }
 
+metrics::histogram smp_message_queue::latency_histogram() const {
+    metrics::histogram h;
+    h.sample_sum = _latency_sum_ns / 1000.0;
+    h.buckets.resize(latency_buckets);
+    uint64_t count = 0;
+    for (unsigned i = 0; i < latency_buckets; ++i) {
+        count += _latency_hist[i];
+        h.buckets[i].count = count;
+        h.buckets[i].upper_bound = 1 << i;
+    }
+    // Not _compl, which also counts messages that failed before being sent
+    h.sample_count = count + _latency_overflow;
+    return h;
+}
+
 void smp_message_queue::start(unsigned cpuid) {
     _tx.init();
     namespace sm = seastar::metrics;
@@ -3357,7 +4349,10 @@ void smp_message_queue::start(unsigned cpuid) {
             // total_operations value:DERIVE:0:U
             sm::make_derive("total_sent_messages", _sent, sm::description("Total number of sent messages"), {sm::shard_label(instance)})(sm::metric_disabled),
             // total_operations value:DERIVE:0:U
-            sm::make_derive("total_completed_messages", _compl, sm::description("Total number of messages completed"), {sm::shard_label(instance)})(sm::metric_disabled)
+            sm::make_derive("total_completed_messages", _compl, sm::description("Total number of messages completed"), {sm::shard_label(instance)})(sm::metric_disabled),
+            sm::make_histogram("round_trip_latency", [this] { return latency_histogram(); },
+                    sm::description("Time from sending a message until its completion is received, in microseconds"),
+                    {sm::shard_label(instance), sm::label("numa")(_remote_node ? "remote" : "local")})(sm::metric_disabled)
     });
 }
 
@@ -3365,9 +4360,9 @@ readable_eventfd writeable_eventfd::read_side() {
     return readable_eventfd(_fd.dup());
 }
 
-file_desc writeable_eventfd::try_create_eventfd(size_t initial) {
+file_desc writeable_eventfd::try_create_eventfd(size_t initial, int flags) {
     assert(size_t(int(initial)) == initial);
-    return file_desc::eventfd(initial, EFD_CLOEXEC);
+    return file_desc::eventfd(initial, EFD_CLOEXEC | flags);
 }
 
 void writeable_eventfd::signal(size_t count) {
@@ -3454,14 +4449,26 @@ reactor_options::reactor_options(program_options::option_group* parent_group)
     , poll_mode(*this, "poll-mode", "poll continuously (100% cpu use)")
     , idle_poll_time_us(*this, "idle-poll-time-us", reactor::calculate_poll_time() / 1us,
                 "idle polling time in microseconds (reduce for overprovisioned environments or laptops)")
+    , idle_mode(*this, "idle-mode", "fixed",
+                "how to poll before sleeping when idle: fixed (for --idle-poll-time-us), or adapting to how long idle periods"
+                " usually last with latency, balanced or power")
     , poll_aio(*this, "poll-aio", true,
                 "busy-poll for disk I/O (reduces latency and increases throughput)")
     , task_quota_ms(*this, "task-quota-ms", 0.5, "Max time (ms) between polls")
     , io_latency_goal_ms(*this, "io-latency-goal-ms", {}, "Max time (ms) io operations must take (1.5 * task-quota-ms if not set)")
+    , io_latency_target_ms(*this, "io-latency-target-ms", {}, "Target 99th percentile latency (ms) of io operations; io rates are lowered while it's exceeded (static rates if not set)")
     , max_task_backlog(*this, "max-task-backlog", 1000, "Maximum number of task backlog to allow; above this we ignore I/O")
     , blocked_reactor_notify_ms(*this, "blocked-reactor-notify-ms", 200, "threshold in miliseconds over which the reactor is considered blocked if no progress is made")
+    , blocked_reactor_notify_us(*this, "blocked-reactor-notify-us", 0,
+                "threshold in microseconds over which the reactor is considered blocked if no progress is made, for sub-millisecond thresholds; overrides blocked-reactor-notify-ms unless 0")
     , blocked_reactor_reports_per_minute(*this, "blocked-reactor-reports-per-minute", 5, "Maximum number of backtraces reported by stall detector per minute")
     , blocked_reactor_report_format_oneline(*this, "blocked-reactor-report-format-oneline", true, "Print a simplified backtrace on a single line")
+    , blocked_reactor_summary_interval_s(*this, "blocked-reactor-summary-interval-s", 600,
+                "Period in seconds of the log summary of the stalls, aggregated by backtrace, that occurred since the last one; 0 disables the summary")
+    , scheduler_trace_entries(*this, "scheduler-trace-entries", 8192,
+                "Number of recent scheduler events (task queue runs, pollers, tasks exceeding the task quota or the stall threshold) kept per shard for tracing; 0 disables the trace")
+    , cpu_profiler_period_us(*this, "cpu-profiler-period-us", 0,
+                "Sample each shard's backtrace once per this many microseconds of CPU time, for an in-process CPU profile per scheduling group; 0 disables the profiler")
     , relaxed_dma(*this, "relaxed-dma", "allow using buffered I/O if DMA is not available (reduces performance)")
     , linux_aio_nowait(*this, "linux-aio-nowait", aio_nowait_supported,
                 "use the Linux NOWAIT AIO feature, which reduces reactor stalls due to aio (autodetected)")
@@ -3486,6 +4493,17 @@ reactor_options::reactor_options(program_options::option_group* parent_group)
     , max_networking_io_control_blocks(*this, "max-networking-io-control-blocks", 10000,
                 "Maximum number of I/O control blocks (IOCBs) to allocate per shard. This translates to the number of sockets supported per shard."
                 " Requires tuning /proc/sys/fs/aio-max-nr. Only valid for the linux-aio reactor backend (see --reactor-backend).")
+    , uring_sqpoll(*this, "uring-sqpoll", false,
+                "Poll the io_uring submission queue from a kernel thread, so that submitting I/O usually doesn't need a system call."
+                " Requires Linux 5.11 or later. Only valid for the io_uring reactor backend (see --reactor-backend).")
+    , uring_iopoll(*this, "uring-iopoll", false,
+                "Poll NVMe generic devices (/dev/ngXnY) for I/O completions instead of waiting for interrupts, busy-polling while such I/O is in flight."
+                " Requires Linux 6.1 or later and nvme driver poll queues. Only valid for the io_uring reactor backend (see --reactor-backend).")
+    , net_busy_poll_us(*this, "net-busy-poll-us", 0,
+                "Busy-poll the network receive queue of the shard's sockets for up to this many microseconds before sleeping, instead of"
+                " waiting for interrupts (0 disables). Requires Linux 6.9 or later, and the epoll or io_uring reactor backend (see --reactor-backend).")
+    , syscall_threads(*this, "syscall-threads", 1,
+                "Number of threads per shard that run blocking system calls, like opening or renaming files.")
 #ifdef SEASTAR_HEAPPROF
     , heapprof(*this, "heapprof", "enable seastar heap profiling")
 #else
@@ -3503,7 +4521,13 @@ smp_options::smp_options(program_options::option_group* parent_group)
     , reserve_memory(*this, "reserve-memory", {}, "memory reserved to OS (if --memory not specified)")
     , hugepages(*this, "hugepages", {}, "path to accessible hugetlbfs mount (typically /dev/hugepages/something)")
     , lock_memory(*this, "lock-memory", {}, "lock all memory (prevents swapping)")
+    , prefault_memory(*this, "prefault-memory", "none",
+                "fault in shard memory ahead of use: none, startup (all shards in parallel, before starting)"
+                " or background (while the shard's cpu is idle)")
     , thread_affinity(*this, "thread-affinity", true, "pin threads to their cpus (disable for overprovisioning)")
+    , one_shard_per_core(*this, "one-shard-per-core", false,
+                "run at most one shard on each physical core, leaving its SMT siblings to the shard's syscall threads and other threads;"
+                " the default number of shards is then the number of cores")
 #ifdef SEASTAR_HAVE_HWLOC
     , num_io_queues(*this, "num-io-queues", {}, "Number of IO queues. Each IO unit will be responsible for a fraction of the IO requests. Defaults to the number of threads")
     , num_io_groups(*this, "num-io-groups", {}, "Number of IO groups. Each IO group will be responsible for a fraction of the IO requests. Defaults to the number of NUMA nodes")
@@ -3526,6 +4550,7 @@ smp_options::smp_options(program_options::option_group* parent_group)
 #else
     , allow_cpus_in_remote_numa_nodes(*this, "allow-cpus-in-remote-numa-nodes", program_options::unused{})
 #endif
+    , poll_active_smp_queues(*this, "poll-active-smp-queues", false, "poll only the cross-shard queues with pending work (helps with many cores)")
 {
 }
 
@@ -3545,6 +4570,10 @@ struct reactor_deleter {
 thread_local std::unique_ptr<reactor, reactor_deleter> reactor_holder;
 
 thread_local smp_message_queue** smp::_qs;
+std::vector<unsigned> smp::_numa_nodes;
+std::vector<int> smp::_cpu_shards;
+std::vector<resource::cpuset> smp::_sibling_cpus;
+std::vector<unsigned> smp::_cache_groups;
 thread_local std::thread::id smp::_tmain;
 unsigned smp::count = 0;
 
@@ -3555,6 +4584,9 @@ void smp::start_all_queues()
             _qs[c][this_shard_id()].start(c);
         }
     }
+    if (active_smp_queues_instance) {
+        unflushed_smp_queues.assign(active_smp_queues_instance->words_per_shard(), 0);
+    }
     _alien._qs[this_shard_id()].start();
 }
 
@@ -3684,6 +4716,7 @@ class disk_config_params {
     std::optional<unsigned> _capacity;
     std::unordered_map<dev_t, mountpoint_params> _mountpoints;
     std::chrono::duration<double> _latency_goal;
+    std::chrono::duration<double> _latency_target{0};
 
 public:
     uint64_t per_io_group(uint64_t qty, unsigned nr_groups) const noexcept {
@@ -3706,6 +4739,9 @@ class disk_config_params {
         seastar_logger.debug("smp::count: {}", smp::count);
         _latency_goal = std::chrono::duration_cast<std::chrono::duration<double>>(latency_goal_opt(reactor_opts) * 1ms);
         seastar_logger.debug("latency_goal: {}", latency_goal().count());
+        if (reactor_opts.io_latency_target_ms) {
+            _latency_target = std::chrono::duration_cast<std::chrono::duration<double>>(reactor_opts.io_latency_target_ms.get_value() * 1ms);
+        }
 
         if (smp_opts.max_io_requests) {
             seastar_logger.warn("the --max-io-requests option is deprecated, switch to io properties file instead");
@@ -3757,6 +4793,11 @@ class disk_config_params {
                             d.read_req_rate == 0 || d.write_req_rate == 0) {
                         throw std::runtime_error(fmt::format("R/W bytes and req rates must not be zero"));
                     }
+                    for (auto& m : d.mixed) {
+                        if (m.read_ratio < 0.0 || m.read_ratio >= 1.0 || m.request_size == 0 || m.iops == 0) {
+                            throw std::runtime_error(fmt::format("Mixed capacity of {} must have a read_ratio in [0, 1) and non-zero request_size and iops", d.mountpoint));
+                        }
+                    }
 
                     seastar_logger.debug("dev_id: {} mountpoint: {}", st_dev, d.mountpoint);
                     _mountpoints.emplace(st_dev, d);
@@ -3769,6 +4810,45 @@ class disk_config_params {
         _mountpoints.emplace(0, d);
     }
 
+    // The costs of requests that the queue model is the sums of the costs of
+    // their counts and of their lengths, both derived from the peak rates
+    // measured separately for reads and writes. When the measured capacity
+    // of a mixed workload is lower than the one this predicts, the writes are
+    // charged for the difference, by as much as the worst mix of requests of
+    // the same size needs. The factors of lengths that were not measured are
+    // interpolated between the nearest measured ones.
+    static std::vector<float> write_cost_factors(const mountpoint_params& p) {
+        auto cost = [] (uint64_t req_rate, uint64_t bytes_rate, uint64_t size) {
+            return 1.0 / req_rate + double(size) / bytes_rate;
+        };
+        std::map<unsigned, float> measured;
+        for (auto& m : p.mixed) {
+            auto read_cost = cost(p.read_req_rate, p.read_bytes_rate, m.request_size);
+            auto write_cost = cost(p.write_req_rate, p.write_bytes_rate, m.request_size);
+            auto factor = (1.0 / m.iops - m.read_ratio * read_cost) / ((1.0 - m.read_ratio) * write_cost);
+            auto idx = log2floor(std::max<uint64_t>(m.request_size >> io_queue::block_size_shift, 1));
+            auto& f = measured[idx];
+            f = std::max({f, float(factor), 1.0f});
+        }
+
+        std::vector<float> factors(measured.rbegin()->first + 1);
+        auto next = measured.begin();
+        for (unsigned idx = 0; idx < factors.size(); idx++) {
+            if (idx > next->first) {
+                ++next;
+            }
+            if (next == measured.begin() || idx == next->first) {
+                factors[idx] = next->second;
+            } else {
+                auto prev = std::prev(next);
+                auto w = float(idx - prev->first) / (next->first - prev->first);
+                factors[idx] = prev->second + w * (next->second - prev->second);
+            }
+        }
+        seastar_logger.debug("write cost factors for {}: {}", p.mountpoint, fmt::join(factors, " "));
+        return factors;
+    }
+
     struct io_queue::config generate_config(dev_t devid, unsigned nr_groups) const {
         seastar_logger.debug("generate_config dev_id: {}", devid);
         const mountpoint_params& p = _mountpoints.at(devid);
@@ -3797,6 +4877,10 @@ class disk_config_params {
                     seastar_logger.warn("IOPS is too low for {}, using {:.3f}ms IO latency goal", p.mountpoint, tick.count() * 1000);
                 }
             }
+            if (!p.mixed.empty() && p.read_bytes_rate != std::numeric_limits<uint64_t>::max()
+                    && p.read_req_rate != std::numeric_limits<uint64_t>::max()) {
+                cfg.disk_write_cost_factors = write_cost_factors(p);
+            }
             if (p.read_saturation_length != std::numeric_limits<uint64_t>::max()) {
                 cfg.disk_read_saturation_length = p.read_saturation_length;
             }
@@ -3807,6 +4891,7 @@ class disk_config_params {
             cfg.duplex = p.duplex;
             cfg.rate_factor = p.rate_factor;
             cfg.rate_limit_duration = tick;
+            cfg.latency_target = _latency_target;
         } else {
             // For backwards compatibility
             cfg.capacity = *_capacity;
@@ -3938,6 +5023,8 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
 
     if (smp_opts.smp) {
         nr_cpus = smp_opts.smp.get_value();
+    } else if (smp_opts.one_shard_per_core.get_value()) {
+        nr_cpus = resource::nr_cores(rc, cpu_set);
     } else {
         nr_cpus = cpu_set.size();
     }
@@ -3973,6 +5060,15 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
     if (smp_opts.hugepages) {
         hugepages_path = smp_opts.hugepages.get_value();
     }
+    auto prefault = memory::prefault_mode::none;
+    auto prefault_opt = smp_opts.prefault_memory.get_value();
+    if (prefault_opt == "startup") {
+        prefault = memory::prefault_mode::startup;
+    } else if (prefault_opt == "background") {
+        prefault = memory::prefault_mode::background;
+    } else if (prefault_opt != "none") {
+        throw std::runtime_error(format("Invalid --prefault-memory {}, valid values are: none, startup and background", prefault_opt));
+    }
     auto mlock = false;
     if (smp_opts.lock_memory) {
         mlock = smp_opts.lock_memory.get_value();
@@ -3997,6 +5093,7 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
 
     rc.cpus = smp::count;
     rc.cpu_set = std::move(cpu_set);
+    rc.one_shard_per_core = smp_opts.one_shard_per_core.get_value();
 
     disk_config_params disk_config;
     disk_config.parse_config(smp_opts, reactor_opts);
@@ -4013,6 +5110,19 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
 
     auto resources = resource::allocate(rc);
     std::vector<resource::cpu> allocations = std::move(resources.cpus);
+    _numa_nodes.clear();
+    _cpu_shards.clear();
+    _sibling_cpus.clear();
+    _cache_groups.clear();
+    for (auto&& a : allocations) {
+        _numa_nodes.push_back(a.nodeid);
+        _sibling_cpus.push_back(thread_affinity ? a.siblings : resource::cpuset());
+        _cache_groups.push_back(a.cache_group);
+        if (a.cpu_id >= _cpu_shards.size()) {
+            _cpu_shards.resize(a.cpu_id + 1, -1);
+        }
+        _cpu_shards[a.cpu_id] = _numa_nodes.size() - 1;
+    }
     if (thread_affinity) {
         smp::pin(allocations[0].cpu_id);
     }
@@ -4029,6 +5139,13 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
     reactor_config reactor_cfg;
     reactor_cfg.auto_handle_sigint_sigterm = reactor_opts._auto_handle_sigint_sigterm;
     reactor_cfg.max_networking_aio_io_control_blocks = adjust_max_networking_aio_io_control_blocks(reactor_opts.max_networking_io_control_blocks.get_value());
+    reactor_cfg.uring_sqpoll = reactor_opts.uring_sqpoll.get_value();
+    reactor_cfg.uring_iopoll = reactor_opts.uring_iopoll.get_value();
+    reactor_cfg.net_busy_poll_us = reactor_opts.net_busy_poll_us.get_value();
+    reactor_cfg.syscall_threads = reactor_opts.syscall_threads.get_value();
+    if (reactor_cfg.syscall_threads == 0) {
+        throw std::runtime_error("--syscall-threads must be at least 1");
+    }
 
 #ifdef SEASTAR_HEAPPROF
     bool heapprof_enabled = reactor_opts.heapprof;
@@ -4079,8 +5196,13 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
                 std::lock_guard _(io_info.lock);
                 auto& iog = io_info.groups[group_idx];
                 if (!iog) {
-                    struct io_queue::config qcfg = disk_config.generate_config(topo.first, io_info.groups.size());
-                    iog = std::make_shared<io_group>(std::move(qcfg));
+                    auto peer = boost::find_if(io_info.groups, [] (auto& g) { return bool(g); });
+                    if (peer != io_info.groups.end()) {
+                        iog = std::make_shared<io_group>(**peer, group_idx);
+                    } else {
+                        struct io_queue::config qcfg = disk_config.generate_config(topo.first, io_info.groups.size());
+                        iog = std::make_shared<io_group>(std::move(qcfg), io_info.groups.size(), group_idx);
+                    }
                     seastar_logger.debug("allocate {} IO group", group_idx);
                 }
                 group = iog;
@@ -4107,7 +5229,7 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
     auto smp_tmain = smp::_tmain;
     for (i = 1; i < smp::count; i++) {
         auto allocation = allocations[i];
-        create_thread([this, smp_tmain, inited, &reactors_registered, &smp_queues_constructed, &reactor_opts, &reactors, hugepages_path, i, allocation, assign_io_queues, alloc_io_queues, thread_affinity, heapprof_enabled, mbind, backend_selector, reactor_cfg] {
+        create_thread([this, smp_tmain, inited, &reactors_registered, &smp_queues_constructed, &reactor_opts, &reactors, hugepages_path, i, allocation, assign_io_queues, alloc_io_queues, thread_affinity, heapprof_enabled, mbind, backend_selector, reactor_cfg, prefault] {
           try {
             // initialize thread_locals that are equal across all reacto threads of this smp instance
             smp::_tmain = smp_tmain;
@@ -4137,6 +5259,7 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
             _qs = _qs_owner.get();
             start_all_queues();
             assign_io_queues(i);
+            memory::prefault_memory(prefault);
             inited->wait();
             engine().configure(reactor_opts);
             engine().do_run();
@@ -4170,6 +5293,12 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
     reactors_registered.wait();
     _qs_owner = decltype(smp::_qs_owner){new smp_message_queue* [smp::count], qs_deleter{}};
     _qs = _qs_owner.get();
+    internal::rcu_init(smp::count);
+    if (smp_opts.poll_active_smp_queues.get_value()) {
+        active_smp_queues_instance = std::make_unique<active_smp_queues>(smp::count);
+    } else {
+        active_smp_queues_instance.reset();
+    }
     for(unsigned i = 0; i < smp::count; i++) {
         smp::_qs_owner[i] = reinterpret_cast<smp_message_queue*>(operator new[] (sizeof(smp_message_queue) * smp::count));
         for (unsigned j = 0; j < smp::count; ++j) {
@@ -4180,6 +5309,7 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
     smp_queues_constructed.wait();
     start_all_queues();
     assign_io_queues(0);
+    memory::prefault_memory(prefault);
     inited->wait();
 
     engine().configure(reactor_opts);
@@ -4187,6 +5317,9 @@ void smp::configure(const smp_options& smp_opts, const reactor_options& reactor_
 }
 
 bool smp::poll_queues() {
+    if (active_smp_queues_instance) {
+        return poll_active_queues();
+    }
     size_t got = 0;
     for (unsigned i = 0; i < count; i++) {
         if (this_shard_id() != i) {
@@ -4203,6 +5336,9 @@ bool smp::poll_queues() {
 }
 
 bool smp::pure_poll_queues() {
+    if (active_smp_queues_instance) {
+        return pure_poll_active_queues();
+    }
     for (unsigned i = 0; i < count; i++) {
         if (this_shard_id() != i) {
             auto& rxq = _qs[this_shard_id()][i];
@@ -4217,6 +5353,53 @@ bool smp::pure_poll_queues() {
     return false;
 }
 
+// Like poll_queues(), but only visits the peers whose queues were pushed to
+// since the last poll, according to active_smp_queues, and the ones this
+// shard has batched requests or responses for.
+bool smp::poll_active_queues() {
+    size_t got = 0;
+    auto me = this_shard_id();
+    for (unsigned w = 0; w < unflushed_smp_queues.size(); ++w) {
+        for_each_set_bit(std::exchange(unflushed_smp_queues[w], 0), w * 64, [&] (shard_id i) {
+            auto& rxq = _qs[me][i];
+            rxq.flush_response_batch();
+            auto& txq = _qs[i][me];
+            txq.flush_request_batch();
+            if (rxq.has_unflushed_responses() || !txq._tx.a.pending_fifo.empty()) {
+                // The peer's queue is full, retry on the next poll
+                mark_unflushed_smp_queue(i);
+                got += rxq.has_unflushed_responses();
+            }
+        });
+    }
+    auto& active = *active_smp_queues_instance;
+    for (unsigned w = 0; w < active.words_per_shard(); ++w) {
+        for_each_set_bit(active.consume(me, w), w * 64, [&] (shard_id i) {
+            got += _qs[me][i].process_incoming();
+            got += _qs[i][me].process_completions(i);
+        });
+    }
+    return got != 0;
+}
+
+bool smp::pure_poll_active_queues() {
+    auto me = this_shard_id();
+    for (unsigned w = 0; w < unflushed_smp_queues.size(); ++w) {
+        bool pending = false;
+        for_each_set_bit(unflushed_smp_queues[w], w * 64, [&] (shard_id i) {
+            auto& rxq = _qs[me][i];
+            rxq.flush_response_batch();
+            auto& txq = _qs[i][me];
+            txq.flush_request_batch();
+            pending |= rxq.has_unflushed_responses();
+        });
+        if (pending) {
+            return true;
+        }
+    }
+    return active_smp_queues_instance->any(me);
+}
+
 __thread reactor* local_engine;
 
 void report_exception(std::string_view message, std::exception_ptr eptr) noexcept {
@@ -4372,24 +5555,61 @@ std::chrono::nanoseconds reactor::total_steal_time() {
            std::chrono::duration_cast<std::chrono::nanoseconds>(thread_cputime_clock::now().time_since_epoch());
 }
 
-static std::atomic<unsigned long> s_used_scheduling_group_ids_bitmap{3}; // 0=main, 1=atexit
+// A set of ids in the [0, Max) range, allocated from any shard. Takes a
+// word of the bitmap per 64 ids, so the limit isn't tied to the word size
+template <unsigned Max>
+class id_bitmap {
+    static constexpr unsigned bits = std::numeric_limits<unsigned long>::digits;
+    std::array<std::atomic<unsigned long>, (Max + bits - 1) / bits> _words;
+
+    static constexpr unsigned long usable_mask(unsigned w) noexcept {
+        auto nr = std::min(Max - w * bits, bits);
+        return nr == bits ? ~0ul : (1ul << nr) - 1;
+    }
+public:
+    // The ids set in the first word are allocated from the start
+    constexpr explicit id_bitmap(unsigned long reserved) noexcept : _words{reserved} {}
+
+    int allocate() noexcept {
+        for (unsigned w = 0; w < _words.size(); w++) {
+            auto b = _words[w].load(std::memory_order_relaxed);
+            auto nb = b;
+            do {
+                auto free = ~b & usable_mask(w);
+                if (free == 0) {
+                    break;
+                }
+                nb = b | (1ul << count_trailing_zeros(free));
+            } while (!_words[w].compare_exchange_weak(b, nb, std::memory_order_relaxed));
+            if ((~b & usable_mask(w)) != 0) {
+                return w * bits + count_trailing_zeros(nb & ~b);
+            }
+        }
+        return -1;
+    }
+
+    void deallocate(unsigned id) noexcept {
+        _words[id / bits].fetch_and(~(1ul << (id % bits)), std::memory_order_relaxed);
+    }
+
+    size_t count() const noexcept {
+        size_t ret = 0;
+        for (auto& w : _words) {
+            ret += __builtin_popcountl(w.load(std::memory_order_relaxed));
+        }
+        return ret;
+    }
+};
+
+static id_bitmap<max_scheduling_groups()> s_used_scheduling_group_ids{3}; // 0=main, 1=atexit
+// A supergroup holds at least one group, so there's no point in having more
+static id_bitmap<max_scheduling_groups() + 1> s_used_scheduling_supergroup_ids{1}; // 0=root
 static std::atomic<unsigned long> s_next_scheduling_group_specific_key{0};
 
 static
 int
 allocate_scheduling_group_id() noexcept {
-    static_assert(max_scheduling_groups() <= std::numeric_limits<unsigned long>::digits, "more scheduling groups than available bits");
-    auto b = s_used_scheduling_group_ids_bitmap.load(std::memory_order_relaxed);
-    auto nb = b;
-    unsigned i = 0;
-    do {
-        if (__builtin_popcountl(b) == max_scheduling_groups()) {
-            return -1;
-        }
-        i = count_trailing_zeros(~b);
-        nb = b | (1ul << i);
-    } while (!s_used_scheduling_group_ids_bitmap.compare_exchange_weak(b, nb, std::memory_order_relaxed));
-    return i;
+    return s_used_scheduling_group_ids.allocate();
 }
 
 static
@@ -4401,7 +5621,7 @@ allocate_scheduling_group_specific_key() noexcept {
 static
 void
 deallocate_scheduling_group_id(unsigned id) noexcept {
-    s_used_scheduling_group_ids_bitmap.fetch_and(~(1ul << id), std::memory_order_relaxed);
+    s_used_scheduling_group_ids.deallocate(id);
 }
 
 void
@@ -4421,12 +5641,14 @@ reactor::allocate_scheduling_group_specific_data(scheduling_group sg, scheduling
 }
 
 future<>
-reactor::init_scheduling_group(seastar::scheduling_group sg, sstring name, float shares) {
+reactor::init_scheduling_group(seastar::scheduling_group sg, sstring name, float shares, scheduling_supergroup parent) {
     auto& sg_data = _scheduling_group_specific_data;
     auto& this_sg = sg_data.per_scheduling_group_data[sg._id];
+    auto p = parent.is_root() ? nullptr : _task_supergroups[parent._id].get();
+    add_sched_member(p);
     this_sg.queue_is_initialized = true;
     _task_queues.resize(std::max<size_t>(_task_queues.size(), sg._id + 1));
-    _task_queues[sg._id] = std::make_unique<task_queue>(sg._id, name, shares);
+    _task_queues[sg._id] = std::make_unique<task_queue>(sg._id, name, shares, p);
     unsigned long num_keys = s_next_scheduling_group_specific_key.load(std::memory_order_relaxed);
 
     return with_scheduling_group(sg, [this, num_keys, sg] () {
@@ -4471,11 +5693,28 @@ reactor::destroy_scheduling_group(scheduling_group sg) {
         auto& sg_data = _scheduling_group_specific_data;
         auto& this_sg = sg_data.per_scheduling_group_data[sg._id];
         this_sg.queue_is_initialized = false;
+        remove_sched_member(_task_queues[sg._id]->_parent);
         _task_queues[sg._id].reset();
     });
 
 }
 
+void
+reactor::init_scheduling_supergroup(scheduling_supergroup sg, float shares, scheduling_supergroup parent) {
+    auto p = parent.is_root() ? nullptr : _task_supergroups[parent._id].get();
+    add_sched_member(p);
+    _task_supergroups.resize(std::max<size_t>(_task_supergroups.size(), sg._id + 1));
+    _task_supergroups[sg._id] = std::make_unique<task_supergroup>(shares, p);
+}
+
+void
+reactor::destroy_scheduling_supergroup(scheduling_supergroup sg) {
+    auto& tsg = _task_supergroups[sg._id];
+    assert(tsg->_nr_members == 0);
+    remove_sched_member(tsg->_parent);
+    tsg.reset();
+}
+
 void
 internal::no_such_scheduling_group(scheduling_group sg) {
     throw std::invalid_argument(format("The scheduling group does not exist ({})", internal::scheduling_group_index(sg)));
@@ -4491,8 +5730,23 @@ scheduling_group::set_shares(float shares) noexcept {
     engine()._task_queues[_id]->set_shares(shares);
 }
 
+void
+scheduling_group::set_cpu_quota(std::chrono::microseconds quota, std::chrono::microseconds period) noexcept {
+    engine().set_cpu_quota(*engine()._task_queues[_id], quota, period);
+}
+
+void
+scheduling_supergroup::set_shares(float shares) noexcept {
+    engine()._task_supergroups[_id]->set_shares(shares);
+}
+
 future<scheduling_group>
 create_scheduling_group(sstring name, float shares) noexcept {
+    return create_scheduling_group(std::move(name), shares, scheduling_supergroup());
+}
+
+future<scheduling_group>
+create_scheduling_group(sstring name, float shares, scheduling_supergroup parent) noexcept {
     auto aid = allocate_scheduling_group_id();
     if (aid < 0) {
         return make_exception_future<scheduling_group>(std::runtime_error("Scheduling group limit exceeded"));
@@ -4500,13 +5754,47 @@ create_scheduling_group(sstring name, float shares) noexcept {
     auto id = static_cast<unsigned>(aid);
     assert(id < max_scheduling_groups());
     auto sg = scheduling_group(id);
-    return smp::invoke_on_all([sg, name, shares] {
-        return engine().init_scheduling_group(sg, name, shares);
+    return smp::invoke_on_all([sg, name, shares, parent] {
+        return engine().init_scheduling_group(sg, name, shares, parent);
     }).then([sg] {
         return make_ready_future<scheduling_group>(sg);
     });
 }
 
+future<scheduling_supergroup>
+create_scheduling_supergroup(float shares, scheduling_supergroup parent) noexcept {
+    auto aid = s_used_scheduling_supergroup_ids.allocate();
+    if (aid < 0) {
+        return make_exception_future<scheduling_supergroup>(std::runtime_error("Scheduling supergroup limit exceeded"));
+    }
+    auto sg = scheduling_supergroup(static_cast<unsigned>(aid));
+    return smp::invoke_on_all([sg, shares, parent] {
+        engine().init_scheduling_supergroup(sg, shares, parent);
+    }).then([sg] {
+        return make_ready_future<scheduling_supergroup>(sg);
+    });
+}
+
+future<scheduling_supergroup>
+create_scheduling_supergroup(float shares) noexcept {
+    return create_scheduling_supergroup(shares, scheduling_supergroup());
+}
+
+future<>
+destroy_scheduling_supergroup(scheduling_supergroup sg) noexcept {
+    if (sg.is_root()) {
+        return make_exception_future<>(make_backtraced_exception_ptr<std::runtime_error>("Attempt to destroy the root scheduling supergroup"));
+    }
+    if (engine()._task_supergroups[sg._id]->_nr_members != 0) {
+        return make_exception_future<>(make_backtraced_exception_ptr<std::runtime_error>("Attempt to destroy a scheduling supergroup that has members"));
+    }
+    return smp::invoke_on_all([sg] {
+        engine().destroy_scheduling_supergroup(sg);
+    }).then([sg] {
+        s_used_scheduling_supergroup_ids.deallocate(sg._id);
+    });
+}
+
 future<scheduling_group_key>
 scheduling_group_key_create(scheduling_group_key_config cfg) noexcept {
     scheduling_group_key key = allocate_scheduling_group_specific_key();
@@ -4628,8 +5916,7 @@ std::ostream& operator<<(std::ostream& os, const stall_report& sr) {
 }
 
 size_t scheduling_group_count() {
-    auto b = s_used_scheduling_group_ids_bitmap.load(std::memory_order_relaxed);
-    return __builtin_popcountl(b);
+    return s_used_scheduling_group_ids.count();
 }
 
 }
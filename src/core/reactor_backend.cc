@@ -21,14 +21,23 @@
 #include "core/reactor_backend.hh"
 #include "core/thread_pool.hh"
 #include "core/syscall_result.hh"
+#include "core/uname.hh"
 #include <seastar/core/print.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/prefetch.hh>
 #include <seastar/core/internal/buffer_allocator.hh>
 #include <seastar/util/defer.hh>
 #include <seastar/util/read_first_line.hh>
 #include <chrono>
+#include <sys/ioctl.h>
 #include <sys/poll.h>
 #include <sys/syscall.h>
+#include <sys/resource.h>
+
+#ifdef SEASTAR_HAVE_URING
+#include <liburing.h>
+#include <linux/nvme_ioctl.h>
+#endif
 
 #ifdef HAVE_OSV
 #include <osv/newpoll.hh>
@@ -265,6 +274,11 @@ bool aio_storage_context::reap_completions(bool allow_retry)
     }
     assert(n >= 0);
     for (size_t i = 0; i < size_t(n); ++i) {
+        // Completing a request touches its descriptor, which has long left the
+        // cache since submission, so fetch the next one while this one completes
+        if (i + 1 < size_t(n)) {
+            prefetch<1>(reinterpret_cast<kernel_completion*>(_ev_buffer[i + 1].data));
+        }
         auto iocb = get_iocb(_ev_buffer[i]);
         if (_ev_buffer[i].res == -EAGAIN && allow_retry) {
             set_nowait(*iocb, false);
@@ -492,6 +506,10 @@ reactor_backend_aio::reactor_backend_aio(reactor& r)
     sigset_t mask = make_sigset_mask(hrtimer_signal());
     auto e = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
     assert(e == 0);
+
+    if (_r._cfg.net_busy_poll_us) {
+        seastar_logger.warn("--net-busy-poll-us is not supported by the linux-aio reactor backend, ignoring it");
+    }
 }
 
 bool reactor_backend_aio::reap_kernel_completions() {
@@ -660,6 +678,31 @@ reactor_backend_aio::make_pollable_fd_state(file_desc fd, pollable_fd::speculati
     return pollable_fd_state_ptr(new aio_pollable_fd_state(std::move(fd), std::move(speculate)));
 }
 
+// struct epoll_params of <linux/eventpoll.h>, which can't be included
+// together with <sys/epoll.h>
+struct epoll_busy_poll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t pad;
+};
+
+static constexpr unsigned long epoll_set_params_ioctl = _IOW(0x8A, 0x01, epoll_busy_poll_params);
+
+// Makes epoll_wait() run the receive processing of the NAPI instance of
+// the epoll's sockets, rather than rely on interrupts. A wait with no
+// timeout polls once, others poll up to \c usecs before sleeping.
+static void enable_epoll_busy_poll(int epfd, unsigned usecs) {
+    epoll_busy_poll_params params = {};
+    params.busy_poll_usecs = usecs;
+    params.busy_poll_budget = 64;
+    params.prefer_busy_poll = 1;
+    if (::ioctl(epfd, epoll_set_params_ioctl, &params) == -1) {
+        seastar_logger.warn("Unable to enable epoll busy polling ({}), requires Linux 6.9 or later; ignoring --net-busy-poll-us",
+                std::error_code(errno, std::system_category()).message());
+    }
+}
+
 reactor_backend_epoll::reactor_backend_epoll(reactor& r)
         : _r(r)
         , _steady_clock_timer_reactor_thread(file_desc::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC))
@@ -675,6 +718,9 @@ reactor_backend_epoll::reactor_backend_epoll(reactor& r)
     event.data.ptr = &_steady_clock_timer_reactor_thread;
     ret = ::epoll_ctl(_epollfd.get(), EPOLL_CTL_ADD, _steady_clock_timer_reactor_thread.get(), &event);
     throw_system_error_on(ret == -1);
+    if (_r._cfg.net_busy_poll_us) {
+        enable_epoll_busy_poll(_epollfd.get(), _r._cfg.net_busy_poll_us);
+    }
 }
 
 void
@@ -1114,6 +1160,1004 @@ reactor_backend_osv::make_pollable_fd_state(file_desc fd, pollable_fd::speculati
 }
 #endif
 
+#ifdef SEASTAR_HAVE_URING
+
+static
+std::optional<::io_uring>
+try_create_uring(unsigned queue_len, bool sqpoll, bool throw_on_error, unsigned extra_flags = 0) {
+    auto required_features =
+            IORING_FEAT_SUBMIT_STABLE
+            | IORING_FEAT_NODROP;
+    if (sqpoll) {
+        // We don't register file descriptors with the ring, so the
+        // submission poller thread must be able to use plain ones.
+        required_features |= IORING_FEAT_SQPOLL_NONFIXED;
+    }
+    auto required_ops = {
+            IORING_OP_POLL_ADD,
+            IORING_OP_READ,
+            IORING_OP_WRITE,
+            IORING_OP_READV,
+            IORING_OP_WRITEV,
+            IORING_OP_FSYNC,
+            };
+    auto maybe_throw = [&] (auto exception) {
+        if (throw_on_error) {
+            throw exception;
+        }
+    };
+
+    auto params = ::io_uring_params{};
+    params.flags |= extra_flags;
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        // Let the kernel poller go to sleep after a short idle period; the next
+        // io_uring_submit() will notice and wake it up.
+        params.sq_thread_idle = 10; // milliseconds
+    }
+    ::io_uring ring;
+    auto err = ::io_uring_queue_init_params(queue_len, &ring, &params);
+    if (err != 0) {
+        maybe_throw(std::system_error(std::error_code(-err, std::system_category()), "trying to create io_uring"));
+        return std::nullopt;
+    }
+    auto free_ring = defer([&] () noexcept { ::io_uring_queue_exit(&ring); });
+    ::io_uring_ring_dontfork(&ring);
+    if (~ring.features & required_features) {
+        maybe_throw(std::runtime_error(fmt::format("missing required io_ring features, required 0x{:x} available 0x{:x}", required_features, ring.features)));
+        return std::nullopt;
+    }
+
+    auto probe = ::io_uring_get_probe_ring(&ring);
+    if (!probe) {
+        maybe_throw(std::runtime_error("unable to create io_uring probe"));
+        return std::nullopt;
+    }
+    auto free_probe = defer([&] () noexcept { ::io_uring_free_probe(probe); });
+
+    for (auto op : required_ops) {
+        if (!::io_uring_opcode_supported(probe, op)) {
+            maybe_throw(std::runtime_error(fmt::format("required io_uring opcode {} not supported", op)));
+            return std::nullopt;
+        }
+    }
+    free_ring.cancel();
+
+    return ring;
+}
+
+// NVMe passthrough commands (IORING_OP_URING_CMD) don't fit a regular
+// submission queue entry. Try to create the ring with 128-byte entries
+// where the kernel supports them, falling back to a regular ring.
+static
+::io_uring
+create_reactor_uring(unsigned queue_len, bool sqpoll) {
+#ifdef IORING_SETUP_SQE128
+    auto ring = try_create_uring(queue_len, sqpoll, false, IORING_SETUP_SQE128);
+    if (ring) {
+        return *ring;
+    }
+#endif
+    return try_create_uring(queue_len, sqpoll, true).value();
+}
+
+// A ring whose completions are polled from the device, rather than
+// signaled by interrupts. It can only carry polled block I/O, which
+// seastar only sends for NVMe passthrough commands.
+static
+std::optional<::io_uring>
+create_iopoll_uring(unsigned queue_len) {
+#ifdef IORING_SETUP_SQE128
+    return try_create_uring(queue_len, false, true, IORING_SETUP_IOPOLL | IORING_SETUP_SQE128);
+#else
+    throw std::runtime_error("--uring-iopoll is not supported by the io_uring library seastar was built with");
+#endif
+}
+
+// Makes waiting for completions busy-poll the NAPI instance of the ring's
+// sockets for up to \c usecs, rather than sleep until an interrupt
+static
+void
+enable_uring_busy_poll(::io_uring& ring, unsigned usecs) {
+#if defined(IO_URING_CHECK_VERSION) && !IO_URING_CHECK_VERSION(2, 6)
+    ::io_uring_napi napi = {};
+    napi.busy_poll_to = usecs;
+    napi.prefer_busy_poll = 1;
+    auto r = ::io_uring_register_napi(&ring, &napi);
+    if (r < 0) {
+        seastar_logger.warn("Unable to enable io_uring busy polling ({}), requires Linux 6.9 or later; ignoring --net-busy-poll-us",
+                std::error_code(-r, std::system_category()).message());
+    }
+#else
+    seastar_logger.warn("--net-busy-poll-us is not supported by the io_uring library seastar was built with, ignoring it");
+#endif
+}
+
+static
+bool
+uring_supports_nvme_passthrough(::io_uring& ring) {
+#ifdef IORING_SETUP_SQE128
+    if (!(ring.flags & IORING_SETUP_SQE128)) {
+        return false;
+    }
+    auto probe = ::io_uring_get_probe_ring(&ring);
+    if (!probe) {
+        return false;
+    }
+    auto free_probe = defer([&] () noexcept { ::io_uring_free_probe(probe); });
+    return ::io_uring_opcode_supported(probe, IORING_OP_URING_CMD);
+#else
+    return false;
+#endif
+}
+
+static
+bool
+have_md_devices() {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    for (auto& dentry : fs::directory_iterator("/sys/block", ec)) {
+        if (dentry.is_directory() && fs::exists(dentry.path() / "md")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t mlock_limit() {
+    struct ::rlimit lim;
+    int r = ::getrlimit(RLIMIT_MEMLOCK, &lim);
+    if (r == -1) {
+        return 0; // assume the worst; this is not the failure we are looking for
+    }
+    return lim.rlim_cur;
+}
+
+static
+bool
+detect_io_uring() {
+    if (!kernel_uname().whitelisted({"5.17"}) && have_md_devices()) {
+        // Older kernels fall back to workqueues for RAID devices
+        return false;
+    }
+    if (!kernel_uname().whitelisted({"5.12"}) && mlock_limit() < (8 << 20)) {
+        // Older kernels lock about 32k/vcpu for the ring itself. Require 8MB of
+        // locked memory to be safe (8MB is what newer kernels and newer systemd provide)
+        return false;
+    }
+    auto ring_opt = try_create_uring(1, false, false);
+    if (ring_opt) {
+        ::io_uring_queue_exit(&ring_opt.value());
+    }
+    return bool(ring_opt);
+}
+
+// Whether the ring can run socket operations (recv, send, accept, connect)
+// to completion itself, polling internally for readiness.
+static
+bool
+uring_supports_socket_io(::io_uring& ring) {
+    if (!(ring.features & IORING_FEAT_FAST_POLL)) {
+        return false;
+    }
+    auto probe = ::io_uring_get_probe_ring(&ring);
+    if (!probe) {
+        return false;
+    }
+    auto free_probe = defer([&] () noexcept { ::io_uring_free_probe(probe); });
+    auto required_ops = {
+            IORING_OP_RECV,
+            IORING_OP_SEND,
+            IORING_OP_RECVMSG,
+            IORING_OP_SENDMSG,
+            IORING_OP_ACCEPT,
+            IORING_OP_CONNECT,
+            IORING_OP_ASYNC_CANCEL,
+            };
+    for (auto op : required_ops) {
+        if (!::io_uring_opcode_supported(probe, op)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// reactor backend using io_uring. Storage requests from the io_queues and
+// pollable_fd operations are all queued on a single submission ring and
+// flushed with one io_uring_enter() per poll cycle (or none at all, if the
+// kernel submission poller thread is enabled). Completions are reaped
+// directly from the shared completion ring, without a system call.
+//
+// Socket reads, writes, accept() and connect() are submitted as operations
+// the kernel runs to completion, rather than waiting for readiness and then
+// issuing the system call. When a previous operation suggests the fd is
+// still ready (see pollable_fd_state::speculate_epoll()), the system call is
+// tried directly first.
+//
+// The timer tick and the high resolution timer still use linux-aio
+// (preempt_io_context), since the preemption monitor needs a ring head the
+// kernel writes to asynchronously.
+class reactor_backend_uring final : public reactor_backend {
+    // s_queue_len is more or less arbitrary. Too low and we'll be
+    // issuing too small batches, too high and we require too much locked
+    // memory, but otherwise it doesn't matter.
+    static constexpr unsigned s_queue_len = 200;
+    reactor& _r;
+    ::io_uring _uring;
+    bool _socket_io;
+    bool _nvme_passthrough;
+    // With --uring-iopoll, NVMe passthrough commands go to this ring. Its
+    // completions don't wake the reactor up, so it doesn't sleep while
+    // any of them are in flight, and reaps them by polling the ring.
+    std::optional<::io_uring> _iopoll_uring;
+    unsigned _iopoll_in_flight = 0;
+    bool _iopoll_has_pending_submissions = false;
+    bool _did_work_while_getting_sqe = false;
+    bool _has_pending_submissions = false;
+    file_desc _hrtimer_timerfd;
+    preempt_io_context _preempt_io_context;
+
+    class uring_pollable_fd_state;
+
+    // Base for the completions embedded in uring_pollable_fd_state. The
+    // kernel may still hold one when the fd is forgotten, so the fd state
+    // stays alive until all of them have been reaped.
+    class fd_completion : public kernel_completion {
+    protected:
+        uring_pollable_fd_state& _owner;
+        bool _in_flight = false;
+
+        ~fd_completion() = default;
+        void started() noexcept {
+            _in_flight = true;
+            ++_owner._ops_in_flight;
+        }
+        // May destroy the owner, and *this with it
+        void finished() noexcept {
+            _in_flight = false;
+            _owner.op_done();
+        }
+    public:
+        explicit fd_completion(uring_pollable_fd_state& owner) noexcept : _owner(owner) {}
+        bool in_flight() const noexcept {
+            return _in_flight;
+        }
+    };
+
+    // A readiness poll, for callers of readable()/writeable()
+    class poll_completion final : public fd_completion {
+        promise<> _pr;
+        // The events the kernel poll is armed with
+        int _events = 0;
+        // Set while the armed poll is being cancelled, to arm it again
+        // with these events instead of completing
+        int _rearm_events = 0;
+
+        void arm(reactor_backend_uring& be, int events) {
+            auto sqe = be.get_sqe();
+            ::io_uring_prep_poll_add(sqe, _owner.fd.get(), events);
+            ::io_uring_sqe_set_data(sqe, static_cast<kernel_completion*>(this));
+            be._has_pending_submissions = true;
+            _events = events;
+        }
+    public:
+        using fd_completion::fd_completion;
+        future<> start(reactor_backend_uring& be, int events) {
+            if (_in_flight) {
+                // The kernel poll is still armed; hand it over to the new
+                // waiter, failing the one it replaces, and re-arm it if the
+                // new waiter wants other events.
+                _pr.set_exception(std::system_error(ECANCELED, std::system_category()));
+                _pr = promise<>();
+                if (_rearm_events) {
+                    _rearm_events = events;
+                } else if (events != _events) {
+                    _rearm_events = events;
+                    be.cancel(this);
+                }
+                return _pr.get_future();
+            }
+            _pr = promise<>();
+            auto fut = _pr.get_future();
+            arm(be, events);
+            started();
+            return fut;
+        }
+        virtual void complete_with(ssize_t res) override {
+            auto rearm_events = std::exchange(_rearm_events, 0);
+            if (rearm_events && res == -ECANCELED && !_owner._forgotten) {
+                return arm(_owner._be, rearm_events);
+            }
+            if (_owner._forgotten) {
+                _pr.set_exception(broken_promise());
+            } else {
+                _pr.set_value();
+            }
+            finished();
+        }
+    };
+
+    // A socket operation the kernel runs to completion. pollable_fd allows
+    // one reader and one writer at a time, so each fd state embeds one of
+    // these per direction and no allocation is needed per operation.
+    class op_completion final : public fd_completion {
+        promise<size_t> _pr;
+        std::optional<internal::io_request> _req;
+        int _poll_events = 0;
+        size_t _full_size = 0;
+        bool _polling = false;
+
+        void finish(ssize_t res) noexcept {
+            if (_owner._forgotten) {
+                if (res >= 0 && _req->opcode() == internal::io_request::operation::accept) {
+                    ::close(res);
+                }
+                _pr.set_exception(broken_promise());
+            } else if (res < 0) {
+                _pr.set_exception(std::make_exception_ptr(std::system_error(-res, std::system_category())));
+            } else {
+                if (size_t(res) == _full_size) {
+                    // A full read or write suggests the fd is still ready; next
+                    // time, try the system call directly.
+                    _owner.speculate_epoll(_poll_events);
+                }
+                if (_req->opcode() == internal::io_request::operation::accept) {
+                    _owner._accepted_fd = file_desc::from_fd(res);
+                }
+                _pr.set_value(size_t(res));
+            }
+            finished();
+        }
+
+        void poll_and_retry() noexcept {
+            _polling = true;
+            auto sqe = _owner._be.get_sqe();
+            ::io_uring_prep_poll_add(sqe, _owner.fd.get(), _poll_events);
+            ::io_uring_sqe_set_data(sqe, static_cast<kernel_completion*>(this));
+            _owner._be._has_pending_submissions = true;
+        }
+    public:
+        using fd_completion::fd_completion;
+
+        // \c poll_events are the events to speculate when \c full_size bytes were
+        // transferred, and to wait for if the kernel returns EAGAIN (it may, since
+        // our sockets are non-blocking).
+        future<size_t> start(internal::io_request req, int poll_events, size_t full_size) {
+            _pr = promise<size_t>();
+            auto fut = _pr.get_future();
+            _req.emplace(std::move(req));
+            _poll_events = poll_events;
+            _full_size = full_size;
+            _owner._be.submit_io_request(*_req, this);
+            started();
+            return fut;
+        }
+
+        virtual void complete_with(ssize_t res) override {
+            using o = internal::io_request::operation;
+            if (std::exchange(_polling, false)) {
+                if (_owner._forgotten || res < 0) {
+                    return finish(_owner._forgotten ? -ECANCELED : res);
+                }
+                if (_req->opcode() == o::connect) {
+                    // The connection attempt is running in the background; the
+                    // socket becoming writable means it finished, one way or another.
+                    try {
+                        auto err = _owner.fd.getsockopt<int>(SOL_SOCKET, SO_ERROR);
+                        return finish(-err);
+                    } catch (std::system_error& e) {
+                        return finish(-e.code().value());
+                    }
+                }
+                // The poll may have been woken only by the error queue
+                _owner.maybe_consume_error_queue();
+                _owner._be.submit_io_request(*_req, this);
+                return;
+            }
+            if (!_owner._forgotten && (res == -EAGAIN || (res == -EINPROGRESS && _req->opcode() == o::connect))) {
+                return poll_and_retry();
+            }
+            finish(res);
+        }
+    };
+
+    class uring_pollable_fd_state final : public pollable_fd_state {
+    public:
+        reactor_backend_uring& _be;
+        poll_completion _pollin{*this};
+        poll_completion _pollout{*this};
+        op_completion _reader{*this};
+        op_completion _writer{*this};
+        // Arguments of in-flight operations, which must stay put until completion
+        std::vector<iovec> _read_iov;
+        ::msghdr _read_mh = {};
+        ::msghdr _write_mh = {};
+        socket_address _accept_sa;
+        socket_address _connect_sa;
+        std::optional<file_desc> _accepted_fd;
+        unsigned _ops_in_flight = 0;
+        bool _forgotten = false;
+
+        explicit uring_pollable_fd_state(reactor_backend_uring& be, file_desc desc, speculation speculate)
+                : pollable_fd_state(std::move(desc), std::move(speculate))
+                , _be(be) {
+        }
+        poll_completion& get_poll(int events) {
+            if (events & POLLIN) {
+                return _pollin;
+            }
+            return _pollout;
+        }
+        bool take_speculation(int events) {
+            if (events_known & events) {
+                events_known &= ~events;
+                return true;
+            }
+            return false;
+        }
+        void op_done() noexcept {
+            if (--_ops_in_flight == 0 && _forgotten) {
+                delete this;
+            }
+        }
+        void forget() noexcept {
+            _forgotten = true;
+            ++_ops_in_flight; // don't get deleted by completions reaped while cancelling
+            for (fd_completion* c : {static_cast<fd_completion*>(&_pollin), static_cast<fd_completion*>(&_pollout),
+                    static_cast<fd_completion*>(&_reader), static_cast<fd_completion*>(&_writer)}) {
+                if (c->in_flight()) {
+                    _be.cancel(static_cast<kernel_completion*>(c));
+                }
+            }
+            op_done();
+        }
+    };
+
+    // Completion for the eventfd used to wake the reactor from other threads,
+    // and for the high resolution timerfd.
+    struct recurring_eventfd_or_timerfd_completion : public kernel_completion {
+        bool _armed = false;
+        file_desc& _fd;
+        explicit recurring_eventfd_or_timerfd_completion(file_desc& fd) : _fd(fd) {}
+        virtual void complete_with(ssize_t res) override {
+            char garbage[8];
+            auto ret = _fd.read(garbage, 8);
+            // Note: for hrtimer_completion we can have spurious wakeups,
+            // since we wait for this using both _preempt_io_context and the
+            // ring. So don't assert that we read anything.
+            assert(!ret || *ret == 8);
+            _armed = false;
+        }
+        void maybe_rearm(reactor_backend_uring& be) {
+            if (_armed) {
+                return;
+            }
+            auto sqe = be.get_sqe();
+            ::io_uring_prep_poll_add(sqe, _fd.get(), POLLIN);
+            ::io_uring_sqe_set_data(sqe, static_cast<kernel_completion*>(this));
+            _armed = true;
+            be._has_pending_submissions = true;
+        }
+    };
+
+    // Completion for high resolution timerfd, used in wait_and_process_events()
+    // (while running tasks it's waited for in _preempt_io_context)
+    struct hrtimer_completion : public recurring_eventfd_or_timerfd_completion {
+        reactor& _r;
+        explicit hrtimer_completion(reactor& r, file_desc& timerfd)
+                : recurring_eventfd_or_timerfd_completion(timerfd), _r(r) {
+        }
+        virtual void complete_with(ssize_t res) override {
+            recurring_eventfd_or_timerfd_completion::complete_with(res);
+            _r.service_highres_timer();
+        }
+    };
+
+    using smp_wakeup_completion = recurring_eventfd_or_timerfd_completion;
+
+    // For requests whose own completion carries no information (cancellations)
+    struct ignore_completion final : public kernel_completion {
+        virtual void complete_with(ssize_t res) override {}
+    };
+
+    hrtimer_completion _hrtimer_completion;
+    smp_wakeup_completion _smp_wakeup_completion;
+    ignore_completion _ignore_completion;
+private:
+    static file_desc make_timerfd() {
+        return file_desc::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK);
+    }
+
+    // Can fail if the submission queue is full
+    ::io_uring_sqe* try_get_sqe() {
+        return ::io_uring_get_sqe(&_uring);
+    }
+
+    // Returns true if any work was done
+    bool do_flush_submission_ring() {
+        if (_has_pending_submissions) {
+            _has_pending_submissions = false;
+            _did_work_while_getting_sqe = false;
+            // With IORING_SETUP_SQPOLL, this only enters the kernel if the
+            // submission poller thread went to sleep.
+            ::io_uring_submit(&_uring);
+            return true;
+        } else {
+            return std::exchange(_did_work_while_getting_sqe, false);
+        }
+    }
+
+    ::io_uring_sqe* get_sqe() {
+        ::io_uring_sqe* sqe;
+        while (__builtin_expect((sqe = try_get_sqe()) == nullptr, false)) {
+            do_flush_submission_ring();
+            do_process_kernel_completions_step();
+            _did_work_while_getting_sqe = true;
+        }
+        return sqe;
+    }
+
+    void cancel(kernel_completion* target) noexcept {
+        auto sqe = get_sqe();
+        ::io_uring_prep_cancel(sqe, target, 0);
+        ::io_uring_sqe_set_data(sqe, static_cast<kernel_completion*>(&_ignore_completion));
+        _has_pending_submissions = true;
+    }
+
+    future<> poll(pollable_fd_state& fd, int events) {
+        if (events & fd.events_known) {
+            fd.events_known &= ~events;
+            return make_ready_future<>();
+        }
+        fd.events_rw = events == (POLLIN|POLLOUT);
+        auto ufd = static_cast<uring_pollable_fd_state*>(&fd);
+        return ufd->get_poll(events).start(*this, events);
+    }
+
+    // Completes with the NVMe status: 0 on success, positive on an NVMe
+    // error, negative errno if the command couldn't be sent.
+    static void prep_nvme_io(::io_uring_sqe* sqe, const internal::io_request& req) {
+#ifdef IORING_SETUP_SQE128
+        ::io_uring_prep_rw(IORING_OP_URING_CMD, sqe, req.fd(), nullptr, 0, 0);
+        sqe->cmd_op = NVME_URING_CMD_IO;
+        auto cmd = reinterpret_cast<::nvme_uring_cmd*>(sqe->cmd);
+        *cmd = ::nvme_uring_cmd{};
+        constexpr uint8_t nvme_cmd_write = 0x01;
+        constexpr uint8_t nvme_cmd_read = 0x02;
+        cmd->opcode = req.opcode() == internal::io_request::operation::nvme_read ? nvme_cmd_read : nvme_cmd_write;
+        cmd->nsid = req.nsid();
+        uint64_t slba = req.pos() >> req.lba_shift();
+        uint32_t nlb = (req.size() >> req.lba_shift()) - 1; // zero based
+        cmd->cdw10 = slba & 0xffffffff;
+        cmd->cdw11 = slba >> 32;
+        cmd->cdw12 = nlb;
+        cmd->addr = reinterpret_cast<uintptr_t>(req.address());
+        cmd->data_len = req.size();
+#else
+        seastar_logger.error("Invalid operation for io_uring: {}", req.opname());
+        std::abort();
+#endif
+    }
+
+    void submit_polled_io_request(const internal::io_request& req, kernel_completion* completion) {
+        ::io_uring_sqe* sqe;
+        while ((sqe = ::io_uring_get_sqe(&*_iopoll_uring)) == nullptr) {
+            process_polled_completions();
+        }
+        prep_nvme_io(sqe, req);
+        ::io_uring_sqe_set_data(sqe, completion);
+        ++_iopoll_in_flight;
+        _iopoll_has_pending_submissions = true;
+    }
+
+    // Submits the pending polled requests and reaps the completed ones.
+    // Returns true if any work was done
+    bool process_polled_completions() {
+        if (!_iopoll_in_flight) {
+            return false;
+        }
+        // On an IOPOLL ring this also polls the device for completions,
+        // even if there's nothing to submit
+        ::io_uring_submit(&*_iopoll_uring);
+        auto did_work = std::exchange(_iopoll_has_pending_submissions, false);
+        struct ::io_uring_cqe* buf[s_queue_len];
+        auto n = ::io_uring_peek_batch_cqe(&*_iopoll_uring, buf, s_queue_len);
+        do_process_ready_kernel_completions(buf, n);
+        ::io_uring_cq_advance(&*_iopoll_uring, n);
+        _iopoll_in_flight -= n;
+        return did_work || n != 0;
+    }
+
+    void submit_io_request(const internal::io_request& req, kernel_completion* completion) {
+        using o = internal::io_request::operation;
+        if (_iopoll_uring && (req.opcode() == o::nvme_read || req.opcode() == o::nvme_write)) {
+            submit_polled_io_request(req, completion);
+            return;
+        }
+        auto sqe = get_sqe();
+        switch (req.opcode()) {
+            case o::read:
+                ::io_uring_prep_read(sqe, req.fd(), req.address(), req.size(), req.pos());
+                break;
+            case o::write:
+                ::io_uring_prep_write(sqe, req.fd(), req.address(), req.size(), req.pos());
+                break;
+            case o::readv:
+                ::io_uring_prep_readv(sqe, req.fd(), req.iov(), req.iov_len(), req.pos());
+                break;
+            case o::writev:
+                ::io_uring_prep_writev(sqe, req.fd(), req.iov(), req.iov_len(), req.pos());
+                break;
+            case o::fdatasync:
+                ::io_uring_prep_fsync(sqe, req.fd(), IORING_FSYNC_DATASYNC);
+                break;
+            case o::recv:
+                ::io_uring_prep_recv(sqe, req.fd(), req.address(), req.size(), req.flags());
+                break;
+            case o::recvmsg:
+                ::io_uring_prep_recvmsg(sqe, req.fd(), req.msghdr(), req.flags());
+                break;
+            case o::send:
+                ::io_uring_prep_send(sqe, req.fd(), req.address(), req.size(), req.flags());
+                break;
+            case o::sendmsg:
+                ::io_uring_prep_sendmsg(sqe, req.fd(), req.msghdr(), req.flags());
+                break;
+            case o::accept:
+                ::io_uring_prep_accept(sqe, req.fd(), req.posix_sockaddr(), req.socklen_ptr(), req.flags());
+                break;
+            case o::connect:
+                ::io_uring_prep_connect(sqe, req.fd(), req.posix_sockaddr(), req.socklen());
+                break;
+            case o::poll_add:
+                ::io_uring_prep_poll_add(sqe, req.fd(), req.events());
+                break;
+            case o::poll_remove:
+                // liburing changed the type of io_uring_prep_poll_remove()'s argument
+                // across versions, so prepare it by hand.
+                ::io_uring_prep_rw(IORING_OP_POLL_REMOVE, sqe, -1, req.address(), 0, 0);
+                break;
+            case o::cancel:
+                ::io_uring_prep_cancel(sqe, req.address(), 0);
+                break;
+            case o::nvme_read:
+            case o::nvme_write:
+                prep_nvme_io(sqe, req);
+                break;
+            case o::discard:
+            case o::punch_hole:
+                // The I/O queue runs these itself
+                seastar_logger.error("Invalid operation for io_uring: {}", req.opname());
+                std::abort();
+        }
+        ::io_uring_sqe_set_data(sqe, completion);
+
+        _has_pending_submissions = true;
+    }
+
+    // Returns true if any work was done
+    bool queue_pending_file_io() {
+        return _r._io_sink.drain([&] (internal::io_request& req, io_completion* completion) -> bool {
+            submit_io_request(req, completion);
+            return true;
+        });
+    }
+
+    // Process kernel completions already extracted from the ring.
+    // This is needed because we sometimes extract completions without
+    // waiting, and sometimes with waiting.
+    void do_process_ready_kernel_completions(::io_uring_cqe** buf, size_t nr) {
+        for (auto p = buf; p != buf + nr; ++p) {
+            auto cqe = *p;
+            auto completion = reinterpret_cast<kernel_completion*>(cqe->user_data);
+            completion->complete_with(cqe->res);
+        }
+    }
+
+    // Returns true if completions were processed
+    bool do_process_kernel_completions_step() {
+        struct ::io_uring_cqe* buf[s_queue_len];
+        auto n = ::io_uring_peek_batch_cqe(&_uring, buf, s_queue_len);
+        do_process_ready_kernel_completions(buf, n);
+        ::io_uring_cq_advance(&_uring, n);
+        return n != 0;
+    }
+
+    // Returns true if completions were processed
+    bool do_process_kernel_completions() {
+        auto did_work = false;
+        while (do_process_kernel_completions_step()) {
+            did_work = true;
+        }
+        return did_work | std::exchange(_did_work_while_getting_sqe, false);
+    }
+
+public:
+    explicit reactor_backend_uring(reactor& r)
+            : _r(r)
+            , _uring(create_reactor_uring(s_queue_len, r._cfg.uring_sqpoll))
+            , _socket_io(uring_supports_socket_io(_uring))
+            , _nvme_passthrough(uring_supports_nvme_passthrough(_uring))
+            , _iopoll_uring(r._cfg.uring_iopoll && _nvme_passthrough ? create_iopoll_uring(s_queue_len) : std::nullopt)
+            , _hrtimer_timerfd(make_timerfd())
+            , _preempt_io_context(_r, _r._task_quota_timer, _hrtimer_timerfd)
+            , _hrtimer_completion(_r, _hrtimer_timerfd)
+            , _smp_wakeup_completion(_r._notify_eventfd) {
+        // Protect against spurious wakeups - if we get notified that the timer has
+        // expired when it really hasn't, we don't want to block in read(tfd, ...).
+        auto tfd = _r._task_quota_timer.get();
+        ::fcntl(tfd, F_SETFL, ::fcntl(tfd, F_GETFL) | O_NONBLOCK);
+
+        sigset_t mask = make_sigset_mask(hrtimer_signal());
+        auto e = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
+        assert(e == 0);
+
+        if (_r._cfg.net_busy_poll_us) {
+            enable_uring_busy_poll(_uring, _r._cfg.net_busy_poll_us);
+        }
+    }
+    ~reactor_backend_uring() {
+        if (_iopoll_uring) {
+            ::io_uring_queue_exit(&*_iopoll_uring);
+        }
+        ::io_uring_queue_exit(&_uring);
+    }
+    virtual bool supports_nvme_passthrough() const noexcept override {
+        return _nvme_passthrough;
+    }
+    virtual bool reap_kernel_completions() override {
+        bool did_work = do_process_kernel_completions();
+        did_work |= process_polled_completions();
+        return did_work;
+    }
+    virtual bool kernel_submit_work() override {
+        bool did_work = false;
+        did_work |= _preempt_io_context.service_preempting_io();
+        did_work |= queue_pending_file_io();
+        did_work |= do_flush_submission_ring();
+        did_work |= process_polled_completions();
+        // io_uring_submit() may have reaped completions
+        did_work |= do_process_kernel_completions();
+        return did_work;
+    }
+    virtual bool kernel_events_can_sleep() const override {
+        // Completions of in-flight I/O wake us up, so we never need to spin,
+        // except for the polled ones
+        return !_iopoll_in_flight;
+    }
+    virtual void wait_and_process_events(const sigset_t* active_sigmask) override {
+        _smp_wakeup_completion.maybe_rearm(*this);
+        _hrtimer_completion.maybe_rearm(*this);
+        do_flush_submission_ring();
+        bool did_work = false;
+        did_work |= _preempt_io_context.service_preempting_io();
+        did_work |= std::exchange(_did_work_while_getting_sqe, false);
+        if (did_work) {
+            return;
+        }
+        struct ::io_uring_cqe* cqe = nullptr;
+        sigset_t sigs = *active_sigmask; // io_uring_wait_cqes() wants non-const
+        auto r = ::io_uring_wait_cqes(&_uring, &cqe, 1, nullptr, &sigs);
+        if (__builtin_expect(r < 0, false)) {
+            switch (-r) {
+            case EINTR:
+                return;
+            default:
+                abort();
+            }
+        }
+        do_process_kernel_completions();
+        _preempt_io_context.service_preempting_io();
+    }
+    virtual future<> readable(pollable_fd_state& fd) override {
+        return poll(fd, POLLIN);
+    }
+    virtual future<> writeable(pollable_fd_state& fd) override {
+        return poll(fd, POLLOUT);
+    }
+    virtual future<> readable_or_writeable(pollable_fd_state& fd) override {
+        return poll(fd, POLLIN | POLLOUT);
+    }
+    virtual void forget(pollable_fd_state& fd) noexcept override {
+        auto* pfd = static_cast<uring_pollable_fd_state*>(&fd);
+        pfd->forget();
+    }
+    virtual future<std::tuple<pollable_fd, socket_address>> accept(pollable_fd_state& listenfd) override {
+        auto& ufd = static_cast<uring_pollable_fd_state&>(listenfd);
+        if (!_socket_io || ufd._reader.in_flight()) {
+            return _r.do_accept(listenfd);
+        }
+        try {
+            listenfd.maybe_no_more_recv();
+            if (ufd.take_speculation(POLLIN)) {
+                socket_address sa;
+                auto maybe_fd = listenfd.fd.try_accept(sa, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (maybe_fd) {
+                    // See reactor::do_accept() for why we speculate here
+                    listenfd.speculate_epoll(POLLIN);
+                    pollable_fd pfd(std::move(*maybe_fd), pollable_fd::speculation(EPOLLOUT));
+                    return make_ready_future<std::tuple<pollable_fd, socket_address>>(std::make_tuple(std::move(pfd), std::move(sa)));
+                }
+            }
+            ufd._accept_sa = socket_address();
+            ufd._accept_sa.addr_length = sizeof(ufd._accept_sa.u);
+            auto req = internal::io_request::make_accept(listenfd.fd.get(), &ufd._accept_sa.as_posix_sockaddr(),
+                    &ufd._accept_sa.addr_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            // Never speculate on a partial transfer, so pass an impossible full size
+            return ufd._reader.start(std::move(req), POLLIN, std::numeric_limits<size_t>::max()).then([&ufd] (size_t) {
+                ufd.speculate_epoll(POLLIN);
+                pollable_fd pfd(std::move(*std::exchange(ufd._accepted_fd, std::nullopt)), pollable_fd::speculation(EPOLLOUT));
+                return make_ready_future<std::tuple<pollable_fd, socket_address>>(std::make_tuple(std::move(pfd), ufd._accept_sa));
+            });
+        } catch (...) {
+            return current_exception_as_future<std::tuple<pollable_fd, socket_address>>();
+        }
+    }
+    virtual future<> connect(pollable_fd_state& fd, socket_address& sa) override {
+        auto& ufd = static_cast<uring_pollable_fd_state&>(fd);
+        if (!_socket_io || ufd._writer.in_flight()) {
+            return _r.do_connect(fd, sa);
+        }
+        ufd._connect_sa = sa;
+        auto req = internal::io_request::make_connect(fd.fd.get(), &ufd._connect_sa.as_posix_sockaddr(), ufd._connect_sa.length());
+        // A connected socket is writable, so a zero "full size" makes us speculate on it
+        return ufd._writer.start(std::move(req), POLLOUT, 0).discard_result();
+    }
+    virtual void shutdown(pollable_fd_state& fd, int how) override {
+        fd.fd.shutdown(how);
+    }
+    virtual future<size_t> read_some(pollable_fd_state& fd, void* buffer, size_t len) override {
+        auto& ufd = static_cast<uring_pollable_fd_state&>(fd);
+        if (!_socket_io || ufd._reader.in_flight()) {
+            return _r.do_read_some(fd, buffer, len);
+        }
+        try {
+            if (ufd.take_speculation(POLLIN)) {
+                auto r = fd.fd.read(buffer, len);
+                if (r) {
+                    if (*r == len) {
+                        fd.speculate_epoll(POLLIN);
+                    }
+                    return make_ready_future<size_t>(*r);
+                }
+            }
+            auto req = internal::io_request::make_read(fd.fd.get(), uint64_t(-1), buffer, len, false);
+            return ufd._reader.start(std::move(req), POLLIN, len);
+        } catch (...) {
+            return current_exception_as_future<size_t>();
+        }
+    }
+    virtual future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) override {
+        auto& ufd = static_cast<uring_pollable_fd_state&>(fd);
+        if (!_socket_io || ufd._reader.in_flight()) {
+            return _r.do_read_some(fd, iov);
+        }
+        try {
+            ufd._read_iov = iov;
+            ufd._read_mh = {};
+            ufd._read_mh.msg_iov = ufd._read_iov.data();
+            ufd._read_mh.msg_iovlen = ufd._read_iov.size();
+            if (ufd.take_speculation(POLLIN)) {
+                auto r = fd.fd.recvmsg(&ufd._read_mh, 0);
+                if (r) {
+                    if (*r == iovec_len(iov)) {
+                        fd.speculate_epoll(POLLIN);
+                    }
+                    return make_ready_future<size_t>(*r);
+                }
+            }
+            auto req = internal::io_request::make_recvmsg(fd.fd.get(), &ufd._read_mh, 0);
+            return ufd._reader.start(std::move(req), POLLIN, iovec_len(iov));
+        } catch (...) {
+            return current_exception_as_future<size_t>();
+        }
+    }
+    virtual future<temporary_buffer<char>> read_some(pollable_fd_state& fd, internal::buffer_allocator* ba) override {
+        auto& ufd = static_cast<uring_pollable_fd_state&>(fd);
+        if (!_socket_io || ufd._reader.in_flight()) {
+            return _r.do_read_some(fd, ba);
+        }
+        try {
+            // Unlike the readiness-based implementation, the buffer has to exist
+            // before we know data is available, since the kernel reads into it
+            // as soon as it arrives.
+            auto buffer = ba->allocate_buffer();
+            if (ufd.take_speculation(POLLIN)) {
+                auto r = fd.fd.read(buffer.get_write(), buffer.size());
+                if (r) {
+                    if (*r == buffer.size()) {
+                        fd.speculate_epoll(POLLIN);
+                    }
+                    buffer.trim(*r);
+                    return make_ready_future<temporary_buffer<char>>(std::move(buffer));
+                }
+            }
+            auto req = internal::io_request::make_read(fd.fd.get(), uint64_t(-1), buffer.get_write(), buffer.size(), false);
+            auto size = buffer.size();
+            return ufd._reader.start(std::move(req), POLLIN, size).then([buffer = std::move(buffer)] (size_t r) mutable {
+                buffer.trim(r);
+                return std::move(buffer);
+            });
+        } catch (...) {
+            return current_exception_as_future<temporary_buffer<char>>();
+        }
+    }
+    virtual future<size_t> write_some(pollable_fd_state& fd, net::packet& p) override {
+        auto& ufd = static_cast<uring_pollable_fd_state&>(fd);
+        if (!_socket_io || ufd._writer.in_flight()) {
+            return _r.do_write_some(fd, p);
+        }
+        try {
+            // See reactor::do_write_some() for why this cast is safe
+            iovec* iov = reinterpret_cast<iovec*>(p.fragment_array());
+            ufd._write_mh = {};
+            ufd._write_mh.msg_iov = iov;
+            ufd._write_mh.msg_iovlen = std::min<size_t>(p.nr_frags(), IOV_MAX);
+            if (ufd.take_speculation(POLLOUT)) {
+                auto r = fd.fd.sendmsg(&ufd._write_mh, MSG_NOSIGNAL);
+                if (r) {
+                    if (*r == p.len()) {
+                        fd.speculate_epoll(POLLOUT);
+                    }
+                    return make_ready_future<size_t>(*r);
+                }
+            }
+            auto req = internal::io_request::make_sendmsg(fd.fd.get(), &ufd._write_mh, MSG_NOSIGNAL);
+            return ufd._writer.start(std::move(req), POLLOUT, p.len());
+        } catch (...) {
+            return current_exception_as_future<size_t>();
+        }
+    }
+    virtual future<size_t> write_some(pollable_fd_state& fd, const void* buffer, size_t len) override {
+        auto& ufd = static_cast<uring_pollable_fd_state&>(fd);
+        if (!_socket_io || ufd._writer.in_flight()) {
+            return _r.do_write_some(fd, buffer, len);
+        }
+        try {
+            if (ufd.take_speculation(POLLOUT)) {
+                auto r = fd.fd.send(buffer, len, MSG_NOSIGNAL);
+                if (r) {
+                    if (*r == len) {
+                        fd.speculate_epoll(POLLOUT);
+                    }
+                    return make_ready_future<size_t>(*r);
+                }
+            }
+            auto req = internal::io_request::make_send(fd.fd.get(), buffer, len, MSG_NOSIGNAL);
+            return ufd._writer.start(std::move(req), POLLOUT, len);
+        } catch (...) {
+            return current_exception_as_future<size_t>();
+        }
+    }
+    virtual void signal_received(int signo, siginfo_t* siginfo, void* ignore) override {
+        _r._signals.action(signo, siginfo, ignore);
+    }
+    virtual void start_tick() override {
+        _preempt_io_context.start_tick();
+    }
+    virtual void stop_tick() override {
+        _preempt_io_context.stop_tick();
+    }
+    virtual void arm_highres_timer(const ::itimerspec& its) override {
+        _hrtimer_timerfd.timerfd_settime(TFD_TIMER_ABSTIME, its);
+    }
+    virtual void reset_preemption_monitor() override {
+        _preempt_io_context.reset_preemption_monitor();
+    }
+    virtual void request_preemption() override {
+        _preempt_io_context.request_preemption();
+    }
+    virtual void start_handling_signal() override {
+        // The io_uring backend only uses SIGHUP/SIGTERM/SIGINT. We don't need to handle them right away and our
+        // implementation of request_preemption is not signal safe, so do nothing.
+    }
+    virtual pollable_fd_state_ptr make_pollable_fd_state(file_desc fd, pollable_fd::speculation speculate) override {
+        return pollable_fd_state_ptr(new uring_pollable_fd_state(*this, std::move(fd), std::move(speculate)));
+    }
+};
+
+#endif
+
 static bool detect_aio_poll() {
     auto fd = file_desc::eventfd(0, 0);
     aio_context_t ioc{};
@@ -1157,6 +2201,10 @@ std::unique_ptr<reactor_backend> reactor_backend_selector::create(reactor& r) {
         return std::make_unique<reactor_backend_aio>(r);
     } else if (_name == "epoll") {
         return std::make_unique<reactor_backend_epoll>(r);
+#ifdef SEASTAR_HAVE_URING
+    } else if (_name == "io_uring") {
+        return std::make_unique<reactor_backend_uring>(r);
+#endif
     }
     throw std::logic_error("bad reactor backend");
 }
@@ -1171,6 +2219,11 @@ std::vector<reactor_backend_selector> reactor_backend_selector::available() {
         ret.push_back(reactor_backend_selector("linux-aio"));
     }
     ret.push_back(reactor_backend_selector("epoll"));
+#ifdef SEASTAR_HAVE_URING
+    if (detect_io_uring()) {
+        ret.push_back(reactor_backend_selector("io_uring"));
+    }
+#endif
     return ret;
 }
 
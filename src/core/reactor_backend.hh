@@ -212,6 +212,9 @@ class reactor_backend {
     virtual void start_handling_signal() = 0;
 
     virtual pollable_fd_state_ptr make_pollable_fd_state(file_desc fd, pollable_fd::speculation speculate) = 0;
+
+    // Whether io_request::operation::nvme_read and nvme_write can be submitted
+    virtual bool supports_nvme_passthrough() const noexcept { return false; }
 };
 
 // reactor backend using file-descriptor & epoll, suitable for running on
@@ -35,6 +35,7 @@
 
 #include <boost/range/adaptor/map.hpp>
 #include <boost/range/algorithm/copy.hpp>
+#include <fmt/ranges.h>
 
 namespace seastar {
 
@@ -324,11 +325,12 @@ struct distribute_objects {
     std::vector<hwloc_cpuset_t> cpu_sets;
     hwloc_obj_t root;
 
-    distribute_objects(hwloc_topology_t topology, size_t nobjs) : cpu_sets(nobjs), root(hwloc_get_root_obj(topology)) {
+    // Objects deeper than until are not split between cpu sets
+    distribute_objects(hwloc_topology_t topology, size_t nobjs, int until = INT_MAX) : cpu_sets(nobjs), root(hwloc_get_root_obj(topology)) {
 #if HWLOC_API_VERSION >= 0x00010900
-        hwloc_distrib(topology, &root, 1, cpu_sets.data(), cpu_sets.size(), INT_MAX, 0);
+        hwloc_distrib(topology, &root, 1, cpu_sets.data(), cpu_sets.size(), until, 0);
 #else
-        hwloc_distribute(topology, root, cpu_sets.data(), cpu_sets.size(), INT_MAX);
+        hwloc_distribute(topology, root, cpu_sets.data(), cpu_sets.size(), until);
 #endif
     }
 
@@ -342,6 +344,30 @@ struct distribute_objects {
     }
 };
 
+// Finds the PUs next to each shard's that are left to other threads, and
+// the shards that share a last level cache: the L3, which chiplet cpus
+// have one of per core complex
+static void describe_neighbourhood(hwloc_topology_t topology, std::vector<cpu>& cpus) {
+    std::set<unsigned> used;
+    for (auto& c : cpus) {
+        used.insert(c.cpu_id);
+    }
+    std::unordered_map<hwloc_obj_t, unsigned> caches;
+    for (auto& c : cpus) {
+        auto core = hwloc_get_ancestor(HWLOC_OBJ_CORE, topology, c.cpu_id);
+        if (core) {
+            for (auto id = hwloc_bitmap_first(core->cpuset); id != -1; id = hwloc_bitmap_next(core->cpuset, id)) {
+                if (!used.count(id)) {
+                    c.siblings.insert(id);
+                }
+            }
+        }
+        auto cache = hwloc_get_ancestor(HWLOC_OBJ_L3CACHE, topology, c.cpu_id);
+        c.cache_group = caches.emplace(cache, caches.size()).first->second;
+        seastar_logger.debug("CPU{} has siblings {} and cache group {}", c.cpu_id, c.siblings, c.cache_group);
+    }
+}
+
 static io_queue_topology
 allocate_io_queues(hwloc_topology_t topology, std::vector<cpu> cpus, std::unordered_map<unsigned, hwloc_obj_t>& cpu_to_node,
         unsigned num_io_groups, unsigned& last_node_idx) {
@@ -510,10 +536,11 @@ resources allocate(configuration& c) {
 #endif
     size_t mem = calculate_memory(c, std::min(available_memory,
                                               cgroup::memory_limit()));
-    unsigned available_procs = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_PU);
+    auto unit = c.one_shard_per_core ? HWLOC_OBJ_CORE : HWLOC_OBJ_PU;
+    unsigned available_procs = hwloc_get_nbobjs_by_type(topology, unit);
     unsigned procs = c.cpus.value_or(available_procs);
     if (procs > available_procs) {
-        throw std::runtime_error("insufficient processing units");
+        throw std::runtime_error(c.one_shard_per_core ? "insufficient cores" : "insufficient processing units");
     }
     // limit memory address to fit in 36-bit, see core/memory.cc:Memory map
     constexpr size_t max_mem_per_proc = 1UL << 36;
@@ -526,7 +553,13 @@ resources allocate(configuration& c) {
     std::vector<std::pair<cpu, size_t>> remains;
     size_t remain;
 
-    auto cpu_sets = distribute_objects(topology, procs);
+    // With one shard per core, cores are not split between shards, and
+    // each shard takes the first PU of its cpu set
+    int until = INT_MAX;
+    if (c.one_shard_per_core) {
+        until = std::max<int>(hwloc_get_type_depth(topology, HWLOC_OBJ_CORE), 0);
+    }
+    auto cpu_sets = distribute_objects(topology, procs, until);
 
     for (auto&& cs : cpu_sets()) {
         auto cpu_id = hwloc_bitmap_first(cs);
@@ -596,6 +629,7 @@ resources allocate(configuration& c) {
         auto node = cpu_to_node.at(cpu_id);
         cpu this_cpu;
         this_cpu.cpu_id = cpu_id;
+        this_cpu.nodeid = hwloc_bitmap_first(node->nodeset);
         remain = mem_per_proc - alloc_from_node(this_cpu, node, topo_used_mem, mem_per_proc);
 
         remains.emplace_back(std::move(this_cpu), remain);
@@ -621,6 +655,7 @@ resources allocate(configuration& c) {
         assert(!remain);
         ret.cpus.push_back(std::move(this_cpu));
     }
+    describe_neighbourhood(topology, ret.cpus);
 
     unsigned last_node_idx = 0;
     for (auto devid : c.devices) {
@@ -633,6 +668,15 @@ unsigned nr_processing_units(configuration& c) {
     return hwloc_get_nbobjs_by_type(c.topology.get(), HWLOC_OBJ_PU);
 }
 
+unsigned nr_cores(configuration& c, const cpuset& cpus) {
+    auto topology = c.topology.get();
+    std::set<hwloc_obj_t> cores;
+    for (auto cpu_id : cpus) {
+        cores.insert(hwloc_get_ancestor(HWLOC_OBJ_CORE, topology, cpu_id));
+    }
+    return cores.size();
+}
+
 }
 
 }
@@ -689,6 +733,11 @@ unsigned nr_processing_units(configuration&) {
     return ::sysconf(_SC_NPROCESSORS_ONLN);
 }
 
+// Without hwloc, the topology is unknown and every PU counts as a core
+unsigned nr_cores(configuration&, const cpuset& cpus) {
+    return cpus.size();
+}
+
 }
 
 }
@@ -0,0 +1,176 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/scheduler_trace.hh>
+#include <seastar/core/internal/scheduler_trace.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/map_reduce.hh>
+#include <seastar/core/print.hh>
+#include <seastar/util/log.hh>
+#include <fmt/format.h>
+#include <boost/range/irange.hpp>
+#include <iterator>
+
+namespace seastar {
+
+namespace internal {
+
+void scheduler_trace_ring::configure(size_t entries, std::chrono::nanoseconds long_task_threshold) {
+    if (entries == 0) {
+        _events.reset();
+        _mask = 0;
+        return;
+    }
+    size_t size = 2;
+    while (size < entries) {
+        size <<= 1;
+    }
+    _events = std::make_unique<event[]>(size);
+    _mask = size - 1;
+    _head = 0;
+
+    // Calibrated ticks let tasks be compared against the threshold
+    // without converting every timestamp
+    _base_time = std::chrono::steady_clock::now();
+    _base_ticks = timestamp();
+    _ticks_per_ns = ticks_per_ns();
+    set_long_task_threshold(long_task_threshold);
+}
+
+double scheduler_trace_ring::ticks_per_ns() noexcept {
+    // Calibrate the ticks against steady_clock
+    static const double ratio = [] {
+        auto base_time = std::chrono::steady_clock::now();
+        auto base_ticks = timestamp();
+        std::chrono::steady_clock::time_point now;
+        do {
+            now = std::chrono::steady_clock::now();
+        } while (now - base_time < std::chrono::microseconds(200));
+        return double(timestamp() - base_ticks) / std::chrono::duration_cast<std::chrono::nanoseconds>(now - base_time).count();
+    }();
+    return ratio;
+}
+
+static void append_escaped(fmt::memory_buffer& out, const sstring& s) {
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fmt::format_to(std::back_inserter(out), "\\u{:04x}", unsigned(c));
+        } else {
+            out.push_back(c);
+        }
+    }
+}
+
+sstring scheduler_trace_ring::to_json(unsigned shard, noncopyable_function<sstring (unsigned)> group_name) const {
+    fmt::memory_buffer out;
+    fmt::format_to(std::back_inserter(out), R"({{"name":"thread_name","ph":"M","pid":0,"tid":{},"args":{{"name":"shard {}"}}}})", shard, shard);
+    if (!enabled()) {
+        return sstring(out.data(), out.size());
+    }
+
+    // Timestamps are placed on the steady_clock time line, which is common
+    // to all shards, using the tick rate observed since configure()
+    auto now = std::chrono::steady_clock::now();
+    auto now_ticks = timestamp();
+    double ns_per_tick = now_ticks > _base_ticks
+            ? std::chrono::duration_cast<std::chrono::nanoseconds>(now - _base_time).count() / double(now_ticks - _base_ticks)
+            : 1.0;
+    double base_us = std::chrono::duration_cast<std::chrono::nanoseconds>(_base_time.time_since_epoch()).count() / 1000.0;
+    auto to_us = [&] (uint64_t ticks) {
+        return double(ticks) * ns_per_tick / 1000.0;
+    };
+
+    uint64_t first = _head > _mask ? _head - _mask - 1 : 0;
+    for (uint64_t i = first; i != _head; ++i) {
+        const event& e = _events[i & _mask];
+        out.push_back(',');
+        fmt::format_to(std::back_inserter(out), R"({{"ph":"X","pid":0,"tid":{},"ts":{:.3f},"dur":{:.3f},"name":")",
+                shard, base_us + to_us(e.start - _base_ticks), to_us(e.duration));
+        switch (e.kind) {
+        case event_type::task_queue:
+            append_escaped(out, group_name(e.id));
+            fmt::format_to(std::back_inserter(out), R"(","cat":"task_queue"}})");
+            break;
+        case event_type::poller:
+            append_escaped(out, pretty_type_name(*e.type));
+            fmt::format_to(std::back_inserter(out), R"(","cat":"poller"}})");
+            break;
+        case event_type::long_task:
+            append_escaped(out, pretty_type_name(*e.type));
+            out.append(std::string_view(R"(","cat":"long_task","args":{"group":")"));
+            append_escaped(out, group_name(e.id));
+            fmt::format_to(std::back_inserter(out), R"("}}}})");
+            break;
+        }
+    }
+    return sstring(out.data(), out.size());
+}
+
+}
+
+namespace scheduler_trace {
+
+future<sstring> dump() {
+    return map_reduce(boost::irange(0u, smp::count), [] (unsigned shard) {
+        return smp::submit_to(shard, [] {
+            return engine().format_scheduler_trace();
+        });
+    }, sstring(R"({"displayTimeUnit":"ns","traceEvents":[)"), [] (sstring acc, sstring shard_events) {
+        if (acc.back() != '[') {
+            acc += ",";
+        }
+        acc += shard_events;
+        return acc;
+    }).then([] (sstring json) {
+        json += "]}";
+        return json;
+    });
+}
+
+class scheduler_trace_handler : public httpd::handler_base {
+public:
+    future<std::unique_ptr<httpd::reply>> handle(const sstring& path,
+            std::unique_ptr<httpd::request> req, std::unique_ptr<httpd::reply> rep) override {
+        return dump().then([rep = std::move(rep)] (sstring json) mutable {
+            rep->write_body("json", std::move(json));
+            return std::move(rep);
+        });
+    }
+};
+
+future<> add_routes(http_server& server, sstring path) {
+    server._routes.put(httpd::GET, path, new scheduler_trace_handler());
+    return make_ready_future<>();
+}
+
+future<> add_routes(distributed<http_server>& server, sstring path) {
+    return server.invoke_on_all([path] (http_server& s) {
+        return add_routes(s, path);
+    });
+}
+
+}
+
+}
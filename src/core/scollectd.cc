@@ -439,7 +439,8 @@ void impl::run() {
         bool out_of_space = false;
         while (!out_of_space && mf < values.size()) {
             while (i != values[mf].end()) {
-                if (i->type() == seastar::metrics::impl::data_type::HISTOGRAM) {
+                if (i->type() == seastar::metrics::impl::data_type::HISTOGRAM ||
+                        i->type() == seastar::metrics::impl::data_type::SUMMARY) {
                     ++i;
                     ++md_iterator;
                     continue;
@@ -37,6 +37,40 @@ static_assert(std::is_nothrow_constructible_v<semaphore, size_t, semaphore_defau
 static_assert(std::is_nothrow_move_constructible_v<semaphore>);
 
 
+class internal::deferred_wakeup::wakeup_task final : public task {
+public:
+    void (*_fn)(void*);
+    // Null once the semaphore is gone
+    void* _target;
+
+    wakeup_task(void (*fn)(void*), void* target) noexcept : _fn(fn), _target(target) {}
+    virtual void run_and_dispose() noexcept override {
+        if (_target) {
+            _fn(_target);
+        }
+        delete this;
+    }
+    virtual task* waiting_task() noexcept override {
+        return nullptr;
+    }
+};
+
+bool internal::deferred_wakeup::schedule(void (*fn)(void*), void* target) noexcept {
+    _task = new (std::nothrow) wakeup_task(fn, target);
+    if (!_task) {
+        return false;
+    }
+    seastar::schedule(_task);
+    return true;
+}
+
+void internal::deferred_wakeup::cancel() noexcept {
+    if (_task) {
+        _task->_target = nullptr;
+        _task = nullptr;
+    }
+}
+
 const char* broken_semaphore::what() const noexcept {
     return "Semaphore broken";
 }
@@ -22,6 +22,7 @@
 #include <seastar/core/sharded.hh>
 #include <seastar/core/loop.hh>
 #include <boost/iterator/counting_iterator.hpp>
+#include <boost/range/adaptor/transformed.hpp>
 
 namespace seastar {
 
@@ -30,7 +31,13 @@ namespace internal {
 
 future<>
 sharded_parallel_for_each(unsigned nr_shards, on_each_shard_func on_each_shard) noexcept(std::is_nothrow_move_constructible_v<on_each_shard_func>) {
-    return parallel_for_each(boost::irange<unsigned>(0, nr_shards), std::move(on_each_shard));
+    // The other shards first, so that their requests are on their way
+    // while this one runs its part inline, last
+    auto me = this_shard_id();
+    auto shards = boost::irange<unsigned>(1, nr_shards + 1) | boost::adaptors::transformed([me, nr_shards] (unsigned i) {
+        return (me + i) % nr_shards;
+    });
+    return parallel_for_each(shards, std::move(on_each_shard));
 }
 
 }
@@ -23,7 +23,12 @@
 #include <seastar/core/loop.hh>
 #include <seastar/core/semaphore.hh>
 #include <seastar/core/print.hh>
+#include <seastar/core/make_task.hh>
+#include <seastar/core/deleter.hh>
 #include <boost/range/algorithm/find_if.hpp>
+#include <filesystem>
+#include <fstream>
+#include <map>
 #include <vector>
 
 namespace seastar {
@@ -112,4 +117,142 @@ smp_service_group_semaphore& get_smp_service_groups_semaphore(unsigned ssg_id, s
     return smp_service_groups[ssg_id].clients[t];
 }
 
+
+// Deleters of cross-shard buffers released on this shard, waiting to be
+// sent back to the shards that own them
+struct cross_shard_deleter_batches {
+    static constexpr size_t max_batch = 128;
+    std::vector<std::vector<deleter>> pending;
+    std::vector<shard_id> dirty;
+    bool flush_scheduled = false;
+
+    void send(shard_id owner) noexcept {
+        // FIXME: future is discarded
+        (void)smp::submit_to(owner, [batch = std::move(pending[owner])] () mutable {
+            // The deleters need to be destroyed here, rather than with the
+            // work item on the sending shard
+            batch.clear();
+        });
+        pending[owner].clear();
+    }
+
+    void flush() noexcept {
+        flush_scheduled = false;
+        for (auto owner : dirty) {
+            if (!pending[owner].empty()) {
+                send(owner);
+            }
+        }
+        dirty.clear();
+    }
+
+    void push(shard_id owner, deleter d) noexcept {
+        if (pending.empty()) {
+            pending.resize(smp::count);
+        }
+        auto& batch = pending[owner];
+        if (batch.empty()) {
+            dirty.push_back(owner);
+        }
+        batch.push_back(std::move(d));
+        if (batch.size() >= max_batch) {
+            send(owner);
+        } else if (!flush_scheduled) {
+            flush_scheduled = true;
+            schedule(make_task([this] { flush(); }));
+        }
+    }
+};
+
+static thread_local cross_shard_deleter_batches cross_shard_deleters;
+
+struct cross_shard_deleter_impl final : deleter::impl {
+    deleter inner;
+    shard_id owner;
+    cross_shard_deleter_impl(deleter inner, shard_id owner) noexcept
+        : impl(deleter()), inner(std::move(inner)), owner(owner) {}
+    virtual ~cross_shard_deleter_impl() override {
+        if (this_shard_id() != owner) {
+            cross_shard_deleters.push(owner, std::move(inner));
+        }
+    }
+};
+
+deleter make_cross_shard_deleter(deleter d, unsigned owner) {
+    if (!d || d.is_raw_object()) {
+        return d;
+    }
+    return deleter(new cross_shard_deleter_impl(std::move(d), owner));
+}
+
+deleter make_cross_shard_deleter(deleter d) {
+    return make_cross_shard_deleter(std::move(d), this_shard_id());
+}
+
+const resource::cpuset& smp::sibling_cpus(shard_id shard) noexcept {
+    static const resource::cpuset none;
+    return shard < _sibling_cpus.size() ? _sibling_cpus[shard] : none;
+}
+
+std::vector<shard_id> smp::shards_sharing_cache(shard_id shard) {
+    std::vector<shard_id> ret;
+    for (shard_id s = 0; s < count; s++) {
+        if (_cache_groups[s] == _cache_groups[shard]) {
+            ret.push_back(s);
+        }
+    }
+    return ret;
+}
+
+// The interrupts of a network device: its MSI vectors if it is a PCI
+// device, otherwise those named after it in /proc/interrupts
+static std::vector<unsigned> network_device_irqs(std::string_view interface) {
+    std::vector<unsigned> irqs;
+    std::error_code ec;
+    for (auto& e : std::filesystem::directory_iterator(fmt::format("/sys/class/net/{}/device/msi_irqs", interface), ec)) {
+        irqs.push_back(std::stoul(e.path().filename().string()));
+    }
+    if (irqs.empty()) {
+        std::ifstream interrupts("/proc/interrupts");
+        std::string line;
+        while (std::getline(interrupts, line)) {
+            unsigned irq;
+            if (line.find(interface) != std::string::npos && std::sscanf(line.c_str(), " %u:", &irq) == 1) {
+                irqs.push_back(irq);
+            }
+        }
+    }
+    std::sort(irqs.begin(), irqs.end());
+    return irqs;
+}
+
+std::vector<smp::irq_affinity> smp::advise_irq_affinity(std::string_view interface) {
+    auto irqs = network_device_irqs(interface);
+    std::vector<unsigned> shard_cpus(count);
+    for (unsigned cpu = 0; cpu < _cpu_shards.size(); cpu++) {
+        if (_cpu_shards[cpu] >= 0) {
+            shard_cpus[_cpu_shards[cpu]] = cpu;
+        }
+    }
+    // Shards taken from each cache group in turn
+    std::map<unsigned, std::vector<shard_id>> groups;
+    for (shard_id s = 0; s < count; s++) {
+        groups[_cache_groups[s]].push_back(s);
+    }
+    std::vector<shard_id> order;
+    for (size_t i = 0; order.size() < count; i++) {
+        for (auto& [group, shards] : groups) {
+            if (i < shards.size()) {
+                order.push_back(shards[i]);
+            }
+        }
+    }
+    std::vector<irq_affinity> ret;
+    for (size_t i = 0; i < irqs.size(); i++) {
+        auto shard = order[i % order.size()];
+        ret.push_back(irq_affinity{irqs[i], shard_cpus[shard], shard});
+    }
+    return ret;
+}
+
 }
@@ -20,6 +20,7 @@
  */
 
 #include <seastar/core/sstring.hh>
+#include <cstring>
 
 using namespace seastar;
 
@@ -34,3 +35,60 @@ using namespace seastar;
 [[noreturn]] void internal::throw_sstring_out_of_range() {
     throw std::out_of_range("sstring out of range");
 }
+
+namespace {
+
+constexpr uint64_t every_byte(uint8_t b) {
+    return 0x0101010101010101ull * b;
+}
+
+// Lowers the ASCII capitals of 8 bytes at once. Adding to the low 7 bits
+// of each byte sets its top bit from 'A' on, and from past 'Z' on, and the
+// bytes where only the first one is set (and which are ASCII) get 0x20.
+uint64_t lower_word(uint64_t x) noexcept {
+    auto low7 = x & every_byte(0x7f);
+    auto from_a = low7 + every_byte(0x80 - 'A');
+    auto past_z = low7 + every_byte(0x80 - 'Z' - 1);
+    auto upper = (from_a ^ past_z) & ~x & every_byte(0x80);
+    return x | (upper >> 2);
+}
+
+char lower_char(char c) noexcept {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+}
+
+bool seastar::ascii_iequals(std::string_view a, std::string_view b) noexcept {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    size_t i = 0;
+    for (; i + 8 <= a.size(); i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a.data() + i, 8);
+        std::memcpy(&y, b.data() + i, 8);
+        if (x != y && lower_word(x) != lower_word(y)) {
+            return false;
+        }
+    }
+    for (; i < a.size(); i++) {
+        if (lower_char(a[i]) != lower_char(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void seastar::ascii_to_lower(char* p, size_t n) noexcept {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+        std::memcpy(&x, p + i, 8);
+        x = lower_word(x);
+        std::memcpy(p + i, &x, 8);
+    }
+    for (; i < n; i++) {
+        p[i] = lower_char(p[i]);
+    }
+}
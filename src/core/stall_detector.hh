@@ -24,12 +24,22 @@
 
 #include <signal.h>
 #include <limits>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <map>
 #include <memory>
+#include <optional>
+#include <typeinfo>
+#include <vector>
 #include <seastar/core/posix.hh>
 #include <seastar/core/metrics_registration.hh>
 #include <seastar/core/scheduling.hh>
+#include <seastar/core/sstring.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/util/backtrace.hh>
+#include <seastar/util/noncopyable_function.hh>
 #include <linux/perf_event.h>
 
 namespace seastar {
@@ -44,6 +54,7 @@ struct cpu_stall_detector_config {
     unsigned stall_detector_reports_per_minute = 1;
     float slack = 0.3;  // fraction of threshold that we're allowed to overshoot
     bool oneline = true; // print a simplified backtrace on a single line
+    std::chrono::seconds summary_interval = std::chrono::minutes(10); // period of the log summary of the aggregated stalls, 0 for none
     std::function<void ()> report;  // alternative reporting function for tests
 };
 
@@ -71,10 +82,44 @@ class cpu_stall_detector {
         return false;
     }
     virtual void maybe_report_kernel_trace() {}
+private:
+    static constexpr size_t max_stall_frames = 32;
+    static constexpr size_t max_distinct_stalls = 1024;
+    // The backtrace of the stall in progress, taken by the signal handler
+    // whether the stall is reported or not, and aggregated into _stalls by
+    // end_task_run() once the stall is over
+    struct stall_capture {
+        unsigned sg;
+        // The continuation or other task that stalled, if a task did
+        const std::type_info* task_type;
+        unsigned nr_frames;
+        frame frames[max_stall_frames];
+    };
+    struct stall_stats {
+        simple_backtrace trace;
+        unsigned sg;
+        const std::type_info* task_type;
+        uint64_t count = 0;
+        sched_clock::duration total{};
+        sched_clock::duration max{};
+        // As of the last log summary
+        uint64_t summarized_count = 0;
+        sched_clock::duration summarized_total{};
+    };
+    stall_capture _capture;
+    std::atomic<bool> _captured = { false };
+    // Keyed by the scheduling group and the task type followed by the frames
+    std::map<std::vector<uintptr_t>, stall_stats> _stalls;
+    uint64_t _total_stalls = 0;
+    sched_clock::duration _total_stall_time{};
+    sched_clock::time_point _summary_mark{};
 private:
     void maybe_report();
     virtual void arm_timer() = 0;
     void report_suppressions(sched_clock::time_point now);
+    void capture_stall() noexcept;
+    void aggregate_stall(sched_clock::time_point now);
+    void maybe_summarize(sched_clock::time_point now);
 public:
     using clock_type = thread_cputime_clock;
 public:
@@ -89,6 +134,10 @@ class cpu_stall_detector {
     void on_signal();
     virtual void start_sleep() = 0;
     void end_sleep();
+    // Formats the aggregated stalls, one "shard N group G: ..." line per
+    // distinct task type and backtrace, the longest in total first
+    sstring format_stalls(unsigned shard) const;
+    void reset_stalls();
 };
 
 class cpu_stall_detector_posix_timer : public cpu_stall_detector {
@@ -165,5 +214,58 @@ class cpu_stall_detector_linux_perf_event : public cpu_stall_detector {
 
 std::unique_ptr<cpu_stall_detector> make_cpu_stall_detector(cpu_stall_detector_config cfg = {});
 
+// Samples the reactor thread's backtrace every \c period of CPU time it
+// consumes, tagging each sample with the scheduling group that was current.
+//
+// Samples are taken from a signal handler into a fixed array, and folded
+// into per-stack counters by a timer on the reactor, so the handler never
+// allocates. Like the stall detector, the signal is driven by a perf_event
+// task clock, or by a thread CPU time posix timer if that is unavailable.
+class cpu_profiler {
+public:
+    static constexpr size_t max_frames = 32;
+private:
+    struct sample {
+        unsigned sg;
+        unsigned nr_frames;
+        uintptr_t frames[max_frames];
+    };
+    static constexpr size_t max_pending = 256;
+    std::unique_ptr<std::array<sample, max_pending>> _pending;
+    // _head is advanced by the signal handler and _tail by the reactor,
+    // both on the reactor thread
+    std::atomic<uint64_t> _head = { 0 };
+    std::atomic<uint64_t> _tail = { 0 };
+    uint64_t _dropped = 0;
+    uint64_t _total = 0;
+    // Keyed by the scheduling group id followed by the frames, innermost first
+    std::map<std::vector<uintptr_t>, uint64_t> _stacks;
+    std::optional<file_desc> _perf_event;
+    std::optional<timer_t> _timer;
+    std::chrono::nanoseconds _period = std::chrono::nanoseconds(0);
+    timer<> _collect_timer;
+private:
+    void collect();
+public:
+    cpu_profiler();
+    ~cpu_profiler();
+    static int signal_number() { return SIGRTMIN + 2; }
+    // 0 stops sampling; collected stacks are kept
+    void set_period(std::chrono::nanoseconds period);
+    std::chrono::nanoseconds period() const noexcept { return _period; }
+    void on_signal(void* ucontext) noexcept;
+    // Drops the collected stacks
+    void reset();
+    // Formats the collected stacks as folded stacks ("frame;frame;... count" lines,
+    // outermost frame first), rooted at "shard N;<scheduling group>"
+    sstring folded_stacks(unsigned shard, noncopyable_function<sstring (unsigned)> group_name);
+    uint64_t samples() const noexcept { return _total; }
+    uint64_t dropped_samples() const noexcept { return _dropped; }
+};
+
+// Opens a perf_event that delivers \c signo to the calling thread when its
+// sample period elapses. Throws if perf_event_open() fails.
+file_desc open_signalling_perf_event(::perf_event_attr& pea, int signo);
+
 }
 }
@@ -0,0 +1,79 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/stall_reports.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/map_reduce.hh>
+#include <boost/range/irange.hpp>
+
+namespace seastar {
+
+namespace stall_reports {
+
+future<sstring> summary() {
+    return map_reduce(boost::irange(0u, smp::count), [] (unsigned shard) {
+        return smp::submit_to(shard, [] {
+            return engine().format_stall_reports();
+        });
+    }, sstring(), [] (sstring acc, sstring shard_stalls) {
+        acc += shard_stalls;
+        return acc;
+    });
+}
+
+future<> reset() {
+    return smp::invoke_on_all([] {
+        engine().reset_stall_reports();
+    });
+}
+
+class stall_reports_handler : public httpd::handler_base {
+public:
+    future<std::unique_ptr<httpd::reply>> handle(const sstring& path,
+            std::unique_ptr<httpd::request> req, std::unique_ptr<httpd::reply> rep) override {
+        bool do_reset = req->get_query_param("reset") == "true";
+        return summary().then([rep = std::move(rep), do_reset] (sstring stalls) mutable {
+            rep->write_body("txt", std::move(stalls));
+            if (!do_reset) {
+                return make_ready_future<std::unique_ptr<httpd::reply>>(std::move(rep));
+            }
+            return reset().then([rep = std::move(rep)] () mutable {
+                return std::move(rep);
+            });
+        });
+    }
+};
+
+future<> add_routes(http_server& server, sstring path) {
+    server._routes.put(httpd::GET, path, new stall_reports_handler());
+    return make_ready_future<>();
+}
+
+future<> add_routes(distributed<http_server>& server, sstring path) {
+    return server.invoke_on_all([path] (http_server& s) {
+        return add_routes(s, path);
+    });
+}
+
+}
+
+}
@@ -26,20 +26,36 @@
 #include <seastar/core/semaphore.hh>
 #include <seastar/util/std-compat.hh>
 #include <seastar/util/noncopyable_function.hh>
-#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <chrono>
 
 namespace seastar {
 
 class syscall_work_queue {
     static constexpr size_t queue_length = 128;
     struct work_item;
-    using lf_queue = boost::lockfree::spsc_queue<work_item*,
+    // Both queues can be accessed by several syscall threads at once
+    using lf_queue = boost::lockfree::queue<work_item*,
                             boost::lockfree::capacity<queue_length>>;
     lf_queue _pending;
     lf_queue _completed;
+    // In semaphore mode, so that each submitted item wakes up one thread
     writeable_eventfd _start_eventfd;
     semaphore _queue_has_room = { queue_length };
+    // Wake-ups of the threads are batched: the first item submitted since
+    // the last flush_wakeups() wakes up a thread right away, and that
+    // thread takes all the items it finds. The items submitted after it
+    // only wake up more threads, to work on them in parallel, when the
+    // reactor polls next.
+    bool _woken = false;
+    unsigned _unsignaled = 0;
+    uint64_t _wakeups = 0;
+    std::chrono::steady_clock::duration _wait_time = {};
+    std::chrono::steady_clock::duration _run_time = {};
     struct work_item {
+        std::chrono::steady_clock::time_point submitted;
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point finished;
         virtual ~work_item() {}
         virtual void process() = 0;
         virtual void complete() = 0;
@@ -78,6 +94,9 @@ class syscall_work_queue {
     //
     // Returns the number of requests handled.
     unsigned complete();
+    // Wakes up threads for the items submitted since the last call, at
+    // most max_threads of them. Returns whether any were woken up.
+    bool flush_wakeups(unsigned max_threads);
     void submit_item(std::unique_ptr<syscall_work_queue::work_item> wi);
 
     friend class thread_pool;
@@ -0,0 +1,242 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/task_local.hh>
+#include <atomic>
+#include <new>
+
+namespace seastar {
+
+namespace {
+
+constexpr unsigned index_bits = 20;
+constexpr uint32_t index_mask = (uint32_t(1) << index_bits) - 1;
+constexpr uint32_t generation_mask = (uint32_t(1) << (32 - index_bits)) - 1;
+
+struct values_slot {
+    internal::task_local_values values;
+    uint32_t generation = 0;
+    bool in_use = false;
+    // The next slot of its list, when not in use
+    uint32_t next_free = 0;
+};
+
+// A FIFO list of slots, linked through values_slot::next_free
+struct slot_list {
+    // index + 1 of the first and last slots, or 0
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint32_t size = 0;
+
+    void push(std::vector<values_slot>& slots, uint32_t index) noexcept {
+        slots[index].next_free = 0;
+        if (tail) {
+            slots[tail - 1].next_free = index + 1;
+        } else {
+            head = index + 1;
+        }
+        tail = index + 1;
+        size++;
+    }
+
+    uint32_t pop(std::vector<values_slot>& slots) noexcept {
+        auto index = head - 1;
+        head = slots[index].next_free;
+        if (!head) {
+            tail = 0;
+        }
+        size--;
+        return index;
+    }
+};
+
+// The sets of task-local values of a shard. Handles are index + 1 in the
+// low bits and the generation of the slot in the high ones, which changes
+// when the slot is released, so that stale handles are told apart.
+//
+// Tasks may hold a stale handle for any time, so a slot must not come back
+// with a generation it had before. Released slots are reused in FIFO order,
+// and only once enough of them are free, so that the generations of each
+// advance slowly; a slot whose generation would wrap around is retired,
+// and only reused once the table can't grow anymore.
+struct values_table {
+    static constexpr uint32_t min_free = 128;
+
+    std::vector<values_slot> slots;
+    slot_list free;
+    slot_list retired;
+
+    uint32_t allocate(internal::task_local_values values) noexcept {
+        uint32_t index;
+        if (free.size >= min_free || (free.size && slots.size() >= index_mask)) {
+            index = free.pop(slots);
+        } else if (slots.size() < index_mask) {
+            try {
+                slots.emplace_back();
+            } catch (...) {
+                return 0;
+            }
+            index = slots.size() - 1;
+        } else if (retired.size) {
+            index = retired.pop(slots);
+            slots[index].generation = 0;
+        } else {
+            return 0;
+        }
+        auto& s = slots[index];
+        s.values = std::move(values);
+        s.in_use = true;
+        return (s.generation << index_bits) | (index + 1);
+    }
+
+    const internal::task_local_values* lookup(uint32_t handle) const noexcept {
+        auto index = (handle & index_mask) - 1;
+        if (!handle || index >= slots.size()) {
+            return nullptr;
+        }
+        auto& s = slots[index];
+        if (!s.in_use || s.generation != handle >> index_bits) {
+            return nullptr;
+        }
+        return &s.values;
+    }
+
+    void release(uint32_t handle) noexcept {
+        if (!lookup(handle)) {
+            return;
+        }
+        auto index = (handle & index_mask) - 1;
+        auto& s = slots[index];
+        s.values.clear();
+        s.in_use = false;
+        if (s.generation == generation_mask) {
+            // Retired slots may stay unused for long
+            s.values.shrink_to_fit();
+            retired.push(slots, index);
+            return;
+        }
+        s.generation++;
+        free.push(slots, index);
+    }
+};
+
+thread_local values_table task_locals;
+
+// Keys are usually static objects, and are shared by the shards
+std::atomic<unsigned> next_key_id = 0;
+
+const std::any* find_value(const internal::task_local_values* values, unsigned id) noexcept {
+    if (!values) {
+        return nullptr;
+    }
+    for (auto& [key, value] : *values) {
+        if (key == id) {
+            return &value;
+        }
+    }
+    return nullptr;
+}
+
+}
+
+namespace internal {
+
+task_local_values cross_shard_task_local_values() {
+    task_local_values ret;
+    if (auto values = task_locals.lookup(*current_task_local_handle_ptr())) {
+        for (auto& v : *values) {
+            // See task_local_key::crosses_shards()
+            if (v.first & 1) {
+                ret.push_back(v);
+            }
+        }
+    }
+    return ret;
+}
+
+}
+
+// The low bit of the id tells whether the value crosses shards, which
+// spares the values a pointer to their key
+task_local_key::task_local_key(bool crosses_shards) noexcept
+        : _id((next_key_id.fetch_add(1, std::memory_order_relaxed) << 1) | crosses_shards) {
+}
+
+const std::any* task_local_key::find() const noexcept {
+    return find_value(task_locals.lookup(*internal::current_task_local_handle_ptr()), _id);
+}
+
+void task_local_scope::activate(const task_local_key& key, std::any value) {
+    _previous = *internal::current_task_local_handle_ptr();
+    internal::task_local_values values;
+    if (auto current = task_locals.lookup(_previous)) {
+        values.reserve(current->size() + 1);
+        for (auto& v : *current) {
+            if (v.first != key.id()) {
+                values.push_back(v);
+            }
+        }
+    }
+    values.emplace_back(key.id(), std::move(value));
+    _handle = task_locals.allocate(std::move(values));
+    *internal::current_task_local_handle_ptr() = _handle;
+}
+
+task_local_scope::task_local_scope(internal::task_local_values values) noexcept
+        : _previous(*internal::current_task_local_handle_ptr()) {
+    if (values.empty()) {
+        return;
+    }
+    _handle = task_locals.allocate(std::move(values));
+    *internal::current_task_local_handle_ptr() = _handle;
+}
+
+task_local_scope::task_local_scope(task_local_scope&& o) noexcept
+        : _handle(std::exchange(o._handle, 0))
+        , _previous(o._previous) {
+}
+
+task_local_scope& task_local_scope::operator=(task_local_scope&& o) noexcept {
+    if (this != &o) {
+        this->~task_local_scope();
+        new (this) task_local_scope(std::move(o));
+    }
+    return *this;
+}
+
+task_local_scope::~task_local_scope() {
+    if (_handle) {
+        deactivate();
+        task_locals.release(_handle);
+    }
+}
+
+void task_local_scope::deactivate() noexcept {
+    if (*internal::current_task_local_handle_ptr() == _handle) {
+        *internal::current_task_local_handle_ptr() = _previous;
+    }
+}
+
+const std::any* task_local_scope::find(const task_local_key& key) const noexcept {
+    return find_value(task_locals.lookup(_handle), key.id());
+}
+
+}
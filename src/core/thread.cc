@@ -23,7 +23,9 @@
 #include <seastar/core/thread.hh>
 #include <seastar/core/posix.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/align.hh>
 #include <ucontext.h>
+#include <sys/mman.h>
 #include <algorithm>
 
 #include <valgrind/valgrind.h>
@@ -111,8 +113,125 @@ void jmp_buf_link::final_switch_out()
     setcontext(&g_current_context->context);
 }
 
+#elif defined(SEASTAR_THREAD_FAST_SWITCH)
+
+// seastar_switch_context(save_sp, new_sp) pushes the callee-saved registers
+// on the current stack, stores the stack pointer in *save_sp, and pops the
+// registers saved at new_sp, returning to where that context left off.
+// The caller-saved registers are already saved by the compiler around the
+// call, and the signal mask is never switched, so that is all it takes.
+//
+// A new context starts with a frame that returns to
+// seastar_thread_trampoline, with the entry point and its argument in two
+// of the restored registers.
+extern "C" {
+void seastar_switch_context(void** save_sp, void* new_sp);
+void seastar_thread_trampoline();
+}
+
+asm(R"(
+    .text
+    .globl seastar_switch_context
+    .hidden seastar_switch_context
+    .type seastar_switch_context, @function
+seastar_switch_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size seastar_switch_context, .-seastar_switch_context
+
+    .globl seastar_thread_trampoline
+    .hidden seastar_thread_trampoline
+    .type seastar_thread_trampoline, @function
+seastar_thread_trampoline:
+    movq %rbx, %rdi
+    callq *%r12
+    ud2
+    .size seastar_thread_trampoline, .-seastar_thread_trampoline
+)");
+
+namespace {
+
+// What seastar_switch_context() pops, lowest address first
+struct switch_frame {
+    uint32_t mxcsr;
+    uint16_t fpu_control;
+    uint16_t padding;
+    uint64_t r15, r14, r13, r12, rbx, rbp;
+    void (*ret)();
+
+    switch_frame(void (*entry)(void*), void* arg)
+        : mxcsr(0x1f80) // all exceptions masked, round to nearest
+        , fpu_control(0x037f) // likewise, with extended precision
+        , padding(0)
+        , r15(0), r14(0), r13(0)
+        , r12(reinterpret_cast<uintptr_t>(entry))
+        , rbx(reinterpret_cast<uintptr_t>(arg))
+        , rbp(0)
+        , ret(seastar_thread_trampoline)
+    {}
+};
+
+}
+
+static_assert(sizeof(switch_frame) % 16 == 0, "stack pointer alignment");
+
+void jmp_buf_link::initial_switch_in(void (*entry)(void*), void* arg, char* stack_top)
+{
+    // Once the frame is popped, the stack pointer is 16-byte aligned, as the
+    // ABIs require before a call
+    auto top = align_down(reinterpret_cast<uintptr_t>(stack_top), uintptr_t(16));
+    auto frame = new (reinterpret_cast<void*>(top - sizeof(switch_frame))) switch_frame(entry, arg);
+    sp = frame;
+    switch_in();
+}
+
+inline void jmp_buf_link::switch_in()
+{
+    auto prev = std::exchange(g_current_context, this);
+    link = prev;
+    seastar_switch_context(&prev->sp, sp);
+}
+
+inline void jmp_buf_link::switch_out()
+{
+    g_current_context = link;
+    seastar_switch_context(&sp, g_current_context->sp);
+}
+
+inline void jmp_buf_link::initial_switch_in_completed()
+{
+}
+
+inline void jmp_buf_link::final_switch_out()
+{
+    g_current_context = link;
+    // The registers saved here are never restored, the stack is about to go
+    seastar_switch_context(&sp, g_current_context->sp);
+    __builtin_unreachable();
+}
+
 #else
 
+
 inline void jmp_buf_link::initial_switch_in(ucontext_t* initial_context, const void*, size_t)
 {
     auto prev = std::exchange(g_current_context, this);
@@ -161,32 +280,110 @@ static constexpr size_t base_stack_size = 128 * 1024;
 
 static size_t get_stack_size(thread_attributes attr) {
 #if defined(__OPTIMIZE__) && defined(SEASTAR_ASAN_ENABLED)
-    return std::max(base_stack_size, attr.stack_size);
+    auto size = std::max(base_stack_size, attr.stack_size);
 #else
-    return attr.stack_size ? attr.stack_size : base_stack_size;
+    auto size = attr.stack_size ? attr.stack_size : base_stack_size;
 #endif
+    if (attr.lazy_stack) {
+        size = align_up(size, size_t(getpagesize()));
+    }
+    return size;
 }
 
-thread_context::thread_context(thread_attributes attr, noncopyable_function<void ()> func)
-        : task(attr.sched_group.value_or(current_scheduling_group()))
-        , _stack(make_stack(get_stack_size(attr)))
-        , _func(std::move(func)) {
-    setup(get_stack_size(attr));
-    _all_threads.push_front(*this);
-}
+namespace {
 
-thread_context::~thread_context() {
+// Stacks of finished threads, kept to save new threads the allocation, the
+// guard page setup and the page faults of a fresh stack. The most recently
+// released stacks are reused first, as their memory is the likeliest to be
+// in the caches.
+class thread_stack_pool {
+    struct stack {
+        char* mem;
+        size_t size;
+        bool lazy;
+    };
+    std::vector<stack> _stacks;
+    size_t _bytes = 0;
+#ifdef SEASTAR_ASAN_ENABLED
+    // A reused stack has the shadow memory of the previous thread's frames
+    size_t _limit = 0;
+#else
+    size_t _limit = 2 << 20;
+#endif
+    // The top of a stack is used by every thread, so there is no point
+    // in returning it to the kernel only to fault it back in
+    static constexpr size_t hot_size = 16 * 1024;
+public:
+    ~thread_stack_pool() {
+        for (auto& s : _stacks) {
+            free_stack(s.mem, s.size, s.lazy);
+        }
+    }
+
+    char* take(size_t size, bool lazy) noexcept {
+        for (auto it = _stacks.rbegin(); it != _stacks.rend(); ++it) {
+            if (it->size == size && it->lazy == lazy) {
+                auto mem = it->mem;
+                _bytes -= size;
+                _stacks.erase(std::next(it).base());
+                return mem;
+            }
+        }
+        return nullptr;
+    }
+
+    void release(char* mem, size_t size, bool lazy) noexcept {
+        if (_bytes + size > _limit) {
+            free_stack(mem, size, lazy);
+            return;
+        }
+        try {
+            _stacks.push_back(stack{mem, size, lazy});
+        } catch (...) {
+            free_stack(mem, size, lazy);
+            return;
+        }
+        _bytes += size;
+        if (lazy && size > hot_size) {
+            // Let the kernel take back the pages the thread dirtied, but only
+            // when it needs memory; until then, reuse costs no page faults.
+            // The guard page is left alone, it is not writable anyway.
+            size_t page_size = getpagesize();
+#ifdef MADV_FREE
+            auto advice = MADV_FREE;
+#else
+            auto advice = MADV_DONTNEED;
+#endif
+            ::madvise(mem + page_size, size - hot_size - page_size, advice);
+        }
+    }
+
+    void set_limit(size_t bytes) noexcept {
+        _limit = bytes;
+        while (_bytes > _limit) {
+            auto s = _stacks.front();
+            _stacks.erase(_stacks.begin());
+            _bytes -= s.size;
+            free_stack(s.mem, s.size, s.lazy);
+        }
+    }
+
+    static void free_stack(char* mem, size_t size, bool lazy) noexcept {
+        if (lazy) {
+            ::munmap(mem, size);
+            return;
+        }
 #ifdef SEASTAR_THREAD_STACK_GUARDS
-    auto mp_result = mprotect(_stack.get(), getpagesize(), PROT_READ | PROT_WRITE);
-    assert(mp_result == 0);
+        auto mp_result = mprotect(mem, getpagesize(), PROT_READ | PROT_WRITE);
+        assert(mp_result == 0);
 #endif
-    _all_threads.erase(_all_threads.iterator_to(*this));
-}
+        free(mem);
+    }
+};
 
-thread_context::stack_deleter::stack_deleter(int valgrind_id) : valgrind_id(valgrind_id) {}
+thread_local thread_stack_pool stack_pool;
 
-thread_context::stack_holder
-thread_context::make_stack(size_t stack_size) {
+char* allocate_stack(size_t stack_size) {
 #ifdef SEASTAR_THREAD_STACK_GUARDS
     size_t page_size = getpagesize();
     size_t alignment = page_size;
@@ -197,28 +394,83 @@ thread_context::make_stack(size_t stack_size) {
     if (mem == nullptr) {
         throw std::bad_alloc();
     }
-    int valgrind_id = VALGRIND_STACK_REGISTER(mem, reinterpret_cast<char*>(mem) + stack_size);
-    auto stack = stack_holder(new (mem) char[stack_size], stack_deleter(valgrind_id));
+    auto stack = reinterpret_cast<char*>(mem);
 #ifdef SEASTAR_ASAN_ENABLED
     // Avoid ASAN false positive due to garbage on stack
-    std::fill_n(stack.get(), stack_size, 0);
+    std::fill_n(stack, stack_size, 0);
 #endif
 
 #ifdef SEASTAR_THREAD_STACK_GUARDS
-    auto mp_status = mprotect(stack.get(), page_size, PROT_READ);
-    throw_system_error_on(mp_status != 0, "mprotect");
+    auto mp_status = mprotect(stack, page_size, PROT_READ);
+    if (mp_status != 0) {
+        free(mem);
+        throw_system_error_on(true, "mprotect");
+    }
 #endif
-
     return stack;
 }
 
+// Fresh anonymous memory reads as zeros, so ASan has no garbage to
+// complain about here
+char* map_stack(size_t stack_size) {
+    void* mem = ::mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    throw_system_error_on(mem == MAP_FAILED, "mmap");
+    auto mp_status = mprotect(mem, getpagesize(), PROT_NONE);
+    if (mp_status != 0) {
+        ::munmap(mem, stack_size);
+        throw_system_error_on(true, "mprotect");
+    }
+    return reinterpret_cast<char*>(mem);
+}
+
+}
+
+void set_thread_stack_pool_limit(size_t bytes) noexcept {
+    stack_pool.set_limit(bytes);
+}
+
+thread_context::thread_context(thread_attributes attr, noncopyable_function<void ()> func)
+        : task(attr.sched_group.value_or(current_scheduling_group()))
+        , _stack(make_stack(get_stack_size(attr), attr.lazy_stack))
+        , _func(std::move(func)) {
+    setup(get_stack_size(attr));
+    _all_threads.push_front(*this);
+}
+
+thread_context::~thread_context() {
+    _all_threads.erase(_all_threads.iterator_to(*this));
+}
+
+thread_context::stack_deleter::stack_deleter(int valgrind_id, size_t size, bool lazy)
+    : valgrind_id(valgrind_id)
+    , size(size)
+    , lazy(lazy)
+{}
+
+thread_context::stack_holder
+thread_context::make_stack(size_t stack_size, bool lazy) {
+    char* stack = stack_pool.take(stack_size, lazy);
+    if (!stack) {
+        stack = lazy ? map_stack(stack_size) : allocate_stack(stack_size);
+    }
+    int valgrind_id = VALGRIND_STACK_REGISTER(stack, stack + stack_size);
+    return stack_holder(stack, stack_deleter(valgrind_id, stack_size, lazy));
+}
+
 void thread_context::stack_deleter::operator()(char* ptr) const noexcept {
     VALGRIND_STACK_DEREGISTER(valgrind_id);
-    free(ptr);
+    stack_pool.release(ptr, size, lazy);
 }
 
 void
 thread_context::setup(size_t stack_size) {
+#ifdef SEASTAR_THREAD_FAST_SWITCH
+    _context.thread = this;
+    _context.initial_switch_in([] (void* self) {
+        static_cast<thread_context*>(self)->main();
+    }, this, _stack.get() + stack_size);
+#else
     // use setcontext() for the initial jump, as it allows us
     // to set up a stack, but continue with longjmp() as it's
     // much faster.
@@ -233,6 +485,7 @@ thread_context::setup(size_t stack_size) {
     makecontext(&initial_context, main, 2, int(q), int(q >> 32));
     _context.thread = this;
     _context.initial_switch_in(&initial_context, _stack.get(), stack_size);
+#endif
 }
 
 void
@@ -26,16 +26,30 @@ namespace seastar {
 
 /* not yet implemented for OSv. TODO: do the notification like we do class smp. */
 #ifndef HAVE_OSV
-thread_pool::thread_pool(reactor* r, sstring name) : _reactor(r), _worker_thread([this, name] { work(name); }) {
+thread_pool::thread_pool(reactor* r, sstring name, unsigned nr_threads) : _reactor(r) {
+    _worker_threads.reserve(nr_threads);
+    for (unsigned i = 0; i < nr_threads; ++i) {
+        auto thread_name = i ? seastar::format("{}-{}", name, i) : name;
+        _worker_threads.emplace_back([this, thread_name] { work(thread_name); });
+    }
 }
 
 void thread_pool::work(sstring name) {
     pthread_setname_np(pthread_self(), name.c_str());
+    // Leave the shard's cpu to the reactor when its core has spare PUs
+    auto& siblings = smp::sibling_cpus(_reactor->_id);
+    if (!siblings.empty()) {
+        cpu_set_t cs;
+        CPU_ZERO(&cs);
+        for (auto cpu : siblings) {
+            CPU_SET(cpu, &cs);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+    }
     sigset_t mask;
     sigfillset(&mask);
     auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
     throw_pthread_error(r);
-    std::array<syscall_work_queue::work_item*, syscall_work_queue::queue_length> tmp_buf;
     while (true) {
         uint64_t count;
         auto r = ::read(inter_thread_wq._start_eventfd.get_read_fd(), &count, sizeof(count));
@@ -43,26 +57,31 @@ void thread_pool::work(sstring name) {
         if (_stopped.load(std::memory_order_relaxed)) {
             break;
         }
-        auto end = tmp_buf.data();
-        inter_thread_wq._pending.consume_all([&] (syscall_work_queue::work_item* wi) {
-            *end++ = wi;
-        });
-        for (auto p = tmp_buf.data(); p != end; ++p) {
-            auto wi = *p;
+        // Items are taken one at a time, so that the other threads, woken
+        // up for the items after this one, can work on them meanwhile. A
+        // thread may find the queue empty, if others took the item it was
+        // woken up for.
+        syscall_work_queue::work_item* wi;
+        while (inter_thread_wq._pending.pop(wi)) {
+            wi->started = std::chrono::steady_clock::now();
             wi->process();
+            wi->finished = std::chrono::steady_clock::now();
+            // Can't fail, there are never more items in flight than fit in the queue
             inter_thread_wq._completed.push(wi);
-        }
-        if (_main_thread_idle.load(std::memory_order_seq_cst)) {
-            uint64_t one = 1;
-            ::write(_reactor->_notify_eventfd.get(), &one, 8);
+            if (_main_thread_idle.load(std::memory_order_seq_cst)) {
+                uint64_t one = 1;
+                ::write(_reactor->_notify_eventfd.get(), &one, 8);
+            }
         }
     }
 }
 
 thread_pool::~thread_pool() {
     _stopped.store(true, std::memory_order_relaxed);
-    inter_thread_wq._start_eventfd.signal(1);
-    _worker_thread.join();
+    inter_thread_wq._start_eventfd.signal(_worker_threads.size());
+    for (auto& t : _worker_threads) {
+        t.join();
+    }
 }
 #endif
 
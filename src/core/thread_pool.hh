@@ -22,6 +22,7 @@
 #pragma once
 
 #include "syscall_work_queue.hh"
+#include <vector>
 
 namespace seastar {
 
@@ -32,11 +33,13 @@ class thread_pool {
     uint64_t _aio_threaded_fallbacks = 0;
 #ifndef HAVE_OSV
     syscall_work_queue inter_thread_wq;
-    posix_thread _worker_thread;
+    // The threads share inter_thread_wq, each takes the next item when done
+    // with one, so a slow operation doesn't hold back the ones queued after it
+    std::vector<posix_thread> _worker_threads;
     std::atomic<bool> _stopped = { false };
     std::atomic<bool> _main_thread_idle = { false };
 public:
-    explicit thread_pool(reactor* r, sstring thread_name);
+    thread_pool(reactor* r, sstring thread_name, unsigned nr_threads = 1);
     ~thread_pool();
     template <typename T, typename Func>
     future<T> submit(Func func) noexcept {
@@ -44,8 +47,21 @@ class thread_pool {
         return inter_thread_wq.submit<T>(std::move(func));
     }
     uint64_t operation_count() const { return _aio_threaded_fallbacks; }
+    // Operations submitted and not completed yet, including the ones waiting
+    // for room in the queue
+    size_t queue_length() const {
+        return syscall_work_queue::queue_length - inter_thread_wq._queue_has_room.available_units() + inter_thread_wq._queue_has_room.waiters();
+    }
+    // Total time completed operations waited for a thread
+    std::chrono::steady_clock::duration wait_time() const { return inter_thread_wq._wait_time; }
+    // Total time completed operations ran for
+    std::chrono::steady_clock::duration run_time() const { return inter_thread_wq._run_time; }
+
+    // Number of times the threads were woken up for submitted operations
+    uint64_t wakeup_count() const { return inter_thread_wq._wakeups; }
 
     unsigned complete() { return inter_thread_wq.complete(); }
+    bool flush_wakeups() { return inter_thread_wq.flush_wakeups(_worker_threads.size()); }
     // Before we enter interrupt mode, we must make sure that the syscall thread will properly
     // generate signals to wake us up. This means we need to make sure that all modifications to
     // the pending and completed fields in the inter_thread_wq are visible to all threads.
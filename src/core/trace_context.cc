@@ -0,0 +1,186 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/trace_context.hh>
+#include <cstring>
+#include <random>
+#include <utility>
+
+namespace seastar {
+
+namespace tracing {
+
+namespace {
+
+// Goes with the functions submitted to other shards
+task_local<trace_context> current(true);
+
+struct tracing_state {
+    sampler sample;
+    std::mt19937_64 rng{std::random_device()()};
+
+    uint64_t random_nonzero() noexcept {
+        uint64_t v;
+        do {
+            v = rng();
+        } while (!v);
+        return v;
+    }
+};
+
+thread_local tracing_state state;
+
+constexpr char hex_digits[] = "0123456789abcdef";
+
+void append_hex(sstring& s, size_t pos, const uint8_t* data, size_t size) noexcept {
+    for (size_t i = 0; i < size; i++) {
+        s[pos + 2 * i] = hex_digits[data[i] >> 4];
+        s[pos + 2 * i + 1] = hex_digits[data[i] & 0xf];
+    }
+}
+
+// Lower case only, as the specification wants
+bool parse_hex(std::string_view s, uint8_t* out) noexcept {
+    auto digit = [] (char c) -> int {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        return -1;
+    };
+    for (size_t i = 0; i < s.size() / 2; i++) {
+        auto hi = digit(s[2 * i]);
+        auto lo = digit(s[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+}
+
+trace_context trace_context::make_child() const noexcept {
+    trace_context child = *this;
+    child.span_id = state.random_nonzero();
+    return child;
+}
+
+trace_context trace_context::make_root() noexcept {
+    trace_context ctx;
+    for (size_t i = 0; i < ctx.trace_id.size(); i += 8) {
+        auto v = state.random_nonzero();
+        std::memcpy(ctx.trace_id.data() + i, &v, 8);
+    }
+    ctx.span_id = state.random_nonzero();
+    try {
+        if (state.sample && state.sample(ctx)) {
+            ctx.flags |= sampled_flag;
+        }
+    } catch (...) {
+        // not sampled
+    }
+    return ctx;
+}
+
+// version "-" trace-id "-" parent-id "-" trace-flags
+sstring trace_context::to_traceparent() const {
+    sstring s(sstring::initialized_later(), 55);
+    s[0] = '0';
+    s[1] = '0';
+    s[2] = '-';
+    append_hex(s, 3, trace_id.data(), trace_id.size());
+    s[35] = '-';
+    uint8_t span[8];
+    for (int i = 0; i < 8; i++) {
+        span[i] = span_id >> (56 - 8 * i);
+    }
+    append_hex(s, 36, span, sizeof(span));
+    s[52] = '-';
+    append_hex(s, 53, &flags, 1);
+    return s;
+}
+
+std::optional<trace_context> trace_context::from_traceparent(std::string_view value) noexcept {
+    // Future versions may append fields, which are ignored
+    if (value.size() < 55 || value[2] != '-' || value[35] != '-' || value[52] != '-'
+            || (value.size() > 55 && value[55] != '-')) {
+        return std::nullopt;
+    }
+    uint8_t version;
+    if (!parse_hex(value.substr(0, 2), &version) || version == 0xff || (version == 0 && value.size() != 55)) {
+        return std::nullopt;
+    }
+    trace_context ctx;
+    uint8_t span[8];
+    if (!parse_hex(value.substr(3, 32), ctx.trace_id.data()) || !parse_hex(value.substr(36, 16), span)
+            || !parse_hex(value.substr(53, 2), &ctx.flags)) {
+        return std::nullopt;
+    }
+    for (auto b : span) {
+        ctx.span_id = (ctx.span_id << 8) | b;
+    }
+    if (ctx.trace_id == trace_id_type{} || ctx.span_id == 0) {
+        return std::nullopt;
+    }
+    return ctx;
+}
+
+void set_sampler(sampler s) {
+    state.sample = std::move(s);
+}
+
+bool has_sampler() noexcept {
+    return bool(state.sample);
+}
+
+sampler make_ratio_sampler(double ratio) {
+    return [ratio] (const trace_context& ctx) {
+        if (ratio >= 1) {
+            return true;
+        }
+        uint64_t v = 0;
+        for (size_t i = 8; i < 16; i++) {
+            v = (v << 8) | ctx.trace_id[i];
+        }
+        return double(v) < ratio * 18446744073709551616.0;
+    };
+}
+
+const trace_context* current_trace_context() noexcept {
+    return current.get();
+}
+
+active_context::active_context(const trace_context& ctx) noexcept
+        : _scope(current, ctx) {
+}
+
+const trace_context* active_context::get() const noexcept {
+    auto v = _scope.find(current);
+    return v ? std::any_cast<trace_context>(v) : nullptr;
+}
+
+}
+
+}
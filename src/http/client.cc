@@ -0,0 +1,362 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/http/client.hh>
+#include <seastar/http/internal/content_source.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/print.hh>
+#include <seastar/core/trace_context.hh>
+#include <seastar/net/tls.hh>
+#include <limits>
+
+namespace seastar {
+
+namespace http {
+
+namespace experimental {
+
+using httpd::request;
+using httpd::reply;
+
+static bool header_equals(const sstring& value, const sstring& expected) {
+    return request::case_insensitive_cmp()(value, expected);
+}
+
+static const sstring* find_header(const reply& rep, const sstring& name) {
+    // Unlike requests, replies keep header names as received
+    for (auto& h : rep._headers) {
+        if (header_equals(h.first, name)) {
+            return &h.second;
+        }
+    }
+    return nullptr;
+}
+
+class connection_not_reusable : public std::runtime_error {
+public:
+    connection_not_reusable() : std::runtime_error("HTTP connection can no longer be used") {}
+};
+
+unexpected_status_error::unexpected_status_error(reply::status_type st)
+        : std::runtime_error(format("Unexpected HTTP reply status {}", static_cast<int>(st)))
+        , _status(st) {
+}
+
+connection::connection(connected_socket&& fd)
+        : _fd(std::move(fd))
+        , _read_buf(_fd.input())
+        , _write_buf(_fd.output()) {
+}
+
+future<> connection::send_request(request& req) {
+    if (!_persistent) {
+        return make_exception_future<>(connection_not_reusable());
+    }
+    if (req.body_writer) {
+        if (req.content_length) {
+            req._headers["Content-Length"] = to_sstring(req.content_length);
+        } else {
+            req._headers["Transfer-Encoding"] = "chunked";
+        }
+    } else if (!req.content.empty()) {
+        req._headers["Content-Length"] = to_sstring(req.content.size());
+    }
+    sstring head = format("{} {} HTTP/{}\r\n", req._method, req._url, req._version.empty() ? "1.1" : req._version);
+    for (auto& h : req._headers) {
+        head += h.first + ": " + h.second + "\r\n";
+    }
+    head += "\r\n";
+    // A body of known length is passed on without copying, so the head
+    // must not be left in the buffer
+    auto f = req.body_writer && req.content_length ? _write_buf.write(temporary_buffer<char>(head.data(), head.size())) : _write_buf.write(head);
+    return f.then([this, &req] {
+        if (req.body_writer) {
+            if (req.content_length) {
+                return req.body_writer(httpd::internal::make_http_content_length_output_stream(_write_buf, req.content_length));
+            }
+            return req.body_writer(httpd::internal::make_http_chunked_output_stream(_write_buf)).then([this] {
+                return _write_buf.write("0\r\n\r\n", 5);
+            });
+        }
+        return _write_buf.write(req.content);
+    }).then([this] {
+        return _write_buf.flush();
+    });
+}
+
+future<std::unique_ptr<reply>> connection::recv_reply_head() {
+    _parser.init();
+    return _read_buf.consume(_parser).then([this] {
+        if (_parser.eof()) {
+            return make_exception_future<std::unique_ptr<reply>>(std::runtime_error("HTTP connection closed by the server"));
+        }
+        if (_parser._state != http_response_parser::state::done) {
+            return make_exception_future<std::unique_ptr<reply>>(std::runtime_error("Can't parse the HTTP reply"));
+        }
+        auto resp = _parser.get_parsed_response();
+        auto code = resp->_status_code;
+        if (code >= 100 && code < 200 && code != 101) {
+            // Interim response (100 Continue, 103 Early Hints); the final one follows
+            return recv_reply_head();
+        }
+        auto rep = std::make_unique<reply>();
+        rep->_status = static_cast<reply::status_type>(code);
+        rep->_version = std::move(resp->_version);
+        rep->_headers = std::move(resp->_headers);
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    });
+}
+
+input_stream<char> connection::make_body_stream(const request& req, const reply& rep,
+        std::unordered_map<sstring, sstring>& chunk_extensions, std::unordered_map<sstring, sstring>& trailing_headers) {
+    using httpd::internal::content_length_source_impl;
+    using httpd::internal::chunked_source_impl;
+    auto code = static_cast<int>(rep._status);
+    if (req._method == "HEAD" || code == 204 || code == 304 || code < 200) {
+        return input_stream<char>(data_source(std::make_unique<content_length_source_impl>(_read_buf, 0)));
+    }
+    auto te = find_header(rep, "Transfer-Encoding");
+    if (te && header_equals(*te, "chunked")) {
+        return input_stream<char>(data_source(std::make_unique<chunked_source_impl>(_read_buf, chunk_extensions, trailing_headers)));
+    }
+    auto cl = find_header(rep, "Content-Length");
+    if (cl) {
+        return input_stream<char>(data_source(std::make_unique<content_length_source_impl>(_read_buf, strtoull(cl->c_str(), nullptr, 10))));
+    }
+    // The body extends to the end of the connection
+    _persistent = false;
+    return input_stream<char>(data_source(std::make_unique<content_length_source_impl>(_read_buf, std::numeric_limits<size_t>::max())));
+}
+
+future<> connection::recv_reply(const request& req, reply_handler& handle, std::optional<reply::status_type> expected) {
+    if (!_persistent) {
+        // An earlier reply on this connection failed, or ended it
+        return make_exception_future<>(connection_not_reusable());
+    }
+    return recv_reply_head().then([this, &req, &handle, expected] (std::unique_ptr<reply> rep) {
+        auto conn = find_header(*rep, "Connection");
+        if (rep->_version == "1.0" ? !(conn && header_equals(*conn, "keep-alive")) : (conn && header_equals(*conn, "close"))) {
+            _persistent = false;
+        }
+        if (expected && rep->_status != *expected) {
+            // We don't read the body, so the next reply can't be found
+            _persistent = false;
+            return make_exception_future<>(unexpected_status_error(rep->_status));
+        }
+        return do_with(std::move(rep), std::unordered_map<sstring, sstring>(), std::unordered_map<sstring, sstring>(),
+                [this, &req, &handle] (std::unique_ptr<reply>& rep, auto& chunk_extensions, auto& trailing_headers) {
+            return do_with(make_body_stream(req, *rep, chunk_extensions, trailing_headers), [this, &handle, &rep] (input_stream<char>& body) {
+                return handle(*rep, body).then([this, &body] {
+                    // If the handler did not read the entire body, the next
+                    // reply can't be found. body.eof() may only become true
+                    // after read(), see connection::read_one() in httpd.cc.
+                    return body.read().then([this] (temporary_buffer<char> buf) {
+                        if (!buf.empty()) {
+                            _persistent = false;
+                        }
+                    });
+                });
+            });
+        });
+    });
+}
+
+void connection::shutdown() noexcept {
+    _persistent = false;
+    try {
+        _fd.shutdown_input();
+        _fd.shutdown_output();
+    } catch (...) {
+        // Already disconnected
+    }
+}
+
+// Passes the trace context of the caller on to the server
+static void add_trace_header(request& req) {
+    if (auto ctx = tracing::current_trace_context()) {
+        if (req.get_header("traceparent").empty()) {
+            req._headers["traceparent"] = ctx->to_traceparent();
+        }
+    }
+}
+
+future<> connection::make_request(request req, reply_handler handle, std::optional<reply::status_type> expected, abort_source* as) {
+    add_trace_header(req);
+    ++_in_flight;
+    return do_make_request(std::move(req), std::move(handle), expected, as);
+}
+
+future<> connection::do_make_request(request req, reply_handler handle, std::optional<reply::status_type> expected, abort_source* as) {
+    auto sub = as ? as->subscribe([this] () noexcept { shutdown(); }) : optimized_optional<abort_source::subscription>();
+    if (as && !sub) {
+        --_in_flight;
+        return make_exception_future<>(abort_requested_exception());
+    }
+    return do_with(std::move(req), std::move(handle), [this, expected] (request& req, reply_handler& handle) {
+        return get_units(_send_sem, 1).then([this, &req, &handle, expected] (semaphore_units<> send_units) {
+            // Queue up for the reply before the next request may be sent
+            auto recv_units = get_units(_recv_sem, 1);
+            return send_request(req).then_wrapped([this, &req, &handle, expected, send_units = std::move(send_units), recv_units = std::move(recv_units)] (future<> f) mutable {
+                send_units.return_all();
+                return recv_units.then([this, &req, &handle, expected, f = std::move(f)] (semaphore_units<> recv_units) mutable {
+                    if (f.failed()) {
+                        return std::move(f);
+                    }
+                    return recv_reply(req, handle, expected).finally([recv_units = std::move(recv_units)] {});
+                });
+            });
+        });
+    }).then_wrapped([this, as, sub = std::move(sub)] (future<> f) {
+        --_in_flight;
+        if (f.failed()) {
+            _persistent = false;
+            if (as && as->abort_requested()) {
+                f.ignore_ready_future();
+                return make_exception_future<>(abort_requested_exception());
+            }
+        }
+        return f;
+    });
+}
+
+future<> connection::close() {
+    _persistent = false;
+    return _write_buf.close().then_wrapped([this] (future<> f) {
+        f.ignore_ready_future();
+        return _read_buf.close();
+    });
+}
+
+class plain_connection_factory : public connection_factory {
+    socket_address _addr;
+public:
+    explicit plain_connection_factory(socket_address addr) : _addr(std::move(addr)) {}
+    virtual future<connected_socket> make() override {
+        return seastar::connect(_addr, {}, transport::TCP);
+    }
+};
+
+class tls_connection_factory : public connection_factory {
+    socket_address _addr;
+    shared_ptr<tls::certificate_credentials> _creds;
+    sstring _host;
+public:
+    tls_connection_factory(socket_address addr, shared_ptr<tls::certificate_credentials> creds, sstring host)
+            : _addr(std::move(addr)), _creds(std::move(creds)), _host(std::move(host)) {}
+    virtual future<connected_socket> make() override {
+        return tls::connect(_creds, _addr, _host);
+    }
+};
+
+client::client(socket_address addr, sstring host, config cfg)
+        : client(std::make_unique<plain_connection_factory>(std::move(addr)), std::move(host), cfg) {
+}
+
+client::client(socket_address addr, shared_ptr<tls::certificate_credentials> creds, sstring host, config cfg)
+        : client(std::make_unique<tls_connection_factory>(std::move(addr), std::move(creds), host), std::move(host), cfg) {
+}
+
+client::client(std::unique_ptr<connection_factory> f, sstring host, config cfg)
+        : _new_connections(std::move(f)), _host(std::move(host)), _cfg(cfg) {
+}
+
+client::~client() = default;
+
+future<lw_shared_ptr<connection>> client::get_connection(abort_source* as) {
+    if (as && as->abort_requested()) {
+        return make_exception_future<lw_shared_ptr<connection>>(abort_requested_exception());
+    }
+    lw_shared_ptr<connection> best;
+    for (auto& con : _connections) {
+        if (con->persistent() && (!best || con->in_flight() < best->in_flight())) {
+            best = con;
+        }
+    }
+    if (best && best->in_flight() == 0) {
+        ++best->_in_flight;
+        return make_ready_future<lw_shared_ptr<connection>>(std::move(best));
+    }
+    if (_nr_connections < _cfg.max_connections) {
+        ++_nr_connections;
+        return _new_connections->make().then_wrapped([this] (future<connected_socket> f) {
+            if (f.failed()) {
+                --_nr_connections;
+                _wait_con.signal();
+                return make_exception_future<lw_shared_ptr<connection>>(f.get_exception());
+            }
+            auto con = make_lw_shared<connection>(f.get0());
+            ++con->_in_flight;
+            _connections.push_back(con);
+            return make_ready_future<lw_shared_ptr<connection>>(std::move(con));
+        });
+    }
+    if (best && best->in_flight() < _cfg.max_pipeline_depth) {
+        ++best->_in_flight;
+        return make_ready_future<lw_shared_ptr<connection>>(std::move(best));
+    }
+    auto sub = as ? as->subscribe([this] () noexcept { _wait_con.broadcast(); }) : optimized_optional<abort_source::subscription>();
+    return _wait_con.wait().then([this, as, sub = std::move(sub)] {
+        return get_connection(as);
+    });
+}
+
+future<> client::put_connection(lw_shared_ptr<connection> con) {
+    if (con->persistent() || con->in_flight()) {
+        _wait_con.signal();
+        return make_ready_future<>();
+    }
+    _connections.erase(std::remove(_connections.begin(), _connections.end(), con), _connections.end());
+    --_nr_connections;
+    _wait_con.signal();
+    return con->close().finally([con] {});
+}
+
+future<> client::make_request(request req, reply_handler handle, std::optional<reply::status_type> expected, abort_source* as) {
+    if (req.get_header("Host").empty() && !_host.empty()) {
+        req._headers["Host"] = _host;
+    }
+    add_trace_header(req);
+    return with_gate(_gate, [this, req = std::move(req), handle = std::move(handle), expected, as] () mutable {
+        return get_connection(as).then([this, req = std::move(req), handle = std::move(handle), expected, as] (lw_shared_ptr<connection> con) mutable {
+            return con->do_make_request(std::move(req), std::move(handle), expected, as).finally([this, con] {
+                return put_connection(con);
+            });
+        });
+    });
+}
+
+future<> client::close() {
+    return _gate.close().then([this] {
+        return parallel_for_each(_connections, [] (lw_shared_ptr<connection> con) {
+            return con->close().finally([con] {});
+        });
+    }).then([this] {
+        _connections.clear();
+        _nr_connections = 0;
+    });
+}
+
+} // namespace experimental
+
+} // namespace http
+
+}
@@ -50,6 +50,21 @@ operation_type str2type(const sstring& type) {
     return GET;
 }
 
+sstring type2str(operation_type type) {
+    switch (type) {
+    case GET: return "GET";
+    case POST: return "POST";
+    case PUT: return "PUT";
+    case DELETE: return "DELETE";
+    case HEAD: return "HEAD";
+    case OPTIONS: return "OPTIONS";
+    case TRACE: return "TRACE";
+    case CONNECT: return "CONNECT";
+    case NUM_OPERATION: break;
+    }
+    return "GET";
+}
+
 }
 
 }
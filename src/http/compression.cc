@@ -0,0 +1,308 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/http/compression.hh>
+#include <seastar/http/reply.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/print.hh>
+#include <seastar/core/with_scheduling_group.hh>
+#include <zlib.h>
+#include <zstd.h>
+
+namespace seastar {
+
+namespace httpd {
+
+std::string_view to_string(content_encoding e) noexcept {
+    switch (e) {
+    case content_encoding::identity: return "identity";
+    case content_encoding::gzip: return "gzip";
+    case content_encoding::deflate: return "deflate";
+    case content_encoding::zstd: return "zstd";
+    }
+    return "identity";
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// The q-value of a coding in Accept-Encoding, scaled to 0..1000, or -1 if
+// it is not mentioned. The wildcard applies to what is not mentioned.
+static int accepted_quality(std::string_view accept_encoding, std::string_view coding) {
+    int wildcard = -1;
+    while (!accept_encoding.empty()) {
+        auto comma = accept_encoding.find(',');
+        auto item = accept_encoding.substr(0, comma);
+        accept_encoding.remove_prefix(comma == std::string_view::npos ? accept_encoding.size() : comma + 1);
+
+        auto semicolon = item.find(';');
+        auto name = trim(item.substr(0, semicolon));
+        int q = 1000;
+        if (semicolon != std::string_view::npos) {
+            auto param = trim(item.substr(semicolon + 1));
+            if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                // qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+                auto value = param.substr(2);
+                q = 0;
+                int scale = 1000;
+                for (auto c : value) {
+                    if (c >= '0' && c <= '9') {
+                        q += (c - '0') * scale;
+                        scale /= 10;
+                    } else if (c != '.') {
+                        break;
+                    }
+                }
+                q = std::min(q, 1000);
+            }
+        }
+        if (ascii_iequals(name, coding)) {
+            return q;
+        }
+        if (name == "*") {
+            wildcard = q;
+        }
+    }
+    return wildcard;
+}
+
+content_encoding negotiate_content_encoding(std::string_view accept_encoding,
+        const std::vector<content_encoding>& supported) {
+    auto best = content_encoding::identity;
+    int best_q = 0;
+    for (auto e : supported) {
+        auto q = accepted_quality(accept_encoding, to_string(e));
+        if (q > best_q) {
+            best = e;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+namespace {
+
+// Compresses a stream of data incrementally
+class stream_compressor {
+public:
+    enum class mode { none, flush, finish };
+
+    virtual ~stream_compressor() = default;
+    // Compresses in, and appends the output produced to out
+    virtual void compress(std::string_view in, mode m, std::vector<temporary_buffer<char>>& out) = 0;
+};
+
+constexpr size_t compressed_buffer_size = 8192;
+
+class zlib_compressor final : public stream_compressor {
+    z_stream _zs = {};
+public:
+    explicit zlib_compressor(content_encoding e) {
+        // Adding 16 to the window bits makes a gzip wrapper rather than
+        // a zlib one, the latter being what HTTP calls deflate
+        int window_bits = e == content_encoding::gzip ? 15 + 16 : 15;
+        if (deflateInit2(&_zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::bad_alloc();
+        }
+    }
+    ~zlib_compressor() {
+        deflateEnd(&_zs);
+    }
+    virtual void compress(std::string_view in, mode m, std::vector<temporary_buffer<char>>& out) override {
+        _zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        _zs.avail_in = in.size();
+        int flush = m == mode::finish ? Z_FINISH : m == mode::flush ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        for (;;) {
+            temporary_buffer<char> buf(compressed_buffer_size);
+            _zs.next_out = reinterpret_cast<Bytef*>(buf.get_write());
+            _zs.avail_out = buf.size();
+            auto ret = deflate(&_zs, flush);
+            if (ret == Z_STREAM_ERROR) {
+                throw std::runtime_error("HTTP reply deflate failure");
+            }
+            buf.trim(buf.size() - _zs.avail_out);
+            if (!buf.empty()) {
+                out.push_back(std::move(buf));
+            }
+            // deflate() is done with the input, and with flushing or finishing,
+            // once it leaves some of the output unused
+            if (_zs.avail_out != 0) {
+                return;
+            }
+        }
+    }
+};
+
+class zstd_compressor final : public stream_compressor {
+    ZSTD_CCtx* _cctx;
+
+    static size_t check(size_t ret) {
+        if (ZSTD_isError(ret)) {
+            throw std::runtime_error(format("HTTP reply ZSTD compression failure: {}", ZSTD_getErrorName(ret)));
+        }
+        return ret;
+    }
+public:
+    zstd_compressor() : _cctx(ZSTD_createCCtx()) {
+        if (!_cctx) {
+            throw std::bad_alloc();
+        }
+    }
+    ~zstd_compressor() {
+        ZSTD_freeCCtx(_cctx);
+    }
+    virtual void compress(std::string_view in, mode m, std::vector<temporary_buffer<char>>& out) override {
+        ZSTD_inBuffer input = { in.data(), in.size(), 0 };
+        auto directive = m == mode::finish ? ZSTD_e_end : m == mode::flush ? ZSTD_e_flush : ZSTD_e_continue;
+        for (;;) {
+            temporary_buffer<char> buf(compressed_buffer_size);
+            ZSTD_outBuffer output = { buf.get_write(), buf.size(), 0 };
+            auto remaining = check(ZSTD_compressStream2(_cctx, &output, &input, directive));
+            buf.trim(output.pos);
+            if (!buf.empty()) {
+                out.push_back(std::move(buf));
+            }
+            if (directive == ZSTD_e_continue ? input.pos == input.size : remaining == 0) {
+                return;
+            }
+        }
+    }
+};
+
+std::unique_ptr<stream_compressor> make_compressor(content_encoding e) {
+    switch (e) {
+    case content_encoding::gzip:
+    case content_encoding::deflate:
+        return std::make_unique<zlib_compressor>(e);
+    case content_encoding::zstd:
+        return std::make_unique<zstd_compressor>();
+    case content_encoding::identity:
+        break;
+    }
+    throw std::invalid_argument("No compressor for the identity content coding");
+}
+
+class compressing_data_sink_impl final : public data_sink_impl {
+    output_stream<char> _out;
+    std::unique_ptr<stream_compressor> _compressor;
+    scheduling_group _sg;
+    size_t _buffer_size;
+
+    future<> compress(temporary_buffer<char> buf, stream_compressor::mode m) {
+        return with_scheduling_group(_sg, [this, buf = std::move(buf), m] {
+            std::vector<temporary_buffer<char>> out;
+            _compressor->compress(std::string_view(buf.get(), buf.size()), m, out);
+            return out;
+        }).then([this] (std::vector<temporary_buffer<char>> out) {
+            return do_with(std::move(out), [this] (std::vector<temporary_buffer<char>>& out) {
+                return do_for_each(out, [this] (temporary_buffer<char>& buf) {
+                    return _out.write(std::move(buf));
+                });
+            });
+        });
+    }
+public:
+    compressing_data_sink_impl(output_stream<char>&& out, content_encoding e, scheduling_group sg, size_t buffer_size)
+            : _out(std::move(out)), _compressor(make_compressor(e)), _sg(sg), _buffer_size(buffer_size) {
+    }
+    virtual future<> put(net::packet data) override {
+        return do_with(data.release(), [this] (std::vector<temporary_buffer<char>>& bufs) {
+            return do_for_each(bufs, [this] (temporary_buffer<char>& buf) {
+                return put(std::move(buf));
+            });
+        });
+    }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        if (buf.size() <= _buffer_size) {
+            return compress(std::move(buf), stream_compressor::mode::none);
+        }
+        // Large buffers written as they are, are compressed a piece at a time
+        return do_with(std::move(buf), [this] (temporary_buffer<char>& buf) {
+            return repeat([this, &buf] {
+                auto piece = buf.share(0, std::min(buf.size(), _buffer_size));
+                buf.trim_front(piece.size());
+                return compress(std::move(piece), stream_compressor::mode::none).then([&buf] {
+                    return stop_iteration(buf.empty());
+                });
+            });
+        });
+    }
+    virtual future<> flush() override {
+        return compress(temporary_buffer<char>(), stream_compressor::mode::flush).then([this] {
+            return _out.flush();
+        });
+    }
+    virtual future<> close() override {
+        return compress(temporary_buffer<char>(), stream_compressor::mode::finish).finally([this] {
+            return _out.close();
+        });
+    }
+    virtual size_t buffer_size() const noexcept override {
+        return _buffer_size;
+    }
+};
+
+}
+
+output_stream<char> make_compressing_output_stream(output_stream<char>&& out,
+        content_encoding encoding, scheduling_group sg, size_t buffer_size) {
+    output_stream_options opts;
+    opts.trim_to_size = true;
+    return output_stream<char>(data_sink(std::make_unique<compressing_data_sink_impl>(std::move(out), encoding, sg, buffer_size)),
+            buffer_size, opts);
+}
+
+void compress_reply(reply& rep, content_encoding encoding, scheduling_group sg) {
+    rep._headers["Content-Encoding"] = sstring(to_string(encoding));
+    auto vary = rep._headers.find("Vary");
+    if (vary == rep._headers.end()) {
+        rep._headers["Vary"] = "Accept-Encoding";
+    } else if (vary->second != "*" && vary->second.find("Accept-Encoding") == sstring::npos) {
+        vary->second += ", Accept-Encoding";
+    }
+    rep._body_length = std::nullopt;
+    if (rep._body_writer) {
+        rep._body_writer = [writer = std::move(rep._body_writer), encoding, sg] (output_stream<char>&& out) mutable {
+            return writer(make_compressing_output_stream(std::move(out), encoding, sg));
+        };
+        return;
+    }
+    rep._body_writer = [content = std::exchange(rep._content, {}), encoding, sg] (output_stream<char>&& out) mutable {
+        return do_with(make_compressing_output_stream(std::move(out), encoding, sg), std::move(content),
+                [] (output_stream<char>& os, sstring& content) {
+            return os.write(content).then([&os] {
+                return os.close();
+            });
+        });
+    };
+}
+
+}
+
+}
@@ -27,12 +27,73 @@
 #include <seastar/core/fstream.hh>
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/core/app-template.hh>
+#include <seastar/core/loop.hh>
 #include <seastar/http/exception.hh>
+#include <list>
+#include <unordered_map>
 
 namespace seastar {
 
 namespace httpd {
 
+/*
+ * Small files by path, with the time they were modified at when read.
+ * A file that was modified since is read again.
+ */
+class file_interaction_handler::content_cache {
+    struct entry {
+        temporary_buffer<char> content;
+        std::chrono::system_clock::time_point modified;
+        std::list<sstring>::iterator lru;
+    };
+    size_t _max_file_size;
+    size_t _max_total_size;
+    size_t _total_size = 0;
+    std::unordered_map<sstring, entry> _entries;
+    // most recently used first
+    std::list<sstring> _lru;
+
+    void erase(std::unordered_map<sstring, entry>::iterator i) {
+        _total_size -= i->second.content.size();
+        _lru.erase(i->second.lru);
+        _entries.erase(i);
+    }
+public:
+    content_cache(size_t max_file_size, size_t max_total_size)
+            : _max_file_size(std::min(max_file_size, max_total_size)), _max_total_size(max_total_size) {
+    }
+
+    bool fits(const stat_data& st) const {
+        return st.size <= _max_file_size;
+    }
+
+    std::optional<temporary_buffer<char>> get(const sstring& name, const stat_data& st) {
+        auto i = _entries.find(name);
+        if (i == _entries.end()) {
+            return std::nullopt;
+        }
+        if (i->second.modified != st.time_modified || i->second.content.size() != st.size) {
+            erase(i);
+            return std::nullopt;
+        }
+        _lru.splice(_lru.begin(), _lru, i->second.lru);
+        return i->second.content.share();
+    }
+
+    void put(const sstring& name, const stat_data& st, temporary_buffer<char> content) {
+        auto i = _entries.find(name);
+        if (i != _entries.end()) {
+            erase(i);
+        }
+        while (_total_size + content.size() > _max_total_size) {
+            erase(_entries.find(_lru.back()));
+        }
+        _lru.push_front(name);
+        _total_size += content.size();
+        _entries.emplace(name, entry{std::move(content), st.time_modified, _lru.begin()});
+    }
+};
+
 directory_handler::directory_handler(const sstring& doc_root,
         file_transformer* transformer)
         : file_interaction_handler(transformer), doc_root(doc_root) {
@@ -59,10 +120,24 @@ future<std::unique_ptr<reply>> directory_handler::handle(const sstring& path,
             });
 }
 
+file_interaction_handler::file_interaction_handler(file_transformer* p)
+        : transformer(p) {
+}
+
 file_interaction_handler::~file_interaction_handler() {
     delete transformer;
 }
 
+file_interaction_handler* file_interaction_handler::set_cache(size_t max_file_size, size_t max_total_size) {
+    _cache = std::make_unique<content_cache>(max_file_size, max_total_size);
+    return this;
+}
+
+file_interaction_handler* file_interaction_handler::set_precompressed(std::vector<content_encoding> encodings) {
+    _precompressed = std::move(encodings);
+    return this;
+}
+
 sstring file_interaction_handler::get_extension(const sstring& file) {
     size_t last_slash_pos = file.find_last_of('/');
     size_t last_dot_pos = file.find_last_of('.');
@@ -83,25 +158,149 @@ output_stream<char> file_interaction_handler::get_stream(std::unique_ptr<request
     return std::move(s);
 }
 
+void file_interaction_handler::write_content(temporary_buffer<char> content, std::unique_ptr<request> req,
+        const sstring& extension, reply& rep) {
+    if (transformer) {
+        rep.write_body(extension, [req = std::move(req), extension, content = std::move(content), this] (output_stream<char>&& s) mutable {
+            return do_with(output_stream<char>(get_stream(std::move(req), extension, std::move(s))), std::move(content),
+                    [] (output_stream<char>& os, temporary_buffer<char>& content) {
+                return os.write(content.get(), content.size()).then([&os] {
+                    return os.close();
+                });
+            });
+        });
+        return;
+    }
+    auto len = content.size();
+    rep.write_body(extension, len, [content = std::move(content)] (output_stream<char>&& s) mutable {
+        return do_with(std::move(s), [content = std::move(content)] (output_stream<char>& os) mutable {
+            return os.write(std::move(content)).then([&os] {
+                return os.close();
+            });
+        });
+    });
+}
+
 future<std::unique_ptr<reply>> file_interaction_handler::read(
         sstring file_name, std::unique_ptr<request> req,
         std::unique_ptr<reply> rep) {
-    sstring extension = get_extension(file_name);
-    rep->write_body(extension, [req = std::move(req), extension, file_name, this] (output_stream<char>&& s) mutable {
-        return do_with(output_stream<char>(get_stream(std::move(req), extension, std::move(s))),
-                [file_name] (output_stream<char>& os) {
-            return open_file_dma(file_name, open_flags::ro).then([&os] (file f) {
-                return do_with(input_stream<char>(make_file_input_stream(std::move(f))), [&os](input_stream<char>& is) {
-                    return copy(is, os).then([&os] {
-                        return os.close();
-                    }).then([&is] {
-                        return is.close();
+    if (_precompressed.empty() || transformer) {
+        auto extension = get_extension(file_name);
+        return read_file(std::move(file_name), std::move(extension), std::move(req), std::move(rep));
+    }
+    // The reply depends on the Accept-Encoding of the request, whether it
+    // turns out to be compressed or not
+    rep->add_header("Vary", "Accept-Encoding");
+    auto accept_encoding = req->get_header("Accept-Encoding");
+    return read_precompressed(std::move(file_name), std::move(accept_encoding), _precompressed, std::move(req), std::move(rep));
+}
+
+static const char* precompressed_suffix(content_encoding e) {
+    switch (e) {
+    case content_encoding::gzip: return ".gz";
+    case content_encoding::zstd: return ".zst";
+    default: return nullptr;
+    }
+}
+
+future<std::unique_ptr<reply>> file_interaction_handler::read_precompressed(sstring file_name, sstring accept_encoding,
+        std::vector<content_encoding> encodings, std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    auto encoding = negotiate_content_encoding(accept_encoding, encodings);
+    if (encoding == content_encoding::identity) {
+        auto extension = get_extension(file_name);
+        return read_file(std::move(file_name), std::move(extension), std::move(req), std::move(rep));
+    }
+    // Falls back to the next best coding when there is no such variant
+    encodings.erase(std::find(encodings.begin(), encodings.end(), encoding));
+    auto suffix = precompressed_suffix(encoding);
+    if (!suffix) {
+        return read_precompressed(std::move(file_name), std::move(accept_encoding), std::move(encodings), std::move(req), std::move(rep));
+    }
+    sstring variant = file_name + suffix;
+    return file_type(variant).then([this, file_name = std::move(file_name), variant, encoding, accept_encoding = std::move(accept_encoding),
+            encodings = std::move(encodings), req = std::move(req), rep = std::move(rep)] (std::optional<directory_entry_type> type) mutable {
+        if (type != directory_entry_type::regular) {
+            return read_precompressed(std::move(file_name), std::move(accept_encoding), std::move(encodings), std::move(req), std::move(rep));
+        }
+        rep->add_header("Content-Encoding", sstring(to_string(encoding)));
+        return read_file(std::move(variant), get_extension(file_name), std::move(req), std::move(rep));
+    });
+}
+
+future<std::unique_ptr<reply>> file_interaction_handler::read_file(sstring file_name, sstring extension,
+        std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    return file_stat(file_name).then_wrapped([file_name, extension = std::move(extension), req = std::move(req), rep = std::move(rep), this] (future<stat_data> f) mutable {
+        stat_data st;
+        try {
+            st = f.get0();
+        } catch (const std::system_error& e) {
+            if (e.code().value() != ENOENT) {
+                throw;
+            }
+            rep->set_status(reply::status_type::not_found).done();
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        }
+        if (_cache) {
+            if (auto content = _cache->get(file_name, st)) {
+                write_content(std::move(*content), std::move(req), extension, *rep);
+                return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+            }
+            if (_cache->fits(st)) {
+                return with_file(open_file_dma(file_name, open_flags::ro), [size = st.size] (file& f) {
+                    return f.dma_read_bulk<char>(0, size);
+                }).then([file_name, st, extension, req = std::move(req), rep = std::move(rep), this] (temporary_buffer<char> content) mutable {
+                    // The file may have changed since it was stat'ed, only the
+                    // next request can tell
+                    if (content.size() == st.size) {
+                        _cache->put(file_name, st, content.share());
+                    }
+                    write_content(std::move(content), std::move(req), extension, *rep);
+                    return std::move(rep);
+                });
+            }
+        }
+        if (transformer) {
+            rep->write_body(extension, [req = std::move(req), extension, file_name, this] (output_stream<char>&& s) mutable {
+                return do_with(output_stream<char>(get_stream(std::move(req), extension, std::move(s))),
+                        [file_name] (output_stream<char>& os) {
+                    return open_file_dma(file_name, open_flags::ro).then([&os] (file f) {
+                        return do_with(input_stream<char>(make_file_input_stream(std::move(f))), [&os](input_stream<char>& is) {
+                            return copy(is, os).then([&os] {
+                                return os.close();
+                            }).then([&is] {
+                                return is.close();
+                            });
+                        });
+                    });
+                });
+            });
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        }
+        rep->write_body(extension, st.size, [file_name, size = st.size] (output_stream<char>&& s) {
+            return do_with(std::move(s), [file_name, size] (output_stream<char>& os) {
+                return open_file_dma(file_name, open_flags::ro).then([&os, size] (file f) {
+                    return do_with(input_stream<char>(make_file_input_stream(std::move(f), 0, size)), [&os](input_stream<char>& is) {
+                        // Pass the read buffers on as they are, unlike copy()
+                        return repeat([&is, &os] {
+                            return is.read().then([&os] (temporary_buffer<char> buf) {
+                                if (buf.empty()) {
+                                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                                }
+                                return os.write(std::move(buf)).then([] {
+                                    return stop_iteration::no;
+                                });
+                            });
+                        }).then([&os] {
+                            return os.close();
+                        }).then([&is] {
+                            return is.close();
+                        });
                     });
                 });
             });
         });
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
     });
-    return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
 }
 
 bool file_interaction_handler::redirect_if_needed(const request& req,
@@ -0,0 +1,390 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/http/internal/hpack.hh>
+
+#include <array>
+#include <cstdint>
+
+namespace seastar {
+
+namespace httpd {
+
+namespace internal {
+
+namespace {
+
+// RFC 7541, Appendix A
+constexpr std::pair<std::string_view, std::string_view> static_table[] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+constexpr size_t static_table_size = std::size(static_table);
+
+// RFC 7541, Appendix B. The code is canonical, so the lengths are enough
+// to derive the codes: they are assigned in increasing order of length,
+// then of symbol.
+constexpr uint8_t huffman_code_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+constexpr unsigned huffman_eos = 256;
+constexpr unsigned huffman_max_length = 30;
+
+struct huffman_code {
+    // codes[symbol], right aligned
+    std::array<uint32_t, 257> codes{};
+    // The first code and number of codes of each length, and the symbols
+    // ordered by code
+    std::array<uint32_t, huffman_max_length + 1> first{};
+    std::array<uint32_t, huffman_max_length + 1> count{};
+    std::array<uint16_t, huffman_max_length + 1> offset{};
+    std::array<uint16_t, 257> symbols{};
+};
+
+constexpr huffman_code make_huffman_code() {
+    huffman_code h;
+    for (auto len : huffman_code_lengths) {
+        h.count[len]++;
+    }
+    uint32_t code = 0;
+    uint16_t offset = 0;
+    for (unsigned len = 1; len <= huffman_max_length; ++len) {
+        code <<= 1;
+        h.first[len] = code;
+        h.offset[len] = offset;
+        code += h.count[len];
+        offset += h.count[len];
+    }
+    std::array<uint16_t, huffman_max_length + 1> next{};
+    for (unsigned sym = 0; sym < 257; ++sym) {
+        auto len = huffman_code_lengths[sym];
+        auto i = next[len]++;
+        h.codes[sym] = h.first[len] + i;
+        h.symbols[h.offset[len] + i] = sym;
+    }
+    return h;
+}
+
+constexpr huffman_code huffman = make_huffman_code();
+
+// A complete code ends with EOS as the all ones code of the longest length
+static_assert(huffman.codes[huffman_eos] == (1u << huffman_max_length) - 1);
+static_assert(huffman.codes['a'] == 0x3 && huffman.codes[0] == 0x1ff8);
+
+// Integer representation, RFC 7541, section 5.1
+void encode_integer(std::string& out, uint8_t first_byte, unsigned prefix_bits, size_t value) {
+    const size_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out.push_back(char(first_byte | value));
+        return;
+    }
+    out.push_back(char(first_byte | max_prefix));
+    value -= max_prefix;
+    while (value >= 128) {
+        out.push_back(char(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+size_t decode_integer(std::string_view& in, unsigned prefix_bits) {
+    const size_t max_prefix = (1u << prefix_bits) - 1;
+    size_t value = uint8_t(in.front()) & max_prefix;
+    in.remove_prefix(1);
+    if (value < max_prefix) {
+        return value;
+    }
+    for (unsigned shift = 0; ; shift += 7) {
+        // Nothing legitimate comes close to 2^28
+        if (in.empty() || shift > 21) {
+            throw hpack_error("Bad HPACK integer");
+        }
+        auto b = uint8_t(in.front());
+        in.remove_prefix(1);
+        value += size_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+}
+
+// String literal, RFC 7541, section 5.2
+void encode_string(std::string& out, std::string_view s) {
+    size_t huffman_bits = 0;
+    for (auto c : s) {
+        huffman_bits += huffman_code_lengths[uint8_t(c)];
+    }
+    size_t huffman_size = (huffman_bits + 7) / 8;
+    if (huffman_size < s.size()) {
+        encode_integer(out, 0x80, 7, huffman_size);
+        huffman_encode(out, s);
+    } else {
+        encode_integer(out, 0, 7, s.size());
+        out.append(s);
+    }
+}
+
+sstring decode_string(std::string_view& in) {
+    if (in.empty()) {
+        throw hpack_error("Truncated HPACK string");
+    }
+    bool is_huffman = uint8_t(in.front()) & 0x80;
+    auto size = decode_integer(in, 7);
+    if (size > in.size()) {
+        throw hpack_error("Truncated HPACK string");
+    }
+    auto s = in.substr(0, size);
+    in.remove_prefix(size);
+    return is_huffman ? huffman_decode(s) : sstring(s.data(), s.size());
+}
+
+constexpr size_t entry_overhead = 32;
+
+}
+
+void huffman_encode(std::string& out, std::string_view in) {
+    uint64_t bits = 0;
+    unsigned nr_bits = 0;
+    for (auto c : in) {
+        auto len = huffman_code_lengths[uint8_t(c)];
+        bits = (bits << len) | huffman.codes[uint8_t(c)];
+        nr_bits += len;
+        while (nr_bits >= 8) {
+            nr_bits -= 8;
+            out.push_back(char(bits >> nr_bits));
+        }
+    }
+    if (nr_bits) {
+        // Padded with the most significant bits of EOS
+        out.push_back(char((bits << (8 - nr_bits)) | (0xff >> nr_bits)));
+    }
+}
+
+sstring huffman_decode(std::string_view in) {
+    std::string out;
+    out.reserve(in.size() * 8 / 5);
+    uint32_t code = 0;
+    unsigned len = 0;
+    for (auto c : in) {
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((uint8_t(c) >> bit) & 1);
+            ++len;
+            auto i = code - huffman.first[len];
+            if (i < huffman.count[len]) {
+                auto sym = huffman.symbols[huffman.offset[len] + i];
+                if (sym == huffman_eos) {
+                    throw hpack_error("EOS in Huffman encoded string");
+                }
+                out.push_back(char(sym));
+                code = 0;
+                len = 0;
+            } else if (len == huffman_max_length) {
+                throw hpack_error("Bad Huffman code");
+            }
+        }
+    }
+    // Padding is shorter than a byte, and a prefix of EOS
+    if (len > 7 || code != (1u << len) - 1) {
+        throw hpack_error("Bad Huffman padding");
+    }
+    return sstring(out.data(), out.size());
+}
+
+hpack_decoder::hpack_decoder(size_t table_size_limit)
+        : _max_table_size(table_size_limit)
+        , _table_size_limit(table_size_limit) {
+}
+
+const std::pair<sstring, sstring>& hpack_decoder::lookup(size_t index) const {
+    if (index == 0 || index - static_table_size - 1 >= _table.size()) {
+        throw hpack_error("Bad HPACK table index");
+    }
+    return _table[index - static_table_size - 1];
+}
+
+void hpack_decoder::evict(size_t max_size) {
+    while (_table_size > max_size) {
+        auto& e = _table.back();
+        _table_size -= e.first.size() + e.second.size() + entry_overhead;
+        _table.pop_back();
+    }
+}
+
+void hpack_decoder::insert(sstring name, sstring value) {
+    auto size = name.size() + value.size() + entry_overhead;
+    // An entry larger than the table empties it, and is not inserted
+    evict(size <= _max_table_size ? _max_table_size - size : 0);
+    if (size <= _max_table_size) {
+        _table.emplace_front(std::move(name), std::move(value));
+        _table_size += size;
+    }
+}
+
+header_list hpack_decoder::decode(std::string_view in) {
+    header_list headers;
+    auto field = [&] (size_t index) -> std::pair<sstring, sstring> {
+        if (index >= 1 && index <= static_table_size) {
+            auto& e = static_table[index - 1];
+            return { sstring(e.first.data(), e.first.size()), sstring(e.second.data(), e.second.size()) };
+        }
+        return lookup(index);
+    };
+    auto literal = [&] (unsigned prefix_bits) {
+        auto index = decode_integer(in, prefix_bits);
+        auto name = index ? field(index).first : decode_string(in);
+        auto value = decode_string(in);
+        return std::make_pair(std::move(name), std::move(value));
+    };
+    while (!in.empty()) {
+        auto b = uint8_t(in.front());
+        if (b & 0x80) {
+            // Indexed header field, section 6.1
+            headers.push_back(field(decode_integer(in, 7)));
+        } else if (b & 0x40) {
+            // Literal with incremental indexing, section 6.2.1
+            auto f = literal(6);
+            insert(f.first, f.second);
+            headers.push_back(std::move(f));
+        } else if (b & 0x20) {
+            // Dynamic table size update, section 6.3, only allowed at the
+            // start of a block
+            if (!headers.empty()) {
+                throw hpack_error("HPACK table size update after a header field");
+            }
+            auto size = decode_integer(in, 5);
+            if (size > _table_size_limit) {
+                throw hpack_error("HPACK table size update above the limit");
+            }
+            _max_table_size = size;
+            evict(size);
+        } else {
+            // Literal without indexing or never indexed, sections 6.2.2
+            // and 6.2.3
+            headers.push_back(literal(4));
+        }
+    }
+    return headers;
+}
+
+void hpack_encoder::encode(std::string& block, std::string_view name, std::string_view value) const {
+    size_t name_index = 0;
+    for (size_t i = 0; i < static_table_size; ++i) {
+        if (static_table[i].first != name) {
+            continue;
+        }
+        if (static_table[i].second == value) {
+            encode_integer(block, 0x80, 7, i + 1);
+            return;
+        }
+        if (!name_index) {
+            name_index = i + 1;
+        }
+    }
+    // Literal without indexing, section 6.2.2
+    encode_integer(block, 0, 4, name_index);
+    if (!name_index) {
+        encode_string(block, name);
+    }
+    encode_string(block, value);
+}
+
+}
+
+}
+
+}
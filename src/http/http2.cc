@@ -0,0 +1,863 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/condition-variable.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/byteorder.hh>
+#include <seastar/net/packet-data-source.hh>
+#include <seastar/util/log.hh>
+#include <seastar/http/httpd.hh>
+#include <seastar/http/reply.hh>
+#include <seastar/http/internal/hpack.hh>
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+
+namespace seastar {
+
+extern logger hlogger;
+
+namespace httpd {
+
+// HTTP/2 framing and stream handling, see RFC 9113
+
+namespace {
+
+enum class frame_type : uint8_t {
+    data = 0x0,
+    headers = 0x1,
+    priority = 0x2,
+    rst_stream = 0x3,
+    settings = 0x4,
+    push_promise = 0x5,
+    ping = 0x6,
+    goaway = 0x7,
+    window_update = 0x8,
+    continuation = 0x9,
+};
+
+namespace frame_flags {
+constexpr uint8_t end_stream = 0x1;
+constexpr uint8_t ack = 0x1;
+constexpr uint8_t end_headers = 0x4;
+constexpr uint8_t padded = 0x8;
+constexpr uint8_t priority = 0x20;
+}
+
+enum class error_code : uint32_t {
+    no_error = 0x0,
+    protocol_error = 0x1,
+    internal_error = 0x2,
+    flow_control_error = 0x3,
+    stream_closed = 0x5,
+    frame_size_error = 0x6,
+    refused_stream = 0x7,
+    compression_error = 0x9,
+    enhance_your_calm = 0xb,
+};
+
+enum class setting : uint16_t {
+    header_table_size = 0x1,
+    enable_push = 0x2,
+    max_concurrent_streams = 0x3,
+    initial_window_size = 0x4,
+    max_frame_size = 0x5,
+    max_header_list_size = 0x6,
+};
+
+constexpr size_t frame_header_size = 9;
+constexpr uint32_t default_max_frame_size = 16384;
+constexpr uint32_t max_max_frame_size = (1 << 24) - 1;
+constexpr int64_t default_window_size = 65535;
+constexpr int64_t max_window_size = 0x7fffffff;
+// Advertised to clients, and enforced
+constexpr size_t max_concurrent_streams = 100;
+constexpr size_t max_header_block_size = 64 * 1024;
+
+// Tears the whole connection down with a GOAWAY frame
+class connection_error : public std::runtime_error {
+    error_code _code;
+public:
+    connection_error(error_code code, const char* msg) : std::runtime_error(msg), _code(code) {}
+    error_code code() const noexcept {
+        return _code;
+    }
+};
+
+class stream_reset_error : public std::runtime_error {
+public:
+    stream_reset_error() : std::runtime_error("HTTP/2 stream was reset") {}
+};
+
+// RFC 9113, section 8.2.2
+bool is_connection_specific(std::string_view name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+            || name == "transfer-encoding" || name == "upgrade";
+}
+
+sstring to_lower(const sstring& s) {
+    sstring ret(s);
+    std::transform(ret.begin(), ret.end(), ret.begin(), [] (char c) { return std::tolower(c); });
+    return ret;
+}
+
+}
+
+struct http2_stream {
+    const uint32_t id;
+    std::unique_ptr<request> req;
+    std::vector<temporary_buffer<char>> body;
+    size_t body_size = 0;
+    // Received since the last WINDOW_UPDATE
+    size_t unacknowledged = 0;
+    // END_STREAM was received, the request is complete
+    bool end_of_request = false;
+    // Either side reset the stream, nothing more may be sent on it
+    bool reset = false;
+    int64_t send_window;
+    input_stream<char> content_stream;
+    admission_permit permit;
+
+    http2_stream(uint32_t id, int64_t send_window) : id(id), send_window(send_window) {}
+};
+
+class http2_connection {
+    using stream_ptr = lw_shared_ptr<http2_stream>;
+
+    connection& _conn;
+    http_server& _server;
+    input_stream<char>& _in;
+    output_stream<char>& _out;
+    internal::hpack_decoder _decoder;
+    internal::hpack_encoder _encoder;
+    std::unordered_map<uint32_t, stream_ptr> _streams;
+    uint32_t _last_stream_id = 0;
+    // A header block being received over HEADERS and CONTINUATION frames
+    uint32_t _header_block_stream = 0;
+    bool _header_block_end_stream = false;
+    std::string _header_block;
+    // Connection level data received since the last WINDOW_UPDATE
+    size_t _unacknowledged = 0;
+    // Flow control of what we send, as set by the client
+    int64_t _send_window = default_window_size;
+    int64_t _initial_window_size = default_window_size;
+    uint32_t _max_frame_size = default_max_frame_size;
+    condition_variable _window_available;
+    // Frames are written whole, one at a time
+    semaphore _write_sem{1};
+    gate _requests_gate;
+
+    class data_sink_impl;
+public:
+    explicit http2_connection(connection& conn)
+            : _conn(conn)
+            , _server(conn._server)
+            , _in(conn._read_buf)
+            , _out(conn._write_buf) {
+    }
+
+    future<> serve();
+private:
+    future<> read_frames();
+    future<> handle_frame(frame_type type, uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload);
+    future<> handle_data(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload);
+    future<> handle_headers(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload);
+    future<> handle_continuation(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload);
+    future<> handle_header_block();
+    future<> handle_rst_stream(uint32_t stream_id, temporary_buffer<char> payload);
+    future<> handle_settings(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload);
+    future<> handle_ping(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload);
+    future<> handle_window_update(uint32_t stream_id, temporary_buffer<char> payload);
+
+    std::unique_ptr<request> make_request(internal::header_list headers);
+    void start_request(stream_ptr s);
+    void reject_request(stream_ptr s, reply::status_type status, sstring msg);
+    future<> handle_request(stream_ptr s);
+    future<> write_reply(stream_ptr s, std::unique_ptr<reply> rep);
+    future<> send_data(stream_ptr s, temporary_buffer<char> buf, bool end_stream);
+
+    void close_stream(stream_ptr s);
+    future<> reset_stream(stream_ptr s, error_code code);
+    future<> write_frame(frame_type type, uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload);
+    future<> write_headers(uint32_t stream_id, std::string block, bool end_stream);
+    future<> write_rst_stream(uint32_t stream_id, error_code code);
+    future<> write_window_update(uint32_t stream_id, uint32_t increment);
+    future<> write_settings();
+    future<> write_goaway(error_code code);
+};
+
+// Writes the body of a reply as DATA frames, within the flow control
+// windows of the stream and the connection
+class http2_connection::data_sink_impl : public seastar::data_sink_impl {
+    http2_connection& _conn;
+    stream_ptr _stream;
+public:
+    data_sink_impl(http2_connection& conn, stream_ptr s) : _conn(conn), _stream(std::move(s)) {}
+
+    virtual future<> put(net::packet data) override {
+        return do_with(data.release(), [this] (std::vector<temporary_buffer<char>>& bufs) {
+            return do_for_each(bufs, [this] (temporary_buffer<char>& buf) {
+                return _conn.send_data(_stream, std::move(buf), false);
+            });
+        });
+    }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        return _conn.send_data(_stream, std::move(buf), false);
+    }
+    virtual future<> close() override {
+        return _conn.send_data(_stream, temporary_buffer<char>(), true);
+    }
+    virtual size_t buffer_size() const noexcept override {
+        return default_max_frame_size;
+    }
+};
+
+future<> http2_connection::serve() {
+    return write_settings().then([this] {
+        return read_frames();
+    }).handle_exception_type([this] (const connection_error& e) {
+        hlogger.debug("HTTP/2 connection error: {}", e.what());
+        return write_goaway(e.code());
+    }).finally([this] {
+        // Nothing can be sent once the client stops reading
+        _window_available.broken();
+        return _requests_gate.close();
+    });
+}
+
+future<> http2_connection::read_frames() {
+    return repeat([this] {
+        return _in.read_exactly(frame_header_size).then([this] (temporary_buffer<char> header) {
+            if (header.size() != frame_header_size) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto p = header.get();
+            uint32_t length = (uint32_t(uint8_t(p[0])) << 16) | (uint32_t(uint8_t(p[1])) << 8) | uint8_t(p[2]);
+            auto type = frame_type(p[3]);
+            uint8_t flags = p[4];
+            uint32_t stream_id = read_be<uint32_t>(p + 5) & 0x7fffffff;
+            if (length > default_max_frame_size) {
+                throw connection_error(error_code::frame_size_error, "Frame larger than SETTINGS_MAX_FRAME_SIZE");
+            }
+            return _in.read_exactly(length).then([this, length, type, flags, stream_id] (temporary_buffer<char> payload) {
+                if (payload.size() != length) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return handle_frame(type, flags, stream_id, std::move(payload)).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    });
+}
+
+future<> http2_connection::handle_frame(frame_type type, uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload) {
+    // A header block may not be interleaved with any other frame
+    if (_header_block_stream && type != frame_type::continuation) {
+        throw connection_error(error_code::protocol_error, "Expected CONTINUATION frame");
+    }
+    switch (type) {
+    case frame_type::data:
+        return handle_data(flags, stream_id, std::move(payload));
+    case frame_type::headers:
+        return handle_headers(flags, stream_id, std::move(payload));
+    case frame_type::continuation:
+        return handle_continuation(flags, stream_id, std::move(payload));
+    case frame_type::priority:
+        // Priorities are advisory, and ignored
+        if (stream_id == 0) {
+            throw connection_error(error_code::protocol_error, "PRIORITY frame on stream 0");
+        }
+        return make_ready_future<>();
+    case frame_type::rst_stream:
+        return handle_rst_stream(stream_id, std::move(payload));
+    case frame_type::settings:
+        return handle_settings(flags, stream_id, std::move(payload));
+    case frame_type::push_promise:
+        throw connection_error(error_code::protocol_error, "PUSH_PROMISE frame from a client");
+    case frame_type::ping:
+        return handle_ping(flags, stream_id, std::move(payload));
+    case frame_type::goaway:
+        // The client opens no more streams, and closes the connection
+        // once it has the responses to those it opened
+        hlogger.debug("HTTP/2 GOAWAY received");
+        return make_ready_future<>();
+    case frame_type::window_update:
+        return handle_window_update(stream_id, std::move(payload));
+    }
+    // Unknown frame types are ignored, section 4.1
+    return make_ready_future<>();
+}
+
+// Strips the padding of DATA and HEADERS frames
+static void remove_padding(uint8_t flags, temporary_buffer<char>& payload) {
+    if (!(flags & frame_flags::padded)) {
+        return;
+    }
+    if (payload.empty() || uint8_t(payload[0]) >= payload.size()) {
+        throw connection_error(error_code::protocol_error, "Bad padding");
+    }
+    size_t padding = uint8_t(payload[0]);
+    payload.trim_front(1);
+    payload.trim(payload.size() - padding);
+}
+
+future<> http2_connection::handle_data(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload) {
+    if (stream_id == 0 || stream_id > _last_stream_id) {
+        throw connection_error(error_code::protocol_error, "DATA frame on an idle stream");
+    }
+    // Padding counts against flow control too
+    auto flow_controlled = payload.size();
+    remove_padding(flags, payload);
+
+    future<> f = make_ready_future<>();
+    _unacknowledged += flow_controlled;
+    if (_unacknowledged >= default_window_size / 2) {
+        f = write_window_update(0, std::exchange(_unacknowledged, 0));
+    }
+    auto it = _streams.find(stream_id);
+    if (it == _streams.end() || it->second->end_of_request) {
+        if (it != _streams.end()) {
+            return f.then([this, s = it->second] {
+                return reset_stream(s, error_code::stream_closed);
+            });
+        }
+        return f.then([this, stream_id] {
+            return write_rst_stream(stream_id, error_code::stream_closed);
+        });
+    }
+    auto s = it->second;
+    s->body_size += payload.size();
+    if (s->body_size > _server.get_content_length_limit()) {
+        reject_request(s, reply::status_type::payload_too_large,
+                format("Content length limit ({}) exceeded: {}", _server.get_content_length_limit(), s->body_size));
+        return f;
+    }
+    if (!payload.empty()) {
+        s->body.push_back(std::move(payload));
+    }
+    if (flags & frame_flags::end_stream) {
+        start_request(s);
+        return f;
+    }
+    s->unacknowledged += flow_controlled;
+    if (s->unacknowledged >= default_window_size / 2) {
+        return f.then([this, s] {
+            return write_window_update(s->id, std::exchange(s->unacknowledged, 0));
+        });
+    }
+    return f;
+}
+
+future<> http2_connection::handle_headers(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload) {
+    if (stream_id == 0) {
+        throw connection_error(error_code::protocol_error, "HEADERS frame on stream 0");
+    }
+    remove_padding(flags, payload);
+    if (flags & frame_flags::priority) {
+        if (payload.size() < 5) {
+            throw connection_error(error_code::frame_size_error, "HEADERS frame too short for its priority");
+        }
+        payload.trim_front(5);
+    }
+    _header_block_stream = stream_id;
+    _header_block_end_stream = flags & frame_flags::end_stream;
+    _header_block.assign(payload.get(), payload.size());
+    if (flags & frame_flags::end_headers) {
+        return handle_header_block();
+    }
+    return make_ready_future<>();
+}
+
+future<> http2_connection::handle_continuation(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload) {
+    if (!_header_block_stream || stream_id != _header_block_stream) {
+        throw connection_error(error_code::protocol_error, "Unexpected CONTINUATION frame");
+    }
+    if (_header_block.size() + payload.size() > max_header_block_size) {
+        throw connection_error(error_code::enhance_your_calm, "Header block too large");
+    }
+    _header_block.append(payload.get(), payload.size());
+    if (flags & frame_flags::end_headers) {
+        return handle_header_block();
+    }
+    return make_ready_future<>();
+}
+
+future<> http2_connection::handle_header_block() {
+    auto stream_id = std::exchange(_header_block_stream, 0);
+    internal::header_list headers;
+    try {
+        // Always decoded, even for streams which are gone, to keep the
+        // dynamic table in sync with the client
+        headers = _decoder.decode(_header_block);
+    } catch (const internal::hpack_error& e) {
+        throw connection_error(error_code::compression_error, e.what());
+    }
+    _header_block.clear();
+
+    auto it = _streams.find(stream_id);
+    if (it != _streams.end()) {
+        // Trailers, which have to end the request
+        auto s = it->second;
+        if (s->end_of_request) {
+            return reset_stream(s, error_code::stream_closed);
+        }
+        if (!_header_block_end_stream) {
+            return reset_stream(s, error_code::protocol_error);
+        }
+        for (auto& h : headers) {
+            s->req->trailing_headers[std::move(h.first)] = std::move(h.second);
+        }
+        start_request(s);
+        return make_ready_future<>();
+    }
+    if (stream_id <= _last_stream_id) {
+        return write_rst_stream(stream_id, error_code::stream_closed);
+    }
+    if (stream_id % 2 == 0) {
+        throw connection_error(error_code::protocol_error, "Client opened an even numbered stream");
+    }
+    _last_stream_id = stream_id;
+    if (_streams.size() >= max_concurrent_streams) {
+        return write_rst_stream(stream_id, error_code::refused_stream);
+    }
+    auto req = make_request(std::move(headers));
+    if (!req) {
+        return write_rst_stream(stream_id, error_code::protocol_error);
+    }
+    auto s = make_lw_shared<http2_stream>(stream_id, _initial_window_size);
+    s->req = std::move(req);
+    _streams.emplace(stream_id, s);
+
+    auto content_length = s->req->get_header("Content-Length");
+    if (!content_length.empty()) {
+        s->req->content_length = strtol(content_length.c_str(), nullptr, 10);
+        if (s->req->content_length > _server.get_content_length_limit()) {
+            reject_request(s, reply::status_type::payload_too_large,
+                    format("Content length limit ({}) exceeded: {}", _server.get_content_length_limit(), s->req->content_length));
+            return make_ready_future<>();
+        }
+    }
+    auto permit = _server.admit(*s->req, _conn._over_connection_limit);
+    if (!permit) {
+        reject_request(s, reply::status_type::service_unavailable, "Server is overloaded");
+        return make_ready_future<>();
+    }
+    s->permit = std::move(*permit);
+    if (_header_block_end_stream) {
+        start_request(s);
+    }
+    return make_ready_future<>();
+}
+
+future<> http2_connection::handle_rst_stream(uint32_t stream_id, temporary_buffer<char> payload) {
+    if (stream_id == 0 || stream_id > _last_stream_id) {
+        throw connection_error(error_code::protocol_error, "RST_STREAM frame on an idle stream");
+    }
+    if (payload.size() != 4) {
+        throw connection_error(error_code::frame_size_error, "Bad RST_STREAM frame size");
+    }
+    auto it = _streams.find(stream_id);
+    if (it != _streams.end()) {
+        close_stream(it->second);
+    }
+    return make_ready_future<>();
+}
+
+future<> http2_connection::handle_settings(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload) {
+    if (stream_id != 0) {
+        throw connection_error(error_code::protocol_error, "SETTINGS frame on a stream");
+    }
+    if (flags & frame_flags::ack) {
+        if (!payload.empty()) {
+            throw connection_error(error_code::frame_size_error, "SETTINGS acknowledgement with a payload");
+        }
+        return make_ready_future<>();
+    }
+    if (payload.size() % 6) {
+        throw connection_error(error_code::frame_size_error, "Bad SETTINGS frame size");
+    }
+    for (auto p = payload.get(); p != payload.end(); p += 6) {
+        auto id = setting(read_be<uint16_t>(p));
+        auto value = read_be<uint32_t>(p + 2);
+        switch (id) {
+        case setting::initial_window_size:
+            if (value > max_window_size) {
+                throw connection_error(error_code::flow_control_error, "SETTINGS_INITIAL_WINDOW_SIZE too large");
+            }
+            // Applies to the open streams as well, section 6.9.2
+            for (auto& s : _streams) {
+                s.second->send_window += int64_t(value) - _initial_window_size;
+            }
+            _initial_window_size = value;
+            _window_available.broadcast();
+            break;
+        case setting::max_frame_size:
+            if (value < default_max_frame_size || value > max_max_frame_size) {
+                throw connection_error(error_code::protocol_error, "Bad SETTINGS_MAX_FRAME_SIZE");
+            }
+            _max_frame_size = value;
+            break;
+        default:
+            // The header table size does not matter since the encoder does
+            // not use the dynamic table, and the rest concern clients
+            break;
+        }
+    }
+    return write_frame(frame_type::settings, frame_flags::ack, 0, temporary_buffer<char>());
+}
+
+future<> http2_connection::handle_ping(uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload) {
+    if (stream_id != 0) {
+        throw connection_error(error_code::protocol_error, "PING frame on a stream");
+    }
+    if (payload.size() != 8) {
+        throw connection_error(error_code::frame_size_error, "Bad PING frame size");
+    }
+    if (flags & frame_flags::ack) {
+        return make_ready_future<>();
+    }
+    return write_frame(frame_type::ping, frame_flags::ack, 0, std::move(payload));
+}
+
+future<> http2_connection::handle_window_update(uint32_t stream_id, temporary_buffer<char> payload) {
+    if (payload.size() != 4) {
+        throw connection_error(error_code::frame_size_error, "Bad WINDOW_UPDATE frame size");
+    }
+    auto increment = read_be<uint32_t>(payload.get()) & 0x7fffffff;
+    if (stream_id == 0) {
+        if (increment == 0) {
+            throw connection_error(error_code::protocol_error, "Zero WINDOW_UPDATE increment");
+        }
+        _send_window += increment;
+        if (_send_window > max_window_size) {
+            throw connection_error(error_code::flow_control_error, "Connection window overflow");
+        }
+        _window_available.broadcast();
+        return make_ready_future<>();
+    }
+    if (stream_id > _last_stream_id) {
+        throw connection_error(error_code::protocol_error, "WINDOW_UPDATE frame on an idle stream");
+    }
+    auto it = _streams.find(stream_id);
+    if (it == _streams.end()) {
+        // The stream is done, and updates can race with that
+        return make_ready_future<>();
+    }
+    auto s = it->second;
+    if (increment == 0) {
+        return reset_stream(s, error_code::protocol_error);
+    }
+    s->send_window += increment;
+    if (s->send_window > max_window_size) {
+        return reset_stream(s, error_code::flow_control_error);
+    }
+    _window_available.broadcast();
+    return make_ready_future<>();
+}
+
+// Returns nullptr for malformed requests, section 8.1.1
+std::unique_ptr<request> http2_connection::make_request(internal::header_list headers) {
+    auto req = std::make_unique<request>();
+    req->_version = "2.0";
+    if (_server._credentials) {
+        req->protocol_name = "https";
+    }
+    sstring authority;
+    bool regular_seen = false;
+    for (auto& [name, value] : headers) {
+        if (name.empty() || std::any_of(name.begin(), name.end(), [] (char c) { return c >= 'A' && c <= 'Z'; })) {
+            return nullptr;
+        }
+        if (name[0] == ':') {
+            // Pseudo-header fields come first
+            if (regular_seen) {
+                return nullptr;
+            }
+            if (name == ":method") {
+                req->_method = std::move(value);
+            } else if (name == ":path") {
+                req->_url = std::move(value);
+            } else if (name == ":authority") {
+                authority = std::move(value);
+            } else if (name != ":scheme") {
+                return nullptr;
+            }
+            continue;
+        }
+        regular_seen = true;
+        if (is_connection_specific(name) || (name == "te" && value != "trailers")) {
+            return nullptr;
+        }
+        auto [it, inserted] = req->_headers.try_emplace(name, value);
+        if (!inserted) {
+            // Cookies may be split into several fields, section 8.2.3
+            it->second += sstring(name == "cookie" ? "; " : ",") + value;
+        }
+    }
+    if (req->_method.empty() || req->_url.empty()) {
+        return nullptr;
+    }
+    if (!authority.empty()) {
+        req->_headers.try_emplace("host", std::move(authority));
+    }
+    return req;
+}
+
+void http2_connection::start_request(stream_ptr s) {
+    s->end_of_request = true;
+    (void)with_gate(_requests_gate, [this, s] {
+        return handle_request(s);
+    });
+}
+
+// Replies without waiting for the rest of the request, and asks the
+// client to stop sending it, section 8.1
+void http2_connection::reject_request(stream_ptr s, reply::status_type status, sstring msg) {
+    _streams.erase(s->id);
+    auto rep = std::make_unique<reply>();
+    _conn.set_headers(*rep);
+    rep->set_status(status, std::move(msg));
+    (void)with_gate(_requests_gate, [this, s, rep = std::move(rep)] () mutable {
+        return write_reply(s, std::move(rep)).then([this, s] {
+            return write_rst_stream(s->id, error_code::no_error);
+        }).handle_exception([] (std::exception_ptr ep) {
+            hlogger.debug("HTTP/2 error reply failed: {}", ep);
+        });
+    });
+}
+
+future<> http2_connection::handle_request(stream_ptr s) {
+    auto req = std::move(s->req);
+    ++_server._requests_served;
+    req->content_length = s->body_size;
+    if (!_server.get_content_streaming()) {
+        req->content = uninitialized_string(s->body_size);
+        auto p = req->content.data();
+        for (auto& b : s->body) {
+            p = std::copy(b.begin(), b.end(), p);
+        }
+    }
+    net::packet body;
+    for (auto& b : s->body) {
+        body = net::packet(std::move(body), std::move(b));
+    }
+    s->body.clear();
+    s->content_stream = net::as_input_stream(std::move(body));
+    req->content_stream = &s->content_stream;
+
+    sstring url = connection::set_query_param(*req);
+    auto rep = std::make_unique<reply>();
+    _conn.set_headers(*rep);
+    rep->set_version(req->_version);
+    sstring accept_encoding = req->get_header("Accept-Encoding");
+    return _server._routes.handle(url, std::move(req), std::move(rep)).then([this, s, accept_encoding = std::move(accept_encoding)] (std::unique_ptr<reply> rep) {
+        _server.compress(*rep, accept_encoding);
+        auto stats = rep->_route_stats;
+        auto start = std::chrono::steady_clock::now();
+        if (stats) {
+            stats->queue_time.add(start - rep->_handled_at);
+        }
+        return write_reply(s, std::move(rep)).then([stats, start] {
+            if (stats) {
+                stats->write_time.add(std::chrono::steady_clock::now() - start);
+            }
+        });
+    }).then_wrapped([this, s] (future<> f) {
+        if (!f.failed()) {
+            close_stream(s);
+            return make_ready_future<>();
+        }
+        auto ep = f.get_exception();
+        hlogger.debug("HTTP/2 stream {} failed: {}", s->id, ep);
+        if (s->reset) {
+            return make_ready_future<>();
+        }
+        ++_server._respond_errors;
+        return reset_stream(s, error_code::internal_error).handle_exception([] (std::exception_ptr) {});
+    });
+}
+
+future<> http2_connection::write_reply(stream_ptr s, std::unique_ptr<reply> rep) {
+    if (s->reset) {
+        // The client is not interested anymore
+        return make_ready_future<>();
+    }
+    if (!rep->_body_writer) {
+        rep->_headers["Content-Length"] = to_sstring(rep->_content.size());
+    } else if (rep->_body_length) {
+        rep->_headers["Content-Length"] = to_sstring(*rep->_body_length);
+    }
+    std::string block;
+    _encoder.encode(block, ":status", to_sstring(int(rep->_status)));
+    for (auto& h : rep->_headers) {
+        auto name = to_lower(h.first);
+        if (!is_connection_specific(name)) {
+            _encoder.encode(block, name, h.second);
+        }
+    }
+    bool has_body = rep->_body_writer || !rep->_content.empty();
+    return write_headers(s->id, std::move(block), !has_body).then([this, s, has_body, rep = std::move(rep)] () mutable {
+        if (!has_body) {
+            return make_ready_future<>();
+        }
+        if (!rep->_body_writer) {
+            auto& content = rep->_content;
+            temporary_buffer<char> buf(content.data(), content.size(), make_object_deleter(std::move(rep)));
+            return send_data(s, std::move(buf), true);
+        }
+        auto& body_writer = rep->_body_writer;
+        return body_writer(output_stream<char>(data_sink(std::make_unique<data_sink_impl>(*this, s)))).finally([rep = std::move(rep)] {});
+    });
+}
+
+future<> http2_connection::send_data(stream_ptr s, temporary_buffer<char> buf, bool end_stream) {
+    if (buf.empty()) {
+        if (!end_stream) {
+            return make_ready_future<>();
+        }
+        if (s->reset) {
+            return make_exception_future<>(stream_reset_error());
+        }
+        return write_frame(frame_type::data, frame_flags::end_stream, s->id, std::move(buf));
+    }
+    return do_with(std::move(buf), [this, s, end_stream] (temporary_buffer<char>& buf) {
+        return repeat([this, s, end_stream, &buf] {
+            return _window_available.wait([this, s] {
+                return s->reset || (_send_window > 0 && s->send_window > 0);
+            }).then([this, s, end_stream, &buf] {
+                if (s->reset) {
+                    return make_exception_future<stop_iteration>(stream_reset_error());
+                }
+                auto size = std::min({int64_t(buf.size()), _send_window, s->send_window, int64_t(_max_frame_size)});
+                _send_window -= size;
+                s->send_window -= size;
+                auto chunk = buf.share(0, size);
+                buf.trim_front(size);
+                auto flags = buf.empty() && end_stream ? frame_flags::end_stream : 0;
+                return write_frame(frame_type::data, flags, s->id, std::move(chunk)).then([&buf] {
+                    return stop_iteration(buf.empty());
+                });
+            });
+        });
+    });
+}
+
+void http2_connection::close_stream(stream_ptr s) {
+    s->reset = true;
+    auto it = _streams.find(s->id);
+    if (it != _streams.end() && it->second == s) {
+        _streams.erase(it);
+    }
+    // Wakes its writers up
+    _window_available.broadcast();
+}
+
+future<> http2_connection::reset_stream(stream_ptr s, error_code code) {
+    close_stream(s);
+    return write_rst_stream(s->id, code);
+}
+
+static temporary_buffer<char> frame_header(size_t length, frame_type type, uint8_t flags, uint32_t stream_id) {
+    temporary_buffer<char> header(frame_header_size);
+    auto p = header.get_write();
+    p[0] = char(length >> 16);
+    p[1] = char(length >> 8);
+    p[2] = char(length);
+    p[3] = char(type);
+    p[4] = char(flags);
+    write_be<uint32_t>(p + 5, stream_id);
+    return header;
+}
+
+future<> http2_connection::write_frame(frame_type type, uint8_t flags, uint32_t stream_id, temporary_buffer<char> payload) {
+    return with_semaphore(_write_sem, 1, [this, type, flags, stream_id, payload = std::move(payload)] () mutable {
+        return _out.write(frame_header(payload.size(), type, flags, stream_id)).then([this, payload = std::move(payload)] () mutable {
+            return payload.empty() ? make_ready_future<>() : _out.write(std::move(payload));
+        }).then([this] {
+            return _out.flush();
+        });
+    });
+}
+
+// The block is split into a HEADERS frame and as many CONTINUATION frames
+// as needed, which nothing else may be interleaved with
+future<> http2_connection::write_headers(uint32_t stream_id, std::string block, bool end_stream) {
+    return with_semaphore(_write_sem, 1, [this, stream_id, end_stream, block = std::move(block)] {
+        size_t nr_frames = std::max<size_t>(1, (block.size() + _max_frame_size - 1) / _max_frame_size);
+        temporary_buffer<char> frames(block.size() + nr_frames * frame_header_size);
+        auto p = frames.get_write();
+        std::string_view rest = block;
+        for (size_t i = 0; i < nr_frames; ++i) {
+            auto fragment = rest.substr(0, _max_frame_size);
+            rest.remove_prefix(fragment.size());
+            uint8_t flags = rest.empty() ? frame_flags::end_headers : 0;
+            if (i == 0 && end_stream) {
+                flags |= frame_flags::end_stream;
+            }
+            auto header = frame_header(fragment.size(), i ? frame_type::continuation : frame_type::headers, flags, stream_id);
+            p = std::copy(header.begin(), header.end(), p);
+            p = std::copy(fragment.begin(), fragment.end(), p);
+        }
+        return _out.write(std::move(frames)).then([this] {
+            return _out.flush();
+        });
+    });
+}
+
+future<> http2_connection::write_rst_stream(uint32_t stream_id, error_code code) {
+    temporary_buffer<char> payload(4);
+    write_be<uint32_t>(payload.get_write(), uint32_t(code));
+    return write_frame(frame_type::rst_stream, 0, stream_id, std::move(payload));
+}
+
+future<> http2_connection::write_window_update(uint32_t stream_id, uint32_t increment) {
+    temporary_buffer<char> payload(4);
+    write_be<uint32_t>(payload.get_write(), increment);
+    return write_frame(frame_type::window_update, 0, stream_id, std::move(payload));
+}
+
+future<> http2_connection::write_settings() {
+    temporary_buffer<char> payload(6);
+    write_be<uint16_t>(payload.get_write(), uint16_t(setting::max_concurrent_streams));
+    write_be<uint32_t>(payload.get_write() + 2, max_concurrent_streams);
+    return write_frame(frame_type::settings, 0, 0, std::move(payload));
+}
+
+future<> http2_connection::write_goaway(error_code code) {
+    temporary_buffer<char> payload(8);
+    write_be<uint32_t>(payload.get_write(), _last_stream_id);
+    write_be<uint32_t>(payload.get_write() + 4, uint32_t(code));
+    return write_frame(frame_type::goaway, 0, 0, std::move(payload));
+}
+
+future<> connection::serve_http2() {
+    auto conn = std::make_unique<http2_connection>(*this);
+    auto f = conn->serve();
+    return f.finally([conn = std::move(conn)] {});
+}
+
+}
+
+}
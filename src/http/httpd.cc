@@ -59,7 +59,8 @@ http_stats::http_stats(http_server& server, const sstring& name)
             sm::make_gauge("connections_current", [&server] { return server.current_connections(); }, sm::description("The current number of open  connections"), labels),
             sm::make_derive("read_errors", [&server] { return server.read_errors(); }, sm::description("The total number of errors while reading http requests"), labels),
             sm::make_derive("reply_errors", [&server] { return server.reply_errors(); }, sm::description("The total number of errors while replying to http"), labels),
-            sm::make_derive("requests_served", [&server] { return server.requests_served(); }, sm::description("The total number of http requests served"), labels)
+            sm::make_derive("requests_served", [&server] { return server.requests_served(); }, sm::description("The total number of http requests served"), labels),
+            sm::make_derive("requests_shed", [&server] { return server.requests_shed(); }, sm::description("The total number of http requests answered with 503 by admission control"), labels)
     });
 }
 
@@ -69,14 +70,24 @@ sstring http_server_control::generate_server_name() {
 }
 
 future<> connection::do_response_loop() {
-    return _replies.pop_eventually().then(
+    return _replies.not_empty().then([this] {
+        return _replies.pop();
+    }).then(
         [this] (std::unique_ptr<reply> resp) {
             if (!resp) {
                 // eof
                 return make_ready_future<>();
             }
             _resp = std::move(resp);
-            return start_response().then([this] {
+            auto stats = _resp->_route_stats;
+            auto start = std::chrono::steady_clock::now();
+            if (stats) {
+                stats->queue_time.add(start - _resp->_handled_at);
+            }
+            return start_response().then([this, stats, start] {
+                        if (stats) {
+                            stats->write_time.add(std::chrono::steady_clock::now() - start);
+                        }
                         return do_response_loop();
                     });
         });
@@ -90,10 +101,13 @@ future<> connection::start_response() {
                 _server._respond_errors++;
                 _done = true;
                 _replies.abort(std::make_exception_ptr(std::logic_error("Unknown exception during body creation")));
-                _replies.push(std::unique_ptr<reply>());
+                _replies.push(make_ready_future<std::unique_ptr<reply>>());
                 f.ignore_ready_future();
                 return make_ready_future<>();
             }
+            if (_resp->_body_length) {
+                return make_ready_future<>();
+            }
             return _write_buf.write("0\r\n\r\n", 5);
         }).then_wrapped([this ] (auto f) {
             if (f.failed()) {
@@ -102,18 +116,18 @@ future<> connection::start_response() {
                 // we should close it, so the client will disconnect
                 _done = true;
                 _replies.abort(std::make_exception_ptr(std::logic_error("Unknown exception during body creation")));
-                _replies.push(std::unique_ptr<reply>());
+                _replies.push(make_ready_future<std::unique_ptr<reply>>());
                 f.ignore_ready_future();
                 return make_ready_future<>();
             } else {
-                return _write_buf.flush();
+                return flush_unless_more_ready();
             }
         }).then_wrapped([this] (auto f) {
             if (f.failed()) {
                 // flush failed. just close the connection
                 _done = true;
                 _replies.abort(std::make_exception_ptr(std::logic_error("Unknown exception during body creation")));
-                _replies.push(std::unique_ptr<reply>());
+                _replies.push(make_ready_future<std::unique_ptr<reply>>());
                 f.ignore_ready_future();
             }
             _resp.reset();
@@ -131,12 +145,21 @@ future<> connection::start_response() {
     }).then([this] {
         return write_body();
     }).then([this] {
-        return _write_buf.flush();
+        return flush_unless_more_ready();
     }).then([this] {
         _resp.reset();
     });
 }
 
+future<> connection::flush_unless_more_ready() {
+    // The replies of pipelined requests that are ready go out together,
+    // with a single flush
+    if (!_replies.empty() && _replies.front().available()) {
+        return make_ready_future<>();
+    }
+    return _write_buf.flush();
+}
+
 connection::~connection() {
     --_server._current_connections;
     _server._connections.erase(_server._connections.iterator_to(*this));
@@ -167,7 +190,9 @@ bool connection::url_decode(const std::string_view& in, sstring& out) {
 void connection::on_new_connection() {
     ++_server._total_connections;
     ++_server._current_connections;
+    _over_connection_limit = _server._admission && _server._current_connections > _server._admission->max_connections;
     _fd.set_nodelay(true);
+    _replies.set_max_size(_server._pipeline_depth);
     _server._connections.push_back(*this);
 }
 
@@ -180,7 +205,7 @@ future<> connection::read() {
             _server._read_errors++;
         }
         f.ignore_ready_future();
-        return _replies.push_eventually( {});
+        return _replies.push_eventually(make_ready_future<std::unique_ptr<reply>>());
     }).finally([this] {
         return _read_buf.close();
     });
@@ -210,14 +235,17 @@ set_request_content(std::unique_ptr<httpd::request> req, input_stream<char>* con
     }
 }
 
-void connection::generate_error_reply_and_close(std::unique_ptr<httpd::request> req, reply::status_type status, const sstring& msg) {
+future<> connection::generate_error_reply_and_close(std::unique_ptr<httpd::request> req, reply::status_type status, const sstring& msg) {
     auto resp = std::make_unique<reply>();
     // TODO: Handle HTTP/2.0 when it releases
     resp->set_version(req->_version);
     resp->set_status(status, msg);
+    // Tell the client not to send anything more on this connection
+    resp->_headers["Connection"] = "close";
     resp->done();
     _done = true;
-    _replies.push(std::move(resp));
+    // Waits for room behind the replies of pipelined requests
+    return _replies.push_eventually(make_ready_future<std::unique_ptr<reply>>(std::move(resp)));
 }
 
 future<> connection::read_one() {
@@ -227,8 +255,21 @@ future<> connection::read_one() {
             _done = true;
             return make_ready_future<>();
         }
-        ++_server._requests_served;
         std::unique_ptr<httpd::request> req = _parser.get_parsed_request();
+        // The HTTP/2 connection preface reads as a "PRI * HTTP/2.0" request
+        // followed by "SM\r\n\r\n", RFC 9113, section 3.4. Clients send it
+        // right away after negotiating h2 with ALPN, or with prior knowledge.
+        if (std::exchange(_first_request, false) && !_parser.failed() && req->_method == "PRI" && req->_version == "2.0") {
+            _done = true;
+            return _read_buf.read_exactly(6).then([this] (temporary_buffer<char> buf) {
+                if (std::string_view(buf.get(), buf.size()) != "SM\r\n\r\n") {
+                    ++_server._read_errors;
+                    return make_ready_future<>();
+                }
+                return serve_http2();
+            });
+        }
+        ++_server._requests_served;
         if (_server._credentials) {
             req->protocol_name = "https";
         }
@@ -237,8 +278,7 @@ future<> connection::read_one() {
                 // we might have failed to parse even the version
                 req->_version = "1.1";
             }
-            generate_error_reply_and_close(std::move(req), reply::status_type::bad_request, "Can't parse the request");
-            return make_ready_future<>();
+            return generate_error_reply_and_close(std::move(req), reply::status_type::bad_request, "Can't parse the request");
         }
 
         size_t content_length_limit = _server.get_content_length_limit();
@@ -247,15 +287,19 @@ future<> connection::read_one() {
 
         if (req->content_length > content_length_limit) {
             auto msg = format("Content length limit ({}) exceeded: {}", content_length_limit, req->content_length);
-            generate_error_reply_and_close(std::move(req), reply::status_type::payload_too_large, std::move(msg));
-            return make_ready_future<>();
+            return generate_error_reply_and_close(std::move(req), reply::status_type::payload_too_large, std::move(msg));
         }
 
         sstring encoding = req->get_header("Transfer-Encoding");
         if (encoding.size() && !request::case_insensitive_cmp()(encoding, "chunked")){
             //TODO: add "identity", "gzip"("x-gzip"), "compress"("x-compress"), and "deflate" encodings and their combinations
-            generate_error_reply_and_close(std::move(req), reply::status_type::not_implemented, format("Encodings other than \"chunked\" are not implemented (received encoding: \"{}\")", encoding));
-            return make_ready_future<>();
+            return generate_error_reply_and_close(std::move(req), reply::status_type::not_implemented, format("Encodings other than \"chunked\" are not implemented (received encoding: \"{}\")", encoding));
+        }
+
+        // Before the body is read, or the client is told to send it
+        auto permit = _server.admit(*req, _over_connection_limit);
+        if (!permit) {
+            return generate_error_reply_and_close(std::move(req), reply::status_type::service_unavailable, "Server is overloaded");
         }
 
         auto maybe_reply_continue = [this, req = std::move(req)] () mutable {
@@ -265,7 +309,7 @@ future<> connection::read_one() {
                     set_headers(*continue_reply);
                     continue_reply->set_version(req->_version);
                     continue_reply->set_status(reply::status_type::continue_).done();
-                    this->_replies.push(std::move(continue_reply));
+                    this->_replies.push(make_ready_future<std::unique_ptr<reply>>(std::move(continue_reply)));
                     return make_ready_future<std::unique_ptr<httpd::request>>(std::move(req));
                 });
             } else {
@@ -274,32 +318,48 @@ future<> connection::read_one() {
         };
 
         return maybe_reply_continue().then([this] (std::unique_ptr<httpd::request> req) {
-            return do_with(make_content_stream(req.get(), _read_buf), sstring(req->_version), std::move(req), [this] (input_stream<char>& content_stream, sstring& version, std::unique_ptr<httpd::request>& req) {
-                return set_request_content(std::move(req), &content_stream, _server.get_content_streaming()).then([this, &content_stream] (std::unique_ptr<httpd::request> req) {
-                    return _replies.not_full().then([this, req = std::move(req)] () mutable {
-                        return generate_reply(std::move(req));
-                    }).then([this, &content_stream](bool done) {
-                        _done = done;
+            // The request points to its content stream, which lives until
+            // it is handled
+            auto content_stream = std::make_unique<input_stream<char>>(make_content_stream(req.get(), _read_buf));
+            auto streaming = _server.get_content_streaming();
+            sstring version = req->_version;
+            auto content = set_request_content(std::move(req), content_stream.get(), streaming);
+            return content.then([this, content_stream = std::move(content_stream), streaming] (std::unique_ptr<httpd::request> req) mutable {
+                return _replies.not_full().then([this, req = std::move(req), content_stream = std::move(content_stream), streaming] () mutable {
+                    auto r = generate_reply(std::move(req));
+                    auto should_close = r.second;
+                    if (!streaming) {
+                        // The body was read whole, so the next request is
+                        // read while this one is handled, its reply taking
+                        // its turn in the queue
+                        _done = should_close;
+                        _replies.push(std::move(r.first).finally([content_stream = std::move(content_stream)] {}));
+                        return make_ready_future<>();
+                    }
+                    auto& cs = *content_stream;
+                    return std::move(r.first).then([this, &cs, should_close] (std::unique_ptr<reply> rep) {
+                        _replies.push(make_ready_future<std::unique_ptr<reply>>(std::move(rep)));
+                        _done = should_close;
                         // If the handler did not read the entire request
                         // content, this connection cannot be reused so we
                         // need to close it (via "_done = true"). But we can't
                         // just check content_stream.eof(): It may only become
                         // true after read(). Issue #907.
-                        return content_stream.read().then([this] (temporary_buffer<char> buf) {
+                        return cs.read().then([this] (temporary_buffer<char> buf) {
                             if (!buf.empty()) {
                                 _done = true;
                             }
                         });
-                    });
-                }).handle_exception_type([this, &version] (const base_exception& e) mutable {
-                    // If the request had a "Transfer-Encoding: chunked" header and content streaming wasn't enabled, we might have failed
-                    // before passing the request to handler - when we were parsing chunks
-                    auto err_req = std::make_unique<httpd::request>();
-                    err_req->_version = version;
-                    generate_error_reply_and_close(std::move(err_req), e.status(), e.str());
+                    }).finally([content_stream = std::move(content_stream)] {});
                 });
+            }).handle_exception_type([this, version = std::move(version)] (const base_exception& e) mutable {
+                // If the request had a "Transfer-Encoding: chunked" header and content streaming wasn't enabled, we might have failed
+                // before passing the request to handler - when we were parsing chunks
+                auto err_req = std::make_unique<httpd::request>();
+                err_req->_version = version;
+                return generate_error_reply_and_close(std::move(err_req), e.status(), e.str());
             });
-        });
+        }).finally([permit = std::move(*permit)] {});
     });
 }
 
@@ -403,12 +463,29 @@ future<> connection::respond() {
         // swallow error
         if (f.failed()) {
             _server._respond_errors++;
+            f.ignore_ready_future();
+            // Let the requests still being handled end
+            _done = true;
+            return drain_replies().handle_exception([] (std::exception_ptr) {});
         }
-        f.ignore_ready_future();
+        return make_ready_future<>();
+    }).then([this] {
         return _write_buf.close();
     });
 }
 
+future<> connection::drain_replies() {
+    return _replies.not_empty().then([this] {
+        return _replies.pop().then_wrapped([this] (future<std::unique_ptr<reply>> resp) {
+            if (resp.failed()) {
+                resp.ignore_ready_future();
+                return drain_replies();
+            }
+            return resp.get0() ? drain_replies() : make_ready_future<>();
+        });
+    });
+}
+
 future<> connection::write_body() {
     return _write_buf.write(_resp->_content.data(),
             _resp->_content.size());
@@ -419,7 +496,7 @@ void connection::set_headers(reply& resp) {
     resp._headers["Date"] = _server._date;
 }
 
-future<bool> connection::generate_reply(std::unique_ptr<request> req) {
+std::pair<future<std::unique_ptr<reply>>, bool> connection::generate_reply(std::unique_ptr<request> req) {
     auto resp = std::make_unique<reply>();
     bool conn_keep_alive = false;
     bool conn_close = false;
@@ -448,14 +525,17 @@ future<bool> connection::generate_reply(std::unique_ptr<request> req) {
     }
     sstring url = set_query_param(*req.get());
     sstring version = req->_version;
+    sstring accept_encoding = req->get_header("Accept-Encoding");
     set_headers(*resp);
-    return _server._routes.handle(url, std::move(req), std::move(resp)).
-    // Caller guarantees enough room
-    then([this, should_close, version = std::move(version)](std::unique_ptr<reply> rep) {
+    auto rep = _server._routes.handle(url, std::move(req), std::move(resp)).
+    // The reply may be written after the connection moved on to other
+    // requests, so only the server is used
+    then([&server = _server, version = std::move(version), accept_encoding = std::move(accept_encoding)](std::unique_ptr<reply> rep) {
         rep->set_version(version).done();
-        this->_replies.push(std::move(rep));
-        return make_ready_future<bool>(should_close);
+        server.compress(*rep, accept_encoding);
+        return rep;
     });
+    return {std::move(rep), should_close};
 }
 
 void http_server::set_tls_credentials(shared_ptr<seastar::tls::server_credentials> credentials) {
@@ -470,6 +550,14 @@ void http_server::set_content_length_limit(size_t limit) {
     _content_length_limit = limit;
 }
 
+size_t http_server::get_pipeline_depth() const {
+    return _pipeline_depth;
+}
+
+void http_server::set_pipeline_depth(size_t depth) {
+    _pipeline_depth = std::max<size_t>(depth, 1);
+}
+
 bool http_server::get_content_streaming() const {
     return _content_streaming;
 }
@@ -478,6 +566,94 @@ void http_server::set_content_streaming(bool b) {
     _content_streaming = b;
 }
 
+void http_server::set_compression(compression_config cfg) {
+    _compression = std::move(cfg);
+}
+
+// Content types which are worth compressing
+static bool is_compressible(std::string_view content_type) {
+    content_type = content_type.substr(0, content_type.find(';'));
+    auto plus = content_type.rfind('+');
+    if (plus != std::string_view::npos) {
+        // e.g. image/svg+xml, application/ld+json
+        auto suffix = content_type.substr(plus + 1);
+        return suffix == "xml" || suffix == "json";
+    }
+    return content_type.substr(0, 5) == "text/"
+        || content_type == "application/json"
+        || content_type == "application/javascript"
+        || content_type == "application/xml";
+}
+
+void http_server::compress(reply& rep, std::string_view accept_encoding) const {
+    if (!_compression || accept_encoding.empty() || rep._headers.count("Content-Encoding")) {
+        return;
+    }
+    if (rep._status == reply::status_type::no_content || rep._status == reply::status_type::not_modified) {
+        return;
+    }
+    if (!rep._body_writer) {
+        // HTTP/1.0 has no chunked transfer encoding, which compressed
+        // content is sent with
+        if (rep._content.size() < _compression->min_size || rep._version == "1.0") {
+            return;
+        }
+    }
+    auto content_type = rep._headers.find("Content-Type");
+    if (content_type == rep._headers.end() || !is_compressible(content_type->second)) {
+        return;
+    }
+    auto encoding = negotiate_content_encoding(accept_encoding, _compression->encodings);
+    if (encoding != content_encoding::identity) {
+        compress_reply(rep, encoding, _compression->sg);
+    }
+}
+
+// Changes the count of a semaphore whose units may be held
+static void resize_semaphore(semaphore& sem, size_t old_count, size_t new_count) {
+    old_count = std::min(old_count, semaphore::max_counter());
+    new_count = std::min(new_count, semaphore::max_counter());
+    if (new_count > old_count) {
+        sem.signal(new_count - old_count);
+    } else {
+        sem.consume(old_count - new_count);
+    }
+}
+
+void http_server::set_admission_control(admission_config cfg) {
+    auto old = _admission.value_or(admission_config{0, 0, 0, {}, 0});
+    resize_semaphore(_admitted_requests, old.max_requests, cfg.max_requests);
+    resize_semaphore(_admitted_memory, old.max_request_memory, cfg.max_request_memory);
+    resize_semaphore(_admitted_priority_requests, old.max_priority_requests, cfg.max_priority_requests);
+    _admission = std::move(cfg);
+}
+
+std::optional<admission_permit> http_server::admit(const request& req, bool over_connection_limit) {
+    if (!_admission) {
+        return admission_permit{};
+    }
+    auto path = std::string_view(req._url).substr(0, req._url.find('?'));
+    auto& priority_paths = _admission->priority_paths;
+    std::optional<admission_permit> permit;
+    if (std::find(priority_paths.begin(), priority_paths.end(), path) != priority_paths.end()) {
+        if (auto units = try_get_units(_admitted_priority_requests, 1)) {
+            permit = admission_permit{std::move(*units), {}};
+        }
+    } else if (!over_connection_limit) {
+        // A body larger than the whole budget is admitted when alone
+        auto memory_units = std::min(req.content_length, std::min(_admission->max_request_memory, semaphore::max_counter()));
+        auto requests = try_get_units(_admitted_requests, 1);
+        auto memory = try_get_units(_admitted_memory, memory_units);
+        if (requests && memory) {
+            permit = admission_permit{std::move(*requests), std::move(*memory)};
+        }
+    }
+    if (!permit) {
+        ++_requests_shed;
+    }
+    return permit;
+}
+
 future<> http_server::listen(socket_address addr, listen_options lo) {
     if (_credentials) {
         _listeners.push_back(seastar::tls::listen(_credentials, addr, lo));
@@ -548,6 +724,9 @@ uint64_t http_server::read_errors() const {
 uint64_t http_server::reply_errors() const {
     return _respond_errors;
 }
+uint64_t http_server::requests_shed() const {
+    return _requests_shed;
+}
 
 // Write the current date in the specific "preferred format" defined in
 // RFC 7231, Section 7.1.1.1, a.k.a. IMF (Internet Message Format) fixdate.
@@ -585,6 +764,18 @@ future<> http_server_control::set_routes(std::function<void(routes& r)> fun) {
     });
 }
 
+future<> http_server_control::set_shared_routes(std::function<void(routes& r)> fun) {
+    auto table = seastar::make_shared<routes>();
+    fun(*table);
+    return do_with(make_foreign(seastar::shared_ptr<const routes>(std::move(table))), [this] (const routes::shared_table& table) {
+        return _server_dist->invoke_on_all([&table] (http_server& server) {
+            return table.copy().then([&server] (routes::shared_table t) {
+                server._routes.set_shared(std::move(t));
+            });
+        });
+    });
+}
+
 future<> http_server_control::listen(socket_address addr) {
     return _server_dist->invoke_on_all<future<> (http_server::*)(socket_address)>(&http_server::listen, addr);
 }
@@ -0,0 +1,65 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/http/memory_diagnostics.hh>
+#include <seastar/http/exception.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/util/memory_diagnostics.hh>
+
+namespace seastar {
+
+namespace httpd {
+
+namespace {
+
+class memory_diagnostics_handler : public handler_base {
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        auto shard = this_shard_id();
+        auto param = req->get_query_param("shard");
+        if (!param.empty()) {
+            char* end;
+            shard = std::strtoul(param.c_str(), &end, 10);
+            if (*end || shard >= smp::count) {
+                return make_exception_future<std::unique_ptr<reply>>(
+                        bad_param_exception(format("Invalid shard {}, there are {} shards", param, smp::count)));
+            }
+        }
+        return smp::submit_to(shard, [] {
+            return memory::generate_memory_diagnostics_report();
+        }).then([rep = std::move(rep)] (sstring report) mutable {
+            rep->write_body("txt", std::move(report));
+            return std::move(rep);
+        });
+    }
+};
+
+}
+
+future<> add_memory_diagnostics_routes(http_server& server, sstring path) {
+    server._routes.put(GET, path, new memory_diagnostics_handler());
+    return make_ready_future<>();
+}
+
+}
+
+}
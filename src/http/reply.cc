@@ -31,6 +31,7 @@
 #include <seastar/http/reply.hh>
 #include <seastar/core/print.hh>
 #include <seastar/http/httpd.hh>
+#include <seastar/http/internal/content_source.hh>
 #include <seastar/core/loop.hh>
 
 namespace seastar {
@@ -209,31 +210,86 @@ class http_chunked_data_sink : public data_sink {
                 out)) {}
 };
 
-static output_stream<char> make_http_chunked_output_stream(output_stream<char>& out) {
+class http_content_length_data_sink_impl : public data_sink_impl {
+    output_stream<char>& _out;
+    size_t _remaining;
+public:
+    http_content_length_data_sink_impl(output_stream<char>& out, size_t length)
+        : _out(out), _remaining(length) {
+    }
+    // The data is passed on without copying, so nothing may be buffered
+    // in _out when the body starts
+    virtual future<> put(net::packet data) override {
+        if (data.len() > _remaining) {
+            return make_exception_future<>(std::runtime_error(format("Body exceeds its Content-Length by {} bytes", data.len() - _remaining)));
+        }
+        _remaining -= data.len();
+        return _out.write(std::move(data));
+    }
+    using data_sink_impl::put;
+    virtual future<> put(temporary_buffer<char> buf) override {
+        return put(net::packet(std::move(buf)));
+    }
+    virtual future<> close() override {
+        if (_remaining) {
+            return make_exception_future<>(std::runtime_error(format("Body is {} bytes short of its Content-Length", _remaining)));
+        }
+        return make_ready_future<>();
+    }
+};
+
+namespace internal {
+
+output_stream<char> make_http_chunked_output_stream(output_stream<char>& out) {
     output_stream_options opts;
     opts.trim_to_size = true;
     return output_stream<char>(http_chunked_data_sink(out), 32000, opts);
 }
 
+output_stream<char> make_http_content_length_output_stream(output_stream<char>& out, size_t length) {
+    output_stream_options opts;
+    opts.trim_to_size = true;
+    return output_stream<char>(data_sink(std::make_unique<http_content_length_data_sink_impl>(out, length)), 32000, opts);
+}
+
+} // namespace internal
+
 
 void reply::write_body(const sstring& content_type, noncopyable_function<future<>(output_stream<char>&&)>&& body_writer) {
     set_content_type(content_type);
     _body_writer  = std::move(body_writer);
 }
 
+void reply::write_body(const sstring& content_type, size_t len, noncopyable_function<future<>(output_stream<char>&&)>&& body_writer) {
+    write_body(content_type, std::move(body_writer));
+    _body_length = len;
+}
+
 void reply::write_body(const sstring& content_type, const sstring& content) {
     _content = content;
     done(content_type);
 }
 
 future<> reply::write_reply_to_connection(connection& con) {
+    if (_body_length) {
+        add_header("Content-Length", to_sstring(*_body_length));
+        // The head is written as a buffer of its own, like the body that follows
+        sstring head = response_line();
+        for (auto& h : _headers) {
+            head += h.first + ": " + h.second + "\r\n";
+        }
+        head += "\r\n";
+        return con.out().write(temporary_buffer<char>(head.data(), head.size())).then([this, &con] {
+            return _body_writer(internal::make_http_content_length_output_stream(con.out(), *_body_length));
+        });
+    }
     add_header("Transfer-Encoding", "chunked");
     return con.out().write(response_line()).then([this, &con] () mutable {
         return write_reply_headers(con);
     }).then([&con] () mutable {
         return con.out().write("\r\n", 2);
     }).then([this, &con] () mutable {
-        return _body_writer(make_http_chunked_output_stream(con.out()));
+        return _body_writer(internal::make_http_chunked_output_stream(con.out()));
     });
 
 }
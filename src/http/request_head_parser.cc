@@ -0,0 +1,205 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/http/internal/request_head_parser.hh>
+#include <seastar/http/request.hh>
+
+#include <boost/container/small_vector.hpp>
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace seastar {
+
+namespace internal {
+
+// The grammar accepted here is the one of request_parser.rl, minus obs-fold
+// and anything malformed, which are left to the state machine.
+
+namespace {
+
+constexpr auto tchar_table = [] {
+    std::array<bool, 256> table{};
+    for (unsigned char c : std::string_view("!#$%&'*+-.^_`|~")) {
+        table[c] = true;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        table[c] = true;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        table[c] = true;
+        table[c - 'a' + 'A'] = true;
+    }
+    return table;
+}();
+
+// graph | obs_text
+bool is_vchar(char c) noexcept {
+    return uint8_t(c) > 0x20 && uint8_t(c) != 0x7f;
+}
+
+bool is_digit(char c) noexcept {
+    return c >= '0' && c <= '9';
+}
+
+bool is_sp_ht(char c) noexcept {
+    return c == ' ' || c == '\t';
+}
+
+// Returns the first character in [p, pe) which is not a vchar, that is
+// a control character (including CR), a space or DEL.
+const char* find_non_vchar(const char* p, const char* pe) noexcept {
+#ifdef __AVX2__
+    const auto space32 = _mm256_set1_epi8(0x20);
+    const auto del32 = _mm256_set1_epi8(0x7f);
+    for (; pe - p >= 32; p += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        // max(v, 0x20) == 0x20 iff v <= 0x20, comparing as unsigned
+        auto stop = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, space32), space32), _mm256_cmpeq_epi8(v, del32));
+        if (auto mask = unsigned(_mm256_movemask_epi8(stop))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+#ifdef __SSE2__
+    const auto space16 = _mm_set1_epi8(0x20);
+    const auto del16 = _mm_set1_epi8(0x7f);
+    for (; pe - p >= 16; p += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto stop = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, space16), space16), _mm_cmpeq_epi8(v, del16));
+        if (auto mask = unsigned(_mm_movemask_epi8(stop))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (p != pe && is_vchar(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+bool consume_crlf(const char*& p, const char* pe) noexcept {
+    if (pe - p < 2 || p[0] != '\r' || p[1] != '\n') {
+        return false;
+    }
+    p += 2;
+    return true;
+}
+
+struct header_field {
+    std::string_view name;
+    std::string_view value;
+};
+
+}
+
+const char* parse_http_request_head(const char* p, const char* pe, httpd::request& req) {
+    // method SP request-target SP HTTP/d.d CRLF
+    auto method = p;
+    while (p != pe && *p >= 'A' && *p <= 'Z') {
+        ++p;
+    }
+    if (p == method || p == pe || *p != ' ') {
+        return nullptr;
+    }
+    auto method_end = p++;
+    auto url = p;
+    p = find_non_vchar(p, pe);
+    if (p == url || p == pe || *p != ' ') {
+        return nullptr;
+    }
+    auto url_end = p++;
+    if (pe - p < 8 || std::string_view(p, 5) != "HTTP/" || !is_digit(p[5]) || p[6] != '.' || !is_digit(p[7])) {
+        return nullptr;
+    }
+    auto version = p + 5;
+    p += 8;
+    if (!consume_crlf(p, pe)) {
+        return nullptr;
+    }
+
+    // Fields are only stored once the whole head is known to be valid, so
+    // that a fallback starts from a clean request
+    boost::container::small_vector<header_field, 16> fields;
+    for (;;) {
+        if (p == pe) {
+            return nullptr;
+        }
+        if (*p == '\r') {
+            break;
+        }
+        auto name = p;
+        while (p != pe && tchar_table[uint8_t(*p)]) {
+            ++p;
+        }
+        if (p == name || p == pe || *p != ':') {
+            return nullptr;
+        }
+        auto name_end = p++;
+        while (p != pe && is_sp_ht(*p)) {
+            ++p;
+        }
+        // Trailing whitespace is not part of the value
+        auto value = p;
+        auto value_end = p;
+        for (;;) {
+            auto run_end = find_non_vchar(p, pe);
+            if (run_end != p) {
+                value_end = run_end;
+            }
+            p = run_end;
+            while (p != pe && is_sp_ht(*p)) {
+                ++p;
+            }
+            if (p == pe || !is_vchar(*p)) {
+                break;
+            }
+        }
+        if (!consume_crlf(p, pe) || p == pe || is_sp_ht(*p)) {
+            // incomplete, malformed or followed by obs-fold
+            return nullptr;
+        }
+        fields.push_back({std::string_view(name, name_end - name), std::string_view(value, value_end - value)});
+    }
+    if (!consume_crlf(p, pe)) {
+        return nullptr;
+    }
+
+    req._method = sstring(method, method_end);
+    req._url = sstring(url, url_end);
+    req._version = sstring(version, 3);
+    for (auto& f : fields) {
+        auto [it, inserted] = req._headers.try_emplace(sstring(f.name.data(), f.name.size()), f.value.data(), f.value.size());
+        if (!inserted) {
+            // Combined the same way the state machine does, see RFC 7230, section 3.2.2
+            it->second += sstring(",") + sstring(f.value.data(), f.value.size());
+        }
+    }
+    return p;
+}
+
+}
+
+}
@@ -25,6 +25,7 @@
 #include <memory>
 #include <unordered_map>
 #include <seastar/http/request.hh>
+#include <seastar/http/internal/request_head_parser.hh>
 
 namespace seastar {
 
@@ -149,6 +150,14 @@ public:
         %% write init;
     }
     char* parse(char* p, char* pe, char* eof) {
+        if (_fsm_cs == start && p != pe) {
+            // Most requests arrive with the whole head in a single buffer,
+            // which the vectorized fast path handles without the state machine
+            if (auto head_end = seastar::internal::parse_http_request_head(p, pe, *_req)) {
+                _state = state::done;
+                return p + (head_end - p);
+            }
+        }
         sstring_builder::guard g(_builder, p, pe);
         auto str = [this, &g, &p] { g.mark_end(p); return get_str(); };
         bool done = false;
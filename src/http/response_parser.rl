@@ -19,6 +19,8 @@
  * Copyright (C) 2015 Cloudius Systems, Ltd.
  */
 
+#pragma once
+
 #include <seastar/core/ragel.hh>
 #include <memory>
 #include <unordered_map>
@@ -24,6 +24,11 @@
 #include <seastar/http/request.hh>
 #include <seastar/http/exception.hh>
 #include <seastar/http/json_path.hh>
+#include <seastar/core/exception_hacks.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/with_trace_context.hh>
+#include <limits>
+#include <typeinfo>
 
 namespace seastar {
 
@@ -31,12 +36,237 @@ namespace httpd {
 
 using namespace std;
 
+/*
+ * Indexes the match rules by url path segments.
+ *
+ * A segment starts at a '/' and ends before the next one, e.g. "/api" and
+ * "/v1" in "/api/v1". This is also what param_matcher takes, and what a
+ * str_matcher of a string made of whole segments needs to be followed by.
+ * So a rule made of such matchers is a path in the trie, with a literal
+ * edge per segment of the strings and a wildcard edge per parameter, ending
+ * at the node where the rule is kept. Parameters that take the rest of the
+ * url end the path as well.
+ *
+ * Finding a rule walks the segments of the url once for each wildcard
+ * branch taken, without allocating; the rule with the lowest cookie among
+ * those that match wins, to keep the insertion order priority. Its
+ * parameters are then filled in by the rule itself.
+ *
+ * Rules with other matchers are kept aside and tried one by one.
+ */
+class routes::rule_trie {
+    using rules_map = std::map<rule_cookie, match_rule*>;
+
+    struct node {
+        std::map<sstring, std::unique_ptr<node>, std::less<>> literals;
+        std::unique_ptr<node> param;
+        // rules ending here
+        rules_map rules;
+        // rules ending here with a parameter that takes the rest of the url
+        rules_map remainders;
+
+        bool empty() const noexcept {
+            return literals.empty() && !param && rules.empty() && remainders.empty();
+        }
+    };
+
+    enum class step_type { literal, param, remainder };
+    struct step {
+        step_type type;
+        sstring segment;
+    };
+
+    node _roots[NUM_OPERATION];
+    rules_map _unindexed[NUM_OPERATION];
+
+    static bool compile(const match_rule& rule, std::vector<step>& steps) {
+        auto& matchers = rule.matchers();
+        if (matchers.empty()) {
+            // matches any url
+            steps.push_back(step{step_type::remainder, ""});
+            return true;
+        }
+        for (unsigned i = 0; i < matchers.size(); i++) {
+            auto m = matchers[i];
+            if (typeid(*m) == typeid(param_matcher)) {
+                if (static_cast<const param_matcher*>(m)->entire_path()) {
+                    if (i + 1 != matchers.size()) {
+                        return false;
+                    }
+                    steps.push_back(step{step_type::remainder, ""});
+                } else {
+                    steps.push_back(step{step_type::param, ""});
+                }
+            } else if (typeid(*m) == typeid(str_matcher)) {
+                auto& str = static_cast<const str_matcher*>(m)->str();
+                if (str.empty() || str[0] != '/') {
+                    return false;
+                }
+                size_t pos = 0;
+                while (pos < str.size()) {
+                    auto end = str.find('/', pos + 1);
+                    if (end == sstring::npos) {
+                        end = str.size();
+                    }
+                    steps.push_back(step{step_type::literal, str.substr(pos, end - pos)});
+                    pos = end;
+                }
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static rules_map& rules_at(node& n, const std::vector<step>& steps) {
+        return steps.back().type == step_type::remainder ? n.remainders : n.rules;
+    }
+
+    static node* child(node& n, const step& s, bool create) {
+        if (s.type == step_type::param) {
+            if (!n.param && create) {
+                n.param = std::make_unique<node>();
+            }
+            return n.param.get();
+        }
+        auto i = n.literals.find(s.segment);
+        if (i == n.literals.end()) {
+            if (!create) {
+                return nullptr;
+            }
+            i = n.literals.emplace(s.segment, std::make_unique<node>()).first;
+        }
+        return i->second.get();
+    }
+
+    // Removes the rule from the subtree of n, returns whether n became empty
+    static bool erase(node& n, const std::vector<step>& steps, size_t i, rule_cookie cookie) {
+        if (i + 1 == steps.size() && steps[i].type == step_type::remainder) {
+            n.remainders.erase(cookie);
+        } else if (i == steps.size()) {
+            n.rules.erase(cookie);
+        } else {
+            auto c = child(n, steps[i], false);
+            if (c && erase(*c, steps, i + 1, cookie)) {
+                if (steps[i].type == step_type::param) {
+                    n.param.reset();
+                } else {
+                    n.literals.erase(steps[i].segment);
+                }
+            }
+        }
+        return n.empty();
+    }
+
+    static void consider(const rules_map& rules, rule_cookie& best, match_rule*& best_rule) {
+        if (!rules.empty() && rules.begin()->first < best) {
+            best = rules.begin()->first;
+            best_rule = rules.begin()->second;
+        }
+    }
+
+    static void find(const node& n, const sstring& url, size_t ind, rule_cookie& best, match_rule*& best_rule) {
+        consider(n.remainders, best, best_rule);
+        // match_rule::get() allows for a single character, a trailing
+        // slash, after the last matcher
+        if (ind + 1 >= url.length()) {
+            consider(n.rules, best, best_rule);
+        }
+        if (ind >= url.length()) {
+            return;
+        }
+        auto end = url.find('/', ind + 1);
+        if (end == sstring::npos) {
+            end = url.length();
+        }
+        auto i = n.literals.find(std::string_view(url.data() + ind, end - ind));
+        if (i != n.literals.end()) {
+            find(*i->second, url, end, best, best_rule);
+        }
+        if (n.param) {
+            find(*n.param, url, end, best, best_rule);
+        }
+    }
+
+public:
+    void insert(operation_type type, rule_cookie cookie, match_rule* rule) {
+        std::vector<step> steps;
+        if (!compile(*rule, steps)) {
+            _unindexed[type].emplace(cookie, rule);
+            return;
+        }
+        node* n = &_roots[type];
+        for (auto& s : steps) {
+            if (s.type != step_type::remainder) {
+                n = child(*n, s, true);
+            }
+        }
+        rules_at(*n, steps).emplace(cookie, rule);
+    }
+
+    void erase(operation_type type, rule_cookie cookie, match_rule* rule) {
+        std::vector<step> steps;
+        if (!compile(*rule, steps)) {
+            _unindexed[type].erase(cookie);
+            return;
+        }
+        erase(_roots[type], steps, 0, cookie);
+    }
+
+    handler_base* get(operation_type type, const sstring& url, parameters& params) const {
+        auto best = std::numeric_limits<rule_cookie>::max();
+        match_rule* best_rule = nullptr;
+        find(_roots[type], url, 0, best, best_rule);
+        for (auto&& rule : _unindexed[type]) {
+            if (rule.first > best) {
+                break;
+            }
+            auto handler = rule.second->get(url, params);
+            if (handler != nullptr) {
+                return handler;
+            }
+            params.clear();
+        }
+        if (best_rule) {
+            auto handler = best_rule->get(url, params);
+            if (handler != nullptr) {
+                return handler;
+            }
+            params.clear();
+        }
+        return nullptr;
+    }
+};
+
+void latency_histogram::add(std::chrono::steady_clock::duration latency) noexcept {
+    _histogram.add(std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 0));
+}
+
+metrics::histogram latency_histogram::get() const {
+    return _histogram.to_histogram();
+}
+
+// The metrics label of a rule, with its parameters in braces
+static sstring rule_label(const match_rule& rule) {
+    sstring label;
+    for (auto m : rule.matchers()) {
+        if (typeid(*m) == typeid(param_matcher)) {
+            label += "/{" + static_cast<const param_matcher*>(m)->name() + "}";
+        } else if (typeid(*m) == typeid(str_matcher)) {
+            label += static_cast<const str_matcher*>(m)->str();
+        } else {
+            label += "*";
+        }
+    }
+    return label.empty() ? sstring("*") : label;
+}
+
 void verify_param(const request& req, const sstring& param) {
     if (req.get_query_param(param) == "") {
         throw missing_param_exception(param);
     }
 }
-routes::routes() : _general_handler([this](std::exception_ptr eptr) mutable {
+routes::routes() : _trie(std::make_unique<rule_trie>()), _general_handler([this](std::exception_ptr eptr) mutable {
     return exception_reply(eptr);
 }) {}
 
@@ -56,25 +286,24 @@ routes::~routes() {
 
 std::unique_ptr<reply> routes::exception_reply(std::exception_ptr eptr) {
     auto rep = std::make_unique<reply>();
-    try {
-        // go over the register exception handler
-        // if one of them handle the exception, return.
-        for (auto e: _exceptions) {
-            try {
-                return e.second(eptr);
-            } catch (...) {
-                // this is needed if there are more then one register exception handler
-                // so if the exception handler throw a new exception, they would
-                // get the new exception and not the original one.
-                eptr = std::current_exception();
-            }
+    // go over the register exception handler
+    // if one of them handle the exception, return.
+    for (auto e: _shared ? (**_shared)._exceptions : _exceptions) {
+        try {
+            return e.second(eptr);
+        } catch (...) {
+            // this is needed if there are more then one register exception handler
+            // so if the exception handler throw a new exception, they would
+            // get the new exception and not the original one.
+            eptr = std::current_exception();
         }
-        std::rethrow_exception(eptr);
-    } catch (const base_exception& e) {
-        rep->set_status(e.status(), json_exception(e).to_json());
-    } catch (...) {
+    }
+    // Unhandled exceptions are mapped to a status without rethrowing them
+    if (auto e = try_catch<const base_exception>(eptr)) {
+        rep->set_status(e->status(), json_exception(*e).to_json());
+    } else {
         rep->set_status(reply::status_type::internal_server_error,
-                json_exception(std::current_exception()).to_json());
+                json_exception(eptr).to_json());
     }
 
     rep->done("json");
@@ -82,8 +311,62 @@ std::unique_ptr<reply> routes::exception_reply(std::exception_ptr eptr) {
 }
 
 future<std::unique_ptr<reply> > routes::handle(const sstring& path, std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
-    handler_base* handler = get_handler(str2type(req->_method),
-            normalize_url(path), req->param);
+    // The handler is a span of the trace of the caller, if it sent its
+    // context, or starts a trace if there is a sampler to decide about it
+    std::optional<tracing::trace_context> trace;
+    if (auto parent = tracing::trace_context::from_traceparent(req->get_header("traceparent"))) {
+        trace = parent->make_child();
+    } else if (tracing::has_sampler()) {
+        trace = tracing::trace_context::make_root();
+    }
+    if (trace) {
+        return with_trace_context(*trace, [this, &path, req = std::move(req), rep = std::move(rep)] () mutable {
+            return do_handle(path, std::move(req), std::move(rep));
+        });
+    }
+    return do_handle(path, std::move(req), std::move(rep));
+}
+
+void routes::set_shared(shared_table table) {
+    _shared = table ? seastar::make_shared<shared_table>(std::move(table)) : nullptr;
+}
+
+future<std::unique_ptr<reply>> routes::do_handle(const sstring& path, std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    auto type = str2type(req->_method);
+    if (_shared) {
+        // The table's handler runs with the table kept alive
+        auto& table = **_shared;
+        handler_base* handler = table.get_handler(type, normalize_url(path), req->param);
+        return handle_with_stats(type, handler, path, std::move(req), std::move(rep)).finally([table = _shared] {});
+    }
+    handler_base* handler = get_handler(type, normalize_url(path), req->param);
+    return handle_with_stats(type, handler, path, std::move(req), std::move(rep));
+}
+
+future<std::unique_ptr<reply>> routes::handle_with_stats(operation_type type, handler_base* handler, const sstring& path,
+        std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    auto stats = get_route_stats(type, handler);
+    if (!stats) {
+        return call_handler(handler, path, std::move(req), std::move(rep));
+    }
+    stats->in_flight++;
+    auto start = std::chrono::steady_clock::now();
+    return call_handler(handler, path, std::move(req), std::move(rep)).then_wrapped([stats, start] (future<std::unique_ptr<reply>> f) {
+        auto now = std::chrono::steady_clock::now();
+        stats->in_flight--;
+        stats->handler_time.add(now - start);
+        if (f.failed()) {
+            return f;
+        }
+        auto rep = f.get0();
+        rep->_route_stats = stats;
+        rep->_handled_at = now;
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    });
+}
+
+future<std::unique_ptr<reply>> routes::call_handler(handler_base* handler, const sstring& path,
+        std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
     if (handler != nullptr) {
         try {
             for (auto& i : handler->_mandatory_param) {
@@ -115,18 +398,15 @@ sstring routes::normalize_url(const sstring& url) {
 }
 
 handler_base* routes::get_handler(operation_type type, const sstring& url,
-        parameters& params) {
+        parameters& params) const {
     handler_base* handler = get_exact_match(type, url);
     if (handler != nullptr) {
         return handler;
     }
 
-    for (auto&& rule : _rules[type]) {
-        handler = rule.second->get(url, params);
-        if (handler != nullptr) {
-            return handler;
-        }
-        params.clear();
+    handler = _trie->get(type, url, params);
+    if (handler != nullptr) {
+        return handler;
     }
     return _default_handler;
 }
@@ -143,9 +423,78 @@ routes& routes::add(operation_type type, const url& url,
 
 routes& routes::add_default_handler(handler_base* handler) {
     _default_handler = handler;
+    for (int i = 0; i < NUM_OPERATION; i++) {
+        add_label(operation_type(i), handler, "default");
+    }
     return *this;
 }
 
+void routes::enable_metrics(const sstring& service) {
+    _metrics_service = service;
+    for (int i = 0; i < NUM_OPERATION; i++) {
+        add_label(operation_type(i), nullptr, "not_found");
+    }
+}
+
+void routes::add_label(operation_type type, const handler_base* handler, sstring label) {
+    // A handler registered under several urls is labeled by the first one
+    _labels[type].emplace(handler, route_label{std::move(label)});
+}
+
+void routes::drop_label(operation_type type, const handler_base* handler) {
+    if (handler) {
+        _labels[type].erase(handler);
+    }
+}
+
+route_stats* routes::get_route_stats(operation_type type, const handler_base* handler) {
+    if (!_metrics_service) {
+        return nullptr;
+    }
+    if (_shared) {
+        // The labels are the table's, the metrics this shard's
+        auto& labels = (**_shared)._labels[type];
+        auto i = labels.find(handler);
+        if (i != labels.end()) {
+            return make_route_stats(type, i->second.name);
+        }
+        return handler ? nullptr : make_route_stats(type, "not_found");
+    }
+    auto i = _labels[type].find(handler);
+    if (i == _labels[type].end()) {
+        return nullptr;
+    }
+    if (i->second.stats) {
+        return i->second.stats;
+    }
+    i->second.stats = make_route_stats(type, i->second.name);
+    return i->second.stats;
+}
+
+route_stats* routes::make_route_stats(operation_type type, const sstring& name) {
+    auto& stats = _route_stats[type][name];
+    if (!stats) {
+        namespace sm = seastar::metrics;
+        stats = std::make_unique<route_stats>();
+        std::vector<sm::label_instance> labels;
+        labels.push_back(sm::label_instance("service", *_metrics_service));
+        labels.push_back(sm::label_instance("method", type2str(type)));
+        labels.push_back(sm::label_instance("route", name));
+        auto s = stats.get();
+        s->metrics.add_group("httpd", {
+                sm::make_histogram("route_queue_latency", [s] { return s->queue_time.get(); },
+                        sm::description("Time from a handler being done to its reply starting to be written, in microseconds"), labels),
+                sm::make_histogram("route_handler_latency", [s] { return s->handler_time.get(); },
+                        sm::description("Time from a request being routed to its handler being done, in microseconds"), labels),
+                sm::make_histogram("route_write_latency", [s] { return s->write_time.get(); },
+                        sm::description("Time from a reply starting to be written to it being flushed, in microseconds"), labels),
+                sm::make_gauge("route_requests_in_flight", [s] { return s->in_flight; },
+                        sm::description("The number of requests in their handlers"), labels),
+        });
+    }
+    return stats.get();
+}
+
 template <typename Map, typename Key>
 static auto delete_rule_from(operation_type type, Key& key, Map& map) {
     auto& bucket = map[type];
@@ -160,7 +509,9 @@ static auto delete_rule_from(operation_type type, Key& key, Map& map) {
 }
 
 handler_base* routes::drop(operation_type type, const sstring& url) {
-    return delete_rule_from(type, url, _map);
+    auto handler = delete_rule_from(type, url, _map);
+    drop_label(type, handler);
+    return handler;
 }
 
 routes& routes::put(operation_type type, const sstring& url, handler_base* handler) {
@@ -168,11 +519,25 @@ routes& routes::put(operation_type type, const sstring& url, handler_base* handl
     if (it.second == false) {
         throw std::runtime_error(format("Handler for {} already exists.", url));
     }
+    add_label(type, handler, url);
     return *this;
 }
 
+routes::rule_cookie routes::add_cookie(match_rule* rule, operation_type type) {
+    auto pos = _rover++;
+    _rules[type][pos] = rule;
+    _trie->insert(type, pos, rule);
+    add_label(type, rule->handler(), rule_label(*rule));
+    return pos;
+}
+
 match_rule* routes::del_cookie(rule_cookie cookie, operation_type type) {
-    return delete_rule_from(type, cookie, _rules);
+    auto rule = delete_rule_from(type, cookie, _rules);
+    if (rule) {
+        _trie->erase(type, cookie, rule);
+        drop_label(type, rule->handler());
+    }
+    return rule;
 }
 
 void routes::add_alias(const path_description& old_path, const path_description& new_path) {
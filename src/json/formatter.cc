@@ -21,8 +21,13 @@
 
 #include <seastar/json/formatter.hh>
 #include <seastar/json/json_elements.hh>
+#include <seastar/core/loop.hh>
+#include <charconv>
 #include <cmath>
 #include <algorithm>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 namespace seastar {
 
@@ -46,58 +51,127 @@ sstring formatter::end(state s) {
     }
 }
 
-static inline bool is_control_char(char c) {
-    return c >= 0 && c <= 0x1F;
+static inline bool needs_escaping(char c) {
+    return uint8_t(c) <= 0x1F || c == '"' || c == '\\';
 }
 
-static bool needs_escaping(const string_view& str) {
-    return std::any_of(str.begin(), str.end(), [] (char c) {
-        return is_control_char(c) || c == '"' || c == '\\';
-    });
+// Returns the position of the first character at or after pos which
+// needs escaping, or str.size() if there is none
+static size_t find_escaped(std::string_view str, size_t pos) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for (; pos + 16 <= str.size(); pos += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str.data() + pos));
+        __m128i escaped = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        if (auto mask = _mm_movemask_epi8(escaped)) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (pos < str.size() && !needs_escaping(str[pos])) {
+        ++pos;
+    }
+    return pos;
 }
 
-static sstring string_view_to_json(const string_view& str) {
-    if (!needs_escaping(str)) {
-        return format("\"{}\"", str);
+// Writes the escape sequence of c to out, which has room for 6 characters,
+// and returns its length
+static size_t escape(char c, char* out) {
+    static constexpr char hex[] = "0123456789ABCDEF";
+    out[0] = '\\';
+    switch (c) {
+    case '"': out[1] = '"'; return 2;
+    case '\\': out[1] = '\\'; return 2;
+    case '\b': out[1] = 'b'; return 2;
+    case '\f': out[1] = 'f'; return 2;
+    case '\n': out[1] = 'n'; return 2;
+    case '\r': out[1] = 'r'; return 2;
+    case '\t': out[1] = 't'; return 2;
+    default:
+        out[1] = 'u';
+        out[2] = '0';
+        out[3] = '0';
+        out[4] = hex[uint8_t(c) >> 4];
+        out[5] = hex[uint8_t(c) & 0xF];
+        return 6;
     }
+}
+
+static size_t escaped_size(char c) {
+    char buf[6];
+    return escape(c, buf);
+}
 
-    ostringstream oss;
-    oss << std::hex << std::uppercase << std::setfill('0');
-    oss.put('"');
-    for (char c : str) {
-        switch (c) {
-        case '"':
-            oss.put('\\').put('"');
-            break;
-        case '\\':
-            oss.put('\\').put('\\');
-            break;
-        case '\b':
-            oss.put('\\').put('b');
-            break;
-        case '\f':
-            oss.put('\\').put('f');
-            break;
-        case '\n':
-            oss.put('\\').put('n');
-            break;
-        case '\r':
-            oss.put('\\').put('r');
-            break;
-        case '\t':
-            oss.put('\\').put('t');
-            break;
-        default:
-            if (is_control_char(c)) {
-                oss.put('\\').put('u') << std::setw(4) << static_cast<int>(c);
-            } else {
-                oss.put(c);
-            }
-            break;
+static sstring string_view_to_json(std::string_view str) {
+    auto pos = find_escaped(str, 0);
+    size_t size = str.size() + 2;
+    for (auto p = pos; p < str.size(); p = find_escaped(str, p + 1)) {
+        size += escaped_size(str[p]) - 1;
+    }
+    auto ret = uninitialized_string(size);
+    auto out = ret.data();
+    *out++ = '"';
+    size_t done = 0;
+    while (done < str.size()) {
+        out = std::copy(str.data() + done, str.data() + pos, out);
+        if (pos < str.size()) {
+            out += escape(str[pos], out);
+            ++pos;
         }
+        done = pos;
+        pos = find_escaped(str, pos);
     }
-    oss.put('"');
-    return oss.str();
+    *out = '"';
+    return ret;
+}
+
+// Strings larger than this are written piecewise rather than formatted
+// into a string first
+static constexpr size_t max_formatted_string = 8192;
+
+static future<> write_string(output_stream<char>& s, std::string_view str) {
+    if (str.size() <= max_formatted_string) {
+        return s.write(string_view_to_json(str));
+    }
+    return s.write("\"", 1).then([&s, str] {
+        return do_with(size_t(0), [&s, str] (size_t& done) {
+            return repeat([&s, str, &done] {
+                auto pos = find_escaped(str, done);
+                return s.write(str.data() + done, pos - done).then([&s, str, &done, pos] {
+                    if (pos == str.size()) {
+                        return s.write("\"", 1).then([] {
+                            return stop_iteration::yes;
+                        });
+                    }
+                    done = pos + 1;
+                    char buf[6];
+                    auto len = escape(str[pos], buf);
+                    return s.write(buf, len).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        });
+    });
+}
+
+template <typename T>
+static sstring number_to_json(T n) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), n);
+    return sstring(buf, res.ptr - buf);
+}
+
+// Same as printf's %g, without the locale
+template <typename T>
+static sstring float_to_json(T f) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), f, std::chars_format::general, 6);
+    return sstring(buf, res.ptr - buf);
 }
 
 sstring formatter::to_json(const sstring& str) {
@@ -113,15 +187,15 @@ sstring formatter::to_json(const char* str, size_t len) {
 }
 
 sstring formatter::to_json(int n) {
-    return to_string(n);
+    return number_to_json(n);
 }
 
 sstring formatter::to_json(unsigned n) {
-    return to_string(n);
+    return number_to_json(n);
 }
 
 sstring formatter::to_json(long n) {
-    return to_string(n);
+    return number_to_json(n);
 }
 
 sstring formatter::to_json(float f) {
@@ -130,7 +204,7 @@ sstring formatter::to_json(float f) {
     } else if (std::isnan(f)) {
         throw invalid_argument("Invalid float value");
     }
-    return to_sstring(f);
+    return float_to_json(f);
 }
 
 sstring formatter::to_json(double d) {
@@ -139,7 +213,7 @@ sstring formatter::to_json(double d) {
     } else if (std::isnan(d)) {
         throw invalid_argument("Invalid double value");
     }
-    return to_sstring(d);
+    return float_to_json(d);
 }
 
 sstring formatter::to_json(bool b) {
@@ -164,8 +238,20 @@ sstring formatter::to_json(const jsonable& obj) {
     return obj.to_json();
 }
 
+future<> formatter::write(output_stream<char>& s, const jsonable& obj) {
+    return obj.write(s);
+}
+
 sstring formatter::to_json(unsigned long l) {
-    return to_string(l);
+    return number_to_json(l);
+}
+
+future<> formatter::write(output_stream<char>& s, const sstring& str) {
+    return write_string(s, str);
+}
+
+future<> formatter::write(output_stream<char>& s, const char* str) {
+    return write_string(s, str);
 }
 
 }
@@ -0,0 +1,497 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/json/parser.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/print.hh>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+namespace seastar {
+
+namespace json {
+
+value::type value::get_type() const noexcept {
+    switch (_v.index()) {
+    case 0: return type::null;
+    case 1: return type::boolean;
+    case 2:
+    case 3: return type::number;
+    case 4: return type::string;
+    case 5: return type::array;
+    default: return type::object;
+    }
+}
+
+const value* value::find(std::string_view name) const {
+    for (auto& [key, v] : as_object()) {
+        if (key == name) {
+            return &v;
+        }
+    }
+    return nullptr;
+}
+
+const value& value::operator[](std::string_view name) const {
+    auto v = find(name);
+    if (!v) {
+        throw std::out_of_range(format("no member {} in json object", name));
+    }
+    return *v;
+}
+
+parse_error::parse_error(const std::string& msg, uint64_t offset)
+    : std::runtime_error(format("{} at offset {}", msg, offset))
+    , _offset(offset)
+{}
+
+enum class parser::state : uint8_t {
+    value,          // a value
+    array_first,    // a value or the end of an empty array
+    object_first,   // a key or the end of an empty object
+    key,            // a key
+    colon,
+    after_value,    // a comma or the end of the container
+    string,
+    string_escape,  // after a backslash
+    string_unicode, // in the hex digits of \u
+    surrogate_backslash, // the low half of a surrogate pair is due
+    surrogate_u,
+    number,
+    literal,
+    done,           // only whitespace may follow
+};
+
+namespace {
+
+// Parsing big documents in slices lets other tasks run
+constexpr size_t slice_size = 16 * 1024;
+
+constexpr uint64_t ones = 0x0101010101010101ull;
+constexpr uint64_t highs = 0x8080808080808080ull;
+
+// Non zero if a byte of w is below n, which must be at most 0x80. May
+// flag bytes following a true match as well.
+uint64_t has_less(uint64_t w, uint8_t n) noexcept {
+    return (w - ones * n) & ~w & highs;
+}
+
+uint64_t has_byte(uint64_t w, uint8_t b) noexcept {
+    return has_less(w ^ (ones * b), 1);
+}
+
+// The length of the run of string bytes that need no care: no quote,
+// backslash or control character. Looks at a word at a time, falling back
+// to bytes for the tail and for the word that ends the run.
+size_t plain_string_run(const char* p, size_t n) noexcept {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, p + i, sizeof(w));
+        if (has_byte(w, '"') | has_byte(w, '\\') | has_less(w, 0x20)) {
+            break;
+        }
+    }
+    for (; i < n; i++) {
+        auto c = static_cast<unsigned char>(p[i]);
+        if (c == '"' || c == '\\' || c < 0x20) {
+            break;
+        }
+    }
+    return i;
+}
+
+bool is_whitespace(char c) noexcept {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+bool is_number_char(char c) noexcept {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+}
+
+parser::parser(parse_options opts)
+    : _opts(opts)
+    , _state(state::value)
+{}
+
+void parser::fail(const char* what, const char* p, const char* begin) const {
+    throw parse_error(what, _offset + (p - begin));
+}
+
+void parser::complete(value v, const char* p, const char* begin) {
+    if (_stack.empty()) {
+        _result = std::move(v);
+        _state = state::done;
+        return;
+    }
+    auto& top = _stack.back();
+    if (top.container.get_type() == value::type::array) {
+        top.container.as_array().push_back(std::move(v));
+    } else {
+        top.container.as_object().emplace_back(std::move(top.key), std::move(v));
+    }
+    _state = state::after_value;
+}
+
+void parser::complete_number(const char* p, const char* begin) {
+    auto s = _token.data();
+    auto e = s + _token.size();
+    auto digits = [&] {
+        auto from = s;
+        while (s < e && *s >= '0' && *s <= '9') {
+            s++;
+        }
+        return s != from;
+    };
+    bool integral = true;
+    if (s < e && *s == '-') {
+        s++;
+    }
+    if (s < e && *s == '0') {
+        s++;
+    } else if (!digits()) {
+        fail("malformed number", p, begin);
+    }
+    if (s < e && *s == '.') {
+        s++;
+        integral = false;
+        if (!digits()) {
+            fail("malformed number", p, begin);
+        }
+    }
+    if (s < e && (*s == 'e' || *s == 'E')) {
+        s++;
+        integral = false;
+        if (s < e && (*s == '+' || *s == '-')) {
+            s++;
+        }
+        if (!digits()) {
+            fail("malformed number", p, begin);
+        }
+    }
+    if (s != e) {
+        fail("malformed number", p, begin);
+    }
+    if (integral) {
+        int64_t n;
+        if (std::from_chars(_token.data(), e, n).ec == std::errc()) {
+            complete(value(n), p, begin);
+            return;
+        }
+        // Too large, it becomes a double
+    }
+    complete(value(std::strtod(_token.c_str(), nullptr)), p, begin);
+}
+
+void parser::append_code_point(uint32_t cp) {
+    if (cp < 0x80) {
+        _token.push_back(char(cp));
+    } else if (cp < 0x800) {
+        _token.push_back(char(0xc0 | (cp >> 6)));
+        _token.push_back(char(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        _token.push_back(char(0xe0 | (cp >> 12)));
+        _token.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+        _token.push_back(char(0x80 | (cp & 0x3f)));
+    } else {
+        _token.push_back(char(0xf0 | (cp >> 18)));
+        _token.push_back(char(0x80 | ((cp >> 12) & 0x3f)));
+        _token.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+        _token.push_back(char(0x80 | (cp & 0x3f)));
+    }
+}
+
+const char* parser::parse_string(const char* p, const char* end, const char* begin) {
+    auto n = plain_string_run(p, end - p);
+    _token.append(p, n);
+    p += n;
+    if (p == end) {
+        return p;
+    }
+    if (*p == '\\') {
+        _state = state::string_escape;
+        return p + 1;
+    }
+    if (*p != '"') {
+        fail("control character in string", p, begin);
+    }
+    if (_token_is_key) {
+        _stack.back().key = sstring(_token.data(), _token.size());
+        _state = state::colon;
+    } else {
+        complete(value(sstring(_token.data(), _token.size())), p, begin);
+    }
+    return p + 1;
+}
+
+void parser::feed(std::string_view fragment) {
+    auto begin = fragment.data();
+    auto p = begin;
+    auto end = p + fragment.size();
+    if (_offset + fragment.size() > _opts.max_size) {
+        throw parse_error("json document too large", _opts.max_size);
+    }
+
+    auto push = [&] (value container, state next) {
+        if (_stack.size() >= _opts.max_depth) {
+            fail("json nested too deep", p, begin);
+        }
+        _stack.push_back(frame{std::move(container), {}});
+        _state = next;
+    };
+    auto pop = [&] {
+        auto container = std::move(_stack.back().container);
+        _stack.pop_back();
+        complete(std::move(container), p, begin);
+    };
+    auto start_string = [&] (bool key) {
+        _token.clear();
+        _token_is_key = key;
+        _state = state::string;
+    };
+
+    while (p < end) {
+        switch (_state) {
+        case state::string:
+            p = parse_string(p, end, begin);
+            continue;
+        case state::string_escape: {
+            char c;
+            switch (*p) {
+            case '"': c = '"'; break;
+            case '\\': c = '\\'; break;
+            case '/': c = '/'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                _escape = 0;
+                _escape_digits = 0;
+                _state = state::string_unicode;
+                p++;
+                continue;
+            default:
+                fail("invalid escape in string", p, begin);
+            }
+            _token.push_back(c);
+            _state = state::string;
+            p++;
+            continue;
+        }
+        case state::string_unicode: {
+            char c = *p;
+            unsigned digit;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            } else {
+                fail("invalid unicode escape in string", p, begin);
+            }
+            p++;
+            _escape = _escape * 16 + digit;
+            if (++_escape_digits < 4) {
+                continue;
+            }
+            auto cp = _escape;
+            if (_high_surrogate) {
+                if (cp < 0xdc00 || cp > 0xdfff) {
+                    fail("unpaired surrogate in string", p, begin);
+                }
+                cp = 0x10000 + ((_high_surrogate - 0xd800) << 10) + (cp - 0xdc00);
+                _high_surrogate = 0;
+            } else if (cp >= 0xd800 && cp <= 0xdbff) {
+                _high_surrogate = cp;
+                _state = state::surrogate_backslash;
+                continue;
+            } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                fail("unpaired surrogate in string", p, begin);
+            }
+            append_code_point(cp);
+            _state = state::string;
+            continue;
+        }
+        case state::surrogate_backslash:
+        case state::surrogate_u:
+            if (*p != (_state == state::surrogate_backslash ? '\\' : 'u')) {
+                fail("unpaired surrogate in string", p, begin);
+            }
+            _state = _state == state::surrogate_backslash ? state::surrogate_u : state::string_unicode;
+            _escape = 0;
+            _escape_digits = 0;
+            p++;
+            continue;
+        case state::number:
+            while (p < end && is_number_char(*p)) {
+                _token.push_back(*p++);
+            }
+            if (p < end) {
+                complete_number(p, begin);
+            }
+            continue;
+        case state::literal:
+            if (*p != _literal[_literal_matched]) {
+                fail("invalid literal", p, begin);
+            }
+            p++;
+            if (++_literal_matched == _literal.size()) {
+                complete(_literal[0] == 'n' ? value() : value(_literal[0] == 't'), p, begin);
+            }
+            continue;
+        default:
+            break;
+        }
+
+        // Between tokens
+        char c = *p;
+        if (is_whitespace(c)) {
+            p++;
+            continue;
+        }
+        switch (_state) {
+        case state::array_first:
+            if (c == ']') {
+                pop();
+                p++;
+                continue;
+            }
+            [[fallthrough]];
+        case state::value:
+            switch (c) {
+            case '{':
+                push(value(value::object_type()), state::object_first);
+                break;
+            case '[':
+                push(value(value::array_type()), state::array_first);
+                break;
+            case '"':
+                start_string(false);
+                break;
+            case 't':
+            case 'f':
+            case 'n':
+                _literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+                _literal_matched = 0;
+                _state = state::literal;
+                continue;
+            default:
+                if (c != '-' && (c < '0' || c > '9')) {
+                    fail("unexpected character", p, begin);
+                }
+                _token.clear();
+                _state = state::number;
+                continue;
+            }
+            p++;
+            continue;
+        case state::object_first:
+            if (c == '}') {
+                pop();
+                p++;
+                continue;
+            }
+            [[fallthrough]];
+        case state::key:
+            if (c != '"') {
+                fail("expected an object key", p, begin);
+            }
+            start_string(true);
+            p++;
+            continue;
+        case state::colon:
+            if (c != ':') {
+                fail("expected ':'", p, begin);
+            }
+            _state = state::value;
+            p++;
+            continue;
+        case state::after_value: {
+            bool array = _stack.back().container.get_type() == value::type::array;
+            if (c == ',') {
+                _state = array ? state::value : state::key;
+            } else if (c == (array ? ']' : '}')) {
+                pop();
+            } else {
+                fail(array ? "expected ',' or ']'" : "expected ',' or '}'", p, begin);
+            }
+            p++;
+            continue;
+        }
+        case state::done:
+            fail("trailing data after json document", p, begin);
+        default:
+            __builtin_unreachable();
+        }
+    }
+    _offset += fragment.size();
+}
+
+value parser::finish() {
+    if (_state == state::number) {
+        complete_number(nullptr, nullptr);
+    }
+    if (_state != state::done) {
+        fail("unexpected end of json document", nullptr, nullptr);
+    }
+    return std::move(_result);
+}
+
+value parse(std::string_view json, parse_options opts) {
+    parser p(opts);
+    p.feed(json);
+    return p.finish();
+}
+
+future<value> parse(input_stream<char>& in, parse_options opts) {
+    return do_with(parser(opts), [&in] (parser& p) {
+        return repeat([&in, &p] {
+            return in.read().then([&p] (temporary_buffer<char> buf) {
+                if (buf.empty()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return do_with(std::move(buf), [&p] (temporary_buffer<char>& buf) {
+                    return repeat([&p, &buf] {
+                        auto n = std::min(buf.size(), slice_size);
+                        p.feed(std::string_view(buf.get(), n));
+                        buf.trim_front(n);
+                        return make_ready_future<stop_iteration>(buf.empty() ? stop_iteration::yes : stop_iteration::no);
+                    });
+                }).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        }).then([&p] {
+            return p.finish();
+        });
+    });
+}
+
+}
+
+}
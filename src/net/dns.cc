@@ -282,6 +282,60 @@ class net::dns_resolver::impl
         });
     }
 
+    future<hostent_with_ttl> get_host_by_name_with_ttl(sstring name, opt_family family) {
+#if ARES_VERSION >= 0x011000
+        class promise_wrap : public promise<hostent_with_ttl> {
+        public:
+            promise_wrap(sstring s)
+                : name(std::move(s))
+            {}
+            sstring name;
+        };
+
+        dns_log.debug("Query name {} ({}) with ttl", name, family);
+
+        if (!family) {
+            auto res = inet_address::parse_numerical(name);
+            if (res) {
+                return make_ready_future<hostent_with_ttl>(hostent_with_ttl{hostent{ {name}, {*res}}, std::nullopt});
+            }
+        }
+
+        auto p = new promise_wrap(std::move(name));
+        auto f = p->get_future();
+
+        dns_call call(*this);
+
+        ares_addrinfo_hints hints = {};
+        hints.ai_family = family ? int(*family) : AF_UNSPEC;
+        ares_getaddrinfo(_channel, p->name.c_str(), nullptr, &hints, [](void* arg, int status, int timeouts, ares_addrinfo* res) {
+            std::unique_ptr<promise_wrap> p(reinterpret_cast<promise_wrap *>(arg));
+            std::unique_ptr<ares_addrinfo, decltype(&ares_freeaddrinfo)> res_ptr(res, &ares_freeaddrinfo);
+
+            if (status != ARES_SUCCESS) {
+                dns_log.debug("Query failed: {}", status);
+                p->set_exception(std::system_error(status, ares_errorc, p->name));
+                return;
+            }
+            try {
+                p->set_value(make_hostent_with_ttl(p->name, *res));
+            } catch (...) {
+                p->set_exception(std::current_exception());
+            }
+        }, reinterpret_cast<void *>(p));
+
+        poll_sockets();
+
+        return f.finally([this] {
+            end_call();
+        });
+#else
+        return get_host_by_name(std::move(name), family).then([] (hostent h) {
+            return hostent_with_ttl{std::move(h), std::nullopt};
+        });
+#endif
+    }
+
     future<hostent> get_host_by_addr(inet_address addr) {
         class promise_wrap : public promise<hostent> {
         public:
@@ -477,6 +531,46 @@ class net::dns_resolver::impl
         return records;
     }
 
+#if ARES_VERSION >= 0x011000
+    static hostent_with_ttl make_hostent_with_ttl(const sstring& name, const ares_addrinfo& info) {
+        hostent_with_ttl e;
+        int ttl = std::numeric_limits<int>::max();
+        // The chain of aliases leads to the canonical name
+        sstring canonical = name;
+        std::vector<sstring> aliases;
+        for (auto c = info.cnames; c; c = c->next) {
+            aliases.emplace_back(c->alias);
+            canonical = c->name;
+            ttl = std::min(ttl, c->ttl);
+        }
+        e.host.names.push_back(std::move(canonical));
+        std::move(aliases.begin(), aliases.end(), std::back_inserter(e.host.names));
+        for (auto n = info.nodes; n; n = n->ai_next) {
+            switch (n->ai_family) {
+            case AF_INET:
+                e.host.addr_list.emplace_back(reinterpret_cast<const sockaddr_in*>(n->ai_addr)->sin_addr);
+                break;
+            case AF_INET6:
+                e.host.addr_list.emplace_back(reinterpret_cast<const sockaddr_in6*>(n->ai_addr)->sin6_addr);
+                break;
+            default:
+                continue;
+            }
+            ttl = std::min(ttl, n->ai_ttl);
+        }
+        if (e.host.addr_list.empty()) {
+            throw std::system_error(ARES_ENODATA, ares_errorc, name);
+        }
+        if (ttl > 0 && ttl != std::numeric_limits<int>::max()) {
+            e.ttl = std::chrono::seconds(ttl);
+        }
+
+        dns_log.debug("Query success: {}/{} ttl {}", e.host.names.front(), e.host.addr_list.front(), ttl);
+
+        return e;
+    }
+#endif
+
     static hostent make_hostent(const ::hostent& host) {
         hostent e;
         e.names.emplace_back(host.h_name);
@@ -989,6 +1083,10 @@ future<net::hostent> net::dns_resolver::get_host_by_name(const sstring& name, op
     return _impl->get_host_by_name(name, family);
 }
 
+future<net::hostent_with_ttl> net::dns_resolver::get_host_by_name_with_ttl(const sstring& name, opt_family family) {
+    return _impl->get_host_by_name_with_ttl(name, family);
+}
+
 future<net::hostent> net::dns_resolver::get_host_by_addr(const inet_address& addr) {
     return _impl->get_host_by_addr(addr);
 }
@@ -1016,6 +1114,161 @@ static net::dns_resolver& resolver() {
     return resolver;
 }
 
+net::dns_cache::dns_cache(dns_resolver& resolver)
+    : dns_cache(resolver, options())
+{}
+
+net::dns_cache::dns_cache(dns_resolver& resolver, options opts)
+    : _resolver(resolver)
+    , _options(opts)
+{}
+
+static bool is_negative_answer(const std::exception_ptr& ep) {
+    try {
+        std::rethrow_exception(ep);
+    } catch (const std::system_error& e) {
+        auto code = e.code();
+        return code.category() == ares_errorc &&
+            (code.value() == ARES_ENOTFOUND || code.value() == ARES_ENODATA || code.value() == ARES_ENONAME);
+    } catch (...) {
+        return false;
+    }
+}
+
+future<net::hostent> net::dns_cache::query(const sstring& key, const sstring& name, opt_family family) {
+    auto& e = _entries[key];
+    if (e.query) {
+        return e.query->get_future();
+    }
+    // Tells the entry apart from one made anew after invalidate()
+    auto id = e.query_id = ++_queries;
+    auto f = _resolver.get_host_by_name_with_ttl(name, family).then_wrapped([this, key, id] (future<hostent_with_ttl> f) {
+        auto now = clock::now();
+        auto it = _entries.find(key);
+        if (it != _entries.end() && it->second.query_id != id) {
+            it = _entries.end();
+        }
+        if (f.failed()) {
+            auto ep = f.get_exception();
+            if (it != _entries.end()) {
+                auto& e = it->second;
+                e.query.reset();
+                if (is_negative_answer(ep)) {
+                    e.host.reset();
+                    e.error = ep;
+                    e.expiry = now + _options.negative_ttl;
+                } else if (!e.host && !e.error) {
+                    // Don't remember failures of the resolver itself
+                    _entries.erase(it);
+                }
+            }
+            return make_exception_future<hostent>(std::move(ep));
+        }
+        auto r = f.get0();
+        if (it != _entries.end()) {
+            auto& e = it->second;
+            auto ttl = std::clamp(r.ttl.value_or(_options.default_ttl), _options.min_ttl, _options.max_ttl);
+            e.query.reset();
+            e.host = r.host;
+            e.error = nullptr;
+            e.expiry = now + ttl;
+        }
+        return make_ready_future<hostent>(std::move(r.host));
+    });
+    if (f.available()) {
+        // The continuation above already ran, and may have dropped the entry
+        return f;
+    }
+    auto it = _entries.find(key);
+    if (it == _entries.end()) {
+        return f;
+    }
+    it->second.query.emplace(std::move(f));
+    return it->second.query->get_future();
+}
+
+void net::dns_cache::make_room(clock::time_point now) {
+    if (_entries.size() < _options.max_entries) {
+        return;
+    }
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        auto& e = it->second;
+        if (!e.query && e.expiry + _options.stale_ttl <= now) {
+            it = _entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Still full of live entries, any of them will do
+    for (auto it = _entries.begin(); _entries.size() >= _options.max_entries && it != _entries.end();) {
+        if (!it->second.query) {
+            it = _entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+future<net::hostent> net::dns_cache::get_host_by_name(const sstring& name, opt_family family) {
+    auto key = (family ? (*family == inet_address::family::INET ? "4:" : "6:") : "*:") + name;
+    auto now = clock::now();
+    auto it = _entries.find(key);
+    if (it == _entries.end()) {
+        make_room(now);
+        return query(key, name, family);
+    }
+    auto& e = it->second;
+    if (e.query && !e.host && !e.error) {
+        // The first lookup is in progress
+        return e.query->get_future();
+    }
+    if (now < e.expiry) {
+        if (e.error) {
+            return make_exception_future<hostent>(e.error);
+        }
+        return make_ready_future<hostent>(*e.host);
+    }
+    if (e.host && now < e.expiry + _options.stale_ttl && !_refreshes.is_closed()) {
+        // Serve the stale answer while a fresh one is looked up
+        if (!e.query) {
+            (void)with_gate(_refreshes, [this, key, name, family] {
+                return query(key, name, family).discard_result().handle_exception([] (std::exception_ptr) {});
+            });
+        }
+        return make_ready_future<hostent>(*e.host);
+    }
+    return query(key, name, family);
+}
+
+future<net::inet_address> net::dns_cache::resolve_name(const sstring& name, opt_family family) {
+    return get_host_by_name(name, family).then([] (hostent h) {
+        return make_ready_future<inet_address>(h.addr_list.front());
+    });
+}
+
+void net::dns_cache::invalidate(const sstring& name) {
+    for (auto prefix : {"*:", "4:", "6:"}) {
+        auto it = _entries.find(sstring(prefix) + name);
+        // A query in progress finds its entry gone and keeps nothing
+        if (it != _entries.end()) {
+            _entries.erase(it);
+        }
+    }
+}
+
+void net::dns_cache::clear() {
+    _entries.clear();
+}
+
+future<> net::dns_cache::close() {
+    return _refreshes.close();
+}
+
+net::dns_cache& net::dns::cache() {
+    static thread_local net::dns_cache cache(resolver());
+    return cache;
+}
+
 
 future<net::hostent> net::dns::get_host_by_name(const sstring& name, opt_family family) {
     return resolver().get_host_by_name(name, family);
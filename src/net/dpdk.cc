@@ -31,11 +31,16 @@
 #include <seastar/core/sstring.hh>
 #include <seastar/core/memory.hh>
 #include <seastar/core/metrics.hh>
+#include <seastar/core/map_reduce.hh>
 #include <seastar/util/function_input_iterator.hh>
 #include <seastar/util/transform_iterator.hh>
 #include <atomic>
 #include <vector>
 #include <queue>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <boost/range/irange.hpp>
 #include <seastar/util/std-compat.hh>
 #include <boost/preprocessor.hpp>
 #include <seastar/net/ip.hh>
@@ -54,6 +59,8 @@
 #include <rte_eal.h>
 #include <rte_pci.h>
 #include <rte_ethdev.h>
+#include <rte_eth_bond.h>
+#include <rte_flow.h>
 #include <rte_cycles.h>
 #include <rte_memzone.h>
 #include <rte_vfio.h>
@@ -123,6 +130,16 @@ static constexpr uint16_t default_ring_size      = 512;
 static constexpr uint16_t mbufs_per_queue_rx     = 2 * default_ring_size;
 static constexpr uint16_t rx_gc_thresh           = 64;
 
+//
+// Without a hugetlbfs backend received mbufs are lent to the stack until the
+// packet is freed, so the pool needs room for the data queued in the stack
+// on top of what the PMD needs. Once fewer than a ring's worth of mbufs are
+// left in the pool received data is copied instead, so that a backlog of
+// unread data never stops the ring from being refilled.
+//
+static constexpr uint16_t mbufs_per_queue_rx_zc  = 8 * default_ring_size;
+static constexpr unsigned rx_zc_min_avail_mbufs  = default_ring_size;
+
 //
 // No need to keep more descriptors in the air than can be sent in a single
 // rte_eth_tx_burst() call.
@@ -348,6 +365,22 @@ class dpdk_device : public device {
     bool _is_i40e_device = false;
     bool _is_vmxnet3_device = false;
     dpdk_xstats _xstats;
+    std::chrono::milliseconds _rss_rebalance_period{0};
+    timer<> _rss_rebalancer;
+    // Buckets moved by the rebalancer that still carry flows established
+    // on the shards of their previous queues
+    std::set<unsigned> _migrated_buckets;
+    static constexpr double rss_max_imbalance = 0.25;
+    static constexpr unsigned rss_max_moves = 8;
+    // The exact match rules steering flows to the queues of the shards
+    // owning them; each shard only touches its own
+    struct flow_rules {
+        std::unordered_map<net::flow_key, rte_flow*, net::flow_key::hash> rules;
+        unsigned max = 0;
+        // The device refused a rule; none is tried until one is removed
+        bool full = false;
+    };
+    std::vector<flow_rules> _flow_rules;
 
 public:
     rte_eth_dev_info _dev_info = {};
@@ -393,6 +426,27 @@ class dpdk_device : public device {
      */
     void set_hw_flow_control();
 
+    /**
+     * Moves buckets of the RSS redirection table from the queues receiving
+     * the most packets to the ones receiving the least.
+     */
+    future<> rebalance_rss_table();
+
+    /**
+     * Points the moved buckets to their new queues, in the HW table and in
+     * the local one.
+     */
+    void update_rss_table(const std::vector<net::reta_move>& moves);
+
+    /**
+     * Makes the queues that receive the migrated buckets forward the
+     * packets of the flows established before the move to the shards that
+     * own them.
+     *
+     * @param pending moves that are about to be applied
+     */
+    future<> pin_migrated_flows(std::vector<net::reta_move> pending);
+
 public:
     dpdk_device(uint16_t port_idx, uint16_t num_queues, bool use_lro,
                 bool enable_fc)
@@ -404,6 +458,7 @@ class dpdk_device : public device {
         , _stats_plugin_name("network")
         , _stats_plugin_inst(std::string("port") + std::to_string(_port_idx))
         , _xstats(port_idx)
+        , _flow_rules(smp::count)
     {
 
         /* now initialise the port we will use */
@@ -498,7 +553,8 @@ class dpdk_device : public device {
     virtual std::unique_ptr<qp> init_local_queue(const program_options::option_group& opts, uint16_t qid) override;
     virtual unsigned hash2qid(uint32_t hash) override {
         assert(_redir_table.size());
-        return _redir_table[hash & (_redir_table.size() - 1)];
+        // The table may be rebalanced by the home shard meanwhile
+        return std::atomic_ref<uint8_t>(_redir_table[hash & (_redir_table.size() - 1)]).load(std::memory_order_relaxed);
     }
     uint16_t port_idx() { return _port_idx; }
     bool is_i40e_device() const {
@@ -509,6 +565,8 @@ class dpdk_device : public device {
     }
 
     virtual rss_key_type rss_key() const override { return _rss_key; }
+    virtual bool steer_flow(const net::flow_key& flow) override;
+    virtual void unsteer_flow(const net::flow_key& flow) override;
 };
 
 template <bool HugetlbfsMemBackend>
@@ -1630,6 +1688,8 @@ int dpdk_device::init_port_start()
     }
 
     //rte_eth_promiscuous_enable(port_num);
+    // IPv6 neighbor solicitations are sent to solicited-node multicast groups
+    rte_eth_allmulticast_enable(_port_idx);
     printf("done: \n");
 
     return 0;
@@ -1736,6 +1796,24 @@ void dpdk_device::init_port_fini()
         }
 
         set_rss_table();
+
+        if (_dev_info.reta_size && _rss_rebalance_period.count()) {
+            _rss_rebalancer.set_callback([this] {
+                // FIXME: future is discarded
+                (void)rebalance_rss_table().handle_exception([] (std::exception_ptr ep) {
+                    try {
+                        std::rethrow_exception(ep);
+                    } catch (std::exception& e) {
+                        printf("RSS table rebalancing failed: %s\n", e.what());
+                    } catch (...) {
+                        printf("RSS table rebalancing failed\n");
+                    }
+                }).finally([this] {
+                    _rss_rebalancer.arm(_rss_rebalance_period);
+                });
+            });
+            _rss_rebalancer.arm(_rss_rebalance_period);
+        }
     }
     #pragma GCC diagnostic pop
 
@@ -1778,8 +1856,9 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
     using namespace memory;
     sstring name = sstring(pktmbuf_pool_name) + to_sstring(_qid) + "_rx";
 
+    auto nr_mbufs = HugetlbfsMemBackend ? mbufs_per_queue_rx : mbufs_per_queue_rx_zc;
     printf("Creating Rx mbuf pool '%s' [%u mbufs] ...\n",
-           name.c_str(), mbufs_per_queue_rx);
+           name.c_str(), nr_mbufs);
 
     //
     // If we have a hugetlbfs memory backend we may perform a virt2phys
@@ -1858,7 +1937,7 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
         roomsz.mbuf_data_room_size = inline_mbuf_data_size + RTE_PKTMBUF_HEADROOM;
         _pktmbuf_pool_rx =
             rte_mempool_create(name.c_str(),
-                               mbufs_per_queue_rx, inline_mbuf_size,
+                               nr_mbufs, inline_mbuf_size,
                                mbuf_cache_size,
                                sizeof(struct rte_pktmbuf_pool_private),
                                rte_pktmbuf_pool_init, as_cookie(roomsz),
@@ -2006,6 +2085,7 @@ dpdk_qp<false>::from_mbuf_lro(rte_mbuf* m)
 
         rte_pktmbuf_free(m);
 
+        _stats.rx.good.update_copy_stats(1, pkt_len);
         return packet(fragment{buf, pkt_len}, make_free_deleter(buf));
     }
 
@@ -2019,12 +2099,27 @@ template<>
 inline std::optional<packet>
 dpdk_qp<false>::from_mbuf(rte_mbuf* m)
 {
+    //
+    // Hand the mbuf cluster itself to the stack unless the pool is running
+    // low: buffers held by slow consumers (e.g. connections whose
+    // application doesn't read) would otherwise starve the Rx ring. Below
+    // the watermark the data is copied and the mbuf is returned right away.
+    //
+    if (rte_mempool_avail_count(_pktmbuf_pool_rx) >= rx_zc_min_avail_mbufs) {
+        _frags.clear();
+        for (rte_mbuf* m1 = m; m1 != nullptr; m1 = m1->next) {
+            _frags.emplace_back(fragment{rte_pktmbuf_mtod(m1, char*), rte_pktmbuf_data_len(m1)});
+        }
+        // The deleter runs on this shard, forwarded packets are freed on
+        // their source cpu
+        return packet(_frags.begin(), _frags.end(), make_deleter([m] { rte_pktmbuf_free(m); }));
+    }
+
     if (!_dev->hw_features_ref().rx_lro || rte_pktmbuf_is_contiguous(m)) {
         //
-        // Try to allocate a buffer for packet's data. If we fail - give the
-        // application an mbuf itself. If we succeed - copy the data into this
-        // buffer, create a packet based on this buffer and return the mbuf to
-        // its pool.
+        // Try to allocate a buffer for packet's data. If we fail - drop the
+        // packet. If we succeed - copy the data into this buffer, create a
+        // packet based on this buffer and return the mbuf to its pool.
         //
         auto len = rte_pktmbuf_data_len(m);
         char* buf = (char*)malloc(len);
@@ -2038,6 +2133,7 @@ dpdk_qp<false>::from_mbuf(rte_mbuf* m)
             rte_memcpy(buf, rte_pktmbuf_mtod(m, char*), len);
             rte_pktmbuf_free(m);
 
+            _stats.rx.good.update_copy_stats(1, len);
             return packet(fragment{buf, len}, make_free_deleter(buf));
         }
     } else {
@@ -2183,18 +2279,15 @@ void dpdk_qp<HugetlbfsMemBackend>::process_packets(
         (*p).set_offload_info(oi);
         if (m->ol_flags & PKT_RX_RSS_HASH) {
             (*p).set_rss_hash(m->hash.rss);
+            count_rss_bucket(m->hash.rss);
         }
 
         _dev->l2receive(std::move(*p));
     }
+    _dev->l2flush();
 
     _stats.rx.good.update_pkts_bunch(count);
     _stats.rx.good.update_frags_stats(nr_frags, bytes);
-
-    if (!HugetlbfsMemBackend) {
-        _stats.rx.good.copy_frags = _stats.rx.good.nr_frags;
-        _stats.rx.good.copy_bytes = _stats.rx.good.bytes;
-    }
 }
 
 template <bool HugetlbfsMemBackend>
@@ -2243,6 +2336,104 @@ void dpdk_device::set_rss_table()
     }
 }
 
+future<> dpdk_device::rebalance_rss_table()
+{
+    // There is an assumption here that qid == cpu_id, as in hash2cpu()
+    return map_reduce(boost::irange<unsigned>(0, _num_queues), [this] (unsigned qid) {
+        return smp::submit_to(qid, [this] {
+            return local_queue().take_rss_bucket_load();
+        });
+    }, std::vector<uint64_t>(_redir_table.size()), [] (std::vector<uint64_t> acc, std::vector<uint64_t> load) {
+        for (size_t i = 0; i < acc.size(); i++) {
+            acc[i] += load[i];
+        }
+        return acc;
+    }).then([this] (std::vector<uint64_t> load) {
+        auto moves = net::plan_reta_rebalance(_redir_table, load, _num_queues, rss_max_imbalance, rss_max_moves);
+        if (moves.empty() && _migrated_buckets.empty()) {
+            return make_ready_future<>();
+        }
+        // The established flows are pinned before the NIC starts delivering
+        // them to the new queues, and once more afterwards to catch the
+        // connections established meanwhile
+        return pin_migrated_flows(moves).then([this, moves] {
+            if (moves.empty()) {
+                return make_ready_future<>();
+            }
+            update_rss_table(moves);
+            return pin_migrated_flows({});
+        });
+    });
+}
+
+void dpdk_device::update_rss_table(const std::vector<net::reta_move>& moves)
+{
+    int reta_conf_size =
+        std::max(1, _dev_info.reta_size / RTE_RETA_GROUP_SIZE);
+    std::vector<rte_eth_rss_reta_entry64> reta_conf(reta_conf_size);
+
+    for (auto& m : moves) {
+        auto& x = reta_conf[m.bucket / RTE_RETA_GROUP_SIZE];
+        x.mask |= 1ULL << (m.bucket % RTE_RETA_GROUP_SIZE);
+        x.reta[m.bucket % RTE_RETA_GROUP_SIZE] = m.to;
+    }
+
+    if (rte_eth_dev_rss_reta_update(_port_idx, reta_conf.data(), _dev_info.reta_size)) {
+        printf("Port %d: Failed to update an RSS indirection table\n", _port_idx);
+        return;
+    }
+
+    for (auto& m : moves) {
+        std::atomic_ref<uint8_t>(_redir_table[m.bucket]).store(m.to, std::memory_order_relaxed);
+        _migrated_buckets.insert(m.bucket);
+    }
+}
+
+future<> dpdk_device::pin_migrated_flows(std::vector<net::reta_move> pending)
+{
+    // bucket -> queue receiving it
+    std::unordered_map<unsigned, unsigned> dst;
+    for (auto b : _migrated_buckets) {
+        dst[b] = _redir_table[b];
+    }
+    for (auto& m : pending) {
+        dst[m.bucket] = m.to;
+    }
+    auto mask = _redir_table.size() - 1;
+
+    using flows = std::vector<std::pair<uint32_t, unsigned>>;
+    return map_reduce(boost::irange(0u, smp::count), [this, dst, mask] (unsigned shard) {
+        return smp::submit_to(shard, [this, dst, mask, shard] {
+            flows ret;
+            for (auto hash : local_queue().flow_hashes()) {
+                if (dst.contains(hash & mask)) {
+                    ret.emplace_back(hash, shard);
+                }
+            }
+            return ret;
+        });
+    }, flows(), [] (flows acc, flows f) {
+        acc.insert(acc.end(), f.begin(), f.end());
+        return acc;
+    }).then([this, dst = std::move(dst), mask, pending = std::move(pending)] (flows f) {
+        std::vector<std::unordered_map<uint32_t, unsigned>> pins(_num_queues);
+        std::set<unsigned> busy;
+        for (auto& [hash, shard] : f) {
+            pins[dst.at(hash & mask)].emplace(hash, shard);
+            busy.insert(hash & mask);
+        }
+        // Once their last pinned flow is gone, buckets are no longer tracked
+        std::erase_if(_migrated_buckets, [&] (unsigned b) {
+            return !busy.contains(b);
+        });
+        return parallel_for_each(boost::irange<unsigned>(0, _num_queues), [this, pins = std::move(pins)] (unsigned qid) mutable {
+            return smp::submit_to(qid, [this, p = std::move(pins[qid])] () mutable {
+                local_queue().set_pinned_flows(std::move(p));
+            });
+        });
+    });
+}
+
 std::unique_ptr<qp> dpdk_device::init_local_queue(const program_options::option_group& opts, uint16_t qid) {
     auto net_opts = dynamic_cast<const net::native_stack_options*>(&opts);
     assert(net_opts);
@@ -2256,14 +2447,106 @@ std::unique_ptr<qp> dpdk_device::init_local_queue(const program_options::option_
                                  _stats_plugin_name + "-" + _stats_plugin_inst);
     }
 
+    _flow_rules[this_shard_id()].max = net_opts->dpdk_opts.flow_steering_rules.get_value();
+
+    auto rebalance_period = std::chrono::milliseconds(net_opts->dpdk_opts.rss_rebalance_period.get_value());
+    if (rebalance_period.count() && _dev_info.reta_size) {
+        qp->enable_rss_bucket_load(_redir_table.size());
+    }
+
     // FIXME: future is discarded
-    (void)smp::submit_to(_home_cpu, [this] () mutable {
+    (void)smp::submit_to(_home_cpu, [this, rebalance_period] () mutable {
+        _rss_rebalance_period = rebalance_period;
         if (++_queues_ready == _num_queues) {
             init_port_fini();
         }
     });
     return qp;
 }
+
+bool dpdk_device::steer_flow(const net::flow_key& flow)
+{
+    // There is an assumption here that qid == cpu_id, as in hash2cpu()
+    auto cpu = this_shard_id();
+    auto& fr = _flow_rules[cpu];
+    if (cpu >= _num_queues || fr.full || fr.rules.size() >= fr.max) {
+        return false;
+    }
+
+    rte_flow_attr attr = {};
+    attr.ingress = 1;
+
+    rte_flow_item_ipv4 ip_spec = {};
+    rte_flow_item_ipv4 ip_mask = {};
+    ip_spec.hdr.src_addr = rte_cpu_to_be_32(flow.src_ip);
+    ip_spec.hdr.dst_addr = rte_cpu_to_be_32(flow.dst_ip);
+    ip_spec.hdr.next_proto_id = flow.proto;
+    ip_mask.hdr.src_addr = ~uint32_t(0);
+    ip_mask.hdr.dst_addr = ~uint32_t(0);
+    ip_mask.hdr.next_proto_id = 0xff;
+
+    rte_flow_item_tcp tcp_spec = {};
+    rte_flow_item_tcp tcp_mask = {};
+    rte_flow_item_udp udp_spec = {};
+    rte_flow_item_udp udp_mask = {};
+    rte_flow_item l4 = {};
+    if (flow.proto == uint8_t(net::ip_protocol_num::tcp)) {
+        tcp_spec.hdr.src_port = rte_cpu_to_be_16(flow.src_port);
+        tcp_spec.hdr.dst_port = rte_cpu_to_be_16(flow.dst_port);
+        tcp_mask.hdr.src_port = 0xffff;
+        tcp_mask.hdr.dst_port = 0xffff;
+        l4 = {RTE_FLOW_ITEM_TYPE_TCP, &tcp_spec, nullptr, &tcp_mask};
+    } else if (flow.proto == uint8_t(net::ip_protocol_num::udp)) {
+        udp_spec.hdr.src_port = rte_cpu_to_be_16(flow.src_port);
+        udp_spec.hdr.dst_port = rte_cpu_to_be_16(flow.dst_port);
+        udp_mask.hdr.src_port = 0xffff;
+        udp_mask.hdr.dst_port = 0xffff;
+        l4 = {RTE_FLOW_ITEM_TYPE_UDP, &udp_spec, nullptr, &udp_mask};
+    } else {
+        return false;
+    }
+
+    rte_flow_item pattern[] = {
+        {RTE_FLOW_ITEM_TYPE_ETH, nullptr, nullptr, nullptr},
+        {RTE_FLOW_ITEM_TYPE_IPV4, &ip_spec, nullptr, &ip_mask},
+        l4,
+        {RTE_FLOW_ITEM_TYPE_END, nullptr, nullptr, nullptr},
+    };
+    rte_flow_action_queue queue = {};
+    queue.index = cpu;
+    rte_flow_action actions[] = {
+        {RTE_FLOW_ACTION_TYPE_QUEUE, &queue},
+        {RTE_FLOW_ACTION_TYPE_END, nullptr},
+    };
+
+    rte_flow_error error = {};
+    auto f = rte_flow_create(_port_idx, &attr, pattern, actions, &error);
+    if (!f) {
+        // Out of flow table entries, or no support at all: RSS it is
+        printf("Port %d: flow steering rule refused on queue %u (%s), falling back to RSS\n",
+               _port_idx, cpu, error.message ? error.message : "unknown error");
+        fr.full = true;
+        return false;
+    }
+    fr.rules.emplace(flow, f);
+    return true;
+}
+
+void dpdk_device::unsteer_flow(const net::flow_key& flow)
+{
+    auto& fr = _flow_rules[this_shard_id()];
+    auto i = fr.rules.find(flow);
+    if (i == fr.rules.end()) {
+        return;
+    }
+    rte_flow_error error = {};
+    if (rte_flow_destroy(_port_idx, i->second, &error)) {
+        printf("Port %d: failed to remove a flow steering rule (%s)\n",
+               _port_idx, error.message ? error.message : "unknown error");
+    }
+    fr.rules.erase(i);
+    fr.full = false;
+}
 } // namespace dpdk
 
 /******************************** Interface functions *************************/
@@ -2298,6 +2581,56 @@ std::unique_ptr<net::device> create_dpdk_net_device(
     return create_dpdk_net_device(*hw_cfg.port_index, smp::count, hw_cfg.lro, hw_cfg.hw_fc);
 }
 
+uint16_t create_dpdk_bonded_port(const std::string& ports, const std::string& mode)
+{
+    assert(dpdk::eal::initialized);
+
+    uint8_t bond_mode;
+    if (mode == "balance") {
+        bond_mode = BONDING_MODE_BALANCE;
+    } else if (mode == "lacp") {
+        bond_mode = BONDING_MODE_8023AD;
+    } else {
+        rte_exit(EXIT_FAILURE, "Unknown bonding mode %s, expected balance or lacp\n", mode.c_str());
+    }
+
+    int bond = rte_eth_bond_create("net_bonding0", bond_mode, rte_socket_id());
+    if (bond < 0) {
+        rte_exit(EXIT_FAILURE, "Cannot create a bonded port: %s\n", rte_strerror(-bond));
+    }
+
+    std::istringstream in(ports);
+    std::string port;
+    unsigned nr_ports = 0;
+    while (std::getline(in, port, ',')) {
+        auto idx = std::stoul(port);
+        if (!rte_eth_dev_is_valid_port(idx)) {
+            rte_exit(EXIT_FAILURE, "Port %lu to bond does not exist\n", idx);
+        }
+#if RTE_VERSION >= RTE_VERSION_NUM(23,11,0,0)
+        int ret = rte_eth_bond_member_add(bond, idx);
+#else
+        int ret = rte_eth_bond_slave_add(bond, idx);
+#endif
+        if (ret) {
+            rte_exit(EXIT_FAILURE, "Cannot add port %lu to the bonded port: %s\n", idx, rte_strerror(-ret));
+        }
+        nr_ports++;
+    }
+    if (nr_ports < 2) {
+        rte_exit(EXIT_FAILURE, "Bonding needs at least two ports, got \"%s\"\n", ports.c_str());
+    }
+
+    // Spread the flows across the ports the way RSS spreads them across
+    // queues, keeping each flow in order on one port
+    if (rte_eth_bond_xmit_policy_set(bond, BALANCE_XMIT_POLICY_LAYER34)) {
+        rte_exit(EXIT_FAILURE, "Cannot set the transmit policy of the bonded port\n");
+    }
+
+    printf("Bonded ports %s into port %d (%s)\n", ports.c_str(), bond, mode.c_str());
+    return bond;
+}
+
 }
 
 #else
@@ -2315,10 +2648,26 @@ dpdk_options::dpdk_options(program_options::option_group* parent_group)
     , hw_fc(*this, "hw-fc",
                 "on",
                 "Enable HW Flow Control (on / off)")
+    , rss_rebalance_period(*this, "rss-rebalance-period",
+                0,
+                "Period in milliseconds of moving RSS redirection table entries from the busiest queues to the idlest ones (0 disables)")
+    , flow_steering_rules(*this, "flow-steering-rules",
+                0,
+                "Maximum number of hardware (rte_flow) rules per shard steering its outgoing TCP connections to its queue; connections beyond it, or refused by the device, rely on RSS (0 disables)")
+    , bond_ports(*this, "dpdk-bond-ports",
+                {},
+                "Comma separated DPDK port indexes to bond into one port, with a queue per shard on each, instead of --dpdk-port-index")
+    , bond_mode(*this, "dpdk-bond-mode",
+                "balance",
+                "Bonding mode of --dpdk-bond-ports: balance (static link aggregation) or lacp (802.3ad)")
 #else
     : program_options::option_group(parent_group, "DPDK net options", program_options::unused{})
     , dpdk_port_index(*this, "dpdk-port-index", program_options::unused{})
     , hw_fc(*this, "hw-fc", program_options::unused{})
+    , rss_rebalance_period(*this, "rss-rebalance-period", program_options::unused{})
+    , flow_steering_rules(*this, "flow-steering-rules", program_options::unused{})
+    , bond_ports(*this, "dpdk-bond-ports", program_options::unused{})
+    , bond_mode(*this, "dpdk-bond-mode", program_options::unused{})
 #endif
 #if 0
     opts.add_options()
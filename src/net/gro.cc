@@ -0,0 +1,144 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/net/gro.hh>
+#include <seastar/net/ethernet.hh>
+#include <seastar/net/ip.hh>
+#include <seastar/core/byteorder.hh>
+#include <algorithm>
+
+namespace seastar {
+
+namespace net {
+
+namespace {
+
+constexpr uint8_t tcp_flag_psh = 0x08;
+constexpr uint8_t tcp_flag_ack = 0x10;
+constexpr size_t tcp_offset = sizeof(eth_hdr) + ipv4_hdr_len_min;
+
+}
+
+gro::gro(deliver_fn deliver)
+    : _deliver(std::move(deliver)) {
+    _flows.reserve(max_flows);
+}
+
+void gro::deliver(flow& f) {
+    if (f.segments > 1) {
+        auto iph = f.p.get_header<ip_hdr>(sizeof(eth_hdr));
+        auto h = ntoh(*iph);
+        h.len = f.p.len() - sizeof(eth_hdr);
+        *iph = hton(h);
+        _stats.merged_packets++;
+    }
+    _deliver(std::move(f.p));
+}
+
+void gro::receive(packet p) {
+    auto eh = p.get_header<eth_hdr>(0);
+    if (!eh || ntoh(eh->eth_proto) != uint16_t(eth_protocol_num::ipv4)) {
+        _deliver(std::move(p));
+        return;
+    }
+    auto iph = p.get_header<ip_hdr>(sizeof(eth_hdr));
+    if (!iph) {
+        _deliver(std::move(p));
+        return;
+    }
+    auto ip = ntoh(*iph);
+    // No IP options, no fragments, and nothing trailing the datagram
+    if (ip.ihl * 4 != ipv4_hdr_len_min || ip.ip_proto != uint8_t(ip_protocol_num::tcp)
+            || ip.mf() || ip.offset() != 0 || ip.len + sizeof(eth_hdr) != p.len()) {
+        _deliver(std::move(p));
+        return;
+    }
+    auto th = p.get_header(tcp_offset, tcp_hdr_len_min);
+    if (!th) {
+        _deliver(std::move(p));
+        return;
+    }
+    size_t tcp_len = (uint8_t(th[12]) >> 4) * 4;
+    th = tcp_len >= tcp_hdr_len_min ? p.get_header(tcp_offset, tcp_len) : nullptr;
+    if (!th) {
+        _deliver(std::move(p));
+        return;
+    }
+    uint32_t ports = read_be<uint32_t>(th);
+    auto it = std::find_if(_flows.begin(), _flows.end(), [&] (const flow& f) {
+        return f.ports == ports && f.src_ip == ip.src_ip.ip && f.dst_ip == ip.dst_ip.ip;
+    });
+
+    auto seq = read_be<uint32_t>(th + 4);
+    auto ack = read_be<uint32_t>(th + 8);
+    auto flags = uint8_t(th[13]);
+    auto window = read_be<uint16_t>(th + 14);
+    size_t payload_len = ip.len - ipv4_hdr_len_min - tcp_len;
+    // Pure acknowledgements are not merged, so that duplicate ones are seen
+    bool mergeable = payload_len > 0 && (flags & ~(tcp_flag_ack | tcp_flag_psh)) == 0 && (flags & tcp_flag_ack);
+    if (it != _flows.end()) {
+        if (mergeable && seq == it->next_seq && ack == it->ack && window == it->window
+                && tcp_len - tcp_hdr_len_min == it->options_len
+                && std::equal(th + tcp_hdr_len_min, th + tcp_len, it->options.begin())
+                && it->segments < max_segments
+                && it->p.len() - sizeof(eth_hdr) + payload_len <= ip_packet_len_max) {
+            p.trim_front(tcp_offset + tcp_len);
+            it->p.append(std::move(p));
+            it->next_seq += payload_len;
+            it->segments++;
+            _stats.merged_segments++;
+            if (flags & tcp_flag_psh) {
+                // The sender has nothing more to send for now
+                auto held_th = it->p.get_header(tcp_offset, tcp_hdr_len_min);
+                held_th[13] |= tcp_flag_psh;
+                deliver(*it);
+                _flows.erase(it);
+            }
+            return;
+        }
+        // Keep the segments of the flow in order
+        deliver(*it);
+        _flows.erase(it);
+    }
+    if (!mergeable || (flags & tcp_flag_psh)) {
+        _deliver(std::move(p));
+        return;
+    }
+    if (_flows.size() == max_flows) {
+        deliver(_flows.front());
+        _flows.erase(_flows.begin());
+    }
+    auto& f = _flows.emplace_back(flow{ip.src_ip.ip, ip.dst_ip.ip, ports, seq + uint32_t(payload_len), ack, window,
+            uint8_t(tcp_len - tcp_hdr_len_min), {}, 1, packet()});
+    std::copy(th + tcp_hdr_len_min, th + tcp_len, f.options.begin());
+    f.p = std::move(p);
+}
+
+void gro::flush() {
+    for (auto& f : _flows) {
+        deliver(f);
+    }
+    _flows.clear();
+}
+
+}
+
+}
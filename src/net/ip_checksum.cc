@@ -22,33 +22,166 @@
 #include <seastar/net/ip_checksum.hh>
 #include <seastar/net/net.hh>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#ifdef __aarch64__
+#include <arm_neon.h>
+#endif
 
 namespace seastar {
 
 namespace net {
 
-void checksummer::sum(const char* data, size_t len) {
-    auto orig_len = len;
-    if (odd) {
-        csum += uint8_t(*data++);
-        --len;
-    }
-    auto p64 = reinterpret_cast<const packed<uint64_t>*>(data);
+namespace {
+
+// The sums below add up the data as 16-bit words in host byte order. The
+// ones' complement sum doesn't depend on the order the words are added
+// in, nor on their byte order, as long as the result is swapped back
+// (RFC 1071), so they can be added 64 bits or a vector at a time.
+
+uint64_t add_with_carry(uint64_t a, uint64_t b) {
+    a += b;
+    return a + (a < b);
+}
+
+uint16_t fold(uint64_t sum) {
+    sum = (sum & 0xffff'ffff) + (sum >> 32);
+    sum = (sum & 0xffff'ffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (sum & 0xffff) + (sum >> 16);
+}
+
+uint64_t sum_scalar(const char* data, size_t len, uint64_t sum = 0) {
     while (len >= 8) {
-        csum += ntohq(*p64++);
+        uint64_t w;
+        std::memcpy(&w, data, 8);
+        sum = add_with_carry(sum, w);
+        data += 8;
         len -= 8;
     }
-    auto p16 = reinterpret_cast<const packed<uint16_t>*>(p64);
-    while (len >= 2) {
-        csum += ntohs(*p16++);
-        len -= 2;
+    // Words past the end, including half of the last one if the length
+    // is odd, are zero
+    uint64_t w = 0;
+    std::memcpy(&w, data, len);
+    return add_with_carry(sum, w);
+}
+
+// 32-bit lanes take up to two 16-bit words per step, so they are spilled
+// into the 64-bit sum before they can overflow
+constexpr size_t max_steps_per_spill = 1 << 15;
+
+#ifdef __x86_64__
+
+[[gnu::target("avx2")]]
+uint64_t sum_avx2(const char* data, size_t len) {
+    uint64_t sum = 0;
+    const __m256i low = _mm256_set1_epi32(0xffff);
+    while (len >= 32) {
+        auto steps = std::min(len / 32, max_steps_per_spill);
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t i = 0; i < steps; i++) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+            acc = _mm256_add_epi32(acc, _mm256_and_si256(v, low));
+            acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+            data += 32;
+        }
+        len -= steps * 32;
+        alignas(32) uint32_t lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        for (auto l : lanes) {
+            sum += l;
+        }
+    }
+    return sum_scalar(data, len, sum);
+}
+
+[[gnu::target("avx512f")]]
+uint64_t sum_avx512(const char* data, size_t len) {
+    uint64_t sum = 0;
+    const __m512i low = _mm512_set1_epi32(0xffff);
+    while (len >= 64) {
+        auto steps = std::min(len / 64, max_steps_per_spill);
+        __m512i acc = _mm512_setzero_si512();
+        for (size_t i = 0; i < steps; i++) {
+            auto v = _mm512_loadu_si512(data);
+            acc = _mm512_add_epi32(acc, _mm512_and_si512(v, low));
+            acc = _mm512_add_epi32(acc, _mm512_srli_epi32(v, 16));
+            data += 64;
+        }
+        len -= steps * 64;
+        alignas(64) uint32_t lanes[16];
+        _mm512_store_si512(lanes, acc);
+        for (auto l : lanes) {
+            sum += l;
+        }
+    }
+    return sum_scalar(data, len, sum);
+}
+
+#endif
+
+#ifdef __aarch64__
+
+uint64_t sum_neon(const char* data, size_t len) {
+    uint64_t sum = 0;
+    while (len >= 16) {
+        auto steps = std::min(len / 16, max_steps_per_spill);
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (size_t i = 0; i < steps; i++) {
+            acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(data))));
+            data += 16;
+        }
+        len -= steps * 16;
+        sum += vaddlvq_u32(acc);
+    }
+    return sum_scalar(data, len, sum);
+}
+
+#endif
+
+using sum_function = uint64_t (*)(const char* data, size_t len);
+
+sum_function pick_sum_function() {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return sum_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return sum_avx2;
     }
-    auto p8 = reinterpret_cast<const uint8_t*>(p16);
-    if (len) {
-        csum += *p8++ << 8;
-        len -= 1;
+#endif
+#ifdef __aarch64__
+    return sum_neon;
+#else
+    return [] (const char* data, size_t len) { return sum_scalar(data, len); };
+#endif
+}
+
+}
+
+uint16_t ones_complement_sum(const char* data, size_t len) noexcept {
+    // Headers are too short for the vector code to pay off
+    if (len < 64) {
+        return fold(sum_scalar(data, len));
+    }
+    static const sum_function sum = pick_sum_function();
+    return fold(sum(data, len));
+}
+
+void checksummer::sum(const char* data, size_t len) {
+    // The sum of data placed at an even offset, in network byte order
+    uint16_t s = ntohs(ones_complement_sum(data, len));
+    // At an odd offset, each byte takes the other half of its word
+    if (odd) {
+        s = (s << 8) | (s >> 8);
     }
-    odd ^= orig_len & 1;
+    csum += s;
+    odd ^= len & 1;
 }
 
 uint16_t checksummer::get() const {
@@ -61,6 +194,8 @@ uint16_t checksummer::get() const {
 }
 
 void checksummer::sum(const packet& p) {
+    // Fragments of any length are summed whole, the parity of where they
+    // start telling how their sums line up
     for (auto&& f : p.fragments()) {
         sum(f.base, f.size);
     }
@@ -0,0 +1,669 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/net/ipv6.hh>
+#include <seastar/net/tcp.hh>
+#include <seastar/net/stack.hh>
+#include <seastar/net/inet_address.hh>
+
+namespace seastar {
+
+namespace net {
+
+ipv6::ipv6(interface* netif)
+    : _netif(netif)
+    , _hw_features(netif->hw_features())
+    , _link_local_address(link_local_address(netif->hw_address()))
+    , _l3(netif, eth_protocol_num::ipv6, [this] { return get_packet(); })
+    , _tcp(*this)
+    , _icmp(*this)
+    , _udp(*this)
+    , _l4({ { uint8_t(ip_protocol_num::tcp), &_tcp }, { uint8_t(ip_protocol_num::icmpv6), &_icmp }, { uint8_t(ip_protocol_num::udp), &_udp }})
+{
+    _hw_features.tx_csum_ip_offload = false;
+    _hw_features.tx_csum_l4_offload = false;
+    _hw_features.rx_csum_offload = false;
+    _hw_features.tx_tso = false;
+    _hw_features.tx_ufo = false;
+    // FIXME: ignored future
+    (void)_l3.receive(
+        [this](packet p, ethernet_address ea) {
+            return handle_received_packet(std::move(p), ea);
+        },
+        [this](forward_hash& out_hash_data, packet& p, size_t off) {
+            return forward(out_hash_data, p, off);
+        });
+}
+
+bool ipv6::forward(forward_hash& out_hash_data, packet& p, size_t off) {
+    auto iph = p.get_header<ipv6_hdr>(off);
+    if (!iph) {
+        return false;
+    }
+
+    push_address(out_hash_data, iph->src_ip);
+    push_address(out_hash_data, iph->dst_ip);
+
+    auto l4 = _l4[iph->next_header];
+    if (l4) {
+        l4->forward(out_hash_data, p, off + sizeof(ipv6_hdr));
+    }
+    return true;
+}
+
+bool ipv6::in_my_prefix(const ipv6_address& a) const {
+    if (_host_address.is_unspecified()) {
+        return false;
+    }
+    auto full_bytes = _prefix_length / 8;
+    if (!std::equal(a.ip.begin(), a.ip.begin() + full_bytes, _host_address.ip.begin())) {
+        return false;
+    }
+    auto rest = _prefix_length % 8;
+    if (!rest) {
+        return true;
+    }
+    uint8_t mask = 0xff << (8 - rest);
+    return !((a.ip[full_bytes] ^ _host_address.ip[full_bytes]) & mask);
+}
+
+bool ipv6::is_my_address(const ipv6_address& a) const {
+    return a == _link_local_address || (a == _host_address && !_host_address.is_unspecified());
+}
+
+bool ipv6::accepts(const ipv6_address& dst) const {
+    static const ipv6_address all_nodes(ipv6_address::ipv6_bytes{0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1});
+    return is_my_address(dst)
+            || dst == all_nodes
+            || dst == solicited_node_address(_link_local_address)
+            || (!_host_address.is_unspecified() && dst == solicited_node_address(_host_address));
+}
+
+future<>
+ipv6::handle_received_packet(packet p, ethernet_address from) {
+    auto iph = p.get_header<ipv6_hdr>(0);
+    if (!iph) {
+        return make_ready_future<>();
+    }
+
+    auto h = ntoh(*iph);
+    if (h.version() != 6) {
+        return make_ready_future<>();
+    }
+    unsigned ip_len = ipv6_hdr_len_min + h.payload_len;
+    unsigned pkt_len = p.len();
+    if (pkt_len > ip_len) {
+        // Trim extra data in the packet beyond IP payload length
+        p.trim_back(pkt_len - ip_len);
+    } else if (pkt_len < ip_len) {
+        // Drop if it contains less than IP payload length
+        return make_ready_future<>();
+    }
+
+    if (!accepts(h.dst_ip)) {
+        // FIXME: forward
+        return make_ready_future<>();
+    }
+
+    // Extension headers (including fragments) are not supported
+    auto l4 = _l4[h.next_header];
+    if (!l4) {
+        return make_ready_future<>();
+    }
+
+    // Neighbor discovery messages must come from the link
+    if (h.next_header == uint8_t(ip_protocol_num::icmpv6) && h.hop_limit != ndp_hop_limit) {
+        auto ih = p.get_header<icmpv6_hdr>(sizeof(ipv6_hdr));
+        if (!ih || (uint8_t(ih->type) >= uint8_t(icmpv6_hdr::msg_type::router_solicitation)
+                && uint8_t(ih->type) <= uint8_t(icmpv6_hdr::msg_type::redirect))) {
+            return make_ready_future<>();
+        }
+    }
+
+    if ((is_link_local(h.src_ip) || in_my_prefix(h.src_ip)) && !is_my_address(h.src_ip)) {
+        _icmp.learn(from, h.src_ip);
+    }
+
+    // Trim IP header and pass to upper layer
+    p.trim_front(sizeof(ipv6_hdr));
+    l4->received(std::move(p), h.src_ip, h.dst_ip);
+    return make_ready_future<>();
+}
+
+future<ethernet_address> ipv6::get_l2_dst_address(ipv6_address to) {
+    if (is_multicast(to)) {
+        return make_ready_future<ethernet_address>(multicast_mac(to));
+    }
+    // Figure out where to send the packet to. If it is a directly connected
+    // host, send to it directly, otherwise send to the default gateway.
+    if (is_link_local(to) || in_my_prefix(to)) {
+        return _icmp.lookup(to);
+    }
+    if (_gw_address.is_unspecified()) {
+        return make_exception_future<ethernet_address>(ndp_error("No IPv6 route to host"));
+    }
+    return _icmp.lookup(_gw_address);
+}
+
+ipv6_address ipv6::source_address(const ipv6_address& to) const {
+    if (_host_address.is_unspecified() || is_link_local(to) || is_multicast(to)) {
+        return _link_local_address;
+    }
+    return _host_address;
+}
+
+void ipv6::send(ipv6_address to, ip_protocol_num proto_num, packet p, ethernet_address e_dst, uint8_t hop_limit) {
+    if (p.len() + ipv6_hdr_len_min > _hw_features.mtu) {
+        // No fragmentation
+        return;
+    }
+
+    auto iph = p.prepend_header<ipv6_hdr>();
+    iph->ver_tc_flow = uint32_t(6) << 28;
+    iph->payload_len = p.len() - sizeof(ipv6_hdr);
+    iph->next_header = uint8_t(proto_num);
+    iph->hop_limit = hop_limit;
+    iph->src_ip = source_address(to);
+    iph->dst_ip = to;
+    *iph = hton(*iph);
+
+    _packetq.push_back(l3_protocol::l3packet{eth_protocol_num::ipv6, e_dst, std::move(p)});
+}
+
+std::optional<l3_protocol::l3packet> ipv6::get_packet() {
+    if (_packetq.empty()) {
+        for (size_t i = 0; i < _pkt_providers.size(); i++) {
+            auto l4p = _pkt_providers[_pkt_provider_idx++]();
+            if (_pkt_provider_idx == _pkt_providers.size()) {
+                _pkt_provider_idx = 0;
+            }
+            if (l4p) {
+                auto l4pv = std::move(l4p.value());
+                send(l4pv.to, l4pv.proto_num, std::move(l4pv.p), l4pv.e_dst, l4pv.hop_limit);
+                break;
+            }
+        }
+    }
+
+    std::optional<l3_protocol::l3packet> p;
+    if (!_packetq.empty()) {
+        p = std::move(_packetq.front());
+        _packetq.pop_front();
+    }
+    return p;
+}
+
+void ipv6::set_host_address(ipv6_address ip) {
+    _host_address = ip;
+}
+
+ipv6_address ipv6::host_address() const {
+    return _host_address.is_unspecified() ? _link_local_address : _host_address;
+}
+
+ipv6_address ipv6::link_local_address() const {
+    return _link_local_address;
+}
+
+void ipv6::set_gw_address(ipv6_address ip) {
+    _gw_address = ip;
+}
+
+ipv6_address ipv6::gw_address() const {
+    return _gw_address;
+}
+
+void ipv6::set_prefix_length(unsigned prefix_length) {
+    _prefix_length = std::min(prefix_length, 128u);
+}
+
+unsigned ipv6::prefix_length() const {
+    return _prefix_length;
+}
+
+ipv6_address ipv6::solicited_node_address(const ipv6_address& a) {
+    return ipv6_address(ipv6_address::ipv6_bytes{0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0xff, a.ip[13], a.ip[14], a.ip[15]});
+}
+
+ethernet_address ipv6::multicast_mac(const ipv6_address& a) {
+    return ethernet_address{0x33, 0x33, a.ip[12], a.ip[13], a.ip[14], a.ip[15]};
+}
+
+ipv6_address ipv6::link_local_address(ethernet_address mac) {
+    // fe80::/64 with the modified EUI-64 interface identifier
+    auto& m = mac.mac;
+    return ipv6_address(ipv6_address::ipv6_bytes{0xfe, 0x80, 0, 0, 0, 0, 0, 0,
+            uint8_t(m[0] ^ 0x02), m[1], m[2], 0xff, 0xfe, m[3], m[4], m[5]});
+}
+
+// Neighbor discovery message layouts (RFC 4861)
+static constexpr size_t nd_target_offset = 8;
+static constexpr size_t nd_options_offset = 24;
+static constexpr uint8_t nd_option_source_link_layer_address = 1;
+static constexpr uint8_t nd_option_target_link_layer_address = 2;
+static constexpr uint8_t na_flag_solicited = 0x40;
+static constexpr uint8_t na_flag_override = 0x20;
+
+static void icmpv6_checksum(packet& p, const ipv6_address& src, const ipv6_address& dst) {
+    auto hdr = p.get_header<icmpv6_hdr>(0);
+    hdr->csum = 0;
+    checksummer csum;
+    ipv6_traits::pseudo_header_checksum(csum, src, dst, ip_protocol_num::icmpv6, p.len());
+    csum.sum(p);
+    hdr->csum = csum.get();
+}
+
+// Looks for a link-layer address option of a (linearized) neighbor
+// discovery message
+static std::optional<ethernet_address> find_link_layer_address(const packet& p, uint8_t option) {
+    auto data = p.frag(0).base;
+    size_t off = nd_options_offset;
+    while (off + 2 <= p.len()) {
+        size_t len = uint8_t(data[off + 1]) * 8;
+        if (!len || off + len > p.len()) {
+            break;
+        }
+        if (uint8_t(data[off]) == option && len >= 2 + ethernet_address::size()) {
+            return ethernet_address::read(data + off + 2);
+        }
+        off += len;
+    }
+    return std::nullopt;
+}
+
+ipv6_icmp::ipv6_icmp(ipv6& inet)
+    : _inet(inet) {
+    _inet.register_packet_provider([this] {
+        std::optional<ipv6_traits::l4packet> l4p;
+        if (!_packetq.empty()) {
+            l4p = std::move(_packetq.front());
+            _packetq.pop_front();
+            _queue_space.signal(l4p.value().p.len());
+        }
+        return l4p;
+    });
+}
+
+void ipv6_icmp::send(ipv6_address to, ethernet_address e_dst, packet p, uint8_t hop_limit) {
+    if (_queue_space.try_wait(p.len())) { // drop packets that do not fit the queue
+        _packetq.emplace_back(ipv6_traits::l4packet{to, std::move(p), e_dst, ip_protocol_num::icmpv6, hop_limit});
+    }
+}
+
+void ipv6_icmp::received(packet p, ipv6_address from, ipv6_address to) {
+    if (p.len() < sizeof(icmpv6_hdr)) {
+        return;
+    }
+    p.linearize();
+    checksummer csum;
+    ipv6_traits::pseudo_header_checksum(csum, from, to, ip_protocol_num::icmpv6, p.len());
+    csum.sum(p);
+    if (csum.get() != 0) {
+        return;
+    }
+
+    auto hdr = p.get_header<icmpv6_hdr>(0);
+    switch (hdr->type) {
+    case icmpv6_hdr::msg_type::echo_request: {
+        hdr->type = icmpv6_hdr::msg_type::echo_reply;
+        hdr->code = 0;
+        icmpv6_checksum(p, _inet.source_address(from), from);
+        if (_queue_space.try_wait(p.len())) { // drop packets that do not fit the queue
+            // FIXME: future is discarded
+            (void)_inet.get_l2_dst_address(from).then([this, from, p = std::move(p)] (ethernet_address e_dst) mutable {
+                _packetq.emplace_back(ipv6_traits::l4packet{from, std::move(p), e_dst, ip_protocol_num::icmpv6});
+            });
+        }
+        break;
+    }
+    case icmpv6_hdr::msg_type::neighbor_solicitation:
+        handle_solicitation(std::move(p), from);
+        break;
+    case icmpv6_hdr::msg_type::neighbor_advertisement:
+        handle_advertisement(std::move(p));
+        break;
+    default:
+        break;
+    }
+}
+
+void ipv6_icmp::handle_solicitation(packet p, ipv6_address from) {
+    if (p.len() < nd_options_offset) {
+        return;
+    }
+    auto target = ipv6_address::read(p.frag(0).base + nd_target_offset);
+    if (!_inet.is_my_address(target)) {
+        return;
+    }
+    auto sender = find_link_layer_address(p, nd_option_source_link_layer_address);
+    // An unspecified source is a duplicate address detection probe, which
+    // is answered to all nodes
+    bool dad = from.is_unspecified();
+    auto to = from;
+    ethernet_address e_dst;
+    if (dad) {
+        to = ipv6_address(ipv6_address::ipv6_bytes{0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1});
+        e_dst = ipv6::multicast_mac(to);
+    } else if (sender) {
+        learn(*sender, from);
+        e_dst = *sender;
+    } else {
+        auto i = _neighbors.find(from);
+        if (i == _neighbors.end()) {
+            return;
+        }
+        e_dst = i->second;
+    }
+
+    packet na;
+    auto h = na.prepend_uninitialized_header(nd_options_offset + 8);
+    std::fill_n(h, nd_options_offset + 8, 0);
+    h[0] = uint8_t(icmpv6_hdr::msg_type::neighbor_advertisement);
+    h[4] = (dad ? 0 : na_flag_solicited) | na_flag_override;
+    target.write(h + nd_target_offset);
+    h[nd_options_offset] = nd_option_target_link_layer_address;
+    h[nd_options_offset + 1] = 1;
+    _inet.netif()->hw_address().write(h + nd_options_offset + 2);
+    icmpv6_checksum(na, _inet.source_address(to), to);
+    send(to, e_dst, std::move(na), ipv6::ndp_hop_limit);
+}
+
+void ipv6_icmp::handle_advertisement(packet p) {
+    if (p.len() < nd_options_offset) {
+        return;
+    }
+    auto target = ipv6_address::read(p.frag(0).base + nd_target_offset);
+    auto l2 = find_link_layer_address(p, nd_option_target_link_layer_address);
+    if (l2) {
+        // The waiters of this shard need not wait for the other shards
+        learn(*l2, target);
+        ndp_learn(*l2, target);
+    }
+}
+
+void ipv6_icmp::send_solicitation(const ipv6_address& target) {
+    auto to = ipv6::solicited_node_address(target);
+    packet ns;
+    auto h = ns.prepend_uninitialized_header(nd_options_offset + 8);
+    std::fill_n(h, nd_options_offset + 8, 0);
+    h[0] = uint8_t(icmpv6_hdr::msg_type::neighbor_solicitation);
+    target.write(h + nd_target_offset);
+    h[nd_options_offset] = nd_option_source_link_layer_address;
+    h[nd_options_offset + 1] = 1;
+    _inet.netif()->hw_address().write(h + nd_options_offset + 2);
+    icmpv6_checksum(ns, _inet.source_address(to), to);
+    send(to, ipv6::multicast_mac(to), std::move(ns), ipv6::ndp_hop_limit);
+}
+
+future<ethernet_address> ipv6_icmp::lookup(const ipv6_address& addr) {
+    auto i = _neighbors.find(addr);
+    if (i != _neighbors.end()) {
+        return make_ready_future<ethernet_address>(i->second);
+    }
+    auto j = _in_progress.find(addr);
+    auto first_request = j == _in_progress.end();
+    auto& res = first_request ? _in_progress[addr] : j->second;
+
+    if (first_request) {
+        res._timeout_timer.set_callback([addr, this, &res] {
+            send_solicitation(addr);
+            for (auto& w : res._waiters) {
+                w.set_exception(ndp_error("NDP timeout"));
+            }
+            res._waiters.clear();
+        });
+        res._timeout_timer.arm_periodic(std::chrono::seconds(1));
+        send_solicitation(addr);
+    }
+
+    if (res._waiters.size() >= max_waiters) {
+        return make_exception_future<ethernet_address>(ndp_error("NDP waiter's queue is full"));
+    }
+
+    res._waiters.emplace_back();
+    return res._waiters.back().get_future();
+}
+
+void ipv6_icmp::learn(ethernet_address l2, const ipv6_address& l3) {
+    _neighbors[l3] = l2;
+    auto i = _in_progress.find(l3);
+    if (i != _in_progress.end()) {
+        auto& res = i->second;
+        res._timeout_timer.cancel();
+        for (auto&& pr : res._waiters) {
+            pr.set_value(l2);
+        }
+        _in_progress.erase(i);
+    }
+}
+
+namespace ipv6_udp_impl {
+
+class native_datagram : public udp_datagram_impl {
+private:
+    ipv6_addr _src;
+    ipv6_addr _dst;
+    packet _p;
+public:
+    native_datagram(ipv6_address src, ipv6_address dst, packet p)
+            : _src(src.ip), _dst(dst.ip), _p(std::move(p)) {
+        udp_hdr* hdr = _p.get_header<udp_hdr>();
+        auto h = ntoh(*hdr);
+        _p.trim_front(sizeof(*hdr));
+        _src.port = h.src_port;
+        _dst.port = h.dst_port;
+    }
+
+    virtual socket_address get_src() override {
+        return _src;
+    };
+
+    virtual socket_address get_dst() override {
+        return _dst;
+    };
+
+    virtual uint16_t get_dst_port() override {
+        return _dst.port;
+    }
+
+    virtual packet& get_data() override {
+        return _p;
+    }
+};
+
+class native_channel : public udp_channel_impl {
+private:
+    ipv6_udp& _proto;
+    ipv6_udp::registration _reg;
+    bool _closed;
+    lw_shared_ptr<udp_channel_state> _state;
+
+public:
+    native_channel(ipv6_udp &proto, ipv6_udp::registration reg, lw_shared_ptr<udp_channel_state> state)
+            : _proto(proto)
+            , _reg(reg)
+            , _closed(false)
+            , _state(state)
+    {
+    }
+
+    ~native_channel()
+    {
+        if (!_closed)
+            close();
+    }
+
+    socket_address local_address() const override {
+        return socket_address(_proto.inet().host_address(), _reg.port());
+    }
+
+    virtual future<udp_datagram> receive() override {
+        return _state->_queue.pop_eventually();
+    }
+
+    virtual future<> send(const socket_address& dst, const char* msg) override {
+        return send(dst, packet::from_static_data(msg, strlen(msg)));
+    }
+
+    virtual future<> send(const socket_address& dst, packet p) override {
+        auto len = p.len();
+        return _state->wait_for_send_buffer(len).then([this, dst, p = std::move(p), len] () mutable {
+            p = packet(std::move(p), make_deleter([s = _state, len] { s->complete_send(len); }));
+            _proto.send(_reg.port(), dst, std::move(p));
+        });
+    }
+
+    virtual bool is_closed() const override {
+        return _closed;
+    }
+
+    virtual void shutdown_input() override {
+        _state->_queue.abort(std::make_exception_ptr(std::system_error(EBADF, std::system_category())));
+    }
+
+    virtual void shutdown_output() override {
+        _state->_queue.abort(std::make_exception_ptr(std::system_error(EPIPE, std::system_category())));
+    }
+
+    virtual void close() override {
+        _reg.unregister();
+        _closed = true;
+    }
+};
+
+} /* namespace ipv6_udp_impl */
+
+using namespace net::ipv6_udp_impl;
+
+const int ipv6_udp::default_queue_size = 1024;
+
+ipv6_udp::ipv6_udp(ipv6& inet)
+    : _inet(inet)
+{
+    _inet.register_packet_provider([this] {
+        std::optional<ipv6_traits::l4packet> l4p;
+        if (!_packetq.empty()) {
+            l4p = std::move(_packetq.front());
+            _packetq.pop_front();
+        }
+        return l4p;
+    });
+}
+
+bool ipv6_udp::forward(forward_hash& out_hash_data, packet& p, size_t off)
+{
+    auto uh = p.get_header<udp_hdr>(off);
+
+    if (uh) {
+        out_hash_data.push_back(uh->src_port);
+        out_hash_data.push_back(uh->dst_port);
+    }
+    return true;
+}
+
+void ipv6_udp::received(packet p, ipv6_address from, ipv6_address to)
+{
+    if (p.len() < sizeof(udp_hdr)) {
+        return;
+    }
+    // The checksum is mandatory in IPv6
+    checksummer csum;
+    ipv6_traits::udp_pseudo_header_checksum(csum, from, to, p.len());
+    csum.sum(p);
+    if (csum.get() != 0) {
+        return;
+    }
+
+    udp_datagram dgram(std::make_unique<native_datagram>(from, to, std::move(p)));
+
+    auto chan_it = _channels.find(dgram.get_dst_port());
+    if (chan_it != _channels.end()) {
+        auto chan = chan_it->second;
+        chan->_queue.push(std::move(dgram));
+    }
+}
+
+void ipv6_udp::send(uint16_t src_port, ipv6_addr dst_addr, packet &&p)
+{
+    auto dst = ipv6_address(dst_addr);
+    auto src = _inet.source_address(dst);
+    auto hdr = p.prepend_header<udp_hdr>();
+    hdr->src_port = src_port;
+    hdr->dst_port = dst_addr.port;
+    hdr->len = p.len();
+    *hdr = hton(*hdr);
+
+    offload_info oi;
+    checksummer csum;
+    ipv6_traits::udp_pseudo_header_checksum(csum, src, dst, p.len());
+    csum.sum(p);
+    // A zero checksum is transmitted as all ones
+    auto cksum = csum.get();
+    hdr->cksum = cksum ? cksum : 0xffff;
+    oi.needs_csum = false;
+    oi.protocol = ip_protocol_num::udp;
+    oi.ip_hdr_len = ipv6_hdr_len_min;
+    p.set_offload_info(oi);
+
+    // FIXME: future is discarded
+    (void)_inet.get_l2_dst_address(dst).then([this, dst, p = std::move(p)] (ethernet_address e_dst) mutable {
+        _packetq.emplace_back(ipv6_traits::l4packet{dst, std::move(p), e_dst, ip_protocol_num::udp});
+    });
+}
+
+uint16_t ipv6_udp::next_port(uint16_t port) {
+    return (port + 1) == 0 ? min_anonymous_port : port + 1;
+}
+
+udp_channel
+ipv6_udp::make_channel(ipv6_addr addr) {
+    if (!addr.is_ip_unspecified() && !_inet.is_my_address(ipv6_address(addr))) {
+        throw std::runtime_error("Binding to specific IP not supported yet");
+    }
+
+    uint16_t bind_port;
+
+    if (!addr.is_port_unspecified()) {
+        if (_channels.count(addr.port)) {
+            throw std::runtime_error("Address already in use");
+        }
+        bind_port = addr.port;
+    } else {
+        auto starting_port = _next_anonymous_port;
+        while (_channels.count(_next_anonymous_port)) {
+            _next_anonymous_port = next_port(_next_anonymous_port);
+            if (starting_port == _next_anonymous_port) {
+                throw std::runtime_error("No free port");
+            }
+        }
+
+        bind_port = _next_anonymous_port;
+        _next_anonymous_port = next_port(_next_anonymous_port);
+    }
+
+    auto chan_state = make_lw_shared<udp_channel_state>(_queue_size);
+    _channels[bind_port] = chan_state;
+    return udp_channel(std::make_unique<native_channel>(*this, registration(*this, bind_port), chan_state));
+}
+
+}
+
+}
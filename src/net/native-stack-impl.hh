@@ -24,6 +24,9 @@
 #include <seastar/net/stack.hh>
 #include <iostream>
 #include <seastar/net/inet_address.hh>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <cstring>
 
 namespace seastar {
 
@@ -62,11 +65,11 @@ native_server_socket_impl<Protocol>::accept() {
         // Save "conn" contents before call below function
         // "conn" is moved in 1st argument, and used in 2nd argument
         // It causes trouble on Arm which passes arguments from left to right
-        auto ip = conn.foreign_ip().ip;
+        auto ip = conn.foreign_ip();
         auto port = conn.foreign_port();
         return make_ready_future<accept_result>(accept_result{
                 connected_socket(std::make_unique<native_connected_socket_impl<Protocol>>(make_lw_shared(std::move(conn)))),
-                make_ipv4_address(ip, port)});
+                socket_address(ip, port)});
     });
 }
 
@@ -103,6 +106,7 @@ class native_connected_socket_impl : public connected_socket_impl {
     keepalive_params get_keepalive_parameters() const override;
     int get_sockopt(int level, int optname, void* data, size_t len) const override;
     void set_sockopt(int level, int optname, const void* data, size_t len) override;
+    tcp_connection_stats get_tcp_stats() const override;
     socket_address local_address() const noexcept override;
 };
 
@@ -119,7 +123,7 @@ class native_socket_impl final : public socket_impl {
         assert(proto == transport::TCP);
 
         // FIXME: local is ignored since native stack does not support multiple IPs yet
-        assert(sa.as_posix_sockaddr().sa_family == AF_INET);
+        assert(sa.as_posix_sockaddr().sa_family == (std::is_same_v<typename Protocol::ipaddr, ipv6_address> ? AF_INET6 : AF_INET));
 
         _conn = make_lw_shared<typename Protocol::connection>(_proto.connect(sa));
         return _conn->connected().then([conn = _conn]() mutable {
@@ -257,14 +261,62 @@ keepalive_params native_connected_socket_impl<Protocol>::get_keepalive_parameter
 
 template<typename Protocol>
 void native_connected_socket_impl<Protocol>::set_sockopt(int level, int optname, const void* data, size_t len) {
+    if (level == IPPROTO_TCP && optname == TCP_CONGESTION) {
+        auto name = static_cast<const char*>(data);
+        _conn->set_congestion_control(std::string_view(name, strnlen(name, len)));
+        return;
+    }
     throw std::runtime_error("Setting custom socket options is not supported for native stack");
 }
 
 template<typename Protocol>
 int native_connected_socket_impl<Protocol>::get_sockopt(int level, int optname, void* data, size_t len) const {
+    if (level == IPPROTO_TCP && optname == TCP_CONGESTION) {
+        std::string_view name = _conn->congestion_control();
+        std::memset(data, 0, len);
+        std::memcpy(data, name.data(), std::min(name.size(), len));
+        return 0;
+    }
+    if (level == IPPROTO_TCP && optname == TCP_INFO) {
+        // Only the congestion control and round-trip time fields are filled
+        // in, in the units Linux uses
+        auto info = _conn->info();
+        auto mss = std::max<uint32_t>(info.snd_mss, 1);
+        auto us = [] (std::chrono::milliseconds t) {
+            return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(t).count());
+        };
+        struct tcp_info ti = {};
+        ti.tcpi_snd_mss = info.snd_mss;
+        ti.tcpi_rcv_mss = info.rcv_mss;
+        ti.tcpi_snd_cwnd = info.cwnd / mss;
+        ti.tcpi_snd_ssthresh = info.ssthresh / mss;
+        ti.tcpi_unacked = (info.flight_size + mss - 1) / mss;
+        ti.tcpi_sacked = info.sacked_bytes / mss;
+        ti.tcpi_rtt = us(info.srtt);
+        ti.tcpi_rttvar = us(info.rttvar);
+        ti.tcpi_rto = us(info.rto);
+        ti.tcpi_total_retrans = info.total_retransmits;
+        std::memset(data, 0, len);
+        std::memcpy(data, &ti, std::min(sizeof(ti), len));
+        return 0;
+    }
     throw std::runtime_error("Getting custom socket options is not supported for native stack");
 }
 
+template<typename Protocol>
+tcp_connection_stats native_connected_socket_impl<Protocol>::get_tcp_stats() const {
+    auto info = _conn->info();
+    return tcp_connection_stats {
+        .srtt = info.srtt,
+        .rttvar = info.rttvar,
+        .rto = info.rto,
+        .cwnd = info.cwnd,
+        .unacked_bytes = info.flight_size,
+        .unsent_bytes = info.unsent_bytes,
+        .total_retransmits = info.total_retransmits,
+    };
+}
+
 template<typename Protocol>
 socket_address native_connected_socket_impl<Protocol>::local_address() const noexcept {
     return {_conn->local_ip(), _conn->local_port()};
@@ -23,10 +23,12 @@
 #include "net/native-stack-impl.hh"
 #include <seastar/net/net.hh>
 #include <seastar/net/ip.hh>
+#include <seastar/net/ipv6.hh>
 #include <seastar/net/tcp-stack.hh>
 #include <seastar/net/tcp.hh>
 #include <seastar/net/udp.hh>
 #include <seastar/net/virtio.hh>
+#include <seastar/net/xdp.hh>
 #include <seastar/net/dpdk.hh>
 #include <seastar/net/proxy.hh>
 #include <seastar/net/dhcp.hh>
@@ -70,11 +72,21 @@ void create_native_net_device(const native_stack_options& opts) {
     if ( deprecated_config_used) {
 #ifdef SEASTAR_HAVE_DPDK
         if ( opts.dpdk_pmd) {
-             dev = create_dpdk_net_device(opts.dpdk_opts.dpdk_port_index.get_value(), smp::count,
+             uint16_t port_idx = opts.dpdk_opts.dpdk_port_index.get_value();
+             if (opts.dpdk_opts.bond_ports) {
+                 port_idx = create_dpdk_bonded_port(opts.dpdk_opts.bond_ports.get_value(), opts.dpdk_opts.bond_mode.get_value());
+             }
+             dev = create_dpdk_net_device(port_idx, smp::count,
                 !(opts.lro && opts.lro.get_value() == "off"),
                 !(opts.dpdk_opts.hw_fc && opts.dpdk_opts.hw_fc.get_value() == "off"));
        } else 
 #endif  
+        if (opts.xdp_opts.xdp_interface) {
+            bool dhcp = opts.host_ipv4_addr.defaulted()
+                    && opts.gw_ipv4_addr.defaulted()
+                    && opts.netmask_ipv4_addr.defaulted() && opts.dhcp.get_value();
+            dev = create_xdp_net_device(opts.xdp_opts, dhcp ? ipv4_address() : ipv4_address(opts.host_ipv4_addr.get_value()));
+        } else
         dev = create_virtio_net_device(opts.virtio_opts, opts.lro);
     }
     else {
@@ -114,6 +126,11 @@ void create_native_net_device(const native_stack_options& opts) {
                 }
                 cpu_weights[qid] = opts.hw_queue_weight.get_value();
                 qp->configure_proxies(cpu_weights);
+                auto hw_features = sdev->hw_features();
+                if (!(opts.gro && opts.gro.get_value() == "off")
+                        && hw_features.rx_csum_offload && !hw_features.rx_lro) {
+                    qp->enable_gro();
+                }
                 sdev->set_local_queue(std::move(qp));
             } else {
                 auto master = qid % sdev->hw_queues_count();
@@ -146,6 +163,7 @@ class native_network_stack : public network_stack {
 private:
     interface _netif;
     ipv4 _inet;
+    ipv6 _inet6;
     bool _dhcp = false;
     promise<> _config;
     timer<> _timer;
@@ -156,6 +174,7 @@ class native_network_stack : public network_stack {
         _inet.set_packet_filter(filter);
     }
     using tcp4 = tcp<ipv4_traits>;
+    using tcp6 = tcp<ipv6_traits>;
 public:
     explicit native_network_stack(const native_stack_options& opts, std::shared_ptr<device> dev);
     virtual server_socket listen(socket_address sa, listen_options opt) override;
@@ -174,7 +193,14 @@ class native_network_stack : public network_stack {
     void arp_learn(ethernet_address l2, ipv4_address l3) {
         _inet.learn(l2, l3);
     }
+    void ndp_learn(ethernet_address l2, ipv6_address l3) {
+        _inet6.learn(l2, l3);
+    }
+    virtual bool supports_ipv6() const override {
+        return true;
+    }
     friend class native_server_socket_impl<tcp4>;
+    friend class native_server_socket_impl<tcp6>;
 
     class native_network_interface;
     friend class native_network_interface;
@@ -186,13 +212,27 @@ thread_local promise<std::unique_ptr<network_stack>> native_network_stack::ready
 
 udp_channel
 native_network_stack::make_udp_channel(const socket_address& addr) {
+    if (addr.family() == AF_INET6) {
+        return _inet6.get_udp().make_channel(addr);
+    }
     return _inet.get_udp().make_channel(addr);
 }
 
 native_network_stack::native_network_stack(const native_stack_options& opts, std::shared_ptr<device> dev)
     : _netif(std::move(dev))
-    , _inet(&_netif) {
+    , _inet(&_netif)
+    , _inet6(&_netif) {
     _inet.get_udp().set_queue_size(opts.udpv4_queue_size.get_value());
+    _inet6.get_udp().set_queue_size(opts.udpv4_queue_size.get_value());
+    _inet.get_tcp().set_congestion_control(opts.tcp_congestion_control.get_value());
+    _inet6.get_tcp().set_congestion_control(opts.tcp_congestion_control.get_value());
+    if (opts.host_ipv6_addr) {
+        _inet6.set_host_address(ipv6_address(opts.host_ipv6_addr.get_value()));
+        _inet6.set_prefix_length(opts.ipv6_prefix_length.get_value());
+    }
+    if (opts.gw_ipv6_addr) {
+        _inet6.set_gw_address(ipv6_address(opts.gw_ipv6_addr.get_value()));
+    }
     _dhcp = opts.host_ipv4_addr.defaulted()
             && opts.gw_ipv4_addr.defaulted()
             && opts.netmask_ipv4_addr.defaulted() && opts.dhcp.get_value();
@@ -205,12 +245,11 @@ native_network_stack::native_network_stack(const native_stack_options& opts, std
 
 server_socket
 native_network_stack::listen(socket_address sa, listen_options opts) {
-    assert(sa.family() == AF_INET || sa.is_unspecified());
-    return tcpv4_listen(_inet.get_tcp(), ntohs(sa.as_posix_sockaddr_in().sin_port), opts);
+    return tcp_dual_stack_listen(_inet.get_tcp(), _inet6.get_tcp(), sa, opts);
 }
 
 seastar::socket native_network_stack::socket() {
-    return tcpv4_socket(_inet.get_tcp());
+    return tcp_dual_stack_socket(_inet.get_tcp(), _inet6.get_tcp());
 }
 
 using namespace std::chrono_literals;
@@ -295,6 +334,17 @@ void arp_learn(ethernet_address l2, ipv4_address l3)
     });
 }
 
+void ndp_learn(ethernet_address l2, ipv6_address l3)
+{
+    // Run ndp_learn on all shard in the background
+    (void)smp::invoke_on_all([l2, l3] {
+        // The interface may be driven without a native stack, as by tests
+        if (auto ns = dynamic_cast<native_network_stack*>(&engine().net())) {
+            ns->ndp_learn(l2, l3);
+        }
+    });
+}
+
 void create_native_stack(const native_stack_options& opts, std::shared_ptr<device> dev) {
     native_network_stack::ready_promise.set_value(std::unique_ptr<network_stack>(std::make_unique<native_network_stack>(opts, std::move(dev))));
 }
@@ -316,6 +366,15 @@ native_stack_options::native_stack_options()
     , netmask_ipv4_addr(*this, "netmask-ipv4-addr",
                 "255.255.255.0",
                 "static IPv4 netmask to use")
+    , host_ipv6_addr(*this, "host-ipv6-addr",
+                {},
+                "static IPv6 address to use")
+    , gw_ipv6_addr(*this, "gw-ipv6-addr",
+                {},
+                "static IPv6 gateway to use")
+    , ipv6_prefix_length(*this, "ipv6-prefix-length",
+                64,
+                "length of the on-link IPv6 prefix")
     , udpv4_queue_size(*this, "udpv4-queue-size",
                 ipv4_udp::default_queue_size,
                 "Default size of the UDPv4 per-channel packet queue")
@@ -333,8 +392,15 @@ native_stack_options::native_stack_options()
     , lro(*this, "lro",
                 "on",
                 "Enable LRO")
+    , gro(*this, "gro",
+                "on",
+                "Enable software receive offload when the device does not support LRO")
+    , tcp_congestion_control(*this, "tcp-congestion-control",
+                "reno",
+                "TCP congestion control algorithm of new connections (reno, cubic or bbr)")
     , virtio_opts(this)
     , dpdk_opts(this)
+    , xdp_opts(this)
 {
 }
 
@@ -351,6 +417,10 @@ class native_network_stack::native_network_interface : public net::network_inter
         : _stack(stack)
         , _addresses(1, _stack._inet.host_address())
     {
+        _addresses.emplace_back(_stack._inet6.link_local_address());
+        if (_stack._inet6.host_address() != _stack._inet6.link_local_address()) {
+            _addresses.emplace_back(_stack._inet6.host_address());
+        }
         const auto mac = _stack._inet.netif()->hw_address().mac;
         _hardware_address = std::vector<uint8_t>{mac.cbegin(), mac.cend()};
     }
@@ -385,7 +455,7 @@ class native_network_stack::native_network_interface : public net::network_inter
         return true;
     }
     bool supports_ipv6() const override {
-        return false;
+        return true;
     }
 };
 
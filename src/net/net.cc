@@ -110,7 +110,7 @@ bool qp::poll_tx() {
 
 qp::qp(bool register_copy_stats,
        const std::string stats_plugin_name, uint8_t qid)
-        : _tx_poller(std::make_unique<internal::poller>(reactor::poller::simple([this] { return poll_tx(); })))
+        : _tx_poller(std::make_unique<internal::poller>(reactor::poller::simple([this] { return poll_tx(); }, {"net_tx"})))
         , _stats_plugin_name(stats_plugin_name)
         , _queue_name(std::string("queue") + std::to_string(qid))
 {
@@ -198,6 +198,118 @@ qp::qp(bool register_copy_stats,
 qp::~qp() {
 }
 
+void qp::deliver_rx_batch() {
+    // The headers of the next few packets are fetched while the current one
+    // goes through the protocol handlers, so the handlers do not stall on
+    // cache misses
+    static constexpr size_t prefetch_distance = 4;
+    auto prefetch = [] (const packet& p) {
+        if (!p.nr_frags()) {
+            return;
+        }
+        auto f = p.frag(0);
+        __builtin_prefetch(f.base);
+        if (f.size > 64) {
+            __builtin_prefetch(f.base + 64);
+        }
+    };
+
+    // A packet received by a handler must not end up in the batch being
+    // iterated on
+    std::swap(_rx_batch, _rx_delivering);
+    auto n = _rx_delivering.size();
+    for (size_t i = 0; i < std::min(n, prefetch_distance); ++i) {
+        prefetch(_rx_delivering[i]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (i + prefetch_distance < n) {
+            prefetch(_rx_delivering[i + prefetch_distance]);
+        }
+        if (_gro) {
+            _gro->receive(std::move(_rx_delivering[i]));
+        } else {
+            // FIXME: future is discarded
+            (void)_rx_stream.produce(std::move(_rx_delivering[i]));
+        }
+    }
+    _rx_delivering.clear();
+    if (_gro) {
+        _gro->flush();
+    }
+}
+
+std::vector<uint32_t> qp::flow_hashes() const {
+    std::vector<uint32_t> hashes;
+    for (auto& provider : _flow_providers) {
+        provider(hashes);
+    }
+    return hashes;
+}
+
+std::vector<uint64_t> qp::take_rss_bucket_load() {
+    auto load = _rss_bucket_load;
+    std::fill(_rss_bucket_load.begin(), _rss_bucket_load.end(), 0);
+    return load;
+}
+
+std::vector<reta_move> plan_reta_rebalance(std::vector<uint8_t> reta, const std::vector<uint64_t>& bucket_load,
+        unsigned nr_queues, double max_imbalance, unsigned max_moves) {
+    std::vector<reta_move> moves;
+    std::vector<uint64_t> queue_load(nr_queues);
+    uint64_t total = 0;
+    for (size_t b = 0; b < reta.size(); ++b) {
+        queue_load[reta[b]] += bucket_load[b];
+        total += bucket_load[b];
+    }
+    double limit = double(total) / nr_queues * (1 + max_imbalance);
+    while (total && moves.size() < max_moves) {
+        auto hot = std::max_element(queue_load.begin(), queue_load.end()) - queue_load.begin();
+        auto cold = std::min_element(queue_load.begin(), queue_load.end()) - queue_load.begin();
+        if (queue_load[hot] <= limit) {
+            break;
+        }
+        // Moving a bucket with less load than the gap between the two
+        // queues lowers the maximum; the best one leaves them even
+        auto gap = queue_load[hot] - queue_load[cold];
+        std::optional<size_t> best;
+        uint64_t best_score = 0;
+        for (size_t b = 0; b < reta.size(); ++b) {
+            auto load = bucket_load[b];
+            if (reta[b] != hot || load == 0 || load >= gap) {
+                continue;
+            }
+            auto score = std::min(load, gap - load);
+            if (!best || score > best_score) {
+                best = b;
+                best_score = score;
+            }
+        }
+        if (!best) {
+            break;
+        }
+        reta[*best] = cold;
+        queue_load[hot] -= bucket_load[*best];
+        queue_load[cold] += bucket_load[*best];
+        moves.push_back(reta_move{unsigned(*best), unsigned(hot), unsigned(cold)});
+    }
+    return moves;
+}
+
+void qp::enable_gro() {
+    namespace sm = metrics;
+
+    _gro = std::make_unique<gro>([this] (packet p) {
+        // FIXME: future is discarded
+        (void)_rx_stream.produce(std::move(p));
+    });
+    _metrics.add_group(_stats_plugin_name, {
+        sm::make_derive(_queue_name + "_rx_gro_merged_segments", [this] { return _gro->get_stats().merged_segments; },
+                        sm::description("Counts a number of received TCP segments that were merged into a preceding segment of the same flow.")),
+        sm::make_derive(_queue_name + "_rx_gro_packets", [this] { return _gro->get_stats().merged_packets; },
+                        sm::description(format("Counts a number of packets made of several received TCP segments. Divide {} by this value to get an average number of segments merged into one.", _queue_name + "_rx_gro_merged_segments"))),
+    });
+}
+
 void qp::configure_proxies(const std::map<unsigned, float>& cpu_weights) {
     assert(!cpu_weights.empty());
     if ((cpu_weights.size() == 1 && cpu_weights.begin()->first == this_shard_id())) {
@@ -302,6 +414,18 @@ unsigned interface::hash2cpu(uint32_t hash) {
     return _dev->hash2cpu(hash);
 }
 
+void interface::register_flow_provider(std::function<void (std::vector<uint32_t>&)> func) {
+    _dev->local_queue().register_flow_provider(std::move(func));
+}
+
+bool interface::steer_flow(const flow_key& flow) {
+    return _dev->steer_flow(flow);
+}
+
+void interface::unsteer_flow(const flow_key& flow) {
+    _dev->unsteer_flow(flow);
+}
+
 uint16_t interface::hw_queues_count() {
     return _dev->hw_queues_count();
 }
@@ -310,19 +434,44 @@ rss_key_type interface::rss_key() const {
     return _dev->rss_key();
 }
 
+interface::~interface() = default;
+
+// Packets are forwarded as they are: the other shard frees them back on
+// this one through their deleter, nothing is copied
 void interface::forward(unsigned cpuid, packet p) {
-    static __thread unsigned queue_depth;
+    // Packets beyond the limit, queued or on their way, are dropped
+    if (_forwarding >= max_forwarding) {
+        return;
+    }
+    if (!_forward_poller) {
+        _forward_batches.resize(smp::count);
+        _forward_poller = std::make_unique<internal::poller>(reactor::poller::simple([this] { return flush_forwards(); }, {"net_forward"}));
+    }
+    _forwarding++;
+    _forward_batches[cpuid].push_back(std::move(p));
+}
 
-    if (queue_depth < 1000) {
-        queue_depth++;
-        auto src_cpu = this_shard_id();
+bool interface::flush_forwards() {
+    bool flushed = false;
+    auto src_cpu = this_shard_id();
+    for (unsigned cpu = 0; cpu < _forward_batches.size(); cpu++) {
+        if (_forward_batches[cpu].empty()) {
+            continue;
+        }
+        auto batch = std::exchange(_forward_batches[cpu], {});
+        auto n = batch.size();
+        flushed = true;
         // FIXME: future is discarded
-        (void)smp::submit_to(cpuid, [this, p = std::move(p), src_cpu]() mutable {
-            _dev->l2receive(p.free_on_cpu(src_cpu));
-        }).then([] {
-            queue_depth--;
+        (void)smp::submit_to(cpu, [this, batch = std::move(batch), src_cpu] () mutable {
+            for (auto& p : batch) {
+                _dev->l2receive(p.free_on_cpu(src_cpu));
+            }
+            _dev->l2flush();
+        }).then([this, n] {
+            _forwarding -= n;
         });
     }
+    return flushed;
 }
 
 future<> interface::dispatch_packet(packet p) {
@@ -38,6 +38,48 @@ static_assert(std::is_nothrow_move_constructible_v<packet>);
 constexpr size_t packet::internal_data_size;
 constexpr size_t packet::default_nr_frags;
 
+namespace {
+
+struct impl_freelist {
+    // Enough for the packets of a burst or two, a few dozen kilobytes
+    static constexpr size_t max_size = 256;
+
+    struct node {
+        node* next;
+    };
+    node* head = nullptr;
+    size_t size = 0;
+
+    ~impl_freelist() {
+        while (head) {
+            ::operator delete(std::exchange(head, head->next));
+        }
+    }
+};
+
+thread_local impl_freelist freelist;
+
+}
+
+void* packet::impl::allocate_memory(size_t nr_frags) {
+    if (nr_frags == default_nr_frags && freelist.head) {
+        --freelist.size;
+        return std::exchange(freelist.head, freelist.head->next);
+    }
+    return ::operator new(sizeof(impl) + nr_frags * sizeof(fragment));
+}
+
+void packet::impl::free_memory(void* ptr, size_t nr_frags) noexcept {
+    // Impls freed on another shard than they came from end up in its list,
+    // which the seastar allocator copes with
+    if (nr_frags == default_nr_frags && freelist.size < impl_freelist::max_size) {
+        ++freelist.size;
+        freelist.head = new (ptr) impl_freelist::node{freelist.head};
+        return;
+    }
+    ::operator delete(ptr);
+}
+
 void packet::linearize(size_t at_frag, size_t desired_size) {
     _impl->unuse_internal_data();
     size_t nr_frags = 0;
@@ -69,17 +111,10 @@ void packet::linearize(size_t at_frag, size_t desired_size) {
 
 packet packet::free_on_cpu(unsigned cpu, std::function<void()> cb)
 {
-    // make new deleter that runs old deleter on an origin cpu
-    _impl->_deleter = make_deleter(deleter(), [d = std::move(_impl->_deleter), cpu, cb = std::move(cb)] () mutable {
-        // FIXME: future is discarded
-        (void)smp::submit_to(cpu, [d = std::move(d), cb = std::move(cb)] () mutable {
-            // deleter needs to be moved from lambda capture to be destroyed here
-            // otherwise deleter destructor will be called on a cpu that called smp::submit_to()
-            // when work_item is destroyed.
-            deleter xxx(std::move(d));
-            cb();
-        });
-    });
+    // make new deleter that runs old deleter, and then cb, on an origin cpu
+    deleter d = std::move(_impl->_deleter);
+    d.append(make_deleter([cb = std::move(cb)] { cb(); }));
+    _impl->_deleter = make_cross_shard_deleter(std::move(d), cpu);
 
     return packet(impl::copy(_impl.get()));
 }
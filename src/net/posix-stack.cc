@@ -19,16 +19,25 @@
  * Copyright (C) 2014 Cloudius Systems, Ltd.
  */
 
+#include <deque>
 #include <random>
 
 #include <sys/socket.h>
+#include <linux/errqueue.h>
 #include <linux/if.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <linux/sockios.h>
 #include <net/route.h>
+#if __has_include(<linux/tls.h>)
+#include <linux/tls.h>
+#endif
 
+#include <seastar/core/align.hh>
 #include <seastar/core/loop.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/sleep.hh>
 #include <seastar/net/posix-stack.hh>
 #include <seastar/net/net.hh>
 #include <seastar/net/packet.hh>
@@ -36,6 +45,7 @@
 #include <seastar/net/inet_address.hh>
 #include <seastar/util/std-compat.hh>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <netinet/sctp.h>
 
 namespace std {
@@ -92,6 +102,9 @@ class posix_connected_socket_operations {
     virtual socket_address local_address(file_desc& _fd) const {
         return _fd.get_address();
     }
+    virtual tcp_connection_stats get_tcp_stats(file_desc& _fd) const {
+        throw std::runtime_error("TCP statistics are not supported by this socket");
+    }
 };
 
 thread_local posix_ap_server_socket_impl::sockets_map_t posix_ap_server_socket_impl::sockets{};
@@ -124,6 +137,21 @@ class posix_tcp_connected_socket_operations : public posix_connected_socket_oper
             _fd.getsockopt<unsigned>(IPPROTO_TCP, TCP_KEEPCNT)
         };
     }
+    virtual tcp_connection_stats get_tcp_stats(file_desc& _fd) const override {
+        auto ti = _fd.getsockopt<struct tcp_info>(IPPROTO_TCP, TCP_INFO);
+        int unsent = 0;
+        // Not ioctl(int, int), which passes the value rather than a pointer
+        _fd.ioctl<int>(SIOCOUTQNSD, unsent);
+        return tcp_connection_stats {
+            .srtt = std::chrono::microseconds(ti.tcpi_rtt),
+            .rttvar = std::chrono::microseconds(ti.tcpi_rttvar),
+            .rto = std::chrono::microseconds(ti.tcpi_rto),
+            .cwnd = ti.tcpi_snd_cwnd * ti.tcpi_snd_mss,
+            .unacked_bytes = ti.tcpi_unacked * ti.tcpi_snd_mss,
+            .unsent_bytes = uint32_t(unsent),
+            .total_retransmits = ti.tcpi_total_retrans,
+        };
+    }
 };
 
 class posix_sctp_connected_socket_operations : public posix_connected_socket_operations {
@@ -200,17 +228,29 @@ get_posix_connected_socket_ops(sa_family_t family, int protocol) {
     }
 }
 
+// MSG_ZEROCOPY is only implemented for TCP (and UDP, which doesn't get here)
+static lw_shared_ptr<posix_zerocopy_state>
+make_posix_zerocopy_state(sa_family_t family, int protocol, const pollable_fd& fd) {
+    if ((family == AF_INET || family == AF_INET6) && protocol == IPPROTO_TCP) {
+        return make_lw_shared<posix_zerocopy_state>(fd);
+    }
+    return nullptr;
+}
+
 class posix_connected_socket_impl final : public connected_socket_impl {
     pollable_fd _fd;
     const posix_connected_socket_operations* _ops;
     conntrack::handle _handle;
     std::pmr::polymorphic_allocator<char>* _allocator;
+    lw_shared_ptr<posix_zerocopy_state> _zerocopy;
 private:
     explicit posix_connected_socket_impl(sa_family_t family, int protocol, pollable_fd fd, std::pmr::polymorphic_allocator<char>* allocator=memory::malloc_allocator) :
-        _fd(std::move(fd)), _ops(get_posix_connected_socket_ops(family, protocol)), _allocator(allocator) {}
+        _fd(std::move(fd)), _ops(get_posix_connected_socket_ops(family, protocol)), _allocator(allocator)
+                , _zerocopy(make_posix_zerocopy_state(family, protocol, _fd)) {}
     explicit posix_connected_socket_impl(sa_family_t family, int protocol, pollable_fd fd, conntrack::handle&& handle,
         std::pmr::polymorphic_allocator<char>* allocator=memory::malloc_allocator) : _fd(std::move(fd))
-                , _ops(get_posix_connected_socket_ops(family, protocol)), _handle(std::move(handle)), _allocator(allocator) {}
+                , _ops(get_posix_connected_socket_ops(family, protocol)), _handle(std::move(handle)), _allocator(allocator)
+                , _zerocopy(make_posix_zerocopy_state(family, protocol, _fd)) {}
 public:
     virtual data_source source() override {
         return source(connected_socket_input_stream_config());
@@ -219,7 +259,7 @@ class posix_connected_socket_impl final : public connected_socket_impl {
         return data_source(std::make_unique<posix_data_source_impl>(_fd, csisc, _allocator));
     }
     virtual data_sink sink() override {
-        return data_sink(std::make_unique< posix_data_sink_impl>(_fd));
+        return data_sink(std::make_unique< posix_data_sink_impl>(_fd, _zerocopy));
     }
     virtual void shutdown_input() override {
         _fd.shutdown(SHUT_RD);
@@ -246,14 +286,136 @@ class posix_connected_socket_impl final : public connected_socket_impl {
         return _ops->get_keepalive_parameters(_fd.get_file_desc());
     }
     void set_sockopt(int level, int optname, const void* data, size_t len) override {
-        return _ops->set_sockopt(_fd.get_file_desc(), level, optname, data, len);
+        _ops->set_sockopt(_fd.get_file_desc(), level, optname, data, len);
+        // The kernel only accepts MSG_ZEROCOPY sends once SO_ZEROCOPY is set,
+        // so that is also how zero-copy transmission is requested from us.
+        if (_zerocopy && level == SOL_SOCKET && optname == SO_ZEROCOPY && len >= sizeof(int)) {
+            _zerocopy->enable(copy_reinterpret_cast<int>(data));
+        }
+#ifdef SOL_TLS
+        // Sockets with kernel TLS offload reject MSG_ZEROCOPY sends
+        if (_zerocopy && level == SOL_TLS) {
+            _zerocopy->enable(false);
+        }
+#endif
     }
     int get_sockopt(int level, int optname, void* data, size_t len) const override {
         return _ops->get_sockopt(_fd.get_file_desc(), level, optname, data, len);
     }
+    tcp_connection_stats get_tcp_stats() const override {
+        return _ops->get_tcp_stats(_fd.get_file_desc());
+    }
     socket_address local_address() const noexcept override {
         return _ops->local_address(_fd.get_file_desc());
     }
+#ifdef TLS_SET_RECORD_TYPE
+    future<> send_tls_record(uint8_t content_type, temporary_buffer<char> data) override {
+        // The record type travels in a control message, so it has to be
+        // kept alive, together with the data, until the send completes
+        struct record {
+            temporary_buffer<char> data;
+            ::iovec iov;
+            ::msghdr mh = {};
+            alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(uint8_t))] = {};
+        };
+        auto r = std::make_unique<record>();
+        r->data = std::move(data);
+        r->iov = ::iovec{r->data.get_write(), r->data.size()};
+        r->mh.msg_iov = &r->iov;
+        r->mh.msg_iovlen = 1;
+        r->mh.msg_control = r->control;
+        r->mh.msg_controllen = sizeof(r->control);
+        auto cmsg = CMSG_FIRSTHDR(&r->mh);
+        cmsg->cmsg_level = SOL_TLS;
+        cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint8_t));
+        *CMSG_DATA(cmsg) = content_type;
+        auto mh = &r->mh;
+        return _fd.sendmsg(mh, MSG_NOSIGNAL).then([r = std::move(r)] (size_t) {});
+    }
+#endif
+    future<> send_fds(temporary_buffer<char> data, std::vector<file_desc> fds) override {
+        if (_fd.get_file_desc().getsockopt<int>(SOL_SOCKET, SO_DOMAIN) != AF_UNIX) {
+            return make_exception_future<>(std::system_error(ENOTSUP, std::system_category(), "file descriptors can only be passed over unix domain sockets"));
+        }
+        if (data.empty() || fds.size() > max_passed_fds) {
+            return make_exception_future<>(std::invalid_argument("file descriptors are passed with 1 to 253 of them and some data"));
+        }
+        // The descriptors stay open, with the data, until they are sent
+        struct message {
+            temporary_buffer<char> data;
+            std::vector<file_desc> fds;
+            ::iovec iov;
+            ::msghdr mh = {};
+            alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_passed_fds)] = {};
+        };
+        auto m = std::make_unique<message>();
+        m->data = std::move(data);
+        m->fds = std::move(fds);
+        m->iov = ::iovec{m->data.get_write(), m->data.size()};
+        m->mh.msg_iov = &m->iov;
+        m->mh.msg_iovlen = 1;
+        if (!m->fds.empty()) {
+            m->mh.msg_control = m->control;
+            m->mh.msg_controllen = CMSG_SPACE(sizeof(int) * m->fds.size());
+            auto cmsg = CMSG_FIRSTHDR(&m->mh);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * m->fds.size());
+            auto p = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+            for (auto& fd : m->fds) {
+                *p++ = fd.get();
+            }
+        }
+        auto mh = &m->mh;
+        return _fd.sendmsg(mh, MSG_NOSIGNAL).then([this, m = std::move(m)] (size_t n) mutable {
+            // The descriptors went with the first bytes sent
+            if (n == m->data.size()) {
+                return make_ready_future<>();
+            }
+            auto rest = m->data.share(n, m->data.size() - n);
+            return _fd.write_all(rest.get(), rest.size()).finally([rest = std::move(rest)] {});
+        });
+    }
+    future<fd_message> receive_fds(size_t max_size) override {
+        struct message {
+            temporary_buffer<char> data;
+            ::iovec iov;
+            ::msghdr mh = {};
+            alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_passed_fds)] = {};
+        };
+        auto m = std::make_unique<message>();
+        m->data = temporary_buffer<char>(std::max(max_size, size_t(1)));
+        m->iov = ::iovec{m->data.get_write(), m->data.size()};
+        m->mh.msg_iov = &m->iov;
+        m->mh.msg_iovlen = 1;
+        m->mh.msg_control = m->control;
+        m->mh.msg_controllen = sizeof(m->control);
+        auto mh = &m->mh;
+        return _fd.recvmsg(mh).then([m = std::move(m)] (size_t n) {
+            fd_message msg;
+            for (auto cmsg = CMSG_FIRSTHDR(&m->mh); cmsg; cmsg = CMSG_NXTHDR(&m->mh, cmsg)) {
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                    continue;
+                }
+                auto p = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+                auto nr = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < nr; i++) {
+                    ::fcntl(p[i], F_SETFD, FD_CLOEXEC);
+                    msg.fds.push_back(file_desc::from_fd(p[i]));
+                }
+            }
+            m->data.trim(n);
+            msg.data = std::move(m->data);
+            return msg;
+        });
+    }
+    file_desc dup_fd() const override {
+        return _fd.get_file_desc().dup();
+    }
+
+    // SCM_MAX_FD of the kernel
+    static constexpr size_t max_passed_fds = 253;
 
     friend class posix_server_socket_impl;
     friend class posix_ap_server_socket_impl;
@@ -261,6 +423,7 @@ class posix_connected_socket_impl final : public connected_socket_impl {
     friend class posix_network_stack;
     friend class posix_ap_network_stack;
     friend class posix_socket_impl;
+    friend connected_socket seastar::adopt_connected_socket(file_desc fd);
 };
 
 static void resolve_outgoing_address(socket_address& a) {
@@ -463,35 +626,82 @@ class posix_socket_impl final : public socket_impl {
     }
 };
 
+conntrack::handle
+posix_server_socket_impl::connection_handle(const file_desc& fd, const socket_address& sa) {
+    switch(_lba) {
+    case server_socket::load_balancing_algorithm::connection_distribution:
+        return _conntrack.get_handle();
+    case server_socket::load_balancing_algorithm::port:
+        return _conntrack.get_handle(ntoh(sa.as_posix_sockaddr_in().sin_port) % smp::count);
+    case server_socket::load_balancing_algorithm::fixed:
+        return _conntrack.get_handle(_fixed_cpu);
+    case server_socket::load_balancing_algorithm::incoming_cpu: {
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (::getsockopt(fd.get(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0) {
+            if (auto shard = smp::shard_of_cpu(cpu)) {
+                return _conntrack.get_handle(*shard);
+            }
+        }
+        return _conntrack.get_handle();
+    }
+    default: abort();
+    }
+}
+
+void
+posix_server_socket_impl::dispatch(file_desc fd, socket_address sa, handoff_map& handoffs) {
+    auto cth = connection_handle(fd, sa);
+    auto cpu = cth.cpu();
+    if (cpu == this_shard_id()) {
+        pollable_fd pfd(std::move(fd), pollable_fd::speculation(EPOLLOUT));
+        std::unique_ptr<connected_socket_impl> csi(
+                new posix_connected_socket_impl(sa.family(), _protocol, std::move(pfd), std::move(cth), _allocator));
+        _accepted.push_back(accept_result{connected_socket(std::move(csi)), sa});
+    } else {
+        handoffs[cpu].push_back(handoff{std::move(fd), sa, std::move(cth)});
+    }
+}
+
+void
+posix_server_socket_impl::hand_off(handoff_map handoffs) {
+    // One message for all the connections going to a shard
+    for (auto& [cpu, batch] : handoffs) {
+        // FIXME: future is discarded
+        (void)smp::submit_to(cpu, [protocol = _protocol, ssa = _sa, batch = std::move(batch), allocator = _allocator] () mutable {
+            for (auto& h : batch) {
+                posix_ap_server_socket_impl::move_connected_socket(protocol, ssa, pollable_fd(std::move(h.fd)), h.addr, std::move(h.cth), allocator);
+            }
+        });
+    }
+}
+
 future<accept_result>
 posix_server_socket_impl::accept() {
+    if (!_accepted.empty()) {
+        auto ar = std::move(_accepted.front());
+        _accepted.pop_front();
+        return make_ready_future<accept_result>(std::move(ar));
+    }
     return _lfd.accept().then([this] (std::tuple<pollable_fd, socket_address> fd_sa) {
-        auto& fd = std::get<0>(fd_sa);
-        auto& sa = std::get<1>(fd_sa);
-        auto cth = [this, &sa] {
-            switch(_lba) {
-            case server_socket::load_balancing_algorithm::connection_distribution:
-                return _conntrack.get_handle();
-            case server_socket::load_balancing_algorithm::port:
-                return _conntrack.get_handle(ntoh(sa.as_posix_sockaddr_in().sin_port) % smp::count);
-            case server_socket::load_balancing_algorithm::fixed:
-                return _conntrack.get_handle(_fixed_cpu);
-            default: abort();
+        handoff_map handoffs;
+        dispatch(std::move(std::get<0>(fd_sa).get_file_desc()), std::get<1>(fd_sa), handoffs);
+        // In a connection storm more connections are queued behind this one,
+        // take them now rather than one per poll
+        try {
+            for (unsigned i = 1; i < max_accept_batch; i++) {
+                socket_address sa;
+                auto fd = _lfd.get_file_desc().try_accept(sa, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (!fd) {
+                    break;
+                }
+                dispatch(std::move(*fd), sa, handoffs);
             }
-        } ();
-        auto cpu = cth.cpu();
-        if (cpu == this_shard_id()) {
-            std::unique_ptr<connected_socket_impl> csi(
-                    new posix_connected_socket_impl(sa.family(), _protocol, std::move(fd), std::move(cth), _allocator));
-            return make_ready_future<accept_result>(
-                    accept_result{connected_socket(std::move(csi)), sa});
-        } else {
-            // FIXME: future is discarded
-            (void)smp::submit_to(cpu, [protocol = _protocol, ssa = _sa, fd = std::move(fd.get_file_desc()), sa, cth = std::move(cth), allocator = _allocator] () mutable {
-                posix_ap_server_socket_impl::move_connected_socket(protocol, ssa, pollable_fd(std::move(fd)), sa, std::move(cth), allocator);
-            });
-            return accept();
+        } catch (...) {
+            // The next accept() will hit the error again and report it
         }
+        hand_off(std::move(handoffs));
+        return accept();
     });
 }
 
@@ -577,9 +787,56 @@ posix_ap_server_socket_impl::move_connected_socket(int protocol, socket_address
     }
 }
 
+namespace {
+
+// Receive buffers of the connections which use the default allocator are
+// carved out of shared chunks, so that a connection reading 100 bytes at a
+// time doesn't allocate (and keep alive, until the application is done
+// with the data) a whole buffer for each read. Each read gets a slice as
+// large as the connection's buffer size, and the slice is cut down to the
+// bytes read if nothing was carved after it meanwhile, which is always the
+// case unless reads complete asynchronously.
+//
+// A chunk is freed once all of its slices are, so an application holding
+// on to a few bytes of a read holds on to the chunk; chunks are kept small
+// to bound that.
+class receive_arena {
+    temporary_buffer<char> _chunk;
+    size_t _used = 0;
+    const char* _last = nullptr;
+public:
+    static constexpr size_t chunk_size = 32 * 1024;
+    // Larger buffers are allocated on their own, slicing them would leave
+    // most of the chunks unused
+    static constexpr size_t max_slice = chunk_size / 4;
+    static constexpr size_t alignment = alignof(std::max_align_t);
+
+    temporary_buffer<char> allocate(size_t size) {
+        if (_chunk.size() - _used < size) {
+            _chunk = temporary_buffer<char>(chunk_size);
+            _used = 0;
+        }
+        auto b = _chunk.share(_used, size);
+        _used += size;
+        _last = b.get();
+        return b;
+    }
+    void trim(const temporary_buffer<char>& b) noexcept {
+        if (b.get() == _last) {
+            _used = std::min(align_up(size_t(_last - _chunk.get()) + b.size(), alignment), _chunk.size());
+            _last = nullptr;
+        }
+    }
+};
+
+thread_local receive_arena local_receive_arena;
+
+}
+
 future<temporary_buffer<char>>
 posix_data_source_impl::get() {
     return _fd.read_some(static_cast<internal::buffer_allocator*>(this)).then([this] (temporary_buffer<char> b) {
+        local_receive_arena.trim(b);
         if (b.size() >= _config.buffer_size) {
             _config.buffer_size *= 2;
             _config.buffer_size = std::min(_config.buffer_size, _config.max_buffer_size);
@@ -593,6 +850,9 @@ posix_data_source_impl::get() {
 
 temporary_buffer<char>
 posix_data_source_impl::allocate_buffer() {
+    if (_buffer_allocator == memory::malloc_allocator && _config.buffer_size <= receive_arena::max_slice) {
+        return local_receive_arena.allocate(_config.buffer_size);
+    }
     return make_temporary_buffer<char>(_buffer_allocator, _config.buffer_size);
 }
 
@@ -619,21 +879,159 @@ std::vector<iovec> to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
     return v;
 }
 
+posix_zerocopy_state::~posix_zerocopy_state() {
+    _fd.set_error_queue_consumer(nullptr);
+}
+
+void
+posix_zerocopy_state::enable(bool enabled) noexcept {
+    _enabled = enabled;
+    if (enabled) {
+        _fd.set_error_queue_consumer(this);
+    }
+}
+
+void
+posix_zerocopy_state::consume_error_queue(file_desc& fd) noexcept {
+    while (!_pending.empty()) {
+        alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(::sock_extended_err) + sizeof(::sockaddr_in6))];
+        ::msghdr mh = {};
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        if (::recvmsg(fd.get(), &mh, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            // Drained (EAGAIN), or nothing we can do about it anyway
+            break;
+        }
+        for (auto cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            auto ee = copy_reinterpret_cast<::sock_extended_err>(CMSG_DATA(cm));
+            if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // The kernel copied the data anyway (e.g. on loopback), so all
+                // we get from zero-copy sends is the completion overhead.
+                _enabled = false;
+            }
+            // [ee_info, ee_data] is an inclusive range of sends, which may wrap
+            for (uint32_t seq = ee.ee_info; ; ++seq) {
+                auto idx = seq - _first_seq;
+                if (idx < _pending.size()) {
+                    _pending[idx].done = true;
+                }
+                if (seq == ee.ee_data) {
+                    break;
+                }
+            }
+        }
+        while (!_pending.empty() && _pending.front().done) {
+            _pending.pop_front();
+            ++_first_seq;
+        }
+    }
+}
+
+future<>
+posix_zerocopy_state::wait_for_completions() {
+    return do_with(std::chrono::milliseconds(1), [this] (std::chrono::milliseconds& interval) {
+        return do_until([this] {
+            consume_error_queue(_fd.get_file_desc());
+            return !has_pending();
+        }, [&interval] {
+            auto next = std::min<std::chrono::milliseconds>(interval * 2, max_poll_interval);
+            return sleep(std::exchange(interval, next));
+        });
+    });
+}
+
+posix_data_sink_impl::~posix_data_sink_impl() {
+    if (_zerocopy && _zerocopy->has_pending()) {
+        // Until the kernel reports the sends complete, it may still transmit
+        // (or retransmit) from the packets we hold, so keep them, and the
+        // socket whose error queue reports on them, until it does. A peer
+        // that stopped acknowledging is eventually timed out by TCP, which
+        // completes the sends too.
+        (void)_zerocopy->wait_for_completions().finally([zerocopy = _zerocopy] {});
+    }
+}
+
 future<>
 posix_data_sink_impl::put(temporary_buffer<char> buf) {
+    if (use_zerocopy(buf.size())) {
+        return put_zerocopy(packet(std::move(buf)));
+    }
     return _fd.write_all(buf.get(), buf.size()).then([d = buf.release()] {});
 }
 
 future<>
 posix_data_sink_impl::put(packet p) {
+    if (use_zerocopy(p.len())) {
+        return put_zerocopy(std::move(p));
+    }
     _p = std::move(p);
     return _fd.write_all(_p).then([this] { _p.reset(); });
 }
 
+future<>
+posix_data_sink_impl::put_zerocopy(packet p) {
+    _zerocopy->consume_error_queue(_fd.get_file_desc());
+    _p = std::move(p);
+    auto sent_any = make_lw_shared<bool>(false);
+    return repeat([this, sent_any] {
+        // See reactor::do_write_some() for why this cast is safe
+        _zerocopy_mh = {};
+        _zerocopy_mh.msg_iov = reinterpret_cast<iovec*>(_p.fragment_array());
+        _zerocopy_mh.msg_iovlen = std::min<size_t>(_p.nr_frags(), IOV_MAX);
+        return _fd.sendmsg(&_zerocopy_mh, MSG_ZEROCOPY | MSG_NOSIGNAL).then([this, sent_any] (size_t size) {
+            _zerocopy->sent();
+            *sent_any = true;
+            if (size == _p.len()) {
+                return stop_iteration::yes;
+            }
+            _p.trim_front(size);
+            return stop_iteration::no;
+        });
+    }).handle_exception([this] (std::exception_ptr ep) {
+        try {
+            std::rethrow_exception(std::move(ep));
+        } catch (const std::system_error& e) {
+            if (e.code().value() != ENOBUFS) {
+                throw;
+            }
+        }
+        // Too much memory is pinned by sends in flight (see optmem_max in
+        // socket(7)); copy the rest instead.
+        return _fd.write_all(_p);
+    }).then([this, sent_any] {
+        if (*sent_any) {
+            _zerocopy->hold(std::move(_p));
+        }
+        _p.reset();
+    });
+}
+
 future<>
 posix_data_sink_impl::close() {
     _fd.shutdown(SHUT_WR);
-    return make_ready_future<>();
+    if (!_zerocopy) {
+        return make_ready_future<>();
+    }
+    // The kernel may still be transmitting from packets we hold. Their
+    // completions arrive as the peer acknowledges the data, and don't wake
+    // anyone if the socket has no reader, so poll for them. A peer that
+    // stopped acknowledging mustn't hold up close() though: past the
+    // timeout, the packets are left to the destructor, which keeps them
+    // and the socket until the sends complete.
+    auto deadline = lowres_clock::now() + posix_zerocopy_state::close_timeout;
+    return do_until([this, deadline] {
+        _zerocopy->consume_error_queue(_fd.get_file_desc());
+        return !_zerocopy->has_pending() || lowres_clock::now() >= deadline;
+    }, [] {
+        return sleep(std::chrono::milliseconds(1));
+    });
 }
 
 posix_network_stack::posix_network_stack(const program_options::option_group& opts, std::pmr::polymorphic_allocator<char>* allocator)
@@ -682,39 +1080,45 @@ posix_ap_network_stack::listen(socket_address sa, listen_options opt) {
         server_socket(std::make_unique<posix_ap_server_socket_impl>(protocol, sa, _allocator));
 }
 
-struct cmsg_with_pktinfo {
-    struct cmsghdrcmh;
-    union {
-        struct in_pktinfo pktinfo;
-        struct in6_pktinfo pkt6info;
-    };
-};
-
 class posix_udp_channel : public udp_channel_impl {
 private:
     static constexpr int MAX_DATAGRAM_SIZE = 65507;
-    struct recv_ctx {
-        struct msghdr _hdr;
-        struct iovec _iov;
-        socket_address _src_addr;
-        char* _buffer;
-        cmsg_with_pktinfo _cmsg;
-
-        recv_ctx() {
-            memset(&_hdr, 0, sizeof(_hdr));
-            _hdr.msg_iov = &_iov;
-            _hdr.msg_iovlen = 1;
-            _hdr.msg_name = &_src_addr.u.sa;
-            _hdr.msg_namelen = sizeof(_src_addr.u.sas);
-            memset(&_cmsg, 0, sizeof(_cmsg));
-            _hdr.msg_control = &_cmsg;
-            _hdr.msg_controllen = sizeof(_cmsg);
+    // Datagrams read by a single recvmmsg(). With UDP GRO, each of them
+    // may hold several datagrams coalesced by the kernel, up to 64k.
+    static constexpr unsigned max_recv_batch = 16;
+    static constexpr size_t recv_buffer_size = 65536;
+    // The kernel's limit on the segments of a UDP GSO send (UDP_MAX_SEGMENTS)
+    static constexpr size_t max_gso_segments = 64;
+    union recv_cmsg {
+        char buf[CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    };
+    struct recv_batch_ctx {
+        std::array<struct mmsghdr, max_recv_batch> _hdrs;
+        std::array<struct iovec, max_recv_batch> _iovs;
+        std::array<socket_address, max_recv_batch> _src_addrs;
+        std::array<recv_cmsg, max_recv_batch> _cmsgs;
+        std::unique_ptr<char[]> _buffers;
+
+        recv_batch_ctx() : _buffers(new char[max_recv_batch * recv_buffer_size]) {
+            memset(_hdrs.data(), 0, sizeof(_hdrs));
+            for (unsigned i = 0; i < max_recv_batch; ++i) {
+                auto& hdr = _hdrs[i].msg_hdr;
+                hdr.msg_iov = &_iovs[i];
+                hdr.msg_iovlen = 1;
+                hdr.msg_name = &_src_addrs[i].u.sa;
+                hdr.msg_control = &_cmsgs[i];
+                _iovs[i].iov_base = _buffers.get() + i * recv_buffer_size;
+            }
         }
 
         void prepare() {
-            _buffer = new char[MAX_DATAGRAM_SIZE];
-            _iov.iov_base = _buffer;
-            _iov.iov_len = MAX_DATAGRAM_SIZE;
+            for (unsigned i = 0; i < max_recv_batch; ++i) {
+                // The kernel shrinks these to what it filled in
+                _hdrs[i].msg_hdr.msg_namelen = sizeof(_src_addrs[i].u.sas);
+                _hdrs[i].msg_hdr.msg_controllen = sizeof(_cmsgs[i]);
+                _iovs[i].iov_len = recv_buffer_size;
+            }
         }
     };
     struct send_ctx {
@@ -739,11 +1143,33 @@ class posix_udp_channel : public udp_channel_impl {
             resolve_outgoing_address(_dst);
         }
     };
+    union segment_cmsg {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    };
+    struct send_batch_ctx {
+        socket_address _dst;
+        std::vector<packet> _datagrams;
+        std::vector<struct iovec> _iovecs;
+        std::vector<struct mmsghdr> _msgs;
+        std::vector<segment_cmsg> _cmsgs;
+        // Index of the first datagram of each message
+        std::vector<size_t> _first_datagram;
+        // Messages sent so far
+        size_t _sent = 0;
+
+        void build(bool gso);
+    };
     pollable_fd _fd;
     socket_address _address;
-    recv_ctx _recv;
+    std::unique_ptr<recv_batch_ctx> _recv;
+    // Datagrams received by receive_batch() but not yet returned by receive()
+    std::deque<udp_datagram> _received;
     send_ctx _send;
+    bool _gso = false;
     bool _closed;
+private:
+    std::vector<udp_datagram> parse_batch(unsigned n);
 public:
     posix_udp_channel(const socket_address& bind_address)
             : _closed(false) {
@@ -753,14 +1179,22 @@ class posix_udp_channel : public udp_channel_impl {
         if (engine().posix_reuseport_available()) {
             fd.setsockopt(SOL_SOCKET, SO_REUSEPORT, 1);
         }
+        // Both need Linux 4.18 or later, and are only used when available.
+        // Setting a zero segment size keeps single sends unsegmented.
+        int zero = 0;
+        _gso = ::setsockopt(fd.get(), SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+        int one = 1;
+        ::setsockopt(fd.get(), SOL_UDP, UDP_GRO, &one, sizeof(one));
         fd.bind(sa.u.sa, sizeof(sa.u.sas));
         _address = fd.get_address();
         _fd = std::move(fd);
     }
     virtual ~posix_udp_channel() { if (!_closed) close(); };
     virtual future<udp_datagram> receive() override;
+    virtual future<std::vector<udp_datagram>> receive_batch() override;
     virtual future<> send(const socket_address& dst, const char *msg) override;
     virtual future<> send(const socket_address& dst, packet p) override;
+    virtual future<> send_batch(const socket_address& dst, std::vector<packet> datagrams) override;
     virtual void shutdown_input() override {
         _fd.abort_reader();
     }
@@ -793,6 +1227,95 @@ future<> posix_udp_channel::send(const socket_address& dst, packet p) {
             .then([len] (size_t size) { assert(size == len); });
 }
 
+void posix_udp_channel::send_batch_ctx::build(bool gso) {
+    size_t nr_iovecs = 0;
+    for (auto& p : _datagrams) {
+        nr_iovecs += p.nr_frags();
+    }
+    // Reserved up front, since the messages point into these
+    _iovecs.clear();
+    _iovecs.reserve(nr_iovecs);
+    _cmsgs.clear();
+    _cmsgs.reserve(_datagrams.size());
+    _msgs.clear();
+    _first_datagram.clear();
+    _sent = 0;
+    for (size_t i = 0; i < _datagrams.size();) {
+        size_t segment_size = _datagrams[i].len();
+        size_t total = 0;
+        size_t first_iovec = _iovecs.size();
+        size_t j = i;
+        // Datagrams of the same size, optionally followed by a shorter one,
+        // are sent as the segments of a single GSO message
+        do {
+            for (auto& f : _datagrams[j].fragments()) {
+                _iovecs.push_back(iovec{f.base, f.size});
+            }
+            total += _datagrams[j].len();
+            ++j;
+        } while (gso && segment_size && j < _datagrams.size() && j - i < max_gso_segments
+                && _datagrams[j - 1].len() == segment_size
+                && _datagrams[j].len() <= segment_size
+                && total + _datagrams[j].len() <= MAX_DATAGRAM_SIZE
+                && _iovecs.size() - first_iovec + _datagrams[j].nr_frags() <= IOV_MAX);
+        struct mmsghdr m;
+        memset(&m, 0, sizeof(m));
+        m.msg_hdr.msg_name = &_dst.u.sa;
+        m.msg_hdr.msg_namelen = _dst.addr_length;
+        m.msg_hdr.msg_iov = _iovecs.data() + first_iovec;
+        m.msg_hdr.msg_iovlen = _iovecs.size() - first_iovec;
+        if (j - i > 1) {
+            auto& c = _cmsgs.emplace_back();
+            memset(&c, 0, sizeof(c));
+            m.msg_hdr.msg_control = c.buf;
+            m.msg_hdr.msg_controllen = sizeof(c.buf);
+            auto* cmsg = CMSG_FIRSTHDR(&m.msg_hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            auto gso_size = uint16_t(segment_size);
+            memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+        }
+        _msgs.push_back(m);
+        _first_datagram.push_back(i);
+        i = j;
+    }
+}
+
+future<> posix_udp_channel::send_batch(const socket_address& dst, std::vector<packet> datagrams) {
+    auto ctx = std::make_unique<send_batch_ctx>();
+    ctx->_dst = dst;
+    resolve_outgoing_address(ctx->_dst);
+    ctx->_datagrams = std::move(datagrams);
+    ctx->build(_gso);
+    auto& c = *ctx;
+    return repeat([this, &c] {
+        if (c._sent == c._msgs.size()) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        auto r = ::sendmmsg(_fd.get_file_desc().get(), c._msgs.data() + c._sent, c._msgs.size() - c._sent, MSG_DONTWAIT);
+        if (r >= 0) {
+            c._sent += r;
+            return make_ready_future<stop_iteration>(stop_iteration::no);
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return _fd.writeable().then([] {
+                return stop_iteration::no;
+            });
+        }
+        // Segmentation needs checksum offload from the device, so it can
+        // still fail after the socket accepted UDP_SEGMENT. Send the rest
+        // as one datagram per message then.
+        if (_gso && (errno == EIO || errno == EINVAL) && c._msgs[c._sent].msg_hdr.msg_control) {
+            _gso = false;
+            c._datagrams.erase(c._datagrams.begin(), c._datagrams.begin() + c._first_datagram[c._sent]);
+            c.build(false);
+            return make_ready_future<stop_iteration>(stop_iteration::no);
+        }
+        return make_exception_future<stop_iteration>(std::system_error(errno, std::system_category(), "sendmmsg"));
+    }).finally([ctx = std::move(ctx)] {});
+}
+
 udp_channel
 posix_network_stack::make_udp_channel(const socket_address& addr) {
     return udp_channel(std::make_unique<posix_udp_channel>(addr));
@@ -825,25 +1348,78 @@ class posix_datagram : public udp_datagram_impl {
     virtual packet& get_data() override { return _p; }
 };
 
-future<udp_datagram>
-posix_udp_channel::receive() {
-    _recv.prepare();
-    return _fd.recvmsg(&_recv._hdr).then([this] (size_t size) {
+std::vector<udp_datagram>
+posix_udp_channel::parse_batch(unsigned n) {
+    std::vector<udp_datagram> batch;
+    batch.reserve(n);
+    for (unsigned i = 0; i < n; ++i) {
+        auto& hdr = _recv->_hdrs[i].msg_hdr;
+        size_t size = _recv->_hdrs[i].msg_len;
+        size_t segment_size = size;
         socket_address dst;
-        for (auto* cmsg = CMSG_FIRSTHDR(&_recv._hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&_recv._hdr, cmsg)) {
+        for (auto* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
             if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
                 dst = ipv4_addr(copy_reinterpret_cast<in_pktinfo>(CMSG_DATA(cmsg)).ipi_addr, _address.port());
-                break;
             } else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
                 dst = ipv6_addr(copy_reinterpret_cast<in6_pktinfo>(CMSG_DATA(cmsg)).ipi6_addr, _address.port());
-                break;
+            } else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                // Datagrams coalesced by GRO all have this size, but the last
+                segment_size = copy_reinterpret_cast<int>(CMSG_DATA(cmsg));
             }
         }
-        return make_ready_future<udp_datagram>(udp_datagram(std::make_unique<posix_datagram>(
-            _recv._src_addr, dst, packet(fragment{_recv._buffer, size}, make_deleter([buf = _recv._buffer] { delete[] buf; })))));
-    }).handle_exception([p = _recv._buffer](auto ep) {
-        delete[] p;
-        return make_exception_future<udp_datagram>(std::move(ep));
+        auto src = _recv->_src_addrs[i];
+        src.addr_length = hdr.msg_namelen;
+        auto data = static_cast<const char*>(_recv->_iovs[i].iov_base);
+        if (segment_size == 0) {
+            segment_size = size;
+        }
+        size_t off = 0;
+        // The data is copied out, so that a small datagram does not pin
+        // a whole receive buffer
+        do {
+            auto len = std::min(segment_size, size - off);
+            batch.push_back(udp_datagram(std::make_unique<posix_datagram>(src, dst, packet(data + off, len))));
+            off += len;
+        } while (off < size);
+    }
+    return batch;
+}
+
+future<std::vector<udp_datagram>>
+posix_udp_channel::receive_batch() {
+    if (!_received.empty()) {
+        std::vector<udp_datagram> batch(std::make_move_iterator(_received.begin()), std::make_move_iterator(_received.end()));
+        _received.clear();
+        return make_ready_future<std::vector<udp_datagram>>(std::move(batch));
+    }
+    if (!_recv) {
+        _recv = std::make_unique<recv_batch_ctx>();
+    }
+    _recv->prepare();
+    auto r = ::recvmmsg(_fd.get_file_desc().get(), _recv->_hdrs.data(), max_recv_batch, MSG_DONTWAIT, nullptr);
+    if (r > 0) {
+        return make_ready_future<std::vector<udp_datagram>>(parse_batch(r));
+    }
+    if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return make_exception_future<std::vector<udp_datagram>>(std::system_error(errno, std::system_category(), "recvmmsg"));
+    }
+    return _fd.readable().then([this] {
+        return receive_batch();
+    });
+}
+
+future<udp_datagram>
+posix_udp_channel::receive() {
+    if (!_received.empty()) {
+        auto dgram = std::move(_received.front());
+        _received.pop_front();
+        return make_ready_future<udp_datagram>(std::move(dgram));
+    }
+    return receive_batch().then([this] (std::vector<udp_datagram> batch) {
+        for (auto it = std::next(batch.begin()); it != batch.end(); ++it) {
+            _received.push_back(std::move(*it));
+        }
+        return std::move(batch.front());
     });
 }
 
@@ -1083,4 +1659,19 @@ std::vector<network_interface> posix_network_stack::network_interfaces() {
 
 }
 
+connected_socket adopt_connected_socket(file_desc fd) {
+    auto family = fd.getsockopt<int>(SOL_SOCKET, SO_DOMAIN);
+    auto protocol = fd.getsockopt<int>(SOL_SOCKET, SO_PROTOCOL);
+    bool known = family == AF_UNIX
+            || ((family == AF_INET || family == AF_INET6) && (protocol == IPPROTO_TCP || protocol == IPPROTO_SCTP));
+    if (!known || fd.getsockopt<int>(SOL_SOCKET, SO_TYPE) != SOCK_STREAM) {
+        throw std::invalid_argument("not a stream socket of a supported protocol");
+    }
+    auto flags = ::fcntl(fd.get(), F_GETFL);
+    throw_system_error_on(flags == -1, "fcntl");
+    throw_system_error_on(::fcntl(fd.get(), F_SETFL, flags | O_NONBLOCK) == -1, "fcntl");
+    return connected_socket(std::unique_ptr<net::connected_socket_impl>(
+            new net::posix_connected_socket_impl(family, protocol, pollable_fd(std::move(fd)))));
+}
+
 }
@@ -0,0 +1,582 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/net/shm.hh>
+#include <seastar/net/stack.hh>
+#include <seastar/core/internal/pollable_fd.hh>
+#include <seastar/core/iostream.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/posix.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/util/later.hh>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+namespace seastar {
+
+namespace net {
+
+namespace {
+
+constexpr uint32_t shm_magic = 0x5353484d;
+constexpr uint32_t shm_version = 1;
+constexpr size_t segment_header_size = 4096;
+constexpr size_t ring_header_size = 128;
+// The memfd and the eventfds waking the reader and the writer of each ring
+constexpr unsigned nr_fds = 5;
+// The most a read returns, so that a full ring is handed out in pieces
+constexpr size_t max_read_size = 128 << 10;
+
+struct segment_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+};
+
+// The writer's fields, then the reader's, each in its own cache line
+struct ring_header {
+    std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> writer_closed;
+    char pad0[64 - 12];
+    std::atomic<uint64_t> head;
+    std::atomic<uint32_t> reader_closed;
+    std::atomic<uint32_t> reader_sleeps;
+    std::atomic<uint32_t> writer_sleeps;
+    char pad1[64 - 20];
+};
+
+static_assert(sizeof(ring_header) == ring_header_size);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+size_t segment_size(size_t ring_size) noexcept {
+    return segment_header_size + 2 * (ring_header_size + ring_size);
+}
+
+std::system_error shm_error(int err) {
+    return std::system_error(err, std::system_category());
+}
+
+void set_nonblocking(file_desc& fd) {
+    auto flags = ::fcntl(fd.get(), F_GETFL);
+    throw_system_error_on(flags == -1, "fcntl");
+    throw_system_error_on(::fcntl(fd.get(), F_SETFL, flags | O_NONBLOCK) == -1, "fcntl");
+}
+
+void wake(const file_desc& efd) noexcept {
+    uint64_t one = 1;
+    // Fails only with a saturated counter, which wakes the peer anyway
+    (void)!::write(efd.get(), &one, sizeof(one));
+}
+
+// Clears the flag of a side sleeping on the ring and wakes it
+void wake_if_sleeping(std::atomic<uint32_t>& sleeps, const file_desc& efd) noexcept {
+    if (sleeps.load() && sleeps.exchange(0)) {
+        wake(efd);
+    }
+}
+
+// One direction of a connection, as seen by one of its sides
+struct ring {
+    ring_header* h;
+    char* data;
+    size_t size;
+    // The side's own index, head for the reader and tail for the writer;
+    // the peer's is read from the ring and checked against it
+    uint64_t pos = 0;
+    // The eventfd this side sleeps on, and the peer's
+    pollable_fd wait;
+    file_desc peer;
+    uint64_t counter = 0;
+
+    ring(char* base, size_t size, file_desc own_efd, file_desc peer_efd)
+        : h(reinterpret_cast<ring_header*>(base))
+        , data(base + ring_header_size)
+        , size(size)
+        , wait(std::move(own_efd))
+        , peer(std::move(peer_efd))
+    {}
+};
+
+class shm_connection {
+    mmap_area _area;
+    ring _in;
+    ring _out;
+    pollable_fd _control;
+    char _control_buf;
+    shm_options _opts;
+    socket_address _local;
+    bool _peer_gone = false;
+    bool _input_shut = false;
+    bool _output_shut = false;
+
+    size_t readable() const {
+        auto avail = _in.h->tail.load() - _in.pos;
+        if (avail > _in.size) {
+            throw shm_error(EPROTO);
+        }
+        return avail;
+    }
+    size_t writable() const {
+        auto used = _out.pos - _out.h->head.load();
+        if (used > _out.size) {
+            throw shm_error(EPROTO);
+        }
+        return _out.size - used;
+    }
+    bool input_done() const {
+        return _input_shut || _peer_gone || _in.h->writer_closed.load();
+    }
+    bool output_done() const {
+        return _output_shut || _peer_gone || _out.h->reader_closed.load();
+    }
+
+    // Polls, then sleeps, until ready() holds
+    template <typename Ready>
+    future<> wait(ring& r, std::atomic<uint32_t>& sleeps, Ready ready) {
+        auto sleep = [this, &r, &sleeps, ready] {
+            sleeps.store(1);
+            // The peer may have moved before it could see the flag
+            if (ready()) {
+                sleeps.store(0);
+                return make_ready_future<>();
+            }
+            return r.wait.read_some(reinterpret_cast<char*>(&r.counter), sizeof(r.counter)).discard_result();
+        };
+        if (!_opts.poll_for.count()) {
+            return sleep();
+        }
+        auto until = std::chrono::steady_clock::now() + _opts.poll_for;
+        return repeat([ready, until] {
+            return yield().then([ready, until] {
+                return stop_iteration(ready() || std::chrono::steady_clock::now() >= until);
+            });
+        }).then([ready, sleep] {
+            return ready() ? make_ready_future<>() : sleep();
+        });
+    }
+
+    // Copies what fits of the buffer into the ring
+    size_t push(const char* p, size_t len) {
+        auto n = std::min(len, writable());
+        auto off = _out.pos % _out.size;
+        auto first = std::min(n, _out.size - off);
+        std::memcpy(_out.data + off, p, first);
+        std::memcpy(_out.data, p + first, n - first);
+        _out.pos += n;
+        _out.h->tail.store(_out.pos);
+        return n;
+    }
+
+    // Copies what fits of the packet from its fragment frag, offset off,
+    // into the ring, returning whether all of it did
+    bool push(packet& p, size_t& frag, size_t& off) {
+        bool pushed = false;
+        for (; frag < p.nr_frags(); ++frag, off = 0) {
+            if (output_done()) {
+                throw shm_error(EPIPE);
+            }
+            auto f = p.frag(frag);
+            auto n = push(f.base + off, f.size - off);
+            pushed |= n != 0;
+            off += n;
+            if (off != f.size) {
+                break;
+            }
+        }
+        if (pushed) {
+            wake_if_sleeping(_out.h->reader_sleeps, _out.peer);
+        }
+        return frag == p.nr_frags();
+    }
+public:
+    shm_connection(mmap_area area, size_t ring_size, bool connecting, std::vector<file_desc> fds,
+            pollable_fd control, shm_options opts, socket_address local)
+        // The ring from the connecting side comes first
+        : _area(std::move(area))
+        , _in(_area.get() + segment_header_size + (connecting ? ring_header_size + ring_size : 0), ring_size,
+                std::move(fds[connecting ? 3 : 1]), std::move(fds[connecting ? 4 : 2]))
+        , _out(_area.get() + segment_header_size + (connecting ? 0 : ring_header_size + ring_size), ring_size,
+                std::move(fds[connecting ? 2 : 4]), std::move(fds[connecting ? 1 : 3]))
+        , _control(std::move(control))
+        , _opts(opts)
+        , _local(local)
+    {
+        // Our indices start where the peer's are, for the listening side
+        // the memfd is fresh
+        _in.pos = _in.h->head.load();
+        _out.pos = _out.h->tail.load();
+    }
+
+    // Anything read from the unix socket, including its end, means the
+    // peer went away
+    static void watch_peer(lw_shared_ptr<shm_connection> c) {
+        (void)c->_control.read_some(&c->_control_buf, 1).then_wrapped([c] (future<size_t> f) {
+            f.ignore_ready_future();
+            c->_peer_gone = true;
+            wake(c->_in.wait.get_file_desc());
+            wake(c->_out.wait.get_file_desc());
+        });
+    }
+
+    future<temporary_buffer<char>> get() {
+        // Checked first: the peer closed after its last write
+        bool done = input_done();
+        auto avail = readable();
+        if (avail) {
+            auto off = _in.pos % _in.size;
+            auto n = std::min({avail, _in.size - off, max_read_size});
+            temporary_buffer<char> buf(_in.data + off, n);
+            _in.pos += n;
+            _in.h->head.store(_in.pos);
+            wake_if_sleeping(_in.h->writer_sleeps, _in.peer);
+            return make_ready_future<temporary_buffer<char>>(std::move(buf));
+        }
+        if (done) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        return wait(_in, _in.h->reader_sleeps, [this] {
+            return readable() || input_done();
+        }).then([this] {
+            return get();
+        });
+    }
+
+    future<> put(packet p) {
+        size_t frag = 0, off = 0;
+        if (push(p, frag, off)) {
+            return make_ready_future<>();
+        }
+        return do_with(std::move(p), frag, off, [this] (packet& p, size_t& frag, size_t& off) {
+            return repeat([this, &p, &frag, &off] {
+                return wait(_out, _out.h->writer_sleeps, [this] {
+                    return writable() || output_done();
+                }).then([this, &p, &frag, &off] {
+                    return stop_iteration(push(p, frag, off));
+                });
+            });
+        });
+    }
+
+    void shutdown_input() noexcept {
+        if (!std::exchange(_input_shut, true)) {
+            _in.h->reader_closed.store(1);
+            wake_if_sleeping(_in.h->writer_sleeps, _in.peer);
+            wake(_in.wait.get_file_desc());
+        }
+    }
+
+    void shutdown_output() noexcept {
+        if (!std::exchange(_output_shut, true)) {
+            _out.h->writer_closed.store(1);
+            wake_if_sleeping(_out.h->reader_sleeps, _out.peer);
+            wake(_out.wait.get_file_desc());
+        }
+    }
+
+    // Tells the peer, and ends watch_peer()
+    void close() noexcept {
+        shutdown_input();
+        shutdown_output();
+        try {
+            _control.shutdown(SHUT_RDWR);
+        } catch (...) {
+            // Already gone
+        }
+    }
+
+    const socket_address& local_address() const noexcept {
+        return _local;
+    }
+};
+
+class shm_data_source_impl final : public data_source_impl {
+    lw_shared_ptr<shm_connection> _c;
+public:
+    explicit shm_data_source_impl(lw_shared_ptr<shm_connection> c) noexcept : _c(std::move(c)) {}
+    future<temporary_buffer<char>> get() override {
+        return futurize_invoke([this] { return _c->get(); });
+    }
+    future<> close() override {
+        _c->shutdown_input();
+        return make_ready_future<>();
+    }
+};
+
+class shm_data_sink_impl final : public data_sink_impl {
+    lw_shared_ptr<shm_connection> _c;
+public:
+    explicit shm_data_sink_impl(lw_shared_ptr<shm_connection> c) noexcept : _c(std::move(c)) {}
+    future<> put(packet p) override {
+        return futurize_invoke([this, &p] { return _c->put(std::move(p)); });
+    }
+    future<> close() override {
+        _c->shutdown_output();
+        return make_ready_future<>();
+    }
+};
+
+class shm_connected_socket_impl final : public connected_socket_impl {
+    lw_shared_ptr<shm_connection> _c;
+public:
+    explicit shm_connected_socket_impl(lw_shared_ptr<shm_connection> c) noexcept : _c(std::move(c)) {}
+    ~shm_connected_socket_impl() {
+        _c->close();
+    }
+    data_source source() override {
+        return data_source(std::make_unique<shm_data_source_impl>(_c));
+    }
+    data_sink sink() override {
+        return data_sink(std::make_unique<shm_data_sink_impl>(_c));
+    }
+    void shutdown_input() override {
+        _c->shutdown_input();
+    }
+    void shutdown_output() override {
+        _c->shutdown_output();
+    }
+    void set_nodelay(bool nodelay) override {}
+    bool get_nodelay() const override {
+        return true;
+    }
+    void set_keepalive(bool keepalive) override {}
+    bool get_keepalive() const override {
+        return false;
+    }
+    void set_keepalive_parameters(const keepalive_params&) override {}
+    keepalive_params get_keepalive_parameters() const override {
+        return tcp_keepalive_params {std::chrono::seconds(0), std::chrono::seconds(0), 0};
+    }
+    void set_sockopt(int level, int optname, const void* data, size_t len) override {
+        throw std::runtime_error("Setting custom socket options is not supported for shared memory connections");
+    }
+    int get_sockopt(int level, int optname, void* data, size_t len) const override {
+        throw std::runtime_error("Getting custom socket options is not supported for shared memory connections");
+    }
+    socket_address local_address() const noexcept override {
+        return _c->local_address();
+    }
+};
+
+connected_socket make_connection(mmap_area area, size_t ring_size, bool connecting, std::vector<file_desc> fds,
+        pollable_fd control, shm_options opts, socket_address local) {
+    auto c = make_lw_shared<shm_connection>(std::move(area), ring_size, connecting, std::move(fds),
+            std::move(control), opts, local);
+    shm_connection::watch_peer(c);
+    return connected_socket(std::make_unique<shm_connected_socket_impl>(std::move(c)));
+}
+
+// The byte and the descriptors of the handshake
+struct handshake_msg {
+    char byte = 0;
+    iovec iov;
+    msghdr msg = {};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * nr_fds)] = {};
+
+    handshake_msg() noexcept {
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+    }
+    handshake_msg(const handshake_msg&) = delete;
+
+    void set_fds(const std::vector<file_desc>& fds) noexcept {
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nr_fds);
+        auto p = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+        for (auto& fd : fds) {
+            *p++ = fd.get();
+        }
+    }
+
+    // Takes the received descriptors, all of them so that none leaks
+    std::vector<file_desc> take_fds() {
+        std::vector<file_desc> fds;
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            auto p = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            auto n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < n; i++) {
+                fds.push_back(file_desc::from_fd(p[i]));
+            }
+        }
+        if (fds.size() != nr_fds || (msg.msg_flags & MSG_CTRUNC)) {
+            throw shm_error(EPROTO);
+        }
+        for (auto& fd : fds) {
+            throw_system_error_on(::fcntl(fd.get(), F_SETFD, FD_CLOEXEC) == -1, "fcntl");
+        }
+        return fds;
+    }
+};
+
+class shm_server_socket_impl final : public server_socket_impl {
+    pollable_fd _listener;
+    shm_options _opts;
+
+    // Maps the memfd the peer sent, answering it once done
+    future<accept_result> handshake(pollable_fd fd, socket_address remote) {
+        auto hs = std::make_unique<handshake_msg>();
+        auto f = fd.recvmsg(&hs->msg);
+        return f.then([this, fd, remote, hs = std::move(hs)] (size_t n) mutable {
+            if (n != 1) {
+                throw shm_error(ECONNRESET);
+            }
+            auto fds = hs->take_fds();
+            auto& memfd = fds[0];
+            auto seals = ::fcntl(memfd.get(), F_GET_SEALS);
+            // A peer shrinking the memfd would fault us
+            if (seals == -1 || !(seals & F_SEAL_SHRINK)) {
+                throw shm_error(EPROTO);
+            }
+            segment_header sh;
+            if (memfd.pread(&sh, sizeof(sh), 0) != sizeof(sh)
+                    || sh.magic != shm_magic || sh.version != shm_version
+                    || sh.ring_size < 4096 || (sh.ring_size & (sh.ring_size - 1)) || sh.ring_size > _opts.max_ring_size) {
+                throw shm_error(EPROTO);
+            }
+            struct stat st;
+            throw_system_error_on(::fstat(memfd.get(), &st) == -1, "fstat");
+            if (uint64_t(st.st_size) < segment_size(sh.ring_size)) {
+                throw shm_error(EPROTO);
+            }
+            auto area = memfd.map_shared_rw(segment_size(sh.ring_size), 0);
+            for (unsigned i = 1; i < nr_fds; i++) {
+                set_nonblocking(fds[i]);
+            }
+            auto ring_size = sh.ring_size;
+            auto ack = fd.write_all(&hs->byte, 1);
+            return ack.then([this, fd, remote, area = std::move(area), ring_size, fds = std::move(fds), hs = std::move(hs)] () mutable {
+                auto local = _listener.get_file_desc().get_address();
+                return accept_result{make_connection(std::move(area), ring_size, false, std::move(fds), std::move(fd), _opts, local), remote};
+            });
+        });
+    }
+public:
+    shm_server_socket_impl(pollable_fd listener, shm_options opts) noexcept
+        : _listener(std::move(listener)), _opts(opts)
+    {}
+    future<accept_result> accept() override {
+        return _listener.accept().then([this] (std::tuple<pollable_fd, socket_address> t) {
+            auto& [fd, remote] = t;
+            return handshake(std::move(fd), remote).then_wrapped([this] (future<accept_result> f) {
+                if (f.failed()) {
+                    // The peer sees the unix socket close
+                    f.ignore_ready_future();
+                    return accept();
+                }
+                return f;
+            });
+        });
+    }
+    void abort_accept() override {
+        _listener.abort_reader();
+    }
+    socket_address local_address() const override {
+        return _listener.get_file_desc().get_address();
+    }
+};
+
+class shm_socket_impl final : public socket_impl {
+    shm_options _opts;
+    pollable_fd _control;
+public:
+    explicit shm_socket_impl(shm_options opts) noexcept : _opts(opts) {}
+    future<connected_socket> connect(socket_address sa, socket_address local, transport proto) override {
+        if (!sa.is_af_unix()) {
+            return make_exception_future<connected_socket>(std::invalid_argument("shared memory connections need a unix domain address"));
+        }
+        if (_opts.ring_size < 4096 || (_opts.ring_size & (_opts.ring_size - 1))) {
+            return make_exception_future<connected_socket>(std::invalid_argument("the ring size must be a power of two of at least 4096"));
+        }
+        try {
+            _control = engine().make_pollable_fd(sa, 0);
+        } catch (...) {
+            return current_exception_as_future<connected_socket>();
+        }
+        return engine().posix_connect(_control, sa, local).then([this] {
+            auto ring_size = _opts.ring_size;
+            auto size = segment_size(ring_size);
+            int raw = ::memfd_create("seastar-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            throw_system_error_on(raw == -1, "memfd_create");
+            std::vector<file_desc> fds;
+            fds.push_back(file_desc::from_fd(raw));
+            auto& memfd = fds[0];
+            throw_system_error_on(::ftruncate(memfd.get(), size) == -1, "ftruncate");
+            throw_system_error_on(::fcntl(memfd.get(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1, "fcntl");
+            auto area = memfd.map_shared_rw(size, 0);
+            segment_header sh{shm_magic, shm_version, ring_size};
+            std::memcpy(area.get(), &sh, sizeof(sh));
+            for (unsigned i = 1; i < nr_fds; i++) {
+                fds.push_back(file_desc::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+            }
+            auto hs = std::make_unique<handshake_msg>();
+            hs->set_fds(fds);
+            auto sent = _control.sendmsg(&hs->msg);
+            return sent.then([this, hs = std::move(hs)] (size_t) mutable {
+                auto& byte = hs->byte;
+                return _control.read_some(&byte, 1).finally([hs = std::move(hs)] {});
+            }).then([this, area = std::move(area), ring_size, fds = std::move(fds)] (size_t n) mutable {
+                // The listener closes the unix socket on a bad handshake
+                if (n != 1) {
+                    throw shm_error(ECONNREFUSED);
+                }
+                return make_connection(std::move(area), ring_size, true, std::move(fds), std::move(_control), _opts, {});
+            });
+        });
+    }
+    void set_reuseaddr(bool reuseaddr) override {}
+    bool get_reuseaddr() const override {
+        return false;
+    }
+    void shutdown() override {
+        if (_control) {
+            _control.shutdown(SHUT_RDWR);
+        }
+    }
+};
+
+}
+
+server_socket shm_listen(socket_address addr, shm_options opts) {
+    listen_options lo;
+    return server_socket(std::make_unique<shm_server_socket_impl>(engine().posix_listen(addr, lo), opts));
+}
+
+socket shm_socket(shm_options opts) {
+    return socket(std::make_unique<shm_socket_impl>(opts));
+}
+
+}
+
+}
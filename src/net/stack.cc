@@ -21,6 +21,7 @@
 
 #include <seastar/net/stack.hh>
 #include <seastar/net/inet_address.hh>
+#include <seastar/core/loop.hh>
 
 namespace seastar {
 
@@ -53,6 +54,10 @@ future<net::udp_datagram> net::udp_channel::receive() {
     return _impl->receive();
 }
 
+future<std::vector<net::udp_datagram>> net::udp_channel::receive_batch() {
+    return _impl->receive_batch();
+}
+
 future<> net::udp_channel::send(const socket_address& dst, const char* msg) {
     return _impl->send(dst, msg);
 }
@@ -61,6 +66,10 @@ future<> net::udp_channel::send(const socket_address& dst, packet p) {
     return _impl->send(dst, std::move(p));
 }
 
+future<> net::udp_channel::send_batch(const socket_address& dst, std::vector<packet> datagrams) {
+    return _impl->send_batch(dst, std::move(datagrams));
+}
+
 bool net::udp_channel::is_closed() const {
     return _impl->is_closed();
 }
@@ -129,6 +138,10 @@ int connected_socket::get_sockopt(int level, int optname, void* data, size_t len
     return _csi->get_sockopt(level, optname, data, len);
 }
 
+net::tcp_connection_stats connected_socket::get_tcp_stats() const {
+    return _csi->get_tcp_stats();
+}
+
 socket_address connected_socket::local_address() const noexcept {
     return _csi->local_address();
 }
@@ -141,12 +154,69 @@ void connected_socket::shutdown_input() {
     _csi->shutdown_input();
 }
 
+future<> connected_socket::send_fds(temporary_buffer<char> data, std::vector<file_desc> fds) {
+    return _csi->send_fds(std::move(data), std::move(fds));
+}
+
+future<fd_message> connected_socket::receive_fds(size_t max_size) {
+    return _csi->receive_fds(max_size);
+}
+
+file_desc connected_socket::dup_fd() const {
+    return _csi->dup_fd();
+}
+
 data_source
 net::connected_socket_impl::source(connected_socket_input_stream_config csisc) {
     // Default implementation falls back to non-parameterized data_source
     return source();
 }
 
+future<std::vector<net::udp_datagram>>
+net::udp_channel_impl::receive_batch() {
+    // Default implementation receives a single datagram
+    return receive().then([] (udp_datagram dgram) {
+        std::vector<udp_datagram> batch;
+        batch.push_back(std::move(dgram));
+        return batch;
+    });
+}
+
+future<>
+net::udp_channel_impl::send_batch(const socket_address& dst, std::vector<packet> datagrams) {
+    // Default implementation sends the datagrams one by one
+    return do_with(std::move(datagrams), [this, dst] (std::vector<packet>& datagrams) {
+        return do_for_each(datagrams, [this, dst] (packet& p) {
+            return send(dst, std::move(p));
+        });
+    });
+}
+
+net::tcp_connection_stats
+net::connected_socket_impl::get_tcp_stats() const {
+    throw std::runtime_error("TCP statistics are not supported by this socket");
+}
+
+future<>
+net::connected_socket_impl::send_tls_record(uint8_t content_type, temporary_buffer<char> data) {
+    return make_exception_future<>(std::system_error(ENOTSUP, std::system_category(), "kernel TLS is not supported by this socket"));
+}
+
+future<>
+net::connected_socket_impl::send_fds(temporary_buffer<char> data, std::vector<file_desc> fds) {
+    return make_exception_future<>(std::system_error(ENOTSUP, std::system_category(), "passing file descriptors is not supported by this socket"));
+}
+
+future<fd_message>
+net::connected_socket_impl::receive_fds(size_t max_size) {
+    return make_exception_future<fd_message>(std::system_error(ENOTSUP, std::system_category(), "passing file descriptors is not supported by this socket"));
+}
+
+file_desc
+net::connected_socket_impl::dup_fd() const {
+    throw std::system_error(ENOTSUP, std::system_category(), "this socket has no file descriptor");
+}
+
 socket::~socket()
 {}
 
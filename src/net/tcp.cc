@@ -22,6 +22,7 @@
 #include <seastar/net/tcp.hh>
 #include <seastar/net/tcp-stack.hh>
 #include <seastar/net/ip.hh>
+#include <seastar/net/ipv6.hh>
 #include <seastar/core/align.hh>
 #include <seastar/core/future.hh>
 #include "net/native-stack-impl.hh"
@@ -77,7 +78,39 @@ void tcp_option::parse(uint8_t* beg1, uint8_t* end1) {
     }
 }
 
-uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
+unsigned tcp_option::parse_sack_blocks(const uint8_t* beg1, const uint8_t* end1, sack_block* blocks) {
+    const char* beg = reinterpret_cast<const char*>(beg1);
+    const char* end = reinterpret_cast<const char*>(end1);
+    while (beg < end) {
+        auto kind = option_kind(*beg);
+        if (kind == option_kind::eol) {
+            break;
+        }
+        if (kind == option_kind::nop) {
+            beg += option_len::nop;
+            continue;
+        }
+        if (beg + 1 >= end) {
+            break;
+        }
+        auto len = uint8_t(beg[1]);
+        if (len < 2 || beg + len > end) {
+            break;
+        }
+        if (kind == option_kind::sack_blocks) {
+            unsigned nr_blocks = std::min<unsigned>((len - 2) / 8, max_sack_blocks);
+            for (unsigned i = 0; i < nr_blocks; ++i) {
+                blocks[i].start = read_be<uint32_t>(beg + 2 + 8 * i);
+                blocks[i].end = read_be<uint32_t>(beg + 6 + 8 * i);
+            }
+            return nr_blocks;
+        }
+        beg += len;
+    }
+    return 0;
+}
+
+uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size, const sack_block* blocks, unsigned nr_blocks) {
     auto hdr = reinterpret_cast<char*>(h);
     auto off = hdr + tcp_hdr::len;
     uint8_t size = 0;
@@ -99,6 +132,26 @@ uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
             off += win_scale.len;
             size += win_scale.len;
         }
+        if (_sack_received || !ack_on) {
+            auto sack = tcp_option::sack();
+            sack.write(off);
+            off += sack.len;
+            size += sack.len;
+        }
+    } else if (nr_blocks) {
+        nop().write(off++);
+        nop().write(off++);
+        off[0] = static_cast<uint8_t>(option_kind::sack_blocks);
+        off[1] = 2 + 8 * nr_blocks;
+        off += 2;
+        for (unsigned i = 0; i < nr_blocks; ++i) {
+            write_be<uint32_t>(off, blocks[i].start);
+            write_be<uint32_t>(off + 4, blocks[i].end);
+            off += 8;
+        }
+        size = sack_blocks_size(nr_blocks);
+        assert(size == options_size);
+        return size;
     }
     if (size > 0) {
         // Insert NOP option
@@ -118,7 +171,7 @@ uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
     return size;
 }
 
-uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
+uint8_t tcp_option::get_size(bool syn_on, bool ack_on, unsigned nr_blocks) {
     uint8_t size = 0;
     if (syn_on) {
         if (_mss_received || !ack_on) {
@@ -127,6 +180,11 @@ uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
         if (_win_scale_received || !ack_on) {
             size += option_len::win_scale;
         }
+        if (_sack_received || !ack_on) {
+            size += option_len::sack;
+        }
+    } else {
+        return sack_blocks_size(nr_blocks);
     }
     if (size > 0) {
         size += option_len::eol;
@@ -152,6 +210,21 @@ bool ipv4_tcp::forward(forward_hash& out_hash_data, packet& p, size_t off) {
     return _tcp->forward(out_hash_data, p, off);
 }
 
+ipv6_tcp::ipv6_tcp(ipv6& inet)
+    : _inet_l4(inet), _tcp(std::make_unique<tcp<ipv6_traits>>(_inet_l4)) {
+}
+
+ipv6_tcp::~ipv6_tcp() {
+}
+
+void ipv6_tcp::received(packet p, ipv6_address from, ipv6_address to) {
+    _tcp->received(std::move(p), from, to);
+}
+
+bool ipv6_tcp::forward(forward_hash& out_hash_data, packet& p, size_t off) {
+    return _tcp->forward(out_hash_data, p, off);
+}
+
 server_socket
 tcpv4_listen(tcp<ipv4_traits>& tcpv4, uint16_t port, listen_options opts) {
 	return server_socket(std::make_unique<native_server_socket_impl<tcp<ipv4_traits>>>(
@@ -164,6 +237,58 @@ tcpv4_socket(tcp<ipv4_traits>& tcpv4) {
             tcpv4));
 }
 
+server_socket
+tcpv6_listen(tcp<ipv6_traits>& tcpv6, uint16_t port, listen_options opts) {
+    return server_socket(std::make_unique<native_server_socket_impl<tcp<ipv6_traits>>>(
+            tcpv6, port, opts));
+}
+
+::seastar::socket
+tcpv6_socket(tcp<ipv6_traits>& tcpv6) {
+    return ::seastar::socket(std::make_unique<native_socket_impl<tcp<ipv6_traits>>>(
+            tcpv6));
+}
+
+server_socket
+tcp_dual_stack_listen(tcp<ipv4_traits>& tcpv4, tcp<ipv6_traits>& tcpv6, socket_address sa, listen_options opts) {
+    // An IPv6 listener only accepts IPv6 connections
+    if (sa.family() == AF_INET6) {
+        return tcpv6_listen(tcpv6, sa.port(), opts);
+    }
+    assert(sa.family() == AF_INET || sa.is_unspecified());
+    return tcpv4_listen(tcpv4, ntohs(sa.as_posix_sockaddr_in().sin_port), opts);
+}
+
+class dual_stack_socket_impl final : public socket_impl {
+    seastar::socket _v4;
+    seastar::socket _v6;
+public:
+    dual_stack_socket_impl(seastar::socket v4, seastar::socket v6)
+        : _v4(std::move(v4)), _v6(std::move(v6)) {}
+    virtual future<connected_socket> connect(socket_address sa, socket_address local, transport proto = transport::TCP) override {
+        if (sa.family() == AF_INET6) {
+            return _v6.connect(sa, local, proto);
+        }
+        return _v4.connect(sa, local, proto);
+    }
+    virtual void set_reuseaddr(bool reuseaddr) override {
+        _v4.set_reuseaddr(reuseaddr);
+    }
+    virtual bool get_reuseaddr() const override {
+        return _v4.get_reuseaddr();
+    }
+    virtual void shutdown() override {
+        _v4.shutdown();
+        _v6.shutdown();
+    }
+};
+
+::seastar::socket
+tcp_dual_stack_socket(tcp<ipv4_traits>& tcpv4, tcp<ipv6_traits>& tcpv6) {
+    return ::seastar::socket(std::make_unique<dual_stack_socket_impl>(
+            tcpv4_socket(tcpv4), tcpv6_socket(tcpv6)));
+}
+
 }
 
 }
@@ -0,0 +1,260 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/net/tcp_congestion_control.hh>
+#include <seastar/core/print.hh>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+namespace seastar {
+
+namespace net {
+
+using std::chrono::steady_clock;
+
+// RFC 5681 slow start and congestion avoidance
+class tcp_reno final : public tcp_congestion_control {
+public:
+    virtual const char* name() const noexcept override {
+        return "reno";
+    }
+    virtual uint32_t on_ack(const state& s, uint32_t acked_bytes) noexcept override {
+        uint32_t smss = s.mss;
+        if (s.cwnd < s.ssthresh) {
+            // In slow start phase
+            return s.cwnd + std::min(acked_bytes, smss);
+        } else {
+            // In congestion avoidance phase
+            uint32_t round_up = 1;
+            return s.cwnd + std::max(round_up, smss * smss / s.cwnd);
+        }
+    }
+    virtual uint32_t on_loss(const state& s) noexcept override {
+        return std::max(s.flight_size / 2, 2u * s.mss);
+    }
+    virtual uint32_t on_retransmit_timeout(const state& s) noexcept override {
+        return std::max(s.flight_size / 2, 2u * s.mss);
+    }
+};
+
+// RFC 8312: the window grows as a cubic function of the time since the last
+// loss, centered on the window at which the loss happened, so it recovers
+// quickly on paths with a large bandwidth-delay product.
+class tcp_cubic final : public tcp_congestion_control {
+    static constexpr double C = 0.4;
+    static constexpr double beta = 0.7;
+    // In segments
+    double _w_max = 0;
+    double _w_est = 0;
+    double _origin = 0;
+    double _k = 0;
+    // Increase not yet applied, in bytes
+    double _pending = 0;
+    std::optional<steady_clock::time_point> _epoch_start;
+public:
+    virtual const char* name() const noexcept override {
+        return "cubic";
+    }
+    virtual uint32_t on_ack(const state& s, uint32_t acked_bytes) noexcept override {
+        if (s.cwnd < s.ssthresh) {
+            return s.cwnd + std::min(acked_bytes, uint32_t(s.mss));
+        }
+        auto now = steady_clock::now();
+        double cwnd = double(s.cwnd) / s.mss;
+        if (!_epoch_start) {
+            _epoch_start = now;
+            if (cwnd < _w_max) {
+                _k = std::cbrt((_w_max - cwnd) / C);
+                _origin = _w_max;
+            } else {
+                _k = 0;
+                _origin = cwnd;
+            }
+            _w_est = cwnd;
+        }
+        double t = std::chrono::duration<double>(now - *_epoch_start + s.srtt).count();
+        double target = _origin + C * std::pow(t - _k, 3);
+        // The window standard TCP would have reached, which CUBIC should
+        // not fall behind of
+        _w_est += 3 * (1 - beta) / (1 + beta) * acked_bytes / s.cwnd;
+        target = std::clamp(std::max(target, _w_est), cwnd, 1.5 * cwnd);
+        _pending += (target - cwnd) / cwnd * acked_bytes;
+        if (_pending < 1) {
+            return s.cwnd;
+        }
+        auto increase = uint32_t(_pending);
+        _pending -= increase;
+        return s.cwnd + increase;
+    }
+    virtual uint32_t on_loss(const state& s) noexcept override {
+        double cwnd = double(s.cwnd) / s.mss;
+        // Fast convergence: release bandwidth to new flows sooner
+        _w_max = cwnd < _w_max ? cwnd * (1 + beta) / 2 : cwnd;
+        _epoch_start.reset();
+        _pending = 0;
+        return std::max(uint32_t(s.cwnd * beta), 2u * s.mss);
+    }
+    virtual uint32_t on_retransmit_timeout(const state& s) noexcept override {
+        return on_loss(s);
+    }
+};
+
+// A window-based rendition of BBR: the bottleneck bandwidth and the
+// round-trip propagation delay are estimated from the acknowledgements,
+// and the congestion window is set to a multiple of their product rather
+// than reduced on every loss. Without a pacer, the pacing gain cycling of
+// ProbeBW is left out; the window gain alone keeps probing for bandwidth.
+class tcp_bbr final : public tcp_congestion_control {
+    enum class mode { startup, drain, probe_bw, probe_rtt };
+    static constexpr double high_gain = 2.885;
+    static constexpr double cwnd_gain = 2;
+    static constexpr unsigned bw_filter_rounds = 10;
+    static constexpr unsigned full_bw_rounds = 3;
+    static constexpr double full_bw_growth = 1.25;
+    static constexpr auto min_rtt_expiry = std::chrono::seconds(10);
+    static constexpr auto probe_rtt_duration = std::chrono::milliseconds(200);
+    static constexpr unsigned min_cwnd_segments = 4;
+
+    mode _mode = mode::startup;
+    uint64_t _delivered = 0;
+    // A round trip ends when the data in flight at its start has been delivered
+    uint64_t _round_end_delivered = 0;
+    uint64_t _round_start_delivered = 0;
+    steady_clock::time_point _round_start;
+    uint64_t _round_count = 0;
+    // Delivery rate of the most recent rounds, in bytes per second
+    std::array<double, bw_filter_rounds> _bw_samples = {};
+    double _full_bw = 0;
+    unsigned _full_bw_count = 0;
+    bool _filled_pipe = false;
+    steady_clock::duration _min_rtt = steady_clock::duration::max();
+    steady_clock::time_point _min_rtt_stamp;
+    steady_clock::time_point _probe_rtt_done;
+    uint32_t _prior_cwnd = 0;
+private:
+    double max_bw() const noexcept {
+        return *std::max_element(_bw_samples.begin(), _bw_samples.end());
+    }
+    double bdp() const noexcept {
+        if (_min_rtt == steady_clock::duration::max()) {
+            return 0;
+        }
+        return max_bw() * std::chrono::duration<double>(_min_rtt).count();
+    }
+    void on_round_end(steady_clock::time_point now, uint32_t flight_size) noexcept {
+        if (_round_count++) {
+            auto interval = now - _round_start;
+            if (interval.count() > 0) {
+                auto rate = (_delivered - _round_start_delivered) / std::chrono::duration<double>(interval).count();
+                _bw_samples[_round_count % bw_filter_rounds] = rate;
+                if (interval <= _min_rtt || now - _min_rtt_stamp > min_rtt_expiry) {
+                    _min_rtt = interval;
+                    _min_rtt_stamp = now;
+                }
+            }
+        }
+        _round_start = now;
+        _round_start_delivered = _delivered;
+        _round_end_delivered = _delivered + std::max(flight_size, 1u);
+
+        if (!_filled_pipe) {
+            auto bw = max_bw();
+            if (bw >= _full_bw * full_bw_growth) {
+                _full_bw = bw;
+                _full_bw_count = 0;
+            } else if (++_full_bw_count >= full_bw_rounds) {
+                _filled_pipe = true;
+            }
+        }
+    }
+public:
+    virtual const char* name() const noexcept override {
+        return "bbr";
+    }
+    virtual uint32_t on_ack(const state& s, uint32_t acked_bytes) noexcept override {
+        auto now = steady_clock::now();
+        _delivered += acked_bytes;
+        if (_delivered >= _round_end_delivered) {
+            on_round_end(now, s.flight_size);
+        }
+
+        if (_mode == mode::startup && _filled_pipe) {
+            _mode = mode::drain;
+        }
+        if (_mode == mode::drain && s.flight_size <= bdp()) {
+            _mode = mode::probe_bw;
+        }
+        if (_mode != mode::probe_rtt && _min_rtt != steady_clock::duration::max()
+                && now - _min_rtt_stamp > min_rtt_expiry) {
+            // Drain the queue to measure the propagation delay again
+            _mode = mode::probe_rtt;
+            _prior_cwnd = s.cwnd;
+            _probe_rtt_done = now + std::max(probe_rtt_duration, std::chrono::duration_cast<std::chrono::milliseconds>(_min_rtt));
+        }
+
+        uint32_t min_cwnd = min_cwnd_segments * s.mss;
+        if (_mode == mode::probe_rtt) {
+            if (now < _probe_rtt_done) {
+                return min_cwnd;
+            }
+            _min_rtt_stamp = now;
+            _mode = _filled_pipe ? mode::probe_bw : mode::startup;
+            return std::max(_prior_cwnd, min_cwnd);
+        }
+
+        double gain = _mode == mode::startup ? high_gain : _mode == mode::drain ? 1 : cwnd_gain;
+        double target = gain * bdp() + 3 * s.mss;
+        uint64_t cwnd = s.cwnd;
+        if (_filled_pipe) {
+            cwnd = std::min<double>(cwnd + acked_bytes, target);
+        } else if (cwnd < target || bdp() == 0) {
+            cwnd += acked_bytes;
+        }
+        return std::clamp<uint64_t>(cwnd, min_cwnd, std::numeric_limits<uint32_t>::max());
+    }
+    virtual uint32_t on_loss(const state& s) noexcept override {
+        // Loss is not taken as a sign of congestion; fast recovery restores
+        // the current window when it completes
+        return std::max(s.cwnd, 2u * s.mss);
+    }
+    virtual uint32_t on_retransmit_timeout(const state& s) noexcept override {
+        return std::max(s.cwnd, 2u * s.mss);
+    }
+};
+
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(std::string_view name) {
+    if (name == "reno") {
+        return std::make_unique<tcp_reno>();
+    } else if (name == "cubic") {
+        return std::make_unique<tcp_cubic>();
+    } else if (name == "bbr") {
+        return std::make_unique<tcp_bbr>();
+    }
+    throw std::invalid_argument(format("unknown TCP congestion control algorithm: {}", name));
+}
+
+}
+
+}
@@ -21,7 +21,14 @@
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
+#include <gnutls/abstract.h>
 #include <system_error>
+#include <list>
+#include <unordered_map>
+#include <netinet/tcp.h>
+#if __has_include(<linux/tls.h>)
+#include <linux/tls.h>
+#endif
 
 #include <seastar/core/loop.hh>
 #include <seastar/core/reactor.hh>
@@ -31,12 +38,15 @@
 #include <seastar/core/sstring.hh>
 #include <seastar/core/semaphore.hh>
 #include <seastar/core/timer.hh>
+#include <seastar/core/lowres_clock.hh>
 #include <seastar/core/print.hh>
 #include <seastar/core/with_timeout.hh>
+#include <seastar/core/with_scheduling_group.hh>
 #include <seastar/net/tls.hh>
 #include <seastar/net/stack.hh>
 #include <seastar/util/std-compat.hh>
 #include <seastar/util/variant_utils.hh>
+#include <seastar/util/defer.hh>
 
 #include <boost/range/iterator_range.hpp>
 #include <boost/range/adaptor/map.hpp>
@@ -50,6 +60,9 @@ class net::get_impl {
     static std::unique_ptr<connected_socket_impl> get(connected_socket s) {
         return std::move(s._csi);
     }
+    static connected_socket_impl* maybe_get_ptr(connected_socket& s) {
+        return s._csi.get();
+    }
 };
 
 class blob_wrapper: public gnutls_datum_t {
@@ -304,6 +317,216 @@ future<tls::x509_cert> tls::x509_cert::from_file(
     });
 }
 
+// Serialized session parameters for resumption, keyed by session id on
+// servers and by server name on clients. Least recently used entries are
+// dropped once full.
+class session_cache {
+    struct entry {
+        sstring key;
+        sstring data;
+        lowres_clock::time_point expires;
+    };
+    std::list<entry> _lru;
+    std::unordered_map<sstring, std::list<entry>::iterator> _index;
+    size_t _max_entries;
+    std::chrono::seconds _lifetime;
+public:
+    session_cache(size_t max_entries, std::chrono::seconds lifetime)
+        : _max_entries(max_entries)
+        , _lifetime(lifetime)
+    {}
+    void put(sstring key, sstring data) {
+        remove(key);
+        if (_max_entries == 0) {
+            return;
+        }
+        if (_index.size() == _max_entries) {
+            _index.erase(_lru.back().key);
+            _lru.pop_back();
+        }
+        _lru.push_front(entry{key, std::move(data), lowres_clock::now() + _lifetime});
+        _index.emplace(std::move(key), _lru.begin());
+    }
+    const sstring* get(const sstring& key) {
+        auto i = _index.find(key);
+        if (i == _index.end()) {
+            return nullptr;
+        }
+        if (i->second->expires < lowres_clock::now()) {
+            _lru.erase(i->second);
+            _index.erase(i);
+            return nullptr;
+        }
+        _lru.splice(_lru.begin(), _lru, i->second);
+        return &i->second->data;
+    }
+    void remove(const sstring& key) {
+        auto i = _index.find(key);
+        if (i != _index.end()) {
+            _lru.erase(i->second);
+            _index.erase(i);
+        }
+    }
+
+    // gnutls server side database callbacks, see gnutls_db_set_ptr()
+    static int store(void* ptr, gnutls_datum_t key, gnutls_datum_t data) noexcept {
+        try {
+            static_cast<session_cache*>(ptr)->put(to_sstring(key), to_sstring(data));
+            return 0;
+        } catch (...) {
+            return GNUTLS_E_MEMORY_ERROR;
+        }
+    }
+    static gnutls_datum_t retrieve(void* ptr, gnutls_datum_t key) noexcept {
+        try {
+            auto data = static_cast<session_cache*>(ptr)->get(to_sstring(key));
+            if (data) {
+                auto p = static_cast<unsigned char*>(gnutls_malloc(data->size()));
+                if (p) {
+                    std::copy(data->begin(), data->end(), p);
+                    return gnutls_datum_t{p, unsigned(data->size())};
+                }
+            }
+        } catch (...) {
+        }
+        return gnutls_datum_t{nullptr, 0};
+    }
+    static int remove(void* ptr, gnutls_datum_t key) noexcept {
+        try {
+            static_cast<session_cache*>(ptr)->remove(to_sstring(key));
+            return 0;
+        } catch (...) {
+            return GNUTLS_E_MEMORY_ERROR;
+        }
+    }
+private:
+    static sstring to_sstring(const gnutls_datum_t& d) {
+        return sstring(reinterpret_cast<const char*>(d.data), d.size);
+    }
+};
+
+// An RSA private key whose operations are run by a private_key_executor.
+// gnutls calls into the key synchronously, so handshakes using it run in a
+// seastar::thread (see session::handshake_step()) which waits for the
+// executor. Operations invoked outside of a thread run inline.
+class offloaded_private_key {
+    gnutls_privkey_t _key;
+    tls::private_key_executor _executor;
+
+    offloaded_private_key(gnutls_privkey_t key, tls::private_key_executor executor) noexcept
+        : _key(key)
+        , _executor(std::move(executor))
+    {}
+    ~offloaded_private_key() {
+        gnutls_privkey_deinit(_key);
+    }
+
+    template <typename Func>
+    int run(Func func) noexcept {
+        if (!thread::running_in_thread()) {
+            return func();
+        }
+        int res;
+        try {
+            _executor([&res, &func] {
+                res = func();
+            }).get();
+        } catch (...) {
+            return GNUTLS_E_INTERNAL_ERROR;
+        }
+        return res;
+    }
+
+    static offloaded_private_key& from(void* userdata) noexcept {
+        return *static_cast<offloaded_private_key*>(userdata);
+    }
+    static int sign_data(gnutls_privkey_t, gnutls_sign_algorithm_t algo, void* userdata, unsigned flags,
+            const gnutls_datum_t* data, gnutls_datum_t* signature) noexcept {
+        auto& k = from(userdata);
+        return k.run([&] {
+            return gnutls_privkey_sign_data2(k._key, algo, flags, data, signature);
+        });
+    }
+    static int sign_hash(gnutls_privkey_t, gnutls_sign_algorithm_t algo, void* userdata, unsigned flags,
+            const gnutls_datum_t* hash, gnutls_datum_t* signature) noexcept {
+        auto& k = from(userdata);
+        return k.run([&] {
+            return gnutls_privkey_sign_hash2(k._key, algo, flags, hash, signature);
+        });
+    }
+    static int decrypt(gnutls_privkey_t, void* userdata, const gnutls_datum_t* ciphertext, gnutls_datum_t* plaintext) noexcept {
+        auto& k = from(userdata);
+        return k.run([&] {
+            return gnutls_privkey_decrypt_data(k._key, 0, ciphertext, plaintext);
+        });
+    }
+    static int info(gnutls_privkey_t, unsigned flags, void* userdata) noexcept {
+        auto& k = from(userdata);
+        unsigned bits = 0;
+        auto pk = gnutls_privkey_get_pk_algorithm(k._key, &bits);
+        if (flags & GNUTLS_PRIVKEY_INFO_HAVE_SIGN_ALGO) {
+            auto sign = gnutls_sign_algorithm_t(GNUTLS_FLAGS_TO_SIGN_ALGO(flags));
+            return gnutls_sign_supports_pk_algorithm(sign, gnutls_pk_algorithm_t(pk));
+        }
+        if (flags & GNUTLS_PRIVKEY_INFO_PK_ALGO_BITS) {
+            return bits;
+        }
+        if (flags & GNUTLS_PRIVKEY_INFO_PK_ALGO) {
+            return pk;
+        }
+        // no preferred signature algorithm
+        return 0;
+    }
+    static void deinit(gnutls_privkey_t, void* userdata) noexcept {
+        delete &from(userdata);
+    }
+public:
+    // Adds the certificate chain and key to the credentials, with the key
+    // offloaded. Returns false, leaving the credentials alone, for keys
+    // other than RSA.
+    static bool load(gnutls_certificate_credentials_t creds, const gnutls_datum_t& cert, const gnutls_datum_t& key,
+            gnutls_x509_crt_fmt_t fmt, const tls::private_key_executor& executor) {
+        auto make_privkey = [] {
+            gnutls_privkey_t k;
+            gtls_chk(gnutls_privkey_init(&k));
+            return std::unique_ptr<std::remove_pointer_t<gnutls_privkey_t>, void(*)(gnutls_privkey_t)>(k, &gnutls_privkey_deinit);
+        };
+        auto real = make_privkey();
+        gtls_chk(gnutls_privkey_import_x509_raw(real.get(), &key, fmt, nullptr, 0));
+        if (gnutls_privkey_get_pk_algorithm(real.get(), nullptr) != GNUTLS_PK_RSA) {
+            return false;
+        }
+
+        std::vector<gnutls_pcert_st> pcerts(8);
+        auto n = unsigned(pcerts.size());
+        auto res = gnutls_pcert_list_import_x509_raw(pcerts.data(), &n, &cert, fmt, 0);
+        if (res == GNUTLS_E_SHORT_MEMORY_BUFFER) {
+            pcerts.resize(n);
+            res = gnutls_pcert_list_import_x509_raw(pcerts.data(), &n, &cert, fmt, 0);
+        }
+        gtls_chk(res);
+        auto deinit_pcerts = defer([&] () noexcept {
+            for (unsigned i = 0; i < n; ++i) {
+                gnutls_pcert_deinit(&pcerts[i]);
+            }
+        });
+
+        auto wrapper = make_privkey();
+        auto k = new offloaded_private_key(real.release(), executor);
+        res = gnutls_privkey_import_ext4(wrapper.get(), k, &sign_data, &sign_hash, &decrypt, &deinit, &info,
+                GNUTLS_PRIVKEY_IMPORT_AUTO_RELEASE);
+        if (res < 0) {
+            delete k;
+            gtls_chk(res);
+        }
+        // The credentials own the certificates and key from here on
+        gtls_chk(gnutls_certificate_set_key(creds, nullptr, 0, pcerts.data(), n, wrapper.get()));
+        wrapper.release();
+        deinit_pcerts.cancel();
+        return true;
+    }
+};
+
 class tls::certificate_credentials::impl: public gnutlsobj {
 public:
     impl()
@@ -341,6 +564,9 @@ class tls::certificate_credentials::impl: public gnutlsobj {
     void set_x509_key(const blob& cert, const blob& key, x509_crt_format fmt) {
         blob_wrapper w1(cert);
         blob_wrapper w2(key);
+        if (_private_key_executor && offloaded_private_key::load(_creds, w1, w2, gnutls_x509_crt_fmt_t(fmt), _private_key_executor)) {
+            return;
+        }
         gtls_chk(
                 gnutls_certificate_set_x509_key_mem(_creds, &w1, &w2,
                         gnutls_x509_crt_fmt_t(fmt)));
@@ -393,6 +619,38 @@ class tls::certificate_credentials::impl: public gnutlsobj {
     void set_dn_verification_callback(dn_callback cb) {
         _dn_callback = std::move(cb);
     }
+    void enable_kernel_tls(bool enabled) {
+        _kernel_tls = enabled;
+    }
+    bool kernel_tls() const {
+        return _kernel_tls;
+    }
+    void enable_session_tickets(const blob& key, std::chrono::seconds lifetime) {
+        if (key.empty()) {
+            throw std::invalid_argument("Session ticket key must not be empty");
+        }
+        _session_ticket_key = sstring(key.data(), key.size());
+        _session_lifetime = lifetime;
+    }
+    void enable_session_cache(size_t max_entries, std::chrono::seconds lifetime) {
+        _server_session_cache = std::make_unique<session_cache>(max_entries, lifetime);
+        if (_session_ticket_key.empty()) {
+            _session_lifetime = lifetime;
+        }
+    }
+    void set_handshake_scheduling_group(scheduling_group sg) {
+        _handshake_scheduling_group = sg;
+    }
+    void set_private_key_executor(private_key_executor executor) {
+        _private_key_executor = std::move(executor);
+    }
+    void enable_session_resumption(size_t max_entries) {
+        // The server decides how long its sessions stay resumable
+        _client_session_cache = std::make_unique<session_cache>(max_entries, std::chrono::hours(24 * 7));
+    }
+    void set_alpn_protocols(const std::vector<sstring>& protocols) {
+        _alpn_protocols = protocols;
+    }
 private:
     friend class credentials_builder;
     friend class session;
@@ -416,6 +674,14 @@ class tls::certificate_credentials::impl: public gnutlsobj {
     bool _load_system_trust = false;
     semaphore _system_trust_sem {1};
     dn_callback _dn_callback;
+    bool _kernel_tls = false;
+    sstring _session_ticket_key;
+    std::chrono::seconds _session_lifetime;
+    std::unique_ptr<session_cache> _server_session_cache;
+    std::unique_ptr<session_cache> _client_session_cache;
+    std::vector<sstring> _alpn_protocols;
+    std::optional<scheduling_group> _handshake_scheduling_group;
+    private_key_executor _private_key_executor;
 };
 
 tls::certificate_credentials::certificate_credentials()
@@ -493,6 +759,26 @@ void tls::certificate_credentials::set_dn_verification_callback(dn_callback cb)
     _impl->set_dn_verification_callback(std::move(cb));
 }
 
+void tls::certificate_credentials::enable_kernel_tls(bool enabled) {
+    _impl->enable_kernel_tls(enabled);
+}
+
+void tls::certificate_credentials::enable_session_resumption(size_t max_entries) {
+    _impl->enable_session_resumption(max_entries);
+}
+
+void tls::certificate_credentials::set_alpn_protocols(const std::vector<sstring>& protocols) {
+    _impl->set_alpn_protocols(protocols);
+}
+
+void tls::certificate_credentials::set_handshake_scheduling_group(scheduling_group sg) {
+    _impl->set_handshake_scheduling_group(sg);
+}
+
+void tls::certificate_credentials::set_private_key_executor(private_key_executor executor) {
+    _impl->set_private_key_executor(std::move(executor));
+}
+
 tls::server_credentials::server_credentials()
 #if GNUTLS_VERSION_NUMBER < 0x030600
     : server_credentials(dh_params{})
@@ -515,6 +801,23 @@ void tls::server_credentials::set_client_auth(client_auth ca) {
     _impl->set_client_auth(ca);
 }
 
+void tls::server_credentials::enable_session_tickets(const blob& key, std::chrono::seconds lifetime) {
+    _impl->enable_session_tickets(key, lifetime);
+}
+
+void tls::server_credentials::enable_session_cache(size_t max_entries, std::chrono::seconds lifetime) {
+    _impl->enable_session_cache(max_entries, lifetime);
+}
+
+sstring tls::generate_session_ticket_key() {
+    gnutls_datum_t key;
+    gtls_chk(gnutls_session_ticket_key_generate(&key));
+    sstring res(reinterpret_cast<const char*>(key.data), key.size);
+    gnutls_memset(key.data, 0, key.size);
+    gnutls_free(key.data);
+    return res;
+}
+
 static const sstring dh_level_key = "dh_level";
 static const sstring x509_trust_key = "x509_trust";
 static const sstring x509_crl_key = "x509_crl";
@@ -617,6 +920,38 @@ void tls::credentials_builder::set_priority_string(const sstring& prio) {
     _priority = prio;
 }
 
+void tls::credentials_builder::enable_kernel_tls(bool enabled) {
+    _kernel_tls = enabled;
+}
+
+void tls::credentials_builder::enable_session_tickets(std::chrono::seconds lifetime) {
+    if (_session_ticket_key.empty()) {
+        _session_ticket_key = generate_session_ticket_key();
+    }
+    _session_ticket_lifetime = lifetime;
+}
+
+void tls::credentials_builder::enable_session_cache(size_t max_entries, std::chrono::seconds lifetime) {
+    _session_cache_size = max_entries;
+    _session_cache_lifetime = lifetime;
+}
+
+void tls::credentials_builder::enable_session_resumption(size_t max_entries) {
+    _session_resumption_size = max_entries;
+}
+
+void tls::credentials_builder::set_alpn_protocols(const std::vector<sstring>& protocols) {
+    _alpn_protocols = protocols;
+}
+
+void tls::credentials_builder::set_handshake_scheduling_group(scheduling_group sg) {
+    _handshake_scheduling_group = sg;
+}
+
+void tls::credentials_builder::set_private_key_executor(private_key_executor executor) {
+    _private_key_executor = std::move(executor);
+}
+
 template<typename Blobs, typename Visitor>
 static void visit_blobs(Blobs& blobs, Visitor&& visitor) {
     auto visit = [&](const sstring& key, auto* vt) {
@@ -633,6 +968,14 @@ static void visit_blobs(Blobs& blobs, Visitor&& visitor) {
 }
 
 void tls::credentials_builder::apply_to(certificate_credentials& creds) const {
+    // Must be in place before the keys are loaded
+    if (_private_key_executor) {
+        creds.set_private_key_executor(_private_key_executor);
+    }
+    if (_handshake_scheduling_group) {
+        creds.set_handshake_scheduling_group(*_handshake_scheduling_group);
+    }
+
     // Could potentially be templated down, but why bother...
     visit_blobs(_blobs, make_visitor(
         [&](const sstring& key, const x509_simple& info) {
@@ -664,6 +1007,18 @@ void tls::credentials_builder::apply_to(certificate_credentials& creds) const {
     }
 
     creds._impl->set_client_auth(_client_auth);
+    creds._impl->enable_kernel_tls(_kernel_tls);
+
+    if (!_session_ticket_key.empty()) {
+        creds._impl->enable_session_tickets(_session_ticket_key, _session_ticket_lifetime);
+    }
+    if (_session_cache_size) {
+        creds._impl->enable_session_cache(_session_cache_size, _session_cache_lifetime);
+    }
+    if (_session_resumption_size) {
+        creds._impl->enable_session_resumption(_session_resumption_size);
+    }
+    creds._impl->set_alpn_protocols(_alpn_protocols);
 }
 
 shared_ptr<tls::certificate_credentials> tls::credentials_builder::build_certificate_credentials() const {
@@ -1005,6 +1360,39 @@ class session : public enable_lw_shared_from_this<session> {
             gtls_chk(gnutls_priority_set(*this, prio));
         }
 
+        if (!_creds->_alpn_protocols.empty()) {
+            // Copied by gnutls
+            std::vector<gnutls_datum_t> protocols;
+            for (auto& p : _creds->_alpn_protocols) {
+                protocols.push_back({reinterpret_cast<unsigned char*>(const_cast<char*>(p.data())), unsigned(p.size())});
+            }
+            gtls_chk(gnutls_alpn_set_protocols(*this, protocols.data(), protocols.size(),
+                    _type == type::SERVER ? GNUTLS_ALPN_SERVER_PRECEDENCE : 0));
+        }
+
+        if (_type == type::SERVER) {
+            if (!_creds->_session_ticket_key.empty()) {
+                blob_wrapper key(_creds->_session_ticket_key);
+                gtls_chk(gnutls_session_ticket_enable_server(*this, &key));
+            }
+            if (auto cache = _creds->_server_session_cache.get()) {
+                gnutls_db_set_ptr(*this, cache);
+                gnutls_db_set_store_function(*this, &session_cache::store);
+                gnutls_db_set_retrieve_function(*this, &session_cache::retrieve);
+                gnutls_db_set_remove_function(*this, &session_cache::remove);
+            }
+            if (!_creds->_session_ticket_key.empty() || _creds->_server_session_cache) {
+                // Also the period at which gnutls rotates the keys derived
+                // from the ticket master key
+                gnutls_db_set_cache_expiration(*this, _creds->_session_lifetime.count());
+            }
+        } else if (_creds->_client_session_cache && !_hostname.empty()) {
+            if (auto data = _creds->_client_session_cache->get(_hostname)) {
+                // Failing to resume just means a full handshake
+                (void)gnutls_session_set_data(*this, data->data(), data->size());
+            }
+        }
+
         gnutls_transport_set_ptr(*this, this);
         gnutls_transport_set_vec_push_function(*this, &vec_push_wrapper);
         gnutls_transport_set_pull_function(*this, &pull_wrapper);
@@ -1067,8 +1455,29 @@ class session : public enable_lw_shared_from_this<session> {
         if (_type == type::CLIENT && !_hostname.empty()) {
             gnutls_server_name_set(*this, GNUTLS_NAME_DNS, _hostname.data(), _hostname.size());
         }
+        return handshake_step().then([this] (int res) {
+            return handle_handshake_result(res);
+        });
+    }
+    // Runs gnutls_handshake() in the handshake scheduling group. With
+    // offloaded private keys it runs in a thread, which waits for their
+    // operations (see offloaded_private_key).
+    future<int> handshake_step() {
+        auto step = [this] {
+            return gnutls_handshake(*this);
+        };
+        if (_creds->_private_key_executor) {
+            thread_attributes attr;
+            attr.sched_group = _creds->_handshake_scheduling_group;
+            return seastar::async(std::move(attr), step);
+        }
+        if (_creds->_handshake_scheduling_group) {
+            return with_scheduling_group(*_creds->_handshake_scheduling_group, step);
+        }
+        return make_ready_future<int>(step());
+    }
+    future<> handle_handshake_result(int res) {
         try {
-            auto res = gnutls_handshake(*this);
             if (res < 0) {
                 switch (res) {
                 case GNUTLS_E_AGAIN:
@@ -1111,12 +1520,123 @@ class session : public enable_lw_shared_from_this<session> {
                 verify();
             }
             _connected = true;
+            remember_session();
             // make sure we reset output_pending
-            return wait_for_output();
+            return wait_for_output().then([this] {
+                if (_creds->kernel_tls() && !_ktls_tx) {
+                    offload_tx_to_kernel();
+                }
+            });
         } catch (...) {
             return make_exception_future<>(std::current_exception());
         }
     }
+    // Gives the kernel the write keys and sequence number of the session,
+    // after which it encrypts whatever is written to the socket. Leaves the
+    // session alone when the cipher, the kernel or the socket cannot do it.
+    void offload_tx_to_kernel() noexcept {
+#if defined(TLS_TX) && defined(TCP_ULP)
+        auto version = gnutls_protocol_get_version(*this);
+        if (version != GNUTLS_TLS1_2 && version != GNUTLS_TLS1_3) {
+            return;
+        }
+        gnutls_datum_t mac_key, iv, cipher_key;
+        unsigned char seq[8];
+        if (gnutls_record_get_state(*this, 0, &mac_key, &iv, &cipher_key, seq) < 0) {
+            return;
+        }
+        auto offload = [&] <typename CryptoInfo> (CryptoInfo info, uint16_t cipher_type) {
+            if (iv.size < sizeof(info.salt) || cipher_key.size != sizeof(info.key)) {
+                return false;
+            }
+            info.info.version = version == GNUTLS_TLS1_2 ? TLS_1_2_VERSION : TLS_1_3_VERSION;
+            info.info.cipher_type = cipher_type;
+            std::copy_n(iv.data, sizeof(info.salt), info.salt);
+            // TLS 1.2 GCM sends the explicit nonce with every record, and the
+            // sequence number is what gnutls uses for it; the other variants
+            // derive the nonce from the rest of the static IV.
+            if (version == GNUTLS_TLS1_2 && iv.size == sizeof(info.salt)) {
+                std::copy_n(seq, sizeof(info.iv), info.iv);
+            } else if (iv.size == sizeof(info.salt) + sizeof(info.iv)) {
+                std::copy_n(iv.data + sizeof(info.salt), sizeof(info.iv), info.iv);
+            } else {
+                return false;
+            }
+            std::copy_n(cipher_key.data, sizeof(info.key), info.key);
+            std::copy_n(seq, sizeof(info.rec_seq), info.rec_seq);
+            _sock->set_sockopt(IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"));
+            _sock->set_sockopt(SOL_TLS, TLS_TX, &info, sizeof(info));
+            return true;
+        };
+        try {
+            switch (gnutls_cipher_get(*this)) {
+            case GNUTLS_CIPHER_AES_128_GCM:
+                _ktls_tx = offload(tls12_crypto_info_aes_gcm_128{}, TLS_CIPHER_AES_GCM_128);
+                break;
+            case GNUTLS_CIPHER_AES_256_GCM:
+                _ktls_tx = offload(tls12_crypto_info_aes_gcm_256{}, TLS_CIPHER_AES_GCM_256);
+                break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+            case GNUTLS_CIPHER_CHACHA20_POLY1305:
+                _ktls_tx = offload(tls12_crypto_info_chacha20_poly1305{}, TLS_CIPHER_CHACHA20_POLY1305);
+                break;
+#endif
+            default:
+                break;
+            }
+        } catch (...) {
+            // No tls module, or not a kernel socket. Once the ULP is attached
+            // without keys the socket still passes plain data through, so
+            // carrying on in userspace is safe.
+        }
+#endif
+    }
+    // Saves the session parameters for the next connection to the same
+    // server name, see certificate_credentials::enable_session_resumption()
+    void remember_session() noexcept {
+        if (_type != type::CLIENT || _session_remembered || !_creds->_client_session_cache || _hostname.empty()) {
+            return;
+        }
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+        // TLS 1.3 sessions become resumable once the server sends a ticket,
+        // which arrives with the application data after the handshake
+        if (gnutls_protocol_get_version(*this) == GNUTLS_TLS1_3
+                && !(gnutls_session_get_flags(*this) & GNUTLS_SFLAGS_SESSION_TICKET)) {
+            return;
+        }
+#endif
+        gnutls_datum_t data;
+        if (gnutls_session_get_data2(*this, &data) < 0) {
+            return;
+        }
+        try {
+            _creds->_client_session_cache->put(_hostname, sstring(reinterpret_cast<const char*>(data.data), data.size));
+            _session_remembered = true;
+        } catch (...) {
+            // not remembering is fine
+        }
+        gnutls_free(data.data);
+    }
+    future<bool> is_resumed() {
+        if (!_connected) {
+            return handshake().then([this] {
+                return is_resumed();
+            });
+        }
+        return make_ready_future<bool>(gnutls_session_is_resumed(*this));
+    }
+    future<std::optional<sstring>> get_alpn_protocol() {
+        if (!_connected) {
+            return handshake().then([this] {
+                return get_alpn_protocol();
+            });
+        }
+        gnutls_datum_t protocol;
+        if (gnutls_alpn_get_selected_protocol(*this, &protocol) != GNUTLS_E_SUCCESS) {
+            return make_ready_future<std::optional<sstring>>();
+        }
+        return make_ready_future<std::optional<sstring>>(sstring(reinterpret_cast<const char*>(protocol.data), protocol.size));
+    }
     future<> handshake() {
         // maybe load system certificates before handshake, in case we
         // have not done so yet...
@@ -1293,6 +1813,7 @@ class session : public enable_lw_shared_from_this<session> {
             if (n == 0) {
                 _eof = true;
             }
+            remember_session();
             return make_ready_future<temporary_buffer<char>>(std::move(buf));
         }
         if (eof()) {
@@ -1340,6 +1861,11 @@ class session : public enable_lw_shared_from_this<session> {
                return put(std::move(p));
             });
         }
+        if (_ktls_tx) {
+            return with_semaphore(_out_sem, 1, [this, p = std::move(p)] () mutable {
+                return _out.put(std::move(p));
+            });
+        }
         auto i = p.fragments().begin();
         auto e = p.fragments().end();
         return with_semaphore(_out_sem, 1, std::bind(&session::do_put, this, i, e)).finally([p = std::move(p)] {});
@@ -1361,6 +1887,14 @@ class session : public enable_lw_shared_from_this<session> {
         return n;
     }
     ssize_t vec_push(const giovec_t * iov, int iovcnt) {
+        if (_ktls_tx) {
+            // The kernel owns the write keys and sequence numbers now, so
+            // records encrypted by gnutls (re-handshakes, key updates) can
+            // no longer be sent.
+            gnutls_transport_set_errno(*this, EIO);
+            _output_pending = make_exception_future<>(std::runtime_error("TLS renegotiation is not supported with kernel TLS offload"));
+            return -1;
+        }
         if (!_output_pending.available()) {
             gnutls_transport_set_errno(*this, EAGAIN);
             return -1;
@@ -1410,6 +1944,15 @@ class session : public enable_lw_shared_from_this<session> {
         if (_error || !_connected) {
             return make_ready_future();
         }
+        if (_ktls_tx) {
+            static constexpr uint8_t alert_content_type = 21;
+            temporary_buffer<char> alert(2);
+            alert.get_write()[0] = GNUTLS_AL_WARNING;
+            alert.get_write()[1] = GNUTLS_A_CLOSE_NOTIFY;
+            return _out.flush().then([this, alert = std::move(alert)] () mutable {
+                return _sock->send_tls_record(alert_content_type, std::move(alert));
+            });
+        }
         auto res = gnutls_bye(*this, GNUTLS_SHUT_WR);
         if (res < 0) {
             switch (res) {
@@ -1512,6 +2055,9 @@ class session : public enable_lw_shared_from_this<session> {
     bool _eof = false;
     bool _shutdown = false;
     bool _connected = false;
+    // outgoing records are encrypted by the kernel
+    bool _ktls_tx = false;
+    bool _session_remembered = false;
     std::exception_ptr _error;
 
     future<> _output_pending;
@@ -1586,9 +2132,18 @@ class tls_connected_socket_impl : public net::connected_socket_impl, public sess
     int get_sockopt(int level, int optname, void* data, size_t len) const override {
         return _session->socket().get_sockopt(level, optname, data, len);
     }
+    net::tcp_connection_stats get_tcp_stats() const override {
+        return _session->socket().get_tcp_stats();
+    }
     socket_address local_address() const noexcept override {
         return _session->socket().local_address();
     }
+    future<bool> is_resumed() {
+        return _session->is_resumed();
+    }
+    future<std::optional<sstring>> get_alpn_protocol() {
+        return _session->get_alpn_protocol();
+    }
 
 };
 
@@ -1725,4 +2280,20 @@ server_socket tls::listen(shared_ptr<server_credentials> creds, server_socket ss
     return server_socket(std::move(ssls));
 }
 
+future<bool> tls::check_session_is_resumed(connected_socket& socket) {
+    auto impl = dynamic_cast<tls_connected_socket_impl*>(net::get_impl::maybe_get_ptr(socket));
+    if (!impl) {
+        return make_exception_future<bool>(std::invalid_argument("Not a TLS socket"));
+    }
+    return impl->is_resumed();
+}
+
+future<std::optional<sstring>> tls::get_alpn_protocol(connected_socket& socket) {
+    auto impl = dynamic_cast<tls_connected_socket_impl*>(net::get_impl::maybe_get_ptr(socket));
+    if (!impl) {
+        return make_exception_future<std::optional<sstring>>(std::invalid_argument("Not a TLS socket"));
+    }
+    return impl->get_alpn_protocol();
+}
+
 }
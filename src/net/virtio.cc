@@ -29,6 +29,8 @@
 #include <seastar/core/circular_buffer.hh>
 #include <seastar/core/align.hh>
 #include <seastar/core/metrics.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/print.hh>
 #include <seastar/util/function_input_iterator.hh>
 #include <seastar/util/transform_iterator.hh>
 #include <atomic>
@@ -37,6 +39,8 @@
 #include <fcntl.h>
 #include <linux/vhost.h>
 #include <linux/if_tun.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <seastar/net/ip.hh>
 #include <seastar/net/const.hh>
 #include <seastar/net/native-stack.hh>
@@ -204,6 +208,8 @@ struct buffer {
 //
 //     void (buffer_chain&, size_t len);
 //
+// with a done() member called after each batch of completions.
+//
 template <typename BufferChain, typename Completion>
 class vring {
 private:
@@ -461,6 +467,7 @@ bool vring<BufferChain, Completion>::do_complete() {
         }
         _free_last = id;
     }
+    _complete.done();
     return count;
 }
 
@@ -504,6 +511,7 @@ class qp : public net::qp {
                 q._ring.available_descriptors().signal(p.nr_frags());
             }
             void bunch(uint64_t c) {}
+            void done() {}
         };
         qp& _dev;
         vring<packet_as_buffer_chain, complete> _ring;
@@ -534,6 +542,9 @@ class qp : public net::qp {
             void bunch(uint64_t c) {
                 q.update_rx_count(c);
             }
+            void done() {
+                q._dev._dev->l2flush();
+            }
         };
         qp& _dev;
         vring<single_buffer, complete> _ring;
@@ -567,6 +578,15 @@ class qp : public net::qp {
 protected:
     device* _dev;
     size_t _header_len;
+    // The memory the host can access, when it can't access all of ours
+    const char* _shared_begin = nullptr;
+    const char* _shared_end = nullptr;
+    bool in_shared_memory(const packet& p) const noexcept {
+        return !_shared_begin || std::all_of(p.fragments().begin(), p.fragments().end(), [this] (const fragment& f) {
+            return f.base >= _shared_begin && f.base + f.size <= _shared_end;
+        });
+    }
+    static packet copy_packet(packet p);
     std::unique_ptr<char[], free_deleter> _txq_storage;
     std::unique_ptr<char[], free_deleter> _rxq_storage;
     txq _txq;
@@ -586,6 +606,17 @@ class qp : public net::qp {
     friend class rxq;
 };
 
+packet qp::copy_packet(packet p) {
+    temporary_buffer<char> buf(p.len());
+    auto to = buf.get_write();
+    for (auto& f : p.fragments()) {
+        to = std::copy_n(f.base, f.size, to);
+    }
+    packet copy(std::move(buf));
+    copy.set_offload_info(p.offload_info());
+    return copy;
+}
+
 qp::txq::txq(qp& dev, ring_config config)
     : _dev(dev), _ring(config, complete{*this}) {
 }
@@ -641,6 +672,9 @@ qp::txq::post(circular_buffer<packet>& pb) {
                 }
             }
         }
+        if (!_dev.in_shared_memory(p)) {
+            p = copy_packet(std::move(p));
+        }
         // prepend virtio-net header
         packet q = packet(fragment{reinterpret_cast<char*>(&vhdr), _dev._header_len},
                 std::move(p));
@@ -898,6 +932,161 @@ qp_vhost::qp_vhost(device *dev, const native_stack_options& opts)
     _vhost_fd.ioctl(VHOST_NET_SET_BACKEND, vhost_vring_file{1, tap_fd.get()});
 }
 
+namespace vhost_user {
+
+// The messages of the vhost-user protocol, which follow the vhost ioctls
+enum request : uint32_t {
+    get_features = 1,
+    set_features = 2,
+    set_owner = 3,
+    set_mem_table = 5,
+    set_vring_num = 8,
+    set_vring_addr = 9,
+    set_vring_base = 10,
+    set_vring_kick = 12,
+    set_vring_call = 13,
+};
+
+struct header {
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t reply = 1 << 2;
+    uint32_t request;
+    uint32_t flags;
+    uint32_t size;
+};
+
+struct memory_region {
+    uint64_t guest_phys_addr;
+    uint64_t memory_size;
+    uint64_t userspace_addr;
+    uint64_t mmap_offset;
+};
+
+struct memory {
+    uint32_t nregions;
+    uint32_t padding;
+    memory_region regions[1];
+};
+
+// Protocol features, which we don't use, make the rings start disabled
+constexpr uint64_t protocol_features = uint64_t(1) << 30;
+
+}
+
+// The rings are served by a userspace switch connected through a unix
+// socket, which maps the memory of the shard and accesses packets in
+// place. Only that memory can be shared, so packets that have fragments
+// elsewhere are copied.
+class qp_vhost_user : public qp {
+private:
+    file_desc _socket;
+public:
+    qp_vhost_user(device* dev, const native_stack_options& opts);
+private:
+    void send_message(vhost_user::request req, const void* payload, size_t size, int fd = -1);
+    uint64_t receive_u64(vhost_user::request req);
+};
+
+void qp_vhost_user::send_message(vhost_user::request req, const void* payload, size_t size, int fd) {
+    vhost_user::header hdr{req, vhost_user::header::version, uint32_t(size)};
+    iovec iov[2] = {{&hdr, sizeof(hdr)}, {const_cast<void*>(payload), size}};
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = size ? 2 : 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    auto r = _socket.sendmsg(&msg, 0);
+    if (!r || *r != sizeof(hdr) + size) {
+        throw std::runtime_error(format("vhost-user: short write of request {}", unsigned(req)));
+    }
+}
+
+uint64_t qp_vhost_user::receive_u64(vhost_user::request req) {
+    send_message(req, nullptr, 0);
+    struct {
+        vhost_user::header hdr;
+        uint64_t value;
+    } __attribute__((packed)) reply;
+    auto r = _socket.read(&reply, sizeof(reply));
+    if (!r || *r != sizeof(reply) || reply.hdr.request != req
+            || !(reply.hdr.flags & vhost_user::header::reply) || reply.hdr.size != sizeof(uint64_t)) {
+        throw std::runtime_error(format("vhost-user: bad reply to request {}", unsigned(req)));
+    }
+    return reply.value;
+}
+
+qp_vhost_user::qp_vhost_user(device *dev, const native_stack_options& opts)
+    : qp(dev, config_ring_size(opts.virtio_opts), config_ring_size(opts.virtio_opts))
+    , _socket(file_desc::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC))
+{
+    auto mem = memory::shard_memory_file();
+    if (!mem) {
+        throw std::runtime_error("vhost-user requires the memory to be backed by hugetlbfs, see --hugepages");
+    }
+    _shared_begin = mem->base;
+    _shared_end = mem->base + mem->size;
+
+    auto path = opts.virtio_opts.vhost_user_socket.get_value();
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error(format("vhost-user socket path too long: {}", path));
+    }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    _socket.connect(reinterpret_cast<sockaddr&>(addr), sizeof(addr));
+
+    send_message(vhost_user::set_owner, nullptr, 0);
+    uint64_t features = receive_u64(vhost_user::get_features);
+    features &= _dev->features() & ~vhost_user::protocol_features;
+    send_message(vhost_user::set_features, &features, sizeof(features));
+    if (features & VIRTIO_NET_F_MRG_RXBUF) {
+        _header_len = sizeof(net_hdr_mrg);
+    } else {
+        _header_len = sizeof(net_hdr);
+    }
+    bool event_index = features & VIRTIO_RING_F_EVENT_IDX;
+    if (event_index != _txq.getconfig().event_index) {
+        throw std::runtime_error("vhost-user switch doesn't support the event index, use --event-index=off");
+    }
+
+    // Addresses in the rings are our virtual addresses, so the switch
+    // maps the memory at the same "guest physical" ones
+    vhost_user::memory mem_table = {};
+    mem_table.nregions = 1;
+    mem_table.regions[0] = {uintptr_t(mem->base), mem->size, uintptr_t(mem->base), 0};
+    send_message(vhost_user::set_mem_table, &mem_table, sizeof(mem_table), mem->fd);
+
+    readable_eventfd _txq_notify;
+    writeable_eventfd _txq_kick;
+    readable_eventfd _rxq_notify;
+    writeable_eventfd _rxq_kick;
+    auto tov = [](char* x) { return reinterpret_cast<uintptr_t>(x); };
+    auto setup_ring = [&] (unsigned index, const ring_config& config, int kick, int call) {
+        vhost_vring_state num = { index, config.size };
+        send_message(vhost_user::set_vring_num, &num, sizeof(num));
+        vhost_vring_state base = { index, 0 };
+        send_message(vhost_user::set_vring_base, &base, sizeof(base));
+        vhost_vring_addr addr = { index, 0, tov(config.descs), tov(config.used), tov(config.avail), 0 };
+        send_message(vhost_user::set_vring_addr, &addr, sizeof(addr));
+        uint64_t idx = index;
+        send_message(vhost_user::set_vring_call, &idx, sizeof(idx), call);
+        // Without protocol features, the kick enables the ring
+        send_message(vhost_user::set_vring_kick, &idx, sizeof(idx), kick);
+    };
+    setup_ring(0, _rxq.getconfig(), _rxq_kick.get_read_fd(), _rxq_notify.get_write_fd());
+    setup_ring(1, _txq.getconfig(), _txq_kick.get_read_fd(), _txq_notify.get_write_fd());
+    _rxq.set_notifier(std::make_unique<notifier_vhost>(std::move(_rxq_kick)));
+    _txq.set_notifier(std::make_unique<notifier_vhost>(std::move(_txq_kick)));
+}
+
 #ifdef HAVE_OSV
 class qp_osv : public qp {
 private:
@@ -988,6 +1177,9 @@ std::unique_ptr<net::qp> device::init_local_queue(const program_options::option_
 #endif
     auto net_opts = dynamic_cast<const net::native_stack_options*>(&opts);
     assert(net_opts);
+    if (net_opts->virtio_opts.vhost_user_socket) {
+        return std::make_unique<qp_vhost_user>(this, *net_opts);
+    }
     return std::make_unique<qp_vhost>(this, *net_opts);
 }
 
@@ -1010,6 +1202,9 @@ net::virtio_options::virtio_options(program_options::option_group* parent_group)
     , virtio_ring_size(*this, "virtio-ring-size",
                 256,
                 "Virtio ring size (must be power-of-two)")
+    , vhost_user_socket(*this, "vhost-user-socket",
+                {},
+                "Connect to a vhost-user switch through this unix socket, instead of using vhost-net and a tap device (requires --hugepages)")
 {
 }
 
@@ -0,0 +1,528 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/net/xdp.hh>
+#include <seastar/net/native-stack.hh>
+#include <seastar/core/posix.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/internal/poll.hh>
+#include <seastar/core/print.hh>
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <vector>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// Not exported to userspace
+#ifndef ETH_RSS_HASH_TOP
+#define ETH_RSS_HASH_TOP (1 << 0)
+#endif
+
+namespace seastar {
+
+namespace xdp {
+
+using namespace net;
+
+// UMEM frames hold a packet each; received packets are preceded by the
+// kernel's XDP headroom
+static constexpr size_t frame_size = 4096;
+static constexpr size_t rx_headroom = XDP_PACKET_HEADROOM;
+static constexpr unsigned rx_batch = 64;
+
+static int sys_bpf(int cmd, bpf_attr& attr) {
+    return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+static file_desc bpf_fd(int cmd, bpf_attr& attr, const char* what) {
+    int fd = sys_bpf(cmd, attr);
+    throw_system_error_on(fd == -1, what);
+    return file_desc::from_fd(fd);
+}
+
+static bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    bpf_insn i = {};
+    i.code = code;
+    i.dst_reg = dst;
+    i.src_reg = src;
+    i.off = off;
+    i.imm = imm;
+    return i;
+}
+
+// The XDP program: redirects the packets of each receive queue to the
+// AF_XDP socket bound to it, if there is one, and passes the others to
+// the kernel. With an address given, only IPv4 packets to it and ARP
+// packets whose target is it are redirected.
+static std::vector<bpf_insn> xdp_program(int xsks_map_fd, ipv4_address addr) {
+    std::vector<bpf_insn> p;
+    // r6 = ctx
+    p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+    std::vector<size_t> jumps_to_pass;
+    if (addr.ip) {
+        // r2 = data, r3 = data_end; pass if shorter than ethernet + ARP
+        p.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(xdp_md, data), 0));
+        p.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof(xdp_md, data_end), 0));
+        p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+        p.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 42));
+        jumps_to_pass.push_back(p.size());
+        p.push_back(insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0));
+        // r5 = ethertype, as loaded from network order on a little-endian host
+        p.push_back(insn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 12, 0));
+        p.push_back(insn(BPF_JMP32 | BPF_JEQ | BPF_K, BPF_REG_5, 0, 3, htons(uint16_t(eth_protocol_num::ipv4))));
+        jumps_to_pass.push_back(p.size());
+        p.push_back(insn(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, htons(uint16_t(eth_protocol_num::arp))));
+        // ARP target protocol address
+        p.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, 14 + 24, 0));
+        p.push_back(insn(BPF_JMP | BPF_JA, 0, 0, 1, 0));
+        // IPv4 destination address
+        p.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, 14 + 16, 0));
+        jumps_to_pass.push_back(p.size());
+        p.push_back(insn(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, int32_t(htonl(addr.ip))));
+    }
+    // return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS)
+    p.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, rx_queue_index), 0));
+    p.push_back(insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, xsks_map_fd));
+    p.push_back(insn(0, 0, 0, 0, 0));
+    p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS));
+    p.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+    p.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    auto pass = p.size();
+    p.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS));
+    p.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    for (auto j : jumps_to_pass) {
+        p[j].off = pass - j - 1;
+    }
+    return p;
+}
+
+class device : public net::device {
+    std::string _ifname;
+    unsigned _ifindex;
+    ethernet_address _hw_address;
+    net::hw_features _hw_features;
+    uint16_t _queues;
+    std::vector<uint8_t> _rss_key;
+    std::vector<uint32_t> _indir;
+    std::optional<file_desc> _xsks_map;
+    std::optional<file_desc> _prog;
+    std::optional<file_desc> _link;
+    unsigned _ring_size;
+    bool _zero_copy;
+private:
+    void ethtool(file_desc& sock, void* data) {
+        ifreq ifr = {};
+        _ifname.copy(ifr.ifr_name, IFNAMSIZ - 1);
+        ifr.ifr_data = reinterpret_cast<char*>(data);
+        sock.ioctl(SIOCETHTOOL, ifr);
+    }
+    void setup_rss(file_desc& sock, uint32_t channels);
+public:
+    device(const xdp_options& opts, ipv4_address host_address);
+    virtual ethernet_address hw_address() override {
+        return _hw_address;
+    }
+    virtual net::hw_features hw_features() override {
+        return _hw_features;
+    }
+    virtual uint16_t hw_queues_count() override {
+        return _queues;
+    }
+    virtual rss_key_type rss_key() const override {
+        if (_rss_key.empty()) {
+            return default_rsskey_40bytes;
+        }
+        return rss_key_type(_rss_key.data(), _rss_key.size());
+    }
+    virtual unsigned hash2qid(uint32_t hash) override {
+        if (_indir.empty()) {
+            return hash % _queues;
+        }
+        return _indir[hash % _indir.size()];
+    }
+    virtual std::unique_ptr<net::qp> init_local_queue(const program_options::option_group& opts, uint16_t qid) override;
+    friend class qp;
+};
+
+device::device(const xdp_options& opts, ipv4_address host_address)
+    : _ifname(opts.xdp_interface.get_value())
+    , _ifindex(if_nametoindex(_ifname.c_str()))
+    , _ring_size(opts.xdp_ring_size.get_value())
+    , _zero_copy(opts.xdp_zero_copy.get_value() != "off") {
+    throw_system_error_on(_ifindex == 0, "if_nametoindex");
+    if (_ring_size == 0 || (_ring_size & (_ring_size - 1))) {
+        throw std::invalid_argument("xdp-ring-size must be a power of two");
+    }
+
+    auto sock = file_desc::socket(AF_INET, SOCK_DGRAM);
+    ifreq ifr = {};
+    _ifname.copy(ifr.ifr_name, IFNAMSIZ - 1);
+    sock.ioctl(SIOCGIFHWADDR, ifr);
+    std::copy_n(reinterpret_cast<const uint8_t*>(ifr.ifr_hwaddr.sa_data), 6, _hw_address.mac.begin());
+    sock.ioctl(SIOCGIFMTU, ifr);
+    if (size_t(ifr.ifr_mtu) + eth_hdr_len > frame_size - rx_headroom) {
+        throw std::runtime_error(format("MTU of {} is too large for AF_XDP frames", _ifname));
+    }
+    _hw_features.mtu = ifr.ifr_mtu;
+
+    ethtool_channels ch = {};
+    ch.cmd = ETHTOOL_GCHANNELS;
+    uint32_t channels = 1;
+    try {
+        ethtool(sock, &ch);
+        channels = std::max(1u, ch.combined_count + ch.rx_count);
+    } catch (std::system_error&) {
+        // Single queue device
+    }
+    _queues = std::min<uint32_t>(channels, smp::count);
+    if (_queues > 1) {
+        setup_rss(sock, channels);
+    }
+
+    bpf_attr attr = {};
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = channels;
+    _xsks_map = bpf_fd(BPF_MAP_CREATE, attr, "bpf(BPF_MAP_CREATE)");
+
+    auto prog = xdp_program(_xsks_map->get(), host_address);
+    static const char license[] = "Apache-2.0";
+    attr = {};
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = reinterpret_cast<uintptr_t>(prog.data());
+    attr.insn_cnt = prog.size();
+    attr.license = reinterpret_cast<uintptr_t>(license);
+    _prog = bpf_fd(BPF_PROG_LOAD, attr, "bpf(BPF_PROG_LOAD)");
+
+    // The program is detached when the link is closed, at exit
+    attr = {};
+    attr.link_create.prog_fd = _prog->get();
+    attr.link_create.target_ifindex = _ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    _link = bpf_fd(BPF_LINK_CREATE, attr, "bpf(BPF_LINK_CREATE)");
+}
+
+// Spread the NIC's RSS over the queues bound to shards, and learn its
+// key and redirection table so that hash2cpu() agrees with the NIC
+void device::setup_rss(file_desc& sock, uint32_t channels) {
+    ethtool_rxfh sizes = {};
+    sizes.cmd = ETHTOOL_GRSSH;
+    try {
+        ethtool(sock, &sizes);
+    } catch (std::system_error&) {
+        print("AF_XDP: {} does not report its RSS configuration, connections may be steered to the wrong shard\n", _ifname);
+        return;
+    }
+
+    auto buf_size = sizeof(ethtool_rxfh) + sizes.indir_size * sizeof(uint32_t) + sizes.key_size;
+    std::vector<char> buf(buf_size);
+    auto rxfh = reinterpret_cast<ethtool_rxfh*>(buf.data());
+    if (channels > _queues && sizes.indir_size) {
+        rxfh->cmd = ETHTOOL_SRSSH;
+        rxfh->indir_size = sizes.indir_size;
+        for (uint32_t i = 0; i < sizes.indir_size; i++) {
+            rxfh->rss_config[i] = i % _queues;
+        }
+        ethtool(sock, rxfh);
+        std::fill(buf.begin(), buf.end(), 0);
+    }
+
+    rxfh->cmd = ETHTOOL_GRSSH;
+    rxfh->indir_size = sizes.indir_size;
+    rxfh->key_size = sizes.key_size;
+    ethtool(sock, rxfh);
+    if (rxfh->hfunc && !(rxfh->hfunc & ETH_RSS_HASH_TOP)) {
+        print("AF_XDP: {} does not use the Toeplitz RSS hash, connections may be steered to the wrong shard\n", _ifname);
+    }
+    _indir.assign(rxfh->rss_config, rxfh->rss_config + sizes.indir_size);
+    auto key = reinterpret_cast<const uint8_t*>(rxfh->rss_config + sizes.indir_size);
+    _rss_key.assign(key, key + sizes.key_size);
+}
+
+template <typename Desc>
+struct ring {
+    mmap_area _area;
+    uint32_t* _producer;
+    uint32_t* _consumer;
+    uint32_t* _flags;
+    Desc* _descs;
+    uint32_t _mask;
+
+    ring(file_desc& fd, const xdp_ring_offset& off, uint32_t size, size_t pgoff)
+        : _area(fd.map(off.desc + size * sizeof(Desc), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pgoff))
+        , _producer(reinterpret_cast<uint32_t*>(_area.get() + off.producer))
+        , _consumer(reinterpret_cast<uint32_t*>(_area.get() + off.consumer))
+        , _flags(reinterpret_cast<uint32_t*>(_area.get() + off.flags))
+        , _descs(reinterpret_cast<Desc*>(_area.get() + off.desc))
+        , _mask(size - 1) {
+    }
+    uint32_t producer() const noexcept {
+        return __atomic_load_n(_producer, __ATOMIC_ACQUIRE);
+    }
+    uint32_t consumer() const noexcept {
+        return __atomic_load_n(_consumer, __ATOMIC_ACQUIRE);
+    }
+    void set_producer(uint32_t v) noexcept {
+        __atomic_store_n(_producer, v, __ATOMIC_RELEASE);
+    }
+    void set_consumer(uint32_t v) noexcept {
+        __atomic_store_n(_consumer, v, __ATOMIC_RELEASE);
+    }
+    bool needs_wakeup() const noexcept {
+        return __atomic_load_n(_flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP;
+    }
+    Desc& operator[](uint32_t idx) noexcept {
+        return _descs[idx & _mask];
+    }
+    uint32_t size() const noexcept {
+        return _mask + 1;
+    }
+};
+
+class qp : public net::qp {
+    device& _dev;
+    uint16_t _qid;
+    file_desc _fd;
+    std::unique_ptr<char[], free_deleter> _umem;
+    // Frames not owned by the kernel or the stack; the first half of the
+    // UMEM is for receiving and the second for sending
+    std::vector<uint64_t> _rx_frames;
+    std::vector<uint64_t> _tx_frames;
+    std::optional<ring<uint64_t>> _fill;
+    std::optional<ring<uint64_t>> _completion;
+    std::optional<ring<xdp_desc>> _rx;
+    std::optional<ring<xdp_desc>> _tx;
+    std::optional<reactor::poller> _rx_poller;
+    reactor::poller _tx_gc_poller;
+private:
+    static std::unique_ptr<char[], free_deleter> alloc_umem(size_t size) {
+        void* ret;
+        auto r = posix_memalign(&ret, 4096, size);
+        if (r) {
+            throw std::bad_alloc();
+        }
+        return std::unique_ptr<char[], free_deleter>(reinterpret_cast<char*>(ret));
+    }
+    void bind(bool zero_copy);
+    bool poll_rx_once();
+    bool refill();
+    bool reclaim_tx();
+public:
+    qp(device& dev, uint16_t qid);
+    virtual future<> send(packet p) override {
+        abort();
+    }
+    virtual uint32_t send(circular_buffer<packet>& pb) override;
+    virtual void rx_start() override {
+        _rx_poller = reactor::poller::simple([this] { return poll_rx_once(); });
+    }
+};
+
+qp::qp(device& dev, uint16_t qid)
+    : net::qp(true, "network", qid)
+    , _dev(dev)
+    , _qid(qid)
+    , _fd(file_desc::socket(AF_XDP, SOCK_RAW))
+    , _umem(alloc_umem(4 * dev._ring_size * frame_size))
+    , _tx_gc_poller(reactor::poller::simple([this] { return reclaim_tx(); })) {
+    auto nr_frames = 4 * _dev._ring_size;
+    _rx_frames.reserve(nr_frames / 2);
+    _tx_frames.reserve(nr_frames / 2);
+    for (uint64_t i = 0; i < nr_frames / 2; i++) {
+        _rx_frames.push_back(i * frame_size);
+        _tx_frames.push_back((nr_frames / 2 + i) * frame_size);
+    }
+
+    xdp_umem_reg reg = {};
+    reg.addr = reinterpret_cast<uintptr_t>(_umem.get());
+    reg.len = nr_frames * frame_size;
+    reg.chunk_size = frame_size;
+    _fd.setsockopt(SOL_XDP, XDP_UMEM_REG, reg);
+    int size = _dev._ring_size;
+    _fd.setsockopt(SOL_XDP, XDP_UMEM_FILL_RING, size);
+    _fd.setsockopt(SOL_XDP, XDP_UMEM_COMPLETION_RING, size);
+    _fd.setsockopt(SOL_XDP, XDP_RX_RING, size);
+    _fd.setsockopt(SOL_XDP, XDP_TX_RING, size);
+    auto off = _fd.getsockopt<xdp_mmap_offsets>(SOL_XDP, XDP_MMAP_OFFSETS);
+    _fill.emplace(_fd, off.fr, size, XDP_UMEM_PGOFF_FILL_RING);
+    _completion.emplace(_fd, off.cr, size, XDP_UMEM_PGOFF_COMPLETION_RING);
+    _rx.emplace(_fd, off.rx, size, XDP_PGOFF_RX_RING);
+    _tx.emplace(_fd, off.tx, size, XDP_PGOFF_TX_RING);
+    refill();
+
+    try {
+        bind(_dev._zero_copy);
+    } catch (std::system_error&) {
+        if (!_dev._zero_copy) {
+            throw;
+        }
+        // The driver does not support zero-copy mode
+        bind(false);
+    }
+
+    bpf_attr attr = {};
+    uint32_t key = qid;
+    uint32_t value = _fd.get();
+    attr.map_fd = _dev._xsks_map->get();
+    attr.key = reinterpret_cast<uintptr_t>(&key);
+    attr.value = reinterpret_cast<uintptr_t>(&value);
+    throw_system_error_on(sys_bpf(BPF_MAP_UPDATE_ELEM, attr) == -1, "bpf(BPF_MAP_UPDATE_ELEM)");
+}
+
+void qp::bind(bool zero_copy) {
+    sockaddr_xdp sxdp = {};
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = _dev._ifindex;
+    sxdp.sxdp_queue_id = _qid;
+    sxdp.sxdp_flags = (zero_copy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
+    _fd.bind(reinterpret_cast<sockaddr&>(sxdp), sizeof(sxdp));
+}
+
+// Gives the free receive frames to the kernel
+bool qp::refill() {
+    auto prod = *_fill->_producer;
+    auto n = std::min<size_t>(_fill->size() - (prod - _fill->consumer()), _rx_frames.size());
+    for (size_t i = 0; i < n; i++) {
+        (*_fill)[prod++] = _rx_frames.back();
+        _rx_frames.pop_back();
+    }
+    if (n) {
+        _fill->set_producer(prod);
+    }
+    if (_fill->needs_wakeup()) {
+        ::recvfrom(_fd.get(), nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    }
+    return n;
+}
+
+bool qp::poll_rx_once() {
+    auto cons = *_rx->_consumer;
+    auto n = std::min(_rx->producer() - cons, rx_batch);
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        auto& desc = (*_rx)[cons++];
+        // The frames are aligned, the packet is somewhere within its frame
+        auto frame = desc.addr & ~uint64_t(frame_size - 1);
+        bytes += desc.len;
+        _dev.l2receive(packet(fragment{_umem.get() + desc.addr, desc.len}, make_deleter([this, frame] {
+            _rx_frames.push_back(frame);
+        })));
+    }
+    if (n) {
+        _rx->set_consumer(cons);
+        _stats.rx.good.update_pkts_bunch(n);
+        _stats.rx.good.update_frags_stats(n, bytes);
+        _dev.l2flush();
+    }
+    return refill() || n;
+}
+
+bool qp::reclaim_tx() {
+    auto cons = *_completion->_consumer;
+    auto n = _completion->producer() - cons;
+    for (uint32_t i = 0; i < n; i++) {
+        _tx_frames.push_back((*_completion)[cons++]);
+    }
+    if (n) {
+        _completion->set_consumer(cons);
+    }
+    return n;
+}
+
+// Packets are copied into UMEM frames: the stack's buffers are not in the UMEM
+uint32_t qp::send(circular_buffer<packet>& pb) {
+    reclaim_tx();
+    auto prod = *_tx->_producer;
+    auto room = _tx->size() - (prod - _tx->consumer());
+    uint32_t sent = 0;
+    uint64_t nr_frags = 0, bytes = 0;
+    while (!pb.empty() && sent < room && !_tx_frames.empty()) {
+        auto p = std::move(pb.front());
+        pb.pop_front();
+        sent++;
+        if (p.len() > frame_size) {
+            continue;
+        }
+        auto frame = _tx_frames.back();
+        _tx_frames.pop_back();
+        auto dst = _umem.get() + frame;
+        for (auto& f : p.fragments()) {
+            dst = std::copy_n(f.base, f.size, dst);
+        }
+        auto& desc = (*_tx)[prod++];
+        desc.addr = frame;
+        desc.len = p.len();
+        desc.options = 0;
+        nr_frags += p.nr_frags();
+        bytes += p.len();
+    }
+    if (sent) {
+        _tx->set_producer(prod);
+        _stats.tx.good.update_frags_stats(nr_frags, bytes);
+        _stats.tx.good.update_copy_stats(nr_frags, bytes);
+        if (_tx->needs_wakeup()) {
+            ::sendto(_fd.get(), nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+        }
+    }
+    return sent;
+}
+
+std::unique_ptr<net::qp> device::init_local_queue(const program_options::option_group& opts, uint16_t qid) {
+    return std::make_unique<qp>(*this, qid);
+}
+
+}
+
+net::xdp_options::xdp_options(program_options::option_group* parent_group)
+    : program_options::option_group(parent_group, "AF_XDP net options")
+    , xdp_interface(*this, "xdp-interface",
+                {},
+                "Network interface to use with AF_XDP sockets instead of a tap device")
+    , xdp_ring_size(*this, "xdp-ring-size",
+                2048,
+                "Number of descriptors of each AF_XDP ring (must be power-of-two)")
+    , xdp_zero_copy(*this, "xdp-zero-copy",
+                "on",
+                "Use zero-copy mode if the driver supports it (on / off)")
+{
+}
+
+std::unique_ptr<net::device> create_xdp_net_device(const net::xdp_options& opts, net::ipv4_address host_address) {
+    return std::make_unique<xdp::device>(opts, host_address);
+}
+
+}
@@ -1,8 +1,12 @@
 #include <seastar/rpc/rpc.hh>
 #include <seastar/core/align.hh>
+#include <seastar/core/exception_hacks.hh>
 #include <seastar/core/seastar.hh>
 #include <seastar/core/print.hh>
 #include <seastar/core/future-util.hh>
+#include <seastar/core/with_trace_context.hh>
+#include <seastar/core/metrics.hh>
+#include <random>
 #include <boost/range/adaptor/map.hpp>
 
 namespace seastar {
@@ -54,6 +58,34 @@ namespace rpc {
   snd_buf::snd_buf(snd_buf&&) noexcept = default;
   snd_buf& snd_buf::operator=(snd_buf&&) noexcept = default;
 
+  zero_copy_buffer::zero_copy_buffer(sstring s) {
+      auto p = s.data();
+      auto size = s.size();
+      fragments.emplace_back(p, size, make_object_deleter(std::move(s)));
+  }
+
+  size_t zero_copy_buffer::size() const noexcept {
+      return boost::accumulate(fragments | boost::adaptors::transformed(std::mem_fn(&temporary_buffer<char>::size)), size_t(0));
+  }
+
+  std::vector<temporary_buffer<char>> zero_copy_buffer::share() const {
+      std::vector<temporary_buffer<char>> ret;
+      ret.reserve(fragments.size());
+      for (auto& f : fragments) {
+          ret.push_back(const_cast<temporary_buffer<char>&>(f).share());
+      }
+      return ret;
+  }
+
+  sstring zero_copy_buffer::linearize() const {
+      auto ret = uninitialized_string(size());
+      auto p = ret.data();
+      for (auto& f : fragments) {
+          p = std::copy(f.begin(), f.end(), p);
+      }
+      return ret;
+  }
+
   temporary_buffer<char>& snd_buf::front() {
       auto* one = std::get_if<temporary_buffer<char>>(&bufs);
       if (one) {
@@ -93,22 +125,62 @@ namespace rpc {
   template rcv_buf make_shard_local_buffer_copy(foreign_ptr<std::unique_ptr<rcv_buf>>);
 
   static void log_exception(connection& c, log_level level, const char* log, std::exception_ptr eptr) {
-      const char* s;
-      try {
-          std::rethrow_exception(eptr);
-      } catch (std::exception& ex) {
-          s = ex.what();
-      } catch (...) {
-          s = "unknown exception";
+      const char* s = "unknown exception";
+      if (auto ex = try_catch<const std::exception>(eptr)) {
+          s = ex->what();
       }
       auto formatted = format("{}: {}", log, s);
       c.get_logger()(c.peer_address(), level, std::string_view(formatted.data(), formatted.size()));
   }
 
+  // Set in the compression header of frames sent uncompressed on a
+  // compressing connection, see adaptive_compression_options
+  static constexpr uint32_t uncompressed_frame_flag = uint32_t(1) << 31;
+
+  bool connection::skip_compression(size_t size) {
+      if (!_adaptive_compression) {
+          return false;
+      }
+      if (size < _adaptive_compression->min_frame_size) {
+          return true;
+      }
+      if (_compression_ratio > _adaptive_compression->max_compression_ratio) {
+          if (++_frames_since_probe < _adaptive_compression->probe_interval) {
+              return true;
+          }
+          _frames_since_probe = 0;
+      }
+      return false;
+  }
+
   snd_buf connection::compress(snd_buf buf) {
       if (_compressor) {
-          buf = _compressor->compress(4, std::move(buf));
           static_assert(snd_buf::chunk_size >= 4, "send buffer chunk size is too small");
+          auto size = buf.size;
+          if (skip_compression(size)) {
+              _stats.uncompressed_frames++;
+              std::vector<temporary_buffer<char>> bufs;
+              bufs.emplace_back(4);
+              write_le<uint32_t>(bufs.back().get_write(), uncompressed_frame_flag | size);
+              if (auto* one = std::get_if<temporary_buffer<char>>(&buf.bufs)) {
+                  bufs.push_back(std::move(*one));
+              } else {
+                  auto& frags = std::get<std::vector<temporary_buffer<char>>>(buf.bufs);
+                  std::move(frags.begin(), frags.end(), std::back_inserter(bufs));
+              }
+              return snd_buf(std::move(bufs), size + 4);
+          }
+          auto start = std::chrono::steady_clock::now();
+          buf = _compressor->compress(4, std::move(buf));
+          _stats.compression_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+          _stats.compressed_frames++;
+          _stats.compression_input_bytes += size;
+          _stats.compression_output_bytes += buf.size - 4;
+          if (size) {
+              // Exponentially weighted, so that it follows changes in the data
+              auto ratio = double(buf.size - 4) / size;
+              _compression_ratio = _compression_ratio ? (_compression_ratio * 7 + ratio) / 8 : ratio;
+          }
           write_le<uint32_t>(buf.front().get_write(), buf.size - 4);
           return buf;
       }
@@ -120,18 +192,55 @@ namespace rpc {
       if (b) {
           return _write_buf.write(std::move(*b));
       } else {
-          return do_with(std::move(std::get<std::vector<temporary_buffer<char>>>(buf.bufs)),
-                  [this] (std::vector<temporary_buffer<char>>& ar) {
-              return do_for_each(ar.begin(), ar.end(), [this] (auto& b) {
-                  return _write_buf.write(std::move(b));
-              });
-          });
+          // The fragments, which may reference the caller's memory, are
+          // released by their deleters once the packet is sent
+          net::packet p;
+          for (auto& b : std::get<std::vector<temporary_buffer<char>>>(buf.bufs)) {
+              if (b.size()) {
+                  p = net::packet(std::move(p), std::move(b));
+              }
+          }
+          return _write_buf.write(std::move(p));
       }
   }
 
+  // Messages are written as they come, and flushed once the queue stays
+  // empty until the deadline or enough of them are pending. Frames keep
+  // their own headers, so the receiver parses a coalesced write exactly
+  // like separate ones, from the same input buffer.
+  future<> connection::flush_sent(size_t size) {
+      if (!_coalescing) {
+          return _write_buf.flush();
+      }
+      if (!_unflushed_bytes) {
+          _flush_deadline = timer<>::clock::now() + _coalescing->max_delay;
+      }
+      _unflushed_bytes += size;
+      auto flush = [this] {
+          _unflushed_bytes = 0;
+          _stats.flushes++;
+          return _write_buf.flush();
+      };
+      if (_unflushed_bytes >= _coalescing->max_bytes) {
+          return flush();
+      }
+      return _outgoing_queue_cond.wait(_flush_deadline, [this] { return !_outgoing_queue.empty(); }).then_wrapped([flush] (future<> f) {
+          try {
+              f.get();
+              return make_ready_future<>();
+          } catch (condition_variable_timed_out&) {
+              return flush();
+          }
+      });
+  }
+
   template<connection::outgoing_queue_type QueueType>
   void connection::send_loop() {
       _send_loop_stopped = do_until([this] { return _error; }, [this] {
+          if (_unflushed_bytes && _outgoing_queue.empty()) {
+              // the entry that was waited for expired before it was sent
+              return flush_sent(0);
+          }
           return _outgoing_queue_cond.wait([this] { return !_outgoing_queue.empty(); }).then([this] {
               // despite using wait with predicated above _outgoing_queue can still be empty here if
               // there is only one entry on the list and its expire timer runs after wait() returned ready future,
@@ -146,23 +255,35 @@ namespace rpc {
                   d.pcancel->cancel_send = std::function<void()>(); // request is no longer cancellable
               }
               if (QueueType == outgoing_queue_type::request) {
-                  static_assert(snd_buf::chunk_size >= 8, "send buffer chunk size is too small");
+                  static_assert(snd_buf::chunk_size >= request_trace_size + 8, "send buffer chunk size is too small");
+                  // The request starts with the trace context and the timeout,
+                  // the ones that were not negotiated are dropped
+                  auto p = d.buf.front().get_write();
+                  size_t skip = 0;
                   if (_timeout_negotiated) {
                       auto expire = d.t.get_timeout();
                       uint64_t left = 0;
                       if (expire != typename timer<rpc_clock_type>::time_point()) {
                           left = std::chrono::duration_cast<std::chrono::milliseconds>(expire - timer<rpc_clock_type>::clock::now()).count();
                       }
-                      write_le<uint64_t>(d.buf.front().get_write(), left);
+                      write_le<uint64_t>(p + request_trace_size, left);
                   } else {
-                      d.buf.front().trim_front(8);
-                      d.buf.size -= 8;
+                      if (_trace_negotiated) {
+                          std::memmove(p + 8, p, request_trace_size);
+                      }
+                      skip += 8;
                   }
+                  if (!_trace_negotiated) {
+                      skip += request_trace_size;
+                  }
+                  d.buf.front().trim_front(skip);
+                  d.buf.size -= skip;
               }
               d.buf = compress(std::move(d.buf));
-              auto f = send_buffer(std::move(d.buf)).then([this] {
+              auto size = d.buf.size;
+              auto f = send_buffer(std::move(d.buf)).then([this, size] {
                   _stats.sent_messages++;
-                  return _write_buf.flush();
+                  return flush_sent(size);
               });
               return f.finally([d = std::move(d)] {});
           });
@@ -394,12 +515,21 @@ namespace rpc {
               }
               auto ptr = compress_header.get();
               auto size = read_le<uint32_t>(ptr);
-              return read_rcv_buf(in, size).then([this, size, &compressor, info] (rcv_buf compressed_data) {
+              bool uncompressed = _adaptive_compression_negotiated && (size & uncompressed_frame_flag);
+              size &= uncompressed ? ~uncompressed_frame_flag : ~uint32_t(0);
+              return read_rcv_buf(in, size).then([this, size, uncompressed, &compressor, info] (rcv_buf compressed_data) {
                   if (compressed_data.size != size) {
                       _logger(info, format("unexpected eof on a {} while reading compressed data: expected {:d} got {:d}", FrameType::role(), size, compressed_data.size));
                       return FrameType::empty_value();
                   }
-                  auto eb = compressor->decompress(std::move(compressed_data));
+                  rcv_buf eb;
+                  if (uncompressed) {
+                      eb = std::move(compressed_data);
+                  } else {
+                      auto start = std::chrono::steady_clock::now();
+                      eb = compressor->decompress(std::move(compressed_data));
+                      _stats.decompression_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                  }
                   net::packet p;
                   auto* one = std::get_if<temporary_buffer<char>>(&eb.bufs);
                   if (one) {
@@ -422,11 +552,12 @@ namespace rpc {
   }
 
   struct stream_frame {
-      using opt_buf_type = std::optional<rcv_buf>;
+      using opt_buf_type = std::optional<connection::stream_frame_buf>;
       using return_type = future<opt_buf_type>;
       struct header_type {
           uint32_t size;
           bool eos;
+          bool batch;
       };
       static size_t header_size() {
           return 4;
@@ -438,10 +569,13 @@ namespace rpc {
           return make_ready_future<opt_buf_type>(std::nullopt);
       }
       static header_type decode_header(const char* ptr) {
-          header_type h{read_le<uint32_t>(ptr), false};
+          header_type h{read_le<uint32_t>(ptr), false, false};
           if (h.size == -1U) {
               h.size = 0;
               h.eos = true;
+          } else if (h.size & stream_batch_flag) {
+              h.size &= ~stream_batch_flag;
+              h.batch = true;
           }
           return h;
       }
@@ -452,11 +586,68 @@ namespace rpc {
           if (t.eos) {
               data.size = -1U;
           }
-          return make_ready_future<opt_buf_type>(std::move(data));
+          return make_ready_future<opt_buf_type>(connection::stream_frame_buf{std::move(data), t.batch});
       }
   };
 
-  future<std::optional<rcv_buf>>
+  // Splits a batched stream frame into its elements, which share the
+  // buffers the frame was read into
+  static std::vector<rcv_buf> split_stream_batch(rcv_buf batch) {
+      std::vector<temporary_buffer<char>> frags;
+      if (auto* one = std::get_if<temporary_buffer<char>>(&batch.bufs)) {
+          frags.push_back(std::move(*one));
+      } else {
+          frags = std::move(std::get<std::vector<temporary_buffer<char>>>(batch.bufs));
+      }
+      auto frag = frags.begin();
+      auto take = [&] (size_t n) {
+          std::vector<temporary_buffer<char>> ret;
+          while (n) {
+              if (frag == frags.end()) {
+                  throw std::runtime_error("truncated batched stream frame");
+              }
+              if (frag->empty()) {
+                  ++frag;
+                  continue;
+              }
+              auto now = std::min(n, frag->size());
+              ret.push_back(frag->share(0, now));
+              frag->trim_front(now);
+              n -= now;
+          }
+          return ret;
+      };
+      std::vector<rcv_buf> elements;
+      size_t left = batch.size;
+      while (left) {
+          if (left < 4) {
+              throw std::runtime_error("truncated element length in a batched stream frame");
+          }
+          char header[4];
+          auto p = header;
+          for (auto& b : take(4)) {
+              p = std::copy(b.begin(), b.end(), p);
+          }
+          auto size = read_le<uint32_t>(header);
+          left -= 4;
+          if (size > left) {
+              throw std::runtime_error("truncated element in a batched stream frame");
+          }
+          auto parts = take(size);
+          left -= size;
+          if (parts.size() == 1) {
+              elements.emplace_back(std::move(parts.front()));
+          } else {
+              elements.emplace_back(std::move(parts), size);
+          }
+      }
+      if (elements.empty()) {
+          throw std::runtime_error("empty batched stream frame");
+      }
+      return elements;
+  }
+
+  future<std::optional<connection::stream_frame_buf>>
   connection::read_stream_frame_compressed(input_stream<char>& in) {
       return read_frame_compressed<stream_frame>(peer_address(), _compressor, in);
   }
@@ -473,23 +664,57 @@ namespace rpc {
       return f.finally([this] () mutable { return stop(); });
   }
 
-  future<> connection::stream_process_incoming(rcv_buf&& buf) {
+  void connection::set_stream_window(size_t window, size_t max_batch_bytes) {
+      // Nothing was received yet
+      if (window > _stream_window) {
+          _stream_sem.signal(window - _stream_window);
+      } else {
+          _stream_sem.consume(_stream_window - window);
+      }
+      _stream_window = window;
+      _stream_batch_bytes = std::min(max_batch_bytes, size_t(std::numeric_limits<uint32_t>::max() >> 1));
+  }
+
+  static sstring serialize_stream_window(size_t window) {
+      sstring p = uninitialized_string(sizeof(uint32_t));
+      write_le<uint32_t>(p.data(), std::clamp<size_t>(window, 1, std::numeric_limits<uint32_t>::max()));
+      return p;
+  }
+
+  static size_t deserialize_stream_window(const sstring& s) {
+      if (s.size() != sizeof(uint32_t)) {
+          throw std::runtime_error("bad stream window size in negotiation frame");
+      }
+      return std::max<uint32_t>(read_le<uint32_t>(s.data()), 1);
+  }
+
+  future<> connection::stream_process_incoming(rcv_buf&& buf, bool batch) {
       // we do not want to dead lock on huge packets, so let them in
       // but only one at a time
-      auto size = std::min(size_t(buf.size), max_stream_buffers_memory);
-      return get_units(_stream_sem, size).then([this, buf = std::move(buf)] (semaphore_units<>&& su) mutable {
-          buf.su = std::move(su);
-          return _stream_queue.push_eventually(std::move(buf));
+      auto size = std::min(size_t(buf.size), _stream_window);
+      return get_units(_stream_sem, size).then([this, buf = std::move(buf), batch] (semaphore_units<>&& su) mutable {
+          if (!batch) {
+              buf.su = std::move(su);
+              return _stream_queue.push_eventually(std::move(buf));
+          }
+          auto elements = split_stream_batch(std::move(buf));
+          // The frame's memory is released with the last of its elements
+          elements.back().su = std::move(su);
+          return do_with(std::move(elements), [this] (std::vector<rcv_buf>& elements) {
+              return do_for_each(elements, [this] (rcv_buf& element) {
+                  return _stream_queue.push_eventually(std::move(element));
+              });
+          });
       });
   }
 
   future<> connection::handle_stream_frame() {
-      return read_stream_frame_compressed(_read_buf).then([this] (std::optional<rcv_buf> data) {
+      return read_stream_frame_compressed(_read_buf).then([this] (std::optional<stream_frame_buf> data) {
           if (!data) {
               _error = true;
               return make_ready_future<>();
           }
-          return stream_process_incoming(std::move(*data));
+          return stream_process_incoming(std::move(data->buf), data->batch);
       });
   }
 
@@ -540,10 +765,20 @@ namespace rpc {
           case protocol_features::TIMEOUT:
               _timeout_negotiated = true;
               break;
+          case protocol_features::TRACING:
+              _trace_negotiated = true;
+              break;
+          case protocol_features::ADAPTIVE_COMPRESSION:
+              _adaptive_compression_negotiated = true;
+              _adaptive_compression = _options.adaptive_compression;
+              break;
           case protocol_features::CONNECTION_ID: {
               _id = deserialize_connection_id(e.second);
               break;
           }
+          case protocol_features::STREAM_WINDOW:
+              set_stream_window(deserialize_stream_window(e.second), _options.stream.max_batch_bytes);
+              break;
           default:
               // nothing to do
               ;
@@ -603,10 +838,53 @@ namespace rpc {
       return res;
   }
 
+  timeout_wheel::timeout_wheel(noncopyable_function<void (entry&)> expire)
+      : _timer([this] { on_tick(); })
+      , _expire(std::move(expire))
+  {}
+
+  void timeout_wheel::add(entry& e, rpc_clock_type::time_point deadline) noexcept {
+      if (!_timer.armed()) {
+          _next_tick = tick_of(rpc_clock_type::now());
+      }
+      e.deadline = deadline;
+      // Expires at the end of the tick of the deadline, never before it
+      auto t = std::max(tick_of(deadline) + 1, _next_tick);
+      _slots[t % nr_slots].push_back(e);
+      auto at = rpc_clock_type::time_point(t * tick);
+      if (!_timer.armed() || at < _timer.get_timeout()) {
+          _timer.rearm(at);
+      }
+  }
+
+  void timeout_wheel::on_tick() {
+      auto now = rpc_clock_type::now();
+      auto now_tick = tick_of(now);
+      // Past a full turn every slot was visited, whatever the stall
+      for (size_t visited = 0; _next_tick <= now_tick && visited < nr_slots; ++_next_tick, ++visited) {
+          auto& slot = _slots[_next_tick % nr_slots];
+          for (auto it = slot.begin(); it != slot.end(); ) {
+              // Entries of later turns of the wheel share the slot
+              auto& e = *it++;
+              if (e.deadline <= now) {
+                  e.hook.unlink();
+                  _expire(e);
+              }
+          }
+      }
+      _next_tick = std::max(_next_tick, now_tick + 1);
+      for (size_t i = 0; i < nr_slots; ++i) {
+          if (!_slots[(_next_tick + i) % nr_slots].empty()) {
+              _timer.arm(rpc_clock_type::time_point((_next_tick + i) * tick));
+              break;
+          }
+      }
+  }
+
   void client::wait_for_reply(id_type id, std::unique_ptr<reply_handler_base>&& h, std::optional<rpc_clock_type::time_point> timeout, cancellable* cancel) {
+      h->id = id;
       if (timeout) {
-          h->t.set_callback(std::bind(std::mem_fn(&client::wait_timed_out), this, id));
-          h->t.arm(timeout.value());
+          _timeouts.add(*h, timeout.value());
       }
       if (cancel) {
           cancel->cancel_wait = [this, id] {
@@ -650,8 +928,11 @@ namespace rpc {
   }
 
   client::client(const logger& l, void* s, client_options ops, socket socket, const socket_address& addr, const socket_address& local)
-  : rpc::connection(l, s), _socket(std::move(socket)), _server_addr(addr), _local_addr(local), _options(ops) {
+  : rpc::connection(l, s), _socket(std::move(socket))
+  , _timeouts([this] (timeout_wheel::entry& e) { wait_timed_out(static_cast<reply_handler_base&>(e).id); })
+  , _server_addr(addr), _local_addr(local), _options(ops) {
        _socket.set_reuseaddr(ops.reuseaddr);
+       _coalescing = ops.coalescing;
       // Run client in the background.
       // Communicate result via _stopped.
       // The caller has to call client::stop() to synchronize.
@@ -667,11 +948,18 @@ namespace rpc {
           if (_options.compressor_factory) {
               features[protocol_features::COMPRESS] = _options.compressor_factory->supported();
           }
+          if (_options.compressor_factory && _options.adaptive_compression) {
+              features[protocol_features::ADAPTIVE_COMPRESSION] = "";
+          }
           if (_options.send_timeout_data) {
               features[protocol_features::TIMEOUT] = "";
           }
+          if (_options.send_trace_context) {
+              features[protocol_features::TRACING] = "";
+          }
           if (_options.stream_parent) {
               features[protocol_features::STREAM_PARENT] = serialize_connection_id(_options.stream_parent);
+              features[protocol_features::STREAM_WINDOW] = serialize_stream_window(_options.stream.window);
           }
           if (!_options.isolation_cookie.empty()) {
               features[protocol_features::ISOLATION] = _options.isolation_cookie;
@@ -779,6 +1067,17 @@ namespace rpc {
               _timeout_negotiated = true;
               ret[protocol_features::TIMEOUT] = "";
               break;
+          case protocol_features::TRACING:
+              _trace_negotiated = true;
+              ret[protocol_features::TRACING] = "";
+              break;
+          case protocol_features::ADAPTIVE_COMPRESSION:
+              // Uncompressed frames are always understood, but only sent
+              // if configured
+              _adaptive_compression_negotiated = true;
+              _adaptive_compression = _server._options.adaptive_compression;
+              ret[protocol_features::ADAPTIVE_COMPRESSION] = "";
+              break;
           case protocol_features::STREAM_PARENT: {
               if (!_server._options.streaming_domain) {
                   f = make_exception_future<>(std::runtime_error("streaming is not configured for the server"));
@@ -809,6 +1108,12 @@ namespace rpc {
               ret.emplace(e);
               break;
           }
+          case protocol_features::STREAM_WINDOW: {
+              auto window = std::min(deserialize_stream_window(e.second), _server._options.stream.window);
+              set_stream_window(window, _server._options.stream.max_batch_bytes);
+              ret[protocol_features::STREAM_WINDOW] = serialize_stream_window(window);
+              break;
+          }
           default:
               // nothing to do
               ;
@@ -833,9 +1138,10 @@ namespace rpc {
 
   struct request_frame {
       using opt_buf_type = std::optional<rcv_buf>;
-      using header_and_buffer_type = std::tuple<std::optional<uint64_t>, uint64_t, int64_t, opt_buf_type>;
+      using opt_trace_type = std::optional<tracing::trace_context>;
+      using header_and_buffer_type = std::tuple<std::optional<uint64_t>, uint64_t, int64_t, opt_buf_type, opt_trace_type>;
       using return_type = future<header_and_buffer_type>;
-      using header_type = std::tuple<std::optional<uint64_t>, uint64_t, int64_t, uint32_t>;
+      using header_type = std::tuple<std::optional<uint64_t>, uint64_t, int64_t, uint32_t, opt_trace_type>;
       static size_t header_size() {
           return 20;
       }
@@ -843,19 +1149,19 @@ namespace rpc {
           return "server";
       }
       static auto empty_value() {
-          return make_ready_future<header_and_buffer_type>(header_and_buffer_type(std::nullopt, uint64_t(0), 0, std::nullopt));
+          return make_ready_future<header_and_buffer_type>(header_and_buffer_type(std::nullopt, uint64_t(0), 0, std::nullopt, std::nullopt));
       }
       static header_type decode_header(const char* ptr) {
           auto type = read_le<uint64_t>(ptr);
           auto msgid = read_le<int64_t>(ptr + 8);
           auto size = read_le<uint32_t>(ptr + 16);
-          return std::make_tuple(std::nullopt, type, msgid, size);
+          return std::make_tuple(std::nullopt, type, msgid, size, std::nullopt);
       }
       static uint32_t get_size(const header_type& t) {
           return std::get<3>(t);
       }
       static auto make_value(const header_type& t, rcv_buf data) {
-          return make_ready_future<header_and_buffer_type>(header_and_buffer_type(std::get<0>(t), std::get<1>(t), std::get<2>(t), std::move(data)));
+          return make_ready_future<header_and_buffer_type>(header_and_buffer_type(std::get<0>(t), std::get<1>(t), std::get<2>(t), std::move(data), std::get<4>(t)));
       }
   };
 
@@ -871,8 +1177,27 @@ namespace rpc {
       }
   };
 
+  template <typename Base>
+  struct request_frame_with_trace : Base {
+      static size_t header_size() {
+          return request_trace_size + Base::header_size();
+      }
+      static typename request_frame::header_type decode_header(const char* ptr) {
+          auto h = Base::decode_header(ptr + request_trace_size);
+          std::get<4>(h) = read_request_trace(ptr);
+          return h;
+      }
+  };
+
   future<request_frame::header_and_buffer_type>
   server::connection::read_request_frame_compressed(input_stream<char>& in) {
+      if (_trace_negotiated) {
+          if (_timeout_negotiated) {
+              return read_frame_compressed<request_frame_with_trace<request_frame_with_timeout>>(_info.addr, _compressor, in);
+          } else {
+              return read_frame_compressed<request_frame_with_trace<request_frame>>(_info.addr, _compressor, in);
+          }
+      }
       if (_timeout_negotiated) {
           return read_frame_compressed<request_frame_with_timeout>(_info.addr, _compressor, in);
       } else {
@@ -924,6 +1249,7 @@ future<> server::connection::send_unknown_verb_reply(std::optional<rpc_clock_typ
                   auto& type = std::get<1>(header_and_buffer);
                   auto& msg_id = std::get<2>(header_and_buffer);
                   auto& data = std::get<3>(header_and_buffer);
+                  auto& trace = std::get<4>(header_and_buffer);
                   if (!data) {
                       _error = true;
                       return make_ready_future<>();
@@ -940,11 +1266,18 @@ future<> server::connection::send_unknown_verb_reply(std::optional<rpc_clock_typ
                       // If the new method of per-connection scheduling group was used, honor it.
                       // Otherwise, use the old per-handler scheduling group.
                       auto sg = _isolation_config ? _isolation_config->sched_group : h->sg;
-                      return with_scheduling_group(sg, [this, timeout, msg_id, h, data = std::move(data.value())] () mutable {
-                          return h->func(shared_from_this(), timeout, msg_id, std::move(data)).finally([this, h] {
-                              // If anything between get_handler() and here throws, we leak put_handler
-                              _server._proto->put_handler(h);
-                          });
+                      return with_scheduling_group(sg, [this, timeout, msg_id, h, data = std::move(data.value()), trace = std::move(trace)] () mutable {
+                          auto handle = [this, timeout, msg_id, h, data = std::move(data)] () mutable {
+                              return h->func(shared_from_this(), timeout, msg_id, std::move(data)).finally([this, h] {
+                                  // If anything between get_handler() and here throws, we leak put_handler
+                                  _server._proto->put_handler(h);
+                              });
+                          };
+                          if (trace) {
+                              // The handler is a span of the trace of the caller
+                              return with_trace_context(trace->make_child(), std::move(handle));
+                          }
+                          return handle();
                       });
                   }
               });
@@ -997,12 +1330,171 @@ future<> server::connection::send_unknown_verb_reply(std::optional<rpc_clock_typ
 
   thread_local std::unordered_map<streaming_domain_type, server*> server::_servers;
 
+  socket_address shard_aware_local_address(const socket_address& remote, unsigned shard, unsigned nr_shards) {
+      // Linux' default ephemeral port range
+      constexpr unsigned first_port = 32768;
+      constexpr unsigned last_port = 60999;
+      static thread_local std::default_random_engine random_engine(std::random_device{}());
+      auto slots = (last_port - first_port + 1) / nr_shards;
+      auto base = std::uniform_int_distribution<unsigned>(first_port / nr_shards + 1, first_port / nr_shards + slots - 1)(random_engine);
+      uint16_t port = base * nr_shards + shard % nr_shards;
+      if (remote.family() == AF_INET6) {
+          return socket_address(ipv6_addr(port));
+      }
+      return socket_address(ipv4_addr(port));
+  }
+
+  void handler_admission::latency_histogram::add(std::chrono::microseconds v) {
+      _histogram.add(std::max<int64_t>(v.count(), 0));
+  }
+
+  metrics::histogram handler_admission::latency_histogram::get() const {
+      return _histogram.to_histogram();
+  }
+
+  handler_admission::permit::permit(lw_shared_ptr<handler_admission> admission, semaphore_units<semaphore_default_exception_factory, rpc_clock_type> units) noexcept
+          : _admission(std::move(admission)), _units(std::move(units)), _start(rpc_clock_type::now()) {
+      _admission->_stats.running++;
+  }
+
+  handler_admission::permit::~permit() {
+      if (_admission) {
+          auto latency = std::chrono::duration_cast<std::chrono::microseconds>(rpc_clock_type::now() - _start);
+          _admission->_latency.add(latency);
+          auto& avg = _admission->_average_latency;
+          avg = avg ? (avg * 7 + latency.count()) / 8 : latency.count();
+          _admission->_stats.running--;
+          _admission->_stats.completed++;
+      }
+  }
+
+  handler_admission::handler_admission(handler_limits limits)
+          : _limits(limits)
+          , _concurrency(std::min<size_t>(limits.max_concurrency, rpc_semaphore::max_counter())) {
+  }
+
+  bool handler_admission::admit(std::optional<rpc_clock_type::time_point> timeout) noexcept {
+      if (_stats.queued >= _limits.max_queued) {
+          _stats.rejected++;
+          return false;
+      }
+      if (_limits.reject_late && timeout && !_concurrency.available_units()) {
+          // Each queued request, and this one, waits for a slot to free up
+          auto slots = std::min<size_t>(_limits.max_concurrency, _stats.running + 1);
+          auto wait = std::chrono::microseconds(int64_t(_average_latency * (_stats.queued + 1) / slots));
+          if (rpc_clock_type::now() + wait > *timeout) {
+              _stats.rejected++;
+              return false;
+          }
+      }
+      return true;
+  }
+
+  future<handler_admission::permit> handler_admission::enter(std::optional<rpc_clock_type::time_point> timeout) {
+      auto queued_at = rpc_clock_type::now();
+      _stats.queued++;
+      auto f = timeout ? get_units(_concurrency, 1, *timeout) : get_units(_concurrency, 1);
+      return f.then_wrapped([this, queued_at, self = shared_from_this()] (auto f) mutable {
+          _stats.queued--;
+          if (f.failed()) {
+              _stats.timed_out++;
+              return make_exception_future<permit>(f.get_exception());
+          }
+          _queue_time.add(std::chrono::duration_cast<std::chrono::microseconds>(rpc_clock_type::now() - queued_at));
+          _stats.started++;
+          return make_ready_future<permit>(permit(std::move(self), f.get0()));
+      });
+  }
+
+  handler_stats handler_admission::get_stats() const {
+      auto ret = _stats;
+      ret.queue_time = _queue_time.get();
+      ret.latency = _latency.get();
+      return ret;
+  }
+
+  verb_metrics::verb_metrics() : _shard(this_shard_id()) {
+  }
+
+  void verb_metrics::enable(verb_metrics_options options) {
+      _options = std::move(options);
+  }
+
+  verb_metrics::series* verb_metrics::get(side s, uint64_t verb, connection& c) {
+      if (!_options || this_shard_id() != _shard) {
+          return nullptr;
+      }
+      if (!c._peer_group) {
+          c._peer_group = _options->peer_group ? _options->peer_group(c.peer_address()) : sstring();
+      }
+      auto& series = _series[int(s)];
+      auto key = std::make_pair(verb, *c._peer_group);
+      auto i = series.find(key);
+      if (i == series.end() && series.size() >= _options->max_series) {
+          key.second = "other";
+          i = series.find(key);
+      }
+      if (i == series.end()) {
+          i = series.emplace(key, make_series(s, verb, key.second)).first;
+      }
+      return i->second.get();
+  }
+
+  std::unique_ptr<verb_metrics::series> verb_metrics::make_series(side s, uint64_t verb, const sstring& peer_group) {
+      auto name = _options->verb_name ? _options->verb_name(verb) : to_sstring(verb);
+      if (name.empty()) {
+          return nullptr;
+      }
+      namespace sm = seastar::metrics;
+      auto ret = std::make_unique<series>();
+      auto p = ret.get();
+      std::vector<sm::label_instance> labels;
+      labels.push_back(sm::label_instance("protocol", _options->protocol_name));
+      labels.push_back(sm::label_instance("verb", name));
+      labels.push_back(sm::label_instance("peer_group", peer_group));
+      bool server = s == side::server;
+      sstring prefix = server ? "server_" : "client_";
+      ret->metrics.add_group("rpc", {
+              sm::make_histogram(prefix + "latency", [p] { return p->latency.to_histogram(); },
+                      sm::description(server ? "Time from the handler of a request starting to its reply being sent, in microseconds"
+                              : "Time from a request being sent to its reply arriving, in microseconds"), labels),
+              sm::make_histogram(prefix + "request_size", [p] { return p->request_size.to_histogram(); },
+                      sm::description("Size of the serialized arguments of the requests, in bytes"), labels),
+              sm::make_histogram(prefix + "response_size", [p] { return p->response_size.to_histogram(); },
+                      sm::description("Size of the serialized replies, in bytes"), labels),
+              sm::make_counter(prefix + "errors", [p] { return p->errors; },
+                      sm::description(server ? "Requests that were rejected or whose handler failed"
+                              : "Requests that failed, with an exception reply, a timeout or a connection error"), labels),
+      });
+      return ret;
+  }
+
   server::server(protocol_base* proto, const socket_address& addr, resource_limits limits)
       : server(proto, seastar::listen(addr, listen_options{true}), limits, server_options{})
   {}
 
+  socket_address shard_port_address(const socket_address& addr, unsigned shard) {
+      auto ret = addr;
+      auto port = htons(addr.port() + shard);
+      if (addr.family() == AF_INET6) {
+          ret.as_posix_sockaddr_in6().sin6_port = port;
+      } else {
+          ret.as_posix_sockaddr_in().sin_port = port;
+      }
+      return ret;
+  }
+
+  static server_socket listen_for(const socket_address& addr, const server_options& opts) {
+      listen_options lo{true, opts.load_balancing_algorithm};
+      if (opts.shard_ports) {
+          lo.set_fixed_cpu(this_shard_id());
+          return seastar::listen(shard_port_address(addr, this_shard_id()), lo);
+      }
+      return seastar::listen(addr, lo);
+  }
+
   server::server(protocol_base* proto, server_options opts, const socket_address& addr, resource_limits limits)
-      : server(proto, seastar::listen(addr, listen_options{true, opts.load_balancing_algorithm}), limits, opts)
+      : server(proto, listen_for(addr, opts), limits, opts)
   {}
 
   server::server(protocol_base* proto, server_socket ss, resource_limits limits, server_options opts)
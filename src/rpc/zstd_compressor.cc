@@ -0,0 +1,255 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/rpc/zstd_compressor.hh>
+#include <seastar/core/print.hh>
+
+#include <zstd.h>
+#include <zdict.h>
+
+namespace seastar {
+namespace rpc {
+
+// Frame format: a single zstd frame, which records the decompressed size.
+// Connections that negotiated a dictionary compress every frame with it.
+
+static const sstring zstd_feature = "ZSTD";
+
+namespace {
+
+struct compression_context_deleter {
+    void operator()(ZSTD_CCtx* ctx) const noexcept {
+        ZSTD_freeCCtx(ctx);
+    }
+};
+
+struct decompression_context_deleter {
+    void operator()(ZSTD_DCtx* ctx) const noexcept {
+        ZSTD_freeDCtx(ctx);
+    }
+};
+
+size_t check(size_t ret, const char* what) {
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(format("RPC frame ZSTD {} failure: {}", what, ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+template <typename Func>
+void for_each_fragment(const std::variant<std::vector<temporary_buffer<char>>, temporary_buffer<char>>& bufs, Func&& func) {
+    if (auto single = std::get_if<temporary_buffer<char>>(&bufs)) {
+        func(*single);
+    } else {
+        for (auto& fragment : std::get<std::vector<temporary_buffer<char>>>(bufs)) {
+            func(fragment);
+        }
+    }
+}
+
+}
+
+zstd_compressor::dictionary::dictionary(temporary_buffer<char> data, int level)
+        : _id(ZSTD_getDictID_fromDict(data.get(), data.size()))
+        , _data(std::move(data)) {
+    if (!_id) {
+        throw std::invalid_argument("Not a zstd dictionary");
+    }
+    _cdict = ZSTD_createCDict(_data.get(), _data.size(), level);
+    _ddict = ZSTD_createDDict(_data.get(), _data.size());
+    if (!_cdict || !_ddict) {
+        ZSTD_freeCDict(_cdict);
+        ZSTD_freeDDict(_ddict);
+        throw std::bad_alloc();
+    }
+}
+
+zstd_compressor::dictionary::~dictionary() {
+    ZSTD_freeCDict(_cdict);
+    ZSTD_freeDDict(_ddict);
+}
+
+temporary_buffer<char> zstd_compressor::dictionary::train(const std::vector<temporary_buffer<char>>& samples, size_t max_size) {
+    std::vector<char> concatenated;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    for (auto& s : samples) {
+        concatenated.insert(concatenated.end(), s.begin(), s.end());
+        sizes.push_back(s.size());
+    }
+    auto dict = temporary_buffer<char>(max_size);
+    auto size = ZDICT_trainFromBuffer(dict.get_write(), dict.size(), concatenated.data(), sizes.data(), sizes.size());
+    if (ZDICT_isError(size)) {
+        throw std::runtime_error(format("ZSTD dictionary training failed: {}", ZDICT_getErrorName(size)));
+    }
+    dict.trim(size);
+    return dict;
+}
+
+// The client offers "ZSTD:<id>" for each of its dictionaries, then "ZSTD"
+zstd_compressor::factory::factory(int level, std::vector<lw_shared_ptr<const dictionary>> dictionaries)
+        : _level(level)
+        , _dictionaries(std::move(dictionaries)) {
+    for (auto& d : _dictionaries) {
+        _features += format("{}:{},", zstd_feature, d->id());
+    }
+    _features += zstd_feature;
+}
+
+const sstring& zstd_compressor::factory::supported() const {
+    return _features;
+}
+
+std::unique_ptr<rpc::compressor> zstd_compressor::factory::negotiate(sstring feature, bool is_server) const {
+    if (feature == zstd_feature) {
+        return std::make_unique<zstd_compressor>(_level, nullptr);
+    }
+    auto prefix = zstd_feature + ":";
+    if (feature.size() <= prefix.size() || feature.substr(0, prefix.size()) != prefix) {
+        return nullptr;
+    }
+    auto id = feature.substr(prefix.size());
+    for (auto& d : _dictionaries) {
+        if (id == to_sstring(d->id())) {
+            return std::make_unique<zstd_compressor>(_level, d);
+        }
+    }
+    return nullptr;
+}
+
+zstd_compressor::zstd_compressor(int level, lw_shared_ptr<const dictionary> dictionary)
+        : _level(level)
+        , _dictionary(std::move(dictionary)) {
+}
+
+sstring zstd_compressor::name() const {
+    return _dictionary ? format("{}:{}", zstd_feature, _dictionary->id()) : zstd_feature;
+}
+
+snd_buf zstd_compressor::compress(size_t head_space, snd_buf data) {
+    static thread_local auto ctx = std::unique_ptr<ZSTD_CCtx, compression_context_deleter>(ZSTD_createCCtx());
+
+    check(ZSTD_CCtx_reset(ctx.get(), ZSTD_reset_session_and_parameters), "compression");
+    if (_dictionary) {
+        check(ZSTD_CCtx_refCDict(ctx.get(), _dictionary->_cdict), "compression");
+    } else {
+        check(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_compressionLevel, _level), "compression");
+    }
+    check(ZSTD_CCtx_setPledgedSrcSize(ctx.get(), data.size), "compression");
+
+    // Small messages get a single buffer sized for the worst case, large
+    // ones are compressed into chunks of the preferred size.
+    std::vector<temporary_buffer<char>> dst_buffers;
+    dst_buffers.emplace_back(head_space + std::min(ZSTD_compressBound(data.size), snd_buf::chunk_size));
+    ZSTD_outBuffer out{dst_buffers.back().get_write(), dst_buffers.back().size(), head_space};
+
+    auto compress_some = [&] (const char* src, size_t size, ZSTD_EndDirective mode) {
+        ZSTD_inBuffer in{src, size, 0};
+        size_t left;
+        do {
+            if (out.pos == out.size) {
+                dst_buffers.emplace_back(snd_buf::chunk_size);
+                out = ZSTD_outBuffer{dst_buffers.back().get_write(), dst_buffers.back().size(), 0};
+            }
+            left = check(ZSTD_compressStream2(ctx.get(), &out, &in, mode), "compression");
+        } while (mode == ZSTD_e_end ? left != 0 : in.pos != in.size);
+    };
+    for_each_fragment(data.bufs, [&] (const temporary_buffer<char>& fragment) {
+        compress_some(fragment.get(), fragment.size(), ZSTD_e_continue);
+    });
+    compress_some(nullptr, 0, ZSTD_e_end);
+    dst_buffers.back().trim(out.pos);
+
+    if (dst_buffers.size() == 1) {
+        return snd_buf(std::move(dst_buffers.front()));
+    }
+    size_t total_size = 0;
+    for (auto& b : dst_buffers) {
+        total_size += b.size();
+    }
+    return snd_buf(std::move(dst_buffers), total_size);
+}
+
+rcv_buf zstd_compressor::decompress(rcv_buf data) {
+    if (data.size == 0) {
+        return rcv_buf();
+    }
+
+    static thread_local auto ctx = std::unique_ptr<ZSTD_DCtx, decompression_context_deleter>(ZSTD_createDCtx());
+
+    check(ZSTD_DCtx_reset(ctx.get(), ZSTD_reset_session_and_parameters), "decompression");
+    check(ZSTD_DCtx_refDDict(ctx.get(), _dictionary ? _dictionary->_ddict : nullptr), "decompression");
+
+    // The frame header records the decompressed size, which lets messages
+    // that fit a chunk be decompressed into a single buffer of the right size
+    size_t first_size = snd_buf::chunk_size;
+    for_each_fragment(data.bufs, [&] (const temporary_buffer<char>& fragment) {
+        if (first_size == snd_buf::chunk_size && fragment.size() == data.size) {
+            auto content_size = ZSTD_getFrameContentSize(fragment.get(), fragment.size());
+            if (content_size < snd_buf::chunk_size) {
+                first_size = std::max<size_t>(content_size, 1);
+            }
+        }
+    });
+
+    std::vector<temporary_buffer<char>> dst_buffers;
+    ZSTD_outBuffer out{nullptr, 0, 0};
+    auto next_output = [&] {
+        dst_buffers.emplace_back(dst_buffers.empty() ? first_size : snd_buf::chunk_size);
+        out = ZSTD_outBuffer{dst_buffers.back().get_write(), dst_buffers.back().size(), 0};
+    };
+
+    size_t left = 1;
+    for_each_fragment(data.bufs, [&] (const temporary_buffer<char>& fragment) {
+        ZSTD_inBuffer in{fragment.get(), fragment.size(), 0};
+        while (in.pos != in.size) {
+            if (out.pos == out.size) {
+                next_output();
+            }
+            left = check(ZSTD_decompressStream(ctx.get(), &out, &in), "decompression");
+        }
+    });
+    // Flush what the decoder still holds once all of the input is consumed
+    while (left != 0) {
+        if (out.pos == out.size) {
+            next_output();
+        }
+        auto pos = out.pos;
+        ZSTD_inBuffer in{nullptr, 0, 0};
+        left = check(ZSTD_decompressStream(ctx.get(), &out, &in), "decompression");
+        if (left != 0 && out.pos == pos) {
+            throw std::runtime_error("RPC frame ZSTD decompression failure: truncated frame");
+        }
+    }
+    dst_buffers.back().trim(out.pos);
+
+    if (dst_buffers.size() == 1) {
+        return rcv_buf(std::move(dst_buffers.front()));
+    }
+    size_t total_size = 0;
+    for (auto& b : dst_buffers) {
+        total_size += b.size();
+    }
+    return rcv_buf(std::move(dst_buffers), total_size);
+}
+
+}
+}
@@ -0,0 +1,198 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/util/crc32c.hh>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#ifdef __aarch64__
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace seastar {
+
+namespace {
+
+// The functions below work on the raw CRC register, which the public ones
+// invert on the way in and out.
+
+// Slicing-by-8 tables for the reflected Castagnoli polynomial, for cpus
+// without CRC32 instructions. The 8-byte steps assume little endian.
+struct crc32c_tables {
+    uint32_t t[8][256];
+
+    crc32c_tables() noexcept {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+            }
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const crc32c_tables tables;
+
+uint32_t crc_scalar(uint32_t crc, const char* data, size_t len) noexcept {
+    auto& t = tables.t;
+    while (len >= 8) {
+        uint64_t w;
+        std::memcpy(&w, data, 8);
+        w ^= crc;
+        crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^ t[5][(w >> 16) & 0xff] ^ t[4][(w >> 24) & 0xff]
+                ^ t[3][(w >> 32) & 0xff] ^ t[2][(w >> 40) & 0xff] ^ t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = t[0][(crc ^ uint8_t(*data++)) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+uint32_t copy_scalar(uint32_t crc, char* dst, const char* src, size_t len) noexcept {
+    std::memcpy(dst, src, len);
+    return crc_scalar(crc, dst, len);
+}
+
+#ifdef __x86_64__
+
+[[gnu::target("sse4.2")]]
+uint32_t crc_sse42(uint32_t crc, const char* data, size_t len) noexcept {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t w;
+        std::memcpy(&w, data, 8);
+        c = _mm_crc32_u64(c, w);
+        data += 8;
+        len -= 8;
+    }
+    crc = c;
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+[[gnu::target("sse4.2")]]
+uint32_t copy_sse42(uint32_t crc, char* dst, const char* src, size_t len) noexcept {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t w;
+        std::memcpy(&w, src, 8);
+        std::memcpy(dst, &w, 8);
+        c = _mm_crc32_u64(c, w);
+        src += 8;
+        dst += 8;
+        len -= 8;
+    }
+    crc = c;
+    while (len--) {
+        *dst++ = *src;
+        crc = _mm_crc32_u8(crc, *src++);
+    }
+    return crc;
+}
+
+#endif
+
+#ifdef __aarch64__
+
+[[gnu::target("+crc")]]
+uint32_t crc_arm(uint32_t crc, const char* data, size_t len) noexcept {
+    while (len >= 8) {
+        uint64_t w;
+        std::memcpy(&w, data, 8);
+        crc = __crc32cd(crc, w);
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+
+[[gnu::target("+crc")]]
+uint32_t copy_arm(uint32_t crc, char* dst, const char* src, size_t len) noexcept {
+    while (len >= 8) {
+        uint64_t w;
+        std::memcpy(&w, src, 8);
+        std::memcpy(dst, &w, 8);
+        crc = __crc32cd(crc, w);
+        src += 8;
+        dst += 8;
+        len -= 8;
+    }
+    while (len--) {
+        *dst++ = *src;
+        crc = __crc32cb(crc, *src++);
+    }
+    return crc;
+}
+
+#endif
+
+struct crc32c_functions {
+    uint32_t (*crc)(uint32_t crc, const char* data, size_t len) noexcept;
+    uint32_t (*copy)(uint32_t crc, char* dst, const char* src, size_t len) noexcept;
+};
+
+crc32c_functions pick_functions() noexcept {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return {crc_sse42, copy_sse42};
+    }
+#endif
+#ifdef __aarch64__
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        return {crc_arm, copy_arm};
+    }
+#endif
+    return {crc_scalar, copy_scalar};
+}
+
+const crc32c_functions& functions() noexcept {
+    static const crc32c_functions f = pick_functions();
+    return f;
+}
+
+}
+
+uint32_t crc32c(uint32_t crc, const char* data, size_t len) noexcept {
+    return ~functions().crc(~crc, data, len);
+}
+
+uint32_t crc32c_copy(uint32_t crc, char* dst, const char* src, size_t len) noexcept {
+    return ~functions().copy(~crc, dst, src, len);
+}
+
+}
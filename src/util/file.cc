@@ -26,6 +26,8 @@
 
 #include <seastar/core/reactor.hh>
 #include <seastar/core/seastar.hh>
+#include <seastar/core/sharded.hh>
+#include <seastar/core/loop.hh>
 #include <seastar/util/file.hh>
 
 namespace seastar {
@@ -215,6 +217,110 @@ future<sstring> read_entire_file_contiguous(std::filesystem::path path) {
     });
 }
 
+namespace {
+
+class directory_walker : public peering_sharded_service<directory_walker> {
+    std::function<future<> (std::vector<directory_tree_entry>)> _consume;
+    directory_walk_options _opts;
+    semaphore _directories;
+    unsigned _next_shard;
+
+    future<> resolve(std::vector<directory_tree_entry>& batch) {
+        return parallel_for_each(batch, [this] (directory_tree_entry& e) {
+            if (_opts.stat_entries) {
+                return file_stat(e.path.native(), follow_symlink::no).then([&e] (stat_data sd) {
+                    e.type = sd.type;
+                    e.size = sd.size;
+                });
+            }
+            if (e.type != directory_entry_type::unknown) {
+                return make_ready_future<>();
+            }
+            // The file system doesn't report types in directory listings
+            return file_type(e.path.native(), follow_symlink::no).then([&e] (std::optional<directory_entry_type> type) {
+                e.type = type.value_or(directory_entry_type::unknown);
+            });
+        });
+    }
+
+    future<> flush(std::vector<directory_tree_entry>& batch, std::vector<fs::path>& subdirs) {
+        if (batch.empty()) {
+            return make_ready_future<>();
+        }
+        return resolve(batch).then([this, &batch, &subdirs] {
+            for (auto& e : batch) {
+                if (e.type == directory_entry_type::directory) {
+                    subdirs.push_back(e.path);
+                }
+            }
+            return _consume(std::exchange(batch, {}));
+        });
+    }
+
+    // Passes the entries of dir to the consumer and returns its subdirectories
+    future<std::vector<fs::path>> list(fs::path dir) {
+        return open_directory(dir.native()).then([this, dir = std::move(dir)] (file f) mutable {
+            return do_with(std::move(f), std::move(dir), std::vector<directory_tree_entry>(), std::vector<fs::path>(),
+                    [this] (file& f, const fs::path& dir, std::vector<directory_tree_entry>& batch, std::vector<fs::path>& subdirs) {
+                return f.list_directory([this, &dir, &batch, &subdirs] (directory_entry de) {
+                    batch.push_back({dir / de.name.c_str(), de.type.value_or(directory_entry_type::unknown)});
+                    if (batch.size() < _opts.batch_size) {
+                        return make_ready_future<>();
+                    }
+                    return flush(batch, subdirs);
+                }).done().then([this, &batch, &subdirs] {
+                    return flush(batch, subdirs);
+                }).finally([&f] {
+                    return f.close();
+                }).then([&subdirs] {
+                    return std::move(subdirs);
+                });
+            });
+        });
+    }
+public:
+    directory_walker(std::function<future<> (std::vector<directory_tree_entry>)> consume, directory_walk_options opts)
+        : _consume(std::move(consume))
+        , _opts(opts)
+        , _directories(std::max(opts.max_concurrent_directories, 1u))
+        , _next_shard(this_shard_id() + 1)
+    {
+        _opts.batch_size = std::max<size_t>(_opts.batch_size, 1);
+    }
+
+    future<> stop() {
+        return make_ready_future<>();
+    }
+
+    future<> walk(fs::path dir) {
+        // Don't hold the units while walking the subdirectories, they
+        // may need them
+        return with_semaphore(_directories, 1, [this, dir = std::move(dir)] () mutable {
+            return list(std::move(dir));
+        }).then([this] (std::vector<fs::path> subdirs) {
+            return do_with(std::move(subdirs), [this] (std::vector<fs::path>& subdirs) {
+                return parallel_for_each(subdirs, [this] (fs::path& sub) {
+                    auto shard = _next_shard++ % smp::count;
+                    return container().invoke_on(shard, [sub = std::move(sub)] (directory_walker& w) mutable {
+                        return w.walk(std::move(sub));
+                    });
+                });
+            });
+        });
+    }
+};
+
+}
+
+future<> walk_directory_tree(fs::path root, std::function<future<> (std::vector<directory_tree_entry>)> consume, directory_walk_options opts) {
+    auto walkers = make_lw_shared<sharded<directory_walker>>();
+    return walkers->start(std::move(consume), opts).then([walkers, root = std::move(root)] () mutable {
+        return walkers->local().walk(std::move(root)).finally([walkers] {
+            return walkers->stop();
+        });
+    });
+}
+
 } // namespace util
 
 } //namespace seastar
@@ -30,7 +30,10 @@
 #include <seastar/core/smp.hh>
 #include <seastar/util/log-cli.hh>
 
+#include <seastar/core/align.hh>
 #include <seastar/core/array_map.hh>
+#include <seastar/core/bitops.hh>
+#include <seastar/core/exception_hacks.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/future.hh>
 #include <seastar/core/print.hh>
@@ -47,6 +50,9 @@
 #include <string>
 #include <system_error>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "core/program_options.hh"
 
@@ -158,23 +164,30 @@ std::ostream& operator<<(std::ostream& os, logger_ostream_type lot) {
     return os;
 }
 
-static internal::log_buf::inserter_iterator print_no_timestamp(internal::log_buf::inserter_iterator it) {
+// Timestamps are read and printed separately, for messages whose
+// formatting is deferred to be printed with the time they were logged at
+struct timestamp_printer {
+    std::chrono::nanoseconds (*now)();
+    internal::log_buf::inserter_iterator (*print)(internal::log_buf::inserter_iterator, std::chrono::nanoseconds);
+};
+
+static internal::log_buf::inserter_iterator print_no_timestamp(internal::log_buf::inserter_iterator it, std::chrono::nanoseconds) {
     return it;
 }
 
-static internal::log_buf::inserter_iterator print_boot_timestamp(internal::log_buf::inserter_iterator it) {
-    auto n = std::chrono::steady_clock::now().time_since_epoch() / 1us;
+static internal::log_buf::inserter_iterator print_boot_timestamp(internal::log_buf::inserter_iterator it, std::chrono::nanoseconds ts) {
+    auto n = ts / 1us;
     return fmt::format_to(it, "{:10d}.{:06d}", n / 1000000, n % 1000000);
 }
 
-static internal::log_buf::inserter_iterator print_real_timestamp(internal::log_buf::inserter_iterator it) {
+static internal::log_buf::inserter_iterator print_real_timestamp(internal::log_buf::inserter_iterator it, std::chrono::nanoseconds ts) {
     struct a_second {
         time_t t;
         std::string s;
     };
     static thread_local a_second this_second;
     using clock = std::chrono::system_clock;
-    auto n = clock::now();
+    auto n = clock::time_point(std::chrono::duration_cast<clock::duration>(ts));
     auto t = clock::to_time_t(n);
     if (this_second.t != t) {
         this_second.s = fmt::format("{:%Y-%m-%d %T}", fmt::localtime(t));
@@ -184,7 +197,22 @@ static internal::log_buf::inserter_iterator print_real_timestamp(internal::log_b
     return fmt::format_to(it, "{},{:03d}", this_second.s, ms);
 }
 
-static internal::log_buf::inserter_iterator (*print_timestamp)(internal::log_buf::inserter_iterator) = print_no_timestamp;
+static const timestamp_printer no_timestamp = {
+    [] { return std::chrono::nanoseconds(0); },
+    print_no_timestamp,
+};
+
+static const timestamp_printer boot_timestamp = {
+    [] { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()); },
+    print_boot_timestamp,
+};
+
+static const timestamp_printer real_timestamp = {
+    [] { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()); },
+    print_real_timestamp,
+};
+
+static const timestamp_printer* print_timestamp = &no_timestamp;
 
 const std::map<log_level, sstring> log_level_names = {
         { log_level::trace, "trace" },
@@ -217,6 +245,8 @@ std::istream& operator>>(std::istream& in, log_level& level) {
 std::ostream* logger::_out = &std::cerr;
 std::atomic<bool> logger::_ostream = { true };
 std::atomic<bool> logger::_syslog = { false };
+std::atomic<bool> logger::_async = { false };
+std::atomic<bool> logger::_deferred = { false };
 
 logger::logger(sstring name) : _name(std::move(name)) {
     global_logger_registry().register_logger(this);
@@ -232,6 +262,335 @@ logger::~logger() {
 
 static thread_local std::array<char, 8192> static_log_buf;
 
+static array_map<sstring, 20> level_tags = {
+        { int(log_level::debug), "DEBUG" },
+        { int(log_level::info),  "INFO "  },
+        { int(log_level::trace), "TRACE" },
+        { int(log_level::warn),  "WARN "  },
+        { int(log_level::error), "ERROR" },
+};
+
+static array_map<int, 20> syslog_priorities = {
+        { int(log_level::debug), LOG_DEBUG },
+        { int(log_level::info), LOG_INFO },
+        { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
+        { int(log_level::warn), LOG_WARNING },
+        { int(log_level::error), LOG_ERR },
+};
+
+namespace internal {
+
+// A message whose formatting is deferred, as queued. It is followed by the
+// logger name, the format string and the encoded arguments.
+struct deferred_log_record {
+    deferred_log_args::formatter formatter;
+    const timestamp_printer* timestamp_style;
+    std::chrono::nanoseconds timestamp;
+    // -1 out of a reactor
+    int32_t shard;
+    uint32_t format_size;
+    uint16_t name_size;
+    uint8_t level;
+    bool to_ostream;
+    bool to_syslog;
+};
+
+// A ring of log records, written by the thread that logs and read by the
+// log writer thread, without locking.
+//
+// _head and _tail count the bytes written and read since the ring was
+// created, the records being at their value modulo the ring size. A record
+// is a header followed by the message, padded to the alignment of headers.
+// A record never wraps around, the end of the ring being skipped with a
+// padding record instead.
+class log_ring {
+    struct record_header {
+        uint32_t size;
+        // The syslog priority, or one of the below
+        int32_t priority;
+    };
+    static constexpr size_t alignment = sizeof(record_header);
+    static constexpr int32_t padding_record = -2;
+
+    std::unique_ptr<char[]> _buf;
+    size_t _size;
+    // The end of the record being written, for commit()
+    size_t _prepared_head = 0;
+    alignas(64) std::atomic<size_t> _head = { 0 };
+    alignas(64) std::atomic<size_t> _tail = { 0 };
+    std::atomic<uint64_t> _dropped = { 0 };
+    // The dropped messages the writer reported
+    uint64_t _reported_dropped = 0;
+
+    static size_t record_size(size_t msg_size) noexcept {
+        return align_up(sizeof(record_header) + msg_size, alignment);
+    }
+    void write_header(size_t pos, uint32_t size, int32_t priority) noexcept {
+        record_header h{size, priority};
+        std::memcpy(_buf.get() + (pos & (_size - 1)), &h, sizeof(h));
+    }
+public:
+    static constexpr int32_t ostream_record = -1;
+    static constexpr int32_t deferred_record = -3;
+
+    explicit log_ring(size_t size)
+        : _buf(new char[size]), _size(size) {
+        assert(size >= 64 && (size & (size - 1)) == 0);
+    }
+
+    // The largest record the ring takes
+    size_t max_record_size() const noexcept {
+        return _size / 2 - sizeof(record_header);
+    }
+
+    // Returns where to write a record of the given size, which is up to
+    // max_record_size(), and which commit() publishes, or nullptr if the
+    // ring is full
+    char* prepare(int32_t priority, size_t size) noexcept {
+        auto need = record_size(size);
+        auto head = _head.load(std::memory_order_relaxed);
+        auto tail = _tail.load(std::memory_order_acquire);
+        auto to_end = _size - (head & (_size - 1));
+        auto total = need <= to_end ? need : to_end + need;
+        if (head + total - tail > _size) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        if (need > to_end) {
+            write_header(head, to_end - sizeof(record_header), padding_record);
+            head += to_end;
+        }
+        write_header(head, size, priority);
+        _prepared_head = head + need;
+        return _buf.get() + (head & (_size - 1)) + sizeof(record_header);
+    }
+
+    void commit() noexcept {
+        _head.store(_prepared_head, std::memory_order_release);
+    }
+
+    // Returns false if the ring is full. Messages larger than
+    // max_record_size() are truncated.
+    bool push(int32_t priority, std::string_view msg) noexcept {
+        msg = msg.substr(0, max_record_size());
+        auto p = prepare(priority, msg.size());
+        if (!p) {
+            return false;
+        }
+        std::memcpy(p, msg.data(), msg.size());
+        commit();
+        return true;
+    }
+
+    bool empty() const noexcept {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_relaxed);
+    }
+
+    // Calls func(priority, message) for the records written so far, in order
+    template <typename Func>
+    void consume(Func&& func) {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        auto head = _head.load(std::memory_order_acquire);
+        while (tail != head) {
+            record_header h;
+            auto p = _buf.get() + (tail & (_size - 1));
+            std::memcpy(&h, p, sizeof(h));
+            if (h.priority != padding_record) {
+                func(h.priority, std::string_view(p + sizeof(h), h.size));
+            }
+            tail += record_size(h.size);
+        }
+        _tail.store(tail, std::memory_order_release);
+    }
+
+    uint64_t dropped() const noexcept {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    // The messages dropped since the previous call, for the writer
+    uint64_t get_and_reset_unreported_dropped() noexcept {
+        auto dropped = _dropped.load(std::memory_order_relaxed);
+        return dropped - std::exchange(_reported_dropped, dropped);
+    }
+};
+
+// Writes the records of the rings of all threads, from a thread of its own,
+// so that a slow terminal or syslog daemon never stalls a reactor.
+class async_log_backend {
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    // The rings of the threads that logged, a thread that exits leaves
+    // its ring to be drained and released by the writer
+    std::vector<std::shared_ptr<log_ring>> _rings;
+    size_t _buffer_size = 1 << 20;
+    bool _running = false;
+    std::atomic<bool> _sleeping = { false };
+    std::thread _thread;
+    // Where the writer formats deferred messages
+    std::array<char, 8192> _format_buf;
+
+    static thread_local std::shared_ptr<log_ring> _local_ring;
+
+    void write_deferred(std::string_view record) {
+        deferred_log_record h;
+        std::memcpy(&h, record.data(), sizeof(h));
+        auto p = record.data() + sizeof(h);
+        std::string_view name(p, h.name_size);
+        p += h.name_size;
+        std::string_view format(p, h.format_size);
+        p += h.format_size;
+        auto print_once = [&] (log_buf::inserter_iterator it) {
+            if (h.shard >= 0) {
+                it = fmt::format_to(it, " [shard {}]", h.shard);
+            }
+            it = fmt::format_to(it, " {} - ", name);
+            try {
+                return h.formatter(it, format, p);
+            } catch (...) {
+                return fmt::format_to(it, "failed to format message: fmt='{}': {}", format, std::current_exception());
+            }
+        };
+        if (h.to_ostream) {
+            log_buf buf(_format_buf.data(), _format_buf.size());
+            auto it = buf.back_insert_begin();
+            it = fmt::format_to(it, "{} ", level_tags[h.level]);
+            it = h.timestamp_style->print(it, h.timestamp);
+            it = print_once(it);
+            *it++ = '\n';
+            *logger::_out << buf.view();
+        }
+        if (h.to_syslog) {
+            log_buf buf(_format_buf.data(), _format_buf.size());
+            auto it = buf.back_insert_begin();
+            it = print_once(it);
+            syslog(syslog_priorities[h.level], "%.*s", int(buf.size()), buf.data());
+        }
+    }
+
+    // Writes what the rings hold, returning whether there was something
+    bool drain(std::vector<std::shared_ptr<log_ring>>& rings) {
+        bool written = false;
+        for (auto& ring : rings) {
+            auto dropped = ring->get_and_reset_unreported_dropped();
+            if (dropped) {
+                *logger::_out << fmt::format("(async logging dropped {} messages)\n", dropped);
+                written = true;
+            }
+            ring->consume([&] (int32_t priority, std::string_view msg) {
+                if (priority == log_ring::ostream_record) {
+                    *logger::_out << msg;
+                } else if (priority == log_ring::deferred_record) {
+                    write_deferred(msg);
+                } else {
+                    syslog(priority, "%.*s", int(msg.size()), msg.data());
+                }
+                written = true;
+            });
+        }
+        if (written) {
+            logger::_out->flush();
+        }
+        return written;
+    }
+
+    void run() {
+        std::vector<std::shared_ptr<log_ring>> rings;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_running) {
+            // The rings of exited threads are checked for before they are
+            // drained, so that they are released only when empty
+            std::vector<size_t> exited;
+            for (size_t i = 0; i < _rings.size(); i++) {
+                if (_rings[i].use_count() == 1) {
+                    exited.push_back(i);
+                }
+            }
+            rings = _rings;
+            lock.unlock();
+            bool written = drain(rings);
+            rings.clear();
+            lock.lock();
+            for (auto i = exited.rbegin(); i != exited.rend(); ++i) {
+                _rings.erase(_rings.begin() + *i);
+            }
+            if (written) {
+                continue;
+            }
+            // Threads that log wake the writer up only when it sleeps, a wake
+            // up that is missed is made up for by the timeout
+            _sleeping.store(true);
+            if (std::all_of(_rings.begin(), _rings.end(), [] (auto& r) { return r->empty(); })) {
+                _cv.wait_for(lock, std::chrono::milliseconds(10));
+            }
+            _sleeping.store(false, std::memory_order_relaxed);
+        }
+        rings = _rings;
+        lock.unlock();
+        drain(rings);
+    }
+public:
+    ~async_log_backend() {
+        stop();
+    }
+
+    static async_log_backend& instance() {
+        static async_log_backend backend;
+        return backend;
+    }
+
+    void start(size_t buffer_size) {
+        std::lock_guard<std::mutex> g(_mutex);
+        _buffer_size = 1ul << log2ceil(std::max<size_t>(buffer_size, 4096));
+        if (!_running) {
+            _running = true;
+            _thread = std::thread([this] { run(); });
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> g(_mutex);
+            _running = false;
+        }
+        _cv.notify_one();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    log_ring& local_ring() {
+        if (!_local_ring) {
+            std::lock_guard<std::mutex> g(_mutex);
+            _local_ring = std::make_shared<log_ring>(_buffer_size);
+            _rings.push_back(_local_ring);
+        }
+        return *_local_ring;
+    }
+
+    bool push(int32_t priority, std::string_view msg) {
+        return local_ring().push(priority, msg);
+    }
+
+    void notify() noexcept {
+        if (_sleeping.load()) {
+            _cv.notify_one();
+        }
+    }
+
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> g(_mutex);
+        uint64_t dropped = 0;
+        for (auto& ring : _rings) {
+            dropped += ring->dropped();
+        }
+        return dropped;
+    }
+};
+
+thread_local std::shared_ptr<log_ring> async_log_backend::_local_ring;
+
+}
+
 bool logger::rate_limit::check() {
     const auto now = clock::now();
     if (now < _next) {
@@ -246,20 +605,15 @@ logger::rate_limit::rate_limit(std::chrono::milliseconds interval)
     : _interval(interval), _next(clock::now())
 { }
 
-void
+bool
 logger::do_log(log_level level, log_writer& writer) {
     bool is_ostream_enabled = _ostream.load(std::memory_order_relaxed);
     bool is_syslog_enabled = _syslog.load(std::memory_order_relaxed);
     if(!is_ostream_enabled && !is_syslog_enabled) {
-      return;
-    }
-    static array_map<sstring, 20> level_map = {
-            { int(log_level::debug), "DEBUG" },
-            { int(log_level::info),  "INFO "  },
-            { int(log_level::trace), "TRACE" },
-            { int(log_level::warn),  "WARN "  },
-            { int(log_level::error), "ERROR" },
-    };
+      return true;
+    }
+    bool is_async = _async.load(std::memory_order_relaxed);
+    bool logged = true;
     auto print_once = [&] (internal::log_buf::inserter_iterator it) {
       if (local_engine) {
           it = fmt::format_to(it, " [shard {}]", this_shard_id());
@@ -275,33 +629,85 @@ logger::do_log(log_level level, log_writer& writer) {
     if (is_ostream_enabled) {
         internal::log_buf buf(static_log_buf.data(), static_log_buf.size());
         auto it = buf.back_insert_begin();
-        it = fmt::format_to(it, "{} ", level_map[int(level)]);
-        it = print_timestamp(it);
+        it = fmt::format_to(it, "{} ", level_tags[int(level)]);
+        it = print_timestamp->print(it, print_timestamp->now());
         it = print_once(it);
         *it++ = '\n';
-        *_out << buf.view();
-        _out->flush();
+        if (is_async) {
+            logged = internal::async_log_backend::instance().push(internal::log_ring::ostream_record, buf.view());
+        } else {
+            *_out << buf.view();
+            _out->flush();
+        }
     }
     if (is_syslog_enabled) {
         internal::log_buf buf(static_log_buf.data(), static_log_buf.size());
         auto it = buf.back_insert_begin();
         it = print_once(it);
         *it = '\0';
-        static array_map<int, 20> level_map = {
-                { int(log_level::debug), LOG_DEBUG },
-                { int(log_level::info), LOG_INFO },
-                { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
-                { int(log_level::warn), LOG_WARNING },
-                { int(log_level::error), LOG_ERR },
-        };
-        // NOTE: syslog() can block, which will stall the reactor thread.
-        //       this should be rare (will have to fill the pipe buffer
-        //       before syslogd can clear it) but can happen.  If it does,
-        //       we'll have to implement some internal buffering (which
-        //       still means the problem can happen, just less frequently).
-        // syslog() interprets % characters, so send msg as a parameter
-        syslog(level_map[int(level)], "%s", buf.data());
+        if (is_async) {
+            logged &= internal::async_log_backend::instance().push(syslog_priorities[int(level)], buf.view());
+        } else {
+            // NOTE: syslog() can block, which will stall the reactor thread.
+            //       this should be rare (will have to fill the pipe buffer
+            //       before syslogd can clear it) but can happen. Asynchronous
+            //       logging avoids it.
+            // syslog() interprets % characters, so send msg as a parameter
+            syslog(syslog_priorities[int(level)], "%s", buf.data());
+        }
+    }
+    if (is_async) {
+        internal::async_log_backend::instance().notify();
     }
+    return logged;
+}
+
+bool
+logger::do_log_deferred(log_level level, std::string_view format, const internal::deferred_log_args& args) {
+    if (!_async.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    bool is_ostream_enabled = _ostream.load(std::memory_order_relaxed);
+    bool is_syslog_enabled = _syslog.load(std::memory_order_relaxed);
+    if (!is_ostream_enabled && !is_syslog_enabled) {
+        return true;
+    }
+    silencer be_silent;
+    auto& backend = internal::async_log_backend::instance();
+    auto& ring = backend.local_ring();
+    std::string_view name = _name;
+    name = name.substr(0, std::numeric_limits<uint16_t>::max());
+    auto args_size = args.size();
+    auto size = sizeof(internal::deferred_log_record) + name.size() + format.size() + args_size;
+    if (size > ring.max_record_size()) {
+        // Formatted, the message is truncated to fit
+        return false;
+    }
+    auto p = ring.prepare(internal::log_ring::deferred_record, size);
+    if (!p) {
+        return true;
+    }
+    internal::deferred_log_record h{
+        args.get_formatter(),
+        print_timestamp,
+        print_timestamp->now(),
+        local_engine ? int32_t(this_shard_id()) : -1,
+        uint32_t(format.size()),
+        uint16_t(name.size()),
+        uint8_t(level),
+        is_ostream_enabled,
+        is_syslog_enabled,
+    };
+    std::memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    std::memcpy(p, name.data(), name.size());
+    p += name.size();
+    std::memcpy(p, format.data(), format.size());
+    p += format.size();
+    args.encode(p);
+    ring.commit();
+    backend.notify();
+    return true;
 }
 
 void logger::failed_to_log(std::exception_ptr ex, format_info fmt) noexcept
@@ -340,6 +746,32 @@ logger::set_syslog_enabled(bool enabled) noexcept {
     _syslog.store(enabled, std::memory_order_relaxed);
 }
 
+void
+logger::set_async_enabled(bool enabled, size_t buffer_size) {
+    auto& backend = internal::async_log_backend::instance();
+    if (enabled) {
+        backend.start(buffer_size);
+        _async.store(true, std::memory_order_relaxed);
+    } else {
+        _async.store(false, std::memory_order_relaxed);
+        backend.stop();
+    }
+}
+
+void
+logger::set_deferred_formatting_enabled(bool enabled) noexcept {
+    _deferred.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t
+logger::async_dropped_messages() noexcept {
+    try {
+        return internal::async_log_backend::instance().dropped();
+    } catch (...) {
+        return 0;
+    }
+}
+
 bool logger::is_shard_zero() noexcept {
     return this_shard_id() == 0;
 }
@@ -420,16 +852,18 @@ void apply_logging_settings(const logging_settings& s) {
         break;
     }
     logger::set_syslog_enabled(s.syslog_enabled);
+    logger::set_async_enabled(s.async_buffer_size != 0, s.async_buffer_size);
+    logger::set_deferred_formatting_enabled(s.deferred_formatting);
 
     switch (s.stdout_timestamp_style) {
     case logger_timestamp_style::none:
-        print_timestamp = print_no_timestamp;
+        print_timestamp = &no_timestamp;
         break;
     case logger_timestamp_style::boot:
-        print_timestamp = print_boot_timestamp;
+        print_timestamp = &boot_timestamp;
         break;
     case logger_timestamp_style::real:
-        print_timestamp = print_real_timestamp;
+        print_timestamp = &real_timestamp;
         break;
     default:
         break;
@@ -508,6 +942,12 @@ options::options(program_options::option_group* parent_group)
     , logger_ostream_type(*this, "logger-ostream-type", logger_ostream_type::stderr,
             "Send log output to: none|stdout|stderr")
     , log_to_syslog(*this, "log-to-syslog", false, "Send log output to syslog.")
+    , log_async_buffer_size(*this, "log-async-buffer-size", 0,
+            "Write the log from a background thread, with a buffer of this size per shard, "
+            "dropping messages when it is full. 0 logs synchronously.")
+    , log_deferred_formatting(*this, "log-deferred-formatting", false,
+            "Let the background log writer format the messages, when their arguments are numbers and strings. "
+            "Requires --log-async-buffer-size.")
 {
 }
 
@@ -538,6 +978,8 @@ logging_settings extract_settings(const options& opts) {
         opts.log_to_syslog.get_value(),
         opts.logger_stdout_timestamps.get_value(),
         opts.logger_ostream_type.get_value(),
+        opts.log_async_buffer_size.get_value(),
+        opts.log_deferred_formatting.get_value(),
     };
 }
 
@@ -563,36 +1005,24 @@ std::ostream& operator<<(std::ostream& out, const std::exception_ptr& eptr) {
         out << "<no exception>";
         return out;
     }
-    try {
-        std::rethrow_exception(eptr);
-    } catch(...) {
-        auto tp = abi::__cxa_current_exception_type();
-        if (tp) {
-            out << seastar::pretty_type_name(*tp);
-        } else {
-            // This case shouldn't happen...
-            out << "<unknown exception>";
-        }
-        // Print more information on some familiar exception types
-        try {
-            throw;
-        } catch (const seastar::nested_exception& ne) {
-            out << fmt::format(": {} (while cleaning up after {})", ne.inner, ne.outer);
-        } catch (const std::system_error& e) {
-            out << " (error " << e.code() << ", " << e.what() << ")";
-        } catch (const std::exception& e) {
-            out << " (" << e.what() << ")";
-        } catch (...) {
-            // no extra info
-        }
+    auto tp = seastar::exception_ptr_type(eptr);
+    if (tp) {
+        out << seastar::pretty_type_name(*tp);
+    } else {
+        // This case shouldn't happen...
+        out << "<unknown exception>";
+    }
+    // Print more information on some familiar exception types
+    if (auto ne = seastar::try_catch<const seastar::nested_exception>(eptr)) {
+        out << fmt::format(": {} (while cleaning up after {})", ne->inner, ne->outer);
+    } else if (auto e = seastar::try_catch<const std::system_error>(eptr)) {
+        out << " (error " << e->code() << ", " << e->what() << ")";
+    } else if (auto e = seastar::try_catch<const std::exception>(eptr)) {
+        out << " (" << e->what() << ")";
+    }
 
-        try {
-            throw;
-        } catch (const std::nested_exception& ne) {
-            out << ": " << ne.nested_ptr();
-        } catch (...) {
-            // do nothing
-        }
+    if (auto ne = seastar::try_catch<const std::nested_exception>(eptr)) {
+        out << ": " << ne->nested_ptr();
     }
     return out;
 }
@@ -20,10 +20,20 @@
  */
 
 #include <seastar/websocket/server.hh>
+#include <seastar/core/byteorder.hh>
+#include <seastar/core/do_with.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/net/packet.hh>
 #include <seastar/util/log.hh>
 #include <cryptopp/sha.h>
 #include <cryptopp/filters.h>
 #include <cryptopp/base64.h>
+#include <zlib.h>
+#include <cstring>
+#include <optional>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifndef CRYPTOPP_NO_GLOBAL_BYTE
 namespace CryptoPP {
@@ -43,6 +53,265 @@ static sstring http_upgrade_reply_template =
 
 static logger wlogger("websocket");
 
+// RFC 6455, section 5.2
+namespace opcode {
+constexpr uint8_t continuation = 0x0;
+constexpr uint8_t text = 0x1;
+constexpr uint8_t binary = 0x2;
+constexpr uint8_t close = 0x8;
+constexpr uint8_t ping = 0x9;
+constexpr uint8_t pong = 0xa;
+}
+
+constexpr uint8_t fin_bit = 0x80;
+// Marks compressed messages with permessage-deflate
+constexpr uint8_t rsv1_bit = 0x40;
+constexpr uint8_t rsv_bits = 0x70;
+constexpr uint8_t mask_bit = 0x80;
+
+// RFC 6455, section 7.4.1
+constexpr uint16_t close_protocol_error = 1002;
+constexpr uint16_t close_invalid_payload = 1007;
+
+// Smaller messages are sent uncompressed, deflate would only grow them
+constexpr size_t min_compressed_size = 64;
+constexpr size_t inflated_buffer_size = 8192;
+// The pieces of a message waiting for its handler to read them
+constexpr size_t message_queue_size = 16;
+
+struct connection::frame {
+    bool fin;
+    bool rsv1;
+    uint8_t opcode;
+    uint64_t length;
+    char mask[4];
+};
+
+namespace {
+
+class message_source_impl final : public data_source_impl {
+    queue<temporary_buffer<char>>& _pieces;
+    bool _eof = false;
+public:
+    explicit message_source_impl(queue<temporary_buffer<char>>& pieces) : _pieces(pieces) {}
+    virtual future<temporary_buffer<char>> get() override {
+        if (_eof) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        return _pieces.pop_eventually().then([this] (temporary_buffer<char> buf) {
+            _eof = buf.empty();
+            return buf;
+        });
+    }
+};
+
+struct deflate_params {
+    bool server_no_context_takeover = false;
+    bool client_no_context_takeover = false;
+    std::optional<int> server_max_window_bits;
+
+    sstring response() const {
+        sstring ret = "permessage-deflate";
+        if (server_no_context_takeover) {
+            ret += "; server_no_context_takeover";
+        }
+        if (client_no_context_takeover) {
+            ret += "; client_no_context_takeover";
+        }
+        if (server_max_window_bits) {
+            ret += format("; server_max_window_bits={}", *server_max_window_bits);
+        }
+        return ret;
+    }
+};
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// Splits s at the first sep, returning what is before it
+std::string_view next_token(std::string_view& s, char sep) {
+    auto pos = s.find(sep);
+    auto token = s.substr(0, pos);
+    s.remove_prefix(pos == std::string_view::npos ? s.size() : pos + 1);
+    return trim(token);
+}
+
+std::optional<int> parse_window_bits(std::string_view value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    if (value.empty() || value.size() > 2 || !std::all_of(value.begin(), value.end(), ::isdigit)) {
+        return std::nullopt;
+    }
+    auto bits = std::stoi(std::string(value));
+    if (bits < 8 || bits > 15) {
+        return std::nullopt;
+    }
+    return bits;
+}
+
+// Accepts the first offer of permessage-deflate the server can honor,
+// as offers come by the client's order of preference, RFC 7692, section 5
+std::optional<deflate_params> negotiate_permessage_deflate(std::string_view extensions) {
+    while (!extensions.empty()) {
+        auto offer = next_token(extensions, ',');
+        if (next_token(offer, ';') != "permessage-deflate") {
+            continue;
+        }
+        deflate_params params;
+        bool acceptable = true;
+        while (acceptable && !offer.empty()) {
+            auto value = next_token(offer, ';');
+            auto name = next_token(value, '=');
+            if (name == "server_no_context_takeover" && value.empty()) {
+                params.server_no_context_takeover = true;
+            } else if (name == "client_no_context_takeover" && value.empty()) {
+                params.client_no_context_takeover = true;
+            } else if (name == "server_max_window_bits") {
+                // zlib can't deflate with a window of 8 bits, it uses 9
+                params.server_max_window_bits = parse_window_bits(value);
+                acceptable = params.server_max_window_bits && *params.server_max_window_bits > 8;
+            } else if (name == "client_max_window_bits") {
+                // Messages are inflated with the largest window, which
+                // works with any the client deflates them with
+                acceptable = value.empty() || parse_window_bits(value);
+            } else {
+                acceptable = false;
+            }
+        }
+        if (acceptable) {
+            return params;
+        }
+    }
+    return std::nullopt;
+}
+
+// XORs the payload with the masking key, from key[offset % 4] on. Clients
+// mask all they send, so every byte received goes through here, a vector
+// at a time, in place.
+void unmask(char* data, size_t size, const char key[4], uint64_t offset) {
+    char k[16];
+    for (size_t i = 0; i < sizeof(k); i++) {
+        k[i] = key[(offset + i) % 4];
+    }
+    size_t i = 0;
+#ifdef __SSE2__
+    auto k128 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(k));
+    for (; i + 16 <= size; i += 16) {
+        auto p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k128));
+    }
+#endif
+    uint64_t k64;
+    std::memcpy(&k64, k, sizeof(k64));
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, data + i, sizeof(v));
+        v ^= k64;
+        std::memcpy(data + i, &v, sizeof(v));
+    }
+    for (; i < size; i++) {
+        data[i] ^= k[i % 4];
+    }
+}
+
+}
+
+// permessage-deflate, RFC 7692
+struct connection::deflate_state {
+    z_stream inflater = {};
+    z_stream deflater = {};
+    deflate_params params;
+
+    explicit deflate_state(deflate_params p) : params(p) {
+        if (inflateInit2(&inflater, -15) != Z_OK) {
+            throw std::bad_alloc();
+        }
+        if (deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -params.server_max_window_bits.value_or(15),
+                8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            inflateEnd(&inflater);
+            throw std::bad_alloc();
+        }
+    }
+    ~deflate_state() {
+        inflateEnd(&inflater);
+        deflateEnd(&deflater);
+    }
+
+    // Inflates a piece of a message, appending the output to out
+    void inflate(std::string_view in, std::vector<temporary_buffer<char>>& out) {
+        inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        inflater.avail_in = in.size();
+        for (;;) {
+            temporary_buffer<char> buf(inflated_buffer_size);
+            inflater.next_out = reinterpret_cast<Bytef*>(buf.get_write());
+            inflater.avail_out = buf.size();
+            auto ret = ::inflate(&inflater, Z_SYNC_FLUSH);
+            if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+                throw websocket::exception("Invalid compressed message");
+            }
+            buf.trim(buf.size() - inflater.avail_out);
+            if (!buf.empty()) {
+                out.push_back(std::move(buf));
+            }
+            if (ret == Z_STREAM_END) {
+                // A final block, whatever follows it in the message is ignored
+                inflateReset(&inflater);
+                return;
+            }
+            if (inflater.avail_out != 0) {
+                return;
+            }
+        }
+    }
+
+    void end_message(std::vector<temporary_buffer<char>>& out) {
+        // The sender removed this from the end of the message
+        static const char tail[] = { 0x00, 0x00, char(0xff), char(0xff) };
+        inflate(std::string_view(tail, sizeof(tail)), out);
+        if (params.client_no_context_takeover) {
+            inflateReset(&inflater);
+        }
+    }
+
+    net::packet deflate(const temporary_buffer<char>& payload) {
+        net::packet out;
+        deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.get()));
+        deflater.avail_in = payload.size();
+        for (;;) {
+            temporary_buffer<char> buf(std::min<size_t>(deflateBound(&deflater, deflater.avail_in) + 8, 65536));
+            deflater.next_out = reinterpret_cast<Bytef*>(buf.get_write());
+            deflater.avail_out = buf.size();
+            if (::deflate(&deflater, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+                throw std::runtime_error("WebSocket message deflate failure");
+            }
+            buf.trim(buf.size() - deflater.avail_out);
+            out = net::packet(std::move(out), std::move(buf));
+            if (deflater.avail_out != 0) {
+                break;
+            }
+        }
+        // The empty block the sync flush ends with is implied, RFC 7692, section 7.2.1
+        out.trim_back(4);
+        if (params.server_no_context_takeover) {
+            deflateReset(&deflater);
+        }
+        return out;
+    }
+};
+
+connection::message::message()
+        : pieces(message_queue_size)
+        , stream(data_source(std::make_unique<message_source_impl>(pieces))) {
+}
+
 void server::listen(socket_address addr, listen_options lo) {
     _listeners.push_back(seastar::listen(addr, lo));
     do_accepts(_listeners.size() - 1);
@@ -94,6 +363,23 @@ future<> server::stop() {
     return tasks_done;
 }
 
+void server::set_handler(handler_t handler) {
+    _handler = std::move(handler);
+}
+
+void server::set_permessage_deflate(bool enable) {
+    _permessage_deflate = enable;
+}
+
+connection::connection(server& server, connected_socket&& fd)
+    : _server(server)
+    , _fd(std::move(fd))
+    , _read_buf(_fd.input())
+    , _write_buf(_fd.output())
+{
+    on_new_connection();
+}
+
 connection::~connection() {
     _server._connections.erase(_server._connections.iterator_to(*this));
 }
@@ -103,19 +389,14 @@ void connection::on_new_connection() {
 }
 
 future<> connection::process() {
-    return when_all(read_loop(), response_loop()).then(
-            [] (std::tuple<future<>, future<>> joined) {
-        try {
-            std::get<0>(joined).get();
-        } catch (...) {
-            wlogger.debug("Read exception encountered: {}", std::current_exception());
-        }
-        try {
-            std::get<1>(joined).get();
-        } catch (...) {
-            wlogger.debug("Response exception encountered: {}", std::current_exception());
-        }
-        return make_ready_future<>();
+    return read_loop().handle_exception([] (std::exception_ptr ep) {
+        wlogger.debug("Read exception encountered: {}", ep);
+    }).then([this] {
+        return with_semaphore(_write_sem, 1, [this] {
+            return _write_buf.close();
+        });
+    }).handle_exception([] (std::exception_ptr ep) {
+        wlogger.debug("Write exception encountered: {}", ep);
     });
 }
 
@@ -156,26 +437,261 @@ future<> connection::read_http_upgrade_request() {
         std::string sha1_output = sha1_base64(sha1_input);
         wlogger.debug("SHA1 output: {} of size {}", sha1_output, sha1_output.size());
 
-        return _write_buf.write(http_upgrade_reply_template).then([this, sha1_output = std::move(sha1_output)] {
-            return _write_buf.write(sha1_output);
-        }).then([this] {
-            return _write_buf.write("\r\n\r\n", 4);
-        }).then([this] {
+        sstring reply = http_upgrade_reply_template + sstring(sha1_output) + "\r\n";
+        if (_server._permessage_deflate) {
+            if (auto params = negotiate_permessage_deflate(req->get_header("Sec-WebSocket-Extensions"))) {
+                _deflate = std::make_unique<deflate_state>(*params);
+                reply += "Sec-WebSocket-Extensions: " + params->response() + "\r\n";
+            }
+        }
+        reply += "\r\n";
+        return _write_buf.write(reply).then([this] {
             return _write_buf.flush();
         });
     });
 }
 
 future<> connection::read_one() {
-    return _read_buf.read().then([this] (temporary_buffer<char> buf) {
-        if (buf.empty()) {
+    return _read_buf.read_exactly(2).then([this] (temporary_buffer<char> header) {
+        if (header.size() < 2) {
+            _done = true;
+            return make_ready_future<>();
+        }
+        frame f;
+        uint8_t b0 = header[0];
+        uint8_t b1 = header[1];
+        f.fin = b0 & fin_bit;
+        f.rsv1 = b0 & rsv1_bit;
+        f.opcode = b0 & 0x0f;
+        if (b0 & rsv_bits & ~rsv1_bit) {
+            return fail(close_protocol_error, "Reserved bits set");
+        }
+        if (!(b1 & mask_bit)) {
+            return fail(close_protocol_error, "Unmasked frame");
+        }
+        uint8_t length = b1 & ~mask_bit;
+        size_t extended_length = length == 126 ? 2 : length == 127 ? 8 : 0;
+        return _read_buf.read_exactly(extended_length + sizeof(f.mask)).then([this, f, length, extended_length] (temporary_buffer<char> rest) mutable {
+            if (rest.size() < extended_length + sizeof(f.mask)) {
+                _done = true;
+                return make_ready_future<>();
+            }
+            f.length = extended_length == 2 ? read_be<uint16_t>(rest.get())
+                    : extended_length == 8 ? read_be<uint64_t>(rest.get())
+                    : length;
+            std::copy_n(rest.get() + extended_length, sizeof(f.mask), f.mask);
+            if (f.opcode & 0x8) {
+                return read_control_frame(f);
+            }
+            return read_data_frame(f);
+        });
+    });
+}
+
+future<> connection::read_control_frame(frame f) {
+    if (!f.fin || f.rsv1 || f.length > 125) {
+        return fail(close_protocol_error, "Invalid control frame");
+    }
+    return _read_buf.read_exactly(f.length).then([this, f] (temporary_buffer<char> payload) {
+        if (payload.size() < f.length) {
+            _done = true;
+            return make_ready_future<>();
+        }
+        unmask(payload.get_write(), payload.size(), f.mask, 0);
+        switch (f.opcode) {
+        case opcode::ping:
+            return send_frame(fin_bit | opcode::pong, net::packet(std::move(payload)));
+        case opcode::pong:
+            return make_ready_future<>();
+        case opcode::close:
             _done = true;
+            if (std::exchange(_close_sent, true)) {
+                return make_ready_future<>();
+            }
+            // Echo the status code, RFC 6455, section 5.5.1
+            payload.trim(std::min<size_t>(payload.size(), 2));
+            return send_frame(fin_bit | opcode::close, net::packet(std::move(payload)));
+        default:
+            return fail(close_protocol_error, "Unknown control frame");
+        }
+    });
+}
+
+future<> connection::read_data_frame(frame f) {
+    future<> started = make_ready_future<>();
+    if (f.opcode == opcode::continuation) {
+        if (!_message) {
+            return fail(close_protocol_error, "Continuation frame without a message");
+        }
+        if (f.rsv1) {
+            return fail(close_protocol_error, "RSV1 set on a continuation frame");
+        }
+    } else if (f.opcode == opcode::text || f.opcode == opcode::binary) {
+        if (_message) {
+            return fail(close_protocol_error, "Message started before the previous one ended");
+        }
+        if (f.rsv1 && !_deflate) {
+            return fail(close_protocol_error, "RSV1 set without permessage-deflate");
+        }
+        _message_compressed = f.rsv1;
+        started = start_message(f.opcode == opcode::text ? message_type::text : message_type::binary);
+    } else {
+        return fail(close_protocol_error, "Unknown data frame");
+    }
+    return started.then([this, f] {
+        // The payload is passed on in the buffers it was read in, unmasked
+        // in place, and isn't gathered into a frame or a message
+        return do_with(uint64_t(0), [this, f] (uint64_t& offset) {
+            return do_until([this, &offset, f] { return offset == f.length || _done; }, [this, &offset, f] {
+                return _read_buf.read_up_to(f.length - offset).then([this, &offset, f] (temporary_buffer<char> buf) {
+                    if (buf.empty()) {
+                        _done = true;
+                        return make_ready_future<>();
+                    }
+                    unmask(buf.get_write(), buf.size(), f.mask, offset);
+                    offset += buf.size();
+                    return push_payload(std::move(buf));
+                });
+            });
+        });
+    }).then([this, f] {
+        if (!f.fin || _done) {
+            return make_ready_future<>();
+        }
+        return end_message();
+    });
+}
+
+future<> connection::start_message(message_type type) {
+    // Messages are handled one at a time
+    return std::exchange(_handled, make_ready_future<>()).then([this, type] {
+        auto msg = make_lw_shared<message>();
+        _message = msg;
+        if (!_server._handler) {
+            msg->abandoned = true;
+            return;
+        }
+        _handled = futurize_invoke(_server._handler, *this, type, msg->stream).then_wrapped([msg] (future<> f) {
+            if (f.failed()) {
+                wlogger.debug("Message handler failed: {}", f.get_exception());
+            }
+            msg->abandoned = true;
+            // Wakes up the reader, if it waits for room
+            while (!msg->pieces.empty()) {
+                msg->pieces.pop();
+            }
+        });
+    });
+}
+
+future<> connection::push_payload(temporary_buffer<char> buf) {
+    auto msg = _message;
+    if (!_message_compressed) {
+        return msg->abandoned ? make_ready_future<>() : msg->pieces.push_eventually(std::move(buf));
+    }
+    // Inflated even if the handler is done, to keep up with the
+    // compression context the client shares between messages
+    std::vector<temporary_buffer<char>> inflated;
+    try {
+        _deflate->inflate(std::string_view(buf.get(), buf.size()), inflated);
+    } catch (const websocket::exception& e) {
+        return fail(close_invalid_payload, e.what());
+    }
+    return do_with(std::move(inflated), [msg] (std::vector<temporary_buffer<char>>& inflated) {
+        return do_for_each(inflated, [msg] (temporary_buffer<char>& buf) {
+            return msg->abandoned ? make_ready_future<>() : msg->pieces.push_eventually(std::move(buf));
+        });
+    });
+}
+
+future<> connection::end_message() {
+    auto msg = std::exchange(_message, nullptr);
+    std::vector<temporary_buffer<char>> inflated;
+    if (_message_compressed) {
+        try {
+            _deflate->end_message(inflated);
+        } catch (const websocket::exception& e) {
+            msg->pieces.abort(std::make_exception_ptr(e));
+            return fail(close_invalid_payload, e.what());
+        }
+    }
+    // The empty buffer ends the message
+    inflated.emplace_back();
+    return do_with(std::move(inflated), [msg] (std::vector<temporary_buffer<char>>& inflated) {
+        return do_for_each(inflated, [msg] (temporary_buffer<char>& buf) {
+            return msg->abandoned ? make_ready_future<>() : msg->pieces.push_eventually(std::move(buf));
+        });
+    });
+}
+
+future<> connection::send_message(message_type type, temporary_buffer<char> payload) {
+    if (_close_sent) {
+        return make_exception_future<>(websocket::exception("The connection is closing"));
+    }
+    uint8_t first_byte = fin_bit | (type == message_type::text ? opcode::text : opcode::binary);
+    if (_deflate && payload.size() >= min_compressed_size) {
+        // Compressed right away, so that messages are deflated in the
+        // order they are sent, as they share the compression context
+        net::packet compressed;
+        try {
+            compressed = _deflate->deflate(payload);
+        } catch (...) {
+            return current_exception_as_future();
         }
-        //FIXME: implement
-        wlogger.info("Received: {}", buf.get());
+        return send_frame(first_byte | rsv1_bit, std::move(compressed));
+    }
+    return send_frame(first_byte, net::packet(std::move(payload)));
+}
+
+future<> connection::send_frame(uint8_t first_byte, net::packet payload) {
+    char header[10];
+    size_t header_size;
+    auto length = payload.len();
+    header[0] = first_byte;
+    if (length < 126) {
+        header[1] = length;
+        header_size = 2;
+    } else if (length <= 0xffff) {
+        header[1] = 126;
+        write_be<uint16_t>(header + 2, length);
+        header_size = 4;
+    } else {
+        header[1] = 127;
+        write_be<uint64_t>(header + 2, length);
+        header_size = 10;
+    }
+    // The header goes in front of the payload, which isn't copied
+    net::packet frame(net::fragment{header, header_size}, std::move(payload));
+    return with_semaphore(_write_sem, 1, [this, frame = std::move(frame)] () mutable {
+        return _write_buf.write(std::move(frame)).then([this] {
+            return _write_buf.flush();
+        });
     });
 }
 
+future<> connection::close(uint16_t code) {
+    if (std::exchange(_close_sent, true)) {
+        return make_ready_future<>();
+    }
+    temporary_buffer<char> payload(2);
+    write_be<uint16_t>(payload.get_write(), code);
+    return send_frame(fin_bit | opcode::close, net::packet(std::move(payload)));
+}
+
+future<> connection::fail(uint16_t code, std::string_view reason) {
+    wlogger.debug("Closing connection: {}", reason);
+    _done = true;
+    if (std::exchange(_close_sent, true)) {
+        return make_ready_future<>();
+    }
+    // Control frames carry at most 125 bytes
+    reason = reason.substr(0, 123);
+    temporary_buffer<char> payload(2 + reason.size());
+    write_be<uint16_t>(payload.get_write(), code);
+    std::copy(reason.begin(), reason.end(), payload.get_write() + 2);
+    return send_frame(fin_bit | opcode::close, net::packet(std::move(payload)));
+}
+
 future<> connection::read_loop() {
     return read_http_upgrade_request().then([this] {
         return do_until([this] {return _done;}, [this] {
@@ -185,17 +701,16 @@ future<> connection::read_loop() {
         if (f.failed()) {
             wlogger.error("Read failed: {}", f.get_exception());
         }
-        return _replies.push_eventually({});
+        if (_message) {
+            std::exchange(_message, nullptr)->pieces.abort(std::make_exception_ptr(
+                    websocket::exception("Connection closed in the middle of a message")));
+        }
+        return std::exchange(_handled, make_ready_future<>());
     }).finally([this] {
         return _read_buf.close();
     });
 }
 
-future<> connection::response_loop() {
-    // FIXME: implement
-    return make_ready_future<>();
-}
-
 void connection::shutdown() {
     wlogger.debug("Shutting down");
     _fd.shutdown_input();
@@ -31,10 +31,15 @@
 
 static constexpr fair_queue::class_id cid = 0;
 
+// The nested queue has two levels of groups with classes at the bottom
+static constexpr unsigned nested_fanout = 8;
+static constexpr unsigned nested_classes = nested_fanout * nested_fanout * nested_fanout;
+
 struct local_fq_and_class {
     seastar::fair_group fg;
     seastar::fair_queue fq;
     seastar::fair_queue sfq;
+    seastar::fair_queue nfq;
     unsigned executed = 0;
 
     static fair_group::config fg_config() {
@@ -50,12 +55,30 @@ struct local_fq_and_class {
         : fg(fg_config())
         , fq(fg, seastar::fair_queue::config())
         , sfq(sfg, seastar::fair_queue::config())
+        , nfq(fg, seastar::fair_queue::config())
     {
         fq.register_priority_class(cid, 1);
+
+        for (unsigned t = 0; t < nested_fanout; t++) {
+            nfq.register_priority_group(t, 100 + t);
+            for (unsigned g = 0; g < nested_fanout; g++) {
+                auto gid = nested_fanout + t * nested_fanout + g;
+                nfq.register_priority_group(gid, 100 + g, t);
+                for (unsigned c = 0; c < nested_fanout; c++) {
+                    nfq.register_priority_class((t * nested_fanout + g) * nested_fanout + c, 100 + c, gid);
+                }
+            }
+        }
     }
 
     ~local_fq_and_class() {
         fq.unregister_priority_class(cid);
+        for (unsigned c = 0; c < nested_classes; c++) {
+            nfq.unregister_priority_class(c);
+        }
+        for (unsigned g = nested_fanout * (nested_fanout + 1); g-- > 0;) {
+            nfq.unregister_priority_group(g);
+        }
     }
 };
 
@@ -95,6 +118,7 @@ struct perf_fair_queue {
     }
 
     future<> test(bool local);
+    future<> test_nested();
 };
 
 future<> perf_fair_queue::test(bool loc) {
@@ -134,6 +158,29 @@ future<> perf_fair_queue::test(bool loc) {
     return when_all_succeed(std::move(invokers), std::move(collectors)).discard_result();
 }
 
+future<> perf_fair_queue::test_nested() {
+    return local_fq.invoke_on_all([] (local_fq_and_class& local) {
+        local.executed = 0;
+        for (unsigned i = 0; i < requests_to_dispatch; i++) {
+            auto req = std::make_unique<local_fq_entry>(1, 1, [&local] {
+                local.executed++;
+                local.nfq.notify_request_finished(seastar::fair_queue_ticket{1, 1});
+            });
+            local.nfq.queue(i % nested_classes, req->ent);
+            req.release();
+        }
+
+        return do_until([&local] { return local.executed == requests_to_dispatch; }, [&local] {
+            local.nfq.dispatch_requests([] (fair_queue_entry& ent) {
+                local_fq_entry* le = boost::intrusive::get_parent_from_member(&ent, &local_fq_entry::ent);
+                le->submit();
+                delete le;
+            });
+            return make_ready_future<>();
+        });
+    });
+}
+
 PERF_TEST_F(perf_fair_queue, contended_local)
 {
     return test(true);
@@ -142,3 +189,7 @@ PERF_TEST_F(perf_fair_queue, contended_shared)
 {
     return test(false);
 }
+PERF_TEST_F(perf_fair_queue, nested_local)
+{
+    return test_nested();
+}
@@ -0,0 +1,134 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/core/flat_hash_map.hh>
+#include <seastar/core/sstring.hh>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace seastar;
+
+// Random keys, half of which are in the maps, looked up in another order
+// than they were inserted
+struct hash_maps {
+    static constexpr size_t nr_keys = 100000;
+
+    std::vector<uint64_t> _keys;
+    std::vector<uint64_t> _lookups;
+    std::unordered_map<uint64_t, uint64_t> _std_map;
+    flat_hash_map<uint64_t, uint64_t> _flat_map;
+    std::unordered_map<sstring, uint64_t> _std_string_map;
+    flat_hash_map<sstring, uint64_t> _flat_string_map;
+    std::vector<sstring> _string_lookups;
+
+    hash_maps() {
+        std::default_random_engine rng;
+        for (size_t i = 0; i < nr_keys; i++) {
+            _keys.push_back(rng());
+        }
+        for (size_t i = 0; i < nr_keys; i++) {
+            _lookups.push_back(i % 2 ? _keys[rng() % nr_keys] : rng());
+        }
+        for (auto k : _keys) {
+            _std_map.emplace(k, k);
+            _flat_map.emplace(k, k);
+            _std_string_map.emplace(to_sstring(k), k);
+            _flat_string_map.emplace(to_sstring(k), k);
+        }
+        for (auto k : _lookups) {
+            _string_lookups.push_back(to_sstring(k));
+        }
+    }
+
+    template <typename Map>
+    size_t insert_and_erase() {
+        Map map;
+        for (auto k : _keys) {
+            map.emplace(k, k);
+        }
+        for (auto k : _keys) {
+            map.erase(k);
+        }
+        return _keys.size();
+    }
+
+    template <typename Map, typename Keys>
+    size_t lookup(const Map& map, const Keys& keys) {
+        size_t found = 0;
+        for (auto& k : keys) {
+            found += map.find(k) != map.end();
+        }
+        perf_tests::do_not_optimize(found);
+        return keys.size();
+    }
+
+    template <typename Map>
+    size_t iterate(const Map& map) {
+        uint64_t sum = 0;
+        for (auto& [k, v] : map) {
+            sum += v;
+        }
+        perf_tests::do_not_optimize(sum);
+        return map.size();
+    }
+};
+
+PERF_TEST_F(hash_maps, std_insert_and_erase)
+{
+    return insert_and_erase<std::unordered_map<uint64_t, uint64_t>>();
+}
+
+PERF_TEST_F(hash_maps, flat_insert_and_erase)
+{
+    return insert_and_erase<flat_hash_map<uint64_t, uint64_t>>();
+}
+
+PERF_TEST_F(hash_maps, std_lookup)
+{
+    return lookup(_std_map, _lookups);
+}
+
+PERF_TEST_F(hash_maps, flat_lookup)
+{
+    return lookup(_flat_map, _lookups);
+}
+
+PERF_TEST_F(hash_maps, std_string_lookup)
+{
+    return lookup(_std_string_map, _string_lookups);
+}
+
+PERF_TEST_F(hash_maps, flat_string_lookup)
+{
+    return lookup(_flat_string_map, _string_lookups);
+}
+
+PERF_TEST_F(hash_maps, std_iterate)
+{
+    return iterate(_std_map);
+}
+
+PERF_TEST_F(hash_maps, flat_iterate)
+{
+    return iterate(_flat_map);
+}
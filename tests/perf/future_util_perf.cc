@@ -19,12 +19,19 @@
  * Copyright (C) 2018 ScyllaDB Ltd.
  */
 
+#include <array>
+
 #include <boost/range.hpp>
 #include <boost/range/irange.hpp>
 
 #include <seastar/testing/perf_tests.hh>
 #include <seastar/core/loop.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/util/later.hh>
+#ifdef SEASTAR_COROUTINES_ENABLED
+#include <seastar/core/coroutine.hh>
+#include <seastar/coroutine/all.hh>
+#endif
 
 struct parallel_for_each {
     std::vector<int> empty_range;
@@ -75,3 +82,157 @@ PERF_TEST_F(parallel_for_each, suspend)
         perf_tests::do_not_optimize(value);
     });
 }
+
+struct chunked_parallel_for_each_test {
+    std::vector<int> range;
+    int value = 0;
+
+    chunked_parallel_for_each_test()
+        : range(boost::copy_range<std::vector<int>>(boost::irange(0, 100'000)))
+    { }
+};
+
+PERF_TEST_F(chunked_parallel_for_each_test, parallel_for_each_immediate)
+{
+    return seastar::parallel_for_each(range, [this] (int v) {
+        return immediate(v, value);
+    }).then([this] {
+        perf_tests::do_not_optimize(value);
+        return range.size();
+    });
+}
+
+PERF_TEST_F(chunked_parallel_for_each_test, chunked_immediate)
+{
+    return seastar::chunked_parallel_for_each(range, [this] (int v) {
+        return immediate(v, value);
+    }).then([this] {
+        perf_tests::do_not_optimize(value);
+        return range.size();
+    });
+}
+
+PERF_TEST_F(chunked_parallel_for_each_test, chunked_void)
+{
+    return seastar::chunked_parallel_for_each(range, [this] (int v) {
+        value += v;
+    }).then([this] {
+        perf_tests::do_not_optimize(value);
+        return range.size();
+    });
+}
+
+// A chain of continuations attached to a future that isn't ready yet, as
+// built by a request handler waiting for I/O; each step needs a continuation.
+PERF_TEST(chain, then_10)
+{
+    promise<> pr;
+    auto f = pr.get_future();
+    for (int i = 0; i < 10; ++i) {
+        f = f.then([i] {
+            perf_tests::do_not_optimize(i);
+        });
+    }
+    pr.set_value();
+    return f;
+}
+
+PERF_TEST(chain, then_value_10)
+{
+    promise<int> pr;
+    auto f = pr.get_future();
+    for (int i = 0; i < 10; ++i) {
+        f = f.then([i] (int v) {
+            return v + i;
+        });
+    }
+    pr.set_value(0);
+    return f.then([] (int v) {
+        perf_tests::do_not_optimize(v);
+    });
+}
+
+// Fan-out to three replicas: the state waiting for the futures is what
+// when_all() allocates.
+struct when_all_test {
+    std::array<promise<int>, 3> replicas;
+
+    void reply() {
+        for (auto& p : replicas) {
+            p = promise<int>();
+        }
+    }
+};
+
+PERF_TEST_F(when_all_test, ready)
+{
+    return when_all(make_ready_future<int>(1), make_ready_future<int>(2), make_ready_future<int>(3)).then([] (auto t) {
+        perf_tests::do_not_optimize(std::get<0>(t).get0() + std::get<1>(t).get0() + std::get<2>(t).get0());
+    });
+}
+
+PERF_TEST_F(when_all_test, variadic)
+{
+    auto f = when_all(replicas[0].get_future(), replicas[1].get_future(), replicas[2].get_future());
+    for (auto& p : replicas) {
+        p.set_value(1);
+    }
+    reply();
+    return f.then([] (auto t) {
+        perf_tests::do_not_optimize(std::get<0>(t).get0() + std::get<1>(t).get0() + std::get<2>(t).get0());
+    });
+}
+
+PERF_TEST_F(when_all_test, vector)
+{
+    std::vector<future<int>> futures;
+    futures.reserve(replicas.size());
+    for (auto& p : replicas) {
+        futures.push_back(p.get_future());
+    }
+    auto f = when_all(futures.begin(), futures.end());
+    for (auto& p : replicas) {
+        p.set_value(1);
+    }
+    reply();
+    return f.then([] (std::vector<future<int>> v) {
+        perf_tests::do_not_optimize(v[0].get0() + v[1].get0() + v[2].get0());
+    });
+}
+
+PERF_TEST_F(when_all_test, succeed_vector)
+{
+    std::vector<future<int>> futures;
+    futures.reserve(replicas.size());
+    for (auto& p : replicas) {
+        futures.push_back(p.get_future());
+    }
+    auto f = when_all_succeed(futures.begin(), futures.end());
+    for (auto& p : replicas) {
+        p.set_value(1);
+    }
+    reply();
+    return f.then([] (std::vector<int> v) {
+        perf_tests::do_not_optimize(v[0] + v[1] + v[2]);
+    });
+}
+
+#ifdef SEASTAR_COROUTINES_ENABLED
+
+PERF_TEST_F(when_all_test, coroutine_all)
+{
+    auto f = [] (std::array<promise<int>, 3>& r) -> future<> {
+        auto [a, b, c] = co_await coroutine::all(
+            [&r] { return r[0].get_future(); },
+            [&r] { return r[1].get_future(); },
+            [&r] { return r[2].get_future(); });
+        perf_tests::do_not_optimize(a + b + c);
+    }(replicas);
+    for (auto& p : replicas) {
+        p.set_value(1);
+    }
+    reply();
+    return f;
+}
+
+#endif
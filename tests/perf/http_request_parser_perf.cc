@@ -0,0 +1,71 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/http/request_parser.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+using namespace seastar;
+
+// A typical browser request
+struct http_request {
+    static constexpr std::string_view head =
+        "GET /api/v1/items?offset=100&limit=50 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/104.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; lang=en\r\n"
+        "Connection: keep-alive\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "\r\n";
+
+    http_request_parser parser;
+
+    // The parser writes nothing, so the same bytes can be fed over and over
+    temporary_buffer<char> fragment(size_t offset, size_t size) {
+        return temporary_buffer<char>(const_cast<char*>(head.data()) + offset, size, deleter());
+    }
+
+    size_t parse(size_t split) {
+        parser.init();
+        if (split) {
+            (void)parser(fragment(0, split));
+        }
+        (void)parser(fragment(split, head.size() - split));
+        auto req = parser.get_parsed_request();
+        perf_tests::do_not_optimize(req);
+        return 1;
+    }
+};
+
+// The whole head in one buffer, handled by the fast path
+PERF_TEST_F(http_request, whole)
+{
+    return parse(0);
+}
+
+// The head split in two, which falls back to the state machine
+PERF_TEST_F(http_request, fragmented)
+{
+    return parse(head.size() / 2);
+}
@@ -0,0 +1,237 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+// End-to-end TCP benchmarks, over the network stack the process runs
+// (--network-stack) and over TLS.
+//
+// The clients talk to an echo server: one of this process, listening on
+// 127.0.0.1, or, for stacks that can't reach themselves such as the
+// native stack over a tap device, any echo server at the address in
+// SEASTAR_NET_PERF_SERVER (e.g. "192.168.122.1:7"). TLS always runs
+// against the server of this process.
+//
+// Group names are <transport>_<message size>[_<connections>]:
+//  - echo measures the round trip of a message,
+//  - stream the throughput of messages kept in flight, a message per
+//    iteration,
+//  - request_response the round trips of all connections at once, a
+//    message per connection per iteration.
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/iostream.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/net/api.hh>
+#include <seastar/net/inet_address.hh>
+#include <seastar/net/tls.hh>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace seastar;
+
+namespace {
+
+struct connection {
+    connected_socket socket;
+    input_stream<char> in;
+    output_stream<char> out;
+
+    explicit connection(connected_socket s)
+        : socket(std::move(s)), in(socket.input()), out(socket.output()) {
+    }
+};
+
+static future<> echo(connection& c) {
+    return repeat([&c] {
+        return c.in.read().then([&c] (temporary_buffer<char> buf) {
+            if (buf.empty()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return c.out.write(std::move(buf)).then([&c] {
+                return c.out.flush();
+            }).then([] {
+                return stop_iteration::no;
+            });
+        });
+    }).finally([&c] {
+        return c.out.close();
+    });
+}
+
+template <bool Tls>
+class echo_server {
+    std::optional<server_socket> _listener;
+    gate _gate;
+    future<> _done = make_ready_future<>();
+public:
+    explicit echo_server(socket_address addr) {
+        listen_options lo;
+        lo.reuse_address = true;
+        if constexpr (Tls) {
+            tls::credentials_builder b;
+            b.set_x509_key_file(SEASTAR_TESTING_CERT_DIR "/test.crt", SEASTAR_TESTING_CERT_DIR "/test.key", tls::x509_crt_format::PEM).get();
+            _listener = tls::listen(b.build_server_credentials(), addr, lo);
+        } else {
+            _listener = seastar::listen(addr, lo);
+        }
+        _done = keep_doing([this] {
+            return _listener->accept().then([this] (accept_result ar) {
+                (void)with_gate(_gate, [s = std::move(ar.connection)] () mutable {
+                    return do_with(connection(std::move(s)), [] (connection& c) {
+                        return echo(c);
+                    });
+                }).handle_exception([] (std::exception_ptr) {});
+            });
+        }).handle_exception([] (std::exception_ptr) {});
+    }
+    ~echo_server() {
+        _listener->abort_accept();
+        _done.get();
+        _gate.close().get();
+    }
+};
+
+static socket_address remote_server() {
+    auto addr = std::getenv("SEASTAR_NET_PERF_SERVER");
+    if (!addr) {
+        return {};
+    }
+    std::string s(addr);
+    auto colon = s.rfind(':');
+    return socket_address(net::inet_address(s.substr(0, colon)), std::stoul(s.substr(colon + 1)));
+}
+
+template <size_t Size, unsigned Connections, bool Tls>
+class net_perf {
+    static constexpr unsigned stream_depth = 16;
+    // Each fixture listens on a port of its own, as the previous one may
+    // linger in TIME_WAIT
+    static inline uint16_t next_port = 10000;
+
+    std::optional<echo_server<Tls>> _server;
+    std::vector<std::unique_ptr<connection>> _connections;
+    temporary_buffer<char> _message;
+    unsigned _in_flight = 0;
+public:
+    net_perf() : _message(Size) {
+        std::fill_n(_message.get_write(), Size, 'x');
+        auto addr = Tls ? socket_address() : remote_server();
+        if (addr.is_unspecified()) {
+            addr = socket_address(net::inet_address("127.0.0.1"), next_port++);
+            _server.emplace(addr);
+        }
+        shared_ptr<tls::certificate_credentials> creds;
+        if constexpr (Tls) {
+            creds = make_shared<tls::certificate_credentials>();
+            creds->set_x509_trust_file(SEASTAR_TESTING_CERT_DIR "/catest.pem", tls::x509_crt_format::PEM).get();
+        }
+        for (unsigned i = 0; i < Connections; i++) {
+            auto s = Tls ? tls::connect(creds, addr, "test.scylladb.org").get0() : seastar::connect(addr).get0();
+            s.set_nodelay(true);
+            _connections.push_back(std::make_unique<connection>(std::move(s)));
+        }
+    }
+    ~net_perf() {
+        for (auto& c : _connections) {
+            // Drain what stream() left in flight
+            while (_in_flight) {
+                c->in.read_exactly(Size).get();
+                _in_flight--;
+            }
+            c->out.close().get();
+            c->in.close().get();
+        }
+        _connections.clear();
+        _server.reset();
+    }
+
+    future<> round_trip(connection& c) {
+        return c.out.write(_message.get(), Size).then([&c] {
+            return c.out.flush();
+        }).then([&c] {
+            return c.in.read_exactly(Size);
+        }).then([] (temporary_buffer<char> buf) {
+            if (buf.size() != Size) {
+                return make_exception_future<>(std::runtime_error("connection closed"));
+            }
+            return make_ready_future<>();
+        });
+    }
+
+    future<size_t> echo() {
+        return round_trip(*_connections.front()).then([] {
+            return size_t(1);
+        });
+    }
+
+    future<size_t> stream() {
+        auto& c = *_connections.front();
+        return c.out.write(_message.get(), Size).then([&c] {
+            return c.out.flush();
+        }).then([this, &c] {
+            if (++_in_flight <= stream_depth) {
+                return make_ready_future<size_t>(1);
+            }
+            _in_flight--;
+            return c.in.read_exactly(Size).then([] (temporary_buffer<char> buf) {
+                if (buf.size() != Size) {
+                    return make_exception_future<size_t>(std::runtime_error("connection closed"));
+                }
+                return make_ready_future<size_t>(1);
+            });
+        });
+    }
+
+    future<size_t> request_response() {
+        return parallel_for_each(_connections, [this] (std::unique_ptr<connection>& c) {
+            return round_trip(*c);
+        }).then([] {
+            return size_t(Connections);
+        });
+    }
+};
+
+}
+
+struct tcp_64 : net_perf<64, 1, false> {};
+struct tcp_4k : net_perf<4096, 1, false> {};
+struct tcp_64k : net_perf<65536, 1, false> {};
+struct tcp_64_16 : net_perf<64, 16, false> {};
+struct tcp_4k_16 : net_perf<4096, 16, false> {};
+struct tcp_64_128 : net_perf<64, 128, false> {};
+struct tls_64 : net_perf<64, 1, true> {};
+struct tls_64k : net_perf<65536, 1, true> {};
+struct tls_4k_16 : net_perf<4096, 16, true> {};
+
+PERF_TEST_F(tcp_64, echo) { return echo(); }
+PERF_TEST_F(tcp_4k, echo) { return echo(); }
+PERF_TEST_F(tcp_64k, echo) { return echo(); }
+PERF_TEST_F(tcp_4k, stream) { return stream(); }
+PERF_TEST_F(tcp_64k, stream) { return stream(); }
+PERF_TEST_F(tcp_64_16, request_response) { return request_response(); }
+PERF_TEST_F(tcp_4k_16, request_response) { return request_response(); }
+PERF_TEST_F(tcp_64_128, request_response) { return request_response(); }
+
+PERF_TEST_F(tls_64, echo) { return echo(); }
+PERF_TEST_F(tls_64k, stream) { return stream(); }
+PERF_TEST_F(tls_4k_16, request_response) { return request_response(); }
@@ -0,0 +1,139 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/net/net.hh>
+#include <seastar/net/ip.hh>
+#include <seastar/core/byteorder.hh>
+#include <string>
+#include <vector>
+
+using namespace seastar;
+using namespace net;
+
+// A device whose queue is fed directly by the test, standing in for a
+// driver receiving bursts of packets
+class rx_device : public device {
+    class rx_qp : public qp {
+    public:
+        explicit rx_qp(std::string name) : qp(false, std::move(name)) {}
+        virtual future<> send(packet p) override {
+            return make_ready_future<>();
+        }
+    };
+public:
+    uint64_t payload_bytes = 0;
+
+    explicit rx_device(std::string name, bool gro) {
+        auto q = std::make_unique<rx_qp>(std::move(name));
+        if (gro) {
+            q->enable_gro();
+        }
+        set_local_queue(std::move(q));
+        // Stands in for the IP and TCP layers
+        (void)receive([this] (packet p) {
+            auto iph = p.get_header<ip_hdr>(sizeof(eth_hdr));
+            auto th = p.get_header(sizeof(eth_hdr) + ipv4_hdr_len_min, tcp_hdr_len_min);
+            payload_bytes += ntoh(iph->len) - ipv4_hdr_len_min - (uint8_t(th[12]) >> 4) * 4;
+            return make_ready_future<>();
+        });
+    }
+    virtual ethernet_address hw_address() override {
+        return ethernet_address{};
+    }
+    virtual net::hw_features hw_features() override {
+        net::hw_features hw;
+        hw.rx_csum_offload = true;
+        return hw;
+    }
+    virtual std::unique_ptr<qp> init_local_queue(const program_options::option_group& opts, uint16_t qid) override {
+        abort();
+    }
+};
+
+// Bursts of full-sized segments of a few interleaved flows, as seen by a
+// queue of a 100GbE NIC under a bulk transfer
+struct rx_bursts {
+    static constexpr size_t burst_size = 32;
+    static constexpr size_t nr_flows = 4;
+    static constexpr size_t mss = 1448;
+    static constexpr size_t nr_bursts = 100;
+
+    std::vector<std::string> _frames;
+    std::vector<uint32_t> _seq = std::vector<uint32_t>(nr_flows);
+
+    rx_bursts() {
+        for (size_t i = 0; i < burst_size; ++i) {
+            _frames.emplace_back(sizeof(eth_hdr) + ipv4_hdr_len_min + tcp_hdr_len_min + mss, '\0');
+            auto& frame = _frames.back();
+            auto eh = reinterpret_cast<eth_hdr*>(frame.data());
+            eh->eth_proto = uint16_t(eth_protocol_num::ipv4);
+            *eh = hton(*eh);
+            auto iph = reinterpret_cast<ip_hdr*>(frame.data() + sizeof(eth_hdr));
+            iph->ihl = 5;
+            iph->ver = 4;
+            iph->len = frame.size() - sizeof(eth_hdr);
+            iph->ip_proto = uint8_t(ip_protocol_num::tcp);
+            iph->src_ip = ipv4_address(0x0a000001);
+            iph->dst_ip = ipv4_address(0x0a000002);
+            *iph = hton(*iph);
+            auto th = frame.data() + sizeof(eth_hdr) + ipv4_hdr_len_min;
+            write_be<uint16_t>(th, 10000 + i % nr_flows);
+            write_be<uint16_t>(th + 2, 80);
+            th[12] = (tcp_hdr_len_min / 4) << 4;
+            th[13] = 0x10;
+            write_be<uint16_t>(th + 14, 65535);
+        }
+    }
+
+    size_t receive(rx_device& dev) {
+        for (size_t b = 0; b < nr_bursts; ++b) {
+            for (size_t i = 0; i < burst_size; ++i) {
+                auto& frame = _frames[i];
+                auto& seq = _seq[i % nr_flows];
+                write_be<uint32_t>(frame.data() + sizeof(eth_hdr) + ipv4_hdr_len_min + 4, seq);
+                seq += mss;
+                dev.l2receive(packet(frame.data(), frame.size()));
+            }
+            dev.l2flush();
+        }
+        perf_tests::do_not_optimize(dev.payload_bytes);
+        return nr_bursts * burst_size;
+    }
+};
+
+static rx_device& plain_device() {
+    static thread_local rx_device dev("perf_rx_plain", false);
+    return dev;
+}
+
+static rx_device& gro_device() {
+    static thread_local rx_device dev("perf_rx_gro", true);
+    return dev;
+}
+
+PERF_TEST_F(rx_bursts, per_packet) {
+    return receive(plain_device());
+}
+
+PERF_TEST_F(rx_bursts, gro) {
+    return receive(gro_device());
+}
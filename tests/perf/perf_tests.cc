@@ -21,23 +21,33 @@
 
 #include <seastar/testing/perf_tests.hh>
 
+#include <array>
+#include <cmath>
 #include <fstream>
+#include <optional>
 #include <regex>
 
 #include <boost/range.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/range/algorithm.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 #include <fmt/ostream.h>
 
 #include <seastar/core/app-template.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/posix.hh>
+#include <seastar/core/reactor.hh>
 #include <seastar/core/thread.hh>
 #include <seastar/core/sharded.hh>
 #include <seastar/json/formatter.hh>
 #include <seastar/util/later.hh>
 #include <seastar/testing/random.hh>
 
+#include <linux/perf_event.h>
 #include <signal.h>
+#include <sys/syscall.h>
 
 namespace perf_tests {
 namespace internal {
@@ -104,6 +114,60 @@ class signal_timer {
     }
 };
 
+// Counts hardware events on the reactor thread, which runs the tests. The
+// counters are a perf_event group, so that they are enabled and read together.
+class perf_counters {
+public:
+    enum counter { instructions, cycles, cache_misses, branch_misses, nr_counters };
+    using values = std::array<uint64_t, nr_counters>;
+private:
+    std::vector<file_desc> _fds;
+public:
+    perf_counters() {
+        static constexpr uint64_t configs[nr_counters] = {
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        for (auto config : configs) {
+            ::perf_event_attr pea{};
+            pea.type = PERF_TYPE_HARDWARE;
+            pea.size = sizeof(pea);
+            pea.config = config;
+            // The group is enabled through its leader
+            pea.disabled = _fds.empty();
+            pea.exclude_kernel = 1;
+            pea.exclude_hv = 1;
+            pea.read_format = PERF_FORMAT_GROUP;
+            int group_fd = _fds.empty() ? -1 : _fds.front().get();
+            int fd = syscall(__NR_perf_event_open, &pea, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+            if (fd == -1) {
+                throw std::system_error(errno, std::system_category(),
+                        "perf_event_open() failed, hardware counters may be unavailable or not permitted");
+            }
+            _fds.push_back(file_desc::from_fd(fd));
+        }
+    }
+
+    void start() {
+        _fds.front().ioctl(PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        _fds.front().ioctl(PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    values stop() {
+        _fds.front().ioctl(PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        struct {
+            uint64_t nr;
+            uint64_t values[nr_counters];
+        } buf;
+        _fds.front().read(&buf, sizeof(buf));
+        values ret;
+        std::copy_n(buf.values, nr_counters, ret.begin());
+        return ret;
+    }
+};
+
 }
 
 time_measurement measure_time;
@@ -124,6 +188,7 @@ struct config {
     unsigned number_of_runs;
     std::vector<std::unique_ptr<result_printer>> printers;
     unsigned random_seed = 0;
+    std::unique_ptr<perf_counters> counters;
 };
 
 struct result {
@@ -136,6 +201,12 @@ struct result {
     double mad;
     double min;
     double max;
+    double allocs;
+    double tasks;
+    // The time per iteration of each run, sorted
+    std::vector<double> samples;
+    // Per iteration, if the counters are enabled
+    std::optional<std::array<double, perf_counters::nr_counters>> counters;
 };
 
 namespace {
@@ -163,7 +234,8 @@ static inline std::ostream& operator<<(std::ostream& os, duration d)
 
 }
 
-static constexpr auto format_string = "{:<40} {:>11} {:>11} {:>11} {:>11} {:>11}\n";
+static constexpr auto format_string = "{:<40} {:>11} {:>11} {:>11} {:>11} {:>11} {:>11} {:>11}";
+static constexpr auto counters_format_string = " {:>11} {:>11} {:>11} {:>11}";
 
 struct stdout_printer final : result_printer {
   virtual void print_configuration(const config& c) override {
@@ -173,38 +245,199 @@ struct stdout_printer final : result_printer {
                "number of runs:", c.number_of_runs,
                "number of cores:", smp::count,
                "random seed:", c.random_seed);
-    fmt::print(format_string, "test", "iterations", "median", "mad", "min", "max");
+    fmt::print(format_string, "test", "iterations", "median", "mad", "min", "max", "allocs", "tasks");
+    if (c.counters) {
+        fmt::print(counters_format_string, "inst", "cycles", "cache-miss", "branch-miss");
+    }
+    fmt::print("\n");
   }
 
   virtual void print_result(const result& r) override {
     fmt::print(format_string, r.test_name, r.total_iterations / r.runs, duration { r.median },
-               duration { r.mad }, duration { r.min }, duration { r.max });
+               duration { r.mad }, duration { r.min }, duration { r.max }, fmt::format("{:.3f}", r.allocs),
+               fmt::format("{:.3f}", r.tasks));
+    if (r.counters) {
+        auto& c = *r.counters;
+        fmt::print(counters_format_string, fmt::format("{:.1f}", c[perf_counters::instructions]),
+                   fmt::format("{:.1f}", c[perf_counters::cycles]), fmt::format("{:.3f}", c[perf_counters::cache_misses]),
+                   fmt::format("{:.3f}", c[perf_counters::branch_misses]));
+    }
+    fmt::print("\n");
   }
 };
 
 class json_printer final : public result_printer {
     std::string _output_file;
-    std::unordered_map<std::string,
-                       std::unordered_map<std::string,
-                                          std::unordered_map<std::string, double>>> _root;
+    std::unordered_map<std::string, std::unordered_map<std::string, double>> _results;
+    std::unordered_map<std::string, std::vector<double>> _samples;
 public:
     explicit json_printer(const std::string& file) : _output_file(file) { }
 
     ~json_printer() {
         std::ofstream out(_output_file);
-        out << json::formatter::to_json(_root);
+        out << "{\"results\":" << json::formatter::to_json(_results)
+            << ",\"samples\":" << json::formatter::to_json(_samples) << "}";
     }
 
     virtual void print_configuration(const config&) override { }
 
     virtual void print_result(const result& r) override {
-        auto& result = _root["results"][r.test_name];
+        _samples[r.test_name] = r.samples;
+        auto& result = _results[r.test_name];
         result["runs"] = r.runs;
         result["total_iterations"] = r.total_iterations;
         result["median"] = r.median;
         result["mad"] = r.mad;
         result["min"] = r.min;
         result["max"] = r.max;
+        result["allocs"] = r.allocs;
+        result["tasks"] = r.tasks;
+        if (r.counters) {
+            auto& c = *r.counters;
+            result["instructions"] = c[perf_counters::instructions];
+            result["cycles"] = c[perf_counters::cycles];
+            result["cache_misses"] = c[perf_counters::cache_misses];
+            result["branch_misses"] = c[perf_counters::branch_misses];
+        }
+    }
+};
+
+namespace {
+
+// The two-sided p-value of the Mann-Whitney U test, the probability that
+// samples at least as different come from the same distribution. It is
+// exact for few samples without ties, which perf tests usually have, and
+// uses the normal approximation otherwise.
+double mann_whitney_p_value(const std::vector<double>& a, const std::vector<double>& b) {
+    size_t m = a.size();
+    size_t n = b.size();
+    double u = 0;
+    for (auto x : a) {
+        for (auto y : b) {
+            u += x > y ? 1 : x == y ? 0.5 : 0;
+        }
+    }
+    std::vector<double> all;
+    boost::range::copy(a, std::back_inserter(all));
+    boost::range::copy(b, std::back_inserter(all));
+    boost::range::sort(all);
+    double ties = 0;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j] == all[i]) {
+            j++;
+        }
+        double t = j - i;
+        ties += t * t * t - t;
+        i = j;
+    }
+
+    if (ties == 0 && m + n <= 40) {
+        // ways[j][k]: the number of orderings of j samples of a and n of b
+        // in which U is k, built up one sample of b at a time
+        std::vector<std::vector<double>> ways(m + 1, std::vector<double>(m * n + 1));
+        for (size_t j = 0; j <= m; j++) {
+            ways[j][0] = 1;
+        }
+        for (size_t nb = 1; nb <= n; nb++) {
+            std::vector<std::vector<double>> next(m + 1, std::vector<double>(m * n + 1));
+            next[0][0] = 1;
+            for (size_t j = 1; j <= m; j++) {
+                for (size_t k = 0; k <= m * n; k++) {
+                    // The largest sample is either from b, or from a and
+                    // greater than all of b
+                    next[j][k] = ways[j][k] + (k >= nb ? next[j - 1][k - nb] : 0);
+                }
+            }
+            ways = std::move(next);
+        }
+        double total = 0, below = 0, above = 0;
+        for (size_t k = 0; k <= m * n; k++) {
+            total += ways[m][k];
+            below += k <= u ? ways[m][k] : 0;
+            above += k >= u ? ways[m][k] : 0;
+        }
+        return std::min(1.0, 2 * std::min(below, above) / total);
+    }
+
+    double nt = m + n;
+    double mu = double(m) * n / 2;
+    double sigma = std::sqrt(double(m) * n / 12 * ((nt + 1) - ties / (nt * (nt - 1))));
+    if (sigma == 0) {
+        return 1;
+    }
+    double z = std::max(0.0, std::abs(u - mu) - 0.5) / sigma;
+    return std::erfc(z / std::sqrt(2.0));
+}
+
+}
+
+// Compares the results to the ones of a file written by json_printer,
+// and reports the significant changes once all tests ran
+class baseline_comparison final : public result_printer {
+    struct baseline {
+        double median;
+        std::vector<double> samples;
+    };
+    static constexpr double significance = 0.05;
+
+    std::string _file;
+    double _threshold;
+    std::unordered_map<std::string, baseline> _baseline;
+    std::vector<std::string> _lines;
+    unsigned _regressions = 0;
+public:
+    baseline_comparison(const std::string& file, double threshold)
+            : _file(file), _threshold(threshold) {
+        namespace pt = boost::property_tree;
+        pt::ptree root;
+        pt::read_json(file, root);
+        // Not with get_child(), test names contain the path separator
+        for (auto& [name, node] : root.get_child("results")) {
+            _baseline[name].median = node.get<double>("median");
+        }
+        if (auto samples = root.get_child_optional("samples")) {
+            for (auto& [name, node] : *samples) {
+                for (auto& [_, v] : node) {
+                    _baseline[name].samples.push_back(v.get_value<double>());
+                }
+            }
+        }
+    }
+
+    virtual void print_configuration(const config&) override { }
+
+    virtual void print_result(const result& r) override {
+        auto it = _baseline.find(r.test_name);
+        if (it == _baseline.end()) {
+            return;
+        }
+        auto& base = it->second;
+        double change = (r.median - base.median) / base.median;
+        // Files written before the samples were only compare by the threshold
+        double p = base.samples.empty() ? 0 : mann_whitney_p_value(base.samples, r.samples);
+        const char* verdict = "";
+        if (std::abs(change) > _threshold && p < significance) {
+            if (change > 0) {
+                verdict = "REGRESSION";
+                _regressions++;
+            } else {
+                verdict = "improvement";
+            }
+        }
+        _lines.push_back(fmt::format("{:<40} {:>11} {:>11} {:>9} {:>9} {}", r.test_name,
+                duration { base.median }, duration { r.median }, fmt::format("{:+.2f}%", change * 100),
+                base.samples.empty() ? "-" : fmt::format("{:.4f}", p), verdict));
+    }
+
+    // Prints the comparison, returning the number of regressions
+    unsigned report() {
+        fmt::print("\ncomparison to {} (threshold {:.2f}%, p < {}):\n", _file, _threshold * 100, significance);
+        fmt::print("{:<40} {:>11} {:>11} {:>9} {:>9}\n", "test", "baseline", "median", "change", "p-value");
+        for (auto& l : _lines) {
+            fmt::print("{}\n", l);
+        }
+        return _regressions;
     }
 };
 
@@ -233,15 +466,31 @@ void performance_test::do_run(const config& conf)
 
     auto results = std::vector<double>(conf.number_of_runs);
     uint64_t total_iterations = 0;
+    uint64_t total_allocs = 0;
+    uint64_t total_tasks = 0;
+    perf_counters::values total_counters = {};
     for (auto i = 0u; i < conf.number_of_runs; i++) {
         // switch out of seastar thread
         yield().then([&] {
             _single_run_iterations = 0;
-            return do_single_run().then([&] (clock_type::duration dt) {
+            auto allocs_before = memory::stats().mallocs();
+            auto tasks_before = engine().get_sched_stats().tasks_processed;
+            if (conf.counters) {
+                conf.counters->start();
+            }
+            return do_single_run().then([&, allocs_before, tasks_before] (clock_type::duration dt) {
+                if (conf.counters) {
+                    auto values = conf.counters->stop();
+                    for (size_t c = 0; c < values.size(); c++) {
+                        total_counters[c] += values[c];
+                    }
+                }
                 double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count();
                 results[i] = ns / _single_run_iterations;
 
                 total_iterations += _single_run_iterations;
+                total_allocs += memory::stats().mallocs() - allocs_before;
+                total_tasks += engine().get_sched_stats().tasks_processed - tasks_before;
             });
         }).get();
     }
@@ -250,6 +499,14 @@ void performance_test::do_run(const config& conf)
     r.test_name = name();
     r.total_iterations = total_iterations;
     r.runs = conf.number_of_runs;
+    r.allocs = double(total_allocs) / total_iterations;
+    r.tasks = double(total_tasks) / total_iterations;
+    if (conf.counters) {
+        r.counters.emplace();
+        for (size_t c = 0; c < total_counters.size(); c++) {
+            (*r.counters)[c] = double(total_counters[c]) / total_iterations;
+        }
+    }
 
     auto mid = conf.number_of_runs / 2;
 
@@ -264,6 +521,7 @@ void performance_test::do_run(const config& conf)
 
     r.min = results[0];
     r.max = results[results.size() - 1];
+    r.samples = std::move(results);
 
     for (auto& rp : conf.printers) {
         rp->print_result(r);
@@ -329,12 +587,18 @@ int main(int ac, char** av)
         ("random-seed,S", bpo::value<unsigned>()->default_value(0),
             "random number generator seed")
         ("no-stdout", "do not print to stdout")
+        ("perf-counters", "also report the instructions, cycles, cache misses and branch misses per iteration, "
+            "counted with perf_event_open()")
         ("json-output", bpo::value<std::string>(), "output json file")
+        ("compare-to", bpo::value<std::string>(), "compare the results to a json file written by --json-output, "
+            "and exit with a non-zero status if a test got significantly slower")
+        ("compare-threshold", bpo::value<double>()->default_value(5),
+            "the change of the median time in percent above which a significant difference is reported")
         ("list", "list available tests")
         ;
 
     return app.run(ac, av, [&] {
-        return async([&] {
+        return async([&] () -> int {
             signal_timer::init();
 
             config conf;
@@ -354,7 +618,11 @@ int main(int ac, char** av)
                 for (auto&& t : all_tests()) {
                     fmt::print("\t{}\n", t->name());
                 }
-                return;
+                return 0;
+            }
+
+            if (app.configuration().count("perf-counters")) {
+                conf.counters = std::make_unique<perf_counters>();
             }
 
             if (!app.configuration().count("no-stdout")) {
@@ -367,6 +635,14 @@ int main(int ac, char** av)
                 ));
             }
 
+            baseline_comparison* comparison = nullptr;
+            if (app.configuration().count("compare-to")) {
+                auto c = std::make_unique<baseline_comparison>(app.configuration()["compare-to"].as<std::string>(),
+                        app.configuration()["compare-threshold"].as<double>() / 100);
+                comparison = c.get();
+                conf.printers.emplace_back(std::move(c));
+            }
+
             if (!conf.random_seed) {
                 conf.random_seed = std::random_device()();
             }
@@ -376,6 +652,11 @@ int main(int ac, char** av)
             }).get();
 
             run_all(tests_to_run, conf);
+
+            if (comparison && comparison->report()) {
+                return 1;
+            }
+            return 0;
         });
     });
 }
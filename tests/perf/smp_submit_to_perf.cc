@@ -20,6 +20,8 @@
  */
 
 #include <random>
+#include <array>
+#include <cmath>
 #include <boost/range/irange.hpp>
 #include <fmt/core.h>
 #include <seastar/core/app-template.hh>
@@ -27,6 +29,8 @@
 #include <seastar/core/do_with.hh>
 #include <seastar/core/loop.hh>
 #include <seastar/core/sleep.hh>
+#include <seastar/core/sharded.hh>
+#include <seastar/core/thread_cputime_clock.hh>
 #include <seastar/util/later.hh>
 
 using namespace seastar;
@@ -100,38 +104,231 @@ static respond_type parse_respond_type(std::string s) {
     throw std::runtime_error("unknown respond type");
 }
 
+// Who each shard sends to
+enum class pattern_type {
+    targets,        // shards grouped around --targets responders
+    all_to_all,     // every shard to every other one, in turn
+    hot_spot,       // everyone to shard 0
+    numa_local,     // to the next shard of the same NUMA node
+    numa_remote,    // to the next shard of another NUMA node
+};
+
+static pattern_type parse_pattern_type(std::string s) {
+    if (s == "targets") {
+        return pattern_type::targets;
+    }
+    if (s == "all-to-all") {
+        return pattern_type::all_to_all;
+    }
+    if (s == "hot-spot") {
+        return pattern_type::hot_spot;
+    }
+    if (s == "numa-local") {
+        return pattern_type::numa_local;
+    }
+    if (s == "numa-remote") {
+        return pattern_type::numa_remote;
+    }
+
+    throw std::runtime_error("unknown pattern");
+}
+
+// What crosses the shards besides the call itself
+enum class operation_type {
+    submit,         // nothing
+    foreign_ptr,    // the target returns a foreign_ptr, destroyed back on it
+    free,           // the sender hands memory over for the target to free
+};
+
+static operation_type parse_operation_type(std::string s) {
+    if (s == "submit") {
+        return operation_type::submit;
+    }
+    if (s == "foreign-ptr") {
+        return operation_type::foreign_ptr;
+    }
+    if (s == "free") {
+        return operation_type::free;
+    }
+
+    throw std::runtime_error("unknown operation");
+}
+
+// Log-linear histogram of nanosecond latencies, within 1/16th
+class latency_stats {
+    static constexpr unsigned sub_bits = 4;
+    static constexpr uint64_t exact = 2 << sub_bits;
+    static constexpr uint64_t half = 1 << sub_bits;
+
+    std::array<uint64_t, exact + (64 - sub_bits - 1) * half> _counts = {};
+    uint64_t _total = 0;
+    uint64_t _max = 0;
+
+    static size_t index_of(uint64_t v) noexcept {
+        if (v < exact) {
+            return v;
+        }
+        unsigned shift = 64 - __builtin_clzll(v) - sub_bits - 1;
+        return exact + (shift - 1) * half + ((v >> shift) - half);
+    }
+    static uint64_t value_of(size_t i) noexcept {
+        if (i < exact) {
+            return i;
+        }
+        unsigned shift = (i - exact) / half + 1;
+        return (((i - exact) % half + half + 1) << shift) - 1;
+    }
+
+public:
+    void record(steady_clock::duration d) noexcept {
+        uint64_t v = std::max<int64_t>(duration_cast<nanoseconds>(d).count(), 0);
+        _counts[index_of(v)]++;
+        _total++;
+        _max = std::max(_max, v);
+    }
+
+    latency_stats& operator+=(const latency_stats& o) noexcept {
+        for (size_t i = 0; i < _counts.size(); i++) {
+            _counts[i] += o._counts[i];
+        }
+        _total += o._total;
+        _max = std::max(_max, o._max);
+        return *this;
+    }
+
+    // In microseconds
+    double percentile(double p) const noexcept {
+        auto target = std::max<uint64_t>(1, std::ceil(p / 100 * _total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); i++) {
+            seen += _counts[i];
+            if (seen >= target) {
+                return std::min(value_of(i), _max) / 1000.0;
+            }
+        }
+        return _max / 1000.0;
+    }
+};
+
+static future<> respond(respond_type resp, microseconds tmo) {
+    switch (resp) {
+    case respond_type::ready:
+        return make_ready_future<>();
+    case respond_type::yield:
+        return yield();
+    case respond_type::io:
+        return check_for_io_immediately();
+    case respond_type::timer:
+        return seastar::sleep<lowres_clock>(tmo);
+    }
+
+    __builtin_unreachable();
+}
+
 class worker {
-    const unsigned _to;
+public:
+    struct config {
+        pattern_type pattern;
+        operation_type operation;
+        size_t size;
+        unsigned targets;
+        unsigned thinkers;
+        microseconds think;
+        respond_type respond;
+        microseconds respond_tmo;
+        unsigned concurrency;
+    };
+
+private:
+    // Shards to send to, in turn; empty when the pattern has none for
+    // this one, e.g. numa-remote on a single node
+    const std::vector<unsigned> _to;
+    const bool _is_target;
 
     std::unique_ptr<thinker> _think;
 
     uint64_t _total;
+    unsigned _next = 0;
+    latency_stats _latency;
+    thread_cputime_clock::time_point _cpu_start;
+    thread_cputime_clock::duration _cpu;
     bool _stop;
     future<> _done;
 
-    static unsigned my_target(unsigned targets) noexcept {
+    static unsigned group_target(unsigned targets) noexcept {
         unsigned group_size = (smp::count + (targets - 1)) / targets;
         unsigned group_no = this_shard_id() / group_size;
         return group_size * group_no;
     }
 
-    future<> start_working(unsigned concurrency, respond_type resp, microseconds tmo) {
-        return parallel_for_each(boost::irange(0u, concurrency), [this, resp, tmo] (unsigned f) {
-            return do_until([this] { return _stop; }, [this, resp, tmo] {
-                return smp::submit_to(_to, [resp, tmo] {
-                    switch (resp) {
-                    case respond_type::ready:
-                        return make_ready_future<>();
-                    case respond_type::yield:
-                        return yield();
-                    case respond_type::io:
-                        return check_for_io_immediately();
-                    case respond_type::timer:
-                        return seastar::sleep<lowres_clock>(tmo);
-                    }
+    // The first shard after this one, cyclically, matching pred
+    template <typename Pred>
+    static std::vector<unsigned> next_shard(Pred pred) {
+        for (unsigned i = 1; i < smp::count; i++) {
+            auto s = (this_shard_id() + i) % smp::count;
+            if (pred(s)) {
+                return { s };
+            }
+        }
+        return {};
+    }
 
-                    __builtin_unreachable();
-                }).then([this] {
+    static std::vector<unsigned> my_targets(pattern_type pattern, unsigned targets) {
+        auto node = smp::numa_node(this_shard_id());
+        switch (pattern) {
+        case pattern_type::targets:
+            return { group_target(targets) };
+        case pattern_type::hot_spot:
+            return { 0 };
+        case pattern_type::all_to_all: {
+            std::vector<unsigned> to;
+            for (unsigned i = 1; i < smp::count; i++) {
+                to.push_back((this_shard_id() + i) % smp::count);
+            }
+            return to;
+        }
+        case pattern_type::numa_local:
+            return next_shard([node] (unsigned s) { return smp::numa_node(s) == node; });
+        case pattern_type::numa_remote:
+            return next_shard([node] (unsigned s) { return smp::numa_node(s) != node; });
+        }
+
+        __builtin_unreachable();
+    }
+
+    future<> call(unsigned to, operation_type op, respond_type resp, microseconds tmo, size_t size) {
+        switch (op) {
+        case operation_type::submit:
+            return smp::submit_to(to, [resp, tmo] {
+                return respond(resp, tmo);
+            });
+        case operation_type::foreign_ptr:
+            return smp::submit_to(to, [resp, tmo, size] {
+                return respond(resp, tmo).then([size] {
+                    return make_foreign(std::make_unique<std::vector<char>>(size));
+                });
+            }).discard_result();
+        case operation_type::free:
+            return smp::submit_to(to, [resp, tmo, buf = std::make_unique<char[]>(size)] () mutable {
+                buf.reset();
+                return respond(resp, tmo);
+            });
+        }
+
+        __builtin_unreachable();
+    }
+
+    future<> start_working(const config& cfg) {
+        if (_to.empty()) {
+            fmt::print("shard {} has no shard to send to\n", this_shard_id());
+            return make_ready_future<>();
+        }
+        return parallel_for_each(boost::irange(0u, cfg.concurrency), [this, cfg] (unsigned f) {
+            return do_until([this] { return _stop; }, [this, cfg] {
+                auto to = _to[_next++ % _to.size()];
+                auto start = steady_clock::now();
+                return call(to, cfg.operation, cfg.respond, cfg.respond_tmo, cfg.size).then([this, start] {
+                    _latency.record(steady_clock::now() - start);
                     _total++;
                     return make_ready_future<>();
                 });
@@ -140,21 +337,14 @@ class worker {
     }
 
 public:
-    struct config {
-        unsigned targets;
-        unsigned thinkers;
-        microseconds think;
-        respond_type respond;
-        microseconds respond_tmo;
-        unsigned concurrency;
-    };
-
-    worker(config cfg) noexcept
-        : _to(my_target(cfg.targets))
+    worker(config cfg)
+        : _to(my_targets(cfg.pattern, cfg.targets))
+        , _is_target((cfg.pattern == pattern_type::targets || cfg.pattern == pattern_type::hot_spot) && _to.front() == this_shard_id())
         , _think(is_target() && (cfg.thinkers > 0) ? std::make_unique<thinker>(cfg.thinkers, cfg.think) : nullptr)
         , _total(0)
+        , _cpu_start(thread_cputime_clock::now())
         , _stop(false)
-        , _done(start_working(cfg.concurrency, cfg.respond, cfg.respond_tmo))
+        , _done(start_working(cfg))
     {
     }
 
@@ -166,11 +356,17 @@ class worker {
         _stop = true;
         return std::move(_done).then([this] {
             return _think ? _think->stop() : make_ready_future<>();
+        }).then([this] {
+            _cpu = thread_cputime_clock::now() - _cpu_start;
         });
     }
 
-    bool is_target() const noexcept { return _to == this_shard_id(); }
+    bool is_target() const noexcept { return _is_target; }
     uint64_t total() const noexcept { return _total; }
+    const std::vector<unsigned>& to() const noexcept { return _to; }
+    const latency_stats& latency() const noexcept { return _latency; }
+    // The CPU time the shard used while working, from its thread
+    thread_cputime_clock::duration cpu() const noexcept { return _cpu; }
 };
 
 class stats {
@@ -202,6 +398,9 @@ int main(int ac, char** av) {
     namespace bpo = boost::program_options;
     at.add_options()
             ("duration", bpo::value<unsigned>()->default_value(32), "time to run the test (seconds)")
+            ("pattern", bpo::value<std::string>()->default_value("targets"), "who sends to whom (targets, all-to-all, hot-spot, numa-local, numa-remote)")
+            ("operation", bpo::value<std::string>()->default_value("submit"), "what each call carries (submit, foreign-ptr, free)")
+            ("size", bpo::value<size_t>()->default_value(128), "bytes of the foreign-ptr and free operations")
             ("targets", bpo::value<unsigned>()->default_value(1), "number of responder shards")
             ("thinkers", bpo::value<unsigned>()->default_value(0), "thinker fibers to run in parallel on targets")
             ("think", bpo::value<unsigned>()->default_value(100), "time (us) thinkers busyloop for")
@@ -213,6 +412,9 @@ int main(int ac, char** av) {
     return at.run(ac, av, [&at] {
         auto duration = seconds(at.configuration()["duration"].as<unsigned>());
         worker::config cfg;
+        cfg.pattern = parse_pattern_type(at.configuration()["pattern"].as<std::string>());
+        cfg.operation = parse_operation_type(at.configuration()["operation"].as<std::string>());
+        cfg.size = at.configuration()["size"].as<size_t>();
         cfg.targets = at.configuration()["targets"].as<unsigned>();
         cfg.thinkers = at.configuration()["thinkers"].as<unsigned>();
         cfg.think = microseconds(at.configuration()["think"].as<unsigned>());
@@ -231,17 +433,25 @@ int main(int ac, char** av) {
             auto real_duration = duration_cast<seconds>(steady_clock::now() - start);
             fmt::print("took {}s (expected {}s)\n", real_duration.count(), duration.count());
             stats st(real_duration.count()), st_targets(real_duration.count());
+            latency_stats latency;
             for (unsigned i = 0; i < smp::count; i++) {
-                workers.invoke_on(i, [&st, &st_targets] (worker& w) {
+                workers.invoke_on(i, [&st, &st_targets, &latency, real_duration] (worker& w) {
                     if (w.is_target()) {
                         st_targets.append(w.total());
                     } else {
                         st.append(w.total());
                     }
+                    latency += w.latency();
+                    auto cpu = duration_cast<std::chrono::duration<double>>(w.cpu()).count() / real_duration.count() * 100;
+                    fmt::print("shard {:2} (node {}) -> {}: {:.1f} op/s, cpu {:.1f}%\n", this_shard_id(), smp::numa_node(this_shard_id()),
+                            w.to().size() == 1 ? fmt::format("{}", w.to().front()) : fmt::format("{} shards", w.to().size()),
+                            (double)w.total() / real_duration.count(), cpu);
                 }).get();
             }
             fmt::print("workers({:2}): min {:.1f} avg {:.1f} max {:.1f} op/s\n", st.nr(), st.min(), st.avg(), st.max());
             fmt::print("targets({:2}): min {:.1f} avg {:.1f} max {:.1f} op/s\n", st_targets.nr(), st_targets.min(), st_targets.avg(), st_targets.max());
+            fmt::print("latency: p50 {:.2f} p90 {:.2f} p99 {:.2f} p99.9 {:.2f} max {:.2f} us\n",
+                    latency.percentile(50), latency.percentile(90), latency.percentile(99), latency.percentile(99.9), latency.percentile(100));
 
             workers.stop().get();
         });
@@ -0,0 +1,99 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/scheduling.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/with_scheduling_group.hh>
+#include <seastar/util/later.hh>
+#include <boost/range/irange.hpp>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace seastar;
+
+// The reactor's own data structures under many active task queues and
+// many expiring timers. Run with --perf-counters to see the cache misses
+// per iteration.
+struct reactor_queues {
+    static constexpr unsigned nr_groups = 8;
+    static constexpr unsigned fibers_per_group = 64;
+    static constexpr unsigned yields_per_fiber = 4;
+    static constexpr unsigned nr_timers = 10000;
+
+    std::vector<scheduling_group> _groups;
+    std::vector<std::unique_ptr<timer<>>> _timers;
+    // Allocated in between the timers, so that they are spread in memory
+    std::vector<std::unique_ptr<char[]>> _padding;
+    unsigned _fired = 0;
+
+    reactor_queues() {
+        for (unsigned i = 0; i < nr_groups; i++) {
+            _groups.push_back(create_scheduling_group(format("perf{}", i), 100).get0());
+        }
+        for (unsigned i = 0; i < nr_timers; i++) {
+            _timers.push_back(std::make_unique<timer<>>([this] { ++_fired; }));
+            _padding.push_back(std::make_unique<char[]>(256));
+        }
+        std::shuffle(_timers.begin(), _timers.end(), std::default_random_engine());
+    }
+
+    ~reactor_queues() {
+        for (auto sg : _groups) {
+            destroy_scheduling_group(sg).get();
+        }
+    }
+};
+
+// Tasks of all the groups are queued at once, so the reactor switches
+// between the task queues all the time
+PERF_TEST_F(reactor_queues, task_queue_switch)
+{
+    return parallel_for_each(_groups, [] (scheduling_group sg) {
+        return parallel_for_each(boost::irange(0u, fibers_per_group), [sg] (unsigned) {
+            return with_scheduling_group(sg, [] {
+                return repeat([n = yields_per_fiber] () mutable {
+                    return yield().then([&n] {
+                        return --n ? stop_iteration::no : stop_iteration::yes;
+                    });
+                });
+            });
+        });
+    }).then([] {
+        return size_t(nr_groups * fibers_per_group * yields_per_fiber);
+    });
+}
+
+// All the timers expire in the same reactor iteration
+PERF_TEST_F(reactor_queues, timers_expire)
+{
+    _fired = 0;
+    for (auto& t : _timers) {
+        t->arm(timer<>::clock::now());
+    }
+    return do_until([this] { return _fired == nr_timers; }, [] {
+        return yield();
+    }).then([] {
+        return size_t(nr_timers);
+    });
+}
@@ -0,0 +1,120 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/core/thread.hh>
+#include <seastar/core/semaphore.hh>
+
+using namespace seastar;
+
+// A thread that switches right back out each time it is switched in, to
+// measure the bare context switch
+class switch_in_out {
+    static constexpr size_t rounds = 1000;
+
+    thread_context* _context = nullptr;
+    bool _done = false;
+    thread _thread{[this] { main(); }};
+private:
+    void main() {
+        _context = thread_impl::get();
+        while (!_done) {
+            thread_impl::switch_out(_context);
+        }
+    }
+public:
+    ~switch_in_out() {
+        _done = true;
+        thread_impl::switch_in(_context);
+        _thread.join().get();
+    }
+
+    size_t switch_rounds() {
+        for (size_t i = 0; i < rounds; i++) {
+            thread_impl::switch_in(_context);
+        }
+        // Each round switches in and back out
+        return rounds * 2;
+    }
+};
+
+// Two threads waking each other through semaphores, which adds the
+// scheduling of the woken thread to each switch
+class ping_pong {
+    static constexpr size_t rounds = 1000;
+
+    semaphore _s1{0};
+    semaphore _s2{0};
+    semaphore _round_done{0};
+    size_t _left = 0;
+    bool _done = false;
+    thread _t1{[this] { main1(); }};
+    thread _t2{[this] { main2(); }};
+private:
+    void main1() {
+        while (true) {
+            _s1.wait().get();
+            if (_done) {
+                break;
+            }
+            _s2.signal();
+        }
+    }
+    void main2() {
+        while (true) {
+            _s2.wait().get();
+            if (_done) {
+                break;
+            }
+            if (--_left == 0) {
+                _round_done.signal();
+            } else {
+                _s1.signal();
+            }
+        }
+    }
+public:
+    ~ping_pong() {
+        _done = true;
+        _s1.signal();
+        _s2.signal();
+        _t1.join().get();
+        _t2.join().get();
+    }
+
+    future<size_t> switch_rounds() {
+        _left = rounds;
+        _s1.signal();
+        return _round_done.wait().then([] {
+            return rounds * 2;
+        });
+    }
+};
+
+PERF_TEST_F(switch_in_out, switch)
+{
+    return switch_rounds();
+}
+
+PERF_TEST_F(ping_pong, semaphore)
+{
+    return switch_rounds();
+}
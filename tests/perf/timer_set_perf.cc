@@ -0,0 +1,160 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/core/timer-set.hh>
+#include <seastar/core/timer-wheel.hh>
+#include <boost/intrusive/list.hpp>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace seastar;
+
+struct test_timer {
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+    using duration = clock::duration;
+
+    time_point _expiry;
+    boost::intrusive::list_member_hook<> _link;
+
+    time_point get_timeout() const noexcept {
+        return _expiry;
+    }
+    // The sets are drained before they are destroyed
+    void cancel() noexcept {
+        abort();
+    }
+};
+
+using test_timer_set = timer_set<test_timer, &test_timer::_link>;
+using test_timer_wheel = timer_wheel<test_timer, &test_timer::_link>;
+
+// Many timers spread over ten seconds, expired in 1ms steps the way the
+// reactor polls them
+struct timers {
+    static constexpr size_t nr_timers = 100000;
+    static constexpr auto span = std::chrono::seconds(10);
+    static constexpr auto step = std::chrono::milliseconds(1);
+
+    std::vector<test_timer> _timers{nr_timers};
+    // The same timeouts, but each timer allocated on its own, with other
+    // allocations in between, and inserted in random order, the way
+    // timers embedded in connections and requests are. Walking the lists
+    // then misses the cache on every timer.
+    std::vector<std::unique_ptr<test_timer>> _scattered_storage;
+    std::vector<std::unique_ptr<char[]>> _padding;
+    std::vector<test_timer*> _scattered;
+    test_timer::time_point _start = test_timer::time_point(std::chrono::hours(1));
+
+    timers() {
+        std::default_random_engine rng;
+        std::uniform_int_distribution<test_timer::duration::rep> dist(1, std::chrono::duration_cast<test_timer::duration>(span).count());
+        for (auto& t : _timers) {
+            t._expiry = _start + test_timer::duration(dist(rng));
+            _scattered_storage.push_back(std::make_unique<test_timer>());
+            _scattered_storage.back()->_expiry = t._expiry;
+            _padding.push_back(std::make_unique<char[]>(256));
+            _scattered.push_back(_scattered_storage.back().get());
+        }
+        std::shuffle(_scattered.begin(), _scattered.end(), rng);
+    }
+
+    template <typename Set>
+    size_t arm_and_cancel() {
+        Set set;
+        set.expire(_start);
+        for (auto& t : _timers) {
+            set.insert(t);
+        }
+        for (auto& t : _timers) {
+            set.remove(t);
+        }
+        return _timers.size();
+    }
+
+    template <typename Set>
+    size_t arm_and_expire() {
+        Set set;
+        set.expire(_start);
+        for (auto& t : _timers) {
+            set.insert(t);
+        }
+        return expire_all(set);
+    }
+
+    template <typename Set>
+    size_t arm_and_expire_scattered() {
+        Set set;
+        set.expire(_start);
+        for (auto t : _scattered) {
+            set.insert(*t);
+        }
+        return expire_all(set);
+    }
+
+    template <typename Set>
+    size_t expire_all(Set& set) {
+        size_t expired = 0;
+        for (auto now = _start; !set.empty(); now += step) {
+            auto exp = set.expire(now);
+            while (!exp.empty()) {
+                exp.pop_front();
+                expired++;
+            }
+        }
+        perf_tests::do_not_optimize(expired);
+        return _timers.size();
+    }
+};
+
+PERF_TEST_F(timers, timer_set_arm_and_cancel)
+{
+    return arm_and_cancel<test_timer_set>();
+}
+
+PERF_TEST_F(timers, timer_wheel_arm_and_cancel)
+{
+    return arm_and_cancel<test_timer_wheel>();
+}
+
+PERF_TEST_F(timers, timer_set_arm_and_expire)
+{
+    return arm_and_expire<test_timer_set>();
+}
+
+PERF_TEST_F(timers, timer_wheel_arm_and_expire)
+{
+    return arm_and_expire<test_timer_wheel>();
+}
+
+PERF_TEST_F(timers, timer_set_arm_and_expire_scattered)
+{
+    return arm_and_expire_scattered<test_timer_set>();
+}
+
+PERF_TEST_F(timers, timer_wheel_arm_and_expire_scattered)
+{
+    return arm_and_expire_scattered<test_timer_wheel>();
+}
@@ -0,0 +1,231 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+// TLS benchmarks, both ends in this process, over loopback.
+//
+//  - handshake_rsa and handshake_ecdsa: connections per iteration, with
+//    a full handshake, or resuming the session from a ticket. The TCP
+//    connection setup is part of each.
+//  - records_<size> and records_ktls_<size>: writes of <size> bytes per
+//    iteration, encrypted by gnutls or, where the kernel supports it, by
+//    kTLS, and decrypted by gnutls on the other end. At the end of a
+//    case, the CPU time the shard took per GB written is printed, kernel
+//    time included.
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/iostream.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/condition-variable.hh>
+#include <seastar/core/thread_cputime_clock.hh>
+#include <seastar/net/api.hh>
+#include <seastar/net/inet_address.hh>
+#include <seastar/net/tls.hh>
+#include <seastar/util/noncopyable_function.hh>
+#include <fmt/core.h>
+
+using namespace seastar;
+
+namespace {
+
+struct cert {
+    const char* crt;
+    const char* key;
+    const char* ca;
+};
+
+static const cert rsa_cert = {
+    SEASTAR_TESTING_CERT_DIR "/test.crt", SEASTAR_TESTING_CERT_DIR "/test.key", SEASTAR_TESTING_CERT_DIR "/catest.pem",
+};
+static const cert ecdsa_cert = {
+    SEASTAR_TESTING_CERT_DIR "/ecdsa.crt", SEASTAR_TESTING_CERT_DIR "/ecdsa.key", SEASTAR_TESTING_CERT_DIR "/caecdsa.pem",
+};
+
+// Each fixture listens on a port of its own, as the previous one may
+// linger in TIME_WAIT
+static uint16_t next_port = 11000;
+
+// A TLS listener running handler on each connection
+class tls_server {
+    using handler_type = noncopyable_function<future<> (connected_socket&)>;
+
+    handler_type _handler;
+    std::optional<server_socket> _listener;
+    gate _gate;
+    future<> _done = make_ready_future<>();
+public:
+    tls_server(const cert& c, socket_address addr, handler_type handler) : _handler(std::move(handler)) {
+        auto creds = make_shared<tls::server_credentials>();
+        creds->set_x509_key_file(c.crt, c.key, tls::x509_crt_format::PEM).get();
+        creds->enable_session_tickets(tls::generate_session_ticket_key());
+        listen_options lo;
+        lo.reuse_address = true;
+        _listener = tls::listen(std::move(creds), addr, lo);
+        _done = keep_doing([this] {
+            return _listener->accept().then([this] (accept_result ar) {
+                (void)with_gate(_gate, [this, s = std::move(ar.connection)] () mutable {
+                    return do_with(std::move(s), [this] (connected_socket& s) {
+                        return _handler(s);
+                    });
+                }).handle_exception([] (std::exception_ptr) {});
+            });
+        }).handle_exception([] (std::exception_ptr) {});
+    }
+    ~tls_server() {
+        _listener->abort_accept();
+        _done.get();
+        _gate.close().get();
+    }
+};
+
+static shared_ptr<tls::certificate_credentials> client_credentials(const cert& c) {
+    auto creds = make_shared<tls::certificate_credentials>();
+    creds->set_x509_trust_file(c.ca, tls::x509_crt_format::PEM).get();
+    return creds;
+}
+
+template <bool Ecdsa>
+class handshakes {
+    const cert& _cert = Ecdsa ? ecdsa_cert : rsa_cert;
+    socket_address _addr = socket_address(net::inet_address("127.0.0.1"), next_port++);
+    // The server closes first, leaving TIME_WAIT on its side instead of
+    // using up the client's ephemeral ports
+    tls_server _server{_cert, _addr, [] (connected_socket& s) {
+        return tls::check_session_is_resumed(s).discard_result().then([&s] {
+            return do_with(s.output(), [] (output_stream<char>& out) {
+                return out.close();
+            });
+        });
+    }};
+    shared_ptr<tls::certificate_credentials> _full = client_credentials(_cert);
+    shared_ptr<tls::certificate_credentials> _resuming = [this] {
+        auto creds = client_credentials(_cert);
+        creds->enable_session_resumption(1);
+        return creds;
+    }();
+    // Whether a session to resume was kept yet
+    bool _resumable = false;
+public:
+    future<size_t> handshake(bool resume) {
+        auto creds = resume ? _resuming : _full;
+        return tls::connect(creds, _addr, "test.scylladb.org").then([this, resume] (connected_socket s) {
+            return do_with(std::move(s), [this, resume] (connected_socket& s) {
+                return tls::check_session_is_resumed(s).then([this, resume] (bool resumed) {
+                    if (resume && !resumed && std::exchange(_resumable, true)) {
+                        throw std::runtime_error("session not resumed");
+                    }
+                }).then([&s] {
+                    return do_with(s.input(), [] (input_stream<char>& in) {
+                        return in.read().discard_result().finally([&in] {
+                            return in.close();
+                        });
+                    });
+                });
+            });
+        }).then([] {
+            return size_t(1);
+        });
+    }
+};
+
+template <size_t Size, bool Ktls>
+class records {
+    static constexpr size_t window = std::max<size_t>(4 * Size, 256 << 10);
+
+    socket_address _addr = socket_address(net::inet_address("127.0.0.1"), next_port++);
+    uint64_t _received = 0;
+    condition_variable _progress;
+    tls_server _server{rsa_cert, _addr, [this] (connected_socket& s) {
+        return do_with(s.input(), [this] (input_stream<char>& in) {
+            return repeat([this, &in] {
+                return in.read().then([this] (temporary_buffer<char> buf) {
+                    _received += buf.size();
+                    _progress.broadcast();
+                    return buf.empty() ? stop_iteration::yes : stop_iteration::no;
+                });
+            }).finally([&in] {
+                return in.close();
+            });
+        });
+    }};
+    connected_socket _socket;
+    output_stream<char> _out;
+    temporary_buffer<char> _buffer;
+    uint64_t _sent = 0;
+    thread_cputime_clock::time_point _cpu_start;
+public:
+    records() : _buffer(Size) {
+        std::fill_n(_buffer.get_write(), Size, 'x');
+        auto creds = client_credentials(rsa_cert);
+        creds->enable_kernel_tls(Ktls);
+        _socket = tls::connect(creds, _addr, "test.scylladb.org").get0();
+        _out = _socket.output();
+        _cpu_start = thread_cputime_clock::now();
+    }
+    ~records() {
+        _out.flush().get();
+        _progress.wait([this] { return _received == _sent; }).get();
+        auto cpu = std::chrono::duration<double, std::milli>(thread_cputime_clock::now() - _cpu_start);
+        if (_sent) {
+            fmt::print("records{}_{}: {:.0f} ms CPU per GB\n", Ktls ? "_ktls" : "", Size, cpu.count() * (1 << 30) / _sent);
+        }
+        _out.close().get();
+    }
+
+    future<size_t> write() {
+        return _out.write(_buffer.get(), Size).then([this] {
+            _sent += Size;
+            if (_sent - _received <= window) {
+                return make_ready_future<size_t>(1);
+            }
+            return _out.flush().then([this] {
+                return _progress.wait([this] { return _sent - _received <= window; });
+            }).then([] {
+                return size_t(1);
+            });
+        });
+    }
+};
+
+}
+
+struct handshake_rsa : handshakes<false> {};
+struct handshake_ecdsa : handshakes<true> {};
+
+PERF_TEST_F(handshake_rsa, full) { return handshake(false); }
+PERF_TEST_F(handshake_rsa, resumed) { return handshake(true); }
+PERF_TEST_F(handshake_ecdsa, full) { return handshake(false); }
+PERF_TEST_F(handshake_ecdsa, resumed) { return handshake(true); }
+
+struct records_1k : records<1024, false> {};
+struct records_16k : records<16384, false> {};
+struct records_64k : records<65536, false> {};
+struct records_ktls_1k : records<1024, true> {};
+struct records_ktls_16k : records<16384, true> {};
+struct records_ktls_64k : records<65536, true> {};
+
+PERF_TEST_F(records_1k, write) { return write(); }
+PERF_TEST_F(records_16k, write) { return write(); }
+PERF_TEST_F(records_64k, write) { return write(); }
+PERF_TEST_F(records_ktls_1k, write) { return write(); }
+PERF_TEST_F(records_ktls_16k, write) { return write(); }
+PERF_TEST_F(records_ktls_64k, write) { return write(); }
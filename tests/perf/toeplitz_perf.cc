@@ -0,0 +1,58 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2024 ScyllaDB
+ */
+
+#include <seastar/testing/perf_tests.hh>
+#include <seastar/net/net.hh>
+#include <seastar/net/toeplitz.hh>
+
+using namespace seastar;
+
+struct toeplitz {
+    // The 4-tuples of IPv4 and IPv6 connections
+    net::forward_hash v4;
+    net::forward_hash v6;
+    uint8_t next = 0;
+
+    toeplitz() {
+        for (uint8_t i = 0; i < 12; i++) {
+            v4.push_back(uint8_t(i * 37));
+        }
+        for (uint8_t i = 0; i < 36; i++) {
+            v6.push_back(uint8_t(i * 37));
+        }
+    }
+};
+
+PERF_TEST_F(toeplitz, bitwise_ipv4) {
+    perf_tests::do_not_optimize(toeplitz_hash_bitwise(default_rsskey_40bytes, v4));
+}
+
+PERF_TEST_F(toeplitz, table_ipv4) {
+    perf_tests::do_not_optimize(toeplitz_hash(default_rsskey_40bytes, v4));
+}
+
+PERF_TEST_F(toeplitz, bitwise_ipv6) {
+    perf_tests::do_not_optimize(toeplitz_hash_bitwise(default_rsskey_40bytes, v6));
+}
+
+PERF_TEST_F(toeplitz, table_ipv6) {
+    perf_tests::do_not_optimize(toeplitz_hash(default_rsskey_40bytes, v6));
+}
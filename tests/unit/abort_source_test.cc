@@ -20,10 +20,14 @@
  */
 
 #include <seastar/testing/test_case.hh>
+#include <seastar/testing/thread_test_case.hh>
 
+#include <seastar/core/abort_on_expiry.hh>
 #include <seastar/core/gate.hh>
+#include <seastar/core/manual_clock.hh>
 #include <seastar/core/sleep.hh>
 #include <seastar/core/do_with.hh>
+#include <seastar/util/later.hh>
 
 using namespace seastar;
 using namespace std::chrono_literals;
@@ -62,6 +66,57 @@ SEASTAR_TEST_CASE(test_abort_source_rejects_subscription) {
     return make_ready_future<>();
 }
 
+SEASTAR_THREAD_TEST_CASE(test_abort_source_preemptible) {
+    abort_source as;
+    unsigned signalled = 0;
+    std::vector<optimized_optional<abort_source::subscription>> subs;
+    for (unsigned i = 0; i < 100000; i++) {
+        subs.push_back(as.subscribe([&signalled] () noexcept {
+            signalled++;
+        }));
+    }
+    // Gone before the abort, not called
+    subs.pop_back();
+    auto f = as.request_abort_preemptible();
+    BOOST_REQUIRE(as.abort_requested());
+    BOOST_REQUIRE(!as.subscribe([] () noexcept { }));
+    f.get();
+    BOOST_REQUIRE_EQUAL(signalled, 99999);
+    BOOST_REQUIRE(std::none_of(subs.begin(), subs.end(), [] (auto& s) { return bool(s); }));
+    // Once is enough
+    as.request_abort_preemptible().get();
+    as.request_abort();
+    BOOST_REQUIRE_EQUAL(signalled, 99999);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_abort_on_expiry_group) {
+    abort_source parent;
+    abort_on_expiry_group<manual_clock> group(10ms, &parent);
+    manual_clock::advance(10ms - manual_clock::now().time_since_epoch() % 10ms);
+    auto now = manual_clock::now();
+    auto as1 = group.get(now + 1ms);
+    auto as2 = group.get(now + 9ms);
+    auto as3 = group.get(now + 25ms);
+    // Rounded up to the same 10ms
+    BOOST_REQUIRE(as1 == as2);
+    BOOST_REQUIRE_EQUAL(group.pending(), 2);
+
+    manual_clock::advance(5ms);
+    yield().get();
+    BOOST_REQUIRE(!as1->abort_requested());
+
+    manual_clock::advance(10ms);
+    yield().get();
+    BOOST_REQUIRE(as1->abort_requested());
+    BOOST_REQUIRE(!as3->abort_requested());
+    BOOST_REQUIRE_EQUAL(group.pending(), 1);
+
+    parent.request_abort();
+    BOOST_REQUIRE(as3->abort_requested());
+    BOOST_REQUIRE_EQUAL(group.pending(), 0);
+    BOOST_REQUIRE(group.get(manual_clock::now() + 1s)->abort_requested());
+}
+
 SEASTAR_TEST_CASE(test_sleep_abortable) {
     auto as = std::make_unique<abort_source>();
     auto f = sleep_abortable(100s, *as).then_wrapped([] (auto&& f) {
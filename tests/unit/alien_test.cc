@@ -29,6 +29,7 @@
 #include <seastar/core/posix.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/util/later.hh>
+#include <poll.h>
 
 using namespace seastar;
 
@@ -73,6 +74,47 @@ int main(int argc, char** argv)
         for (auto& count : counts) {
             total += count.get();
         }
+        // many functions in one message
+        std::vector<std::function<future<int> ()>> funcs;
+        for (int i = 0; i < 1000; i++) {
+            funcs.push_back([i] {
+                return seastar::make_ready_future<int>(i);
+            });
+        }
+        auto values = alien::submit_batch(app.alien(), smp::count - 1, std::move(funcs)).get();
+        if (values.size() != 1000 || values[0] != 0 || values[999] != 999) {
+            return -EINVAL;
+        }
+        std::vector<std::function<void ()>> void_funcs(10, [] {});
+        alien::submit_batch(app.alien(), 0, std::move(void_funcs)).wait();
+        // results delivered through an eventfd, as to an event loop
+        alien::completion_queue cq;
+        int completed = 0;
+        for (auto i : boost::irange(0u, smp::count)) {
+            alien::submit_to(app.alien(), i, [i] {
+                return seastar::make_ready_future<int>(i);
+            }, cq, [&completed, i] (std::future<int> f) {
+                if (f.get() == int(i)) {
+                    ++completed;
+                }
+            });
+        }
+        alien::submit_to(app.alien(), 0, [] {
+            return seastar::make_exception_future<>(std::runtime_error("expected"));
+        }, cq, [&completed] (std::future<void> f) {
+            try {
+                f.get();
+            } catch (std::runtime_error&) {
+                ++completed;
+            }
+        });
+        while (completed != int(smp::count) + 1) {
+            pollfd pfd = { cq.fd(), POLLIN, 0 };
+            if (::poll(&pfd, 1, -1) < 0) {
+                return -EINVAL;
+            }
+            cq.poll();
+        }
         // i am done. dismiss the engine
         ::eventfd_write(alien_done, ALIEN_DONE);
         return total;
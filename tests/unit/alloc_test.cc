@@ -23,7 +23,10 @@
 #include <seastar/core/memory.hh>
 #include <seastar/core/smp.hh>
 #include <seastar/core/temporary_buffer.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/sleep.hh>
 #include <seastar/util/memory_diagnostics.hh>
+#include <seastar/util/later.hh>
 
 #include <vector>
 #include <future>
@@ -115,6 +118,27 @@ SEASTAR_TEST_CASE(test_memory_diagnostics) {
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(test_fragmentation_report) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    auto obj = std::make_unique<char[]>(100);
+    auto report = memory::get_fragmentation_report();
+    BOOST_REQUIRE_GT(report.free_memory, 0u);
+    BOOST_REQUIRE_GT(report.largest_free_span, 0u);
+    BOOST_REQUIRE_LE(report.largest_free_span, report.free_memory);
+    size_t in_spans = 0;
+    for (unsigned i = 0; i < report.free_spans.size(); i++) {
+        in_spans += report.free_spans[i] * (memory::page_size << i);
+    }
+    BOOST_REQUIRE_LE(in_spans, report.free_memory);
+    BOOST_REQUIRE_GE(in_spans, report.largest_free_span);
+    BOOST_REQUIRE(!report.small_pools.empty());
+    for (auto& sp : report.small_pools) {
+        BOOST_REQUIRE_LE(sp.used_objects * sp.object_size + sp.unused_memory, sp.memory);
+    }
+#endif
+    return make_ready_future<>();
+}
+
 #ifndef SEASTAR_DEFAULT_ALLOCATOR
 
 struct thread_alloc_info {
@@ -176,3 +200,65 @@ SEASTAR_TEST_CASE(test_foreign_function_use_glibc_malloc) {
     return make_ready_future<>();
 }
 #endif
+
+SEASTAR_TEST_CASE(test_huge_page_layout) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    auto before = memory::get_huge_page_layout();
+    BOOST_REQUIRE(before.total > 0);
+    BOOST_REQUIRE_EQUAL(before.unused + before.partial + before.full, before.total);
+
+    // A huge page sized allocation takes a whole, aligned, region
+    auto obj = std::make_unique<char[]>(memory::huge_page_size);
+    BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(obj.get()) % memory::huge_page_size, 0);
+    auto after = memory::get_huge_page_layout();
+    BOOST_REQUIRE_EQUAL(after.unused + after.partial + after.full, after.total);
+    BOOST_REQUIRE_GE(after.full, before.full + 1);
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_background_reclaim) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    auto calls = std::make_unique<unsigned>(0);
+    auto r = std::make_unique<memory::reclaimer>([&calls = *calls] {
+        ++calls;
+        return memory::reclaiming_result::reclaimed_nothing;
+    }, memory::reclaimer_scope::async);
+    // Above the current free memory, so background reclaim starts right away,
+    // but doesn't run synchronously
+    memory::set_background_reclaim_free_pages((memory::free_memory() + (64 << 20)) / memory::page_size);
+    BOOST_REQUIRE_EQUAL(*calls, 0u);
+    // The reclaim runs in a scheduling group of its own, give it a chance to
+    return do_until([c = calls.get(), i = 0] () mutable { return *c || ++i > 1000; }, [] {
+        return sleep(std::chrono::milliseconds(1));
+    }).then([calls = std::move(calls), r = std::move(r)] {
+        memory::set_background_reclaim_free_pages(0);
+        BOOST_REQUIRE_GE(*calls, 1u);
+    });
+#else
+    return make_ready_future<>();
+#endif
+}
+
+SEASTAR_TEST_CASE(test_large_span_cache) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    memory::set_background_reclaim_free_pages(0);
+    auto free_before = memory::free_memory();
+    auto p = std::make_unique<char[]>(200 << 10);
+    auto addr = p.get();
+    p.reset();
+    // Freed memory stays free, cached or not
+    BOOST_REQUIRE_EQUAL(memory::free_memory(), free_before);
+
+    // The next allocation of the same size reuses the span
+    auto hits = memory::stats().large_span_cache_hits();
+    auto cached = memory::stats().large_span_cache_memory();
+    p = std::make_unique<char[]>(150 << 10);
+    if (cached) {
+        BOOST_REQUIRE_EQUAL(memory::stats().large_span_cache_hits(), hits + 1);
+        BOOST_REQUIRE_EQUAL(p.get(), addr);
+        BOOST_REQUIRE_EQUAL(memory::stats().large_span_cache_memory(), cached - (256 << 10));
+    }
+#endif
+    return make_ready_future<>();
+}
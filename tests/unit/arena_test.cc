@@ -0,0 +1,98 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/core/arena.hh>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace seastar;
+
+BOOST_AUTO_TEST_CASE(test_arena_alignment) {
+    arena a(64);
+    for (size_t align : {1, 2, 8, 16, 64, 4096}) {
+        for (size_t size : {1, 7, 100, 5000}) {
+            auto p = a.allocate(size, align);
+            BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(p) % align, 0u);
+            std::memset(p, 0xaa, size);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_distinct_allocations) {
+    arena a(128);
+    std::vector<uint64_t*> ptrs;
+    for (uint64_t i = 0; i < 10000; ++i) {
+        auto p = static_cast<uint64_t*>(a.allocate(sizeof(uint64_t) * (1 + i % 7)));
+        *p = i;
+        ptrs.push_back(p);
+    }
+    for (uint64_t i = 0; i < ptrs.size(); ++i) {
+        BOOST_REQUIRE_EQUAL(*ptrs[i], i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_reset_reuses_memory) {
+    arena a(256);
+    auto fill = [&a] {
+        for (int i = 0; i < 1000; ++i) {
+            (void)a.allocate(32);
+        }
+        (void)a.allocate(1 << 20); // gets its own chunk
+    };
+    fill();
+    auto reserved = a.reserved_memory();
+    BOOST_REQUIRE_GE(reserved, 32000u + (1 << 20));
+    a.reset();
+    BOOST_REQUIRE_LT(a.reserved_memory(), reserved);
+    auto kept = a.reserved_memory();
+    // The chunk kept is large enough for the small allocations of another round
+    for (size_t i = 0; i < 1000 && 32 * (i + 1) < kept / 2; ++i) {
+        (void)a.allocate(32);
+        BOOST_REQUIRE_EQUAL(a.reserved_memory(), kept);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_pmr_container) {
+    arena a;
+    std::pmr::vector<std::pmr::string> v(&a);
+    for (int i = 0; i < 1000; ++i) {
+        v.emplace_back(std::string(i % 50, 'x'));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_REQUIRE_EQUAL(v[i].size(), size_t(i % 50));
+    }
+    BOOST_REQUIRE(v.get_allocator().resource() == &a);
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_move) {
+    arena a;
+    auto p = static_cast<int*>(a.allocate(sizeof(int)));
+    *p = 42;
+    arena b(std::move(a));
+    BOOST_REQUIRE_EQUAL(a.reserved_memory(), 0u);
+    BOOST_REQUIRE_EQUAL(*p, 42);
+    BOOST_REQUIRE(b.reserved_memory() > 0);
+}
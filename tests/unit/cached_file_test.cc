@@ -0,0 +1,129 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/cached_file.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/core/when_all.hh>
+#include <seastar/util/tmp_file.hh>
+#include <seastar/util/closeable.hh>
+
+using namespace seastar;
+
+static constexpr size_t block_size = 4096;
+
+static file open_with_contents(sstring name, size_t size) {
+    auto f = open_file_dma(name, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto buf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), align_up(size, block_size));
+    for (size_t i = 0; i < buf.size(); i++) {
+        buf.get_write()[i] = char(i / block_size + i);
+    }
+    f.dma_write(0, buf.get(), buf.size()).get();
+    f.truncate(size).get();
+    return f;
+}
+
+SEASTAR_THREAD_TEST_CASE(test_cached_file_reads) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        block_cache cache(16 * block_size, block_size);
+        auto size = 3 * block_size + 100;
+        auto f = make_cached_file(open_with_contents((t.get_path() / "testfile").native(), size), cache);
+        auto close_f = deferred_close(f);
+
+        auto buf = f.dma_read_exactly<char>(0, size).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), size);
+        for (size_t i = 0; i < size; i++) {
+            BOOST_REQUIRE_EQUAL(buf[i], char(i / block_size + i));
+        }
+        BOOST_REQUIRE_EQUAL(cache.get_stats().misses, 4);
+        BOOST_REQUIRE_EQUAL(cache.get_stats().hits, 0);
+
+        // Unaligned read within a block comes from the cache
+        auto part = f.dma_read_bulk<char>(block_size + 10, 20).get0();
+        BOOST_REQUIRE_EQUAL(part.size(), 20);
+        BOOST_REQUIRE_EQUAL(part[0], char(1 + block_size + 10));
+        BOOST_REQUIRE_EQUAL(cache.get_stats().misses, 4);
+        BOOST_REQUIRE_EQUAL(cache.get_stats().hits, 1);
+
+        // Reads past the end are short
+        auto tail = f.dma_read_bulk<char>(3 * block_size, block_size).get0();
+        BOOST_REQUIRE_EQUAL(tail.size(), 100);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_cached_file_concurrent_reads_share_io) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        block_cache cache(16 * block_size, block_size);
+        auto f = make_cached_file(open_with_contents((t.get_path() / "testfile").native(), block_size), cache);
+        auto close_f = deferred_close(f);
+
+        auto r1 = f.dma_read_bulk<char>(0, block_size);
+        auto r2 = f.dma_read_bulk<char>(0, block_size);
+        auto b1 = r1.get0();
+        auto b2 = r2.get0();
+        BOOST_REQUIRE(b1 == b2);
+        BOOST_REQUIRE_EQUAL(cache.get_stats().misses, 1);
+        BOOST_REQUIRE_EQUAL(cache.get_stats().hits, 1);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_cached_file_write_invalidates) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        block_cache cache(16 * block_size, block_size);
+        auto f = make_cached_file(open_with_contents((t.get_path() / "testfile").native(), 2 * block_size), cache);
+        auto close_f = deferred_close(f);
+
+        f.dma_read_exactly<char>(0, 2 * block_size).get();
+        BOOST_REQUIRE_EQUAL(cache.used(), 2 * block_size);
+
+        auto wbuf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), block_size);
+        std::fill_n(wbuf.get_write(), block_size, 'x');
+        f.dma_write(block_size, wbuf.get(), block_size).get();
+        BOOST_REQUIRE_EQUAL(cache.used(), block_size);
+
+        auto buf = f.dma_read_exactly<char>(block_size, block_size).get0();
+        BOOST_REQUIRE(buf == wbuf);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_block_cache_evicts_lru) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        block_cache cache(2 * block_size, block_size);
+        auto f = make_cached_file(open_with_contents((t.get_path() / "testfile").native(), 3 * block_size), cache);
+        auto close_f = deferred_close(f);
+
+        f.dma_read_bulk<char>(0, block_size).get();
+        f.dma_read_bulk<char>(block_size, block_size).get();
+        f.dma_read_bulk<char>(0, block_size).get();
+        f.dma_read_bulk<char>(2 * block_size, block_size).get();
+        BOOST_REQUIRE_EQUAL(cache.get_stats().evictions, 1);
+        BOOST_REQUIRE_EQUAL(cache.used(), 2 * block_size);
+
+        // Block 0 was used more recently than block 1, so it's still cached
+        auto misses = cache.get_stats().misses;
+        f.dma_read_bulk<char>(0, block_size).get();
+        BOOST_REQUIRE_EQUAL(cache.get_stats().misses, misses);
+        f.dma_read_bulk<char>(block_size, block_size).get();
+        BOOST_REQUIRE_EQUAL(cache.get_stats().misses, misses + 1);
+    }).get();
+}
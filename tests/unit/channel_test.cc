@@ -0,0 +1,106 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/channel.hh>
+#include <seastar/core/thread.hh>
+#include <seastar/core/when_all.hh>
+
+using namespace seastar;
+
+static shard_id other_shard() {
+    return (this_shard_id() + 1) % smp::count;
+}
+
+SEASTAR_THREAD_TEST_CASE(test_channel_passes_items_in_order) {
+    const int nr_items = 10000;
+    channel<int> ch(this_shard_id(), other_shard(), 16);
+
+    auto consumer = smp::submit_to(other_shard(), [&ch] {
+        return seastar::async([&ch] {
+            auto rx = ch.get_receiver();
+            int expected = 0;
+            while (auto item = rx.pop().get0()) {
+                BOOST_REQUIRE_EQUAL(*item, expected++);
+            }
+            rx.close().get();
+            return expected;
+        });
+    });
+
+    auto tx = ch.get_sender();
+    for (int i = 0; i < nr_items; i++) {
+        tx.push(i).get();
+    }
+    tx.close().get();
+    BOOST_REQUIRE_EQUAL(consumer.get0(), nr_items);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_channel_backpressure) {
+    const size_t capacity = 8;
+    channel<int> ch(this_shard_id(), other_shard(), capacity);
+    auto tx = ch.get_sender();
+
+    // Nothing pops, so the channel fills up
+    std::vector<future<>> pushes;
+    for (size_t i = 0; i < capacity + 1; i++) {
+        pushes.emplace_back(tx.push(i));
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        BOOST_REQUIRE(pushes[i].available());
+    }
+    BOOST_REQUIRE(!pushes[capacity].available());
+
+    smp::submit_to(other_shard(), [&ch] {
+        return seastar::async([&ch] {
+            auto rx = ch.get_receiver();
+            for (size_t i = 0; i < capacity + 1; i++) {
+                BOOST_REQUIRE_EQUAL(*rx.pop().get0(), int(i));
+            }
+        });
+    }).get();
+    when_all_succeed(pushes.begin(), pushes.end()).get();
+
+    tx.close().get();
+    smp::submit_to(other_shard(), [&ch] {
+        return seastar::async([&ch] {
+            auto rx = ch.get_receiver();
+            BOOST_REQUIRE(!rx.pop().get0());
+            rx.close().get();
+        });
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_channel_receiver_closed) {
+    channel<int> ch(this_shard_id(), other_shard(), 1);
+    auto tx = ch.get_sender();
+
+    tx.push(0).get();
+    auto blocked = tx.push(1);
+    BOOST_REQUIRE(!blocked.available());
+
+    smp::submit_to(other_shard(), [&ch] {
+        return ch.get_receiver().close();
+    }).get();
+    BOOST_REQUIRE_THROW(blocked.get(), broken_channel);
+    BOOST_REQUIRE_THROW(tx.push(2).get(), broken_channel);
+    tx.close().get();
+}
@@ -0,0 +1,142 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/checksummed_file.hh>
+#include <seastar/core/fstream.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/util/crc32c.hh>
+#include <seastar/util/tmp_file.hh>
+#include <seastar/util/closeable.hh>
+#include "layered_file_test.hh"
+
+using namespace seastar;
+
+static constexpr size_t block_size = 4096;
+
+static file open_checksummed(const tmp_dir& t) {
+    auto flags = open_flags::rw | open_flags::create;
+    auto data = open_file_dma((t.get_path() / "data").native(), flags).get0();
+    auto checksums = open_file_dma((t.get_path() / "checksums").native(), flags).get0();
+    return make_checksummed_file(std::move(data), std::move(checksums)).get0();
+}
+
+SEASTAR_TEST_CASE(test_crc32c) {
+    const char* s = "123456789";
+    BOOST_REQUIRE_EQUAL(crc32c(0, s, 9), 0xe3069283);
+    BOOST_REQUIRE_EQUAL(crc32c(crc32c(0, s, 4), s + 4, 5), 0xe3069283);
+    char dst[9];
+    BOOST_REQUIRE_EQUAL(crc32c_copy(0, dst, s, 9), 0xe3069283);
+    BOOST_REQUIRE(std::equal(dst, dst + 9, s));
+    return make_ready_future<>();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_checksummed_file_round_trip) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto size = 10 * block_size + 100;
+        auto checksum = write_data(open_checksummed(t), size);
+        auto buf = make_data(0, size);
+        BOOST_REQUIRE_EQUAL(checksum, crc32c(0, buf.data(), buf.size()));
+
+        auto f = open_checksummed(t);
+        auto close_f = deferred_close(f);
+        check_data(f, size, block_size);
+        // Unaligned reads across blocks
+        auto part = f.dma_read_bulk<char>(block_size - 10, 20).get0();
+        BOOST_REQUIRE_EQUAL(part.size(), 20);
+        for (size_t i = 0; i < part.size(); i++) {
+            BOOST_REQUIRE_EQUAL(part[i], data_at(block_size - 10 + i));
+        }
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_checksummed_file_detects_corruption) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto size = 4 * block_size;
+        write_data(open_checksummed(t), size);
+        {
+            auto raw = open_file_dma((t.get_path() / "data").native(), open_flags::rw).get0();
+            auto close_raw = deferred_close(raw);
+            auto buf = raw.dma_read_exactly<char>(2 * block_size, block_size).get0();
+            buf.get_write()[17] ^= 1;
+            raw.dma_write(2 * block_size, buf.get(), buf.size()).get();
+        }
+
+        auto f = open_checksummed(t);
+        auto close_f = deferred_close(f);
+        // Only the blocks read are verified
+        auto good = f.dma_read_bulk<char>(0, 2 * block_size).get0();
+        BOOST_REQUIRE_EQUAL(good.size(), 2 * block_size);
+        try {
+            f.dma_read_bulk<char>(block_size + 100, 2 * block_size).get();
+            BOOST_FAIL("the corruption went unnoticed");
+        } catch (checksum_error& e) {
+            BOOST_REQUIRE_EQUAL(e.position(), 2 * block_size);
+        }
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_checksummed_file_truncate) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        write_data(open_checksummed(t), 5 * block_size);
+        auto size = 2 * block_size + 123;
+        {
+            auto f = open_checksummed(t);
+            auto close_f = deferred_close(f);
+            // Into a full block, which becomes the partial one
+            f.truncate(size).get();
+            check_data(f, size, block_size);
+
+            // Extending fills with zeroes
+            f.truncate(size + block_size).get();
+            auto buf = f.dma_read_bulk<char>(size, block_size).get0();
+            BOOST_REQUIRE_EQUAL(buf.size(), block_size);
+            BOOST_REQUIRE(std::all_of(buf.begin(), buf.end(), [] (char c) { return c == 0; }));
+            f.truncate(size).get();
+        }
+
+        auto f = open_checksummed(t);
+        auto close_f = deferred_close(f);
+        check_data(f, size, block_size);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_checksummed_file_rejects_unaligned_writes) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        write_data(open_checksummed(t), 2 * block_size + 10);
+        auto f = open_checksummed(t);
+        auto close_f = deferred_close(f);
+
+        auto buf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), block_size);
+        std::fill(buf.get_write(), buf.get_write() + buf.size(), 'x');
+        BOOST_REQUIRE_THROW(f.dma_write(10, buf.get(), buf.size()).get(), std::system_error);
+        BOOST_REQUIRE_THROW(f.dma_write(0, buf.get(), 10).get(), std::system_error);
+        // The last block, partial or not, can be rewritten
+        BOOST_REQUIRE_EQUAL(f.dma_write(2 * block_size, buf.get(), buf.size()).get0(), buf.size());
+        BOOST_REQUIRE_EQUAL(f.size().get0(), 3 * block_size);
+        BOOST_REQUIRE_EQUAL(f.dma_write(block_size, buf.get(), buf.size()).get0(), buf.size());
+        auto back = f.dma_read_bulk<char>(block_size, block_size).get0();
+        BOOST_REQUIRE(std::equal(back.begin(), back.end(), buf.begin()));
+    }).get();
+}
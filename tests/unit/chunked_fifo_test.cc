@@ -356,3 +356,38 @@ BOOST_AUTO_TEST_CASE(chunked_fifo_iterator) {
         BOOST_REQUIRE(std::equal(fifo.begin(), fifo.end(), reference.begin(), reference.end()));
     }
 }
+
+template <typename T, typename Make>
+static void check_bulk_operations(Make make) {
+    constexpr auto items_per_chunk = 8;
+    auto fifo = chunked_fifo<T, items_per_chunk>{};
+    std::deque<T> reference;
+    unsigned seed = 1;
+
+    for (unsigned i = 0; i < 1000; ++i) {
+        std::vector<T> in;
+        for (unsigned n = rand_r(&seed) % 30; n; --n) {
+            in.push_back(make(i * 100 + n));
+        }
+        fifo.append(in.data(), in.data() + in.size());
+        reference.insert(reference.end(), in.begin(), in.end());
+        BOOST_REQUIRE_EQUAL(fifo.size(), reference.size());
+
+        auto n = std::min<size_t>(rand_r(&seed) % 30, fifo.size());
+        if (i % 2) {
+            std::vector<T> out(n);
+            BOOST_REQUIRE(fifo.pop_front_n(n, out.data()) == out.data() + n);
+            BOOST_REQUIRE(std::equal(out.begin(), out.end(), reference.begin()));
+        } else {
+            fifo.pop_front_n(n);
+        }
+        reference.erase(reference.begin(), reference.begin() + n);
+        BOOST_REQUIRE_EQUAL(fifo.size(), reference.size());
+        BOOST_REQUIRE(std::equal(fifo.begin(), fifo.end(), reference.begin(), reference.end()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(chunked_fifo_bulk_operations) {
+    check_bulk_operations<int>([] (int i) { return i; });
+    check_bulk_operations<std::string>([] (int i) { return std::string(30, 'a' + i % 26); });
+}
@@ -177,3 +177,53 @@ BOOST_AUTO_TEST_CASE(test_underflow_index_iterator_comparison) {
         buf.erase(buf.begin() + offset, buf.begin() + std::min(size_t(offset + erase_count), buf.size()));
     }
 }
+
+template <typename T, typename Make>
+static void check_bulk_operations(Make make) {
+    circular_buffer<T> buf;
+    std::deque<T> reference;
+    auto rnd_engine = std::mt19937(1);
+    std::uniform_int_distribution<unsigned> count_dist(0, 40);
+
+    for (unsigned i = 0; i < 1000; ++i) {
+        std::vector<T> in;
+        for (unsigned n = count_dist(rnd_engine); n; --n) {
+            in.push_back(make(i * 100 + n));
+        }
+        buf.append(in.data(), in.data() + in.size());
+        reference.insert(reference.end(), in.begin(), in.end());
+
+        auto n = std::min<size_t>(count_dist(rnd_engine), buf.size());
+        if (i % 2) {
+            std::vector<T> out(n);
+            BOOST_REQUIRE(buf.pop_front_n(n, out.data()) == out.data() + n);
+            BOOST_REQUIRE(std::equal(out.begin(), out.end(), reference.begin()));
+        } else {
+            buf.pop_front_n(n);
+        }
+        reference.erase(reference.begin(), reference.begin() + n);
+        BOOST_REQUIRE(std::equal(buf.begin(), buf.end(), reference.begin(), reference.end()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_bulk_operations) {
+    check_bulk_operations<int>([] (int i) { return i; });
+    check_bulk_operations<std::string>([] (int i) { return std::string(30, 'a' + i % 26); });
+}
+
+BOOST_AUTO_TEST_CASE(test_shrink_to_fit) {
+    circular_buffer<int> buf;
+    for (int i = 0; i < 1000; ++i) {
+        buf.push_back(i);
+    }
+    BOOST_REQUIRE_EQUAL(buf.capacity(), 1024u);
+    buf.pop_front_n(990);
+    buf.shrink_to_fit();
+    BOOST_REQUIRE_EQUAL(buf.capacity(), 16u);
+    for (int i = 0; i < 10; ++i) {
+        BOOST_REQUIRE_EQUAL(buf[i], 990 + i);
+    }
+    buf.clear();
+    buf.shrink_to_fit();
+    BOOST_REQUIRE_EQUAL(buf.capacity(), 0u);
+}
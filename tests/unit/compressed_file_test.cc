@@ -0,0 +1,139 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/compressed_file.hh>
+#include <seastar/core/fstream.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/util/tmp_file.hh>
+#include <seastar/util/closeable.hh>
+#include "layered_file_test.hh"
+
+using namespace seastar;
+
+static constexpr size_t chunk_size = 4096;
+
+static file open_compressed(sstring name, compressed_file_options opts = {}) {
+    opts.chunk_size = chunk_size;
+    auto f = open_file_dma(name, open_flags::rw | open_flags::create).get0();
+    return make_compressed_file(std::move(f), opts).get0();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_compressed_file_round_trip) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        auto size = 10 * chunk_size + 100;
+        write_data(open_compressed(name), size);
+
+        auto f = open_compressed(name);
+        auto close_f = deferred_close(f);
+        check_data(f, size, chunk_size);
+        // Unaligned reads across chunks
+        auto part = f.dma_read_bulk<char>(chunk_size - 10, 20).get0();
+        BOOST_REQUIRE_EQUAL(part.size(), 20);
+        for (size_t i = 0; i < part.size(); i++) {
+            BOOST_REQUIRE_EQUAL(part[i], data_at(chunk_size - 10 + i));
+        }
+
+        auto raw = open_file_dma(name, open_flags::ro).get0();
+        auto close_raw = deferred_close(raw);
+        BOOST_REQUIRE_LT(raw.size().get0(), size);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_compressed_file_append_after_reopen) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        compressed_file_options opts;
+        opts.algorithm = compressed_file_algorithm::zstd;
+        auto size = 3 * chunk_size + 1000;
+        write_data(open_compressed(name, opts), size);
+        {
+            // The partial chunk is taken up again, and more is appended;
+            // the file keeps its algorithm
+            auto f = open_compressed(name);
+            auto close_f = deferred_close(f);
+            check_data(f, size, chunk_size);
+            auto more = 2 * chunk_size;
+            auto buf = make_data(size, size + more);
+            BOOST_REQUIRE_EQUAL(f.dma_write(size, buf.data(), buf.size()).get0(), buf.size());
+            size += more;
+            f.flush().get();
+            check_data(f, size, chunk_size);
+        }
+
+        auto f = open_compressed(name);
+        auto close_f = deferred_close(f);
+        check_data(f, size, chunk_size);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_compressed_file_truncate) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        write_data(open_compressed(name), 5 * chunk_size);
+        auto f = open_compressed(name);
+        auto close_f = deferred_close(f);
+
+        // Into a full chunk, which becomes the partial one
+        auto size = 2 * chunk_size + 123;
+        f.truncate(size).get();
+        check_data(f, size, chunk_size);
+
+        // Extending fills with zeroes
+        f.truncate(size + chunk_size).get();
+        auto buf = f.dma_read_bulk<char>(size, chunk_size).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), chunk_size);
+        BOOST_REQUIRE(std::all_of(buf.begin(), buf.end(), [] (char c) { return c == 0; }));
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_compressed_file_rejects_overwrites) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        write_data(open_compressed(name), 2 * chunk_size + 10);
+        auto f = open_compressed(name);
+        auto close_f = deferred_close(f);
+
+        char c = 'x';
+        BOOST_REQUIRE_THROW(f.dma_write(0, &c, 1).get(), std::system_error);
+        BOOST_REQUIRE_THROW(f.dma_write(3 * chunk_size, &c, 1).get(), std::system_error);
+        // The partial chunk can be rewritten
+        BOOST_REQUIRE_EQUAL(f.dma_write(2 * chunk_size, &c, 1).get0(), 1);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_compressed_file_rejects_garbage) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        {
+            auto f = open_file_dma(name, open_flags::rw | open_flags::create).get0();
+            auto close_f = deferred_close(f);
+            auto buf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), 4096);
+            std::fill(buf.get_write(), buf.get_write() + buf.size(), 'x');
+            f.dma_write(0, buf.get(), buf.size()).get();
+        }
+        auto f = open_file_dma(name, open_flags::rw).get0();
+        BOOST_REQUIRE_THROW(make_compressed_file(std::move(f)).get(), std::runtime_error);
+    }).get();
+}
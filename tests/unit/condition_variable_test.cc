@@ -222,6 +222,49 @@ SEASTAR_THREAD_TEST_CASE(test_condition_variable_has_waiter) {
     BOOST_REQUIRE_EQUAL(cv.has_waiters(), false);
 }
 
+SEASTAR_THREAD_TEST_CASE(test_condition_variable_batched_broadcast) {
+    condition_variable cv;
+
+    // More than a batch, so that broadcast() leaves some to its task
+    std::vector<future<>> waiters;
+    for (int i = 0; i < 1000; i++) {
+        waiters.emplace_back(cv.wait());
+    }
+
+    cv.broadcast();
+    // Not woken by the broadcast, which was before it started waiting
+    auto late = cv.wait();
+    when_all_succeed(waiters.begin(), waiters.end()).get();
+    BOOST_REQUIRE(!late.available());
+    BOOST_REQUIRE_EQUAL(cv.has_waiters(), true);
+
+    cv.signal();
+    late.get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_condition_variable_broken_during_broadcast) {
+    auto cv = std::make_unique<condition_variable>();
+
+    std::vector<future<>> waiters;
+    for (int i = 0; i < 1000; i++) {
+        waiters.emplace_back(cv->wait());
+    }
+
+    cv->broadcast();
+    cv.reset();
+    unsigned broken = 0;
+    for (auto& f : waiters) {
+        try {
+            f.get();
+        } catch (broken_condition_variable&) {
+            broken++;
+        }
+    }
+    // The first batch was woken by broadcast(), the rest by the destructor
+    BOOST_REQUIRE_GT(broken, 0u);
+    BOOST_REQUIRE_LT(broken, waiters.size());
+}
+
 #ifdef SEASTAR_COROUTINES_ENABLED
 
 SEASTAR_TEST_CASE(test_condition_variable_signal_consume_coroutine) {
@@ -45,6 +45,7 @@ SEASTAR_TEST_CASE(test_coroutines_not_compiled_in) {
 #include <seastar/coroutine/maybe_yield.hh>
 #include <seastar/coroutine/switch_to.hh>
 #include <seastar/coroutine/parallel_for_each.hh>
+#include <seastar/coroutine/generator.hh>
 
 namespace {
 
@@ -582,4 +583,88 @@ SEASTAR_TEST_CASE(test_parallel_for_each) {
 #endif
 }
 
+namespace {
+
+coroutine::generator<int, 4> count_to(int n) {
+    for (int i = 0; i < n; ++i) {
+        co_yield i;
+    }
+}
+
+coroutine::generator<int, 4> count_slowly_to(int n) {
+    for (int i = 0; i < n; ++i) {
+        if (i % 3 == 0) {
+            co_await yield();
+        }
+        co_yield i;
+    }
+}
+
+coroutine::generator<int, 4> count_then_throw(int n) {
+    for (int i = 0; i < n; ++i) {
+        co_yield i;
+    }
+    throw std::runtime_error("generator failed");
+}
+
+coroutine::generator<int, 4> count_with_pause(int n, future<>& pause) {
+    for (int i = 0; i < n; ++i) {
+        if (i == 2) {
+            co_await std::move(pause);
+        }
+        co_yield i;
+    }
+}
+
+}
+
+SEASTAR_TEST_CASE(test_generator) {
+    int sum = 0;
+    auto gen = count_to(100);
+    while (auto v = co_await gen()) {
+        sum += *v;
+    }
+    BOOST_REQUIRE_EQUAL(sum, 4950);
+    BOOST_REQUIRE(!co_await gen());
+
+    sum = 0;
+    auto slow = count_slowly_to(100);
+    while (auto v = co_await slow()) {
+        sum += *v;
+    }
+    BOOST_REQUIRE_EQUAL(sum, 4950);
+}
+
+SEASTAR_TEST_CASE(test_generator_exception) {
+    auto gen = count_then_throw(10);
+    int seen = 0;
+    try {
+        while (co_await gen()) {
+            ++seen;
+        }
+        BOOST_FAIL("exception expected");
+    } catch (const std::runtime_error&) {
+    }
+    BOOST_REQUIRE_EQUAL(seen, 10);
+}
+
+SEASTAR_TEST_CASE(test_generator_early_destruction) {
+    {
+        auto gen = count_to(100);
+        BOOST_REQUIRE_EQUAL(*co_await gen(), 0);
+    }
+
+    // Destroyed while the producer waits for a future: the elements it
+    // yielded before that are still delivered
+    promise<> pr;
+    auto pause = pr.get_future();
+    {
+        auto gen = count_with_pause(100, pause);
+        BOOST_REQUIRE_EQUAL(*co_await gen(), 0);
+        BOOST_REQUIRE_EQUAL(*co_await gen(), 1);
+    }
+    pr.set_value();
+    co_await yield();
+}
+
 #endif
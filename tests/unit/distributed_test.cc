@@ -30,6 +30,9 @@
 #include <seastar/core/print.hh>
 #include <seastar/util/defer.hh>
 #include <seastar/util/closeable.hh>
+#include <boost/range/irange.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <algorithm>
 #include <mutex>
 
 using namespace seastar;
@@ -131,6 +134,36 @@ SEASTAR_TEST_CASE(test_map_reduce) {
     });
 }
 
+SEASTAR_TEST_CASE(test_map_reduce0_tree) {
+    return do_with_distributed<X>([] (distributed<X>& x) {
+        return x.start().then([&x] {
+            return x.map_reduce0_tree(std::mem_fn(&X::cpu_id_squared),
+                                      0,
+                                      std::plus<int>()).then([] (int result) {
+                int n = smp::count - 1;
+                if (result != (n * (n + 1) * (2*n + 1)) / 6) {
+                    throw std::runtime_error("map_reduce0_tree failed");
+                }
+            });
+        }).then([&x] {
+            // Every shard's result is reduced exactly once, whichever shard calls
+            return smp::submit_to(smp::count - 1, [&x] {
+                return x.map_reduce0_tree([] (X&) {
+                    return make_ready_future<std::vector<unsigned>>(std::vector<unsigned>{this_shard_id()});
+                }, std::vector<unsigned>(), [] (std::vector<unsigned> a, std::vector<unsigned> b) {
+                    a.insert(a.end(), b.begin(), b.end());
+                    return a;
+                }).then([] (std::vector<unsigned> shards) {
+                    std::sort(shards.begin(), shards.end());
+                    if (shards != boost::copy_range<std::vector<unsigned>>(boost::irange(0u, smp::count))) {
+                        throw std::runtime_error("map_reduce0_tree failed");
+                    }
+                });
+            });
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_async) {
     return do_with_distributed<async_service>([] (distributed<async_service>& x) {
         return x.start().then([&x] {
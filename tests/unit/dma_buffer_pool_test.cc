@@ -0,0 +1,82 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/core/dma_buffer_pool.hh>
+
+using namespace seastar;
+
+static bool aligned_to(const void* p, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+}
+
+SEASTAR_TEST_CASE(test_dma_buffer_pool_reuse) {
+    auto before = get_dma_buffer_pool_stats();
+    const char* first;
+    {
+        auto buf = allocate_dma_buffer(512, 5000);
+        BOOST_REQUIRE_EQUAL(buf.size(), 5000);
+        BOOST_REQUIRE(aligned_to(buf.get(), 4096));
+        first = buf.get();
+    }
+    auto stats = get_dma_buffer_pool_stats();
+    BOOST_REQUIRE_GE(stats.cached_bytes, 8192);
+
+    // Same size class
+    auto buf = allocate_dma_buffer<uint8_t>(4096, 8192);
+    BOOST_REQUIRE_EQUAL(buf.size(), 8192);
+    BOOST_REQUIRE_EQUAL(reinterpret_cast<const char*>(buf.get()), first);
+    stats = get_dma_buffer_pool_stats();
+    BOOST_REQUIRE_EQUAL(stats.hits, before.hits + 1);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_dma_buffer_pool_bypass) {
+    auto before = get_dma_buffer_pool_stats();
+    {
+        auto buf = allocate_dma_buffer(4096, 4 << 20);
+        BOOST_REQUIRE_EQUAL(buf.size(), 4 << 20);
+        BOOST_REQUIRE(aligned_to(buf.get(), 4096));
+        auto aligned = allocate_dma_buffer(1 << 16, 4096);
+        BOOST_REQUIRE(aligned_to(aligned.get(), 1 << 16));
+    }
+    auto stats = get_dma_buffer_pool_stats();
+    BOOST_REQUIRE_EQUAL(stats.bypasses, before.bypasses + 2);
+    BOOST_REQUIRE_EQUAL(stats.cached_bytes, before.cached_bytes);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_dma_buffer_pool_capacity) {
+    set_dma_buffer_pool_capacity(0);
+    BOOST_REQUIRE_EQUAL(get_dma_buffer_pool_stats().cached_bytes, 0);
+    allocate_dma_buffer(4096, 4096);
+    BOOST_REQUIRE_EQUAL(get_dma_buffer_pool_stats().cached_bytes, 0);
+
+    set_dma_buffer_pool_capacity(16384);
+    {
+        auto a = allocate_dma_buffer(4096, 16384);
+        auto b = allocate_dma_buffer(4096, 16384);
+    }
+    // Only one of them fits
+    BOOST_REQUIRE_EQUAL(get_dma_buffer_pool_stats().cached_bytes, 16384);
+    set_dma_buffer_pool_capacity(8 << 20);
+    return make_ready_future<>();
+}
@@ -26,6 +26,7 @@
 #include <seastar/testing/test_case.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/core/do_with.hh>
 #include <seastar/net/dns.hh>
 #include <seastar/net/inet_address.hh>
@@ -126,3 +127,49 @@ static future<> test_srv() {
 SEASTAR_TEST_CASE(test_srv_tcp) {
     return test_srv();
 }
+
+SEASTAR_TEST_CASE(test_cache) {
+    auto d = ::make_lw_shared<dns_resolver>();
+    auto c = ::make_lw_shared<dns_cache>(*d);
+    // Concurrent lookups share one query, and later ones hit the cache
+    auto f1 = c->get_host_by_name(seastar_name, inet_address::family::INET);
+    auto f2 = c->get_host_by_name(seastar_name, inet_address::family::INET);
+    return when_all_succeed(std::move(f1), std::move(f2)).then_unpack([c] (hostent e1, hostent e2) {
+        BOOST_REQUIRE(e1.addr_list == e2.addr_list);
+        BOOST_REQUIRE_EQUAL(c->size(), 1u);
+        return c->get_host_by_name(seastar_name, inet_address::family::INET).then([e1] (hostent e) {
+            BOOST_REQUIRE(e.addr_list == e1.addr_list);
+        });
+    }).then([c] {
+        c->invalidate(seastar_name);
+        BOOST_REQUIRE_EQUAL(c->size(), 0u);
+    }).finally([c, d] {
+        return c->close().then([d] {
+            return d->close();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_cache_bad_name) {
+    auto d = ::make_lw_shared<dns_resolver>();
+    auto c = ::make_lw_shared<dns_cache>(*d);
+    auto lookup = [c] {
+        return c->get_host_by_name("apa.ninja.gnu", inet_address::family::INET).then_wrapped([](future<hostent> f) {
+            try {
+                f.get();
+                BOOST_FAIL("should not succeed");
+            } catch (...) {
+                // ok.
+            }
+        });
+    };
+    return lookup().then([c, lookup] {
+        // The failure to find the name is remembered
+        BOOST_REQUIRE_EQUAL(c->size(), 1u);
+        return lookup();
+    }).finally([c, d] {
+        return c->close().then([d] {
+            return d->close();
+        });
+    });
+}
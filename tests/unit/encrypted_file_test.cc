@@ -0,0 +1,130 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/encrypted_file.hh>
+#include <seastar/core/fstream.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/util/tmp_file.hh>
+#include <seastar/util/closeable.hh>
+#include "layered_file_test.hh"
+
+using namespace seastar;
+
+static constexpr size_t block_size = 4096;
+
+static std::vector<uint8_t> make_key(uint8_t seed) {
+    std::vector<uint8_t> key(64);
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = seed + i;
+    }
+    return key;
+}
+
+static file open_encrypted(sstring name, uint8_t seed = 0) {
+    encrypted_file_options opts;
+    // Several pieces for the tests' sizes
+    opts.pipeline_size = 2 * block_size;
+    auto f = open_file_dma(name, open_flags::rw | open_flags::create).get0();
+    return make_encrypted_file(std::move(f), make_key(seed), opts).get0();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_encrypted_file_round_trip) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        auto size = 10 * block_size + 100;
+        write_data(open_encrypted(name), size);
+
+        auto f = open_encrypted(name);
+        auto close_f = deferred_close(f);
+        check_data(f, size, block_size);
+        // Unaligned reads across blocks
+        auto part = f.dma_read_bulk<char>(block_size - 10, 20).get0();
+        BOOST_REQUIRE_EQUAL(part.size(), 20);
+        for (size_t i = 0; i < part.size(); i++) {
+            BOOST_REQUIRE_EQUAL(part[i], data_at(block_size - 10 + i));
+        }
+
+        // None of the data is there in the clear
+        auto raw = open_file_dma(name, open_flags::ro).get0();
+        auto close_raw = deferred_close(raw);
+        auto stored = raw.dma_read_bulk<char>(block_size, block_size).get0();
+        auto plain = make_data(0, block_size);
+        BOOST_REQUIRE(!std::equal(plain.begin(), plain.end(), stored.begin()));
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_encrypted_file_wrong_key) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        write_data(open_encrypted(name), 3 * block_size);
+        BOOST_REQUIRE_THROW(open_encrypted(name, 1), std::runtime_error);
+        auto f = open_file_dma(name, open_flags::rw).get0();
+        BOOST_REQUIRE_THROW(make_encrypted_file(std::move(f), std::vector<uint8_t>(16)).get(), std::invalid_argument);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_encrypted_file_truncate) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        write_data(open_encrypted(name), 5 * block_size);
+        auto size = 2 * block_size + 123;
+        {
+            auto f = open_encrypted(name);
+            auto close_f = deferred_close(f);
+            // Into a full block, which becomes the partial one
+            f.truncate(size).get();
+            check_data(f, size, block_size);
+
+            // Extending fills with zeroes, including the rest of the
+            // partial block
+            f.truncate(size + 2 * block_size).get();
+            auto buf = f.dma_read_bulk<char>(size, 2 * block_size).get0();
+            BOOST_REQUIRE_EQUAL(buf.size(), 2 * block_size);
+            BOOST_REQUIRE(std::all_of(buf.begin(), buf.end(), [] (char c) { return c == 0; }));
+            f.truncate(size).get();
+        }
+
+        auto f = open_encrypted(name);
+        auto close_f = deferred_close(f);
+        check_data(f, size, block_size);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_encrypted_file_rejects_unaligned_io) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        auto name = (t.get_path() / "testfile").native();
+        write_data(open_encrypted(name), 2 * block_size);
+        auto f = open_encrypted(name);
+        auto close_f = deferred_close(f);
+
+        auto buf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), block_size);
+        std::fill(buf.get_write(), buf.get_write() + buf.size(), 'x');
+        BOOST_REQUIRE_THROW(f.dma_write(10, buf.get(), buf.size()).get(), std::system_error);
+        BOOST_REQUIRE_THROW(f.dma_write(0, buf.get(), 10).get(), std::system_error);
+        BOOST_REQUIRE_THROW(f.dma_read(10, buf.get_write(), buf.size()).get(), std::system_error);
+        BOOST_REQUIRE_EQUAL(f.dma_write(block_size, buf.get(), buf.size()).get0(), buf.size());
+        auto back = f.dma_read_bulk<char>(block_size, block_size).get0();
+        BOOST_REQUIRE(std::equal(back.begin(), back.end(), buf.begin()));
+    }).get();
+}
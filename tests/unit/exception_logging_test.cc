@@ -26,6 +26,7 @@
 #include <boost/test/included/unit_test.hpp>
 #include <seastar/util/log.hh>
 #include <seastar/util/backtrace.hh>
+#include <seastar/core/exception_hacks.hh>
 #include <ostream>
 #include <regex>
 
@@ -269,3 +270,34 @@ BOOST_AUTO_TEST_CASE(double_throw_with_backtrace_seastar_nested_exception_loggin
     std::regex expected_msg_re(regex_str, std::regex_constants::ECMAScript | std::regex_constants::icase);
     BOOST_REQUIRE(std::regex_search(log_msg.str(), expected_msg_re));
 }
+
+BOOST_AUTO_TEST_CASE(try_catch_test) {
+    struct base {
+        virtual ~base() = default;
+    };
+    struct other {
+        int x = 0;
+    };
+    // a second base class, so the pointer has to be adjusted to it
+    struct derived : other, base, std::runtime_error {
+        derived() : std::runtime_error("derived") {}
+    };
+
+    auto eptr = std::make_exception_ptr(derived());
+    BOOST_REQUIRE(try_catch<derived>(eptr));
+    BOOST_REQUIRE(try_catch<const derived>(eptr));
+    auto b = try_catch<base>(eptr);
+    BOOST_REQUIRE(b);
+    BOOST_REQUIRE_EQUAL(static_cast<void*>(b), static_cast<void*>(static_cast<base*>(try_catch<derived>(eptr))));
+    auto e = try_catch<const std::exception>(eptr);
+    BOOST_REQUIRE(e);
+    BOOST_REQUIRE_EQUAL(e->what(), std::string("derived"));
+    BOOST_REQUIRE(!try_catch<std::logic_error>(eptr));
+    BOOST_REQUIRE(!try_catch<std::runtime_error>(std::exception_ptr()));
+    BOOST_REQUIRE(*exception_ptr_type(eptr) == typeid(derived));
+    BOOST_REQUIRE(!exception_ptr_type(std::exception_ptr()));
+
+    auto ieptr = std::make_exception_ptr(42);
+    BOOST_REQUIRE(!try_catch<std::exception>(ieptr));
+    BOOST_REQUIRE(*exception_ptr_type(ieptr) == typeid(int));
+}
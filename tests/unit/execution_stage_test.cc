@@ -278,6 +278,50 @@ SEASTAR_TEST_CASE(test_stage_stats) {
     });
 }
 
+SEASTAR_THREAD_TEST_CASE(test_stage_batch_histograms) {
+    auto stage = seastar::make_execution_stage("test", [] { });
+
+    auto fs = std::vector<future<>>();
+    static constexpr auto call_count = 53u;
+    for (auto i = 0u; i < call_count; i++) {
+        fs.emplace_back(stage());
+    }
+    for (auto& f : fs) {
+        f.get();
+    }
+
+    BOOST_REQUIRE_EQUAL(stage.batch_sizes().count(), stage.get_stats().tasks_scheduled);
+    BOOST_REQUIRE_EQUAL(stage.batch_sizes().sum(), call_count);
+    BOOST_REQUIRE_EQUAL(stage.queue_delays().count(), stage.get_stats().tasks_scheduled);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_stage_adaptive_batching) {
+    auto stage = seastar::make_execution_stage("test", [] { });
+    stage.set_max_batch_delay(1ms);
+    BOOST_REQUIRE_EQUAL(stage.batch_target(), 1u);
+
+    // Calls queued faster than the delay fill up the batches, which grow
+    for (auto round = 0; round < 4; round++) {
+        auto fs = std::vector<future<>>();
+        for (auto i = 0u; i < 100; i++) {
+            fs.emplace_back(stage());
+        }
+        for (auto& f : fs) {
+        f.get();
+    }
+    }
+    auto target = stage.batch_target();
+    BOOST_REQUIRE_GT(target, 1u);
+    BOOST_REQUIRE_LE(target, execution_stage::max_batch_size);
+
+    // A lone call waits for the delay at most, and the batches shrink
+    auto start = std::chrono::steady_clock::now();
+    stage().get();
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - start < 1s);
+    BOOST_REQUIRE_LT(stage.batch_target(), target);
+    BOOST_REQUIRE_EQUAL(stage.batch_sizes().sum(), stage.get_stats().function_calls_executed);
+}
+
 SEASTAR_TEST_CASE(test_unique_stage_names_are_enforced) {
     return seastar::async([] {
         {
@@ -60,6 +60,7 @@ class test_env {
     std::vector<int> _results;
     std::vector<std::vector<std::exception_ptr>> _exceptions;
     fair_queue::class_id _nr_classes = 0;
+    fair_queue::group_id _nr_groups = 0;
     std::vector<request> _inflight;
 
     static fair_group::config fg_config(unsigned cap) {
@@ -122,15 +123,27 @@ class test_env {
         for (fair_queue::class_id id = 0; id < _nr_classes; id++) {
             _fq.unregister_priority_class(id);
         }
+        for (fair_queue::group_id id = _nr_groups; id-- > 0;) {
+            _fq.unregister_priority_group(id);
+        }
     }
 
-    size_t register_priority_class(uint32_t shares) {
+    size_t register_priority_class(uint32_t shares, std::optional<fair_queue::group_id> group = std::nullopt) {
         _results.push_back(0);
         _exceptions.push_back(std::vector<std::exception_ptr>());
-        _fq.register_priority_class(_nr_classes, shares);
+        if (group) {
+            _fq.register_priority_class(_nr_classes, shares, *group);
+        } else {
+            _fq.register_priority_class(_nr_classes, shares);
+        }
         return _nr_classes++;
     }
 
+    fair_queue::group_id register_priority_group(uint32_t shares, std::optional<fair_queue::group_id> parent = std::nullopt) {
+        _fq.register_priority_group(_nr_groups, shares, parent);
+        return _nr_groups++;
+    }
+
     void do_op(fair_queue::class_id id, unsigned weight) {
         unsigned index = id;
         auto req = std::make_unique<request>(weight, index, [this, index] (request& req) mutable noexcept {
@@ -447,3 +460,218 @@ SEASTAR_THREAD_TEST_CASE(test_fair_queue_random_run) {
     auto expected_error = std::max(1, int(round(reqs * 0.05)));
     env.verify(format("random_run ({:d} requests)", reqs), {1, 1}, expected_error);
 }
+
+// Group and class with equal shares split the capacity in halves, and
+// the classes in the group split their half 1:3.
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_nested_groups) {
+    test_env env(1);
+
+    auto g = env.register_priority_group(20);
+    auto a = env.register_priority_class(10, g);
+    auto b = env.register_priority_class(30, g);
+    auto c = env.register_priority_class(20);
+
+    for (int i = 0; i < 400; ++i) {
+        env.do_op(a, 1);
+        env.do_op(b, 1);
+        env.do_op(c, 1);
+    }
+    yield().get();
+
+    env.tick(400);
+    env.verify("nested_groups", {1, 3, 4});
+}
+
+// Two levels of groups, shares compose along the tree
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_two_level_groups) {
+    test_env env(1);
+
+    auto tenant = env.register_priority_group(10);
+    auto inner = env.register_priority_group(10, tenant);
+    auto a = env.register_priority_class(10, inner);
+    auto b = env.register_priority_class(10, inner);
+    auto c = env.register_priority_class(20, tenant);
+    auto d = env.register_priority_class(30);
+
+    for (int i = 0; i < 600; ++i) {
+        env.do_op(a, 1);
+        env.do_op(b, 1);
+        env.do_op(c, 1);
+        env.do_op(d, 1);
+    }
+    yield().get();
+
+    // tenant gets 1/4, inner gets 1/3 of it, split in halves
+    env.tick(600);
+    env.verify("two_level_groups", {1, 1, 4, 18}, 2);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_fair_group_pool_borrowing) {
+    fair_group::config cfg;
+    cfg.weight_rate = 1'000'000;
+    cfg.size_rate = std::numeric_limits<int>::max();
+    fair_group_pool pool(cfg, 2);
+    auto& busy = pool.group(0);
+    auto& idle = pool.group(1);
+
+    auto cap = busy.maximum_capacity() / 2;
+    auto want_head = busy.grab_capacity(cap) + cap;
+    BOOST_REQUIRE_EQUAL(busy.capacity_deficiency(want_head), cap);
+
+    // The limit is the default rate_limit_duration (1ms) worth of capacity, so
+    // that's enough time for each group to replenish a half of what's wanted
+    auto half = std::chrono::microseconds(250);
+    auto now = std::max(busy.replenished_ts(), idle.replenished_ts()) + half;
+    busy.replenish_capacity(now);
+    BOOST_REQUIRE_LT(busy.capacity_deficiency(want_head), cap / 8);
+    BOOST_REQUIRE(idle.replenished_ts() == now);
+
+    // A peer with requests of its own doesn't lend
+    auto idle_want_head = idle.grab_capacity(cap) + cap;
+    want_head = busy.grab_capacity(cap) + cap;
+    auto deficiency = busy.capacity_deficiency(want_head);
+    now += half;
+    busy.replenish_capacity(now);
+    BOOST_REQUIRE_GT(busy.capacity_deficiency(want_head), deficiency - cap / 2 - cap / 8);
+    BOOST_REQUIRE_EQUAL(idle.capacity_deficiency(idle_want_head), cap);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_deadlines) {
+    fair_group::config gcfg;
+    gcfg.weight_rate = 1'000'000;
+    gcfg.size_rate = std::numeric_limits<int>::max();
+    fair_group fg(gcfg);
+    fair_queue::config qcfg;
+    qcfg.deadline_slack = std::chrono::seconds(10);
+    fair_queue fq(fg, qcfg);
+    fq.register_priority_class(0, 100);
+
+    auto now = fair_queue_entry::clock_type::now();
+    std::vector<std::unique_ptr<fair_queue_entry>> entries;
+    for (auto deadline : { now + std::chrono::hours(1), now + std::chrono::seconds(9), now - std::chrono::seconds(1), now + std::chrono::seconds(5) }) {
+        auto& ent = *entries.emplace_back(std::make_unique<fair_queue_entry>(fair_queue_ticket(1, 0)));
+        ent.set_deadline(deadline);
+        fq.queue(0, ent);
+    }
+    auto& plain = *entries.emplace_back(std::make_unique<fair_queue_entry>(fair_queue_ticket(1, 0)));
+    fq.queue(0, plain);
+
+    auto index = [&entries] (fair_queue_entry& ent) {
+        return std::find_if(entries.begin(), entries.end(), [&ent] (auto& e) { return e.get() == &ent; }) - entries.begin();
+    };
+    std::vector<unsigned> dispatched, expired;
+    while (dispatched.size() + expired.size() < entries.size()) {
+        fq.dispatch_requests([&] (fair_queue_entry& ent) {
+            dispatched.push_back(index(ent));
+        }, [&] (fair_queue_entry& ent) {
+            expired.push_back(index(ent));
+        });
+    }
+
+    // The past-deadline request is dropped, the ones within the slack go
+    // first, earliest deadline first, and the rest keep the queueing order
+    BOOST_REQUIRE_EQUAL(expired, std::vector<unsigned>({2}));
+    BOOST_REQUIRE_EQUAL(dispatched, std::vector<unsigned>({3, 1, 0, 4}));
+
+    for (auto idx : dispatched) {
+        fq.notify_request_finished(entries[idx]->ticket());
+    }
+    fq.unregister_priority_class(0);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_cancel) {
+    fair_group::config gcfg;
+    gcfg.weight_rate = 1'000'000;
+    gcfg.size_rate = std::numeric_limits<int>::max();
+    fair_group fg(gcfg);
+    fair_queue fq(fg, fair_queue::config());
+    fq.register_priority_class(0, 100);
+    fq.register_priority_class(1, 100);
+
+    auto now = fair_queue_entry::clock_type::now();
+    std::vector<std::unique_ptr<fair_queue_entry>> entries;
+    for (unsigned i = 0; i < 4; i++) {
+        auto& ent = *entries.emplace_back(std::make_unique<fair_queue_entry>(fair_queue_ticket(1, 0)));
+        if (i == 2) {
+            ent.set_deadline(now - std::chrono::seconds(1));
+        }
+        fq.queue(0, ent);
+    }
+    auto& lone = *entries.emplace_back(std::make_unique<fair_queue_entry>(fair_queue_ticket(1, 0)));
+    fq.queue(1, lone);
+
+    // Cancelled entries leave the queue right away and may be freed
+    fq.notify_request_cancelled(0, *entries[1]);
+    fq.notify_request_cancelled(0, *entries[2]);
+    fq.notify_request_cancelled(1, lone);
+    entries[1].reset();
+    entries[2].reset();
+    entries[4].reset();
+    BOOST_REQUIRE_EQUAL(fq.waiters(), 2);
+    BOOST_REQUIRE_EQUAL(fq.resources_currently_waiting().weight(), 2);
+
+    auto index = [&entries] (fair_queue_entry& ent) {
+        return std::find_if(entries.begin(), entries.end(), [&ent] (auto& e) { return e.get() == &ent; }) - entries.begin();
+    };
+    std::vector<unsigned> dispatched;
+    bool expired = false;
+    while (fq.waiters() != 0) {
+        fq.dispatch_requests([&] (fair_queue_entry& ent) {
+            dispatched.push_back(index(ent));
+        }, [&] (fair_queue_entry& ent) {
+            expired = true;
+        });
+    }
+    BOOST_REQUIRE(!expired);
+    BOOST_REQUIRE_EQUAL(dispatched, std::vector<unsigned>({0, 3}));
+    BOOST_REQUIRE_EQUAL(fq.requests_currently_executing(), 2);
+
+    for (auto idx : dispatched) {
+        fq.notify_request_finished(entries[idx]->ticket());
+    }
+    fq.dispatch_requests([] (fair_queue_entry&) {
+        BOOST_FAIL("nothing left to dispatch");
+    });
+    fq.unregister_priority_class(0);
+    fq.unregister_priority_class(1);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_fair_queue_cancel_and_unregister) {
+    fair_group::config gcfg;
+    gcfg.weight_rate = 1'000'000;
+    gcfg.size_rate = std::numeric_limits<int>::max();
+    fair_group fg(gcfg);
+    fair_queue fq(fg, fair_queue::config());
+    fq.register_priority_group(0, 100);
+    fq.register_priority_class(0, 100, 0);
+    fq.register_priority_class(1, 100);
+    fq.register_priority_class(2, 100);
+
+    std::vector<std::unique_ptr<fair_queue_entry>> entries;
+    for (fair_queue::class_id id : {0, 0, 0, 1, 1, 2}) {
+        fq.queue(id, *entries.emplace_back(std::make_unique<fair_queue_entry>(fair_queue_ticket(1, 0))));
+    }
+
+    // The classes, and the group, left with no requests go away while
+    // still queued for dispatching
+    for (unsigned i = 0; i < 5; i++) {
+        fq.notify_request_cancelled(i < 3 ? 0 : 1, *entries[i]);
+        entries[i].reset();
+    }
+    fq.unregister_priority_class(0);
+    fq.unregister_priority_group(0);
+    fq.unregister_priority_class(1);
+    BOOST_REQUIRE_EQUAL(fq.waiters(), 1);
+
+    std::vector<fair_queue_entry*> dispatched;
+    while (fq.waiters() != 0) {
+        fq.dispatch_requests([&] (fair_queue_entry& ent) {
+            dispatched.push_back(&ent);
+        });
+    }
+    BOOST_REQUIRE_EQUAL(dispatched.size(), 1);
+    BOOST_REQUIRE(dispatched[0] == entries[5].get());
+
+    fq.notify_request_finished(entries[5]->ticket());
+    fq.unregister_priority_class(2);
+}
@@ -38,6 +38,7 @@
 #include <seastar/util/internal/magic.hh>
 
 #include <boost/range/adaptor/transformed.hpp>
+#include <boost/range/irange.hpp>
 #include <iostream>
 #include <sys/statfs.h>
 #include <fcntl.h>
@@ -916,6 +917,42 @@ SEASTAR_TEST_CASE(test_intent) {
     });
 }
 
+SEASTAR_TEST_CASE(test_append_challenged_file_pipelined_appends) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring filename = (t.get_path() / "testfile.tmp").native();
+        auto f = open_file_dma(filename, open_flags::rw | open_flags::create).get0();
+        constexpr size_t nr_blocks = 64;
+        auto buf = allocate_aligned_buffer<unsigned char>(4096 * nr_blocks, 4096);
+        for (size_t i = 0; i < nr_blocks; i++) {
+            std::fill(buf.get() + i * 4096, buf.get() + (i + 1) * 4096, i);
+        }
+        f.dma_write(0, buf.get(), 4096).get();
+
+        // Appends, with reads of what is already there in between them
+        auto rbuf = allocate_aligned_buffer<unsigned char>(4096, 4096);
+        std::vector<future<size_t>> ops;
+        for (size_t i = 1; i < nr_blocks; i++) {
+            ops.push_back(f.dma_write(i * 4096, buf.get() + i * 4096, 4096));
+            if (i % 4 == 0) {
+                ops.push_back(f.dma_read(0, rbuf.get(), 4096));
+            }
+        }
+        for (auto& op : ops) {
+            BOOST_REQUIRE_EQUAL(op.get0(), 4096u);
+        }
+        BOOST_REQUIRE(std::all_of(rbuf.get(), rbuf.get() + 4096, [] (unsigned char c) { return c == 0; }));
+        BOOST_REQUIRE_EQUAL(f.size().get0(), 4096 * nr_blocks);
+        f.flush().get();
+        f.close().get();
+
+        f = open_file_dma(filename, open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), 4096 * nr_blocks);
+        auto data = f.dma_read_exactly<unsigned char>(0, 4096 * nr_blocks).get0();
+        BOOST_REQUIRE(std::equal(data.begin(), data.end(), buf.get()));
+        f.close().get();
+    });
+}
+
 SEASTAR_TEST_CASE(parallel_overwrite) {
     // Avoid /tmp for tmp_dir, since it can be tmpfs
     return tmp_dir::do_with("XXXXXXXX.tmp", [] (tmp_dir& t) {
@@ -974,3 +1011,67 @@ SEASTAR_TEST_CASE(test_oversized_io_works) {
         BOOST_REQUIRE((size_t)std::count_if(buf.get(), buf.get() + buf_size, [](auto x) { return x == 'a'; }) == buf_size);
     });
 }
+
+SEASTAR_TEST_CASE(test_concurrent_discards) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring filename = (t.get_path() / "testfile.tmp").native();
+        auto f = open_file_dma(filename, open_flags::rw | open_flags::create).get0();
+        auto close_f = deferred_close(f);
+
+        size_t block = 4096;
+        size_t nr_blocks = 64;
+        auto buf = allocate_aligned_buffer<unsigned char>(block * nr_blocks, 4096);
+        std::fill(buf.get(), buf.get() + block * nr_blocks, 'a');
+        f.dma_write(0, buf.get(), block * nr_blocks).get();
+
+        // Adjacent and overlapping ranges, all but the last block, which are
+        // merged while the first one is being sent
+        parallel_for_each(boost::irange<size_t>(0, nr_blocks - 1), [&] (size_t i) {
+            return f.discard(i * block, i % 3 ? block : 2 * block);
+        }).get();
+
+        BOOST_REQUIRE_EQUAL(f.size().get0(), block * nr_blocks);
+        auto data = f.dma_read_exactly<unsigned char>(0, block * nr_blocks).get0();
+        BOOST_REQUIRE(std::all_of(data.begin(), data.end() - block, [] (unsigned char c) { return c == 0; }));
+        BOOST_REQUIRE(std::all_of(data.end() - block, data.end(), [] (unsigned char c) { return c == 'a'; }));
+    });
+}
+
+SEASTAR_TEST_CASE(test_buffered_file_reads) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring filename = (t.get_path() / "testfile.tmp").native();
+        auto size = 3 * 4096 + 100;
+        {
+            auto f = open_file_dma(filename, open_flags::rw | open_flags::create).get0();
+            auto close_f = deferred_close(f);
+            auto buf = allocate_aligned_buffer<unsigned char>(4 * 4096, 4096);
+            for (int i = 0; i < size; i++) {
+                buf.get()[i] = 'a' + i % 26;
+            }
+            f.dma_write(0, buf.get(), 4 * 4096).get();
+            f.truncate(size).get();
+        }
+
+        file_open_options options;
+        options.buffered = true;
+        auto f = open_file_dma(filename, open_flags::ro, options).get0();
+        auto close_f = deferred_close(f);
+        BOOST_REQUIRE_EQUAL(f.disk_read_dma_alignment(), 1);
+        // Twice, the second one being served from the page cache
+        for (int pass = 0; pass < 2; pass++) {
+            auto data = f.dma_read_bulk<char>(0, size + 4096).get0();
+            BOOST_REQUIRE_EQUAL(data.size(), size);
+            for (int i = 0; i < size; i++) {
+                BOOST_REQUIRE_EQUAL(data[i], 'a' + i % 26);
+            }
+        }
+
+        // Unaligned and across the end of the file
+        char small[10];
+        BOOST_REQUIRE_EQUAL(f.dma_read(size - 7, small, sizeof(small)).get0(), 7);
+        for (int i = 0; i < 7; i++) {
+            BOOST_REQUIRE_EQUAL(small[i], 'a' + (size - 7 + i) % 26);
+        }
+        BOOST_REQUIRE_EQUAL(f.dma_read(size, small, sizeof(small)).get0(), 0);
+    });
+}
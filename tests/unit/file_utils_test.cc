@@ -304,3 +304,40 @@ SEASTAR_TEST_CASE(test_read_entire_file_contiguous) {
         });
     });
 }
+
+SEASTAR_THREAD_TEST_CASE(test_walk_directory_tree) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        const auto& root = t.get_path();
+        std::map<fs::path, std::pair<directory_entry_type, uint64_t>> expected;
+        for (int i = 0; i < 4; i++) {
+            auto dir = root / format("dir{}", i).c_str();
+            make_directory(dir.native()).get();
+            expected[dir] = {directory_entry_type::directory, 0};
+            auto sub = dir / "sub";
+            make_directory(sub.native()).get();
+            expected[sub] = {directory_entry_type::directory, 0};
+            for (int j = 0; j < 5; j++) {
+                auto path = sub / format("file{}", j).c_str();
+                auto f = open_file_dma(path.native(), open_flags::wo | open_flags::create).get0();
+                f.truncate(j * 100).get();
+                f.close().get();
+                expected[path] = {directory_entry_type::regular, j * 100};
+            }
+        }
+
+        std::map<fs::path, std::pair<directory_entry_type, uint64_t>> found;
+        util::directory_walk_options opts;
+        opts.batch_size = 3;
+        opts.stat_entries = true;
+        util::walk_directory_tree(root, [&found] (std::vector<util::directory_tree_entry> batch) {
+            return smp::submit_to(0, [&found, batch = std::move(batch)] {
+                BOOST_REQUIRE_LE(batch.size(), 3);
+                for (auto& e : batch) {
+                    auto inserted = found.emplace(e.path, std::make_pair(e.type, e.type == directory_entry_type::regular ? e.size : 0)).second;
+                    BOOST_REQUIRE(inserted);
+                }
+            });
+        }, opts).get();
+        BOOST_REQUIRE(found == expected);
+    }).get();
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/core/flat_hash_map.hh>
+#include <seastar/core/sstring.hh>
+#include <random>
+#include <unordered_map>
+
+using namespace seastar;
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_basic) {
+    flat_hash_map<int, sstring> m;
+    BOOST_REQUIRE(m.empty());
+    BOOST_REQUIRE(m.find(1) == m.end());
+    BOOST_REQUIRE(m.begin() == m.end());
+
+    BOOST_REQUIRE(m.emplace(1, "one").second);
+    BOOST_REQUIRE(!m.emplace(1, "uno").second);
+    BOOST_REQUIRE(m.insert({2, "two"}).second);
+    m[3] = "three";
+    BOOST_REQUIRE_EQUAL(m.size(), 3u);
+    BOOST_REQUIRE_EQUAL(m.at(1), "one");
+    BOOST_REQUIRE_EQUAL(m[2], "two");
+    BOOST_REQUIRE_EQUAL(m.find(3)->second, "three");
+    BOOST_REQUIRE(m.contains(3));
+    BOOST_REQUIRE_THROW(m.at(4), std::out_of_range);
+
+    BOOST_REQUIRE(!m.insert_or_assign(1, "uno").second);
+    BOOST_REQUIRE_EQUAL(m.at(1), "uno");
+
+    BOOST_REQUIRE_EQUAL(m.erase(2), 1u);
+    BOOST_REQUIRE_EQUAL(m.erase(2), 0u);
+    BOOST_REQUIRE_EQUAL(m.size(), 2u);
+    BOOST_REQUIRE_EQUAL(std::distance(m.begin(), m.end()), 2);
+
+    auto copy = m;
+    m.clear();
+    BOOST_REQUIRE(m.empty());
+    BOOST_REQUIRE(!m.contains(1));
+    BOOST_REQUIRE_EQUAL(copy.size(), 2u);
+    BOOST_REQUIRE_EQUAL(copy.at(3), "three");
+
+    auto moved = std::move(copy);
+    BOOST_REQUIRE(copy.empty());
+    BOOST_REQUIRE_EQUAL(moved.at(1), "uno");
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_incremental_rehash) {
+    flat_hash_map<uint64_t, uint64_t> m;
+    bool rehashed = false;
+    for (uint64_t i = 0; i < 100000; i++) {
+        m.emplace(i, i * 2);
+        if (m.rehashing()) {
+            rehashed = true;
+            // Elements that were not moved yet are still found
+            BOOST_REQUIRE_EQUAL(m.at(i / 2), i / 2 * 2);
+            BOOST_REQUIRE_EQUAL(m.size(), i + 1);
+        }
+    }
+    BOOST_REQUIRE(rehashed);
+    size_t n = 0;
+    for (auto& [k, v] : m) {
+        BOOST_REQUIRE_EQUAL(v, k * 2);
+        n++;
+    }
+    BOOST_REQUIRE_EQUAL(n, m.size());
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_erase_while_iterating) {
+    flat_hash_map<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m.emplace(i, i);
+    }
+    for (auto it = m.begin(); it != m.end();) {
+        if (it->first % 2) {
+            it = m.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(m.size(), 500u);
+    for (int i = 0; i < 1000; i++) {
+        BOOST_REQUIRE_EQUAL(m.contains(i), i % 2 == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_random) {
+    flat_hash_map<uint32_t, sstring> m;
+    std::unordered_map<uint32_t, sstring> ref;
+    std::default_random_engine rng;
+    // A small key space, so that erases and tombstones are frequent
+    std::uniform_int_distribution<uint32_t> keys(0, 20000);
+    for (int i = 0; i < 500000; i++) {
+        auto k = keys(rng);
+        switch (rng() % 4) {
+        case 0:
+        case 1: {
+            auto v = to_sstring(i);
+            BOOST_REQUIRE_EQUAL(m.try_emplace(k, v).second, ref.try_emplace(k, v).second);
+            break;
+        }
+        case 2:
+            BOOST_REQUIRE_EQUAL(m.erase(k), ref.erase(k));
+            break;
+        case 3: {
+            auto it = m.find(k);
+            auto rit = ref.find(k);
+            BOOST_REQUIRE_EQUAL(it == m.end(), rit == ref.end());
+            if (it != m.end()) {
+                BOOST_REQUIRE_EQUAL(it->second, rit->second);
+            }
+            break;
+        }
+        }
+        BOOST_REQUIRE_EQUAL(m.size(), ref.size());
+    }
+    for (auto& [k, v] : m) {
+        BOOST_REQUIRE_EQUAL(ref.at(k), v);
+    }
+}
@@ -163,3 +163,37 @@ SEASTAR_THREAD_TEST_CASE(foreign_ptr_destroy_test) {
     BOOST_REQUIRE(destroyed_on[1]);
     BOOST_REQUIRE(!destroyed_on[0]);
 }
+
+SEASTAR_THREAD_TEST_CASE(cross_shard_buffer_test) {
+    if (smp::count == 1) {
+        std::cerr << "Skipping multi-cpu cross-shard buffer tests. Run with --smp=2 to test multi-cpu delete.";
+        return;
+    }
+
+    using namespace std::chrono_literals;
+
+    constexpr unsigned nr_buffers = 1000;
+    std::vector<unsigned> deleted_on(smp::count);
+
+    std::vector<temporary_buffer<char>> bufs;
+    for (unsigned i = 0; i != nr_buffers; ++i) {
+        temporary_buffer<char> buf(16);
+        auto data = buf.get();
+        buf = temporary_buffer<char>(buf.get_write(), buf.size(), make_deleter(buf.release(), [&deleted_on] {
+            ++deleted_on[this_shard_id()];
+        }));
+        bufs.push_back(make_cross_shard_buffer(std::move(buf)));
+        BOOST_REQUIRE_EQUAL(bufs.back().get(), data);
+    }
+
+    smp::submit_to(1, [bufs = std::move(bufs)] () mutable {
+        // Destroy the buffers here, rather than with the work item on shard 0
+        bufs.clear();
+    }).get();
+
+    // The deleters are sent back asynchronously
+    while (deleted_on[0] != nr_buffers) {
+        seastar::sleep(1ms).get();
+    }
+    BOOST_REQUIRE_EQUAL(deleted_on[1], 0);
+}
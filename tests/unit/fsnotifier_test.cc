@@ -225,3 +225,70 @@ SEASTAR_THREAD_TEST_CASE(test_shutdown_notifier) {
     auto events = fut.get0();
     BOOST_REQUIRE(events.empty());
 }
+
+SEASTAR_THREAD_TEST_CASE(test_notify_coalesce) {
+    tmpdir tmp;
+    fsnotifier fsn;
+
+    auto p = tmp.path() / "kossa.dat";
+    auto f = open_file_dma(p.native(), open_flags::create|open_flags::rw).get0();
+    auto w = fsn.create_watch(tmp.path().native(), fsnotifier::flags::modify
+        | fsnotifier::flags::close_write
+    ).get0();
+
+    auto os = api_v3::and_newer::make_file_output_stream(f).get0();
+    for (int i = 0; i < 5; i++) {
+        os.write("kossa").get();
+        os.flush().get();
+    }
+    os.close().get();
+
+    fsnotifier::batch_options opts;
+    opts.window = std::chrono::milliseconds(10);
+    auto events = fsn.wait(opts).get0();
+    BOOST_REQUIRE_EQUAL(events.size(), 1);
+    BOOST_REQUIRE(find_event(events, w, fsnotifier::flags::modify, p.filename().native()));
+    BOOST_REQUIRE(find_event(events, w, fsnotifier::flags::close_write, p.filename().native()));
+}
+
+static void wait_for_event(recursive_fsnotifier& rfsn, fsnotifier::flags mask, sstring path) {
+    for (;;) {
+        auto events = rfsn.wait().get0();
+        for (auto& e : events) {
+            BOOST_REQUIRE((e.mask & fsnotifier::flags::overflow) == fsnotifier::flags{});
+            if ((e.mask & mask) != fsnotifier::flags{} && e.path == path) {
+                return;
+            }
+        }
+    }
+}
+
+SEASTAR_THREAD_TEST_CASE(test_notify_recursive) {
+    tmpdir tmp;
+    make_directory((tmp.path() / "a").native()).get();
+    make_directory((tmp.path() / "a" / "b").native()).get();
+
+    {
+        recursive_fsnotifier small(tmp.path().native(), fsnotifier::flags::create_child, 2);
+        BOOST_REQUIRE_THROW(small.start().get(), std::runtime_error);
+    }
+
+    recursive_fsnotifier rfsn(tmp.path().native(), fsnotifier::flags::create_child
+        | fsnotifier::flags::close_write
+    );
+    rfsn.start().get();
+    BOOST_REQUIRE_EQUAL(rfsn.watch_count(), 3);
+
+    auto f = open_file_dma((tmp.path() / "a" / "b" / "kossa.dat").native(), open_flags::create|open_flags::rw).get0();
+    f.close().get();
+    wait_for_event(rfsn, fsnotifier::flags::close_write, "a/b/kossa.dat");
+
+    // A new directory is watched as well
+    make_directory((tmp.path() / "a" / "c").native()).get();
+    wait_for_event(rfsn, fsnotifier::flags::is_dir, "a/c");
+    BOOST_REQUIRE_EQUAL(rfsn.watch_count(), 4);
+
+    f = open_file_dma((tmp.path() / "a" / "c" / "kossa.dat").native(), open_flags::create|open_flags::rw).get0();
+    f.close().get();
+    wait_for_event(rfsn, fsnotifier::flags::close_write, "a/c/kossa.dat");
+}
@@ -29,6 +29,7 @@
 #include <seastar/core/do_with.hh>
 #include <seastar/core/seastar.hh>
 #include <seastar/core/semaphore.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/testing/test_case.hh>
 #include <seastar/testing/test_runner.hh>
 #include <seastar/core/thread.hh>
@@ -539,6 +540,159 @@ SEASTAR_TEST_CASE(test_fstream_slow_start) {
     });
 }
 
+SEASTAR_TEST_CASE(test_fstream_adaptive_read_ahead) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring filename = (t.get_path() / "testfile.tmp").native();
+        size_t file_length = 8 * 1024 * 1024 + 1234;
+        {
+            file f = open_file_dma(filename, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+            auto out = make_file_output_stream(std::move(f)).get0();
+            std::vector<char> buf(file_length);
+            for (size_t i = 0; i < file_length; i++) {
+                buf[i] = i % 251;
+            }
+            out.write(buf.data(), buf.size()).get();
+            out.close().get();
+        }
+
+        // Start in the middle of a block to exercise the trimming of merged reads
+        for (uint64_t offset : {uint64_t(0), uint64_t(777)}) {
+            file f = open_file_dma(filename, open_flags::ro).get0();
+            file_input_stream_options options;
+            options.buffer_size = 4096;
+            options.max_read_ahead = 1024 * 1024;
+            auto in = make_file_input_stream(std::move(f), offset, options);
+            auto close_in = deferred_close(in);
+            uint64_t pos = offset;
+            while (true) {
+                auto buf = in.read().get0();
+                if (buf.empty()) {
+                    break;
+                }
+                for (size_t i = 0; i < buf.size(); i++) {
+                    BOOST_REQUIRE_EQUAL(buf[i], char((pos + i) % 251));
+                }
+                pos += buf.size();
+            }
+            BOOST_REQUIRE_EQUAL(pos, file_length);
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_group_commit) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring filename = (t.get_path() / "testfile.tmp").native();
+        file f = open_file_dma(filename, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto close_f = deferred_close(f);
+
+        // Requests made while a flush is in progress share the next one
+        {
+            group_commit gc(f);
+            std::vector<future<>> flushes;
+            for (int i = 0; i < 10; i++) {
+                flushes.push_back(gc.flush());
+            }
+            when_all_succeed(flushes.begin(), flushes.end()).get();
+            gc.close().get();
+            BOOST_REQUIRE_EQUAL(gc.get_stats().requests, 10);
+            BOOST_REQUIRE_LE(gc.get_stats().flushes, 2);
+        }
+
+        // With a window, all of them share the first one
+        {
+            group_commit gc(f, std::chrono::milliseconds(10));
+            std::vector<future<>> flushes;
+            for (int i = 0; i < 10; i++) {
+                flushes.push_back(gc.flush());
+            }
+            when_all_succeed(flushes.begin(), flushes.end()).get();
+            gc.close().get();
+            BOOST_REQUIRE_EQUAL(gc.get_stats().flushes, 1);
+        }
+
+        // An output stream sharing a group with another writer
+        {
+            file_output_stream_options options;
+            options.flush_group = make_lw_shared<group_commit>(f, std::chrono::milliseconds(100));
+            auto out = make_file_output_stream(open_file_dma(filename, open_flags::rw).get0(), options).get0();
+            auto close_out = deferred_close(out);
+            out.write("a", 1).get();
+            when_all_succeed(out.flush(), options.flush_group->flush()).get();
+            options.flush_group->close().get();
+            BOOST_REQUIRE_EQUAL(options.flush_group->get_stats().requests, 2);
+            BOOST_REQUIRE_EQUAL(options.flush_group->get_stats().flushes, 1);
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_zero_copy_write) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring filename = (t.get_path() / "testfile.tmp").native();
+        file f = open_file_dma(filename, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto align = f.memory_dma_alignment();
+        file_output_stream_options options;
+        options.buffer_size = 65536;
+        auto out = make_file_output_stream(std::move(f), options).get0();
+
+        // Aligned buffers are written as they are, the unaligned ones and
+        // the tail are copied
+        std::vector<char> expected;
+        auto write = [&] (temporary_buffer<char> buf) {
+            for (size_t i = 0; i < buf.size(); i++) {
+                buf.get_write()[i] = char(expected.size() % 251);
+                expected.push_back(buf[i]);
+            }
+            out.write(std::move(buf)).get();
+        };
+        for (int i = 0; i < 64; i++) {
+            write(temporary_buffer<char>::aligned(align, 4096));
+        }
+        write(temporary_buffer<char>(1000));
+        write(temporary_buffer<char>::aligned(align, 65536));
+        write(temporary_buffer<char>::aligned(align, 123));
+        out.close().get();
+
+        auto in = make_file_input_stream(open_file_dma(filename, open_flags::ro).get0());
+        auto close_in = deferred_close(in);
+        auto data = in.read_exactly(expected.size() + 1).get0();
+        BOOST_REQUIRE_EQUAL(data.size(), expected.size());
+        BOOST_REQUIRE(std::equal(expected.begin(), expected.end(), data.begin()));
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_background_preallocation) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring filename = (t.get_path() / "testfile.tmp").native();
+        file f = open_file_dma(filename, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        file_output_stream_options options;
+        options.buffer_size = 65536;
+        options.preallocation_size = 256 << 10;
+        options.preallocation_headroom = 128 << 10;
+        options.write_behind = 4;
+        auto out = make_file_output_stream(std::move(f), options).get0();
+
+        // Preallocation doesn't show in the size, nor in the contents
+        std::vector<char> expected;
+        for (int i = 0; i < 40; i++) {
+            sstring chunk(sstring::initialized_later(), 30000);
+            for (auto& c : chunk) {
+                c = char(expected.size() % 251);
+                expected.push_back(c);
+            }
+            out.write(chunk).get();
+        }
+        out.close().get();
+
+        f = open_file_dma(filename, open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), expected.size());
+        auto in = make_file_input_stream(std::move(f));
+        auto close_in = deferred_close(in);
+        auto data = in.read_exactly(expected.size() + 1).get0();
+        BOOST_REQUIRE_EQUAL(data.size(), expected.size());
+        BOOST_REQUIRE(std::equal(expected.begin(), expected.end(), data.begin()));
+    });
+}
+
 #ifdef SEASTAR_ENABLE_ALLOC_FAILURE_INJECTION
 
 SEASTAR_TEST_CASE(test_close_error) {
@@ -842,6 +842,49 @@ SEASTAR_TEST_CASE(test_parallel_for_each) {
     });
 }
 
+SEASTAR_THREAD_TEST_CASE(test_chunked_parallel_for_each) {
+    // empty
+    chunked_parallel_for_each(std::vector<int>(), [] (int) {
+        BOOST_FAIL("should not reach");
+    }).get();
+
+    // large range of synchronous elements, spanning several task quotas
+    auto range = boost::irange<int64_t>(0, 10'000'000);
+    int64_t sum = 0;
+    chunked_parallel_for_each(range, [&sum] (int64_t v) {
+        sum += v;
+    }).get();
+    BOOST_REQUIRE_EQUAL(sum, int64_t(10'000'000) * 9'999'999 / 2);
+
+    // some elements block
+    auto small = boost::copy_range<std::vector<int>>(boost::irange(1, 101));
+    sum = 0;
+    chunked_parallel_for_each(small, [&sum] (int v) {
+        if (v % 10) {
+            sum += v;
+            return make_ready_future<>();
+        }
+        return yield().then([&sum, v] {
+            sum += v;
+        });
+    }).get();
+    BOOST_REQUIRE_EQUAL(sum, 5050);
+
+    // throws, synchronously and after suspension
+    BOOST_CHECK_EXCEPTION(chunked_parallel_for_each(small, [] (int v) {
+        if (v == 50) {
+            throw 5;
+        }
+    }).get(), int, [] (int v) { return v == 5; });
+    BOOST_CHECK_EXCEPTION(chunked_parallel_for_each(small, [] (int v) {
+        return yield().then([v] {
+            if (v == 50) {
+                throw 5;
+            }
+        });
+    }).get(), int, [] (int v) { return v == 5; });
+}
+
 SEASTAR_TEST_CASE(test_parallel_for_each_early_failure) {
     return do_with(0, [] (int& counter) {
         return parallel_for_each(boost::irange(0, 11000), [&counter] (int i) {
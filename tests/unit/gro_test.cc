@@ -0,0 +1,142 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE gro
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/net/gro.hh>
+#include <seastar/net/ethernet.hh>
+#include <seastar/net/ip.hh>
+#include <seastar/core/byteorder.hh>
+#include <string>
+#include <vector>
+
+using namespace seastar;
+using namespace net;
+
+static constexpr uint8_t ack = 0x10;
+static constexpr uint8_t psh = 0x08;
+static constexpr uint8_t fin = 0x01;
+
+static packet make_segment(uint16_t src_port, uint32_t seq, uint8_t flags, const std::string& data) {
+    std::string frame(sizeof(eth_hdr) + ipv4_hdr_len_min + tcp_hdr_len_min, '\0');
+    frame += data;
+    auto eh = reinterpret_cast<eth_hdr*>(frame.data());
+    eh->eth_proto = uint16_t(eth_protocol_num::ipv4);
+    *eh = hton(*eh);
+    auto iph = reinterpret_cast<ip_hdr*>(frame.data() + sizeof(eth_hdr));
+    iph->ihl = 5;
+    iph->ver = 4;
+    iph->len = frame.size() - sizeof(eth_hdr);
+    iph->ip_proto = uint8_t(ip_protocol_num::tcp);
+    iph->src_ip = ipv4_address(0x0a000001);
+    iph->dst_ip = ipv4_address(0x0a000002);
+    *iph = hton(*iph);
+    auto th = frame.data() + sizeof(eth_hdr) + ipv4_hdr_len_min;
+    write_be<uint16_t>(th, src_port);
+    write_be<uint16_t>(th + 2, 80);
+    write_be<uint32_t>(th + 4, seq);
+    write_be<uint32_t>(th + 8, 1000);
+    th[12] = (tcp_hdr_len_min / 4) << 4;
+    th[13] = flags;
+    write_be<uint16_t>(th + 14, 512);
+    return packet(frame.data(), frame.size());
+}
+
+struct segment {
+    uint16_t src_port;
+    uint32_t seq;
+    uint8_t flags;
+    std::string data;
+};
+
+static segment parse(packet& p) {
+    auto iph = p.get_header<ip_hdr>(sizeof(eth_hdr));
+    auto h = ntoh(*iph);
+    BOOST_REQUIRE_EQUAL(h.len + sizeof(eth_hdr), p.len());
+    p.linearize();
+    auto th = p.get_header(sizeof(eth_hdr) + ipv4_hdr_len_min, tcp_hdr_len_min);
+    auto data = p.frag(0).base + sizeof(eth_hdr) + ipv4_hdr_len_min + tcp_hdr_len_min;
+    return segment{read_be<uint16_t>(th), read_be<uint32_t>(th + 4), uint8_t(th[13]),
+            std::string(data, p.frag(0).base + p.len())};
+}
+
+struct gro_fixture {
+    std::vector<segment> delivered;
+    gro g{[this] (packet p) { delivered.push_back(parse(p)); }};
+};
+
+BOOST_FIXTURE_TEST_CASE(test_merges_in_order_segments, gro_fixture) {
+    g.receive(make_segment(1, 100, ack, "abc"));
+    g.receive(make_segment(1, 103, ack, "def"));
+    g.receive(make_segment(1, 106, ack, "gh"));
+    BOOST_REQUIRE(delivered.empty());
+    g.flush();
+    BOOST_REQUIRE_EQUAL(delivered.size(), 1u);
+    BOOST_REQUIRE_EQUAL(delivered[0].seq, 100u);
+    BOOST_REQUIRE_EQUAL(delivered[0].data, "abcdefgh");
+    BOOST_REQUIRE_EQUAL(g.get_stats().merged_segments, 2u);
+    BOOST_REQUIRE_EQUAL(g.get_stats().merged_packets, 1u);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_keeps_flows_apart, gro_fixture) {
+    g.receive(make_segment(1, 100, ack, "ab"));
+    g.receive(make_segment(2, 500, ack, "xy"));
+    g.receive(make_segment(1, 102, ack, "cd"));
+    g.receive(make_segment(2, 502, ack, "z"));
+    g.flush();
+    BOOST_REQUIRE_EQUAL(delivered.size(), 2u);
+    BOOST_REQUIRE_EQUAL(delivered[0].data, "abcd");
+    BOOST_REQUIRE_EQUAL(delivered[1].data, "xyz");
+}
+
+BOOST_FIXTURE_TEST_CASE(test_out_of_order_segment_is_not_merged, gro_fixture) {
+    g.receive(make_segment(1, 100, ack, "ab"));
+    g.receive(make_segment(1, 110, ack, "cd"));
+    g.flush();
+    BOOST_REQUIRE_EQUAL(delivered.size(), 2u);
+    BOOST_REQUIRE_EQUAL(delivered[0].seq, 100u);
+    BOOST_REQUIRE_EQUAL(delivered[1].seq, 110u);
+    BOOST_REQUIRE_EQUAL(g.get_stats().merged_segments, 0u);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_push_and_fin_end_the_merge, gro_fixture) {
+    g.receive(make_segment(1, 100, ack, "ab"));
+    g.receive(make_segment(1, 102, ack | psh, "cd"));
+    BOOST_REQUIRE_EQUAL(delivered.size(), 1u);
+    BOOST_REQUIRE_EQUAL(delivered[0].data, "abcd");
+    BOOST_REQUIRE(delivered[0].flags & psh);
+
+    g.receive(make_segment(1, 104, ack, "ef"));
+    g.receive(make_segment(1, 106, ack | fin, "gh"));
+    BOOST_REQUIRE_EQUAL(delivered.size(), 3u);
+    BOOST_REQUIRE_EQUAL(delivered[1].data, "ef");
+    BOOST_REQUIRE_EQUAL(delivered[2].data, "gh");
+    BOOST_REQUIRE(delivered[2].flags & fin);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_pure_acks_pass_through, gro_fixture) {
+    g.receive(make_segment(1, 100, ack, ""));
+    g.receive(make_segment(1, 100, ack, ""));
+    BOOST_REQUIRE_EQUAL(delivered.size(), 2u);
+    g.flush();
+    BOOST_REQUIRE_EQUAL(delivered.size(), 2u);
+}
@@ -0,0 +1,100 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/core/heap_profile.hh>
+#include <seastar/core/memory.hh>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_format_profile) {
+    std::vector<heap_profile::internal::shard_profile> profiles = {
+        {100, {{2, 64, {0x1000, 0x2000}}}},
+        {100, {{1, 32, {0x3000}}, {4, 4096, {}}}},
+    };
+    auto text = heap_profile::internal::format_profile(profiles);
+    std::string_view expected =
+            "heap profile: 7: 4192 [7: 4192] @ heap_v2/100\n"
+            "2: 64 [2: 64] @ 0x1000 0x2000\n"
+            "1: 32 [1: 32] @ 0x3000\n"
+            "4: 4096 [4: 4096] @\n"
+            "\nMAPPED_LIBRARIES:\n";
+    BOOST_REQUIRE_EQUAL(std::string_view(text).substr(0, expected.size()), expected);
+    // The memory map follows, for pprof to symbolize the addresses
+    BOOST_REQUIRE_GT(text.size(), expected.size());
+
+    // An unsampled profile still gives pprof a valid period
+    profiles = {{0, {}}};
+    text = heap_profile::internal::format_profile(profiles);
+    expected = "heap profile: 0: 0 [0: 0] @ heap_v2/1\n";
+    BOOST_REQUIRE_EQUAL(std::string_view(text).substr(0, expected.size()), expected);
+    return make_ready_future<>();
+}
+
+#ifdef SEASTAR_HEAPPROF
+
+static size_t profiled_objects() {
+    size_t count = 0;
+    for (auto& e : memory::get_heap_profile()) {
+        count += e.count;
+    }
+    return count;
+}
+
+// Live objects the profiler records for nr allocations of size bytes
+static size_t profile_allocations(size_t nr, size_t size) {
+    std::vector<std::unique_ptr<char[]>> objects;
+    objects.reserve(nr);
+    memory::scoped_heap_profiling profiling;
+    auto before = profiled_objects();
+    for (size_t i = 0; i < nr; i++) {
+        objects.push_back(std::make_unique<char[]>(size));
+    }
+    return profiled_objects() - before;
+}
+
+SEASTAR_TEST_CASE(test_heap_profiling_sample_period) {
+    constexpr size_t nr = 10000;
+    constexpr size_t size = 1000;
+
+    // Without a period, every allocation is recorded
+    memory::set_heap_profiling_sample_period(0);
+    BOOST_REQUIRE_EQUAL(memory::get_heap_profiling_sample_period(), 0);
+    BOOST_REQUIRE_GE(profile_allocations(nr, size), nr);
+
+    // With one, about one allocation per period bytes is. The number of
+    // samples is Poisson distributed with a mean of 100 here, the bounds
+    // are far enough out not to be hit by chance.
+    memory::set_heap_profiling_sample_period(100 * size);
+    BOOST_REQUIRE_EQUAL(memory::get_heap_profiling_sample_period(), 100 * size);
+    auto sampled = profile_allocations(nr, size);
+    BOOST_REQUIRE_GE(sampled, 50);
+    BOOST_REQUIRE_LE(sampled, 200);
+
+    memory::set_heap_profiling_sample_period(0);
+    return make_ready_future<>();
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/http/internal/hpack.hh>
+
+using namespace seastar;
+using namespace seastar::httpd::internal;
+
+static std::string from_hex(std::string_view hex) {
+    std::string ret;
+    std::string digits;
+    for (auto c : hex) {
+        if (c != ' ') {
+            digits.push_back(c);
+        }
+    }
+    for (size_t i = 0; i < digits.size(); i += 2) {
+        ret.push_back(char(std::stoi(digits.substr(i, 2), nullptr, 16)));
+    }
+    return ret;
+}
+
+static std::string huffman(std::string_view s) {
+    std::string out;
+    huffman_encode(out, s);
+    return out;
+}
+
+// Examples from RFC 7541, Appendix C
+
+BOOST_AUTO_TEST_CASE(test_huffman) {
+    std::vector<std::pair<std::string_view, std::string_view>> examples = {
+        { "www.example.com", "f1e3 c2e5 f23a 6ba0 ab90 f4ff" },
+        { "no-cache", "a8eb 1064 9cbf" },
+        { "custom-key", "25a8 49e9 5ba9 7d7f" },
+        { "custom-value", "25a8 49e9 5bb8 e8b4 bf" },
+        { "302", "6402" },
+        { "private", "aec3 771a 4b" },
+        { "Mon, 21 Oct 2013 20:13:21 GMT", "d07a be94 1054 d444 a820 0595 040b 8166 e082 a62d 1bff" },
+        { "https://www.example.com", "9d29 ad17 1863 c78f 0b97 c8e9 ae82 ae43 d3" },
+        { "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1",
+          "94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07" },
+    };
+    for (auto& [text, encoded] : examples) {
+        BOOST_REQUIRE(huffman(text) == from_hex(encoded));
+        BOOST_REQUIRE_EQUAL(huffman_decode(from_hex(encoded)), sstring(text));
+    }
+
+    std::string all_bytes;
+    for (int i = 0; i < 256; ++i) {
+        all_bytes.push_back(char(i));
+    }
+    BOOST_REQUIRE(std::string(huffman_decode(huffman(all_bytes))) == all_bytes);
+
+    // Padding which is not a prefix of EOS
+    BOOST_REQUIRE_THROW(huffman_decode(from_hex("f1e3 c2e5 f23a 6ba0 ab90 f400")), hpack_error);
+    // Padding longer than 7 bits
+    BOOST_REQUIRE_THROW(huffman_decode(from_hex("6402 ff")), hpack_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_requests) {
+    // C.4, requests with Huffman coding, sharing the dynamic table
+    hpack_decoder decoder;
+
+    auto h = decoder.decode(from_hex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"));
+    header_list expected = { {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"} };
+    BOOST_REQUIRE(h == expected);
+    BOOST_REQUIRE_EQUAL(decoder.table_size(), 57);
+
+    h = decoder.decode(from_hex("8286 84be 5886 a8eb 1064 9cbf"));
+    expected.emplace_back("cache-control", "no-cache");
+    BOOST_REQUIRE(h == expected);
+    BOOST_REQUIRE_EQUAL(decoder.table_size(), 110);
+
+    h = decoder.decode(from_hex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"));
+    expected = { {":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"}, {":authority", "www.example.com"}, {"custom-key", "custom-value"} };
+    BOOST_REQUIRE(h == expected);
+    BOOST_REQUIRE_EQUAL(decoder.table_size(), 164);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_with_eviction) {
+    // C.5, responses with a 256 byte table, which evicts entries
+    hpack_decoder decoder(256);
+
+    auto h = decoder.decode(from_hex("4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133"
+            "2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"));
+    header_list expected = { {":status", "302"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+            {"location", "https://www.example.com"} };
+    BOOST_REQUIRE(h == expected);
+    BOOST_REQUIRE_EQUAL(decoder.table_size(), 222);
+
+    h = decoder.decode(from_hex("4803 3330 37c1 c0bf"));
+    expected[0].second = "307";
+    BOOST_REQUIRE(h == expected);
+    BOOST_REQUIRE_EQUAL(decoder.table_size(), 222);
+
+    h = decoder.decode(from_hex("88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d"
+            "54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49"
+            "553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31"));
+    expected = { {":status", "200"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+            {"location", "https://www.example.com"}, {"content-encoding", "gzip"},
+            {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"} };
+    BOOST_REQUIRE(h == expected);
+    BOOST_REQUIRE_EQUAL(decoder.table_size(), 215);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_errors) {
+    hpack_decoder decoder;
+    // Index past the end of the (empty) dynamic table
+    BOOST_REQUIRE_THROW(decoder.decode(from_hex("be")), hpack_error);
+    // Table size update above the advertised limit
+    BOOST_REQUIRE_THROW(hpack_decoder().decode(from_hex("3fe2 1f")), hpack_error);
+    // Table size update after a field
+    BOOST_REQUIRE_THROW(hpack_decoder().decode(from_hex("823f e11f")), hpack_error);
+    // Truncated literal
+    BOOST_REQUIRE_THROW(hpack_decoder().decode(from_hex("400a 6375 7374")), hpack_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_encode) {
+    hpack_encoder encoder;
+    std::string block;
+    encoder.encode(block, ":status", "200");
+    encoder.encode(block, ":status", "201");
+    encoder.encode(block, "content-type", "application/json");
+    encoder.encode(block, "x-custom", "value");
+    // Fully indexed static table entry
+    BOOST_REQUIRE_EQUAL(uint8_t(block[0]), 0x88);
+
+    hpack_decoder decoder;
+    header_list expected = { {":status", "200"}, {":status", "201"}, {"content-type", "application/json"}, {"x-custom", "value"} };
+    BOOST_REQUIRE(decoder.decode(block) == expected);
+    // Nothing goes to the dynamic table
+    BOOST_REQUIRE_EQUAL(decoder.table_size(), 0);
+}
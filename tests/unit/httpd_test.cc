@@ -3,6 +3,7 @@
  */
 
 #include <seastar/http/httpd.hh>
+#include <seastar/http/client.hh>
 #include <seastar/http/handlers.hh>
 #include <seastar/http/matcher.hh>
 #include <seastar/http/matchrules.hh>
@@ -10,8 +11,13 @@
 #include <seastar/http/routes.hh>
 #include <seastar/http/exception.hh>
 #include <seastar/http/transformers.hh>
+#include <seastar/http/file_handler.hh>
 #include <seastar/core/do_with.hh>
+#include <seastar/core/fstream.hh>
 #include <seastar/core/loop.hh>
+#include <seastar/core/metrics_api.hh>
+#include <seastar/core/otlp.hh>
+#include <seastar/core/trace_context.hh>
 #include <seastar/core/when_all.hh>
 #include <seastar/testing/test_case.hh>
 #include <seastar/testing/thread_test_case.hh>
@@ -24,6 +30,10 @@
 #include <sstream>
 #include <seastar/core/shared_future.hh>
 #include <seastar/util/later.hh>
+#include <seastar/util/tmp_file.hh>
+#include <seastar/http/internal/hpack.hh>
+#include <zlib.h>
+#include <zstd.h>
 
 using namespace seastar;
 using namespace httpd;
@@ -116,6 +126,75 @@ SEASTAR_TEST_CASE(test_put_drop_rule)
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(test_rule_priority)
+{
+    routes rts;
+    parameters params;
+    httpd::handler_base* nl = nullptr;
+
+    handl* h1 = new handl();
+    match_rule* r1 = new match_rule(h1);
+    r1->add_str("/api").add_param("id");
+    auto c1 = rts.add_cookie(r1, GET);
+
+    handl* h2 = new handl();
+    match_rule* r2 = new match_rule(h2);
+    r2->add_str("/api/special");
+    rts.add_cookie(r2, GET);
+
+    handl* h3 = new handl();
+    rts.add(GET, url("/api/files").remainder("path"), h3);
+
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/api/special", params), h1);
+    BOOST_REQUIRE_EQUAL(params["id"], "special");
+    params.clear();
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/api/x/", params), h1);
+    params.clear();
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/api/x/y", params), nl);
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/api/files/a/b", params), h3);
+    BOOST_REQUIRE_EQUAL(params.path("path"), "/a/b");
+    params.clear();
+    BOOST_REQUIRE_EQUAL(rts.get_handler(POST, "/api/special", params), nl);
+
+    delete rts.del_cookie(c1, GET);
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/api/special", params), h2);
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/api/x", params), nl);
+    return make_ready_future<>();
+}
+
+// A matcher the routes can't index, tried in order with the indexed rules
+class any_matcher : public matcher {
+public:
+    virtual size_t match(const sstring& url, size_t ind, parameters& param) override {
+        return url.length();
+    }
+};
+
+SEASTAR_TEST_CASE(test_custom_matcher_priority)
+{
+    routes rts;
+    parameters params;
+
+    handl* h1 = new handl();
+    match_rule* r1 = new match_rule(h1);
+    r1->add_matcher(new any_matcher());
+    auto c1 = rts.add_cookie(r1, GET);
+
+    handl* h2 = new handl();
+    rts.add(GET, url("/hello"), h2);
+
+    handl* h3 = new handl();
+    match_rule* r3 = new match_rule(h3);
+    r3->add_str("/bye").add_matcher(new any_matcher());
+    rts.add_cookie(r3, GET);
+
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/hello", params), h1);
+    delete rts.del_cookie(c1, GET);
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/hello", params), h2);
+    BOOST_REQUIRE_EQUAL(rts.get_handler(GET, "/bye/now", params), h3);
+    return make_ready_future<>();
+}
+
 // Putting a duplicated exact rule would result
 // in a memory leak due to the fact that rules are implemented
 // as raw pointers. In order to prevent such leaks,
@@ -247,6 +326,107 @@ SEASTAR_TEST_CASE(test_routes) {
     });
 }
 
+SEASTAR_THREAD_TEST_CASE(test_route_trace_context) {
+    routes route;
+    route.put(operation_type::GET, "/trace", new function_handler([] (const_req req) {
+        auto ctx = tracing::current_trace_context();
+        return ctx ? ctx->to_traceparent() : sstring("none");
+    }, "txt"));
+    auto handle = [&] (sstring traceparent) {
+        auto req = std::make_unique<request>();
+        req->_method = "GET";
+        if (!traceparent.empty()) {
+            req->_headers["traceparent"] = traceparent;
+        }
+        return route.handle("/trace", std::move(req), std::make_unique<reply>()).get0()->_content;
+    };
+
+    BOOST_REQUIRE_EQUAL(handle(""), "none");
+
+    // The handler is a child span of the caller
+    auto caller = "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+    auto ctx = tracing::trace_context::from_traceparent(handle(caller));
+    BOOST_REQUIRE(ctx);
+    BOOST_REQUIRE(ctx->trace_id == tracing::trace_context::from_traceparent(caller)->trace_id);
+    BOOST_REQUIRE(ctx->sampled());
+    BOOST_REQUIRE(!tracing::current_trace_context());
+
+    // With a sampler, requests without a context start a trace
+    tracing::set_sampler(tracing::make_ratio_sampler(1));
+    ctx = tracing::trace_context::from_traceparent(handle(""));
+    tracing::set_sampler({});
+    BOOST_REQUIRE(ctx);
+    BOOST_REQUIRE(ctx->sampled());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_route_metrics) {
+    routes route;
+    route.enable_metrics("route_metrics_test");
+    route.add(operation_type::GET, url("/api").remainder("path"), new handl());
+    route.put(operation_type::GET, "/exact", new handl());
+    for (auto path : {"/api/abc", "/api/def", "/exact", "/missing"}) {
+        auto req = std::make_unique<request>();
+        req->_method = "GET";
+        route.handle(path, std::move(req), std::make_unique<reply>()).get();
+    }
+
+    namespace smi = seastar::metrics::impl;
+    auto values = smi::get_values();
+    auto& metadata = *values->metadata;
+    std::map<sstring, uint64_t> handled;
+    for (size_t i = 0; i < metadata.size(); i++) {
+        if (metadata[i].mf.name != "httpd_route_handler_latency") {
+            continue;
+        }
+        for (size_t j = 0; j < metadata[i].metrics.size(); j++) {
+            auto& labels = metadata[i].metrics[j].id.labels();
+            if (labels.at("service") == "route_metrics_test") {
+                BOOST_REQUIRE_EQUAL(labels.at("method"), "GET");
+                handled[labels.at("route")] = values->values[i][j].get_histogram().sample_count;
+            }
+        }
+    }
+    BOOST_REQUIRE_EQUAL(handled.size(), 3);
+    BOOST_REQUIRE_EQUAL(handled["/api/{path}"], 2);
+    BOOST_REQUIRE_EQUAL(handled["/exact"], 1);
+    BOOST_REQUIRE_EQUAL(handled["not_found"], 1);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_shared_routes) {
+    auto make_table = [] (sstring content) {
+        auto table = seastar::make_shared<routes>();
+        table->put(operation_type::GET, "/table", new function_handler([content] (const_req req) {
+            return content;
+        }, "txt"));
+        return make_foreign(seastar::shared_ptr<const routes>(std::move(table)));
+    };
+    routes route;
+    route.put(operation_type::GET, "/local", new function_handler([] (const_req req) {
+        return "local";
+    }, "txt"));
+    auto handle = [&] (sstring path) {
+        auto req = std::make_unique<request>();
+        req->_method = "GET";
+        return route.handle(path, std::move(req), std::make_unique<reply>()).get0();
+    };
+
+    route.set_shared(make_table("first"));
+    BOOST_REQUIRE_EQUAL(handle("/table")->_content, "first");
+    BOOST_REQUIRE_EQUAL((int)handle("/local")->_status, (int)reply::status_type::not_found);
+
+    // A request in flight keeps the table it started with
+    auto req = std::make_unique<request>();
+    req->_method = "GET";
+    auto in_flight = route.handle("/table", std::move(req), std::make_unique<reply>());
+    route.set_shared(make_table("second"));
+    BOOST_REQUIRE_EQUAL(in_flight.get0()->_content, "first");
+    BOOST_REQUIRE_EQUAL(handle("/table")->_content, "second");
+
+    route.set_shared({});
+    BOOST_REQUIRE_EQUAL(handle("/local")->_content, "local");
+    BOOST_REQUIRE_EQUAL((int)handle("/table")->_status, (int)reply::status_type::not_found);
+}
+
 SEASTAR_TEST_CASE(test_json_path) {
     shared_ptr<bool> res1 = make_shared<bool>(false);
     shared_ptr<bool> res2 = make_shared<bool>(false);
@@ -1120,6 +1300,51 @@ SEASTAR_TEST_CASE(test_string_content) {
     });
 }
 
+SEASTAR_THREAD_TEST_CASE(test_pipelined_requests) {
+    loopback_connection_factory lcf;
+    http_server server("test");
+    loopback_socket_impl lsi(lcf);
+    httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+    promise<> release;
+    promise<> fast_handled;
+    server._routes.put(GET, "/slow", new function_handler([&] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+        return release.get_future().then([rep = std::move(rep)] () mutable {
+            rep->write_body("txt", sstring("slow"));
+            return std::move(rep);
+        });
+    }, "txt"));
+    server._routes.put(GET, "/fast", new function_handler([&] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+        fast_handled.set_value();
+        rep->write_body("txt", sstring("fast"));
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }, "txt"));
+    server.do_accepts(0).get();
+
+    connected_socket c_socket = lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr())).get0();
+    input_stream<char> input(c_socket.input());
+    output_stream<char> output(c_socket.output());
+    output.write(sstring("GET /slow HTTP/1.1\r\nHost: test\r\n\r\n"
+                         "GET /fast HTTP/1.1\r\nHost: test\r\nContent-Length: 4\r\n\r\nbody")).get();
+    output.flush().get();
+
+    // The second request is handled while the first one waits
+    fast_handled.get_future().get();
+    release.set_value();
+
+    // And the replies come in request order
+    std::string replies;
+    while (replies.find("fast") == std::string::npos) {
+        auto buf = input.read().get0();
+        BOOST_REQUIRE(!buf.empty());
+        replies.append(buf.get(), buf.size());
+    }
+    BOOST_REQUIRE_LT(replies.find("slow"), replies.find("fast"));
+
+    input.close().get();
+    output.close().get();
+    server.stop().get();
+}
+
 SEASTAR_TEST_CASE(test_full_chunk_format) {
     return check_http_reply({
         "GET /test HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n",
@@ -1218,3 +1443,507 @@ SEASTAR_TEST_CASE(test_shared_future) {
 
     return std::move(fut).discard_result();
 }
+
+class loopback_http_connection_factory : public http::experimental::connection_factory {
+    loopback_connection_factory& _lcf;
+    std::vector<std::unique_ptr<loopback_socket_impl>> _sockets;
+public:
+    explicit loopback_http_connection_factory(loopback_connection_factory& lcf) : _lcf(lcf) {}
+    virtual future<connected_socket> make() override {
+        socket_address addr{ipv4_addr()};
+        _sockets.push_back(std::make_unique<loopback_socket_impl>(_lcf));
+        return _sockets.back()->connect(addr, addr);
+    }
+};
+
+static future<> read_body(input_stream<char>& in, sstring& body) {
+    return do_until([&in] { return in.eof(); }, [&in, &body] {
+        return in.read().then([&body] (temporary_buffer<char> buf) {
+            body += to_sstring(std::move(buf));
+        });
+    });
+}
+
+static void run_client_test(noncopyable_function<void(http_server&)> routes,
+        http::experimental::client::config cfg,
+        noncopyable_function<void(http::experimental::client&)> test) {
+    loopback_connection_factory lcf;
+    http_server server("test");
+    server.set_content_streaming(true);
+    httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+    routes(server);
+    server.do_accepts(0).get();
+
+    http::experimental::client cln(std::make_unique<loopback_http_connection_factory>(lcf), "test", cfg);
+    test(cln);
+    cln.close().get();
+    server.stop().get();
+}
+
+static void put_hello_route(http_server& server) {
+    server._routes.put(GET, "/hello", new function_handler([] (const_req req) {
+        return "hello";
+    }, "txt"));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_client_keepalive) {
+    run_client_test(put_hello_route, {}, [] (http::experimental::client& cln) {
+        for (int i = 0; i < 3; i++) {
+            sstring body;
+            auto req = request::make("GET", "test", "/hello");
+            cln.make_request(std::move(req), [&body] (const reply& rep, input_stream<char>& in) {
+                BOOST_REQUIRE(rep._status == reply::status_type::ok);
+                return read_body(in, body);
+            }).get();
+            BOOST_REQUIRE_EQUAL(body, "hello");
+            BOOST_REQUIRE_EQUAL(cln.connections_nr(), 1);
+        }
+    });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_client_pipelining) {
+    http::experimental::client::config cfg;
+    cfg.max_connections = 1;
+    cfg.max_pipeline_depth = 4;
+    run_client_test(put_hello_route, cfg, [] (http::experimental::client& cln) {
+        std::vector<sstring> bodies(16);
+        parallel_for_each(bodies, [&cln] (sstring& body) {
+            return cln.make_request(request::make("GET", "test", "/hello"), [&body] (const reply& rep, input_stream<char>& in) {
+                return read_body(in, body);
+            });
+        }).get();
+        for (auto& body : bodies) {
+            BOOST_REQUIRE_EQUAL(body, "hello");
+        }
+        BOOST_REQUIRE_EQUAL(cln.connections_nr(), 1);
+    });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_client_streamed_body) {
+    auto routes = [] (http_server& server) {
+        server._routes.put(POST, "/echo", new echo_stream_handler());
+    };
+    run_client_test(routes, {}, [] (http::experimental::client& cln) {
+        auto writer = [] (output_stream<char>&& out) {
+            return do_with(std::move(out), [] (output_stream<char>& out) {
+                return out.write("1234567890").then([&out] {
+                    return out.flush();
+                }).then([&out] {
+                    return out.write("abcdefghij");
+                }).finally([&out] {
+                    return out.close();
+                });
+            });
+        };
+
+        auto chunked = request::make("POST", "test", "/echo");
+        chunked.write_body("txt", writer);
+        sstring body;
+        cln.make_request(std::move(chunked), [&body] (const reply& rep, input_stream<char>& in) {
+            return read_body(in, body);
+        }).get();
+        BOOST_REQUIRE_EQUAL(body, "1234567890abcdefghij");
+
+        auto sized = request::make("POST", "test", "/echo");
+        sized.write_body("txt", 20, writer);
+        body = "";
+        cln.make_request(std::move(sized), [&body] (const reply& rep, input_stream<char>& in) {
+            return read_body(in, body);
+        }).get();
+        BOOST_REQUIRE_EQUAL(body, "1234567890abcdefghij");
+        BOOST_REQUIRE_EQUAL(cln.connections_nr(), 1);
+    });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_client_unexpected_status) {
+    run_client_test(put_hello_route, {}, [] (http::experimental::client& cln) {
+        auto f = cln.make_request(request::make("GET", "test", "/missing"), [] (const reply& rep, input_stream<char>& in) {
+            BOOST_FAIL("handler called for an unexpected status");
+            return make_ready_future<>();
+        });
+        BOOST_REQUIRE_THROW(f.get(), http::experimental::unexpected_status_error);
+
+        // The connection was dropped with the unread body, a new one is used
+        sstring body;
+        cln.make_request(request::make("GET", "test", "/hello"), [&body] (const reply& rep, input_stream<char>& in) {
+            return read_body(in, body);
+        }).get();
+        BOOST_REQUIRE_EQUAL(body, "hello");
+        BOOST_REQUIRE_EQUAL(cln.connections_nr(), 1);
+    });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_client_abort) {
+    promise<> unblock;
+    auto routes = [&unblock] (http_server& server) {
+        server._routes.put(GET, "/block", new function_handler([&unblock] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+            return unblock.get_future().then([rep = std::move(rep)] () mutable {
+                return std::move(rep);
+            });
+        }, "txt"));
+    };
+    run_client_test(routes, {}, [&unblock] (http::experimental::client& cln) {
+        abort_source as;
+        timer<> t([&as] { as.request_abort(); });
+        t.arm(std::chrono::milliseconds(10));
+        auto f = cln.make_request(request::make("GET", "test", "/block"), [] (const reply& rep, input_stream<char>& in) {
+            return make_ready_future<>();
+        }, reply::status_type::ok, &as);
+        BOOST_REQUIRE_THROW(f.get(), abort_requested_exception);
+        unblock.set_value();
+    });
+}
+
+static void write_file(const sstring& name, const sstring& content) {
+    auto f = open_file_dma(name, open_flags::wo | open_flags::create | open_flags::truncate).get0();
+    auto out = make_file_output_stream(std::move(f)).get0();
+    out.write(content).get();
+    out.close().get();
+}
+
+static sstring get_file(http::experimental::client& cln, const sstring& path) {
+    sstring body;
+    cln.make_request(request::make("GET", "test", path), [&body] (const reply& rep, input_stream<char>& in) {
+        auto i = rep._headers.find("Content-Length");
+        BOOST_REQUIRE(i != rep._headers.end());
+        return read_body(in, body).then([&body, len = i->second] {
+            BOOST_REQUIRE_EQUAL(to_sstring(body.size()), len);
+        });
+    }).get();
+    return body;
+}
+
+SEASTAR_THREAD_TEST_CASE(test_file_handler) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring small = (t.get_path() / "small.txt").native();
+        sstring large = (t.get_path() / "large.txt").native();
+        sstring large_content(100000, 'x');
+        write_file(small, "hello");
+        write_file(large, large_content);
+
+        auto routes = [&] (http_server& server) {
+            server._routes.put(GET, "/small", (new file_handler(small, nullptr, false))->set_cache(1024, 4096));
+            server._routes.put(GET, "/large", (new file_handler(large, nullptr, false))->set_cache(1024, 4096));
+            server._routes.put(GET, "/missing", new file_handler((t.get_path() / "missing").native(), nullptr, false));
+        };
+        run_client_test(routes, {}, [&] (http::experimental::client& cln) {
+            BOOST_REQUIRE_EQUAL(get_file(cln, "/small"), "hello");
+            BOOST_REQUIRE_EQUAL(get_file(cln, "/small"), "hello");
+            write_file(small, "hello again");
+            BOOST_REQUIRE_EQUAL(get_file(cln, "/small"), "hello again");
+            BOOST_REQUIRE_EQUAL(get_file(cln, "/large"), large_content);
+
+            cln.make_request(request::make("GET", "test", "/missing"), [] (const reply& rep, input_stream<char>& in) {
+                sstring body;
+                return do_with(std::move(body), [&in] (sstring& body) {
+                    return read_body(in, body);
+                });
+            }, reply::status_type::not_found).get();
+        });
+    }).get();
+}
+
+static sstring http2_frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    std::string f;
+    f.push_back(char(payload.size() >> 16));
+    f.push_back(char(payload.size() >> 8));
+    f.push_back(char(payload.size()));
+    f.push_back(char(type));
+    f.push_back(char(flags));
+    f.push_back(char(stream_id >> 24));
+    f.push_back(char(stream_id >> 16));
+    f.push_back(char(stream_id >> 8));
+    f.push_back(char(stream_id));
+    f.append(payload);
+    return sstring(f.data(), f.size());
+}
+
+static std::string http2_headers(std::vector<std::pair<std::string_view, std::string_view>> fields) {
+    seastar::httpd::internal::hpack_encoder encoder;
+    std::string block;
+    for (auto& [name, value] : fields) {
+        encoder.encode(block, name, value);
+    }
+    return block;
+}
+
+SEASTAR_TEST_CASE(test_http2) {
+    return seastar::async([] {
+        loopback_connection_factory lcf;
+        http_server server("test");
+        loopback_socket_impl lsi(lcf);
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+
+        future<> client = seastar::async([&lsi] {
+            connected_socket c_socket = lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr())).get0();
+            input_stream<char> input(c_socket.input());
+            output_stream<char> output(c_socket.output());
+
+            // Prior knowledge: the preface, then requests without waiting for the server's SETTINGS
+            output.write(sstring("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n")).get();
+            output.write(http2_frame(0x4, 0, 0, "")).get();
+            output.write(http2_frame(0x1, 0x5, 1, http2_headers({{":method", "GET"}, {":scheme", "http"}, {":path", "/hello"}, {":authority", "test"}}))).get();
+            output.write(http2_frame(0x1, 0x4, 3, http2_headers({{":method", "POST"}, {":scheme", "http"}, {":path", "/echo?x=1"}, {"x-test", "value"}}))).get();
+            output.write(http2_frame(0x0, 0, 3, "bo")).get();
+            output.write(http2_frame(0x0, 0x1, 3, "dy")).get();
+            output.write(http2_frame(0x1, 0x5, 5, http2_headers({{":method", "GET"}, {":scheme", "http"}, {":path", "/stream"}}))).get();
+            output.flush().get();
+
+            struct response {
+                std::map<sstring, sstring> headers;
+                sstring body;
+                bool done = false;
+            };
+            std::map<uint32_t, response> responses;
+            seastar::httpd::internal::hpack_decoder decoder;
+            bool server_settings = false;
+            bool settings_acked = false;
+            auto all_done = [&] {
+                return responses.size() == 3 && std::all_of(responses.begin(), responses.end(), [] (auto& r) { return r.second.done; });
+            };
+            while (!all_done()) {
+                auto header = input.read_exactly(9).get0();
+                BOOST_REQUIRE_EQUAL(header.size(), 9);
+                auto p = reinterpret_cast<const uint8_t*>(header.get());
+                size_t length = (size_t(p[0]) << 16) | (size_t(p[1]) << 8) | p[2];
+                uint8_t type = p[3];
+                uint8_t flags = p[4];
+                uint32_t stream_id = ((uint32_t(p[5]) << 24) | (uint32_t(p[6]) << 16) | (uint32_t(p[7]) << 8) | p[8]) & 0x7fffffff;
+                auto payload = input.read_exactly(length).get0();
+                BOOST_REQUIRE_EQUAL(payload.size(), length);
+                switch (type) {
+                case 0x4:
+                    if (flags & 0x1) {
+                        settings_acked = true;
+                    } else {
+                        server_settings = true;
+                        output.write(http2_frame(0x4, 0x1, 0, "")).get();
+                        output.flush().get();
+                    }
+                    break;
+                case 0x1: {
+                    // Header blocks of these responses fit in a single frame
+                    BOOST_REQUIRE(flags & 0x4);
+                    auto& r = responses[stream_id];
+                    for (auto& [name, value] : decoder.decode(std::string_view(payload.get(), payload.size()))) {
+                        r.headers[name] = value;
+                    }
+                    r.done = flags & 0x1;
+                    break;
+                }
+                case 0x0: {
+                    auto& r = responses[stream_id];
+                    r.body += sstring(payload.get(), payload.size());
+                    r.done = flags & 0x1;
+                    break;
+                }
+                default:
+                    BOOST_FAIL(format("Unexpected frame type {}", type));
+                }
+            }
+            BOOST_REQUIRE(server_settings);
+            BOOST_REQUIRE(settings_acked);
+
+            BOOST_REQUIRE_EQUAL(responses[1].headers[":status"], "200");
+            BOOST_REQUIRE_EQUAL(responses[1].body, "hello");
+            BOOST_REQUIRE_EQUAL(responses[3].headers[":status"], "200");
+            BOOST_REQUIRE_EQUAL(responses[3].body, "body,value,1");
+            BOOST_REQUIRE_EQUAL(responses[5].headers[":status"], "200");
+            BOOST_REQUIRE_EQUAL(responses[5].headers["content-type"], "application/json");
+            BOOST_REQUIRE_NE(responses[5].body.find("hello"), sstring::npos);
+
+            input.close().get();
+            output.close().get();
+        });
+
+        put_hello_route(server);
+        server._routes.put(POST, "/echo", new function_handler([] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+            rep->_content = req->content + "," + req->get_header("X-Test") + "," + req->get_query_param("x");
+            rep->done("txt");
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        }, "txt"));
+        server._routes.put(GET, "/stream", new json_test_handler(json::stream_object("hello")));
+        server.do_accepts(0).get();
+
+        client.get();
+        server.stop().get();
+    });
+}
+
+static sstring inflate_body(const sstring& compressed, int window_bits) {
+    z_stream zs = {};
+    BOOST_REQUIRE_EQUAL(inflateInit2(&zs, window_bits), Z_OK);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    zs.avail_in = compressed.size();
+    sstring ret;
+    int r;
+    do {
+        char buf[4096];
+        zs.next_out = reinterpret_cast<Bytef*>(buf);
+        zs.avail_out = sizeof(buf);
+        r = inflate(&zs, Z_NO_FLUSH);
+        BOOST_REQUIRE(r == Z_OK || r == Z_STREAM_END);
+        ret += sstring(buf, sizeof(buf) - zs.avail_out);
+    } while (r != Z_STREAM_END);
+    inflateEnd(&zs);
+    return ret;
+}
+
+static sstring zstd_decompress_body(const sstring& compressed) {
+    auto dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer input = { compressed.data(), compressed.size(), 0 };
+    sstring ret;
+    size_t r;
+    do {
+        char buf[4096];
+        ZSTD_outBuffer output = { buf, sizeof(buf), 0 };
+        r = ZSTD_decompressStream(dctx, &output, &input);
+        BOOST_REQUIRE(!ZSTD_isError(r));
+        ret += sstring(buf, output.pos);
+    } while (r != 0);
+    ZSTD_freeDCtx(dctx);
+    return ret;
+}
+
+SEASTAR_THREAD_TEST_CASE(test_admission_control) {
+    promise<> entered;
+    promise<> release;
+    auto routes = [&] (http_server& server) {
+        admission_config cfg;
+        cfg.max_requests = 1;
+        cfg.priority_paths = {"/health"};
+        server.set_admission_control(cfg);
+        server._routes.put(GET, "/slow", new function_handler([&] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+            entered.set_value();
+            return release.get_future().then([rep = std::move(rep)] () mutable {
+                rep->write_body("txt", sstring("slow"));
+                return std::move(rep);
+            });
+        }, "txt"));
+        put_hello_route(server);
+        server._routes.put(GET, "/health", new function_handler([] (const_req req) {
+            return "ok";
+        }, "txt"));
+    };
+    run_client_test(routes, {}, [&] (http::experimental::client& cln) {
+        auto get = [&cln] (sstring path, reply::status_type expected) {
+            auto body = make_lw_shared<sstring>();
+            return cln.make_request(request::make("GET", "test", path), [body, expected] (const reply& rep, input_stream<char>& in) {
+                BOOST_REQUIRE_EQUAL(int(rep._status), int(expected));
+                return read_body(in, *body);
+            }).then([body] {
+                return *body;
+            });
+        };
+        auto slow = get("/slow", reply::status_type::ok);
+        entered.get_future().get();
+        // The only request slot is taken, health checks still get through
+        BOOST_REQUIRE_EQUAL(get("/health", reply::status_type::ok).get0(), "ok");
+        get("/hello", reply::status_type::service_unavailable).get();
+        release.set_value();
+        BOOST_REQUIRE_EQUAL(slow.get0(), "slow");
+        BOOST_REQUIRE_EQUAL(get("/hello", reply::status_type::ok).get0(), "hello");
+    });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_compression) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        sstring text;
+        for (int i = 0; i < 1000; ++i) {
+            text += format("hello world {}\n", i);
+        }
+        sstring file = (t.get_path() / "file.txt").native();
+        write_file(file, text);
+        // Served as it is, so it doesn't need to be gzip for real
+        write_file(file + ".gz", "pre-compressed");
+
+        auto routes = [&] (http_server& server) {
+            server.set_compression(compression_config{});
+            server._routes.put(GET, "/text", new function_handler([&text] (const_req req) {
+                return text;
+            }, "txt"));
+            server._routes.put(GET, "/small", new function_handler([] (const_req req) {
+                return "hello";
+            }, "txt"));
+            server._routes.put(GET, "/stream", new json_test_handler(json::stream_object(text)));
+            server._routes.put(GET, "/file", (new file_handler(file, nullptr, false))->set_precompressed());
+        };
+        run_client_test(routes, {}, [&] (http::experimental::client& cln) {
+            auto get = [&cln] (sstring path, sstring accept_encoding, sstring expected_encoding) {
+                auto req = request::make("GET", "test", path);
+                if (!accept_encoding.empty()) {
+                    req._headers["Accept-Encoding"] = accept_encoding;
+                }
+                sstring body;
+                cln.make_request(std::move(req), [&] (const reply& rep, input_stream<char>& in) {
+                    auto i = rep._headers.find("Content-Encoding");
+                    BOOST_REQUIRE_EQUAL(i == rep._headers.end() ? "" : i->second, expected_encoding);
+                    return read_body(in, body);
+                }).get();
+                return body;
+            };
+            BOOST_REQUIRE_EQUAL(inflate_body(get("/text", "gzip", "gzip"), 15 + 16), text);
+            BOOST_REQUIRE_EQUAL(zstd_decompress_body(get("/text", "deflate;q=0.5, zstd", "zstd")), text);
+            BOOST_REQUIRE_EQUAL(inflate_body(get("/text", "br, *;q=0.1, zstd;q=0", "gzip"), 15 + 16), text);
+            BOOST_REQUIRE_EQUAL(get("/text", "", ""), text);
+            BOOST_REQUIRE_EQUAL(get("/text", "br, gzip;q=0", ""), text);
+            BOOST_REQUIRE_EQUAL(get("/small", "gzip", ""), "hello");
+            BOOST_REQUIRE_EQUAL(inflate_body(get("/stream", "deflate", "deflate"), 15), json::formatter::to_json(text));
+
+            BOOST_REQUIRE_EQUAL(get("/file", "gzip, zstd;q=0.5", "gzip"), "pre-compressed");
+            // No pre-compressed variant, so the server compresses it
+            BOOST_REQUIRE_EQUAL(zstd_decompress_body(get("/file", "zstd", "zstd")), text);
+            BOOST_REQUIRE_EQUAL(get("/file", "", ""), text);
+        });
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_otlp_exporter) {
+    loopback_connection_factory lcf;
+    http_server server("test");
+    httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+    std::vector<sstring> bodies;
+    server._routes.put(POST, "/v1/metrics", new function_handler([&bodies] (const_req req) {
+        BOOST_REQUIRE_EQUAL(req.get_header("Content-Encoding"), "gzip");
+        bodies.push_back(inflate_body(req.content, 15 + 16));
+        return "{}";
+    }, "json"));
+    server.do_accepts(0).get();
+
+    uint64_t counted = 5;
+    double gauge = 1.5;
+    metrics::metric_groups mg;
+    mg.add_group("otlp_test", {
+        metrics::make_counter("counted", counted, metrics::description("counted")),
+        metrics::make_gauge("gauge", gauge, metrics::description("gauge")),
+    });
+
+    otlp::config cfg;
+    cfg.host = "test";
+    otlp::exporter exporter(cfg, std::make_unique<loopback_http_connection_factory>(lcf));
+    exporter.push().get();
+    counted = 8;
+    gauge = 2.5;
+    exporter.push().get();
+    exporter.stop().get();
+    server.stop().get();
+
+    // The value of the first data point of a metric in a request
+    auto value_of = [] (const sstring& body, const sstring& name) {
+        auto pos = body.find("\"name\":\"seastar_" + name + "\"");
+        BOOST_REQUIRE(pos != sstring::npos);
+        pos = body.find("\"asDouble\":", pos);
+        BOOST_REQUIRE(pos != sstring::npos);
+        pos += strlen("\"asDouble\":");
+        return sstring(std::string_view(body).substr(pos, std::string_view(body).find_first_of(",}", pos) - pos));
+    };
+    BOOST_REQUIRE_EQUAL(bodies.size(), 2);
+    BOOST_REQUIRE(bodies[0].find("\"resourceMetrics\"") == 1);
+    BOOST_REQUIRE_EQUAL(value_of(bodies[0], "otlp_test_counted"), "5");
+    BOOST_REQUIRE_EQUAL(value_of(bodies[0], "otlp_test_gauge"), "1.5");
+    // counters are sent as deltas, gauges as they are
+    BOOST_REQUIRE_EQUAL(value_of(bodies[1], "otlp_test_counted"), "3");
+    BOOST_REQUIRE_EQUAL(value_of(bodies[1], "otlp_test_gauge"), "2.5");
+    BOOST_REQUIRE_EQUAL(exporter.get_stats().pushes, 2);
+    BOOST_REQUIRE_EQUAL(exporter.get_stats().failed_requests, 0);
+}
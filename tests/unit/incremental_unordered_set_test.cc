@@ -0,0 +1,128 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/core/incremental_unordered_set.hh>
+#include <boost/intrusive/unordered_set_hook.hpp>
+#include <functional>
+#include <memory>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+using namespace seastar;
+
+namespace bi = boost::intrusive;
+
+struct element {
+    uint64_t key;
+    bi::unordered_set_member_hook<> link;
+
+    explicit element(uint64_t k) : key(k) {}
+
+    friend bool operator==(const element& a, const element& b) {
+        return a.key == b.key;
+    }
+    friend size_t hash_value(const element& e) {
+        return std::hash<uint64_t>()(e.key);
+    }
+};
+
+struct key_equal {
+    bool operator()(uint64_t key, const element& e) const {
+        return key == e.key;
+    }
+    bool operator()(const element& e, uint64_t key) const {
+        return key == e.key;
+    }
+};
+
+using element_set = incremental_unordered_set<element,
+    bi::member_hook<element, bi::unordered_set_member_hook<>, &element::link>>;
+
+static element* find(element_set& set, uint64_t key) {
+    return set.find(key, std::hash<uint64_t>(), key_equal());
+}
+
+BOOST_AUTO_TEST_CASE(incremental_unordered_set_grows) {
+    element_set set(16);
+    std::vector<std::unique_ptr<element>> elements;
+    bool rehashed = false;
+    for (uint64_t i = 0; i < 100000; i++) {
+        elements.push_back(std::make_unique<element>(i));
+        auto [e, inserted] = set.insert(*elements.back());
+        BOOST_REQUIRE(inserted);
+        BOOST_REQUIRE_EQUAL(e, elements.back().get());
+        if (set.rehashing()) {
+            rehashed = true;
+            // Elements that were not moved yet are still found
+            BOOST_REQUIRE_EQUAL(find(set, i / 2), elements[i / 2].get());
+        }
+        BOOST_REQUIRE_EQUAL(set.size(), i + 1);
+    }
+    BOOST_REQUIRE(rehashed);
+    BOOST_REQUIRE_GE(set.bucket_count(), 100000 / 0.75 / 2);
+    for (uint64_t i = 0; i < 100000; i++) {
+        BOOST_REQUIRE_EQUAL(find(set, i), elements[i].get());
+    }
+
+    element dup(7);
+    auto [e, inserted] = set.insert(dup);
+    BOOST_REQUIRE(!inserted);
+    BOOST_REQUIRE_EQUAL(e, elements[7].get());
+
+    size_t counted = 0;
+    set.for_each_bucket_size([&] (size_t size) { counted += size; });
+    BOOST_REQUIRE_EQUAL(counted, set.size());
+
+    size_t disposed = 0;
+    set.clear_and_dispose([&] (element*) { disposed++; });
+    BOOST_REQUIRE_EQUAL(disposed, 100000u);
+    BOOST_REQUIRE(set.empty());
+    BOOST_REQUIRE(!find(set, 7));
+}
+
+BOOST_AUTO_TEST_CASE(incremental_unordered_set_random) {
+    element_set set(16);
+    std::unordered_set<uint64_t> ref;
+    std::vector<std::unique_ptr<element>> elements(10000);
+    std::default_random_engine rng;
+    for (int i = 0; i < 300000; i++) {
+        auto k = rng() % elements.size();
+        if (rng() % 3) {
+            if (!elements[k]) {
+                elements[k] = std::make_unique<element>(k);
+                BOOST_REQUIRE(set.insert(*elements[k]).second);
+                ref.insert(k);
+            }
+        } else if (elements[k]) {
+            set.erase(*elements[k]);
+            elements[k].reset();
+            ref.erase(k);
+        }
+        BOOST_REQUIRE_EQUAL(set.size(), ref.size());
+        auto q = rng() % elements.size();
+        BOOST_REQUIRE_EQUAL(find(set, q), elements[q].get());
+    }
+    set.clear_and_dispose([] (element*) {});
+}
@@ -56,8 +56,8 @@ struct io_queue_for_tests {
     io_queue queue;
     timer<> kicker;
 
-    io_queue_for_tests()
-        : group(std::make_shared<io_group>(io_queue::config{0}))
+    io_queue_for_tests(io_queue::config cfg = io_queue::config{0})
+        : group(std::make_shared<io_group>(std::move(cfg)))
         , sink()
         , queue(group, sink)
         , kicker([this] { kick(); })
@@ -70,6 +70,18 @@ struct io_queue_for_tests {
             fg->replenish_capacity(std::chrono::steady_clock::now());
         }
     }
+
+    void complete_requests(std::chrono::duration<double> lat, unsigned nr) {
+        group->_latency_hist[io_queue::latency_bucket(lat)] += nr;
+    }
+
+    void adjust_rates(io_queue::clock_type::time_point now) {
+        group->maybe_adjust_rates(now);
+    }
+
+    float rate_scale() const {
+        return group->_fgs[0]->rate_scale();
+    }
 };
 
 SEASTAR_THREAD_TEST_CASE(test_basic_flow) {
@@ -92,6 +104,111 @@ SEASTAR_THREAD_TEST_CASE(test_basic_flow) {
     f.get();
 }
 
+SEASTAR_THREAD_TEST_CASE(test_tracing) {
+    io_queue_for_tests tio;
+    fake_file<4> file;
+    tio.queue.start_tracing(3);
+
+    auto val = std::make_unique<int>(42);
+    std::vector<future<size_t>> futs;
+    for (size_t i = 0; i < 4; i++) {
+        futs.push_back(tio.queue.queue_request(default_priority_class(), 4, file.make_write_req(i, val.get()), nullptr));
+    }
+    seastar::sleep(std::chrono::milliseconds(500)).get();
+    tio.queue.poll_io_queue();
+    tio.sink.drain([&file] (internal::io_request& rq, io_completion* desc) -> bool {
+        file.execute_write_req(rq, desc);
+        return true;
+    });
+    when_all_succeed(futs.begin(), futs.end()).get();
+
+    // The oldest record was overwritten
+    auto records = tio.queue.trace();
+    BOOST_REQUIRE_EQUAL(records.size(), 3);
+    for (size_t i = 0; i < records.size(); i++) {
+        auto& r = records[i];
+        BOOST_REQUIRE_EQUAL(r.pos, i + 1);
+        BOOST_REQUIRE_EQUAL(r.length, 4);
+        BOOST_REQUIRE(r.write);
+        BOOST_REQUIRE(r.outcome == io_queue::trace_outcome::completed);
+        BOOST_REQUIRE_LE(r.queued, r.dispatched);
+        BOOST_REQUIRE_LE(r.dispatched, r.completed);
+        BOOST_REQUIRE_GT(r.ticket_weight, 0);
+        BOOST_REQUIRE_EQUAL(r.class_id, default_priority_class().id());
+    }
+
+    tio.queue.stop_tracing();
+    BOOST_REQUIRE(tio.queue.trace().empty());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_write_cost_factors) {
+    io_queue::config cfg{0};
+    cfg.disk_write_cost_factors = {1.0, 1.0, 1.5, 2.0};
+    io_queue_for_tests tio(cfg);
+    using dnl = internal::io_direction_and_length;
+
+    auto read = tio.queue.request_fq_ticket(dnl(dnl::read_idx, 4096));
+    BOOST_REQUIRE_EQUAL(read.weight(), io_queue::read_request_base_count);
+    BOOST_REQUIRE_EQUAL(read.size(), io_queue::read_request_base_count * 8);
+
+    auto small = tio.queue.request_fq_ticket(dnl(dnl::write_idx, 512));
+    BOOST_REQUIRE_EQUAL(small.weight(), io_queue::read_request_base_count);
+    BOOST_REQUIRE_EQUAL(small.size(), io_queue::read_request_base_count);
+
+    auto medium = tio.queue.request_fq_ticket(dnl(dnl::write_idx, 2048));
+    BOOST_REQUIRE_EQUAL(medium.weight(), io_queue::read_request_base_count * 3 / 2);
+    BOOST_REQUIRE_EQUAL(medium.size(), io_queue::read_request_base_count * 4 * 3 / 2);
+
+    // Lengths past the table use its last factor
+    auto large = tio.queue.request_fq_ticket(dnl(dnl::write_idx, 65536));
+    BOOST_REQUIRE_EQUAL(large.weight(), io_queue::read_request_base_count * 2);
+    BOOST_REQUIRE_EQUAL(large.size(), io_queue::read_request_base_count * 128 * 2);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_latency_buckets) {
+    for (auto us : {0, 1, 3, 4, 7, 100, 999, 1000, 12345, 1000000}) {
+        auto lat = std::chrono::duration<double>(us * 1e-6);
+        auto b = io_queue::latency_bucket(lat);
+        BOOST_REQUIRE(io_queue::latency_bucket_limit(b) > lat);
+        if (b > 0) {
+            BOOST_REQUIRE(io_queue::latency_bucket_limit(b - 1) <= lat);
+        }
+    }
+}
+
+SEASTAR_THREAD_TEST_CASE(test_latency_target_rate_control) {
+    io_queue::config cfg{0};
+    cfg.latency_target = std::chrono::milliseconds(1);
+    io_queue_for_tests tio(cfg);
+    auto now = io_queue::clock_type::now();
+
+    BOOST_REQUIRE_EQUAL(tio.rate_scale(), 1.0f);
+
+    // 2% of requests above the target, rates go down
+    tio.complete_requests(std::chrono::microseconds(100), 98);
+    tio.complete_requests(std::chrono::milliseconds(10), 2);
+    now += io_queue::latency_control_period;
+    tio.adjust_rates(now);
+    auto lowered = tio.rate_scale();
+    BOOST_REQUIRE_LT(lowered, 1.0f);
+
+    // Not enough time has passed
+    tio.complete_requests(std::chrono::milliseconds(10), 100);
+    tio.adjust_rates(now);
+    BOOST_REQUIRE_EQUAL(tio.rate_scale(), lowered);
+    now += io_queue::latency_control_period;
+    tio.adjust_rates(now);
+    BOOST_REQUIRE_LT(tio.rate_scale(), lowered);
+
+    // Healthy device, rates come back but not above the configured ones
+    for (int i = 0; i < 100; i++) {
+        tio.complete_requests(std::chrono::microseconds(100), 100);
+        now += io_queue::latency_control_period;
+        tio.adjust_rates(now);
+    }
+    BOOST_REQUIRE_EQUAL(tio.rate_scale(), 1.0f);
+}
+
 SEASTAR_THREAD_TEST_CASE(test_intent_safe_ref) {
     auto get_cancelled = [] (internal::intent_reference& iref) -> bool {
         try {
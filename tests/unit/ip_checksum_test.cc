@@ -0,0 +1,100 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2024 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/net/ip_checksum.hh>
+#include <random>
+#include <vector>
+
+using namespace seastar;
+using namespace net;
+
+// RFC 1071, a byte at a time
+static uint16_t reference_checksum(const uint8_t* data, size_t len) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += i & 1 ? data[i] : data[i] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons(~sum);
+}
+
+static std::vector<uint8_t> random_bytes(std::mt19937& rnd, size_t len) {
+    std::vector<uint8_t> v(len);
+    for (auto& b : v) {
+        b = rnd();
+    }
+    return v;
+}
+
+BOOST_AUTO_TEST_CASE(test_lengths_and_alignments) {
+    std::mt19937 rnd(0);
+    auto buf = random_bytes(rnd, 4096 + 64);
+    for (size_t len = 0; len <= 4096; len += len < 300 ? 1 : 37) {
+        for (size_t offset = 0; offset < 64; offset += 7) {
+            auto data = buf.data() + offset;
+            BOOST_REQUIRE_EQUAL(ip_checksum(data, len), reference_checksum(data, len));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_no_lane_overflow) {
+    // All ones make the vector lanes carry the most between spills
+    std::vector<uint8_t> buf((1 << 22) + 3, 0xff);
+    BOOST_REQUIRE_EQUAL(ip_checksum(buf.data(), buf.size()), reference_checksum(buf.data(), buf.size()));
+}
+
+BOOST_AUTO_TEST_CASE(test_fragments) {
+    std::mt19937 rnd(1);
+    for (int i = 0; i < 1000; i++) {
+        auto buf = random_bytes(rnd, rnd() % 20000);
+        checksummer csum;
+        packet p;
+        size_t pos = 0;
+        while (pos < buf.size()) {
+            auto n = std::min<size_t>(buf.size() - pos, 1 + rnd() % 1500);
+            csum.sum(reinterpret_cast<const char*>(buf.data() + pos), n);
+            p.append(packet(reinterpret_cast<const char*>(buf.data() + pos), n));
+            pos += n;
+        }
+        auto expected = reference_checksum(buf.data(), buf.size());
+        BOOST_REQUIRE_EQUAL(csum.get(), expected);
+        checksummer packet_csum;
+        packet_csum.sum(p);
+        BOOST_REQUIRE_EQUAL(packet_csum.get(), expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_mixed_with_words) {
+    // A header field summed at an odd offset after the payload
+    std::mt19937 rnd(2);
+    auto buf = random_bytes(rnd, 1001);
+    checksummer csum;
+    csum.sum(reinterpret_cast<const char*>(buf.data()), buf.size());
+    csum.sum(uint16_t(0x1234));
+    buf.push_back(0x12);
+    buf.push_back(0x34);
+    BOOST_REQUIRE_EQUAL(csum.get(), reference_checksum(buf.data(), buf.size()));
+}
@@ -0,0 +1,476 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/net/ip.hh>
+#include <seastar/net/ipv6.hh>
+#include <seastar/net/tcp.hh>
+#include <seastar/net/tcp-stack.hh>
+#include <seastar/net/udp.hh>
+#include <seastar/net/api.hh>
+#include <seastar/core/thread.hh>
+
+#include <array>
+#include <string>
+#include <vector>
+
+using namespace seastar;
+using namespace net;
+
+static const ethernet_address our_mac{0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const ethernet_address peer_mac{0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+static const ipv6_address our_address("2001:db8::1");
+
+// Offsets in a frame carrying an IPv6 packet
+static constexpr size_t ipv6_offset = sizeof(eth_hdr);
+static constexpr size_t l4_offset = ipv6_offset + sizeof(ipv6_hdr);
+
+// A device that keeps the frames it sends, and receives those fed by the test
+class test_device : public device {
+    class test_qp : public qp {
+        std::vector<packet>& _sent;
+    public:
+        explicit test_qp(std::vector<packet>& sent) : _sent(sent) {}
+        virtual future<> send(packet p) override {
+            _sent.push_back(std::move(p));
+            return make_ready_future<>();
+        }
+    };
+public:
+    std::vector<packet> sent;
+
+    test_device() {
+        set_local_queue(std::make_unique<test_qp>(sent));
+    }
+    virtual ethernet_address hw_address() override {
+        return our_mac;
+    }
+    virtual net::hw_features hw_features() override {
+        return net::hw_features();
+    }
+    virtual std::unique_ptr<qp> init_local_queue(const program_options::option_group& opts, uint16_t qid) override {
+        abort();
+    }
+};
+
+// The IPv4 and IPv6 layers of the native stack over a test device. The
+// queue of a device lives as long as the reactor, so a single stack serves
+// all the tests, each talking to its own peer addresses.
+struct test_stack {
+    test_device& dev;
+    interface netif;
+    ipv4 inet;
+    ipv6 inet6;
+
+    test_stack() : test_stack(std::make_shared<test_device>()) {}
+    explicit test_stack(std::shared_ptr<test_device> d)
+            : dev(*d), netif(std::move(d)), inet(&netif), inet6(&netif) {
+        inet.set_host_address(ipv4_address("192.168.0.1"));
+        inet.set_netmask_address(ipv4_address("255.255.255.0"));
+        inet6.set_host_address(our_address);
+        inet6.set_prefix_length(64);
+    }
+
+    void receive(packet frame) {
+        dev.l2receive(std::move(frame));
+        dev.l2flush();
+        thread::yield();
+    }
+
+    // The frames sent since the last call, linearized
+    std::vector<std::string> transmitted() {
+        thread::yield();
+        dev.local_queue().poll_tx();
+        std::vector<std::string> frames;
+        for (auto& p : dev.sent) {
+            auto& f = frames.emplace_back();
+            for (auto& frag : p.fragments()) {
+                f.append(frag.base, frag.size);
+            }
+        }
+        dev.sent.clear();
+        return frames;
+    }
+};
+
+static test_stack& stack() {
+    static thread_local test_stack* s = new test_stack();
+    return *s;
+}
+
+static bool same_mac(const ethernet_address& a, const ethernet_address& b) {
+    return a.mac == b.mac;
+}
+
+// An Ethernet frame carrying an IPv6 packet from the peer
+static packet ipv6_frame(const ipv6_address& src, const ipv6_address& dst, ip_protocol_num proto, packet l4, uint8_t hop_limit = 64) {
+    auto iph = l4.prepend_header<ipv6_hdr>();
+    iph->ver_tc_flow = uint32_t(6) << 28;
+    iph->payload_len = l4.len() - sizeof(ipv6_hdr);
+    iph->next_header = uint8_t(proto);
+    iph->hop_limit = hop_limit;
+    iph->src_ip = src;
+    iph->dst_ip = dst;
+    *iph = hton(*iph);
+    auto eh = l4.prepend_header<eth_hdr>();
+    eh->dst_mac = our_mac;
+    eh->src_mac = peer_mac;
+    eh->eth_proto = uint16_t(eth_protocol_num::ipv6);
+    *eh = hton(*eh);
+    return l4;
+}
+
+// Writes the transport checksum of an IPv6 packet at \c csum_offset of its payload
+static packet with_checksum(std::string l4, const ipv6_address& src, const ipv6_address& dst, ip_protocol_num proto, size_t csum_offset) {
+    checksummer csum;
+    ipv6_traits::pseudo_header_checksum(csum, src, dst, proto, l4.size());
+    csum.sum(l4.data(), l4.size());
+    auto c = csum.get();
+    std::copy_n(reinterpret_cast<const char*>(&c), 2, l4.data() + csum_offset);
+    return packet(l4.data(), l4.size());
+}
+
+// A neighbor discovery message (RFC 4861), with a link-layer address option
+// of kind \c option unless it is zero
+static packet nd_message(icmpv6_hdr::msg_type type, uint8_t flags, const ipv6_address& target,
+        uint8_t option, const ipv6_address& src, const ipv6_address& dst) {
+    std::string m(option ? 32 : 24, '\0');
+    m[0] = uint8_t(type);
+    m[4] = flags;
+    target.write(m.data() + 8);
+    if (option) {
+        m[24] = option;
+        m[25] = 1;
+        peer_mac.write(m.data() + 26);
+    }
+    return with_checksum(std::move(m), src, dst, ip_protocol_num::icmpv6, 2);
+}
+
+static ipv6_address frame_src(const std::string& f) {
+    return ipv6_address::read(f.data() + ipv6_offset + 8);
+}
+
+static ipv6_address frame_dst(const std::string& f) {
+    return ipv6_address::read(f.data() + ipv6_offset + 24);
+}
+
+static uint16_t eth_proto(const std::string& f) {
+    return read_be<uint16_t>(f.data() + 12);
+}
+
+static uint8_t next_header(const std::string& f) {
+    return f[ipv6_offset + 6];
+}
+
+// Whether the transport checksum of an IPv6 packet, over the pseudo-header,
+// is valid
+static bool checksum_ok(const std::string& f) {
+    checksummer csum;
+    auto len = f.size() - l4_offset;
+    ipv6_traits::pseudo_header_checksum(csum, frame_src(f), frame_dst(f), ip_protocol_num(next_header(f)), len);
+    csum.sum(f.data() + l4_offset, len);
+    return csum.get() == 0;
+}
+
+// RFC 1071, a byte at a time
+static uint16_t reference_checksum(const uint8_t* data, size_t len) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += i & 1 ? data[i] : data[i] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons(~sum);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_eui64) {
+    // The universal/local bit is inverted, ff:fe goes in the middle
+    auto a = ipv6::link_local_address(ethernet_address{0x00, 0x1b, 0x21, 0x0a, 0x0b, 0x0c});
+    BOOST_REQUIRE_EQUAL(a, ipv6_address("fe80::21b:21ff:fe0a:b0c"));
+    a = ipv6::link_local_address(ethernet_address{0x02, 0x00, 0x5e, 0x10, 0x00, 0x01});
+    BOOST_REQUIRE_EQUAL(a, ipv6_address("fe80::5eff:fe10:1"));
+    BOOST_REQUIRE(ipv6::is_link_local(a));
+
+    BOOST_REQUIRE_EQUAL(stack().inet6.link_local_address(), ipv6_address("fe80::ff:fe00:1"));
+    BOOST_REQUIRE_EQUAL(stack().inet6.host_address(), our_address);
+
+    BOOST_REQUIRE_EQUAL(ipv6::solicited_node_address(ipv6_address("2001:db8::1234:5678")), ipv6_address("ff02::1:ff34:5678"));
+    BOOST_REQUIRE(same_mac(ipv6::multicast_mac(ipv6_address("ff02::1:ff34:5678")),
+            ethernet_address{0x33, 0x33, 0xff, 0x34, 0x56, 0x78}));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_pseudo_header_checksum) {
+    auto src = ipv6_address("2001:db8::1");
+    auto dst = ipv6_address("2001:db8:ffff::abcd");
+    for (size_t len : {0, 1, 8, 13, 1000}) {
+        std::vector<uint8_t> payload(len);
+        for (size_t i = 0; i < len; i++) {
+            payload[i] = i * 7 + 3;
+        }
+        for (auto proto : {ip_protocol_num::udp, ip_protocol_num::tcp}) {
+            // RFC 8200 Section 8.1: the addresses, the 32-bit length, three
+            // zero bytes and the next header
+            std::vector<uint8_t> ref(src.ip.begin(), src.ip.end());
+            ref.insert(ref.end(), dst.ip.begin(), dst.ip.end());
+            ref.insert(ref.end(), {0, 0, uint8_t(len >> 8), uint8_t(len), 0, 0, 0, uint8_t(proto)});
+            ref.insert(ref.end(), payload.begin(), payload.end());
+
+            checksummer csum;
+            if (proto == ip_protocol_num::udp) {
+                ipv6_traits::udp_pseudo_header_checksum(csum, src, dst, len);
+            } else {
+                ipv6_traits::tcp_pseudo_header_checksum(csum, src, dst, len);
+            }
+            csum.sum(reinterpret_cast<const char*>(payload.data()), len);
+            BOOST_REQUIRE_EQUAL(csum.get(), reference_checksum(ref.data(), ref.size()));
+        }
+    }
+}
+
+SEASTAR_THREAD_TEST_CASE(test_ndp_solicitation) {
+    auto& s = stack();
+    auto our_ll = s.inet6.link_local_address();
+    auto peer = ipv6_address("fe80::1");
+    auto ns = icmpv6_hdr::msg_type::neighbor_solicitation;
+
+    auto to = ipv6::solicited_node_address(our_ll);
+
+    // Solicitations from off the link, or for other targets, are ignored
+    s.receive(ipv6_frame(peer, to, ip_protocol_num::icmpv6, nd_message(ns, 0, our_ll, 1, peer, to), 64));
+    BOOST_REQUIRE(s.transmitted().empty());
+    auto other = ipv6_address("fe80::ff:fe01:1");
+    s.receive(ipv6_frame(peer, to, ip_protocol_num::icmpv6, nd_message(ns, 0, other, 1, peer, to), ipv6::ndp_hop_limit));
+    BOOST_REQUIRE(s.transmitted().empty());
+
+    // A solicitation is answered with our link-layer address, and teaches
+    // us the one of the sender
+    s.receive(ipv6_frame(peer, to, ip_protocol_num::icmpv6, nd_message(ns, 0, our_ll, 1, peer, to), ipv6::ndp_hop_limit));
+    auto frames = s.transmitted();
+    BOOST_REQUIRE_EQUAL(frames.size(), 1);
+    auto& na = frames[0];
+    BOOST_REQUIRE(same_mac(ethernet_address::read(na.data()), peer_mac));
+    BOOST_REQUIRE_EQUAL(eth_proto(na), uint16_t(eth_protocol_num::ipv6));
+    BOOST_REQUIRE_EQUAL(next_header(na), uint8_t(ip_protocol_num::icmpv6));
+    BOOST_REQUIRE_EQUAL(uint8_t(na[ipv6_offset + 7]), ipv6::ndp_hop_limit);
+    BOOST_REQUIRE_EQUAL(frame_src(na), our_ll);
+    BOOST_REQUIRE_EQUAL(frame_dst(na), peer);
+    BOOST_REQUIRE(checksum_ok(na));
+    BOOST_REQUIRE_EQUAL(uint8_t(na[l4_offset]), uint8_t(icmpv6_hdr::msg_type::neighbor_advertisement));
+    // Solicited and override
+    BOOST_REQUIRE_EQUAL(uint8_t(na[l4_offset + 4]), 0x60);
+    BOOST_REQUIRE_EQUAL(ipv6_address::read(na.data() + l4_offset + 8), our_ll);
+    BOOST_REQUIRE_EQUAL(uint8_t(na[l4_offset + 24]), 2);
+    BOOST_REQUIRE(same_mac(ethernet_address::read(na.data() + l4_offset + 26), our_mac));
+
+    auto f = s.inet6.get_l2_dst_address(peer);
+    BOOST_REQUIRE(f.available());
+    BOOST_REQUIRE(same_mac(f.get0(), peer_mac));
+    BOOST_REQUIRE(s.transmitted().empty());
+
+    // Duplicate address detection probes come from the unspecified address,
+    // and are answered to all nodes
+    auto unspecified = ipv6_address();
+    s.receive(ipv6_frame(unspecified, to, ip_protocol_num::icmpv6, nd_message(ns, 0, our_ll, 0, unspecified, to), ipv6::ndp_hop_limit));
+    frames = s.transmitted();
+    BOOST_REQUIRE_EQUAL(frames.size(), 1);
+    BOOST_REQUIRE(same_mac(ethernet_address::read(frames[0].data()), ethernet_address{0x33, 0x33, 0, 0, 0, 1}));
+    BOOST_REQUIRE_EQUAL(frame_dst(frames[0]), ipv6_address("ff02::1"));
+    BOOST_REQUIRE_EQUAL(uint8_t(frames[0][l4_offset + 4]), 0x20);
+    BOOST_REQUIRE(checksum_ok(frames[0]));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_ndp_resolution) {
+    auto& s = stack();
+    auto peer = ipv6_address("2001:db8::2");
+
+    // Resolving an address solicits it on its solicited-node group
+    auto f = s.inet6.get_l2_dst_address(peer);
+    auto f2 = s.inet6.get_l2_dst_address(peer);
+    BOOST_REQUIRE(!f.available());
+    auto frames = s.transmitted();
+    BOOST_REQUIRE_EQUAL(frames.size(), 1);
+    auto& ns = frames[0];
+    auto group = ipv6::solicited_node_address(peer);
+    BOOST_REQUIRE(same_mac(ethernet_address::read(ns.data()), ipv6::multicast_mac(group)));
+    BOOST_REQUIRE_EQUAL(frame_src(ns), s.inet6.link_local_address());
+    BOOST_REQUIRE_EQUAL(frame_dst(ns), group);
+    BOOST_REQUIRE_EQUAL(uint8_t(ns[ipv6_offset + 7]), ipv6::ndp_hop_limit);
+    BOOST_REQUIRE(checksum_ok(ns));
+    BOOST_REQUIRE_EQUAL(uint8_t(ns[l4_offset]), uint8_t(icmpv6_hdr::msg_type::neighbor_solicitation));
+    BOOST_REQUIRE_EQUAL(ipv6_address::read(ns.data() + l4_offset + 8), peer);
+    BOOST_REQUIRE_EQUAL(uint8_t(ns[l4_offset + 24]), 1);
+    BOOST_REQUIRE(same_mac(ethernet_address::read(ns.data() + l4_offset + 26), our_mac));
+
+    // The advertisement wakes up all the waiters, the answer is cached. It
+    // comes from the link-local address of the peer, so that the address
+    // is only learned from its target.
+    auto na = icmpv6_hdr::msg_type::neighbor_advertisement;
+    auto peer_ll = ipv6_address("fe80::2");
+    s.receive(ipv6_frame(peer_ll, our_address, ip_protocol_num::icmpv6,
+            nd_message(na, 0x60, peer, 2, peer_ll, our_address), ipv6::ndp_hop_limit));
+    BOOST_REQUIRE(same_mac(f.get0(), peer_mac));
+    BOOST_REQUIRE(same_mac(f2.get0(), peer_mac));
+    f = s.inet6.get_l2_dst_address(peer);
+    BOOST_REQUIRE(f.available());
+    BOOST_REQUIRE(s.transmitted().empty());
+
+    // Multicast addresses need no resolution
+    f = s.inet6.get_l2_dst_address(ipv6_address("ff02::1:ff00:2"));
+    BOOST_REQUIRE(same_mac(f.get0(), ethernet_address{0x33, 0x33, 0xff, 0x00, 0x00, 0x02}));
+
+    // Off-link addresses go through the gateway, if any
+    auto remote = ipv6_address("2001:db9::1");
+    BOOST_REQUIRE_THROW(s.inet6.get_l2_dst_address(remote).get(), ndp_error);
+    auto gw = ipv6_address("fe80::fe");
+    auto gw_mac = ethernet_address{0x52, 0x54, 0x00, 0x00, 0x00, 0xfe};
+    s.inet6.set_gw_address(gw);
+    s.inet6.learn(gw_mac, gw);
+    BOOST_REQUIRE(same_mac(s.inet6.get_l2_dst_address(remote).get0(), gw_mac));
+    s.inet6.set_gw_address(ipv6_address());
+    BOOST_REQUIRE(s.transmitted().empty());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_udp_checksum) {
+    auto& s = stack();
+    auto peer = ipv6_address("2001:db8::6");
+    auto chan = s.inet6.get_udp().make_channel(ipv6_addr(uint16_t(5000)));
+
+    auto datagram = [&] (bool corrupt) {
+        std::string d(sizeof(udp_hdr), '\0');
+        d += "hello";
+        write_be<uint16_t>(d.data(), 6000);
+        write_be<uint16_t>(d.data() + 2, 5000);
+        write_be<uint16_t>(d.data() + 4, d.size());
+        auto p = with_checksum(std::move(d), peer, our_address, ip_protocol_num::udp, 6);
+        if (corrupt) {
+            auto c = p.get_header<udp_hdr>();
+            c->cksum = ~c->cksum;
+        }
+        return ipv6_frame(peer, our_address, ip_protocol_num::udp, std::move(p));
+    };
+
+    // The checksum is mandatory, datagrams failing it are dropped
+    s.receive(datagram(false));
+    auto dg = chan.receive().get0();
+    BOOST_REQUIRE_EQUAL(dg.get_src(), socket_address(ipv6_addr(peer.ip, 6000)));
+    auto& data = dg.get_data();
+    BOOST_REQUIRE_EQUAL(std::string(data.frag(0).base, data.len()), "hello");
+    s.receive(datagram(true));
+    auto f = chan.receive();
+    thread::yield();
+    BOOST_REQUIRE(!f.available());
+
+    // Sent datagrams carry a checksum over the pseudo-header
+    chan.send(socket_address(ipv6_addr(peer.ip, 6000)), "world").get();
+    auto frames = s.transmitted();
+    BOOST_REQUIRE_EQUAL(frames.size(), 1);
+    auto& out = frames[0];
+    BOOST_REQUIRE(same_mac(ethernet_address::read(out.data()), peer_mac));
+    BOOST_REQUIRE_EQUAL(next_header(out), uint8_t(ip_protocol_num::udp));
+    BOOST_REQUIRE_EQUAL(frame_src(out), our_address);
+    BOOST_REQUIRE_EQUAL(frame_dst(out), peer);
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(out.data() + l4_offset), 5000);
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(out.data() + l4_offset + 2), 6000);
+    BOOST_REQUIRE_NE(read_be<uint16_t>(out.data() + l4_offset + 6), 0);
+    BOOST_REQUIRE(checksum_ok(out));
+
+    chan.shutdown_input();
+    BOOST_REQUIRE_THROW(f.get(), std::system_error);
+    chan.close();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_listen_family) {
+    auto& s = stack();
+    auto& tcp4 = s.inet.get_tcp();
+    auto& tcp6 = s.inet6.get_tcp();
+
+    auto ss4 = tcp_dual_stack_listen(tcp4, tcp6, socket_address(ipv4_addr(uint16_t(8080))), listen_options());
+    BOOST_REQUIRE_EQUAL(ss4.local_address().family(), AF_INET);
+    auto ss6 = tcp_dual_stack_listen(tcp4, tcp6, socket_address(ipv6_addr(uint16_t(8080))), listen_options());
+    BOOST_REQUIRE_EQUAL(ss6.local_address().family(), AF_INET6);
+    BOOST_REQUIRE_EQUAL(ss6.local_address(), socket_address(ipv6_addr(our_address.ip, 8080)));
+
+    // A SYN over IPv6 reaches the IPv6 listener, and is answered over IPv6
+    auto peer = ipv6_address("2001:db8::7");
+    auto segment = [&] (uint32_t seq, uint8_t flags) {
+        std::string th(tcp_hdr::len, '\0');
+        write_be<uint16_t>(th.data(), 40000);
+        write_be<uint16_t>(th.data() + 2, 8080);
+        write_be<uint32_t>(th.data() + 4, seq);
+        th[12] = (tcp_hdr::len / 4) << 4;
+        th[13] = flags;
+        write_be<uint16_t>(th.data() + 14, 65535);
+        return ipv6_frame(peer, our_address, ip_protocol_num::tcp,
+                with_checksum(std::move(th), peer, our_address, ip_protocol_num::tcp, 16));
+    };
+    s.receive(segment(1000, 0x02));
+    auto frames = s.transmitted();
+    BOOST_REQUIRE_EQUAL(frames.size(), 1);
+    auto& synack = frames[0];
+    BOOST_REQUIRE_EQUAL(eth_proto(synack), uint16_t(eth_protocol_num::ipv6));
+    BOOST_REQUIRE_EQUAL(next_header(synack), uint8_t(ip_protocol_num::tcp));
+    BOOST_REQUIRE_EQUAL(frame_dst(synack), peer);
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(synack.data() + l4_offset), 8080);
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(synack.data() + l4_offset + 2), 40000);
+    BOOST_REQUIRE_EQUAL(uint8_t(synack[l4_offset + 13]), 0x12);
+    BOOST_REQUIRE_EQUAL(read_be<uint32_t>(synack.data() + l4_offset + 8), 1001);
+    BOOST_REQUIRE(checksum_ok(synack));
+
+    // Reset the connection, so that it does not retransmit
+    s.receive(segment(1001, 0x04));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_connect_family) {
+    auto& s = stack();
+    auto peer6 = ipv6_address("2001:db8::8");
+    auto peer4 = ipv4_address("192.168.0.8");
+    s.inet6.learn(peer_mac, peer6);
+    s.inet.learn(peer_mac, peer4);
+
+    // Each connection is opened over the family of its address
+    auto sock6 = tcp_dual_stack_socket(s.inet.get_tcp(), s.inet6.get_tcp());
+    auto f6 = sock6.connect(socket_address(ipv6_addr(peer6.ip, 80)));
+    auto frames = s.transmitted();
+    BOOST_REQUIRE_EQUAL(frames.size(), 1);
+    auto& syn6 = frames[0];
+    BOOST_REQUIRE_EQUAL(eth_proto(syn6), uint16_t(eth_protocol_num::ipv6));
+    BOOST_REQUIRE_EQUAL(next_header(syn6), uint8_t(ip_protocol_num::tcp));
+    BOOST_REQUIRE_EQUAL(frame_src(syn6), our_address);
+    BOOST_REQUIRE_EQUAL(frame_dst(syn6), peer6);
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(syn6.data() + l4_offset + 2), 80);
+    BOOST_REQUIRE_EQUAL(uint8_t(syn6[l4_offset + 13]), 0x02);
+    BOOST_REQUIRE(checksum_ok(syn6));
+
+    auto sock4 = tcp_dual_stack_socket(s.inet.get_tcp(), s.inet6.get_tcp());
+    auto f4 = sock4.connect(socket_address(ipv4_addr("192.168.0.8", 80)));
+    frames = s.transmitted();
+    BOOST_REQUIRE_EQUAL(frames.size(), 1);
+    auto& syn4 = frames[0];
+    BOOST_REQUIRE_EQUAL(eth_proto(syn4), uint16_t(eth_protocol_num::ipv4));
+    BOOST_REQUIRE_EQUAL(uint8_t(syn4[sizeof(eth_hdr) + 9]), uint8_t(ip_protocol_num::tcp));
+    BOOST_REQUIRE_EQUAL(read_be<uint32_t>(syn4.data() + sizeof(eth_hdr) + 16), 0xc0a80008);
+
+    sock6.shutdown();
+    sock4.shutdown();
+    BOOST_REQUIRE_THROW(f6.get(), std::system_error);
+    BOOST_REQUIRE_THROW(f4.get(), std::system_error);
+}
@@ -25,7 +25,10 @@
 #include <seastar/testing/test_case.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/do_with.hh>
+#include <seastar/core/vector-data-sink.hh>
 #include <seastar/json/formatter.hh>
+#include <seastar/json/json_elements.hh>
+#include <seastar/testing/thread_test_case.hh>
 
 using namespace seastar;
 using namespace json;
@@ -59,3 +62,76 @@ SEASTAR_TEST_CASE(test_collections) {
 
     return make_ready_future();
 }
+
+template <typename T>
+static sstring write_json(const T& val) {
+    std::vector<net::packet> packets;
+    // A small buffer, so that the output is flushed many times along the way
+    output_stream<char> out(data_sink(std::make_unique<vector_data_sink>(packets)), 8);
+    formatter::write(out, val).get();
+    out.close().get();
+    sstring ret;
+    for (auto& p : packets) {
+        for (auto& f : p.fragments()) {
+            ret += sstring(f.base, f.size);
+        }
+    }
+    return ret;
+}
+
+struct point : public jsonable {
+    static inline unsigned to_json_calls = 0;
+    int x;
+    int y;
+    point(int x, int y) : x(x), y(y) {}
+    virtual std::string to_json() const override {
+        ++to_json_calls;
+        return format("{{\"x\":{},\"y\":{}}}", x, y);
+    }
+    virtual future<> write(output_stream<char>& s) const override {
+        return s.write(format("{{\"x\":{},", x)).then([this, &s] {
+            return s.write(format("\"y\":{}}}", y));
+        });
+    }
+};
+
+SEASTAR_THREAD_TEST_CASE(test_write) {
+    BOOST_CHECK_EQUAL("{1:2,3:4}", write_json(std::map<int,int>({{1,2},{3,4}})));
+    BOOST_CHECK_EQUAL("[1,2,3,4]", write_json(std::vector<int>({1,2,3,4})));
+    BOOST_CHECK_EQUAL("[{1:2},{3:4}]", write_json(std::vector<std::pair<int,int>>({{1,2},{3,4}})));
+    BOOST_CHECK_EQUAL("[{1:2},{3:4}]", write_json(std::vector<std::map<int,int>>({{{1,2}},{{3,4}}})));
+
+    // Objects are written as they are formatted, not formatted into a string first
+    std::vector<point> points;
+    for (int i = 0; i < 100; ++i) {
+        points.emplace_back(i, -i);
+    }
+    BOOST_CHECK_EQUAL(formatter::to_json(points), write_json(points));
+    point::to_json_calls = 0;
+    write_json(points);
+    BOOST_CHECK_EQUAL(point::to_json_calls, 0);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_long_strings) {
+    // Characters to escape at every offset in and across 16 byte blocks
+    for (size_t i = 0; i < 40; ++i) {
+        sstring str(40, 'a');
+        str[i] = '"';
+        sstring expected = "\"" + str.substr(0, i) + "\\\"" + str.substr(i + 1) + "\"";
+        BOOST_CHECK_EQUAL(expected, formatter::to_json(str));
+        str[i] = '\x1f';
+        expected = "\"" + str.substr(0, i) + "\\u001F" + str.substr(i + 1) + "\"";
+        BOOST_CHECK_EQUAL(expected, formatter::to_json(str));
+    }
+    BOOST_CHECK_EQUAL("\"\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\\\\\"",
+            formatter::to_json("\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\\"));
+
+    // Large strings are written without being formatted first
+    sstring large;
+    for (int i = 0; i < 10000; ++i) {
+        large += (i % 7 == 0) ? "\n\"" : "abc";
+    }
+    BOOST_CHECK_EQUAL(formatter::to_json(large), write_json(large));
+    sstring plain(20000, 'x');
+    BOOST_CHECK_EQUAL(formatter::to_json(plain), write_json(plain));
+}
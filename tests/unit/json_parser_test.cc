@@ -0,0 +1,125 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/sstring.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/http/internal/content_source.hh>
+#include <seastar/json/parser.hh>
+#include <seastar/testing/thread_test_case.hh>
+
+using namespace seastar;
+
+// Hands out its data in fragments of the given size
+class fragments_source_impl : public data_source_impl {
+    sstring _data;
+    size_t _fragment;
+    size_t _pos = 0;
+public:
+    fragments_source_impl(sstring data, size_t fragment) : _data(std::move(data)), _fragment(fragment) {}
+    virtual future<temporary_buffer<char>> get() override {
+        auto n = std::min(_fragment, _data.size() - _pos);
+        temporary_buffer<char> buf(_data.data() + _pos, n);
+        _pos += n;
+        return make_ready_future<temporary_buffer<char>>(std::move(buf));
+    }
+};
+
+static input_stream<char> fragments_stream(sstring data, size_t fragment) {
+    return input_stream<char>(data_source(std::make_unique<fragments_source_impl>(std::move(data), fragment)));
+}
+
+static const sstring document = R"( {"name": "kossa", "tags": ["a", "b\"c", "\u00e9\ud83d\ude00"],
+    "size": 12345, "ratio": -2.5e-3, "big": 123456789012345678901, "on": true, "off": false,
+    "none": null, "nested": {"empty": [], "also": {}}} )";
+
+static void check_document(const json::value& v) {
+    BOOST_REQUIRE(v.get_type() == json::value::type::object);
+    BOOST_REQUIRE_EQUAL(v["name"].as_string(), "kossa");
+    auto& tags = v["tags"].as_array();
+    BOOST_REQUIRE_EQUAL(tags.size(), 3);
+    BOOST_REQUIRE_EQUAL(tags[1].as_string(), "b\"c");
+    BOOST_REQUIRE_EQUAL(tags[2].as_string(), "\xc3\xa9\xf0\x9f\x98\x80");
+    BOOST_REQUIRE_EQUAL(v["size"].as_int64(), 12345);
+    BOOST_REQUIRE_EQUAL(v["ratio"].as_double(), -2.5e-3);
+    BOOST_REQUIRE(!v["big"].is_integer());
+    BOOST_REQUIRE(v["on"].as_bool());
+    BOOST_REQUIRE(!v["off"].as_bool());
+    BOOST_REQUIRE(v["none"].is_null());
+    BOOST_REQUIRE(v["nested"]["empty"].as_array().empty());
+    BOOST_REQUIRE(v["nested"]["also"].as_object().empty());
+    BOOST_REQUIRE(!v.find("missing"));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_parse_fragmented) {
+    check_document(json::parse(document));
+    // Fragment boundaries fall inside every kind of token
+    for (size_t fragment = 1; fragment < 16; fragment++) {
+        auto in = fragments_stream(document, fragment);
+        check_document(json::parse(in).get0());
+    }
+}
+
+SEASTAR_THREAD_TEST_CASE(test_parse_chunked_body) {
+    sstring body;
+    for (size_t pos = 0; pos < document.size(); pos += 7) {
+        auto chunk = document.substr(pos, 7);
+        body += format("{:x}\r\n{}\r\n", chunk.size(), chunk);
+    }
+    body += "0\r\n\r\n";
+    auto inp = fragments_stream(body, 10);
+    std::unordered_map<sstring, sstring> chunk_extensions, trailing_headers;
+    auto content = input_stream<char>(data_source(std::make_unique<httpd::internal::chunked_source_impl>(inp, chunk_extensions, trailing_headers)));
+    check_document(json::parse(content).get0());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_parse_large_document) {
+    sstring doc = "[";
+    for (int i = 0; i < 100000; i++) {
+        doc += format("{}{{\"id\": {}, \"text\": \"{}\"}}", i ? "," : "", i, sstring(i % 100, 'x'));
+    }
+    doc += "]";
+    auto in = fragments_stream(doc, 128 * 1024);
+    auto v = json::parse(in).get0();
+    auto& items = v.as_array();
+    BOOST_REQUIRE_EQUAL(items.size(), 100000);
+    BOOST_REQUIRE_EQUAL(items[99999]["id"].as_int64(), 99999);
+    BOOST_REQUIRE_EQUAL(items[99999]["text"].as_string().size(), 99);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_parse_errors) {
+    for (auto bad : {"", "[1,]", "{\"a\" 1}", "{\"a\":}", "01", "1.", "-", "tru", "[1] x", "\"a\nb\"", "\"\\x\"", "\"\\ud800\"", "[[["}) {
+        BOOST_REQUIRE_THROW(json::parse(bad), json::parse_error);
+    }
+    try {
+        json::parse("[1, 2, x]");
+        BOOST_FAIL("accepted malformed json");
+    } catch (json::parse_error& e) {
+        BOOST_REQUIRE_EQUAL(e.offset(), 7);
+    }
+
+    json::parse_options opts;
+    opts.max_depth = 4;
+    json::parse("[[[[]]]]", opts);
+    BOOST_REQUIRE_THROW(json::parse("[[[[[]]]]]", opts), json::parse_error);
+    opts.max_size = 16;
+    auto in = fragments_stream("[1, 2, 3, 4, 5, 6, 7]", 4);
+    BOOST_REQUIRE_THROW(json::parse(in, opts).get(), json::parse_error);
+}
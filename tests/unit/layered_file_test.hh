@@ -0,0 +1,66 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#pragma once
+
+// The data the tests of the layered files write, and the checks of what
+// they read back
+
+#include <seastar/core/file.hh>
+#include <seastar/core/fstream.hh>
+#include <seastar/util/closeable.hh>
+#include <seastar/util/crc32c.hh>
+#include <boost/test/unit_test.hpp>
+#include <vector>
+
+// Compressible, but not trivially
+inline char data_at(uint64_t pos) {
+    return char('a' + (pos / 7) % 13);
+}
+
+inline std::vector<char> make_data(uint64_t from, uint64_t to) {
+    std::vector<char> buf;
+    for (auto pos = from; pos < to; pos++) {
+        buf.push_back(data_at(pos));
+    }
+    return buf;
+}
+
+// Writes the data up to size to a new file through an output stream,
+// which closes it, and returns the checksum of what was written
+inline uint32_t write_data(seastar::file f, uint64_t size) {
+    auto out = seastar::make_file_output_stream(std::move(f), seastar::file_output_stream_options{}).get0();
+    auto close_out = seastar::deferred_close(out);
+    auto buf = make_data(0, size);
+    seastar::crc32c_checksum checksum;
+    out.write(buf.data(), buf.size(), checksum).get();
+    return checksum.get();
+}
+
+// Checks the file holds the data up to size, and nothing past it
+inline void check_data(seastar::file f, uint64_t size, size_t block_size) {
+    BOOST_REQUIRE_EQUAL(f.size().get0(), size);
+    auto buf = f.dma_read_bulk<char>(0, size + block_size).get0();
+    BOOST_REQUIRE_EQUAL(buf.size(), size);
+    for (uint64_t pos = 0; pos < size; pos++) {
+        BOOST_REQUIRE_EQUAL(buf[pos], data_at(pos));
+    }
+}
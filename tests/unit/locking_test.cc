@@ -29,6 +29,7 @@
 #include <seastar/core/sleep.hh>
 #include <seastar/core/rwlock.hh>
 #include <seastar/core/shared_mutex.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/util/alloc_failure_injector.hh>
 #include <boost/range/irange.hpp>
 
@@ -302,3 +303,32 @@ SEASTAR_THREAD_TEST_CASE(test_shared_mutex_failed_lock) {
     seastar::memory::local_failure_injector().cancel();
 #endif // SEASTAR_ENABLE_ALLOC_FAILURE_INJECTION
 }
+
+SEASTAR_THREAD_TEST_CASE(test_shared_mutex_reader_batching) {
+    shared_mutex sm;
+    std::vector<sstring> order;
+    auto locked = [&order] (sstring name) {
+        return [&order, name] {
+            order.push_back(name);
+        };
+    };
+
+    sm.lock().get();
+    auto r1 = sm.lock_shared().then(locked("r1"));
+    auto w1 = sm.lock().then(locked("w1"));
+    auto r2 = sm.lock_shared().then(locked("r2"));
+    auto w2 = sm.lock().then(locked("w2"));
+    // All queued readers get in when the writer unlocks
+    sm.unlock();
+    when_all(std::move(r1), std::move(r2)).get();
+    BOOST_REQUIRE(!w1.available());
+    // Readers don't pass queued writers
+    BOOST_REQUIRE(!sm.try_lock_shared());
+    sm.unlock_shared();
+    sm.unlock_shared();
+    w1.get();
+    sm.unlock();
+    w2.get();
+    sm.unlock();
+    BOOST_REQUIRE(order == (std::vector<sstring>{"r1", "r2", "w1", "w2"}));
+}
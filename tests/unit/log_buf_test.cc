@@ -96,3 +96,64 @@ SEASTAR_TEST_CASE(log_buf_insert_iterator_format_to) {
     BOOST_REQUIRE_EQUAL(p[pos++], '\n');
     return make_ready_future<>();
 }
+
+SEASTAR_TEST_CASE(async_logging) {
+    seastar::logger log("async_logging_test");
+    std::ostringstream out;
+    logger::set_ostream(out);
+    auto dropped_before = logger::async_dropped_messages();
+    logger::set_async_enabled(true, 4096);
+    constexpr int nr_messages = 1000;
+    for (int i = 0; i < nr_messages; i++) {
+        log.info("message {} {}", i, std::string(64, 'x'));
+    }
+    logger::set_async_enabled(false);
+    logger::set_ostream(std::cerr);
+    auto dropped = logger::async_dropped_messages() - dropped_before;
+
+    // The messages that were not dropped are written in order
+    std::istringstream in(out.str());
+    std::string line;
+    int written = 0;
+    int last = -1;
+    while (std::getline(in, line)) {
+        auto pos = line.find("message ");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        auto i = std::stoi(line.substr(pos + 8));
+        BOOST_REQUIRE_GT(i, last);
+        last = i;
+        written++;
+    }
+    BOOST_REQUIRE_EQUAL(written + dropped, nr_messages);
+    if (dropped) {
+        BOOST_REQUIRE_NE(out.str().find("(async logging dropped"), std::string::npos);
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(deferred_formatting) {
+    seastar::logger log("deferred_formatting_test");
+    std::ostringstream out;
+    logger::set_ostream(out);
+    logger::set_async_enabled(true);
+    logger::set_deferred_formatting_enabled(true);
+    std::string s = "abc";
+    log.info("deferred {} {:.2f} {} {} {}", 42, 1.5, s, sstring("def"), 'x');
+    s = "changed";
+    // Not deferred, a pointer may be null
+    log.info("formatted {}", "literal");
+    logger::set_deferred_formatting_enabled(false);
+    logger::set_async_enabled(false);
+    logger::set_ostream(std::cerr);
+
+    auto output = out.str();
+    auto deferred = output.find("deferred_formatting_test - deferred 42 1.50 abc def x\n");
+    auto formatted = output.find("deferred_formatting_test - formatted literal\n");
+    BOOST_REQUIRE_NE(deferred, std::string::npos);
+    BOOST_REQUIRE_NE(formatted, std::string::npos);
+    BOOST_REQUIRE_LT(deferred, formatted);
+    BOOST_REQUIRE(output.compare(0, 5, "INFO ") == 0);
+    return make_ready_future<>();
+}
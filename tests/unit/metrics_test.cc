@@ -23,6 +23,7 @@
 #include <seastar/core/metrics_registration.hh>
 #include <seastar/core/metrics.hh>
 #include <seastar/core/metrics_api.hh>
+#include <seastar/core/metrics_histogram.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/scheduling.hh>
 #include <seastar/core/sleep.hh>
@@ -168,3 +169,143 @@ SEASTAR_THREAD_TEST_CASE(test_renaming_io_priority_classes) {
     bool name2_found = label_vals.find(sstring(name2)) != label_vals.end();
     BOOST_REQUIRE((name1_found && !name2_found) || (name2_found && !name1_found));
 }
+
+SEASTAR_TEST_CASE(test_log_linear_histogram) {
+    using namespace seastar::metrics;
+    using hist = log_linear_histogram<2, 10>;
+
+    // 1, 2, 3, 4, then four buckets per power of two
+    BOOST_REQUIRE_EQUAL(hist::upper_bound(0), 1);
+    BOOST_REQUIRE_EQUAL(hist::upper_bound(3), 4);
+    BOOST_REQUIRE_EQUAL(hist::upper_bound(4), 5);
+    BOOST_REQUIRE_EQUAL(hist::upper_bound(7), 8);
+    BOOST_REQUIRE_EQUAL(hist::upper_bound(8), 10);
+    BOOST_REQUIRE_EQUAL(hist::upper_bound(hist::nr_buckets - 1), 1024);
+
+    hist h;
+    for (uint64_t v = 1; v <= 100; v++) {
+        h.add(v);
+    }
+    h.add(100000); // beyond the last bucket
+    BOOST_REQUIRE_EQUAL(h.count(), 101);
+    BOOST_REQUIRE_EQUAL(h.sum(), 105050);
+    BOOST_REQUIRE_EQUAL(h.quantile(0), 1);
+    BOOST_REQUIRE_EQUAL(h.quantile(0.03), 4);
+    // the median is 51, in (48, 56]
+    BOOST_REQUIRE_EQUAL(h.quantile(0.5), 56);
+    BOOST_REQUIRE_EQUAL(h.quantile(1), 1024);
+
+    hist other;
+    other.add(1);
+    h += other;
+    BOOST_REQUIRE_EQUAL(h.count(), 102);
+    BOOST_REQUIRE_EQUAL(h.bucket_count(0), 2);
+
+    auto coarse = h.to_histogram();
+    BOOST_REQUIRE_EQUAL(coarse.buckets.size(), 11);
+    BOOST_REQUIRE_EQUAL(coarse.buckets[0].upper_bound, 1);
+    BOOST_REQUIRE_EQUAL(coarse.buckets[0].count, 2);
+    BOOST_REQUIRE_EQUAL(coarse.buckets[6].upper_bound, 64);
+    BOOST_REQUIRE_EQUAL(coarse.buckets[6].count, 65);
+    BOOST_REQUIRE_EQUAL(coarse.buckets[10].count, 102);
+
+    auto full = h.to_full_histogram();
+    BOOST_REQUIRE_EQUAL(full.buckets.size(), hist::nr_buckets);
+    BOOST_REQUIRE_EQUAL(full.sample_count, 102);
+    // histograms of the same bounds add up, counts included
+    auto sum = full + full;
+    BOOST_REQUIRE_EQUAL(sum.sample_count, 204);
+    BOOST_REQUIRE_EQUAL(sum.buckets.back().count, 204);
+    return seastar::make_ready_future<>();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_summary_metric) {
+    namespace sm = seastar::metrics;
+    namespace smi = seastar::metrics::impl;
+    sm::log_linear_histogram<> h;
+    h.add(10);
+    sm::metric_groups metrics;
+    metrics.add_group("test", {
+        sm::make_summary("summary", {0.5, 0.99}, [&h] { return h.to_full_histogram(); },
+                sm::description("a summary")).aggregate({sm::shard_label}),
+    });
+
+    auto values = smi::get_values();
+    const auto& metadata = *values->metadata;
+    auto family = std::find_if(metadata.begin(), metadata.end(), [] (const auto& x) { return x.mf.name == "test_summary"; });
+    BOOST_REQUIRE(family != metadata.end());
+    BOOST_REQUIRE(family->mf.type == smi::data_type::SUMMARY);
+    BOOST_REQUIRE(family->mf.quantiles == std::vector<double>({0.5, 0.99}));
+    BOOST_REQUIRE_EQUAL(family->metrics.size(), 1);
+    BOOST_REQUIRE(family->metrics[0].aggregate_labels == std::vector<seastar::sstring>({sm::shard_label.name()}));
+    auto& value = values->values[family - metadata.begin()][0];
+    BOOST_REQUIRE(value.type() == smi::data_type::SUMMARY);
+    BOOST_REQUIRE_EQUAL(value.get_histogram().sample_count, 1);
+}
+
+SEASTAR_TEST_CASE(test_formatted_labels) {
+    namespace smi = seastar::metrics::impl;
+    BOOST_REQUIRE_EQUAL(smi::format_labels({}), "");
+    BOOST_REQUIRE_EQUAL(smi::format_labels({{"b", "2"}, {"a", "1"}}), "a=\"1\",b=\"2\"");
+
+    auto values = smi::get_values();
+    for (auto&& family : *values->metadata) {
+        for (auto&& metric : family.metrics) {
+            BOOST_REQUIRE_EQUAL(metric.formatted_labels, smi::format_labels(metric.id.labels()));
+        }
+    }
+    return seastar::make_ready_future<>();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_relabel_configs) {
+    namespace sm = seastar::metrics;
+    namespace smi = seastar::metrics::impl;
+    sm::metric_groups metrics;
+    metrics.add_group("relabel", {
+        sm::make_gauge("kept", [] { return 1; }, sm::description("kept"), {sm::label("class")("a")}),
+        sm::make_gauge("kept", [] { return 2; }, sm::description("kept"), {sm::label("class")("b")}),
+        sm::make_gauge("dropped", [] { return 3; }, sm::description("dropped")),
+    });
+    auto find = [] (const seastar::sstring& name) {
+        auto values = smi::get_values();
+        std::vector<smi::metric_info> res;
+        for (auto&& family : *values->metadata) {
+            if (family.mf.name == name) {
+                res = family.metrics;
+            }
+        }
+        return res;
+    };
+
+    sm::relabel_config drop_family;
+    drop_family.source_labels = {"__name__"};
+    drop_family.expr = std::regex("relabel_drop.*");
+    sm::relabel_config drop_class;
+    drop_class.source_labels = {"__name__", "class"};
+    drop_class.expr = std::regex("relabel_kept;b");
+    sm::set_relabel_configs({drop_family, drop_class}).get();
+    BOOST_REQUIRE(find("relabel_dropped").empty());
+    BOOST_REQUIRE_EQUAL(find("relabel_kept").size(), 1);
+
+    // Configs apply to metrics registered after them too
+    sm::metric_groups later;
+    later.add_group("relabel", {
+        sm::make_gauge("dropped_later", [] { return 4; }, sm::description("dropped")),
+    });
+    BOOST_REQUIRE(find("relabel_dropped_later").empty());
+
+    sm::metric_family_config aggregate;
+    aggregate.name = "relabel_kept";
+    aggregate.aggregate_labels = {sm::shard_label.name()};
+    sm::set_metric_family_configs({aggregate}).get();
+    auto kept = find("relabel_kept");
+    BOOST_REQUIRE_EQUAL(kept.size(), 1);
+    BOOST_REQUIRE(kept[0].aggregate_labels == std::vector<seastar::sstring>({sm::shard_label.name()}));
+
+    sm::set_relabel_configs({}).get();
+    sm::set_metric_family_configs({}).get();
+    BOOST_REQUIRE_EQUAL(find("relabel_dropped").size(), 1);
+    kept = find("relabel_kept");
+    BOOST_REQUIRE_EQUAL(kept.size(), 2);
+    BOOST_REQUIRE(kept[0].aggregate_labels.empty());
+}
@@ -157,3 +157,56 @@ SEASTAR_THREAD_TEST_CASE(test_simple_write) {
     BOOST_REQUIRE_EQUAL(buf.size(), 1);
     BOOST_REQUIRE_EQUAL(sstring(buf.front().get(), buf.front().size()), value);
 }
+
+SEASTAR_THREAD_TEST_CASE(test_mixed_writes_are_sent_as_one_packet) {
+    auto vec = std::vector<net::packet>{};
+    auto out = output_stream<char>(data_sink(std::make_unique<vector_data_sink>(vec)), 8);
+
+    out.write("ab").get();
+    out.write(temporary_buffer<char>("cd", 2)).get();
+    out.write("ef").get();
+    out.flush().get();
+
+    BOOST_REQUIRE_EQUAL(vec.size(), 1);
+    BOOST_REQUIRE_EQUAL(vec[0].nr_frags(), 3);
+    BOOST_REQUIRE_EQUAL(to_sstring(vec[0]), "abcdef");
+
+    // a large write behind zero-copy data is sent together with it
+    out.write(temporary_buffer<char>("12", 2)).get();
+    out.write("34567890123").get();
+    BOOST_REQUIRE_EQUAL(vec.size(), 2);
+    BOOST_REQUIRE_EQUAL(to_sstring(vec[1]), "1234567890123");
+    out.close().get();
+    BOOST_REQUIRE_EQUAL(vec.size(), 2);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_cork) {
+    auto vec = std::vector<net::packet>{};
+    auto out = output_stream<char>(data_sink(std::make_unique<vector_data_sink>(vec)), 4);
+
+    out.cork();
+    out.write("12").get();
+    out.write("345").get();
+    out.write(temporary_buffer<char>("6789", 4)).get();
+    out.flush().get();
+    out.write("0").get();
+    BOOST_REQUIRE(vec.empty());
+    out.uncork().get();
+    BOOST_REQUIRE_EQUAL(vec.size(), 1);
+    BOOST_REQUIRE_EQUAL(to_sstring(vec[0]), "1234567890");
+
+    // nested, and without a flush small writes stay buffered
+    out.cork();
+    out.cork();
+    out.write("a").get();
+    out.uncork().get();
+    out.uncork().get();
+    BOOST_REQUIRE_EQUAL(vec.size(), 1);
+
+    // close() sends what is held back
+    out.cork();
+    out.write("b").get();
+    out.close().get();
+    BOOST_REQUIRE_EQUAL(vec.size(), 2);
+    BOOST_REQUIRE_EQUAL(to_sstring(vec[1]), "ab");
+}
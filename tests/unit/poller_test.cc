@@ -0,0 +1,71 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/core/reactor.hh>
+#include <seastar/util/later.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+// Keeps tasks queued for d, so that the reactor polls once per task quota
+static void keep_busy(std::chrono::milliseconds d) {
+    auto until = std::chrono::steady_clock::now() + d;
+    while (std::chrono::steady_clock::now() < until) {
+        yield().get();
+    }
+}
+
+SEASTAR_THREAD_TEST_CASE(test_poller_priority) {
+    std::vector<char> polled;
+    auto low = reactor::poller::simple([&] { polled.push_back('l'); return false; });
+    auto high = reactor::poller::simple([&] { polled.push_back('h'); return false; }, {"test_high", 1});
+    keep_busy(20ms);
+
+    // Once both are registered, high runs first in each round
+    auto first = std::find(polled.begin(), polled.end(), 'h');
+    BOOST_REQUIRE(first != polled.end());
+    BOOST_REQUIRE(std::distance(first, polled.end()) > 2);
+    for (auto i = first; i != polled.end(); ++i) {
+        BOOST_REQUIRE_EQUAL(*i, (i - first) % 2 ? 'l' : 'h');
+    }
+}
+
+SEASTAR_THREAD_TEST_CASE(test_poller_budget) {
+    unsigned free_polls = 0;
+    unsigned bounded_polls = 0;
+    auto unbounded = reactor::poller::simple([&] { free_polls++; return false; });
+    auto bounded = reactor::poller::simple([&] {
+        bounded_polls++;
+        auto until = std::chrono::steady_clock::now() + 100us;
+        while (std::chrono::steady_clock::now() < until) {
+        }
+        return false;
+    }, {"test_bounded", 0, 10us});
+    keep_busy(100ms);
+
+    // Taking 10 times its budget, it is polled about once in 10 rounds
+    BOOST_REQUIRE_GT(bounded_polls, 0);
+    BOOST_REQUIRE_LT(bounded_polls * 4, free_polls);
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/rcu.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/thread.hh>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct table {
+    static std::atomic<int> live;
+    int version;
+    explicit table(int v) : version(v) {
+        live++;
+    }
+    ~table() {
+        live--;
+    }
+};
+
+std::atomic<int> table::live{0};
+
+}
+
+SEASTAR_THREAD_TEST_CASE(test_rcu_readers_see_updates) {
+    rcu_ptr<table> p(std::make_unique<table>(0));
+    for (int v = 1; v <= 10; v++) {
+        p.update(std::make_unique<table>(v));
+        smp::invoke_on_all([&p, v] {
+            BOOST_REQUIRE_EQUAL(p.read()->version, v);
+        }).get();
+    }
+    synchronize_rcu().get();
+    BOOST_REQUIRE_EQUAL(table::live.load(), 1);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_rcu_concurrent_updates) {
+    {
+        rcu_ptr<table> p(std::make_unique<table>(0));
+        smp::invoke_on_all([&p] {
+            return async([&p] {
+                // Reads and updates interleave on all shards
+                for (int i = 0; i < 100; i++) {
+                    auto t = p.read();
+                    BOOST_REQUIRE_GE(t->version, 0);
+                    p.update(std::make_unique<table>(this_shard_id() * 1000 + i));
+                    thread::yield();
+                }
+                synchronize_rcu().get();
+            });
+        }).get();
+        BOOST_REQUIRE_EQUAL(table::live.load(), 1);
+    }
+    BOOST_REQUIRE_EQUAL(table::live.load(), 0);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_rcu_synchronize_with_idle_shards) {
+    // The other shards sleep, they must not hold reclamation up
+    rcu_ptr<table> p(std::make_unique<table>(0));
+    sleep(10ms).get();
+    p.update(std::make_unique<table>(1));
+    synchronize_rcu().get();
+    BOOST_REQUIRE_EQUAL(table::live.load(), 1);
+}
@@ -72,3 +72,41 @@ SEASTAR_TEST_CASE(test_header_parsing) {
     }
     return make_ready_future<>();
 }
+
+SEASTAR_TEST_CASE(test_fragmented_request_head) {
+    // A head split across buffers is parsed by the state machine, a whole one
+    // by the fast path, and both have to agree
+    sstring msg = "POST /some/longer/path?with=a&query=string HTTP/1.1\r\n"
+            "Host: test\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) \t \r\n"
+            "Accept: text/html\r\n"
+            "accept: application/json\r\n"
+            "Content-Length: 4\r\n"
+            "\r\n"
+            "body";
+
+    auto check = [] (const httpd::request& req) {
+        BOOST_REQUIRE_EQUAL(req._method, "POST");
+        BOOST_REQUIRE_EQUAL(req._url, "/some/longer/path?with=a&query=string");
+        BOOST_REQUIRE_EQUAL(req._version, "1.1");
+        BOOST_REQUIRE_EQUAL(req.get_header("Host"), "test");
+        BOOST_REQUIRE_EQUAL(req.get_header("User-Agent"), "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)");
+        BOOST_REQUIRE_EQUAL(req.get_header("Accept"), "text/html,application/json");
+        BOOST_REQUIRE_EQUAL(req.get_header("Content-Length"), "4");
+    };
+
+    http_request_parser parser;
+    for (size_t split = 0; split < msg.size() - 4; ++split) {
+        parser.init();
+        if (split) {
+            auto rem = parser(temporary_buffer<char>(msg.c_str(), split)).get0();
+            BOOST_REQUIRE(!rem.has_value());
+        }
+        auto rem = parser(temporary_buffer<char>(msg.c_str() + split, msg.size() - split)).get0();
+        BOOST_REQUIRE(rem.has_value());
+        BOOST_REQUIRE_EQUAL(sstring(rem->get(), rem->size()), "body");
+        BOOST_REQUIRE(!parser.failed());
+        check(*parser.get_parsed_request());
+    }
+    return make_ready_future<>();
+}
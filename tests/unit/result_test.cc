@@ -0,0 +1,120 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/result.hh>
+#include <seastar/core/sstring.hh>
+#ifdef SEASTAR_COROUTINES_ENABLED
+#include <seastar/core/coroutine.hh>
+#endif
+
+using namespace seastar;
+
+enum class lookup_error { not_found, bad_key };
+
+static future<result<int, lookup_error>> lookup(int key) {
+    if (key < 0) {
+        return make_ready_future<result<int, lookup_error>>(make_result_error(lookup_error::bad_key));
+    }
+    if (key % 2) {
+        return make_ready_future<result<int, lookup_error>>(make_result_error(lookup_error::not_found));
+    }
+    return make_ready_future<result<int, lookup_error>>(key * 10);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_result_value_and_error) {
+    result<sstring, lookup_error> r = sstring("x");
+    BOOST_REQUIRE(r);
+    BOOST_REQUIRE_EQUAL(r.value(), "x");
+
+    result<sstring, lookup_error> e = make_result_error(lookup_error::bad_key);
+    BOOST_REQUIRE(!e);
+    BOOST_REQUIRE(e.error() == lookup_error::bad_key);
+    BOOST_REQUIRE_EQUAL(std::move(e).value_or("default"), "default");
+
+    result<void, lookup_error> v;
+    BOOST_REQUIRE(v);
+    result<void, lookup_error> ve = make_result_error(lookup_error::not_found);
+    BOOST_REQUIRE(!ve);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_result_then_ok) {
+    // A plain value is taken as success
+    auto r = then_ok(lookup(2), [] (int v) { return v + 1; }).get0();
+    BOOST_REQUIRE_EQUAL(r.value(), 21);
+
+    // Errors skip the continuation
+    bool called = false;
+    r = then_ok(lookup(3), [&] (int v) { called = true; return v; }).get0();
+    BOOST_REQUIRE(!called);
+    BOOST_REQUIRE(r.error() == lookup_error::not_found);
+
+    // A continuation can fail with an error of its own, through a future
+    auto chained = then_ok(lookup(4), [] (int v) {
+        return lookup(-v);
+    }).get0();
+    BOOST_REQUIRE(chained.error() == lookup_error::bad_key);
+
+    // And return nothing
+    auto nothing = then_ok(lookup(4), [] (int) {}).get0();
+    static_assert(std::is_same_v<decltype(nothing), result<void, lookup_error>>);
+    BOOST_REQUIRE(nothing);
+    auto after_void = then_ok(make_ready_future<result<void, lookup_error>>(), [] {
+        return make_ready_future<sstring>("done");
+    }).get0();
+    BOOST_REQUIRE_EQUAL(after_void.value(), "done");
+
+    // Exceptions still fail the future
+    auto failed = then_ok(lookup(2), [] (int) -> int {
+        throw std::runtime_error("oops");
+    });
+    BOOST_REQUIRE_THROW(failed.get(), std::runtime_error);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_result_value_or_exception) {
+    auto to_exception = [] (lookup_error) {
+        return std::make_exception_ptr(std::out_of_range("lookup failed"));
+    };
+    BOOST_REQUIRE_EQUAL(value_or_exception(lookup(2), to_exception).get0(), 20);
+    BOOST_REQUIRE_THROW(value_or_exception(lookup(3), to_exception).get(), std::out_of_range);
+}
+
+#ifdef SEASTAR_COROUTINES_ENABLED
+
+static future<result<int, lookup_error>> sum_two(int a, int b) {
+    auto x = co_await lookup(a);
+    if (!x) {
+        co_return make_result_error(x.error());
+    }
+    auto y = co_await lookup(b);
+    if (!y) {
+        co_return make_result_error(y.error());
+    }
+    co_return x.value() + y.value();
+}
+
+SEASTAR_TEST_CASE(test_result_coroutine) {
+    BOOST_REQUIRE_EQUAL((co_await sum_two(2, 4)).value(), 60);
+    BOOST_REQUIRE((co_await sum_two(2, 5)).error() == lookup_error::not_found);
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include <seastar/rpc/lz4_compressor.hh>
 #include <seastar/rpc/lz4_fragmented_compressor.hh>
 #include <seastar/rpc/multi_algo_compressor_factory.hh>
+#include <seastar/rpc/zstd_compressor.hh>
 #include <seastar/testing/test_case.hh>
 #include <seastar/testing/thread_test_case.hh>
 #include <seastar/testing/test_runner.hh>
@@ -32,10 +33,15 @@
 #include <seastar/core/sleep.hh>
 #include <seastar/core/distributed.hh>
 #include <seastar/core/loop.hh>
+#include <seastar/core/with_trace_context.hh>
+#include <seastar/core/metrics_api.hh>
+#include <seastar/net/shm.hh>
+#include <seastar/net/unix_address.hh>
 #include <seastar/util/defer.hh>
 #include <seastar/util/log.hh>
 #include <seastar/util/closeable.hh>
 #include <seastar/util/noncopyable_function.hh>
+#include <seastar/util/tmp_file.hh>
 
 using namespace seastar;
 
@@ -358,6 +364,267 @@ SEASTAR_TEST_CASE(test_rpc_connect_multi_compression_algo) {
     });
 }
 
+SEASTAR_TEST_CASE(test_rpc_adaptive_compression) {
+    static rpc::zstd_compressor::factory factory;
+    rpc::server_options so;
+    rpc::client_options co;
+    so.compressor_factory = &factory;
+    so.adaptive_compression = rpc::adaptive_compression_options{};
+    co.compressor_factory = &factory;
+    co.adaptive_compression = rpc::adaptive_compression_options{};
+    rpc_test_config cfg;
+    cfg.server_options = so;
+    return rpc_test_env<>::do_with_thread(cfg, co, [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
+        env.register_handler(1, [] (sstring s) {
+            return make_ready_future<sstring>(std::move(s));
+        }).get();
+        auto echo = env.proto().make_client<sstring (sstring)>(1);
+
+        // Small frames are sent as is
+        BOOST_REQUIRE_EQUAL(echo(c1, "small").get0(), "small");
+        BOOST_REQUIRE_EQUAL(c1.get_stats().compressed_frames, 0);
+        BOOST_REQUIRE_EQUAL(c1.get_stats().uncompressed_frames, 1);
+
+        // Large compressible ones are compressed
+        auto compressible = sstring(10000, 'a');
+        BOOST_REQUIRE_EQUAL(echo(c1, compressible).get0(), compressible);
+        BOOST_REQUIRE_EQUAL(c1.get_stats().compressed_frames, 1);
+        BOOST_REQUIRE_LT(c1.get_stats().compression_output_bytes, c1.get_stats().compression_input_bytes);
+
+        // Random data stops being compressed, except for the periodic probes
+        auto& eng = testing::local_random_engine;
+        std::uniform_int_distribution<int> dist(0, 255);
+        auto random = uninitialized_string(10000);
+        std::generate(random.begin(), random.end(), [&] { return char(dist(eng)); });
+        for (unsigned i = 0; i < 64; i++) {
+            BOOST_REQUIRE_EQUAL(echo(c1, random).get0(), random);
+        }
+        BOOST_REQUIRE_LT(c1.get_stats().compressed_frames, 16);
+        BOOST_REQUIRE_GT(c1.get_stats().uncompressed_frames, 50);
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_coalescing) {
+    rpc::client_options co;
+    co.coalescing = rpc::coalescing_options{};
+    return rpc_test_env<>::do_with_thread(rpc_test_config(), co, [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
+        env.register_handler(1, [](int a, int b) {
+            return make_ready_future<int>(a+b);
+        }).get();
+        auto sum = env.proto().make_client<int (int, int)>(1);
+
+        std::vector<future<int>> results;
+        for (int i = 0; i < 100; i++) {
+            results.push_back(sum(c1, i, 1));
+        }
+        for (int i = 0; i < 100; i++) {
+            BOOST_REQUIRE_EQUAL(results[i].get0(), i + 1);
+        }
+        BOOST_REQUIRE_LT(c1.get_stats().flushes, 10);
+
+        // A lone message is flushed after the delay
+        BOOST_REQUIRE_EQUAL(sum(c1, 2, 3).get0(), 5);
+    });
+}
+
+static future<> test_rpc_trace_context_with(bool send_timeout_data) {
+    rpc::client_options co;
+    co.send_trace_context = true;
+    co.send_timeout_data = send_timeout_data;
+    return rpc_test_env<>::do_with_thread(rpc_test_config(), co, [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
+        env.register_handler(1, [] (int a) {
+            auto ctx = tracing::current_trace_context();
+            return make_ready_future<sstring>(ctx ? ctx->to_traceparent() : sstring());
+        }).get();
+        auto call = env.proto().make_client<sstring (int)>(1);
+
+        BOOST_REQUIRE_EQUAL(call(c1, 1).get0(), "");
+
+        auto ctx = tracing::trace_context::make_root();
+        ctx.flags = tracing::trace_context::sampled_flag;
+        auto received = with_trace_context(ctx, [&] {
+            return call(c1, 1);
+        }).get0();
+        // The handler runs in a child span
+        auto server_ctx = tracing::trace_context::from_traceparent(received);
+        BOOST_REQUIRE(server_ctx);
+        BOOST_REQUIRE(server_ctx->trace_id == ctx.trace_id);
+        BOOST_REQUIRE(server_ctx->sampled());
+        BOOST_REQUIRE_NE(server_ctx->span_id, ctx.span_id);
+
+        // The caller has no context again
+        BOOST_REQUIRE(!tracing::current_trace_context());
+        BOOST_REQUIRE_EQUAL(call(c1, 1).get0(), "");
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_trace_context) {
+    return test_rpc_trace_context_with(true).then([] {
+        return test_rpc_trace_context_with(false);
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_zero_copy_buffer) {
+    return rpc_test_env<>::do_with_thread(rpc_test_config(), [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
+        env.register_handler(1, [] (int n, rpc::zero_copy_buffer b, sstring s) {
+            BOOST_REQUIRE_EQUAL(n, 17);
+            BOOST_REQUIRE_EQUAL(s, "tail");
+            return make_ready_future<rpc::zero_copy_buffer>(std::move(b));
+        }).get();
+        auto echo = env.proto().make_client<rpc::zero_copy_buffer (int, rpc::zero_copy_buffer, sstring)>(1);
+
+        std::vector<temporary_buffer<char>> fragments;
+        fragments.emplace_back(temporary_buffer<char>::aligned(4096, 300000));
+        std::fill_n(fragments.back().get_write(), fragments.back().size(), 'a');
+        fragments.emplace_back();
+        fragments.emplace_back(temporary_buffer<char>("bcd", 3));
+        auto b = rpc::zero_copy_buffer(std::move(fragments));
+        auto expected = b.linearize();
+
+        auto reply = echo(c1, 17, std::move(b), "tail").get0();
+        BOOST_REQUIRE_EQUAL(reply.size(), expected.size());
+        BOOST_REQUIRE_EQUAL(reply.linearize(), expected);
+
+        // The frame references the buffer rather than copying it
+        serializer ser;
+        auto zb = rpc::zero_copy_buffer(sstring(1000, 'x'));
+        auto marshalled = rpc::marshall(ser, 0, int32_t(1), zb, sstring("tail"));
+        auto& bufs = std::get<std::vector<temporary_buffer<char>>>(marshalled.bufs);
+        BOOST_REQUIRE_EQUAL(bufs.size(), 3);
+        BOOST_REQUIRE_EQUAL(marshalled.size, 4 + 4 + 1000 + 4 + 4);
+        BOOST_REQUIRE(bufs[1].get() == zb.fragments[0].get());
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_handler_limits) {
+    return rpc_test_env<>::do_with_thread(rpc_test_config(), [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
+        rpc::handler_limits limits;
+        limits.max_concurrency = 1;
+        limits.max_queued = 1;
+        promise<> release;
+        shared_future<> released(release.get_future());
+        env.proto().register_handler(1, scheduling_group(), limits, [released] (int x) {
+            return released.get_future().then([x] {
+                return x;
+            });
+        });
+        auto call = env.proto().make_client<int (int)>(1);
+        auto stats = [&env] {
+            return *env.proto().get_handler_stats(1);
+        };
+
+        auto f1 = call(c1, 1);
+        while (stats().running == 0) {
+            sleep(std::chrono::milliseconds(1)).get();
+        }
+        auto f2 = call(c1, 2);
+        while (stats().queued == 0) {
+            sleep(std::chrono::milliseconds(1)).get();
+        }
+        // Neither running nor queueing, rejected right away
+        BOOST_REQUIRE_THROW(call(c1, 3).get(), std::runtime_error);
+
+        release.set_value();
+        BOOST_REQUIRE_EQUAL(f1.get0(), 1);
+        BOOST_REQUIRE_EQUAL(f2.get0(), 2);
+        while (stats().completed < 2) {
+            sleep(std::chrono::milliseconds(1)).get();
+        }
+        BOOST_REQUIRE_EQUAL(stats().started, 2);
+        BOOST_REQUIRE_EQUAL(stats().rejected, 1);
+        BOOST_REQUIRE_EQUAL(stats().queue_time.sample_count, 2);
+        BOOST_REQUIRE_EQUAL(stats().latency.sample_count, 2);
+        BOOST_REQUIRE(!env.proto().get_handler_stats(2));
+        env.proto().unregister_handler(1).get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_verb_metrics) {
+    return rpc_test_env<>::do_with_thread(rpc_test_config(), [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
+        rpc::verb_metrics_options options;
+        options.protocol_name = "verb_metrics_test";
+        options.verb_name = [] (uint64_t verb) {
+            return verb == 1 ? sstring("echo") : verb == 2 ? sstring("fail") : sstring();
+        };
+        env.proto().enable_metrics(std::move(options));
+        env.register_handler(1, [] (sstring s) { return s; }).get();
+        env.register_handler(2, [] () { throw std::runtime_error("fail"); }).get();
+        env.register_handler(3, [] () {}).get();
+        auto echo = env.proto().make_client<sstring (sstring)>(1);
+        for (int i = 0; i < 3; i++) {
+            BOOST_REQUIRE_EQUAL(echo(c1, sstring(100, 'x')).get0(), sstring(100, 'x'));
+        }
+        BOOST_REQUIRE_THROW(env.proto().make_client<void ()>(2)(c1).get(), std::runtime_error);
+        env.proto().make_client<void ()>(3)(c1).get();
+
+        namespace smi = seastar::metrics::impl;
+        // The count of a metric of each verb
+        auto counts = [] (sstring name) {
+            std::map<sstring, uint64_t> ret;
+            auto values = smi::get_values();
+            auto& metadata = *values->metadata;
+            for (size_t i = 0; i < metadata.size(); i++) {
+                if (metadata[i].mf.name != name) {
+                    continue;
+                }
+                for (size_t j = 0; j < metadata[i].metrics.size(); j++) {
+                    auto& labels = metadata[i].metrics[j].id.labels();
+                    if (labels.at("protocol") == "verb_metrics_test") {
+                        auto& v = values->values[i][j];
+                        ret[labels.at("verb")] = v.type() == smi::data_type::HISTOGRAM ? v.get_histogram().sample_count : v.ui();
+                    }
+                }
+            }
+            return ret;
+        };
+        // The server records the latency once the reply is sent
+        while (counts("rpc_server_latency")["echo"] < 3) {
+            sleep(std::chrono::milliseconds(1)).get();
+        }
+        BOOST_REQUIRE_EQUAL(counts("rpc_server_request_size").size(), 2);
+        BOOST_REQUIRE_EQUAL(counts("rpc_client_latency")["echo"], 3);
+        BOOST_REQUIRE_EQUAL(counts("rpc_client_response_size")["echo"], 3);
+        BOOST_REQUIRE_EQUAL(counts("rpc_server_errors")["echo"], 0);
+        BOOST_REQUIRE_EQUAL(counts("rpc_server_errors")["fail"], 1);
+        BOOST_REQUIRE_EQUAL(counts("rpc_client_errors")["fail"], 1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_client_pool) {
+    return rpc_test_env<>::do_with_thread(rpc_test_config(), [] (rpc_test_env<>& env) {
+        env.register_handler(1, [](int a, int b) {
+            return make_ready_future<int>(a+b);
+        }).get();
+        auto sum = env.proto().make_client<int (int, int)>(1);
+
+        for (auto balancing : {rpc::pool_balancing::round_robin, rpc::pool_balancing::least_pending}) {
+            rpc::client_pool_options po;
+            po.connections = 3;
+            po.balancing = balancing;
+            test_rpc_proto::client_pool pool(env.proto(), po, [&env] { return env.make_socket(); }, ipv4_addr());
+            auto stop = deferred_stop(pool);
+            BOOST_REQUIRE_EQUAL(pool.size(), 3);
+
+            std::vector<future<int>> results;
+            for (int i = 0; i < 30; i++) {
+                results.push_back(sum(pool.pick(), i, 1));
+            }
+            for (int i = 0; i < 30; i++) {
+                BOOST_REQUIRE_EQUAL(results[i].get0(), i + 1);
+            }
+            for (unsigned i = 0; i < pool.size(); i++) {
+                BOOST_REQUIRE_GT(pool.at(i).get_stats().replied, 0);
+            }
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_shard_port_address) {
+    BOOST_REQUIRE_EQUAL(rpc::shard_port_address(ipv4_addr("127.0.0.1", 7000), 3), socket_address(ipv4_addr("127.0.0.1", 7003)));
+    BOOST_REQUIRE_EQUAL(rpc::shard_port_address(ipv6_addr("::1", 7000), 0), socket_address(ipv6_addr("::1", 7000)));
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(test_rpc_connect_abort) {
     rpc_test_config cfg;
     cfg.connect = false;
@@ -588,6 +855,46 @@ SEASTAR_TEST_CASE(test_stream_connection_error) {
     });
 }
 
+SEASTAR_TEST_CASE(test_stream_batching) {
+    rpc::server_options so;
+    so.streaming_domain = rpc::streaming_domain_type(1);
+    so.stream.window = 64 * 1024;
+    rpc_test_config cfg;
+    cfg.server_options = so;
+    return rpc_test_env<>::do_with(cfg, [] (rpc_test_env<>& env) {
+        return seastar::async([&env] {
+            rpc::client_options co;
+            co.stream.window = 1024 * 1024;
+            co.stream.max_batch_bytes = 1024;
+            test_rpc_proto::client c(env.proto(), co, env.make_socket(), ipv4_addr());
+            std::vector<sstring> expected;
+            for (int i = 0; i < 2000; i++) {
+                // Some elements are too large to be batched
+                expected.push_back(i % 100 == 0 ? sstring(4096, char('a' + i % 26)) : to_sstring(i));
+            }
+            future<std::vector<sstring>> received = make_ready_future<std::vector<sstring>>();
+            env.register_handler(1, [&] (rpc::source<sstring> source) {
+                received = seastar::async([source] () mutable {
+                    std::vector<sstring> ret;
+                    while (auto data = source().get0()) {
+                        ret.push_back(std::get<0>(*data));
+                    }
+                    return ret;
+                });
+            }).get();
+            auto sink = c.make_stream_sink<serializer, sstring>(env.make_socket()).get0();
+            env.proto().make_client<void (rpc::sink<sstring>)>(1)(c, sink).get();
+            for (auto& e : expected) {
+                sink(e).get();
+            }
+            sink.flush().get();
+            sink.close().get();
+            BOOST_REQUIRE(received.get0() == expected);
+            c.stop().get();
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_rpc_scheduling) {
     return rpc_test_env<>::do_with_thread(rpc_test_config(), [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
         auto sg = create_scheduling_group("rpc", 100).get0();
@@ -947,6 +1254,61 @@ SEASTAR_THREAD_TEST_CASE(test_lz4_fragmented_compressor) {
     test_compressor([] { return std::make_unique<rpc::lz4_fragmented_compressor>(); });
 }
 
+SEASTAR_THREAD_TEST_CASE(test_zstd_compressor) {
+    test_compressor([] { return std::make_unique<rpc::zstd_compressor>(rpc::zstd_compressor::default_level, nullptr); });
+}
+
+static lw_shared_ptr<const rpc::zstd_compressor::dictionary> make_test_zstd_dictionary() {
+    static const char* words[] = { "{\"id\": ", ", \"name\": \"", "\", \"tags\": [", "\"alpha\"", "\"beta\"", "], \"value\": ", "}" };
+    auto& eng = testing::local_random_engine;
+    std::vector<temporary_buffer<char>> samples;
+    for (int i = 0; i < 2000; ++i) {
+        sstring s;
+        for (auto w : words) {
+            s += w;
+            s += to_sstring(eng() % 1000);
+        }
+        samples.emplace_back(s.c_str(), s.size());
+    }
+    return make_lw_shared<const rpc::zstd_compressor::dictionary>(rpc::zstd_compressor::dictionary::train(samples, 16 * 1024));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_zstd_dictionary_compressor) {
+    auto dict = make_test_zstd_dictionary();
+    test_compressor([dict] { return std::make_unique<rpc::zstd_compressor>(rpc::zstd_compressor::default_level, dict); });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_zstd_dictionary_negotiation) {
+    auto dict = make_test_zstd_dictionary();
+    rpc::zstd_compressor::factory with_dict(rpc::zstd_compressor::default_level, {dict});
+    rpc::zstd_compressor::factory without_dict;
+    rpc::lz4_compressor::factory lz4;
+
+    rpc::multi_algo_compressor_factory client({&with_dict, &lz4});
+    rpc::multi_algo_compressor_factory server_with_dict({&lz4, &with_dict});
+    rpc::multi_algo_compressor_factory server_without_dict({&lz4, &without_dict});
+
+    // The server picks the client's preferred algorithm, the dictionary first
+    auto c = server_with_dict.negotiate(client.supported(), true);
+    BOOST_REQUIRE(c);
+    BOOST_REQUIRE_EQUAL(c->name(), format("ZSTD:{}", dict->id()));
+    BOOST_REQUIRE(client.negotiate(c->name(), false));
+
+    // A server without the dictionary falls back to plain zstd
+    c = server_without_dict.negotiate(client.supported(), true);
+    BOOST_REQUIRE(c);
+    BOOST_REQUIRE_EQUAL(c->name(), "ZSTD");
+    BOOST_REQUIRE(client.negotiate(c->name(), false));
+
+    // Frames compressed with the dictionary are smaller
+    auto msg = sstring("{\"id\": 17, \"name\": \"42\", \"tags\": [\"alpha\"99\"beta\"3], \"value\": 5}");
+    auto compressed_size = [&] (lw_shared_ptr<const rpc::zstd_compressor::dictionary> d) {
+        rpc::zstd_compressor z(rpc::zstd_compressor::default_level, std::move(d));
+        return z.compress(0, rpc::snd_buf(temporary_buffer<char>(msg.c_str(), msg.size()))).size;
+    };
+    BOOST_REQUIRE_LT(compressed_size(dict), compressed_size(nullptr));
+}
+
 // Test reproducing issue #671: If timeout is time_point::max(), translating
 // it to relative timeout in the sender and then back in the receiver, when
 // these calculations happen across a millisecond boundary, overflowed the
@@ -1022,6 +1384,48 @@ SEASTAR_TEST_CASE(test_max_relative_timeout) {
     });
 }
 
+SEASTAR_TEST_CASE(test_many_timeouts) {
+    return rpc_test_env<>::do_with_thread(rpc_test_config(), [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
+        env.register_handler(1, [] (int a) {
+            return sleep(std::chrono::milliseconds(200)).then([a] { return a; });
+        }).get();
+        auto echo = env.proto().make_client<int (int)>(1);
+        std::vector<future<int>> expiring, completing;
+        for (int i = 0; i < 1000; i++) {
+            expiring.push_back(echo(c1, std::chrono::milliseconds(10 + i % 50), i));
+        }
+        for (int i = 0; i < 10; i++) {
+            completing.push_back(echo(c1, std::chrono::seconds(30), i));
+        }
+        for (auto& f : expiring) {
+            BOOST_REQUIRE_THROW(f.get(), rpc::timeout_error);
+        }
+        for (int i = 0; i < 10; i++) {
+            BOOST_REQUIRE_EQUAL(completing[i].get0(), i);
+        }
+        BOOST_REQUIRE_EQUAL(c1.get_stats().timeout, 1000);
+        BOOST_REQUIRE_EQUAL(c1.get_stats().wait_reply, 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_over_shm) {
+    return tmp_dir::do_with_thread([] (tmp_dir& t) {
+        socket_address addr(unix_domain_addr((t.get_path() / "rpc.sock").native()));
+        test_rpc_proto proto(serializer{});
+        test_rpc_proto::server server(proto, net::shm_listen(addr));
+        proto.register_handler(1, [] (int a, int b) {
+            return a + b;
+        });
+        test_rpc_proto::client client(proto, net::shm_socket(), addr);
+        auto sum = proto.make_client<int (int, int)>(1);
+        for (int i = 0; i < 100; i++) {
+            BOOST_REQUIRE_EQUAL(sum(client, i, 3).get0(), i + 3);
+        }
+        client.stop().get();
+        server.stop().get();
+    });
+}
+
 SEASTAR_TEST_CASE(test_rpc_tuple) {
     return rpc_test_env<>::do_with_thread(rpc_test_config(), [] (rpc_test_env<>& env, test_rpc_proto::client& c1) {
         env.register_handler(1, [] () {
@@ -0,0 +1,80 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE rss_rebalance
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/net/net.hh>
+#include <algorithm>
+#include <vector>
+
+using namespace seastar;
+using namespace net;
+
+static std::vector<uint64_t> queue_load(const std::vector<uint8_t>& reta, const std::vector<uint64_t>& bucket_load,
+        unsigned nr_queues, const std::vector<reta_move>& moves) {
+    auto r = reta;
+    for (auto& m : moves) {
+        BOOST_REQUIRE_EQUAL(r[m.bucket], m.from);
+        r[m.bucket] = m.to;
+    }
+    std::vector<uint64_t> load(nr_queues);
+    for (size_t b = 0; b < r.size(); ++b) {
+        load[r[b]] += bucket_load[b];
+    }
+    return load;
+}
+
+BOOST_AUTO_TEST_CASE(test_balanced_table_is_left_alone) {
+    std::vector<uint8_t> reta = {0, 1, 0, 1};
+    std::vector<uint64_t> load = {100, 90, 80, 110};
+    BOOST_REQUIRE(plan_reta_rebalance(reta, load, 2, 0.25, 8).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_idle_table_is_left_alone) {
+    std::vector<uint8_t> reta = {0, 1, 2, 3};
+    std::vector<uint64_t> load(4);
+    BOOST_REQUIRE(plan_reta_rebalance(reta, load, 4, 0.25, 8).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_moves_buckets_off_the_busiest_queue) {
+    std::vector<uint8_t> reta = {0, 1, 2, 3, 0, 1, 2, 3};
+    std::vector<uint64_t> load = {400, 10, 10, 10, 400, 10, 10, 10};
+    auto moves = plan_reta_rebalance(reta, load, 4, 0.25, 8);
+    BOOST_REQUIRE(!moves.empty());
+    auto after = queue_load(reta, load, 4, moves);
+    BOOST_REQUIRE_LE(*std::max_element(after.begin(), after.end()), 420u);
+}
+
+BOOST_AUTO_TEST_CASE(test_elephant_bucket_stays) {
+    // Moving the only busy bucket would just overload another queue
+    std::vector<uint8_t> reta = {0, 1, 2, 3};
+    std::vector<uint64_t> load = {1000, 10, 10, 10};
+    BOOST_REQUIRE(plan_reta_rebalance(reta, load, 4, 0.25, 8).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_number_of_moves_is_bounded) {
+    std::vector<uint8_t> reta(64, 0);
+    reta[63] = 1;
+    std::vector<uint64_t> load(64, 10);
+    auto moves = plan_reta_rebalance(reta, load, 2, 0.25, 3);
+    BOOST_REQUIRE_EQUAL(moves.size(), 3u);
+}
@@ -33,7 +33,10 @@
 #include <seastar/core/scheduling_specific.hh>
 #include <seastar/core/smp.hh>
 #include <seastar/core/with_scheduling_group.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/scheduler_trace.hh>
+#include <seastar/core/cpu_profiler.hh>
 #include <seastar/util/later.hh>
 #include <seastar/util/defer.hh>
 
@@ -282,3 +285,110 @@ SEASTAR_THREAD_TEST_CASE(sg_count) {
     }
     BOOST_REQUIRE_EQUAL(internal::scheduling_group_count(), max_scheduling_groups());
 }
+
+SEASTAR_THREAD_TEST_CASE(sg_supergroup_shares) {
+    // The supergroup and the top-level group split the CPU in halves,
+    // the groups in the supergroup split their half 1:3
+    auto ssg = create_scheduling_supergroup(100).get();
+    auto a = create_scheduling_group("sg_a", 100, ssg).get();
+    auto b = create_scheduling_group("sg_b", 300, ssg).get();
+    auto c = create_scheduling_group("sg_c", 100).get();
+    auto cleanup = defer([&] () noexcept {
+        destroy_scheduling_group(a).get();
+        destroy_scheduling_group(b).get();
+        destroy_scheduling_group(c).get();
+        destroy_scheduling_supergroup(ssg).get();
+    });
+
+    BOOST_REQUIRE_THROW(destroy_scheduling_supergroup(ssg).get(), std::runtime_error);
+
+    auto end = lowres_clock::now() + 500ms;
+    std::vector<uint64_t> counts(3);
+    auto spin = [&] (scheduling_group sg, uint64_t& count) {
+        return with_scheduling_group(sg, [&] {
+            return seastar::async([&] {
+                while (lowres_clock::now() < end) {
+                    count++;
+                    thread::maybe_yield();
+                }
+            });
+        });
+    };
+    when_all(spin(a, counts[0]), spin(b, counts[1]), spin(c, counts[2])).get();
+
+    fmt::print("supergroup shares: a {} b {} c {}\n", counts[0], counts[1], counts[2]);
+    BOOST_REQUIRE_GT(counts[1], counts[0] * 2);
+    BOOST_REQUIRE_LT(counts[1], counts[0] * 4);
+    BOOST_REQUIRE_GT(counts[2], (counts[0] + counts[1]) * 2 / 3);
+    BOOST_REQUIRE_LT(counts[2], (counts[0] + counts[1]) * 3 / 2);
+}
+
+SEASTAR_THREAD_TEST_CASE(sg_cpu_quota) {
+    auto sg = create_scheduling_group("sg_quota", 100).get();
+    auto cleanup = defer([&] () noexcept { destroy_scheduling_group(sg).get(); });
+
+    auto spin = [sg] (std::chrono::milliseconds duration) {
+        return with_scheduling_group(sg, [duration] {
+            return seastar::async([duration] {
+                uint64_t count = 0;
+                auto end = lowres_clock::now() + duration;
+                while (lowres_clock::now() < end) {
+                    count++;
+                    thread::maybe_yield();
+                }
+                return count;
+            });
+        }).get();
+    };
+
+    auto unlimited = spin(300ms);
+    sg.set_cpu_quota(5ms, 20ms);
+    auto limited = spin(300ms);
+    sg.set_cpu_quota(0ms);
+
+    // The group alone on the shard gets a quarter of it
+    fmt::print("cpu quota: unlimited {} limited {}\n", unlimited, limited);
+    BOOST_REQUIRE_LT(limited, unlimited / 2);
+    BOOST_REQUIRE_GT(limited, unlimited / 10);
+}
+
+SEASTAR_THREAD_TEST_CASE(sg_scheduler_trace) {
+    auto sg = create_scheduling_group("sg_traced", 100).get();
+    auto cleanup = defer([&] () noexcept { destroy_scheduling_group(sg).get(); });
+
+    with_scheduling_group(sg, [] {
+        return seastar::async([] {
+            auto end = lowres_clock::now() + 10ms;
+            while (lowres_clock::now() < end) {
+                thread::maybe_yield();
+            }
+        });
+    }).get();
+
+    auto json = scheduler_trace::dump().get();
+    std::string_view prefix = R"({"displayTimeUnit":"ns","traceEvents":[)";
+    BOOST_REQUIRE_EQUAL(std::string_view(json).substr(0, prefix.size()), prefix);
+    BOOST_REQUIRE(json.size() >= 2 && std::string_view(json).substr(json.size() - 2) == "]}");
+    BOOST_REQUIRE_NE(json.find(R"("name":"sg_traced","cat":"task_queue")"), sstring::npos);
+}
+
+SEASTAR_THREAD_TEST_CASE(sg_cpu_profiler) {
+    auto sg = create_scheduling_group("sg_profiled", 100).get();
+    auto cleanup = defer([&] () noexcept { destroy_scheduling_group(sg).get(); });
+
+    cpu_profiler::start(1ms).get();
+    with_scheduling_group(sg, [] {
+        return seastar::async([] {
+            auto end = lowres_clock::now() + 100ms;
+            while (lowres_clock::now() < end) {
+                thread::maybe_yield();
+            }
+        });
+    }).get();
+    cpu_profiler::stop().get();
+
+    auto stacks = cpu_profiler::folded_stacks().get();
+    BOOST_REQUIRE_NE(stacks.find("shard 0;sg_profiled;"), sstring::npos);
+    cpu_profiler::reset().get();
+    BOOST_REQUIRE_EQUAL(cpu_profiler::folded_stacks().get(), "");
+}
@@ -29,6 +29,7 @@
 #include <seastar/core/do_with.hh>
 #include <seastar/core/loop.hh>
 #include <seastar/core/map_reduce.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/core/sleep.hh>
 #include <seastar/core/shared_mutex.hh>
 #include <boost/range/irange.hpp>
@@ -396,3 +397,43 @@ SEASTAR_THREAD_TEST_CASE(test_semaphore_abort_before_wait) {
     BOOST_CHECK_THROW(fut1.get(), semaphore_aborted);
     BOOST_REQUIRE_EQUAL(x, 0);
 }
+
+SEASTAR_THREAD_TEST_CASE(test_semaphore_batched_wakeup) {
+    auto sem = semaphore(0);
+    std::vector<unsigned> order;
+    std::vector<future<>> futs;
+    for (unsigned i = 0; i < 10000; i++) {
+        futs.push_back(sem.wait().then([&order, i] {
+            order.push_back(i);
+        }));
+    }
+    sem.signal(10000);
+    // The first batch is woken right away, the rest later on
+    BOOST_REQUIRE_GT(sem.waiters(), 0u);
+    BOOST_REQUIRE_LT(sem.waiters(), 10000u);
+    // Waiters queued meanwhile still come after them
+    auto late = sem.wait();
+    sem.signal();
+    when_all_succeed(futs.begin(), futs.end()).get();
+    late.get();
+    BOOST_REQUIRE_EQUAL(order.size(), 10000u);
+    BOOST_REQUIRE(std::is_sorted(order.begin(), order.end()));
+    BOOST_REQUIRE_EQUAL(sem.waiters(), 0u);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_semaphore_destroyed_with_pending_wakeup) {
+    auto sem = std::make_optional<semaphore>(0);
+    std::vector<future<>> futs;
+    for (unsigned i = 0; i < 1000; i++) {
+        futs.push_back(sem->wait());
+    }
+    sem->signal(500);
+    sem = std::nullopt;
+    for (unsigned i = 0; i < 1000; i++) {
+        if (i < 500) {
+            BOOST_REQUIRE_NO_THROW(futs[i].get());
+        } else {
+            BOOST_CHECK_THROW(futs[i].get(), broken_promise);
+        }
+    }
+}
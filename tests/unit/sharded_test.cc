@@ -22,6 +22,7 @@
 #include <seastar/testing/thread_test_case.hh>
 
 #include <seastar/core/sharded.hh>
+#include <seastar/util/later.hh>
 
 using namespace seastar;
 
@@ -129,3 +130,63 @@ SEASTAR_THREAD_TEST_CASE(failed_sharded_start_doesnt_hang) {
     seastar::sharded<fail_to_start> s;
     s.start().then_wrapped([] (auto&& fut) { fut.ignore_ready_future(); }).get();
 }
+
+class call_counter {
+public:
+    int calls = 0;
+    std::vector<sstring> keys;
+    int add(int n) {
+        calls += n;
+        return calls;
+    }
+    future<> put(const sstring& key) {
+        return yield().then([this, &key] {
+            keys.push_back(key);
+        });
+    }
+    future<> stop() {
+        return make_ready_future<>();
+    }
+};
+
+SEASTAR_THREAD_TEST_CASE(invoke_on_others_skips_local) {
+    seastar::sharded<call_counter> s;
+    s.start().get();
+    smp_submit_to_options options;
+    options.push_now = true;
+    s.invoke_on_others(options, [] (call_counter& c) {
+        c.calls++;
+    }).get();
+    BOOST_REQUIRE_EQUAL(s.local().calls, 0);
+    auto total = s.map_reduce(options, adder<int>(), [] (call_counter& c) {
+        return c.calls;
+    }).get0();
+    BOOST_REQUIRE_EQUAL(total, smp::count - 1);
+    s.stop().get();
+}
+
+SEASTAR_THREAD_TEST_CASE(invoke_on_local_member_function) {
+    seastar::sharded<call_counter> s;
+    s.start().get();
+    BOOST_REQUIRE_EQUAL(s.invoke_on(this_shard_id(), &call_counter::add, 2).get0(), 2);
+    BOOST_REQUIRE_EQUAL(s.local().calls, 2);
+    auto other = (this_shard_id() + 1) % smp::count;
+    BOOST_REQUIRE_EQUAL(s.invoke_on(other, &call_counter::add, 3).get0(), other == this_shard_id() ? 5 : 3);
+    s.stop().get();
+}
+
+SEASTAR_THREAD_TEST_CASE(invoke_on_member_function_keeps_arguments) {
+    seastar::sharded<call_counter> s;
+    s.start().get();
+    // The arguments must outlive the call, which reads them after yielding
+    auto key = sstring(100, 'k');
+    s.invoke_on(this_shard_id(), &call_counter::put, sstring(key)).get();
+    auto other = (this_shard_id() + 1) % smp::count;
+    s.invoke_on(other, &call_counter::put, sstring(key)).get();
+    BOOST_REQUIRE(s.local().keys.size() >= 1);
+    BOOST_REQUIRE_EQUAL(s.local().keys.front(), key);
+    s.invoke_on(other, [key] (call_counter& c) {
+        BOOST_REQUIRE_EQUAL(c.keys.back(), key);
+    }).get();
+    s.stop().get();
+}
@@ -202,3 +202,31 @@ BOOST_AUTO_TEST_CASE(test_const_release) {
     do_test_release<const A>();
     do_test_release<const A_esft>();
 }
+
+BOOST_AUTO_TEST_CASE(test_borrow) {
+    auto lw = make_lw_shared<sstring>("lw");
+    auto lw_esft = make_lw_shared<E>();
+    auto sp = make_shared<C>();
+    {
+        auto b1 = lw.borrow();
+        auto b2 = b1;
+        borrowed_ptr<const sstring> cb = b2;
+        BOOST_REQUIRE_EQUAL(*cb, "lw");
+        BOOST_REQUIRE_EQUAL(b1->size(), 2);
+        BOOST_REQUIRE_EQUAL(lw.use_count(), 1);
+
+        auto be = lw_esft.borrow();
+        BOOST_REQUIRE_EQUAL(be.get(), lw_esft.get());
+        BOOST_REQUIRE_EQUAL(lw_esft.use_count(), 1);
+
+        auto bs = sp.borrow();
+        BOOST_REQUIRE_EQUAL(bs.get(), sp.get());
+        BOOST_REQUIRE_EQUAL(sp.use_count(), 1);
+
+        BOOST_REQUIRE(!lw_shared_ptr<D>().borrow());
+        BOOST_REQUIRE(!shared_ptr<D>().borrow());
+    }
+#ifndef SEASTAR_DEBUG_SHARED_PTR
+    static_assert(std::is_trivially_copyable_v<borrowed_ptr<sstring>>);
+#endif
+}
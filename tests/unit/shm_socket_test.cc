@@ -0,0 +1,110 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2023 ScyllaDB
+ */
+
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/net/shm.hh>
+#include <seastar/net/unix_address.hh>
+#include <seastar/core/iostream.hh>
+#include <seastar/util/tmp_file.hh>
+
+using namespace seastar;
+
+static socket_address socket_path(const tmp_dir& t) {
+    return socket_address(unix_domain_addr((t.get_path() / "shm.sock").native()));
+}
+
+static sstring pattern(size_t size) {
+    sstring s = uninitialized_string(size);
+    for (size_t i = 0; i < size; i++) {
+        s[i] = char('a' + i % 23);
+    }
+    return s;
+}
+
+SEASTAR_THREAD_TEST_CASE(test_shm_stream) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        net::shm_options opts;
+        // Much less than what is sent, for the writer to wait on the reader
+        opts.ring_size = 64 << 10;
+        auto ss = net::shm_listen(socket_path(t), opts);
+        auto accepted = ss.accept();
+        auto client = net::shm_socket(opts).connect(socket_path(t)).get0();
+        auto server = accepted.get0().connection;
+
+        auto data = pattern(3 << 20);
+        auto out = client.output();
+        auto sent = out.write(data).then([&out] {
+            return out.flush();
+        }).then([&out] {
+            return out.close();
+        });
+
+        auto in = server.input();
+        sstring received;
+        while (auto buf = in.read().get0()) {
+            received.append(buf.get(), buf.size());
+        }
+        sent.get();
+        BOOST_REQUIRE(received == data);
+
+        // And back
+        auto reply = server.output();
+        reply.write("done").get();
+        reply.close().get();
+        auto client_in = client.input();
+        BOOST_REQUIRE_EQUAL(sstring(client_in.read_exactly(4).get0().get(), 4), "done");
+        BOOST_REQUIRE(client_in.read().get0().empty());
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_shm_peer_gone) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        net::shm_options opts;
+        opts.poll_for = std::chrono::microseconds(100);
+        auto ss = net::shm_listen(socket_path(t), opts);
+        auto accepted = ss.accept();
+        auto client = net::shm_socket(opts).connect(socket_path(t)).get0();
+        auto in = client.input();
+        auto read = in.read();
+        {
+            auto server = accepted.get0().connection;
+        }
+        BOOST_REQUIRE(read.get0().empty());
+
+        auto out = client.output();
+        BOOST_REQUIRE_THROW(out.write("x").then([&out] { return out.flush(); }).get(), std::system_error);
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_shm_bad_ring_size) {
+    tmp_dir::do_with_thread([] (tmp_dir& t) {
+        net::shm_options opts;
+        opts.max_ring_size = 64 << 10;
+        auto ss = net::shm_listen(socket_path(t), opts);
+        (void)ss.accept().handle_exception([] (std::exception_ptr) {
+            return accept_result{};
+        });
+        // The listener drops the peer asking for more than it accepts
+        opts.ring_size = 1 << 20;
+        BOOST_REQUIRE_THROW(net::shm_socket(opts).connect(socket_path(t)).get(), std::system_error);
+        ss.abort_accept();
+    }).get();
+}
@@ -17,13 +17,11 @@
  */
 /*
  * Copyright (C) 2015 Cloudius Systems, Ltd.
- *
- * To compile: g++ -std=c++14 slab_test.cc
  */
 
-#include <iostream>
-#include <assert.h>
+#include <unordered_set>
 #include <seastar/core/slab.hh>
+#include <seastar/testing/thread_test_case.hh>
 
 using namespace seastar;
 
@@ -61,15 +59,14 @@ static void test_allocation_1(const double growth_factor, const unsigned slab_li
 
     std::vector<item *> items;
 
-    assert(slab_limit_size % size == 0);
+    BOOST_REQUIRE(slab_limit_size % size == 0);
     for (auto i = 0u; i < (slab_limit_size / size); i++) {
         auto item = slab.create(size);
         items.push_back(item);
     }
-    assert(slab.create(size) == nullptr);
+    BOOST_REQUIRE(slab.create(size) == nullptr);
 
     free_vector<item>(slab, items);
-    std::cout << __FUNCTION__ << " done!\n";
 }
 
 static void test_allocation_2(const double growth_factor, const unsigned slab_limit_size) {
@@ -91,10 +88,9 @@ static void test_allocation_2(const double growth_factor, const unsigned slab_li
     auto class_size = slab.class_size(size);
     auto per_slab_page = max_object_size / class_size;
     auto available_slab_pages = slab_limit_size / max_object_size;
-    assert(allocations == (per_slab_page * available_slab_pages));
+    BOOST_REQUIRE_EQUAL(allocations, (per_slab_page * available_slab_pages));
 
     free_vector<item>(slab, items);
-    std::cout << __FUNCTION__ << " done!\n";
 }
 
 static void test_allocation_with_lru(const double growth_factor, const unsigned slab_limit_size) {
@@ -108,20 +104,107 @@ static void test_allocation_with_lru(const double growth_factor, const unsigned
     auto max = slab_limit_size / max_object_size;
     for (auto i = 0u; i < max * 1000; i++) {
         auto item = slab.create(size);
-        assert(item != nullptr);
+        BOOST_REQUIRE(item != nullptr);
         _cache.push_front(*item);
     }
-    assert(evictions == max * 999);
+    BOOST_REQUIRE_EQUAL(evictions, max * 999);
 
     _cache.clear();
+}
+
+static void test_scan_resistance(const double growth_factor, const unsigned slab_limit_size) {
+    // evicted objects are reused, so only the hot items that were not
+    // evicted yet are in the set
+    std::unordered_set<item*> hot;
+    slab_allocator<item> slab(growth_factor, slab_limit_size, max_object_size,
+        [&](item& item_ref) { hot.erase(&item_ref); });
+    slab.set_protected_ratio(0.5);
+    size_t size = 1024;
+    auto per_slab_page = max_object_size / slab.class_size(size);
+    auto capacity = per_slab_page * (slab_limit_size / max_object_size);
+
+    for (auto i = 0u; i < capacity; i++) {
+        auto item = slab.create(size);
+        if (i < capacity / 4) {
+            hot.insert(item);
+        }
+    }
+    for (auto item : hot) {
+        // what accessing an item does
+        slab.lock_item(item);
+        slab.unlock_item(item);
+    }
+    // items that are used once don't evict the ones used again
+    for (auto i = 0u; i < capacity * 2; i++) {
+        slab.create(size);
+    }
+    BOOST_REQUIRE_EQUAL(hot.size(), capacity / 4);
+    BOOST_REQUIRE_EQUAL(slab.evictions(), capacity * 2);
+}
+
+static void test_page_reassignment(const double growth_factor, const unsigned slab_limit_size) {
+    std::unordered_set<item*> small_items, large_items;
+    slab_allocator<item> slab(growth_factor, slab_limit_size, max_object_size,
+        [&](item& item_ref) { small_items.erase(&item_ref); large_items.erase(&item_ref); });
+    slab.enable_page_reassignment(true);
+    size_t small = 1024;
+    size_t large = 100 * 1024;
+    auto small_per_page = max_object_size / slab.class_size(small);
+    auto large_per_page = max_object_size / slab.class_size(large);
+    auto pages = slab_limit_size / max_object_size;
+
+    // all pages but one hold small items, that are not used anymore
+    for (auto i = 0u; i < small_per_page * (pages - 1); i++) {
+        small_items.insert(slab.create(small));
+    }
+    for (auto i = 0u; i < large_per_page * 10; i++) {
+        large_items.insert(slab.create(large));
+    }
+    // the large items took all the pages of small ones but one
+    BOOST_REQUIRE_EQUAL(small_items.size(), small_per_page);
+    BOOST_REQUIRE_EQUAL(large_items.size(), large_per_page * (pages - 1));
+}
 
-    std::cout << __FUNCTION__ << " done!\n";
+static void test_page_lending(const double growth_factor, const unsigned slab_limit_size) {
+    unsigned evictions = 0;
+    slab_allocator<item> lender(growth_factor, slab_limit_size, max_object_size);
+    slab_allocator<item> borrower(growth_factor, slab_limit_size, max_object_size,
+        [&](item& item_ref) { evictions++; });
+    auto pages = slab_limit_size / max_object_size;
+
+    // only the pages that were not allocated yet can be lent
+    lender.create(max_object_size);
+    BOOST_REQUIRE_EQUAL(lender.lend_pages(pages), pages - 1);
+    BOOST_REQUIRE_EQUAL(lender.available_pages(), 0);
+    borrower.borrow_pages(pages - 1);
+    BOOST_REQUIRE_EQUAL(borrower.available_pages(), 2 * pages - 1);
+
+    // the borrowed pages hold items before anything is evicted
+    for (auto i = 0u; i < 2 * pages - 1; i++) {
+        BOOST_REQUIRE(borrower.create(max_object_size) != nullptr);
+    }
+    BOOST_REQUIRE_EQUAL(evictions, 0);
+    BOOST_REQUIRE(borrower.create(max_object_size) != nullptr);
+    BOOST_REQUIRE_EQUAL(evictions, 1);
 }
 
-int main(int ac, char** av) {
+SEASTAR_THREAD_TEST_CASE(test_allocation) {
     test_allocation_1(1.25, 5*1024*1024);
     test_allocation_2(1.07, 5*1024*1024); // 1.07 is the growth factor used by facebook.
+}
+
+SEASTAR_THREAD_TEST_CASE(test_lru) {
     test_allocation_with_lru(1.25, 5*1024*1024);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_segmented_lru) {
+    test_scan_resistance(1.25, 5*1024*1024);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_reassignment) {
+    test_page_reassignment(1.25, 5*1024*1024);
+}
 
-    return 0;
+SEASTAR_THREAD_TEST_CASE(test_lending) {
+    test_page_lending(1.25, 5*1024*1024);
 }
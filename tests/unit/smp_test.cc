@@ -23,6 +23,7 @@
 #include <seastar/core/smp.hh>
 #include <seastar/core/app-template.hh>
 #include <seastar/core/print.hh>
+#include <seastar/core/sleep.hh>
 
 using namespace seastar;
 
@@ -58,6 +59,26 @@ future<bool> test_smp_exception() {
     });
 }
 
+future<bool> test_idle_modes() {
+    using namespace std::chrono_literals;
+    static const std::vector<idle_mode> modes = {idle_mode::power, idle_mode::balanced, idle_mode::latency, idle_mode::fixed};
+    return do_with(true, [] (bool& ok) {
+        return do_for_each(modes, [&ok] (idle_mode mode) {
+            return set_idle_mode(mode).then([] {
+                return sleep(10ms);
+            }).then([mode] {
+                return smp::submit_to(1, [mode] {
+                    return engine().get_idle_mode() == mode;
+                });
+            }).then([&ok] (bool same) {
+                ok &= same;
+            });
+        }).then([&ok] {
+            return ok;
+        });
+    });
+}
+
 int tests, fails;
 
 future<>
@@ -73,6 +94,8 @@ int main(int ac, char** av) {
     return app_template().run_deprecated(ac, av, [] {
        return report("smp call", test_smp_call()).then([] {
            return report("smp exception", test_smp_exception());
+       }).then([] {
+           return report("idle modes", test_idle_modes());
        }).then([] {
            fmt::print("\n{:d} tests / {:d} failures\n", tests, fails);
            engine().exit(fails ? 1 : 0);
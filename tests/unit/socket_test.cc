@@ -104,4 +104,275 @@ SEASTAR_TEST_CASE(socket_skip_test) {
         as.request_abort();
         client.get();
     });
-}
\ No newline at end of file
+}
+
+SEASTAR_TEST_CASE(socket_zerocopy_test) {
+    return seastar::async([&] {
+        listen_options lo;
+        lo.reuse_address = true;
+        server_socket ss = seastar::listen(ipv4_addr("127.0.0.1", 1234), lo);
+
+        constexpr size_t big_size = 4 << 20;
+        auto client = async([] {
+            connected_socket socket = connect(ipv4_addr("127.0.0.1", 1234)).get();
+            int one = 1;
+            try {
+                socket.set_sockopt(SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+            } catch (const std::system_error&) {
+                // Kernel too old for MSG_ZEROCOPY; the sends below just copy
+            }
+            auto out = socket.output();
+            temporary_buffer<char> big(big_size);
+            for (size_t i = 0; i < big.size(); ++i) {
+                big.get_write()[i] = char(i % 251);
+            }
+            out.write(temporary_buffer<char>("head", 4)).get();
+            out.write(std::move(big)).get();
+            out.write(temporary_buffer<char>("tail", 4)).get();
+            out.close().get();
+        });
+
+        accept_result accepted = ss.accept().get();
+        input_stream<char> input = accepted.connection.input();
+        sstring received;
+        while (true) {
+            auto buf = input.read().get();
+            if (buf.empty()) {
+                break;
+            }
+            received.append(buf.get(), buf.size());
+        }
+        client.get();
+        BOOST_REQUIRE_EQUAL(received.size(), big_size + 8);
+        BOOST_REQUIRE_EQUAL(received.substr(0, 4), "head");
+        BOOST_REQUIRE_EQUAL(received.substr(big_size + 4), "tail");
+        for (size_t i = 0; i < big_size; ++i) {
+            if (received[i + 4] != char(i % 251)) {
+                BOOST_FAIL(format("mismatch at offset {}", i));
+            }
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(socket_zerocopy_unclosed_test) {
+    // Dropping the socket without closing it must not release the packets
+    // the kernel may still send from before it reports the sends complete
+    return seastar::async([&] {
+        listen_options lo;
+        lo.reuse_address = true;
+        server_socket ss = seastar::listen(ipv4_addr("127.0.0.1", 1234), lo);
+
+        constexpr size_t big_size = 1 << 20;
+        constexpr int nr_buffers = 4;
+        auto client = async([] {
+            {
+                connected_socket socket = connect(ipv4_addr("127.0.0.1", 1234)).get();
+                int one = 1;
+                try {
+                    socket.set_sockopt(SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+                } catch (const std::system_error&) {
+                    // Kernel too old for MSG_ZEROCOPY; the sends below just copy
+                }
+                auto out = socket.output();
+                for (int n = 0; n < nr_buffers; ++n) {
+                    temporary_buffer<char> big(big_size);
+                    std::fill_n(big.get_write(), big.size(), char('a' + n));
+                    out.write(std::move(big)).get();
+                }
+                out.flush().get();
+            }
+            // Reuse the memory of the sent buffers, if they were released
+            for (int n = 0; n < nr_buffers; ++n) {
+                temporary_buffer<char> big(big_size);
+                std::fill_n(big.get_write(), big.size(), 'x');
+            }
+        });
+
+        accept_result accepted = ss.accept().get();
+        input_stream<char> input = accepted.connection.input();
+        size_t received = 0;
+        while (true) {
+            auto buf = input.read().get();
+            if (buf.empty()) {
+                break;
+            }
+            for (size_t i = 0; i < buf.size(); ++i) {
+                if (buf[i] != char('a' + (received + i) / big_size)) {
+                    BOOST_FAIL(format("mismatch at offset {}", received + i));
+                }
+            }
+            received += buf.size();
+        }
+        client.get();
+        BOOST_REQUIRE_EQUAL(received, big_size * nr_buffers);
+    });
+}
+
+SEASTAR_TEST_CASE(socket_tcp_stats_test) {
+    return seastar::async([&] {
+        listen_options lo;
+        lo.reuse_address = true;
+        server_socket ss = seastar::listen(ipv4_addr("127.0.0.1", 1234), lo);
+
+        auto client = async([] {
+            connected_socket socket = connect(ipv4_addr("127.0.0.1", 1234)).get();
+            auto out = socket.output();
+            out.write("ping").get();
+            out.flush().get();
+            auto in = socket.input();
+            auto buf = in.read().get();
+            BOOST_REQUIRE_EQUAL(sstring(buf.get(), buf.size()), "pong");
+            auto stats = socket.get_tcp_stats();
+            BOOST_REQUIRE(stats.srtt.count() > 0);
+            BOOST_REQUIRE(stats.rto.count() > 0);
+            BOOST_REQUIRE(stats.cwnd > 0);
+            BOOST_REQUIRE_EQUAL(stats.unsent_bytes, 0);
+            out.close().get();
+        });
+
+        accept_result accepted = ss.accept().get();
+        auto in = accepted.connection.input();
+        auto out = accepted.connection.output();
+        in.read_exactly(4).get();
+        out.write("pong").get();
+        out.flush().get();
+        client.get();
+        out.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(socket_small_reads_test) {
+    // Small reads share receive buffers; those held on to must not be
+    // overwritten by the next reads
+    return seastar::async([&] {
+        listen_options lo;
+        lo.reuse_address = true;
+        server_socket ss = seastar::listen(ipv4_addr("127.0.0.1", 1234), lo);
+        constexpr int nr_messages = 500;
+
+        auto client = async([] {
+            connected_socket socket = connect(ipv4_addr("127.0.0.1", 1234)).get();
+            auto out = socket.output();
+            auto in = socket.input();
+            for (int i = 0; i < nr_messages; ++i) {
+                out.write(format("message {:04d};", i)).get();
+                out.flush().get();
+                // Wait for the server to read it, so that reads are separate
+                in.read_exactly(1).get();
+            }
+            out.close().get();
+        });
+
+        accept_result accepted = ss.accept().get();
+        auto in = accepted.connection.input();
+        auto out = accepted.connection.output();
+        std::vector<temporary_buffer<char>> held;
+        size_t received = 0;
+        while (received < nr_messages * 13) {
+            auto buf = in.read().get();
+            BOOST_REQUIRE(!buf.empty());
+            received += buf.size();
+            held.push_back(std::move(buf));
+            out.write("k").get();
+            out.flush().get();
+        }
+        client.get();
+        out.close().get();
+
+        sstring all;
+        for (auto& buf : held) {
+            all.append(buf.get(), buf.size());
+        }
+        for (int i = 0; i < nr_messages; ++i) {
+            BOOST_REQUIRE_EQUAL(all.substr(i * 13, 13), format("message {:04d};", i));
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(socket_shutdown_input_aborts_read_test) {
+    // A read waiting for data (in the kernel, with io_uring) must complete
+    // once the input is shut down, not wait for the peer
+    return seastar::async([&] {
+        listen_options lo;
+        lo.reuse_address = true;
+        server_socket ss = seastar::listen(ipv4_addr("127.0.0.1", 1234), lo);
+
+        connected_socket client = connect(ipv4_addr("127.0.0.1", 1234)).get();
+        accept_result accepted = ss.accept().get();
+        auto in = accepted.connection.input();
+        auto f = in.read();
+        sleep(std::chrono::milliseconds(10)).get();
+        BOOST_REQUIRE(!f.available());
+        accepted.connection.shutdown_input();
+        try {
+            BOOST_REQUIRE(f.get().empty());
+        } catch (const std::system_error&) {
+            // as good as end of stream
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(socket_reset_aborts_read_test) {
+    // A read waiting for data must fail when the peer resets the connection
+    return seastar::async([&] {
+        listen_options lo;
+        lo.reuse_address = true;
+        server_socket ss = seastar::listen(ipv4_addr("127.0.0.1", 1234), lo);
+
+        std::optional<connected_socket> client = connect(ipv4_addr("127.0.0.1", 1234)).get();
+        accept_result accepted = ss.accept().get();
+        auto in = accepted.connection.input();
+        auto f = in.read();
+        sleep(std::chrono::milliseconds(10)).get();
+        BOOST_REQUIRE(!f.available());
+        // Closing with a zero linger time sends a reset
+        struct linger lg = { 1, 0 };
+        client->set_sockopt(SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        client = std::nullopt;
+        BOOST_REQUIRE_THROW(f.get(), std::system_error);
+    });
+}
+
+SEASTAR_TEST_CASE(udp_batch_test) {
+    return seastar::async([] {
+        auto server = make_udp_channel(ipv4_addr("127.0.0.1", 0));
+        auto client = make_udp_channel(ipv4_addr("127.0.0.1", 0));
+
+        // The first four can be sent as the segments of one GSO message
+        std::vector<size_t> sizes = {1000, 1000, 1000, 500, 1200, 0, 7};
+        std::vector<net::packet> datagrams;
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            datagrams.emplace_back(net::packet(temporary_buffer<char>(sstring(sizes[i], char('a' + i)).c_str(), sizes[i])));
+        }
+        client.send_batch(server.local_address(), std::move(datagrams)).get();
+
+        auto as_string = [] (net::packet& p) {
+            p.linearize();
+            return p.len() ? sstring(p.frag(0).base, p.len()) : sstring();
+        };
+        std::vector<net::udp_datagram> received;
+        while (received.size() < sizes.size()) {
+            auto batch = server.receive_batch().get();
+            BOOST_REQUIRE(!batch.empty());
+            std::move(batch.begin(), batch.end(), std::back_inserter(received));
+        }
+        BOOST_REQUIRE_EQUAL(received.size(), sizes.size());
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            auto& p = received[i].get_data();
+            BOOST_REQUIRE_EQUAL(p.len(), sizes[i]);
+            BOOST_REQUIRE_EQUAL(as_string(p), sstring(sizes[i], char('a' + i)));
+            BOOST_REQUIRE_EQUAL(received[i].get_src(), client.local_address());
+        }
+
+        // receive() hands out batched datagrams one at a time
+        client.send(server.local_address(), "one").get();
+        client.send(server.local_address(), "two").get();
+        for (auto expected : {"one", "two"}) {
+            auto dgram = server.receive().get();
+            BOOST_REQUIRE_EQUAL(as_string(dgram.get_data()), expected);
+        }
+
+        client.close();
+        server.close();
+    });
+}
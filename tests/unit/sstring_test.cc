@@ -79,6 +79,34 @@ BOOST_AUTO_TEST_CASE(test_find_sstring_compatible) {
     check_find("abcde", "", 6);
 }
 
+BOOST_AUTO_TEST_CASE(test_find_long_sstring) {
+    // Past the inline buffer, at every offset
+    std::string s(100, 'a');
+    for (size_t i = 0; i < s.size(); i++) {
+        auto t = s;
+        t[i] = 'b';
+        BOOST_REQUIRE_EQUAL(sstring(t).find('b'), i);
+        BOOST_REQUIRE_EQUAL(sstring(t).find('b', i + 1), sstring::npos);
+        BOOST_REQUIRE_EQUAL(sstring(t).find(sstring("ab")), i ? i - 1 : sstring::npos);
+    }
+    BOOST_REQUIRE_EQUAL(sstring("abc").find('a', 10), sstring::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_ascii_iequals) {
+    BOOST_REQUIRE(ascii_iequals("", ""));
+    BOOST_REQUIRE(ascii_iequals("Transfer-Encoding", "TRANSFER-encoding"));
+    BOOST_REQUIRE(!ascii_iequals("Transfer-Encoding", "Transfer-Encodin"));
+    BOOST_REQUIRE(!ascii_iequals("Transfer-Encodinf", "Transfer-Encoding"));
+    // Only ASCII letters fold, not the characters next to them or bytes
+    // whose low 7 bits are letters
+    BOOST_REQUIRE(!ascii_iequals("[@]", "{`}"));
+    BOOST_REQUIRE(!ascii_iequals("\xc1\xc1\xc1\xc1\xc1\xc1\xc1\xc1", "\xe1\xe1\xe1\xe1\xe1\xe1\xe1\xe1"));
+
+    std::string s = "Content-Type: TEXT/Plain; Charset=UTF-8 \xc1";
+    ascii_to_lower(s.data(), s.size());
+    BOOST_REQUIRE_EQUAL(s, "content-type: text/plain; charset=utf-8 \xc1");
+}
+
 BOOST_AUTO_TEST_CASE(test_not_find_sstring) {
     BOOST_REQUIRE_EQUAL(sstring("abcde").find('x'), sstring::npos);
 }
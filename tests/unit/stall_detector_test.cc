@@ -22,28 +22,30 @@
 #include <seastar/core/reactor.hh>
 #include <seastar/core/thread_cputime_clock.hh>
 #include <seastar/core/loop.hh>
+#include <seastar/core/stall_reports.hh>
 #include <seastar/util/later.hh>
 #include <seastar/testing/test_case.hh>
 #include <seastar/testing/thread_test_case.hh>
 #include <../../src/core/stall_detector.hh>
 #include <atomic>
 #include <chrono>
+#include <sstream>
 
 using namespace seastar;
 using namespace std::chrono_literals;
 
 class temporary_stall_detector_settings {
-    std::chrono::milliseconds _old_threshold;
+    std::chrono::microseconds _old_threshold;
     std::function<void ()> _old_report;
 public:
     temporary_stall_detector_settings(std::chrono::duration<double> threshold, std::function<void ()> report)
-            : _old_threshold(engine().get_blocked_reactor_notify_ms())
+            : _old_threshold(engine().get_blocked_reactor_notify())
             , _old_report(engine().get_stall_detector_report_function()) {
-        engine().update_blocked_reactor_notify_ms(std::chrono::duration_cast<std::chrono::milliseconds>(threshold));
+        engine().update_blocked_reactor_notify(std::chrono::duration_cast<std::chrono::microseconds>(threshold));
         engine().set_stall_detector_report_function(std::move(report));
     }
     ~temporary_stall_detector_settings() {
-        engine().update_blocked_reactor_notify_ms(_old_threshold);
+        engine().update_blocked_reactor_notify(_old_threshold);
         engine().set_stall_detector_report_function(std::move(_old_report));
     }
 };
@@ -106,3 +108,68 @@ SEASTAR_THREAD_TEST_CASE(no_poll_no_stall) {
     f.get();
     BOOST_REQUIRE_EQUAL(reports, 0);
 }
+
+SEASTAR_THREAD_TEST_CASE(aggregated_stalls) {
+    std::atomic<unsigned> reports{};
+    temporary_stall_detector_settings tsds(10ms, [&] { ++reports; });
+    spin_some_cooperatively(1ms);
+    stall_reports::reset().get();
+    unsigned nr = 10;
+    for (unsigned i = 0; i < nr; ++i) {
+        spin_some_cooperatively(100ms);
+        spin(20ms);
+    }
+    spin_some_cooperatively(100ms);
+
+    // All stalls are aggregated, not only the reported ones; the signal
+    // may catch spin() in different frames, so they can spread over a
+    // few backtraces
+    auto summary = stall_reports::summary().get0();
+    unsigned stalls = 0;
+    std::istringstream lines(summary);
+    for (std::string line; std::getline(lines, line); ) {
+        if (line.rfind("shard ", 0) != 0) {
+            continue; // a frame of a multi-line backtrace
+        }
+        BOOST_REQUIRE_EQUAL(line.rfind("shard 0 group main: ", 0), 0);
+        stalls += std::stoul(line.substr(line.find(": ") + 2));
+    }
+    BOOST_REQUIRE_EQUAL(stalls, nr);
+
+    stall_reports::reset().get();
+    BOOST_REQUIRE(stall_reports::summary().get0().empty());
+}
+
+SEASTAR_THREAD_TEST_CASE(sub_millisecond_stalls) {
+    std::atomic<unsigned> reports{};
+    temporary_stall_detector_settings tsds(500us, [&] { ++reports; });
+    // Yield far more often than the threshold, unlike spin_some_cooperatively()
+    auto run_cooperatively = [] (std::chrono::duration<double> how_much) {
+        auto end = std::chrono::steady_clock::now() + how_much;
+        while (std::chrono::steady_clock::now() < end) {
+            spin(20us);
+            thread::yield();
+        }
+    };
+    run_cooperatively(1ms);
+    stall_reports::reset().get();
+    unsigned nr = 3;
+    for (unsigned i = 0; i < nr; ++i) {
+        run_cooperatively(20ms);
+        spin(3ms);
+    }
+    run_cooperatively(20ms);
+
+    auto summary = stall_reports::summary().get0();
+    unsigned stalls = 0;
+    std::istringstream lines(summary);
+    for (std::string line; std::getline(lines, line); ) {
+        if (line.rfind("shard ", 0) != 0) {
+            continue;
+        }
+        // The stalling task is recorded along with the backtrace
+        BOOST_REQUIRE_EQUAL(line.find("task none"), std::string::npos);
+        stalls += std::stoul(line.substr(line.find(": ") + 2));
+    }
+    BOOST_REQUIRE_GE(stalls, nr);
+}
@@ -109,3 +109,38 @@ SEASTAR_TEST_CASE(test_skip_all) {
         BOOST_REQUIRE(to_sstring(empty_inp.read().get0()).empty());
     });
 }
+
+SEASTAR_THREAD_TEST_CASE(test_peek_and_read_fragmented) {
+    auto concat = [] (const std::vector<temporary_buffer<char>>& bufs) {
+        sstring s;
+        for (auto& buf : bufs) {
+            s += sstring(buf.get(), buf.size());
+        }
+        return s;
+    };
+
+    input_stream<char> inp(data_source(std::make_unique<test_source_impl>(5, 23)));
+    auto peeked = inp.peek(7).get0();
+    BOOST_REQUIRE_EQUAL(peeked.size(), 2);
+    BOOST_REQUIRE_EQUAL(concat(peeked), "abcdefg");
+
+    // peeked bytes are read again, and spanning buffers are not merged
+    auto bufs = inp.read_exactly_fragmented(12).get0();
+    BOOST_REQUIRE_EQUAL(bufs.size(), 3);
+    BOOST_REQUIRE_EQUAL(concat(bufs), "abcdefghijkl");
+    BOOST_REQUIRE_EQUAL(to_sstring(inp.read_exactly(4).get0()), "mnop");
+
+    // short at end of stream, which is only reached once read past
+    BOOST_REQUIRE_EQUAL(concat(inp.peek(100).get0()), "qrstuvw");
+    BOOST_REQUIRE(!inp.eof());
+    BOOST_REQUIRE_EQUAL(concat(inp.read_exactly_fragmented(100).get0()), "qrstuvw");
+    BOOST_REQUIRE(inp.read().get0().empty());
+    BOOST_REQUIRE(inp.eof());
+
+    input_stream<char> inp2(data_source(std::make_unique<test_source_impl>(5, 23)));
+    BOOST_REQUIRE_EQUAL(concat(inp2.peek(12).get0()), "abcdefghijkl");
+    inp2.skip(7).get();
+    BOOST_REQUIRE_EQUAL(to_sstring(inp2.read_exactly(5).get0()), "hijkl");
+    inp2.skip(8).get();
+    BOOST_REQUIRE_EQUAL(to_sstring(inp2.read_up_to(100).get0()), "uvw");
+}
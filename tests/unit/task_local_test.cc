@@ -0,0 +1,186 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/with_task_local.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/thread.hh>
+#include <seastar/core/when_all.hh>
+#include <boost/range/irange.hpp>
+#ifdef SEASTAR_COROUTINES_ENABLED
+#include <seastar/core/coroutine.hh>
+#include <seastar/coroutine/maybe_yield.hh>
+#endif
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+static task_local<int> deadline;
+static task_local<sstring> request(true);
+
+static int current_deadline() {
+    auto v = deadline.get();
+    return v ? *v : -1;
+}
+
+SEASTAR_THREAD_TEST_CASE(test_values_flow_through_continuations) {
+    BOOST_REQUIRE(!deadline.get());
+    auto f = with_task_local(deadline, 1, [] {
+        BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+        return sleep(1ms).then([] {
+            BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+            return when_all_succeed(sleep(1ms).then([] {
+                BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+            }), yield().then([] {
+                BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+            })).discard_result();
+        }).then([] {
+            return parallel_for_each(boost::irange(0, 10), [] (int) {
+                return sleep(1ms).then([] {
+                    BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+                });
+            });
+        }).then([] {
+            BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+        });
+    });
+    // The caller keeps its own values
+    BOOST_REQUIRE(!deadline.get());
+    f.get();
+    BOOST_REQUIRE(!deadline.get());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_nested_values) {
+    with_task_local(request, sstring("outer"), [] {
+        return with_task_local(deadline, 1, [] {
+            return yield().then([] {
+                BOOST_REQUIRE_EQUAL(*request.get(), "outer");
+                BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+                return with_task_local(deadline, 2, [] {
+                    return yield().then([] {
+                        BOOST_REQUIRE_EQUAL(*request.get(), "outer");
+                        BOOST_REQUIRE_EQUAL(current_deadline(), 2);
+                    });
+                });
+            }).then([] {
+                BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+            });
+        }).then([] {
+            BOOST_REQUIRE_EQUAL(*request.get(), "outer");
+            BOOST_REQUIRE(!deadline.get());
+        });
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_values_across_shards) {
+    with_task_local(request, sstring("req"), [] {
+        return with_task_local(deadline, 1, [] {
+            return smp::submit_to((this_shard_id() + 1) % smp::count, [] {
+                // Only the values that cross shards are there
+                BOOST_REQUIRE(request.get());
+                BOOST_REQUIRE_EQUAL(*request.get(), "req");
+                BOOST_REQUIRE(smp::count == 1 || !deadline.get());
+            }).then([] {
+                BOOST_REQUIRE_EQUAL(current_deadline(), 1);
+            });
+        });
+    }).get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_values_in_thread) {
+    task_local_scope scope(deadline, 3);
+    seastar::async([] {
+        BOOST_REQUIRE_EQUAL(current_deadline(), 3);
+        sleep(1ms).get();
+        BOOST_REQUIRE_EQUAL(current_deadline(), 3);
+        task_local_scope inner(deadline, 4);
+        yield().get();
+        BOOST_REQUIRE_EQUAL(current_deadline(), 4);
+    }).get();
+    BOOST_REQUIRE_EQUAL(current_deadline(), 3);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_released_values) {
+    promise<> p;
+    future<> f = make_ready_future<>();
+    {
+        task_local_scope scope(deadline, 5);
+        f = p.get_future().then([] {
+            // The values are gone, and their slot may be reused
+            BOOST_REQUIRE(!deadline.get());
+        });
+    }
+    task_local_scope other(deadline, 6);
+    other.deactivate();
+    p.set_value();
+    f.get();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_released_values_after_many_reuses) {
+    uint32_t stale;
+    {
+        task_local_scope scope(deadline, 5);
+        stale = *internal::current_task_local_handle_ptr();
+    }
+    // Cycle the slots well past the 4096 generations a handle can tell
+    // apart, checking that a task holding the stale handle never finds
+    // the values of another scope
+    unsigned stale_found = 0;
+    unsigned own_missing = 0;
+    for (int i = 0; i < 2 * 4096 * 128; i++) {
+        task_local_scope scope(deadline, i);
+        auto current = std::exchange(*internal::current_task_local_handle_ptr(), stale);
+        stale_found += bool(deadline.get());
+        *internal::current_task_local_handle_ptr() = current;
+        own_missing += current_deadline() != i;
+    }
+    BOOST_REQUIRE_EQUAL(stale_found, 0);
+    BOOST_REQUIRE_EQUAL(own_missing, 0);
+}
+
+#ifdef SEASTAR_COROUTINES_ENABLED
+
+static future<int> coroutine_deadline() {
+    co_await sleep(1ms);
+    co_await coroutine::maybe_yield();
+    co_return current_deadline();
+}
+
+SEASTAR_TEST_CASE(test_values_in_coroutines) {
+    task_local_scope scope(deadline, 7);
+    BOOST_REQUIRE_EQUAL(co_await coroutine_deadline(), 7);
+    BOOST_REQUIRE_EQUAL(current_deadline(), 7);
+    {
+        // Values set while the coroutine runs go with it when it suspends
+        task_local_scope inner(deadline, 8);
+        co_await sleep(1ms);
+        BOOST_REQUIRE_EQUAL(current_deadline(), 8);
+        BOOST_REQUIRE_EQUAL(co_await coroutine_deadline(), 8);
+    }
+    BOOST_REQUIRE_EQUAL(current_deadline(), 7);
+    co_await sleep(1ms);
+    BOOST_REQUIRE_EQUAL(current_deadline(), 7);
+}
+
+#endif
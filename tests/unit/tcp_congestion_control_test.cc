@@ -0,0 +1,114 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <seastar/net/tcp_congestion_control.hh>
+
+#include <boost/test/included/unit_test.hpp>
+
+#include <stdexcept>
+
+using namespace seastar;
+using namespace seastar::net;
+using namespace std::chrono_literals;
+
+static constexpr uint16_t mss = 1000;
+
+// Acknowledges a full window of data, one segment at a time
+static tcp_congestion_control::state ack_window(tcp_congestion_control& cc, tcp_congestion_control::state s) {
+    auto segments = s.cwnd / mss;
+    for (unsigned i = 0; i < segments; ++i) {
+        s.flight_size = (segments - i - 1) * mss;
+        s.cwnd = cc.on_ack(s, mss);
+    }
+    return s;
+}
+
+BOOST_AUTO_TEST_CASE(test_make_tcp_congestion_control) {
+    for (auto name : {"reno", "cubic", "bbr"}) {
+        BOOST_REQUIRE_EQUAL(make_tcp_congestion_control(name)->name(), std::string(name));
+    }
+    BOOST_REQUIRE_THROW(make_tcp_congestion_control("vegas"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_reno) {
+    auto cc = make_tcp_congestion_control("reno");
+    tcp_congestion_control::state s{4 * mss, 64 * mss, mss, 0, 10ms};
+
+    // Slow start doubles the window every round trip
+    s = ack_window(*cc, s);
+    BOOST_REQUIRE_EQUAL(s.cwnd, 8 * mss);
+
+    // Congestion avoidance adds about a segment per round trip
+    s.ssthresh = s.cwnd;
+    s = ack_window(*cc, s);
+    BOOST_REQUIRE_GT(s.cwnd, 8 * mss);
+    BOOST_REQUIRE_LE(s.cwnd, 9 * mss);
+
+    s.flight_size = 10 * mss;
+    BOOST_REQUIRE_EQUAL(cc->on_loss(s), 5 * mss);
+    s.flight_size = mss;
+    BOOST_REQUIRE_EQUAL(cc->on_retransmit_timeout(s), 2 * mss);
+}
+
+BOOST_AUTO_TEST_CASE(test_cubic) {
+    auto cc = make_tcp_congestion_control("cubic");
+    tcp_congestion_control::state s{100 * mss, 0, mss, 100 * mss, 10ms};
+
+    // Multiplicative decrease by 0.7
+    s.ssthresh = cc->on_loss(s);
+    BOOST_REQUIRE_EQUAL(s.ssthresh, 70 * mss);
+    s.cwnd = s.ssthresh;
+
+    // The window grows back towards where the loss happened, but never
+    // by more than half of it per round trip
+    for (unsigned i = 0; i < 10; ++i) {
+        auto prev = s.cwnd;
+        s = ack_window(*cc, s);
+        BOOST_REQUIRE_GE(s.cwnd, prev);
+        BOOST_REQUIRE_LE(s.cwnd, prev * 3 / 2 + mss);
+    }
+    BOOST_REQUIRE_GT(s.cwnd, 70 * mss);
+
+    // Fast convergence: a loss below the previous maximum lowers it further
+    s.cwnd = 50 * mss;
+    BOOST_REQUIRE_EQUAL(cc->on_loss(s), 35 * mss);
+}
+
+BOOST_AUTO_TEST_CASE(test_bbr) {
+    auto cc = make_tcp_congestion_control("bbr");
+    tcp_congestion_control::state s{10 * mss, 10 * mss, mss, 0, 10ms};
+
+    // Grows exponentially while there is no estimate of the path
+    s = ack_window(*cc, s);
+    BOOST_REQUIRE_EQUAL(s.cwnd, 20 * mss);
+
+    // Losses do not shrink the window
+    s.flight_size = s.cwnd;
+    BOOST_REQUIRE_EQUAL(cc->on_loss(s), s.cwnd);
+    BOOST_REQUIRE_EQUAL(cc->on_retransmit_timeout(s), s.cwnd);
+
+    // The window never drops below four segments
+    s.cwnd = mss;
+    s.flight_size = 0;
+    BOOST_REQUIRE_GE(cc->on_ack(s, mss), 4 * mss);
+}
@@ -0,0 +1,247 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <seastar/net/tcp.hh>
+
+#include <boost/test/included/unit_test.hpp>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+using namespace seastar;
+using namespace seastar::net;
+
+static constexpr uint16_t mss = 1000;
+static constexpr uint32_t una = 1000000;
+
+struct segment {
+    packet p;
+    bool sacked = false;
+    bool lost_retransmitted = false;
+};
+
+// nr segments of mss bytes each, starting at una
+static std::deque<segment> make_segments(unsigned nr, uint32_t len = mss) {
+    std::deque<segment> segs;
+    for (unsigned i = 0; i < nr; ++i) {
+        segs.push_back(segment{packet(std::vector<char>(len).data(), len)});
+    }
+    return segs;
+}
+
+// A SACK block covering segments [first, last) of mss bytes each
+static tcp_option::sack_block block(unsigned first, unsigned last) {
+    return {una + first * mss, una + last * mss};
+}
+
+static std::vector<uint32_t> next_segs(tcp_sack_scoreboard& sb, std::deque<segment>& segs, uint32_t cwnd, bool front_lost) {
+    std::vector<uint32_t> retransmitted;
+    sb.next_segs(segs, make_seq(una), cwnd, mss, front_lost, [&] (segment& seg, net::tcp_seq seq) {
+        retransmitted.push_back((seq - make_seq(una)) / mss);
+    });
+    return retransmitted;
+}
+
+BOOST_AUTO_TEST_CASE(test_scoreboard_marking) {
+    auto segs = make_segments(6);
+    tcp_sack_scoreboard sb;
+    sb.lost_boundary = make_seq(una);
+
+    // Only segments entirely covered by a block are sacked
+    tcp_option::sack_block blocks[] = {block(1, 2), {una + 3 * mss, una + 4 * mss + mss / 2}};
+    sb.update(segs, make_seq(una), mss, blocks, 2);
+    BOOST_REQUIRE(!segs[0].sacked);
+    BOOST_REQUIRE(segs[1].sacked);
+    BOOST_REQUIRE(!segs[2].sacked);
+    BOOST_REQUIRE(segs[3].sacked);
+    BOOST_REQUIRE(!segs[4].sacked);
+    BOOST_REQUIRE_EQUAL(sb.sacked_bytes, 2 * mss);
+
+    // Reporting a block again does not count it twice
+    sb.update(segs, make_seq(una), mss, blocks, 1);
+    BOOST_REQUIRE_EQUAL(sb.sacked_bytes, 2 * mss);
+
+    // Two sacked segments above are not enough to deem anything lost
+    BOOST_REQUIRE(!sb.is_lost(make_seq(una + mss)));
+    BOOST_REQUIRE_EQUAL(sb.pipe(segs, make_seq(una)), 4 * mss);
+}
+
+BOOST_AUTO_TEST_CASE(test_is_lost_segments) {
+    // DupThresh segments sacked above a hole deem it lost
+    auto segs = make_segments(5);
+    tcp_sack_scoreboard sb;
+    sb.lost_boundary = make_seq(una);
+    tcp_option::sack_block blocks[] = {block(2, 5)};
+    sb.update(segs, make_seq(una), mss, blocks, 1);
+    BOOST_REQUIRE(sb.is_lost(make_seq(una + mss)));
+    BOOST_REQUIRE(sb.is_lost(make_seq(una + 2 * mss)));
+    BOOST_REQUIRE(!sb.is_lost(make_seq(una + 3 * mss)));
+    // The lost segments left the network, the sacked ones reached the peer
+    BOOST_REQUIRE_EQUAL(sb.pipe(segs, make_seq(una)), 0);
+
+    // With one fewer sacked above, the hole is not deemed lost
+    segs = make_segments(4);
+    sb = {};
+    sb.lost_boundary = make_seq(una);
+    tcp_option::sack_block fewer[] = {block(2, 4)};
+    sb.update(segs, make_seq(una), mss, fewer, 1);
+    BOOST_REQUIRE(!sb.is_lost(make_seq(una + mss)));
+    BOOST_REQUIRE_EQUAL(sb.pipe(segs, make_seq(una)), 2 * mss);
+}
+
+BOOST_AUTO_TEST_CASE(test_is_lost_bytes) {
+    // Two large segments sacked above a hole: more than (DupThresh - 1) *
+    // SMSS bytes deem it lost, although fewer than DupThresh segments were
+    auto segs = make_segments(3, mss + 1);
+    tcp_sack_scoreboard sb;
+    sb.lost_boundary = make_seq(una);
+    tcp_option::sack_block blocks[] = {{una + mss + 1, una + 3 * (mss + 1)}};
+    sb.update(segs, make_seq(una), mss, blocks, 1);
+    BOOST_REQUIRE(sb.is_lost(make_seq(una + mss + 1)));
+
+    // Exactly (DupThresh - 1) * SMSS bytes are not enough
+    segs = make_segments(3);
+    sb = {};
+    sb.lost_boundary = make_seq(una);
+    tcp_option::sack_block exact[] = {block(1, 3)};
+    sb.update(segs, make_seq(una), mss, exact, 1);
+    BOOST_REQUIRE(!sb.is_lost(make_seq(una + mss)));
+}
+
+BOOST_AUTO_TEST_CASE(test_next_seg_order) {
+    // Holes at 0, 2 and 4, each with DupThresh segments sacked above
+    auto segs = make_segments(10);
+    tcp_sack_scoreboard sb;
+    sb.lost_boundary = make_seq(una);
+    tcp_option::sack_block blocks[] = {block(1, 2), block(3, 4), block(5, 8)};
+    sb.update(segs, make_seq(una), mss, blocks, 3);
+    BOOST_REQUIRE(sb.is_lost(make_seq(una + 5 * mss)));
+    BOOST_REQUIRE(!sb.is_lost(make_seq(una + 6 * mss)));
+    // 8 and 9 are in the network
+    BOOST_REQUIRE_EQUAL(sb.pipe(segs, make_seq(una)), 2 * mss);
+
+    // The lost segments go in sequence order, while the window allows
+    BOOST_REQUIRE(next_segs(sb, segs, 4 * mss, false) == std::vector<uint32_t>({0, 2}));
+    BOOST_REQUIRE_EQUAL(sb.recovery_retransmits, 2);
+    BOOST_REQUIRE_EQUAL(sb.pipe(segs, make_seq(una)), 4 * mss);
+
+    // Retransmitted segments are not sent again
+    BOOST_REQUIRE(next_segs(sb, segs, 10 * mss, false) == std::vector<uint32_t>({4}));
+    BOOST_REQUIRE(next_segs(sb, segs, 10 * mss, false).empty());
+
+    // Ending the recovery allows retransmitting them once more
+    sb.end_recovery(segs);
+    BOOST_REQUIRE_EQUAL(sb.recovery_retransmits, 0);
+    BOOST_REQUIRE(next_segs(sb, segs, 10 * mss, false) == std::vector<uint32_t>({0, 2, 4}));
+}
+
+BOOST_AUTO_TEST_CASE(test_next_seg_front) {
+    auto segs = make_segments(4);
+    tcp_sack_scoreboard sb;
+    sb.lost_boundary = make_seq(una);
+
+    // Nothing is deemed lost yet
+    BOOST_REQUIRE(next_segs(sb, segs, 10 * mss, false).empty());
+
+    // The segment at SND.UNA is retransmitted regardless of the window when
+    // known to be lost, the following ones are not
+    BOOST_REQUIRE(next_segs(sb, segs, 0, true) == std::vector<uint32_t>({0}));
+    BOOST_REQUIRE(segs[0].lost_retransmitted);
+}
+
+BOOST_AUTO_TEST_CASE(test_rto_clears_scoreboard) {
+    auto segs = make_segments(5);
+    tcp_sack_scoreboard sb;
+    sb.lost_boundary = make_seq(una);
+    tcp_option::sack_block blocks[] = {block(2, 5)};
+    sb.update(segs, make_seq(una), mss, blocks, 1);
+    BOOST_REQUIRE_EQUAL(next_segs(sb, segs, 10 * mss, false).size(), 2);
+
+    // After a retransmission timeout, the receiver may have reneged on
+    // what it sacked: everything is back in flight
+    sb.clear(segs, make_seq(una));
+    BOOST_REQUIRE_EQUAL(sb.sacked_bytes, 0);
+    BOOST_REQUIRE_EQUAL(sb.recovery_retransmits, 0);
+    for (auto& seg : segs) {
+        BOOST_REQUIRE(!seg.sacked);
+        BOOST_REQUIRE(!seg.lost_retransmitted);
+    }
+    BOOST_REQUIRE(!sb.is_lost(make_seq(una + mss)));
+    BOOST_REQUIRE_EQUAL(sb.pipe(segs, make_seq(una)), 5 * mss);
+}
+
+BOOST_AUTO_TEST_CASE(test_sack_blocks) {
+    std::map<net::tcp_seq, packet> out_of_order;
+    auto add = [&] (uint32_t beg, uint32_t len) {
+        out_of_order.emplace(make_seq(una + beg), packet(std::vector<char>(len).data(), len));
+    };
+    tcp_option::sack_block blocks[tcp_option::max_sack_blocks];
+    BOOST_REQUIRE_EQUAL(make_sack_blocks(out_of_order, make_seq(una), make_seq(una), blocks), 0);
+
+    // Adjacent and overlapping segments merge, the block of the most recent
+    // segment comes first, the others in sequence order
+    add(1000, 1000);
+    add(2000, 500);
+    add(2200, 800);
+    add(4000, 1000);
+    add(6000, 1000);
+    BOOST_REQUIRE_EQUAL(make_sack_blocks(out_of_order, make_seq(una), make_seq(una + 6000), blocks), 3);
+    BOOST_REQUIRE_EQUAL(blocks[0].start, una + 6000);
+    BOOST_REQUIRE_EQUAL(blocks[0].end, una + 7000);
+    BOOST_REQUIRE_EQUAL(blocks[1].start, una + 1000);
+    BOOST_REQUIRE_EQUAL(blocks[1].end, una + 3000);
+    BOOST_REQUIRE_EQUAL(blocks[2].start, una + 4000);
+    BOOST_REQUIRE_EQUAL(blocks[2].end, una + 5000);
+
+    // Data at or below RCV.NXT is not reported
+    BOOST_REQUIRE_EQUAL(make_sack_blocks(out_of_order, make_seq(una + 2500), make_seq(una + 4500), blocks), 3);
+    BOOST_REQUIRE_EQUAL(blocks[0].start, una + 4000);
+    BOOST_REQUIRE_EQUAL(blocks[1].start, una + 2500);
+    BOOST_REQUIRE_EQUAL(blocks[1].end, una + 3000);
+    BOOST_REQUIRE_EQUAL(blocks[2].start, una + 6000);
+
+    // At most max_sack_blocks are reported, the most recent one included
+    add(8000, 1000);
+    add(10000, 1000);
+    BOOST_REQUIRE_EQUAL(make_sack_blocks(out_of_order, make_seq(una), make_seq(una + 10000), blocks), tcp_option::max_sack_blocks);
+    BOOST_REQUIRE_EQUAL(blocks[0].start, una + 10000);
+    BOOST_REQUIRE_EQUAL(blocks[3].start, una + 6000);
+}
+
+BOOST_AUTO_TEST_CASE(test_fit_sack_blocks) {
+    BOOST_REQUIRE_EQUAL(tcp_option::sack_blocks_size(0), 0);
+    BOOST_REQUIRE_EQUAL(tcp_option::sack_blocks_size(1), 12);
+    BOOST_REQUIRE_EQUAL(tcp_option::sack_blocks_size(4), 36);
+
+    // A full sized segment leaves no room for blocks
+    BOOST_REQUIRE_EQUAL(fit_sack_blocks(mss, mss, 4), 0);
+    // Blocks are dropped until the segment and the option fit
+    BOOST_REQUIRE_EQUAL(fit_sack_blocks(mss - 12, mss, 4), 1);
+    BOOST_REQUIRE_EQUAL(fit_sack_blocks(mss - 20, mss, 4), 2);
+    BOOST_REQUIRE_EQUAL(fit_sack_blocks(mss - 28, mss, 4), 3);
+    BOOST_REQUIRE_EQUAL(fit_sack_blocks(mss - 36, mss, 4), 4);
+    BOOST_REQUIRE_EQUAL(fit_sack_blocks(100, mss, 3), 3);
+    // A segment larger than the MSS, sent before it was lowered, keeps them
+    BOOST_REQUIRE_EQUAL(fit_sack_blocks(mss + 1, mss, 2), 2);
+}
@@ -29,10 +29,15 @@
 #include <seastar/core/do_with.hh>
 #include <seastar/core/loop.hh>
 #include <seastar/core/sleep.hh>
+#include <seastar/core/when_all.hh>
 #include <sys/mman.h>
 #include <sys/signal.h>
 
 #include <valgrind/valgrind.h>
+#include <cfenv>
+#ifdef __x86_64__
+#include <xmmintrin.h>
+#endif
 
 using namespace seastar;
 using namespace std::chrono_literals;
@@ -166,6 +171,150 @@ SEASTAR_TEST_CASE(test_thread_custom_stack_size) {
     });
 }
 
+#ifndef SEASTAR_ASAN_ENABLED
+SEASTAR_THREAD_TEST_CASE(test_thread_stack_reuse) {
+    thread_attributes attr;
+    attr.stack_size = 64 * 1024;
+    auto stack_address = [] {
+        char c;
+        return reinterpret_cast<uintptr_t>(&c);
+    };
+    auto first = async(attr, stack_address).get0();
+    auto second = async(attr, stack_address).get0();
+    BOOST_REQUIRE_EQUAL(first, second);
+}
+#endif
+
+static size_t use_stack_deeply(size_t depth) {
+    volatile char buf[1024];
+    buf[0] = 1;
+    if (depth == 0) {
+        return buf[0];
+    }
+    return use_stack_deeply(depth - 1) + buf[0];
+}
+
+SEASTAR_THREAD_TEST_CASE(test_thread_lazy_stack) {
+    thread_attributes attr;
+    attr.stack_size = 8 << 20;
+    attr.lazy_stack = true;
+    for (int i = 0; i < 2; i++) {
+        auto sum = async(attr, [] {
+            return use_stack_deeply(2048);
+        }).get0();
+        BOOST_REQUIRE_EQUAL(sum, size_t(2049));
+    }
+}
+
+#ifdef __x86_64__
+
+// Loads a known value in each callee-saved register, calls fn() and
+// returns zero if all of them came back unchanged
+extern "C" uint64_t call_with_callee_saved_registers(void (*fn)());
+
+asm(R"(
+    .text
+    .type call_with_callee_saved_registers, @function
+call_with_callee_saved_registers:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    movabsq $0x1111111111111111, %rbx
+    movabsq $0x2222222222222222, %rbp
+    movabsq $0x3333333333333333, %r12
+    movabsq $0x4444444444444444, %r13
+    movabsq $0x5555555555555555, %r14
+    movabsq $0x6666666666666666, %r15
+    callq *%rdi
+    xorl %eax, %eax
+    movabsq $0x1111111111111111, %rcx
+    xorq %rcx, %rbx
+    orq %rbx, %rax
+    movabsq $0x2222222222222222, %rcx
+    xorq %rcx, %rbp
+    orq %rbp, %rax
+    movabsq $0x3333333333333333, %rcx
+    xorq %rcx, %r12
+    orq %r12, %rax
+    movabsq $0x4444444444444444, %rcx
+    xorq %rcx, %r13
+    orq %r13, %rax
+    movabsq $0x5555555555555555, %rcx
+    xorq %rcx, %r14
+    orq %r14, %rax
+    movabsq $0x6666666666666666, %rcx
+    xorq %rcx, %r15
+    orq %r15, %rax
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size call_with_callee_saved_registers, .-call_with_callee_saved_registers
+)");
+
+#endif
+
+static void yield_a_few_times() {
+    for (int i = 0; i < 10; i++) {
+        thread::yield();
+    }
+}
+
+// Several threads take turns, each checking that what it keeps in
+// registers across the switches is still there when it runs again
+SEASTAR_THREAD_TEST_CASE(test_thread_switch_preserves_registers) {
+    auto run = [] (int rounding) {
+        return async([rounding] {
+            volatile double one = 1.0;
+            double sum = 0;
+            for (int i = 0; i < 1000; i++) {
+                sum += one / (i + 3);
+                yield_a_few_times();
+            }
+            double expected = 0;
+            for (int i = 0; i < 1000; i++) {
+                expected += one / (i + 3);
+            }
+            BOOST_REQUIRE_EQUAL(sum, expected);
+#ifdef __x86_64__
+            for (int i = 0; i < 1000; i++) {
+                BOOST_REQUIRE_EQUAL(call_with_callee_saved_registers(yield_a_few_times), 0);
+            }
+#endif
+#ifdef SEASTAR_THREAD_FAST_SWITCH
+            // The floating point control registers go with the thread too
+            // (unlike with longjmp()), so each thread keeps its rounding mode
+            std::fesetround(rounding);
+            sum = 0;
+            for (int i = 0; i < 1000; i++) {
+                sum += one / (i + 3);
+                yield_a_few_times();
+                BOOST_REQUIRE_EQUAL(std::fegetround(), rounding);
+                // MXCSR keeps the rounding mode two bits higher than the
+                // x87 control word fegetround() reads
+                BOOST_REQUIRE_EQUAL(int(_mm_getcsr() >> 3 & 0xc00), rounding);
+            }
+            expected = 0;
+            for (int i = 0; i < 1000; i++) {
+                expected += one / (i + 3);
+            }
+            std::fesetround(FE_TONEAREST);
+            BOOST_REQUIRE_EQUAL(sum, expected);
+#endif
+        });
+    };
+    when_all_succeed(run(FE_TONEAREST), run(FE_UPWARD), run(FE_DOWNWARD), run(FE_TOWARDZERO)).get();
+    BOOST_REQUIRE_EQUAL(std::fegetround(), FE_TONEAREST);
+}
+
 // The test case uses x86_64 specific signal handler info. The test
 // fails with detect_stack_use_after_return=1. We could put it behind
 // a command line option and fork/exec to run it after removing
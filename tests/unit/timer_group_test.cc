@@ -0,0 +1,176 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/core/thread.hh>
+#include <seastar/core/manual_clock.hh>
+#include <seastar/core/timer_group.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/util/later.hh>
+#include <algorithm>
+#include <vector>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct item : public timer_group<manual_clock>::entry {
+    int id;
+    item(timer_group<manual_clock>& g, int id) : entry(g), id(id) {}
+};
+
+struct batches {
+    std::vector<std::vector<int>> fired;
+
+    timer_group<manual_clock>::callback_t callback() {
+        return [this] (timer_group<manual_clock>::expired_list& expired) {
+            std::vector<int> ids;
+            for (auto& e : expired) {
+                ids.push_back(static_cast<item&>(e).id);
+            }
+            std::sort(ids.begin(), ids.end());
+            fired.push_back(std::move(ids));
+        };
+    }
+};
+
+}
+
+SEASTAR_THREAD_TEST_CASE(test_timer_group_expires_in_batches) {
+    batches b;
+    timer_group<manual_clock> group(b.callback(), 10ms);
+
+    // Expiry times are rounded to multiples of the slack since the epoch
+    auto start = manual_clock::time_point((manual_clock::now().time_since_epoch() / 10ms + 1) * 10ms);
+    manual_clock::advance(start - manual_clock::now());
+    yield().get();
+    item i1(group, 1), i2(group, 2), i3(group, 3), i4(group, 4);
+    i1.arm(start + 1ms);
+    i2.arm(start + 5ms);
+    i3.arm(start + 9ms);
+    i4.arm(start + 25ms);
+    BOOST_REQUIRE_EQUAL(group.size(), 4u);
+
+    manual_clock::advance(5ms);
+    yield().get();
+    BOOST_REQUIRE(b.fired.empty());
+
+    manual_clock::advance(5ms);
+    yield().get();
+    BOOST_REQUIRE_EQUAL(b.fired.size(), 1u);
+    BOOST_REQUIRE(b.fired[0] == std::vector<int>({1, 2, 3}));
+    BOOST_REQUIRE(!i1.armed());
+    BOOST_REQUIRE(i4.armed());
+
+    manual_clock::advance(20ms);
+    yield().get();
+    BOOST_REQUIRE_EQUAL(b.fired.size(), 2u);
+    BOOST_REQUIRE(b.fired[1] == std::vector<int>({4}));
+    BOOST_REQUIRE_EQUAL(group.size(), 0u);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_timer_group_cancel) {
+    batches b;
+    timer_group<manual_clock> group(b.callback());
+
+    auto start = manual_clock::now();
+    item i1(group, 1), i2(group, 2);
+    i1.arm(start + 1s);
+    i2.arm(start + 1s);
+    BOOST_REQUIRE(i1.cancel());
+    BOOST_REQUIRE(!i1.cancel());
+    {
+        item i3(group, 3);
+        i3.arm(start + 1s);
+    }
+
+    manual_clock::advance(1s);
+    yield().get();
+    BOOST_REQUIRE_EQUAL(b.fired.size(), 1u);
+    BOOST_REQUIRE(b.fired[0] == std::vector<int>({2}));
+}
+
+SEASTAR_THREAD_TEST_CASE(test_timer_group_rearm_from_callback) {
+    std::vector<int> fired;
+    std::unique_ptr<item> i1, i2;
+    timer_group<manual_clock> group([&] (timer_group<manual_clock>::expired_list& expired) {
+        // Cancelling an entry which is still in the batch removes it from it
+        i2->cancel();
+        for (auto& e : expired) {
+            fired.push_back(static_cast<item&>(e).id);
+        }
+        i1->rearm(1s);
+    });
+    i1 = std::make_unique<item>(group, 1);
+    i2 = std::make_unique<item>(group, 2);
+
+    i1->arm(1s);
+    i2->arm(1s);
+    manual_clock::advance(1s);
+    yield().get();
+    BOOST_REQUIRE(fired == std::vector<int>({1}));
+    BOOST_REQUIRE(i1->armed());
+
+    manual_clock::advance(1s);
+    yield().get();
+    BOOST_REQUIRE(fired == std::vector<int>({1, 1}));
+
+    i1.reset();
+    i2.reset();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_timer_group_arm_from_callback) {
+    std::vector<int> fired;
+    timer_group<manual_clock> group([&] (timer_group<manual_clock>::expired_list& expired) {
+        for (auto it = expired.begin(); it != expired.end();) {
+            auto& e = static_cast<item&>(*it++);
+            fired.push_back(e.id);
+            // An expired entry is no longer armed, so arm() can be used
+            BOOST_REQUIRE(!e.armed());
+            if (e.id != 3) {
+                e.arm(1s);
+            }
+        }
+    });
+    item i1(group, 1), i2(group, 2), i3(group, 3);
+
+    i1.arm(1s);
+    i2.arm(1s);
+    i3.arm(1s);
+    manual_clock::advance(1s);
+    yield().get();
+    std::sort(fired.begin(), fired.end());
+    BOOST_REQUIRE(fired == std::vector<int>({1, 2, 3}));
+    BOOST_REQUIRE(i1.armed());
+    BOOST_REQUIRE(i2.armed());
+    BOOST_REQUIRE(!i3.armed());
+    BOOST_REQUIRE_EQUAL(group.size(), 2u);
+
+    fired.clear();
+    manual_clock::advance(1s);
+    yield().get();
+    std::sort(fired.begin(), fired.end());
+    BOOST_REQUIRE(fired == std::vector<int>({1, 2}));
+    BOOST_REQUIRE_EQUAL(group.size(), 2u);
+
+    BOOST_REQUIRE(i1.cancel());
+    BOOST_REQUIRE(i2.cancel());
+}
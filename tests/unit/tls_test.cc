@@ -33,7 +33,10 @@
 #include <seastar/core/temporary_buffer.hh>
 #include <seastar/core/iostream.hh>
 #include <seastar/core/with_timeout.hh>
+#include <seastar/util/later.hh>
+#include <seastar/core/scheduling.hh>
 #include <seastar/util/std-compat.hh>
+#include <seastar/util/defer.hh>
 #include <seastar/net/tls.hh>
 #include <seastar/net/dns.hh>
 #include <seastar/net/inet_address.hh>
@@ -1102,4 +1105,213 @@ SEASTAR_THREAD_TEST_CASE(test_closed_write) {
         check_same_message_two_writes(out);
     }
 
-}
\ No newline at end of file
+}
+
+SEASTAR_THREAD_TEST_CASE(test_kernel_tls) {
+    tls::credentials_builder b;
+
+    b.set_x509_key_file(certfile("test.crt"), certfile("test.key"), tls::x509_crt_format::PEM).get();
+    b.set_x509_trust_file(certfile("catest.pem"), tls::x509_crt_format::PEM).get();
+    b.set_dh_level();
+    // Whether or not the kernel can take over, the peers must see the same stream
+    b.enable_kernel_tls(true);
+
+    auto creds = b.build_certificate_credentials();
+    auto serv = b.build_server_credentials();
+
+    ::listen_options opts;
+    opts.reuse_address = true;
+    opts.set_fixed_cpu(this_shard_id());
+
+    auto addr = ::make_ipv4_address( {0x7f000001, 4713});
+    auto server = tls::listen(serv, addr, opts);
+
+    auto sa = server.accept();
+    auto c = tls::connect(creds, addr, "test.scylladb.org").get0();
+    auto s = sa.get0().connection;
+
+    auto cin = c.input();
+    auto cout = c.output();
+    auto sin = s.input();
+    auto sout = s.output();
+
+    const auto big = sstring(128 * 1024, 'x');
+    for (int i = 0; i < 5; ++i) {
+        cout.write(message).get();
+        cout.write(big).get();
+        cout.flush().get();
+        auto buf = sin.read_exactly(message.size() + big.size()).get0();
+        BOOST_REQUIRE(sstring(buf.get(), buf.size()) == message + big);
+
+        sout.write(message).get();
+        sout.flush().get();
+        buf = cin.read_exactly(message.size()).get0();
+        BOOST_REQUIRE(sstring(buf.get(), buf.size()) == message);
+    }
+
+    // the close_notify sent on shutdown shows up as a clean end of stream
+    cout.close().get();
+    BOOST_REQUIRE(sin.read().get0().empty());
+    sout.close().get();
+    BOOST_REQUIRE(cin.read().get0().empty());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_session_resumption) {
+    auto addr = ::make_ipv4_address( {0x7f000001, 4714});
+
+    auto make_builder = [] {
+        tls::credentials_builder b;
+        b.set_x509_key_file(certfile("test.crt"), certfile("test.key"), tls::x509_crt_format::PEM).get();
+        b.set_x509_trust_file(certfile("catest.pem"), tls::x509_crt_format::PEM).get();
+        b.set_dh_level();
+        b.enable_session_resumption(16);
+        return b;
+    };
+
+    // Connects, exchanges a message each way (which also delivers TLS 1.3
+    // tickets to the client) and reports whether the session was resumed
+    auto connect_once = [&] (shared_ptr<tls::server_credentials> serv, shared_ptr<tls::certificate_credentials> creds) {
+        ::listen_options opts;
+        opts.reuse_address = true;
+        opts.set_fixed_cpu(this_shard_id());
+        auto server = tls::listen(serv, addr, opts);
+        auto sa = server.accept();
+        auto c = tls::connect(creds, addr, "test.scylladb.org").get0();
+        auto s = sa.get0().connection;
+
+        auto cout = c.output();
+        auto sin = s.input();
+        cout.write(message).get();
+        cout.flush().get();
+        BOOST_REQUIRE_EQUAL(sin.read_exactly(message.size()).get0().size(), message.size());
+        auto sout = s.output();
+        auto cin = c.input();
+        sout.write(message).get();
+        sout.flush().get();
+        BOOST_REQUIRE_EQUAL(cin.read_exactly(message.size()).get0().size(), message.size());
+
+        auto resumed = tls::check_session_is_resumed(c).get0();
+        BOOST_REQUIRE_EQUAL(tls::check_session_is_resumed(s).get0(), resumed);
+        cout.close().get();
+        sout.close().get();
+        return resumed;
+    };
+
+    {
+        // Tickets are accepted by other credentials (shards) with the same key
+        auto b = make_builder();
+        b.enable_session_tickets();
+        auto creds = b.build_certificate_credentials();
+        BOOST_REQUIRE(!connect_once(b.build_server_credentials(), creds));
+        BOOST_REQUIRE(connect_once(b.build_server_credentials(), creds));
+
+        // but not by ones with another key
+        auto other = make_builder();
+        other.enable_session_tickets();
+        BOOST_REQUIRE(!connect_once(other.build_server_credentials(), creds));
+    }
+
+    {
+        // TLS 1.2 clients resume from the session cache without tickets
+        auto b = make_builder();
+        b.enable_session_cache(16);
+        b.set_priority_string("NORMAL:-VERS-ALL:+VERS-TLS1.2:%NO_TICKETS");
+        auto creds = b.build_certificate_credentials();
+        auto serv = b.build_server_credentials();
+        BOOST_REQUIRE(!connect_once(serv, creds));
+        BOOST_REQUIRE(connect_once(serv, creds));
+        BOOST_REQUIRE(!connect_once(make_builder().build_server_credentials(), creds));
+    }
+}
+
+SEASTAR_THREAD_TEST_CASE(test_private_key_executor) {
+    auto sg = create_scheduling_group("tls handshake", 100).get0();
+    auto destroy_sg = defer([sg] () noexcept { destroy_scheduling_group(sg).get(); });
+
+    unsigned operations = 0;
+    bool in_handshake_group = true;
+
+    tls::credentials_builder b;
+    b.set_handshake_scheduling_group(sg);
+    b.set_private_key_executor([&] (noncopyable_function<void()> op) {
+        ++operations;
+        in_handshake_group &= current_scheduling_group() == sg;
+        // stands in for a thread pool
+        return yield().then([op = std::move(op)] () mutable {
+            op();
+        });
+    });
+    b.set_x509_key_file(certfile("test.crt"), certfile("test.key"), tls::x509_crt_format::PEM).get();
+    b.set_x509_trust_file(certfile("catest.pem"), tls::x509_crt_format::PEM).get();
+    b.set_dh_level();
+
+    auto creds = b.build_certificate_credentials();
+    auto serv = b.build_server_credentials();
+
+    ::listen_options opts;
+    opts.reuse_address = true;
+    opts.set_fixed_cpu(this_shard_id());
+
+    auto addr = ::make_ipv4_address( {0x7f000001, 4715});
+    auto server = tls::listen(serv, addr, opts);
+
+    for (auto prio : { "NORMAL", "NORMAL:-VERS-ALL:+VERS-TLS1.2", "NORMAL:-VERS-ALL:+VERS-TLS1.2:-KX-ALL:+RSA" }) {
+        auto client_creds = ::make_shared<tls::certificate_credentials>();
+        client_creds->set_x509_trust_file(certfile("catest.pem"), tls::x509_crt_format::PEM).get();
+        client_creds->set_priority_string(prio);
+
+        auto before = operations;
+        auto sa = server.accept();
+        auto c = tls::connect(client_creds, addr, "test.scylladb.org").get0();
+        auto s = sa.get0().connection;
+
+        auto cout = c.output();
+        auto sin = s.input();
+        cout.write(message).get();
+        cout.flush().get();
+        auto buf = sin.read_exactly(message.size()).get0();
+        BOOST_REQUIRE(sstring(buf.get(), buf.size()) == message);
+        BOOST_REQUIRE_GT(operations, before);
+
+        cout.close().get();
+        s.shutdown_output();
+    }
+    BOOST_REQUIRE(in_handshake_group);
+}
+
+SEASTAR_THREAD_TEST_CASE(test_alpn) {
+    auto addr = ::make_ipv4_address( {0x7f000001, 4716});
+
+    // Returns the protocol selected on either side
+    auto negotiate = [&] (std::vector<sstring> server_protocols, std::vector<sstring> client_protocols) {
+        tls::credentials_builder b;
+        b.set_x509_key_file(certfile("test.crt"), certfile("test.key"), tls::x509_crt_format::PEM).get();
+        b.set_x509_trust_file(certfile("catest.pem"), tls::x509_crt_format::PEM).get();
+        b.set_dh_level();
+        b.set_alpn_protocols(server_protocols);
+        auto serv = b.build_server_credentials();
+        b.set_alpn_protocols(client_protocols);
+        auto creds = b.build_certificate_credentials();
+
+        ::listen_options opts;
+        opts.reuse_address = true;
+        opts.set_fixed_cpu(this_shard_id());
+        auto server = tls::listen(serv, addr, opts);
+        auto sa = server.accept();
+        auto c = tls::connect(creds, addr, "test.scylladb.org").get0();
+        auto s = sa.get0().connection;
+
+        auto client_protocol = tls::get_alpn_protocol(c);
+        auto protocol = tls::get_alpn_protocol(s).get0();
+        BOOST_REQUIRE(client_protocol.get0() == protocol);
+        c.shutdown_output();
+        s.shutdown_output();
+        return protocol;
+    };
+
+    // The server's preference wins
+    BOOST_REQUIRE(negotiate({"h2", "http/1.1"}, {"http/1.1", "h2"}) == sstring("h2"));
+    BOOST_REQUIRE(negotiate({"h2", "http/1.1"}, {"http/1.1"}) == sstring("http/1.1"));
+    BOOST_REQUIRE(!negotiate({"h2"}, {}));
+    BOOST_REQUIRE(!negotiate({}, {"h2"}));
+}
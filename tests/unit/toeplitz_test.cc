@@ -0,0 +1,63 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2024 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <seastar/net/toeplitz.hh>
+#include <random>
+
+using namespace seastar;
+
+// The key and test vectors of Microsoft's "Verifying the RSS Hash
+// Calculation"
+static constexpr uint8_t ms_key_v[] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+static constexpr rss_key_type ms_key{ms_key_v, sizeof(ms_key_v)};
+
+BOOST_AUTO_TEST_CASE(test_known_hashes) {
+    // 66.9.149.187:2794 to 161.142.100.80:1766
+    std::vector<uint8_t> tuple = {66, 9, 149, 187, 161, 142, 100, 80, 0x0a, 0xea, 0x06, 0xe6};
+    BOOST_REQUIRE_EQUAL(toeplitz_hash(ms_key, tuple), 0x51ccc178u);
+    BOOST_REQUIRE_EQUAL(toeplitz_hash_bitwise(ms_key, tuple), 0x51ccc178u);
+    tuple.resize(8);
+    BOOST_REQUIRE_EQUAL(toeplitz_hash(ms_key, tuple), 0x323e8fc2u);
+}
+
+BOOST_AUTO_TEST_CASE(test_table_matches_bitwise) {
+    std::mt19937 rnd(0);
+    for (auto key : {default_rsskey_40bytes, default_rsskey_52bytes, ms_key}) {
+        // Including data longer than the key, which falls back to bits
+        for (size_t len = 0; len <= 64; len++) {
+            std::vector<uint8_t> data(len);
+            for (auto& b : data) {
+                b = rnd();
+            }
+            BOOST_REQUIRE_EQUAL(toeplitz_hash(key, data), toeplitz_hash_bitwise(key, data));
+        }
+    }
+}
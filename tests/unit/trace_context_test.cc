@@ -0,0 +1,112 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2022 ScyllaDB
+ */
+
+#include <seastar/testing/test_case.hh>
+#include <seastar/testing/thread_test_case.hh>
+#include <seastar/core/with_trace_context.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/thread.hh>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+SEASTAR_TEST_CASE(test_traceparent) {
+    auto ctx = tracing::trace_context::from_traceparent("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01");
+    BOOST_REQUIRE(ctx);
+    BOOST_REQUIRE_EQUAL(ctx->trace_id[0], 0x4b);
+    BOOST_REQUIRE_EQUAL(ctx->trace_id[15], 0x36);
+    BOOST_REQUIRE_EQUAL(ctx->span_id, 0x00f067aa0ba902b7);
+    BOOST_REQUIRE(ctx->sampled());
+    BOOST_REQUIRE_EQUAL(ctx->to_traceparent(), "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01");
+
+    // Future versions may have more fields
+    BOOST_REQUIRE(tracing::trace_context::from_traceparent("01-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-00-more"));
+
+    BOOST_REQUIRE(!tracing::trace_context::from_traceparent(""));
+    BOOST_REQUIRE(!tracing::trace_context::from_traceparent("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-more"));
+    BOOST_REQUIRE(!tracing::trace_context::from_traceparent("ff-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01"));
+    BOOST_REQUIRE(!tracing::trace_context::from_traceparent("00-00000000000000000000000000000000-00f067aa0ba902b7-01"));
+    BOOST_REQUIRE(!tracing::trace_context::from_traceparent("00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01"));
+    BOOST_REQUIRE(!tracing::trace_context::from_traceparent("00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01"));
+
+    auto child = ctx->make_child();
+    BOOST_REQUIRE(child.trace_id == ctx->trace_id);
+    BOOST_REQUIRE_NE(child.span_id, ctx->span_id);
+    BOOST_REQUIRE_EQUAL(child.flags, ctx->flags);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_sampler) {
+    BOOST_REQUIRE(!tracing::has_sampler());
+    BOOST_REQUIRE(!tracing::trace_context::make_root().sampled());
+    tracing::set_sampler(tracing::make_ratio_sampler(1));
+    BOOST_REQUIRE(tracing::has_sampler());
+    BOOST_REQUIRE(tracing::trace_context::make_root().sampled());
+    tracing::set_sampler(tracing::make_ratio_sampler(0));
+    BOOST_REQUIRE(!tracing::trace_context::make_root().sampled());
+    tracing::set_sampler({});
+    return make_ready_future<>();
+}
+
+SEASTAR_THREAD_TEST_CASE(test_context_flows_through_continuations) {
+    auto ctx = tracing::trace_context::make_root();
+    BOOST_REQUIRE(!tracing::current_trace_context());
+    auto f = with_trace_context(ctx, [ctx] {
+        return sleep(1ms).then([ctx] {
+            BOOST_REQUIRE(tracing::current_trace_context());
+            BOOST_REQUIRE(*tracing::current_trace_context() == ctx);
+            return yield();
+        }).then([ctx] {
+            BOOST_REQUIRE(*tracing::current_trace_context() == ctx);
+            // Other shards get the context too
+            return smp::submit_to((this_shard_id() + 1) % smp::count, [ctx] {
+                BOOST_REQUIRE(tracing::current_trace_context());
+                BOOST_REQUIRE(*tracing::current_trace_context() == ctx);
+            });
+        }).then([ctx] {
+            BOOST_REQUIRE(*tracing::current_trace_context() == ctx);
+        });
+    });
+    // The caller keeps its own context
+    BOOST_REQUIRE(!tracing::current_trace_context());
+    f.get();
+    BOOST_REQUIRE(!tracing::current_trace_context());
+}
+
+SEASTAR_THREAD_TEST_CASE(test_released_context) {
+    promise<> p;
+    future<> f = make_ready_future<>();
+    {
+        tracing::active_context active(tracing::trace_context::make_root());
+        BOOST_REQUIRE(active.get());
+        BOOST_REQUIRE(tracing::current_trace_context() == active.get());
+        f = p.get_future().then([] {
+            // The context is gone, and its slot may be reused
+            BOOST_REQUIRE(!tracing::current_trace_context());
+        });
+    }
+    BOOST_REQUIRE(!tracing::current_trace_context());
+    tracing::active_context other(tracing::trace_context::make_root());
+    other.deactivate();
+    p.set_value();
+    f.get();
+}
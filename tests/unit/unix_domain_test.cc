@@ -24,6 +24,7 @@
 #include <seastar/net/api.hh>
 #include <seastar/net/inet_address.hh>
 #include <seastar/core/print.hh>
+#include <seastar/core/posix.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/thread.hh>
 #include <seastar/util/log.hh>
@@ -232,3 +233,40 @@ SEASTAR_TEST_CASE(unixdomain_abort) {
     });
 }
 
+
+// Hands a connection over through another one, as a front-end would hand
+// an accepted connection to a back-end process
+SEASTAR_TEST_CASE(unixdomain_fd_passing) {
+    return seastar::async([] {
+        socket_address addr{unix_domain_addr{"\0fd_passing"s}};
+        auto ss = seastar::listen(addr);
+        auto accepted = ss.accept();
+        auto sender = seastar::connect(addr).get0();
+        auto receiver = accepted.get0().connection;
+
+        socket_address client_addr{unix_domain_addr{"\0fd_passing_client"s}};
+        auto client_ss = seastar::listen(client_addr);
+        auto client_accepted = client_ss.accept();
+        auto client = seastar::connect(client_addr).get0();
+        auto handed = client_accepted.get0().connection;
+
+        std::vector<file_desc> fds;
+        fds.push_back(handed.dup_fd());
+        sender.send_fds(temporary_buffer<char>("conn", 4), std::move(fds)).get();
+        // The connection outlives the sender's socket
+        handed = connected_socket();
+
+        auto msg = receiver.receive_fds().get0();
+        BOOST_REQUIRE_EQUAL(sstring(msg.data.get(), msg.data.size()), "conn");
+        BOOST_REQUIRE_EQUAL(msg.fds.size(), 1);
+        auto adopted = adopt_connected_socket(std::move(msg.fds[0]));
+
+        auto out = client.output();
+        out.write("hello").get();
+        out.flush().get();
+        auto in = adopted.input();
+        BOOST_REQUIRE_EQUAL(sstring(in.read_exactly(5).get0().get(), 5), "hello");
+        out.close().get();
+        BOOST_REQUIRE(in.read().get0().empty());
+    });
+}
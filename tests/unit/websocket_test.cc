@@ -7,7 +7,9 @@
 #include <seastar/testing/thread_test_case.hh>
 #include <seastar/http/response_parser.hh>
 #include <seastar/util/defer.hh>
+#include <seastar/util/short_streams.hh>
 #include "loopback_socket.hh"
+#include <zlib.h>
 
 using namespace seastar;
 using namespace seastar::experimental;
@@ -64,3 +66,205 @@ SEASTAR_TEST_CASE(test_websocket_handshake) {
         }
     });
 }
+
+// Connects to a connection of the server, and does the handshake
+static void with_websocket(websocket::server& server, sstring extensions,
+        noncopyable_function<void(input_stream<char>&, output_stream<char>&, http_response&)> test) {
+    sstring request =
+            "GET / HTTP/1.1\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n";
+    if (!extensions.empty()) {
+        request += "Sec-WebSocket-Extensions: " + extensions + "\r\n";
+    }
+    request += "\r\n";
+    loopback_connection_factory factory;
+    loopback_socket_impl lsi(factory);
+
+    auto acceptor = factory.get_server_socket().accept();
+    auto connector = lsi.connect(socket_address(), socket_address());
+    connected_socket sock = connector.get0();
+    auto input = sock.input();
+    auto output = sock.output();
+
+    websocket::connection conn(server, acceptor.get0().connection);
+    future<> serve = conn.process();
+    auto close = defer([&conn, &input, &output, &serve] () noexcept {
+        conn.shutdown();
+        input.close().get();
+        output.close().get();
+        serve.get();
+    });
+
+    output.write(request).get();
+    output.flush().get();
+    http_response_parser parser;
+    parser.init();
+    input.consume(parser).get();
+    std::unique_ptr<http_response> resp = parser.get_parsed_response();
+    BOOST_REQUIRE(resp);
+    test(input, output, *resp);
+}
+
+// A frame as clients send it, masked
+static sstring client_frame(uint8_t first_byte, std::string_view payload) {
+    static const char mask[4] = { 0x11, 0x22, 0x33, 0x44 };
+    std::string frame;
+    frame += char(first_byte);
+    if (payload.size() < 126) {
+        frame += char(0x80 | payload.size());
+    } else if (payload.size() <= 0xffff) {
+        frame += char(0x80 | 126);
+        frame += char(payload.size() >> 8);
+        frame += char(payload.size());
+    } else {
+        frame += char(0x80 | 127);
+        for (int i = 7; i >= 0; i--) {
+            frame += char(payload.size() >> (i * 8));
+        }
+    }
+    frame.append(mask, 4);
+    for (size_t i = 0; i < payload.size(); i++) {
+        frame += char(payload[i] ^ mask[i % 4]);
+    }
+    return sstring(frame.data(), frame.size());
+}
+
+struct server_frame {
+    uint8_t first_byte;
+    sstring payload;
+};
+
+static server_frame read_frame(input_stream<char>& in) {
+    auto header = in.read_exactly(2).get0();
+    BOOST_REQUIRE_EQUAL(header.size(), 2);
+    // Servers don't mask
+    BOOST_REQUIRE_EQUAL(header[1] & 0x80, 0);
+    uint64_t length = header[1] & 0x7f;
+    if (length >= 126) {
+        auto extended = in.read_exactly(length == 126 ? 2 : 8).get0();
+        length = 0;
+        for (auto c : extended) {
+            length = (length << 8) | uint8_t(c);
+        }
+    }
+    auto payload = in.read_exactly(length).get0();
+    BOOST_REQUIRE_EQUAL(payload.size(), length);
+    return server_frame{uint8_t(header[0]), sstring(payload.get(), payload.size())};
+}
+
+static void send(output_stream<char>& out, sstring data) {
+    out.write(data).get();
+    out.flush().get();
+}
+
+static websocket::handler_t echo_handler() {
+    return [] (websocket::connection& conn, websocket::message_type type, input_stream<char>& message) {
+        return util::read_entire_stream_contiguous(message).then([&conn, type] (sstring msg) {
+            return conn.send_message(type, temporary_buffer<char>(msg.data(), msg.size()));
+        });
+    };
+}
+
+SEASTAR_THREAD_TEST_CASE(test_websocket_messages) {
+    websocket::server server;
+    server.set_handler(echo_handler());
+    with_websocket(server, "", [] (input_stream<char>& in, output_stream<char>& out, http_response&) {
+        // A fragmented message, with a ping in the middle
+        send(out, client_frame(0x01, "Hello"));
+        send(out, client_frame(0x00, ", "));
+        send(out, client_frame(0x89, "ping"));
+        auto pong = read_frame(in);
+        BOOST_REQUIRE_EQUAL(pong.first_byte, 0x8a);
+        BOOST_REQUIRE_EQUAL(pong.payload, "ping");
+        send(out, client_frame(0x80, "World"));
+        auto echo = read_frame(in);
+        BOOST_REQUIRE_EQUAL(echo.first_byte, 0x81);
+        BOOST_REQUIRE_EQUAL(echo.payload, "Hello, World");
+
+        // Lengths with 16 and 64 bits
+        for (size_t size : {300, 70000}) {
+            sstring big(size, 'x');
+            send(out, client_frame(0x82, big));
+            echo = read_frame(in);
+            BOOST_REQUIRE_EQUAL(echo.first_byte, 0x82);
+            BOOST_REQUIRE_EQUAL(echo.payload, big);
+        }
+
+        send(out, client_frame(0x88, std::string_view("\x03\xe8", 2)));
+        auto close = read_frame(in);
+        BOOST_REQUIRE_EQUAL(close.first_byte, 0x88);
+        BOOST_REQUIRE_EQUAL(close.payload, sstring("\x03\xe8", 2));
+    });
+}
+
+SEASTAR_THREAD_TEST_CASE(test_websocket_protocol_error) {
+    websocket::server server;
+    with_websocket(server, "", [] (input_stream<char>& in, output_stream<char>& out, http_response&) {
+        // A continuation without a message to continue
+        send(out, client_frame(0x80, "oops"));
+        auto close = read_frame(in);
+        BOOST_REQUIRE_EQUAL(close.first_byte, 0x88);
+        BOOST_REQUIRE_EQUAL(close.payload.substr(0, 2), sstring("\x03\xea", 2));
+    });
+}
+
+static sstring raw_deflate(std::string_view in) {
+    z_stream zs = {};
+    BOOST_REQUIRE_EQUAL(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    sstring out(in.size() + 64, '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = in.size();
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = out.size();
+    BOOST_REQUIRE_EQUAL(deflate(&zs, Z_SYNC_FLUSH), Z_OK);
+    out.resize(out.size() - zs.avail_out);
+    deflateEnd(&zs);
+    // Without the 00 00 ff ff the flush ends with
+    return out.substr(0, out.size() - 4);
+}
+
+static sstring raw_inflate(std::string_view in) {
+    z_stream zs = {};
+    BOOST_REQUIRE_EQUAL(inflateInit2(&zs, -15), Z_OK);
+    sstring data = sstring(in.data(), in.size()) + sstring("\x00\x00\xff\xff", 4);
+    sstring out(1 << 20, '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(data.data());
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = out.size();
+    BOOST_REQUIRE_EQUAL(inflate(&zs, Z_SYNC_FLUSH), Z_OK);
+    out.resize(out.size() - zs.avail_out);
+    inflateEnd(&zs);
+    return out;
+}
+
+SEASTAR_THREAD_TEST_CASE(test_websocket_permessage_deflate) {
+    websocket::server server;
+    server.set_handler(echo_handler());
+    server.set_permessage_deflate(true);
+    with_websocket(server, "permessage-deflate; server_no_context_takeover; client_max_window_bits",
+            [] (input_stream<char>& in, output_stream<char>& out, http_response& resp) {
+        BOOST_REQUIRE_NE(resp._headers["Sec-WebSocket-Extensions"].find("permessage-deflate; server_no_context_takeover"), sstring::npos);
+        sstring text;
+        for (int i = 0; i < 100; i++) {
+            text += format("message {} ", i % 10);
+        }
+        auto compressed = raw_deflate(text);
+        // Compressed messages have RSV1 set on their first frame
+        auto half = compressed.size() / 2;
+        send(out, client_frame(0x41, std::string_view(compressed).substr(0, half)));
+        send(out, client_frame(0x80, std::string_view(compressed).substr(half)));
+        auto echo = read_frame(in);
+        BOOST_REQUIRE_EQUAL(echo.first_byte, 0xc1);
+        BOOST_REQUIRE_EQUAL(raw_inflate(echo.payload), text);
+
+        // Too small to be worth compressing
+        send(out, client_frame(0x81, "hi"));
+        echo = read_frame(in);
+        BOOST_REQUIRE_EQUAL(echo.first_byte, 0x81);
+        BOOST_REQUIRE_EQUAL(echo.payload, "hi");
+    });
+}